@@ -0,0 +1,1217 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+/*
+ * End to end throughput benchmark
+ *
+ * This runs three nodes in one process connected by an in-memory wire. Node 0
+ * is the planet's only root and the controller for a set of public networks
+ * that differ only in the size of their rule sets. Nodes 1 and 2 join them all,
+ * then node 1 pushes frames to node 2 through processVirtualNetworkFrame() on
+ * one or more threads. Each sending thread has its own lane: packets sent from
+ * it land in a per-lane queue at the receiver that is drained by that lane's
+ * thread, so lanes scale like the service's I/O threads do.
+ *
+ * Results are one line per thread count, rule count and frame size, either as
+ * a table or as CSV (-c) for tracking regressions.
+ *
+ * With -m this instead runs micro-benchmarks of core data structures. Each is
+ * timed over a number of samples of a fixed operation count, and the median,
+ * minimum, mean and standard deviation per operation are reported.
+ *
+ * With -n this instead load tests EmbeddedNetworkController by calling its
+ * request() method directly with synthetic members at a fixed rate, and
+ * reports request latency, the cost of signing configs and time spent
+ * waiting on database locks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+#include "include/ZeroTierOne.h"
+
+#include "node/Constants.hpp"
+#include "node/Identity.hpp"
+#include "node/InetAddress.hpp"
+#include "node/MAC.hpp"
+#include "node/World.hpp"
+#include "node/NetworkConfig.hpp"
+#include "node/NetworkController.hpp"
+#include "node/Utils.hpp"
+#include "node/Hashtable.hpp"
+#include "node/FlatHashtable.hpp"
+#include "node/Buffer.hpp"
+#include "node/Dictionary.hpp"
+#include "node/Path.hpp"
+#include "node/SharedPtr.hpp"
+#include "node/Packet.hpp"
+
+#include "version.h"
+
+#include "osdep/OSUtils.hpp"
+
+#include "controller/EmbeddedNetworkController.hpp"
+
+using namespace ZeroTier;
+
+#define BENCH_NODES 3
+#define BENCH_MAX_LANES 16
+
+// Senders wait while the receiver has this many packets queued on their lane
+#define BENCH_MAX_QUEUED 64
+
+// One in this many frames has its latency recorded
+#define BENCH_LATENCY_SAMPLE_INTERVAL 16
+
+// Frames carry their send time and the run they belong to
+#define BENCH_ETHERTYPE 0x88b5
+#define BENCH_MIN_FRAME_SIZE 16
+
+static const unsigned int BENCH_RULE_COUNTS[] = { 0,16,64,256 };
+#define BENCH_RULE_COUNT_COUNT (sizeof(BENCH_RULE_COUNTS) / sizeof(unsigned int))
+
+static inline uint64_t benchNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchNode;
+
+struct WirePacket
+{
+	InetAddress from;
+	std::string data;
+};
+
+struct Lane
+{
+	Lane() : node((BenchNode *)0),index(0),depth(0) {}
+
+	BenchNode *node;
+	unsigned int index;
+
+	std::mutex q_m;
+	std::condition_variable q_c;
+	std::deque<WirePacket> q;
+	std::atomic<unsigned int> depth;
+
+	// Frames received on this lane in the current run, with sampled latencies in ns
+	std::atomic<uint64_t> framesIn;
+	std::atomic<uint64_t> bytesIn;
+	std::mutex samples_m;
+	std::vector<uint64_t> samples;
+};
+
+struct BenchNode
+{
+	unsigned int index;
+	Identity id;
+	char secret[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+	char pub[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+	InetAddress addr;
+	ZT_Node *node;
+	volatile uint64_t nextBackgroundTaskDeadline;
+	Lane lanes[BENCH_MAX_LANES];
+
+	std::mutex nets_m;
+	std::vector<uint64_t> netsUp;
+};
+
+static BenchNode *bnodes[BENCH_NODES];
+static std::string planet;
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> runId(0);
+
+/**
+ * Controller for the benchmark networks, which are public and differ only in their rules
+ *
+ * Each rule is an ethertype match that never matches our frames followed by a
+ * drop, so every frame is checked against every rule before the final accept.
+ */
+class BenchController : public NetworkController
+{
+public:
+	BenchController() : _sender((NetworkController::Sender *)0) {}
+
+	virtual void init(const Identity &signingId,Sender *sender)
+	{
+		_signingId = signingId;
+		_sender = sender;
+	}
+
+	virtual void request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData)
+	{
+		const unsigned int ri = (unsigned int)(nwid & 0xffULL);
+		if ((!_sender)||(ri >= BENCH_RULE_COUNT_COUNT)) {
+			if (_sender)
+				_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_OBJECT_NOT_FOUND);
+			return;
+		}
+
+		NetworkConfig *nc = new NetworkConfig();
+		try {
+			nc->networkId = nwid;
+			nc->type = ZT_NETWORK_TYPE_PUBLIC;
+			nc->timestamp = OSUtils::now();
+			nc->credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+			nc->revision = 1;
+			nc->issuedTo = identity.address();
+			nc->flags = ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+			nc->mtu = ZT_DEFAULT_MTU;
+			nc->multicastLimit = 32;
+			OSUtils::ztsnprintf(nc->name,sizeof(nc->name),"bench-%u",BENCH_RULE_COUNTS[ri]);
+			for(unsigned int i=0;i<BENCH_RULE_COUNTS[ri];i+=2) {
+				nc->rules[nc->ruleCount].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+				nc->rules[nc->ruleCount++].v.etherType = (uint16_t)(0x9000 + i);
+				nc->rules[nc->ruleCount++].t = ZT_NETWORK_RULE_ACTION_DROP;
+			}
+			nc->rules[nc->ruleCount++].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+			_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*nc,false);
+		} catch ( ... ) {}
+		delete nc;
+	}
+
+private:
+	Identity _signingId;
+	NetworkController::Sender *_sender;
+};
+
+static BenchNode *benchNodeAt(const struct sockaddr_storage *addr)
+{
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		if (bnodes[i]->addr == *(reinterpret_cast<const InetAddress *>(addr)))
+			return bnodes[i];
+	}
+	return (BenchNode *)0;
+}
+
+static int benchStateGet(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	const BenchNode *const n = reinterpret_cast<const BenchNode *>(uptr);
+	const char *s = (const char *)0;
+	unsigned int l = 0;
+	switch(type) {
+		case ZT_STATE_OBJECT_IDENTITY_SECRET: s = n->secret; l = (unsigned int)strlen(s); break;
+		case ZT_STATE_OBJECT_IDENTITY_PUBLIC: s = n->pub; l = (unsigned int)strlen(s); break;
+		case ZT_STATE_OBJECT_PLANET: s = planet.data(); l = (unsigned int)planet.length(); break;
+		default: return -1;
+	}
+	if (l > maxlen)
+		return -1;
+	memcpy(data,s,l);
+	return (int)l;
+}
+
+static void benchStatePut(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len) {}
+
+static int benchWirePacketSend(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+{
+	const BenchNode *const from = reinterpret_cast<const BenchNode *>(uptr);
+	BenchNode *const to = benchNodeAt(addr);
+	if (!to)
+		return -1;
+	Lane &l = to->lanes[(tptr) ? reinterpret_cast<const Lane *>(tptr)->index : 0];
+	{
+		std::lock_guard<std::mutex> _l(l.q_m);
+		l.q.push_back(WirePacket());
+		l.q.back().from = from->addr;
+		l.q.back().data.assign(reinterpret_cast<const char *>(data),len);
+		++l.depth;
+	}
+	l.q_c.notify_one();
+	return 0;
+}
+
+// Queues a run of packets, taking each destination lane's lock once per run
+static int benchWirePacketBatchSend(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count)
+{
+	const BenchNode *const from = reinterpret_cast<const BenchNode *>(uptr);
+	const unsigned int li = (tptr) ? reinterpret_cast<const Lane *>(tptr)->index : 0;
+	int rc = 0;
+	unsigned int i = 0;
+	while (i < count) {
+		BenchNode *const to = benchNodeAt(packets[i].remoteAddress);
+		if (!to) {
+			rc = -1;
+			++i;
+			continue;
+		}
+		Lane &l = to->lanes[li];
+		{
+			std::lock_guard<std::mutex> _l(l.q_m);
+			do {
+				l.q.push_back(WirePacket());
+				l.q.back().from = from->addr;
+				l.q.back().data.assign(reinterpret_cast<const char *>(packets[i].packetData),packets[i].packetLength);
+				++l.depth;
+			} while ((++i < count)&&(benchNodeAt(packets[i].remoteAddress) == to));
+		}
+		l.q_c.notify_one();
+	}
+	return rc;
+}
+
+static void benchVirtualNetworkFrame(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+{
+	if ((!tptr)||(etherType != BENCH_ETHERTYPE)||(len < BENCH_MIN_FRAME_SIZE))
+		return;
+	uint64_t sent;
+	uint32_t rid;
+	memcpy(&sent,data,8);
+	memcpy(&rid,reinterpret_cast<const uint8_t *>(data) + 8,4);
+	if (rid != runId)
+		return;
+	Lane &l = *(reinterpret_cast<Lane *>(tptr));
+	if ((++l.framesIn % BENCH_LATENCY_SAMPLE_INTERVAL) == 0) {
+		const uint64_t now = benchNs();
+		std::lock_guard<std::mutex> _l(l.samples_m);
+		l.samples.push_back((now > sent) ? (now - sent) : 0);
+	}
+	l.bytesIn += len;
+}
+
+static int benchVirtualNetworkConfig(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf)
+{
+	BenchNode *const n = reinterpret_cast<BenchNode *>(uptr);
+	if (((op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP)||(op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE))&&(nwconf)&&(nwconf->status == ZT_NETWORK_STATUS_OK)) {
+		std::lock_guard<std::mutex> _l(n->nets_m);
+		if (std::find(n->netsUp.begin(),n->netsUp.end(),nwid) == n->netsUp.end())
+			n->netsUp.push_back(nwid);
+	}
+	return 0;
+}
+
+static void benchEvent(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData) {}
+
+static int benchPathCheck(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr) { return 1; }
+
+// Drains one lane of one node's incoming wire
+static void benchLaneMain(Lane *l)
+{
+	std::deque<WirePacket> pkts;
+	std::vector<ZT_WirePacket> batch;
+	while (running) {
+		{
+			std::unique_lock<std::mutex> _l(l->q_m);
+			if (l->q.empty())
+				l->q_c.wait_for(_l,std::chrono::milliseconds(10));
+			pkts.swap(l->q);
+		}
+		if (pkts.empty())
+			continue;
+		batch.resize(pkts.size());
+		for(unsigned long i=0;i<(unsigned long)pkts.size();++i) {
+			batch[i].localSocket = 1;
+			batch[i].remoteAddress = reinterpret_cast<const struct sockaddr_storage *>(&(pkts[i].from));
+			batch[i].packetData = pkts[i].data.data();
+			batch[i].packetLength = (unsigned int)pkts[i].data.length();
+			batch[i].ttl = 0;
+		}
+		ZT_Node_processWirePackets(l->node->node,l,OSUtils::now(),batch.data(),(unsigned int)batch.size(),&(l->node->nextBackgroundTaskDeadline));
+		l->depth -= (unsigned int)pkts.size();
+		pkts.clear();
+	}
+}
+
+static void benchBackgroundMain()
+{
+	while (running) {
+		for(unsigned int i=0;i<BENCH_NODES;++i)
+			ZT_Node_processBackgroundTasks(bnodes[i]->node,(void *)0,OSUtils::now(),&(bnodes[i]->nextBackgroundTaskDeadline));
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+}
+
+static std::atomic<bool> sending(false);
+static std::atomic<uint64_t> framesSent(0);
+
+static void benchSendMain(Lane *l,uint64_t nwid,unsigned int frameSize)
+{
+	BenchNode *const from = bnodes[1];
+	const uint64_t fromMac = MAC(from->id.address(),nwid).toInt();
+	const uint64_t toMac = MAC(bnodes[2]->id.address(),nwid).toInt();
+	Lane &rl = bnodes[2]->lanes[l->index];
+	const uint32_t rid = runId;
+	std::vector<uint8_t> frame(frameSize,(uint8_t)0x55);
+	memcpy(frame.data() + 8,&rid,4);
+	uint64_t sent = 0;
+	while (sending) {
+		if (rl.depth >= BENCH_MAX_QUEUED) {
+			std::this_thread::yield();
+			continue;
+		}
+		const uint64_t now = benchNs();
+		memcpy(frame.data(),&now,8);
+		ZT_Node_processVirtualNetworkFrame(from->node,l,OSUtils::now(),nwid,fromMac,toMac,BENCH_ETHERTYPE,0,frame.data(),frameSize,&(from->nextBackgroundTaskDeadline));
+		++sent;
+	}
+	framesSent += sent;
+}
+
+static bool benchWaitFor(bool (*cond)(),unsigned int ms)
+{
+	const uint64_t end = OSUtils::now() + ms;
+	while (OSUtils::now() < end) {
+		if (cond())
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return cond();
+}
+
+static bool benchNetworksUp()
+{
+	for(unsigned int i=1;i<BENCH_NODES;++i) {
+		std::lock_guard<std::mutex> _l(bnodes[i]->nets_m);
+		if (bnodes[i]->netsUp.size() < BENCH_RULE_COUNT_COUNT)
+			return false;
+	}
+	return true;
+}
+
+static bool benchHaveDirectPath()
+{
+	bool direct = false;
+	ZT_PeerList *pl = ZT_Node_peers(bnodes[1]->node);
+	if (pl) {
+		for(unsigned long i=0;i<pl->peerCount;++i) {
+			if (pl->peers[i].address == bnodes[2]->id.address().toInt()) {
+				for(unsigned int p=0;p<pl->peers[i].pathCount;++p) {
+					if ((!pl->peers[i].paths[p].expired)&&(bnodes[2]->addr == *(reinterpret_cast<const InetAddress *>(&(pl->peers[i].paths[p].address)))))
+						direct = true;
+				}
+			}
+		}
+		ZT_Node_freeQueryResult(bnodes[1]->node,pl);
+	}
+	return direct;
+}
+
+static bool benchDrained()
+{
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		for(unsigned int l=0;l<BENCH_MAX_LANES;++l) {
+			if (bnodes[i]->lanes[l].depth)
+				return false;
+		}
+	}
+	return true;
+}
+
+static std::vector<unsigned int> benchParseList(const char *s)
+{
+	std::vector<unsigned int> l;
+	std::vector<std::string> v(OSUtils::split(s,",","",""));
+	for(std::vector<std::string>::iterator i(v.begin());i!=v.end();++i)
+		l.push_back((unsigned int)Utils::strToUInt(i->c_str()));
+	return l;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Micro-benchmarks are repeated this many times and summarized
+#define MICRO_SAMPLES 21
+
+// Each sample runs for at least about this long
+#define MICRO_MIN_SAMPLE_NS 10000000ULL
+
+#define MICRO_KEYS 1024
+
+// Results are folded into this so the compiler can't discard the work
+static volatile uint64_t microSink = 0;
+
+// Deterministic keys so runs are repeatable
+static inline uint64_t microKey(uint64_t i)
+{
+	i += 0x9e3779b97f4a7c15ULL;
+	i = (i ^ (i >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	i = (i ^ (i >> 27)) * 0x94d049bb133111ebULL;
+	return i ^ (i >> 31);
+}
+
+static inline InetAddress microV4(const uint64_t i)
+{
+	const uint32_t ip = (uint32_t)microKey(i);
+	return InetAddress(&ip,4,(unsigned int)(i & 0xffff));
+}
+
+static inline InetAddress microV6(const uint64_t i)
+{
+	uint64_t ip[2];
+	ip[0] = microKey(i);
+	ip[1] = microKey(i + 1);
+	return InetAddress(ip,16,(unsigned int)(i & 0xffff));
+}
+
+// Each benchmark does its setup, then runs and times n operations, returning elapsed ns
+typedef uint64_t (*MicroFunction)(const unsigned long n);
+
+static uint64_t microHashtableGetHit(const unsigned long n)
+{
+	Hashtable<uint64_t,uint64_t> h;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		h.set(microKey(i),i);
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += *(h.get(microKey(i & (MICRO_KEYS - 1))));
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microHashtableGetMiss(const unsigned long n)
+{
+	Hashtable<uint64_t,uint64_t> h;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		h.set(microKey(i),i);
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += (h.get(microKey(MICRO_KEYS + (i & (MICRO_KEYS - 1))))) ? 1 : 0;
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microHashtableSetErase(const unsigned long n)
+{
+	Hashtable<uint64_t,uint64_t> h;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		h.set(microKey(i),i);
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		const uint64_t k = microKey(MICRO_KEYS + (i & (MICRO_KEYS - 1)));
+		h.set(k,i);
+		h.erase(k);
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += h.size();
+	return t;
+}
+
+static uint64_t microFlatHashtableGetHit(const unsigned long n)
+{
+	FlatHashtable<uint64_t,uint64_t> h;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		h.set(microKey(i),i);
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += *(h.get(microKey(i & (MICRO_KEYS - 1))));
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microBufferAppendRead(const unsigned long n)
+{
+	Buffer<ZT_PROTO_MAX_PACKET_LENGTH> b;
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		b.clear();
+		b.append((uint8_t)i);
+		b.append((uint16_t)i);
+		b.append((uint32_t)i);
+		b.append((uint64_t)i);
+		s += b.at<uint64_t>(7) + b.at<uint32_t>(3) + b[0];
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microDictionaryAddGet(const unsigned long n)
+{
+	Dictionary<1024> d;
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		d.clear();
+		d.add("a",(uint64_t)i);
+		d.add("bb",(uint64_t)(i + 1));
+		d.add("ccc",(uint64_t)(i + 2));
+		d.add("dddd",(uint64_t)(i + 3));
+		s += d.getUI("ccc") + d.getUI("a");
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microInetAddressEqV4(const unsigned long n)
+{
+	std::vector<InetAddress> a;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		a.push_back(microV4(i & 0xff)); // many equal pairs
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += (a[i & (MICRO_KEYS - 1)] == a[(i * 7) & (MICRO_KEYS - 1)]) ? 1 : 0;
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microInetAddressLtV6(const unsigned long n)
+{
+	std::vector<InetAddress> a;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		a.push_back(microV6(i));
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += (a[i & (MICRO_KEYS - 1)] < a[(i * 7) & (MICRO_KEYS - 1)]) ? 1 : 0;
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microInetAddressHashV6(const unsigned long n)
+{
+	std::vector<InetAddress> a;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		a.push_back(microV6(i));
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += a[i & (MICRO_KEYS - 1)].hashCode();
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microPathHashKeyV4(const unsigned long n)
+{
+	std::vector<InetAddress> a;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		a.push_back(microV4(i));
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += Path::HashKey((int64_t)i,a[i & (MICRO_KEYS - 1)]).hashCode();
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microPathHashKeyV6(const unsigned long n)
+{
+	std::vector<InetAddress> a;
+	for(unsigned int i=0;i<MICRO_KEYS;++i)
+		a.push_back(microV6(i));
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i)
+		s += Path::HashKey((int64_t)i,a[i & (MICRO_KEYS - 1)]).hashCode();
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microSharedPtrCopy(const unsigned long n)
+{
+	const SharedPtr<Path> p(new Path(1,microV4(1)));
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		const SharedPtr<Path> q(p);
+		s += (uint64_t)(uintptr_t)q.ptr();
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+// A 1400 byte payload that is a typical mix of structure and noise
+static void microPacket(Packet &p)
+{
+	p.reset(Address(0x1122334455ULL),Address(0x5544332211ULL),Packet::VERB_FRAME);
+	for(unsigned int i=0;i<1400;++i)
+		p.append((uint8_t)(((i % 64) < 48) ? (i % 13) : (microKey(i) & 0xff)));
+}
+
+static uint64_t microPacketCompress(const unsigned long n)
+{
+	Packet orig;
+	microPacket(orig);
+	Packet p;
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		p = orig;
+		p.compress();
+		s += p.size();
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static uint64_t microPacketUncompress(const unsigned long n)
+{
+	Packet orig;
+	microPacket(orig);
+	orig.compress();
+	Packet p;
+	uint64_t s = 0;
+	const uint64_t start = benchNs();
+	for(unsigned long i=0;i<n;++i) {
+		p = orig;
+		p.uncompress();
+		s += p.size();
+	}
+	const uint64_t t = benchNs() - start;
+	microSink += s;
+	return t;
+}
+
+static const struct {
+	const char *name;
+	MicroFunction f;
+} MICRO_BENCHMARKS[] = {
+	{ "hashtable_get_hit",microHashtableGetHit },
+	{ "hashtable_get_miss",microHashtableGetMiss },
+	{ "hashtable_set_erase",microHashtableSetErase },
+	{ "flathashtable_get_hit",microFlatHashtableGetHit },
+	{ "buffer_append_read",microBufferAppendRead },
+	{ "dictionary_add4_get2",microDictionaryAddGet },
+	{ "inetaddress_eq_v4",microInetAddressEqV4 },
+	{ "inetaddress_lt_v6",microInetAddressLtV6 },
+	{ "inetaddress_hash_v6",microInetAddressHashV6 },
+	{ "path_hashkey_v4",microPathHashKeyV4 },
+	{ "path_hashkey_v6",microPathHashKeyV6 },
+	{ "sharedptr_copy",microSharedPtrCopy },
+	{ "packet_compress_1400",microPacketCompress },
+	{ "packet_uncompress_1400",microPacketUncompress }
+};
+
+static void microRun(const bool csv)
+{
+	if (csv)
+		printf("benchmark,ops_per_sample,samples,median_ns,min_ns,mean_ns,stddev_ns" ZT_EOL_S);
+	else printf("%-24s %12s %10s %10s %10s %10s" ZT_EOL_S,"benchmark","ops/sample","median ns","min ns","mean ns","stddev ns");
+
+	for(unsigned int b=0;b<(sizeof(MICRO_BENCHMARKS) / sizeof(MICRO_BENCHMARKS[0]));++b) {
+		// Double the operation count until one sample is long enough, which also warms caches
+		unsigned long n = 1024;
+		while ((MICRO_BENCHMARKS[b].f(n) < MICRO_MIN_SAMPLE_NS)&&(n < 0x40000000UL))
+			n <<= 1;
+
+		double ns[MICRO_SAMPLES];
+		double sum = 0.0;
+		for(unsigned int i=0;i<MICRO_SAMPLES;++i) {
+			ns[i] = (double)MICRO_BENCHMARKS[b].f(n) / (double)n;
+			sum += ns[i];
+		}
+		std::sort(ns,ns + MICRO_SAMPLES);
+		const double mean = sum / (double)MICRO_SAMPLES;
+		double var = 0.0;
+		for(unsigned int i=0;i<MICRO_SAMPLES;++i)
+			var += (ns[i] - mean) * (ns[i] - mean);
+		const double stddev = sqrt(var / (double)(MICRO_SAMPLES - 1));
+
+		if (csv)
+			printf("%s,%lu,%u,%.3f,%.3f,%.3f,%.3f" ZT_EOL_S,MICRO_BENCHMARKS[b].name,n,(unsigned int)MICRO_SAMPLES,ns[MICRO_SAMPLES / 2],ns[0],mean,stddev);
+		else printf("%-24s %12lu %10.2f %10.2f %10.2f %10.2f" ZT_EOL_S,MICRO_BENCHMARKS[b].name,n,ns[MICRO_SAMPLES / 2],ns[0],mean,stddev);
+		fflush(stdout);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// The controller ignores requests from a member more often than once a second
+#define CONTROLLER_MIN_REQUEST_SPACING 1100
+
+// Most requests we keep outstanding when sending as fast as possible
+#define CONTROLLER_MAX_OUTSTANDING 256
+
+/**
+ * Stands in for Node, timing each request from request() to its reply
+ *
+ * Signing of the reply is done here as Node would do it before sending, so
+ * its cost can be reported separately.
+ */
+class ControllerBenchSender : public NetworkController::Sender
+{
+public:
+	ControllerBenchSender(const Identity &signingId) : answered(0),errors(0),_signingId(signingId) {}
+
+	inline void started(const uint64_t requestPacketId)
+	{
+		std::lock_guard<std::mutex> _l(_m);
+		_started[requestPacketId] = benchNs();
+	}
+
+	inline unsigned long outstanding()
+	{
+		std::lock_guard<std::mutex> _l(_m);
+		return (unsigned long)_started.size();
+	}
+
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig)
+	{
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> d;
+		if (nc.toDictionary(d,sendLegacyFormatConfig))
+			ncSendSerializedConfig(nwid,requestPacketId,destination,d.data(),d.sizeBytes(),0);
+	}
+
+	virtual void ncSendSerializedConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const void *conf,unsigned int confLen,uint8_t chunkFlags)
+	{
+		const uint64_t signStart = benchNs();
+		const C25519::Signature sig(_signingId.sign(conf,confLen));
+		const uint64_t now = benchNs();
+		microSink += sig.data[0];
+		_done(requestPacketId,now,now - signStart);
+		++answered;
+	}
+
+	virtual void ncSendRevocation(const Address &destination,const Revocation &rev) {}
+	virtual void ncSendRevocations(const Address &destination,const Revocation *revs,unsigned int count) {}
+
+	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode)
+	{
+		_done(requestPacketId,benchNs(),0);
+		++errors;
+	}
+
+	// Latencies and signing times in ns, taken once the run is over
+	std::vector<uint64_t> latencies;
+	std::vector<uint64_t> signTimes;
+	std::atomic<uint64_t> answered;
+	std::atomic<uint64_t> errors;
+
+private:
+	inline void _done(const uint64_t requestPacketId,const uint64_t now,const uint64_t signTime)
+	{
+		std::lock_guard<std::mutex> _l(_m);
+		std::unordered_map<uint64_t,uint64_t>::iterator s(_started.find(requestPacketId));
+		if (s != _started.end()) {
+			latencies.push_back(now - s->second);
+			if (signTime)
+				signTimes.push_back(signTime);
+			_started.erase(s);
+		}
+	}
+
+	const Identity _signingId;
+	std::mutex _m;
+	std::unordered_map<uint64_t,uint64_t> _started;
+};
+
+static inline double controllerPercentile(const std::vector<uint64_t> &sorted,const unsigned int permille)
+{
+	if (sorted.empty())
+		return 0.0;
+	return (double)sorted[std::min((sorted.size() * permille) / 1000,sorted.size() - 1)] / 1000.0;
+}
+
+static int controllerRun(const char *path,const bool csv,const unsigned int networks,const unsigned int members,const unsigned int rate,const unsigned int duration)
+{
+	if (OSUtils::fileExists(path,false)) {
+		fprintf(stderr,"FATAL: %s already exists, remove it or use -p to choose another path" ZT_EOL_S,path);
+		return 1;
+	}
+	if ((unsigned long)networks * (unsigned long)members * 1000UL < (unsigned long)rate * CONTROLLER_MIN_REQUEST_SPACING)
+		fprintf(stderr,"WARNING: too few members for this rate since each may only ask once a second, the achieved rate will be lower" ZT_EOL_S);
+
+	fprintf(stderr,"Generating controller identity..." ZT_EOL_S);
+	Identity signingId;
+	signingId.generate();
+
+	EmbeddedNetworkController *const c = new EmbeddedNetworkController((Node *)0,path);
+	ControllerBenchSender sender(signingId);
+	c->init(signingId,&sender);
+
+	// Synthetic members have random public keys, which the controller doesn't validate
+	fprintf(stderr,"Creating %u networks with %u members each..." ZT_EOL_S,networks,members);
+	std::vector<uint64_t> nwids;
+	std::vector<Identity> ids;
+	std::map<std::string,std::string> noArgs,noHeaders;
+	std::string rb,rct;
+	for(unsigned int n=0;n<networks;++n) {
+		const uint64_t nwid = (signingId.address().toInt() << 24) | (uint64_t)(n + 1);
+		nwids.push_back(nwid);
+		char tmp[256];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+		std::vector<std::string> np;
+		np.push_back("network");
+		np.push_back(tmp);
+		c->handleControlPlaneHttpPOST(np,noArgs,noHeaders,"{\"private\":true,\"v4AssignMode\":{\"zt\":true},\"ipAssignmentPools\":[{\"ipRangeStart\":\"10.0.0.1\",\"ipRangeEnd\":\"10.255.255.254\"}],\"routes\":[{\"target\":\"10.0.0.0/8\"}]}",rb,rct);
+		np.push_back("member");
+		np.push_back(std::string());
+		for(unsigned int m=0;m<members;++m) {
+			const uint64_t k = microKey(((uint64_t)n << 32) | (uint64_t)m);
+			uint64_t a = k & 0xffffffffffULL;
+			if (((a >> 32) == 0xff)||(a == 0))
+				a ^= 0x1000000000ULL;
+			char *p = tmp + OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx:0:",(unsigned long long)a);
+			for(unsigned int i=0;i<ZT_C25519_PUBLIC_KEY_LEN;++i)
+				p += OSUtils::ztsnprintf(p,4,"%.2x",(unsigned int)(microKey(k + i) & 0xff));
+			ids.push_back(Identity(tmp));
+			np[3] = std::string(tmp,10);
+			c->handleControlPlaneHttpPOST(np,noArgs,noHeaders,"{\"authorized\":true}",rb,rct);
+		}
+	}
+
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> rmd;
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_VENDOR,(uint64_t)ZT_VENDOR_ZEROTIER);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_PROTOCOL_VERSION,(uint64_t)ZT_PROTO_VERSION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MAJOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MAJOR);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MINOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MINOR);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_REVISION,(uint64_t)ZEROTIER_ONE_VERSION_REVISION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_RULES,(uint64_t)ZT_MAX_NETWORK_RULES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_CAPABILITIES,(uint64_t)ZT_MAX_NETWORK_CAPABILITIES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_CAPABILITY_RULES,(uint64_t)ZT_MAX_CAPABILITY_RULES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+
+	uint64_t lockWaits0,lockWaitNs0;
+	c->dbLockWaits(lockWaits0,lockWaitNs0);
+
+	// Members are asked in turn, paced to the target rate or to the number outstanding
+	fprintf(stderr,"Sending requests for %u ms..." ZT_EOL_S,duration);
+	std::vector<uint64_t> lastAsked(ids.size(),0);
+	const InetAddress from("10.0.0.1/9993");
+	uint64_t sent = 0,next = 0;
+	const uint64_t start = benchNs();
+	const uint64_t end = start + ((uint64_t)duration * 1000000ULL);
+	for(;;) {
+		const uint64_t now = benchNs();
+		if (now >= end)
+			break;
+		if (rate) {
+			const uint64_t due = start + ((sent * 1000000000ULL) / rate);
+			if (now < due) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(due - now,(uint64_t)1000000ULL)));
+				continue;
+			}
+		} else if (sender.outstanding() >= CONTROLLER_MAX_OUTSTANDING) {
+			std::this_thread::yield();
+			continue;
+		}
+		const unsigned long m = (unsigned long)(next % ids.size());
+		const uint64_t nowMs = now / 1000000ULL;
+		if ((lastAsked[m])&&((nowMs - lastAsked[m]) < CONTROLLER_MIN_REQUEST_SPACING)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		lastAsked[m] = nowMs;
+		++next;
+		++sent;
+		sender.started(sent);
+		c->request(nwids[m / members],from,sent,ids[m],rmd);
+	}
+
+	const uint64_t drainEnd = OSUtils::now() + 30000;
+	while ((sender.outstanding() > 0)&&(OSUtils::now() < drainEnd))
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	const double secs = (double)(benchNs() - start) / 1000000000.0;
+
+	uint64_t lockWaits,lockWaitNs;
+	c->dbLockWaits(lockWaits,lockWaitNs);
+	lockWaits -= lockWaits0;
+	lockWaitNs -= lockWaitNs0;
+	const unsigned long unanswered = sender.outstanding();
+
+	delete c;
+	OSUtils::rmDashRf(path);
+
+	std::sort(sender.latencies.begin(),sender.latencies.end());
+	std::sort(sender.signTimes.begin(),sender.signTimes.end());
+	const uint64_t answered = sender.answered,errors = sender.errors;
+	const double achieved = (double)(answered + errors) / secs;
+
+	if (csv) {
+		printf("networks,members,target_rate,requests,answered,errors,unanswered,requests_per_second,latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,sign_p50_us,sign_p99_us,lock_waits,lock_wait_ms" ZT_EOL_S);
+		printf("%u,%u,%u,%llu,%llu,%llu,%lu,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%.3f" ZT_EOL_S,
+			networks,members,rate,(unsigned long long)sent,(unsigned long long)answered,(unsigned long long)errors,unanswered,achieved,
+			controllerPercentile(sender.latencies,500),controllerPercentile(sender.latencies,900),controllerPercentile(sender.latencies,990),controllerPercentile(sender.latencies,1000),
+			controllerPercentile(sender.signTimes,500),controllerPercentile(sender.signTimes,990),
+			(unsigned long long)lockWaits,(double)lockWaitNs / 1000000.0);
+	} else {
+		printf("Requests:         %llu sent, %llu answered, %llu errors, %lu unanswered" ZT_EOL_S,(unsigned long long)sent,(unsigned long long)answered,(unsigned long long)errors,unanswered);
+		printf("Rate:             %.0f requests/sec" ZT_EOL_S,achieved);
+		printf("Latency us:       p50 %.1f  p90 %.1f  p99 %.1f  max %.1f" ZT_EOL_S,controllerPercentile(sender.latencies,500),controllerPercentile(sender.latencies,900),controllerPercentile(sender.latencies,990),controllerPercentile(sender.latencies,1000));
+		printf("Signing us:       p50 %.1f  p99 %.1f" ZT_EOL_S,controllerPercentile(sender.signTimes,500),controllerPercentile(sender.signTimes,990));
+		printf("DB lock waits:    %llu totalling %.3f ms (%.2f us per request)" ZT_EOL_S,(unsigned long long)lockWaits,(double)lockWaitNs / 1000000.0,(sent) ? ((double)lockWaitNs / 1000.0) / (double)sent : 0.0);
+	}
+	return (unanswered == 0) ? 0 : 1;
+}
+
+static void benchUsage(const char *argv0)
+{
+	fprintf(stderr,"Usage: %s [-c] [-d <ms per run>] [-t <threads,...>] [-r <rules,...>] [-s <frame sizes,...>]" ZT_EOL_S,argv0);
+	fprintf(stderr,"       %s -m [-c]" ZT_EOL_S,argv0);
+	fprintf(stderr,"       %s -n [-c] [-d <ms>] [-N <networks>] [-M <members per network>] [-q <requests/sec>] [-p <db path>]" ZT_EOL_S,argv0);
+	fprintf(stderr,"  -m  Run micro-benchmarks of core data structures instead" ZT_EOL_S);
+	fprintf(stderr,"  -n  Load test a network controller instead (default 10 networks of 1000 members," ZT_EOL_S);
+	fprintf(stderr,"      as many requests as it can take, in zerotier-bench-controller.d)" ZT_EOL_S);
+	fprintf(stderr,"  -c  CSV output" ZT_EOL_S);
+	fprintf(stderr,"  -d  Milliseconds to send for in each run (default 1000)" ZT_EOL_S);
+	fprintf(stderr,"  -t  Sending thread counts, up to %u (default 1,2,4)" ZT_EOL_S,BENCH_MAX_LANES);
+	fprintf(stderr,"  -r  Rule counts from 0,16,64,256 (default all)" ZT_EOL_S);
+	fprintf(stderr,"  -s  Frame sizes from %u to %u (default 64,512,1400,2800)" ZT_EOL_S,BENCH_MIN_FRAME_SIZE,ZT_DEFAULT_MTU);
+}
+
+int main(int argc,char **argv)
+{
+	bool csv = false,micro = false,ctl = false;
+	unsigned int ctlNetworks = 10,ctlMembers = 1000,ctlRate = 0;
+	const char *ctlPath = "zerotier-bench-controller.d";
+	unsigned int duration = 1000;
+	std::vector<unsigned int> threads,rules,sizes;
+	threads.push_back(1); threads.push_back(2); threads.push_back(4);
+	for(unsigned int i=0;i<BENCH_RULE_COUNT_COUNT;++i)
+		rules.push_back(BENCH_RULE_COUNTS[i]);
+	sizes.push_back(64); sizes.push_back(512); sizes.push_back(1400); sizes.push_back(ZT_DEFAULT_MTU);
+
+	for(int i=1;i<argc;++i) {
+		if (!strcmp(argv[i],"-c")) {
+			csv = true;
+		} else if (!strcmp(argv[i],"-m")) {
+			micro = true;
+		} else if (!strcmp(argv[i],"-n")) {
+			ctl = true;
+		} else if ((!strcmp(argv[i],"-N"))&&((i + 1) < argc)) {
+			ctlNetworks = (unsigned int)Utils::strToUInt(argv[++i]);
+		} else if ((!strcmp(argv[i],"-M"))&&((i + 1) < argc)) {
+			ctlMembers = (unsigned int)Utils::strToUInt(argv[++i]);
+		} else if ((!strcmp(argv[i],"-q"))&&((i + 1) < argc)) {
+			ctlRate = (unsigned int)Utils::strToUInt(argv[++i]);
+		} else if ((!strcmp(argv[i],"-p"))&&((i + 1) < argc)) {
+			ctlPath = argv[++i];
+		} else if ((!strcmp(argv[i],"-d"))&&((i + 1) < argc)) {
+			duration = (unsigned int)Utils::strToUInt(argv[++i]);
+		} else if ((!strcmp(argv[i],"-t"))&&((i + 1) < argc)) {
+			threads = benchParseList(argv[++i]);
+		} else if ((!strcmp(argv[i],"-r"))&&((i + 1) < argc)) {
+			rules = benchParseList(argv[++i]);
+		} else if ((!strcmp(argv[i],"-s"))&&((i + 1) < argc)) {
+			sizes = benchParseList(argv[++i]);
+		} else {
+			benchUsage(argv[0]);
+			return 1;
+		}
+	}
+	for(std::vector<unsigned int>::iterator t(threads.begin());t!=threads.end();++t) {
+		if ((*t < 1)||(*t > BENCH_MAX_LANES)) { benchUsage(argv[0]); return 1; }
+	}
+	for(std::vector<unsigned int>::iterator r(rules.begin());r!=rules.end();++r) {
+		if (std::find(BENCH_RULE_COUNTS,BENCH_RULE_COUNTS + BENCH_RULE_COUNT_COUNT,*r) == (BENCH_RULE_COUNTS + BENCH_RULE_COUNT_COUNT)) { benchUsage(argv[0]); return 1; }
+	}
+	for(std::vector<unsigned int>::iterator s(sizes.begin());s!=sizes.end();++s) {
+		if ((*s < BENCH_MIN_FRAME_SIZE)||(*s > ZT_DEFAULT_MTU)) { benchUsage(argv[0]); return 1; }
+	}
+	if (duration == 0)
+		duration = 1000;
+
+	if (micro) {
+		microRun(csv);
+		return 0;
+	}
+	if (ctl) {
+		if ((ctlNetworks < 1)||(ctlNetworks > 0xffffff)||(ctlMembers < 1)) {
+			benchUsage(argv[0]);
+			return 1;
+		}
+		return controllerRun(ctlPath,csv,ctlNetworks,ctlMembers,ctlRate,duration);
+	}
+
+	fprintf(stderr,"Generating identities..." ZT_EOL_S);
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		BenchNode *const n = new BenchNode();
+		n->index = i;
+		n->id.generate();
+		n->id.toString(true,n->secret);
+		n->id.toString(false,n->pub);
+		n->addr.fromString((std::string("10.0.0.") + std::to_string(i + 1) + "/9993").c_str());
+		n->node = (ZT_Node *)0;
+		n->nextBackgroundTaskDeadline = 0;
+		for(unsigned int l=0;l<BENCH_MAX_LANES;++l) {
+			n->lanes[l].node = n;
+			n->lanes[l].index = l;
+			n->lanes[l].framesIn = 0;
+			n->lanes[l].bytesIn = 0;
+		}
+		bnodes[i] = n;
+	}
+
+	// A private planet whose only root is node 0
+	{
+		std::vector<World::Root> roots;
+		roots.push_back(World::Root());
+		roots.back().identity = bnodes[0]->id;
+		roots.back().stableEndpoints.push_back(bnodes[0]->addr);
+		const C25519::Pair pk(C25519::generate());
+		const World w(World::make(World::TYPE_PLANET,0x1234567ULL,OSUtils::now(),pk.pub,roots,pk));
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> wb;
+		w.serialize(wb,false);
+		planet.assign(reinterpret_cast<const char *>(wb.data()),wb.size());
+	}
+
+	struct ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 1;
+	cb.stateGetFunction = benchStateGet;
+	cb.statePutFunction = benchStatePut;
+	cb.wirePacketSendFunction = benchWirePacketSend;
+	cb.virtualNetworkFrameFunction = benchVirtualNetworkFrame;
+	cb.virtualNetworkConfigFunction = benchVirtualNetworkConfig;
+	cb.eventCallback = benchEvent;
+	cb.pathCheckFunction = benchPathCheck;
+	cb.pathLookupFunction = (ZT_PathLookupFunction)0;
+	cb.wirePacketBatchSendFunction = benchWirePacketBatchSend;
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		if (ZT_Node_new(&(bnodes[i]->node),bnodes[i],(void *)0,&cb,OSUtils::now()) != ZT_RESULT_OK) {
+			fprintf(stderr,"FATAL: unable to create node %u" ZT_EOL_S,i);
+			return 1;
+		}
+	}
+	BenchController controller;
+	ZT_Node_setNetconfMaster(bnodes[0]->node,&controller);
+
+	std::vector<std::thread> laneThreads;
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		for(unsigned int l=0;l<BENCH_MAX_LANES;++l)
+			laneThreads.push_back(std::thread(benchLaneMain,&(bnodes[i]->lanes[l])));
+	}
+	std::thread background(benchBackgroundMain);
+
+	const uint64_t nwidBase = bnodes[0]->id.address().toInt() << 24;
+	for(unsigned int i=1;i<BENCH_NODES;++i) {
+		for(unsigned int r=0;r<BENCH_RULE_COUNT_COUNT;++r)
+			ZT_Node_join(bnodes[i]->node,nwidBase + r,(void *)0,(void *)0);
+	}
+
+	int exitCode = 0;
+	fprintf(stderr,"Waiting for networks and a direct path..." ZT_EOL_S);
+	if (!benchWaitFor(benchNetworksUp,30000)) {
+		fprintf(stderr,"FATAL: networks did not come up" ZT_EOL_S);
+		exitCode = 1;
+	} else {
+		// The first frames are relayed by the root, which then introduces the two nodes
+		const uint64_t end = OSUtils::now() + 30000;
+		while ((!benchHaveDirectPath())&&(OSUtils::now() < end)) {
+			uint8_t f[BENCH_MIN_FRAME_SIZE];
+			memset(f,0,sizeof(f));
+			ZT_Node_processVirtualNetworkFrame(bnodes[1]->node,&(bnodes[1]->lanes[0]),OSUtils::now(),nwidBase,MAC(bnodes[1]->id.address(),nwidBase).toInt(),MAC(bnodes[2]->id.address(),nwidBase).toInt(),BENCH_ETHERTYPE,0,f,sizeof(f),&(bnodes[1]->nextBackgroundTaskDeadline));
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		if (!benchHaveDirectPath()) {
+			fprintf(stderr,"FATAL: nodes 1 and 2 did not find a direct path" ZT_EOL_S);
+			exitCode = 1;
+		}
+	}
+
+	if (exitCode == 0) {
+		if (csv)
+			printf("threads,rules,frame_size,frames_sent,frames_received,frames_per_second,gbps,latency_p50_us,latency_p99_us" ZT_EOL_S);
+		else printf("threads  rules  frame size    frames/sec       Gbps   p50 latency us   p99 latency us   lost" ZT_EOL_S);
+
+		for(std::vector<unsigned int>::iterator t(threads.begin());t!=threads.end();++t) {
+			for(std::vector<unsigned int>::iterator r(rules.begin());r!=rules.end();++r) {
+				const uint64_t nwid = nwidBase + (uint64_t)(std::find(BENCH_RULE_COUNTS,BENCH_RULE_COUNTS + BENCH_RULE_COUNT_COUNT,*r) - BENCH_RULE_COUNTS);
+				for(std::vector<unsigned int>::iterator s(sizes.begin());s!=sizes.end();++s) {
+					for(unsigned int l=0;l<BENCH_MAX_LANES;++l) {
+						Lane &rl = bnodes[2]->lanes[l];
+						rl.framesIn = 0;
+						rl.bytesIn = 0;
+						std::lock_guard<std::mutex> _l(rl.samples_m);
+						rl.samples.clear();
+					}
+					framesSent = 0;
+					++runId;
+
+					// Time runs from the first frame sent until the last queued packet is processed
+					const uint64_t start = benchNs();
+					sending = true;
+					std::vector<std::thread> senders;
+					for(unsigned int l=0;l<*t;++l)
+						senders.push_back(std::thread(benchSendMain,&(bnodes[1]->lanes[l]),nwid,*s));
+					std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+					sending = false;
+					for(std::vector<std::thread>::iterator st(senders.begin());st!=senders.end();++st)
+						st->join();
+					benchWaitFor(benchDrained,10000);
+					const double secs = (double)(benchNs() - start) / 1000000000.0;
+
+					uint64_t frames = 0,bytes = 0;
+					std::vector<uint64_t> samples;
+					for(unsigned int l=0;l<BENCH_MAX_LANES;++l) {
+						Lane &rl = bnodes[2]->lanes[l];
+						frames += rl.framesIn;
+						bytes += rl.bytesIn;
+						std::lock_guard<std::mutex> _l(rl.samples_m);
+						samples.insert(samples.end(),rl.samples.begin(),rl.samples.end());
+					}
+					std::sort(samples.begin(),samples.end());
+					const double p50 = (samples.empty()) ? 0.0 : (double)samples[samples.size() / 2] / 1000.0;
+					const double p99 = (samples.empty()) ? 0.0 : (double)samples[(samples.size() * 99) / 100] / 1000.0;
+					const double fps = (double)frames / secs;
+					const double gbps = ((double)bytes * 8.0) / (secs * 1000000000.0);
+					const uint64_t sent = framesSent;
+
+					if (csv)
+						printf("%u,%u,%u,%llu,%llu,%.0f,%.3f,%.1f,%.1f" ZT_EOL_S,*t,*r,*s,(unsigned long long)sent,(unsigned long long)frames,fps,gbps,p50,p99);
+					else printf("%7u  %5u  %10u  %12.0f  %9.3f  %15.1f  %15.1f  %5llu" ZT_EOL_S,*t,*r,*s,fps,gbps,p50,p99,(unsigned long long)((sent > frames) ? (sent - frames) : 0));
+					fflush(stdout);
+				}
+			}
+		}
+	}
+
+	running = false;
+	background.join();
+	for(std::vector<std::thread>::iterator lt(laneThreads.begin());lt!=laneThreads.end();++lt) {
+		lt->join();
+	}
+	for(unsigned int i=0;i<BENCH_NODES;++i) {
+		ZT_Node_delete(bnodes[i]->node);
+		delete bnodes[i];
+	}
+
+	return exitCode;
+}
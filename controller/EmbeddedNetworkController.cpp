@@ -32,6 +32,7 @@
 #include <stdexcept>
 #include <map>
 #include <thread>
+#include <chrono>
 #include <memory>
 
 #include "../include/ZeroTierOne.h"
@@ -43,11 +44,14 @@
 #include "../node/Utils.hpp"
 #include "../node/CertificateOfMembership.hpp"
 #include "../node/NetworkConfig.hpp"
+#include "../node/Packet.hpp"
 #include "../node/Dictionary.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/MAC.hpp"
 #include "../node/Address.hpp"
 
+#include "../osdep/CpuAffinity.hpp"
+
 using json = nlohmann::json;
 
 // API version reported via JSON control plane
@@ -59,6 +63,35 @@ using json = nlohmann::json;
 // Min duration between requests for an address/nwid combo to prevent floods
 #define ZT_NETCONF_MIN_REQUEST_PERIOD 1000
 
+// A cached config is resent until its credentials are this fraction of their max delta old
+#define ZT_NETCONF_CONFIG_CACHE_MAX_AGE_DIVISOR 4
+
+// Default window over which network-wide config pushes are spread
+#define ZT_NETCONF_DEFAULT_PUSH_WINDOW 10000
+
+// How often request threads wake up to drain queued pushes when idle
+#define ZT_NETCONF_PUSH_DRAIN_INTERVAL 250
+
+// Configs shorter than this fit in one chunk, so aren't compressed before chunking
+#define ZT_NETCONF_COMPRESS_MIN_SIZE 1024
+
+// Members sent queued revocations each time a request thread drains them
+#define ZT_NETCONF_REVOCATION_FANOUT_BATCH 1024
+
+// Default and maximum number of objects in one GET /controller/changes response
+#define ZT_NETCONF_CHANGE_FEED_DEFAULT_LIMIT 1000
+#define ZT_NETCONF_CHANGE_FEED_MAX_LIMIT 10000
+
+// Remote traces queued beyond this are dropped until the trace writer catches up
+#define ZT_NETCONF_TRACE_QUEUE_MAX 16384
+
+// The trace writer wakes up when this many traces are queued or after this long
+#define ZT_NETCONF_TRACE_BATCH 256
+#define ZT_NETCONF_TRACE_FLUSH_INTERVAL 1000
+
+// Most free addresses tried when auto-assigning one IPv4 address to a member
+#define ZT_NETCONF_IPV4_ASSIGN_MAX_TRIALS 1024
+
 namespace ZeroTier {
 
 static json _renderRule(ZT_VirtualNetworkRule &rule)
@@ -122,13 +155,11 @@ static json _renderRule(ZT_VirtualNetworkRule &rule)
 				break;
 			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
 				r["type"] = "MATCH_MAC_SOURCE";
-				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(unsigned int)rule.v.mac[0],(unsigned int)rule.v.mac[1],(unsigned int)rule.v.mac[2],(unsigned int)rule.v.mac[3],(unsigned int)rule.v.mac[4],(unsigned int)rule.v.mac[5]);
-				r["mac"] = tmp;
+				r["mac"] = MAC(rule.v.mac,6).toString(tmp);
 				break;
 			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
 				r["type"] = "MATCH_MAC_DEST";
-				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(unsigned int)rule.v.mac[0],(unsigned int)rule.v.mac[1],(unsigned int)rule.v.mac[2],(unsigned int)rule.v.mac[3],(unsigned int)rule.v.mac[4],(unsigned int)rule.v.mac[5]);
-				r["mac"] = tmp;
+				r["mac"] = MAC(rule.v.mac,6).toString(tmp);
 				break;
 			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
 				r["type"] = "MATCH_IPV4_SOURCE";
@@ -179,8 +210,7 @@ static json _renderRule(ZT_VirtualNetworkRule &rule)
 				break;
 			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
 				r["type"] = "MATCH_CHARACTERISTICS";
-				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",rule.v.characteristics);
-				r["mask"] = tmp;
+				r["mask"] = Utils::hex((uint64_t)rule.v.characteristics,tmp);
 				break;
 			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
 				r["type"] = "MATCH_FRAME_SIZE_RANGE";
@@ -426,17 +456,38 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 	return false;
 }
 
-EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath) :
+EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath,const bool logStructuredDb,const char *replicaAuthToken) :
 	_startTime(OSUtils::now()),
 	_running(true),
 	_lastDumpedStatus(0),
-	_db(dbPath),
-	_node(node)
+	_db(dbPath,logStructuredDb,replicaAuthToken),
+	_node(node),
+	_pushDeadline(0),
+	_lastPushDrain(0),
+	_pushesSent(0),
+	_pushWindow(ZT_NETCONF_DEFAULT_PUSH_WINDOW),
+	_revocationRecipientsSent(0),
+	_configsCompressed(0),
+	_configBytesSaved(0),
+	_traceRun(true),
+	_traceSampleRate(1),
+	_tracesReceived(0),
+	_tracesSampledOut(0),
+	_tracesDropped(0),
+	_tracesWritten(0)
 {
 }
 
 EmbeddedNetworkController::~EmbeddedNetworkController()
 {
+	{
+		std::lock_guard<std::mutex> l(_traces_m);
+		_traceRun = false;
+		_traces_c.notify_one();
+	}
+	if (_traceWriter.joinable()) // flushes whatever is still queued
+		_traceWriter.join();
+
 	std::vector<Thread> t;
 	{
 		Mutex::Lock _l(_threads_m);
@@ -475,7 +526,7 @@ void EmbeddedNetworkController::request(
 	qe->identity = identity;
 	qe->metaData = metaData;
 	qe->type = _RQEntry::RQENTRY_TYPE_REQUEST;
-	_queue.post(qe);
+	_queue.post(nwid,qe);
 }
 
 unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
@@ -510,17 +561,54 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 						responseContentType = "application/json";
 
 					} else {
-						// List members and their revisions
+						// List members and their revisions, optionally filtered and one page at a time
+
+						int authorized = -1,hasIp = -1;
+						uint64_t activeSince = 0;
+						unsigned long offset = 0,limit = 0xffffffffUL;
+						std::map<std::string,std::string>::const_iterator a(urlArgs.find("authorized"));
+						if (a != urlArgs.end())
+							authorized = (OSUtils::jsonBool(json(a->second),false)) ? 1 : 0;
+						a = urlArgs.find("hasIp");
+						if (a != urlArgs.end())
+							hasIp = (OSUtils::jsonBool(json(a->second),false)) ? 1 : 0;
+						a = urlArgs.find("activeSince");
+						if (a != urlArgs.end())
+							activeSince = Utils::strToU64(a->second.c_str());
+						a = urlArgs.find("offset");
+						if (a != urlArgs.end())
+							offset = (unsigned long)Utils::strToU64(a->second.c_str());
+						a = urlArgs.find("limit");
+						if (a != urlArgs.end())
+							limit = (unsigned long)Utils::strToU64(a->second.c_str());
+
+						// Only IDs and revisions are copied while the network is locked; nothing is decoded from msgpack
+						std::vector< std::pair<uint64_t,uint64_t> > matches; // member ID, revision
+						matches.reserve(_db.memberCount(nwid));
+						_db.eachMemberRecord(nwid,[&matches,authorized,hasIp,activeSince](uint64_t networkId,uint64_t nodeId,const JSONDB::MemberRecord &member) {
+							if ((authorized >= 0)&&(member.authorized != (authorized > 0)))
+								return;
+							if ((hasIp >= 0)&&(member.ipAssignments.empty() == (hasIp > 0)))
+								return;
+							if ((activeSince)&&(member.lastRequestTime < activeSince))
+								return;
+							matches.push_back(std::pair<uint64_t,uint64_t>(nodeId,member.revision));
+						});
+
+						// Sort by address for stable pages, but only as far as the end of this page
+						const unsigned long end = ((offset < (unsigned long)matches.size())&&(limit < ((unsigned long)matches.size() - offset))) ? (offset + limit) : (unsigned long)matches.size();
+						if (offset < end)
+							std::partial_sort(matches.begin(),matches.begin() + end,matches.end());
 
 						responseBody = "{";
-						responseBody.reserve((_db.memberCount(nwid) + 1) * 32);
-						_db.eachMember(nwid,[&responseBody](uint64_t networkId,uint64_t nodeId,const json &member) {
-							if ((member.is_object())&&(member.size() > 0)) {
-								char tmp[128];
-								OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s%.10llx\":%llu",(responseBody.length() > 1) ? ",\"" : "\"",(unsigned long long)nodeId,(unsigned long long)OSUtils::jsonInt(member["revision"],0));
-								responseBody.append(tmp);
-							}
-						});
+						responseBody.reserve(((offset < end) ? (end - offset) + 1 : 1) * 32);
+						for(unsigned long i=offset;i<end;++i) {
+							char tmp[128];
+							responseBody.append((responseBody.length() > 1) ? ",\"" : "\"");
+							responseBody.append(Utils::hex10(matches[i].first,tmp));
+							OSUtils::ztsnprintf(tmp,sizeof(tmp),"\":%llu",(unsigned long long)matches[i].second);
+							responseBody.append(tmp);
+						}
 						responseBody.push_back('}');
 						responseContentType = "application/json";
 
@@ -551,8 +639,9 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 			for(std::vector<uint64_t>::const_iterator i(networkIds.begin());i!=networkIds.end();++i) {
 				if (responseBody.length() > 1)
 					responseBody.push_back(',');
-				OSUtils::ztsnprintf(tmp,sizeof(tmp),"\"%.16llx\"",(unsigned long long)*i);
-				responseBody.append(tmp);
+				responseBody.push_back('"');
+				responseBody.append(Utils::hex(*i,tmp));
+				responseBody.push_back('"');
 			}
 			responseBody.push_back(']');
 			responseContentType = "application/json";
@@ -561,11 +650,158 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 
 		} // else 404
 
+	} else if ((path.size() == 1)&&(path[0] == "db")) {
+		// Everything replicas need to start, as stored, keyed by object name
+
+		char n[256];
+		responseBody = "{";
+		std::vector<uint64_t> networkIds(_db.networkIds());
+		for(std::vector<uint64_t>::const_iterator nwid(networkIds.begin());nwid!=networkIds.end();++nwid) {
+			json network;
+			if (!_db.getNetwork(*nwid,network))
+				continue;
+			OSUtils::ztsnprintf(n,sizeof(n),"%s\"network/%.16llx\":",(responseBody.length() > 1) ? ",\n" : "\n",(unsigned long long)*nwid);
+			responseBody.append(n);
+			responseBody.append(OSUtils::jsonDump(network,-1));
+			_db.eachMemberJson(*nwid,[&responseBody,&n](uint64_t networkId,uint64_t nodeId,const std::string &member) {
+				OSUtils::ztsnprintf(n,sizeof(n),",\n\"network/%.16llx/member/%.10llx\":",(unsigned long long)networkId,(unsigned long long)nodeId);
+				responseBody.append(n);
+				responseBody.append(member);
+			});
+		}
+		responseBody.append("\n}\n");
+		responseContentType = "application/json";
+		return 200;
+
+	} else if (((path.size() == 1)&&(path[0] == "changes"))||((path.size() == 2)&&(path[0] == "db")&&(path[1] == "changes"))) {
+		// Networks and members changed since a change feed revision (raw for replicas, as stored without non-persisted fields)
+
+		uint64_t since = 0,epoch = 0;
+		unsigned long limit = ZT_NETCONF_CHANGE_FEED_DEFAULT_LIMIT;
+		bool objects = true,raw = false;
+		std::map<std::string,std::string>::const_iterator a(urlArgs.find("since"));
+		if (a != urlArgs.end())
+			since = Utils::strToU64(a->second.c_str());
+		a = urlArgs.find("epoch");
+		if (a != urlArgs.end())
+			epoch = Utils::hexStrToU64(a->second.c_str());
+		a = urlArgs.find("limit");
+		if (a != urlArgs.end())
+			limit = std::max(std::min((unsigned long)Utils::strToU64(a->second.c_str()),(unsigned long)ZT_NETCONF_CHANGE_FEED_MAX_LIMIT),1UL);
+		a = urlArgs.find("objects");
+		if (a != urlArgs.end())
+			objects = OSUtils::jsonBool(json(a->second),true);
+		a = urlArgs.find("raw");
+		if (a != urlArgs.end())
+			raw = OSUtils::jsonBool(json(a->second),false);
+
+		std::vector<JSONDB::Change> changes;
+		uint64_t through = 0;
+		const bool reset = !_db.changesSince(since,epoch,limit,changes,through);
+
+		const uint64_t now = OSUtils::now();
+		char tmp[128];
+		json r(json::object());
+		r["epoch"] = Utils::hex((uint64_t)_db.feedEpoch(),tmp);
+		r["revision"] = through;
+		r["reset"] = reset;
+		json &cl = r["changes"];
+		cl = json::array();
+		for(std::vector<JSONDB::Change>::const_iterator c(changes.begin());c!=changes.end();++c) {
+			json cj(json::object());
+			cj["revision"] = c->revision;
+			cj["nwid"] = Utils::hex((uint64_t)c->networkId,tmp);
+			if (c->memberId) {
+				cj["objtype"] = "member";
+				cj["id"] = Utils::hex10(c->memberId,tmp);
+			} else {
+				cj["objtype"] = "network";
+			}
+			cj["deleted"] = c->erased;
+			if ((objects)&&(!c->erased)) {
+				// Objects are read as they are now, so a change may show a later state than its revision
+				json o;
+				if (c->memberId) {
+					if (_db.getNetworkMember(c->networkId,c->memberId,o)) {
+						if (!raw)
+							_addMemberNonPersistedFields(c->networkId,c->memberId,o,now);
+						cj["object"] = o;
+					} else cj["deleted"] = true;
+				} else {
+					if (_db.getNetwork(c->networkId,o)) {
+						if (!raw) {
+							JSONDB::NetworkSummaryInfo ns;
+							_db.getNetworkSummaryInfo(c->networkId,ns);
+							_addNetworkNonPersistedFields(o,now,ns);
+						}
+						cj["object"] = o;
+					} else cj["deleted"] = true;
+				}
+			}
+			cl.push_back(cj);
+		}
+
+		responseBody = OSUtils::jsonDump(r);
+		responseContentType = "application/json";
+		return 200;
+
 	} else {
 		// Controller status
 
+		const uint64_t now = OSUtils::now();
+		unsigned long pushQueueDepth,pushWindow;
+		uint64_t pushesSent,pushDrainRate = 0;
+		{
+			Mutex::Lock _l(_push_m);
+			pushQueueDepth = (unsigned long)_pushQueue.size();
+			pushWindow = _pushWindow;
+			pushesSent = _pushesSent;
+			// Planned rate in pushes per second to empty the queue by its deadline
+			if (pushQueueDepth > 0)
+				pushDrainRate = (_pushDeadline > now) ? (((uint64_t)pushQueueDepth * 1000ULL) / (_pushDeadline - now)) : (uint64_t)pushQueueDepth;
+		}
+
+		JSONDB::PersistenceStats ps;
+		_db.persistenceStats(ps);
+		uint64_t lockWaits,lockWaitNs;
+		_db.lockWaits(lockWaits,lockWaitNs);
+
+		unsigned long revocationFanouts,revocationRecipientsPending = 0;
+		uint64_t revocationRecipientsSent;
+		{
+			Mutex::Lock _l(_revocations_m);
+			revocationFanouts = (unsigned long)_revocationFanouts.size();
+			for(std::list<_RevocationFanout>::const_iterator f(_revocationFanouts.begin());f!=_revocationFanouts.end();++f)
+				revocationRecipientsPending += (unsigned long)f->recipients.size() - f->next;
+			revocationRecipientsSent = _revocationRecipientsSent;
+		}
+
 		char tmp[4096];
-		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu\n}\n",ZT_NETCONF_CONTROLLER_API_VERSION,(unsigned long long)OSUtils::now());
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"replica\": %s,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu,\n\t\"pushQueueDepth\": %lu,\n\t\"pushDrainRate\": %llu,\n\t\"pushWindow\": %lu,\n\t\"pushesSent\": %llu,\n\t\"dbBacklog\": %lu,\n\t\"dbOldestPendingAge\": %llu,\n\t\"dbWrites\": %llu,\n\t\"dbWritesCoalesced\": %llu,\n\t\"dbWriteFailures\": %llu,\n\t\"dbWriteLatency\": %llu,\n\t\"dbLockWaits\": %llu,\n\t\"dbLockWaitTime\": %llu,\n\t\"tracesReceived\": %llu,\n\t\"tracesSampledOut\": %llu,\n\t\"tracesDropped\": %llu,\n\t\"tracesWritten\": %llu,\n\t\"revocationFanouts\": %lu,\n\t\"revocationRecipientsPending\": %lu,\n\t\"revocationRecipientsSent\": %llu,\n\t\"configsCompressed\": %llu,\n\t\"configBytesSaved\": %llu\n}\n",
+			(_db.replica()) ? "true" : "false",
+			ZT_NETCONF_CONTROLLER_API_VERSION,
+			(unsigned long long)now,
+			pushQueueDepth,
+			(unsigned long long)pushDrainRate,
+			pushWindow,
+			(unsigned long long)pushesSent,
+			ps.backlog,
+			(unsigned long long)ps.oldestPendingAge,
+			(unsigned long long)ps.writes,
+			(unsigned long long)ps.coalesced,
+			(unsigned long long)ps.failures,
+			(unsigned long long)ps.latency,
+			(unsigned long long)lockWaits,
+			(unsigned long long)(lockWaitNs / 1000000ULL),
+			(unsigned long long)_tracesReceived,
+			(unsigned long long)_tracesSampledOut,
+			(unsigned long long)_tracesDropped,
+			(unsigned long long)_tracesWritten,
+			revocationFanouts,
+			revocationRecipientsPending,
+			(unsigned long long)revocationRecipientsSent,
+			(unsigned long long)_configsCompressed,
+			(unsigned long long)_configBytesSaved);
 		responseBody = tmp;
 		responseContentType = "application/json";
 		return 200;
@@ -601,7 +837,47 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 	}
 	const uint64_t now = OSUtils::now();
 
-	if (path[0] == "network") {
+	if ((path[0] == "db")&&(path.size() >= 3)&&(path[1] == "network")&&(path[2].length() == 16)) {
+		// Writes from replicas, stored as they are
+		const uint64_t nwid = Utils::hexStrToU64(path[2].c_str());
+		char tmp[64];
+		if (path.size() == 3) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+			if ((OSUtils::jsonString(b["objtype"],"") != "network")||(OSUtils::jsonString(b["id"],"") != tmp))
+				return 400;
+			json network;
+			_db.getNetwork(nwid,network);
+			if (b != network) {
+				_db.saveNetwork(nwid,b);
+				if (OSUtils::jsonInt(b["revision"],0ULL) != OSUtils::jsonInt(network["revision"],0ULL))
+					_schedulePushes(nwid,now);
+			}
+		} else if ((path.size() == 5)&&(path[3] == "member")&&(path[4].length() == 10)) {
+			const uint64_t address = Utils::hexStrToU64(path[4].c_str());
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)address);
+			if ((OSUtils::jsonString(b["objtype"],"") != "member")||(OSUtils::jsonString(b["id"],"") != tmp))
+				return 400;
+			json member;
+			_db.getNetworkMember(nwid,address,member);
+			if (b != member) {
+				_db.saveNetworkMember(nwid,address,b);
+				if (OSUtils::jsonInt(b["revision"],0ULL) != OSUtils::jsonInt(member["revision"],0ULL)) {
+					// Edited through a replica's API, so push to the member if it's talking to us
+					try {
+						_MemberStatusShard &sh = _memberStatusShard(nwid);
+						Mutex::Lock _l(sh.lock);
+						_MemberStatus &ms = sh.networks[nwid][address];
+						if ((ms.online(now))&&(ms.lastRequestMetaData))
+							request(nwid,InetAddress(),0,ms.identity,ms.lastRequestMetaData);
+					} catch ( ... ) {}
+				}
+			}
+		} else return 404;
+		responseBody = "{}";
+		responseContentType = "application/json";
+		return 200;
+
+	} else if (path[0] == "network") {
 
 		if ((path.size() >= 2)&&(path[1].length() == 16)) {
 			uint64_t nwid = Utils::hexStrToU64(path[1].c_str());
@@ -610,105 +886,107 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 
 			if (path.size() >= 3) {
 
-				if ((path.size() == 4)&&(path[2] == "member")&&(path[3].length() == 10)) {
-					uint64_t address = Utils::hexStrToU64(path[3].c_str());
-					char addrs[24];
-					OSUtils::ztsnprintf(addrs,sizeof(addrs),"%.10llx",(unsigned long long)address);
-
-					json member;
-					_db.getNetworkMember(nwid,address,member);
-					json origMember(member); // for detecting changes
-					_initMember(member);
-
+				if ((path.size() == 3)&&(path[2] == "member")) {
+					// Bulk member update: { "members": { "<address>": { ... }, ... } } or { "members": [ { "id": "<address>", ... }, ... ] }
+					std::vector< std::pair< uint64_t,json > > changes;
 					try {
-						if (b.count("activeBridge")) member["activeBridge"] = OSUtils::jsonBool(b["activeBridge"],false);
-						if (b.count("noAutoAssignIps")) member["noAutoAssignIps"] = OSUtils::jsonBool(b["noAutoAssignIps"],false);
-
-						if (b.count("remoteTraceTarget")) {
-							const std::string rtt(OSUtils::jsonString(b["remoteTraceTarget"],""));
-							if (rtt.length() == 10) {
-								member["remoteTraceTarget"] = rtt;
-							} else {
-								member["remoteTraceTarget"] = json();
+						json &ml = b["members"];
+						if (ml.is_object()) {
+							for(json::iterator m(ml.begin());m!=ml.end();++m) {
+								if ((m.key().length() == 10)&&(m.value().is_object()))
+									changes.push_back(std::pair< uint64_t,json >(Utils::hexStrToU64(m.key().c_str()),m.value()));
 							}
-						}
-
-						if (b.count("authorized")) {
-							const bool newAuth = OSUtils::jsonBool(b["authorized"],false);
-							if (newAuth != OSUtils::jsonBool(member["authorized"],false)) {
-								member["authorized"] = newAuth;
-								member[((newAuth) ? "lastAuthorizedTime" : "lastDeauthorizedTime")] = now;
-
-								json ah;
-								ah["a"] = newAuth;
-								ah["by"] = "api";
-								ah["ts"] = now;
-								ah["ct"] = json();
-								ah["c"] = json();
-								member["authHistory"].push_back(ah);
-
-								// Member is being de-authorized, so spray Revocation objects to all online members
-								if (!newAuth) {
-									Revocation rev((uint32_t)_node->prng(),nwid,0,now,ZT_REVOCATION_FLAG_FAST_PROPAGATE,Address(address),Revocation::CREDENTIAL_TYPE_COM);
-									rev.sign(_signingId);
-
-									Mutex::Lock _l(_memberStatus_m);
-									for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-										if ((i->first.networkId == nwid)&&(i->second.online(now)))
-											_node->ncSendRevocation(Address(i->first.nodeId),rev);
-									}
+						} else if (ml.is_array()) {
+							for(unsigned long i=0;i<ml.size();++i) {
+								if (ml[i].is_object()) {
+									const std::string id(OSUtils::jsonString(ml[i]["id"],OSUtils::jsonString(ml[i]["address"],"").c_str()));
+									if (id.length() == 10)
+										changes.push_back(std::pair< uint64_t,json >(Utils::hexStrToU64(id.c_str()),ml[i]));
 								}
 							}
+						} else {
+							responseBody = "{ \"message\": \"members must be an object or an array\" }";
+							responseContentType = "application/json";
+							return 400;
 						}
+					} catch ( ... ) {
+						responseBody = "{ \"message\": \"exception while processing parameters in JSON body\" }";
+						responseContentType = "application/json";
+						return 400;
+					}
 
-						if (b.count("ipAssignments")) {
-							json &ipa = b["ipAssignments"];
-							if (ipa.is_array()) {
-								json mipa(json::array());
-								for(unsigned long i=0;i<ipa.size();++i) {
-									std::string ips = ipa[i];
-									InetAddress ip(ips.c_str());
-									if ((ip.ss_family == AF_INET)||(ip.ss_family == AF_INET6)) {
-										char tmpip[64];
-										mipa.push_back(ip.toIpString(tmpip));
-									}
-								}
-								member["ipAssignments"] = mipa;
-							}
+					std::unordered_set<uint64_t> seen;
+					for(std::vector< std::pair< uint64_t,json > >::iterator c(changes.begin());c!=changes.end();++c) {
+						if (!seen.insert(c->first).second) {
+							responseBody = "{ \"message\": \"member listed more than once\" }";
+							responseContentType = "application/json";
+							return 400;
 						}
+					}
 
-						if (b.count("tags")) {
-							json &tags = b["tags"];
-							if (tags.is_array()) {
-								std::map<uint64_t,uint64_t> mtags;
-								for(unsigned long i=0;i<tags.size();++i) {
-									json &tag = tags[i];
-									if ((tag.is_array())&&(tag.size() == 2))
-										mtags[OSUtils::jsonInt(tag[0],0ULL) & 0xffffffffULL] = OSUtils::jsonInt(tag[1],0ULL) & 0xffffffffULL;
-								}
-								json mtagsa = json::array();
-								for(std::map<uint64_t,uint64_t>::iterator t(mtags.begin());t!=mtags.end();++t) {
-									json ta = json::array();
-									ta.push_back(t->first);
-									ta.push_back(t->second);
-									mtagsa.push_back(ta);
-								}
-								member["tags"] = mtagsa;
-							}
+					std::vector< std::pair< uint64_t,json > > changed;
+					std::unordered_set<uint64_t> changedIds;
+					std::vector<uint64_t> deauthorized;
+					json results(json::object());
+					for(std::vector< std::pair< uint64_t,json > >::iterator c(changes.begin());c!=changes.end();++c) {
+						char addrs[24];
+						OSUtils::ztsnprintf(addrs,sizeof(addrs),"%.10llx",(unsigned long long)c->first);
+
+						json member;
+						_db.getNetworkMember(nwid,c->first,member);
+						json origMember(member);
+						_initMember(member);
+
+						try {
+							if (_applyMemberChanges(c->second,member,now))
+								deauthorized.push_back(c->first);
+						} catch ( ... ) {
+							responseBody = "{ \"message\": \"exception while processing parameters for member ";
+							responseBody.append(addrs);
+							responseBody.append("\" }");
+							responseContentType = "application/json";
+							return 400;
 						}
 
-						if (b.count("capabilities")) {
-							json &capabilities = b["capabilities"];
-							if (capabilities.is_array()) {
-								json mcaps = json::array();
-								for(unsigned long i=0;i<capabilities.size();++i) {
-									mcaps.push_back(OSUtils::jsonInt(capabilities[i],0ULL));
-								}
-								std::sort(mcaps.begin(),mcaps.end());
-								mcaps.erase(std::unique(mcaps.begin(),mcaps.end()),mcaps.end());
-								member["capabilities"] = mcaps;
-							}
+						member["id"] = addrs;
+						member["address"] = addrs; // legacy
+						member["nwid"] = nwids;
+
+						_removeMemberNonPersistedFields(member);
+						if (member != origMember) {
+							json &revj = member["revision"];
+							member["revision"] = (revj.is_number() ? ((uint64_t)revj + 1ULL) : 1ULL);
+							changed.push_back(std::pair< uint64_t,json >(c->first,member));
+							changedIds.insert(c->first);
 						}
+						results[addrs] = member["revision"];
+					}
+
+					// Members are only saved once all changes have parsed, then get one push wave
+					_db.saveNetworkMembers(nwid,changed);
+					_queueRevocations(nwid,deauthorized,now);
+					if (!changedIds.empty())
+						_schedulePushes(nwid,now,&changedIds);
+
+					responseBody = OSUtils::jsonDump(results);
+					responseContentType = "application/json";
+
+					return 200;
+				}
+
+				if ((path.size() == 4)&&(path[2] == "member")&&(path[3].length() == 10)) {
+					uint64_t address = Utils::hexStrToU64(path[3].c_str());
+					char addrs[24];
+					OSUtils::ztsnprintf(addrs,sizeof(addrs),"%.10llx",(unsigned long long)address);
+
+					json member;
+					_db.getNetworkMember(nwid,address,member);
+					json origMember(member); // for detecting changes
+					_initMember(member);
+
+					try {
+						if (_applyMemberChanges(b,member,now))
+							_queueRevocations(nwid,std::vector<uint64_t>(1,address),now);
 					} catch ( ... ) {
 						responseBody = "{ \"message\": \"exception while processing parameters in JSON body\" }";
 						responseContentType = "application/json";
@@ -727,8 +1005,9 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 
 						// Push update to member if online
 						try {
-							Mutex::Lock _l(_memberStatus_m);
-							_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,address)];
+							_MemberStatusShard &sh = _memberStatusShard(nwid);
+							Mutex::Lock _l(sh.lock);
+							_MemberStatus &ms = sh.networks[nwid][address];
 							if ((ms.online(now))&&(ms.lastRequestMetaData))
 								request(nwid,InetAddress(),0,ms.identity,ms.lastRequestMetaData);
 						} catch ( ... ) {}
@@ -773,7 +1052,14 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					if (b.count("private")) network["private"] = OSUtils::jsonBool(b["private"],true);
 					if (b.count("enableBroadcast")) network["enableBroadcast"] = OSUtils::jsonBool(b["enableBroadcast"],false);
 					if (b.count("allowPassiveBridging")) network["allowPassiveBridging"] = OSUtils::jsonBool(b["allowPassiveBridging"],false);
+					if (b.count("compression")) {
+						const std::string comp(OSUtils::jsonString(b["compression"],"lz4"));
+						if ((comp == "lz4")||(comp == "zstd")||(comp == "none"))
+							network["compression"] = comp;
+					}
 					if (b.count("multicastLimit")) network["multicastLimit"] = OSUtils::jsonInt(b["multicastLimit"],32ULL);
+					if (b.count("memberRateLimit")) network["memberRateLimit"] = OSUtils::jsonInt(b["memberRateLimit"],0ULL);
+					if (b.count("memberRateBurst")) network["memberRateBurst"] = OSUtils::jsonInt(b["memberRateBurst"],0ULL);
 					if (b.count("mtu")) network["mtu"] = std::max(std::min((unsigned int)OSUtils::jsonInt(b["mtu"],ZT_DEFAULT_MTU),(unsigned int)ZT_MAX_MTU),(unsigned int)ZT_MIN_MTU);
 
 					if (b.count("remoteTraceTarget")) {
@@ -856,6 +1142,37 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 						}
 					}
 
+					if (b.count("authOnlyPaths")) {
+						json &aps = b["authOnlyPaths"];
+						if (aps.is_array()) {
+							json naps = json::array();
+							for(unsigned long i=0;i<aps.size();++i) {
+								if (aps[i].is_string()) {
+									InetAddress t(aps[i].get<std::string>().c_str());
+									if ( ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6)) && (t.netmaskBitsValid()) ) {
+										char tmp2[64];
+										naps.push_back(t.toString(tmp2));
+									}
+								}
+							}
+							network["authOnlyPaths"] = naps;
+						}
+					}
+
+					if (b.count("multicastGroupKey")) network["multicastGroupKey"] = OSUtils::jsonBool(b["multicastGroupKey"],false);
+					if (OSUtils::jsonBool(network["multicastGroupKey"],false)) {
+						// The key is made here and kept until turned off or rotated, e.g. after deauthorizing a member
+						if ((OSUtils::jsonString(network["multicastKey"],"").length() != (ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH * 2))||(OSUtils::jsonBool(b["rotateMulticastKey"],false))) {
+							uint8_t mk[ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH];
+							char mkh[(ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH * 2) + 1];
+							Utils::getSecureRandom(mk,sizeof(mk));
+							network["multicastKey"] = Utils::hex(mk,sizeof(mk),mkh);
+							Utils::burn(mk,sizeof(mk));
+						}
+					} else {
+						network.erase("multicastKey");
+					}
+
 					if (b.count("ipAssignmentPools")) {
 						json &ipp = b["ipAssignmentPools"];
 						if (ipp.is_array()) {
@@ -992,12 +1309,8 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					network["revision"] = (revj.is_number() ? ((uint64_t)revj + 1ULL) : 1ULL);
 					_db.saveNetwork(nwid,network);
 
-					// Send an update to all members of the network that are online
-					Mutex::Lock _l(_memberStatus_m);
-					for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-						if ((i->first.networkId == nwid)&&(i->second.online(now))&&(i->second.lastRequestMetaData))
-							request(nwid,InetAddress(),0,i->second.identity,i->second.lastRequestMetaData);
-					}
+					// Send an update to all members of the network that are online, spread out over time
+					_schedulePushes(nwid,now);
 				}
 
 				JSONDB::NetworkSummaryInfo ns;
@@ -1027,6 +1340,9 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 	if (path.empty())
 		return 404;
 
+	if ((path[0] == "db")&&(path.size() > 1)) // deletes from replicas are the same as any other
+		return handleControlPlaneHttpDELETE(std::vector<std::string>(path.begin() + 1,path.end()),urlArgs,headers,body,responseBody,responseContentType);
+
 	if (path[0] == "network") {
 		if ((path.size() >= 2)&&(path[1].length() == 16)) {
 			const uint64_t nwid = Utils::hexStrToU64(path[1].c_str());
@@ -1037,8 +1353,14 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 					json member = _db.eraseNetworkMember(nwid,address);
 
 					{
-						Mutex::Lock _l(_memberStatus_m);
-						_memberStatus.erase(_MemberStatusKey(nwid,address));
+						_MemberStatusShard &sh = _memberStatusShard(nwid);
+						Mutex::Lock _l(sh.lock);
+						const auto n = sh.networks.find(nwid);
+						if (n != sh.networks.end()) {
+							n->second.erase(address);
+							if (n->second.empty())
+								sh.networks.erase(n);
+						}
 					}
 
 					if (!member.size())
@@ -1051,12 +1373,9 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 				json network = _db.eraseNetwork(nwid);
 
 				{
-					Mutex::Lock _l(_memberStatus_m);
-					for(auto i=_memberStatus.begin();i!=_memberStatus.end();) {
-						if (i->first.networkId == nwid)
-							_memberStatus.erase(i++);
-						else ++i;
-					}
+					_MemberStatusShard &sh = _memberStatusShard(nwid);
+					Mutex::Lock _l(sh.lock);
+					sh.networks.erase(nwid);
 				}
 
 				if (!network.size())
@@ -1074,118 +1393,187 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 
 void EmbeddedNetworkController::handleRemoteTrace(const ZT_RemoteTrace &rt)
 {
-	static volatile unsigned long idCounter = 0;
-	char id[128],tmp[128];
-	std::string k,v;
+	const uint64_t n = ++_tracesReceived;
+	const unsigned long sampleRate = _traceSampleRate;
+	if ((sampleRate == 0)||((n % sampleRate) != 0)) {
+		++_tracesSampledOut;
+		return;
+	}
 
-	try {
-		std::vector<uint64_t> nw4m(_db.networksForMember(rt.origin));
+	std::lock_guard<std::mutex> l(_traces_m);
+	if (!_traceRun)
+		return;
+	if (_traces.size() >= ZT_NETCONF_TRACE_QUEUE_MAX) {
+		++_tracesDropped;
+		return;
+	}
+	_traces.push_back(_PendingTrace());
+	_PendingTrace &t = _traces.back();
+	t.origin = rt.origin;
+	t.receivedAt = OSUtils::now();
+	t.data.assign(rt.data,strnlen(rt.data,rt.len));
+	if (!_traceWriter.joinable())
+		_traceWriter = std::thread([this]() { this->_traceWriterMain(); });
+	else if (_traces.size() >= ZT_NETCONF_TRACE_BATCH)
+		_traces_c.notify_one();
+}
 
-		// Ignore remote traces from members we don't know about
-		if (nw4m.empty())
-			return;
+void EmbeddedNetworkController::_traceWriterMain()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_CONTROLLER);
 
-		// Convert Dictionary into JSON object
-		json d;
-		char *saveptr = (char *)0;
-		for(char *l=Utils::stok(rt.data,"\n",&saveptr);(l);l=Utils::stok((char *)0,"\n",&saveptr)) {
-			char *eq = strchr(l,'=');
-			if (eq > l) {
-				k.assign(l,(unsigned long)(eq - l));
-				v.clear();
-				++eq;
-				while (*eq) {
-					if (*eq == '\\') {
+	unsigned long idCounter = 0;
+	char id[128],tmp[128],p[128];
+	std::string k,v;
+	std::deque<_PendingTrace> batch;
+	std::vector< std::pair<std::string,std::string> > objs;
+
+	std::unique_lock<std::mutex> tl(_traces_m);
+	for(;;) {
+		if ((_traceRun)&&(_traces.size() < ZT_NETCONF_TRACE_BATCH))
+			_traces_c.wait_for(tl,std::chrono::milliseconds(ZT_NETCONF_TRACE_FLUSH_INTERVAL));
+		const bool run = _traceRun;
+		batch.swap(_traces);
+		tl.unlock();
+
+		for(std::deque<_PendingTrace>::iterator t(batch.begin());t!=batch.end();++t) {
+			try {
+				std::vector<uint64_t> nw4m(_db.networksForMember(t->origin));
+
+				// Ignore remote traces from members we don't know about
+				if ((nw4m.empty())||(t->data.empty()))
+					continue;
+
+				// Convert Dictionary into JSON object
+				json d;
+				char *saveptr = (char *)0;
+				for(char *l=Utils::stok(&(t->data[0]),"\n",&saveptr);(l);l=Utils::stok((char *)0,"\n",&saveptr)) {
+					char *eq = strchr(l,'=');
+					if (eq > l) {
+						k.assign(l,(unsigned long)(eq - l));
+						v.clear();
 						++eq;
-						if (*eq) {
-							switch(*eq) {
-								case 'r': v.push_back('\r'); break;
-								case 'n': v.push_back('\n'); break;
-								case '0': v.push_back((char)0); break;
-								case 'e': v.push_back('='); break;
-								default: v.push_back(*eq); break;
+						while (*eq) {
+							if (*eq == '\\') {
+								++eq;
+								if (*eq) {
+									switch(*eq) {
+										case 'r': v.push_back('\r'); break;
+										case 'n': v.push_back('\n'); break;
+										case '0': v.push_back((char)0); break;
+										case 'e': v.push_back('='); break;
+										default: v.push_back(*eq); break;
+									}
+									++eq;
+								}
+							} else {
+								v.push_back(*(eq++));
 							}
-							++eq;
 						}
-					} else {
-						v.push_back(*(eq++));
+						if ((k.length() > 0)&&(v.length() > 0))
+							d[k] = v;
 					}
 				}
-				if ((k.length() > 0)&&(v.length() > 0))
-					d[k] = v;
-			}
-		}
 
-		const uint64_t now = OSUtils::now();
-		OSUtils::ztsnprintf(id,sizeof(id),"%.10llx-%.10llx-%.16llx-%.8lx",_signingId.address().toInt(),rt.origin,now,++idCounter);
-		d["id"] = id;
-		d["objtype"] = "trace";
-		d["ts"] = now;
-		d["nodeId"] = Utils::hex10(rt.origin,tmp);
-
-		bool accept = true;
-		/*
-		for(std::vector<uint64_t>::const_iterator nwid(nw4m.begin());nwid!=nw4m.end();++nwid) {
-			json nconf;
-			if (_db.getNetwork(*nwid,nconf)) {
-				try {
-					if (OSUtils::jsonString(nconf["remoteTraceTarget"],"") == _signingIdAddressString) {
-						accept = true;
-						break;
+				OSUtils::ztsnprintf(id,sizeof(id),"%.10llx-%.10llx-%.16llx-%.8lx",_signingId.address().toInt(),t->origin,t->receivedAt,++idCounter);
+				d["id"] = id;
+				d["objtype"] = "trace";
+				d["ts"] = t->receivedAt;
+				d["nodeId"] = Utils::hex10(t->origin,tmp);
+
+				bool accept = true;
+				/*
+				for(std::vector<uint64_t>::const_iterator nwid(nw4m.begin());nwid!=nw4m.end();++nwid) {
+					json nconf;
+					if (_db.getNetwork(*nwid,nconf)) {
+						try {
+							if (OSUtils::jsonString(nconf["remoteTraceTarget"],"") == _signingIdAddressString) {
+								accept = true;
+								break;
+							}
+						} catch ( ... ) {} // ignore missing fields or other errors, drop trace message
 					}
-				} catch ( ... ) {} // ignore missing fields or other errors, drop trace message
-			}
-			if (_db.getNetworkMember(*nwid,rt.origin,nconf)) {
-				try {
-					if (OSUtils::jsonString(nconf["remoteTraceTarget"],"") == _signingIdAddressString) {
-						accept = true;
-						break;
+					if (_db.getNetworkMember(*nwid,t->origin,nconf)) {
+						try {
+							if (OSUtils::jsonString(nconf["remoteTraceTarget"],"") == _signingIdAddressString) {
+								accept = true;
+								break;
+							}
+						} catch ( ... ) {} // ignore missing fields or other errors, drop trace message
 					}
-				} catch ( ... ) {} // ignore missing fields or other errors, drop trace message
+				}
+				*/
+				if (accept) {
+					OSUtils::ztsnprintf(p,sizeof(p),"trace/%s",id);
+					objs.push_back(std::pair<std::string,std::string>(std::string(p),OSUtils::jsonDump(d,-1)));
+				}
+			} catch ( ... ) {
+				// drop invalid trace messages if an error occurs
 			}
 		}
-		*/
-		if (accept) {
-			char p[128];
-			OSUtils::ztsnprintf(p,sizeof(p),"trace/%s",id);
-			_db.writeRaw(p,OSUtils::jsonDump(d,-1));
+		batch.clear();
+
+		if (!objs.empty()) {
+			_tracesWritten += (uint64_t)_db.writeRawBatch(objs);
+			objs.clear();
 		}
-	} catch ( ... ) {
-		// drop invalid trace messages if an error occurs
+
+		if (!run)
+			return;
+		tl.lock();
 	}
 }
 
 void EmbeddedNetworkController::threadMain()
 	throw()
 {
+	CpuAffinity::apply(CpuAffinity::THREAD_CONTROLLER);
+
 	char tmp[256];
+	uint64_t qnwid = 0;
 	_RQEntry *qe = (_RQEntry *)0;
 	while (_running) {
-		const BlockingQueue<_RQEntry *>::TimedWaitResult wr = _queue.get(qe,1000);
-		if ((wr == BlockingQueue<_RQEntry *>::STOP)||(!_running))
+		const FairQueue<uint64_t,_RQEntry *>::TimedWaitResult wr = _queue.get(qnwid,qe,ZT_NETCONF_PUSH_DRAIN_INTERVAL);
+		if ((wr == FairQueue<uint64_t,_RQEntry *>::STOP)||(!_running))
 			break;
 
+		if (wr == FairQueue<uint64_t,_RQEntry *>::OK) {
+			try {
+				if (qe->type == _RQEntry::RQENTRY_TYPE_REQUEST)
+					_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData);
+			} catch ( ... ) {}
+			delete qe;
+			_queue.done(qnwid);
+		}
+
 		try {
-			if ((wr == BlockingQueue<_RQEntry *>::OK)&&(qe->type == _RQEntry::RQENTRY_TYPE_REQUEST)) {
-				_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData);
-				delete qe;
-			}
 
-			// Every 10s we update a 'status' containing member online state, etc.
 			const uint64_t now = OSUtils::now();
+			_drainPushes(now);
+			_drainRevocations();
+
+			// Every 10s we update a 'status' containing member online state, etc.
 			if ((now - _lastDumpedStatus) >= 10000) {
 				_lastDumpedStatus = now;
 				bool first = true;
 				OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\"id\":\"%.10llx-status\",\"objtype\":\"status\",\"memberStatus\":[",_signingId.address().toInt());
 				std::string st(tmp);
 				{
-					Mutex::Lock _l(_memberStatus_m);
-					st.reserve(48 * (_memberStatus.size() + 1));
-					_db.eachId([this,&st,&now,&first,&tmp](uint64_t networkId,uint64_t nodeId) {
+					// Copy out request times a shard at a time rather than holding them all during the walk
+					std::unordered_map< _MemberStatusKey,uint64_t,_MemberStatusHash > lastRequestTimes;
+					for(unsigned int s=0;s<ZT_NETCONF_MEMBER_STATUS_SHARDS;++s) {
+						Mutex::Lock _l(_memberStatus[s].lock);
+						for(auto n=_memberStatus[s].networks.begin();n!=_memberStatus[s].networks.end();++n) {
+							for(auto m=n->second.begin();m!=n->second.end();++m)
+								lastRequestTimes[_MemberStatusKey(n->first,m->first)] = m->second.lastRequestTime;
+						}
+					}
+					st.reserve(48 * (lastRequestTimes.size() + 1));
+					_db.eachId([&lastRequestTimes,&st,&first,&tmp](uint64_t networkId,uint64_t nodeId) {
 						uint64_t lrt = 0ULL;
-						auto ms = this->_memberStatus.find(_MemberStatusKey(networkId,nodeId));
-						if (ms != _memberStatus.end())
-							lrt = ms->second.lastRequestTime;
+						auto ms = lastRequestTimes.find(_MemberStatusKey(networkId,nodeId));
+						if (ms != lastRequestTimes.end())
+							lrt = ms->second;
 						OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s\"%.16llx\",\"%.10llx\",%llu",
 							(first) ? "" : ",",
 							(unsigned long long)networkId,
@@ -1203,6 +1591,360 @@ void EmbeddedNetworkController::threadMain()
 	}
 }
 
+bool EmbeddedNetworkController::_applyMemberChanges(json &b,json &member,const uint64_t now)
+{
+	bool deauthorized = false;
+	if (b.count("activeBridge")) member["activeBridge"] = OSUtils::jsonBool(b["activeBridge"],false);
+	if (b.count("multicastReplicator")) member["multicastReplicator"] = OSUtils::jsonBool(b["multicastReplicator"],false);
+	if (b.count("relay")) member["relay"] = OSUtils::jsonBool(b["relay"],false);
+	if (b.count("noAutoAssignIps")) member["noAutoAssignIps"] = OSUtils::jsonBool(b["noAutoAssignIps"],false);
+
+	if (b.count("remoteTraceTarget")) {
+		const std::string rtt(OSUtils::jsonString(b["remoteTraceTarget"],""));
+		if (rtt.length() == 10) {
+			member["remoteTraceTarget"] = rtt;
+		} else {
+			member["remoteTraceTarget"] = json();
+		}
+	}
+
+	if (b.count("authorized")) {
+		const bool newAuth = OSUtils::jsonBool(b["authorized"],false);
+		if (newAuth != OSUtils::jsonBool(member["authorized"],false)) {
+			member["authorized"] = newAuth;
+			member[((newAuth) ? "lastAuthorizedTime" : "lastDeauthorizedTime")] = now;
+
+			json ah;
+			ah["a"] = newAuth;
+			ah["by"] = "api";
+			ah["ts"] = now;
+			ah["ct"] = json();
+			ah["c"] = json();
+			member["authHistory"].push_back(ah);
+
+			if (!newAuth)
+				deauthorized = true;
+		}
+	}
+
+	if (b.count("ipAssignments")) {
+		json &ipa = b["ipAssignments"];
+		if (ipa.is_array()) {
+			json mipa(json::array());
+			for(unsigned long i=0;i<ipa.size();++i) {
+				std::string ips = ipa[i];
+				InetAddress ip(ips.c_str());
+				if ((ip.ss_family == AF_INET)||(ip.ss_family == AF_INET6)) {
+					char tmpip[64];
+					mipa.push_back(ip.toIpString(tmpip));
+				}
+			}
+			member["ipAssignments"] = mipa;
+		}
+	}
+
+	if (b.count("tags")) {
+		json &tags = b["tags"];
+		if (tags.is_array()) {
+			std::map<uint64_t,uint64_t> mtags;
+			for(unsigned long i=0;i<tags.size();++i) {
+				json &tag = tags[i];
+				if ((tag.is_array())&&(tag.size() == 2))
+					mtags[OSUtils::jsonInt(tag[0],0ULL) & 0xffffffffULL] = OSUtils::jsonInt(tag[1],0ULL) & 0xffffffffULL;
+			}
+			json mtagsa = json::array();
+			for(std::map<uint64_t,uint64_t>::iterator t(mtags.begin());t!=mtags.end();++t) {
+				json ta = json::array();
+				ta.push_back(t->first);
+				ta.push_back(t->second);
+				mtagsa.push_back(ta);
+			}
+			member["tags"] = mtagsa;
+		}
+	}
+
+	if (b.count("capabilities")) {
+		json &capabilities = b["capabilities"];
+		if (capabilities.is_array()) {
+			json mcaps = json::array();
+			for(unsigned long i=0;i<capabilities.size();++i) {
+				mcaps.push_back(OSUtils::jsonInt(capabilities[i],0ULL));
+			}
+			std::sort(mcaps.begin(),mcaps.end());
+			mcaps.erase(std::unique(mcaps.begin(),mcaps.end()),mcaps.end());
+			member["capabilities"] = mcaps;
+		}
+	}
+	return deauthorized;
+}
+
+void EmbeddedNetworkController::_queueRevocations(const uint64_t nwid,const std::vector<uint64_t> &deauthorized,const uint64_t now)
+{
+	if (deauthorized.empty())
+		return;
+
+	std::vector< std::pair<uint64_t,uint64_t> > online; // last request time, member
+	{
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		const auto n = sh.networks.find(nwid);
+		if (n != sh.networks.end()) {
+			for(auto i=n->second.begin();i!=n->second.end();++i) {
+				if (i->second.online(now))
+					online.push_back(std::pair<uint64_t,uint64_t>(i->second.lastRequestTime,i->first));
+			}
+		}
+	}
+	if (online.empty())
+		return;
+
+	// Revocations are flagged to fast propagate, so each member that gets one passes it on to the
+	// peers it's talking to. Sending to the most recently active first reaches those soonest.
+	std::sort(online.begin(),online.end(),[](const std::pair<uint64_t,uint64_t> &a,const std::pair<uint64_t,uint64_t> &b) { return (a.first > b.first); });
+
+	_RevocationFanout f;
+	f.networkId = nwid;
+	f.revocations.reserve(deauthorized.size());
+	for(std::vector<uint64_t>::const_iterator a(deauthorized.begin());a!=deauthorized.end();++a) {
+		f.revocations.emplace_back((uint32_t)_node->prng(),nwid,0,now,ZT_REVOCATION_FLAG_FAST_PROPAGATE,Address(*a),Revocation::CREDENTIAL_TYPE_COM);
+		f.revocations.back().sign(_signingId);
+	}
+	f.recipients.reserve(online.size());
+	for(auto m=online.begin();m!=online.end();++m)
+		f.recipients.push_back(m->second);
+	f.next = 0;
+
+	Mutex::Lock _l(_revocations_m);
+	_revocationFanouts.push_back(_RevocationFanout());
+	std::swap(_revocationFanouts.back(),f);
+}
+
+void EmbeddedNetworkController::_drainRevocations()
+{
+	std::vector<Revocation> revs;
+	std::vector<uint64_t> to;
+	{
+		Mutex::Lock _l(_revocations_m);
+		if (_revocationFanouts.empty())
+			return;
+		_RevocationFanout &f = _revocationFanouts.front();
+		revs = f.revocations;
+		const unsigned long end = std::min((unsigned long)f.recipients.size(),f.next + ZT_NETCONF_REVOCATION_FANOUT_BATCH);
+		to.assign(f.recipients.begin() + f.next,f.recipients.begin() + end);
+		f.next = end;
+		if (f.next >= (unsigned long)f.recipients.size())
+			_revocationFanouts.pop_front();
+		_revocationRecipientsSent += (uint64_t)to.size();
+	}
+
+	for(std::vector<uint64_t>::const_iterator a(to.begin());a!=to.end();++a)
+		_node->ncSendRevocations(Address(*a),revs.data(),(unsigned int)revs.size());
+}
+
+void EmbeddedNetworkController::_schedulePushes(const uint64_t nwid,const uint64_t now,const std::unordered_set<uint64_t> *only)
+{
+	std::vector< std::pair<uint64_t,_MemberStatusKey> > online; // last request time, member
+	{
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		const auto n = sh.networks.find(nwid);
+		if (n != sh.networks.end()) {
+			for(auto i=n->second.begin();i!=n->second.end();++i) {
+				if ((i->second.online(now))&&(i->second.lastRequestMetaData)&&((!only)||(only->count(i->first))))
+					online.push_back(std::pair<uint64_t,_MemberStatusKey>(i->second.lastRequestTime,_MemberStatusKey(nwid,i->first)));
+			}
+		}
+	}
+	if (online.empty())
+		return;
+
+	// Members heard from most recently are most likely to be actively using the network
+	std::sort(online.begin(),online.end(),[](const std::pair<uint64_t,_MemberStatusKey> &a,const std::pair<uint64_t,_MemberStatusKey> &b) { return (a.first > b.first); });
+
+	Mutex::Lock _l(_push_m);
+	if (_pushQueue.empty())
+		_lastPushDrain = now;
+	for(auto m=online.begin();m!=online.end();++m) {
+		if (_pushQueued.insert(m->second).second)
+			_pushQueue.push_back(m->second);
+	}
+	_pushDeadline = now + _pushWindow;
+}
+
+void EmbeddedNetworkController::_drainPushes(const uint64_t now)
+{
+	std::vector<_MemberStatusKey> due;
+	{
+		Mutex::Lock _l(_push_m);
+		if (_pushQueue.empty())
+			return;
+
+		// Send the share of what's left that this much elapsed time accounts for
+		const uint64_t elapsed = now - _lastPushDrain;
+		unsigned long n = (unsigned long)_pushQueue.size();
+		if (_pushDeadline > now)
+			n = (unsigned long)(((uint64_t)n * elapsed) / ((_pushDeadline - now) + elapsed));
+		if (!n)
+			return;
+		_lastPushDrain = now;
+
+		while ((n--)&&(!_pushQueue.empty())) {
+			due.push_back(_pushQueue.front());
+			_pushQueued.erase(_pushQueue.front());
+			_pushQueue.pop_front();
+		}
+		_pushesSent += (uint64_t)due.size();
+	}
+
+	for(auto k=due.begin();k!=due.end();++k) {
+		Identity identity;
+		Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+		{
+			_MemberStatusShard &sh = _memberStatusShard(k->networkId);
+			Mutex::Lock _l(sh.lock);
+			const auto n = sh.networks.find(k->networkId);
+			if (n == sh.networks.end())
+				continue;
+			const auto ms = n->second.find(k->nodeId);
+			if ((ms == n->second.end())||(!ms->second.online(now))||(!ms->second.lastRequestMetaData))
+				continue;
+			identity = ms->second.identity;
+			metaData = ms->second.lastRequestMetaData;
+		}
+		request(k->networkId,InetAddress(),0,identity,metaData);
+	}
+}
+
+bool EmbeddedNetworkController::_cachedConfig(
+	const uint64_t nwid,
+	const uint64_t nodeId,
+	const uint64_t networkRevision,
+	const uint64_t memberRevision,
+	const JSONDB::NetworkSummaryInfo &ns,
+	const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,
+	const uint64_t now,
+	_ConfigKey &ck,
+	std::string &dict,
+	std::string &base,
+	std::string &bin)
+{
+	uint64_t credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+	if (now > ns.mostRecentDeauthTime) {
+		// If we recently de-authorized a member, shrink credential TTL/max delta to
+		// be below the threshold required to exclude it. Cap this to a min/max to
+		// prevent jitter or absurdly large values.
+		const uint64_t deauthWindow = now - ns.mostRecentDeauthTime;
+		if (deauthWindow < ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA) {
+			credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA;
+		} else if (deauthWindow < (ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA + 5000ULL)) {
+			credentialtmd = deauthWindow - 5000ULL;
+		}
+	}
+	ck.credentialTimeMaxDelta = credentialtmd;
+
+	// Unchanged members re-request often, so resend the last signed config if
+	// nothing it was built from has changed and its credentials are still fresh
+	// enough to agree with everyone else's. Credentials issued before the most
+	// recent deauthorization are never reused since they must exclude that member.
+	ck.rulesEngineRev = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0);
+	ck.legacy = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	uint64_t specialistsHash = 0;
+	for(std::vector<Address>::const_iterator ab(ns.activeBridges.begin());ab!=ns.activeBridges.end();++ab)
+		specialistsHash = (specialistsHash * 31ULL) + ab->toInt();
+	specialistsHash = (specialistsHash * 31ULL) + 1ULL;
+	for(std::vector<Address>::const_iterator mr(ns.multicastReplicators.begin());mr!=ns.multicastReplicators.end();++mr)
+		specialistsHash = (specialistsHash * 31ULL) + mr->toInt();
+	specialistsHash = (specialistsHash * 31ULL) + 2ULL;
+	for(std::vector<Address>::const_iterator rl(ns.relays.begin());rl!=ns.relays.end();++rl)
+		specialistsHash = (specialistsHash * 31ULL) + rl->toInt();
+	ck.specialistsHash = specialistsHash;
+
+	// Members that advertise the hash of the config they hold can be sent a delta against it
+	const uint64_t haveBase = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_CONFIG_BASE,0);
+	// Members that can decode binary configs can be sent one if it's smaller
+	ck.binary = ((!ck.legacy)&&(metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY_VERSION,0) >= ZT_NETWORKCONFIG_BINARY_VERSION));
+	// Members that can decompress configs get big ones compressed before they're split into chunks
+	ck.compress = ((!ck.legacy)&&((metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_COMPRESSION,0) & ZT_NETWORKCONFIG_COMPRESSION_LZ4) != 0));
+
+	_MemberStatusShard &sh = _memberStatusShard(nwid);
+	Mutex::Lock _l(sh.lock);
+	const _CachedConfig &cc = sh.networks[nwid][nodeId].config;
+	if ((haveBase)&&(!ck.legacy)&&(cc.dict.length() > 0)&&(cc.dictHash == haveBase))
+		base = cc.dict;
+	if ( (cc.dict.length() > 0) &&
+	     (cc.networkRevision == networkRevision) &&
+	     (cc.memberRevision == memberRevision) &&
+	     (cc.credentialTimeMaxDelta == credentialtmd) &&
+	     (cc.specialistsHash == specialistsHash) &&
+	     (cc.rulesEngineRev == ck.rulesEngineRev) &&
+	     (cc.legacy == ck.legacy) &&
+	     (cc.timestamp > ns.mostRecentDeauthTime) &&
+	     ((now - cc.timestamp) < (credentialtmd / ZT_NETCONF_CONFIG_CACHE_MAX_AGE_DIVISOR)) ) {
+		dict = cc.dict;
+		if (ck.binary)
+			bin = cc.bin;
+		return true;
+	}
+	return false;
+}
+
+bool EmbeddedNetworkController::_requestFromCache(
+	uint64_t nwid,
+	const InetAddress &fromAddr,
+	uint64_t requestPacketId,
+	const Identity &identity,
+	const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,
+	const uint64_t now)
+{
+	const uint64_t nodeId = identity.address().toInt();
+	uint64_t networkRevision = 0;
+	JSONDB::MemberRecord mr;
+	JSONDB::NetworkSummaryInfo ns;
+	if ((_db.getNetworkAndMemberRecord(nwid,nodeId,networkRevision,mr,ns) != 3)||(!mr.authorized))
+		return false;
+
+	// The same checks and updates as _request(), which must leave the member unchanged for this to apply
+	{
+		char idtmp[1024];
+		if (mr.identity != identity.toString(false,idtmp))
+			return false;
+	}
+	const uint64_t vMajor = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MAJOR_VERSION,0);
+	const uint64_t vMinor = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MINOR_VERSION,0);
+	const uint64_t vRev = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_REVISION,0);
+	const uint64_t vProto = metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_PROTOCOL_VERSION,0);
+	if ((requestPacketId)&&((mr.vMajor != vMajor)||(mr.vMinor != vMinor)||(mr.vRev != vRev)||(mr.vProto != vProto)))
+		return false;
+
+	std::string dict,base,bin;
+	_ConfigKey ck;
+	if (!_cachedConfig(nwid,nodeId,networkRevision,mr.revision,ns,metaData,now,ck,dict,base,bin))
+		return false;
+
+	if (requestPacketId) {
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		_MemberStatus &ms = sh.networks[nwid][nodeId];
+		ms.vMajor = (int)vMajor;
+		ms.vMinor = (int)vMinor;
+		ms.vRev = (int)vRev;
+		ms.vProto = (int)vProto;
+		ms.lastRequestMetaData = metaData;
+		ms.identity = identity;
+		if (fromAddr)
+			ms.physicalAddr = fromAddr;
+		if (ms.physicalAddr) {
+			char tmpip[64];
+			if (mr.physicalAddr != ms.physicalAddr.toString(tmpip))
+				return false; // _request() will save the new address
+		}
+	}
+
+	// If the member already holds this exact config, this sends an empty delta
+	_sendConfig(nwid,requestPacketId,identity.address(),base,dict,bin,ck.compress);
+	return true;
+}
+
 void EmbeddedNetworkController::_request(
 	uint64_t nwid,
 	const InetAddress &fromAddr,
@@ -1220,13 +1962,19 @@ void EmbeddedNetworkController::_request(
 	const uint64_t now = OSUtils::now();
 
 	if (requestPacketId) {
-		Mutex::Lock _l(_memberStatus_m);
-		_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		_MemberStatus &ms = sh.networks[nwid][identity.address().toInt()];
 		if ((now - ms.lastRequestTime) <= ZT_NETCONF_MIN_REQUEST_PERIOD)
 			return;
 		ms.lastRequestTime = now;
 	}
 
+	// Known and authorized members whose saved state wouldn't change are answered
+	// from their cached config without decoding the network or member JSON
+	if (_requestFromCache(nwid,fromAddr,requestPacketId,identity,metaData,now))
+		return;
+
 	OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",nwid);
 	if (!_db.getNetworkAndMember(nwid,identity.address().toInt(),network,member,ns)) {
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_OBJECT_NOT_FOUND);
@@ -1355,8 +2103,9 @@ void EmbeddedNetworkController::_request(
 			member["vProto"] = vProto;
 
 			{
-				Mutex::Lock _l(_memberStatus_m);
-				_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
+				_MemberStatusShard &sh = _memberStatusShard(nwid);
+				Mutex::Lock _l(sh.lock);
+				_MemberStatus &ms = sh.networks[nwid][identity.address().toInt()];
 
 				ms.vMajor = (int)vMajor;
 				ms.vMinor = (int)vMinor;
@@ -1385,32 +2134,47 @@ void EmbeddedNetworkController::_request(
 	// If we made it this far, they are authorized.
 	// -------------------------------------------------------------------------
 
-	uint64_t credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
-	if (now > ns.mostRecentDeauthTime) {
-		// If we recently de-authorized a member, shrink credential TTL/max delta to
-		// be below the threshold required to exclude it. Cap this to a min/max to
-		// prevent jitter or absurdly large values.
-		const uint64_t deauthWindow = now - ns.mostRecentDeauthTime;
-		if (deauthWindow < ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA) {
-			credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA;
-		} else if (deauthWindow < (ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA + 5000ULL)) {
-			credentialtmd = deauthWindow - 5000ULL;
-		}
+	const uint64_t networkRevision = OSUtils::jsonInt(network["revision"],0ULL);
+	const uint64_t memberRevision = OSUtils::jsonInt(member["revision"],0ULL);
+	std::string dict,base,bin;
+	_ConfigKey ck;
+	_cachedConfig(nwid,identity.address().toInt(),networkRevision,memberRevision,ns,metaData,now,ck,dict,base,bin);
+	const uint64_t credentialtmd = ck.credentialTimeMaxDelta;
+	const uint64_t rulesEngineRev = ck.rulesEngineRev;
+	const uint64_t specialistsHash = ck.specialistsHash;
+	const bool legacy = ck.legacy;
+	const bool binary = ck.binary;
+	if (dict.length() > 0) {
+		_removeMemberNonPersistedFields(member);
+		if (member != origMember)
+			_db.saveNetworkMember(nwid,identity.address().toInt(),member);
+		// If the member already holds this exact config, this sends an empty delta
+		_sendConfig(nwid,requestPacketId,identity.address(),base,dict,bin,ck.compress);
+		return;
 	}
 
-	std::auto_ptr<NetworkConfig> nc(new NetworkConfig());
+	std::unique_ptr<NetworkConfig> nc(new NetworkConfig());
 
 	nc->networkId = nwid;
 	nc->type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 	nc->timestamp = now;
 	nc->credentialTimeMaxDelta = credentialtmd;
-	nc->revision = OSUtils::jsonInt(network["revision"],0ULL);
+	nc->revision = networkRevision;
 	nc->issuedTo = identity.address();
 	if (OSUtils::jsonBool(network["enableBroadcast"],true)) nc->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
 	if (OSUtils::jsonBool(network["allowPassiveBridging"],false)) nc->flags |= ZT_NETWORKCONFIG_FLAG_ALLOW_PASSIVE_BRIDGING;
+	{
+		const std::string comp(OSUtils::jsonString(network["compression"],"lz4"));
+		if (comp == "zstd")
+			nc->flags |= ZT_NETWORKCONFIG_FLAG_COMPRESS_ZSTD;
+		else if (comp == "none")
+			nc->flags |= ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION;
+	}
 	Utils::scopy(nc->name,sizeof(nc->name),OSUtils::jsonString(network["name"],"").c_str());
 	nc->mtu = std::max(std::min((unsigned int)OSUtils::jsonInt(network["mtu"],ZT_DEFAULT_MTU),(unsigned int)ZT_MAX_MTU),(unsigned int)ZT_MIN_MTU);
 	nc->multicastLimit = (unsigned int)OSUtils::jsonInt(network["multicastLimit"],32ULL);
+	nc->memberRateLimit = OSUtils::jsonInt(network["memberRateLimit"],0ULL);
+	nc->memberRateBurst = OSUtils::jsonInt(network["memberRateBurst"],0ULL);
 
 	std::string rtt(OSUtils::jsonString(member["remoteTraceTarget"],""));
 	if (rtt.length() == 10) {
@@ -1426,6 +2190,10 @@ void EmbeddedNetworkController::_request(
 
 	for(std::vector<Address>::const_iterator ab(ns.activeBridges.begin());ab!=ns.activeBridges.end();++ab)
 		nc->addSpecialist(*ab,ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
+	for(std::vector<Address>::const_iterator mr(ns.multicastReplicators.begin());mr!=ns.multicastReplicators.end();++mr)
+		nc->addSpecialist(*mr,ZT_NETWORKCONFIG_SPECIALIST_TYPE_MULTICAST_REPLICATOR);
+	for(std::vector<Address>::const_iterator rl(ns.relays.begin());rl!=ns.relays.end();++rl)
+		nc->addSpecialist(*rl,ZT_NETWORKCONFIG_SPECIALIST_TYPE_RELAY);
 
 	json &v4AssignMode = network["v4AssignMode"];
 	json &v6AssignMode = network["v6AssignMode"];
@@ -1437,19 +2205,23 @@ void EmbeddedNetworkController::_request(
 	json &memberCapabilities = member["capabilities"];
 	json &memberTags = member["tags"];
 
-	if (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) <= 0) {
+	if (rulesEngineRev <= 0) {
 		// Old versions with no rules engine support get an allow everything rule.
 		// Since rules are enforced bidirectionally, newer versions *will* still
 		// enforce rules on the inbound side.
 		nc->ruleCount = 1;
+		nc->rules.resize(1);
 		nc->rules[0].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
 	} else {
 		if (rules.is_array()) {
 			for(unsigned long i=0;i<rules.size();++i) {
 				if (nc->ruleCount >= ZT_MAX_NETWORK_RULES)
 					break;
-				if (_parseRule(rules[i],nc->rules[nc->ruleCount]))
+				ZT_VirtualNetworkRule r;
+				if (_parseRule(rules[i],r)) {
+					nc->rules.push_back(r);
 					++nc->ruleCount;
+				}
 			}
 		}
 
@@ -1493,9 +2265,11 @@ void EmbeddedNetworkController::_request(
 								++caprc;
 						}
 					}
-					nc->capabilities[nc->capabilityCount] = Capability((uint32_t)capId,nwid,now,1,capr,caprc);
-					if (nc->capabilities[nc->capabilityCount].sign(_signingId,identity.address()))
+					Capability c((uint32_t)capId,nwid,now,1,capr,caprc);
+					if (c.sign(_signingId,identity.address())) {
+						nc->capabilities.push_back(c);
 						++nc->capabilityCount;
+					}
 					if (nc->capabilityCount >= ZT_MAX_NETWORK_CAPABILITIES)
 						break;
 				}
@@ -1529,9 +2303,11 @@ void EmbeddedNetworkController::_request(
 		for(std::map< uint32_t,uint32_t >::const_iterator t(memberTagsById.begin());t!=memberTagsById.end();++t) {
 			if (nc->tagCount >= ZT_MAX_NETWORK_TAGS)
 				break;
-			nc->tags[nc->tagCount] = Tag(nwid,now,identity.address(),t->first,t->second);
-			if (nc->tags[nc->tagCount].sign(_signingId))
+			Tag tag(nwid,now,identity.address(),t->first,t->second);
+			if (tag.sign(_signingId)) {
+				nc->tags.push_back(tag);
 				++nc->tagCount;
+			}
 		}
 	}
 
@@ -1557,6 +2333,25 @@ void EmbeddedNetworkController::_request(
 		}
 	}
 
+	json &authOnlyPaths = network["authOnlyPaths"];
+	if (authOnlyPaths.is_array()) {
+		for(unsigned long i=0;i<authOnlyPaths.size();++i) {
+			if (nc->authOnlyPathCount >= ZT_NETWORKCONFIG_MAX_AUTH_ONLY_PATHS)
+				break;
+			if (authOnlyPaths[i].is_string()) {
+				const InetAddress t(authOnlyPaths[i].get<std::string>().c_str());
+				if ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6))
+					nc->authOnlyPaths[nc->authOnlyPathCount++] = t;
+			}
+		}
+	}
+
+	if (OSUtils::jsonBool(network["multicastGroupKey"],false)) {
+		const std::string mk(OSUtils::jsonString(network["multicastKey"],""));
+		if (Utils::unhex(mk.c_str(),nc->multicastKey,ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH) == ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH)
+			nc->hasMulticastKey = true;
+	}
+
 	const bool noAutoAssignIps = OSUtils::jsonBool(member["noAutoAssignIps"],false);
 
 	if ((v6AssignMode.is_object())&&(!noAutoAssignIps)) {
@@ -1678,42 +2473,85 @@ void EmbeddedNetworkController::_request(
 						continue;
 					uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
 
-					// Start with the LSB of the member's address
-					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
+					// Only the parts of the pool that routes cover can be assigned, so skip
+					// pools no route touches and jump over gaps between routes below
+					std::vector< std::pair<uint32_t,uint32_t> > routed;
+					for(unsigned int rk=0;rk<nc->routeCount;++rk) {
+						if (nc->routes[rk].target.ss_family == AF_INET) {
+							const uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
+							const int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
+							if ((targetBits <= 0)||(targetBits > 32))
+								continue;
+							const uint32_t mask = 0xffffffff << (32 - targetBits);
+							if ((targetIp & mask) != targetIp)
+								continue;
+							const uint32_t lo = std::max(targetIp,ipRangeStart);
+							const uint32_t hi = std::min(targetIp | ~mask,ipRangeEnd);
+							if (lo <= hi)
+								routed.push_back(std::pair<uint32_t,uint32_t>(lo,hi));
+						}
+					}
+					if (routed.empty())
+						continue;
+					std::sort(routed.begin(),routed.end());
 
-					for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
-						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
-						if ((ip & 0x000000ff) == 0x000000ff)
-							continue; // don't allow addresses that end in .255
+					// Start with the LSB of the member's address, then walk forward through
+					// free routed addresses to the end of the range and wrap around to its
+					// start. The allocation index skips whole runs of taken addresses, so
+					// nearly every trial is usable, but the walk is still bounded.
+					const uint32_t ipFirstTrial = (ipRangeLen > 0) ? (ipRangeStart + ((uint32_t)(identity.address().toInt() & 0xffffffff) % ipRangeLen)) : ipRangeStart;
 
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = -1;
-						for(unsigned int rk=0;rk<nc->routeCount;++rk) {
-							if (nc->routes[rk].target.ss_family == AF_INET) {
-								uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
-								int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
-								if ((ip & (0xffffffff << (32 - targetBits))) == targetIp) {
-									routedNetmaskBits = targetBits;
-									break;
+					unsigned int trials = 0;
+					for(unsigned int pass=0;((pass<2)&&(!haveManagedIpv4AutoAssignment));++pass) {
+						if ((pass == 1)&&(ipFirstTrial == ipRangeStart))
+							break;
+						const uint32_t last = (pass == 0) ? ipRangeEnd : (ipFirstTrial - 1);
+						uint32_t ip = (pass == 0) ? ipFirstTrial : ipRangeStart;
+						while ((trials++ < ZT_NETCONF_IPV4_ASSIGN_MAX_TRIALS)&&(_db.nextFreeIpv4(nwid,ip,last,ip))) {
+							std::vector< std::pair<uint32_t,uint32_t> >::const_iterator rs(routed.begin());
+							while ((rs != routed.end())&&(rs->second < ip))
+								++rs;
+							if ((rs == routed.end())||(rs->first > last))
+								break;
+							if (ip < rs->first) {
+								ip = rs->first;
+								continue;
+							}
+
+							// Check if this IP is within a local-to-Ethernet routed network
+							int routedNetmaskBits = -1;
+							if ((ip & 0x000000ff) != 0x000000ff) { // don't allow addresses that end in .255
+								for(unsigned int rk=0;rk<nc->routeCount;++rk) {
+									if (nc->routes[rk].target.ss_family == AF_INET) {
+										uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
+										int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
+										if ((targetBits > 0)&&(targetBits <= 32)&&((ip & (0xffffffff << (32 - targetBits))) == targetIp)) {
+											routedNetmaskBits = targetBits;
+											break;
+										}
+									}
 								}
 							}
-						}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						const InetAddress ip4(Utils::hton(ip),0);
-						if ( (routedNetmaskBits > 0) && (!std::binary_search(ns.allocatedIps.begin(),ns.allocatedIps.end(),ip4)) ) {
-							char tmpip[64];
-							ipAssignments.push_back(ip4.toIpString(tmpip));
-							member["ipAssignments"] = ipAssignments;
-							if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
-								struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc->staticIps[nc->staticIpCount++]));
-								v4ip->sin_family = AF_INET;
-								v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
-								v4ip->sin_addr.s_addr = Utils::hton(ip);
+							// If it's routed, then claim and assign it
+							if (routedNetmaskBits > 0) {
+								const InetAddress ip4(Utils::hton(ip),0);
+								char tmpip[64];
+								ipAssignments.push_back(ip4.toIpString(tmpip));
+								member["ipAssignments"] = ipAssignments;
+								if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
+									struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc->staticIps[nc->staticIpCount++]));
+									v4ip->sin_family = AF_INET;
+									v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
+									v4ip->sin_addr.s_addr = Utils::hton(ip);
+								}
+								haveManagedIpv4AutoAssignment = true;
+								break;
 							}
-							haveManagedIpv4AutoAssignment = true;
-							break;
+
+							if (ip == last)
+								break;
+							++ip;
 						}
 					}
 				}
@@ -1723,7 +2561,7 @@ void EmbeddedNetworkController::_request(
 
 	// Issue a certificate of ownership for all static IPs
 	if (nc->staticIpCount) {
-		nc->certificatesOfOwnership[0] = CertificateOfOwnership(nwid,now,identity.address(),1);
+		nc->certificatesOfOwnership.push_back(CertificateOfOwnership(nwid,now,identity.address(),1));
 		for(unsigned int i=0;i<nc->staticIpCount;++i)
 			nc->certificatesOfOwnership[0].addThing(nc->staticIps[i]);
 		nc->certificatesOfOwnership[0].sign(_signingId);
@@ -1738,11 +2576,76 @@ void EmbeddedNetworkController::_request(
 		return;
 	}
 
+	{
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> dconf;
+		if (nc->toDictionary(dconf,legacy))
+			dict.assign(dconf.data(),dconf.sizeBytes());
+	}
+	if (binary) {
+		std::unique_ptr< Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> > bconf(new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>());
+		if (nc->toBinary(*bconf))
+			bin.assign(reinterpret_cast<const char *>(bconf->data()),bconf->size());
+	}
+	if (!dict.length()) {
+		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
 	_removeMemberNonPersistedFields(member);
 	if (member != origMember)
 		_db.saveNetworkMember(nwid,identity.address().toInt(),member);
 
-	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*(nc.get()),metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	// If a delta is sent, what the member ends up with may differ from dict in entry order
+	_sendConfig(nwid,requestPacketId,identity.address(),base,dict,bin,ck.compress);
+
+	{
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		_CachedConfig &cc = sh.networks[nwid][identity.address().toInt()].config;
+		cc.dict = dict;
+		cc.bin = bin;
+		cc.dictHash = NetworkConfig::dictionaryHash(dict.data(),(unsigned int)dict.length());
+		cc.timestamp = now;
+		cc.networkRevision = networkRevision;
+		cc.memberRevision = OSUtils::jsonInt(member["revision"],0ULL);
+		cc.credentialTimeMaxDelta = credentialtmd;
+		cc.specialistsHash = specialistsHash;
+		cc.rulesEngineRev = rulesEngineRev;
+		cc.legacy = legacy;
+	}
+}
+
+void EmbeddedNetworkController::_sendConfig(const uint64_t nwid,const uint64_t requestPacketId,const Address &destination,const std::string &base,std::string &dict,const std::string &bin,const bool compress)
+{
+	// Send whichever of a delta, the binary config, or the dictionary is smallest
+	const unsigned int fullLen = ((bin.length() > 0)&&(bin.length() < dict.length())) ? (unsigned int)bin.length() : (unsigned int)dict.length();
+	if (base.length() > 0) {
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> delta,result;
+		if ( (NetworkConfig::makeDelta(base.data(),(unsigned int)base.length(),dict.data(),(unsigned int)dict.length(),delta,result)) && (delta.sizeBytes() < fullLen) ) {
+			dict.assign(result.data(),result.sizeBytes());
+			_sendSerializedConfig(nwid,requestPacketId,destination,delta.data(),delta.sizeBytes(),ZT_NETWORKCONFIG_CHUNK_FLAG_DELTA,compress);
+			return;
+		}
+	}
+	if (fullLen < dict.length())
+		_sendSerializedConfig(nwid,requestPacketId,destination,bin.data(),(unsigned int)bin.length(),ZT_NETWORKCONFIG_CHUNK_FLAG_BINARY,compress);
+	else _sendSerializedConfig(nwid,requestPacketId,destination,dict.data(),(unsigned int)dict.length(),0,compress);
+}
+
+void EmbeddedNetworkController::_sendSerializedConfig(const uint64_t nwid,const uint64_t requestPacketId,const Address &destination,const void *conf,const unsigned int confLen,const uint8_t chunkFlags,const bool compress)
+{
+	if ((compress)&&(confLen > ZT_NETCONF_COMPRESS_MIN_SIZE)) {
+		// Only worth it if it's smaller, so anything that doesn't fit in confLen isn't
+		std::unique_ptr<uint8_t[]> c(new uint8_t[confLen]);
+		const unsigned int cl = Packet::lz4Compress(conf,confLen,c.get(),confLen);
+		if ((cl > 0)&&(cl < confLen)) {
+			_sender->ncSendSerializedConfig(nwid,requestPacketId,destination,c.get(),cl,chunkFlags | ZT_NETWORKCONFIG_CHUNK_FLAG_COMPRESSED);
+			++_configsCompressed;
+			_configBytesSaved += (uint64_t)(confLen - cl);
+			return;
+		}
+	}
+	_sender->ncSendSerializedConfig(nwid,requestPacketId,destination,conf,confLen,chunkFlags);
 }
 
 } // namespace ZeroTier
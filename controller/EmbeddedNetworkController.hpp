@@ -27,7 +27,12 @@
 #include <set>
 #include <list>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "../node/Constants.hpp"
 
@@ -37,15 +42,19 @@
 #include "../node/Address.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/NonCopyable.hpp"
+#include "../node/Revocation.hpp"
 
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Thread.hpp"
-#include "../osdep/BlockingQueue.hpp"
+#include "../osdep/FairQueue.hpp"
 
 #include "../ext/json/json.hpp"
 
 #include "JSONDB.hpp"
 
+// Member status is split this many ways by network ID (must be a power of two)
+#define ZT_NETCONF_MEMBER_STATUS_SHARDS 64
+
 namespace ZeroTier {
 
 class Node;
@@ -56,8 +65,10 @@ public:
 	/**
 	 * @param node Parent node
 	 * @param dbPath Path to store data
+	 * @param logStructuredDb If true, store networks and members in an append-only log under dbPath
+	 * @param replicaAuthToken If non-NULL, dbPath is another controller's http://.../controller/db to replicate
 	 */
-	EmbeddedNetworkController(Node *node,const char *dbPath);
+	EmbeddedNetworkController(Node *node,const char *dbPath,const bool logStructuredDb = false,const char *replicaAuthToken = (const char *)0);
 	virtual ~EmbeddedNetworkController();
 
 	virtual void init(const Identity &signingId,Sender *sender);
@@ -91,8 +102,57 @@ public:
 		std::string &responseBody,
 		std::string &responseContentType);
 
+	/**
+	 * Queue a remote trace to be saved
+	 *
+	 * This only copies the trace. Traces are parsed and written in batches by
+	 * a background thread, and are dropped (and counted) if that falls behind.
+	 *
+	 * @param rt Remote trace
+	 */
 	void handleRemoteTrace(const ZT_RemoteTrace &rt);
 
+	/**
+	 * Set how many remote traces are received for each one that's kept
+	 *
+	 * @param n 1 to keep all (default), N to keep one in N, or 0 to keep none
+	 */
+	inline void setRemoteTraceSampleRate(const unsigned long n) { _traceSampleRate = n; }
+
+	/**
+	 * Set the window over which network-wide config pushes are spread
+	 *
+	 * @param ms Window in milliseconds (0 to push as fast as request threads allow)
+	 */
+	inline void setPushWindow(const unsigned long ms)
+	{
+		Mutex::Lock _l(_push_m);
+		_pushWindow = ms;
+	}
+
+	/**
+	 * Get how often and for how long callers waited on contended database locks
+	 *
+	 * @param waits Set to number of waits
+	 * @param ns Set to total time spent waiting in nanoseconds
+	 */
+	inline void dbLockWaits(uint64_t &waits,uint64_t &ns) const { _db.lockWaits(waits,ns); }
+
+	/**
+	 * @return Random ID of this run of the change feed
+	 */
+	inline uint64_t changeFeedEpoch() const { return _db.feedEpoch(); }
+
+	/**
+	 * @return Latest change feed revision, for long polls waiting on GET /controller/changes
+	 */
+	inline uint64_t changeFeedRevision() const { return _db.feedRevision(); }
+
+	/**
+	 * @param mu Memory usage snapshot to add the controller's database to
+	 */
+	inline void memoryUsage(MemoryUsage &mu) const { _db.memoryUsage(mu); }
+
 	void threadMain()
 		throw();
 
@@ -109,8 +169,46 @@ private:
 		} type;
 	};
 
+	// What a cached config must have been built from to be resent
+	struct _ConfigKey
+	{
+		uint64_t credentialTimeMaxDelta;
+		uint64_t specialistsHash;
+		uint64_t rulesEngineRev;
+		bool legacy;
+		bool binary; // whether the member takes binary configs (not part of the match)
+		bool compress; // whether the member takes compressed configs (not part of the match)
+	};
+
+	// Fill ck for a request and base with a delta base if the member has one; returns true with dict (and bin) if a cached config still fits
+	bool _cachedConfig(const uint64_t nwid,const uint64_t nodeId,const uint64_t networkRevision,const uint64_t memberRevision,const JSONDB::NetworkSummaryInfo &ns,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,const uint64_t now,_ConfigKey &ck,std::string &dict,std::string &base,std::string &bin);
+
+	// Answer a request from the member's cached config using only decoded member records, or return false to do it the long way
+	bool _requestFromCache(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,const uint64_t now);
+
 	void _request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData);
 
+	// Send dict, or a delta against base if base is non-empty and that's smaller; dict is set to what the member will hold
+	void _sendConfig(const uint64_t nwid,const uint64_t requestPacketId,const Address &destination,const std::string &base,std::string &dict,const std::string &bin,const bool compress);
+
+	// Send a serialized config, compressed first if compress is set and that makes it smaller
+	void _sendSerializedConfig(const uint64_t nwid,const uint64_t requestPacketId,const Address &destination,const void *conf,const unsigned int confLen,const uint8_t chunkFlags,const bool compress);
+
+	// Apply writable member fields from b to member; throws on bad input, returns true if member was deauthorized
+	bool _applyMemberChanges(nlohmann::json &b,nlohmann::json &member,const uint64_t now);
+
+	// Sign one revocation per deauthorized member and queue them all for every online member of a network
+	void _queueRevocations(const uint64_t nwid,const std::vector<uint64_t> &deauthorized,const uint64_t now);
+
+	// Send queued revocations to the next batch of recipients
+	void _drainRevocations();
+
+	// Queue config pushes to online members of a network (all, or only those in only), most recently active first
+	void _schedulePushes(const uint64_t nwid,const uint64_t now,const std::unordered_set<uint64_t> *only = (const std::unordered_set<uint64_t> *)0);
+
+	// Send however many queued pushes are due to finish the queue by its deadline
+	void _drainPushes(const uint64_t now);
+
 	inline void _startThreads()
 	{
 		Mutex::Lock _l(_threads_m);
@@ -132,6 +230,8 @@ private:
 		if (!member.count("authHistory")) member["authHistory"] = nlohmann::json::array();
  		if (!member.count("ipAssignments")) member["ipAssignments"] = nlohmann::json::array();
 		if (!member.count("activeBridge")) member["activeBridge"] = false;
+		if (!member.count("multicastReplicator")) member["multicastReplicator"] = false;
+		if (!member.count("relay")) member["relay"] = false;
 		if (!member.count("tags")) member["tags"] = nlohmann::json::array();
 		if (!member.count("capabilities")) member["capabilities"] = nlohmann::json::array();
 		if (!member.count("creationTime")) member["creationTime"] = OSUtils::now();
@@ -153,7 +253,12 @@ private:
 		if (!network.count("creationTime")) network["creationTime"] = OSUtils::now();
 		if (!network.count("name")) network["name"] = "";
 		if (!network.count("multicastLimit")) network["multicastLimit"] = (uint64_t)32;
+		if (!network.count("memberRateLimit")) network["memberRateLimit"] = (uint64_t)0;
+		if (!network.count("memberRateBurst")) network["memberRateBurst"] = (uint64_t)0;
+		if (!network.count("authOnlyPaths")) network["authOnlyPaths"] = nlohmann::json::array();
+		if (!network.count("multicastGroupKey")) network["multicastGroupKey"] = false;
 		if (!network.count("enableBroadcast")) network["enableBroadcast"] = true;
+		if (!network.count("compression")) network["compression"] = "lz4";
 		if (!network.count("v4AssignMode")) network["v4AssignMode"] = {{"zt",false}};
 		if (!network.count("v6AssignMode")) network["v6AssignMode"] = {{"rfc4193",false},{"zt",false},{"6plane",false}};
 		if (!network.count("authTokens")) network["authTokens"] = nlohmann::json::array();
@@ -192,9 +297,17 @@ private:
 	inline void _addMemberNonPersistedFields(uint64_t nwid,uint64_t nodeId,nlohmann::json &member,uint64_t now)
 	{
 		member["clock"] = now;
-		Mutex::Lock _l(_memberStatus_m);
-		member["online"] = _memberStatus[_MemberStatusKey(nwid,nodeId)].online(now);
+		bool online = false;
+		_MemberStatusShard &sh = _memberStatusShard(nwid);
+		Mutex::Lock _l(sh.lock);
+		const auto n = sh.networks.find(nwid);
+		if (n != sh.networks.end()) {
+			const auto ms = n->second.find(nodeId);
+			online = ((ms != n->second.end())&&(ms->second.online(now)));
+		}
+		member["online"] = online;
 	}
+	void _traceWriterMain();
 	inline void _removeMemberNonPersistedFields(nlohmann::json &member)
 	{
 		member.erase("clock");
@@ -207,7 +320,7 @@ private:
 	const uint64_t _startTime;
 
 	volatile bool _running;
-	BlockingQueue<_RQEntry *> _queue;
+	FairQueue<uint64_t,_RQEntry *> _queue; // by network, so each network's requests are handled one at a time and networks take turns
 	std::vector<Thread> _threads;
 	volatile uint64_t _lastDumpedStatus;
 	Mutex _threads_m;
@@ -229,6 +342,21 @@ private:
 		uint64_t nodeId;
 		inline bool operator==(const _MemberStatusKey &k) const { return ((k.networkId == networkId)&&(k.nodeId == nodeId)); }
 	};
+	// Signed and serialized config last sent to a member, along with what it was built from
+	struct _CachedConfig
+	{
+		_CachedConfig() : dictHash(0),timestamp(0),networkRevision(0),memberRevision(0),credentialTimeMaxDelta(0),specialistsHash(0),rulesEngineRev(0),legacy(false) {}
+		std::string dict; // exactly what the member holds if it received it, so also its delta base
+		std::string bin; // the same config in binary, if the member could decode that
+		uint64_t dictHash; // NetworkConfig::dictionaryHash() of dict
+		uint64_t timestamp;
+		uint64_t networkRevision;
+		uint64_t memberRevision;
+		uint64_t credentialTimeMaxDelta;
+		uint64_t specialistsHash;
+		uint64_t rulesEngineRev;
+		bool legacy;
+	};
 	struct _MemberStatus
 	{
 		_MemberStatus() : lastRequestTime(0),vMajor(-1),vMinor(-1),vRev(-1),vProto(-1) {}
@@ -237,6 +365,7 @@ private:
 		Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> lastRequestMetaData;
 		Identity identity;
 		InetAddress physicalAddr; // last known physical address
+		_CachedConfig config;
 		inline bool online(const uint64_t now) const { return ((now - lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2)); }
 	};
 	struct _MemberStatusHash
@@ -246,8 +375,56 @@ private:
 			return (std::size_t)(networkIdNodeId.networkId + networkIdNodeId.nodeId);
 		}
 	};
-	std::unordered_map< _MemberStatusKey,_MemberStatus,_MemberStatusHash > _memberStatus;
-	Mutex _memberStatus_m;
+	// Each shard holds whole networks, so a network's members are found and
+	// scanned under one shard lock without touching any other network.
+	struct _MemberStatusShard
+	{
+		std::unordered_map< uint64_t,std::unordered_map< uint64_t,_MemberStatus > > networks; // network ID -> member node ID -> status
+		Mutex lock;
+	};
+	inline _MemberStatusShard &_memberStatusShard(const uint64_t nwid) { return _memberStatus[(unsigned long)((nwid ^ (nwid >> 32)) & (ZT_NETCONF_MEMBER_STATUS_SHARDS - 1))]; }
+	_MemberStatusShard _memberStatus[ZT_NETCONF_MEMBER_STATUS_SHARDS];
+
+	std::list<_MemberStatusKey> _pushQueue;
+	std::unordered_set< _MemberStatusKey,_MemberStatusHash > _pushQueued; // members in _pushQueue
+	uint64_t _pushDeadline; // time by which _pushQueue should be empty
+	uint64_t _lastPushDrain;
+	uint64_t _pushesSent;
+	unsigned long _pushWindow;
+	Mutex _push_m;
+
+	// Revocations on their way to a network's online members, most recently active first
+	struct _RevocationFanout
+	{
+		uint64_t networkId;
+		std::vector<Revocation> revocations;
+		std::vector<uint64_t> recipients;
+		unsigned long next; // index in recipients of the next to send to
+	};
+	std::list<_RevocationFanout> _revocationFanouts;
+	uint64_t _revocationRecipientsSent;
+	Mutex _revocations_m;
+
+	std::atomic<uint64_t> _configsCompressed;
+	std::atomic<uint64_t> _configBytesSaved;
+
+	// Remote traces waiting for _traceWriter
+	struct _PendingTrace
+	{
+		uint64_t origin;
+		uint64_t receivedAt;
+		std::string data;
+	};
+	std::deque<_PendingTrace> _traces;
+	bool _traceRun;
+	std::thread _traceWriter; // started with the first trace
+	std::mutex _traces_m; // guards all of the above
+	std::condition_variable _traces_c;
+	std::atomic<unsigned long> _traceSampleRate;
+	std::atomic<uint64_t> _tracesReceived;
+	std::atomic<uint64_t> _tracesSampledOut;
+	std::atomic<uint64_t> _tracesDropped;
+	std::atomic<uint64_t> _tracesWritten;
 };
 
 } // namespace ZeroTier
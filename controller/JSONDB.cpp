@@ -29,21 +29,133 @@
 #endif
 
 #include "JSONDB.hpp"
+#include "../osdep/CpuAffinity.hpp"
 
 #define ZT_JSONDB_HTTP_TIMEOUT 60000
 
+// Most writes sent over one HTTP connection, and delay before retrying after a batch gets nowhere
+#define ZT_JSONDB_HTTP_BATCH_SIZE 64
+#define ZT_JSONDB_HTTP_RETRY_DELAY 1000
+
+// Summaries are kept up to date as members change, but activity counts age
+// and a few fields can't be decremented exactly, so recount them this often
+#define ZT_JSONDB_SUMMARY_CHECK_INTERVAL 60000
+
+// Maximum number of threads reading JSON files at startup
+#define ZT_JSONDB_MAX_LOAD_THREADS 16
+
+// Number of recent changes kept for the change feed
+#define ZT_JSONDB_FEED_SIZE 262144
+
+// How long a replica's long polls on the primary's change feed wait, which also bounds how long shutdown waits for one
+#define ZT_JSONDB_FOLLOW_WAIT 5000
+
+// Most changes a replica asks the primary for at once
+#define ZT_JSONDB_FOLLOW_BATCH 10000
+
+/*
+ * Log-structured storage format:
+ *
+ *   <[8] ZT_JSONDB_LOG_MAGIC>
+ *   records...
+ *
+ * Each record is:
+ *   <[4] FNV-1a checksum of everything in the record after this field>
+ *   <[1] record type: ZT_JSONDB_LOG_RECORD_PUT or ZT_JSONDB_LOG_RECORD_ERASE>
+ *   <[2] length of object name>
+ *   <[4] length of object>
+ *   <[...] object name, e.g. network/8056c2e21c000001/member/1234567890>
+ *   <[...] object as msgpack (empty for erase)>
+ *
+ * Integers are big-endian. The last record for a name wins. Loading stops
+ * at the first bad record, which is what a torn write at the tail of the
+ * log looks like, and the log is then rewritten without it.
+ */
+#define ZT_JSONDB_LOG_FILENAME "controller.log"
+#define ZT_JSONDB_LOG_MAGIC "ZTJDBLG1"
+#define ZT_JSONDB_LOG_RECORD_PUT 1
+#define ZT_JSONDB_LOG_RECORD_ERASE 2
+#define ZT_JSONDB_LOG_RECORD_HEADER_SIZE 11
+
+// Compact once the log is at least this big and at most half of it is current
+#define ZT_JSONDB_LOG_COMPACT_MIN_SIZE 4194304
+#define ZT_JSONDB_LOG_COMPACT_CHECK_INTERVAL 10000
+
 namespace ZeroTier {
 
 static const nlohmann::json _EMPTY_JSON(nlohmann::json::object());
-static const std::map<std::string,std::string> _ZT_JSONDB_GET_HEADERS;
 
-JSONDB::JSONDB(const std::string &basePath) :
+// Look up a field without inserting it, since members may be const
+static inline const nlohmann::json &_memberField(const nlohmann::json &member,const char *name)
+{
+	static const nlohmann::json nullJson;
+	const nlohmann::json::const_iterator f(member.find(name));
+	return (f == member.end()) ? nullJson : *f;
+}
+
+static inline uint32_t _logChecksum(const uint8_t *p,const uint64_t len)
+{
+	uint32_t h = 0x811c9dc5;
+	for(uint64_t i=0;i<len;++i) {
+		h ^= (uint32_t)p[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static void _logRecord(std::string &r,const uint8_t type,const std::string &n,const std::vector<uint8_t> &obj)
+{
+	const uint16_t nl = (uint16_t)n.length();
+	const uint32_t ol = (uint32_t)obj.size();
+	r.resize(ZT_JSONDB_LOG_RECORD_HEADER_SIZE + (std::size_t)nl + (std::size_t)ol);
+	uint8_t *const p = reinterpret_cast<uint8_t *>(&(r[0]));
+	p[4] = type;
+	p[5] = (uint8_t)(nl >> 8);
+	p[6] = (uint8_t)nl;
+	p[7] = (uint8_t)(ol >> 24);
+	p[8] = (uint8_t)(ol >> 16);
+	p[9] = (uint8_t)(ol >> 8);
+	p[10] = (uint8_t)ol;
+	memcpy(p + ZT_JSONDB_LOG_RECORD_HEADER_SIZE,n.data(),nl);
+	if (ol)
+		memcpy(p + ZT_JSONDB_LOG_RECORD_HEADER_SIZE + nl,obj.data(),ol);
+	const uint32_t cs = _logChecksum(p + 4,(uint64_t)r.length() - 4);
+	p[0] = (uint8_t)(cs >> 24);
+	p[1] = (uint8_t)(cs >> 16);
+	p[2] = (uint8_t)(cs >> 8);
+	p[3] = (uint8_t)cs;
+}
+
+static inline bool _logSeek(FILE *f,const uint64_t offset)
+{
+#ifdef __WINDOWS__
+	return (_fseeki64(f,(__int64)offset,SEEK_SET) == 0);
+#else
+	return (fseeko(f,(off_t)offset,SEEK_SET) == 0);
+#endif
+}
+
+JSONDB::JSONDB(const std::string &basePath,const bool logStructured,const char *replicaAuthToken) :
 	_basePath(basePath),
 	_rawInput(-1),
 	_rawOutput(-1),
 	_summaryThreadRun(true),
-	_dataReady(false)
+	_dataReady(false),
+	_lockWaits(0),
+	_lockWaitNs(0),
+	_loadingKnown(false),
+	_log((FILE *)0),
+	_logSize(0),
+	_logLiveSize(0),
+	_feedRevision(0),
+	_replica(false),
+	_followSince(0),
+	_followEpoch(0),
+	_followRun(true),
+	_writerRun(true)
 {
+	Utils::getSecureRandom(&_feedEpoch,sizeof(_feedEpoch));
+
 	if ((_basePath.length() > 7)&&(_basePath.substr(0,7) == "http://")) {
 		// If base path is http:// we run in HTTP mode
 		// TODO: this doesn't yet support IPv6 since bracketed address notiation isn't supported.
@@ -62,6 +174,11 @@ JSONDB::JSONDB(const std::string &basePath) :
 			_basePath = "/";
 		if (_basePath[0] != '/')
 			_basePath = std::string("/") + _basePath;
+		if (replicaAuthToken) {
+			_replica = true;
+			_httpHeaders["X-ZT1-Auth"] = replicaAuthToken;
+		}
+		_writer = std::thread([this]() { this->_writerMain(); });
 #ifndef __WINDOWS__
 	} else if (_basePath == "-") {
 		// If base path is "-" we run in stdin/stdout mode and expect our database to be populated on startup via stdin
@@ -74,26 +191,36 @@ JSONDB::JSONDB(const std::string &basePath) :
 		// Default mode of operation is to store files in the filesystem
 		OSUtils::mkdir(_basePath.c_str());
 		OSUtils::lockDownFile(_basePath.c_str(),true); // networks might contain auth tokens, etc., so restrict directory permissions
+		if (logStructured)
+			_logPath = _basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_LOG_FILENAME;
 	}
 
-	_networks_m.lock(); // locked until data is loaded, etc.
-
 	if (_rawInput < 0) {
-		unsigned int cnt = 0;
-		while (!_load(_basePath)) {
-			if ((++cnt & 7) == 0)
-				fprintf(stderr,"WARNING: controller still waiting to read '%s'..." ZT_EOL_S,_basePath.c_str());
-			Thread::sleep(250);
+		if ((_logPath.length() > 0)&&(!_logOpen())) {
+			fprintf(stderr,"WARNING: controller unable to use log '%s', falling back to JSON files" ZT_EOL_S,_logPath.c_str());
+			_logPath.clear();
 		}
-
-		for(std::unordered_map<uint64_t,_NW>::iterator n(_networks.begin());n!=_networks.end();++n)
-			_summaryThreadToDo.push_back(n->first);
-
-		if (_summaryThreadToDo.size() > 0) {
-			_summaryThread = Thread::start(this);
+		if ((_logPath.length() == 0)&&(!_httpAddr)) {
+			// Read JSON files in the background so networks can be served as soon as they're loaded
+			_loader = std::thread([this]() { this->_loadInParallel(); });
+		} else if (_replica) {
+			// Note where the primary's feed is before reading everything, so nothing that changes in between is missed
+			unsigned int cnt = 0;
+			while ((!_followPosition())||(!_followResync())) {
+				if ((++cnt & 7) == 0)
+					fprintf(stderr,"WARNING: controller replica still waiting to read '%s'..." ZT_EOL_S,_basePath.c_str());
+				Thread::sleep(250);
+			}
+			_loadComplete();
+			_follower = std::thread([this]() { this->_followerMain(); });
 		} else {
-			_dataReady = true;
-			_networks_m.unlock();
+			unsigned int cnt = 0;
+			while ((_logPath.length() == 0)&&(!_load(_basePath))) {
+				if ((++cnt & 7) == 0)
+					fprintf(stderr,"WARNING: controller still waiting to read '%s'..." ZT_EOL_S,_basePath.c_str());
+				Thread::sleep(250);
+			}
+			_loadComplete();
 		}
 	} else {
 		// In IPC mode we wait for the first message to start, and we start
@@ -104,6 +231,16 @@ JSONDB::JSONDB(const std::string &basePath) :
 
 JSONDB::~JSONDB()
 {
+	if (_loader.joinable())
+		_loader.join();
+	if (_follower.joinable()) {
+		{
+			std::lock_guard<std::mutex> l(_follow_m);
+			_followRun = false;
+			_follow_c.notify_all();
+		}
+		_follower.join();
+	}
 	Thread t;
 	{
 		Mutex::Lock _l(_summaryThread_m);
@@ -112,6 +249,16 @@ JSONDB::~JSONDB()
 	}
 	if (t)
 		Thread::join(t);
+	if (_log)
+		fclose(_log);
+	if (_writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> l(_writes_m);
+			_writerRun = false;
+			_writes_c.notify_all();
+		}
+		_writer.join();
+	}
 }
 
 bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
@@ -129,15 +276,8 @@ bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
 #endif
 		return false;
 	} else if (_httpAddr) {
-		std::map<std::string,std::string> headers;
-		std::string body;
-		std::map<std::string,std::string> reqHeaders;
-		char tmp[64];
-		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%lu",(unsigned long)obj.length());
-		reqHeaders["Content-Length"] = tmp;
-		reqHeaders["Content-Type"] = "application/json";
-		const unsigned int sc = Http::PUT(0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),(_basePath+"/"+n).c_str(),reqHeaders,obj.data(),(unsigned long)obj.length(),headers,body);
-		return (sc == 200);
+		_queueWrite(n,obj,false);
+		return true;
 	} else {
 		const std::string path(_genPath(n,true));
 		if (!path.length())
@@ -146,166 +286,499 @@ bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
 	}
 }
 
+unsigned long JSONDB::writeRawBatch(const std::vector< std::pair<std::string,std::string> > &objs)
+{
+	if (objs.empty())
+		return 0;
+	if (_rawOutput >= 0) {
+#ifndef __WINDOWS__
+		std::string lines;
+		for(std::vector< std::pair<std::string,std::string> >::const_iterator o(objs.begin());o!=objs.end();++o) {
+			if (o->second.length() > 0) {
+				lines.append(o->second);
+				lines.push_back('\n');
+			}
+		}
+		Mutex::Lock _l(_rawLock);
+		if ((long)write(_rawOutput,lines.data(),lines.length()) == (long)lines.length())
+			return (unsigned long)objs.size();
+#endif
+		return 0;
+	} else if (_httpAddr) {
+		std::lock_guard<std::mutex> l(_writes_m);
+		for(std::vector< std::pair<std::string,std::string> >::const_iterator o(objs.begin());o!=objs.end();++o)
+			_queueWriteLocked(o->first,o->second,false);
+		return (unsigned long)objs.size();
+	} else {
+		unsigned long n = 0;
+		for(std::vector< std::pair<std::string,std::string> >::const_iterator o(objs.begin());o!=objs.end();++o) {
+			if (writeRaw(o->first,o->second))
+				++n;
+		}
+		return n;
+	}
+}
+
+void JSONDB::persistenceStats(PersistenceStats &ps) const
+{
+	const uint64_t now = OSUtils::now();
+	std::lock_guard<std::mutex> l(_writes_m);
+	ps = _writeStats;
+	ps.backlog = (unsigned long)_writes.size();
+	if (!_writeOrder.empty()) {
+		const std::unordered_map< std::string,_PendingWrite >::const_iterator w(_writes.find(_writeOrder.front()));
+		if ((w != _writes.end())&&(now > w->second.queuedAt))
+			ps.oldestPendingAge = now - w->second.queuedAt;
+	}
+}
+
+void JSONDB::memoryUsage(MemoryUsage &mu) const
+{
+	// Hash table nodes hold a next pointer besides their value and each bucket is
+	// a pointer, while std::map and std::list nodes have two or three pointers.
+	{
+		_RLock _l(*this,_networks_m);
+		uint64_t nwBytes = _networks.bucket_count() * sizeof(void *);
+		uint64_t memberCount = 0;
+		uint64_t memberBytes = _members.bucket_count() * sizeof(void *);
+		for(std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator n(_networks.begin());n!=_networks.end();++n) {
+			const _NW &nw = *(n->second);
+			_RLock _l2(*this,nw.lock);
+			nwBytes += sizeof(std::pair< const uint64_t,SharedPtr<_NW> >) + sizeof(void *) + sizeof(_NW) + nw.config.capacity();
+			nwBytes += nw.allocatedIpv4.size() * (sizeof(std::pair< const uint32_t,uint32_t >) + (3 * sizeof(void *)));
+			nwBytes += (nw.allocatedIpv4Refs.size() * (sizeof(std::pair< const uint32_t,unsigned int >) + sizeof(void *))) + (nw.allocatedIpv4Refs.bucket_count() * sizeof(void *));
+			memberCount += nw.members.size();
+			memberBytes += nw.members.bucket_count() * sizeof(void *);
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw.members.begin());m!=nw.members.end();++m)
+				memberBytes += sizeof(std::pair< const uint64_t,_Member >) + sizeof(void *) + m->second.config.capacity() + (m->second.record.ipAssignments.capacity() * sizeof(InetAddress));
+		}
+		for(std::unordered_map< uint64_t,std::unordered_set< uint64_t > >::const_iterator m(_members.begin());m!=_members.end();++m)
+			memberBytes += sizeof(std::pair< const uint64_t,std::unordered_set< uint64_t > >) + sizeof(void *) + (m->second.size() * (sizeof(uint64_t) + sizeof(void *))) + (m->second.bucket_count() * sizeof(void *));
+		mu.add(MemoryUsage::CONTROLLER_NETWORKS,_networks.size(),nwBytes);
+		mu.add(MemoryUsage::CONTROLLER_MEMBERS,memberCount,memberBytes);
+	}
+
+	{
+		std::lock_guard<std::mutex> l(_writes_m);
+		uint64_t bytes = _writes.bucket_count() * sizeof(void *);
+		for(std::unordered_map< std::string,_PendingWrite >::const_iterator w(_writes.begin());w!=_writes.end();++w)
+			bytes += sizeof(std::pair< const std::string,_PendingWrite >) + sizeof(void *) + w->first.capacity() + w->second.obj.capacity();
+		for(std::list<std::string>::const_iterator n(_writeOrder.begin());n!=_writeOrder.end();++n)
+			bytes += sizeof(std::string) + (2 * sizeof(void *)) + n->capacity();
+		mu.add(MemoryUsage::CONTROLLER_WRITE_QUEUE,_writes.size(),bytes);
+	}
+}
+
+bool JSONDB::changesSince(const uint64_t since,const uint64_t epoch,const unsigned long max,std::vector<Change> &changes,uint64_t &through) const
+{
+	Mutex::Lock _l(_feed_m);
+	through = _feedRevision;
+	if ((epoch != _feedEpoch)||(since > through)||((!_feed.empty())&&((since + 1) < _feed.front().revision)))
+		return false;
+	if ((_feed.empty())||(since == through))
+		return true;
+
+	// Revisions are consecutive, so the first change after since can be found directly
+	std::map< std::pair<uint64_t,uint64_t>,unsigned long > seen; // network, member -> index in changes
+	const unsigned long first = (unsigned long)changes.size();
+	for(std::deque<Change>::const_iterator c(_feed.begin() + (std::ptrdiff_t)(since + 1 - _feed.front().revision));c!=_feed.end();++c) {
+		const std::pair<uint64_t,uint64_t> k(c->networkId,c->memberId);
+		std::map< std::pair<uint64_t,uint64_t>,unsigned long >::iterator s(seen.find(k));
+		if (s != seen.end()) {
+			changes[s->second] = *c;
+		} else {
+			if ((unsigned long)seen.size() >= max) {
+				through = c->revision - 1;
+				break;
+			}
+			seen[k] = (unsigned long)changes.size();
+			changes.push_back(*c);
+		}
+	}
+	std::sort(changes.begin() + first,changes.end(),[](const Change &a,const Change &b) { return (a.revision < b.revision); });
+	return true;
+}
+
 bool JSONDB::hasNetwork(const uint64_t networkId) const
 {
-	Mutex::Lock _l(_networks_m);
+	_waitForNetwork(networkId);
+	_RLock _l(*this,_networks_m);
 	return (_networks.find(networkId) != _networks.end());
 }
 
 bool JSONDB::getNetwork(const uint64_t networkId,nlohmann::json &config) const
 {
-	Mutex::Lock _l(_networks_m);
-	const std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-	if (i == _networks.end())
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
 		return false;
-	config = nlohmann::json::from_msgpack(i->second.config);
+	_RLock _l(*this,nw->lock);
+	config = nlohmann::json::from_msgpack(nw->config);
 	return true;
 }
 
 bool JSONDB::getNetworkSummaryInfo(const uint64_t networkId,NetworkSummaryInfo &ns) const
 {
-	Mutex::Lock _l(_networks_m);
-	const std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-	if (i == _networks.end())
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
 		return false;
-	ns = i->second.summaryInfo;
+	_RLock _l(*this,nw->lock);
+	ns = nw->summaryInfo;
 	return true;
 }
 
 int JSONDB::getNetworkAndMember(const uint64_t networkId,const uint64_t nodeId,nlohmann::json &networkConfig,nlohmann::json &memberConfig,NetworkSummaryInfo &ns) const
 {
-	Mutex::Lock _l(_networks_m);
-	const std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-	if (i == _networks.end())
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
 		return 0;
-	const std::unordered_map< uint64_t,std::vector<uint8_t> >::const_iterator j(i->second.members.find(nodeId));
-	if (j == i->second.members.end())
+	_RLock _l(*this,nw->lock);
+	const std::unordered_map< uint64_t,_Member >::const_iterator j(nw->members.find(nodeId));
+	if (j == nw->members.end())
 		return 1;
-	networkConfig = nlohmann::json::from_msgpack(i->second.config);
-	memberConfig = nlohmann::json::from_msgpack(j->second);
-	ns = i->second.summaryInfo;
+	networkConfig = nlohmann::json::from_msgpack(nw->config);
+	memberConfig = nlohmann::json::from_msgpack(j->second.config);
+	ns = nw->summaryInfo;
 	return 3;
 }
 
 bool JSONDB::getNetworkMember(const uint64_t networkId,const uint64_t nodeId,nlohmann::json &memberConfig) const
 {
-	Mutex::Lock _l(_networks_m);
-	const std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-	if (i == _networks.end())
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
+		return false;
+	_RLock _l(*this,nw->lock);
+	const std::unordered_map< uint64_t,_Member >::const_iterator j(nw->members.find(nodeId));
+	if (j == nw->members.end())
+		return false;
+	memberConfig = nlohmann::json::from_msgpack(j->second.config);
+	return true;
+}
+
+bool JSONDB::getNetworkMemberRecord(const uint64_t networkId,const uint64_t nodeId,MemberRecord &record) const
+{
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
+		return false;
+	_RLock _l(*this,nw->lock);
+	const std::unordered_map< uint64_t,_Member >::const_iterator j(nw->members.find(nodeId));
+	if (j == nw->members.end())
+		return false;
+	record = j->second.record;
+	return true;
+}
+
+int JSONDB::getNetworkAndMemberRecord(const uint64_t networkId,const uint64_t nodeId,uint64_t &networkRevision,MemberRecord &record,NetworkSummaryInfo &ns) const
+{
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	if (!nw)
+		return 0;
+	_RLock _l(*this,nw->lock);
+	const std::unordered_map< uint64_t,_Member >::const_iterator j(nw->members.find(nodeId));
+	if (j == nw->members.end())
+		return 1;
+	networkRevision = nw->revision;
+	record = j->second.record;
+	ns = nw->summaryInfo;
+	return 3;
+}
+
+// Appends one msgpack value as JSON formatted like nlohmann::json::dump(-1). Returns false
+// on bad input, and on floats since matching dump()'s formatting of them isn't worth it.
+static bool _packedValueToJson(const uint8_t *&p,const uint8_t *const eof,std::string &json,const unsigned int depth)
+{
+	if ((p >= eof)||(depth > 64))
+		return false;
+	const uint8_t c = *(p++);
+	uint64_t n = 0;
+	unsigned int nb = 0;
+	char tmp[32];
+	enum { T_UINT,T_INT,T_STR,T_ARRAY,T_MAP } t;
+
+	if (c <= 0x7f) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%u",(unsigned int)c);
+		json.append(tmp);
+		return true;
+	} else if (c >= 0xe0) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%d",(int)((int8_t)c));
+		json.append(tmp);
+		return true;
+	} else if (c <= 0x8f) {
+		t = T_MAP; n = c & 0x0f;
+	} else if (c <= 0x9f) {
+		t = T_ARRAY; n = c & 0x0f;
+	} else if (c <= 0xbf) {
+		t = T_STR; n = c & 0x1f;
+	} else {
+		switch(c) {
+			case 0xc0: json.append("null"); return true;
+			case 0xc2: json.append("false"); return true;
+			case 0xc3: json.append("true"); return true;
+			case 0xcc: t = T_UINT; nb = 1; break;
+			case 0xcd: t = T_UINT; nb = 2; break;
+			case 0xce: t = T_UINT; nb = 4; break;
+			case 0xcf: t = T_UINT; nb = 8; break;
+			case 0xd0: t = T_INT; nb = 1; break;
+			case 0xd1: t = T_INT; nb = 2; break;
+			case 0xd2: t = T_INT; nb = 4; break;
+			case 0xd3: t = T_INT; nb = 8; break;
+			case 0xd9: t = T_STR; nb = 1; break;
+			case 0xda: t = T_STR; nb = 2; break;
+			case 0xdb: t = T_STR; nb = 4; break;
+			case 0xdc: t = T_ARRAY; nb = 2; break;
+			case 0xdd: t = T_ARRAY; nb = 4; break;
+			case 0xde: t = T_MAP; nb = 2; break;
+			case 0xdf: t = T_MAP; nb = 4; break;
+			default: return false;
+		}
+		if ((unsigned long)(eof - p) < nb)
+			return false;
+		for(unsigned int i=0;i<nb;++i)
+			n = (n << 8) | (uint64_t)*(p++);
+	}
+
+	switch(t) {
+		case T_UINT:
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%llu",(unsigned long long)n);
+			json.append(tmp);
+			return true;
+		case T_INT: {
+			int64_t i;
+			switch(nb) {
+				case 1: i = (int8_t)n; break;
+				case 2: i = (int16_t)n; break;
+				case 4: i = (int32_t)n; break;
+				default: i = (int64_t)n; break;
+			}
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%lld",(long long)i);
+			json.append(tmp);
+			return true;
+		}
+		case T_STR: {
+			if ((uint64_t)(eof - p) < n)
+				return false;
+			static const char *const hexChars = "0123456789abcdef";
+			json.push_back('"');
+			for(const uint8_t *const e=p+n;p<e;++p) {
+				switch(*p) {
+					case '"': json.append("\\\""); break;
+					case '\\': json.append("\\\\"); break;
+					case '\b': json.append("\\b"); break;
+					case '\f': json.append("\\f"); break;
+					case '\n': json.append("\\n"); break;
+					case '\r': json.append("\\r"); break;
+					case '\t': json.append("\\t"); break;
+					default:
+						if (*p < 0x20) {
+							json.append("\\u00");
+							json.push_back(hexChars[*p >> 4]);
+							json.push_back(hexChars[*p & 0xf]);
+						} else json.push_back((char)*p);
+						break;
+				}
+			}
+			json.push_back('"');
+			return true;
+		}
+		case T_ARRAY:
+			json.push_back('[');
+			for(uint64_t i=0;i<n;++i) {
+				if (i)
+					json.push_back(',');
+				if (!_packedValueToJson(p,eof,json,depth + 1))
+					return false;
+			}
+			json.push_back(']');
+			return true;
+		case T_MAP:
+			json.push_back('{');
+			for(uint64_t i=0;i<n;++i) {
+				if (i)
+					json.push_back(',');
+				if ((p >= eof)||(!(((*p >= 0xa0)&&(*p <= 0xbf))||((*p >= 0xd9)&&(*p <= 0xdb))))) // keys must be strings
+					return false;
+				if (!_packedValueToJson(p,eof,json,depth + 1))
+					return false;
+				json.push_back(':');
+				if (!_packedValueToJson(p,eof,json,depth + 1))
+					return false;
+			}
+			json.push_back('}');
+			return true;
+	}
+	return false;
+}
+
+bool JSONDB::packedToJson(const std::vector<uint8_t> &packed,std::string &json)
+{
+	json.clear();
+	if (packed.empty())
 		return false;
-	const std::unordered_map< uint64_t,std::vector<uint8_t> >::const_iterator j(i->second.members.find(nodeId));
-	if (j == i->second.members.end())
+	const uint8_t *p = packed.data();
+	if ((_packedValueToJson(p,p + packed.size(),json,0))&&(p == (packed.data() + packed.size())))
+		return true;
+	try {
+		json = OSUtils::jsonDump(nlohmann::json::from_msgpack(packed),-1);
+		return true;
+	} catch ( ... ) {}
+	json.clear();
+	return false;
+}
+
+bool JSONDB::nextFreeIpv4(const uint64_t networkId,const uint32_t first,const uint32_t last,uint32_t &ip) const
+{
+	if (first > last)
 		return false;
-	memberConfig = nlohmann::json::from_msgpack(j->second);
+	_waitForNetwork(networkId);
+	const SharedPtr<_NW> nw(_network(networkId));
+	uint32_t x = first;
+	if (nw) {
+		_RLock _l(*this,nw->lock);
+		// Runs are merged, so the address after the run containing x is free
+		std::map<uint32_t,uint32_t>::const_iterator r(nw->allocatedIpv4.upper_bound(x));
+		if (r != nw->allocatedIpv4.begin()) {
+			--r;
+			if (r->second >= x) {
+				if (r->second >= last)
+					return false;
+				x = r->second + 1;
+			}
+		}
+	}
+	ip = x;
 	return true;
 }
 
 void JSONDB::saveNetwork(const uint64_t networkId,const nlohmann::json &networkConfig)
 {
+	_waitForNetwork(networkId);
 	char n[64];
 	OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx",(unsigned long long)networkId);
-	writeRaw(n,OSUtils::jsonDump(networkConfig,-1));
+	std::vector<uint8_t> config(nlohmann::json::to_msgpack(networkConfig));
+	if (_logPath.length() > 0)
+		_logAppend(n,&config);
+	else writeRaw(n,OSUtils::jsonDump(networkConfig,-1));
+	const uint64_t revision = OSUtils::jsonInt(_memberField(networkConfig,"revision"),0ULL);
 	{
-		Mutex::Lock _l(_networks_m);
-		_networks[networkId].config = nlohmann::json::to_msgpack(networkConfig);
+		const SharedPtr<_NW> nw(_networkCreate(networkId));
+		_WLock _l(*this,nw->lock);
+		nw->config.swap(config);
+		nw->revision = revision;
 	}
 	_recomputeSummaryInfo(networkId);
+	_feedRecord(networkId,0,false);
 }
 
 void JSONDB::saveNetworkMember(const uint64_t networkId,const uint64_t nodeId,const nlohmann::json &memberConfig)
 {
+	_waitForNetwork(networkId);
 	char n[256];
 	OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx/member/%.10llx",(unsigned long long)networkId,(unsigned long long)nodeId);
-	writeRaw(n,OSUtils::jsonDump(memberConfig,-1));
-	{
-		Mutex::Lock _l(_networks_m);
-		_networks[networkId].members[nodeId] = nlohmann::json::to_msgpack(memberConfig);
-		_members[nodeId].insert(networkId);
+	std::vector<uint8_t> config(nlohmann::json::to_msgpack(memberConfig));
+	if (_logPath.length() > 0)
+		_logAppend(n,&config);
+	else writeRaw(n,OSUtils::jsonDump(memberConfig,-1));
+	_putMember(networkId,nodeId,memberConfig,config);
+	_feedRecord(networkId,nodeId,false);
+}
+
+void JSONDB::saveNetworkMembers(const uint64_t networkId,const std::vector< std::pair< uint64_t,nlohmann::json > > &members)
+{
+	if (members.empty())
+		return;
+	_waitForNetwork(networkId);
+	std::vector< std::pair< std::string,std::vector<uint8_t> > > records;
+	records.reserve(members.size());
+	char n[256];
+	for(std::vector< std::pair< uint64_t,nlohmann::json > >::const_iterator m(members.begin());m!=members.end();++m) {
+		OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx/member/%.10llx",(unsigned long long)networkId,(unsigned long long)m->first);
+		records.push_back(std::pair< std::string,std::vector<uint8_t> >(std::string(n),nlohmann::json::to_msgpack(m->second)));
+		if (_logPath.length() == 0)
+			writeRaw(records.back().first,OSUtils::jsonDump(m->second,-1));
+	}
+	if (_logPath.length() > 0)
+		_logAppendAll(records);
+	for(unsigned long i=0;i<(unsigned long)members.size();++i) {
+		_putMember(networkId,members[i].first,members[i].second,records[i].second);
+		_feedRecord(networkId,members[i].first,false);
 	}
-	_recomputeSummaryInfo(networkId);
 }
 
 nlohmann::json JSONDB::eraseNetwork(const uint64_t networkId)
 {
+	_waitForNetwork(networkId);
 	if (!_httpAddr) { // Member deletion is done by Central in harnessed mode, and deleting the cache network entry also deletes all members
 		std::vector<uint64_t> memberIds;
 		{
-			Mutex::Lock _l(_networks_m);
-			const std::unordered_map<uint64_t,_NW>::iterator i(_networks.find(networkId));
-			if (i == _networks.end())
+			const SharedPtr<_NW> nw(_network(networkId));
+			if (!nw)
 				return _EMPTY_JSON;
-			for(std::unordered_map< uint64_t,std::vector<uint8_t> >::iterator m(i->second.members.begin());m!=i->second.members.end();++m)
+			_RLock _l(*this,nw->lock);
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->members.begin());m!=nw->members.end();++m)
 				memberIds.push_back(m->first);
 		}
 		for(std::vector<uint64_t>::iterator m(memberIds.begin());m!=memberIds.end();++m)
-			eraseNetworkMember(networkId,*m,false);
+			eraseNetworkMember(networkId,*m);
 	}
 
 	char n[256];
 	OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx",(unsigned long long)networkId);
 
+	if (_logPath.length() > 0)
+		_logAppend(n,(const std::vector<uint8_t> *)0); // also remove any JSON file left from before the switch to a log
+
 	if (_rawOutput >= 0) {
 		// In harnessed mode, deletes occur in Central or other management
 		// software and do not need to be executed this way.
 	} else if (_httpAddr) {
-		std::map<std::string,std::string> headers;
-		std::string body;
-		Http::DEL(0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),(_basePath+"/"+n).c_str(),_ZT_JSONDB_GET_HEADERS,headers,body);
+		_queueWrite(n,std::string(),true);
 	} else {
 		const std::string path(_genPath(n,false));
 		if (path.length())
 			OSUtils::rm(path.c_str());
 	}
 
-	{
-		Mutex::Lock _l(_networks_m);
-		std::unordered_map<uint64_t,_NW>::iterator i(_networks.find(networkId));
-		if (i == _networks.end())
-			return _EMPTY_JSON; // sanity check, shouldn't happen
-		nlohmann::json tmp(nlohmann::json::from_msgpack(i->second.config));
-		_networks.erase(i);
-		return tmp;
-	}
+	std::vector<uint8_t> config;
+	if (!_dropNetwork(networkId,config))
+		return _EMPTY_JSON; // sanity check, shouldn't happen
+	return nlohmann::json::from_msgpack(config);
 }
 
-nlohmann::json JSONDB::eraseNetworkMember(const uint64_t networkId,const uint64_t nodeId,bool recomputeSummaryInfo)
+nlohmann::json JSONDB::eraseNetworkMember(const uint64_t networkId,const uint64_t nodeId)
 {
+	_waitForNetwork(networkId);
 	char n[256];
 	OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx/member/%.10llx",(unsigned long long)networkId,(unsigned long long)nodeId);
 
+	if (_logPath.length() > 0)
+		_logAppend(n,(const std::vector<uint8_t> *)0);
+
 	if (_rawOutput >= 0) {
 		// In harnessed mode, deletes occur in Central or other management
 		// software and do not need to be executed this way.
 	} else if (_httpAddr) {
-		std::map<std::string,std::string> headers;
-		std::string body;
-		Http::DEL(0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),(_basePath+"/"+n).c_str(),_ZT_JSONDB_GET_HEADERS,headers,body);
+		_queueWrite(n,std::string(),true);
 	} else {
 		const std::string path(_genPath(n,false));
 		if (path.length())
 			OSUtils::rm(path.c_str());
 	}
 
-	{
-		Mutex::Lock _l(_networks_m);
-		_members[nodeId].erase(networkId);
-		std::unordered_map<uint64_t,_NW>::iterator i(_networks.find(networkId));
-		if (i == _networks.end())
-			return _EMPTY_JSON;
-		std::unordered_map< uint64_t,std::vector<uint8_t> >::iterator j(i->second.members.find(nodeId));
-		if (j == i->second.members.end())
-			return _EMPTY_JSON;
-		nlohmann::json tmp(j->second);
-		i->second.members.erase(j);
-		if (recomputeSummaryInfo)
-			_recomputeSummaryInfo(networkId);
-		return tmp;
-	}
+	std::vector<uint8_t> config;
+	if (!_dropMember(networkId,nodeId,config))
+		return _EMPTY_JSON;
+	return nlohmann::json::from_msgpack(config);
 }
 
 void JSONDB::threadMain()
 	throw()
 {
+	CpuAffinity::apply(CpuAffinity::THREAD_CONTROLLER);
 #ifndef __WINDOWS__
 	fd_set readfds,nullfds;
 	char *const readbuf = (_rawInput >= 0) ? (new char[1048576]) : (char *)0;
@@ -316,6 +789,8 @@ void JSONDB::threadMain()
 #endif
 
 	std::vector<uint64_t> todo;
+	uint64_t lastSummaryCheck = OSUtils::now();
+	uint64_t lastLogCompactCheck = lastSummaryCheck;
 
 	while (_summaryThreadRun) {
 #ifndef __WINDOWS__
@@ -339,17 +814,13 @@ void JSONDB::threadMain()
 							const nlohmann::json obj(OSUtils::jsonParse(rawInputBuf));
 
 							gotMessage = true;
-							if (!_dataReady) {
-								_dataReady = true;
-								_networks_m.unlock();
-							}
-
 							if (obj.is_array()) {
 								for(unsigned long i=0;i<obj.size();++i)
 									_add(obj[i]);
 							} else if (obj.is_object()) {
 								_add(obj);
 							}
+							_dataReady = true;
 						} catch ( ... ) {} // ignore malformed JSON
 						rawInputBuf.clear();
 					}
@@ -362,6 +833,23 @@ void JSONDB::threadMain()
 		Thread::sleep(25);
 #endif
 
+		if ((_dataReady)&&((OSUtils::now() - lastSummaryCheck) >= ZT_JSONDB_SUMMARY_CHECK_INTERVAL)) {
+			lastSummaryCheck = OSUtils::now();
+			const std::vector<uint64_t> nwids(networkIds());
+			Mutex::Lock _l(_summaryThread_m);
+			for(std::vector<uint64_t>::const_iterator n(nwids.begin());n!=nwids.end();++n) {
+				if (std::find(_summaryThreadToDo.begin(),_summaryThreadToDo.end(),*n) == _summaryThreadToDo.end())
+					_summaryThreadToDo.push_back(*n);
+			}
+		}
+
+		if ((_logPath.length() > 0)&&((OSUtils::now() - lastLogCompactCheck) >= ZT_JSONDB_LOG_COMPACT_CHECK_INTERVAL)) {
+			lastLogCompactCheck = OSUtils::now();
+			Mutex::Lock _l(_log_m);
+			if ((_logSize >= ZT_JSONDB_LOG_COMPACT_MIN_SIZE)&&((_logLiveSize * 2) <= _logSize))
+				_logCompact();
+		}
+
 		{
 			Mutex::Lock _l(_summaryThread_m);
 			if (_summaryThreadToDo.empty())
@@ -369,88 +857,53 @@ void JSONDB::threadMain()
 			else _summaryThreadToDo.swap(todo);
 		}
 
-		if (!_dataReady) {
-			_dataReady = true;
-			_networks_m.unlock();
-		}
-
 		const uint64_t now = OSUtils::now();
-		try {
-			Mutex::Lock _l(_networks_m);
-			for(std::vector<uint64_t>::iterator ii(todo.begin());ii!=todo.end();++ii) {
-				const uint64_t networkId = *ii;
-				std::unordered_map<uint64_t,_NW>::iterator n(_networks.find(networkId));
-				if (n != _networks.end()) {
-					NetworkSummaryInfo &ns = n->second.summaryInfo;
-					ns.activeBridges.clear();
-					ns.allocatedIps.clear();
-					ns.authorizedMemberCount = 0;
-					ns.activeMemberCount = 0;
-					ns.totalMemberCount = 0;
-					ns.mostRecentDeauthTime = 0;
-
-					for(std::unordered_map< uint64_t,std::vector<uint8_t> >::const_iterator m(n->second.members.begin());m!=n->second.members.end();++m) {
-						try {
-							nlohmann::json member(nlohmann::json::from_msgpack(m->second));
-
-							if (OSUtils::jsonBool(member["authorized"],false)) {
-								++ns.authorizedMemberCount;
-
-								try {
-									const nlohmann::json &mlog = member["recentLog"];
-									if ((mlog.is_array())&&(mlog.size() > 0)) {
-										const nlohmann::json &mlog1 = mlog[0];
-										if (mlog1.is_object()) {
-											if ((now - OSUtils::jsonInt(mlog1["ts"],0ULL)) < (ZT_NETWORK_AUTOCONF_DELAY * 2))
-												++ns.activeMemberCount;
-										}
-									}
-								} catch ( ... ) {}
-
-								try {
-									if (OSUtils::jsonBool(member["activeBridge"],false))
-										ns.activeBridges.push_back(Address(m->first));
-								} catch ( ... ) {}
-
-								try {
-									const nlohmann::json &mips = member["ipAssignments"];
-									if (mips.is_array()) {
-										for(unsigned long i=0;i<mips.size();++i) {
-											InetAddress mip(OSUtils::jsonString(mips[i],"").c_str());
-											if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
-												ns.allocatedIps.push_back(mip);
-										}
-									}
-								} catch ( ... ) {}
-							} else {
-								try {
-									ns.mostRecentDeauthTime = std::max(ns.mostRecentDeauthTime,OSUtils::jsonInt(member["lastDeauthorizedTime"],0ULL));
-								} catch ( ... ) {}
-							}
-							++ns.totalMemberCount;
-						} catch ( ... ) {}
+		for(std::vector<uint64_t>::iterator ii(todo.begin());ii!=todo.end();++ii) {
+			try {
+				// Only this network is locked, and only for a pass over its decoded records
+				const SharedPtr<_NW> nw(_network(*ii));
+				if (nw) {
+					_WLock _l(*this,nw->lock);
+					NetworkSummaryInfo ns;
+					for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->members.begin());m!=nw->members.end();++m) {
+						const MemberRecord &r = m->second.record;
+						if (r.authorized) {
+							++ns.authorizedMemberCount;
+							if ((now - r.lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2))
+								++ns.activeMemberCount;
+							if (r.activeBridge)
+								ns.activeBridges.push_back(Address(m->first));
+							if (r.multicastReplicator)
+								ns.multicastReplicators.push_back(Address(m->first));
+							if (r.relay)
+								ns.relays.push_back(Address(m->first));
+							ns.allocatedIps.insert(ns.allocatedIps.end(),r.ipAssignments.begin(),r.ipAssignments.end());
+						} else {
+							ns.mostRecentDeauthTime = std::max(ns.mostRecentDeauthTime,r.lastDeauthorizedTime);
+						}
+						++ns.totalMemberCount;
 					}
 
 					std::sort(ns.activeBridges.begin(),ns.activeBridges.end());
+					std::sort(ns.multicastReplicators.begin(),ns.multicastReplicators.end());
+					std::sort(ns.relays.begin(),ns.relays.end());
 					std::sort(ns.allocatedIps.begin(),ns.allocatedIps.end());
 
-					n->second.summaryInfoLastComputed = now;
+					std::swap(nw->summaryInfo,ns);
+					nw->summaryInfoLastComputed = now;
 				}
-			}
-		} catch ( ... ) {}
+			} catch ( ... ) {}
+		}
 
 		todo.clear();
 	}
 
-	if (!_dataReady) // sanity check
-		_networks_m.unlock();
-
 #ifndef __WINDOWS__
 	delete [] readbuf;
 #endif
 }
 
-bool JSONDB::_add(const nlohmann::json &j)
+bool JSONDB::_add(const nlohmann::json &j,std::vector<uint8_t> *packed)
 {
 	try {
 		if (j.is_object()) {
@@ -460,17 +913,32 @@ bool JSONDB::_add(const nlohmann::json &j)
 			if ((id.length() == 16)&&(objtype == "network")) {
 				const uint64_t nwid = Utils::hexStrToU64(id.c_str());
 				if (nwid) {
-					Mutex::Lock _l(_networks_m);
-					_networks[nwid].config = nlohmann::json::to_msgpack(j);
+					const SharedPtr<_NW> nw(_networkCreate(nwid));
+					std::vector<uint8_t> config;
+					if (packed)
+						config.swap(*packed);
+					else config = nlohmann::json::to_msgpack(j);
+					const uint64_t revision = OSUtils::jsonInt(_memberField(j,"revision"),0ULL);
+					{
+						_WLock _l(*this,nw->lock);
+						nw->config.swap(config);
+						nw->revision = revision;
+					}
+					if (_dataReady) // an update rather than the initial load
+						_feedRecord(nwid,0,false);
 					return true;
 				}
 			} else if ((id.length() == 10)&&(objtype == "member")) {
 				const uint64_t mid = Utils::hexStrToU64(id.c_str());
 				const uint64_t nwid = Utils::hexStrToU64(OSUtils::jsonString(j["nwid"],"0").c_str());
 				if ((mid)&&(nwid)) {
-					Mutex::Lock _l(_networks_m);
-					_networks[nwid].members[mid] = nlohmann::json::to_msgpack(j);
-					_members[mid].insert(nwid);
+					std::vector<uint8_t> config;
+					if (packed)
+						config.swap(*packed);
+					else config = nlohmann::json::to_msgpack(j);
+					_putMember(nwid,mid,j,config);
+					if (_dataReady)
+						_feedRecord(nwid,mid,false);
 					return true;
 				}
 			}
@@ -489,13 +957,12 @@ bool JSONDB::_load(const std::string &p)
 
 		std::string body;
 		std::map<std::string,std::string> headers;
-		const unsigned int sc = Http::GET(0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),_basePath.c_str(),_ZT_JSONDB_GET_HEADERS,headers,body);
+		const unsigned int sc = _httpPool.request("GET",0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),_basePath.c_str(),_httpHeaders,(const void *)0,0,headers,body);
 		if (sc == 200) {
 			try {
 				nlohmann::json dbImg(OSUtils::jsonParse(body));
 				std::string tmp;
 				if (dbImg.is_object()) {
-					Mutex::Lock _l(_networks_m);
 					for(nlohmann::json::iterator i(dbImg.begin());i!=dbImg.end();++i) {
 						try {
 							_add(i.value());
@@ -528,6 +995,872 @@ bool JSONDB::_load(const std::string &p)
 	}
 }
 
+void JSONDB::_loadInParallel()
+{
+	// Each network's file and member directory are loaded together by one worker
+	const std::string nwPath(_basePath + ZT_PATH_SEPARATOR_S "network");
+	std::vector<uint64_t> nwids;
+	std::vector<std::string> dl(OSUtils::listDirectory(nwPath.c_str(),true));
+	for(std::vector<std::string>::const_iterator di(dl.begin());di!=dl.end();++di) {
+		const std::string id(((di->length() > 5)&&(di->substr(di->length() - 5) == ".json")) ? di->substr(0,di->length() - 5) : *di);
+		if (id.length() == 16) {
+			const uint64_t nwid = Utils::hexStrToU64(id.c_str());
+			if (nwid)
+				nwids.push_back(nwid);
+		}
+	}
+	std::sort(nwids.begin(),nwids.end());
+	nwids.erase(std::unique(nwids.begin(),nwids.end()),nwids.end());
+	{
+		Mutex::Lock _l(_loading_m);
+		_loading.insert(nwids.begin(),nwids.end());
+	}
+	_loadingKnown = true;
+
+	std::vector<uint64_t>::const_iterator next(nwids.begin());
+	Mutex next_m;
+	std::vector<std::thread> workers;
+	const unsigned int threadCount = std::max(std::min(std::thread::hardware_concurrency(),(unsigned int)ZT_JSONDB_MAX_LOAD_THREADS),1U);
+	for(unsigned int t=0;t<threadCount;++t) {
+		workers.push_back(std::thread([this,&nwids,&next,&next_m,&nwPath]() {
+			char tmp[32];
+			for(;;) {
+				uint64_t nwid;
+				{
+					Mutex::Lock _l(next_m);
+					if (next == nwids.end())
+						return;
+					nwid = *(next++);
+				}
+
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+				const std::string p(nwPath + ZT_PATH_SEPARATOR_S + tmp);
+				std::string buf;
+				if (OSUtils::readFile((p + ".json").c_str(),buf)) {
+					try {
+						_add(OSUtils::jsonParse(buf));
+					} catch ( ... ) {}
+				}
+				_load(p);
+
+				Mutex::Lock _l(_loading_m);
+				_loading.erase(nwid);
+			}
+		}));
+	}
+	for(std::vector<std::thread>::iterator t(workers.begin());t!=workers.end();++t)
+		t->join();
+
+	// Anything else is read as before, except traces, which are never loaded
+	dl = OSUtils::listDirectory(_basePath.c_str(),true);
+	for(std::vector<std::string>::const_iterator di(dl.begin());di!=dl.end();++di) {
+		if ((*di == "network")||(*di == "trace"))
+			continue;
+		const std::string p(_basePath + ZT_PATH_SEPARATOR_S + *di);
+		if ((di->length() > 5)&&(di->substr(di->length() - 5) == ".json")) {
+			std::string buf;
+			if (OSUtils::readFile(p.c_str(),buf)) {
+				try {
+					_add(OSUtils::jsonParse(buf));
+				} catch ( ... ) {}
+			}
+		} else {
+			_load(p);
+		}
+	}
+
+	_loadComplete();
+}
+
+void JSONDB::_loadComplete()
+{
+	// Summaries were built incrementally as data was loaded, but a first
+	// full recount makes sure activity counts start out exact.
+	std::unordered_set<uint64_t> nwids;
+	{
+		_RLock _l(*this,_networks_m);
+		for(std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator n(_networks.begin());n!=_networks.end();++n)
+			nwids.insert(n->first);
+	}
+	Mutex::Lock _l(_summaryThread_m);
+	for(std::vector<uint64_t>::const_iterator n(_summaryThreadToDo.begin());n!=_summaryThreadToDo.end();++n)
+		nwids.erase(*n); // already queued by a save during loading
+	_summaryThreadToDo.insert(_summaryThreadToDo.end(),nwids.begin(),nwids.end());
+	_dataReady = true;
+	if ((!_summaryThread)&&((_summaryThreadToDo.size() > 0)||(_logPath.length() > 0))) // the summary thread also compacts the log
+		_summaryThread = Thread::start(this);
+}
+
+SharedPtr<JSONDB::_NW> JSONDB::_networkCreate(const uint64_t networkId)
+{
+	_WLock _l(*this,_networks_m);
+	SharedPtr<_NW> &nw = _networks[networkId];
+	if (!nw)
+		nw.setToUnsafe(new _NW());
+	return nw;
+}
+
+void JSONDB::_putMember(const uint64_t networkId,const uint64_t nodeId,const nlohmann::json &memberConfig,std::vector<uint8_t> &packed)
+{
+	// Decode before locking anything
+	MemberRecord r;
+	_decodeMemberRecord(memberConfig,r);
+
+	SharedPtr<_NW> nw;
+	{
+		_WLock _l(*this,_networks_m);
+		SharedPtr<_NW> &n = _networks[networkId];
+		if (!n)
+			n.setToUnsafe(new _NW());
+		nw = n;
+		_members[nodeId].insert(networkId);
+	}
+
+	_WLock _l(*this,nw->lock);
+	std::unordered_map< uint64_t,_Member >::iterator m(nw->members.find(nodeId));
+	if (m == nw->members.end()) {
+		_memberChanged(*nw,nodeId,(const MemberRecord *)0,&r);
+		m = nw->members.insert(std::pair< uint64_t,_Member >(nodeId,_Member())).first;
+	} else {
+		_memberChanged(*nw,nodeId,&(m->second.record),&r);
+	}
+	m->second.config.swap(packed);
+	std::swap(m->second.record,r);
+}
+
+void JSONDB::_queueWrite(const std::string &n,const std::string &obj,const bool del)
+{
+	std::lock_guard<std::mutex> l(_writes_m);
+	_queueWriteLocked(n,obj,del);
+}
+
+void JSONDB::_queueWriteLocked(const std::string &n,const std::string &obj,const bool del)
+{
+	std::unordered_map< std::string,_PendingWrite >::iterator w(_writes.find(n));
+	if (w == _writes.end()) {
+		_PendingWrite &pw = _writes[n];
+		pw.obj = obj;
+		pw.queuedAt = OSUtils::now();
+		pw.del = del;
+		_writeOrder.push_back(n);
+		_writes_c.notify_one();
+	} else {
+		// Keep its place in line, since it's been waiting since it was first queued
+		w->second.obj = obj;
+		w->second.del = del;
+		++_writeStats.coalesced;
+	}
+}
+
+void JSONDB::_writerMain()
+{
+	std::vector< std::pair< std::string,_PendingWrite > > sent;
+	std::vector<Http::Request> batch;
+	std::vector<unsigned int> statusCodes;
+	char tmp[64];
+
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> l(_writes_m);
+			while ((_writerRun)&&(_writeOrder.empty()))
+				_writes_c.wait(l);
+			if (_writeOrder.empty())
+				break; // stopped with nothing left to write
+			while ((!_writeOrder.empty())&&(sent.size() < ZT_JSONDB_HTTP_BATCH_SIZE)) {
+				std::unordered_map< std::string,_PendingWrite >::iterator w(_writes.find(_writeOrder.front()));
+				if (w != _writes.end()) {
+					sent.push_back(std::pair< std::string,_PendingWrite >(w->first,w->second));
+					_writes.erase(w);
+				}
+				_writeOrder.pop_front();
+			}
+		}
+
+		batch.resize(sent.size());
+		for(unsigned long i=0;i<sent.size();++i) {
+			Http::Request &r = batch[i];
+			r.path = _basePath + "/" + sent[i].first;
+			r.headers = _httpHeaders;
+			if (sent[i].second.del) {
+				r.method = "DELETE";
+				r.body.clear();
+			} else {
+				r.method = "PUT";
+				r.body.swap(sent[i].second.obj);
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%lu",(unsigned long)r.body.length());
+				r.headers["Content-Length"] = tmp;
+				r.headers["Content-Type"] = "application/json";
+			}
+		}
+		_httpPool.batch(ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),batch,statusCodes);
+
+		const uint64_t now = OSUtils::now();
+		bool progress = false;
+		std::unique_lock<std::mutex> l(_writes_m);
+		// Go backwards so that anything retried goes back on the front in its original order
+		for(unsigned long i=(unsigned long)sent.size();i>0;) {
+			--i;
+			const unsigned int sc = (i < statusCodes.size()) ? statusCodes[i] : 0;
+			if ((sc == 200)||((sent[i].second.del)&&(sc != 0))) { // deletes of objects that are already gone are fine
+				progress = true;
+				++_writeStats.writes;
+				const uint64_t lat = (now > sent[i].second.queuedAt) ? (now - sent[i].second.queuedAt) : 0;
+				_writeStats.latency = (_writeStats.writes == 1) ? lat : (((_writeStats.latency * 7) + lat) / 8);
+				continue;
+			}
+
+			if (sc != 0)
+				++_writeStats.failures;
+			if ((sc >= 400)&&(sc < 500)) {
+				progress = true; // the server got it but won't take it, so there's no point retrying
+				continue;
+			}
+			std::unordered_map< std::string,_PendingWrite >::iterator w(_writes.find(sent[i].first));
+			if (w == _writes.end()) {
+				_PendingWrite &pw = _writes[sent[i].first];
+				pw = sent[i].second;
+				if (!pw.del)
+					pw.obj.swap(batch[i].body);
+				_writeOrder.push_front(sent[i].first);
+			} else {
+				// A newer write was queued while this one was in flight, so it replaces this one
+				w->second.queuedAt = std::min(w->second.queuedAt,sent[i].second.queuedAt);
+				++_writeStats.coalesced;
+			}
+		}
+		if (statusCodes.size() < sent.size())
+			++_writeStats.failures; // couldn't connect or the connection was lost
+		sent.clear();
+
+		if (!progress) {
+			// Back off if the backend is down, and give up on what's left if we're shutting down
+			if (!_writerRun)
+				break;
+			_writes_c.wait_for(l,std::chrono::milliseconds(ZT_JSONDB_HTTP_RETRY_DELAY),[this]() { return (!_writerRun); });
+		}
+	}
+}
+
+bool JSONDB::_logOpen()
+{
+	std::string buf;
+	if (!OSUtils::readFile(_logPath.c_str(),buf)) {
+		// There's no log yet, so start one with whatever is in per-object JSON files
+		_load(_basePath);
+		std::vector< std::pair< std::string,std::vector<uint8_t> > > records;
+		char n[256];
+		for(std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator nw(_networks.begin());nw!=_networks.end();++nw) {
+			_RLock _l(*this,nw->second->lock);
+			OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx",(unsigned long long)nw->first);
+			records.push_back(std::pair< std::string,std::vector<uint8_t> >(n,nw->second->config));
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->second->members.begin());m!=nw->second->members.end();++m) {
+				OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx/member/%.10llx",(unsigned long long)nw->first,(unsigned long long)m->first);
+				records.push_back(std::pair< std::string,std::vector<uint8_t> >(n,m->second.config));
+			}
+		}
+		Mutex::Lock _l(_log_m);
+		return _logReplace(records);
+	}
+
+	if ((buf.length() < 8)||(memcmp(buf.data(),ZT_JSONDB_LOG_MAGIC,8) != 0))
+		return false;
+
+	// Index the most recent record for each name
+	std::unordered_map< std::string,_LogEntry > index;
+	uint64_t ptr = 8,live = 8;
+	const uint8_t *const b = reinterpret_cast<const uint8_t *>(buf.data());
+	while ((ptr + ZT_JSONDB_LOG_RECORD_HEADER_SIZE) <= (uint64_t)buf.length()) {
+		const uint8_t *const r = b + ptr;
+		const uint32_t cs = ((uint32_t)r[0] << 24) | ((uint32_t)r[1] << 16) | ((uint32_t)r[2] << 8) | (uint32_t)r[3];
+		const uint64_t nl = ((uint64_t)r[5] << 8) | (uint64_t)r[6];
+		const uint64_t ol = ((uint64_t)r[7] << 24) | ((uint64_t)r[8] << 16) | ((uint64_t)r[9] << 8) | (uint64_t)r[10];
+		const uint64_t size = ZT_JSONDB_LOG_RECORD_HEADER_SIZE + nl + ol;
+		if (((ptr + size) > (uint64_t)buf.length())||(_logChecksum(r + 4,size - 4) != cs))
+			break;
+
+		const std::string n(reinterpret_cast<const char *>(r + ZT_JSONDB_LOG_RECORD_HEADER_SIZE),(std::size_t)nl);
+		std::unordered_map< std::string,_LogEntry >::iterator e(index.find(n));
+		if (e != index.end())
+			live -= e->second.size;
+		if (r[4] == ZT_JSONDB_LOG_RECORD_PUT) {
+			_LogEntry &ne = index[n];
+			ne.offset = ptr;
+			ne.size = size;
+			live += size;
+		} else if (e != index.end()) {
+			index.erase(e);
+		}
+
+		ptr += size;
+	}
+
+	for(std::unordered_map< std::string,_LogEntry >::const_iterator e(index.begin());e!=index.end();++e) {
+		const uint8_t *const o = b + e->second.offset + ZT_JSONDB_LOG_RECORD_HEADER_SIZE + (uint64_t)e->first.length();
+		std::vector<uint8_t> packed(o,b + e->second.offset + e->second.size);
+		try {
+			_add(nlohmann::json::from_msgpack(packed),&packed);
+		} catch ( ... ) {}
+	}
+	const bool torn = (ptr < (uint64_t)buf.length());
+	std::string().swap(buf);
+
+	Mutex::Lock _l(_log_m);
+	_log = fopen(_logPath.c_str(),"a+b");
+	if (!_log)
+		return false;
+	_logIndex.swap(index);
+	_logSize = ptr;
+	_logLiveSize = live;
+	if (torn) {
+		fprintf(stderr,"WARNING: controller log '%s' has a bad record at %llu, discarding the rest" ZT_EOL_S,_logPath.c_str(),(unsigned long long)ptr);
+		_logCompact();
+	}
+	return true;
+}
+
+void JSONDB::_logAppend(const std::string &n,const std::vector<uint8_t> *obj)
+{
+	static const std::vector<uint8_t> empty;
+	std::string r;
+	_logRecord(r,(obj) ? ZT_JSONDB_LOG_RECORD_PUT : ZT_JSONDB_LOG_RECORD_ERASE,n,(obj) ? *obj : empty);
+
+	Mutex::Lock _l(_log_m);
+	if ((!obj)&&(_logIndex.find(n) == _logIndex.end()))
+		return; // nothing to erase
+
+	if (!_logWrite(r))
+		return;
+
+	std::unordered_map< std::string,_LogEntry >::iterator e(_logIndex.find(n)); // after _logWrite(), which may compact
+	if (e != _logIndex.end()) {
+		_logLiveSize -= e->second.size;
+		if (!obj)
+			_logIndex.erase(e);
+	}
+	if (obj) {
+		_LogEntry &ne = _logIndex[n];
+		ne.offset = _logSize;
+		ne.size = (uint64_t)r.length();
+		_logLiveSize += ne.size;
+	}
+	_logSize += (uint64_t)r.length();
+}
+
+void JSONDB::_logAppendAll(const std::vector< std::pair< std::string,std::vector<uint8_t> > > &records)
+{
+	std::string r,rec;
+	std::vector<uint64_t> sizes;
+	sizes.reserve(records.size());
+	for(std::vector< std::pair< std::string,std::vector<uint8_t> > >::const_iterator i(records.begin());i!=records.end();++i) {
+		_logRecord(rec,ZT_JSONDB_LOG_RECORD_PUT,i->first,i->second);
+		r.append(rec);
+		sizes.push_back((uint64_t)rec.length());
+	}
+
+	Mutex::Lock _l(_log_m);
+	if (!_logWrite(r))
+		return;
+
+	for(unsigned long i=0;i<(unsigned long)records.size();++i) {
+		_LogEntry &e = _logIndex[records[i].first];
+		if (e.size)
+			_logLiveSize -= e.size;
+		e.offset = _logSize;
+		e.size = sizes[i];
+		_logLiveSize += e.size;
+		_logSize += e.size;
+	}
+}
+
+bool JSONDB::_logWrite(const std::string &r)
+{
+	for(unsigned int tries=0;;++tries) {
+		// A compaction that replaced the log but couldn't reopen it leaves that to the next write
+		if ((!_log)&&(OSUtils::fileExists(_logPath.c_str())))
+			_log = fopen(_logPath.c_str(),"a+b");
+		if (_log) {
+			if ((fwrite(r.data(),1,r.length(),_log) == r.length())&&(fflush(_log) == 0))
+				return true;
+			clearerr(_log);
+		}
+		// Rewriting from the index drops any partial record from the end of the log before trying again
+		if ((tries > 0)||(!_logCompact())) {
+			fprintf(stderr,"ERROR: controller unable to write to log '%s', change not saved to disk" ZT_EOL_S,_logPath.c_str());
+			return false;
+		}
+	}
+}
+
+bool JSONDB::_logCompact()
+{
+	if (!_log)
+		return false;
+
+	// Copy current records out of the log itself rather than from memory, since
+	// a save may have been appended here but not yet applied to _networks.
+	std::vector< std::pair< std::string,std::vector<uint8_t> > > records;
+	records.reserve(_logIndex.size());
+	std::string r;
+	for(std::unordered_map< std::string,_LogEntry >::const_iterator e(_logIndex.begin());e!=_logIndex.end();++e) {
+		r.resize((std::size_t)e->second.size);
+		if ((!_logSeek(_log,e->second.offset))||(fread(&(r[0]),1,r.length(),_log) != r.length())) {
+			clearerr(_log);
+			fseek(_log,0,SEEK_END); // a write can't directly follow a read
+			return false;
+		}
+		const uint8_t *const o = reinterpret_cast<const uint8_t *>(r.data()) + ZT_JSONDB_LOG_RECORD_HEADER_SIZE + e->first.length();
+		records.push_back(std::pair< std::string,std::vector<uint8_t> >(e->first,std::vector<uint8_t>(o,reinterpret_cast<const uint8_t *>(r.data()) + r.length())));
+	}
+	return _logReplace(records);
+}
+
+bool JSONDB::_logReplace(const std::vector< std::pair< std::string,std::vector<uint8_t> > > &records)
+{
+	const std::string tmpPath(_logPath + ".tmp");
+	FILE *f = fopen(tmpPath.c_str(),"wb");
+	if (!f)
+		return false;
+	OSUtils::lockDownFile(tmpPath.c_str(),false);
+
+	std::unordered_map< std::string,_LogEntry > index;
+	uint64_t size = 8;
+	bool ok = (fwrite(ZT_JSONDB_LOG_MAGIC,1,8,f) == 8);
+	std::string r;
+	for(std::vector< std::pair< std::string,std::vector<uint8_t> > >::const_iterator rec(records.begin());((ok)&&(rec!=records.end()));++rec) {
+		_logRecord(r,ZT_JSONDB_LOG_RECORD_PUT,rec->first,rec->second);
+		ok = (fwrite(r.data(),1,r.length(),f) == r.length());
+		_LogEntry &e = index[rec->first];
+		e.offset = size;
+		e.size = (uint64_t)r.length();
+		size += e.size;
+	}
+	ok &= (fflush(f) == 0);
+#ifndef __WINDOWS__
+	ok &= (fsync(fileno(f)) == 0); // this is about to become the only copy
+#endif
+	fclose(f);
+	if (!ok) {
+		OSUtils::rm(tmpPath.c_str());
+		return false;
+	}
+
+#ifdef __WINDOWS__
+	// rename() won't replace an existing file or move an open one on Windows
+	if (_log) {
+		fclose(_log);
+		_log = (FILE *)0;
+	}
+	OSUtils::rm(_logPath.c_str());
+	if (rename(tmpPath.c_str(),_logPath.c_str()) != 0) {
+		fprintf(stderr,"ERROR: controller unable to replace log '%s' with '%s'" ZT_EOL_S,_logPath.c_str(),tmpPath.c_str());
+		return false;
+	}
+	_log = fopen(_logPath.c_str(),"a+b"); // if this fails _logWrite() tries again
+#else
+	// Open the new log before it replaces the old one, so on any failure the
+	// old one stays in use and indexed as before
+	FILE *const nf = fopen(tmpPath.c_str(),"a+b");
+	if ((!nf)||(rename(tmpPath.c_str(),_logPath.c_str()) != 0)) {
+		if (nf)
+			fclose(nf);
+		OSUtils::rm(tmpPath.c_str());
+		return false;
+	}
+	if (_log)
+		fclose(_log);
+	_log = nf;
+#endif
+
+	_logIndex.swap(index);
+	_logSize = size;
+	_logLiveSize = size;
+	return true;
+}
+
+void JSONDB::_decodeMemberRecord(const nlohmann::json &member,MemberRecord &record)
+{
+	if (!member.is_object())
+		return;
+	try {
+		record.revision = OSUtils::jsonInt(_memberField(member,"revision"),0ULL);
+		record.lastDeauthorizedTime = OSUtils::jsonInt(_memberField(member,"lastDeauthorizedTime"),0ULL);
+		record.authorized = OSUtils::jsonBool(_memberField(member,"authorized"),false);
+		record.activeBridge = OSUtils::jsonBool(_memberField(member,"activeBridge"),false);
+		record.multicastReplicator = OSUtils::jsonBool(_memberField(member,"multicastReplicator"),false);
+		record.relay = OSUtils::jsonBool(_memberField(member,"relay"),false);
+		const nlohmann::json &vMajor = _memberField(member,"vMajor");
+		const nlohmann::json &vMinor = _memberField(member,"vMinor");
+		const nlohmann::json &vRev = _memberField(member,"vRev");
+		const nlohmann::json &vProto = _memberField(member,"vProto");
+		if (vMajor.is_number()) record.vMajor = (uint64_t)vMajor;
+		if (vMinor.is_number()) record.vMinor = (uint64_t)vMinor;
+		if (vRev.is_number()) record.vRev = (uint64_t)vRev;
+		if (vProto.is_number()) record.vProto = (uint64_t)vProto;
+		const nlohmann::json &identity = _memberField(member,"identity");
+		if (identity.is_string())
+			record.identity = identity.get<std::string>();
+		const nlohmann::json &physicalAddr = _memberField(member,"physicalAddr");
+		if (physicalAddr.is_string())
+			record.physicalAddr = physicalAddr.get<std::string>();
+	} catch ( ... ) {}
+
+	try {
+		const nlohmann::json &mlog = _memberField(member,"recentLog");
+		if ((mlog.is_array())&&(mlog.size() > 0)) {
+			const nlohmann::json &mlog1 = mlog[0];
+			if (mlog1.is_object())
+				record.lastRequestTime = OSUtils::jsonInt(_memberField(mlog1,"ts"),0ULL);
+		}
+	} catch ( ... ) {}
+
+	try {
+		const nlohmann::json &mips = _memberField(member,"ipAssignments");
+		if (mips.is_array()) {
+			for(unsigned long i=0;i<mips.size();++i) {
+				InetAddress mip(OSUtils::jsonString(mips[i],"").c_str());
+				if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
+					record.ipAssignments.push_back(mip);
+			}
+		}
+	} catch ( ... ) {}
+	std::sort(record.ipAssignments.begin(),record.ipAssignments.end());
+}
+
+template<typename T>
+static inline void _sortedInsert(std::vector<T> &v,const T &x) { v.insert(std::upper_bound(v.begin(),v.end(),x),x); }
+template<typename T>
+static inline void _sortedErase(std::vector<T> &v,const T &x)
+{
+	typename std::vector<T>::iterator i(std::lower_bound(v.begin(),v.end(),x));
+	if ((i != v.end())&&(*i == x))
+		v.erase(i);
+}
+
+void JSONDB::_memberChanged(_NW &nw,const uint64_t memberId,const MemberRecord *oldRecord,const MemberRecord *newRecord)
+{
+	static const MemberRecord nullRecord;
+	const MemberRecord &o = (oldRecord) ? *oldRecord : nullRecord;
+	const MemberRecord &n = (newRecord) ? *newRecord : nullRecord;
+	const uint64_t now = OSUtils::now();
+	NetworkSummaryInfo &ns = nw.summaryInfo;
+	const Address a(memberId);
+
+	if (!oldRecord)
+		++ns.totalMemberCount;
+	if ((!newRecord)&&(ns.totalMemberCount > 0))
+		--ns.totalMemberCount;
+
+	if (o.authorized != n.authorized) {
+		if (n.authorized)
+			++ns.authorizedMemberCount;
+		else if (ns.authorizedMemberCount > 0)
+			--ns.authorizedMemberCount;
+	}
+
+	// Activity ages out, so this drifts until the summary thread's next full recount
+	const bool oActive = ((o.authorized)&&((now - o.lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2)));
+	const bool nActive = ((n.authorized)&&((now - n.lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2)));
+	if (oActive != nActive) {
+		if (nActive)
+			++ns.activeMemberCount;
+		else if (ns.activeMemberCount > 0)
+			--ns.activeMemberCount;
+	}
+
+	// Bridges, replicators, relays, and addresses only count for authorized members
+	const bool oBridge = ((o.authorized)&&(o.activeBridge));
+	const bool nBridge = ((n.authorized)&&(n.activeBridge));
+	if (oBridge != nBridge) {
+		if (nBridge)
+			_sortedInsert(ns.activeBridges,a);
+		else _sortedErase(ns.activeBridges,a);
+	}
+	const bool oReplicator = ((o.authorized)&&(o.multicastReplicator));
+	const bool nReplicator = ((n.authorized)&&(n.multicastReplicator));
+	if (oReplicator != nReplicator) {
+		if (nReplicator)
+			_sortedInsert(ns.multicastReplicators,a);
+		else _sortedErase(ns.multicastReplicators,a);
+	}
+	const bool oRelay = ((o.authorized)&&(o.relay));
+	const bool nRelay = ((n.authorized)&&(n.relay));
+	if (oRelay != nRelay) {
+		if (nRelay)
+			_sortedInsert(ns.relays,a);
+		else _sortedErase(ns.relays,a);
+	}
+
+	static const std::vector<InetAddress> noIps;
+	const std::vector<InetAddress> &oIps = (o.authorized) ? o.ipAssignments : noIps;
+	const std::vector<InetAddress> &nIps = (n.authorized) ? n.ipAssignments : noIps;
+
+	// Both lists are sorted, so walk them together and only touch the differences
+	std::vector<InetAddress>::const_iterator oi(oIps.begin()),ni(nIps.begin());
+	while ((oi != oIps.end())||(ni != nIps.end())) {
+		if ((ni == nIps.end())||((oi != oIps.end())&&(*oi < *ni))) {
+			_sortedErase(ns.allocatedIps,*oi);
+			_indexIpv4(nw,*oi,false);
+			++oi;
+		} else if ((oi == oIps.end())||(*ni < *oi)) {
+			_sortedInsert(ns.allocatedIps,*ni);
+			_indexIpv4(nw,*ni,true);
+			++ni;
+		} else {
+			++oi;
+			++ni;
+		}
+	}
+
+	// A deauthorized member being erased may have held the most recent time,
+	// but that's also only corrected by a full recount
+	if (!n.authorized)
+		ns.mostRecentDeauthTime = std::max(ns.mostRecentDeauthTime,n.lastDeauthorizedTime);
+}
+
+void JSONDB::_indexIpv4(_NW &nw,const InetAddress &mip,const bool add)
+{
+	if (mip.ss_family != AF_INET)
+		return;
+	const uint32_t ip = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&mip)->sin_addr.s_addr));
+
+	if (add) {
+		if (nw.allocatedIpv4Refs[ip]++ != 0)
+			return;
+		std::map<uint32_t,uint32_t>::iterator next(nw.allocatedIpv4.upper_bound(ip));
+		std::map<uint32_t,uint32_t>::iterator prev(next);
+		if ((prev != nw.allocatedIpv4.begin())&&((--prev)->second == (ip - 1))) {
+			prev->second = ip;
+		} else {
+			prev = nw.allocatedIpv4.insert(std::pair<uint32_t,uint32_t>(ip,ip)).first;
+		}
+		if ((next != nw.allocatedIpv4.end())&&(next->first == (ip + 1))) {
+			prev->second = next->second;
+			nw.allocatedIpv4.erase(next);
+		}
+	} else {
+		std::unordered_map<uint32_t,unsigned int>::iterator ref(nw.allocatedIpv4Refs.find(ip));
+		if (ref == nw.allocatedIpv4Refs.end())
+			return;
+		if (--ref->second != 0)
+			return;
+		nw.allocatedIpv4Refs.erase(ref);
+		std::map<uint32_t,uint32_t>::iterator run(nw.allocatedIpv4.upper_bound(ip));
+		if (run == nw.allocatedIpv4.begin())
+			return; // sanity check, shouldn't happen
+		--run;
+		const uint32_t first = run->first;
+		const uint32_t last = run->second;
+		nw.allocatedIpv4.erase(run);
+		if (first < ip)
+			nw.allocatedIpv4[first] = ip - 1;
+		if (ip < last)
+			nw.allocatedIpv4[ip + 1] = last;
+	}
+}
+
+bool JSONDB::_dropNetwork(const uint64_t networkId,std::vector<uint8_t> &config)
+{
+	SharedPtr<_NW> nw;
+	{
+		_WLock _l(*this,_networks_m);
+		std::unordered_map< uint64_t,SharedPtr<_NW> >::iterator i(_networks.find(networkId));
+		if (i == _networks.end())
+			return false;
+		nw.swap(i->second);
+		_networks.erase(i);
+	}
+	_feedRecord(networkId,0,true);
+	_RLock _l(*this,nw->lock);
+	config = nw->config;
+	return true;
+}
+
+bool JSONDB::_dropMember(const uint64_t networkId,const uint64_t nodeId,std::vector<uint8_t> &config)
+{
+	SharedPtr<_NW> nw;
+	{
+		_WLock _l(*this,_networks_m);
+		std::unordered_map< uint64_t,std::unordered_set< uint64_t > >::iterator m(_members.find(nodeId));
+		if (m != _members.end()) {
+			m->second.erase(networkId);
+			if (m->second.empty())
+				_members.erase(m);
+		}
+		std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator i(_networks.find(networkId));
+		if (i == _networks.end())
+			return false;
+		nw = i->second;
+	}
+
+	{
+		_WLock _l(*this,nw->lock);
+		std::unordered_map< uint64_t,_Member >::iterator j(nw->members.find(nodeId));
+		if (j == nw->members.end())
+			return false;
+		_memberChanged(*nw,nodeId,&(j->second.record),(const MemberRecord *)0);
+		config.swap(j->second.config);
+		nw->members.erase(j);
+	}
+	_feedRecord(networkId,nodeId,true);
+	return true;
+}
+
+bool JSONDB::_followPosition()
+{
+	std::string body;
+	std::map<std::string,std::string> headers;
+	const std::string path(_basePath + "/changes?limit=1");
+	if (_httpPool.request("GET",0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),path.c_str(),_httpHeaders,(const void *)0,0,headers,body) != 200)
+		return false;
+	try {
+		const nlohmann::json r(OSUtils::jsonParse(body));
+		_followSince = OSUtils::jsonInt(r["revision"],0ULL);
+		_followEpoch = Utils::hexStrToU64(OSUtils::jsonString(r["epoch"],"0").c_str());
+		return true;
+	} catch ( ... ) {}
+	return false;
+}
+
+bool JSONDB::_followResync()
+{
+	std::string body;
+	std::map<std::string,std::string> headers;
+	if (_httpPool.request("GET",0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),_basePath.c_str(),_httpHeaders,(const void *)0,0,headers,body) != 200)
+		return false;
+
+	std::unordered_map< uint64_t,std::unordered_set<uint64_t> > present; // network -> members
+	try {
+		nlohmann::json dbImg(OSUtils::jsonParse(body));
+		if (!dbImg.is_object())
+			return false;
+		for(nlohmann::json::iterator i(dbImg.begin());i!=dbImg.end();++i) {
+			try {
+				nlohmann::json &o = i.value();
+				if (_add(o)) {
+					if (OSUtils::jsonString(o["objtype"],"") == "member")
+						present[Utils::hexStrToU64(OSUtils::jsonString(o["nwid"],"0").c_str())].insert(Utils::hexStrToU64(OSUtils::jsonString(o["id"],"0").c_str()));
+					else present[Utils::hexStrToU64(OSUtils::jsonString(o["id"],"0").c_str())];
+				}
+			} catch ( ... ) {}
+		}
+	} catch ( ... ) {
+		return false;
+	}
+
+	// Anything the primary no longer has was deleted while we weren't following
+	std::vector< std::pair<uint64_t,uint64_t> > gone;
+	{
+		_RLock _l(*this,_networks_m);
+		for(std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator nw(_networks.begin());nw!=_networks.end();++nw) {
+			const std::unordered_map< uint64_t,std::unordered_set<uint64_t> >::const_iterator p(present.find(nw->first));
+			if (p == present.end()) {
+				gone.push_back(std::pair<uint64_t,uint64_t>(nw->first,0));
+			} else {
+				_RLock _l2(*this,nw->second->lock);
+				for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->second->members.begin());m!=nw->second->members.end();++m) {
+					if (!p->second.count(m->first))
+						gone.push_back(std::pair<uint64_t,uint64_t>(nw->first,m->first));
+				}
+			}
+		}
+	}
+	std::vector<uint8_t> config;
+	for(std::vector< std::pair<uint64_t,uint64_t> >::const_iterator g(gone.begin());g!=gone.end();++g) {
+		if (g->second)
+			_dropMember(g->first,g->second,config);
+		else _dropNetwork(g->first,config);
+	}
+
+	return true;
+}
+
+void JSONDB::_followApply(nlohmann::json &change)
+{
+	const std::string objtype(OSUtils::jsonString(change["objtype"],""));
+	const uint64_t nwid = Utils::hexStrToU64(OSUtils::jsonString(change["nwid"],"0").c_str());
+	const uint64_t mid = (objtype == "member") ? Utils::hexStrToU64(OSUtils::jsonString(change["id"],"0").c_str()) : 0;
+	if ((!nwid)||((objtype == "member")&&(!mid)))
+		return;
+
+	// Our own writes still on their way to the primary are newer than what it has now
+	char n[256];
+	if (mid)
+		OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx/member/%.10llx",(unsigned long long)nwid,(unsigned long long)mid);
+	else OSUtils::ztsnprintf(n,sizeof(n),"network/%.16llx",(unsigned long long)nwid);
+	{
+		std::lock_guard<std::mutex> l(_writes_m);
+		if (_writes.count(n))
+			return;
+	}
+
+	if (OSUtils::jsonBool(change["deleted"],false)) {
+		std::vector<uint8_t> config;
+		if (mid)
+			_dropMember(nwid,mid,config);
+		else _dropNetwork(nwid,config);
+	} else {
+		nlohmann::json::iterator o(change.find("object"));
+		if ((o != change.end())&&(o->is_object()))
+			_add(*o);
+	}
+}
+
+void JSONDB::_followerMain()
+{
+	char path[256];
+	std::string body;
+	std::map<std::string,std::string> headers;
+	for(;;) {
+		{
+			std::lock_guard<std::mutex> l(_follow_m);
+			if (!_followRun)
+				break;
+		}
+
+		OSUtils::ztsnprintf(path,sizeof(path),"/changes?raw=1&limit=%u&wait=%u&since=%llu&epoch=%.16llx",(unsigned int)ZT_JSONDB_FOLLOW_BATCH,(unsigned int)ZT_JSONDB_FOLLOW_WAIT,(unsigned long long)_followSince,(unsigned long long)_followEpoch);
+		const std::string p(_basePath + path);
+		body.clear();
+		headers.clear();
+		bool ok = false;
+		if (_httpPool.request("GET",0,ZT_JSONDB_HTTP_TIMEOUT,reinterpret_cast<const struct sockaddr *>(&_httpAddr),p.c_str(),_httpHeaders,(const void *)0,0,headers,body) == 200) {
+			try {
+				nlohmann::json r(OSUtils::jsonParse(body));
+				if (OSUtils::jsonBool(r["reset"],false)) {
+					// We fell too far behind or the primary restarted
+					ok = ((_followPosition())&&(_followResync()));
+				} else {
+					nlohmann::json &changes = r["changes"];
+					if (changes.is_array()) {
+						for(unsigned long i=0;i<(unsigned long)changes.size();++i)
+							_followApply(changes[i]);
+					}
+					_followSince = OSUtils::jsonInt(r["revision"],_followSince);
+					ok = true;
+				}
+			} catch ( ... ) {}
+		}
+
+		if (!ok) {
+			std::unique_lock<std::mutex> l(_follow_m);
+			_follow_c.wait_for(l,std::chrono::milliseconds(ZT_JSONDB_HTTP_RETRY_DELAY),[this]() { return (!_followRun); });
+		}
+	}
+}
+
+void JSONDB::_feedRecord(const uint64_t networkId,const uint64_t memberId,const bool erased)
+{
+	Mutex::Lock _l(_feed_m);
+	Change c;
+	c.revision = _feedRevision + 1;
+	c.networkId = networkId;
+	c.memberId = memberId;
+	c.erased = erased;
+	_feed.push_back(c);
+	if (_feed.size() > ZT_JSONDB_FEED_SIZE)
+		_feed.pop_front();
+	_feedRevision = c.revision; // after the change is in the feed, so readers polling the revision find it
+}
+
 void JSONDB::_recomputeSummaryInfo(const uint64_t networkId)
 {
 	Mutex::Lock _l(_summaryThread_m);
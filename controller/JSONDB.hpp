@@ -25,25 +25,58 @@
 
 #include <string>
 #include <map>
+#include <list>
+#include <deque>
 #include <stdexcept>
 #include <vector>
 #include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/SharedPtr.hpp"
+#include "../node/AtomicCounter.hpp"
+#include "../node/MemoryUsage.hpp"
 #include "../ext/json/json.hpp"
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Http.hpp"
 #include "../osdep/Thread.hpp"
 
+// MemberRecord value for numeric fields a member doesn't have
+#define ZT_JSONDB_FIELD_MISSING 0xffffffffffffffffULL
+
 namespace ZeroTier {
 
 /**
  * Hierarchical JSON store that persists into the filesystem or via HTTP
+ *
+ * In the filesystem each object is normally its own JSON file. Optionally
+ * networks and members can instead be appended to a single binary log that
+ * is compacted in the background, which makes writes a single append and
+ * startup one sequential read. Other objects (status, traces) are always
+ * written as JSON files.
+ *
+ * Each network has its own reader-writer lock, so requests for different
+ * networks and concurrent reads of the same network don't serialize. The
+ * map of networks has its own lock that's only held long enough to look
+ * up or insert a network. Locks are always taken map first, network
+ * second, and never recursively.
+ *
+ * JSON files are loaded at startup by a pool of threads, one network at
+ * a time. Queries about a network only wait for that network to finish
+ * loading, while whole-database queries wait for everything.
+ *
+ * In HTTP mode writes and deletes are queued and sent in the background
+ * by a writer thread, so a slow backend doesn't hold up callers. Repeated
+ * writes to an object that's still queued replace the queued one.
  */
 class JSONDB
 {
@@ -52,6 +85,8 @@ public:
 	{
 		NetworkSummaryInfo() : authorizedMemberCount(0),activeMemberCount(0),totalMemberCount(0),mostRecentDeauthTime(0) {}
 		std::vector<Address> activeBridges;
+		std::vector<Address> multicastReplicators;
+		std::vector<Address> relays;
 		std::vector<InetAddress> allocatedIps;
 		unsigned long authorizedMemberCount;
 		unsigned long activeMemberCount;
@@ -59,7 +94,56 @@ public:
 		uint64_t mostRecentDeauthTime;
 	};
 
-	JSONDB(const std::string &basePath);
+	/**
+	 * A change to a network or member, as recorded in the change feed
+	 */
+	struct Change
+	{
+		uint64_t revision;
+		uint64_t networkId;
+		uint64_t memberId; // 0 if the network itself changed
+		bool erased;
+	};
+
+	/**
+	 * Member fields read on hot paths, decoded once when a member is stored
+	 */
+	struct MemberRecord
+	{
+		MemberRecord() : revision(0),lastDeauthorizedTime(0),lastRequestTime(0),vMajor(ZT_JSONDB_FIELD_MISSING),vMinor(ZT_JSONDB_FIELD_MISSING),vRev(ZT_JSONDB_FIELD_MISSING),vProto(ZT_JSONDB_FIELD_MISSING),authorized(false),activeBridge(false),multicastReplicator(false),relay(false) {}
+		uint64_t revision;
+		uint64_t lastDeauthorizedTime;
+		uint64_t lastRequestTime; // timestamp of most recent recentLog entry
+		uint64_t vMajor,vMinor,vRev,vProto; // ZT_JSONDB_FIELD_MISSING if not set
+		bool authorized;
+		bool activeBridge;
+		bool multicastReplicator;
+		bool relay;
+		std::vector<InetAddress> ipAssignments; // sorted
+		std::string identity; // public identity as stored
+		std::string physicalAddr; // as stored
+	};
+
+	/**
+	 * @param basePath Directory, http:// URL, or "-" for stdin/stdout IPC mode
+	 * @param logStructured If true and basePath is a directory, keep networks and members in an append-only log instead of one JSON file each
+	 * @param replicaAuthToken If non-NULL, basePath is another controller's http://.../controller/db and this follows its change feed
+	 */
+	/**
+	 * State of the HTTP mode write-behind queue
+	 */
+	struct PersistenceStats
+	{
+		PersistenceStats() : backlog(0),oldestPendingAge(0),writes(0),coalesced(0),failures(0),latency(0) {}
+		unsigned long backlog; // objects waiting to be written or deleted
+		uint64_t oldestPendingAge; // ms the oldest of them has waited
+		uint64_t writes; // completed writes and deletes
+		uint64_t coalesced; // writes replaced by a newer one before being sent
+		uint64_t failures; // attempts that failed (retried unless rejected by the server)
+		uint64_t latency; // moving average ms from queueing to completion
+	};
+
+	JSONDB(const std::string &basePath,const bool logStructured = false,const char *replicaAuthToken = (const char *)0);
 	~JSONDB();
 
 	/**
@@ -75,6 +159,73 @@ public:
 	 */
 	bool writeRaw(const std::string &n,const std::string &obj);
 
+	/**
+	 * Write many objects at once
+	 *
+	 * In IPC mode they go out in one write and in HTTP mode they're queued
+	 * together. Files are still written one at a time.
+	 *
+	 * @param objs Path names and objects in the same format as writeRaw()
+	 * @return Number written (or queued) successfully
+	 */
+	unsigned long writeRawBatch(const std::vector< std::pair<std::string,std::string> > &objs);
+
+	/**
+	 * @param ps Filled with current write-behind queue state (all zero unless in HTTP mode)
+	 */
+	void persistenceStats(PersistenceStats &ps) const;
+
+	/**
+	 * Add cached networks, members and pending writes to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu) const;
+
+	/**
+	 * Get how often and for how long callers waited on contended network locks
+	 *
+	 * @param waits Set to number of lock acquisitions that had to wait
+	 * @param ns Set to total time spent waiting in nanoseconds
+	 */
+	inline void lockWaits(uint64_t &waits,uint64_t &ns) const
+	{
+		waits = _lockWaits;
+		ns = _lockWaitNs;
+	}
+
+	/**
+	 * Get distinct networks and members changed after a change feed revision
+	 *
+	 * Only the most recent changes are kept, and the feed starts over with a
+	 * new epoch when the database is reopened. If changes after since might
+	 * be missing this returns false and the caller should re-read everything
+	 * it cares about and continue from feedRevision().
+	 *
+	 * @param since Last revision the caller has seen (ignored if epoch doesn't match)
+	 * @param epoch Feed epoch the caller's revision came from
+	 * @param max Maximum number of distinct objects to return
+	 * @param changes Filled with the latest change to each object, oldest first
+	 * @param through Set to the revision to pass as since next time
+	 * @return False if the caller must resync
+	 */
+	bool changesSince(const uint64_t since,const uint64_t epoch,const unsigned long max,std::vector<Change> &changes,uint64_t &through) const;
+
+	/**
+	 * @return Revision of most recent change
+	 */
+	inline uint64_t feedRevision() const { return _feedRevision; }
+
+	/**
+	 * @return Random ID of this run of the change feed
+	 */
+	inline uint64_t feedEpoch() const { return _feedEpoch; }
+
+	/**
+	 * @return True if this is a replica of another controller's database
+	 */
+	inline bool replica() const { return _replica; }
+
 	bool hasNetwork(const uint64_t networkId) const;
 
 	bool getNetwork(const uint64_t networkId,nlohmann::json &config) const;
@@ -88,52 +239,159 @@ public:
 
 	bool getNetworkMember(const uint64_t networkId,const uint64_t nodeId,nlohmann::json &memberConfig) const;
 
+	bool getNetworkMemberRecord(const uint64_t networkId,const uint64_t nodeId,MemberRecord &record) const;
+
+	/**
+	 * Like getNetworkAndMember() but with a decoded record and no JSON
+	 *
+	 * @return Bit mask: 0 == none, 1 == network only, 3 == network and member
+	 */
+	int getNetworkAndMemberRecord(const uint64_t networkId,const uint64_t nodeId,uint64_t &networkRevision,MemberRecord &record,NetworkSummaryInfo &ns) const;
+
+	/**
+	 * Convert a stored object to single-line JSON without building a JSON object
+	 *
+	 * @param packed Object as stored (msgpack)
+	 * @param json Set to JSON in the same format as OSUtils::jsonDump(obj,-1)
+	 * @return False if packed could not be decoded
+	 */
+	static bool packedToJson(const std::vector<uint8_t> &packed,std::string &json);
+
+	/**
+	 * Find the first IPv4 address in a range that no authorized member holds
+	 *
+	 * This uses an index that's updated as members are saved and erased, so
+	 * unlike NetworkSummaryInfo::allocatedIps it's never stale, and lookup is
+	 * O(log n) in the number of allocated runs of addresses.
+	 *
+	 * @param networkId Network ID
+	 * @param first First address to consider (host byte order)
+	 * @param last Last address to consider (host byte order)
+	 * @param ip Set to a free address (host byte order) if one is found
+	 * @return True if a free address was found
+	 */
+	bool nextFreeIpv4(const uint64_t networkId,const uint32_t first,const uint32_t last,uint32_t &ip) const;
+
 	void saveNetwork(const uint64_t networkId,const nlohmann::json &networkConfig);
 
 	void saveNetworkMember(const uint64_t networkId,const uint64_t nodeId,const nlohmann::json &memberConfig);
 
+	/**
+	 * Save many members of one network at once
+	 *
+	 * In log mode all records go to the log in a single write and flush.
+	 *
+	 * @param networkId Network ID
+	 * @param members Member IDs and their new configurations
+	 */
+	void saveNetworkMembers(const uint64_t networkId,const std::vector< std::pair< uint64_t,nlohmann::json > > &members);
+
 	nlohmann::json eraseNetwork(const uint64_t networkId);
 
-	nlohmann::json eraseNetworkMember(const uint64_t networkId,const uint64_t nodeId,bool recomputeSummaryInfo = true);
+	nlohmann::json eraseNetworkMember(const uint64_t networkId,const uint64_t nodeId);
 
 	std::vector<uint64_t> networkIds() const
 	{
+		_waitForData();
 		std::vector<uint64_t> r;
-		Mutex::Lock _l(_networks_m);
-		for(std::unordered_map<uint64_t,_NW>::const_iterator n(_networks.begin());n!=_networks.end();++n)
+		_RLock _l(*this,_networks_m);
+		r.reserve(_networks.size());
+		for(std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator n(_networks.begin());n!=_networks.end();++n)
 			r.push_back(n->first);
 		return r;
 	}
 
 	inline unsigned long memberCount(const uint64_t networkId)
 	{
-		Mutex::Lock _l(_networks_m);
-		std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-		if (i != _networks.end())
-			return (unsigned long)i->second.members.size();
+		_waitForNetwork(networkId);
+		const SharedPtr<_NW> nw(_network(networkId));
+		if (nw) {
+			_RLock _l(*this,nw->lock);
+			return (unsigned long)nw->members.size();
+		}
 		return 0;
 	}
 
 	template<typename F>
 	inline void eachMember(const uint64_t networkId,F func)
 	{
-		Mutex::Lock _l(_networks_m);
-		std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.find(networkId));
-		if (i != _networks.end()) {
-			for(std::unordered_map< uint64_t,std::vector<uint8_t> >::const_iterator m(i->second.members.begin());m!=i->second.members.end();++m) {
-				try {
-					func(networkId,m->first,nlohmann::json::from_msgpack(m->second));
-				} catch ( ... ) {}
-			}
+		_waitForNetwork(networkId);
+		const SharedPtr<_NW> nw(_network(networkId));
+		if (!nw)
+			return;
+
+		// Copy out the packed configs so decoding doesn't hold up writers
+		std::vector< std::pair< uint64_t,std::vector<uint8_t> > > configs;
+		{
+			_RLock _l(*this,nw->lock);
+			configs.reserve(nw->members.size());
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->members.begin());m!=nw->members.end();++m)
+				configs.push_back(std::pair< uint64_t,std::vector<uint8_t> >(m->first,m->second.config));
+		}
+
+		for(std::vector< std::pair< uint64_t,std::vector<uint8_t> > >::const_iterator m(configs.begin());m!=configs.end();++m) {
+			try {
+				func(networkId,m->first,nlohmann::json::from_msgpack(m->second));
+			} catch ( ... ) {}
+		}
+	}
+
+	/**
+	 * Like eachMember() but with members as single-line JSON strings, converted without a JSON object
+	 */
+	template<typename F>
+	inline void eachMemberJson(const uint64_t networkId,F func)
+	{
+		_waitForNetwork(networkId);
+		const SharedPtr<_NW> nw(_network(networkId));
+		if (!nw)
+			return;
+
+		std::vector< std::pair< uint64_t,std::vector<uint8_t> > > configs;
+		{
+			_RLock _l(*this,nw->lock);
+			configs.reserve(nw->members.size());
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->members.begin());m!=nw->members.end();++m)
+				configs.push_back(std::pair< uint64_t,std::vector<uint8_t> >(m->first,m->second.config));
+		}
+
+		std::string j;
+		for(std::vector< std::pair< uint64_t,std::vector<uint8_t> > >::const_iterator m(configs.begin());m!=configs.end();++m) {
+			if (packedToJson(m->second,j))
+				func(networkId,m->first,j);
+		}
+	}
+
+	/**
+	 * Like eachMember() but with decoded records instead of full member JSON
+	 *
+	 * The network is read locked while func runs, so func must not call
+	 * back into this JSONDB.
+	 */
+	template<typename F>
+	inline void eachMemberRecord(const uint64_t networkId,F func)
+	{
+		_waitForNetwork(networkId);
+		const SharedPtr<_NW> nw(_network(networkId));
+		if (nw) {
+			_RLock _l(*this,nw->lock);
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(nw->members.begin());m!=nw->members.end();++m)
+				func(networkId,m->first,m->second.record);
 		}
 	}
 
 	template<typename F>
 	inline void eachId(F func)
 	{
-		Mutex::Lock _l(_networks_m);
-		for(std::unordered_map<uint64_t,_NW>::const_iterator i(_networks.begin());i!=_networks.end();++i) {
-			for(std::unordered_map< uint64_t,std::vector<uint8_t> >::const_iterator m(i->second.members.begin());m!=i->second.members.end();++m) {
+		_waitForData();
+		std::vector< std::pair< uint64_t,SharedPtr<_NW> > > nws;
+		{
+			_RLock _l(*this,_networks_m);
+			nws.assign(_networks.begin(),_networks.end());
+		}
+		for(std::vector< std::pair< uint64_t,SharedPtr<_NW> > >::const_iterator i(nws.begin());i!=nws.end();++i) {
+			_RLock _l(*this,i->second->lock);
+			for(std::unordered_map< uint64_t,_Member >::const_iterator m(i->second->members.begin());m!=i->second->members.end();++m) {
 				try {
 					func(i->first,m->first);
 				} catch ( ... ) {}
@@ -143,7 +401,8 @@ public:
 
 	inline std::vector<uint64_t> networksForMember(const uint64_t nodeId)
 	{
-		Mutex::Lock _l(_networks_m);
+		_waitForData();
+		_RLock _l(*this,_networks_m);
 		std::unordered_map< uint64_t,std::unordered_set< uint64_t > >::const_iterator m(_members.find(nodeId));
 		if (m != _members.end()) {
 			return std::vector<uint64_t>(m->second.begin(),m->second.end());
@@ -156,13 +415,16 @@ public:
 		throw();
 
 private:
-	bool _add(const nlohmann::json &j);
+	bool _add(const nlohmann::json &j,std::vector<uint8_t> *packed = (std::vector<uint8_t> *)0);
 	bool _load(const std::string &p);
+	void _loadInParallel(); // runs in _loader
+	void _loadComplete();
 	void _recomputeSummaryInfo(const uint64_t networkId);
 	std::string _genPath(const std::string &n,bool create);
 
 	std::string _basePath;
 	InetAddress _httpAddr;
+	Http::Pool _httpPool; // keeps connections to the HTTP backend open across loads and write batches
 	int _rawInput,_rawOutput;
 	Mutex _rawLock;
 
@@ -171,19 +433,173 @@ private:
 	volatile bool _summaryThreadRun;
 	Mutex _summaryThread_m;
 
+	struct _Member
+	{
+		std::vector<uint8_t> config; // msgpack
+		MemberRecord record;
+	};
+
+	// Locks on _networks_m and _NW::lock, which time how long we wait only if the lock is contended
+	class _RLock : NonCopyable
+	{
+	public:
+		_RLock(const JSONDB &db,const RWMutex &m) : _m(m)
+		{
+			if (!m.tryRLock()) {
+				const uint64_t start = _nowNs();
+				m.rlock();
+				db._waited(start);
+			}
+		}
+		~_RLock() { _m.runlock(); }
+	private:
+		const RWMutex &_m;
+	};
+	class _WLock : NonCopyable
+	{
+	public:
+		_WLock(const JSONDB &db,const RWMutex &m) : _m(m)
+		{
+			if (!m.tryLock()) {
+				const uint64_t start = _nowNs();
+				m.lock();
+				db._waited(start);
+			}
+		}
+		~_WLock() { _m.unlock(); }
+	private:
+		const RWMutex &_m;
+	};
+	static inline uint64_t _nowNs() { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+	inline void _waited(const uint64_t start) const
+	{
+		++_lockWaits;
+		_lockWaitNs += _nowNs() - start;
+	}
+
 	struct _NW
 	{
-		_NW() : summaryInfoLastComputed(0) {}
+		_NW() : revision(0),summaryInfoLastComputed(0) {}
+		AtomicCounter __refCount;
+		RWMutex lock; // guards everything below
 		std::vector<uint8_t> config;
+		uint64_t revision; // of config
 		NetworkSummaryInfo summaryInfo;
 		uint64_t summaryInfoLastComputed;
-		std::unordered_map< uint64_t,std::vector<uint8_t> > members;
+		std::unordered_map< uint64_t,_Member > members;
+		std::map<uint32_t,uint32_t> allocatedIpv4; // merged runs of allocated addresses, first -> last
+		std::unordered_map<uint32_t,unsigned int> allocatedIpv4Refs; // number of members holding each address
 	};
 
-	std::unordered_map< uint64_t,_NW > _networks;
+	// Wait for the initial data set to arrive (waits in IPC mode and while loading JSON files)
+	inline void _waitForData() const
+	{
+		while (!_dataReady)
+			Thread::sleep(10);
+	}
+
+	// Wait only until one network has finished loading, if we know which are still loading
+	inline void _waitForNetwork(const uint64_t networkId) const
+	{
+		while (!_dataReady) {
+			if (_loadingKnown) {
+				Mutex::Lock _l(_loading_m);
+				if (_loading.find(networkId) == _loading.end())
+					return;
+			}
+			Thread::sleep(10);
+		}
+	}
+
+	inline SharedPtr<_NW> _network(const uint64_t networkId) const
+	{
+		_RLock _l(*this,_networks_m);
+		const std::unordered_map< uint64_t,SharedPtr<_NW> >::const_iterator i(_networks.find(networkId));
+		return ((i != _networks.end()) ? i->second : SharedPtr<_NW>());
+	}
+
+	SharedPtr<_NW> _networkCreate(const uint64_t networkId);
+	void _putMember(const uint64_t networkId,const uint64_t nodeId,const nlohmann::json &memberConfig,std::vector<uint8_t> &packed);
+
+	// Log-structured storage (record format is described in JSONDB.cpp)
+	struct _LogEntry
+	{
+		uint64_t offset; // of whole record in log
+		uint64_t size; // of whole record
+	};
+	bool _logOpen();
+	void _logAppend(const std::string &n,const std::vector<uint8_t> *obj); // NULL obj records an erase
+	void _logAppendAll(const std::vector< std::pair< std::string,std::vector<uint8_t> > > &records); // puts only
+	bool _logWrite(const std::string &r); // _log_m must be locked
+	bool _logCompact(); // _log_m must be locked
+	bool _logReplace(const std::vector< std::pair< std::string,std::vector<uint8_t> > > &records); // _log_m must be locked
+
+	// HTTP mode write-behind
+	struct _PendingWrite
+	{
+		std::string obj;
+		uint64_t queuedAt; // when this object was first queued
+		bool del; // DELETE instead of PUT
+	};
+	void _queueWrite(const std::string &n,const std::string &obj,const bool del); // _writes_m must not be locked
+	void _queueWriteLocked(const std::string &n,const std::string &obj,const bool del); // _writes_m must be locked
+	void _writerMain(); // runs in _writer
+
+	void _feedRecord(const uint64_t networkId,const uint64_t memberId,const bool erased);
+
+	// Remove from memory only, leaving persistence to the caller
+	bool _dropNetwork(const uint64_t networkId,std::vector<uint8_t> &config);
+	bool _dropMember(const uint64_t networkId,const uint64_t nodeId,std::vector<uint8_t> &config);
+
+	// Replica mode: follow the primary's change feed
+	bool _followPosition(); // get the primary's current feed revision and epoch
+	bool _followResync(); // replace everything with the primary's current data
+	void _followApply(nlohmann::json &change);
+	void _followerMain(); // runs in _follower
+
+	static void _decodeMemberRecord(const nlohmann::json &member,MemberRecord &record);
+	static void _memberChanged(_NW &nw,const uint64_t memberId,const MemberRecord *oldRecord,const MemberRecord *newRecord);
+	static void _indexIpv4(_NW &nw,const InetAddress &ip,const bool add);
+
+	std::unordered_map< uint64_t,SharedPtr<_NW> > _networks;
 	std::unordered_map< uint64_t,std::unordered_set< uint64_t > > _members;
-	bool _dataReady;
-	Mutex _networks_m;
+	volatile bool _dataReady;
+	RWMutex _networks_m; // guards _networks and _members
+	mutable std::atomic<uint64_t> _lockWaits;
+	mutable std::atomic<uint64_t> _lockWaitNs;
+
+	std::thread _loader;
+	std::unordered_set<uint64_t> _loading; // networks whose files are still being read
+	volatile bool _loadingKnown; // true once _loading has been filled in
+	Mutex _loading_m;
+
+	std::string _logPath; // empty unless log-structured
+	FILE *_log;
+	std::unordered_map< std::string,_LogEntry > _logIndex; // object name -> latest record
+	uint64_t _logSize; // also offset of next record
+	uint64_t _logLiveSize; // bytes in header and current records
+	Mutex _log_m; // guards _log and _logIndex/_logSize/_logLiveSize
+
+	std::deque<Change> _feed; // most recent changes, oldest first
+	std::atomic<uint64_t> _feedRevision;
+	uint64_t _feedEpoch;
+	Mutex _feed_m; // guards _feed
+
+	bool _replica;
+	std::map<std::string,std::string> _httpHeaders; // sent with every request in HTTP mode
+	std::thread _follower;
+	uint64_t _followSince,_followEpoch; // position in the primary's feed (follower thread only once started)
+	bool _followRun;
+	std::mutex _follow_m;
+	std::condition_variable _follow_c;
+
+	std::thread _writer;
+	std::list<std::string> _writeOrder; // names in _writes, oldest first
+	std::unordered_map< std::string,_PendingWrite > _writes;
+	PersistenceStats _writeStats;
+	bool _writerRun;
+	mutable std::mutex _writes_m; // guards all of the above except _writer
+	std::condition_variable _writes_c;
 };
 
 } // namespace ZeroTier
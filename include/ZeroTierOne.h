@@ -167,6 +167,21 @@ extern "C" {
  */
 #define ZT_MAX_CAPABILITY_CUSTODY_CHAIN_LENGTH 7
 
+/**
+ * Maximum number of cluster members (and max member ID plus one)
+ */
+#define ZT_CLUSTER_MAX_MEMBERS 128
+
+/**
+ * Maximum number of physical ZeroTier addresses a cluster member can report
+ */
+#define ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES 16
+
+/**
+ * Maximum allowed cluster message length in bytes
+ */
+#define ZT_CLUSTER_MAX_MESSAGE_LENGTH (1500 - 48)
+
 /**
  * Maximum value for link quality (min is 0)
  */
@@ -498,9 +513,81 @@ enum ZT_Event
 	 *
 	 * Meta-data: ZT_RemoteTrace structure
 	 */
-	ZT_EVENT_REMOTE_TRACE = 7
+	ZT_EVENT_REMOTE_TRACE = 7,
+
+	/**
+	 * A peer has been added
+	 *
+	 * Peers are added when first heard from or looked up, and on startup
+	 * for roots. Its full state can be had with ZT_Node_peer().
+	 *
+	 * Meta-data: ZT_PeerEvent structure (path is empty)
+	 */
+	ZT_EVENT_PEER_ADDED = 8,
+
+	/**
+	 * A peer has been removed after going quiet or to stay under the peer limit
+	 *
+	 * Its paths are not reported down separately.
+	 *
+	 * Meta-data: ZT_PeerEvent structure (path is empty)
+	 */
+	ZT_EVENT_PEER_REMOVED = 9,
+
+	/**
+	 * A physical path to a peer has come up
+	 *
+	 * Path changes are checked when a new path is learned and whenever an
+	 * active peer or root is pinged, so one that goes down is reported
+	 * within a keepalive interval or so of expiring.
+	 *
+	 * Meta-data: ZT_PeerEvent structure
+	 */
+	ZT_EVENT_PATH_UP = 10,
+
+	/**
+	 * A physical path to a peer has gone down
+	 *
+	 * Meta-data: ZT_PeerEvent structure
+	 */
+	ZT_EVENT_PATH_DOWN = 11,
+
+	/**
+	 * The path used to send to a peer has changed
+	 *
+	 * Meta-data: ZT_PeerEvent structure (path is the new best path, or empty if there is none)
+	 */
+	ZT_EVENT_BEST_PATH_CHANGED = 12,
+
+	/**
+	 * A peer's measured latency has changed noticeably
+	 *
+	 * Meta-data: ZT_PeerEvent structure (path is the current best path)
+	 */
+	ZT_EVENT_PEER_LATENCY_CHANGED = 13
 };
 
+/**
+ * Payload of peer and path events (ZT_EVENT_PEER_* and ZT_EVENT_*_PATH_*)
+ */
+typedef struct
+{
+	/**
+	 * ZeroTier address of peer (40 bits)
+	 */
+	uint64_t address;
+
+	/**
+	 * Physical path the event concerns (ss_family is 0 if none)
+	 */
+	struct sockaddr_storage path;
+
+	/**
+	 * Peer's latency in milliseconds or zero if unknown
+	 */
+	unsigned int latency;
+} ZT_PeerEvent;
+
 /**
  * Payload of REMOTE_TRACE event
  */
@@ -1097,6 +1184,36 @@ typedef struct
 	 * Routes (excluding those implied by assigned addresses and their masks)
 	 */
 	ZT_VirtualNetworkRoute routes[ZT_MAX_NETWORK_ROUTES];
+
+	/**
+	 * Number of MACs currently known to be reachable behind remote bridges
+	 */
+	unsigned long bridgeRouteCount;
+
+	/**
+	 * Frames from members accepted by the rules and rate limits
+	 */
+	uint64_t framesIn;
+
+	/**
+	 * Frames to members accepted by the rules and rate limits (a multicast counts once per recipient)
+	 */
+	uint64_t framesOut;
+
+	/**
+	 * Bytes of frames counted in framesIn
+	 */
+	uint64_t bytesIn;
+
+	/**
+	 * Bytes of frames counted in framesOut
+	 */
+	uint64_t bytesOut;
+
+	/**
+	 * Frames in either direction dropped by the rules or rate limits
+	 */
+	uint64_t framesDropped;
 } ZT_VirtualNetworkConfig;
 
 /**
@@ -1138,6 +1255,16 @@ typedef struct
 	 */
 	int linkQuality;
 
+	/**
+	 * Are we sending FEC parity on this path at the peer's request?
+	 */
+	int fec;
+
+	/**
+	 * Lost packets and fragments rebuilt from FEC parity received on this path
+	 */
+	uint64_t fecRepaired;
+
 	/**
 	 * Is path expired?
 	 */
@@ -1184,6 +1311,66 @@ typedef struct
 	 */
 	enum ZT_PeerRole role;
 
+	/**
+	 * Frame payload bytes run through the compressor (a measure of CPU spent)
+	 */
+	uint64_t compressionBytesIn;
+
+	/**
+	 * Bytes saved by compressing frames
+	 */
+	uint64_t compressionBytesSaved;
+
+	/**
+	 * Frame payload bytes not compressed because their flow wasn't compressing well
+	 */
+	uint64_t compressionBytesSkipped;
+
+	/**
+	 * Frame payload bytes compressed with zstd (also counted in compressionBytesIn)
+	 */
+	uint64_t compressionZstdBytesIn;
+
+	/**
+	 * Bytes saved by zstd (also counted in compressionBytesSaved)
+	 */
+	uint64_t compressionZstdBytesSaved;
+
+	/**
+	 * If nonzero, this peer can receive frames compressed with zstd
+	 */
+	int zstd;
+
+	/**
+	 * Packets received from this peer (direct or relayed) that were authenticated and decoded
+	 */
+	uint64_t packetsIn;
+
+	/**
+	 * Packets sent to this peer (direct or relayed)
+	 */
+	uint64_t packetsOut;
+
+	/**
+	 * Bytes on the wire of packets counted in packetsIn
+	 */
+	uint64_t bytesIn;
+
+	/**
+	 * Bytes on the wire of packets counted in packetsOut
+	 */
+	uint64_t bytesOut;
+
+	/**
+	 * Packets from this peer dropped because they failed authentication or decoding
+	 */
+	uint64_t packetsDropped;
+
+	/**
+	 * Time of last packet sent to or received from this peer in milliseconds or 0 for never
+	 */
+	uint64_t lastActivity;
+
 	/**
 	 * Number of paths (size of paths[])
 	 */
@@ -1204,6 +1391,155 @@ typedef struct
 	unsigned long peerCount;
 } ZT_PeerList;
 
+/**
+ * Status of a cluster member
+ */
+typedef struct
+{
+	/**
+	 * This cluster member's ID (from 0 to 1-ZT_CLUSTER_MAX_MEMBERS)
+	 */
+	unsigned int id;
+
+	/**
+	 * Number of milliseconds since last 'alive' heartbeat message received via cluster backplane address
+	 */
+	unsigned int msSinceLastHeartbeat;
+
+	/**
+	 * Non-zero if cluster member is alive
+	 */
+	int alive;
+
+	/**
+	 * X, Y, and Z coordinates of this member (if specified, otherwise zero)
+	 *
+	 * What these mean depends on the location scheme being used for
+	 * location-aware clustering. At present this is GeoIP and these
+	 * will be the X, Y, and Z coordinates of the location on a spherical
+	 * approximation of Earth where Earth's core is the origin (in km).
+	 * They don't have to be perfect and need only be comparable with others
+	 * to find shortest path via the standard vector distance formula.
+	 */
+	int x,y,z;
+
+	/**
+	 * Cluster member's last reported load
+	 */
+	uint64_t load;
+
+	/**
+	 * Number of peers
+	 */
+	uint64_t peers;
+
+	/**
+	 * Physical ZeroTier endpoints for this member (where peers are sent when directed here)
+	 */
+	struct sockaddr_storage zeroTierPhysicalEndpoints[ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES];
+
+	/**
+	 * Number of physical ZeroTier endpoints this member is announcing
+	 */
+	unsigned int numZeroTierPhysicalEndpoints;
+} ZT_ClusterMemberStatus;
+
+/**
+ * ZeroTier cluster status
+ */
+typedef struct
+{
+	/**
+	 * My cluster member ID (a record for this member appears in members[] too)
+	 */
+	unsigned int myId;
+
+	/**
+	 * Number of cluster members
+	 */
+	unsigned int clusterSize;
+
+	/**
+	 * Cluster member statuses
+	 */
+	ZT_ClusterMemberStatus members[ZT_CLUSTER_MAX_MEMBERS];
+} ZT_ClusterStatus;
+
+/**
+ * A packet to or from the physical wire
+ *
+ * This is used for received packets by ZT_Node_processWirePackets() and for
+ * outgoing packets by ZT_WirePacketBatchSendFunction.
+ */
+typedef struct
+{
+	/**
+	 * Local socket (you can use 0 if only one local socket is bound and ignore this)
+	 */
+	int64_t localSocket;
+
+	/**
+	 * Origin of packet if received, destination if outgoing
+	 */
+	const struct sockaddr_storage *remoteAddress;
+
+	/**
+	 * Packet data
+	 */
+	const void *packetData;
+
+	/**
+	 * Packet length
+	 */
+	unsigned int packetLength;
+
+	/**
+	 * Desired IP TTL or 0 to use default, plus optional flags (on receive only ZT_WIRE_PACKET_ECN_MASK is used)
+	 */
+	unsigned int ttl;
+} ZT_WirePacket;
+
+/**
+ * A frame from a virtual network port, for ZT_Node_processVirtualNetworkFrames()
+ */
+typedef struct
+{
+	/**
+	 * ZeroTier 64-bit virtual network ID
+	 */
+	uint64_t nwid;
+
+	/**
+	 * Source MAC address (least significant 48 bits)
+	 */
+	uint64_t sourceMac;
+
+	/**
+	 * Destination MAC address (least significant 48 bits)
+	 */
+	uint64_t destMac;
+
+	/**
+	 * 16-bit Ethernet frame type
+	 */
+	unsigned int etherType;
+
+	/**
+	 * 10-bit VLAN ID or 0 if none
+	 */
+	unsigned int vlanId;
+
+	/**
+	 * Frame payload data
+	 */
+	const void *frameData;
+
+	/**
+	 * Frame payload length
+	 */
+	unsigned int frameLength;
+} ZT_VirtualNetworkFrame;
+
 /**
  * ZeroTier core state objects
  */
@@ -1253,8 +1589,13 @@ enum ZT_StateObjectType
 	/**
 	 * Peer and related state
 	 *
+	 * This is a versioned record holding the peer's identity, its shared key
+	 * (encrypted and authenticated with a key derived from our identity
+	 * secret), latency, and last good paths. It lets a restarting node skip
+	 * WHOIS and key agreement for peers it already knew.
+	 *
 	 * Object ID: peer address
-	 * Canonical path: <HOME>/peers.d/<ID> (10-digit address
+	 * Canonical path: <HOME>/peers.d/<ID>.peer (10-digit address)
 	 * Persistence: optional, can be cleared at any time
 	 */
 	ZT_STATE_OBJECT_PEER = 5,
@@ -1266,7 +1607,20 @@ enum ZT_StateObjectType
 	 * Canonical path: <HOME>/networks.d/<NETWORKID>.conf (16-digit hex ID)
 	 * Persistence: required if network memberships should persist
 	 */
-	ZT_STATE_OBJECT_NETWORK_CONFIG = 6
+	ZT_STATE_OBJECT_NETWORK_CONFIG = 6,
+
+	/**
+	 * Public identity of another node (text format)
+	 *
+	 * Only roots and moons store these. They keep the identity of every node
+	 * they have heard from so they can answer WHOIS for it long after it has
+	 * fallen out of memory, without asking further upstream.
+	 *
+	 * Object ID: node address
+	 * Canonical path: <HOME>/identities.d/<ID>.id (10-digit address)
+	 * Persistence: optional, can be cleared at any time
+	 */
+	ZT_STATE_OBJECT_IDENTITY = 7
 };
 
 /**
@@ -1378,6 +1732,24 @@ typedef int (*ZT_StateGetFunction)(
 	void *,                                /* Buffer to store state object data */
 	unsigned int);                         /* Length of data buffer in bytes */
 
+/**
+ * Flag OR'd into the TTL argument of ZT_WirePacketSendFunction to request the IP don't fragment bit
+ *
+ * The remaining low 8 bits are the TTL as usual.
+ */
+#define ZT_WIRE_PACKET_DONT_FRAGMENT 0x100
+
+/**
+ * Bits of the TTL argument and of ZT_WirePacket::ttl holding an IP ECN field
+ *
+ * The field is the two ECN bits of the IP header (0 not ECN-capable, 1
+ * ECT(1), 2 ECT(0), 3 CE) shifted up by ZT_WIRE_PACKET_ECN_SHIFT. Outgoing,
+ * it's the ECN field to send the packet with. Incoming, it's the ECN field
+ * the packet arrived with, if the host can read it (see ZT_Node_setEcn()).
+ */
+#define ZT_WIRE_PACKET_ECN_MASK 0x600
+#define ZT_WIRE_PACKET_ECN_SHIFT 9
+
 /**
  * Function to send a ZeroTier packet out over the physical wire (L2/L3)
  *
@@ -1388,7 +1760,7 @@ typedef int (*ZT_StateGetFunction)(
  *  (4) Remote address
  *  (5) Packet data
  *  (6) Packet length
- *  (7) Desired IP TTL or 0 to use default
+ *  (7) Desired IP TTL or 0 to use default, plus optional flags
  *
  * If there is only one local socket, the local socket can be ignored.
  * If the local socket is -1, the packet should be sent out from all
@@ -1398,6 +1770,12 @@ typedef int (*ZT_StateGetFunction)(
  * value if possible. If this is not possible it is acceptable to ignore
  * this value and send anyway with normal or default TTL.
  *
+ * If ZT_WIRE_PACKET_DONT_FRAGMENT is set, the packet should be sent with
+ * the IP don't fragment bit set (or IPV6_DONTFRAG) so that it is dropped
+ * rather than fragmented if it's too big for the path. This is used for
+ * path MTU discovery. Hosts that can't do this may ignore the flag, but
+ * will then not benefit from paths with MTUs larger than the default.
+ *
  * The function must return zero on success and may return any error code
  * on failure. Note that success does not (of course) guarantee packet
  * delivery. It only means that the packet appears to have been sent.
@@ -1412,6 +1790,73 @@ typedef int (*ZT_WirePacketSendFunction)(
 	unsigned int,                     /* Packet length */
 	unsigned int);                    /* TTL or 0 to use default */
 
+/**
+ * Function to send several ZeroTier packets out over the physical wire at once
+ *
+ * Parameters:
+ *  (1) Node
+ *  (2) User pointer
+ *  (3) Thread pointer
+ *  (4) Array of packets to send
+ *  (5) Number of packets in array
+ *
+ * This is called instead of ZT_WirePacketSendFunction when a single
+ * operation produces a run of packets, such as a fragmented packet, a
+ * multicast fan-out, or a network config pushed in chunks. Each packet
+ * has the same meaning as the parameters of ZT_WirePacketSendFunction.
+ * Packets should be sent in array order. The array and everything it
+ * points to is only valid for the duration of the call.
+ *
+ * The function must return zero if all packets appear to have been sent
+ * and may return any error code otherwise.
+ */
+typedef int (*ZT_WirePacketBatchSendFunction)(
+	ZT_Node *,                        /* Node */
+	void *,                           /* User ptr */
+	void *,                           /* Thread ptr */
+	const ZT_WirePacket *,            /* Packets */
+	unsigned int);                    /* Number of packets */
+
+/**
+ * Function to signal that packets are waiting for ZT_Node_processDeferredPackets()
+ *
+ * Parameters:
+ *  (1) Node
+ *  (2) User pointer
+ *  (3) Thread pointer
+ *
+ * If this is supplied, packets that are expensive to decode (HELLO from
+ * unknown peers, WHOIS replies, and network credentials) are queued rather
+ * than decoded on the thread that received them. This is called once for
+ * each packet queued and should wake a worker thread, which then calls
+ * ZT_Node_processDeferredPackets(). It must not call back into the node
+ * itself.
+ */
+typedef void (*ZT_DeferredPacketsFunction)(
+	ZT_Node *,                        /* Node */
+	void *,                           /* User ptr */
+	void *);                          /* Thread ptr */
+
+/**
+ * Function to signal that packets are waiting for ZT_Node_processCryptoJobs()
+ *
+ * Parameters:
+ *  (1) Node
+ *  (2) User pointer
+ *  (3) Thread pointer
+ *
+ * If this is supplied, packets to and from peers exchanging many packets per
+ * second are encrypted and decrypted by worker threads, so that one busy flow
+ * can use more than one core. They are still handed on to taps and the wire
+ * in order. This is called once for each packet queued and should wake a
+ * worker thread, which then calls ZT_Node_processCryptoJobs(). It must not
+ * call back into the node itself.
+ */
+typedef void (*ZT_CryptoJobsFunction)(
+	ZT_Node *,                        /* Node */
+	void *,                           /* User ptr */
+	void *);                          /* Thread ptr */
+
 /**
  * Function to check whether a path should be used for ZeroTier traffic
  *
@@ -1474,7 +1919,7 @@ typedef int (*ZT_PathLookupFunction)(
 struct ZT_Node_Callbacks
 {
 	/**
-	 * Struct version -- must currently be 0
+	 * Struct version -- 0 to 3 (1 adds wirePacketBatchSendFunction, 2 adds deferredPacketsFunction, 3 adds cryptoJobsFunction)
 	 */
 	long version;
 
@@ -1517,6 +1962,21 @@ struct ZT_Node_Callbacks
 	 * OPTIONAL: Function to get hints to physical paths to ZeroTier addresses
 	 */
 	ZT_PathLookupFunction pathLookupFunction;
+
+	/**
+	 * OPTIONAL: Function to send runs of packets over the physical wire at once (version 1+)
+	 */
+	ZT_WirePacketBatchSendFunction wirePacketBatchSendFunction;
+
+	/**
+	 * OPTIONAL: Function to signal packets waiting for worker threads (version 2+)
+	 */
+	ZT_DeferredPacketsFunction deferredPacketsFunction;
+
+	/**
+	 * OPTIONAL: Function to signal packets waiting for crypto worker threads (version 3+)
+	 */
+	ZT_CryptoJobsFunction cryptoJobsFunction;
 };
 
 /**
@@ -1598,6 +2058,95 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	unsigned int frameLength,
 	volatile uint64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Process several packets received from the physical wire
+ *
+ * This is equivalent to calling ZT_Node_processWirePacket() for each packet
+ * in order, but with the fixed cost of a call paid once per batch. Packets
+ * that are invalid are dropped and do not stop the rest of the batch.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param packets Array of packets
+ * @param packetCount Number of packets in array
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Decode packets queued for ZT_DeferredPacketsFunction
+ *
+ * This may be called from any number of threads at once, and returns
+ * when up to maxPackets have been decoded or the queue is empty.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param maxPackets Maximum number of packets to decode
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processDeferredPackets(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	unsigned int maxPackets,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Encrypt or decrypt packets queued for ZT_CryptoJobsFunction
+ *
+ * This may be called from any number of threads at once, and returns
+ * when up to maxJobs packets have been processed or the queue is empty.
+ * Packets whose turn has come are delivered by the calling thread.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param maxJobs Maximum number of packets to process
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processCryptoJobs(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	unsigned int maxJobs,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Process several frames from virtual network ports (taps)
+ *
+ * This is equivalent to calling ZT_Node_processVirtualNetworkFrame() for
+ * each frame in order. The network is looked up once for each run of
+ * consecutive frames with the same network ID, so callers should group
+ * frames by network where they can. Frames for networks that are not
+ * joined are dropped and processing continues with the next frame.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param frames Array of frames
+ * @param frameCount Number of frames in array
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0), ZT_RESULT_ERROR_NETWORK_NOT_FOUND if any frame's network was not found, or a fatal error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
 /**
  * Perform periodic background operations
  *
@@ -1618,6 +2167,10 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void
  * If we are already a member of the network, nothing is done and OK is
  * returned.
  *
+ * Joins of different networks may be made from several threads at once,
+ * and then load their saved configs and bring up their ports in parallel.
+ * A join of a network already being joined returns OK at once.
+ *
  * @param node Node instance
  * @param nwid 64-bit ZeroTier network ID
  * @param uptr An arbitrary pointer to associate with this network (default: NULL)
@@ -1739,6 +2292,35 @@ ZT_SDK_API void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status);
  */
 ZT_SDK_API ZT_PeerList *ZT_Node_peers(ZT_Node *node);
 
+/**
+ * Get the status of one peer
+ *
+ * This is a cheap way to look up a peer named in a peer or path event.
+ *
+ * @param node Node instance
+ * @param address ZeroTier address of peer (40 bits)
+ * @param peer Buffer to fill with peer status
+ * @return OK (0) or ZT_RESULT_ERROR_BAD_PARAMETER if peer is not known
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_peer(ZT_Node *node,uint64_t address,ZT_Peer *peer);
+
+/**
+ * Get the status of known peers a batch at a time
+ *
+ * This fills peers[] with up to max peers in ascending order of address,
+ * starting with the first address greater than after. Start with after
+ * set to 0 and pass the address of the last peer returned to get the next
+ * batch. Nothing is allocated for the result, but each call still looks
+ * at every peer so large batches are cheaper than small ones.
+ *
+ * @param node Node instance
+ * @param after Return only peers with addresses greater than this
+ * @param peers Buffer to fill with peer status
+ * @param max Size of peers[]
+ * @return Number of peers filled in, which is 0 at the end
+ */
+ZT_SDK_API unsigned int ZT_Node_peersAfter(ZT_Node *node,uint64_t after,ZT_Peer *peers,unsigned int max);
+
 /**
  * Get the status of a virtual network
  *
@@ -1854,6 +2436,246 @@ ZT_SDK_API void ZT_Node_setNetconfMaster(ZT_Node *node,void *networkConfigMaster
  */
 ZT_SDK_API void ZT_Node_setTrustedPaths(ZT_Node *node,const struct sockaddr_storage *networks,const uint64_t *ids,unsigned int count);
 
+/**
+ * Enable or disable multipath mode
+ *
+ * In multipath mode peers keep several active direct paths at once (e.g.
+ * one over each of several uplinks) and traffic is balanced across them
+ * by measured path quality. Each flow sticks to one path so that TCP is
+ * not reordered. Multipath is off by default.
+ *
+ * @param node Node instance
+ * @param enabled Nonzero to enable multipath, zero to disable
+ */
+ZT_SDK_API void ZT_Node_setMultipathMode(ZT_Node *node,int enabled);
+
+/**
+ * Set how long a peer may go without traffic before it's left idle
+ *
+ * Peers are pinged and their direct paths kept open only while frames or
+ * network configs have gone to or from them within this time. After that
+ * the paths lapse, which saves battery on mobile devices and bandwidth on
+ * nodes that know very many peers. The next frame to an idle peer goes
+ * through a root, which introduces the two again so a direct path comes
+ * back within a round trip or two. The default is 500 seconds.
+ *
+ * @param node Node instance
+ * @param ms Idle timeout in milliseconds, or 0 for the default
+ */
+ZT_SDK_API void ZT_Node_setPeerIdleTimeout(ZT_Node *node,unsigned int ms);
+
+/**
+ * Cap this node's outgoing bandwidth
+ *
+ * With a cap, packets this node originates wait in per-class and per-peer
+ * queues when over it and are paced out to it. Control traffic goes first
+ * and data is shared fairly among peers, with frames classed by their
+ * IP DSCP field: CS4 and up are interactive and CS1 and LE are bulk.
+ * Without a cap (the default) packets go straight out. Relayed traffic
+ * is not capped.
+ *
+ * @param node Node instance
+ * @param bitsPerSecond Cap in bits per second or 0 for none
+ */
+ZT_SDK_API void ZT_Node_setEgressBandwidthLimit(ZT_Node *node,uint64_t bitsPerSecond);
+
+/**
+ * Set whether an egress bandwidth cap paces packets out evenly
+ *
+ * By default a cap lets about 20ms worth of packets leave at once. With
+ * pacing that shrinks to about 2ms, so bulk sends such as fragment trains
+ * and multicast fanout reach a shallow uplink buffer spread out instead
+ * of all together. Hosts that can should also have the OS pace their UDP
+ * sockets to the same rate (e.g. SO_MAX_PACING_RATE on Linux). This does
+ * nothing without a cap.
+ *
+ * @param node Node instance
+ * @param enabled If true, pace packets under a cap (default: false)
+ */
+ZT_SDK_API void ZT_Node_setEgressPacing(ZT_Node *node,int enabled);
+
+/**
+ * Set whether ECN is carried between virtual network frames and the wire
+ *
+ * When on, this node tells peers in HELLO that it passes congestion marks
+ * on. Peers that do likewise get direct packets holding an ECN-capable IP
+ * frame sent with that frame's ECN field, and a packet that arrives marked
+ * congestion experienced (CE) has CE set in the IP header of the frame it
+ * holds. Only turn this on if the ECN field of every received packet is
+ * given in ZT_WirePacket::ttl, since marks that are lost on receive would
+ * hide congestion from the flows inside.
+ *
+ * @param node Node instance
+ * @param enabled If true, carry ECN (default: false)
+ */
+ZT_SDK_API void ZT_Node_setEcn(ZT_Node *node,int enabled);
+
+/**
+ * Set the rate at which this node will relay traffic from or to any one peer
+ *
+ * This only matters on roots and other nodes that relay. A packet is
+ * relayed only if neither its source nor its destination is over the
+ * limit, so one abusive peer can't take a relay's whole uplink. The
+ * default is 512 megabits per second.
+ *
+ * @param node Node instance
+ * @param bitsPerSecond Limit in bits per second or 0 for none
+ */
+ZT_SDK_API void ZT_Node_setRelayBandwidthLimit(ZT_Node *node,uint64_t bitsPerSecond);
+
+/**
+ * Set a limit on the number of peers this node holds in memory
+ *
+ * Over the limit the least recently heard from peers, other than roots and
+ * moons, are dropped to a smaller cache of identities and recreated if they
+ * are heard from again. This keeps a root's memory bounded when it is
+ * scanned or flooded by many addresses. The default is no limit.
+ *
+ * @param node Node instance
+ * @param maxPeers Maximum number of peers or 0 for no limit
+ */
+ZT_SDK_API void ZT_Node_setPeerLimit(ZT_Node *node,unsigned long maxPeers);
+
+/**
+ * Set limits on verifying the identities of unknown peers
+ *
+ * Checking a new identity is expensive, so each IPv4 /24 or IPv6 /48 may
+ * only have one checked every few seconds after an initial burst. HELLOs
+ * from unknown identities beyond that are dropped. The number of prefixes
+ * tracked bounds memory; when it's exceeded the least recently seen are
+ * forgotten. Roots under attack from many sources may want more. Changing
+ * the number forgets all prefixes.
+ *
+ * @param node Node instance
+ * @param prefixes Number of source prefixes to track, or 0 to leave unchanged (default 16384)
+ * @param burst Verifications a prefix may have back to back (default 1)
+ */
+ZT_SDK_API void ZT_Node_setIdentityVerificationLimit(ZT_Node *node,unsigned long prefixes,unsigned int burst);
+
+/**
+ * Size the node's peer tables ahead of time for a number of peers
+ *
+ * Peer tables otherwise grow by rehashing, which briefly stalls packet
+ * processing once there are many peers. Nodes that will hear from very
+ * many peers, such as roots, can call this once at startup. Tables never
+ * shrink, and calling this with a smaller number than before does nothing.
+ *
+ * @param node Node instance
+ * @param peers Number of peers expected
+ */
+ZT_SDK_API void ZT_Node_reservePeers(ZT_Node *node,unsigned long peers);
+
+/**
+ * Initialize cluster operation
+ *
+ * This initializes the internal structures and state for cluster operation.
+ * It takes two function pointers. The first is to a function that can be
+ * used to send data to cluster peers (mechanism is not defined by Node),
+ * and the second is to a function that can be used to get the location of
+ * a physical address in X,Y,Z coordinate space (e.g. as cartesian coordinates
+ * projected from the center of the Earth).
+ *
+ * Send function takes an arbitrary pointer followed by the cluster member ID
+ * to send data to, a pointer to the data, and the length of the data. The
+ * maximum message length is ZT_CLUSTER_MAX_MESSAGE_LENGTH, so a message
+ * fits in one UDP datagram on typical links. Messages must be delivered whole and may be dropped or transposed, though high
+ * failure rates are undesirable and can cause problems. Validity checking or
+ * CRC is also not required since the Node validates the authenticity of
+ * cluster messages using cryptographic methods and will silently drop invalid
+ * messages.
+ *
+ * Address to location function is optional and if NULL geo-handoff is not
+ * enabled (in this case x, y, and z in clusterInit are also unused). It
+ * takes an arbitrary pointer followed by a physical address and three result
+ * parameters for x, y, and z. It returns zero on failure or nonzero if these
+ * three coordinates have been set. Coordinate space is arbitrary and can be
+ * e.g. coordinates on Earth relative to Earth's center. These can be obtained
+ * from latitude and longitude by projecting onto a sphere.
+ *
+ * Neither the send nor the address to location function should block. If the
+ * address to location function does not have a location for an address, it
+ * should return zero and then look up the address for future use since it
+ * will be called again in (typically) 1-3 minutes.
+ *
+ * Note that both functions can be called from any thread from which the
+ * various Node functions are called, and so must be thread safe if multiple
+ * threads are being used.
+ *
+ * All members of a cluster share this node's identity. This can only be
+ * called once, before any packets have been processed.
+ *
+ * @param node Node instance
+ * @param myId My cluster member ID (less than ZT_CLUSTER_MAX_MEMBERS)
+ * @param zeroTierPhysicalEndpoints Preferred physical address(es) for ZeroTier clients to contact this member
+ * @param numZeroTierPhysicalEndpoints Number of physical endpoints in zeroTierPhysicalEndpoints[] (max allowed: 255)
+ * @param x My cluster member's X location
+ * @param y My cluster member's Y location
+ * @param z My cluster member's Z location
+ * @param sendFunction Function to be called to send data to other cluster members
+ * @param sendFunctionArg First argument to sendFunction()
+ * @param addressToLocationFunction Function to be called to get the location of a physical address or NULL to disable geo-handoff
+ * @param addressToLocationFunctionArg First argument to addressToLocationFunction()
+ * @return OK, or BAD_PARAMETER if the ID is invalid or the cluster is already initialized
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_clusterInit(
+	ZT_Node *node,
+	unsigned int myId,
+	const struct sockaddr_storage *zeroTierPhysicalEndpoints,
+	unsigned int numZeroTierPhysicalEndpoints,
+	int x,
+	int y,
+	int z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg);
+
+/**
+ * Add a member to this cluster
+ *
+ * Calling this without having called clusterInit() will do nothing.
+ *
+ * @param node Node instance
+ * @param memberId Member ID (must be less than ZT_CLUSTER_MAX_MEMBERS)
+ * @return OK or error if clustering is disabled, ID invalid, etc.
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_clusterAddMember(ZT_Node *node,unsigned int memberId);
+
+/**
+ * Remove a member from this cluster
+ *
+ * Calling this without having called clusterInit() will do nothing.
+ *
+ * @param node Node instance
+ * @param memberId Member ID to remove (nothing happens if not present)
+ */
+ZT_SDK_API void ZT_Node_clusterRemoveMember(ZT_Node *node,unsigned int memberId);
+
+/**
+ * Handle an incoming cluster state message
+ *
+ * The message itself contains cluster member IDs, and invalid or badly
+ * addressed messages will be silently discarded.
+ *
+ * Calling this without having called clusterInit() will do nothing.
+ *
+ * @param node Node instance
+ * @param msg Cluster message
+ * @param len Length of cluster message
+ */
+ZT_SDK_API void ZT_Node_clusterHandleIncomingMessage(ZT_Node *node,const void *msg,unsigned int len);
+
+/**
+ * Get the current status of the cluster from this node's point of view
+ *
+ * Calling this without clusterInit() will just zero out the structure and
+ * show a cluster size of zero.
+ *
+ * @param node Node instance
+ * @param cs Cluster status structure to fill with data
+ */
+ZT_SDK_API void ZT_Node_clusterStatus(ZT_Node *node,ZT_ClusterStatus *cs);
+
 /**
  * Get ZeroTier One version
  *
@@ -17,10 +17,18 @@ LOCAL_CFLAGS := -DZT_USE_MINIUPNPC
 
 # ZeroTierOne SDK source files
 LOCAL_SRC_FILES := \
+    $(ZT1)/node/AES.cpp \
     $(ZT1)/node/C25519.cpp \
 	$(ZT1)/node/Capability.cpp \
 	$(ZT1)/node/CertificateOfMembership.cpp \
 	$(ZT1)/node/CertificateOfOwnership.cpp \
+	$(ZT1)/node/Cluster.cpp \
+	$(ZT1)/node/CryptoPipeline.cpp \
+	$(ZT1)/node/Bench.cpp \
+	$(ZT1)/node/Capture.cpp \
+	$(ZT1)/node/Fec.cpp \
+	$(ZT1)/node/FlowExport.cpp \
+	$(ZT1)/node/HugePages.cpp \
 	$(ZT1)/node/Identity.cpp \
 	$(ZT1)/node/IncomingPacket.cpp \
 	$(ZT1)/node/InetAddress.cpp \
@@ -37,6 +45,7 @@ LOCAL_SRC_FILES := \
 	$(ZT1)/node/Revocation.cpp \
 	$(ZT1)/node/Salsa20.cpp \
 	$(ZT1)/node/SelfAwareness.cpp \
+	$(ZT1)/node/SignatureCache.cpp \
 	$(ZT1)/node/SHA512.cpp \
 	$(ZT1)/node/Switch.cpp \
 	$(ZT1)/node/Tag.cpp \
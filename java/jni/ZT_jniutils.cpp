@@ -59,6 +59,10 @@ jobject createResultObject(JNIEnv *env, ZT_ResultCode code)
         LOGV("RESULT_FATAL_ERROR_DATA_STORE_FAILED");
         fieldName = "RESULT_ERROR_NETWORK_NOT_FOUND";
         break;
+    case ZT_RESULT_ERROR_BAD_PARAMETER:
+        LOGV("RESULT_ERROR_BAD_PARAMETER");
+        fieldName = "RESULT_ERROR_BAD_PARAMETER";
+        break;
     case ZT_RESULT_FATAL_ERROR_INTERNAL:
     default:
         LOGV("RESULT_FATAL_ERROR_DATA_STORE_FAILED");
@@ -154,10 +158,13 @@ jobject createEvent(JNIEnv *env, ZT_Event event)
     case ZT_EVENT_TRACE:
         fieldName = "EVENT_TRACE";
         break;
-    case ZT_EVENT_USER_MESSAGE:
+    default: // peer and path events aren't exposed to Java
         break;
     }
 
+    if (fieldName.empty())
+        return NULL;
+
     jfieldID enumField = lookup.findStaticField(eventClass, fieldName.c_str(), "Lcom/zerotier/sdk/Event;");
 
     eventObject = env->GetStaticObjectField(eventClass, enumField);
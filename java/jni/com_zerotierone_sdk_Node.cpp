@@ -36,9 +36,16 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <assert.h>
 #include <string.h>
 
+// Most packets or frames in one batch handed to or from Java (Node.MAX_BATCH)
+#define ZT_JNI_MAX_BATCH 64
+
+// Size of the direct buffer behind each batch
+#define ZT_JNI_BATCH_BUFFER_SIZE 262144
+
 // global static JNI Lookup Object
 JniLookup lookup;
 
@@ -47,6 +54,8 @@ extern "C" {
 #endif
 
 namespace {
+    struct JniBatches;
+
     struct JniRef
     {
         JniRef()
@@ -59,6 +68,10 @@ namespace {
             , frameListener(NULL)
             , configListener(NULL)
             , pathChecker(NULL)
+            , batchSender(NULL)
+            , frameBatchListener(NULL)
+            , onSendPacketsMethod(NULL)
+            , onVirtualNetworkFramesMethod(NULL)
             , callbacks(NULL)
             , portMapper(NULL)
         {
@@ -66,25 +79,7 @@ namespace {
             memset(callbacks, 0, sizeof(ZT_Node_Callbacks));
         }
 
-        ~JniRef()
-        {
-            JNIEnv *env = NULL;
-            jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
-
-            env->DeleteGlobalRef(dataStoreGetListener);
-            env->DeleteGlobalRef(dataStorePutListener);
-            env->DeleteGlobalRef(packetSender);
-            env->DeleteGlobalRef(eventListener);
-            env->DeleteGlobalRef(frameListener);
-            env->DeleteGlobalRef(configListener);
-            env->DeleteGlobalRef(pathChecker);
-
-            free(callbacks);
-            callbacks = NULL;
-
-            delete portMapper;
-            portMapper = NULL;
-        }
+        ~JniRef();
 
         uint64_t id;
 
@@ -99,12 +94,279 @@ namespace {
         jobject frameListener;
         jobject configListener;
         jobject pathChecker;
+        jobject batchSender;
+        jobject frameBatchListener;
+
+        jmethodID onSendPacketsMethod;
+        jmethodID onVirtualNetworkFramesMethod;
+
+        // Batches not in use by any call into the node, kept for reuse
+        std::vector<JniBatches *> batchPool;
+        ZeroTier::Mutex batchPool_m;
 
         ZT_Node_Callbacks *callbacks;
 
         ZeroTier::PortMapper *portMapper;
     };
 
+    // Packets or frames collected during one call into the node, handed to
+    // Java in a direct ByteBuffer over native memory. The buffer and arrays
+    // are allocated once and reused for every batch, so nothing is
+    // allocated on the Java heap per packet.
+    struct DirectBatch
+    {
+        DirectBatch()
+            : data(NULL)
+            , buffer(NULL)
+            , longs(NULL)
+            , addresses(NULL)
+            , ints(NULL)
+            , count(0)
+            , used(0)
+        {
+        }
+
+        bool init(JNIEnv *env, bool withAddresses)
+        {
+            data = (unsigned char *)malloc(ZT_JNI_BATCH_BUFFER_SIZE);
+            if(data == NULL)
+                return false;
+            jobject b = env->NewDirectByteBuffer(data, ZT_JNI_BATCH_BUFFER_SIZE);
+            jlongArray l = env->NewLongArray(ZT_JNI_MAX_BATCH * 5);
+            jintArray i = env->NewIntArray(ZT_JNI_MAX_BATCH * 4);
+            jbyteArray a = (withAddresses) ? env->NewByteArray(ZT_JNI_MAX_BATCH * 16) : NULL;
+            if(env->ExceptionCheck() || b == NULL || l == NULL || i == NULL || (withAddresses && a == NULL))
+                return false;
+            buffer = env->NewGlobalRef(b);
+            longs = (jlongArray)env->NewGlobalRef(l);
+            ints = (jintArray)env->NewGlobalRef(i);
+            if(a != NULL)
+                addresses = (jbyteArray)env->NewGlobalRef(a);
+            return true;
+        }
+
+        void destroy(JNIEnv *env)
+        {
+            if(buffer) env->DeleteGlobalRef(buffer);
+            if(longs) env->DeleteGlobalRef(longs);
+            if(ints) env->DeleteGlobalRef(ints);
+            if(addresses) env->DeleteGlobalRef(addresses);
+            free(data);
+        }
+
+        // Returns where to copy an item of len bytes, or NULL if it must be flushed first
+        unsigned char *reserve(unsigned int len)
+        {
+            if((count >= ZT_JNI_MAX_BATCH) || ((used + len) > ZT_JNI_BATCH_BUFFER_SIZE))
+                return NULL;
+            return data + used;
+        }
+
+        unsigned char *data;
+        jobject buffer;
+        jlongArray longs;
+        jbyteArray addresses;
+        jintArray ints;
+
+        // Contents of the Java arrays, copied over once per batch
+        jlong longsLocal[ZT_JNI_MAX_BATCH * 5];
+        jbyte addressesLocal[ZT_JNI_MAX_BATCH * 16];
+        jint intsLocal[ZT_JNI_MAX_BATCH * 4];
+
+        unsigned int count;
+        unsigned int used;
+    };
+
+    // Batches for one call into the node, passed to callbacks as the thread pointer
+    struct JniBatches
+    {
+        DirectBatch packets;
+        DirectBatch frames;
+    };
+
+    void flushPackets(JNIEnv *env, JniRef *ref, DirectBatch &b)
+    {
+        if(b.count == 0)
+            return;
+        env->SetLongArrayRegion(b.longs, 0, b.count, b.longsLocal);
+        env->SetByteArrayRegion(b.addresses, 0, b.count * 16, b.addressesLocal);
+        env->SetIntArrayRegion(b.ints, 0, b.count * 4, b.intsLocal);
+        int retval = env->CallIntMethod(ref->batchSender, ref->onSendPacketsMethod, (jint)b.count, b.longs, b.addresses, b.ints, b.buffer);
+        if(retval != 0)
+        {
+            LOGV("JNI Packet Batch Sender returned: %d", retval);
+        }
+        b.count = 0;
+        b.used = 0;
+    }
+
+    void flushFrames(JNIEnv *env, JniRef *ref, DirectBatch &b)
+    {
+        if(b.count == 0)
+            return;
+        env->SetLongArrayRegion(b.longs, 0, b.count * 5, b.longsLocal);
+        env->SetIntArrayRegion(b.ints, 0, b.count * 2, b.intsLocal);
+        env->CallVoidMethod(ref->frameBatchListener, ref->onVirtualNetworkFramesMethod, (jint)b.count, b.longs, b.ints, b.buffer);
+        b.count = 0;
+        b.used = 0;
+    }
+
+    // Takes batches from the pool (or makes new ones) for the life of a call
+    // into the node and hands anything left in them to Java at the end. Holds
+    // nothing if no batch listeners were given, so callbacks go one at a time.
+    class BatchScope
+    {
+    public:
+        BatchScope(JNIEnv *env, JniRef *ref, bool enabled = true)
+            : _env(env)
+            , _ref(ref)
+            , _b(NULL)
+        {
+            if((!enabled) || ((ref->batchSender == NULL) && (ref->frameBatchListener == NULL)))
+                return;
+            {
+                ZeroTier::Mutex::Lock lock(ref->batchPool_m);
+                if(!ref->batchPool.empty())
+                {
+                    _b = ref->batchPool.back();
+                    ref->batchPool.pop_back();
+                    return;
+                }
+            }
+            JniBatches *b = new JniBatches();
+            if(((ref->batchSender != NULL) && (!b->packets.init(env, true))) || ((ref->frameBatchListener != NULL) && (!b->frames.init(env, false))))
+            {
+                LOGE("Couldn't create batch buffers");
+                b->packets.destroy(env);
+                b->frames.destroy(env);
+                delete b;
+                return;
+            }
+            _b = b;
+        }
+
+        ~BatchScope()
+        {
+            if(_b == NULL)
+                return;
+            flushPackets(_env, _ref, _b->packets);
+            flushFrames(_env, _ref, _b->frames);
+            ZeroTier::Mutex::Lock lock(_ref->batchPool_m);
+            _ref->batchPool.push_back(_b);
+        }
+
+        JniBatches *get() const { return _b; }
+
+    private:
+        JNIEnv *_env;
+        JniRef *_ref;
+        JniBatches *_b;
+    };
+
+    bool addPacket(JNIEnv *env, JniRef *ref, JniBatches *batches, int64_t localSocket, const struct sockaddr_storage *remoteAddress, const void *buffer, unsigned int bufferSize, unsigned int ttl)
+    {
+        if(batches == NULL)
+            return false;
+        DirectBatch &b = batches->packets;
+        unsigned char *p = b.reserve(bufferSize);
+        if(p == NULL)
+        {
+            flushPackets(env, ref, b);
+            if((p = b.reserve(bufferSize)) == NULL)
+                return false;
+        }
+
+        jbyte *a = b.addressesLocal + (b.count * 16);
+        unsigned int port;
+        if(remoteAddress->ss_family == AF_INET)
+        {
+            const sockaddr_in *sin = (const sockaddr_in *)remoteAddress;
+            memset(a, 0, 10);
+            a[10] = (jbyte)0xff;
+            a[11] = (jbyte)0xff;
+            memcpy(a + 12, &sin->sin_addr, 4);
+            port = ntohs(sin->sin_port);
+        }
+        else if(remoteAddress->ss_family == AF_INET6)
+        {
+            const sockaddr_in6 *sin6 = (const sockaddr_in6 *)remoteAddress;
+            memcpy(a, sin6->sin6_addr.s6_addr, 16);
+            port = ntohs(sin6->sin6_port);
+        }
+        else
+        {
+            return false;
+        }
+
+        memcpy(p, buffer, bufferSize);
+        b.longsLocal[b.count] = (jlong)localSocket;
+        jint *info = b.intsLocal + (b.count * 4);
+        info[0] = (jint)b.used;
+        info[1] = (jint)bufferSize;
+        info[2] = (jint)port;
+        info[3] = (jint)ttl;
+        b.used += bufferSize;
+        ++b.count;
+        return true;
+    }
+
+    bool addFrame(JNIEnv *env, JniRef *ref, JniBatches *batches, uint64_t nwid, uint64_t sourceMac, uint64_t destMac, unsigned int etherType, unsigned int vlanId, const void *frameData, unsigned int frameLength)
+    {
+        if(batches == NULL)
+            return false;
+        DirectBatch &b = batches->frames;
+        unsigned char *p = b.reserve(frameLength);
+        if(p == NULL)
+        {
+            flushFrames(env, ref, b);
+            if((p = b.reserve(frameLength)) == NULL)
+                return false;
+        }
+
+        memcpy(p, frameData, frameLength);
+        jlong *info = b.longsLocal + (b.count * 5);
+        info[0] = (jlong)nwid;
+        info[1] = (jlong)sourceMac;
+        info[2] = (jlong)destMac;
+        info[3] = (jlong)etherType;
+        info[4] = (jlong)vlanId;
+        b.intsLocal[b.count * 2] = (jint)b.used;
+        b.intsLocal[(b.count * 2) + 1] = (jint)frameLength;
+        b.used += frameLength;
+        ++b.count;
+        return true;
+    }
+
+    JniRef::~JniRef()
+    {
+        JNIEnv *env = NULL;
+        jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+
+        for(std::vector<JniBatches *>::iterator b(batchPool.begin()); b != batchPool.end(); ++b)
+        {
+            (*b)->packets.destroy(env);
+            (*b)->frames.destroy(env);
+            delete *b;
+        }
+        batchPool.clear();
+
+        env->DeleteGlobalRef(dataStoreGetListener);
+        env->DeleteGlobalRef(dataStorePutListener);
+        env->DeleteGlobalRef(packetSender);
+        env->DeleteGlobalRef(eventListener);
+        env->DeleteGlobalRef(frameListener);
+        env->DeleteGlobalRef(configListener);
+        env->DeleteGlobalRef(pathChecker);
+        env->DeleteGlobalRef(batchSender);
+        env->DeleteGlobalRef(frameBatchListener);
+
+        free(callbacks);
+        callbacks = NULL;
+
+        delete portMapper;
+        portMapper = NULL;
+    }
+
 
     int VirtualNetworkConfigFunctionCallback(
         ZT_Node *node,
@@ -176,6 +438,20 @@ namespace {
         JNIEnv *env = NULL;
         ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
 
+        if(ref->frameBatchListener != NULL)
+        {
+            if(threadData != NULL)
+            {
+                addFrame(env, ref, (JniBatches *)threadData, nwid, sourceMac, destMac, etherType, vlanid, frameData, frameLength);
+            }
+            else
+            {
+                // Frames from calls with no batch of their own go out on their own
+                BatchScope scope(env, ref);
+                addFrame(env, ref, scope.get(), nwid, sourceMac, destMac, etherType, vlanid, frameData, frameLength);
+            }
+            return;
+        }
 
         jclass frameListenerClass = env->GetObjectClass(ref->frameListener);
         if(env->ExceptionCheck() || frameListenerClass == NULL)
@@ -326,6 +602,9 @@ namespace {
             case ZT_STATE_OBJECT_PEER:
                 snprintf(p, sizeof(p), "peers.d/%.10llx", (unsigned long long)id[0]);
                 break;
+            case ZT_STATE_OBJECT_IDENTITY:
+                snprintf(p, sizeof(p), "identities.d/%.10llx.id", (unsigned long long)id[0]);
+                break;
             default:
                 return;
         }
@@ -410,6 +689,9 @@ namespace {
             case ZT_STATE_OBJECT_PEER:
                 snprintf(p, sizeof(p), "peers.d/%.10llx", (unsigned long long)id[0]);
                 break;
+            case ZT_STATE_OBJECT_IDENTITY:
+                snprintf(p, sizeof(p), "identities.d/%.10llx.id", (unsigned long long)id[0]);
+                break;
             default:
                 return -1;
         }
@@ -485,6 +767,13 @@ namespace {
         JNIEnv *env = NULL;
         ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
 
+        if(ref->batchSender != NULL)
+        {
+            if(threadData != NULL)
+                return (addPacket(env, ref, (JniBatches *)threadData, localSocket, remoteAddress, buffer, bufferSize, ttl)) ? 0 : -1;
+            BatchScope scope(env, ref);
+            return (addPacket(env, ref, scope.get(), localSocket, remoteAddress, buffer, bufferSize, ttl)) ? 0 : -1;
+        }
 
         jclass packetSenderClass = env->GetObjectClass(ref->packetSender);
         if(packetSenderClass == NULL)
@@ -510,6 +799,30 @@ namespace {
         return retval;
     }
 
+    int WirePacketBatchSendFunction(ZT_Node *node,
+        void *userData,
+        void *threadData,
+        const ZT_WirePacket *packets,
+        unsigned int count)
+    {
+        JniRef *ref = (JniRef*)userData;
+        assert(ref->node == node);
+
+        JNIEnv *env = NULL;
+        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+
+        // Packets from calls with no batch of their own go out together here
+        BatchScope scope(env, ref, threadData == NULL);
+        JniBatches *batches = (threadData != NULL) ? (JniBatches *)threadData : scope.get();
+        int retval = 0;
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            if(!addPacket(env, ref, batches, packets[i].localSocket, packets[i].remoteAddress, packets[i].packetData, packets[i].packetLength, packets[i].ttl))
+                retval = -1;
+        }
+        return retval;
+    }
+
     int PathCheckFunction(ZT_Node *node,
         void *userPtr,
         void *threadPtr,
@@ -669,17 +982,141 @@ namespace {
     static NodeMap nodeMap;
     ZeroTier::Mutex nodeMapMutex;
 
-    ZT_Node* findNode(uint64_t nodeId)
+    JniRef* findRef(uint64_t nodeId)
     {
         ZeroTier::Mutex::Lock lock(nodeMapMutex);
         NodeMap::iterator found = nodeMap.find(nodeId);
         if(found != nodeMap.end())
         {
-            JniRef *ref = found->second;
-            return ref->node;
+            return found->second;
         }
         return NULL;
     }
+
+    ZT_Node* findNode(uint64_t nodeId)
+    {
+        JniRef *ref = findRef(nodeId);
+        return (ref != NULL) ? ref->node : NULL;
+    }
+
+    // Converts a java.net.InetSocketAddress to a sockaddr_in or sockaddr_in6
+    bool toSockaddr(JNIEnv *env, jobject in_remoteAddress, sockaddr_storage &remoteAddress)
+    {
+        // get the java.net.InetSocketAddress class and getAddress() method
+        jclass inetAddressClass = lookup.findClass("java/net/InetAddress");
+        if(inetAddressClass == NULL)
+        {
+            LOGE("Can't find InetAddress class");
+            // can't find java.net.InetAddress
+            return false;
+        }
+
+        jmethodID getAddressMethod = lookup.findMethod(
+            inetAddressClass, "getAddress", "()[B");
+        if(getAddressMethod == NULL)
+        {
+            // cant find InetAddress.getAddres()
+            return false;
+        }
+
+        jclass InetSocketAddressClass = lookup.findClass("java/net/InetSocketAddress");
+        if(InetSocketAddressClass == NULL)
+        {
+            return false;
+        }
+
+        jmethodID inetSockGetAddressMethod = lookup.findMethod(
+            InetSocketAddressClass, "getAddress", "()Ljava/net/InetAddress;");
+
+        jobject remoteAddrObject = env->CallObjectMethod(in_remoteAddress, inetSockGetAddressMethod);
+
+        if(remoteAddrObject == NULL)
+        {
+            return false;
+        }
+
+        jmethodID inetSock_getPort = lookup.findMethod(
+            InetSocketAddressClass, "getPort", "()I");
+
+        if(env->ExceptionCheck() || inetSock_getPort == NULL)
+        {
+            LOGE("Couldn't find getPort method on InetSocketAddress");
+            return false;
+        }
+
+        // call InetSocketAddress.getPort()
+        int remotePort = env->CallIntMethod(in_remoteAddress, inetSock_getPort);
+        if(env->ExceptionCheck())
+        {
+            LOGE("Exception calling InetSocketAddress.getPort()");
+            return false;
+        }
+
+        // Call InetAddress.getAddress()
+        jbyteArray remoteAddressArray = (jbyteArray)env->CallObjectMethod(remoteAddrObject, getAddressMethod);
+        if(remoteAddressArray == NULL)
+        {
+            LOGE("Unable to call getAddress()");
+            // unable to call getAddress()
+            return false;
+        }
+
+        unsigned int addrSize = env->GetArrayLength(remoteAddressArray);
+
+
+        // get the address bytes
+        jbyte *addr = (jbyte*)env->GetPrimitiveArrayCritical(remoteAddressArray, NULL);
+        memset(&remoteAddress, 0, sizeof(remoteAddress));
+
+        if(addrSize == 16)
+        {
+            // IPV6 address
+            sockaddr_in6 ipv6 = {};
+            ipv6.sin6_family = AF_INET6;
+            ipv6.sin6_port = htons(remotePort);
+            memcpy(ipv6.sin6_addr.s6_addr, addr, 16);
+            memcpy(&remoteAddress, &ipv6, sizeof(sockaddr_in6));
+        }
+        else if(addrSize == 4)
+        {
+            // IPV4 address
+            sockaddr_in ipv4 = {};
+            ipv4.sin_family = AF_INET;
+            ipv4.sin_port = htons(remotePort);
+            memcpy(&ipv4.sin_addr, addr, 4);
+            memcpy(&remoteAddress, &ipv4, sizeof(sockaddr_in));
+        }
+        else
+        {
+            LOGE("Unknown IP version");
+            // unknown address type
+            env->ReleasePrimitiveArrayCritical(remoteAddressArray, addr, 0);
+            return false;
+        }
+        env->ReleasePrimitiveArrayCritical(remoteAddressArray, addr, 0);
+        return true;
+    }
+
+    // Converts 16 bytes of IPv6 (or IPv4-mapped IPv4) address and a port to a sockaddr_in or sockaddr_in6
+    void toSockaddrMapped(const jbyte *addr, unsigned int port, sockaddr_storage &remoteAddress)
+    {
+        static const unsigned char v4mapped[12] = { 0,0,0,0,0,0,0,0,0,0,0xff,0xff };
+        memset(&remoteAddress, 0, sizeof(remoteAddress));
+        if(memcmp(addr, v4mapped, 12) == 0)
+        {
+            sockaddr_in *ipv4 = (sockaddr_in *)&remoteAddress;
+            ipv4->sin_family = AF_INET;
+            ipv4->sin_port = htons(port);
+            memcpy(&ipv4->sin_addr, addr + 12, 4);
+        }
+        else
+        {
+            sockaddr_in6 *ipv6 = (sockaddr_in6 *)&remoteAddress;
+            ipv6->sin6_family = AF_INET6;
+            ipv6->sin6_port = htons(port);
+            memcpy(ipv6->sin6_addr.s6_addr, addr, 16);
+        }
+    }
 }
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved)
@@ -811,6 +1248,46 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_node_1init(
         ref->pathChecker = env->NewGlobalRef(tmp);
     }
 
+    fid = lookup.findField(
+        cls, "batchSender", "Lcom/zerotier/sdk/PacketBatchSender;");
+    if(fid == NULL)
+    {
+        return NULL; // exception already thrown
+    }
+
+    tmp = env->GetObjectField(obj, fid);
+    if(tmp != NULL)
+    {
+        ref->onSendPacketsMethod = lookup.findMethod(env->GetObjectClass(tmp),
+            "onSendPackets", "(I[J[B[ILjava/nio/ByteBuffer;)I");
+        if(ref->onSendPacketsMethod == NULL)
+        {
+            LOGE("Couldn't find onSendPackets method");
+            return NULL;
+        }
+        ref->batchSender = env->NewGlobalRef(tmp);
+    }
+
+    fid = lookup.findField(
+        cls, "frameBatchListener", "Lcom/zerotier/sdk/VirtualNetworkFrameBatchListener;");
+    if(fid == NULL)
+    {
+        return NULL; // exception already thrown
+    }
+
+    tmp = env->GetObjectField(obj, fid);
+    if(tmp != NULL)
+    {
+        ref->onVirtualNetworkFramesMethod = lookup.findMethod(env->GetObjectClass(tmp),
+            "onVirtualNetworkFrames", "(I[J[ILjava/nio/ByteBuffer;)V");
+        if(ref->onVirtualNetworkFramesMethod == NULL)
+        {
+            LOGE("Couldn't find onVirtualNetworkFrames method");
+            return NULL;
+        }
+        ref->frameBatchListener = env->NewGlobalRef(tmp);
+    }
+
     ref->callbacks->stateGetFunction = &StateGetFunction;
     ref->callbacks->statePutFunction = &StatePutFunction;
     ref->callbacks->wirePacketSendFunction = &WirePacketSendFunction;
@@ -819,6 +1296,11 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_node_1init(
     ref->callbacks->eventCallback = &EventCallback;
     ref->callbacks->pathCheckFunction = &PathCheckFunction;
     ref->callbacks->pathLookupFunction = &PathLookupFunction;
+    if(ref->batchSender != NULL)
+    {
+        ref->callbacks->version = 1;
+        ref->callbacks->wirePacketBatchSendFunction = &WirePacketBatchSendFunction;
+    }
 
     ZT_ResultCode rc = ZT_Node_new(
         &node,
@@ -907,8 +1389,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame(
 {
     uint64_t nodeId = (uint64_t) id;
 
-    ZT_Node *node = findNode(nodeId);
-    if(node == NULL)
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
     {
         // cannot find valid node.  We should  never get here.
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
@@ -936,9 +1418,10 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame(
 
     uint64_t nextBackgroundTaskDeadline = 0;
 
+    BatchScope scope(env, ref);
     ZT_ResultCode rc = ZT_Node_processVirtualNetworkFrame(
-        node,
-        NULL,
+        ref->node,
+        scope.get(),
         now,
         nwid,
         sourceMac,
@@ -949,6 +1432,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame(
         frameLength,
         &nextBackgroundTaskDeadline);
 
+    free(localData);
+
     jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
     outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
     env->ReleasePrimitiveArrayCritical(out_nextBackgroundTaskDeadline, outDeadline, 0);
@@ -971,8 +1456,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket(
     jlongArray out_nextBackgroundTaskDeadline)
 {
     uint64_t nodeId = (uint64_t) id;
-    ZT_Node *node = findNode(nodeId);
-    if(node == NULL)
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
     {
         // cannot find valid node.  We should  never get here.
         LOGE("Couldn't find a valid node!");
@@ -988,131 +1473,352 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket(
 
     uint64_t now = (uint64_t)in_now;
 
-    // get the java.net.InetSocketAddress class and getAddress() method
-    jclass inetAddressClass = lookup.findClass("java/net/InetAddress");
-    if(inetAddressClass == NULL)
+    sockaddr_storage remoteAddress;
+    if(!toSockaddr(env, in_remoteAddress, remoteAddress))
     {
-        LOGE("Can't find InetAddress class");
-        // can't find java.net.InetAddress
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
 
-    jmethodID getAddressMethod = lookup.findMethod(
-        inetAddressClass, "getAddress", "()[B");
-    if(getAddressMethod == NULL)
+    unsigned int packetLength = (unsigned int)env->GetArrayLength(in_packetData);
+    if(packetLength == 0)
     {
-        // cant find InetAddress.getAddres()
+        LOGE("Empty packet?!?");
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
+    void *packetData = env->GetPrimitiveArrayCritical(in_packetData, NULL);
+    void *localData = malloc(packetLength);
+    memcpy(localData, packetData, packetLength);
+    env->ReleasePrimitiveArrayCritical(in_packetData, packetData, 0);
 
-    jclass InetSocketAddressClass = lookup.findClass("java/net/InetSocketAddress");
-    if(InetSocketAddressClass == NULL)
+    uint64_t nextBackgroundTaskDeadline = 0;
+
+    BatchScope scope(env, ref);
+    ZT_ResultCode rc = ZT_Node_processWirePacket(
+        ref->node,
+        scope.get(),
+        now,
+        in_localSocket,
+        &remoteAddress,
+        localData,
+        packetLength,
+        &nextBackgroundTaskDeadline);
+    if(rc != ZT_RESULT_OK)
     {
-        return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
+        LOGE("ZT_Node_processWirePacket returned: %d", rc);
     }
 
-    jmethodID inetSockGetAddressMethod = lookup.findMethod(
-        InetSocketAddressClass, "getAddress", "()Ljava/net/InetAddress;");
+    free(localData);
+
+    jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
+    outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
+    env->ReleasePrimitiveArrayCritical(out_nextBackgroundTaskDeadline, outDeadline, 0);
+
+    return createResultObject(env, rc);
+}
 
-    jobject remoteAddrObject = env->CallObjectMethod(in_remoteAddress, inetSockGetAddressMethod);
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrameDirect
+ * Signature: (JJJJJIILjava/nio/ByteBuffer;II[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrameDirect(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jlong in_nwid,
+    jlong in_sourceMac,
+    jlong in_destMac,
+    jint in_etherType,
+    jint in_vlanId,
+    jobject in_frameData,
+    jint in_offset,
+    jint in_length,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    uint64_t nodeId = (uint64_t) id;
 
-    if(remoteAddrObject == NULL)
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
     {
+        // cannot find valid node.  We should  never get here.
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
 
-    jmethodID inetSock_getPort = lookup.findMethod(
-        InetSocketAddressClass, "getPort", "()I");
-
-    if(env->ExceptionCheck() || inetSock_getPort == NULL)
+    if(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1)
     {
-        LOGE("Couldn't find getPort method on InetSocketAddress");
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
 
-    // call InetSocketAddress.getPort()
-    int remotePort = env->CallIntMethod(in_remoteAddress, inetSock_getPort);
-    if(env->ExceptionCheck())
+    // The frame is read in place, without copying it out of the buffer
+    const unsigned char *frameData = (const unsigned char *)env->GetDirectBufferAddress(in_frameData);
+    const jlong capacity = env->GetDirectBufferCapacity(in_frameData);
+    if((frameData == NULL) || (in_offset < 0) || (in_length < 0) || (((jlong)in_offset + (jlong)in_length) > capacity))
     {
-        LOGE("Exception calling InetSocketAddress.getPort()");
+        LOGE("Frame is not in a direct buffer or is out of its bounds");
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
+
+    uint64_t nextBackgroundTaskDeadline = 0;
+
+    BatchScope scope(env, ref);
+    ZT_ResultCode rc = ZT_Node_processVirtualNetworkFrame(
+        ref->node,
+        scope.get(),
+        (uint64_t)in_now,
+        (uint64_t)in_nwid,
+        (uint64_t)in_sourceMac,
+        (uint64_t)in_destMac,
+        (unsigned int)in_etherType,
+        (unsigned int)in_vlanId,
+        (const void*)(frameData + in_offset),
+        (unsigned int)in_length,
+        &nextBackgroundTaskDeadline);
+
+    jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return createResultObject(env, rc);
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrames
+ * Signature: (JJI[J[ILjava/nio/ByteBuffer;[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrames(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jint in_count,
+    jlongArray in_frameInfo,
+    jintArray in_extents,
+    jobject in_data,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    uint64_t nodeId = (uint64_t) id;
+
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
 
-    // Call InetAddress.getAddress()
-    jbyteArray remoteAddressArray = (jbyteArray)env->CallObjectMethod(remoteAddrObject, getAddressMethod);
-    if(remoteAddressArray == NULL)
+    if(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1)
     {
-        LOGE("Unable to call getAddress()");
-        // unable to call getAddress()
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
 
-    unsigned int addrSize = env->GetArrayLength(remoteAddressArray);
+    if((in_count < 0) || (in_count > ZT_JNI_MAX_BATCH) || (env->GetArrayLength(in_frameInfo) < (in_count * 5)) || (env->GetArrayLength(in_extents) < (in_count * 2)))
+    {
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
 
+    const unsigned char *data = (const unsigned char *)env->GetDirectBufferAddress(in_data);
+    const jlong capacity = env->GetDirectBufferCapacity(in_data);
+    if(data == NULL)
+    {
+        LOGE("Frames are not in a direct buffer");
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
 
-    // get the address bytes
-    jbyte *addr = (jbyte*)env->GetPrimitiveArrayCritical(remoteAddressArray, NULL);
-    sockaddr_storage remoteAddress = {};
+    jlong frameInfo[ZT_JNI_MAX_BATCH * 5];
+    jint extents[ZT_JNI_MAX_BATCH * 2];
+    env->GetLongArrayRegion(in_frameInfo, 0, in_count * 5, frameInfo);
+    env->GetIntArrayRegion(in_extents, 0, in_count * 2, extents);
 
-    if(addrSize == 16)
+    ZT_VirtualNetworkFrame frames[ZT_JNI_MAX_BATCH];
+    for(int i = 0; i < in_count; ++i)
     {
-        // IPV6 address
-        sockaddr_in6 ipv6 = {};
-        ipv6.sin6_family = AF_INET6;
-        ipv6.sin6_port = htons(remotePort);
-        memcpy(ipv6.sin6_addr.s6_addr, addr, 16);
-        memcpy(&remoteAddress, &ipv6, sizeof(sockaddr_in6));
+        const jint offset = extents[i * 2];
+        const jint length = extents[(i * 2) + 1];
+        if((offset < 0) || (length < 0) || (((jlong)offset + (jlong)length) > capacity))
+        {
+            LOGE("Frame %d is out of the buffer's bounds", i);
+            return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+        }
+        frames[i].nwid = (uint64_t)frameInfo[i * 5];
+        frames[i].sourceMac = (uint64_t)frameInfo[(i * 5) + 1];
+        frames[i].destMac = (uint64_t)frameInfo[(i * 5) + 2];
+        frames[i].etherType = (unsigned int)frameInfo[(i * 5) + 3];
+        frames[i].vlanId = (unsigned int)frameInfo[(i * 5) + 4];
+        frames[i].frameData = data + offset;
+        frames[i].frameLength = (unsigned int)length;
     }
-    else if(addrSize == 4)
+
+    uint64_t nextBackgroundTaskDeadline = 0;
+
+    BatchScope scope(env, ref);
+    ZT_ResultCode rc = ZT_Node_processVirtualNetworkFrames(
+        ref->node,
+        scope.get(),
+        (uint64_t)in_now,
+        frames,
+        (unsigned int)in_count,
+        &nextBackgroundTaskDeadline);
+
+    jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return createResultObject(env, rc);
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePacketDirect
+ * Signature: (JJJLjava/net/InetSocketAddress;Ljava/nio/ByteBuffer;II[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacketDirect(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jlong in_localSocket,
+    jobject in_remoteAddress,
+    jobject in_packetData,
+    jint in_offset,
+    jint in_length,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    uint64_t nodeId = (uint64_t) id;
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
     {
-        // IPV4 address
-        sockaddr_in ipv4 = {};
-        ipv4.sin_family = AF_INET;
-        ipv4.sin_port = htons(remotePort);
-        memcpy(&ipv4.sin_addr, addr, 4);
-        memcpy(&remoteAddress, &ipv4, sizeof(sockaddr_in));
+        // cannot find valid node.  We should  never get here.
+        LOGE("Couldn't find a valid node!");
+        return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
-    else
+
+    if(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1)
     {
-        LOGE("Unknown IP version");
-        // unknown address type
-        env->ReleasePrimitiveArrayCritical(remoteAddressArray, addr, 0);
+        LOGE("nbtd_len < 1");
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
-    env->ReleasePrimitiveArrayCritical(remoteAddressArray, addr, 0);
 
-    unsigned int packetLength = (unsigned int)env->GetArrayLength(in_packetData);
-    if(packetLength == 0)
+    sockaddr_storage remoteAddress;
+    if(!toSockaddr(env, in_remoteAddress, remoteAddress))
     {
-        LOGE("Empty packet?!?");
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
     }
-    void *packetData = env->GetPrimitiveArrayCritical(in_packetData, NULL);
-    void *localData = malloc(packetLength);
-    memcpy(localData, packetData, packetLength);
-    env->ReleasePrimitiveArrayCritical(in_packetData, packetData, 0);
+
+    // The packet is read in place, without copying it out of the buffer
+    const unsigned char *packetData = (const unsigned char *)env->GetDirectBufferAddress(in_packetData);
+    const jlong capacity = env->GetDirectBufferCapacity(in_packetData);
+    if((packetData == NULL) || (in_offset < 0) || (in_length <= 0) || (((jlong)in_offset + (jlong)in_length) > capacity))
+    {
+        LOGE("Packet is not in a direct buffer or is out of its bounds");
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
 
     uint64_t nextBackgroundTaskDeadline = 0;
 
+    BatchScope scope(env, ref);
     ZT_ResultCode rc = ZT_Node_processWirePacket(
-        node,
-        NULL,
-        now,
+        ref->node,
+        scope.get(),
+        (uint64_t)in_now,
         in_localSocket,
         &remoteAddress,
-        localData,
-        packetLength,
+        packetData + in_offset,
+        (unsigned int)in_length,
         &nextBackgroundTaskDeadline);
     if(rc != ZT_RESULT_OK)
     {
         LOGE("ZT_Node_processWirePacket returned: %d", rc);
     }
 
-    free(localData);
+    jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
 
-    jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
-    outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
-    env->ReleasePrimitiveArrayCritical(out_nextBackgroundTaskDeadline, outDeadline, 0);
+    return createResultObject(env, rc);
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePackets
+ * Signature: (JJI[J[B[ILjava/nio/ByteBuffer;[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePackets(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jint in_count,
+    jlongArray in_localSockets,
+    jbyteArray in_addresses,
+    jintArray in_packetInfo,
+    jobject in_data,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    uint64_t nodeId = (uint64_t) id;
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
+        LOGE("Couldn't find a valid node!");
+        return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
+    }
+
+    if(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1)
+    {
+        LOGE("nbtd_len < 1");
+        return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
+    }
+
+    if((in_count < 0) || (in_count > ZT_JNI_MAX_BATCH) || (env->GetArrayLength(in_localSockets) < in_count) || (env->GetArrayLength(in_addresses) < (in_count * 16)) || (env->GetArrayLength(in_packetInfo) < (in_count * 4)))
+    {
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
+
+    const unsigned char *data = (const unsigned char *)env->GetDirectBufferAddress(in_data);
+    const jlong capacity = env->GetDirectBufferCapacity(in_data);
+    if(data == NULL)
+    {
+        LOGE("Packets are not in a direct buffer");
+        return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+    }
+
+    jlong localSockets[ZT_JNI_MAX_BATCH];
+    jbyte addresses[ZT_JNI_MAX_BATCH * 16];
+    jint packetInfo[ZT_JNI_MAX_BATCH * 4];
+    env->GetLongArrayRegion(in_localSockets, 0, in_count, localSockets);
+    env->GetByteArrayRegion(in_addresses, 0, in_count * 16, addresses);
+    env->GetIntArrayRegion(in_packetInfo, 0, in_count * 4, packetInfo);
+
+    sockaddr_storage remoteAddresses[ZT_JNI_MAX_BATCH];
+    ZT_WirePacket packets[ZT_JNI_MAX_BATCH];
+    for(int i = 0; i < in_count; ++i)
+    {
+        const jint offset = packetInfo[i * 4];
+        const jint length = packetInfo[(i * 4) + 1];
+        if((offset < 0) || (length <= 0) || (((jlong)offset + (jlong)length) > capacity))
+        {
+            LOGE("Packet %d is out of the buffer's bounds", i);
+            return createResultObject(env, ZT_RESULT_ERROR_BAD_PARAMETER);
+        }
+        toSockaddrMapped(addresses + (i * 16), (unsigned int)packetInfo[(i * 4) + 2], remoteAddresses[i]);
+        packets[i].localSocket = (int64_t)localSockets[i];
+        packets[i].remoteAddress = &remoteAddresses[i];
+        packets[i].packetData = data + offset;
+        packets[i].packetLength = (unsigned int)length;
+        packets[i].ttl = 0;
+    }
+
+    uint64_t nextBackgroundTaskDeadline = 0;
+
+    BatchScope scope(env, ref);
+    ZT_ResultCode rc = ZT_Node_processWirePackets(
+        ref->node,
+        scope.get(),
+        (uint64_t)in_now,
+        packets,
+        (unsigned int)in_count,
+        &nextBackgroundTaskDeadline);
+    if(rc != ZT_RESULT_OK)
+    {
+        LOGE("ZT_Node_processWirePackets returned: %d", rc);
+    }
+
+    jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
 
     return createResultObject(env, rc);
 }
@@ -1129,8 +1835,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processBackgroundTasks(
     jlongArray out_nextBackgroundTaskDeadline)
 {
     uint64_t nodeId = (uint64_t) id;
-    ZT_Node *node = findNode(nodeId);
-    if(node == NULL)
+    JniRef *ref = findRef(nodeId);
+    if(ref == NULL)
     {
         // cannot find valid node.  We should  never get here.
         return createResultObject(env, ZT_RESULT_FATAL_ERROR_INTERNAL);
@@ -1145,7 +1851,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processBackgroundTasks(
     uint64_t now = (uint64_t)in_now;
     uint64_t nextBackgroundTaskDeadline = 0;
 
-    ZT_ResultCode rc = ZT_Node_processBackgroundTasks(node, NULL, now, &nextBackgroundTaskDeadline);
+    BatchScope scope(env, ref);
+    ZT_ResultCode rc = ZT_Node_processBackgroundTasks(ref->node, scope.get(), now, &nextBackgroundTaskDeadline);
 
     jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
     outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
@@ -39,6 +39,38 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame
 JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket
   (JNIEnv *, jobject, jlong, jlong, jlong, jobject, jbyteArray, jlongArray);
 
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrameDirect
+ * Signature: (JJJJJIILjava/nio/ByteBuffer;II[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrameDirect
+  (JNIEnv *, jobject, jlong, jlong, jlong, jlong, jlong, jint, jint, jobject, jint, jint, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrames
+ * Signature: (JJI[J[ILjava/nio/ByteBuffer;[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrames
+  (JNIEnv *, jobject, jlong, jlong, jint, jlongArray, jintArray, jobject, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePacketDirect
+ * Signature: (JJJLjava/net/InetSocketAddress;Ljava/nio/ByteBuffer;II[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacketDirect
+  (JNIEnv *, jobject, jlong, jlong, jlong, jobject, jobject, jint, jint, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePackets
+ * Signature: (JJI[J[B[ILjava/nio/ByteBuffer;[J)Lcom/zerotier/sdk/ResultCode;
+ */
+JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePackets
+  (JNIEnv *, jobject, jlong, jlong, jint, jlongArray, jbyteArray, jintArray, jobject, jlongArray);
+
 /*
  * Class:     com_zerotier_sdk_Node
  * Method:    processBackgroundTasks
@@ -28,6 +28,7 @@
 package com.zerotier.sdk;
 
 import java.net.InetSocketAddress;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.io.IOException;
 
@@ -60,6 +61,12 @@ public class Node {
 
     private static final String TAG = "NODE";
 
+    /**
+     * Most packets or frames passed to processWirePackets() or
+     * processVirtualNetworkFrames(), or handed to batch listeners, at once
+     */
+    public static final int MAX_BATCH = 64;
+
     /**
      * Node ID for JNI purposes.
      * Currently set to the now value passed in at the constructor
@@ -75,6 +82,8 @@ public class Node {
     private final VirtualNetworkFrameListener frameListener;
     private final VirtualNetworkConfigListener configListener;
     private final PathChecker pathChecker;
+    private final PacketBatchSender batchSender;
+    private final VirtualNetworkFrameBatchListener frameBatchListener;
     
     /**
      * Create a new ZeroTier One node
@@ -100,6 +109,38 @@ public class Node {
                 VirtualNetworkConfigListener configListener,
                 PathChecker pathChecker) throws NodeException
 	{
+        this(now, getListener, putListener, sender, eventListener, frameListener, configListener, pathChecker, null, null);
+	}
+
+    /**
+     * Create a new ZeroTier One node that hands packets and frames over in batches
+     *
+     * <p>Packets and frames are passed in direct buffers that are reused for
+     * every batch, without allocating Java objects for each one. Each batch
+     * is delivered before the call into the node that produced it returns.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param getListener User written instance of the {@link DataStoreGetListener} interface called to get objects from persistent storage.  This instance must be unique per Node object.
+     * @param putListener User written intstance of the {@link DataStorePutListener} interface called to put objects in persistent storage.  This instance must be unique per Node object.
+     * @param sender Used for packets if batchSender is null
+     * @param eventListener User written instance of the {@link EventListener} interface to receive status updates and non-fatal error notices.  This instance must be unique per Node object.
+     * @param frameListener Used for frames if frameBatchListener is null
+     * @param configListener User written instance of the {@link VirtualNetworkConfigListener} interface to be called when virtual LANs are created, deleted, or their config parameters change.  This instance must be unique per Node object.
+     * @param pathChecker User written instance of the {@link PathChecker} interface. Not required and can be null.
+     * @param batchSender User written instance of the {@link PacketBatchSender} interface. Can be null.
+     * @param frameBatchListener User written instance of the {@link VirtualNetworkFrameBatchListener} interface. Can be null.
+     */
+	public Node(long now,
+                DataStoreGetListener getListener,
+                DataStorePutListener putListener,
+                PacketSender sender,
+                EventListener eventListener,
+                VirtualNetworkFrameListener frameListener,
+                VirtualNetworkConfigListener configListener,
+                PathChecker pathChecker,
+                PacketBatchSender batchSender,
+                VirtualNetworkFrameBatchListener frameBatchListener) throws NodeException
+	{
         this.nodeId = now;
 
         this.getListener = getListener;
@@ -109,6 +150,8 @@ public class Node {
         this.frameListener = frameListener;
         this.configListener = configListener;
         this.pathChecker = pathChecker;
+        this.batchSender = batchSender;
+        this.frameBatchListener = frameBatchListener;
 
         ResultCode rc = node_init(now);
         if(rc != ResultCode.RESULT_OK)
@@ -182,6 +225,112 @@ public class Node {
             nextBackgroundTaskDeadline);
     }
 
+    /**
+     * Process a frame from a virtual network port held in a direct buffer
+     *
+     * <p>The frame is read in place from the buffer's position to its limit,
+     * without being copied. The buffer's position is not changed.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param nwid ZeroTier 64-bit virtual network ID
+     * @param sourceMac Source MAC address (least significant 48 bits)
+     * @param destMac Destination MAC address (least significant 48 bits)
+     * @param etherType 16-bit Ethernet frame type
+     * @param vlanId 10-bit VLAN ID or 0 if none
+     * @param frameData Direct buffer holding the frame payload
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processVirtualNetworkFrame(
+        long now,
+        long nwid,
+        long sourceMac,
+        long destMac,
+        int etherType,
+        int vlanId,
+        ByteBuffer frameData,
+        long[] nextBackgroundTaskDeadline) {
+        return processVirtualNetworkFrameDirect(
+            nodeId, now, nwid, sourceMac, destMac, etherType, vlanId,
+            frameData, frameData.position(), frameData.remaining(), nextBackgroundTaskDeadline);
+    }
+
+    /**
+     * Process several frames from virtual network ports held in one direct buffer
+     *
+     * <p>This uses the same layout as {@link VirtualNetworkFrameBatchListener}.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param count Number of frames, at most {@link #MAX_BATCH}
+     * @param frameInfo 5 values per frame: network ID, source MAC, destination MAC, ethertype, VLAN ID
+     * @param extents 2 values per frame: offset in data and length
+     * @param data Direct buffer holding the frames
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processVirtualNetworkFrames(
+        long now,
+        int count,
+        long[] frameInfo,
+        int[] extents,
+        ByteBuffer data,
+        long[] nextBackgroundTaskDeadline) {
+        return processVirtualNetworkFrames(
+            nodeId, now, count, frameInfo, extents, data, nextBackgroundTaskDeadline);
+    }
+
+    /**
+     * Process a packet received from the physical wire held in a direct buffer
+     *
+     * <p>The packet is read in place from the buffer's position to its limit,
+     * without being copied. The buffer's position is not changed.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param remoteAddress Origin of packet
+     * @param packetData Direct buffer holding the packet
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processWirePacket(
+        long now,
+        long localSocket,
+        InetSocketAddress remoteAddress,
+        ByteBuffer packetData,
+        long[] nextBackgroundTaskDeadline) {
+        return processWirePacketDirect(
+            nodeId, now, localSocket, remoteAddress,
+            packetData, packetData.position(), packetData.remaining(),
+            nextBackgroundTaskDeadline);
+    }
+
+    /**
+     * Process several packets received from the physical wire held in one direct buffer
+     *
+     * <p>This uses the same layout as {@link PacketBatchSender}, with
+     * addresses and ports being those the packets came from.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param count Number of packets, at most {@link #MAX_BATCH}
+     * @param localSockets socket each packet was received on, or -1 if not specified
+     * @param addresses 16 bytes of origin IP per packet, IPv4 as IPv4-mapped IPv6 (::ffff:a.b.c.d)
+     * @param packetInfo 4 values per packet: offset in data, length, origin port, and a value that is ignored
+     * @param data Direct buffer holding the packets
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processWirePackets(
+        long now,
+        int count,
+        long[] localSockets,
+        byte[] addresses,
+        int[] packetInfo,
+        ByteBuffer data,
+        long[] nextBackgroundTaskDeadline) {
+        return processWirePackets(
+            nodeId, now, count, localSockets, addresses, packetInfo, data,
+            nextBackgroundTaskDeadline);
+    }
+
     /**
      * Perform periodic background operations
      *
@@ -431,6 +580,48 @@ public class Node {
         byte[] packetData,
         long[] nextBackgroundTaskDeadline);
 
+    private native ResultCode processVirtualNetworkFrameDirect(
+        long nodeId,
+        long now,
+        long nwid,
+        long sourceMac,
+        long destMac,
+        int etherType,
+        int vlanId,
+        ByteBuffer frameData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline);
+
+    private native ResultCode processVirtualNetworkFrames(
+        long nodeId,
+        long now,
+        int count,
+        long[] frameInfo,
+        int[] extents,
+        ByteBuffer data,
+        long[] nextBackgroundTaskDeadline);
+
+    private native ResultCode processWirePacketDirect(
+        long nodeId,
+        long now,
+        long localSocket,
+        InetSocketAddress remoteAddress,
+        ByteBuffer packetData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline);
+
+    private native ResultCode processWirePackets(
+        long nodeId,
+        long now,
+        int count,
+        long[] localSockets,
+        byte[] addresses,
+        int[] packetInfo,
+        ByteBuffer data,
+        long[] nextBackgroundTaskDeadline);
+
     private native ResultCode processBackgroundTasks(
         long nodeId,
         long now,
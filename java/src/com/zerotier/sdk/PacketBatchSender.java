@@ -0,0 +1,56 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+
+public interface PacketBatchSender {
+    /**
+     * Function to send a batch of ZeroTier packets out over the wire
+     *
+     * <p>When a {@link Node} has one of these, it is used instead of
+     * {@link PacketSender} and packets are handed over in batches once per
+     * call into the node instead of one callback per packet.</p>
+     *
+     * <p>The arrays and the direct buffer are reused for every batch, so
+     * their contents are only valid for the duration of the call.</p>
+     *
+     * @param count number of packets in this batch
+     * @param localSockets socket each packet is sent from, or -1 if not specified
+     * @param addresses 16 bytes of destination IP per packet, IPv4 as IPv4-mapped IPv6 (::ffff:a.b.c.d)
+     * @param packetInfo 4 values per packet: offset in data, length, destination port, TTL (0 for default)
+     * @param data direct buffer holding the packets
+     * @return 0 on success, any error code on failure.
+     */
+    public int onSendPackets(
+            int count,
+            long[] localSockets,
+            byte[] addresses,
+            int[] packetInfo,
+            ByteBuffer data);
+}
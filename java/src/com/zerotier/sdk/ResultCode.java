@@ -62,7 +62,12 @@ public enum ResultCode {
     /**
      * Network ID not valid
      */
-	RESULT_ERROR_NETWORK_NOT_FOUND(1000);
+	RESULT_ERROR_NETWORK_NOT_FOUND(1000),
+
+    /**
+     * A parameter was out of range or otherwise invalid
+     */
+	RESULT_ERROR_BAD_PARAMETER(1002);
 	
 	private final int id;
     ResultCode(int id) { this.id = id; }
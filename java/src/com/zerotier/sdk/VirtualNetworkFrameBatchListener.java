@@ -0,0 +1,52 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+public interface VirtualNetworkFrameBatchListener {
+    /**
+     * Function to send a batch of frames out to virtual network ports
+     *
+     * <p>When a {@link Node} has one of these, it is used instead of
+     * {@link VirtualNetworkFrameListener} and frames are handed over in
+     * batches once per call into the node instead of one callback per frame.</p>
+     *
+     * <p>The arrays and the direct buffer are reused for every batch, so
+     * their contents are only valid for the duration of the call.</p>
+     *
+     * @param count number of frames in this batch
+     * @param frameInfo 5 values per frame: network ID, source MAC, destination MAC, ethertype, VLAN ID
+     * @param extents 2 values per frame: offset in data and length
+     * @param data direct buffer holding the frames
+     */
+    public void onVirtualNetworkFrames(
+                int count,
+                long[] frameInfo,
+                int[] extents,
+                ByteBuffer data);
+}
@@ -7,6 +7,12 @@ LIBS=
 include objects.mk
 ONE_OBJS+=osdep/BSDEthernetTap.o ext/http-parser/http_parser.o
 
+# netmap for UDP on a physical device and for taps (used only if enabled in local.conf)
+ifneq ($(wildcard /usr/include/net/netmap_user.h),)
+	DEFS+=-DZT_USE_NETMAP
+	ONE_OBJS+=osdep/BSDNetmapReceiver.o
+endif
+
 # "make debug" is a shortcut for this
 ifeq ($(ZT_DEBUG),1)
 	CFLAGS+=-Wall -Werror -g -pthread $(INCLUDES) $(DEFS)
@@ -27,6 +33,17 @@ ifeq ($(ZT_TRACE),1)
 	DEFS+=-DZT_TRACE
 endif
 
+# Remove per-stage packet path timing (e.g. for embedded builds)
+ifeq ($(ZT_NO_LATENCY),1)
+	DEFS+=-DZT_NO_LATENCY
+endif
+
+# Build with ZT_USDT=1 for DTrace probes (see node/Probes.hpp)
+ifeq ($(ZT_USDT),1)
+	DEFS+=-DZT_USDT -DZT_USDT_DTRACE_H
+	USDT_OBJS=node/ZeroTierProbes.o
+endif
+
 # Determine system build architecture from compiler target
 CC_MACH=$(shell $(CC) -dumpmachine | cut -d '-' -f 1)
 ZT_ARCHITECTURE=999
@@ -127,8 +144,8 @@ CXXFLAGS+=$(CFLAGS) -fno-rtti -std=c++11 #-D_GLIBCXX_USE_C99 -D_GLIBCXX_USE_C99_
 
 all:	one
 
-one:	$(CORE_OBJS) $(ONE_OBJS) one.o
-	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-one $(CORE_OBJS) $(ONE_OBJS) one.o $(LIBS)
+one:	$(CORE_OBJS) $(USDT_OBJS) $(ONE_OBJS) one.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-one $(CORE_OBJS) $(USDT_OBJS) $(ONE_OBJS) one.o $(LIBS)
 	$(STRIP) zerotier-one
 	ln -sf zerotier-one zerotier-idtool
 	ln -sf zerotier-one zerotier-cli
@@ -145,14 +162,20 @@ libzerotiercore.a:	$(CORE_OBJS)
 
 core: libzerotiercore.a
 
-selftest:	$(CORE_OBJS) $(ONE_OBJS) selftest.o
-	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-selftest selftest.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+selftest:	$(CORE_OBJS) $(USDT_OBJS) $(ONE_OBJS) selftest.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-selftest selftest.o $(CORE_OBJS) $(USDT_OBJS) $(ONE_OBJS) $(LIBS)
 	$(STRIP) zerotier-selftest
 
 zerotier-selftest: selftest
 
+bench:	$(CORE_OBJS) $(ONE_OBJS) bench.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-bench bench.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+	$(STRIP) zerotier-bench
+
+zerotier-bench: bench
+
 clean:
-	rm -rf *.a *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o build-* zerotier-one zerotier-idtool zerotier-selftest zerotier-cli $(ONE_OBJS) $(CORE_OBJS)
+	rm -rf *.a *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o build-* zerotier-one zerotier-idtool zerotier-selftest zerotier-bench zerotier-cli node/ZeroTierProbes.h $(ONE_OBJS) $(CORE_OBJS)
 
 debug:	FORCE
 	gmake -j 4 ZT_DEBUG=1
@@ -166,4 +189,14 @@ install:	one
 uninstall:	FORCE
 	rm -rf /usr/local/sbin/zerotier-one /usr/local/sbin/zerotier-cli /usr/local/bin/zerotier-idtool /var/db/zerotier-one/zerotier-one.port /var/db/zerotier-one/zerotier-one.pid /var/db/zerotier-one/iddb.d
 
+# Probes are generated into a header, and then dtrace -G makes an object with
+# the probe table from the objects using them (and patches their call sites)
+ifeq ($(ZT_USDT),1)
+$(CORE_OBJS): node/ZeroTierProbes.h
+node/ZeroTierProbes.h: node/ZeroTierProbes.d
+	dtrace -h -s node/ZeroTierProbes.d -o node/ZeroTierProbes.h
+node/ZeroTierProbes.o: $(CORE_OBJS)
+	dtrace -G -s node/ZeroTierProbes.d -o node/ZeroTierProbes.o $(CORE_OBJS)
+endif
+
 FORCE:
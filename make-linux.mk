@@ -34,6 +34,23 @@ else
 	DEFS+=-DZT_USE_SYSTEM_NATPMP
 endif
 
+# zstd as an optional higher-ratio frame compressor (used only on networks that ask for it)
+ifneq ($(wildcard /usr/include/zstd.h),)
+	DEFS+=-DZT_USE_ZSTD
+	LDLIBS+=-lzstd
+endif
+
+# io_uring for UDP receive and tap I/O (used only if enabled in local.conf and the kernel supports it)
+ifneq ($(wildcard /usr/include/linux/io_uring.h),)
+	DEFS+=-DZT_USE_IO_URING
+endif
+
+# AF_XDP receive for UDP on a physical device (used only if enabled in local.conf)
+ifneq ($(wildcard /usr/include/linux/if_xdp.h),)
+	DEFS+=-DZT_USE_AF_XDP
+	ONE_OBJS+=osdep/LinuxXdpReceiver.o
+endif
+
 # Use bundled http-parser since distribution versions are NOT API-stable or compatible!
 # Trying to use dynamically linked libhttp-parser causes tons of compatibility problems.
 ONE_OBJS+=ext/http-parser/http_parser.o
@@ -50,6 +67,11 @@ ifeq ($(ZT_TRACE),1)
 	DEFS+=-DZT_TRACE
 endif
 
+# Remove per-stage packet path timing (e.g. for embedded builds)
+ifeq ($(ZT_NO_LATENCY),1)
+	DEFS+=-DZT_NO_LATENCY
+endif
+
 ifeq ($(ZT_RULES_ENGINE_DEBUGGING),1)
 	DEFS+=-DZT_RULES_ENGINE_DEBUGGING
 endif
@@ -82,6 +104,16 @@ ifeq ($(ZT_USE_TEST_TAP),1)
 	override DEFS+=-DZT_USE_TEST_TAP
 endif
 
+# Build with ZT_USDT=1 for static tracing probes, which needs <sys/sdt.h> (see node/Probes.hpp)
+ifeq ($(ZT_USDT),1)
+	override DEFS+=-DZT_USDT
+endif
+
+# Build with ZT_USERSPACE_STACK=1 to give networks an in-process UDP-only stack instead of a tap (see osdep/UserspaceStack.hpp)
+ifeq ($(ZT_USERSPACE_STACK),1)
+	override DEFS+=-DZT_USE_USERSPACE_STACK
+endif
+
 # Uncomment for gprof profile build
 #CFLAGS=-Wall -g -pg -pthread $(INCLUDES) $(DEFS)
 #CXXFLAGS=-Wall -g -pg -pthread $(INCLUDES) $(DEFS)
@@ -238,18 +270,24 @@ libzerotiercore.a:	$(CORE_OBJS)
 core: libzerotiercore.a
 
 selftest:	$(CORE_OBJS) $(ONE_OBJS) selftest.o
-	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-selftest selftest.o $(CORE_OBJS) $(ONE_OBJS $(LDLIBS)
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-selftest selftest.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
 	$(STRIP) zerotier-selftest
 
 zerotier-selftest: selftest
 
+bench:	$(CORE_OBJS) $(ONE_OBJS) bench.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-bench bench.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
+	$(STRIP) zerotier-bench
+
+zerotier-bench: bench
+
 manpages:	FORCE
 	cd doc ; ./build.sh
 
 doc:	manpages
 
 clean: FORCE
-	rm -rf *.a *.so *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o ext/miniupnpc/*.o ext/libnatpmp/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-cli zerotier-selftest build-* ZeroTierOneInstaller-* *.deb *.rpm .depend debian/files debian/zerotier-one*.debhelper debian/zerotier-one.substvars debian/*.log debian/zerotier-one doc/node_modules
+	rm -rf *.a *.so *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o ext/miniupnpc/*.o ext/libnatpmp/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-cli zerotier-selftest zerotier-bench build-* ZeroTierOneInstaller-* *.deb *.rpm .depend debian/files debian/zerotier-one*.debhelper debian/zerotier-one.substvars debian/*.log debian/zerotier-one doc/node_modules
 
 distclean:	clean
 
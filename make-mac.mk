@@ -19,7 +19,15 @@ ZT_VERSION_BUILD=$(shell cat version.h | grep -F VERSION_BUILD | cut -d ' ' -f 3
 DEFS+=-DZT_BUILD_PLATFORM=$(ZT_BUILD_PLATFORM) -DZT_BUILD_ARCHITECTURE=$(ZT_BUILD_ARCHITECTURE)
 
 include objects.mk
-ONE_OBJS+=osdep/OSXEthernetTap.o ext/http-parser/http_parser.o
+ONE_OBJS+=ext/http-parser/http_parser.o
+
+# The feth-based tap needs no kext but is still experimental; build with ZT_MAC_FETH=1 to use it
+ifeq ($(ZT_MAC_FETH),1)
+	DEFS+=-DZT_MAC_FETH
+	ONE_OBJS+=osdep/MacEthernetTap.o
+else
+	ONE_OBJS+=osdep/OSXEthernetTap.o
+endif
 
 # Official releases are signed with our Apple cert and apply software updates by default
 ifeq ($(ZT_OFFICIAL_RELEASE),1)
@@ -59,6 +67,16 @@ ifeq ($(ZT_TRACE),1)
 	DEFS+=-DZT_TRACE
 endif
 
+# Remove per-stage packet path timing (e.g. for embedded builds)
+ifeq ($(ZT_NO_LATENCY),1)
+	DEFS+=-DZT_NO_LATENCY
+endif
+
+# Build with ZT_USDT=1 for DTrace probes (see node/Probes.hpp)
+ifeq ($(ZT_USDT),1)
+	DEFS+=-DZT_USDT -DZT_USDT_DTRACE_H
+endif
+
 CXXFLAGS=$(CFLAGS) -std=c++11 -stdlib=libc++ 
 
 all: one macui
@@ -99,6 +117,12 @@ selftest: $(CORE_OBJS) $(ONE_OBJS) selftest.o
 
 zerotier-selftest: selftest
 
+bench: $(CORE_OBJS) $(ONE_OBJS) bench.o
+	$(CXX) $(CXXFLAGS) -o zerotier-bench bench.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+	$(STRIP) zerotier-bench
+
+zerotier-bench: bench
+
 # Requires Packages: http://s.sudre.free.fr/Software/Packages/about.html
 mac-dist-pkg: FORCE
 	packagesbuild "ext/installfiles/mac/ZeroTier One.pkgproj"
@@ -116,7 +140,7 @@ official: FORCE
 	make ZT_OFFICIAL_RELEASE=1 mac-dist-pkg
 
 clean:
-	rm -rf *.dSYM build-* *.a *.pkg *.dmg *.o node/*.o controller/*.o service/*.o osdep/*.o ext/http-parser/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-selftest zerotier-cli zerotier doc/node_modules macui/build zt1_update_$(ZT_BUILD_PLATFORM)_$(ZT_BUILD_ARCHITECTURE)_*
+	rm -rf *.dSYM build-* *.a *.pkg *.dmg *.o node/*.o controller/*.o service/*.o osdep/*.o ext/http-parser/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-selftest zerotier-bench zerotier-cli zerotier node/ZeroTierProbes.h doc/node_modules macui/build zt1_update_$(ZT_BUILD_PLATFORM)_$(ZT_BUILD_ARCHITECTURE)_*
 
 distclean:	clean
 
@@ -129,4 +153,10 @@ install-mac-tap: FORCE
 	cp -R ext/bin/tap-mac/tap.kext /Library/Application\ Support/ZeroTier/One
 	chown -R root:wheel /Library/Application\ Support/ZeroTier/One/tap.kext
 
+ifeq ($(ZT_USDT),1)
+$(CORE_OBJS): node/ZeroTierProbes.h
+node/ZeroTierProbes.h: node/ZeroTierProbes.d
+	dtrace -h -s node/ZeroTierProbes.d -o node/ZeroTierProbes.h
+endif
+
 FORCE:
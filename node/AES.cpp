@@ -0,0 +1,310 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <string.h>
+
+#include "Constants.hpp"
+#include "AES.hpp"
+#include "Utils.hpp"
+
+// AES-NI and PCLMULQDQ code is built with per-function target attributes so
+// the rest of the code still runs on any x86-64 CPU
+#if (!defined(ZT_AES_NO_AESNI)) && (defined(__GNUC__) || defined(__clang__)) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__))
+#define ZT_AES_AESNI 1
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+namespace ZeroTier {
+
+#ifdef ZT_AES_AESNI
+
+static bool _aesDetectAccelerated()
+{
+	__builtin_cpu_init();
+	return ((__builtin_cpu_supports("aes"))&&(__builtin_cpu_supports("pclmul"))&&(__builtin_cpu_supports("ssse3")));
+}
+static const bool _aesAccelerated = _aesDetectAccelerated();
+
+#define ZT_AES_TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+// Key expansion steps from Intel's AES-NI white paper
+ZT_AES_TARGET static inline __m128i _aesExpandEven(__m128i k,__m128i t)
+{
+	t = _mm_shuffle_epi32(t,0xff);
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	return _mm_xor_si128(k,t);
+}
+ZT_AES_TARGET static inline __m128i _aesExpandOdd(__m128i k,__m128i t)
+{
+	t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(t,0x00),0xaa);
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	return _mm_xor_si128(k,t);
+}
+
+ZT_AES_TARGET static inline __m128i _aesEncryptBlock(__m128i x,const __m128i *k)
+{
+	x = _mm_xor_si128(x,_mm_loadu_si128(k));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 1));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 2));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 3));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 4));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 5));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 6));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 7));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 8));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 9));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 10));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 11));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 12));
+	x = _mm_aesenc_si128(x,_mm_loadu_si128(k + 13));
+	return _mm_aesenclast_si128(x,_mm_loadu_si128(k + 14));
+}
+
+ZT_AES_TARGET static void _aesEncryptBlockOut(const void *in,void *out,const uint64_t *k64)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),_aesEncryptBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)),reinterpret_cast<const __m128i *>(k64)));
+}
+
+ZT_AES_TARGET static void _aesDecryptBlockOut(const void *in,void *out,const uint64_t *d64)
+{
+	const __m128i *const d = reinterpret_cast<const __m128i *>(d64);
+	__m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)),_mm_loadu_si128(d));
+	for(unsigned int r=1;r<14;++r)
+		x = _mm_aesdec_si128(x,_mm_loadu_si128(d + r));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),_mm_aesdeclast_si128(x,_mm_loadu_si128(d + 14)));
+}
+
+ZT_AES_TARGET static void _aesInit(const void *key,uint64_t *k64,uint64_t *d64,uint64_t *h64)
+{
+	__m128i *const k = reinterpret_cast<__m128i *>(k64);
+	__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+	__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key) + 1);
+	_mm_storeu_si128(k,a);
+	_mm_storeu_si128(k + 1,b);
+#define ZT_AES_EXPAND_STEP(n,rcon) \
+	a = _aesExpandEven(a,_mm_aeskeygenassist_si128(b,rcon)); _mm_storeu_si128(k + n,a); \
+	b = _aesExpandOdd(b,a); _mm_storeu_si128(k + n + 1,b);
+	ZT_AES_EXPAND_STEP(2,0x01)
+	ZT_AES_EXPAND_STEP(4,0x02)
+	ZT_AES_EXPAND_STEP(6,0x04)
+	ZT_AES_EXPAND_STEP(8,0x08)
+	ZT_AES_EXPAND_STEP(10,0x10)
+	ZT_AES_EXPAND_STEP(12,0x20)
+#undef ZT_AES_EXPAND_STEP
+	a = _aesExpandEven(a,_mm_aeskeygenassist_si128(b,0x40));
+	_mm_storeu_si128(k + 14,a);
+
+	// Decryption round keys for the equivalent inverse cipher
+	__m128i *const d = reinterpret_cast<__m128i *>(d64);
+	_mm_storeu_si128(d,_mm_loadu_si128(k + 14));
+	for(unsigned int r=1;r<14;++r)
+		_mm_storeu_si128(d + r,_mm_aesimc_si128(_mm_loadu_si128(k + (14 - r))));
+	_mm_storeu_si128(d + 14,_mm_loadu_si128(k));
+
+	// H = E(0), byte reversed for the GHASH multiply below
+	const __m128i h = _aesEncryptBlock(_mm_setzero_si128(),k);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(h64),_mm_shuffle_epi8(h,_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15)));
+}
+
+// GF(2^128) multiply of byte reversed operands, from Intel's carry-less
+// multiplication white paper (algorithm 5: shift, then reduce)
+ZT_AES_TARGET static inline __m128i _aesGfmul(const __m128i a,const __m128i b)
+{
+	__m128i t3 = _mm_clmulepi64_si128(a,b,0x00);
+	__m128i t4 = _mm_clmulepi64_si128(a,b,0x10);
+	__m128i t5 = _mm_clmulepi64_si128(a,b,0x01);
+	__m128i t6 = _mm_clmulepi64_si128(a,b,0x11);
+	t4 = _mm_xor_si128(t4,t5);
+	t5 = _mm_slli_si128(t4,8);
+	t4 = _mm_srli_si128(t4,8);
+	t3 = _mm_xor_si128(t3,t5);
+	t6 = _mm_xor_si128(t6,t4);
+	__m128i t7 = _mm_srli_epi32(t3,31);
+	__m128i t8 = _mm_srli_epi32(t6,31);
+	t3 = _mm_slli_epi32(t3,1);
+	t6 = _mm_slli_epi32(t6,1);
+	__m128i t9 = _mm_srli_si128(t7,12);
+	t8 = _mm_slli_si128(t8,4);
+	t7 = _mm_slli_si128(t7,4);
+	t3 = _mm_or_si128(t3,t7);
+	t6 = _mm_or_si128(t6,t8);
+	t6 = _mm_or_si128(t6,t9);
+	t7 = _mm_slli_epi32(t3,31);
+	t8 = _mm_slli_epi32(t3,30);
+	t9 = _mm_slli_epi32(t3,25);
+	t7 = _mm_xor_si128(t7,t8);
+	t7 = _mm_xor_si128(t7,t9);
+	t8 = _mm_srli_si128(t7,4);
+	t7 = _mm_slli_si128(t7,12);
+	t3 = _mm_xor_si128(t3,t7);
+	__m128i t2 = _mm_srli_epi32(t3,1);
+	t4 = _mm_srli_epi32(t3,2);
+	t5 = _mm_srli_epi32(t3,7);
+	t2 = _mm_xor_si128(t2,t4);
+	t2 = _mm_xor_si128(t2,t5);
+	t2 = _mm_xor_si128(t2,t8);
+	t3 = _mm_xor_si128(t3,t2);
+	return _mm_xor_si128(t6,t3);
+}
+
+// Absorb data into the GHASH state y, zero padding the last partial block
+ZT_AES_TARGET static inline __m128i _aesGhash(__m128i y,const __m128i h,const uint8_t *in,unsigned int len)
+{
+	const __m128i swap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+	while (len >= 16) {
+		y = _aesGfmul(_mm_xor_si128(y,_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)),swap)),h);
+		in += 16;
+		len -= 16;
+	}
+	if (len) {
+		uint8_t last[16];
+		memset(last,0,sizeof(last));
+		memcpy(last,in,len);
+		y = _aesGfmul(_mm_xor_si128(y,_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last)),swap)),h);
+	}
+	return y;
+}
+
+ZT_AES_TARGET static void _aesGmac(const uint64_t *k64,const uint64_t *h64,const void *iv,const void *aad,unsigned int aadLen,const void *msg,unsigned int msgLen,void *tag)
+{
+	const __m128i *const k = reinterpret_cast<const __m128i *>(k64);
+	const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h64));
+
+	__m128i y = _aesGhash(_mm_setzero_si128(),h,reinterpret_cast<const uint8_t *>(aad),aadLen);
+	y = _aesGhash(y,h,reinterpret_cast<const uint8_t *>(msg),msgLen);
+	// Length block is [64-bit aad bits][64-bit msg bits] big-endian, which byte reversed is just this
+	y = _aesGfmul(_mm_xor_si128(y,_mm_set_epi64x((long long)((uint64_t)aadLen << 3),(long long)((uint64_t)msgLen << 3))),h);
+
+	uint8_t j0[16];
+	memcpy(j0,iv,12);
+	j0[12] = 0; j0[13] = 0; j0[14] = 0; j0[15] = 1;
+	const __m128i ej0 = _aesEncryptBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(j0)),k);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(tag),_mm_xor_si128(_mm_shuffle_epi8(y,_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15)),ej0));
+}
+
+ZT_AES_TARGET static void _aesCtr(const uint64_t *k64,const void *iv,const uint8_t *in,unsigned int len,uint8_t *out)
+{
+	const __m128i *const k = reinterpret_cast<const __m128i *>(k64);
+	const __m128i k0 = _mm_loadu_si128(k);
+	const __m128i k14 = _mm_loadu_si128(k + 14);
+
+	uint32_t ivw[4];
+	memcpy(ivw,iv,16);
+	uint32_t c = Utils::ntoh(ivw[3]);
+
+	// Four blocks at a time so the AES pipeline stays full
+	while (len >= 64) {
+		__m128i b0 = _mm_xor_si128(_mm_set_epi32((int)Utils::hton(c),(int)ivw[2],(int)ivw[1],(int)ivw[0]),k0);
+		__m128i b1 = _mm_xor_si128(_mm_set_epi32((int)Utils::hton((uint32_t)(c + 1)),(int)ivw[2],(int)ivw[1],(int)ivw[0]),k0);
+		__m128i b2 = _mm_xor_si128(_mm_set_epi32((int)Utils::hton((uint32_t)(c + 2)),(int)ivw[2],(int)ivw[1],(int)ivw[0]),k0);
+		__m128i b3 = _mm_xor_si128(_mm_set_epi32((int)Utils::hton((uint32_t)(c + 3)),(int)ivw[2],(int)ivw[1],(int)ivw[0]),k0);
+		c += 4;
+		for(int r=1;r<14;++r) {
+			const __m128i kr = _mm_loadu_si128(k + r);
+			b0 = _mm_aesenc_si128(b0,kr);
+			b1 = _mm_aesenc_si128(b1,kr);
+			b2 = _mm_aesenc_si128(b2,kr);
+			b3 = _mm_aesenc_si128(b3,kr);
+		}
+		const __m128i *const i = reinterpret_cast<const __m128i *>(in);
+		__m128i *const o = reinterpret_cast<__m128i *>(out);
+		_mm_storeu_si128(o,_mm_xor_si128(_mm_aesenclast_si128(b0,k14),_mm_loadu_si128(i)));
+		_mm_storeu_si128(o + 1,_mm_xor_si128(_mm_aesenclast_si128(b1,k14),_mm_loadu_si128(i + 1)));
+		_mm_storeu_si128(o + 2,_mm_xor_si128(_mm_aesenclast_si128(b2,k14),_mm_loadu_si128(i + 2)));
+		_mm_storeu_si128(o + 3,_mm_xor_si128(_mm_aesenclast_si128(b3,k14),_mm_loadu_si128(i + 3)));
+		in += 64;
+		out += 64;
+		len -= 64;
+	}
+
+	while (len) {
+		uint8_t ks[16];
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(ks),_aesEncryptBlock(_mm_set_epi32((int)Utils::hton(c++),(int)ivw[2],(int)ivw[1],(int)ivw[0]),k));
+		const unsigned int n = (len < 16) ? len : 16;
+		for(unsigned int j=0;j<n;++j)
+			out[j] = in[j] ^ ks[j];
+		in += n;
+		out += n;
+		len -= n;
+	}
+}
+
+bool AES::accelerated() { return _aesAccelerated; }
+
+void AES::init(const void *key)
+{
+	if (_aesAccelerated)
+		_aesInit(key,_k,_d,_h);
+}
+
+void AES::encrypt(const void *in,void *out) const
+{
+	if (_aesAccelerated)
+		_aesEncryptBlockOut(in,out,_k);
+}
+
+void AES::decrypt(const void *in,void *out) const
+{
+	if (_aesAccelerated)
+		_aesDecryptBlockOut(in,out,_d);
+}
+
+void AES::gmac(const void *iv,const void *aad,unsigned int aadLen,const void *msg,unsigned int msgLen,void *tag) const
+{
+	if (_aesAccelerated)
+		_aesGmac(_k,_h,iv,aad,aadLen,msg,msgLen,tag);
+}
+
+void AES::ctr(const void *iv,const void *in,unsigned int len,void *out) const
+{
+	if (_aesAccelerated)
+		_aesCtr(_k,iv,reinterpret_cast<const uint8_t *>(in),len,reinterpret_cast<uint8_t *>(out));
+}
+
+#else // no AES-NI in this build
+
+bool AES::accelerated() { return false; }
+void AES::init(const void *key) {}
+void AES::encrypt(const void *in,void *out) const {}
+void AES::decrypt(const void *in,void *out) const {}
+void AES::gmac(const void *iv,const void *aad,unsigned int aadLen,const void *msg,unsigned int msgLen,void *tag) const {}
+void AES::ctr(const void *iv,const void *in,unsigned int len,void *out) const {}
+
+#endif
+
+AES::~AES()
+{
+	Utils::burn(_k,sizeof(_k));
+	Utils::burn(_d,sizeof(_d));
+	Utils::burn(_h,sizeof(_h));
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,123 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_AES_HPP
+#define ZT_AES_HPP
+
+#include <stdint.h>
+
+namespace ZeroTier {
+
+#define ZT_AES_KEY_SIZE 32
+#define ZT_AES_BLOCK_SIZE 16
+
+/**
+ * AES-256 block cipher with GMAC and CTR mode
+ *
+ * This is only implemented using the AES-NI and PCLMULQDQ instructions on
+ * x86 CPUs. There is deliberately no software fallback since a table based
+ * AES is slower than Salsa20/12 and leaks timing. Callers must check
+ * accelerated() and use the Salsa20/12 cipher suite if it returns false.
+ * All other methods do nothing if it isn't.
+ *
+ * On ARM, including ARMv8 CPUs with the crypto extensions, accelerated() is
+ * always false for now. Those nodes never advertise
+ * ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV, so peers keep using Salsa20/12
+ * with them rather than anything slower.
+ */
+class AES
+{
+public:
+	/**
+	 * @return True if this build and CPU have hardware AES and carry-less multiply
+	 */
+	static bool accelerated();
+
+	AES() {}
+	AES(const void *key) { init(key); }
+	~AES();
+
+	/**
+	 * Expand a key for encryption and decryption and compute the GHASH key for GMAC
+	 *
+	 * @param key 256-bit key
+	 */
+	void init(const void *key);
+
+	/**
+	 * Encrypt a single block
+	 *
+	 * @param in 16-byte input block
+	 * @param out 16-byte output block (may be the same as in)
+	 */
+	void encrypt(const void *in,void *out) const;
+
+	/**
+	 * Decrypt a single block
+	 *
+	 * @param in 16-byte input block
+	 * @param out 16-byte output block (may be the same as in)
+	 */
+	void decrypt(const void *in,void *out) const;
+
+	/**
+	 * Compute a GMAC over additional data and a message
+	 *
+	 * This is the GCM authentication tag computed over aad and msg as if msg
+	 * were GCM ciphertext, so it matches AES-GCM test vectors when msg is the
+	 * ciphertext from them. For plain GMAC msgLen is zero.
+	 *
+	 * @param iv 96-bit IV
+	 * @param aad Additional data
+	 * @param aadLen Length of additional data in bytes
+	 * @param msg Message
+	 * @param msgLen Length of message in bytes
+	 * @param tag Buffer to receive 16-byte tag
+	 */
+	void gmac(const void *iv,const void *aad,unsigned int aadLen,const void *msg,unsigned int msgLen,void *tag) const;
+
+	/**
+	 * Encrypt or decrypt in CTR mode
+	 *
+	 * The last four bytes of the counter block are a big-endian counter that
+	 * is incremented for each block and wraps as in GCM.
+	 *
+	 * @param iv 16-byte initial counter block
+	 * @param in Input data
+	 * @param len Length of data in bytes
+	 * @param out Output buffer (may be the same as in)
+	 */
+	void ctr(const void *iv,const void *in,unsigned int len,void *out) const;
+
+private:
+	uint64_t _k[30]; // 15 round keys
+	uint64_t _d[30]; // 15 decryption round keys
+	uint64_t _h[2]; // byte reversed GHASH key
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -65,6 +65,18 @@ public:
 #endif
 	}
 
+	/**
+	 * @return Current value, ordered after any writes preceding the increment that produced it
+	 */
+	inline int load() const
+	{
+#ifdef __GNUC__
+		return __atomic_load_n(&_v,__ATOMIC_ACQUIRE);
+#else
+		return _v.load();
+#endif
+	}
+
 private:
 #ifdef __GNUC__
 	int _v;
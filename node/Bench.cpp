@@ -0,0 +1,343 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <algorithm>
+
+#include "Bench.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Node.hpp"
+#include "Peer.hpp"
+#include "Path.hpp"
+#include "Packet.hpp"
+#include "Topology.hpp"
+#include "Switch.hpp"
+#include "Latency.hpp"
+
+namespace ZeroTier {
+
+Bench::Bench(const RuntimeEnvironment *renv) :
+	RR(renv),
+	_state(BENCH_IDLE),
+	_session(0),
+	_direct(false),
+	_answered(false),
+	_duration(0),
+	_bitsPerSecond(0),
+	_packetSize(0),
+	_start(0),
+	_lastData(0),
+	_lastPing(0),
+	_lastResultRequest(0),
+	_seq(0),
+	_packetsSent(0),
+	_bytesSent(0),
+	_armorTime(0),
+	_wireTime(0),
+	_packetsReceived(0),
+	_bytesReceived(0),
+	_receiveTime(0),
+	_pingsSent(0),
+	_rxSession(0),
+	_rxPackets(0),
+	_rxBytes(0),
+	_rxFirst(0),
+	_rxLast(0)
+{
+}
+
+bool Bench::start(void *tPtr,const Address &peer,unsigned int duration,uint64_t bitsPerSecond)
+{
+	const uint64_t now = RR->node->now();
+	const SharedPtr<Peer> p(RR->topology->getPeer(tPtr,peer));
+	if (!p)
+		return false;
+
+	// Same choice of path as Switch makes, short of trying to wake a dead one
+	bool direct = true;
+	SharedPtr<Path> path(p->getBestPath(now,false));
+	if ((!path)||(!path->alive(now))) {
+		direct = false;
+		const SharedPtr<Peer> relay(RR->topology->getUpstreamPeer());
+		if ((!relay)||(relay == p)||(!(path = relay->getBestPath(now,false))))
+			return false;
+	}
+
+	Mutex::Lock _l(_lock);
+	if ((_state == BENCH_SENDING)||(_state == BENCH_WAITING))
+		return false;
+	_state = BENCH_SENDING;
+	_peer = p;
+	_path = path;
+	_session = RR->node->prng();
+	_direct = direct;
+	_answered = false;
+	_duration = std::min(duration,(unsigned int)ZT_BENCH_MAX_DURATION);
+	_bitsPerSecond = bitsPerSecond;
+	// Fill a datagram without fragmenting, which is the best a path can do
+	_packetSize = std::max(std::min(path->mtu(),(unsigned int)ZT_PROTO_MAX_PACKET_LENGTH),(unsigned int)(ZT_PROTO_VERB_BENCH_IDX_RESULT + 16));
+	_start = Latency::nanoseconds();
+	_lastData = _start;
+	_lastPing = 0;
+	_lastResultRequest = 0;
+	_seq = 0;
+	_packetsSent = 0;
+	_bytesSent = 0;
+	_armorTime = 0;
+	_wireTime = 0;
+	_packetsReceived = 0;
+	_bytesReceived = 0;
+	_receiveTime = 0;
+	_pingsSent = 0;
+	_rtts.clear();
+	_rtts.reserve(ZT_BENCH_MAX_RTT_SAMPLES);
+	return true;
+}
+
+int Bench::step(void *tPtr)
+{
+	SharedPtr<Peer> peer;
+	SharedPtr<Path> path;
+	uint64_t session,seq = 0;
+	unsigned int n = 0,packetSize;
+	bool ping = false,resultRequest = false;
+	int wait = 0;
+
+	{
+		Mutex::Lock _l(_lock);
+		const uint64_t now = Latency::nanoseconds();
+
+		if ((_state == BENCH_SENDING)&&((now - _start) >= ((uint64_t)_duration * 1000000ULL))) {
+			_state = BENCH_WAITING;
+			_lastResultRequest = 0;
+		}
+
+		if (_state == BENCH_SENDING) {
+			n = ZT_BENCH_BURST;
+			if (_bitsPerSecond) {
+				const uint64_t allowed = (uint64_t)(((double)_bitsPerSecond / 8.0) * ((double)(now - _start) / 1000000000.0));
+				n = (allowed > _bytesSent) ? (unsigned int)std::min((allowed - _bytesSent) / (uint64_t)_packetSize,(uint64_t)ZT_BENCH_BURST) : 0;
+				if (!n)
+					wait = 1;
+			}
+			if ((now - _lastPing) >= ((uint64_t)ZT_BENCH_PING_INTERVAL * 1000000ULL)) {
+				_lastPing = now;
+				++_pingsSent;
+				ping = true;
+			}
+			seq = _seq;
+			_seq += n;
+		} else if (_state == BENCH_WAITING) {
+			const uint64_t since = now - _lastData;
+			if ((_answered)||(since >= ((uint64_t)ZT_BENCH_RESULT_TIMEOUT * 1000000ULL))) {
+				_state = BENCH_DONE;
+				return -1;
+			}
+			if ((since >= ((uint64_t)ZT_BENCH_DRAIN_TIME * 1000000ULL))&&((now - _lastResultRequest) >= ((uint64_t)ZT_BENCH_RESULT_RETRY * 1000000ULL))) {
+				_lastResultRequest = now;
+				resultRequest = true;
+			}
+			wait = 10;
+		} else {
+			return -1;
+		}
+
+		peer = _peer;
+		path = _path;
+		session = _session;
+		packetSize = _packetSize;
+	}
+
+	uint64_t armorTime = 0,wireTime = 0,sent = 0,sentBytes = 0;
+
+	if ((ping)||(resultRequest)) {
+		Packet outp(peer->address(),RR->identity.address(),Packet::VERB_BENCH);
+		outp.append((uint8_t)((ping) ? ZT_PROTO_VERB_BENCH_TYPE_PING : ZT_PROTO_VERB_BENCH_TYPE_RESULT_REQUEST));
+		outp.append(session);
+		outp.append((uint64_t)Latency::nanoseconds());
+		uint64_t a = 0,w = 0;
+		_send(tPtr,peer,path,outp,a,w);
+	}
+
+	if (n) {
+		Packet tmpl(peer->address(),RR->identity.address(),Packet::VERB_BENCH);
+		tmpl.append((uint8_t)ZT_PROTO_VERB_BENCH_TYPE_DATA);
+		tmpl.append(session);
+		tmpl.append((uint64_t)0);
+		tmpl.append((unsigned char)0,packetSize - tmpl.size());
+		for(unsigned int i=0;i<n;++i) {
+			Packet outp(tmpl);
+			outp.newInitializationVector();
+			outp.setAt<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_VALUE,seq + i);
+			if (_send(tPtr,peer,path,outp,armorTime,wireTime)) {
+				++sent;
+				sentBytes += outp.size();
+			}
+		}
+	}
+
+	if (n) {
+		Mutex::Lock _l(_lock);
+		if (_session == session) {
+			_packetsSent += sent;
+			_bytesSent += sentBytes;
+			_armorTime += armorTime;
+			_wireTime += wireTime;
+			_lastData = Latency::nanoseconds();
+		}
+	}
+
+	return wait;
+}
+
+void Bench::stop()
+{
+	Mutex::Lock _l(_lock);
+	if ((_state == BENCH_SENDING)||(_state == BENCH_WAITING))
+		_state = BENCH_DONE;
+}
+
+void Bench::result(Result &r) const
+{
+	std::vector<uint64_t> rtts;
+	{
+		Mutex::Lock _l(_lock);
+		r.peer = (_peer) ? _peer->address().toInt() : 0;
+		r.running = ((_state == BENCH_SENDING)||(_state == BENCH_WAITING));
+		r.path = (_path) ? _path->address() : InetAddress();
+		r.direct = _direct;
+		r.answered = _answered;
+		r.duration = _duration;
+		r.packetSize = _packetSize;
+		r.packetsSent = _packetsSent;
+		r.bytesSent = _bytesSent;
+		r.sendTime = _lastData - _start;
+		r.armorTime = _armorTime;
+		r.wireTime = _wireTime;
+		r.packetsReceived = _packetsReceived;
+		r.bytesReceived = _bytesReceived;
+		r.receiveTime = _receiveTime;
+		r.pingsSent = _pingsSent;
+		r.pongsReceived = (unsigned int)_rtts.size();
+		rtts = _rtts;
+	}
+
+	std::sort(rtts.begin(),rtts.end());
+	if (rtts.empty()) {
+		r.rttMin = r.rttP50 = r.rttP90 = r.rttP99 = r.rttMax = 0;
+	} else {
+		const unsigned long c = (unsigned long)rtts.size();
+		r.rttMin = rtts.front();
+		r.rttP50 = rtts[(c * 50) / 100];
+		r.rttP90 = rtts[(c * 90) / 100];
+		r.rttP99 = rtts[(c * 99) / 100];
+		r.rttMax = rtts.back();
+	}
+}
+
+void Bench::received(void *tPtr,const SharedPtr<Peer> &peer,const Packet &pkt)
+{
+	if (pkt.size() < ZT_PROTO_VERB_BENCH_IDX_RESULT)
+		return;
+	const unsigned int type = (unsigned int)((uint8_t)pkt[ZT_PROTO_VERB_BENCH_IDX_TYPE]);
+	const uint64_t session = pkt.at<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_SESSION);
+	const uint64_t value = pkt.at<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_VALUE);
+	const uint64_t now = Latency::nanoseconds();
+
+	switch(type) {
+
+		case ZT_PROTO_VERB_BENCH_TYPE_DATA: {
+			Mutex::Lock _l(_lock);
+			if ((_rxSession != session)||(_rxPeer != peer->address())) {
+				_rxPeer = peer->address();
+				_rxSession = session;
+				_rxPackets = 0;
+				_rxBytes = 0;
+				_rxFirst = now;
+			}
+			++_rxPackets;
+			_rxBytes += pkt.size();
+			_rxLast = now;
+		}	break;
+
+		case ZT_PROTO_VERB_BENCH_TYPE_PING:
+		case ZT_PROTO_VERB_BENCH_TYPE_RESULT_REQUEST: {
+			Packet outp(peer->address(),RR->identity.address(),Packet::VERB_BENCH);
+			if (type == ZT_PROTO_VERB_BENCH_TYPE_PING) {
+				outp.append((uint8_t)ZT_PROTO_VERB_BENCH_TYPE_PONG);
+				outp.append(session);
+				outp.append(value);
+			} else {
+				outp.append((uint8_t)ZT_PROTO_VERB_BENCH_TYPE_RESULT);
+				outp.append(session);
+				outp.append((uint64_t)0);
+				Mutex::Lock _l(_lock);
+				const bool known = ((_rxSession == session)&&(_rxPeer == peer->address()));
+				outp.append((uint64_t)((known) ? _rxPackets : 0));
+				outp.append((uint64_t)((known) ? _rxBytes : 0));
+				outp.append((uint64_t)((known) ? (_rxLast - _rxFirst) : 0));
+			}
+			RR->sw->send(tPtr,outp,true);
+		}	break;
+
+		case ZT_PROTO_VERB_BENCH_TYPE_PONG: {
+			Mutex::Lock _l(_lock);
+			if ((_session == session)&&(_peer)&&(_peer->address() == peer->address())&&(value <= now)&&(_rtts.size() < ZT_BENCH_MAX_RTT_SAMPLES))
+				_rtts.push_back(now - value);
+		}	break;
+
+		case ZT_PROTO_VERB_BENCH_TYPE_RESULT:
+			if (pkt.size() >= (ZT_PROTO_VERB_BENCH_IDX_RESULT + 24)) {
+				Mutex::Lock _l(_lock);
+				if ((_session == session)&&(_state == BENCH_WAITING)&&(_peer)&&(_peer->address() == peer->address())) {
+					_packetsReceived = pkt.at<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_RESULT);
+					_bytesReceived = pkt.at<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_RESULT + 8);
+					_receiveTime = pkt.at<uint64_t>(ZT_PROTO_VERB_BENCH_IDX_RESULT + 16);
+					_answered = true;
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+bool Bench::_send(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,Packet &pkt,uint64_t &armorTime,uint64_t &wireTime)
+{
+	const uint64_t t0 = Latency::nanoseconds();
+	const unsigned int counter = path->nextOutgoingCounter();
+	if (peer->aesGmacSivEnabled())
+		pkt.armorAesGmacSiv(peer->aesKeys(),counter);
+	else pkt.armor(peer->key(),true,counter,peer->keySchedule());
+	const uint64_t t1 = Latency::nanoseconds();
+	const bool ok = path->send(RR,tPtr,pkt.data(),pkt.size(),RR->node->now());
+	const uint64_t t2 = Latency::nanoseconds();
+	armorTime += t1 - t0;
+	wireTime += t2 - t1;
+	return ok;
+}
+
+} // namespace ZeroTier
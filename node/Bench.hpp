@@ -0,0 +1,211 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BENCH_HPP
+#define ZT_BENCH_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+#include "SharedPtr.hpp"
+#include "Mutex.hpp"
+
+/**
+ * Longest test allowed in milliseconds
+ */
+#define ZT_BENCH_MAX_DURATION 60000
+
+/**
+ * Interval between PINGs during a test in milliseconds
+ */
+#define ZT_BENCH_PING_INTERVAL 20
+
+/**
+ * Round trip times kept per test (later ones are not sampled)
+ */
+#define ZT_BENCH_MAX_RTT_SAMPLES 4096
+
+/**
+ * Most DATA packets sent per call to step()
+ */
+#define ZT_BENCH_BURST 32
+
+/**
+ * Time after the last DATA before asking for a RESULT, so stragglers arrive
+ */
+#define ZT_BENCH_DRAIN_TIME 250
+
+/**
+ * Interval between RESULT_REQUESTs while waiting
+ */
+#define ZT_BENCH_RESULT_RETRY 500
+
+/**
+ * Time after the last DATA to give up waiting for a RESULT
+ */
+#define ZT_BENCH_RESULT_TIMEOUT 3000
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class Peer;
+class Path;
+class Packet;
+
+/**
+ * Peer to peer throughput, round trip time and loss test (VERB_BENCH)
+ *
+ * This answers "is it the overlay or the underlay" without iperf on both
+ * ends. DATA packets are built, armored and handed to the wire send
+ * function directly on the peer's current best path (or the upstream
+ * relay's if there is no direct one), so no tap, rules or queues are
+ * involved. Time spent in armor() and in the send function is measured
+ * separately. PINGs mixed in give the round trip time distribution under
+ * load, and the peer's RESULT gives what actually arrived and over what
+ * time, from which throughput and loss follow.
+ *
+ * A test is started with start() and then driven by calling step() from
+ * one thread until it returns a negative value. Any node also answers
+ * tests run by its peers, keeping counts for one incoming session at a time.
+ */
+class Bench : NonCopyable
+{
+public:
+	struct Result
+	{
+		uint64_t peer;
+		InetAddress path;         // physical path DATA was sent on
+		bool running;
+		bool direct;              // false if sent via an upstream relay
+		bool answered;            // peer sent a RESULT (false if it never did)
+		unsigned int duration;    // requested duration in ms
+		unsigned int packetSize;  // size of each DATA packet on the wire
+		uint64_t packetsSent;
+		uint64_t bytesSent;
+		uint64_t sendTime;        // ns from first to last DATA sent
+		uint64_t armorTime;       // ns spent in armor() for DATA
+		uint64_t wireTime;        // ns spent in the wire send function for DATA
+		uint64_t packetsReceived; // by the peer
+		uint64_t bytesReceived;   // by the peer
+		uint64_t receiveTime;     // ns from first to last DATA received by the peer
+		unsigned int pingsSent;
+		unsigned int pongsReceived;
+		uint64_t rttMin;          // ns, and 0 if no PONGs were received
+		uint64_t rttP50;
+		uint64_t rttP90;
+		uint64_t rttP99;
+		uint64_t rttMax;
+	};
+
+	Bench(const RuntimeEnvironment *renv);
+
+	/**
+	 * Start a test, replacing the result of any previous one
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Peer to test against
+	 * @param duration Time to send DATA in milliseconds (at most ZT_BENCH_MAX_DURATION)
+	 * @param bitsPerSecond Sending rate limit, or 0 to send as fast as possible
+	 * @return False if a test is already running or there is no path to the peer
+	 */
+	bool start(void *tPtr,const Address &peer,unsigned int duration,uint64_t bitsPerSecond);
+
+	/**
+	 * Do the next bit of a running test
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @return Negative when the test is done, else milliseconds to wait before calling again (may be 0)
+	 */
+	int step(void *tPtr);
+
+	/**
+	 * End a running test early (step() then returns negative)
+	 */
+	void stop();
+
+	/**
+	 * @param r Result of the current or last test
+	 */
+	void result(Result &r) const;
+
+	/**
+	 * Handle a VERB_BENCH packet from a peer
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Sending peer
+	 * @param pkt Authenticated packet
+	 */
+	void received(void *tPtr,const SharedPtr<Peer> &peer,const Packet &pkt);
+
+private:
+	bool _send(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,Packet &pkt,uint64_t &armorTime,uint64_t &wireTime);
+
+	const RuntimeEnvironment *const RR;
+
+	// Outgoing test, with times from Latency::nanoseconds()
+	enum { BENCH_IDLE,BENCH_SENDING,BENCH_WAITING,BENCH_DONE } _state;
+	SharedPtr<Peer> _peer;
+	SharedPtr<Path> _path;
+	uint64_t _session;
+	bool _direct;
+	bool _answered;
+	unsigned int _duration;
+	uint64_t _bitsPerSecond;
+	unsigned int _packetSize;
+	uint64_t _start;
+	uint64_t _lastData;
+	uint64_t _lastPing;
+	uint64_t _lastResultRequest;
+	uint64_t _seq;
+	uint64_t _packetsSent;
+	uint64_t _bytesSent;
+	uint64_t _armorTime;
+	uint64_t _wireTime;
+	uint64_t _packetsReceived;
+	uint64_t _bytesReceived;
+	uint64_t _receiveTime;
+	unsigned int _pingsSent;
+	std::vector<uint64_t> _rtts;
+
+	// Incoming test (one session at a time)
+	Address _rxPeer;
+	uint64_t _rxSession;
+	uint64_t _rxPackets;
+	uint64_t _rxBytes;
+	uint64_t _rxFirst;
+	uint64_t _rxLast;
+
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BLOOM_HPP
+#define ZT_BLOOM_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * A small fixed size Bloom filter over 64-bit keys
+ *
+ * This answers "definitely not present" or "maybe present," and is used to
+ * avoid scanning lists for keys that are usually not in them. Each key sets
+ * three bits taken from one multiplicative hash.
+ *
+ * @tparam B Size in bits, a power of two from 64 to 2^21
+ */
+template<unsigned int B>
+class Bloom
+{
+public:
+	Bloom() { clear(); }
+
+	inline void clear() { memset(_b,0,sizeof(_b)); }
+
+	/**
+	 * @param k Key to add
+	 */
+	inline void set(const uint64_t k)
+	{
+		const uint64_t h = _hash(k);
+		_set((unsigned int)h);
+		_set((unsigned int)(h >> 21));
+		_set((unsigned int)(h >> 42));
+	}
+
+	/**
+	 * @param k Key to check
+	 * @return False if key was definitely not added, true if it may have been
+	 */
+	inline bool maybe(const uint64_t k) const
+	{
+		const uint64_t h = _hash(k);
+		return ((_get((unsigned int)h))&&(_get((unsigned int)(h >> 21)))&&(_get((unsigned int)(h >> 42))));
+	}
+
+private:
+	static inline uint64_t _hash(uint64_t k)
+	{
+		k *= 0x9e3779b97f4a7c15ULL;
+		return (k ^ (k >> 31));
+	}
+	inline void _set(const unsigned int i) { _b[(i & (B - 1)) >> 6] |= (1ULL << (i & 63)); }
+	inline bool _get(const unsigned int i) const { return ((_b[(i & (B - 1)) >> 6] & (1ULL << (i & 63))) != 0); }
+
+	uint64_t _b[B / 64];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BRIDGEROUTETABLE_HPP
+#define ZT_BRIDGEROUTETABLE_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "MAC.hpp"
+#include "NonCopyable.hpp"
+
+#define ZT_BRIDGEROUTETABLE_NIL 0xffffffffU
+
+namespace ZeroTier {
+
+/**
+ * LRU ordered table of MACs reachable behind remote bridges
+ *
+ * Entries live in a pool and are threaded onto two doubly linked lists:
+ * one across the whole table and one per bridge, both most recently
+ * learned first. When a bridge goes over its quota its own least recently
+ * learned MAC is dropped, and when the table as a whole is full the least
+ * recently learned MAC overall goes. Both lookup and learning are constant
+ * time, so a flood of new MACs from one bridge cannot make every insert
+ * walk the table or push out routes learned from other bridges.
+ *
+ * This is not thread safe.
+ */
+class BridgeRouteTable : NonCopyable
+{
+private:
+	struct _Entry
+	{
+		MAC mac;
+		Address bridge;
+		uint32_t prev,next; // whole table
+		uint32_t bprev,bnext; // this entry's bridge
+	};
+
+	struct _Bridge
+	{
+		_Bridge() : head(ZT_BRIDGEROUTETABLE_NIL),tail(ZT_BRIDGEROUTETABLE_NIL),count(0) {}
+		uint32_t head,tail;
+		unsigned long count;
+	};
+
+public:
+	/**
+	 * @param maxRoutes Maximum number of MACs in table
+	 * @param maxPerBridge Maximum number of MACs behind any one bridge
+	 */
+	BridgeRouteTable(const unsigned long maxRoutes,const unsigned long maxPerBridge) :
+		_index(256),
+		_bridges(16),
+		_head(ZT_BRIDGEROUTETABLE_NIL),
+		_tail(ZT_BRIDGEROUTETABLE_NIL),
+		_maxRoutes((maxRoutes) ? maxRoutes : 1),
+		_maxPerBridge((maxPerBridge) ? maxPerBridge : 1)
+	{
+	}
+
+	/**
+	 * @param mac MAC address
+	 * @return Bridge this MAC is behind or NULL if none
+	 */
+	inline const Address *get(const MAC &mac) const
+	{
+		const uint32_t *const i = _index.get(mac);
+		return ((i) ? &(_entries[*i].bridge) : (const Address *)0);
+	}
+
+	/**
+	 * Learn or refresh a route, evicting old routes if over quota
+	 *
+	 * @param mac MAC address
+	 * @param bridge Bridge this MAC is reachable behind
+	 */
+	inline void learn(const MAC &mac,const Address &bridge)
+	{
+		const uint32_t *const ip = _index.get(mac);
+		if (ip) {
+			const uint32_t i = *ip;
+			if ((i == _head)&&(_entries[i].bridge == bridge))
+				return; // the usual case of a busy MAC seen again
+			_unlink(i);
+			_entries[i].bridge = bridge;
+			_link(i);
+		} else {
+			uint32_t i;
+			if (_free.empty()) {
+				i = (uint32_t)_entries.size();
+				_entries.push_back(_Entry());
+			} else {
+				i = _free.back();
+				_free.pop_back();
+			}
+			_entries[i].mac = mac;
+			_entries[i].bridge = bridge;
+			_index.set(mac,i);
+			_link(i);
+		}
+
+		const _Bridge *const b = _bridges.get(bridge);
+		if ((b)&&(b->count > _maxPerBridge))
+			_evict(b->tail);
+		if (_index.size() > _maxRoutes)
+			_evict(_tail);
+	}
+
+	/**
+	 * @return Number of MACs in table
+	 */
+	inline unsigned long size() const { return _index.size(); }
+
+	/**
+	 * @return Number of bridges with at least one MAC in table
+	 */
+	inline unsigned long bridgeCount() const { return _bridges.size(); }
+
+private:
+	// Put an entry at the front of both of its lists
+	inline void _link(const uint32_t i)
+	{
+		_Entry &e = _entries[i];
+
+		e.prev = ZT_BRIDGEROUTETABLE_NIL;
+		e.next = _head;
+		if (_head != ZT_BRIDGEROUTETABLE_NIL)
+			_entries[_head].prev = i;
+		else _tail = i;
+		_head = i;
+
+		_Bridge &b = _bridges[e.bridge];
+		e.bprev = ZT_BRIDGEROUTETABLE_NIL;
+		e.bnext = b.head;
+		if (b.head != ZT_BRIDGEROUTETABLE_NIL)
+			_entries[b.head].bprev = i;
+		else b.tail = i;
+		b.head = i;
+		++b.count;
+	}
+
+	// Take an entry off both of its lists, forgetting its bridge if that was its last MAC
+	inline void _unlink(const uint32_t i)
+	{
+		const _Entry &e = _entries[i];
+
+		if (e.prev != ZT_BRIDGEROUTETABLE_NIL)
+			_entries[e.prev].next = e.next;
+		else _head = e.next;
+		if (e.next != ZT_BRIDGEROUTETABLE_NIL)
+			_entries[e.next].prev = e.prev;
+		else _tail = e.prev;
+
+		_Bridge *const b = _bridges.get(e.bridge);
+		if (--b->count == 0) {
+			_bridges.erase(e.bridge);
+		} else {
+			if (e.bprev != ZT_BRIDGEROUTETABLE_NIL)
+				_entries[e.bprev].bnext = e.bnext;
+			else b->head = e.bnext;
+			if (e.bnext != ZT_BRIDGEROUTETABLE_NIL)
+				_entries[e.bnext].bprev = e.bprev;
+			else b->tail = e.bprev;
+		}
+	}
+
+	inline void _evict(const uint32_t i)
+	{
+		_unlink(i);
+		_index.erase(_entries[i].mac);
+		_free.push_back(i);
+	}
+
+	std::vector<_Entry> _entries;
+	std::vector<uint32_t> _free;
+	Hashtable< MAC,uint32_t > _index;
+	Hashtable< Address,_Bridge > _bridges;
+	uint32_t _head,_tail; // most and least recently learned
+	const unsigned long _maxRoutes;
+	const unsigned long _maxPerBridge;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -470,6 +470,110 @@ private:
 	unsigned int _l;
 };
 
+/**
+ * Cursor that reads fields from a Buffer without throwing
+ *
+ * This is for parsing untrusted input such as packets, where a truncated
+ * or malformed one is common and should cost no more than a branch. Any
+ * read past the end marks the reader as failed; further reads return zero
+ * or NULL and do not advance. Callers read what they need and then check
+ * ok() once before acting on any of it.
+ *
+ * The reader points into the buffer's data, so it must not outlive it or
+ * be used across changes to its contents.
+ */
+class BufferReader
+{
+public:
+	template<unsigned int C>
+	BufferReader(const Buffer<C> &b,const unsigned int startAt = 0) :
+		_b(reinterpret_cast<const uint8_t *>(b.data())),
+		_l(b.size()),
+		_p(startAt),
+		_ok(startAt <= b.size())
+	{
+		if (!_ok)
+			_p = _l;
+	}
+
+	/**
+	 * @return Next integer (big-endian on the wire), or 0 if there are not enough bytes left
+	 * @tparam T Integer type (e.g. uint16_t, int64_t)
+	 */
+	template<typename T>
+	inline T next()
+	{
+		if (unlikely(sizeof(T) > (_l - _p))) {
+			fail();
+			return 0;
+		}
+		T v = 0;
+		const uint8_t *p = _b + _p;
+		for(unsigned int x=0;x<sizeof(T);++x) {
+			v <<= 8;
+			v |= (T)*(p++);
+		}
+		_p += sizeof(T);
+		return v;
+	}
+
+	/**
+	 * @param l Length of field in bytes
+	 * @return Pointer to next l bytes, or NULL if there are not enough bytes left
+	 */
+	inline const uint8_t *nextField(const unsigned int l)
+	{
+		if (unlikely(l > (_l - _p))) {
+			fail();
+			return (const uint8_t *)0;
+		}
+		const uint8_t *const f = _b + _p;
+		_p += l;
+		return f;
+	}
+
+	/**
+	 * @param l Number of bytes to skip
+	 * @return True if there were at least l bytes left
+	 */
+	inline bool skip(const unsigned int l) { return (nextField(l) != (const uint8_t *)0); }
+
+	/**
+	 * Mark the reader as failed, e.g. when a field has an invalid value
+	 */
+	inline void fail()
+	{
+		_ok = false;
+		_p = _l;
+	}
+
+	/**
+	 * @return Index of next byte to be read in the underlying buffer
+	 */
+	inline unsigned int position() const { return _p; }
+
+	/**
+	 * @return Number of bytes left to read
+	 */
+	inline unsigned int remaining() const { return (_l - _p); }
+
+	/**
+	 * @return True if there are no bytes left to read
+	 */
+	inline bool atEnd() const { return (_p >= _l); }
+
+	/**
+	 * @return True if no read has failed
+	 */
+	inline bool ok() const { return _ok; }
+
+private:
+	const uint8_t *const _b;
+	const unsigned int _l;
+	unsigned int _p;
+	bool _ok;
+};
+
 } // namespace ZeroTier
 
 #endif
@@ -1982,6 +1982,628 @@ static inline void ge25519_scalarmult_base(ge25519_p3 *r, const sc25519 *s)
   }
 }
 
+#if defined(__SIZEOF_INT128__)
+
+/*
+ * Where 128-bit products are available, fixed-base scalar multiplication
+ * for signing and key generation uses radix 2^51 field arithmetic and a
+ * radix 16 table of 32*8 base point multiples (the ref10 approach). The
+ * table is built on first use from ge25519_base.
+ */
+#define ZT_C25519_FE51 1
+
+typedef unsigned __int128 fe51_uint128;
+
+typedef struct
+{
+  crypto_uint64 v[5];
+}
+fe51;
+
+#define FE51_MASK 0x7ffffffffffffULL
+
+static inline void fe51_carry(fe51 *r)
+{
+  crypto_uint64 c;
+  c = r->v[0] >> 51; r->v[0] &= FE51_MASK; r->v[1] += c;
+  c = r->v[1] >> 51; r->v[1] &= FE51_MASK; r->v[2] += c;
+  c = r->v[2] >> 51; r->v[2] &= FE51_MASK; r->v[3] += c;
+  c = r->v[3] >> 51; r->v[3] &= FE51_MASK; r->v[4] += c;
+  c = r->v[4] >> 51; r->v[4] &= FE51_MASK; r->v[0] += c * 19;
+}
+
+static inline void fe51_setzero(fe51 *r)
+{
+  r->v[0] = r->v[1] = r->v[2] = r->v[3] = r->v[4] = 0;
+}
+
+static inline void fe51_setone(fe51 *r)
+{
+  r->v[0] = 1;
+  r->v[1] = r->v[2] = r->v[3] = r->v[4] = 0;
+}
+
+static inline void fe51_add(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  int i;
+  for(i=0;i<5;i++) r->v[i] = x->v[i] + y->v[i];
+  fe51_carry(r);
+}
+
+/* 4p is added first so limbs never go negative */
+static inline void fe51_sub(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  int i;
+  r->v[0] = (x->v[0] + 0x1fffffffffffb4ULL) - y->v[0];
+  for(i=1;i<5;i++) r->v[i] = (x->v[i] + 0x1ffffffffffffcULL) - y->v[i];
+  fe51_carry(r);
+}
+
+static inline void fe51_neg(fe51 *r, const fe51 *x)
+{
+  fe51 z;
+  fe51_setzero(&z);
+  fe51_sub(r, &z, x);
+}
+
+static inline void fe51_reduce(fe51 *r, fe51_uint128 t0, fe51_uint128 t1, fe51_uint128 t2, fe51_uint128 t3, fe51_uint128 t4)
+{
+  crypto_uint64 c;
+  r->v[0] = (crypto_uint64)t0 & FE51_MASK; t1 += (crypto_uint64)(t0 >> 51);
+  r->v[1] = (crypto_uint64)t1 & FE51_MASK; t2 += (crypto_uint64)(t1 >> 51);
+  r->v[2] = (crypto_uint64)t2 & FE51_MASK; t3 += (crypto_uint64)(t2 >> 51);
+  r->v[3] = (crypto_uint64)t3 & FE51_MASK; t4 += (crypto_uint64)(t3 >> 51);
+  r->v[4] = (crypto_uint64)t4 & FE51_MASK; c = (crypto_uint64)(t4 >> 51);
+  r->v[0] += c * 19;
+  r->v[1] += r->v[0] >> 51;
+  r->v[0] &= FE51_MASK;
+}
+
+static inline void fe51_mul(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 y0 = y->v[0], y1 = y->v[1], y2 = y->v[2], y3 = y->v[3], y4 = y->v[4];
+  const crypto_uint64 y1_19 = y1 * 19, y2_19 = y2 * 19, y3_19 = y3 * 19, y4_19 = y4 * 19;
+  fe51_reduce(r,
+    (fe51_uint128)x0 * y0 + (fe51_uint128)x1 * y4_19 + (fe51_uint128)x2 * y3_19 + (fe51_uint128)x3 * y2_19 + (fe51_uint128)x4 * y1_19,
+    (fe51_uint128)x0 * y1 + (fe51_uint128)x1 * y0 + (fe51_uint128)x2 * y4_19 + (fe51_uint128)x3 * y3_19 + (fe51_uint128)x4 * y2_19,
+    (fe51_uint128)x0 * y2 + (fe51_uint128)x1 * y1 + (fe51_uint128)x2 * y0 + (fe51_uint128)x3 * y4_19 + (fe51_uint128)x4 * y3_19,
+    (fe51_uint128)x0 * y3 + (fe51_uint128)x1 * y2 + (fe51_uint128)x2 * y1 + (fe51_uint128)x3 * y0 + (fe51_uint128)x4 * y4_19,
+    (fe51_uint128)x0 * y4 + (fe51_uint128)x1 * y3 + (fe51_uint128)x2 * y2 + (fe51_uint128)x3 * y1 + (fe51_uint128)x4 * y0);
+}
+
+static inline void fe51_square(fe51 *r, const fe51 *x)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 d0 = x0 * 2, d1 = x1 * 2, d2_19 = x2 * 38, x4_19 = x4 * 19, d4_19 = x4 * 38;
+  fe51_reduce(r,
+    (fe51_uint128)x0 * x0 + (fe51_uint128)d4_19 * x1 + (fe51_uint128)d2_19 * x3,
+    (fe51_uint128)d0 * x1 + (fe51_uint128)d4_19 * x2 + (fe51_uint128)x3 * (x3 * 19),
+    (fe51_uint128)d0 * x2 + (fe51_uint128)x1 * x1 + (fe51_uint128)d4_19 * x3,
+    (fe51_uint128)d0 * x3 + (fe51_uint128)d1 * x2 + (fe51_uint128)x4 * x4_19,
+    (fe51_uint128)d0 * x4 + (fe51_uint128)d1 * x3 + (fe51_uint128)x2 * x2);
+}
+
+static inline void fe51_squaren(fe51 *r, const fe51 *x, int n)
+{
+  fe51_square(r, x);
+  while (--n > 0) fe51_square(r, r);
+}
+
+/* r = x^(p-2) */
+static void fe51_invert(fe51 *r, const fe51 *x)
+{
+  fe51 z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+  fe51_square(&z2, x);
+  fe51_squaren(&t, &z2, 2);
+  fe51_mul(&z9, &t, x);
+  fe51_mul(&z11, &z9, &z2);
+  fe51_square(&t, &z11);
+  fe51_mul(&z2_5_0, &t, &z9);
+  fe51_squaren(&t, &z2_5_0, 5);
+  fe51_mul(&z2_10_0, &t, &z2_5_0);
+  fe51_squaren(&t, &z2_10_0, 10);
+  fe51_mul(&z2_20_0, &t, &z2_10_0);
+  fe51_squaren(&t, &z2_20_0, 20);
+  fe51_mul(&t, &t, &z2_20_0);
+  fe51_squaren(&t, &t, 10);
+  fe51_mul(&z2_50_0, &t, &z2_10_0);
+  fe51_squaren(&t, &z2_50_0, 50);
+  fe51_mul(&z2_100_0, &t, &z2_50_0);
+  fe51_squaren(&t, &z2_100_0, 100);
+  fe51_mul(&t, &t, &z2_100_0);
+  fe51_squaren(&t, &t, 50);
+  fe51_mul(&t, &t, &z2_50_0);
+  fe51_squaren(&t, &t, 5);
+  fe51_mul(r, &t, &z11);
+}
+
+static inline void fe51_cmov(fe51 *r, const fe51 *x, unsigned char b)
+{
+  int i;
+  const crypto_uint64 mask = (crypto_uint64)0 - (crypto_uint64)b;
+  for(i=0;i<5;i++) r->v[i] ^= mask & (x->v[i] ^ r->v[i]);
+}
+
+static inline void fe51_unpack(fe51 *r, const unsigned char x[32])
+{
+  crypto_uint64 t[4];
+  int i,j;
+  for(i=0;i<4;i++) {
+    t[i] = 0;
+    for(j=7;j>=0;j--) t[i] = (t[i] << 8) | x[(i * 8) + j];
+  }
+  r->v[0] = t[0] & FE51_MASK;
+  r->v[1] = ((t[0] >> 51) | (t[1] << 13)) & FE51_MASK;
+  r->v[2] = ((t[1] >> 38) | (t[2] << 26)) & FE51_MASK;
+  r->v[3] = ((t[2] >> 25) | (t[3] << 39)) & FE51_MASK;
+  r->v[4] = (t[3] >> 12) & FE51_MASK;
+}
+
+static inline void fe51_pack(unsigned char r[32], const fe51 *x)
+{
+  fe51 y = *x;
+  crypto_uint64 q,t[4];
+  int i,j;
+  fe51_carry(&y);
+  /* q is 1 if y >= p */
+  q = (y.v[0] + 19) >> 51;
+  q = (y.v[1] + q) >> 51;
+  q = (y.v[2] + q) >> 51;
+  q = (y.v[3] + q) >> 51;
+  q = (y.v[4] + q) >> 51;
+  y.v[0] += 19 * q;
+  y.v[1] += y.v[0] >> 51; y.v[0] &= FE51_MASK;
+  y.v[2] += y.v[1] >> 51; y.v[1] &= FE51_MASK;
+  y.v[3] += y.v[2] >> 51; y.v[2] &= FE51_MASK;
+  y.v[4] += y.v[3] >> 51; y.v[3] &= FE51_MASK;
+  y.v[4] &= FE51_MASK;
+  t[0] = y.v[0] | (y.v[1] << 51);
+  t[1] = (y.v[1] >> 13) | (y.v[2] << 38);
+  t[2] = (y.v[2] >> 26) | (y.v[3] << 25);
+  t[3] = (y.v[3] >> 39) | (y.v[4] << 12);
+  for(i=0;i<4;i++)
+    for(j=0;j<8;j++) r[(i * 8) + j] = (unsigned char)(t[i] >> (j * 8));
+}
+
+/* Converts one of the reduced fe25519 constants above */
+static inline void fe51_from_fe25519(fe51 *r, const fe25519 *x)
+{
+  unsigned char b[32];
+  fe25519_pack(b, x);
+  fe51_unpack(r, b);
+}
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+  fe51 z;
+  fe51 t;
+} ge51_p3;
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+  fe51 z;
+  fe51 t;
+} ge51_p1p1;
+
+/* Affine point as (y+x, y-x, 2*d*x*y) */
+typedef struct
+{
+  fe51 yplusx;
+  fe51 yminusx;
+  fe51 xy2d;
+} ge51_niels;
+
+static inline void ge51_p1p1_to_p2(ge51_p3 *r, const ge51_p1p1 *p)
+{
+  fe51_mul(&r->x, &p->x, &p->t);
+  fe51_mul(&r->y, &p->y, &p->z);
+  fe51_mul(&r->z, &p->z, &p->t);
+}
+
+static inline void ge51_p1p1_to_p3(ge51_p3 *r, const ge51_p1p1 *p)
+{
+  fe51_mul(&r->x, &p->x, &p->t);
+  fe51_mul(&r->y, &p->y, &p->z);
+  fe51_mul(&r->z, &p->z, &p->t);
+  fe51_mul(&r->t, &p->x, &p->y);
+}
+
+static inline void ge51_madd(ge51_p1p1 *r, const ge51_p3 *p, const ge51_niels *q)
+{
+  fe51 t0;
+  fe51_add(&r->x, &p->y, &p->x);
+  fe51_sub(&r->y, &p->y, &p->x);
+  fe51_mul(&r->z, &r->x, &q->yplusx);
+  fe51_mul(&r->y, &r->y, &q->yminusx);
+  fe51_mul(&r->t, &q->xy2d, &p->t);
+  fe51_add(&t0, &p->z, &p->z);
+  fe51_sub(&r->x, &r->z, &r->y);
+  fe51_add(&r->y, &r->z, &r->y);
+  fe51_add(&r->z, &t0, &r->t);
+  fe51_sub(&r->t, &t0, &r->t);
+}
+
+/* Uses only x, y and z of p */
+static inline void ge51_dbl(ge51_p1p1 *r, const ge51_p3 *p)
+{
+  fe51 t0;
+  fe51_square(&r->x, &p->x);
+  fe51_square(&r->z, &p->y);
+  fe51_square(&r->t, &p->z);
+  fe51_add(&r->t, &r->t, &r->t);
+  fe51_add(&r->y, &p->x, &p->y);
+  fe51_square(&t0, &r->y);
+  fe51_add(&r->y, &r->z, &r->x);
+  fe51_sub(&r->z, &r->z, &r->x);
+  fe51_sub(&r->x, &t0, &r->y);
+  fe51_sub(&r->t, &r->t, &r->z);
+}
+
+static void ge51_to_niels(ge51_niels *r, const ge51_p3 *p, const fe51 *d2)
+{
+  fe51 zi, x, y;
+  fe51_invert(&zi, &p->z);
+  fe51_mul(&x, &p->x, &zi);
+  fe51_mul(&y, &p->y, &zi);
+  fe51_add(&r->yplusx, &y, &x);
+  fe51_sub(&r->yminusx, &y, &x);
+  fe51_mul(&r->xy2d, &x, &y);
+  fe51_mul(&r->xy2d, &r->xy2d, d2);
+}
+
+static inline void ge51_pack(unsigned char r[32], const ge51_p3 *p)
+{
+  fe51 zi, x, y;
+  unsigned char xb[32];
+  fe51_invert(&zi, &p->z);
+  fe51_mul(&x, &p->x, &zi);
+  fe51_mul(&y, &p->y, &zi);
+  fe51_pack(r, &y);
+  fe51_pack(xb, &x);
+  r[31] ^= (xb[0] & 1) << 7;
+}
+
+/* [j+1]*256^i*B for i in 0..31 and j in 0..7 */
+struct ge51_base_table
+{
+  ge51_niels t[32][8];
+
+  ge51_base_table()
+  {
+    fe51 d2;
+    ge51_p3 bi, m;
+    ge51_p1p1 r;
+    int i,j;
+    fe51_from_fe25519(&d2, &ge25519_ec2d);
+    fe51_from_fe25519(&bi.x, &ge25519_base.x);
+    fe51_from_fe25519(&bi.y, &ge25519_base.y);
+    fe51_from_fe25519(&bi.z, &ge25519_base.z);
+    fe51_from_fe25519(&bi.t, &ge25519_base.t);
+    for(i=0;i<32;i++)
+    {
+      ge51_to_niels(&t[i][0], &bi, &d2);
+      m = bi;
+      for(j=1;j<8;j++)
+      {
+        ge51_madd(&r, &m, &t[i][0]);
+        ge51_p1p1_to_p3(&m, &r);
+        ge51_to_niels(&t[i][j], &m, &d2);
+      }
+      for(j=0;j<8;j++)
+      {
+        ge51_dbl(&r, &bi);
+        if (j < 7) ge51_p1p1_to_p2(&bi, &r);
+        else ge51_p1p1_to_p3(&bi, &r);
+      }
+    }
+  }
+};
+
+static inline const ge51_base_table &ge51_base()
+{
+  static const ge51_base_table tab;
+  return tab;
+}
+
+static inline void ge51_niels_cmov(ge51_niels *r, const ge51_niels *p, unsigned char b)
+{
+  fe51_cmov(&r->yplusx, &p->yplusx, b);
+  fe51_cmov(&r->yminusx, &p->yminusx, b);
+  fe51_cmov(&r->xy2d, &p->xy2d, b);
+}
+
+/* Constant-time: r = [b]*256^pos*B for b in -8..8 */
+static inline void ge51_select(ge51_niels *r, const ge51_niels pos[8], signed char b)
+{
+  ge51_niels minusr;
+  const unsigned char bnegative = negative(b);
+  const signed char babs = b - (signed char)(((-bnegative) & b) << 1);
+  int j;
+  fe51_setone(&r->yplusx);
+  fe51_setone(&r->yminusx);
+  fe51_setzero(&r->xy2d);
+  for(j=0;j<8;j++) ge51_niels_cmov(r, &pos[j], equal(babs, (signed char)(j + 1)));
+  minusr.yplusx = r->yminusx;
+  minusr.yminusx = r->yplusx;
+  fe51_neg(&minusr.xy2d, &r->xy2d);
+  ge51_niels_cmov(r, &minusr, bnegative);
+}
+
+/* h = [a]B, a[31] <= 127 */
+static void ge51_scalarmult_base(ge51_p3 *h, const unsigned char a[32])
+{
+  const ge51_base_table &tab = ge51_base();
+  signed char e[64];
+  signed char carry;
+  ge51_p1p1 r;
+  ge51_niels t;
+  int i;
+
+  for(i=0;i<32;i++)
+  {
+    e[2*i+0] = (a[i] >> 0) & 15;
+    e[2*i+1] = (a[i] >> 4) & 15;
+  }
+  /* digits in -8..8 */
+  carry = 0;
+  for(i=0;i<63;i++)
+  {
+    e[i] += carry;
+    carry = (e[i] + 8) >> 4;
+    e[i] -= carry << 4;
+  }
+  e[63] += carry;
+
+  fe51_setzero(&h->x);
+  fe51_setone(&h->y);
+  fe51_setone(&h->z);
+  fe51_setzero(&h->t);
+  for(i=1;i<64;i+=2)
+  {
+    ge51_select(&t, tab.t[i/2], e[i]);
+    ge51_madd(&r, h, &t);
+    ge51_p1p1_to_p3(h, &r);
+  }
+
+  ge51_dbl(&r, h);
+  ge51_p1p1_to_p2(h, &r);
+  ge51_dbl(&r, h);
+  ge51_p1p1_to_p2(h, &r);
+  ge51_dbl(&r, h);
+  ge51_p1p1_to_p2(h, &r);
+  ge51_dbl(&r, h);
+  ge51_p1p1_to_p3(h, &r);
+
+  for(i=0;i<64;i+=2)
+  {
+    ge51_select(&t, tab.t[i/2], e[i]);
+    ge51_madd(&r, h, &t);
+    ge51_p1p1_to_p3(h, &r);
+  }
+}
+
+static inline void fe51_cswap(fe51 *x, fe51 *y, unsigned char b)
+{
+  int i;
+  const crypto_uint64 mask = (crypto_uint64)0 - (crypto_uint64)b;
+  for(i=0;i<5;i++)
+  {
+    const crypto_uint64 t = mask & (x->v[i] ^ y->v[i]);
+    x->v[i] ^= t;
+    y->v[i] ^= t;
+  }
+}
+
+static inline void fe51_mul121665(fe51 *r, const fe51 *x)
+{
+  fe51_reduce(r,
+    (fe51_uint128)x->v[0] * 121665,
+    (fe51_uint128)x->v[1] * 121665,
+    (fe51_uint128)x->v[2] * 121665,
+    (fe51_uint128)x->v[3] * 121665,
+    (fe51_uint128)x->v[4] * 121665);
+}
+
+/* Montgomery ladder, same results as crypto_scalarmult() including for points with bit 255 set */
+static void x25519_fe51(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+  fe51 x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d;
+  unsigned char s[32];
+  unsigned char swap = 0, bit;
+  int i;
+  for(i=0;i<32;i++) s[i] = n[i];
+  s[0] &= 248;
+  s[31] &= 127;
+  s[31] |= 64;
+
+  fe51_unpack(&x1, p);
+  x1.v[4] |= (crypto_uint64)(p[31] >> 7) << 51;
+  fe51_carry(&x1);
+  fe51_setone(&x2);
+  fe51_setzero(&z2);
+  x3 = x1;
+  fe51_setone(&z3);
+
+  for(i=254;i>=0;i--)
+  {
+    bit = (s[i >> 3] >> (i & 7)) & 1;
+    swap ^= bit;
+    fe51_cswap(&x2, &x3, swap);
+    fe51_cswap(&z2, &z3, swap);
+    swap = bit;
+
+    fe51_add(&a, &x2, &z2);
+    fe51_square(&aa, &a);
+    fe51_sub(&b, &x2, &z2);
+    fe51_square(&bb, &b);
+    fe51_sub(&e, &aa, &bb);
+    fe51_add(&c, &x3, &z3);
+    fe51_sub(&d, &x3, &z3);
+    fe51_mul(&d, &d, &a); /* DA */
+    fe51_mul(&c, &c, &b); /* CB */
+    fe51_add(&x3, &d, &c);
+    fe51_square(&x3, &x3);
+    fe51_sub(&z3, &d, &c);
+    fe51_square(&z3, &z3);
+    fe51_mul(&z3, &z3, &x1);
+    fe51_mul(&x2, &aa, &bb);
+    fe51_mul121665(&z2, &e);
+    fe51_add(&z2, &z2, &aa);
+    fe51_mul(&z2, &z2, &e);
+  }
+  fe51_cswap(&x2, &x3, swap);
+  fe51_cswap(&z2, &z3, swap);
+
+  fe51_invert(&z2, &z2);
+  fe51_mul(&x2, &x2, &z2);
+  fe51_pack(q, &x2);
+}
+
+/* [n]9 via the fixed-base table, since u = (1+y)/(1-y) = (Z+Y)/(Z-Y) */
+static void x25519_base_fe51(unsigned char *q, const unsigned char *n)
+{
+  ge51_p3 a;
+  fe51 u, w;
+  unsigned char s[32];
+  int i;
+  for(i=0;i<32;i++) s[i] = n[i];
+  s[0] &= 248;
+  s[31] &= 127;
+  s[31] |= 64;
+  ge51_scalarmult_base(&a, s);
+  fe51_add(&u, &a.z, &a.y);
+  fe51_sub(&w, &a.z, &a.y);
+  fe51_invert(&w, &w);
+  fe51_mul(&u, &u, &w);
+  fe51_pack(q, &u);
+}
+
+#endif
+
+/* signed sliding window digits of a scalar, each zero or odd in -15..15 (from ref10) */
+static void sc25519_slide(signed char r[256], const unsigned char a[32])
+{
+  int i,b,k;
+  for(i=0;i<256;++i)
+    r[i] = 1 & (a[i >> 3] >> (i & 7));
+  for(i=0;i<256;++i) {
+    if (r[i]) {
+      for(b=1;(b <= 6)&&((i + b) < 256);++b) {
+        if (r[i + b]) {
+          if ((r[i] + (r[i + b] << b)) <= 15) {
+            r[i] += r[i + b] << b; r[i + b] = 0;
+          } else if ((r[i] - (r[i + b] << b)) >= -15) {
+            r[i] -= r[i + b] << b;
+            for(k=i+b;k<256;++k) {
+              if (!r[k]) {
+                r[k] = 1;
+                break;
+              }
+              r[k] = 0;
+            }
+          } else break;
+        }
+      }
+    }
+  }
+}
+
+static inline void ge25519_neg(ge25519_p3 *r, const ge25519_p3 *p)
+{
+  fe25519_neg(&r->x, &p->x);
+  r->y = p->y;
+  r->z = p->z;
+  fe25519_neg(&r->t, &p->t);
+}
+
+/* computes [s[0]]p[0] + ... + [s[n-1]]p[n-1] with shared doublings (Straus), returns -1 if out of memory */
+static int ge25519_multi_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p, const sc25519 *s, unsigned int n)
+{
+  ge25519_p1p1 tp1p1;
+  ge25519_p3 t;
+  unsigned char sb[32];
+  unsigned int j;
+  int i,top;
+
+  /* pre[8*j + k] = [2k+1]p[j] */
+  ge25519_p3 *const pre = (ge25519_p3 *)malloc(sizeof(ge25519_p3) * 8 * n);
+  signed char *const d = (signed char *)malloc(256 * n);
+  if ((!pre)||(!d)) {
+    free(pre);
+    free(d);
+    return -1;
+  }
+
+  top = -1;
+  for(j=0;j<n;++j) {
+    pre[8*j] = p[j];
+    dbl_p1p1(&tp1p1,(const ge25519_p2 *)&p[j]); p1p1_to_p3(&t, &tp1p1);
+    for(i=1;i<8;++i) {
+      add_p1p1(&tp1p1, &pre[8*j + i - 1], &t);
+      p1p1_to_p3(&pre[8*j + i], &tp1p1);
+    }
+    sc25519_to32bytes(sb, &s[j]);
+    sc25519_slide(d + 256*j, sb);
+    for(i=255;i>top;--i) {
+      if (d[256*j + i]) {
+        top = i;
+        break;
+      }
+    }
+  }
+
+  setneutral(r);
+  for(i=top;i>=0;--i) {
+    dbl_p1p1(&tp1p1, (const ge25519_p2 *)r);
+    p1p1_to_p3(r, &tp1p1);
+    for(j=0;j<n;++j) {
+      const int dj = d[256*j + i];
+      if (dj > 0) {
+        add_p1p1(&tp1p1, r, &pre[8*j + (dj >> 1)]);
+        p1p1_to_p3(r, &tp1p1);
+      } else if (dj < 0) {
+        ge25519_neg(&t, &pre[8*j + ((-dj) >> 1)]);
+        add_p1p1(&tp1p1, r, &t);
+        p1p1_to_p3(r, &tp1p1);
+      }
+    }
+  }
+
+  free(pre);
+  free(d);
+  return 0;
+}
+
+/* returns 1 if p is the neutral element */
+static inline int ge25519_isneutral_vartime(const ge25519_p3 *p)
+{
+  fe25519 zero;
+  fe25519_setzero(&zero);
+  return (fe25519_iseq_vartime(&p->x, &zero) && fe25519_iseq_vartime(&p->y, &p->z));
+}
+
+/* returns 1 if the 32-byte point encoding has y >= p or is negative zero, which verify() would never match */
+static inline int ge25519_noncanonical(const unsigned char p[32], const ge25519_p3 *unpacked)
+{
+  int i;
+  fe25519 zero;
+  if ((p[31] & 0x7f) == 0x7f) {
+    for(i=30;i>0;--i) {
+      if (p[i] != 0xff)
+        break;
+    }
+    if ((i == 0)&&(p[0] >= 0xed))
+      return 1;
+  }
+  fe25519_setzero(&zero);
+  return ((p[31] & 0x80) && fe25519_iseq_vartime(&unpacked->x, &zero));
+}
+
 static inline void get_hram(unsigned char *hram, const unsigned char *sm, const unsigned char *pk, unsigned char *playground, unsigned long long smlen)
 {
   unsigned long long i;
@@ -2002,7 +2624,11 @@ void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void
 	unsigned char rawkey[32];
 	unsigned char digest[64];
 
+#ifdef ZT_C25519_FE51
+	x25519_fe51(rawkey,mine.data,their.data);
+#else
 	crypto_scalarmult(rawkey,mine.data,their.data);
+#endif
 	SHA512::hash(digest,rawkey,32);
 	for(unsigned int i=0,k=0;i<keylen;) {
 		if (k == 64) {
@@ -2016,7 +2642,9 @@ void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void
 void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPublic,const void *msg,unsigned int len,void *signature)
 {
   sc25519 sck, scs, scsk;
+#ifndef ZT_C25519_FE51
   ge25519 ger;
+#endif
   unsigned char r[32];
   unsigned char s[32];
   unsigned char extsk[64];
@@ -2042,8 +2670,17 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 
   /* Computation of R */
   sc25519_from64bytes(&sck, hmg);
+#ifdef ZT_C25519_FE51
+  {
+    ge51_p3 ger51;
+    sc25519_to32bytes(r, &sck);
+    ge51_scalarmult_base(&ger51, r);
+    ge51_pack(r, &ger51);
+  }
+#else
   ge25519_scalarmult_base(&ger, &sck);
   ge25519_pack(r, &ger);
+#endif
   
   /* Computation of s */
   for(unsigned int i=0;i<32;i++)
@@ -2063,17 +2700,22 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 }
 
 bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len,const void *signature)
+{
+  unsigned char digest[64]; // we sign the first 32 bytes of SHA-512(msg)
+  SHA512::hash(digest,msg,len);
+  return verifyDigest(their,digest,signature);
+}
+
+bool C25519::verifyDigest(const C25519::Public &their,const void *digest,const void *signature)
 {
   unsigned char t2[32];
   ge25519 get1, get2;
   sc25519 schram, scs;
   unsigned char hram[crypto_hash_sha512_BYTES];
   unsigned char m[96];
-  unsigned char digest[64]; // we sign the first 32 bytes of SHA-512(msg)
   const unsigned char *sig = (const unsigned char *)signature;
 
   // First check the message's integrity
-  SHA512::hash(digest,msg,len);
   if (!Utils::secureEq(sig + 64,digest,32))
     return false;
 
@@ -2092,18 +2734,143 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   return Utils::secureEq(sig,t2,32);
 }
 
+bool C25519::verifyBatch(const VerifyBatchEntry *entries,unsigned int n,bool *valid)
+{
+  bool allValid = true;
+  while (n > ZT_C25519_VERIFY_BATCH_MAX) {
+    if (!verifyBatch(entries,ZT_C25519_VERIFY_BATCH_MAX,valid))
+      allValid = false;
+    entries += ZT_C25519_VERIFY_BATCH_MAX;
+    if (valid)
+      valid += ZT_C25519_VERIFY_BATCH_MAX;
+    n -= ZT_C25519_VERIFY_BATCH_MAX;
+  }
+  // Check that for random 128-bit z[i]:
+  //   [sum(z[i]*s[i])]B - sum([z[i]]R[i]) - sum([z[i]*h[i]]A[i]) == 0
+  // Terms for the same public key are merged so that many signatures by one
+  // signer (e.g. a network controller) cost one point. Entries whose digest,
+  // R or A are malformed are left for verify() to reject.
+  ge25519_p3 points[ZT_C25519_VERIFY_BATCH_MAX * 2];
+  sc25519 scalars[ZT_C25519_VERIFY_BATCH_MAX * 2];
+  const unsigned char *keys[ZT_C25519_VERIFY_BATCH_MAX];
+  bool inBatch[ZT_C25519_VERIFY_BATCH_MAX];
+  unsigned char zb[ZT_C25519_VERIFY_BATCH_MAX][32];
+  unsigned char digests[ZT_C25519_VERIFY_BATCH_MAX][64];
+  unsigned char hrams[ZT_C25519_VERIFY_BATCH_MAX][crypto_hash_sha512_BYTES];
+  unsigned char m[ZT_C25519_VERIFY_BATCH_MAX][96];
+  void *hashOut[ZT_C25519_VERIFY_BATCH_MAX];
+  const void *hashIn[ZT_C25519_VERIFY_BATCH_MAX];
+  unsigned int hashLen[ZT_C25519_VERIFY_BATCH_MAX];
+  sc25519 sumS,z,t;
+  unsigned int np = 0,nk = 0,batched = 0;
+
+  memset(zb,0,sizeof(zb));
+  for(unsigned int i=0;i<n;++i)
+    Utils::getSecureRandom(zb[i],16);
+
+  // Message digests and H(R,A,M) for every entry, hashed several at a time
+  for(unsigned int i=0;i<n;++i) {
+    hashOut[i] = digests[i];
+    hashIn[i] = entries[i].msg;
+    hashLen[i] = entries[i].len;
+  }
+  SHA512::hashMulti(hashOut,hashIn,hashLen,n);
+  for(unsigned int i=0;i<n;++i) {
+    const unsigned char *const sig = (const unsigned char *)entries[i].signature;
+    memcpy(m[i],sig,32);
+    memcpy(m[i] + 32,entries[i].their->data + 32,32);
+    memcpy(m[i] + 64,sig + 64,32);
+    hashOut[i] = hrams[i];
+    hashIn[i] = m[i];
+    hashLen[i] = 96;
+  }
+  SHA512::hashMulti(hashOut,hashIn,hashLen,n);
+
+  memset(&sumS,0,sizeof(sumS));
+  for(unsigned int i=0;i<n;++i) {
+    const unsigned char *const sig = (const unsigned char *)entries[i].signature;
+    const unsigned char *const pk = entries[i].their->data + 32;
+    inBatch[i] = false;
+
+    if (!Utils::secureEq(sig + 64,digests[i],32))
+      continue;
+
+    // -R
+    if ((ge25519_unpackneg_vartime(&points[np],sig))||(ge25519_noncanonical(sig,&points[np])))
+      continue;
+
+    // -A, merged with earlier entries with the same key
+    unsigned int k = 0;
+    while ((k < nk)&&(memcmp(keys[k],pk,32)))
+      ++k;
+    if (k == nk) {
+      if (ge25519_unpackneg_vartime(&points[ZT_C25519_VERIFY_BATCH_MAX + k],pk))
+        continue;
+      keys[k] = pk;
+      memset(&scalars[ZT_C25519_VERIFY_BATCH_MAX + k],0,sizeof(sc25519));
+      ++nk;
+    }
+
+    sc25519_from32bytes(&z,zb[i]);
+    scalars[np++] = z;
+
+    sc25519_from64bytes(&t,hrams[i]);
+    sc25519_mul(&t,&t,&z);
+    sc25519_add(&scalars[ZT_C25519_VERIFY_BATCH_MAX + k],&scalars[ZT_C25519_VERIFY_BATCH_MAX + k],&t);
+
+    sc25519_from32bytes(&t,sig + 32);
+    sc25519_mul(&t,&t,&z);
+    sc25519_add(&sumS,&sumS,&t);
+
+    inBatch[i] = true;
+    ++batched;
+  }
+
+  bool batchValid = false;
+  if (batched > 1) {
+    // Move the A terms down after the R terms
+    for(unsigned int k=0;k<nk;++k) {
+      points[np + k] = points[ZT_C25519_VERIFY_BATCH_MAX + k];
+      scalars[np + k] = scalars[ZT_C25519_VERIFY_BATCH_MAX + k];
+    }
+    ge25519_p3 sum,sB;
+    ge25519_p1p1 tp1p1;
+    if (ge25519_multi_scalarmult_vartime(&sum,points,scalars,np + nk) == 0) {
+      ge25519_scalarmult_base(&sB,&sumS);
+      add_p1p1(&tp1p1,&sum,&sB);
+      p1p1_to_p3(&sum,&tp1p1);
+      batchValid = (ge25519_isneutral_vartime(&sum) != 0);
+    }
+  }
+
+  // Anything not covered by a passing combined check is verified on its own
+  for(unsigned int i=0;i<n;++i) {
+    const bool v = ((batchValid)&&(inBatch[i])) ? true : verify(*entries[i].their,entries[i].msg,entries[i].len,entries[i].signature);
+    if (valid)
+      valid[i] = v;
+    allValid &= v;
+  }
+  return allValid;
+}
+
 void C25519::_calcPubDH(C25519::Pair &kp)
 {
   // First 32 bytes of pub and priv are the keys for ECDH key
   // agreement. This generates the public portion from the private.
+#ifdef ZT_C25519_FE51
+  x25519_base_fe51(kp.pub.data,kp.priv.data);
+#else
   crypto_scalarmult_base(kp.pub.data,kp.priv.data);
+#endif
 }
 
 void C25519::_calcPubED(C25519::Pair &kp)
 {
   unsigned char extsk[64];
+#ifndef ZT_C25519_FE51
   sc25519 scsk;
   ge25519 gepk;
+#endif
 
   // Second 32 bytes of pub and priv are the keys for ed25519
   // signing and verification.
@@ -2111,9 +2878,15 @@ void C25519::_calcPubED(C25519::Pair &kp)
   extsk[0] &= 248;
   extsk[31] &= 127;
   extsk[31] |= 64;
+#ifdef ZT_C25519_FE51
+  ge51_p3 gepk51;
+  ge51_scalarmult_base(&gepk51,extsk);
+  ge51_pack(kp.pub.data + 32,&gepk51);
+#else
   sc25519_from32bytes(&scsk,extsk);
   ge25519_scalarmult_base(&gepk,&scsk);
   ge25519_pack(kp.pub.data + 32,&gepk);
+#endif
   // In NaCl, the public key is crammed into the next 32 bytes
   // of the private key for signing since both keys are required
   // to sign. In this version we just get it from kp.pub, so we
@@ -36,6 +36,11 @@ namespace ZeroTier {
 #define ZT_C25519_PRIVATE_KEY_LEN 64
 #define ZT_C25519_SIGNATURE_LEN 96
 
+/**
+ * Maximum number of signatures checked together by verifyBatch() (larger batches are split)
+ */
+#define ZT_C25519_VERIFY_BATCH_MAX 32
+
 /**
  * A combined Curve25519 ECDH and Ed25519 signature engine
  */
@@ -188,6 +193,50 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * Verify a signature given the SHA-512 digest of the message
+	 *
+	 * This is for messages too large to hold in memory at once, which can be
+	 * hashed a piece at a time with SHA512::Stream.
+	 *
+	 * @param their Public key to verify against
+	 * @param digest SHA-512 digest of message (ZT_SHA512_DIGEST_LEN bytes)
+	 * @param signature 96-byte signature
+	 * @return True if signature is valid and the digest is that of the signed message
+	 */
+	static bool verifyDigest(const Public &their,const void *digest,const void *signature);
+
+	/**
+	 * A signature to check with verifyBatch()
+	 */
+	typedef struct {
+		const Public *their;
+		const void *msg;
+		unsigned int len;
+		const void *signature;
+	} VerifyBatchEntry;
+
+	/**
+	 * Verify many message signatures at once
+	 *
+	 * This checks a random linear combination of all signatures with one
+	 * multi-scalar multiplication, and signatures by the same key share one
+	 * term. That is several times faster than calling verify() on each. If
+	 * the combined check fails, each signature is checked with verify() to
+	 * find the bad ones.
+	 *
+	 * The combined check differs from verify() only for signatures whose R
+	 * point has a small-order component added. Only the holder of the
+	 * private key, or someone altering an otherwise valid signature, can
+	 * produce such a point.
+	 *
+	 * @param entries Signatures to verify
+	 * @param n Number of entries
+	 * @param valid If non-NULL, filled with whether each signature is valid
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(const VerifyBatchEntry *entries,unsigned int n,bool *valid);
+
 private:
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
@@ -30,6 +30,7 @@
 #include "Topology.hpp"
 #include "Switch.hpp"
 #include "Network.hpp"
+#include "SignatureBatch.hpp"
 
 namespace ZeroTier {
 
@@ -56,7 +57,7 @@ int Capability::verify(const RuntimeEnvironment *RR,void *tPtr) const
 
 			const Identity id(RR->topology->getIdentity(tPtr,_custody[c].from));
 			if (id) {
-				if (!id.verify(tmp.data(),tmp.size(),_custody[c].signature))
+				if (!RR->sc->verify(id,tmp.data(),tmp.size(),_custody[c].signature))
 					return -1;
 			} else {
 				RR->sw->requestWhois(tPtr,_custody[c].from);
@@ -70,4 +71,21 @@ int Capability::verify(const RuntimeEnvironment *RR,void *tPtr) const
 	return -1;
 }
 
+void Capability::addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const
+{
+	if ((_maxCustodyChainLength < 1)||(_maxCustodyChainLength > ZT_MAX_CAPABILITY_CUSTODY_CHAIN_LENGTH))
+		return;
+	try {
+		Buffer<(sizeof(Capability) * 2)> tmp;
+		this->serialize(tmp,true);
+		for(unsigned int c=0;c<_maxCustodyChainLength;++c) {
+			if ((!_custody[c].to)||(!_custody[c].from))
+				return;
+			const Identity id(RR->topology->getIdentity(tPtr,_custody[c].from));
+			if (id)
+				batch.add(id,tmp.data(),tmp.size(),_custody[c].signature);
+		}
+	} catch ( ... ) {}
+}
+
 } // namespace ZeroTier
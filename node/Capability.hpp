@@ -40,9 +40,24 @@
 #include "Identity.hpp"
 #include "../include/ZeroTierOne.h"
 
+/**
+ * Wire layout of the fixed-size head of a capability, ahead of its rules
+ */
+#define ZT_CAPABILITY_WIRE_IDX_NETWORK_ID 0
+#define ZT_CAPABILITY_WIRE_IDX_TIMESTAMP 8
+#define ZT_CAPABILITY_WIRE_IDX_ID 16
+#define ZT_CAPABILITY_WIRE_IDX_RULE_COUNT 20
+#define ZT_CAPABILITY_WIRE_HEAD_LENGTH 22
+
+/**
+ * Length of a custody chain entry: to, from and signature
+ */
+#define ZT_CAPABILITY_WIRE_CUSTODY_LENGTH ((ZT_ADDRESS_LENGTH * 2) + ZT_CREDENTIAL_WIRE_SIGNATURE_LENGTH)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * A set of grouped and signed network flow rules
@@ -174,6 +189,17 @@ public:
 	 */
 	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
 
+	/**
+	 * Add this capability's signatures to a batch where the signers are known
+	 *
+	 * This only makes a later verify() cheaper and does not replace it.
+	 *
+	 * @param RR Runtime environment to allow identity lookup for signers
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch Batch to add to
+	 */
+	void addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const;
+
 	template<unsigned int C>
 	static inline void serializeRules(Buffer<C> &b,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
 	{
@@ -378,22 +404,22 @@ public:
 		if (forSign) b.append((uint64_t)0x7f7f7f7f7f7f7f7fULL);
 
 		// These are the same between Tag and Capability
-		b.append(_nwid);
-		b.append(_ts);
-		b.append(_id);
+		uint8_t *const h = reinterpret_cast<uint8_t *>(b.appendField(ZT_CAPABILITY_WIRE_HEAD_LENGTH));
+		Utils::storeBigEndian<uint64_t>(h + ZT_CAPABILITY_WIRE_IDX_NETWORK_ID,_nwid);
+		Utils::storeBigEndian<uint64_t>(h + ZT_CAPABILITY_WIRE_IDX_TIMESTAMP,_ts);
+		Utils::storeBigEndian<uint32_t>(h + ZT_CAPABILITY_WIRE_IDX_ID,_id);
+		Utils::storeBigEndian<uint16_t>(h + ZT_CAPABILITY_WIRE_IDX_RULE_COUNT,(uint16_t)_ruleCount);
 
-		b.append((uint16_t)_ruleCount);
 		serializeRules(b,_rules,_ruleCount);
 		b.append((uint8_t)_maxCustodyChainLength);
 
 		if (!forSign) {
 			for(unsigned int i=0;;++i) {
 				if ((i < _maxCustodyChainLength)&&(i < ZT_MAX_CAPABILITY_CUSTODY_CHAIN_LENGTH)&&(_custody[i].to)) {
-					_custody[i].to.appendTo(b);
-					_custody[i].from.appendTo(b);
-					b.append((uint8_t)1); // 1 == Ed25519 signature
-					b.append((uint16_t)ZT_C25519_SIGNATURE_LEN); // length of signature
-					b.append(_custody[i].signature.data,ZT_C25519_SIGNATURE_LEN);
+					uint8_t *const c = reinterpret_cast<uint8_t *>(b.appendField(ZT_ADDRESS_LENGTH * 2));
+					_custody[i].to.copyTo(c,ZT_ADDRESS_LENGTH);
+					_custody[i].from.copyTo(c + ZT_ADDRESS_LENGTH,ZT_ADDRESS_LENGTH);
+					_appendSignature(b,_custody[i].signature);
 				} else {
 					b.append((unsigned char)0,ZT_ADDRESS_LENGTH); // zero 'to' terminates chain
 					break;
@@ -414,11 +440,12 @@ public:
 
 		unsigned int p = startAt;
 
-		_nwid = b.template at<uint64_t>(p); p += 8;
-		_ts = b.template at<uint64_t>(p); p += 8;
-		_id = b.template at<uint32_t>(p); p += 4;
-
-		const unsigned int rc = b.template at<uint16_t>(p); p += 2;
+		const uint8_t *const h = b.field(p,ZT_CAPABILITY_WIRE_HEAD_LENGTH);
+		_nwid = Utils::loadBigEndian<uint64_t>(h + ZT_CAPABILITY_WIRE_IDX_NETWORK_ID);
+		_ts = Utils::loadBigEndian<uint64_t>(h + ZT_CAPABILITY_WIRE_IDX_TIMESTAMP);
+		_id = Utils::loadBigEndian<uint32_t>(h + ZT_CAPABILITY_WIRE_IDX_ID);
+		const unsigned int rc = Utils::loadBigEndian<uint16_t>(h + ZT_CAPABILITY_WIRE_IDX_RULE_COUNT);
+		p += ZT_CAPABILITY_WIRE_HEAD_LENGTH;
 		if (rc > ZT_MAX_CAPABILITY_RULES)
 			throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
 		deserializeRules(b,p,_rules,_ruleCount,rc);
@@ -435,14 +462,7 @@ public:
 				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
 			_custody[i].to = to;
 			_custody[i].from.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-			if (b[p++] == 1) {
-				if (b.template at<uint16_t>(p) != ZT_C25519_SIGNATURE_LEN)
-					throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_CRYPTOGRAPHIC_TOKEN;
-				p += 2;
-				memcpy(_custody[i].signature.data,b.field(p,ZT_C25519_SIGNATURE_LEN),ZT_C25519_SIGNATURE_LEN); p += ZT_C25519_SIGNATURE_LEN;
-			} else {
-				p += 2 + b.template at<uint16_t>(p);
-			}
+			p = _readSignature(b,p,_custody[i].signature);
 		}
 
 		p += 2 + b.template at<uint16_t>(p);
@@ -0,0 +1,217 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "Capture.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+// pcapng is written in host byte order, which readers tell from the section header
+static inline void _pcapng16(std::string &out,const uint16_t v) { out.append(reinterpret_cast<const char *>(&v),2); }
+static inline void _pcapng32(std::string &out,const uint32_t v) { out.append(reinterpret_cast<const char *>(&v),4); }
+
+static inline void _pcapngOption(std::string &out,const uint16_t code,const void *data,const unsigned int len)
+{
+	_pcapng16(out,code);
+	_pcapng16(out,(uint16_t)len);
+	out.append(reinterpret_cast<const char *>(data),len);
+	out.append((4 - (len & 3)) & 3,(char)0);
+}
+
+// Appends a block given its body, which must be a multiple of 4 bytes long
+static inline void _pcapngBlock(std::string &out,const uint32_t type,const std::string &body)
+{
+	const uint32_t total = (uint32_t)body.length() + 12;
+	_pcapng32(out,type);
+	_pcapng32(out,total);
+	out.append(body);
+	_pcapng32(out,total);
+}
+
+Capture::Capture() :
+	_enabled(false),
+	_last(0)
+{
+}
+
+void Capture::start(const Filter &f)
+{
+	Mutex::Lock _l(_lock);
+	_enabled = false;
+	_filter = f;
+	_filter.snapLength = std::max(std::min(_filter.snapLength,(unsigned int)ZT_CAPTURE_MAX_SNAP_LENGTH),18U);
+	_frames.clear();
+	_frames.resize(ZT_CAPTURE_FRAMES);
+	for(std::vector<_Frame>::iterator fr(_frames.begin());fr!=_frames.end();++fr)
+		fr->seq = 0;
+	std::vector<uint8_t>(ZT_CAPTURE_FRAMES * _filter.snapLength).swap(_data);
+	_last = 0;
+	_enabled = true;
+}
+
+void Capture::stop()
+{
+	Mutex::Lock _l(_lock);
+	_enabled = false;
+	std::vector<_Frame>().swap(_frames);
+	std::vector<uint8_t>().swap(_data);
+}
+
+void Capture::filter(Filter &f) const
+{
+	Mutex::Lock _l(_lock);
+	f = _filter;
+}
+
+uint64_t Capture::last() const
+{
+	Mutex::Lock _l(_lock);
+	return _last;
+}
+
+bool Capture::wants(const uint64_t networkId,const bool inbound,const uint64_t peer,const unsigned int etherType,const int verdict) const
+{
+	Mutex::Lock _l(_lock);
+	return ( (_enabled) &&
+	         ((!_filter.networkId)||(_filter.networkId == networkId)) &&
+	         ((inbound) ? _filter.inbound : _filter.outbound) &&
+	         ((!_filter.peer)||(_filter.peer == peer)) &&
+	         ((!_filter.etherType)||(_filter.etherType == etherType)) &&
+	         ((!_filter.dropsOnly)||(verdict == 0)) );
+}
+
+void Capture::record(const uint64_t now,const uint64_t networkId,const bool inbound,const int verdict,const uint64_t peer,const InetAddress &path,const MAC &macSource,const MAC &macDest,const unsigned int etherType,const unsigned int vlanId,const void *data,const unsigned int len)
+{
+	Mutex::Lock _l(_lock);
+	if ((!_enabled)||(_frames.empty()))
+		return;
+
+	const uint64_t seq = ++_last;
+	_Frame &fr = _frames[(unsigned long)((seq - 1) % ZT_CAPTURE_FRAMES)];
+	uint8_t *const d = &(_data[(unsigned long)((seq - 1) % ZT_CAPTURE_FRAMES) * _filter.snapLength]);
+
+	// Rebuild the Ethernet header the frame had on the tap
+	uint8_t eh[18];
+	unsigned int ehl = 12;
+	macDest.copyTo(eh,6);
+	macSource.copyTo(eh + 6,6);
+	if (vlanId) {
+		eh[ehl++] = 0x81;
+		eh[ehl++] = 0x00;
+		eh[ehl++] = (uint8_t)((vlanId >> 8) & 0x0f);
+		eh[ehl++] = (uint8_t)(vlanId & 0xff);
+	}
+	eh[ehl++] = (uint8_t)((etherType >> 8) & 0xff);
+	eh[ehl++] = (uint8_t)(etherType & 0xff);
+
+	const unsigned int hl = std::min(ehl,_filter.snapLength);
+	memcpy(d,eh,hl);
+	const unsigned int pl = std::min(len,_filter.snapLength - hl);
+	memcpy(d + hl,data,pl);
+
+	fr.seq = seq;
+	fr.timestamp = now;
+	fr.networkId = networkId;
+	fr.peer = peer;
+	fr.path = path;
+	fr.len = ehl + len;
+	fr.capLen = hl + pl;
+	fr.etherType = etherType;
+	fr.verdict = verdict;
+	fr.inbound = inbound;
+}
+
+unsigned int Capture::pcapng(uint64_t since,uint64_t until,const bool header,std::string &out) const
+{
+	std::string body;
+
+	Mutex::Lock _l(_lock);
+
+	if (header) {
+		// Section header block: byte order magic, version 1.0, unknown section length
+		_pcapng32(body,0x1a2b3c4d);
+		_pcapng16(body,1);
+		_pcapng16(body,0);
+		_pcapng32(body,0xffffffff);
+		_pcapng32(body,0xffffffff);
+		_pcapngOption(body,4,"ZeroTier One",12); // shb_userappl
+		_pcapngOption(body,0,"",0);
+		_pcapngBlock(out,0x0a0d0d0a,body);
+
+		// Interface description block: Ethernet, with timestamps in milliseconds
+		body.clear();
+		_pcapng16(body,1); // LINKTYPE_ETHERNET
+		_pcapng16(body,0);
+		_pcapng32(body,_filter.snapLength);
+		_pcapngOption(body,2,"zerotier",8); // if_name
+		const uint8_t tsresol = 3;
+		_pcapngOption(body,9,&tsresol,1); // if_tsresol
+		_pcapngOption(body,0,"",0);
+		_pcapngBlock(out,0x00000001,body);
+	}
+
+	if (_frames.empty())
+		return 0;
+	until = std::min(until,_last);
+	if ((until - std::min(since,until)) > ZT_CAPTURE_FRAMES)
+		since = until - ZT_CAPTURE_FRAMES;
+
+	unsigned int n = 0;
+	std::string comment;
+	char tmp[64];
+	for(uint64_t seq=since+1;seq<=until;++seq) {
+		const _Frame &fr = _frames[(unsigned long)((seq - 1) % ZT_CAPTURE_FRAMES)];
+		if (fr.seq != seq)
+			continue;
+		const uint8_t *const d = &(_data[(unsigned long)((seq - 1) % ZT_CAPTURE_FRAMES) * _filter.snapLength]);
+
+		// Enhanced packet block with network, direction, peer, path and verdict in the comment
+		body.clear();
+		_pcapng32(body,0); // interface ID
+		_pcapng32(body,(uint32_t)(fr.timestamp >> 32));
+		_pcapng32(body,(uint32_t)fr.timestamp);
+		_pcapng32(body,fr.capLen);
+		_pcapng32(body,fr.len);
+		body.append(reinterpret_cast<const char *>(d),fr.capLen);
+		body.append((4 - (fr.capLen & 3)) & 3,(char)0);
+		comment.assign("nwid=").append(Utils::hex(fr.networkId,tmp));
+		comment.append((fr.inbound) ? " dir=in peer=" : " dir=out peer=").append(Utils::hex10(fr.peer,tmp));
+		comment.append(" path=").append((fr.path) ? fr.path.toString(tmp) : "-");
+		comment.append(" verdict=").append((fr.verdict == 0) ? "drop" : ((fr.verdict == 2) ? "accept-bridged" : "accept"));
+		_pcapngOption(body,1,comment.data(),(unsigned int)comment.length()); // opt_comment
+		_pcapngOption(body,0,"",0);
+		_pcapngBlock(out,0x00000006,body);
+		++n;
+	}
+
+	return n;
+}
+
+} // namespace ZeroTier
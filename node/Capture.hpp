@@ -0,0 +1,199 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_CAPTURE_HPP
+#define ZT_CAPTURE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "InetAddress.hpp"
+#include "MAC.hpp"
+#include "Mutex.hpp"
+
+/**
+ * Number of frames kept while capturing
+ */
+#define ZT_CAPTURE_FRAMES 1024
+
+/**
+ * Default bytes kept of each frame, which is all of a frame at the default MTU
+ */
+#define ZT_CAPTURE_DEFAULT_SNAP_LENGTH (ZT_DEFAULT_MTU + 18)
+
+/**
+ * Most bytes kept of each frame (Ethernet header with VLAN tag plus the largest MTU)
+ */
+#define ZT_CAPTURE_MAX_SNAP_LENGTH (ZT_MAX_MTU + 18)
+
+namespace ZeroTier {
+
+/**
+ * Capture of virtual network frames as they pass the rules engine
+ *
+ * A capture on the tap can't show which peer and path a frame came from or
+ * went to, or frames the rules dropped, and one on the physical interface
+ * only shows ciphertext. This records frames at filterIncomingPacket() and
+ * filterOutgoingPacket() along with the network, direction, peer, physical
+ * path and verdict, and writes them out as pcapng with that in each frame's
+ * comment, for Wireshark or tcpdump.
+ *
+ * While off, which is the default, the cost on the packet paths is one read
+ * of a flag. While on, frames matching the filter are copied into a ring of
+ * the last ZT_CAPTURE_FRAMES under a lock. The ring is only allocated while
+ * capturing.
+ */
+class Capture : NonCopyable
+{
+public:
+	/**
+	 * Which frames to capture
+	 */
+	struct Filter
+	{
+		Filter() :
+			networkId(0),
+			peer(0),
+			etherType(0),
+			inbound(true),
+			outbound(true),
+			dropsOnly(false),
+			snapLength(ZT_CAPTURE_DEFAULT_SNAP_LENGTH) {}
+
+		uint64_t networkId;      // or 0 for all networks
+		uint64_t peer;           // ZeroTier address of remote peer, or 0 for all
+		unsigned int etherType;  // or 0 for all
+		bool inbound;
+		bool outbound;
+		bool dropsOnly;          // only frames the rules dropped
+		unsigned int snapLength; // bytes kept of each frame including its Ethernet header
+	};
+
+	Capture();
+
+	/**
+	 * Start capturing, discarding anything already captured
+	 *
+	 * @param f Frames to capture
+	 */
+	void start(const Filter &f);
+
+	/**
+	 * Stop capturing and free the ring
+	 */
+	void stop();
+
+	/**
+	 * @return True if capturing (checked on the packet paths before anything else)
+	 */
+	inline bool enabled() const { return _enabled; }
+
+	/**
+	 * @param f Filter in use or last used
+	 */
+	void filter(Filter &f) const;
+
+	/**
+	 * @return Sequence number of the last frame captured (frames are numbered from 1)
+	 */
+	uint64_t last() const;
+
+	/**
+	 * Check a frame against the filter, so work to find its path can be skipped
+	 *
+	 * @param networkId Network ID
+	 * @param inbound True if from a peer, false if from our tap
+	 * @param peer Remote peer's ZeroTier address, or 0 if not known (multicast)
+	 * @param etherType Ethernet frame type
+	 * @param verdict Rules engine result: 0 drop, 1 accept, 2 accept even if bridged
+	 * @return True if this frame should be recorded
+	 */
+	bool wants(const uint64_t networkId,const bool inbound,const uint64_t peer,const unsigned int etherType,const int verdict) const;
+
+	/**
+	 * Record a frame wanted by wants()
+	 *
+	 * @param now Current time
+	 * @param networkId Network ID
+	 * @param inbound True if from a peer, false if from our tap
+	 * @param verdict Rules engine result
+	 * @param peer Remote peer's ZeroTier address or 0
+	 * @param path Physical address of the path to or from the peer, or nil if not known
+	 * @param macSource Ethernet source
+	 * @param macDest Ethernet destination
+	 * @param etherType Ethernet frame type
+	 * @param vlanId VLAN ID or 0
+	 * @param data Frame payload
+	 * @param len Length of frame payload
+	 */
+	void record(const uint64_t now,const uint64_t networkId,const bool inbound,const int verdict,const uint64_t peer,const InetAddress &path,const MAC &macSource,const MAC &macDest,const unsigned int etherType,const unsigned int vlanId,const void *data,const unsigned int len);
+
+	/**
+	 * Write captured frames out as pcapng
+	 *
+	 * Each frame's comment holds its network, direction, peer, path and
+	 * verdict. Frames already overwritten in the ring are skipped. To follow a
+	 * capture, get last() and pass it as 'until' here and as 'since' next time,
+	 * with a header only the first time.
+	 *
+	 * @param since Write frames after this sequence number (0 for all)
+	 * @param until Write frames up to and including this sequence number
+	 * @param header If true, start with the section header and interface description
+	 * @param out pcapng data is appended here
+	 * @return Number of frames written
+	 */
+	unsigned int pcapng(uint64_t since,uint64_t until,const bool header,std::string &out) const;
+
+private:
+	struct _Frame
+	{
+		uint64_t seq;
+		uint64_t timestamp;
+		uint64_t networkId;
+		uint64_t peer;
+		InetAddress path;
+		unsigned int len;    // original length including Ethernet header
+		unsigned int capLen; // bytes kept in _data
+		unsigned int etherType;
+		int verdict;
+		bool inbound;
+	};
+
+	volatile bool _enabled;
+	Filter _filter;
+	std::vector<_Frame> _frames;
+	std::vector<uint8_t> _data; // _filter.snapLength bytes per frame
+	uint64_t _last;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
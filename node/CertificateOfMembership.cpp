@@ -29,6 +29,7 @@
 #include "Topology.hpp"
 #include "Switch.hpp"
 #include "Network.hpp"
+#include "SignatureBatch.hpp"
 
 namespace ZeroTier {
 
@@ -234,7 +235,26 @@ int CertificateOfMembership::verify(const RuntimeEnvironment *RR,void *tPtr) con
 		buf[ptr++] = Utils::hton(_qualifiers[i].value);
 		buf[ptr++] = Utils::hton(_qualifiers[i].maxDelta);
 	}
-	return (id.verify(buf,ptr * sizeof(uint64_t),_signature) ? 0 : -1);
+	return (RR->sc->verify(id,buf,ptr * sizeof(uint64_t),_signature) ? 0 : -1);
+}
+
+void CertificateOfMembership::addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const
+{
+	if ((!_signedBy)||(_signedBy != Network::controllerFor(networkId()))||(_qualifierCount > ZT_NETWORK_COM_MAX_QUALIFIERS))
+		return;
+
+	const Identity id(RR->topology->getIdentity(tPtr,_signedBy));
+	if (!id)
+		return;
+
+	uint64_t buf[ZT_NETWORK_COM_MAX_QUALIFIERS * 3];
+	unsigned int ptr = 0;
+	for(unsigned int i=0;i<_qualifierCount;++i) {
+		buf[ptr++] = Utils::hton(_qualifiers[i].id);
+		buf[ptr++] = Utils::hton(_qualifiers[i].value);
+		buf[ptr++] = Utils::hton(_qualifiers[i].maxDelta);
+	}
+	batch.add(id,buf,ptr * sizeof(uint64_t),_signature);
 }
 
 } // namespace ZeroTier
@@ -47,9 +47,15 @@
  */
 #define ZT_NETWORK_COM_MAX_QUALIFIERS 8
 
+/**
+ * Length of a qualifier on the wire: ID, value and max delta
+ */
+#define ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH 24
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Certificate of network membership
@@ -271,6 +277,17 @@ public:
 	 */
 	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
 
+	/**
+	 * Add this certificate's signature to a batch if the signer is known
+	 *
+	 * This only makes a later verify() cheaper and does not replace it.
+	 *
+	 * @param RR Runtime environment to allow identity lookup for signers
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch Batch to add to
+	 */
+	void addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const;
+
 	/**
 	 * @return True if signed
 	 */
@@ -284,14 +301,18 @@ public:
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b) const
 	{
-		b.append((uint8_t)1);
-		b.append((uint16_t)_qualifierCount);
+		// Everything up to the signature is fixed size once the count is known
+		uint8_t *h = reinterpret_cast<uint8_t *>(b.appendField(3 + (_qualifierCount * ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH) + ZT_ADDRESS_LENGTH));
+		h[0] = 1;
+		Utils::storeBigEndian<uint16_t>(h + 1,(uint16_t)_qualifierCount);
+		h += 3;
 		for(unsigned int i=0;i<_qualifierCount;++i) {
-			b.append(_qualifiers[i].id);
-			b.append(_qualifiers[i].value);
-			b.append(_qualifiers[i].maxDelta);
+			Utils::storeBigEndian<uint64_t>(h,_qualifiers[i].id);
+			Utils::storeBigEndian<uint64_t>(h + 8,_qualifiers[i].value);
+			Utils::storeBigEndian<uint64_t>(h + 16,_qualifiers[i].maxDelta);
+			h += ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH;
 		}
-		_signedBy.appendTo(b);
+		_signedBy.copyTo(h,ZT_ADDRESS_LENGTH);
 		if (_signedBy)
 			b.append(_signature.data,(unsigned int)_signature.size());
 	}
@@ -307,25 +328,26 @@ public:
 		if (b[p++] != 1)
 			throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_TYPE;
 
-		unsigned int numq = b.template at<uint16_t>(p); p += sizeof(uint16_t);
+		const unsigned int numq = b.template at<uint16_t>(p); p += sizeof(uint16_t);
+		if (numq > ZT_NETWORK_COM_MAX_QUALIFIERS)
+			throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
+
+		const uint8_t *h = b.field(p,(numq * ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH) + ZT_ADDRESS_LENGTH);
 		uint64_t lastId = 0;
 		for(unsigned int i=0;i<numq;++i) {
-			const uint64_t qid = b.template at<uint64_t>(p);
+			const uint64_t qid = Utils::loadBigEndian<uint64_t>(h);
 			if (qid < lastId)
 				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_BAD_ENCODING;
 			else lastId = qid;
-			if (_qualifierCount < ZT_NETWORK_COM_MAX_QUALIFIERS) {
-				_qualifiers[_qualifierCount].id = qid;
-				_qualifiers[_qualifierCount].value = b.template at<uint64_t>(p + 8);
-				_qualifiers[_qualifierCount].maxDelta = b.template at<uint64_t>(p + 16);
-				p += 24;
-				++_qualifierCount;
-			} else {
-				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
-			}
+			_qualifiers[_qualifierCount].id = qid;
+			_qualifiers[_qualifierCount].value = Utils::loadBigEndian<uint64_t>(h + 8);
+			_qualifiers[_qualifierCount].maxDelta = Utils::loadBigEndian<uint64_t>(h + 16);
+			++_qualifierCount;
+			h += ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH;
 		}
+		p += numq * ZT_NETWORK_COM_WIRE_QUALIFIER_LENGTH;
 
-		_signedBy.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+		_signedBy.setTo(h,ZT_ADDRESS_LENGTH);
 		p += ZT_ADDRESS_LENGTH;
 
 		if (_signedBy) {
@@ -47,9 +47,24 @@
 // Maximum size of a thing's value field in bytes
 #define ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE 16
 
+/**
+ * Wire layout of the fixed-size head of a certificate of ownership
+ *
+ * The head is followed by the thing count's worth of things, each a type byte
+ * and a value, then the issued to and signed by addresses and the signature.
+ */
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_NETWORK_ID 0
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_TIMESTAMP 8
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_FLAGS 16
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_ID 24
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_THING_COUNT 28
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_HEAD_LENGTH 30
+#define ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH (1 + ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Certificate indicating ownership of a network identifier
@@ -155,28 +170,40 @@ public:
 	 */
 	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
 
+	/**
+	 * Add this certificate's signature to a batch if the signer is known
+	 *
+	 * This only makes a later verify() cheaper and does not replace it.
+	 *
+	 * @param RR Runtime environment to allow identity lookup for signers
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch Batch to add to
+	 */
+	void addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const;
+
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
 	{
 		if (forSign) b.append((uint64_t)0x7f7f7f7f7f7f7f7fULL);
 
-		b.append(_networkId);
-		b.append(_ts);
-		b.append(_flags);
-		b.append(_id);
-		b.append((uint16_t)_thingCount);
+		// Head, things and addresses are all fixed size once the count is known
+		uint8_t *h = reinterpret_cast<uint8_t *>(b.appendField(ZT_CERTIFICATEOFOWNERSHIP_WIRE_HEAD_LENGTH + (_thingCount * ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH) + (ZT_ADDRESS_LENGTH * 2)));
+		Utils::storeBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_NETWORK_ID,_networkId);
+		Utils::storeBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_TIMESTAMP,_ts);
+		Utils::storeBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_FLAGS,_flags);
+		Utils::storeBigEndian<uint32_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_ID,_id);
+		Utils::storeBigEndian<uint16_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_THING_COUNT,_thingCount);
+		h += ZT_CERTIFICATEOFOWNERSHIP_WIRE_HEAD_LENGTH;
 		for(unsigned int i=0,j=_thingCount;i<j;++i) {
-			b.append((uint8_t)_thingTypes[i]);
-			b.append(_thingValues[i],ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE);
+			*h = _thingTypes[i];
+			memcpy(h + 1,_thingValues[i],ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE);
+			h += ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH;
 		}
+		_issuedTo.copyTo(h,ZT_ADDRESS_LENGTH);
+		_signedBy.copyTo(h + ZT_ADDRESS_LENGTH,ZT_ADDRESS_LENGTH);
 
-		_issuedTo.appendTo(b);
-		_signedBy.appendTo(b);
-		if (!forSign) {
-			b.append((uint8_t)1); // 1 == Ed25519
-			b.append((uint16_t)ZT_C25519_SIGNATURE_LEN); // length of signature
-			b.append(_signature.data,ZT_C25519_SIGNATURE_LEN);
-		}
+		if (!forSign)
+			_appendSignature(b,_signature);
 
 		b.append((uint16_t)0); // length of additional fields, currently 0
 
@@ -190,29 +217,26 @@ public:
 
 		memset(this,0,sizeof(CertificateOfOwnership));
 
-		_networkId = b.template at<uint64_t>(p); p += 8;
-		_ts = b.template at<uint64_t>(p); p += 8;
-		_flags = b.template at<uint64_t>(p); p += 8;
-		_id = b.template at<uint32_t>(p); p += 4;
-		_thingCount = b.template at<uint16_t>(p); p += 2;
-		for(unsigned int i=0,j=_thingCount;i<j;++i) {
-			if (i < ZT_CERTIFICATEOFOWNERSHIP_MAX_THINGS) {
-				_thingTypes[i] = (uint8_t)b[p++];
-				memcpy(_thingValues[i],b.field(p,ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE),ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE);
-				p += ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE;
-			}
-		}
-
-		_issuedTo.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		_signedBy.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		if (b[p++] == 1) {
-			if (b.template at<uint16_t>(p) != ZT_C25519_SIGNATURE_LEN)
-				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_CRYPTOGRAPHIC_TOKEN;
-			p += 2;
-			memcpy(_signature.data,b.field(p,ZT_C25519_SIGNATURE_LEN),ZT_C25519_SIGNATURE_LEN); p += ZT_C25519_SIGNATURE_LEN;
-		} else {
-			p += 2 + b.template at<uint16_t>(p);
+		const uint8_t *h = b.field(p,ZT_CERTIFICATEOFOWNERSHIP_WIRE_HEAD_LENGTH);
+		_networkId = Utils::loadBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_NETWORK_ID);
+		_ts = Utils::loadBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_TIMESTAMP);
+		_flags = Utils::loadBigEndian<uint64_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_FLAGS);
+		_id = Utils::loadBigEndian<uint32_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_ID);
+		const unsigned int tc = Utils::loadBigEndian<uint16_t>(h + ZT_CERTIFICATEOFOWNERSHIP_WIRE_IDX_THING_COUNT);
+		if (tc > ZT_CERTIFICATEOFOWNERSHIP_MAX_THINGS)
+			throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
+		p += ZT_CERTIFICATEOFOWNERSHIP_WIRE_HEAD_LENGTH;
+
+		h = b.field(p,(tc * ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH) + (ZT_ADDRESS_LENGTH * 2));
+		_thingCount = (uint16_t)tc;
+		for(unsigned int i=0;i<tc;++i) {
+			_thingTypes[i] = *h;
+			memcpy(_thingValues[i],h + 1,ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE);
+			h += ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH;
 		}
+		_issuedTo.setTo(h,ZT_ADDRESS_LENGTH);
+		_signedBy.setTo(h + ZT_ADDRESS_LENGTH,ZT_ADDRESS_LENGTH);
+		p = _readSignature(b,p + (tc * ZT_CERTIFICATEOFOWNERSHIP_WIRE_THING_LENGTH) + (ZT_ADDRESS_LENGTH * 2),_signature);
 
 		p += 2 + b.template at<uint16_t>(p);
 		if (p > b.size())
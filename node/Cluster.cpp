@@ -24,8 +24,6 @@
  * of your own application.
  */
 
-#ifdef ZT_ENABLE_CLUSTER
-
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,31 +32,26 @@
 
 #include <map>
 #include <algorithm>
-#include <set>
 #include <utility>
-#include <list>
-#include <stdexcept>
 
 #include "../version.h"
 
 #include "Cluster.hpp"
 #include "RuntimeEnvironment.hpp"
 #include "MulticastGroup.hpp"
-#include "CertificateOfMembership.hpp"
+#include "Multicaster.hpp"
 #include "Salsa20.hpp"
 #include "Poly1305.hpp"
 #include "Identity.hpp"
 #include "Topology.hpp"
 #include "Packet.hpp"
+#include "Peer.hpp"
 #include "Switch.hpp"
 #include "Node.hpp"
-#include "Network.hpp"
-#include "Array.hpp"
 
 namespace ZeroTier {
 
 static inline double _dist3d(int x1,int y1,int z1,int x2,int y2,int z2)
-	throw()
 {
 	double dx = ((double)x2 - (double)x1);
 	double dy = ((double)y2 - (double)y1);
@@ -66,135 +59,6 @@ static inline double _dist3d(int x1,int y1,int z1,int x2,int y2,int z2)
 	return sqrt((dx * dx) + (dy * dy) + (dz * dz));
 }
 
-// An entry in _ClusterSendQueue
-struct _ClusterSendQueueEntry
-{
-	uint64_t timestamp;
-	Address fromPeerAddress;
-	Address toPeerAddress;
-	// if we ever support larger transport MTUs this must be increased
-	unsigned char data[ZT_CLUSTER_SEND_QUEUE_DATA_MAX];
-	unsigned int len;
-	bool unite;
-};
-
-// A multi-index map with entry memory pooling -- this allows our queue to
-// be O(log(N)) and is complex enough that it makes the code a lot cleaner
-// to break it out from Cluster.
-class _ClusterSendQueue
-{
-public:
-	_ClusterSendQueue() :
-		_poolCount(0) {}
-	~_ClusterSendQueue() {} // memory is automatically freed when _chunks is destroyed
-
-	inline void enqueue(uint64_t now,const Address &from,const Address &to,const void *data,unsigned int len,bool unite)
-	{
-		if (len > ZT_CLUSTER_SEND_QUEUE_DATA_MAX)
-			return;
-
-		Mutex::Lock _l(_lock);
-
-		// Delete oldest queue entry for this sender if this enqueue() would take them over the per-sender limit
-		{
-			std::set< std::pair<Address,_ClusterSendQueueEntry *> >::iterator qi(_bySrc.lower_bound(std::pair<Address,_ClusterSendQueueEntry *>(from,(_ClusterSendQueueEntry *)0)));
-			std::set< std::pair<Address,_ClusterSendQueueEntry *> >::iterator oldest(qi);
-			unsigned long countForSender = 0;
-			while ((qi != _bySrc.end())&&(qi->first == from)) {
-				if (qi->second->timestamp < oldest->second->timestamp)
-					oldest = qi;
-				++countForSender;
-				++qi;
-			}
-			if (countForSender >= ZT_CLUSTER_MAX_QUEUE_PER_SENDER) {
-				_byDest.erase(std::pair<Address,_ClusterSendQueueEntry *>(oldest->second->toPeerAddress,oldest->second));
-				_pool[_poolCount++] = oldest->second;
-				_bySrc.erase(oldest);
-			}
-		}
-
-		_ClusterSendQueueEntry *e;
-		if (_poolCount > 0) {
-			e = _pool[--_poolCount];
-		} else {
-			if (_chunks.size() >= ZT_CLUSTER_MAX_QUEUE_CHUNKS)
-				return; // queue is totally full!
-			_chunks.push_back(Array<_ClusterSendQueueEntry,ZT_CLUSTER_QUEUE_CHUNK_SIZE>());
-			e = &(_chunks.back().data[0]);
-			for(unsigned int i=1;i<ZT_CLUSTER_QUEUE_CHUNK_SIZE;++i)
-				_pool[_poolCount++] = &(_chunks.back().data[i]);
-		}
-
-		e->timestamp = now;
-		e->fromPeerAddress = from;
-		e->toPeerAddress = to;
-		memcpy(e->data,data,len);
-		e->len = len;
-		e->unite = unite;
-
-		_bySrc.insert(std::pair<Address,_ClusterSendQueueEntry *>(from,e));
-		_byDest.insert(std::pair<Address,_ClusterSendQueueEntry *>(to,e));
-	}
-
-	inline void expire(uint64_t now)
-	{
-		Mutex::Lock _l(_lock);
-		for(std::set< std::pair<Address,_ClusterSendQueueEntry *> >::iterator qi(_bySrc.begin());qi!=_bySrc.end();) {
-			if ((now - qi->second->timestamp) > ZT_CLUSTER_QUEUE_EXPIRATION) {
-				_byDest.erase(std::pair<Address,_ClusterSendQueueEntry *>(qi->second->toPeerAddress,qi->second));
-				_pool[_poolCount++] = qi->second;
-				_bySrc.erase(qi++);
-			} else ++qi;
-		}
-	}
-
-	/**
-	 * Get and dequeue entries for a given destination address
-	 *
-	 * After use these entries must be returned with returnToPool()!
-	 *
-	 * @param dest Destination address
-	 * @param results Array to fill with results
-	 * @param maxResults Size of results[] in pointers
-	 * @return Number of actual results returned
-	 */
-	inline unsigned int getByDest(const Address &dest,_ClusterSendQueueEntry **results,unsigned int maxResults)
-	{
-		unsigned int count = 0;
-		Mutex::Lock _l(_lock);
-		std::set< std::pair<Address,_ClusterSendQueueEntry *> >::iterator qi(_byDest.lower_bound(std::pair<Address,_ClusterSendQueueEntry *>(dest,(_ClusterSendQueueEntry *)0)));
-		while ((qi != _byDest.end())&&(qi->first == dest)) {
-			_bySrc.erase(std::pair<Address,_ClusterSendQueueEntry *>(qi->second->fromPeerAddress,qi->second));
-			results[count++] = qi->second;
-			if (count == maxResults)
-				break;
-			_byDest.erase(qi++);
-		}
-		return count;
-	}
-
-	/**
-	 * Return entries to pool after use
-	 *
-	 * @param entries Array of entries
-	 * @param count Number of entries
-	 */
-	inline void returnToPool(_ClusterSendQueueEntry **entries,unsigned int count)
-	{
-		Mutex::Lock _l(_lock);
-		for(unsigned int i=0;i<count;++i)
-			_pool[_poolCount++] = entries[i];
-	}
-
-private:
-	std::list< Array<_ClusterSendQueueEntry,ZT_CLUSTER_QUEUE_CHUNK_SIZE> > _chunks;
-	_ClusterSendQueueEntry *_pool[ZT_CLUSTER_QUEUE_CHUNK_SIZE * ZT_CLUSTER_MAX_QUEUE_CHUNKS];
-	unsigned long _poolCount;
-	std::set< std::pair<Address,_ClusterSendQueueEntry *> > _bySrc;
-	std::set< std::pair<Address,_ClusterSendQueueEntry *> > _byDest;
-	Mutex _lock;
-};
-
 Cluster::Cluster(
 	const RuntimeEnvironment *renv,
 	uint16_t id,
@@ -207,7 +71,6 @@ Cluster::Cluster(
 	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
 	void *addressToLocationFunctionArg) :
 	RR(renv),
-	_sendQueue(new _ClusterSendQueue()),
 	_sendFunction(sendFunction),
 	_sendFunctionArg(sendFunctionArg),
 	_addressToLocationFunction(addressToLocationFunction),
@@ -218,6 +81,7 @@ Cluster::Cluster(
 	_id(id),
 	_zeroTierPhysicalEndpoints(zeroTierPhysicalEndpoints),
 	_members(new _Member[ZT_CLUSTER_MAX_MEMBERS]),
+	_queueSize(0),
 	_lastFlushed(0),
 	_lastCleanedRemotePeers(0),
 	_lastCleanedQueue(0)
@@ -241,10 +105,9 @@ Cluster::~Cluster()
 	Utils::burn(_masterSecret,sizeof(_masterSecret));
 	Utils::burn(_key,sizeof(_key));
 	delete [] _members;
-	delete _sendQueue;
 }
 
-void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
+void Cluster::handleIncomingStateMessage(void *tPtr,const void *msg,unsigned int len)
 {
 	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> dmsg;
 	{
@@ -282,7 +145,7 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 		return;
 	const uint16_t fromMemberId = dmsg.at<uint16_t>(0);
 	unsigned int ptr = 2;
-	if (fromMemberId == _id) // sanity check: we don't talk to ourselves
+	if ((fromMemberId == _id)||(fromMemberId >= ZT_CLUSTER_MAX_MEMBERS)) // sanity check: we don't talk to ourselves
 		return;
 	const uint16_t toMemberId = dmsg.at<uint16_t>(ptr);
 	ptr += 2;
@@ -295,6 +158,8 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 			return;
 	}
 
+	const uint64_t now = RR->node->now();
+
 	try {
 		while (ptr < dmsg.size()) {
 			const unsigned int mlen = dmsg.at<uint16_t>(ptr); ptr += 2;
@@ -302,9 +167,8 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 			if (nextPtr > dmsg.size())
 				break;
 
-			int mtype = -1;
 			try {
-				switch((StateMessageType)(mtype = (int)dmsg[ptr++])) {
+				switch((StateMessageType)dmsg[ptr++]) {
 					default:
 						break;
 
@@ -319,65 +183,59 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						m.load = dmsg.at<uint64_t>(ptr); ptr += 8;
 						m.peers = dmsg.at<uint64_t>(ptr); ptr += 8;
 						ptr += 8; // skip flags, unused
-#ifdef ZT_TRACE
-						std::string addrs;
-#endif
 						unsigned int physicalAddressCount = dmsg[ptr++];
 						m.zeroTierPhysicalEndpoints.clear();
 						for(unsigned int i=0;i<physicalAddressCount;++i) {
 							m.zeroTierPhysicalEndpoints.push_back(InetAddress());
 							ptr += m.zeroTierPhysicalEndpoints.back().deserialize(dmsg,ptr);
-							if (!(m.zeroTierPhysicalEndpoints.back())) {
+							if (!(m.zeroTierPhysicalEndpoints.back()))
 								m.zeroTierPhysicalEndpoints.pop_back();
-							}
-#ifdef ZT_TRACE
-							else {
-								if (addrs.length() > 0)
-									addrs.push_back(',');
-								addrs.append(m.zeroTierPhysicalEndpoints.back().toString());
-							}
-#endif
 						}
-#ifdef ZT_TRACE
-						if ((RR->node->now() - m.lastReceivedAliveAnnouncement) >= ZT_CLUSTER_TIMEOUT) {
-							TRACE("[%u] I'm alive! peers close to %d,%d,%d can be redirected to: %s",(unsigned int)fromMemberId,m.x,m.y,m.z,addrs.c_str());
-						}
-#endif
-						m.lastReceivedAliveAnnouncement = RR->node->now();
+						m.lastReceivedAliveAnnouncement = now;
 					}	break;
 
 					case CLUSTER_MESSAGE_HAVE_PEER: {
 						Identity id;
 						ptr += id.deserialize(dmsg,ptr);
-						if (id) {
+						if ((id)&&(id.address() != RR->identity.address())) {
+							bool isNew;
 							{
 								Mutex::Lock _l(_remotePeers_m);
 								_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(id.address(),(unsigned int)fromMemberId)];
-								if (!rp.lastHavePeerReceived) {
-									RR->topology->saveIdentity((void *)0,id);
-									RR->identity.agree(id,rp.key,ZT_PEER_SECRET_KEY_LENGTH);
-								}
-								rp.lastHavePeerReceived = RR->node->now();
+								isNew = (!rp.lastHavePeerReceived);
+								rp.lastHavePeerReceived = now;
 							}
+							if (isNew)
+								RR->topology->addIdentity(tPtr,id);
 
-							_ClusterSendQueueEntry *q[16384]; // 16384 is "tons"
-							unsigned int qc = _sendQueue->getByDest(id.address(),q,16384);
-							for(unsigned int i=0;i<qc;++i)
-								this->relayViaCluster(q[i]->fromPeerAddress,q[i]->toPeerAddress,q[i]->data,q[i]->len,q[i]->unite);
-							_sendQueue->returnToPool(q,qc);
-
-							TRACE("[%u] has %s (retried %u queued sends)",(unsigned int)fromMemberId,id.address().toString().c_str(),qc);
+							// Anything waiting for this peer can go now
+							std::vector<_QueuedRelay> waiting;
+							{
+								Mutex::Lock _l(_queue_m);
+								std::vector<_QueuedRelay> *const q = _queue.get(id.address());
+								if (q) {
+									waiting.swap(*q);
+									_queueSize -= (unsigned long)waiting.size();
+									_queue.erase(id.address());
+								}
+							}
+							for(std::vector<_QueuedRelay>::const_iterator qr(waiting.begin());qr!=waiting.end();++qr)
+								this->relayViaCluster(tPtr,qr->fromPeerAddress,id.address(),qr->data.data(),(unsigned int)qr->data.length(),qr->unite);
 						}
 					}	break;
 
 					case CLUSTER_MESSAGE_WANT_PEER: {
 						const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
-						SharedPtr<Peer> peer(RR->topology->getPeerNoCache(zeroTierAddress));
-						if ( (peer) && (peer->hasLocalClusterOptimalPath(RR->node->now())) ) {
-							Buffer<1024> buf;
-							peer->identity().serialize(buf);
-							Mutex::Lock _l2(_members[fromMemberId].lock);
-							_send(fromMemberId,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+						const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(zeroTierAddress));
+						if (peer) {
+							// Only claim peers we reach directly, not through another member
+							const SharedPtr<Path> bp(peer->getBestPath(now,false));
+							if ((bp)&&(bp->alive(now))&&(!isClusterPeerFrontplane(bp->address()))) {
+								Buffer<1024> buf;
+								peer->identity().serialize(buf);
+								Mutex::Lock _l2(_members[fromMemberId].lock);
+								_send(fromMemberId,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+							}
 						}
 					}	break;
 
@@ -385,9 +243,8 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						const unsigned int plen = dmsg.at<uint16_t>(ptr); ptr += 2;
 						if (plen) {
 							Packet remotep(dmsg.field(ptr,plen),plen); ptr += plen;
-							//TRACE("remote %s from %s via %u (%u bytes)",Packet::verbString(remotep.verb()),remotep.source().toString().c_str(),fromMemberId,plen);
 							switch(remotep.verb()) {
-								case Packet::VERB_WHOIS:            _doREMOTE_WHOIS(fromMemberId,remotep); break;
+								case Packet::VERB_WHOIS:            _doREMOTE_WHOIS(tPtr,fromMemberId,remotep); break;
 								case Packet::VERB_MULTICAST_GATHER: _doREMOTE_MULTICAST_GATHER(fromMemberId,remotep); break;
 								default: break; // ignore things we don't care about across cluster
 							}
@@ -398,34 +255,21 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						const Address localPeerAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
 						const Address remotePeerAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
 						const unsigned int numRemotePeerPaths = dmsg[ptr++];
-						InetAddress remotePeerPaths[256]; // size is 8-bit, so 256 is max
-						for(unsigned int i=0;i<numRemotePeerPaths;++i)
-							ptr += remotePeerPaths[i].deserialize(dmsg,ptr);
-
-						TRACE("[%u] requested that we unite local %s with remote %s",(unsigned int)fromMemberId,localPeerAddress.toString().c_str(),remotePeerAddress.toString().c_str());
+						InetAddress bestRemoteV4,bestRemoteV6;
+						for(unsigned int i=0;i<numRemotePeerPaths;++i) {
+							InetAddress a;
+							ptr += a.deserialize(dmsg,ptr);
+							if ((a.ss_family == AF_INET)&&(!bestRemoteV4))
+								bestRemoteV4 = a;
+							else if ((a.ss_family == AF_INET6)&&(!bestRemoteV6))
+								bestRemoteV6 = a;
+						}
 
-						const uint64_t now = RR->node->now();
-						SharedPtr<Peer> localPeer(RR->topology->getPeerNoCache(localPeerAddress));
-						if ((localPeer)&&(numRemotePeerPaths > 0)) {
+						const SharedPtr<Peer> localPeer(RR->topology->getPeerNoCache(localPeerAddress));
+						if (localPeer) {
 							InetAddress bestLocalV4,bestLocalV6;
 							localPeer->getRendezvousAddresses(now,bestLocalV4,bestLocalV6);
 
-							InetAddress bestRemoteV4,bestRemoteV6;
-							for(unsigned int i=0;i<numRemotePeerPaths;++i) {
-								if ((bestRemoteV4)&&(bestRemoteV6))
-									break;
-								switch(remotePeerPaths[i].ss_family) {
-									case AF_INET:
-										if (!bestRemoteV4)
-											bestRemoteV4 = remotePeerPaths[i];
-										break;
-									case AF_INET6:
-										if (!bestRemoteV6)
-											bestRemoteV6 = remotePeerPaths[i];
-										break;
-								}
-							}
-
 							Packet rendezvousForLocal(localPeerAddress,RR->identity.address(),Packet::VERB_RENDEZVOUS);
 							rendezvousForLocal.append((uint8_t)0);
 							remotePeerAddress.appendTo(rendezvousForLocal);
@@ -467,7 +311,7 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 									Mutex::Lock _l2(_members[fromMemberId].lock);
 									_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,rendezvousForRemote.data(),rendezvousForRemote.size());
 								}
-								RR->sw->send((void *)0,rendezvousForLocal,true);
+								RR->sw->send(tPtr,rendezvousForLocal,true);
 							}
 						}
 					}	break;
@@ -475,33 +319,17 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 					case CLUSTER_MESSAGE_PROXY_SEND: {
 						const Address rcpt(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
 						const Packet::Verb verb = (Packet::Verb)dmsg[ptr++];
-						const unsigned int len = dmsg.at<uint16_t>(ptr); ptr += 2;
+						const unsigned int plen = dmsg.at<uint16_t>(ptr); ptr += 2;
 						Packet outp(rcpt,RR->identity.address(),verb);
-						outp.append(dmsg.field(ptr,len),len); ptr += len;
-						RR->sw->send((void *)0,outp,true);
-						//TRACE("[%u] proxy send %s to %s length %u",(unsigned int)fromMemberId,Packet::verbString(verb),rcpt.toString().c_str(),len);
-					}	break;
-
-					case CLUSTER_MESSAGE_NETWORK_CONFIG: {
-						const SharedPtr<Network> network(RR->node->network(dmsg.at<uint64_t>(ptr)));
-						if (network) {
-							// Copy into a Packet just to conform to Network API. Eventually
-							// will want to refactor.
-							network->handleConfigChunk((void *)0,0,Address(),Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(dmsg),ptr);
-						}
+						outp.append(dmsg.field(ptr,plen),plen); ptr += plen;
+						RR->sw->send(tPtr,outp,true);
 					}	break;
 				}
-			} catch ( ... ) {
-				TRACE("invalid message of size %u type %d (inner decode), discarding",mlen,mtype);
-				// drop invalids
-			}
+			} catch ( ... ) {} // invalid messages are dropped, the rest of the datagram is still processed
 
 			ptr = nextPtr;
 		}
-	} catch ( ... ) {
-		TRACE("invalid message (outer loop), discarding");
-		// drop invalids
-	}
+	} catch ( ... ) {} // invalid messages are dropped
 }
 
 void Cluster::broadcastHavePeer(const Identity &id)
@@ -515,192 +343,100 @@ void Cluster::broadcastHavePeer(const Identity &id)
 	}
 }
 
-void Cluster::broadcastNetworkConfigChunk(const void *chunk,unsigned int len)
-{
-	Mutex::Lock _l(_memberIds_m);
-	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-		Mutex::Lock _l2(_members[*mid].lock);
-		_send(*mid,CLUSTER_MESSAGE_NETWORK_CONFIG,chunk,len);
-	}
-}
-
-int Cluster::checkSendViaCluster(const Address &toPeerAddress,uint64_t &mostRecentTs,void *peerSecret)
+int Cluster::checkSendViaCluster(const Address &toPeerAddress)
 {
 	const uint64_t now = RR->node->now();
-	mostRecentTs = 0;
-	int mostRecentMemberId = -1;
-	{
-		Mutex::Lock _l2(_remotePeers_m);
-		std::map< std::pair<Address,unsigned int>,_RemotePeer >::const_iterator rpe(_remotePeers.lower_bound(std::pair<Address,unsigned int>(toPeerAddress,0)));
-		for(;;) {
-			if ((rpe == _remotePeers.end())||(rpe->first.first != toPeerAddress))
-				break;
-			else if (rpe->second.lastHavePeerReceived > mostRecentTs) {
-				mostRecentTs = rpe->second.lastHavePeerReceived;
-				memcpy(peerSecret,rpe->second.key,ZT_PEER_SECRET_KEY_LENGTH);
-				mostRecentMemberId = (int)rpe->first.second;
-			}
-			++rpe;
-		}
-	}
-
-	const uint64_t ageOfMostRecentHavePeerAnnouncement = now - mostRecentTs;
-	if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
-		if (ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)
+	uint64_t mostRecentTs = 0;
+	int mostRecentMemberId = _mostRecentHolder(toPeerAddress,mostRecentTs);
+	const uint64_t age = now - mostRecentTs;
+	if (age >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
+		if (age >= ZT_PEER_ACTIVITY_TIMEOUT)
 			mostRecentMemberId = -1;
-
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
+		_broadcastWantPeer(toPeerAddress,now);
 	}
-
 	return mostRecentMemberId;
 }
 
-bool Cluster::sendViaCluster(int mostRecentMemberId,const Address &toPeerAddress,const void *data,unsigned int len)
+bool Cluster::sendViaCluster(void *tPtr,int memberId,const void *data,unsigned int len)
 {
-	if ((mostRecentMemberId < 0)||(mostRecentMemberId >= ZT_CLUSTER_MAX_MEMBERS)) // sanity check
+	if ((memberId < 0)||(memberId >= ZT_CLUSTER_MAX_MEMBERS)) // sanity check
 		return false;
-	Mutex::Lock _l2(_members[mostRecentMemberId].lock);
-	for(std::vector<InetAddress>::const_iterator i1(_zeroTierPhysicalEndpoints.begin());i1!=_zeroTierPhysicalEndpoints.end();++i1) {
-		for(std::vector<InetAddress>::const_iterator i2(_members[mostRecentMemberId].zeroTierPhysicalEndpoints.begin());i2!=_members[mostRecentMemberId].zeroTierPhysicalEndpoints.end();++i2) {
-			if (i1->ss_family == i2->ss_family) {
-				TRACE("sendViaCluster sending %u bytes to %s by way of %u (%s->%s)",len,toPeerAddress.toString().c_str(),(unsigned int)mostRecentMemberId,i1->toString().c_str(),i2->toString().c_str());
-				RR->node->putPacket((void *)0,*i1,*i2,data,len);
-				return true;
-			}
-		}
-	}
-	return false;
+	return _frontplaneSend(tPtr,(uint16_t)memberId,data,len);
 }
 
-void Cluster::relayViaCluster(const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite)
+bool Cluster::relayViaCluster(void *tPtr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite)
 {
 	if (len > ZT_PROTO_MAX_PACKET_LENGTH) // sanity check
-		return;
+		return false;
+	{
+		Mutex::Lock _l(_memberIds_m);
+		if (_memberIds.empty())
+			return false;
+	}
 
 	const uint64_t now = RR->node->now();
 
 	uint64_t mostRecentTs = 0;
-	int mostRecentMemberId = -1;
-	{
-		Mutex::Lock _l2(_remotePeers_m);
-		std::map< std::pair<Address,unsigned int>,_RemotePeer >::const_iterator rpe(_remotePeers.lower_bound(std::pair<Address,unsigned int>(toPeerAddress,0)));
-		for(;;) {
-			if ((rpe == _remotePeers.end())||(rpe->first.first != toPeerAddress))
-				break;
-			else if (rpe->second.lastHavePeerReceived > mostRecentTs) {
-				mostRecentTs = rpe->second.lastHavePeerReceived;
-				mostRecentMemberId = (int)rpe->first.second;
-			}
-			++rpe;
-		}
-	}
-
-	const uint64_t ageOfMostRecentHavePeerAnnouncement = now - mostRecentTs;
-	if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
-		// Enqueue and wait if peer seems alive, but do WANT_PEER to refresh homing
-		const bool enqueueAndWait = ((ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)||(mostRecentMemberId < 0));
+	const int mostRecentMemberId = _mostRecentHolder(toPeerAddress,mostRecentTs);
 
+	const uint64_t age = now - mostRecentTs;
+	if (age >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
 		// Poll everyone with WANT_PEER if the age of our most recent entry is
 		// approaching expiration (or has expired, or does not exist).
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
+		_broadcastWantPeer(toPeerAddress,now);
 
 		// If there isn't a good place to send via, then enqueue this for retrying
-		// later and return after having broadcasted a WANT_PEER.
-		if (enqueueAndWait) {
-			TRACE("relayViaCluster %s -> %s enqueueing to wait for HAVE_PEER",fromPeerAddress.toString().c_str(),toPeerAddress.toString().c_str());
-			_sendQueue->enqueue(now,fromPeerAddress,toPeerAddress,data,len,unite);
-			return;
+		// later when some member answers with HAVE_PEER.
+		if ((age >= ZT_PEER_ACTIVITY_TIMEOUT)||(mostRecentMemberId < 0)) {
+			Mutex::Lock _l(_queue_m);
+			if (_queueSize < ZT_CLUSTER_MAX_QUEUE_GLOBAL) {
+				std::vector<_QueuedRelay> &q = _queue[toPeerAddress];
+				if (q.size() >= ZT_CLUSTER_MAX_QUEUE_PER_DESTINATION) {
+					q.erase(q.begin());
+					--_queueSize;
+				}
+				q.push_back(_QueuedRelay());
+				q.back().timestamp = now;
+				q.back().fromPeerAddress = fromPeerAddress;
+				q.back().unite = unite;
+				q.back().data.assign(reinterpret_cast<const char *>(data),len);
+				++_queueSize;
+			}
+			return true;
 		}
 	}
 
-	if (mostRecentMemberId >= 0) {
-		Buffer<1024> buf;
-		if (unite) {
-			InetAddress v4,v6;
-			if (fromPeerAddress) {
-				SharedPtr<Peer> fromPeer(RR->topology->getPeerNoCache(fromPeerAddress));
-				if (fromPeer)
-					fromPeer->getRendezvousAddresses(now,v4,v6);
-			}
-			uint8_t addrCount = 0;
+	if (unite) {
+		InetAddress v4,v6;
+		if (fromPeerAddress) {
+			const SharedPtr<Peer> fromPeer(RR->topology->getPeerNoCache(fromPeerAddress));
+			if (fromPeer)
+				fromPeer->getRendezvousAddresses(now,v4,v6);
+		}
+		const uint8_t addrCount = (v4 ? 1 : 0) + (v6 ? 1 : 0);
+		if (addrCount) {
+			Buffer<1024> buf;
+			toPeerAddress.appendTo(buf);
+			fromPeerAddress.appendTo(buf);
+			buf.append(addrCount);
 			if (v4)
-				++addrCount;
+				v4.serialize(buf);
 			if (v6)
-				++addrCount;
-			if (addrCount) {
-				toPeerAddress.appendTo(buf);
-				fromPeerAddress.appendTo(buf);
-				buf.append(addrCount);
-				if (v4)
-					v4.serialize(buf);
-				if (v6)
-					v6.serialize(buf);
-			}
-		}
-
-		{
+				v6.serialize(buf);
 			Mutex::Lock _l2(_members[mostRecentMemberId].lock);
-			if (buf.size() > 0)
-				_send(mostRecentMemberId,CLUSTER_MESSAGE_PROXY_UNITE,buf.data(),buf.size());
-
-			for(std::vector<InetAddress>::const_iterator i1(_zeroTierPhysicalEndpoints.begin());i1!=_zeroTierPhysicalEndpoints.end();++i1) {
-				for(std::vector<InetAddress>::const_iterator i2(_members[mostRecentMemberId].zeroTierPhysicalEndpoints.begin());i2!=_members[mostRecentMemberId].zeroTierPhysicalEndpoints.end();++i2) {
-					if (i1->ss_family == i2->ss_family) {
-						TRACE("relayViaCluster relaying %u bytes from %s to %s by way of %u (%s->%s)",len,fromPeerAddress.toString().c_str(),toPeerAddress.toString().c_str(),(unsigned int)mostRecentMemberId,i1->toString().c_str(),i2->toString().c_str());
-						RR->node->putPacket((void *)0,*i1,*i2,data,len);
-						return;
-					}
-				}
-			}
-
-			TRACE("relayViaCluster relaying %u bytes from %s to %s by way of %u failed: no common endpoints with the same address family!",len,fromPeerAddress.toString().c_str(),toPeerAddress.toString().c_str(),(unsigned int)mostRecentMemberId);
+			_send((uint16_t)mostRecentMemberId,CLUSTER_MESSAGE_PROXY_UNITE,buf.data(),buf.size());
 		}
 	}
+
+	_frontplaneSend(tPtr,(uint16_t)mostRecentMemberId,data,len);
+	return true;
 }
 
 void Cluster::sendDistributedQuery(const Packet &pkt)
 {
-	Buffer<4096> buf;
+	if ((pkt.size() + 2) > (ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2 + 3))) // must fit in one message
+		return;
+	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> buf;
 	buf.append((uint16_t)pkt.size());
 	buf.append(pkt.data(),pkt.size());
 	Mutex::Lock _l(_memberIds_m);
@@ -710,10 +446,8 @@ void Cluster::sendDistributedQuery(const Packet &pkt)
 	}
 }
 
-void Cluster::doPeriodicTasks()
+void Cluster::doPeriodicTasks(void *tPtr,uint64_t now)
 {
-	const uint64_t now = RR->node->now();
-
 	if ((now - _lastFlushed) >= ZT_CLUSTER_FLUSH_PERIOD) {
 		_lastFlushed = now;
 
@@ -739,7 +473,7 @@ void Cluster::doPeriodicTasks()
 					alive.append((int32_t)0);
 				}
 				alive.append((uint64_t)now);
-				alive.append((uint64_t)0); // TODO: compute and send load average
+				alive.append((uint64_t)0); // load, not computed yet
 				alive.append((uint64_t)RR->topology->countActive(now));
 				alive.append((uint64_t)0); // unused/reserved flags
 				alive.append((uint8_t)_zeroTierPhysicalEndpoints.size());
@@ -757,7 +491,7 @@ void Cluster::doPeriodicTasks()
 
 		Mutex::Lock _l(_remotePeers_m);
 		for(std::map< std::pair<Address,unsigned int>,_RemotePeer >::iterator rp(_remotePeers.begin());rp!=_remotePeers.end();) {
-			if ((now - rp->second.lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)
+			if (((now - rp->second.lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)&&((now - rp->second.lastSentWantPeer) >= ZT_PEER_ACTIVITY_TIMEOUT))
 				_remotePeers.erase(rp++);
 			else ++rp;
 		}
@@ -765,24 +499,35 @@ void Cluster::doPeriodicTasks()
 
 	if ((now - _lastCleanedQueue) >= ZT_CLUSTER_QUEUE_EXPIRATION) {
 		_lastCleanedQueue = now;
-		_sendQueue->expire(now);
+
+		Mutex::Lock _l(_queue_m);
+		Hashtable< Address,std::vector<_QueuedRelay> >::Iterator i(_queue);
+		Address *k = (Address *)0;
+		std::vector<_QueuedRelay> *q = (std::vector<_QueuedRelay> *)0;
+		while (i.next(k,q)) {
+			std::vector<_QueuedRelay>::iterator e(q->begin());
+			while ((e != q->end())&&((now - e->timestamp) > ZT_CLUSTER_QUEUE_EXPIRATION))
+				++e;
+			_queueSize -= (unsigned long)(e - q->begin());
+			q->erase(q->begin(),e);
+			if (q->empty())
+				_queue.erase(*k);
+		}
 	}
 }
 
-void Cluster::addMember(uint16_t memberId)
+bool Cluster::addMember(uint16_t memberId)
 {
 	if ((memberId >= ZT_CLUSTER_MAX_MEMBERS)||(memberId == _id))
-		return;
+		return false;
 
+	// Same lock order as everywhere else: member IDs first, then the member
+	Mutex::Lock _l(_memberIds_m);
+	if (std::find(_memberIds.begin(),_memberIds.end(),memberId) != _memberIds.end())
+		return true;
 	Mutex::Lock _l2(_members[memberId].lock);
-
-	{
-		Mutex::Lock _l(_memberIds_m);
-		if (std::find(_memberIds.begin(),_memberIds.end(),memberId) != _memberIds.end())
-			return;
-		_memberIds.push_back(memberId);
-		std::sort(_memberIds.begin(),_memberIds.end());
-	}
+	_memberIds.push_back(memberId);
+	std::sort(_memberIds.begin(),_memberIds.end());
 
 	_members[memberId].clear();
 
@@ -803,71 +548,58 @@ void Cluster::addMember(uint16_t memberId)
 	_members[memberId].q.addSize(8); // room for MAC
 	_members[memberId].q.append((uint16_t)_id);
 	_members[memberId].q.append((uint16_t)memberId);
+
+	return true;
 }
 
 void Cluster::removeMember(uint16_t memberId)
 {
 	Mutex::Lock _l(_memberIds_m);
-	std::vector<uint16_t> newMemberIds;
-	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-		if (*mid != memberId)
-			newMemberIds.push_back(*mid);
-	}
-	_memberIds = newMemberIds;
+	std::vector<uint16_t>::iterator mid(std::find(_memberIds.begin(),_memberIds.end(),memberId));
+	if (mid != _memberIds.end())
+		_memberIds.erase(mid);
 }
 
 bool Cluster::findBetterEndpoint(InetAddress &redirectTo,const Address &peerAddress,const InetAddress &peerPhysicalAddress,bool offload)
 {
-	if (_addressToLocationFunction) {
-		// Pick based on location if it can be determined
-		int px = 0,py = 0,pz = 0;
-		if (_addressToLocationFunction(_addressToLocationFunctionArg,reinterpret_cast<const struct sockaddr_storage *>(&peerPhysicalAddress),&px,&py,&pz) == 0) {
-			TRACE("no geolocation data for %s",peerPhysicalAddress.toIpString().c_str());
-			return false;
-		}
+	// Without location data there is nothing to pick by yet
+	if (!_addressToLocationFunction)
+		return false;
 
-		// Find member closest to this peer
-		const uint64_t now = RR->node->now();
-		std::vector<InetAddress> best;
-		const double currentDistance = _dist3d(_x,_y,_z,px,py,pz);
-		double bestDistance = (offload ? 2147483648.0 : currentDistance);
-#ifdef ZT_TRACE
-		unsigned int bestMember = _id;
-#endif
-		{
-			Mutex::Lock _l(_memberIds_m);
-			for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-				_Member &m = _members[*mid];
-				Mutex::Lock _ml(m.lock);
-
-				// Consider member if it's alive and has sent us a location and one or more physical endpoints to send peers to
-				if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && ((m.x != 0)||(m.y != 0)||(m.z != 0)) && (m.zeroTierPhysicalEndpoints.size() > 0) ) {
-					const double mdist = _dist3d(m.x,m.y,m.z,px,py,pz);
-					if (mdist < bestDistance) {
-						bestDistance = mdist;
-#ifdef ZT_TRACE
-						bestMember = *mid;
-#endif
-						best = m.zeroTierPhysicalEndpoints;
-					}
+	int px = 0,py = 0,pz = 0;
+	if (_addressToLocationFunction(_addressToLocationFunctionArg,reinterpret_cast<const struct sockaddr_storage *>(&peerPhysicalAddress),&px,&py,&pz) == 0)
+		return false;
+
+	// Find member closest to this peer
+	const uint64_t now = RR->node->now();
+	std::vector<InetAddress> best;
+	const double currentDistance = _dist3d(_x,_y,_z,px,py,pz);
+	double bestDistance = (offload ? 2147483648.0 : currentDistance);
+	{
+		Mutex::Lock _l(_memberIds_m);
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+			_Member &m = _members[*mid];
+			Mutex::Lock _ml(m.lock);
+
+			// Consider member if it's alive and has sent us a location and one or more physical endpoints to send peers to
+			if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && ((m.x != 0)||(m.y != 0)||(m.z != 0)) && (m.zeroTierPhysicalEndpoints.size() > 0) ) {
+				const double mdist = _dist3d(m.x,m.y,m.z,px,py,pz);
+				if (mdist < bestDistance) {
+					bestDistance = mdist;
+					best = m.zeroTierPhysicalEndpoints;
 				}
 			}
 		}
+	}
 
-		// Redirect to a closer member if it has a ZeroTier endpoint address in the same ss_family
-		for(std::vector<InetAddress>::const_iterator a(best.begin());a!=best.end();++a) {
-			if (a->ss_family == peerPhysicalAddress.ss_family) {
-				TRACE("%s at [%d,%d,%d] is %f from us but %f from %u, can redirect to %s",peerAddress.toString().c_str(),px,py,pz,currentDistance,bestDistance,bestMember,a->toString().c_str());
-				redirectTo = *a;
-				return true;
-			}
+	// Redirect to a closer member if it has a ZeroTier endpoint address in the same ss_family
+	for(std::vector<InetAddress>::const_iterator a(best.begin());a!=best.end();++a) {
+		if (a->ss_family == peerPhysicalAddress.ss_family) {
+			redirectTo = *a;
+			return true;
 		}
-		TRACE("%s at [%d,%d,%d] is %f from us, no better endpoints found",peerAddress.toString().c_str(),px,py,pz,currentDistance);
-		return false;
-	} else {
-		// TODO: pick based on load if no location info?
-		return false;
 	}
+	return false;
 }
 
 bool Cluster::isClusterPeerFrontplane(const InetAddress &ip) const
@@ -897,7 +629,7 @@ void Cluster::status(ZT_ClusterStatus &status) const
 		s->x = _x;
 		s->y = _y;
 		s->z = _z;
-		s->load = 0; // TODO
+		s->load = 0;
 		s->peers = RR->topology->countActive(now);
 		for(std::vector<InetAddress>::const_iterator ep(_zeroTierPhysicalEndpoints.begin());ep!=_zeroTierPhysicalEndpoints.end();++ep) {
 			if (s->numZeroTierPhysicalEndpoints >= ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES) // sanity check
@@ -986,10 +718,64 @@ void Cluster::_flush(uint16_t memberId)
 	}
 }
 
-void Cluster::_doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep)
+void Cluster::_broadcastWantPeer(const Address &peerAddress,uint64_t now)
+{
+	{
+		Mutex::Lock _l(_remotePeers_m);
+		_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(peerAddress,(unsigned int)_id)];
+		if ((now - rp.lastSentWantPeer) < ZT_CLUSTER_WANT_PEER_EVERY)
+			return; // don't flood WANT_PEER
+		rp.lastSentWantPeer = now;
+	}
+	char tmp[ZT_ADDRESS_LENGTH];
+	peerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
+	Mutex::Lock _l(_memberIds_m);
+	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+		Mutex::Lock _l2(_members[*mid].lock);
+		_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
+	}
+}
+
+int Cluster::_mostRecentHolder(const Address &peerAddress,uint64_t &mostRecentTs)
 {
-	if (remotep.payloadLength() >= ZT_ADDRESS_LENGTH) {
-		Identity queried(RR->topology->getIdentity((void *)0,Address(remotep.payload(),ZT_ADDRESS_LENGTH)));
+	int mostRecentMemberId = -1;
+	mostRecentTs = 0;
+	Mutex::Lock _l(_remotePeers_m);
+	std::map< std::pair<Address,unsigned int>,_RemotePeer >::const_iterator rpe(_remotePeers.lower_bound(std::pair<Address,unsigned int>(peerAddress,0)));
+	while ((rpe != _remotePeers.end())&&(rpe->first.first == peerAddress)) {
+		if (rpe->second.lastHavePeerReceived > mostRecentTs) {
+			mostRecentTs = rpe->second.lastHavePeerReceived;
+			mostRecentMemberId = (int)rpe->first.second;
+		}
+		++rpe;
+	}
+	return mostRecentMemberId;
+}
+
+bool Cluster::_frontplaneSend(void *tPtr,uint16_t memberId,const void *data,unsigned int len)
+{
+	InetAddress to;
+	{
+		Mutex::Lock _l(_members[memberId].lock);
+		const std::vector<InetAddress> &theirs = _members[memberId].zeroTierPhysicalEndpoints;
+		for(std::vector<InetAddress>::const_iterator i1(_zeroTierPhysicalEndpoints.begin());((i1!=_zeroTierPhysicalEndpoints.end())&&(!to));++i1) {
+			for(std::vector<InetAddress>::const_iterator i2(theirs.begin());i2!=theirs.end();++i2) {
+				if (i1->ss_family == i2->ss_family) {
+					to = *i2;
+					break;
+				}
+			}
+		}
+	}
+	if (!to)
+		return false;
+	return RR->node->putPacket(tPtr,-1,to,data,len);
+}
+
+void Cluster::_doREMOTE_WHOIS(void *tPtr,uint16_t fromMemberId,const Packet &remotep)
+{
+	for(unsigned int ptr=ZT_PACKET_IDX_PAYLOAD;(ptr + ZT_ADDRESS_LENGTH)<=remotep.size();ptr+=ZT_ADDRESS_LENGTH) {
+		const Identity queried(RR->topology->getIdentity(tPtr,Address(remotep.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH)));
 		if (queried) {
 			Buffer<1024> routp;
 			remotep.source().appendTo(routp);
@@ -1000,14 +786,13 @@ void Cluster::_doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep)
 			queried.serialize(routp);
 			routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
 
-			TRACE("responding to remote WHOIS from %s @ %u with identity of %s",remotep.source().toString().c_str(),(unsigned int)fromMemberId,queried.address().toString().c_str());
 			Mutex::Lock _l2(_members[fromMemberId].lock);
 			_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,routp.data(),routp.size());
 		}
 	}
 }
 
-void Cluster::_doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &remotep)
+void Cluster::_doREMOTE_MULTICAST_GATHER(uint16_t fromMemberId,const Packet &remotep)
 {
 	const uint64_t nwid = remotep.at<uint64_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_NETWORK_ID);
 	const MulticastGroup mg(MAC(remotep.field(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_MAC,6),6),remotep.at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_ADI));
@@ -1030,7 +815,6 @@ void Cluster::_doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &rem
 		if (RR->mc->gather(remotePeerAddress,nwid,mg,routp,gatherLimit)) {
 			routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
 
-			TRACE("responding to remote MULTICAST_GATHER from %s @ %u with %u bytes",remotePeerAddress.toString().c_str(),(unsigned int)fromMemberId,routp.size());
 			Mutex::Lock _l2(_members[fromMemberId].lock);
 			_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,routp.data(),routp.size());
 		}
@@ -1038,5 +822,3 @@ void Cluster::_doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &rem
 }
 
 } // namespace ZeroTier
-
-#endif // ZT_ENABLE_CLUSTER
@@ -27,9 +27,9 @@
 #ifndef ZT_CLUSTER_HPP
 #define ZT_CLUSTER_HPP
 
-#ifdef ZT_ENABLE_CLUSTER
-
 #include <map>
+#include <vector>
+#include <string>
 
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
@@ -39,10 +39,8 @@
 #include "Utils.hpp"
 #include "Buffer.hpp"
 #include "Mutex.hpp"
-#include "SharedPtr.hpp"
 #include "Hashtable.hpp"
 #include "Packet.hpp"
-#include "SharedPtr.hpp"
 
 /**
  * Timeout for cluster members being considered "alive"
@@ -63,38 +61,22 @@
 #define ZT_CLUSTER_FLUSH_PERIOD ZT_CLUSTER_PERIODIC_TASK_PERIOD
 
 /**
- * Maximum number of queued outgoing packets per sender address
- */
-#define ZT_CLUSTER_MAX_QUEUE_PER_SENDER 16
-
-/**
- * Expiration time for send queue entries
+ * Maximum number of relayed packets held per destination while waiting for HAVE_PEER
  */
-#define ZT_CLUSTER_QUEUE_EXPIRATION 3000
+#define ZT_CLUSTER_MAX_QUEUE_PER_DESTINATION 16
 
 /**
- * Chunk size for allocating queue entries
+ * Maximum number of relayed packets held in total while waiting for HAVE_PEER
  *
- * Queue entries are allocated in chunks of this many and are added to a pool.
- * ZT_CLUSTER_MAX_QUEUE_GLOBAL must be evenly divisible by this.
+ * This is a sanity limit against resource exhaustion. Cluster relaying
+ * degrades if it is reached but everything else continues normally.
  */
-#define ZT_CLUSTER_QUEUE_CHUNK_SIZE 32
+#define ZT_CLUSTER_MAX_QUEUE_GLOBAL 65536
 
 /**
- * Maximum number of chunks to ever allocate
- *
- * This is a global sanity limit to prevent resource exhaustion attacks. It
- * works out to about 600mb of RAM. You'll never see this on a normal edge
- * node. We're unlikely to see this on a root server unless someone is DOSing
- * us. In that case cluster relaying will be affected but other functions
- * should continue to operate normally.
- */
-#define ZT_CLUSTER_MAX_QUEUE_CHUNKS 8194
-
-/**
- * Max data per queue entry
+ * Expiration time for send queue entries
  */
-#define ZT_CLUSTER_SEND_QUEUE_DATA_MAX 1500
+#define ZT_CLUSTER_QUEUE_EXPIRATION 3000
 
 /**
  * We won't send WANT_PEER to other members more than every (ms) per recipient
@@ -104,32 +86,21 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
-class MulticastGroup;
-class Peer;
 class Identity;
 
-// Internal class implemented inside Cluster.cpp
-class _ClusterSendQueue;
-
 /**
  * Multi-homing cluster state replication and packet relaying
  *
- * Multi-homing means more than one node sharing the same ZeroTier identity.
- * There is nothing in the protocol to prevent this, but to make it work well
- * requires the devices sharing an identity to cooperate and share some
- * information.
- *
- * There are three use cases we want to fulfill:
- *
- * (1) Multi-homing of root servers with handoff for efficient routing,
- *     HA, and load balancing across many commodity nodes.
- * (2) Multi-homing of network controllers for the same reason.
- * (3) Multi-homing of nodes on virtual networks, such as domain servers
- *     and other important endpoints.
+ * A cluster is a set of nodes sharing one ZeroTier identity, usually a
+ * root or moon, that together act as one larger node. Members exchange
+ * heartbeats and which peers they have direct paths to over a backplane
+ * (the transport is up to the host, see ZT_Node_clusterInit()), relay
+ * traffic for peers homed on other members through those members' front
+ * plane ZeroTier endpoints, and redirect peers to the member closest to
+ * them if location data is available.
  *
- * These use cases are in order of escalating difficulty. The initial
- * version of Cluster is aimed at satisfying the first, though you are
- * free to try #2 and #3.
+ * Backplane messages are encrypted and authenticated with keys derived from
+ * the shared identity's secret, so only holders of it can be members.
  */
 class Cluster
 {
@@ -218,26 +189,16 @@ public:
 		 *   <[2] length of packet payload>
 		 *   <[...] packet payload>
 		 *
-		 * This differs from RELAY in that it requests the receiving cluster
+		 * This differs from relaying in that it requests the receiving cluster
 		 * member to actually compose a ZeroTier Packet from itself to the
-		 * provided recipient. RELAY simply says "please forward this blob."
-		 * RELAY is used to implement peer-to-peer relaying with RENDEZVOUS,
-		 * while PROXY_SEND is used to implement proxy sending (which right
-		 * now is only used to send RENDEZVOUS).
+		 * provided recipient. It is used to answer remote queries and to
+		 * send RENDEZVOUS to peers homed on other members.
 		 */
-		CLUSTER_MESSAGE_PROXY_SEND = 6,
+		CLUSTER_MESSAGE_PROXY_SEND = 6
 
-		/**
-		 * Replicate a network config for a network we belong to:
-		 *   <[...] network config chunk>
-		 *
-		 * This is used by clusters to avoid every member having to query
-		 * for the same netconf for networks all members belong to.
-		 *
-		 * The first field of a network config chunk is the network ID,
-		 * so this can be checked to look up the network on receipt.
-		 */
-		CLUSTER_MESSAGE_NETWORK_CONFIG = 7
+		// 7 was NETWORK_CONFIG, used by older cluster code to share network
+		// configs among members; roots and moons don't join networks so it
+		// is no longer sent and is ignored if received.
 	};
 
 	/**
@@ -260,15 +221,16 @@ public:
 	/**
 	 * @return This cluster member's ID
 	 */
-	inline uint16_t id() const throw() { return _id; }
+	inline uint16_t id() const { return _id; }
 
 	/**
 	 * Handle an incoming intra-cluster message
 	 *
-	 * @param data Message data
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param msg Message data
 	 * @param len Message length (max: ZT_CLUSTER_MAX_MESSAGE_LENGTH)
 	 */
-	void handleIncomingStateMessage(const void *msg,unsigned int len);
+	void handleIncomingStateMessage(void *tPtr,const void *msg,unsigned int len);
 
 	/**
 	 * Broadcast that we have a given peer
@@ -280,50 +242,42 @@ public:
 	void broadcastHavePeer(const Identity &id);
 
 	/**
-	 * Broadcast a network config chunk to other members of cluster
-	 *
-	 * @param chunk Chunk data
-	 * @param len Length of chunk
-	 */
-	void broadcastNetworkConfigChunk(const void *chunk,unsigned int len);
-
-	/**
-	 * If the cluster has this peer, prepare the packet to send via cluster
+	 * Check whether another member has a direct path to a peer we can't reach directly
 	 *
-	 * Note that outp is only armored (or modified at all) if the return value is a member ID.
+	 * This also polls other members with WANT_PEER if what we know is getting old.
 	 *
-	 * @param toPeerAddress Value of outp.destination(), simply to save additional lookup
-	 * @param ts Result: set to time of last HAVE_PEER from the cluster
-	 * @param peerSecret Result: Buffer to fill with peer secret on valid return value, must be at least ZT_PEER_SECRET_KEY_LENGTH bytes
+	 * @param toPeerAddress Peer address
 	 * @return -1 if cluster does not know this peer, or a member ID to pass to sendViaCluster()
 	 */
-	int checkSendViaCluster(const Address &toPeerAddress,uint64_t &mostRecentTs,void *peerSecret);
+	int checkSendViaCluster(const Address &toPeerAddress);
 
 	/**
 	 * Send data via cluster front plane (packet head or fragment)
 	 *
-	 * @param haveMemberId Member ID that has this peer as returned by prepSendviaCluster()
-	 * @param toPeerAddress Destination peer address
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param memberId Member ID that has this peer as returned by checkSendViaCluster()
 	 * @param data Packet or packet fragment data
 	 * @param len Length of packet or fragment
-	 * @return True if packet was sent (and outp was modified via armoring)
+	 * @return True if packet was sent
 	 */
-	bool sendViaCluster(int haveMemberId,const Address &toPeerAddress,const void *data,unsigned int len);
+	bool sendViaCluster(void *tPtr,int memberId,const void *data,unsigned int len);
 
 	/**
 	 * Relay a packet via the cluster
 	 *
-	 * This is used in the outgoing packet and relaying logic in Switch to
-	 * relay packets to other cluster members. It isn't PROXY_SEND-- that is
-	 * used internally in Cluster to send responses to peer queries.
+	 * This is used by Switch to relay packets for peers we have no direct
+	 * path to but which another member may have. If no member is known to
+	 * have the peer, the packet is held briefly while members are asked.
 	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param fromPeerAddress Source peer address (if known, should be NULL for fragments)
 	 * @param toPeerAddress Destination peer address
 	 * @param data Packet or packet fragment data
 	 * @param len Length of packet or fragment
 	 * @param unite If true, also request proxy unite across cluster
+	 * @return True if packet was relayed or queued, false if there are no other live members
 	 */
-	void relayViaCluster(const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite);
+	bool relayViaCluster(void *tPtr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite);
 
 	/**
 	 * Send a distributed query to other cluster members
@@ -338,15 +292,19 @@ public:
 
 	/**
 	 * Call every ~ZT_CLUSTER_PERIODIC_TASK_PERIOD milliseconds.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
 	 */
-	void doPeriodicTasks();
+	void doPeriodicTasks(void *tPtr,uint64_t now);
 
 	/**
 	 * Add a member ID to this cluster
 	 *
 	 * @param memberId Member ID
+	 * @return True if member was added (or already present)
 	 */
-	void addMember(uint16_t memberId);
+	bool addMember(uint16_t memberId);
 
 	/**
 	 * Remove a member ID from this cluster
@@ -382,15 +340,17 @@ public:
 private:
 	void _send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len);
 	void _flush(uint16_t memberId);
+	void _broadcastWantPeer(const Address &peerAddress,uint64_t now);
+	int _mostRecentHolder(const Address &peerAddress,uint64_t &mostRecentTs);
+	bool _frontplaneSend(void *tPtr,uint16_t memberId,const void *data,unsigned int len);
 
-	void _doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep);
-	void _doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &remotep);
+	void _doREMOTE_WHOIS(void *tPtr,uint16_t fromMemberId,const Packet &remotep);
+	void _doREMOTE_MULTICAST_GATHER(uint16_t fromMemberId,const Packet &remotep);
 
 	// These are initialized in the constructor and remain immutable ------------
 	uint16_t _masterSecret[ZT_SHA512_DIGEST_LEN / sizeof(uint16_t)];
 	unsigned char _key[ZT_PEER_SECRET_KEY_LENGTH];
 	const RuntimeEnvironment *RR;
-	_ClusterSendQueue *const _sendQueue;
 	void (*_sendFunction)(void *,unsigned int,const void *,unsigned int);
 	void *_sendFunctionArg;
 	int (*_addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *);
@@ -440,17 +400,29 @@ private:
 	std::vector<uint16_t> _memberIds;
 	Mutex _memberIds_m;
 
+	// Which members have which peers, and when we last asked about each
+	// peer (under our own member ID)
 	struct _RemotePeer
 	{
 		_RemotePeer() : lastHavePeerReceived(0),lastSentWantPeer(0) {}
-		~_RemotePeer() { Utils::burn(key,ZT_PEER_SECRET_KEY_LENGTH); }
 		uint64_t lastHavePeerReceived;
 		uint64_t lastSentWantPeer;
-		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH]; // secret key from identity agreement
 	};
 	std::map< std::pair<Address,unsigned int>,_RemotePeer > _remotePeers; // we need ordered behavior and lower_bound here
 	Mutex _remotePeers_m;
 
+	// Relayed packets waiting for some member to answer WANT_PEER
+	struct _QueuedRelay
+	{
+		uint64_t timestamp;
+		Address fromPeerAddress;
+		bool unite;
+		std::string data;
+	};
+	Hashtable< Address,std::vector<_QueuedRelay> > _queue;
+	unsigned long _queueSize;
+	Mutex _queue_m;
+
 	uint64_t _lastFlushed;
 	uint64_t _lastCleanedRemotePeers;
 	uint64_t _lastCleanedQueue;
@@ -458,6 +430,4 @@ private:
 
 } // namespace ZeroTier
 
-#endif // ZT_ENABLE_CLUSTER
-
 #endif
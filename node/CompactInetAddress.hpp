@@ -0,0 +1,137 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_COMPACTINETADDRESS_HPP
+#define ZT_COMPACTINETADDRESS_HPP
+
+#include <string.h>
+#include <stdint.h>
+
+#include "Constants.hpp"
+#include "Utils.hpp"
+#include "InetAddress.hpp"
+
+namespace ZeroTier {
+
+/**
+ * An IPv4 or IPv6 address and port in 20 bytes
+ *
+ * InetAddress is a sockaddr_storage (128 bytes) so that it can be handed
+ * straight to the OS. Objects kept per path or per peer store this instead
+ * and convert with toInetAddress() where an InetAddress is needed. Only
+ * the IP and port are kept (no IPv6 flow info or scope ID, which paths
+ * don't use), and any other address family is stored as nil.
+ */
+class CompactInetAddress
+{
+public:
+	CompactInetAddress() { memset(this,0,sizeof(CompactInetAddress)); }
+	CompactInetAddress(const InetAddress &a) { set(a); }
+
+	inline CompactInetAddress &operator=(const InetAddress &a)
+	{
+		set(a);
+		return *this;
+	}
+
+	inline void set(const InetAddress &a)
+	{
+		memset(this,0,sizeof(CompactInetAddress));
+		if (a.ss_family == AF_INET) {
+			memcpy(_ip,&(reinterpret_cast<const struct sockaddr_in *>(&a)->sin_addr.s_addr),4);
+			_port = Utils::ntoh((uint16_t)reinterpret_cast<const struct sockaddr_in *>(&a)->sin_port);
+			_family = 4;
+		} else if (a.ss_family == AF_INET6) {
+			memcpy(_ip,reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_addr.s6_addr,16);
+			_port = Utils::ntoh((uint16_t)reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_port);
+			_family = 6;
+		}
+	}
+
+	/**
+	 * @return Full InetAddress, e.g. to pass to the OS
+	 */
+	inline InetAddress toInetAddress() const
+	{
+		if (_family)
+			return InetAddress(_ip,(_family == 4) ? 4 : 16,_port);
+		return InetAddress();
+	}
+
+	/**
+	 * @return AF_INET, AF_INET6, or 0 if nil
+	 */
+	inline int family() const { return ((_family == 4) ? AF_INET : ((_family == 6) ? AF_INET6 : 0)); }
+
+	/**
+	 * @return Port in host byte order
+	 */
+	inline unsigned int port() const { return _port; }
+
+	/**
+	 * @param port Port in host byte order
+	 */
+	inline void setPort(unsigned int port) { _port = (uint16_t)port; }
+
+	inline unsigned long hashCode() const
+	{
+		uint32_t w[4];
+		memcpy(w,_ip,16);
+		return (unsigned long)(((uint64_t)(w[0] ^ w[1] ^ w[2] ^ w[3]) << 16) ^ ((uint64_t)_port << 3) ^ (uint64_t)_family);
+	}
+
+	inline operator bool() const { return (_family != 0); }
+
+	inline bool operator==(const CompactInetAddress &a) const { return (memcmp(this,&a,sizeof(CompactInetAddress)) == 0); }
+	inline bool operator!=(const CompactInetAddress &a) const { return (!(*this == a)); }
+
+	/**
+	 * Compare with an InetAddress without converting either one
+	 */
+	inline bool operator==(const InetAddress &a) const
+	{
+		if (a.ss_family == AF_INET) {
+			return ( (_family == 4) &&
+			         (_port == Utils::ntoh((uint16_t)reinterpret_cast<const struct sockaddr_in *>(&a)->sin_port)) &&
+			         (!memcmp(_ip,&(reinterpret_cast<const struct sockaddr_in *>(&a)->sin_addr.s_addr),4)) );
+		} else if (a.ss_family == AF_INET6) {
+			return ( (_family == 6) &&
+			         (_port == Utils::ntoh((uint16_t)reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_port)) &&
+			         (!memcmp(_ip,reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_addr.s6_addr,16)) );
+		}
+		return (_family == 0);
+	}
+	inline bool operator!=(const InetAddress &a) const { return (!(*this == a)); }
+
+private:
+	uint8_t _ip[16];
+	uint16_t _port;
+	uint16_t _family; // 4, 6, or 0 if nil
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_COMPILEDRULES_HPP
+#define ZT_COMPILEDRULES_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "Constants.hpp"
+#include "../include/ZeroTierOne.h"
+#include "Address.hpp"
+#include "Tag.hpp"
+
+/**
+ * Maximum number of distinct ethertypes a compiled rule list dispatches on
+ *
+ * Sets that test other ethertypes are evaluated for every frame.
+ */
+#define ZT_COMPILED_RULES_MAX_ETHERTYPES 16
+
+/**
+ * Flag on a program entry whose set cannot match, kept only for its side effects
+ */
+#define ZT_COMPILED_RULES_INERT 0x8000
+
+/**
+ * Maximum number of distinct tag IDs a compiled rule list resolves once per frame
+ *
+ * Rules on other tags look them up each time.
+ */
+#define ZT_COMPILED_RULES_MAX_TAGS 32
+
+/**
+ * Tag slot of a rule that tests no tag, or one beyond ZT_COMPILED_RULES_MAX_TAGS
+ */
+#define ZT_COMPILED_RULES_NO_TAG 0xff
+
+namespace ZeroTier {
+
+/**
+ * A network rule list split into sets and indexed by ethertype
+ *
+ * A set is a run of MATCH entries and the ACTION that ends it. Sets whose
+ * leading entries test the ethertype, and that have no OR entries, cannot
+ * match frames of any other ethertype. Each program lists, in order, the
+ * sets an ethertype must still evaluate.
+ *
+ * A set that cannot match still matters if its ACTION forwards to us, since
+ * on inbound that makes later tag matches lenient and final accepts be
+ * super-accepts. Such sets stay in the program marked inert.
+ *
+ * Tag IDs tested by TAGS_* and TAG_SENDER/RECEIVER entries are numbered
+ * into slots, and our own value for each is resolved here. The remote
+ * member's values can then be looked up once per frame into an array by
+ * slot, instead of once per entry, which matters for networks with many
+ * tag rules.
+ *
+ * Only rule indices are stored. The rule list itself is passed in again at
+ * evaluation time and must not change without recompiling, and neither
+ * must our tags.
+ */
+class CompiledRules
+{
+public:
+	struct Set
+	{
+		unsigned int start; // first MATCH entry
+		unsigned int action; // ACTION entry ending this set
+		bool hasOr; // if false a false match state is final for the set
+		bool targetsSelf; // TEE, WATCH, or REDIRECT to us
+	};
+
+	CompiledRules() {}
+
+	/**
+	 * @param rules Rule list
+	 * @param ruleCount Number of rules
+	 * @param self Our own ZeroTier address
+	 * @param localTags Our tags on this network, in ascending order of tag ID
+	 */
+	inline void compile(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount,const Address &self,const std::vector<Tag> &localTags)
+	{
+		_sets.clear();
+		_etherTypes.clear();
+		_programs.clear();
+		_tagSlots.assign(ruleCount,(uint8_t)ZT_COMPILED_RULES_NO_TAG);
+		_tagIds.clear();
+		_localTagValues.clear();
+		_localTagPresent.clear();
+
+		for(unsigned int rn=0;rn<ruleCount;++rn) {
+			switch((ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f)) {
+				case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+				case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+				case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+				case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+				case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+				case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+				case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
+					const uint32_t id = rules[rn].v.tag.id;
+					const std::vector<uint32_t>::const_iterator i(std::find(_tagIds.begin(),_tagIds.end(),id));
+					if (i != _tagIds.end()) {
+						_tagSlots[rn] = (uint8_t)(i - _tagIds.begin());
+					} else if (_tagIds.size() < ZT_COMPILED_RULES_MAX_TAGS) {
+						_tagSlots[rn] = (uint8_t)_tagIds.size();
+						_tagIds.push_back(id);
+						const std::vector<Tag>::const_iterator lt(std::lower_bound(localTags.begin(),localTags.end(),id,Tag::IdComparePredicate()));
+						const bool present = ((lt != localTags.end())&&(lt->id() == id));
+						_localTagValues.push_back((present) ? lt->value() : 0);
+						_localTagPresent.push_back((uint8_t)present);
+					}
+				}	break;
+				default:
+					break;
+			}
+		}
+
+		std::vector<_Guard> guards;
+		unsigned int start = 0;
+		for(unsigned int rn=0;rn<ruleCount;++rn) {
+			const unsigned int rt = (unsigned int)(rules[rn].t & 0x3f);
+			if (rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+				Set s;
+				s.start = start;
+				s.action = rn;
+				s.hasOr = false;
+				for(unsigned int i=start;i<rn;++i) {
+					if ((rules[i].t & 0x40) != 0)
+						s.hasOr = true;
+				}
+				s.targetsSelf = (((rt == ZT_NETWORK_RULE_ACTION_TEE)||(rt == ZT_NETWORK_RULE_ACTION_WATCH)||(rt == ZT_NETWORK_RULE_ACTION_REDIRECT))&&(self == rules[rn].v.fwd.address));
+				_sets.push_back(s);
+
+				// The leading ETHERTYPE entries of a set without ORs are ANDed
+				// into its initial true state, so all of them must hold.
+				_Guard g;
+				if (!s.hasOr) {
+					for(unsigned int i=start;i<rn;++i) {
+						if ((rules[i].t & 0x3f) != ZT_NETWORK_RULE_MATCH_ETHERTYPE)
+							break;
+						const unsigned int et = rules[i].v.etherType;
+						if ((std::find(_etherTypes.begin(),_etherTypes.end(),et) == _etherTypes.end())&&(_etherTypes.size() < ZT_COMPILED_RULES_MAX_ETHERTYPES))
+							_etherTypes.push_back(et);
+						if ((rules[i].t & 0x80) != 0)
+							g.isNot.push_back(et);
+						else g.is.push_back(et);
+					}
+				}
+				guards.push_back(g);
+
+				start = rn + 1;
+			}
+		}
+		// MATCH entries after the last ACTION can never take an action and are dropped
+
+		std::sort(_etherTypes.begin(),_etherTypes.end());
+		_programs.resize(_etherTypes.size() + 1);
+		for(unsigned long p=0;p<_programs.size();++p) {
+			const bool known = (p < _etherTypes.size());
+			for(unsigned long si=0;si<_sets.size();++si) {
+				if (guards[si].admits(_etherTypes,known,(known) ? _etherTypes[p] : 0))
+					_programs[p].push_back((uint16_t)si);
+				else if (_sets[si].targetsSelf)
+					_programs[p].push_back((uint16_t)(si | ZT_COMPILED_RULES_INERT));
+			}
+		}
+	}
+
+	/**
+	 * @param etherType Frame ethertype
+	 * @param len Set to number of program entries
+	 * @return Program entries: set indices, possibly ORed with ZT_COMPILED_RULES_INERT
+	 */
+	inline const uint16_t *program(const unsigned int etherType,unsigned int &len) const
+	{
+		if (_programs.empty()) {
+			len = 0;
+			return (const uint16_t *)0;
+		}
+		const std::vector<unsigned int>::const_iterator i(std::lower_bound(_etherTypes.begin(),_etherTypes.end(),etherType));
+		const std::vector<uint16_t> &p = _programs[((i != _etherTypes.end())&&(*i == etherType)) ? (unsigned long)(i - _etherTypes.begin()) : _etherTypes.size()];
+		len = (unsigned int)p.size();
+		return (len) ? &(p[0]) : (const uint16_t *)0;
+	}
+
+	/**
+	 * @param i Set index from a program entry, without flags
+	 * @return Set
+	 */
+	inline const Set &set(const unsigned int i) const { return _sets[i]; }
+
+	/**
+	 * @param rn Rule index
+	 * @return Tag slot of rule, or ZT_COMPILED_RULES_NO_TAG
+	 */
+	inline unsigned int tagSlot(const unsigned int rn) const { return (rn < _tagSlots.size()) ? (unsigned int)_tagSlots[rn] : (unsigned int)ZT_COMPILED_RULES_NO_TAG; }
+
+	/**
+	 * @return Number of tag slots
+	 */
+	inline unsigned int tagCount() const { return (unsigned int)_tagIds.size(); }
+
+	/**
+	 * @param slot Tag slot
+	 * @return Tag ID
+	 */
+	inline uint32_t tagId(const unsigned int slot) const { return _tagIds[slot]; }
+
+	/**
+	 * @param slot Tag slot
+	 * @param v Set to our value of this tag if we have it
+	 * @return True if we have this tag
+	 */
+	inline bool localTag(const unsigned int slot,uint32_t &v) const
+	{
+		v = _localTagValues[slot];
+		return (_localTagPresent[slot] != 0);
+	}
+
+private:
+	struct _Guard
+	{
+		std::vector<unsigned int> is;
+		std::vector<unsigned int> isNot;
+
+		// True unless this guard rules out the ethertype. An ethertype that is
+		// not known stands for all the ones not in the dispatch list.
+		inline bool admits(const std::vector<unsigned int> &etherTypes,const bool known,const unsigned int et) const
+		{
+			for(std::vector<unsigned int>::const_iterator i(is.begin());i!=is.end();++i) {
+				if (!std::binary_search(etherTypes.begin(),etherTypes.end(),*i))
+					continue; // not dispatched on, so the set is just evaluated
+				if ((!known)||(*i != et))
+					return false;
+			}
+			if (known) {
+				for(std::vector<unsigned int>::const_iterator i(isNot.begin());i!=isNot.end();++i) {
+					if (*i == et)
+						return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	std::vector<Set> _sets;
+	std::vector<unsigned int> _etherTypes; // sorted
+	std::vector< std::vector<uint16_t> > _programs; // one per ethertype, then one for all others
+	std::vector<uint8_t> _tagSlots; // one per rule
+	std::vector<uint32_t> _tagIds; // by slot
+	std::vector<uint32_t> _localTagValues; // by slot
+	std::vector<uint8_t> _localTagPresent; // by slot
+};
+
+} // namespace ZeroTier
+
+#endif
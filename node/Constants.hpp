@@ -150,6 +150,13 @@
 #endif
 #endif
 
+/**
+ * Cache line size assumed when padding apart fields written by different threads
+ */
+#ifndef ZT_CACHE_LINE_SIZE
+#define ZT_CACHE_LINE_SIZE 64
+#endif
+
 #ifdef __WINDOWS__
 #define ZT_PACKED_STRUCT(D) __pragma(pack(push,1)) D __pragma(pack(pop))
 #else
@@ -191,12 +198,48 @@
 #define ZT_MAX_PACKET_FRAGMENTS 7
 
 /**
- * Size of RX queue
+ * Size of RX queue (fragment reassembly table) in entries
+ *
+ * Entries keep only fragment payloads, so this is about 2mb plus the heads
+ * of packets in flight. It can be decreased for small devices by defining
+ * it at build time. It must be a power of two and a multiple of
+ * ZT_RX_QUEUE_WAYS.
+ */
+#ifndef ZT_RX_QUEUE_SIZE
+#define ZT_RX_QUEUE_SIZE 256
+#endif
+
+/**
+ * Entries per RX queue bucket
+ *
+ * Packet IDs are hashed to a bucket, and a new packet replaces the oldest
+ * entry in its bucket. Less than about 4 is going to cause a lot of lost
+ * packets under load.
+ */
+#ifndef ZT_RX_QUEUE_WAYS
+#define ZT_RX_QUEUE_WAYS 4
+#endif
+
+/**
+ * Freed packet buffers each thread keeps for reuse
  *
- * This is about 2mb, and can be decreased for small devices. A queue smaller
- * than about 4 is probably going to cause a lot of lost packets.
+ * Packets are about 10kb each, so this bounds the pool at a few hundred kb
+ * per thread.
+ */
+#define ZT_PACKET_POOL_MAX_FREE 32
+
+/**
+ * Maximum packets queued by Node::SendBatch before it is flushed to the host
  */
-#define ZT_RX_QUEUE_SIZE 64
+#define ZT_SEND_BATCH_MAX_PACKETS 64
+
+/**
+ * Bytes of packet data queued by Node::SendBatch before it is flushed to the host
+ *
+ * This is enough for a maximum size fragmented packet or a fan-out of a few
+ * dozen full-size multicast frames.
+ */
+#define ZT_SEND_BATCH_MAX_BYTES 65536
 
 /**
  * RX queue entries older than this do not "exist"
@@ -215,9 +258,23 @@
 
 /**
  * How often Topology::clean() and Network::clean() and similar are called, in ms
+ *
+ * Topology, Multicaster and SelfAwareness housekeeping is done a slice at a
+ * time on each background task run and covers each table about once in this
+ * period.
  */
 #define ZT_HOUSEKEEPING_PERIOD 60000
 
+/**
+ * Most table entries examined by one housekeeping slice of one table
+ *
+ * This bounds how long housekeeping holds any table's lock during a single
+ * call to processBackgroundTasks().
+ */
+#ifndef ZT_HOUSEKEEPING_SLICE_MAX
+#define ZT_HOUSEKEEPING_SLICE_MAX 2048
+#endif
+
 /**
  * How long to remember peer records in RAM if they haven't been used
  */
@@ -228,11 +285,61 @@
  */
 #define ZT_WHOIS_RETRY_DELAY 1000
 
+/**
+ * Shortest time in ms an upstream may take to answer before another is preferred
+ *
+ * An upstream that leaves a WHOIS or a probe unanswered for longer than its
+ * path's retransmission timeout (smoothed RTT plus four times the jitter, as
+ * in RFC 6298) is passed over until it answers again. This floor keeps the
+ * jitter of very close roots from flipping between them.
+ */
+#define ZT_UPSTREAM_MIN_ANSWER_TIMEOUT 100
+
+/**
+ * Delay between probes of a network's relays for a peer we have no direct path to
+ *
+ * One candidate is probed at a time, since a peer only answers one ECHO
+ * from us per ZT_PEER_GENERAL_RATE_LIMIT.
+ */
+#define ZT_PEER_RELAY_PROBE_INTERVAL 2000
+
+/**
+ * How long a member relay is used after it last carried an answered probe
+ */
+#define ZT_PEER_RELAY_EXPIRATION 60000
+
 /**
  * Maximum identity WHOIS retries (each attempt tries consulting a different peer)
  */
 #define ZT_MAX_WHOIS_RETRIES 4
 
+/**
+ * Window in ms over which new WHOIS lookups are coalesced into one packet
+ *
+ * A lookup goes out at once unless another went out less than this long
+ * ago, in which case it waits to be sent along with any others.
+ */
+#define ZT_WHOIS_BATCH_WINDOW 20
+
+/**
+ * Maximum addresses per WHOIS packet
+ *
+ * This keeps the OK carrying all the identities to a few fragments.
+ */
+#define ZT_WHOIS_MAX_BATCH 32
+
+/**
+ * Most WHOIS requesters a root answers later for one address it had to look up
+ */
+#define ZT_WHOIS_MAX_DEFERRED_REPLIES 8
+
+/**
+ * Maximum packets queued for one destination awaiting WHOIS or a path
+ *
+ * When full the oldest packet for that destination is dropped.
+ */
+#define ZT_TX_QUEUE_PER_DESTINATION 32
+
 /**
  * Transmit queue entry timeout
  */
@@ -255,6 +362,55 @@
  */
 #define ZT_RELAY_MAX_HOPS 3
 
+/**
+ * Default maximum bytes per second relayed from or toward any one peer
+ *
+ * Relaying is meant to carry traffic until a direct path is found, so this
+ * is generous for that but keeps one peer from hogging a root. It can be
+ * changed at runtime with Node::setRelayBandwidthLimit().
+ */
+#ifndef ZT_RELAY_MAX_BYTES_PER_DESTINATION_PER_SECOND
+#define ZT_RELAY_MAX_BYTES_PER_DESTINATION_PER_SECOND 67108864
+#endif
+
+/**
+ * Milliseconds of relay rate limit a peer may use at once after being idle
+ */
+#define ZT_RELAY_BURST_MS 250
+
+/**
+ * Slots in the per-peer relay rate limit table (power of two)
+ *
+ * Peers hashing to a slot that is in use take it over, so this bounds
+ * memory rather than the number of peers limited.
+ */
+#define ZT_RELAY_RATE_LIMIT_SLOTS 4096
+
+/**
+ * Maximum bytes waiting in egress queues when a bandwidth cap is set
+ */
+#define ZT_QOS_MAX_QUEUE_BYTES 4194304
+
+/**
+ * Maximum packets waiting for one peer in one traffic class
+ */
+#define ZT_QOS_MAX_QUEUE_PER_PEER 512
+
+/**
+ * Burst allowed by an egress bandwidth cap, in milliseconds at the capped rate
+ */
+#define ZT_QOS_BURST_MS 20
+
+/**
+ * Burst allowed by an egress bandwidth cap when pacing, in milliseconds at the capped rate
+ *
+ * This is about as fine as the host's timers can reliably wake us. Like
+ * ZT_QOS_BURST_MS it is floored at ZT_PROTO_MAX_PACKET_LENGTH so the largest
+ * datagram we send can always go, so it only tightens things at caps above
+ * a few megabits per second.
+ */
+#define ZT_QOS_PACED_BURST_MS 2
+
 /**
  * Maximum number of upstreams to use (far more than we should ever need)
  */
@@ -270,6 +426,30 @@
  */
 #define ZT_MULTICAST_ANNOUNCE_PERIOD 120000
 
+/**
+ * How long after an IGMP or MLD query is seen from a bridge that a querier is assumed present
+ *
+ * Queriers ask every 125 seconds by default, so this allows one to be missed.
+ */
+#define ZT_MULTICAST_SNOOP_QUERIER_TIMEOUT 300000
+
+/**
+ * How long a bridged IP multicast group lingers after a leave in case other hosts still want it
+ *
+ * The querier follows a leave with a group-specific query that any remaining
+ * member answers within a second or two, which refreshes the group.
+ */
+#define ZT_MULTICAST_SNOOP_LEAVE_DELAY 10000
+
+/**
+ * Minimum time between batches of newly joined multicast groups
+ *
+ * Groups joined between full announcements go out as deltas. The first
+ * goes at once, and any that follow within this window (as when an
+ * interface comes up with many addresses) are sent together after it.
+ */
+#define ZT_MULTICAST_ANNOUNCE_BATCH_WINDOW 100
+
 /**
  * Delay between explicit MULTICAST_GATHER requests for a given multicast channel
  */
@@ -287,6 +467,13 @@
  */
 #define ZT_MULTICAST_TRANSMIT_TIMEOUT 5000
 
+/**
+ * Size in bits of the filter of addresses an outbound multicast was sent to
+ *
+ * This should be several times the usual multicast limit.
+ */
+#define ZT_MULTICAST_SENT_BLOOM_BITS 1024
+
 /**
  * Delay between checks of peer pings, etc., and also related housekeeping tasks
  */
@@ -302,6 +489,42 @@
  */
 #define ZT_PATH_ALIVE_TIMEOUT 45000
 
+/**
+ * Longest a heartbeat period can be stretched to on a path whose NAT binding outlasts it
+ *
+ * This must stay well under ZT_PATH_ALIVE_TIMEOUT, since a path carrying
+ * traffic one way is only kept alive the other way by the peer's heartbeats.
+ */
+#define ZT_PATH_KEEPALIVE_MAX 35000
+
+/**
+ * Heartbeats are sent this long before a path's measured NAT binding timeout
+ */
+#define ZT_PATH_NAT_PROBE_MARGIN 3000
+
+/**
+ * NAT binding timeout search stops when it's known to within this much
+ */
+#define ZT_PATH_NAT_PROBE_RESOLUTION 2000
+
+/**
+ * Minimum time between NAT binding timeout probes on a path
+ */
+#define ZT_PATH_NAT_PROBE_INTERVAL 60000
+
+/**
+ * How long past its delay to wait for a NAT binding timeout probe to be answered
+ */
+#define ZT_PATH_NAT_PROBE_TIMEOUT 5000
+
+/**
+ * Longest delay a NAT binding timeout probe can ask for (or that we'll honor)
+ *
+ * This is just enough for the search to reach ZT_PATH_KEEPALIVE_MAX. With
+ * ZT_PATH_NAT_PROBE_TIMEOUT it must not exceed ZT_PATH_ALIVE_TIMEOUT.
+ */
+#define ZT_PATH_NAT_PROBE_MAX_DELAY (ZT_PATH_KEEPALIVE_MAX + ZT_PATH_NAT_PROBE_MARGIN + ZT_PATH_NAT_PROBE_RESOLUTION)
+
 /**
  * Minimum time between attempts to check dead paths to see if they can be re-awakened
  */
@@ -312,6 +535,16 @@
  */
 #define ZT_PATH_HELLO_RATE_LIMIT 1000
 
+/**
+ * Path MTU is rediscovered this often on paths carrying packets too big for the default MTU
+ */
+#define ZT_PATH_MTU_PROBE_INTERVAL 120000
+
+/**
+ * How long to wait for a path MTU probe to be answered before trying a smaller size
+ */
+#define ZT_PATH_MTU_PROBE_TIMEOUT 3000
+
 /**
  * Delay between full-fledge pings of directly connected peers
  */
@@ -359,22 +592,89 @@
  */
 #define ZT_MIN_UNITE_INTERVAL 30000
 
+/**
+ * Ports above a hinted IPv4 port also tried when answering a RENDEZVOUS
+ *
+ * Many NATs that map each destination to a new port hand them out in
+ * sequence, so the other side's next mapping is likely just above the one
+ * the relay saw. Zero disables port prediction.
+ */
+#define ZT_RENDEZVOUS_PORT_PREDICTION 2
+
 /**
  * How often should peers try memorized or statically defined paths?
  */
 #define ZT_TRY_MEMORIZED_PATH_INTERVAL 30000
 
+/**
+ * Minimum interval between peer cache writes for a peer that is still alive
+ *
+ * Peers are also written once when they are dropped from memory.
+ */
+#define ZT_PEER_STATE_SAVE_INTERVAL 600000
+
+/**
+ * Smallest change in latency (ms) reported with ZT_EVENT_PEER_LATENCY_CHANGED
+ *
+ * Changes of less than an eighth of the last reported latency are not
+ * reported either, so jitter on long paths doesn't flood the event callback.
+ */
+#define ZT_PEER_LATENCY_EVENT_MIN_DELTA 5
+
+/**
+ * Peer cache records older than this are ignored (30 days)
+ */
+#define ZT_PEER_STATE_MAX_AGE 2592000000ULL
+
+/**
+ * Identities held without a Peer (see Topology::addIdentity) expire after this long unused
+ */
+#define ZT_KNOWN_IDENTITY_EXPIRATION 3600000
+
+/**
+ * Known identities on roots and moons expire after this long unused (one day)
+ *
+ * These are also in the identity store (ZT_STATE_OBJECT_IDENTITY), from
+ * which they come back on the next WHOIS, so this only bounds memory.
+ */
+#define ZT_ROOT_KNOWN_IDENTITY_EXPIRATION 86400000
+
+/**
+ * With a peer limit set, known identities are limited to this many times it
+ */
+#define ZT_KNOWN_IDENTITY_LIMIT_FACTOR 8
+
 /**
  * Sanity limit on maximum bridge routes
  *
- * If the number of bridge routes exceeds this, we cull routes from the
- * bridges with the most MACs behind them until it doesn't. This is a
- * sanity limit to prevent memory-filling DOS attacks, nothing more. No
- * physical LAN has anywhere even close to this many nodes. Note that this
- * does not limit the size of ZT virtual LANs, only bridge routing.
+ * If the number of bridge routes exceeds this, the least recently learned
+ * routes are dropped. This is a sanity limit to prevent memory-filling DOS
+ * attacks, nothing more. No physical LAN has anywhere even close to this
+ * many nodes. Note that this does not limit the size of ZT virtual LANs,
+ * only bridge routing.
  */
 #define ZT_MAX_BRIDGE_ROUTES 67108864
 
+/**
+ * Maximum number of MACs learned behind any single bridge
+ *
+ * A bridge over this quota loses its own least recently learned routes
+ * first, so one spamming bridge can't evict routes learned from others.
+ */
+#define ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE 1048576
+
+/**
+ * Maximum number of network addresses remembered for answering ARP and NDP
+ *
+ * Past this, addresses not already known are not learned until some expire.
+ */
+#define ZT_NEIGHBOR_CACHE_MAX_ENTRIES 65536
+
+/**
+ * Time after which an address whose ownership hasn't been seen again is forgotten
+ */
+#define ZT_NEIGHBOR_CACHE_TTL 600000
+
 /**
  * If there is no known route, spam to up to this many active bridges
  */
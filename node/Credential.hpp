@@ -37,6 +37,14 @@
 #include <string.h>
 
 #include "Constants.hpp"
+#include "Buffer.hpp"
+#include "C25519.hpp"
+#include "Utils.hpp"
+
+/**
+ * Length of a signature on the wire: type (1 == Ed25519), 16-bit length, signature
+ */
+#define ZT_CREDENTIAL_WIRE_SIGNATURE_LENGTH (1 + 2 + ZT_C25519_SIGNATURE_LEN)
 
 namespace ZeroTier {
 
@@ -59,6 +67,38 @@ public:
 		CREDENTIAL_TYPE_COR = 5,        // CertificateOfRepresentation
 		CREDENTIAL_TYPE_REVOCATION = 6
 	};
+
+protected:
+	/*
+	 * Credentials are (de)serialized often: on every push, config chunk and
+	 * signature check. Their fixed-size parts have constant layouts (the
+	 * *_WIRE_IDX_* defines in each credential's header) and are written and
+	 * read as single fields, so each costs one bounds check and compiles to
+	 * stores or loads with byte swaps instead of a checked call per integer.
+	 */
+
+	template<unsigned int C>
+	static inline void _appendSignature(Buffer<C> &b,const C25519::Signature &sig)
+	{
+		uint8_t *const f = reinterpret_cast<uint8_t *>(b.appendField(ZT_CREDENTIAL_WIRE_SIGNATURE_LENGTH));
+		f[0] = 1; // 1 == Ed25519
+		Utils::storeBigEndian<uint16_t>(f + 1,(uint16_t)ZT_C25519_SIGNATURE_LEN);
+		memcpy(f + 3,sig.data,ZT_C25519_SIGNATURE_LEN);
+	}
+
+	// Reads an Ed25519 signature at p or skips a signature of another type, returning the position after it
+	template<unsigned int C>
+	static inline unsigned int _readSignature(const Buffer<C> &b,const unsigned int p,C25519::Signature &sig)
+	{
+		if (b[p] == 1) {
+			const uint8_t *const f = b.field(p,ZT_CREDENTIAL_WIRE_SIGNATURE_LENGTH);
+			if (Utils::loadBigEndian<uint16_t>(f + 1) != ZT_C25519_SIGNATURE_LEN)
+				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_CRYPTOGRAPHIC_TOKEN;
+			memcpy(sig.data,f + 3,ZT_C25519_SIGNATURE_LEN);
+			return (p + ZT_CREDENTIAL_WIRE_SIGNATURE_LENGTH);
+		}
+		return (p + 3 + b.template at<uint16_t>(p + 1));
+	}
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,166 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_CREDENTIALPUSHES_HPP
+#define ZT_CREDENTIALPUSHES_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "CertificateOfMembership.hpp"
+#include "CertificateOfOwnership.hpp"
+#include "Capability.hpp"
+#include "Tag.hpp"
+#include "Packet.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Switch.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Credentials collected for pushing, grouped by recipient
+ *
+ * Credentials carry their network IDs, so one NETWORK_CREDENTIALS packet
+ * can hold credentials for any number of networks. Collecting everything
+ * bound for a peer before sending lets the networks we share with it share
+ * packets too.
+ *
+ * This is not thread safe.
+ */
+class CredentialPushes : NonCopyable
+{
+public:
+	CredentialPushes() : _pending(8) {}
+
+	/**
+	 * Add a COM, unless one for the same network is already going to this peer
+	 *
+	 * @param peer Recipient
+	 * @param com Certificate of membership
+	 */
+	inline void add(const Address &peer,const CertificateOfMembership &com)
+	{
+		std::vector<CertificateOfMembership> &coms = _pending[peer].coms;
+		for(std::vector<CertificateOfMembership>::const_iterator c(coms.begin());c!=coms.end();++c) {
+			if (c->networkId() == com.networkId())
+				return;
+		}
+		coms.push_back(com);
+	}
+
+	inline void add(const Address &peer,const Capability &cap) { _pending[peer].caps.push_back(cap); }
+	inline void add(const Address &peer,const Tag &tag) { _pending[peer].tags.push_back(tag); }
+	inline void add(const Address &peer,const CertificateOfOwnership &coo) { _pending[peer].coos.push_back(coo); }
+
+	/**
+	 * @return True if nothing has been added since the last send()
+	 */
+	inline bool empty() const { return (_pending.size() == 0); }
+
+	/**
+	 * Send everything in as few NETWORK_CREDENTIALS packets as will hold it and clear
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 */
+	inline void send(const RuntimeEnvironment *RR,void *tPtr)
+	{
+		Hashtable< Address,_Pending >::Iterator i(_pending);
+		Address *peer = (Address *)0;
+		_Pending *p = (_Pending *)0;
+		while (i.next(peer,p)) {
+			unsigned int comPtr = 0,capPtr = 0,tagPtr = 0,cooPtr = 0;
+			while ((comPtr < p->coms.size())||(capPtr < p->caps.size())||(tagPtr < p->tags.size())||(cooPtr < p->coos.size())) {
+				Packet outp(*peer,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
+				bool progress = false; // the first credential in a packet always goes in
+
+				while ((comPtr < p->coms.size())&&((!progress)||((outp.size() + sizeof(CertificateOfMembership) + 16) < ZT_PROTO_MAX_PACKET_LENGTH))) {
+					p->coms[comPtr++].serialize(outp);
+					progress = true;
+				}
+				outp.append((uint8_t)0x00);
+
+				unsigned int countAt = outp.size();
+				unsigned int count = 0;
+				outp.addSize(2);
+				while ((capPtr < p->caps.size())&&((!progress)||((outp.size() + sizeof(Capability) + 16) < ZT_PROTO_MAX_PACKET_LENGTH))) {
+					p->caps[capPtr++].serialize(outp);
+					++count;
+					progress = true;
+				}
+				outp.setAt(countAt,(uint16_t)count);
+
+				countAt = outp.size();
+				count = 0;
+				outp.addSize(2);
+				while ((tagPtr < p->tags.size())&&((!progress)||((outp.size() + sizeof(Tag) + 16) < ZT_PROTO_MAX_PACKET_LENGTH))) {
+					p->tags[tagPtr++].serialize(outp);
+					++count;
+					progress = true;
+				}
+				outp.setAt(countAt,(uint16_t)count);
+
+				// No revocations, these propagate differently
+				outp.append((uint16_t)0);
+
+				countAt = outp.size();
+				count = 0;
+				outp.addSize(2);
+				while ((cooPtr < p->coos.size())&&((!progress)||((outp.size() + sizeof(CertificateOfOwnership) + 16) < ZT_PROTO_MAX_PACKET_LENGTH))) {
+					p->coos[cooPtr++].serialize(outp);
+					++count;
+					progress = true;
+				}
+				outp.setAt(countAt,(uint16_t)count);
+
+				outp.compress();
+				RR->sw->send(tPtr,outp,true);
+			}
+		}
+		_pending.clear();
+	}
+
+private:
+	struct _Pending
+	{
+		std::vector<CertificateOfMembership> coms;
+		std::vector<Capability> caps;
+		std::vector<Tag> tags;
+		std::vector<CertificateOfOwnership> coos;
+	};
+
+	Hashtable< Address,_Pending > _pending;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include "CryptoPipeline.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "IncomingPacket.hpp"
+#include "Packet.hpp"
+#include "Peer.hpp"
+#include "Path.hpp"
+#include "Switch.hpp"
+#include "Node.hpp"
+#include "Latency.hpp"
+#include "Metrics.hpp"
+
+namespace ZeroTier {
+
+struct CryptoPipeline::Job
+{
+	Job(const bool o) : next((Job *)0),seq(0),outbound(o) {}
+	virtual ~Job() {}
+
+	SharedPtr<Peer> peer;
+	Job *next; // in Sequencer::_done
+	uint64_t seq;
+	const bool outbound;
+};
+
+namespace {
+
+struct _InboundJob : public CryptoPipeline::Job
+{
+	_InboundJob() : CryptoPipeline::Job(false) {}
+	IncomingPacket pkt;
+	int result; // IncomingPacket::DearmorResult
+};
+
+struct _OutboundJob : public CryptoPipeline::Job
+{
+	_OutboundJob() : CryptoPipeline::Job(true) {}
+	Packet pkt;
+	SharedPtr<Path> path;
+	uint64_t now;
+	unsigned int counter;
+	unsigned int chunkSize;
+	unsigned int qosClass;
+	bool encrypt;
+};
+
+} // anonymous namespace
+
+CryptoPipeline::CryptoPipeline() :
+	_head(0),
+	_count(0)
+{
+}
+
+CryptoPipeline::~CryptoPipeline()
+{
+	// Jobs that already finished may be waiting in their sequencers for
+	// ones still queued here, and hold their peers, so drop those too.
+	std::vector<Job *> dead;
+	while (_count) {
+		Job *const j = _q[_head];
+		_head = (_head + 1) % ZT_CRYPTO_PIPELINE_MAX_JOBS;
+		--_count;
+		Sequencer &s = (j->outbound) ? j->peer->outboundSequencer() : j->peer->inboundSequencer();
+		{
+			Mutex::Lock _l(s._lock);
+			while (s._done) {
+				dead.push_back(s._done);
+				s._done = s._done->next;
+			}
+		}
+		dead.push_back(j);
+	}
+	for(std::vector<Job *>::iterator j(dead.begin());j!=dead.end();++j)
+		delete *j;
+	for(std::vector<Job *>::iterator j(_freeIn.begin());j!=_freeIn.end();++j)
+		delete *j;
+	for(std::vector<Job *>::iterator j(_freeOut.begin());j!=_freeOut.end();++j)
+		delete *j;
+}
+
+bool CryptoPipeline::inbound(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const IncomingPacket &pkt,const uint64_t now)
+{
+	if (!peer->inboundSequencer()._use(now))
+		return false;
+	// A job takes a place in the peer's window before its MAC is checked, so
+	// only packets from a path the peer already has live traffic on may be
+	// queued. Anything else could be spoofed to fill the window and crowd out
+	// the peer's real packets, so it's checked inline instead.
+	if (!peer->hasActivePathTo(now,pkt._path->address()))
+		return false;
+
+	_InboundJob *j = (_InboundJob *)0;
+	{
+		Mutex::Lock _l(_lock);
+		if (!_freeIn.empty()) {
+			j = static_cast<_InboundJob *>(_freeIn.back());
+			_freeIn.pop_back();
+		}
+	}
+	if (!j)
+		j = new _InboundJob();
+	j->peer = peer;
+	j->pkt.init(pkt.data(),pkt.size(),pkt._path,pkt._receiveTime);
+	j->pkt._ce = pkt._ce;
+	return _enqueue(RR,tPtr,j);
+}
+
+bool CryptoPipeline::outbound(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const Packet &pkt,const bool encrypt,const unsigned int counter,const unsigned int chunkSize,const unsigned int qosClass,const uint64_t now)
+{
+	if (!peer->outboundSequencer()._use(now))
+		return false;
+
+	_OutboundJob *j = (_OutboundJob *)0;
+	{
+		Mutex::Lock _l(_lock);
+		if (!_freeOut.empty()) {
+			j = static_cast<_OutboundJob *>(_freeOut.back());
+			_freeOut.pop_back();
+		}
+	}
+	if (!j)
+		j = new _OutboundJob();
+	j->peer = peer;
+	j->pkt.copyFrom(pkt.data(),pkt.size());
+	j->path = path;
+	j->now = now;
+	j->counter = counter;
+	j->chunkSize = chunkSize;
+	j->qosClass = qosClass;
+	j->encrypt = encrypt;
+	return _enqueue(RR,tPtr,j);
+}
+
+unsigned int CryptoPipeline::process(const RuntimeEnvironment *RR,void *tPtr,const unsigned int max)
+{
+	unsigned int n = 0;
+	while (n < max) {
+		Job *j;
+		{
+			Mutex::Lock _l(_lock);
+			if (!_count)
+				break;
+			j = _q[_head];
+			_head = (_head + 1) % ZT_CRYPTO_PIPELINE_MAX_JOBS;
+			--_count;
+		}
+		_run(RR,j);
+		_finish(RR,tPtr,j);
+		++n;
+	}
+	return n;
+}
+
+void CryptoPipeline::memoryUsage(MemoryUsage &mu)
+{
+	Mutex::Lock _l(_lock);
+	uint64_t bytes = (_freeIn.size() * sizeof(_InboundJob)) + (_freeOut.size() * sizeof(_OutboundJob));
+	for(unsigned int i=0;i<_count;++i)
+		bytes += (_q[(_head + i) % ZT_CRYPTO_PIPELINE_MAX_JOBS]->outbound) ? sizeof(_OutboundJob) : sizeof(_InboundJob);
+	mu.add(MemoryUsage::CRYPTO_JOBS,_count,bytes);
+}
+
+bool CryptoPipeline::_enqueue(const RuntimeEnvironment *RR,void *tPtr,Job *j)
+{
+	Sequencer &s = (j->outbound) ? j->peer->outboundSequencer() : j->peer->inboundSequencer();
+	bool full;
+	{
+		Mutex::Lock _l(s._lock);
+		full = ((s._nextAssign - s._nextDeliver) >= ZT_CRYPTO_PIPELINE_WINDOW);
+		if (!full)
+			j->seq = s._nextAssign++;
+	}
+	if (full) {
+		// Handling it out of turn would reorder it, so this is tail drop like a full NIC queue
+		_free(j);
+		RR->metrics->inc(Metrics::CRYPTO_JOBS_DROPPED);
+		return true;
+	}
+
+	{
+		Mutex::Lock _l(_lock);
+		if (_count < ZT_CRYPTO_PIPELINE_MAX_JOBS) {
+			_q[(_head + _count) % ZT_CRYPTO_PIPELINE_MAX_JOBS] = j;
+			++_count;
+			j = (Job *)0;
+		}
+	}
+
+	if (j) {
+		// Workers are behind, so do this one here but keep it in order
+		RR->metrics->inc(Metrics::CRYPTO_JOBS_INLINE);
+		_run(RR,j);
+		_finish(RR,tPtr,j);
+	} else {
+		RR->metrics->inc(Metrics::CRYPTO_JOBS_WORKER);
+		RR->node->postCryptoJobs(tPtr);
+	}
+	return true;
+}
+
+void CryptoPipeline::_run(const RuntimeEnvironment *RR,Job *j)
+{
+	if (j->outbound) {
+		_OutboundJob *const oj = static_cast<_OutboundJob *>(j);
+		Latency::Scope _ls(RR->latency,Latency::ARMOR);
+		if ((oj->encrypt)&&(oj->peer->aesGmacSivEnabled())) {
+			oj->pkt.armorAesGmacSiv(oj->peer->aesKeys(),oj->counter);
+		} else {
+			oj->pkt.armor(oj->peer->key(),oj->encrypt,oj->counter,oj->peer->keySchedule());
+		}
+	} else {
+		_InboundJob *const ij = static_cast<_InboundJob *>(j);
+		try {
+			ij->result = (int)ij->pkt._dearmorAndUncompress(RR,ij->peer,false);
+		} catch ( ... ) {
+			ij->result = (int)IncomingPacket::DEARMOR_UNCOMPRESS_FAILED;
+		}
+	}
+}
+
+void CryptoPipeline::_finish(const RuntimeEnvironment *RR,void *tPtr,Job *j)
+{
+	const SharedPtr<Peer> peer(j->peer); // the sequencer lives in the peer, which must outlive this
+	Sequencer &s = (j->outbound) ? peer->outboundSequencer() : peer->inboundSequencer();
+
+	{
+		Mutex::Lock _l(s._lock);
+		Job **p = &(s._done);
+		while ((*p)&&((*p)->seq < j->seq))
+			p = &((*p)->next);
+		j->next = *p;
+		*p = j;
+		if (s._delivering)
+			return; // whoever is delivering will get to it
+		s._delivering = true;
+	}
+
+	for(;;) {
+		Job *d;
+		{
+			Mutex::Lock _l(s._lock);
+			d = s._done;
+			if ((!d)||(d->seq != s._nextDeliver)) {
+				s._delivering = false;
+				return;
+			}
+			s._done = d->next;
+			++s._nextDeliver;
+		}
+
+		try {
+			if (d->outbound) {
+				_OutboundJob *const oj = static_cast<_OutboundJob *>(d);
+				RR->sw->_sendArmored(tPtr,oj->path,oj->pkt,oj->chunkSize,oj->now,oj->qosClass,peer->address());
+			} else {
+				_InboundJob *const ij = static_cast<_InboundJob *>(d);
+				ij->pkt._decoded(RR,tPtr,peer,(IncomingPacket::DearmorResult)ij->result);
+			}
+		} catch ( ... ) {} // same as an invalid packet inline, which tryDecode() would have traced and dropped
+
+		_free(d);
+	}
+}
+
+void CryptoPipeline::_free(Job *j)
+{
+	j->peer.zero();
+	j->next = (Job *)0;
+	if (j->outbound)
+		static_cast<_OutboundJob *>(j)->path.zero();
+	else static_cast<_InboundJob *>(j)->pkt._path.zero();
+
+	{
+		Mutex::Lock _l(_lock);
+		std::vector<Job *> &fl = (j->outbound) ? _freeOut : _freeIn;
+		if (fl.size() < ZT_CRYPTO_PIPELINE_MAX_FREE) {
+			fl.push_back(j);
+			return;
+		}
+	}
+	delete j;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,211 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_CRYPTOPIPELINE_HPP
+#define ZT_CRYPTOPIPELINE_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "MemoryUsage.hpp"
+
+/**
+ * Maximum number of packets waiting for a crypto worker
+ */
+#define ZT_CRYPTO_PIPELINE_MAX_JOBS 1024
+
+/**
+ * Maximum packets in flight through the pipeline per peer and direction
+ */
+#define ZT_CRYPTO_PIPELINE_WINDOW 256
+
+/**
+ * Packets per second in one direction at which a peer's packets are pipelined
+ */
+#define ZT_CRYPTO_PIPELINE_MIN_RATE 2000
+
+/**
+ * Idle jobs of each direction kept for reuse
+ */
+#define ZT_CRYPTO_PIPELINE_MAX_FREE 64
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class Peer;
+class Path;
+class Packet;
+class IncomingPacket;
+
+/**
+ * Spreads armor() and dearmor() for busy peers over embedder worker threads
+ *
+ * A single heavy flow between two peers otherwise lands on one I/O thread
+ * and is limited by one core's cipher throughput. Once a peer sends or
+ * receives at least ZT_CRYPTO_PIPELINE_MIN_RATE packets per second in a
+ * direction, its packets in that direction are numbered and queued here, and
+ * the embedder's worker threads (see ZT_CryptoJobsFunction) run the cipher
+ * and MAC on them in any order. Each peer has a Sequencer per direction that
+ * then hands finished packets on strictly in the order they were numbered:
+ * whichever thread finishes the packet at the head delivers it and every
+ * finished packet right behind it, so delivery to taps and the wire is never
+ * reordered and never needs a thread of its own.
+ *
+ * If the queue is full the caller runs the cipher itself, which still goes
+ * through the sequencer. If a peer already has ZT_CRYPTO_PIPELINE_WINDOW
+ * packets in flight in a direction, more are dropped rather than let past.
+ * Inbound packets are only queued if they came in on one of the peer's live
+ * paths, since they count against its window before they're authenticated.
+ */
+class CryptoPipeline : NonCopyable
+{
+public:
+	struct Job;
+
+	/**
+	 * Per-peer, per-direction numbering and in-order delivery of jobs
+	 */
+	class Sequencer : NonCopyable
+	{
+		friend class CryptoPipeline;
+
+	public:
+		Sequencer() :
+			_nextAssign(0),
+			_nextDeliver(0),
+			_done((Job *)0),
+			_delivering(false),
+			_rateStart(0),
+			_rateCount(0),
+			_heavy(false) {}
+
+	private:
+		// Counts a packet and returns whether this direction should use the
+		// pipeline. This is approximate and lock-free; a lost increment only
+		// shifts when a peer crosses the threshold.
+		inline bool _use(const uint64_t now)
+		{
+			if ((now - _rateStart) >= 1000) {
+				_heavy = (_rateCount >= ZT_CRYPTO_PIPELINE_MIN_RATE);
+				_rateStart = now;
+				_rateCount = 0;
+			}
+			++_rateCount;
+			// Stay on the pipeline until it drains so a peer going quiet isn't
+			// reordered (an unlocked read, so at worst one packet slips past)
+			return ((_heavy)||(_nextAssign != _nextDeliver));
+		}
+
+		uint64_t _nextAssign;
+		uint64_t _nextDeliver;
+		Job *_done; // finished jobs waiting for ones ahead of them, sorted by sequence number
+		bool _delivering;
+		Mutex _lock;
+
+		volatile uint64_t _rateStart;
+		volatile unsigned int _rateCount;
+		volatile bool _heavy;
+	};
+
+	CryptoPipeline();
+	~CryptoPipeline();
+
+	/**
+	 * Queue a packet from a busy peer for dearmor() and uncompress()
+	 *
+	 * Once finished, the packet continues to its verb handler in the order
+	 * it arrived, on whichever thread delivers it.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Peer that sent packet
+	 * @param pkt Packet (still armored)
+	 * @param now Current time
+	 * @return True if taken or dropped (packet is done), false to decode it inline
+	 */
+	bool inbound(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const IncomingPacket &pkt,const uint64_t now);
+
+	/**
+	 * Queue a packet to a busy peer for armor()
+	 *
+	 * Once finished, the packet is sent (and fragmented if needed) in the
+	 * order it was queued, on whichever thread delivers it.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Destination peer
+	 * @param path Path to send via
+	 * @param pkt Packet (not yet armored)
+	 * @param encrypt Encrypt payload
+	 * @param counter Outgoing counter for path
+	 * @param chunkSize Size of head (first) chunk
+	 * @param qosClass Egress class
+	 * @param now Current time
+	 * @return True if taken or dropped (packet is done), false to armor and send it inline
+	 */
+	bool outbound(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const Packet &pkt,const bool encrypt,const unsigned int counter,const unsigned int chunkSize,const unsigned int qosClass,const uint64_t now);
+
+	/**
+	 * Run queued jobs
+	 *
+	 * This may be called by any number of threads at once.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param max Maximum number of jobs to run
+	 * @return Number of jobs run
+	 */
+	unsigned int process(const RuntimeEnvironment *RR,void *tPtr,const unsigned int max);
+
+	/**
+	 * Add queued and idle jobs to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
+private:
+	bool _enqueue(const RuntimeEnvironment *RR,void *tPtr,Job *j);
+	void _run(const RuntimeEnvironment *RR,Job *j);
+	void _finish(const RuntimeEnvironment *RR,void *tPtr,Job *j);
+	void _free(Job *j);
+
+	Job *_q[ZT_CRYPTO_PIPELINE_MAX_JOBS];
+	unsigned int _head;
+	unsigned int _count;
+	std::vector<Job *> _freeIn;
+	std::vector<Job *> _freeOut;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_DEFERREDPACKETS_HPP
+#define ZT_DEFERREDPACKETS_HPP
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Mutex.hpp"
+#include "Hashtable.hpp"
+#include "CompactInetAddress.hpp"
+#include "IncomingPacket.hpp"
+#include "MemoryUsage.hpp"
+
+/**
+ * Maximum number of packets waiting for a worker thread
+ */
+#define ZT_DEFERRED_PACKETS_MAX 256
+
+/**
+ * Maximum number of unauthenticated packets waiting from any one physical source IP
+ */
+#define ZT_DEFERRED_PACKETS_MAX_PER_SOURCE 16
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Packets that are expensive to decode, waiting for embedder worker threads
+ *
+ * HELLOs from peers we don't know yet (identity validation and key
+ * agreement), OK(WHOIS) (identity validation), and NETWORK_CREDENTIALS
+ * (signature checks) are queued here if the embedder supplies a
+ * deferredPacketsFunction, so the thread that received them can go back to
+ * forwarding. Worker threads decode them with process().
+ *
+ * Unauthenticated packets are admitted per source IP so that a HELLO flood
+ * from one place can't take the whole queue. Authenticated packets come
+ * from peers that already hold a key with us and are only refused if the
+ * queue is full, in which case the caller decodes them inline.
+ */
+class DeferredPackets : NonCopyable
+{
+public:
+	DeferredPackets() :
+		_head(0),
+		_count(0),
+		_perSource(32) {}
+
+	~DeferredPackets()
+	{
+		while (_count) {
+			delete _q[_head];
+			_head = (_head + 1) % ZT_DEFERRED_PACKETS_MAX;
+			--_count;
+		}
+	}
+
+	/**
+	 * Queue a copy of a packet
+	 *
+	 * @param pkt Packet to queue
+	 * @param authenticated True if pkt has been dearmored and decompressed and should go straight to its verb
+	 * @return True if queued, false if the queue or this packet's source is full
+	 */
+	inline bool enqueue(const IncomingPacket &pkt,const bool authenticated)
+	{
+		CompactInetAddress src;
+		if (!authenticated) {
+			src = pkt._path->compactAddress();
+			src.setPort(0);
+		}
+
+		Mutex::Lock _l(_lock);
+		if (_count >= ZT_DEFERRED_PACKETS_MAX)
+			return false;
+		if (!authenticated) {
+			unsigned int &n = _perSource[src];
+			if (n >= ZT_DEFERRED_PACKETS_MAX_PER_SOURCE)
+				return false;
+			++n;
+		}
+
+		IncomingPacket *const p = new IncomingPacket(pkt.data(),pkt.size(),pkt._path,pkt._receiveTime);
+		p->_deferred = true;
+		p->_authenticated = authenticated;
+		p->_ce = pkt._ce;
+		_q[(_head + _count) % ZT_DEFERRED_PACKETS_MAX] = p;
+		++_count;
+		return true;
+	}
+
+	/**
+	 * Add queued packets to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	inline void memoryUsage(MemoryUsage &mu)
+	{
+		Mutex::Lock _l(_lock);
+		mu.add(MemoryUsage::DEFERRED_PACKETS,_count,(_count * sizeof(IncomingPacket)) + _perSource.footprint());
+	}
+
+	/**
+	 * Decode queued packets
+	 *
+	 * This may be called by any number of threads at once.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param max Maximum number of packets to decode
+	 * @return Number of packets decoded
+	 */
+	inline unsigned int process(const RuntimeEnvironment *RR,void *tPtr,const unsigned int max)
+	{
+		unsigned int n = 0;
+		while (n < max) {
+			IncomingPacket *p;
+			{
+				Mutex::Lock _l(_lock);
+				if (!_count)
+					break;
+				p = _q[_head];
+				_head = (_head + 1) % ZT_DEFERRED_PACKETS_MAX;
+				--_count;
+				if (!p->_authenticated) {
+					CompactInetAddress src(p->_path->compactAddress());
+					src.setPort(0);
+					unsigned int *const c = _perSource.get(src);
+					if ((c)&&(--*c == 0))
+						_perSource.erase(src);
+				}
+			}
+			// Deferred packets are never requeued, so one still waiting for a WHOIS is dropped
+			p->tryDecode(RR,tPtr);
+			delete p;
+			++n;
+		}
+		return n;
+	}
+
+private:
+	IncomingPacket *_q[ZT_DEFERRED_PACKETS_MAX];
+	unsigned int _head;
+	unsigned int _count;
+	Hashtable< CompactInetAddress,unsigned int > _perSource; // unauthenticated packets queued per source IP
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -31,11 +31,91 @@
 #include "Utils.hpp"
 #include "Buffer.hpp"
 #include "Address.hpp"
+#include "NonCopyable.hpp"
 
 #include <stdint.h>
 
+/**
+ * Maximum number of keys in a Dictionary::Index, beyond which lookups fall back to scanning
+ */
+#define ZT_DICTIONARY_INDEX_MAX_KEYS 128
+
+/**
+ * Hash table slots in a Dictionary::Index (power of two, at least twice ZT_DICTIONARY_INDEX_MAX_KEYS)
+ */
+#define ZT_DICTIONARY_INDEX_SLOTS 256
+
+/**
+ * Largest Dictionary capacity kept inline, above which data is on the heap and sized to content
+ */
+#define ZT_DICTIONARY_MAX_INLINE 16384
+
 namespace ZeroTier {
 
+// Fixed inline storage for a Dictionary
+template<unsigned int C,bool H>
+class _DictionaryStorage
+{
+public:
+	_DictionaryStorage() { _d[0] = (char)0; }
+
+	inline const char *ptr() const { return _d; }
+	inline char *wptr() { return _d; }
+	inline unsigned int size() const { return C; }
+	inline bool grow(const unsigned int n) { return (n <= C); }
+	inline void clear() { _d[0] = (char)0; }
+
+private:
+	char _d[C];
+};
+
+// Heap storage for a large Dictionary, allocated on first use and grown as needed up to C
+template<unsigned int C>
+class _DictionaryStorage<C,true> : NonCopyable
+{
+public:
+	_DictionaryStorage() : _d((char *)0),_size(0) {}
+	~_DictionaryStorage() { delete [] _d; }
+
+	inline const char *ptr() const { return ((_d) ? _d : ""); }
+	inline char *wptr() { return _d; } // only valid after a successful grow()
+	inline unsigned int size() const { return ((_d) ? _size : 1); }
+
+	inline bool grow(const unsigned int n)
+	{
+		if (n > C)
+			return false;
+		if ((!_d)||(n > _size)) {
+			unsigned int ns = (_size) ? (_size * 2) : 256;
+			if (ns < n)
+				ns = n;
+			if (ns > C)
+				ns = C;
+			char *const d = new char[ns];
+			if (_d) {
+				memcpy(d,_d,_size);
+				delete [] _d;
+			} else {
+				d[0] = (char)0;
+			}
+			_d = d;
+			_size = ns;
+		}
+		return true;
+	}
+
+	inline void clear()
+	{
+		delete [] _d;
+		_d = (char *)0;
+		_size = 0;
+	}
+
+private:
+	char *_d;
+	unsigned int _size;
+};
+
 /**
  * A small (in code and data) packed key=value store
  *
@@ -48,7 +128,8 @@ namespace ZeroTier {
  * contains these characters it may not be retrievable. This is not checked.
  *
  * Lookup is via linear search and will be slow with a lot of keys. It's
- * designed for small things.
+ * designed for small things. Code that looks up many keys in a large
+ * dictionary should build an Index of it first.
  *
  * There is code to test and fuzz this in selftest.cpp. Fuzzing a blob of
  * pointer tricks like this is important after any modifications.
@@ -56,24 +137,22 @@ namespace ZeroTier {
  * This is used for network configurations and for saving some things on disk
  * in the ZeroTier One service code.
  *
+ * Dictionaries of up to ZT_DICTIONARY_MAX_INLINE bytes hold their data
+ * inline. Larger ones, such as network configs, keep it on the heap and grow
+ * it as entries are added, so one costs about as much as its content and not
+ * its capacity to create and copy.
+ *
  * @tparam C Dictionary max capacity in bytes
  */
 template<unsigned int C>
 class Dictionary
 {
 public:
-	Dictionary()
-	{
-		_d[0] = (char)0;
-	}
+	Dictionary() {}
 
 	Dictionary(const char *s)
 	{
-		if (s) {
-			Utils::scopy(_d,sizeof(_d),s);
-		} else {
-			_d[0] = (char)0;
-		}
+		this->load(s);
 	}
 
 	Dictionary(const char *s,unsigned int len)
@@ -81,25 +160,23 @@ public:
 		if (s) {
 			if (len > (C-1))
 				len = C-1;
-			memcpy(_d,s,len);
-			_d[len] = (char)0;
-		} else {
-			_d[0] = (char)0;
+			_set(s,len);
 		}
 	}
 
 	Dictionary(const Dictionary &d)
 	{
-		Utils::scopy(_d,sizeof(_d),d._d);
+		_set(d.data(),d.sizeBytes());
 	}
 
 	inline Dictionary &operator=(const Dictionary &d)
 	{
-		Utils::scopy(_d,sizeof(_d),d._d);
+		if (&d != this)
+			_set(d.data(),d.sizeBytes());
 		return *this;
 	}
 
-	inline operator bool() const { return (_d[0] != 0); }
+	inline operator bool() const { return (_s.ptr()[0] != 0); }
 
 	/**
 	 * Load a dictionary from a C-string
@@ -110,19 +187,23 @@ public:
 	inline bool load(const char *s)
 	{
 		if (s) {
-			return Utils::scopy(_d,sizeof(_d),s);
+			unsigned int l = 0;
+			while ((l < (C-1))&&(s[l]))
+				++l;
+			_set(s,l);
+			return (!s[l]);
 		} else {
-			_d[0] = (char)0;
+			_s.clear();
 			return true;
 		}
 	}
 
 	/**
-	 * Delete all entries
+	 * Delete all entries (and free heap storage if any)
 	 */
 	inline void clear()
 	{
-		_d[0] = (char)0;
+		_s.clear();
 	}
 
 	/**
@@ -130,11 +211,9 @@ public:
 	 */
 	inline unsigned int sizeBytes() const
 	{
-		for(unsigned int i=0;i<C;++i) {
-			if (!_d[i])
-				return i;
-		}
-		return C-1;
+		const char *const d = _s.ptr();
+		const char *const e = reinterpret_cast<const char *>(memchr(d,0,_s.size()));
+		return (e) ? (unsigned int)(e - d) : (_s.size() - 1);
 	}
 
 	/**
@@ -161,11 +240,9 @@ public:
 	 */
 	inline int get(const char *key,char *dest,unsigned int destlen) const
 	{
-		const char *p = _d;
-		const char *const eof = p + C;
+		const char *p = _s.ptr();
+		const char *const eof = p + _s.size();
 		const char *k;
-		bool esc;
-		int j;
 
 		if (!destlen) // sanity check
 			return -1;
@@ -183,39 +260,7 @@ public:
 			}
 
 			if ((!*k)&&(*p == '=')) {
-				j = 0;
-				esc = false;
-				++p;
-				while ((*p != 0)&&(*p != 13)&&(*p != 10)) {
-					if (esc) {
-						esc = false;
-						switch(*p) {
-							case 'r': dest[j++] = 13; break;
-							case 'n': dest[j++] = 10; break;
-							case '0': dest[j++] = (char)0; break;
-							case 'e': dest[j++] = '='; break;
-							default: dest[j++] = *p; break;
-						}
-						if (j == (int)destlen) {
-							dest[j-1] = (char)0;
-							return j-1;
-						}
-					} else if (*p == '\\') {
-						esc = true;
-					} else {
-						dest[j++] = *p;
-						if (j == (int)destlen) {
-							dest[j-1] = (char)0;
-							return j-1;
-						}
-					}
-					if (++p == eof) {
-						dest[0] = (char)0;
-						return -1;
-					}
-				}
-				dest[j] = (char)0;
-				return j;
+				return _getValue(p + 1,eof,dest,destlen);
 			} else {
 				while ((*p)&&(*p != 13)&&(*p != 10)) {
 					if (++p == eof) {
@@ -319,77 +364,59 @@ public:
 	 */
 	inline bool add(const char *key,const char *value,int vlen = -1)
 	{
-		for(unsigned int i=0;i<C;++i) {
-			if (!_d[i]) {
-				unsigned int j = i;
-
-				if (j > 0) {
-					_d[j++] = (char)10;
-					if (j == C) {
-						_d[i] = (char)0;
-						return false;
-					}
-				}
-
-				const char *p = key;
-				while (*p) {
-					_d[j++] = *(p++);
-					if (j == C) {
-						_d[i] = (char)0;
-						return false;
-					}
-				}
-
-				_d[j++] = '=';
-				if (j == C) {
-					_d[i] = (char)0;
-					return false;
-				}
-
-				p = value;
-				int k = 0;
-				while ( ((vlen < 0)&&(*p)) || (k < vlen) ) {
-					switch(*p) {
-						case 0:
-						case 13:
-						case 10:
-						case '\\':
-						case '=':
-							_d[j++] = '\\';
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
-							switch(*p) {
-								case 0: _d[j++] = '0'; break;
-								case 13: _d[j++] = 'r'; break;
-								case 10: _d[j++] = 'n'; break;
-								case '\\': _d[j++] = '\\'; break;
-								case '=': _d[j++] = 'e'; break;
-							}
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
-							break;
-						default:
-							_d[j++] = *p;
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
-							break;
-					}
-					++p;
-					++k;
-				}
-
-				_d[j] = (char)0;
+		const char *const d = _s.ptr();
+		const char *const e = reinterpret_cast<const char *>(memchr(d,0,_s.size()));
+		if (!e)
+			return false;
+		const unsigned int i = (unsigned int)(e - d);
+
+		// Find the encoded size first so storage is grown once and a failed add leaves nothing behind
+		unsigned long need = (unsigned long)i + ((i > 0) ? 1 : 0) + (unsigned long)strlen(key) + 2;
+		const char *p = value;
+		int k = 0;
+		while ( ((vlen < 0)&&(*p)) || (k < vlen) ) {
+			switch(*p) {
+				case 0:
+				case 13:
+				case 10:
+				case '\\':
+				case '=':
+					need += 2;
+					break;
+				default:
+					++need;
+					break;
+			}
+			++p;
+			++k;
+		}
+		if ((need > C)||(!_s.grow((unsigned int)need)))
+			return false;
 
-				return true;
+		char *const o = _s.wptr();
+		unsigned int j = i;
+		if (j > 0)
+			o[j++] = (char)10;
+		for(p=key;*p;++p)
+			o[j++] = *p;
+		o[j++] = '=';
+		p = value;
+		k = 0;
+		while ( ((vlen < 0)&&(*p)) || (k < vlen) ) {
+			switch(*p) {
+				case 0: o[j++] = '\\'; o[j++] = '0'; break;
+				case 13: o[j++] = '\\'; o[j++] = 'r'; break;
+				case 10: o[j++] = '\\'; o[j++] = 'n'; break;
+				case '\\': o[j++] = '\\'; o[j++] = '\\'; break;
+				case '=': o[j++] = '\\'; o[j++] = 'e'; break;
+				default: o[j++] = *p; break;
 			}
+			++p;
+			++k;
 		}
-		return false;
+		o[j] = (char)0;
+
+		return true;
 	}
 
 	/**
@@ -458,11 +485,222 @@ public:
 	 */
 	inline unsigned int capacity() const { return C; }
 
-	inline const char *data() const { return _d; }
-	inline char *unsafeData() { return _d; }
+	inline const char *data() const { return _s.ptr(); }
+
+	/**
+	 * Get room to write up to n bytes of data directly, keeping what's there
+	 *
+	 * Callers must leave the data null-terminated within the first n bytes.
+	 *
+	 * @param n Bytes to be written including the terminating null
+	 * @return Pointer to data or NULL if n exceeds capacity
+	 */
+	inline char *unsafeData(const unsigned int n) { return ((_s.grow(n)) ? _s.wptr() : (char *)0); }
+
+	/**
+	 * Index of a dictionary's keys for fast repeated lookups
+	 *
+	 * Building an Index scans the dictionary once. After that each lookup
+	 * hashes the key instead of scanning the whole text, which matters when
+	 * decoding something like a NetworkConfig that looks up dozens of keys
+	 * and is mostly large binary values. Lookups give the same results as
+	 * the same calls on the dictionary, including the first entry winning
+	 * if a key appears more than once. The dictionary must outlive the Index
+	 * and must not change while it's in use.
+	 */
+	class Index
+	{
+	public:
+		Index(const Dictionary &d) :
+			_dict(d),
+			_overflow(false)
+		{
+			memset(_slots,0,sizeof(_slots));
+			const char *const eof = d._s.ptr() + d._s.size();
+			const char *l = d._s.ptr();
+			unsigned int n = 0;
+			while ((l < eof)&&(*l)) {
+				const char *p = l;
+				while ((p < eof)&&(*p)&&(*p != '=')&&(*p != 13)&&(*p != 10))
+					++p;
+				if ((p < eof)&&(*p == '=')) {
+					if (n < ZT_DICTIONARY_INDEX_MAX_KEYS) {
+						if (_insert((unsigned int)(l - d._s.ptr()),(unsigned int)(p - l)))
+							++n;
+					} else {
+						_overflow = true;
+						break;
+					}
+				}
+				while ((p < eof)&&(*p)&&(*p != 13)&&(*p != 10))
+					++p;
+				while ((p < eof)&&((*p == 13)||(*p == 10)))
+					++p;
+				l = p;
+			}
+		}
+
+		/**
+		 * Get an entry, same as Dictionary::get()
+		 */
+		inline int get(const char *key,char *dest,unsigned int destlen) const
+		{
+			if (!destlen)
+				return -1;
+			const unsigned int kl = (unsigned int)strlen(key);
+			const _Slot *const s = _find(key,kl);
+			if (s)
+				return _getValue(_dict._s.ptr() + s->line + kl,_dict._s.ptr() + _dict._s.size(),dest,destlen); // s->line is one past the start of the line
+			if (_overflow)
+				return _dict.get(key,dest,destlen);
+			dest[0] = (char)0;
+			return -1;
+		}
+
+		template<unsigned int BC>
+		inline bool get(const char *key,Buffer<BC> &dest) const
+		{
+			const int r = this->get(key,const_cast<char *>(reinterpret_cast<const char *>(dest.data())),BC);
+			if (r >= 0) {
+				dest.setSize((unsigned int)r);
+				return true;
+			} else {
+				dest.clear();
+				return false;
+			}
+		}
+
+		inline bool getB(const char *key,bool dfl = false) const
+		{
+			char tmp[4];
+			if (this->get(key,tmp,sizeof(tmp)) >= 0)
+				return ((*tmp == '1')||(*tmp == 't')||(*tmp == 'T'));
+			return dfl;
+		}
+
+		inline uint64_t getUI(const char *key,uint64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key,tmp,sizeof(tmp)) >= 1)
+				return Utils::hexStrToU64(tmp);
+			return dfl;
+		}
+
+		inline int64_t getI(const char *key,int64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key,tmp,sizeof(tmp)) >= 1)
+				return Utils::hexStrTo64(tmp);
+			return dfl;
+		}
+
+		inline bool contains(const char *key) const
+		{
+			char tmp[2];
+			return (this->get(key,tmp,2) >= 0);
+		}
+
+	private:
+		struct _Slot
+		{
+			unsigned int line; // offset of the entry's first character plus one, or 0 if empty
+			unsigned int keyLen;
+		};
+
+		static inline unsigned int _hash(const char *k,const unsigned int kl)
+		{
+			uint32_t h = 0x811c9dc5; // FNV-1a
+			for(unsigned int i=0;i<kl;++i)
+				h = (h ^ (uint32_t)((uint8_t)k[i])) * 0x01000193;
+			return (unsigned int)h;
+		}
+
+		inline bool _insert(const unsigned int line,const unsigned int kl)
+		{
+			const char *const k = _dict._s.ptr() + line;
+			for(unsigned int i=_hash(k,kl);;++i) {
+				_Slot &s = _slots[i & (ZT_DICTIONARY_INDEX_SLOTS - 1)];
+				if (!s.line) {
+					s.line = line + 1;
+					s.keyLen = kl;
+					return true;
+				}
+				if ((s.keyLen == kl)&&(memcmp(_dict._s.ptr() + s.line - 1,k,kl) == 0))
+					return false; // only the first of duplicate keys can be looked up
+			}
+		}
+
+		inline const _Slot *_find(const char *k,const unsigned int kl) const
+		{
+			for(unsigned int i=_hash(k,kl);;++i) {
+				const _Slot &s = _slots[i & (ZT_DICTIONARY_INDEX_SLOTS - 1)];
+				if (!s.line)
+					return (const _Slot *)0;
+				if ((s.keyLen == kl)&&(memcmp(_dict._s.ptr() + s.line - 1,k,kl) == 0))
+					return &s;
+			}
+		}
+
+		const Dictionary &_dict;
+		bool _overflow; // true if there were more keys than the index holds
+		_Slot _slots[ZT_DICTIONARY_INDEX_SLOTS];
+	};
 
 private:
-	char _d[C];
+	// Replace contents with len bytes of s (len must be less than C)
+	inline void _set(const char *s,const unsigned int len)
+	{
+		if (!len) {
+			_s.clear();
+		} else if (_s.grow(len + 1)) {
+			char *const d = _s.wptr();
+			memcpy(d,s,len);
+			d[len] = (char)0;
+		}
+	}
+
+	// Unescape a value starting at p, which is just past its key's equals sign
+	static inline int _getValue(const char *p,const char *const eof,char *dest,unsigned int destlen)
+	{
+		int j = 0;
+		bool esc = false;
+		while ((p < eof)&&(*p != 0)&&(*p != 13)&&(*p != 10)) {
+			if (esc) {
+				esc = false;
+				switch(*p) {
+					case 'r': dest[j++] = 13; break;
+					case 'n': dest[j++] = 10; break;
+					case '0': dest[j++] = (char)0; break;
+					case 'e': dest[j++] = '='; break;
+					default: dest[j++] = *p; break;
+				}
+				if (j == (int)destlen) {
+					dest[j-1] = (char)0;
+					return j-1;
+				}
+			} else if (*p == '\\') {
+				esc = true;
+			} else {
+				dest[j++] = *p;
+				if (j == (int)destlen) {
+					dest[j-1] = (char)0;
+					return j-1;
+				}
+			}
+			if (++p == eof) {
+				dest[0] = (char)0;
+				return -1;
+			}
+		}
+		if (p == eof) {
+			dest[0] = (char)0;
+			return -1;
+		}
+		dest[j] = (char)0;
+		return j;
+	}
+
+	_DictionaryStorage< C,(C > ZT_DICTIONARY_MAX_INLINE) > _s;
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,273 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_EGRESSSCHEDULER_HPP
+#define ZT_EGRESSSCHEDULER_HPP
+
+#include <stdint.h>
+
+#include <deque>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "NonCopyable.hpp"
+
+/**
+ * Traffic classes, in order of priority
+ *
+ * Control is served strictly first. The others share what is left by
+ * weight: interactive 4, normal 2 and bulk 1.
+ */
+#define ZT_QOS_CLASS_CONTROL 0
+#define ZT_QOS_CLASS_INTERACTIVE 1
+#define ZT_QOS_CLASS_NORMAL 2
+#define ZT_QOS_CLASS_BULK 3
+#define ZT_QOS_NUM_CLASSES 4
+
+/**
+ * Bits of a frame's traffic class below ZT_QOS_ECN_SHIFT are the class,
+ * and the IP ECN field of the frame sits above them so it reaches the wire
+ * with the packet through any queueing
+ */
+#define ZT_QOS_CLASS_MASK 0xff
+#define ZT_QOS_ECN_SHIFT 8
+
+/**
+ * Bytes per weight unit of service each round (about one full packet)
+ */
+#define ZT_QOS_QUANTUM 1500
+
+namespace ZeroTier {
+
+/**
+ * Egress queues per traffic class and peer
+ *
+ * The control class is always served first. Data classes are served by
+ * deficit round robin so each gets bandwidth in proportion to its weight
+ * whenever it has something queued, and within a class peers take turns
+ * the same way with equal weight. One bulk transfer to one peer therefore
+ * delays control traffic by at most a packet, and other peers in its class
+ * by about a packet each round.
+ *
+ * Pacing (when to dequeue) is up to the caller. This is not thread safe.
+ *
+ * @tparam V Type of queued item
+ */
+template<typename V>
+class EgressScheduler : NonCopyable
+{
+private:
+	struct _Item
+	{
+		_Item(const V &v,const unsigned int b) : value(v),bytes(b) {}
+		V value;
+		unsigned int bytes;
+	};
+
+	struct _PeerQueue
+	{
+		_PeerQueue() : q(),deficit(0),fresh(true) {}
+		std::deque<_Item> q;
+		long deficit;
+		bool fresh; // quantum not yet added for this turn
+	};
+
+	struct _Class
+	{
+		_Class() : peers(16),ring(),deficit(0),fresh(true) {}
+		Hashtable< Address,_PeerQueue > peers;
+		std::deque<Address> ring; // peers with something queued, next to serve first
+		long deficit;
+		bool fresh;
+	};
+
+public:
+	/**
+	 * @param maxBytes Maximum bytes queued in all
+	 * @param maxPerPeer Maximum items queued for one peer in one class
+	 */
+	EgressScheduler(const unsigned long maxBytes,const unsigned long maxPerPeer) :
+		_maxBytes(maxBytes),
+		_maxPerPeer(maxPerPeer),
+		_bytes(0),
+		_count(0),
+		_cur(ZT_QOS_CLASS_INTERACTIVE),
+		_sel((_Class *)0)
+	{
+	}
+
+	/**
+	 * Queue an item
+	 *
+	 * @param cls Traffic class (ZT_QOS_CLASS_*)
+	 * @param peer Peer this item is for, for fair sharing within its class
+	 * @param v Item
+	 * @param bytes Size of item on the wire
+	 * @return False if queues are full and item was dropped
+	 */
+	inline bool enqueue(unsigned int cls,const Address &peer,const V &v,const unsigned int bytes)
+	{
+		if (cls >= ZT_QOS_NUM_CLASSES)
+			cls = ZT_QOS_CLASS_NORMAL;
+		if ((_bytes + bytes) > _maxBytes)
+			return false;
+		_Class &c = _classes[cls];
+		_PeerQueue &pq = c.peers[peer];
+		if (pq.q.size() >= _maxPerPeer)
+			return false;
+		if (pq.q.empty()) {
+			pq.deficit = 0;
+			pq.fresh = true;
+			c.ring.push_back(peer);
+		}
+		pq.q.push_back(_Item(v,bytes));
+		_bytes += bytes;
+		++_count;
+		return true;
+	}
+
+	/**
+	 * Get the item that should go next without removing it
+	 *
+	 * Calling this again without pop() returns the same item.
+	 *
+	 * @param bytes Set to size of item
+	 * @return Item or NULL if nothing is queued
+	 */
+	inline const V *peek(unsigned int &bytes)
+	{
+		if (!_count)
+			return (const V *)0;
+
+		_Class *c = &(_classes[ZT_QOS_CLASS_CONTROL]);
+		if (c->ring.empty()) {
+			for(;;) {
+				c = &(_classes[_cur]);
+				if (c->ring.empty()) {
+					c->deficit = 0;
+					c->fresh = true;
+					_nextClass();
+					continue;
+				}
+				if (c->fresh) {
+					c->deficit += (long)(_weight(_cur) * ZT_QOS_QUANTUM);
+					c->fresh = false;
+				}
+				const _Item &head = _selectPeer(*c)->q.front();
+				if ((long)head.bytes <= c->deficit)
+					break;
+				c->fresh = true;
+				_nextClass();
+			}
+		}
+
+		_sel = c;
+		const _Item &it = _selectPeer(*c)->q.front();
+		bytes = it.bytes;
+		return &(it.value);
+	}
+
+	/**
+	 * Remove the item last returned by peek()
+	 */
+	inline void pop()
+	{
+		if (!_sel)
+			return;
+		_Class &c = *_sel;
+		_sel = (_Class *)0;
+		const Address peer(c.ring.front());
+		_PeerQueue *const pq = c.peers.get(peer);
+		const unsigned int bytes = pq->q.front().bytes;
+		pq->q.pop_front();
+		pq->deficit -= (long)bytes;
+		c.deficit -= (long)bytes;
+		_bytes -= bytes;
+		--_count;
+		if (pq->q.empty()) {
+			c.peers.erase(peer);
+			c.ring.pop_front();
+		}
+	}
+
+	/**
+	 * @return Number of items queued
+	 */
+	inline unsigned long count() const { return _count; }
+
+	/**
+	 * @return Bytes queued
+	 */
+	inline unsigned long bytes() const { return _bytes; }
+
+	/**
+	 * @return True if nothing is queued
+	 */
+	inline bool empty() const { return (_count == 0); }
+
+private:
+	static inline unsigned int _weight(const unsigned int cls)
+	{
+		static const unsigned int w[ZT_QOS_NUM_CLASSES] = { 0,4,2,1 };
+		return w[cls];
+	}
+
+	inline void _nextClass()
+	{
+		if (++_cur >= ZT_QOS_NUM_CLASSES)
+			_cur = ZT_QOS_CLASS_INTERACTIVE;
+	}
+
+	// Rotate peers until the one at the front of the ring can afford its head
+	inline _PeerQueue *_selectPeer(_Class &c)
+	{
+		for(;;) {
+			_PeerQueue *const pq = c.peers.get(c.ring.front());
+			if (pq->fresh) {
+				pq->deficit += ZT_QOS_QUANTUM;
+				pq->fresh = false;
+			}
+			if ((long)pq->q.front().bytes <= pq->deficit)
+				return pq;
+			pq->fresh = true;
+			c.ring.push_back(c.ring.front());
+			c.ring.pop_front();
+		}
+	}
+
+	const unsigned long _maxBytes;
+	const unsigned long _maxPerPeer;
+	unsigned long _bytes;
+	unsigned long _count;
+	unsigned int _cur; // data class whose turn it is
+	_Class *_sel; // class of item returned by last peek()
+	_Class _classes[ZT_QOS_NUM_CLASSES];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <string.h>
+
+#include "Fec.hpp"
+
+namespace ZeroTier {
+
+Fec::Fec() :
+	_enc((uint8_t *)0),
+	_encGroup(0),
+	_encCount(0),
+	_encMaxLen(0),
+	_encLenXor(0),
+	_win((_Remembered *)0),
+	_winPtr(0)
+{
+}
+
+Fec::~Fec()
+{
+	delete [] _enc;
+	delete [] _win;
+}
+
+unsigned int Fec::encode(const void *data,unsigned int len,const Address &source,void *parity)
+{
+	if ((len > ZT_FEC_MAX_DATAGRAM)||(len <= ZT_PROTO_MIN_FRAGMENT_LENGTH))
+		return 0;
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+
+	// A group only covers datagrams to one peer, since parity goes to it
+	const Address dest(d + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+	if (!_enc)
+		_enc = new uint8_t[ZT_UDP_DEFAULT_PAYLOAD_MTU];
+	if ((_encCount)&&(dest != _encDest))
+		_encCount = 0;
+	if (!_encCount) {
+		memset(_enc + ZT_FEC_PARITY_OVERHEAD,0,ZT_FEC_MAX_DATAGRAM);
+		_encDest = dest;
+		_encMaxLen = 0;
+		_encLenXor = 0;
+	}
+
+	uint8_t *const x = _enc + ZT_FEC_PARITY_OVERHEAD;
+	for(unsigned int i=0;i<len;++i)
+		x[i] ^= d[i];
+	const uint32_t dg = _digest(d);
+	uint8_t *const dgp = _enc + ZT_PACKET_IDX_MAC + 3 + (_encCount * 4);
+	dgp[0] = (uint8_t)(dg >> 24);
+	dgp[1] = (uint8_t)(dg >> 16);
+	dgp[2] = (uint8_t)(dg >> 8);
+	dgp[3] = (uint8_t)dg;
+	_encLenXor ^= len;
+	if (len > _encMaxLen)
+		_encMaxLen = len;
+	if (++_encCount < ZT_FEC_GROUP_SIZE)
+		return 0;
+
+	const uint64_t g = ++_encGroup;
+	for(unsigned int i=0;i<8;++i)
+		_enc[i] = (uint8_t)(g >> (56 - (i * 8)));
+	_encDest.copyTo(_enc + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+	source.copyTo(_enc + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH);
+	_enc[ZT_PACKET_IDX_FLAGS] = (uint8_t)(ZT_PROTO_CIPHER_SUITE__FEC_PARITY << 3);
+	_enc[ZT_PACKET_IDX_MAC] = (uint8_t)ZT_FEC_GROUP_SIZE;
+	_enc[ZT_PACKET_IDX_MAC + 1] = (uint8_t)(_encLenXor >> 8);
+	_enc[ZT_PACKET_IDX_MAC + 2] = (uint8_t)_encLenXor;
+	_encCount = 0;
+
+	const unsigned int plen = ZT_FEC_PARITY_OVERHEAD + _encMaxLen;
+	memcpy(parity,_enc,plen);
+	return plen;
+}
+
+void Fec::remember(const void *data,unsigned int len)
+{
+	if ((len > ZT_FEC_MAX_DATAGRAM)||(len <= ZT_PROTO_MIN_FRAGMENT_LENGTH))
+		return;
+	if (!_win) {
+		_win = new _Remembered[ZT_FEC_WINDOW];
+		for(unsigned int i=0;i<ZT_FEC_WINDOW;++i)
+			_win[i].len = 0;
+	}
+	_Remembered &r = _win[_winPtr++ % ZT_FEC_WINDOW];
+	r.digest = _digest(reinterpret_cast<const uint8_t *>(data));
+	r.len = len;
+	memcpy(r.data,data,len);
+}
+
+int Fec::repair(const void *parity,unsigned int len,void *repaired) const
+{
+	const uint8_t *const p = reinterpret_cast<const uint8_t *>(parity);
+	if ((!_win)||(len <= (ZT_PACKET_IDX_MAC + 3)))
+		return 0;
+	const unsigned int n = p[ZT_PACKET_IDX_MAC];
+	const unsigned int hlen = ZT_PACKET_IDX_MAC + 3 + (n * 4);
+	if ((n < 2)||(n > ZT_FEC_GROUP_SIZE)||(len <= hlen)||((len - hlen) > ZT_FEC_MAX_DATAGRAM))
+		return 0;
+	const unsigned int xlen = len - hlen;
+	unsigned int rlen = ((unsigned int)p[ZT_PACKET_IDX_MAC + 1] << 8) | (unsigned int)p[ZT_PACKET_IDX_MAC + 2];
+
+	uint8_t *const out = reinterpret_cast<uint8_t *>(repaired);
+	memcpy(out,p + hlen,xlen);
+	uint32_t lost = 0;
+	bool haveLost = false;
+	for(unsigned int i=0;i<n;++i) {
+		const uint8_t *const dgp = p + ZT_PACKET_IDX_MAC + 3 + (i * 4);
+		const uint32_t dg = ((uint32_t)dgp[0] << 24) | ((uint32_t)dgp[1] << 16) | ((uint32_t)dgp[2] << 8) | (uint32_t)dgp[3];
+		const _Remembered *r = (const _Remembered *)0;
+		for(unsigned int k=0;k<ZT_FEC_WINDOW;++k) {
+			if ((_win[k].len)&&(_win[k].digest == dg)) {
+				r = &(_win[k]);
+				break;
+			}
+		}
+		if (r) {
+			if (r->len > xlen)
+				return 0; // can't be in this group
+			for(unsigned int k=0;k<r->len;++k)
+				out[k] ^= r->data[k];
+			rlen ^= r->len;
+		} else if (haveLost) {
+			return -1;
+		} else {
+			haveLost = true;
+			lost = dg;
+		}
+	}
+
+	if ((!haveLost)||(rlen <= ZT_PROTO_MIN_FRAGMENT_LENGTH)||(rlen > xlen)||(_digest(out) != lost))
+		return 0;
+	return (int)rlen;
+}
+
+uint32_t Fec::_digest(const uint8_t *d)
+{
+	// Low bits of the packet ID, which fragments share with their head
+	uint32_t h = ((uint32_t)d[4] << 24) | ((uint32_t)d[5] << 16) | ((uint32_t)d[6] << 8) | (uint32_t)d[7];
+	if (d[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR)
+		h += 0x9e3779b1 * (uint32_t)d[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO];
+	return h;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,156 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_FEC_HPP
+#define ZT_FEC_HPP
+
+#include <stdint.h>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Address.hpp"
+#include "Packet.hpp"
+
+/**
+ * Datagrams covered by each parity datagram
+ */
+#define ZT_FEC_GROUP_SIZE 8
+
+/**
+ * Recently received datagrams remembered for repairs
+ */
+#define ZT_FEC_WINDOW 32
+
+/**
+ * Size of a parity datagram's header, which precedes the XOR of its group
+ */
+#define ZT_FEC_PARITY_OVERHEAD (ZT_PACKET_IDX_MAC + 3 + (ZT_FEC_GROUP_SIZE * 4))
+
+/**
+ * Largest datagram that can be covered, so parity still fits the default MTU
+ */
+#define ZT_FEC_MAX_DATAGRAM (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_FEC_PARITY_OVERHEAD)
+
+namespace ZeroTier {
+
+/**
+ * XOR forward error correction over the datagrams sent on a path
+ *
+ * The sender XORs each ZT_FEC_GROUP_SIZE datagrams (packet heads and
+ * fragments, zero padded to the longest) into a parity datagram that also
+ * carries a short digest of each. A receiver that remembers what it got
+ * recently can then rebuild any one datagram of a group that was lost.
+ *
+ * Parity datagrams reuse the packet header, so they are addressed like
+ * packets and never mistaken for fragments:
+ *   <[8] group counter>
+ *   <[5] destination ZT address>
+ *   <[5] source ZT address>
+ *   <[1] flags with cipher suite ZT_PROTO_CIPHER_SUITE__FEC_PARITY>
+ *   <[1] number of datagrams covered>
+ *   <[2] XOR of their lengths>
+ *   <[4] digest of each datagram>...
+ *   <[...] XOR of the datagrams>
+ *
+ * Parity is not authenticated. A rebuilt datagram still has to pass the
+ * MAC check of the packet it belongs to, so forged parity can do no more
+ * than a forged packet.
+ *
+ * This is not thread safe. Path locks around it.
+ */
+class Fec : NonCopyable
+{
+public:
+	Fec();
+	~Fec();
+
+	/**
+	 * Add a datagram just sent and get parity if it completes a group
+	 *
+	 * Datagrams longer than ZT_FEC_MAX_DATAGRAM are not covered.
+	 *
+	 * @param data Datagram (packet head or fragment)
+	 * @param len Length of datagram
+	 * @param source Our address
+	 * @param parity Buffer of at least ZT_UDP_DEFAULT_PAYLOAD_MTU bytes
+	 * @return Length of parity datagram to send or 0 if none
+	 */
+	unsigned int encode(const void *data,unsigned int len,const Address &source,void *parity);
+
+	/**
+	 * Remember a received datagram in case another of its group is lost
+	 *
+	 * @param data Datagram (packet head or fragment)
+	 * @param len Length of datagram
+	 */
+	void remember(const void *data,unsigned int len);
+
+	/**
+	 * Try to rebuild a lost datagram from parity
+	 *
+	 * @param parity Parity datagram
+	 * @param len Length of parity datagram
+	 * @param repaired Buffer of at least ZT_FEC_MAX_DATAGRAM bytes
+	 * @return Length of rebuilt datagram, 0 if none was lost or parity is invalid, or -1 if more than one was lost
+	 */
+	int repair(const void *parity,unsigned int len,void *repaired) const;
+
+	/**
+	 * @param data Datagram at least ZT_PROTO_MIN_PACKET_LENGTH long and not a fragment
+	 * @return True if this is a parity datagram
+	 */
+	static inline bool isParity(const void *data)
+	{
+		return ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & 0x38) == (ZT_PROTO_CIPHER_SUITE__FEC_PARITY << 3));
+	}
+
+private:
+	struct _Remembered
+	{
+		uint32_t digest;
+		unsigned int len; // 0 if empty
+		uint8_t data[ZT_FEC_MAX_DATAGRAM];
+	};
+
+	static uint32_t _digest(const uint8_t *d);
+
+	// Group being sent, allocated on first use
+	uint8_t *_enc; // parity datagram being built
+	Address _encDest;
+	uint64_t _encGroup;
+	unsigned int _encCount;
+	unsigned int _encMaxLen;
+	unsigned int _encLenXor;
+
+	// Recently received, allocated on first use
+	_Remembered *_win;
+	unsigned long _winPtr;
+};
+
+} // namespace ZeroTier
+
+#endif
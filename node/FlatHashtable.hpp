@@ -0,0 +1,472 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_FLATHASHTABLE_HPP
+#define ZT_FLATHASHTABLE_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * An open addressing hash table with the same API as Hashtable
+ *
+ * Entries are stored inline in one array and probed linearly, guided by a
+ * parallel array of one byte control words holding seven bits of each
+ * entry's hash. A lookup touches one or two cache lines and never
+ * allocates. Erased entries leave a tombstone, so entries only move when
+ * the table is rehashed.
+ *
+ * Unlike Hashtable, pointers to values are invalidated by any insert that
+ * grows the table. Don't hold one across set() or operator[] of another
+ * key. Large values are also moved on every rehash, so this is best for
+ * values no bigger than a few pointers.
+ */
+template<typename K,typename V>
+class FlatHashtable
+{
+private:
+	struct _Slot
+	{
+		K k;
+		V v;
+	};
+
+	// Control byte values; full slots are 0x80 | seven bits of hash
+	enum { _EMPTY = 0,_DELETED = 1 };
+
+public:
+	/**
+	 * A simple forward iterator (different from STL)
+	 *
+	 * It's safe to erase any key while iterating, but don't use set() since
+	 * that may rehash and invalidate the iterator. Note the erasing the key
+	 * will destroy the targets of the pointers returned by next().
+	 */
+	class Iterator
+	{
+	public:
+		/**
+		 * @param ht Hash table to iterate over
+		 */
+		Iterator(FlatHashtable &ht) :
+			_idx(0),
+			_ht(&ht)
+		{
+		}
+
+		/**
+		 * Start iterating at a position saved from an earlier iterator
+		 *
+		 * This is for incremental passes over a table. If the table has been
+		 * resized since, entries may be skipped or visited twice in a pass.
+		 *
+		 * @param ht Hash table to iterate over
+		 * @param position Value of position() from an earlier iterator or 0 to start at the beginning
+		 */
+		Iterator(FlatHashtable &ht,const unsigned long position) :
+			_idx(position),
+			_ht(&ht)
+		{
+		}
+
+		/**
+		 * @param kptr Pointer to set to point to next key
+		 * @param vptr Pointer to set to point to next value
+		 * @return True if kptr and vptr are set, false if no more entries
+		 */
+		inline bool next(K *&kptr,V *&vptr)
+		{
+			while (_idx < _ht->_cap) {
+				const unsigned long i = _idx++;
+				if (_ht->_ctrl[i] & 0x80) {
+					kptr = &(_ht->_slots[i].k);
+					vptr = &(_ht->_slots[i].v);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+		 * @return Position to resume at
+		 */
+		inline unsigned long position() const { return _idx; }
+
+	private:
+		unsigned long _idx;
+		FlatHashtable *_ht;
+	};
+	friend class FlatHashtable::Iterator;
+
+	/**
+	 * @param bc Initial capacity in entries (default: 64, rounded up to a power of two)
+	 */
+	FlatHashtable(unsigned long bc = 64) :
+		_slots((_Slot *)0),
+		_ctrl((uint8_t *)0),
+		_cap(8),
+		_shift(61),
+		_s(0),
+		_d(0)
+	{
+		while ((_cap - (_cap >> 2)) < bc) {
+			_cap <<= 1;
+			--_shift;
+		}
+		_alloc(_slots,_ctrl,_cap);
+	}
+
+	FlatHashtable(const FlatHashtable<K,V> &ht) :
+		_slots((_Slot *)0),
+		_ctrl((uint8_t *)0),
+		_cap(ht._cap),
+		_shift(ht._shift),
+		_s(ht._s),
+		_d(ht._d)
+	{
+		_alloc(_slots,_ctrl,_cap);
+		memcpy(_ctrl,ht._ctrl,_cap);
+		for(unsigned long i=0;i<_cap;++i) {
+			if (_ctrl[i] & 0x80)
+				_slots[i] = ht._slots[i];
+		}
+	}
+
+	~FlatHashtable()
+	{
+		delete [] _slots;
+		::free(_ctrl);
+	}
+
+	inline FlatHashtable &operator=(const FlatHashtable<K,V> &ht)
+	{
+		if (&ht != this) {
+			this->clear();
+			for(unsigned long i=0;i<ht._cap;++i) {
+				if (ht._ctrl[i] & 0x80)
+					this->set(ht._slots[i].k,ht._slots[i].v);
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * Erase all entries
+	 */
+	inline void clear()
+	{
+		if ((_s)||(_d)) {
+			for(unsigned long i=0;i<_cap;++i) {
+				if (_ctrl[i] & 0x80) {
+					_slots[i].k = K();
+					_slots[i].v = V();
+				}
+			}
+			memset(_ctrl,_EMPTY,_cap);
+			_s = 0;
+			_d = 0;
+		}
+	}
+
+	/**
+	 * @return Vector of all keys
+	 */
+	inline typename std::vector<K> keys() const
+	{
+		typename std::vector<K> k;
+		if (_s) {
+			k.reserve(_s);
+			for(unsigned long i=0;i<_cap;++i) {
+				if (_ctrl[i] & 0x80)
+					k.push_back(_slots[i].k);
+			}
+		}
+		return k;
+	}
+
+	/**
+	 * Append all keys (in unspecified order) to the supplied vector or list
+	 *
+	 * @param v Vector, list, or other compliant container
+	 * @tparam Type of V (generally inferred)
+	 */
+	template<typename C>
+	inline void appendKeys(C &v) const
+	{
+		if (_s) {
+			for(unsigned long i=0;i<_cap;++i) {
+				if (_ctrl[i] & 0x80)
+					v.push_back(_slots[i].k);
+			}
+		}
+	}
+
+	/**
+	 * @return Vector of all entries (pairs of K,V)
+	 */
+	inline typename std::vector< std::pair<K,V> > entries() const
+	{
+		typename std::vector< std::pair<K,V> > k;
+		if (_s) {
+			k.reserve(_s);
+			for(unsigned long i=0;i<_cap;++i) {
+				if (_ctrl[i] & 0x80)
+					k.push_back(std::pair<K,V>(_slots[i].k,_slots[i].v));
+			}
+		}
+		return k;
+	}
+
+	/**
+	 * @param k Key
+	 * @return Pointer to value or NULL if not found
+	 */
+	inline V *get(const K &k)
+	{
+		const unsigned long i = _find(k);
+		return ((i < _cap) ? &(_slots[i].v) : (V *)0);
+	}
+	inline const V *get(const K &k) const { return const_cast<FlatHashtable *>(this)->get(k); }
+
+	/**
+	 * @param k Key to check
+	 * @return True if key is present
+	 */
+	inline bool contains(const K &k) const
+	{
+		return (const_cast<FlatHashtable *>(this)->_find(k) < _cap);
+	}
+
+	/**
+	 * @param k Key
+	 * @return True if value was present
+	 */
+	inline bool erase(const K &k)
+	{
+		const unsigned long i = _find(k);
+		if (i >= _cap)
+			return false;
+		_slots[i].k = K();
+		_slots[i].v = V();
+		// A slot followed by an empty one ends no probe sequence but its own
+		if (_ctrl[(i + 1) & (_cap - 1)] == _EMPTY) {
+			_ctrl[i] = _EMPTY;
+		} else {
+			_ctrl[i] = _DELETED;
+			++_d;
+		}
+		--_s;
+		return true;
+	}
+
+	/**
+	 * @param k Key
+	 * @param v Value
+	 * @return Reference to value in table
+	 */
+	inline V &set(const K &k,const V &v)
+	{
+		V &r = (*this)[k];
+		r = v;
+		return r;
+	}
+
+	/**
+	 * @param k Key
+	 * @return Value, possibly newly created
+	 */
+	inline V &operator[](const K &k)
+	{
+		uint64_t h = _mix(k);
+		unsigned long i = (unsigned long)(h >> _shift);
+		uint8_t tag = _tag(h);
+		unsigned long ins = _cap;
+		const unsigned long mask = _cap - 1;
+		for(;;) {
+			const uint8_t c = _ctrl[i];
+			if (c == _EMPTY)
+				break;
+			if ((c == tag)&&(_slots[i].k == k))
+				return _slots[i].v;
+			if ((c == _DELETED)&&(ins == _cap))
+				ins = i;
+			i = (i + 1) & mask;
+		}
+
+		if (ins == _cap) {
+			// Keep at least a quarter of the table empty so probes stay short
+			if ((_s + _d + 1) > (_cap - (_cap >> 2))) {
+				_rehash(((_s + 1) > (_cap >> 1)) ? (_cap << 1) : _cap);
+				h = _mix(k);
+				i = (unsigned long)(h >> _shift);
+				tag = _tag(h);
+				while (_ctrl[i] != _EMPTY)
+					i = (i + 1) & (_cap - 1);
+			}
+			ins = i;
+		} else --_d;
+
+		_ctrl[ins] = tag;
+		_slots[ins].k = k;
+		++_s;
+		return _slots[ins].v;
+	}
+
+	/**
+	 * @return Number of entries
+	 */
+	inline unsigned long size() const { return _s; }
+
+	/**
+	 * @return True if table is empty
+	 */
+	inline bool empty() const { return (_s == 0); }
+
+	/**
+	 * Grow the table ahead of time so it holds n entries without rehashing
+	 *
+	 * This never shrinks a table. Tombstones can still force a rehash at the
+	 * same size, but that only happens after many erases.
+	 *
+	 * @param n Number of entries to make room for
+	 */
+	inline void reserve(const unsigned long n)
+	{
+		unsigned long nc = _cap;
+		while ((nc - (nc >> 2)) < n)
+			nc <<= 1;
+		if (nc != _cap)
+			_rehash(nc);
+	}
+
+	/**
+	 * @return Bytes allocated for slots and control bytes, not counting anything keys or values point to
+	 */
+	inline unsigned long footprint() const { return (unsigned long)((sizeof(_Slot) + 1) * _cap); }
+
+private:
+	template<typename O>
+	static inline unsigned long _hc(const O &obj)
+	{
+		return (unsigned long)obj.hashCode();
+	}
+	static inline unsigned long _hc(const uint64_t i)
+	{
+		return (unsigned long)(i ^ (i >> 32)); // good for network IDs and addresses
+	}
+	static inline unsigned long _hc(const uint32_t i)
+	{
+		return ((unsigned long)i * (unsigned long)0x9e3779b1);
+	}
+	static inline unsigned long _hc(const uint16_t i)
+	{
+		return ((unsigned long)i * (unsigned long)0x9e3779b1);
+	}
+
+	// Spread hash codes over all 64 bits; the top bits pick the slot and
+	// the next seven give the control tag.
+	static inline uint64_t _mix(const K &k) { return ((uint64_t)_hc(k) * 0x9e3779b97f4a7c15ULL); }
+	inline uint8_t _tag(const uint64_t h) const { return (uint8_t)(0x80 | ((h >> (_shift - 7)) & 0x7f)); }
+
+	inline unsigned long _find(const K &k)
+	{
+		const uint64_t h = _mix(k);
+		const uint8_t tag = _tag(h);
+		const unsigned long mask = _cap - 1;
+		for(unsigned long i=(unsigned long)(h >> _shift);;i=(i + 1) & mask) {
+			const uint8_t c = _ctrl[i];
+			if (c == _EMPTY)
+				return _cap;
+			if ((c == tag)&&(_slots[i].k == k))
+				return i;
+		}
+	}
+
+	static inline void _alloc(_Slot *&slots,uint8_t *&ctrl,const unsigned long cap)
+	{
+		slots = new (std::nothrow) _Slot[cap];
+		ctrl = reinterpret_cast<uint8_t *>(::malloc(cap));
+		if ((!slots)||(!ctrl)) {
+			delete [] slots;
+			::free(ctrl);
+			throw ZT_EXCEPTION_OUT_OF_MEMORY;
+		}
+		memset(ctrl,_EMPTY,cap);
+	}
+
+	inline void _rehash(const unsigned long nc)
+	{
+		_Slot *ns;
+		uint8_t *nctrl;
+		_alloc(ns,nctrl,nc);
+		unsigned int nshift = _shift;
+		for(unsigned long c=_cap;c<nc;c<<=1)
+			--nshift;
+
+		const unsigned long mask = nc - 1;
+		for(unsigned long i=0;i<_cap;++i) {
+			if (_ctrl[i] & 0x80) {
+				const uint64_t h = _mix(_slots[i].k);
+				unsigned long j = (unsigned long)(h >> nshift);
+				while (nctrl[j] != _EMPTY)
+					j = (j + 1) & mask;
+				nctrl[j] = (uint8_t)(0x80 | ((h >> (nshift - 7)) & 0x7f));
+				std::swap(ns[j].k,_slots[i].k);
+				std::swap(ns[j].v,_slots[i].v);
+			}
+		}
+
+		delete [] _slots;
+		::free(_ctrl);
+		_slots = ns;
+		_ctrl = nctrl;
+		_cap = nc;
+		_shift = nshift;
+		_d = 0;
+	}
+
+	_Slot *_slots;
+	uint8_t *_ctrl;
+	unsigned long _cap;
+	unsigned int _shift;
+	unsigned long _s;
+	unsigned long _d;
+};
+
+} // namespace ZeroTier
+
+#endif
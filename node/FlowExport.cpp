@@ -0,0 +1,164 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include "FlowExport.hpp"
+
+namespace ZeroTier {
+
+// IPFIX is big-endian throughout
+static inline void _ipfix8(std::string &out,const unsigned int v) { out.push_back((char)(v & 0xff)); }
+static inline void _ipfix16(std::string &out,const unsigned int v) { _ipfix8(out,v >> 8); _ipfix8(out,v); }
+static inline void _ipfix32(std::string &out,const uint32_t v) { _ipfix16(out,v >> 16); _ipfix16(out,v); }
+static inline void _ipfix64(std::string &out,const uint64_t v) { _ipfix32(out,(uint32_t)(v >> 32)); _ipfix32(out,(uint32_t)v); }
+static inline void _ipfixSetLength(std::string &out,const unsigned long at)
+{
+	const unsigned int len = (unsigned int)(out.length() - at);
+	out[at + 2] = (char)((len >> 8) & 0xff);
+	out[at + 3] = (char)(len & 0xff);
+}
+
+// Information elements in each template, as { ID, length }, with the addresses at ADDR
+static const unsigned int _IPFIX_FIELD_COUNT = 15;
+static const unsigned int _IPFIX_ADDR = 7;
+static const uint16_t _IPFIX_FIELDS[_IPFIX_FIELD_COUNT][2] = {
+	{ 152,8 }, // flowStartMilliseconds
+	{ 153,8 }, // flowEndMilliseconds
+	{ 1,8 },   // octetDeltaCount
+	{ 2,8 },   // packetDeltaCount
+	{ 351,8 }, // layer2SegmentId (network ID)
+	{ 56,6 },  // sourceMacAddress
+	{ 80,6 },  // destinationMacAddress
+	{ 8,4 },   // sourceIPv4Address, or sourceIPv6Address (27,16)
+	{ 12,4 },  // destinationIPv4Address, or destinationIPv6Address (28,16)
+	{ 7,2 },   // sourceTransportPort
+	{ 11,2 },  // destinationTransportPort
+	{ 4,1 },   // protocolIdentifier
+	{ 5,1 },   // ipClassOfService
+	{ 61,1 },  // flowDirection (0 ingress, 1 egress)
+	{ 58,2 }   // vlanId
+};
+
+static void _ipfixTemplate(std::string &out,const bool ipv6)
+{
+	_ipfix16(out,(ipv6) ? ZT_FLOW_EXPORT_TEMPLATE_IPV6 : ZT_FLOW_EXPORT_TEMPLATE_IPV4);
+	_ipfix16(out,_IPFIX_FIELD_COUNT);
+	for(unsigned int f=0;f<_IPFIX_FIELD_COUNT;++f) {
+		if ((ipv6)&&(f == _IPFIX_ADDR)) {
+			_ipfix16(out,27);
+			_ipfix16(out,16);
+		} else if ((ipv6)&&(f == (_IPFIX_ADDR + 1))) {
+			_ipfix16(out,28);
+			_ipfix16(out,16);
+		} else {
+			_ipfix16(out,_IPFIX_FIELDS[f][0]);
+			_ipfix16(out,_IPFIX_FIELDS[f][1]);
+		}
+	}
+}
+
+static void _ipfixRecord(std::string &out,const FlowExport::Flow &f)
+{
+	uint8_t mac[6];
+	_ipfix64(out,f.first);
+	_ipfix64(out,f.last);
+	_ipfix64(out,f.bytes);
+	_ipfix64(out,f.packets);
+	_ipfix64(out,f.networkId);
+	f.macSource.copyTo(mac,6);
+	out.append(reinterpret_cast<const char *>(mac),6);
+	f.macDest.copyTo(mac,6);
+	out.append(reinterpret_cast<const char *>(mac),6);
+	out.append(reinterpret_cast<const char *>(f.ipSource),(f.ipv6) ? 16 : 4);
+	out.append(reinterpret_cast<const char *>(f.ipDest),(f.ipv6) ? 16 : 4);
+	_ipfix16(out,f.portSource);
+	_ipfix16(out,f.portDest);
+	_ipfix8(out,f.protocol);
+	_ipfix8(out,f.tos);
+	_ipfix8(out,(f.inbound) ? 0 : 1);
+	_ipfix16(out,f.vlanId);
+}
+
+static void _ipfixFinish(std::string &m,unsigned long &ds,std::vector<std::string> &messages)
+{
+	if (ds)
+		_ipfixSetLength(m,ds);
+	ds = 0;
+	_ipfixSetLength(m,0); // message length is at the same place as a set's
+	messages.push_back(m);
+	m.clear();
+}
+
+void FlowExport::ipfix(const uint32_t exportTime,const uint32_t domain,const std::vector<Flow> &flows,std::vector<std::string> &messages)
+{
+	std::string m;
+	unsigned long ds = 0; // start of the data set being written, or 0 if none
+
+	// IPv4 records on the first pass and IPv6 on the second, so a message
+	// has at most one data set of each
+	for(int pass=0;pass<2;++pass) {
+		const bool ipv6 = (pass == 1);
+		const unsigned int recordLength = (ipv6) ? 93 : 69;
+		for(std::vector<Flow>::const_iterator f(flows.begin());f!=flows.end();++f) {
+			if (f->ipv6 != ipv6)
+				continue;
+
+			if ((m.length())&&((m.length() + ((ds) ? 0 : 4) + recordLength) > ZT_FLOW_EXPORT_MAX_MESSAGE))
+				_ipfixFinish(m,ds,messages);
+
+			if (!m.length()) {
+				_ipfix16(m,10); // version
+				_ipfix16(m,0); // length
+				_ipfix32(m,exportTime);
+				_ipfix32(m,_sequence);
+				_ipfix32(m,domain);
+				const unsigned long ts = m.length();
+				_ipfix16(m,2); // template set
+				_ipfix16(m,0);
+				_ipfixTemplate(m,false);
+				_ipfixTemplate(m,true);
+				_ipfixSetLength(m,ts);
+			}
+
+			if (!ds) {
+				ds = m.length();
+				_ipfix16(m,(ipv6) ? ZT_FLOW_EXPORT_TEMPLATE_IPV6 : ZT_FLOW_EXPORT_TEMPLATE_IPV4);
+				_ipfix16(m,0);
+			}
+
+			_ipfixRecord(m,*f);
+			++_sequence;
+		}
+		if (ds) {
+			_ipfixSetLength(m,ds);
+			ds = 0;
+		}
+	}
+
+	if (m.length())
+		_ipfixFinish(m,ds,messages);
+}
+
+} // namespace ZeroTier
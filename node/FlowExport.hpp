@@ -0,0 +1,146 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_FLOWEXPORT_HPP
+#define ZT_FLOWEXPORT_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "MAC.hpp"
+
+/**
+ * Default most flows counted per network between exports
+ */
+#define ZT_FLOW_EXPORT_DEFAULT_MAX_FLOWS 4096
+
+/**
+ * Largest IPFIX message, so one fits in a UDP datagram on any path
+ */
+#define ZT_FLOW_EXPORT_MAX_MESSAGE 1400
+
+/**
+ * IPFIX template IDs for IPv4 and IPv6 flow records
+ */
+#define ZT_FLOW_EXPORT_TEMPLATE_IPV4 256
+#define ZT_FLOW_EXPORT_TEMPLATE_IPV6 257
+
+namespace ZeroTier {
+
+/**
+ * Per-flow traffic counters for virtual networks, exported as IPFIX
+ *
+ * While enabled, each network counts the packets and bytes of every TCP,
+ * UDP, SCTP and UDP-Lite flow its filters accept, keyed by the same parse
+ * of the frame the flow cache uses. The service collects these every so
+ * often with Node::flows(), which resets them, and sends them on to a
+ * collector as IPFIX (RFC 7011) messages built here. Counts are deltas
+ * since the last collection, as with octetDeltaCount.
+ *
+ * The network ID goes in layer2SegmentId and the Ethernet addresses in
+ * sourceMacAddress and destinationMacAddress. The remote peer isn't sent
+ * since no standard element fits it, but it follows from its MAC.
+ */
+class FlowExport : NonCopyable
+{
+public:
+	/**
+	 * Counts for one flow in one direction since the last collection
+	 */
+	struct Flow
+	{
+		uint64_t networkId;
+		uint64_t peer;           // remote peer's ZeroTier address, or 0 for multicast
+		uint64_t first;          // first frame seen (ms)
+		uint64_t last;           // last frame seen (ms)
+		uint64_t packets;
+		uint64_t bytes;          // IP packet bytes, without the Ethernet header
+		MAC macSource;
+		MAC macDest;
+		uint8_t ipSource[16];    // first 4 bytes for IPv4
+		uint8_t ipDest[16];
+		unsigned int portSource;
+		unsigned int portDest;
+		unsigned int protocol;
+		unsigned int tos;        // IPv4 TOS or IPv6 traffic class
+		unsigned int vlanId;
+		bool inbound;
+		bool ipv6;
+	};
+
+	FlowExport() :
+		_enabled(false),
+		_maxFlows(ZT_FLOW_EXPORT_DEFAULT_MAX_FLOWS),
+		_sequence(0) {}
+
+	/**
+	 * @param enabled If true, networks count flows (counts already taken are kept until collected)
+	 * @param maxFlows Most flows counted per network between collections
+	 */
+	inline void setEnabled(const bool enabled,const unsigned int maxFlows)
+	{
+		_maxFlows = (maxFlows) ? maxFlows : ZT_FLOW_EXPORT_DEFAULT_MAX_FLOWS;
+		_enabled = enabled;
+	}
+
+	/**
+	 * @return True if counting flows (checked on the packet paths before anything else)
+	 */
+	inline bool enabled() const { return _enabled; }
+
+	/**
+	 * @return Most flows counted per network between collections
+	 */
+	inline unsigned int maxFlows() const { return _maxFlows; }
+
+	/**
+	 * Encode flows as IPFIX messages
+	 *
+	 * Each message carries the templates ahead of its records, so a collector
+	 * that starts late or misses a datagram can decode the next one. Sequence
+	 * numbers run on across calls as IPFIX requires, so call this from one
+	 * thread only.
+	 *
+	 * @param exportTime Current time in seconds since the epoch
+	 * @param domain Observation domain ID
+	 * @param flows Flows to encode
+	 * @param messages Messages, each at most ZT_FLOW_EXPORT_MAX_MESSAGE bytes, are appended here
+	 */
+	void ipfix(const uint32_t exportTime,const uint32_t domain,const std::vector<Flow> &flows,std::vector<std::string> &messages);
+
+private:
+	volatile bool _enabled;
+	volatile unsigned int _maxFlows;
+	uint32_t _sequence; // data records sent so far
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -82,6 +82,22 @@ public:
 		{
 		}
 
+		/**
+		 * Start iterating at a position saved from an earlier iterator
+		 *
+		 * This is for incremental passes over a table. If the table has been
+		 * resized since, entries may be skipped or visited twice in a pass.
+		 *
+		 * @param ht Hash table to iterate over
+		 * @param position Value of position() from an earlier iterator or 0 to start at the beginning
+		 */
+		Iterator(Hashtable &ht,const unsigned long position) :
+			_idx(position),
+			_ht(&ht),
+			_b((position < ht._bc) ? ht._t[position] : (_Bucket *)0)
+		{
+		}
+
 		/**
 		 * @param kptr Pointer to set to point to next key
 		 * @param vptr Pointer to set to point to next value
@@ -103,6 +119,11 @@ public:
 			}
 		}
 
+		/**
+		 * @return Position to resume at, which may revisit some entries already returned
+		 */
+		inline unsigned long position() const { return _idx; }
+
 	private:
 		unsigned long _idx;
 		Hashtable *_ht;
@@ -366,6 +387,41 @@ public:
 	 */
 	inline bool empty() const { return (_s == 0); }
 
+	/**
+	 * Grow the table ahead of time so it holds n entries without rehashing
+	 *
+	 * Growing rehashes every entry at once, which for a big table is a long
+	 * pause for whatever holds its lock. A table that will get large can be
+	 * sized once up front instead. This never shrinks a table.
+	 *
+	 * @param n Number of entries to make room for
+	 */
+	inline void reserve(const unsigned long n)
+	{
+		unsigned long nc = _bc;
+		while (nc < n)
+			nc <<= 1;
+		if (nc != _bc)
+			_rehash(nc);
+	}
+
+	/**
+	 * Swap contents with another table, without copying entries
+	 *
+	 * @param ht Other table
+	 */
+	inline void swap(Hashtable<K,V> &ht)
+	{
+		_Bucket **const t = _t; _t = ht._t; ht._t = t;
+		const unsigned long bc = _bc; _bc = ht._bc; ht._bc = bc;
+		const unsigned long s = _s; _s = ht._s; ht._s = s;
+	}
+
+	/**
+	 * @return Bytes allocated for buckets and entries, not counting anything keys or values point to
+	 */
+	inline unsigned long footprint() const { return (unsigned long)((sizeof(_Bucket *) * _bc) + (sizeof(_Bucket) * _s)); }
+
 private:
 	template<typename O>
 	static inline unsigned long _hc(const O &obj)
@@ -385,9 +441,10 @@ private:
 		return ((unsigned long)i * (unsigned long)0x9e3779b1);
 	}
 
-	inline void _grow()
+	inline void _grow() { _rehash(_bc * 2); }
+
+	inline void _rehash(const unsigned long nc)
 	{
-		const unsigned long nc = _bc * 2;
 		_Bucket **nt = reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * nc));
 		if (nt) {
 			for(unsigned long i=0;i<nc;++i)
@@ -0,0 +1,220 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <new>
+
+#include "HugePages.hpp"
+#include "Mutex.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif
+
+// Blocks are this aligned, which keeps each on its own cache lines
+#define ZT_HUGEPAGES_ALIGN 64
+
+namespace ZeroTier {
+
+uintptr_t HugePages::_base = 0;
+uintptr_t HugePages::_size = 0;
+
+namespace {
+struct _SizeClass
+{
+	size_t size;
+	void **head;
+};
+static Mutex _lock;
+static _SizeClass _classes[ZT_HUGEPAGES_SIZE_CLASSES];
+static uintptr_t _next = 0;
+static HugePages::Backing _backing = HugePages::BACKING_NONE;
+static bool _locked = false;
+} // anonymous namespace
+
+#ifdef __WINDOWS__
+
+// Large pages need SeLockMemoryPrivilege, which the service account has if it was granted "Lock pages in memory"
+static bool _enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(),TOKEN_ADJUST_PRIVILEGES|TOKEN_QUERY,&token))
+		return false;
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool ok = (LookupPrivilegeValueA((LPCSTR)0,"SeLockMemoryPrivilege",&(tp.Privileges[0].Luid)) != FALSE);
+	if (ok)
+		ok = ((AdjustTokenPrivileges(token,FALSE,&tp,0,(PTOKEN_PRIVILEGES)0,(PDWORD)0) != FALSE)&&(GetLastError() == ERROR_SUCCESS));
+	CloseHandle(token);
+	return ok;
+}
+
+#endif
+
+bool HugePages::init(uint64_t size,bool lock)
+{
+	Mutex::Lock _l(_lock);
+	if ((_size)||(!size))
+		return false;
+	size = ((size + ZT_HUGEPAGES_PAGE_SIZE - 1) / ZT_HUGEPAGES_PAGE_SIZE) * ZT_HUGEPAGES_PAGE_SIZE;
+
+	void *p = (void *)0;
+	Backing b = BACKING_NONE;
+
+#ifdef __WINDOWS__
+	const SIZE_T lpm = GetLargePageMinimum();
+	if ((lpm)&&(_enableLockMemoryPrivilege())) {
+		const SIZE_T lsz = (SIZE_T)(((size + lpm - 1) / lpm) * lpm);
+		p = VirtualAlloc((LPVOID)0,lsz,MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,PAGE_READWRITE);
+		if (p) {
+			size = lsz;
+			b = BACKING_HUGETLB;
+			lock = false; // large pages are never paged out
+			_locked = true;
+		}
+	}
+	if (!p) {
+		p = VirtualAlloc((LPVOID)0,(SIZE_T)size,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE);
+		if (!p)
+			return false;
+		b = BACKING_NORMAL;
+	}
+	if (lock) {
+		// The working set has to be big enough to hold what's locked
+		SIZE_T wsMin = 0,wsMax = 0;
+		if (GetProcessWorkingSetSize(GetCurrentProcess(),&wsMin,&wsMax))
+			SetProcessWorkingSetSize(GetCurrentProcess(),wsMin + (SIZE_T)size,wsMax + (SIZE_T)size);
+		_locked = (VirtualLock(p,(SIZE_T)size) != FALSE);
+	}
+#else
+#ifdef MAP_HUGETLB
+	// MAP_POPULATE faults it all in now rather than on the packet path
+	p = mmap((void *)0,(size_t)size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE,-1,0);
+	if (p == MAP_FAILED)
+		p = (void *)0;
+	else b = BACKING_HUGETLB;
+#endif
+	if (!p) {
+		// Over-map by a page so the region can start on a huge page boundary
+		void *const m = mmap((void *)0,(size_t)size + ZT_HUGEPAGES_PAGE_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if (m == MAP_FAILED)
+			return false;
+		const uintptr_t a = (reinterpret_cast<uintptr_t>(m) + ZT_HUGEPAGES_PAGE_SIZE - 1) & ~((uintptr_t)ZT_HUGEPAGES_PAGE_SIZE - 1);
+		if (a > reinterpret_cast<uintptr_t>(m))
+			munmap(m,(size_t)(a - reinterpret_cast<uintptr_t>(m)));
+		const uintptr_t e = reinterpret_cast<uintptr_t>(m) + (uintptr_t)size + ZT_HUGEPAGES_PAGE_SIZE;
+		if (e > (a + (uintptr_t)size))
+			munmap(reinterpret_cast<void *>(a + (uintptr_t)size),(size_t)(e - (a + (uintptr_t)size)));
+		p = reinterpret_cast<void *>(a);
+		b = BACKING_NORMAL;
+#ifdef MADV_HUGEPAGE
+		if (madvise(p,(size_t)size,MADV_HUGEPAGE) == 0)
+			b = BACKING_TRANSPARENT;
+#endif
+		// Touch every page so they're faulted in (as huge pages if possible) now
+		for(uintptr_t i=0;i<(uintptr_t)size;i+=4096)
+			reinterpret_cast<volatile uint8_t *>(p)[i] = 0;
+	}
+	if (lock)
+		_locked = (mlock(p,(size_t)size) == 0);
+#endif
+
+	_next = reinterpret_cast<uintptr_t>(p);
+	_backing = b;
+	_base = reinterpret_cast<uintptr_t>(p);
+	_size = (uintptr_t)size;
+	return true;
+}
+
+void *HugePages::allocate(size_t sz)
+{
+	if (_size) {
+		const size_t asz = (sz + (ZT_HUGEPAGES_ALIGN - 1)) & ~((size_t)ZT_HUGEPAGES_ALIGN - 1);
+		Mutex::Lock _l(_lock);
+		for(unsigned int i=0;i<ZT_HUGEPAGES_SIZE_CLASSES;++i) {
+			if (_classes[i].size == asz) {
+				void **const b = _classes[i].head;
+				if (b) {
+					_classes[i].head = reinterpret_cast<void **>(*b);
+					return reinterpret_cast<void *>(b);
+				}
+				break;
+			}
+		}
+		if ((_next + asz) <= (_base + _size)) {
+			void *const b = reinterpret_cast<void *>(_next);
+			_next += asz;
+			return b;
+		}
+	}
+	return ::operator new(sz);
+}
+
+void HugePages::free(void *p,size_t sz)
+{
+	if (!p)
+		return;
+	if (contains(p)) {
+		const size_t asz = (sz + (ZT_HUGEPAGES_ALIGN - 1)) & ~((size_t)ZT_HUGEPAGES_ALIGN - 1);
+		Mutex::Lock _l(_lock);
+		for(unsigned int i=0;i<ZT_HUGEPAGES_SIZE_CLASSES;++i) {
+			if ((_classes[i].size == asz)||(!_classes[i].size)) {
+				_classes[i].size = asz;
+				*reinterpret_cast<void **>(p) = reinterpret_cast<void *>(_classes[i].head);
+				_classes[i].head = reinterpret_cast<void **>(p);
+				return;
+			}
+		}
+		// More sizes than classes: the block stays unused, which shouldn't happen with the callers we have
+		return;
+	}
+	::operator delete(p);
+}
+
+void HugePages::status(Status &s)
+{
+	Mutex::Lock _l(_lock);
+	s.backing = _backing;
+	s.size = (uint64_t)_size;
+	s.used = (uint64_t)(_next - _base);
+	s.locked = _locked;
+}
+
+const char *HugePages::backingName(const Backing b)
+{
+	switch(b) {
+		case BACKING_HUGETLB: return "hugetlb";
+		case BACKING_TRANSPARENT: return "transparent";
+		case BACKING_NORMAL: return "normal";
+		default: return "none";
+	}
+}
+
+} // namespace ZeroTier
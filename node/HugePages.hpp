@@ -0,0 +1,139 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_HUGEPAGES_HPP
+#define ZT_HUGEPAGES_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "Constants.hpp"
+
+/**
+ * Size of huge pages the arena is rounded up to
+ */
+#define ZT_HUGEPAGES_PAGE_SIZE 2097152
+
+/**
+ * Number of distinct allocation sizes whose freed blocks are reused
+ */
+#define ZT_HUGEPAGES_SIZE_CLASSES 16
+
+namespace ZeroTier {
+
+/**
+ * A process-wide arena in huge pages for packet buffers and hot objects
+ *
+ * At high packet rates, packet buffers, Peer and Path objects and the
+ * Switch's receive queue spread over the heap cost a TLB miss on nearly
+ * every touch. When the arena is set up, these come from one region backed
+ * by 2MiB pages instead, optionally locked in memory so they are never
+ * paged out.
+ *
+ * The region is taken from explicit huge pages (MAP_HUGETLB, or large pages
+ * on Windows) if the system has some reserved, and otherwise from ordinary
+ * memory advised for transparent huge pages. Allocations that don't fit, or
+ * any made without an arena, come from the heap as before, and free() tells
+ * the two apart by address, so callers never need to know.
+ *
+ * Blocks are handed out by bumping a pointer. Freed blocks are kept on a
+ * list per size for reuse, which suits the few fixed sizes allocated here.
+ */
+class HugePages
+{
+public:
+	enum Backing
+	{
+		BACKING_NONE = 0,        // no arena
+		BACKING_HUGETLB = 1,     // explicit huge pages
+		BACKING_TRANSPARENT = 2, // ordinary pages advised for transparent huge pages
+		BACKING_NORMAL = 3       // ordinary pages
+	};
+
+	struct Status
+	{
+		Backing backing;
+		uint64_t size;
+		uint64_t used;  // bytes handed out at least once
+		bool locked;
+	};
+
+	/**
+	 * Set up the arena, which can only be done once
+	 *
+	 * This should be called before the Node is created so that its objects
+	 * come from the arena too.
+	 *
+	 * @param size Size of arena in bytes (rounded up to ZT_HUGEPAGES_PAGE_SIZE)
+	 * @param lock If true, try to lock the arena in memory
+	 * @return False if already set up or no memory could be had at all
+	 */
+	static bool init(uint64_t size,bool lock);
+
+	/**
+	 * Allocate from the arena, or the heap if there is no room
+	 *
+	 * @param sz Bytes needed
+	 * @return Memory aligned to 64 bytes if from the arena
+	 * @throws std::bad_alloc Out of memory
+	 */
+	static void *allocate(size_t sz);
+
+	/**
+	 * Free memory from allocate()
+	 *
+	 * @param p Memory or NULL
+	 * @param sz Size passed to allocate()
+	 */
+	static void free(void *p,size_t sz);
+
+	/**
+	 * @param p Pointer
+	 * @return True if p is within the arena
+	 */
+	static inline bool contains(const void *p)
+	{
+		return ((reinterpret_cast<uintptr_t>(p) - _base) < _size);
+	}
+
+	/**
+	 * @param s Filled with the arena's backing and usage
+	 */
+	static void status(Status &s);
+
+	/**
+	 * @return Name of backing for status reports
+	 */
+	static const char *backingName(const Backing b);
+
+private:
+	static uintptr_t _base;
+	static uintptr_t _size;
+};
+
+} // namespace ZeroTier
+
+#endif
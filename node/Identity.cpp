@@ -80,37 +80,53 @@ static inline void _computeMemoryHardHash(const void *publicKey,unsigned int pub
 }
 
 // Hashcash generation halting condition -- halt when first byte is less than
-// threshold value.
+// threshold value, or when another generator has asked us to stop.
 struct _Identity_generate_cond
 {
 	_Identity_generate_cond() {}
-	_Identity_generate_cond(unsigned char *sb,char *gm) : digest(sb),genmem(gm) {}
+	_Identity_generate_cond(unsigned char *sb,char *gm,const volatile int *ab) : digest(sb),genmem(gm),abort(ab) {}
 	inline bool operator()(const C25519::Pair &kp) const
 	{
+		if ((abort)&&(*abort))
+			return true;
 		_computeMemoryHardHash(kp.pub.data,(unsigned int)kp.pub.size(),digest,genmem);
 		return (digest[0] < ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN);
 	}
 	unsigned char *digest;
 	char *genmem;
+	const volatile int *abort;
 };
 
 void Identity::generate()
+{
+	generate((const volatile int *)0);
+}
+
+bool Identity::generate(const volatile int *abort)
 {
 	unsigned char digest[64];
 	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
 
 	C25519::Pair kp;
+	Address addr;
 	do {
-		kp = C25519::generateSatisfying(_Identity_generate_cond(digest,genmem));
-		_address.setTo(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
-	} while (_address.isReserved());
+		kp = C25519::generateSatisfying(_Identity_generate_cond(digest,genmem,abort));
+		if ((abort)&&(*abort)) {
+			Utils::burn(&kp,sizeof(kp));
+			delete [] genmem;
+			return false;
+		}
+		addr.setTo(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
+	} while (addr.isReserved());
 
+	_address = addr;
 	_publicKey = kp.pub;
 	if (!_privateKey)
 		_privateKey = new C25519::Private();
 	*_privateKey = kp.priv;
 
 	delete [] genmem;
+	return true;
 }
 
 bool Identity::locallyValidate() const
@@ -111,6 +111,18 @@ public:
 	 */
 	void generate();
 
+	/**
+	 * Generate a new identity unless asked to stop
+	 *
+	 * This is safe to call from several threads at once on different Identity
+	 * objects, each of which uses its own scratch memory. Callers run one per
+	 * thread and set *abort once one succeeds (see idtool generate -t).
+	 *
+	 * @param abort If non-NULL, generation stops early once this is nonzero
+	 * @return True if generated, false if aborted (identity is unchanged)
+	 */
+	bool generate(const volatile int *abort);
+
 	/**
 	 * Check the validity of this identity's pairing of key to address
 	 *
@@ -180,6 +192,21 @@ public:
 		return C25519::verify(_publicKey,data,len,signature);
 	}
 
+	/**
+	 * Verify a message signature against this identity given the message's SHA-512 digest
+	 *
+	 * @param digest SHA-512 digest of data
+	 * @param signature Signature bytes
+	 * @param siglen Length of signature in bytes
+	 * @return True if signature validates and the digest matches
+	 */
+	inline bool verifyDigest(const void *digest,const void *signature,unsigned int siglen) const
+	{
+		if (siglen != ZT_C25519_SIGNATURE_LEN)
+			return false;
+		return C25519::verifyDigest(_publicKey,digest,signature);
+	}
+
 	/**
 	 * Shortcut method to perform key agreement with another identity
 	 *
@@ -264,6 +291,39 @@ public:
 		return (p - startAt);
 	}
 
+	/**
+	 * Deserialize a binary serialized identity without throwing
+	 *
+	 * @param r Reader positioned at serialized data, advanced past it on success
+	 * @return True if a well formed identity was read (r is marked failed otherwise)
+	 */
+	inline bool deserialize(BufferReader &r)
+	{
+		delete _privateKey;
+		_privateKey = (C25519::Private *)0;
+
+		const uint8_t *const a = r.nextField(ZT_ADDRESS_LENGTH);
+		const unsigned int type = r.next<uint8_t>();
+		const uint8_t *const pub = r.nextField((unsigned int)_publicKey.size());
+		const unsigned int privateKeyLength = r.next<uint8_t>();
+		if ((!r.ok())||(type != 0)||((privateKeyLength)&&(privateKeyLength != ZT_C25519_PRIVATE_KEY_LEN))) {
+			r.fail();
+			return false;
+		}
+		_address.setTo(a,ZT_ADDRESS_LENGTH);
+		memcpy(_publicKey.data,pub,(unsigned int)_publicKey.size());
+
+		if (privateKeyLength) {
+			const uint8_t *const priv = r.nextField(ZT_C25519_PRIVATE_KEY_LEN);
+			if (!priv)
+				return false;
+			_privateKey = new C25519::Private();
+			memcpy(_privateKey->data,priv,ZT_C25519_PRIVATE_KEY_LEN);
+		}
+
+		return true;
+	}
+
 	/**
 	 * Serialize to a more human-friendly string
 	 *
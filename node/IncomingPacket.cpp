@@ -48,7 +48,15 @@
 #include "Capability.hpp"
 #include "Tag.hpp"
 #include "Revocation.hpp"
+#include "SignatureBatch.hpp"
 #include "Trace.hpp"
+#include "PacketTrace.hpp"
+#include "Latency.hpp"
+#include "Probes.hpp"
+#include "DeferredPackets.hpp"
+#include "CryptoPipeline.hpp"
+#include "Bench.hpp"
+#include "Cluster.hpp"
 
 namespace ZeroTier {
 
@@ -57,6 +65,11 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 	const Address sourceAddress(source());
 
 	try {
+		if (_authenticated) {
+			const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,sourceAddress));
+			return ((peer) ? _dispatch(RR,tPtr,peer) : true);
+		}
+
 		// Check for trusted paths or unencrypted HELLOs (HELLO is the only packet sent in the clear)
 		const unsigned int c = cipher();
 		bool trusted = false;
@@ -73,48 +86,22 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 				return true;
 			}
 		} else if ((c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(verb() == Packet::VERB_HELLO)) {
-			// Only HELLO is allowed in the clear, but will still have a MAC
+			// Only HELLO is allowed in the clear, but will still have a MAC. One from
+			// a peer we don't know yet means validating its identity, so hand it off.
+			if ((!_deferred)&&(RR->node->deferringPackets())&&(!RR->topology->hasPeer(sourceAddress))) {
+				if (!_defer(RR,tPtr,false))
+					RR->t->incomingPacketDroppedHELLO(tPtr,_path,packetId(),sourceAddress,"deferred packet queue full");
+				return true;
+			}
 			return _doHELLO(RR,tPtr,false);
 		}
 
 		const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,sourceAddress));
 		if (peer) {
-			if (!trusted) {
-				if (!dearmor(peer->key())) {
-					RR->t->incomingPacketMessageAuthenticationFailure(tPtr,_path,packetId(),sourceAddress,hops());
-					return true;
-				}
-			}
-
-			if (!uncompress()) {
-				RR->t->incomingPacketInvalid(tPtr,_path,packetId(),sourceAddress,hops(),Packet::VERB_NOP,"LZ4 decompression failed");
+			// Busy peers have their packets decrypted by worker threads and handed back in order
+			if ((!trusted)&&(!_deferred)&&(RR->cp)&&(RR->cp->inbound(RR,tPtr,peer,*this,RR->node->now())))
 				return true;
-			}
-
-			const Packet::Verb v = verb();
-			switch(v) {
-				//case Packet::VERB_NOP:
-				default: // ignore unknown verbs, but if they pass auth check they are "received"
-					peer->received(tPtr,_path,hops(),packetId(),v,0,Packet::VERB_NOP,false,0);
-					return true;
-				case Packet::VERB_HELLO:                      return _doHELLO(RR,tPtr,true);
-				case Packet::VERB_ERROR:                      return _doERROR(RR,tPtr,peer);
-				case Packet::VERB_OK:                         return _doOK(RR,tPtr,peer);
-				case Packet::VERB_WHOIS:                      return _doWHOIS(RR,tPtr,peer);
-				case Packet::VERB_RENDEZVOUS:                 return _doRENDEZVOUS(RR,tPtr,peer);
-				case Packet::VERB_FRAME:                      return _doFRAME(RR,tPtr,peer);
-				case Packet::VERB_EXT_FRAME:                  return _doEXT_FRAME(RR,tPtr,peer);
-				case Packet::VERB_ECHO:                       return _doECHO(RR,tPtr,peer);
-				case Packet::VERB_MULTICAST_LIKE:             return _doMULTICAST_LIKE(RR,tPtr,peer);
-				case Packet::VERB_NETWORK_CREDENTIALS:        return _doNETWORK_CREDENTIALS(RR,tPtr,peer);
-				case Packet::VERB_NETWORK_CONFIG_REQUEST:     return _doNETWORK_CONFIG_REQUEST(RR,tPtr,peer);
-				case Packet::VERB_NETWORK_CONFIG:             return _doNETWORK_CONFIG(RR,tPtr,peer);
-				case Packet::VERB_MULTICAST_GATHER:           return _doMULTICAST_GATHER(RR,tPtr,peer);
-				case Packet::VERB_MULTICAST_FRAME:            return _doMULTICAST_FRAME(RR,tPtr,peer);
-				case Packet::VERB_PUSH_DIRECT_PATHS:          return _doPUSH_DIRECT_PATHS(RR,tPtr,peer);
-				case Packet::VERB_USER_MESSAGE:               return _doUSER_MESSAGE(RR,tPtr,peer);
-				case Packet::VERB_REMOTE_TRACE:               return _doREMOTE_TRACE(RR,tPtr,peer);
-			}
+			return _decoded(RR,tPtr,peer,_dearmorAndUncompress(RR,peer,trusted));
 		} else {
 			RR->sw->requestWhois(tPtr,sourceAddress);
 			return false;
@@ -125,11 +112,141 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 	}
 }
 
+IncomingPacket::DearmorResult IncomingPacket::_dearmorAndUncompress(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer,const bool trusted)
+{
+	Latency::Scope _ls(RR->latency,Latency::WIRE_DEARMOR);
+	const unsigned int wireLen = size();
+	if (cipher() == ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012) {
+		// A group key only vouches for multicasts on its own network
+		const uint64_t groupNwid = RR->node->dearmorGroup(*this);
+		if ( (!groupNwid) || (!uncompress()) || (verb() != Packet::VERB_MULTICAST_FRAME) || (size() < (ZT_PACKET_IDX_PAYLOAD + 8)) || (at<uint64_t>(ZT_PACKET_IDX_PAYLOAD) != groupNwid) ) {
+			peer->countIn(_receiveTime,wireLen,true);
+			ZT_PROBE_DEARMOR_FAIL(peer->address().toInt(),packetId(),1);
+			return DEARMOR_MAC_FAILED;
+		}
+		peer->countIn(_receiveTime,wireLen,false);
+		ZT_PROBE_DEARMOR_OK(peer->address().toInt(),packetId(),size());
+		return DEARMOR_OK;
+	}
+	if ((!trusted)&&(!dearmor(peer->key(),peer->aesKeys(),peer->keySchedule()))) {
+		peer->countIn(_receiveTime,wireLen,true);
+		ZT_PROBE_DEARMOR_FAIL(peer->address().toInt(),packetId(),1);
+		return DEARMOR_MAC_FAILED;
+	}
+	if (!uncompress()) {
+		peer->countIn(_receiveTime,wireLen,true);
+		ZT_PROBE_DEARMOR_FAIL(peer->address().toInt(),packetId(),2);
+		return DEARMOR_UNCOMPRESS_FAILED;
+	}
+	peer->countIn(_receiveTime,wireLen,false);
+	ZT_PROBE_DEARMOR_OK(peer->address().toInt(),packetId(),size());
+	return DEARMOR_OK;
+}
+
+bool IncomingPacket::_decoded(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const DearmorResult result)
+{
+	switch(result) {
+		case DEARMOR_MAC_FAILED:
+			RR->t->incomingPacketMessageAuthenticationFailure(tPtr,_path,packetId(),source(),hops());
+			return true;
+		case DEARMOR_UNCOMPRESS_FAILED:
+			RR->t->incomingPacketInvalid(tPtr,_path,packetId(),source(),hops(),Packet::VERB_NOP,"decompression failed");
+			return true;
+		default:
+			break;
+	}
+
+	// The sender is authenticated, so if the queue is full this is just decoded here
+	if ((!_deferred)&&(RR->node->deferringPackets())&&(_expensive())&&(_defer(RR,tPtr,true)))
+		return true;
+
+	return _dispatch(RR,tPtr,peer);
+}
+
+bool IncomingPacket::_dispatch(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	const Packet::Verb v = verb();
+	if ((cipher() == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(!_unencryptedFrameAllowed(RR))) {
+		RR->t->incomingPacketInvalid(tPtr,_path,packetId(),source(),hops(),v,"unencrypted frame not via an authenticated-only path");
+		return true;
+	}
+	RR->ptrace->record(_receiveTime,PacketTrace::EVENT_PACKET_RECEIVED,PacketTrace::REASON_NONE,packetId(),0,source().toInt(),destination().toInt(),(unsigned int)v,hops(),size());
+	Latency::Scope _ls(RR->latency,Latency::WIRE_VERB);
+	ZT_PROBE_VERB_DISPATCH(source().toInt(),packetId(),(unsigned int)v,hops());
+	switch(v) {
+		//case Packet::VERB_NOP:
+		default: // ignore unknown verbs, but if they pass auth check they are "received"
+			peer->received(tPtr,_path,hops(),packetId(),v,0,Packet::VERB_NOP,false,0);
+			return true;
+		case Packet::VERB_HELLO:                      return _doHELLO(RR,tPtr,true);
+		case Packet::VERB_ERROR:                      return _doERROR(RR,tPtr,peer);
+		case Packet::VERB_OK:                         return _doOK(RR,tPtr,peer);
+		case Packet::VERB_WHOIS:                      return _doWHOIS(RR,tPtr,peer);
+		case Packet::VERB_RENDEZVOUS:                 return _doRENDEZVOUS(RR,tPtr,peer);
+		case Packet::VERB_FRAME:                      return _doFRAME(RR,tPtr,peer);
+		case Packet::VERB_EXT_FRAME:                  return _doEXT_FRAME(RR,tPtr,peer);
+		case Packet::VERB_ECHO:                       return _doECHO(RR,tPtr,peer);
+		case Packet::VERB_MULTICAST_LIKE:             return _doMULTICAST_LIKE(RR,tPtr,peer);
+		case Packet::VERB_NETWORK_CREDENTIALS:        return _doNETWORK_CREDENTIALS(RR,tPtr,peer);
+		case Packet::VERB_NETWORK_CONFIG_REQUEST:     return _doNETWORK_CONFIG_REQUEST(RR,tPtr,peer);
+		case Packet::VERB_NETWORK_CONFIG:             return _doNETWORK_CONFIG(RR,tPtr,peer);
+		case Packet::VERB_MULTICAST_GATHER:           return _doMULTICAST_GATHER(RR,tPtr,peer);
+		case Packet::VERB_MULTICAST_FRAME:            return _doMULTICAST_FRAME(RR,tPtr,peer);
+		case Packet::VERB_PUSH_DIRECT_PATHS:          return _doPUSH_DIRECT_PATHS(RR,tPtr,peer);
+		case Packet::VERB_USER_MESSAGE:               return _doUSER_MESSAGE(RR,tPtr,peer);
+		case Packet::VERB_REMOTE_TRACE:               return _doREMOTE_TRACE(RR,tPtr,peer);
+		case Packet::VERB_PATH_FEC:                   return _doPATH_FEC(RR,tPtr,peer);
+		case Packet::VERB_BENCH:                      return _doBENCH(RR,tPtr,peer);
+		case Packet::VERB_NAT_PROBE:                  return _doNAT_PROBE(RR,tPtr,peer);
+	}
+}
+
+// Verbs whose handlers are dominated by identity validation or signature checks
+bool IncomingPacket::_expensive() const
+{
+	switch(verb()) {
+		case Packet::VERB_OK:
+			return ((size() > ZT_PROTO_VERB_OK_IDX_IN_RE_VERB)&&((Packet::Verb)(*this)[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB] == Packet::VERB_WHOIS));
+		case Packet::VERB_NETWORK_CREDENTIALS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Frames may only arrive unencrypted directly over a path their network designates for it
+bool IncomingPacket::_unencryptedFrameAllowed(const RuntimeEnvironment *RR) const
+{
+	switch(verb()) {
+		case Packet::VERB_FRAME:
+		case Packet::VERB_EXT_FRAME:
+		case Packet::VERB_MULTICAST_FRAME:
+			break;
+		default:
+			return true;
+	}
+	if ((hops() != 0)||(size() < (ZT_PACKET_IDX_PAYLOAD + 8)))
+		return false;
+	const SharedPtr<Network> &network = RR->node->network(at<uint64_t>(ZT_PACKET_IDX_PAYLOAD));
+	return ((network)&&(network->config().authOnlyPath(_path->address())));
+}
+
+bool IncomingPacket::_defer(const RuntimeEnvironment *RR,void *tPtr,const bool authenticated)
+{
+	if (!RR->dp->enqueue(*this,authenticated))
+		return false;
+	RR->node->postDeferredPackets(tPtr);
+	return true;
+}
+
 bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const Packet::Verb inReVerb = (Packet::Verb)(*this)[ZT_PROTO_VERB_ERROR_IDX_IN_RE_VERB];
-	const uint64_t inRePacketId = at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_IN_RE_PACKET_ID);
-	const Packet::ErrorCode errorCode = (Packet::ErrorCode)(*this)[ZT_PROTO_VERB_ERROR_IDX_ERROR_CODE];
+	BufferReader r(*this,ZT_PROTO_VERB_ERROR_IDX_IN_RE_VERB);
+	const Packet::Verb inReVerb = (Packet::Verb)r.next<uint8_t>();
+	const uint64_t inRePacketId = r.next<uint64_t>();
+	const Packet::ErrorCode errorCode = (Packet::ErrorCode)r.next<uint8_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
 	uint64_t networkId = 0;
 
 	/* Security note: we do not gate doERROR() with expectingReplyTo() to
@@ -143,7 +260,10 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 		case Packet::ERROR_OBJ_NOT_FOUND:
 			// Object not found, currently only meaningful from network controllers.
 			if (inReVerb == Packet::VERB_NETWORK_CONFIG_REQUEST) {
-				const SharedPtr<Network> network(RR->node->network(at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD)));
+				const uint64_t nwid = r.next<uint64_t>();
+				if (!r.ok())
+					return _malformed(RR,tPtr);
+				const SharedPtr<Network> network(RR->node->network(nwid));
 				if ((network)&&(network->controller() == peer->address()))
 					network->setNotFound();
 			}
@@ -154,7 +274,10 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 			// consider it meaningful from network controllers. This would indicate
 			// that the queried node does not support acting as a controller.
 			if (inReVerb == Packet::VERB_NETWORK_CONFIG_REQUEST) {
-				const SharedPtr<Network> network(RR->node->network(at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD)));
+				const uint64_t nwid = r.next<uint64_t>();
+				if (!r.ok())
+					return _malformed(RR,tPtr);
+				const SharedPtr<Network> network(RR->node->network(nwid));
 				if ((network)&&(network->controller() == peer->address()))
 					network->setNotFound();
 			}
@@ -168,7 +291,9 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 
 		case Packet::ERROR_NEED_MEMBERSHIP_CERTIFICATE: {
 			// Peers can send this in response to frames if they do not have a recent enough COM from us
-			networkId = at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD);
+			networkId = r.next<uint64_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
 			const SharedPtr<Network> network(RR->node->network(networkId));
 			const uint64_t now = RR->node->now();
 			if ( (network) && (network->config().com) && (peer->rateGateIncomingComRequest(now)) )
@@ -177,7 +302,10 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 
 		case Packet::ERROR_NETWORK_ACCESS_DENIED_: {
 			// Network controller: network access denied.
-			const SharedPtr<Network> network(RR->node->network(at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD)));
+			const uint64_t nwid = r.next<uint64_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
+			const SharedPtr<Network> network(RR->node->network(nwid));
 			if ((network)&&(network->controller() == peer->address()))
 				network->setAccessDenied();
 		}	break;
@@ -185,12 +313,14 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 		case Packet::ERROR_UNWANTED_MULTICAST: {
 			// Members of networks can use this error to indicate that they no longer
 			// want to receive multicasts on a given channel.
-			networkId = at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD);
+			networkId = r.next<uint64_t>();
+			const uint8_t *const mac = r.nextField(6);
+			const uint32_t adi = r.next<uint32_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
 			const SharedPtr<Network> network(RR->node->network(networkId));
-			if ((network)&&(network->gate(tPtr,peer))) {
-				const MulticastGroup mg(MAC(field(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD + 8,6),6),at<uint32_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD + 14));
-				RR->mc->remove(network->id(),mg,peer->address());
-			}
+			if ((network)&&(network->gate(tPtr,peer)))
+				RR->mc->remove(network->id(),MulticastGroup(MAC(mac,6),adi),peer->address());
 		}	break;
 
 		default: break;
@@ -207,13 +337,17 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 
 	const uint64_t pid = packetId();
 	const Address fromAddress(source());
-	const unsigned int protoVersion = (*this)[ZT_PROTO_VERB_HELLO_IDX_PROTOCOL_VERSION];
-	const unsigned int vMajor = (*this)[ZT_PROTO_VERB_HELLO_IDX_MAJOR_VERSION];
-	const unsigned int vMinor = (*this)[ZT_PROTO_VERB_HELLO_IDX_MINOR_VERSION];
-	const unsigned int vRevision = at<uint16_t>(ZT_PROTO_VERB_HELLO_IDX_REVISION);
-	const uint64_t timestamp = at<uint64_t>(ZT_PROTO_VERB_HELLO_IDX_TIMESTAMP);
+	BufferReader r(*this,ZT_PROTO_VERB_HELLO_IDX_PROTOCOL_VERSION);
+	const unsigned int protoVersion = r.next<uint8_t>();
+	const unsigned int vMajor = r.next<uint8_t>();
+	const unsigned int vMinor = r.next<uint8_t>();
+	const unsigned int vRevision = r.next<uint16_t>();
+	const uint64_t timestamp = r.next<uint64_t>();
 	Identity id;
-	unsigned int ptr = ZT_PROTO_VERB_HELLO_IDX_IDENTITY + id.deserialize(*this,ZT_PROTO_VERB_HELLO_IDX_IDENTITY);
+	if (!id.deserialize(r)) {
+		RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"malformed packet");
+		return true;
+	}
 
 	if (protoVersion < ZT_PROTO_VERSION_MIN) {
 		RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"protocol version too old");
@@ -256,7 +390,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 			} else {
 				// Identity is the same as the one we already have -- check packet integrity
 
-				if (!dearmor(peer->key())) {
+				if (!dearmor(peer->key(),(const AES *)0,peer->keySchedule())) {
 					RR->t->incomingPacketMessageAuthenticationFailure(tPtr,_path,pid,fromAddress,hops());
 					return true;
 				}
@@ -287,7 +421,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 		}
 
 		// Check that identity's address is valid as per the derivation function
-		if (!id.locallyValidate()) {
+		if (!RR->topology->locallyValidate(id)) {
 			RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"invalid identity");
 			return true;
 		}
@@ -301,8 +435,9 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 
 	// Get external surface address if present (was not in old versions)
 	InetAddress externalSurfaceAddress;
-	if (ptr < size()) {
-		ptr += externalSurfaceAddress.deserialize(*this,ptr);
+	if (!r.atEnd()) {
+		if (!externalSurfaceAddress.deserialize(r))
+			return _malformed(RR,tPtr);
 		if ((externalSurfaceAddress)&&(hops() == 0))
 			RR->sa->iam(tPtr,id.address(),_path->localSocket(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(id),now);
 	}
@@ -310,34 +445,42 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 	// Get primary planet world ID and world timestamp if present
 	uint64_t planetWorldId = 0;
 	uint64_t planetWorldTimestamp = 0;
-	if ((ptr + 16) <= size()) {
-		planetWorldId = at<uint64_t>(ptr); ptr += 8;
-		planetWorldTimestamp = at<uint64_t>(ptr); ptr += 8;
+	if (r.remaining() >= 16) {
+		planetWorldId = r.next<uint64_t>();
+		planetWorldTimestamp = r.next<uint64_t>();
 	}
 
 	std::vector< std::pair<uint64_t,uint64_t> > moonIdsAndTimestamps;
-	if (ptr < size()) {
+	uint64_t remoteCapabilities = 0;
+	if (!r.atEnd()) {
 		// Remainder of packet, if present, is encrypted
-		cryptField(peer->key(),ptr,size() - ptr);
+		cryptField(peer->key(),r.position(),r.remaining());
 
 		// Get moon IDs and timestamps if present
-		if ((ptr + 2) <= size()) {
-			const unsigned int numMoons = at<uint16_t>(ptr); ptr += 2;
+		if (r.remaining() >= 2) {
+			const unsigned int numMoons = r.next<uint16_t>();
 			for(unsigned int i=0;i<numMoons;++i) {
-				if ((World::Type)(*this)[ptr++] == World::TYPE_MOON)
-					moonIdsAndTimestamps.push_back(std::pair<uint64_t,uint64_t>(at<uint64_t>(ptr),at<uint64_t>(ptr + 8)));
-				ptr += 16;
+				const World::Type type = (World::Type)r.next<uint8_t>();
+				const uint64_t moonId = r.next<uint64_t>();
+				const uint64_t moonTimestamp = r.next<uint64_t>();
+				if (!r.ok())
+					return _malformed(RR,tPtr);
+				if (type == World::TYPE_MOON)
+					moonIdsAndTimestamps.push_back(std::pair<uint64_t,uint64_t>(moonId,moonTimestamp));
 			}
 		}
 
 		// Certificates of representation (if present)
-		if ((ptr + 2) <= size()) {
-			if (at<uint16_t>(ptr) > 0) {
+		if (r.remaining() >= 2) {
+			if (r.next<uint16_t>() > 0) {
 				CertificateOfRepresentation cor;
-				ptr += 2;
-				ptr += cor.deserialize(*this,ptr);
-			} else ptr += 2;
+				r.skip(cor.deserialize(*this,r.position()));
+			}
 		}
+
+		// Capability flags (if present)
+		if (r.remaining() >= 8)
+			remoteCapabilities = r.next<uint64_t>();
 	}
 
 	// Send OK(HELLO) with an echo of the packet's timestamp and some of the same
@@ -407,10 +550,13 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 	RR->topology->appendCertificateOfRepresentation(outp);
 	outp.setAt(corSizeAt,(uint16_t)(outp.size() - (corSizeAt + 2)));
 
-	outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+	outp.append((uint64_t)(((AES::accelerated()) ? ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV : 0) | ((Packet::zstdAvailable()) ? ZT_PROTO_HELLO_CAPABILITY_ZSTD : 0) | ((RR->node->ecn()) ? ZT_PROTO_HELLO_CAPABILITY_ECN : 0) | ZT_PROTO_HELLO_CAPABILITY_FEC | ZT_PROTO_HELLO_CAPABILITY_GROUP_KEY | ZT_PROTO_HELLO_CAPABILITY_NAT_PROBE));
+
+	outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 	_path->send(RR,tPtr,outp.data(),outp.size(),now);
 
 	peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision); // important for this to go first so received() knows the version
+	peer->setRemoteCapabilities(remoteCapabilities);
 	peer->received(tPtr,_path,hops(),pid,Packet::VERB_HELLO,0,Packet::VERB_NOP,false,0);
 
 	return true;
@@ -418,61 +564,87 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 
 bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const Packet::Verb inReVerb = (Packet::Verb)(*this)[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB];
-	const uint64_t inRePacketId = at<uint64_t>(ZT_PROTO_VERB_OK_IDX_IN_RE_PACKET_ID);
+	BufferReader r(*this,ZT_PROTO_VERB_OK_IDX_IN_RE_VERB);
+	const Packet::Verb inReVerb = (Packet::Verb)r.next<uint8_t>();
+	const uint64_t inRePacketId = r.next<uint64_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
 	uint64_t networkId = 0;
 
+	// The path remembers its NAT probe's packet ID itself, since the answer
+	// comes long enough after it that the expected replies table may have moved on
+	if (inReVerb == Packet::VERB_NAT_PROBE) {
+		if (!hops())
+			_path->natProbeAnswered(RR->node->now(),inRePacketId);
+		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_OK,inRePacketId,inReVerb,false,0);
+		return true;
+	}
+
 	if (!RR->node->expectingReplyTo(inRePacketId))
 		return true;
 
+	// Direct replies to HELLO and ECHO feed the path's RTT and loss estimates,
+	// except for replies to MTU probes which are counted separately
+	if ( (!hops()) && ((inReVerb == Packet::VERB_HELLO)||(inReVerb == Packet::VERB_ECHO)) ) {
+		if ((inReVerb != Packet::VERB_ECHO)||(!_path->mtuProbeAnswered(inRePacketId)))
+			_path->probeAnswered(RR->node->now());
+	}
+
 	switch(inReVerb) {
 
 		case Packet::VERB_HELLO: {
-			const uint64_t latency = RR->node->now() - at<uint64_t>(ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP);
+			const uint64_t timestamp = r.next<uint64_t>();
+			const unsigned int vProto = r.next<uint8_t>();
+			const unsigned int vMajor = r.next<uint8_t>();
+			const unsigned int vMinor = r.next<uint8_t>();
+			const unsigned int vRevision = r.next<uint16_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
+
+			const uint64_t latency = RR->node->now() - timestamp;
 			if (latency > ZT_HELLO_MAX_ALLOWABLE_LATENCY)
 				return true;
-
-			const unsigned int vProto = (*this)[ZT_PROTO_VERB_HELLO__OK__IDX_PROTOCOL_VERSION];
-			const unsigned int vMajor = (*this)[ZT_PROTO_VERB_HELLO__OK__IDX_MAJOR_VERSION];
-			const unsigned int vMinor = (*this)[ZT_PROTO_VERB_HELLO__OK__IDX_MINOR_VERSION];
-			const unsigned int vRevision = at<uint16_t>(ZT_PROTO_VERB_HELLO__OK__IDX_REVISION);
 			if (vProto < ZT_PROTO_VERSION_MIN)
 				return true;
 
-			InetAddress externalSurfaceAddress;
-			unsigned int ptr = ZT_PROTO_VERB_HELLO__OK__IDX_REVISION + 2;
-
 			// Get reported external surface address if present
-			if (ptr < size())
-				ptr += externalSurfaceAddress.deserialize(*this,ptr);
+			InetAddress externalSurfaceAddress;
+			if ((!r.atEnd())&&(!externalSurfaceAddress.deserialize(r)))
+				return _malformed(RR,tPtr);
 
 			// Handle planet or moon updates if present
-			if ((ptr + 2) <= size()) {
-				const unsigned int worldsLen = at<uint16_t>(ptr); ptr += 2;
+			if (r.remaining() >= 2) {
+				const unsigned int worldsLen = r.next<uint16_t>();
 				if (RR->topology->shouldAcceptWorldUpdateFrom(peer->address())) {
-					const unsigned int endOfWorlds = ptr + worldsLen;
-					while (ptr < endOfWorlds) {
+					const unsigned int endOfWorlds = r.position() + worldsLen;
+					while (r.position() < endOfWorlds) {
 						World w;
-						ptr += w.deserialize(*this,ptr);
+						if (!r.skip(w.deserialize(*this,r.position())))
+							return _malformed(RR,tPtr);
 						RR->topology->addWorld(tPtr,w,false);
 					}
 				} else {
-					ptr += worldsLen;
+					r.skip(worldsLen);
 				}
 			}
 
 			// Handle certificate of representation if present
-			if ((ptr + 2) <= size()) {
-				if (at<uint16_t>(ptr) > 0) {
+			if (r.remaining() >= 2) {
+				if (r.next<uint16_t>() > 0) {
 					CertificateOfRepresentation cor;
-					ptr += 2;
-					ptr += cor.deserialize(*this,ptr);
-				} else ptr += 2;
+					r.skip(cor.deserialize(*this,r.position()));
+				}
 			}
 
+			// Capability flags if present
+			uint64_t remoteCapabilities = 0;
+			if (r.remaining() >= 8)
+				remoteCapabilities = r.next<uint64_t>();
+
 			if (!hops())
 				peer->addDirectLatencyMeasurment((unsigned int)latency);
 			peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision);
+			peer->setRemoteCapabilities(remoteCapabilities);
 
 			if ((externalSurfaceAddress)&&(hops() == 0))
 				RR->sa->iam(tPtr,peer->address(),_path->localSocket(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(peer->identity()),RR->node->now());
@@ -480,54 +652,84 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 
 		case Packet::VERB_WHOIS:
 			if (RR->topology->isUpstream(peer->identity())) {
-				const Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
-				RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+				// One OK can answer a whole batch of lookups
+				while (!r.atEnd()) {
+					Identity id;
+					if (!id.deserialize(r))
+						return _malformed(RR,tPtr);
+					RR->topology->addIdentity(tPtr,id);
+					RR->sw->doAnythingWaitingForPeer(tPtr,id.address());
+				}
 			}
 			break;
 
 		case Packet::VERB_NETWORK_CONFIG_REQUEST: {
-			networkId = at<uint64_t>(ZT_PROTO_VERB_OK_IDX_PAYLOAD);
+			networkId = r.next<uint64_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
 			const SharedPtr<Network> network(RR->node->network(networkId));
 			if (network)
 				network->handleConfigChunk(tPtr,packetId(),source(),*this,ZT_PROTO_VERB_OK_IDX_PAYLOAD);
 		}	break;
 
 		case Packet::VERB_MULTICAST_GATHER: {
-			networkId = at<uint64_t>(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_NETWORK_ID);
+			networkId = r.next<uint64_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
 			const SharedPtr<Network> network(RR->node->network(networkId));
 			if (network) {
-				const MulticastGroup mg(MAC(field(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_MAC,6),6),at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_ADI));
-				const unsigned int count = at<uint16_t>(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_GATHER_RESULTS + 4);
-				RR->mc->addMultiple(tPtr,RR->node->now(),networkId,mg,field(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_GATHER_RESULTS + 6,count * 5),count,at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER__OK__IDX_GATHER_RESULTS));
+				const uint8_t *const mac = r.nextField(6);
+				const uint32_t adi = r.next<uint32_t>();
+				const unsigned int totalKnown = r.next<uint32_t>();
+				const unsigned int count = r.next<uint16_t>();
+				const uint8_t *const addresses = r.nextField(count * 5);
+				if (!r.ok())
+					return _malformed(RR,tPtr);
+				RR->mc->addMultiple(tPtr,RR->node->now(),networkId,MulticastGroup(MAC(mac,6),adi),addresses,count,totalKnown);
 			}
 		}	break;
 
 		case Packet::VERB_MULTICAST_FRAME: {
-			const unsigned int flags = (*this)[ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_FLAGS];
-			networkId = at<uint64_t>(ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_NETWORK_ID);
-			const MulticastGroup mg(MAC(field(ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_MAC,6),6),at<uint32_t>(ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_ADI));
+			networkId = r.next<uint64_t>();
+			const uint8_t *const mac = r.nextField(6);
+			const uint32_t adi = r.next<uint32_t>();
+			const unsigned int flags = r.next<uint8_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
+			const MulticastGroup mg(MAC(mac,6),adi);
 
 			const SharedPtr<Network> network(RR->node->network(networkId));
 			if (network) {
-				unsigned int offset = 0;
-
 				if ((flags & 0x01) != 0) { // deprecated but still used by older peers
 					CertificateOfMembership com;
-					offset += com.deserialize(*this,ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_COM_AND_GATHER_RESULTS);
+					r.skip(com.deserialize(*this,r.position()));
 					if (com)
 						network->addCredential(tPtr,com);
 				}
 
 				if ((flags & 0x02) != 0) {
 					// OK(MULTICAST_FRAME) includes implicit gather results
-					offset += ZT_PROTO_VERB_MULTICAST_FRAME__OK__IDX_COM_AND_GATHER_RESULTS;
-					unsigned int totalKnown = at<uint32_t>(offset); offset += 4;
-					unsigned int count = at<uint16_t>(offset); offset += 2;
-					RR->mc->addMultiple(tPtr,RR->node->now(),networkId,mg,field(offset,count * 5),count,totalKnown);
+					const unsigned int totalKnown = r.next<uint32_t>();
+					const unsigned int count = r.next<uint16_t>();
+					const uint8_t *const addresses = r.nextField(count * 5);
+					if (!r.ok())
+						return _malformed(RR,tPtr);
+					RR->mc->addMultiple(tPtr,RR->node->now(),networkId,mg,addresses,count,totalKnown);
 				}
 			}
 		}	break;
 
+		case Packet::VERB_ECHO:
+			// Probes sent through a relay come back with the relay and when they were sent
+			if ((r.remaining() == ZT_PROTO_ECHO_RELAY_PROBE_LENGTH)&&(r.next<uint8_t>() == ZT_PROTO_ECHO_RELAY_PROBE)) {
+				const Address via(r.nextField(ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+				const uint64_t sent = r.next<uint64_t>();
+				const uint64_t now = RR->node->now();
+				if ((r.ok())&&(via)&&(now >= sent)&&((now - sent) <= ZT_HELLO_MAX_ALLOWABLE_LATENCY))
+					peer->relayProbeAnswered(now,via,(unsigned int)(now - sent));
+			}
+			break;
+
 		default: break;
 	}
 
@@ -546,23 +748,32 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 	outp.append(packetId());
 
 	unsigned int count = 0;
-	unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
-	while ((ptr + ZT_ADDRESS_LENGTH) <= size()) {
-		const Address addr(field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
-		ptr += ZT_ADDRESS_LENGTH;
+	bool unknown = false;
+	BufferReader r(*this,ZT_PROTO_VERB_WHOIS_IDX_ZTADDRESS);
+	while (r.remaining() >= ZT_ADDRESS_LENGTH) {
+		const Address addr(r.nextField(ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
 
 		const Identity id(RR->topology->getIdentity(tPtr,addr));
 		if (id) {
 			id.serialize(outp,false);
 			++count;
+		} else if (!RR->cluster) {
+			// Request unknown WHOIS from upstream from us (if we have one). Roots
+			// and moons answer the requester themselves once it arrives.
+			if (RR->topology->amRoot())
+				RR->sw->requestWhois(tPtr,addr,peer->address(),packetId());
+			else RR->sw->requestWhois(tPtr,addr);
 		} else {
-			// Request unknown WHOIS from upstream from us (if we have one)
-			RR->sw->requestWhois(tPtr,addr);
+			unknown = true;
 		}
 	}
 
+	// Other cluster members answer for the ones we don't know via PROXY_SEND
+	if (unknown)
+		RR->cluster->sendDistributedQuery(*this);
+
 	if (count > 0) {
-		outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+		outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 		_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 	}
 
@@ -573,18 +784,36 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 
 bool IncomingPacket::_doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	if (RR->topology->isUpstream(peer->identity())) {
-		const Address with(field(ZT_PROTO_VERB_RENDEZVOUS_IDX_ZTADDRESS,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+	BufferReader r(*this,ZT_PROTO_VERB_RENDEZVOUS_IDX_FLAGS);
+	const unsigned int flags = r.next<uint8_t>();
+	const uint8_t *const withBytes = r.nextField(ZT_ADDRESS_LENGTH);
+	if (!r.ok())
+		return _malformed(RR,tPtr);
+	const Address with(withBytes,ZT_ADDRESS_LENGTH);
+	if ((flags & ZT_PROTO_VERB_RENDEZVOUS_FLAG_REQUEST) != 0) {
+		if (RR->topology->amRoot())
+			RR->sw->rendezvousRequested(tPtr,peer->address(),with);
+	} else if (RR->topology->isUpstream(peer->identity())) {
 		const SharedPtr<Peer> rendezvousWith(RR->topology->getPeer(tPtr,with));
 		if (rendezvousWith) {
-			const unsigned int port = at<uint16_t>(ZT_PROTO_VERB_RENDEZVOUS_IDX_PORT);
-			const unsigned int addrlen = (*this)[ZT_PROTO_VERB_RENDEZVOUS_IDX_ADDRLEN];
+			const unsigned int port = r.next<uint16_t>();
+			const unsigned int addrlen = r.next<uint8_t>();
+			const uint8_t *const addr = r.nextField(addrlen);
+			if (!r.ok())
+				return _malformed(RR,tPtr);
 			if ((port > 0)&&((addrlen == 4)||(addrlen == 16))) {
-				const InetAddress atAddr(field(ZT_PROTO_VERB_RENDEZVOUS_IDX_ADDRESS,addrlen),addrlen,port);
-				if (RR->node->shouldUsePathForZeroTierTraffic(tPtr,with,_path->localSocket(),atAddr)) {
-					const uint64_t junk = RR->node->prng();
-					RR->node->putPacket(tPtr,_path->localSocket(),atAddr,&junk,4,2); // send low-TTL junk packet to 'open' local NAT(s) and stateful firewalls
-					rendezvousWith->attemptToContactAt(tPtr,_path->localSocket(),atAddr,RR->node->now(),false,0);
+				// Punch from every local socket at once, and for IPv4 at the ports a
+				// sequentially allocating NAT is likely to hand out next as well
+				InetAddress atAddr(addr,addrlen,port);
+				const unsigned int lastPort = (addrlen == 4) ? std::min(port + ZT_RENDEZVOUS_PORT_PREDICTION,65535U) : port;
+				const uint64_t now = RR->node->now();
+				for(unsigned int p=port;p<=lastPort;++p) {
+					atAddr.setPort(p);
+					if (RR->node->shouldUsePathForZeroTierTraffic(tPtr,with,-1,atAddr)) {
+						const uint64_t junk = RR->node->prng();
+						RR->node->putPacket(tPtr,-1,atAddr,&junk,4,2); // send low-TTL junk packet to 'open' local NAT(s) and stateful firewalls
+						rendezvousWith->attemptToContactAt(tPtr,-1,atAddr,now,false,0);
+					}
 				}
 			}
 		}
@@ -597,18 +826,21 @@ bool IncomingPacket::_doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const
 
 bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID);
-	const SharedPtr<Network> network(RR->node->network(nwid));
+	BufferReader r(*this,ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID);
+	const uint64_t nwid = r.next<uint64_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
+	const SharedPtr<Network> &network = RR->node->network(nwid);
 	bool trustEstablished = false;
 	if (network) {
 		if (network->gate(tPtr,peer)) {
 			trustEstablished = true;
-			if (size() > ZT_PROTO_VERB_FRAME_IDX_PAYLOAD) {
-				const unsigned int etherType = at<uint16_t>(ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE);
+			if (r.remaining() > 2) {
+				const unsigned int etherType = r.next<uint16_t>();
 				const MAC sourceMac(peer->address(),nwid);
-				const unsigned int frameLen = size() - ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
-				const uint8_t *const frameData = reinterpret_cast<const uint8_t *>(data()) + ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
-				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0)
+				const unsigned int frameLen = r.remaining();
+				const uint8_t *const frameData = r.nextField(frameLen);
+				if ( (network->filterIncomingPacket(tPtr,peer,_path,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0) && ((!_ce)||(Switch::markCongestion(etherType,field(size() - frameLen,frameLen),frameLen))) )
 					RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
 			}
 		} else {
@@ -626,15 +858,16 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 
 bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID);
-	const SharedPtr<Network> network(RR->node->network(nwid));
+	BufferReader r(*this,ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID);
+	const uint64_t nwid = r.next<uint64_t>();
+	const unsigned int flags = r.next<uint8_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
+	const SharedPtr<Network> &network = RR->node->network(nwid);
 	if (network) {
-		const unsigned int flags = (*this)[ZT_PROTO_VERB_EXT_FRAME_IDX_FLAGS];
-
-		unsigned int comLen = 0;
 		if ((flags & 0x01) != 0) { // inline COM with EXT_FRAME is deprecated but still used with old peers
 			CertificateOfMembership com;
-			comLen = com.deserialize(*this,ZT_PROTO_VERB_EXT_FRAME_IDX_COM);
+			r.skip(com.deserialize(*this,r.position()));
 			if (com)
 				network->addCredential(tPtr,com);
 		}
@@ -647,18 +880,22 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 		}
 
 		if (size() > ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD) {
-			const unsigned int etherType = at<uint16_t>(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_ETHERTYPE);
-			const MAC to(field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_TO,ZT_PROTO_VERB_EXT_FRAME_LEN_TO),ZT_PROTO_VERB_EXT_FRAME_LEN_TO);
-			const MAC from(field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_FROM,ZT_PROTO_VERB_EXT_FRAME_LEN_FROM),ZT_PROTO_VERB_EXT_FRAME_LEN_FROM);
-			const unsigned int frameLen = size() - (comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD);
-			const uint8_t *const frameData = (const uint8_t *)field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD,frameLen);
+			const uint8_t *const toBytes = r.nextField(ZT_PROTO_VERB_EXT_FRAME_LEN_TO);
+			const uint8_t *const fromBytes = r.nextField(ZT_PROTO_VERB_EXT_FRAME_LEN_FROM);
+			const unsigned int etherType = r.next<uint16_t>();
+			if (!r.ok())
+				return _malformed(RR,tPtr);
+			const MAC to(toBytes,ZT_PROTO_VERB_EXT_FRAME_LEN_TO);
+			const MAC from(fromBytes,ZT_PROTO_VERB_EXT_FRAME_LEN_FROM);
+			const unsigned int frameLen = r.remaining();
+			const uint8_t *const frameData = r.nextField(frameLen);
 
 			if ((!from)||(from == network->mac())) {
 				peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 				return true;
 			}
 
-			switch (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to,frameData,frameLen,etherType,0)) {
+			switch (network->filterIncomingPacket(tPtr,peer,_path,RR->identity.address(),from,to,frameData,frameLen,etherType,0)) {
 				case 1:
 					if (from != MAC(peer->address(),nwid)) {
 						if (network->config().permitsBridging(peer->address())) {
@@ -683,7 +920,8 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 					}
 					// fall through -- 2 means accept regardless of bridging checks or other restrictions
 				case 2:
-					RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to,etherType,0,(const void *)frameData,frameLen);
+					if ((!_ce)||(Switch::markCongestion(etherType,field(size() - frameLen,frameLen),frameLen)))
+						RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to,etherType,0,(const void *)frameData,frameLen);
 					break;
 			}
 		}
@@ -693,7 +931,7 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 			outp.append((uint8_t)Packet::VERB_EXT_FRAME);
 			outp.append((uint64_t)packetId());
 			outp.append((uint64_t)nwid);
-			outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+			outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
 
@@ -716,7 +954,7 @@ bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const Share
 	outp.append((uint64_t)pid);
 	if (size() > ZT_PACKET_IDX_PAYLOAD)
 		outp.append(reinterpret_cast<const unsigned char *>(data()) + ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD);
-	outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+	outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 	_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 
 	peer->received(tPtr,_path,hops(),pid,Packet::VERB_ECHO,0,Packet::VERB_NOP,false,0);
@@ -734,8 +972,13 @@ bool IncomingPacket::_doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,c
 	bool trustEstablished = false;
 
 	// Iterate through 18-byte network,MAC,ADI tuples
-	for(unsigned int ptr=ZT_PACKET_IDX_PAYLOAD;ptr<size();ptr+=18) {
-		const uint64_t nwid = at<uint64_t>(ptr);
+	BufferReader r(*this,ZT_PACKET_IDX_PAYLOAD);
+	while (!r.atEnd()) {
+		const uint64_t nwid = r.next<uint64_t>();
+		const uint8_t *const mac = r.nextField(6);
+		const uint32_t adi = r.next<uint32_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 
 		bool auth = false;
 		for(unsigned int i=0;i<authOnNetworkCount;++i) {
@@ -758,10 +1001,8 @@ bool IncomingPacket::_doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,c
 			}
 		}
 
-		if (auth) {
-			const MulticastGroup group(MAC(field(ptr + 8,6),6),at<uint32_t>(ptr + 14));
-			RR->mc->add(tPtr,now,nwid,group,peer->address());
-		}
+		if (auth)
+			RR->mc->add(tPtr,now,nwid,MulticastGroup(MAC(mac,6),adi),peer->address());
 	}
 
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_LIKE,0,Packet::VERB_NOP,trustEstablished,(network) ? network->id() : 0);
@@ -774,6 +1015,8 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	if (!peer->rateGateCredentialsReceived(RR->node->now()))
 		return true;
 
+	_batchVerifyCredentials(RR,tPtr);
+
 	CertificateOfMembership com;
 	Capability cap;
 	Tag tag;
@@ -782,9 +1025,9 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	bool trustEstablished = false;
 	SharedPtr<Network> network;
 
-	unsigned int p = ZT_PACKET_IDX_PAYLOAD;
-	while ((p < size())&&((*this)[p] != 0)) {
-		p += com.deserialize(*this,p);
+	BufferReader r(*this,ZT_PACKET_IDX_PAYLOAD);
+	while ((!r.atEnd())&&((*this)[r.position()] != 0)) {
+		r.skip(com.deserialize(*this,r.position()));
 		if (com) {
 			network = RR->node->network(com.networkId());
 			if (network) {
@@ -801,12 +1044,14 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 			} else RR->mc->addCredential(tPtr,com,false);
 		}
 	}
-	++p; // skip trailing 0 after COMs if present
+	r.skip(1); // skip trailing 0 after COMs if present
 
-	if (p < size()) { // older ZeroTier versions do not send capabilities, tags, or revocations
-		const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
+	if (!r.atEnd()) { // older ZeroTier versions do not send capabilities, tags, or revocations
+		const unsigned int numCapabilities = r.next<uint16_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 		for(unsigned int i=0;i<numCapabilities;++i) {
-			p += cap.deserialize(*this,p);
+			r.skip(cap.deserialize(*this,r.position()));
 			if ((!network)||(network->id() != cap.networkId()))
 				network = RR->node->network(cap.networkId());
 			if (network) {
@@ -823,11 +1068,13 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 			}
 		}
 
-		if (p >= size()) return true;
+		if (r.atEnd()) return true;
 
-		const unsigned int numTags = at<uint16_t>(p); p += 2;
+		const unsigned int numTags = r.next<uint16_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 		for(unsigned int i=0;i<numTags;++i) {
-			p += tag.deserialize(*this,p);
+			r.skip(tag.deserialize(*this,r.position()));
 			if ((!network)||(network->id() != tag.networkId()))
 				network = RR->node->network(tag.networkId());
 			if (network) {
@@ -844,11 +1091,13 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 			}
 		}
 
-		if (p >= size()) return true;
+		if (r.atEnd()) return true;
 
-		const unsigned int numRevocations = at<uint16_t>(p); p += 2;
+		const unsigned int numRevocations = r.next<uint16_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 		for(unsigned int i=0;i<numRevocations;++i) {
-			p += revocation.deserialize(*this,p);
+			r.skip(revocation.deserialize(*this,r.position()));
 			if ((!network)||(network->id() != revocation.networkId()))
 				network = RR->node->network(revocation.networkId());
 			if (network) {
@@ -865,11 +1114,13 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 			}
 		}
 
-		if (p >= size()) return true;
+		if (r.atEnd()) return true;
 
-		const unsigned int numCoos = at<uint16_t>(p); p += 2;
+		const unsigned int numCoos = r.next<uint16_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 		for(unsigned int i=0;i<numCoos;++i) {
-			p += coo.deserialize(*this,p);
+			r.skip(coo.deserialize(*this,r.position()));
 			if ((!network)||(network->id() != coo.networkId()))
 				network = RR->node->network(coo.networkId());
 			if (network) {
@@ -892,15 +1143,75 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	return true;
 }
 
+void IncomingPacket::_batchVerifyCredentials(const RuntimeEnvironment *RR,void *tPtr)
+{
+	// Check all signatures in a NETWORK_CREDENTIALS payload in one batch so
+	// that the verify() done by addCredential() finds them in the signature
+	// cache. Malformed payloads are left for the main parse to reject.
+	SignatureBatch batch(*(RR->sc));
+	try {
+		CertificateOfMembership com;
+		Capability cap;
+		Tag tag;
+		Revocation revocation;
+		CertificateOfOwnership coo;
+
+		BufferReader r(*this,ZT_PACKET_IDX_PAYLOAD);
+		while ((!r.atEnd())&&((*this)[r.position()] != 0)) {
+			r.skip(com.deserialize(*this,r.position()));
+			if (com)
+				com.addToBatch(RR,tPtr,batch);
+		}
+		r.skip(1);
+
+		if (!r.atEnd()) {
+			const unsigned int numCapabilities = r.next<uint16_t>();
+			for(unsigned int i=0;(i<numCapabilities)&&(r.ok());++i) {
+				r.skip(cap.deserialize(*this,r.position()));
+				cap.addToBatch(RR,tPtr,batch);
+			}
+		}
+		if (!r.atEnd()) {
+			const unsigned int numTags = r.next<uint16_t>();
+			for(unsigned int i=0;(i<numTags)&&(r.ok());++i) {
+				r.skip(tag.deserialize(*this,r.position()));
+				tag.addToBatch(RR,tPtr,batch);
+			}
+		}
+		if (!r.atEnd()) {
+			const unsigned int numRevocations = r.next<uint16_t>();
+			for(unsigned int i=0;(i<numRevocations)&&(r.ok());++i) {
+				r.skip(revocation.deserialize(*this,r.position()));
+				revocation.addToBatch(RR,tPtr,batch);
+			}
+		}
+		if (!r.atEnd()) {
+			const unsigned int numCoos = r.next<uint16_t>();
+			for(unsigned int i=0;(i<numCoos)&&(r.ok());++i) {
+				r.skip(coo.deserialize(*this,r.position()));
+				coo.addToBatch(RR,tPtr,batch);
+			}
+		}
+	} catch ( ... ) {}
+
+	if (batch.size() > 1)
+		batch.verify();
+}
+
 bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_NETWORK_ID);
+	BufferReader r(*this,ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_NETWORK_ID);
+	const uint64_t nwid = r.next<uint64_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
 	const unsigned int hopCount = hops();
 	const uint64_t requestPacketId = packetId();
 
 	if (RR->localNetworkController) {
-		const unsigned int metaDataLength = (ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT_LEN <= size()) ? at<uint16_t>(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT_LEN) : 0;
-		const char *metaDataBytes = (metaDataLength != 0) ? (const char *)field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT,metaDataLength) : (const char *)0;
+		const unsigned int metaDataLength = (r.remaining() >= 2) ? r.next<uint16_t>() : 0;
+		const char *const metaDataBytes = (metaDataLength != 0) ? (const char *)r.nextField(metaDataLength) : (const char *)0;
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 		const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData(metaDataBytes,metaDataLength);
 		RR->localNetworkController->request(nwid,(hopCount > 0) ? InetAddress() : _path->address(),requestPacketId,peer->identity(),metaData);
 	} else {
@@ -909,7 +1220,7 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void
 		outp.append(requestPacketId);
 		outp.append((unsigned char)Packet::ERROR_UNSUPPORTED_OPERATION);
 		outp.append(nwid);
-		outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+		outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 		_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 	}
 
@@ -920,7 +1231,11 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void
 
 bool IncomingPacket::_doNETWORK_CONFIG(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const SharedPtr<Network> network(RR->node->network(at<uint64_t>(ZT_PACKET_IDX_PAYLOAD)));
+	BufferReader r(*this,ZT_PACKET_IDX_PAYLOAD);
+	const uint64_t nwid = r.next<uint64_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
+	const SharedPtr<Network> network(RR->node->network(nwid));
 	if (network) {
 		const uint64_t configUpdateId = network->handleConfigChunk(tPtr,packetId(),source(),*this,ZT_PACKET_IDX_PAYLOAD);
 		if (configUpdateId) {
@@ -929,7 +1244,7 @@ bool IncomingPacket::_doNETWORK_CONFIG(const RuntimeEnvironment *RR,void *tPtr,c
 			outp.append((uint64_t)packetId());
 			outp.append((uint64_t)network->id());
 			outp.append((uint64_t)configUpdateId);
-			outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+			outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
 	}
@@ -941,17 +1256,22 @@ bool IncomingPacket::_doNETWORK_CONFIG(const RuntimeEnvironment *RR,void *tPtr,c
 
 bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_NETWORK_ID);
-	const unsigned int flags = (*this)[ZT_PROTO_VERB_MULTICAST_GATHER_IDX_FLAGS];
-	const MulticastGroup mg(MAC(field(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_MAC,6),6),at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_ADI));
-	const unsigned int gatherLimit = at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_GATHER_LIMIT);
+	BufferReader r(*this,ZT_PROTO_VERB_MULTICAST_GATHER_IDX_NETWORK_ID);
+	const uint64_t nwid = r.next<uint64_t>();
+	const unsigned int flags = r.next<uint8_t>();
+	const uint8_t *const mac = r.nextField(6);
+	const uint32_t adi = r.next<uint32_t>();
+	const unsigned int gatherLimit = r.next<uint32_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
+	const MulticastGroup mg(MAC(mac,6),adi);
 
 	const SharedPtr<Network> network(RR->node->network(nwid));
 
 	if ((flags & 0x01) != 0) {
 		try {
 			CertificateOfMembership com;
-			com.deserialize(*this,ZT_PROTO_VERB_MULTICAST_GATHER_IDX_COM);
+			com.deserialize(*this,r.position());
 			if (com) {
 				if (network)
 					network->addCredential(tPtr,com);
@@ -972,9 +1292,13 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr
 		outp.append((uint32_t)mg.adi());
 		const unsigned int gatheredLocally = RR->mc->gather(peer->address(),nwid,mg,outp,gatherLimit);
 		if (gatheredLocally > 0) {
-			outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+			outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
+
+		// Members of a group may be scattered across the cluster
+		if ((RR->cluster)&&(gatheredLocally < gatherLimit))
+			RR->cluster->sendDistributedQuery(*this);
 	}
 
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_GATHER,0,Packet::VERB_NOP,trustEstablished,nwid);
@@ -984,18 +1308,18 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr
 
 bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_MULTICAST_FRAME_IDX_NETWORK_ID);
-	const unsigned int flags = (*this)[ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS];
+	BufferReader r(*this,ZT_PROTO_VERB_MULTICAST_FRAME_IDX_NETWORK_ID);
+	const uint64_t nwid = r.next<uint64_t>();
+	const unsigned int flags = r.next<uint8_t>();
+	if (!r.ok())
+		return _malformed(RR,tPtr);
 
 	const SharedPtr<Network> network(RR->node->network(nwid));
 	if (network) {
-		// Offset -- size of optional fields added to position of later fields
-		unsigned int offset = 0;
-
 		if ((flags & 0x01) != 0) {
 			// This is deprecated but may still be sent by old peers
 			CertificateOfMembership com;
-			offset += com.deserialize(*this,ZT_PROTO_VERB_MULTICAST_FRAME_IDX_COM);
+			r.skip(com.deserialize(*this,r.position()));
 			if (com)
 				network->addCredential(tPtr,com);
 		}
@@ -1007,23 +1331,21 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 			return true;
 		}
 
-		unsigned int gatherLimit = 0;
-		if ((flags & 0x02) != 0) {
-			gatherLimit = at<uint32_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_GATHER_LIMIT);
-			offset += 4;
-		}
+		const unsigned int gatherLimit = ((flags & 0x02) != 0) ? r.next<uint32_t>() : 0;
+		const uint8_t *const fromBytes = ((flags & 0x04) != 0) ? r.nextField(6) : (const uint8_t *)0;
+		const uint8_t *const toBytes = r.nextField(6);
+		const uint32_t toAdi = r.next<uint32_t>();
+		const unsigned int etherType = r.next<uint16_t>();
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 
 		MAC from;
-		if ((flags & 0x04) != 0) {
-			from.setTo(field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_SOURCE_MAC,6),6);
-			offset += 6;
-		} else {
-			from.fromAddress(peer->address(),nwid);
-		}
-
-		const MulticastGroup to(MAC(field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_MAC,6),6),at<uint32_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_ADI));
-		const unsigned int etherType = at<uint16_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE);
-		const unsigned int frameLen = size() - (offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME);
+		if (fromBytes)
+			from.setTo(fromBytes,6);
+		else from.fromAddress(peer->address(),nwid);
+		const MulticastGroup to(MAC(toBytes,6),toAdi);
+		const unsigned int frameLen = r.remaining();
+		const uint8_t *const frameData = r.nextField(frameLen);
 
 		if (network->config().multicastLimit == 0) {
 			RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTICAST_FRAME,from,to.mac(),"multicast disabled");
@@ -1046,6 +1368,8 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 			if (from != MAC(peer->address(),nwid)) {
 				if (network->config().permitsBridging(peer->address())) {
 					network->learnBridgeRoute(from,peer->address());
+				} else if (network->config().isMulticastReplicator(peer->address())) {
+					// Replicators re-send other members' multicasts with their source MACs
 				} else {
 					RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTICAST_FRAME,from,to.mac(),"bridging not allowed (remote)");
 					peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
@@ -1053,9 +1377,25 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 				}
 			}
 
-			const uint8_t *const frameData = (const uint8_t *)field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME,frameLen);
-			if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0) > 0)
+			if (network->filterIncomingPacket(tPtr,peer,_path,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0) > 0)
 				RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to.mac(),etherType,0,(const void *)frameData,frameLen);
+
+			if (((flags & 0x08) != 0)&&(network->config().isMulticastReplicator(RR->identity.address()))) {
+				// We are a replicator for this network, so send this on to the group
+				RR->mc->send(
+					tPtr,
+					network->config().multicastLimit,
+					RR->node->now(),
+					nwid,
+					network->config().disableCompression(),
+					network->config().activeBridges(),
+					peer->address(),
+					to,
+					from,
+					etherType,
+					frameData,
+					frameLen);
+			}
 		}
 
 		if (gatherLimit) {
@@ -1067,7 +1407,7 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 			outp.append((uint32_t)to.adi());
 			outp.append((unsigned char)0x02); // flag 0x02 = contains gather results
 			if (RR->mc->gather(peer->address(),nwid,to,outp,gatherLimit)) {
-				outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+				outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 				_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 			}
 		}
@@ -1095,21 +1435,25 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 	uint8_t countPerScope[ZT_INETADDRESS_MAX_SCOPE+1][2]; // [][0] is v4, [][1] is v6
 	memset(countPerScope,0,sizeof(countPerScope));
 
-	unsigned int count = at<uint16_t>(ZT_PACKET_IDX_PAYLOAD);
-	unsigned int ptr = ZT_PACKET_IDX_PAYLOAD + 2;
+	BufferReader r(*this,ZT_PACKET_IDX_PAYLOAD);
+	unsigned int count = r.next<uint16_t>();
 
-	while (count--) { // if ptr overflows Buffer will throw
+	while (count--) {
 		// TODO: some flags are not yet implemented
 
-		unsigned int flags = (*this)[ptr++];
-		unsigned int extLen = at<uint16_t>(ptr); ptr += 2;
-		ptr += extLen; // unused right now
-		unsigned int addrType = (*this)[ptr++];
-		unsigned int addrLen = (*this)[ptr++];
+		const unsigned int flags = r.next<uint8_t>();
+		r.skip(r.next<uint16_t>()); // extended attributes, unused right now
+		const unsigned int addrType = r.next<uint8_t>();
+		const unsigned int addrLen = r.next<uint8_t>();
+		const uint8_t *const addr = r.nextField(addrLen);
+		if (!r.ok())
+			return _malformed(RR,tPtr);
 
 		switch(addrType) {
 			case 4: {
-				const InetAddress a(field(ptr,4),4,at<uint16_t>(ptr + 4));
+				if (addrLen < 6)
+					break;
+				const InetAddress a(addr,4,((unsigned int)addr[4] << 8) | (unsigned int)addr[5]);
 				if (
 				    ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_FORGET_PATH) == 0) && // not being told to forget
 						(!( ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT) == 0) && (peer->hasActivePathTo(now,a)) )) && // not already known
@@ -1123,7 +1467,9 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 				}
 			}	break;
 			case 6: {
-				const InetAddress a(field(ptr,16),16,at<uint16_t>(ptr + 16));
+				if (addrLen < 18)
+					break;
+				const InetAddress a(addr,16,((unsigned int)addr[16] << 8) | (unsigned int)addr[17]);
 				if (
 				    ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_FORGET_PATH) == 0) && // not being told to forget
 						(!( ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT) == 0) && (peer->hasActivePathTo(now,a)) )) && // not already known
@@ -1137,7 +1483,6 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 				}
 			}	break;
 		}
-		ptr += addrLen;
 	}
 
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_PUSH_DIRECT_PATHS,0,Packet::VERB_NOP,false,0);
@@ -1185,6 +1530,50 @@ bool IncomingPacket::_doREMOTE_TRACE(const RuntimeEnvironment *RR,void *tPtr,con
 	return true;
 }
 
+bool IncomingPacket::_doPATH_FEC(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	// This is about the path it came in on, so relayed requests mean nothing
+	if (hops() == 0)
+		_path->fecRequested(RR->node->now(),((size() > ZT_PROTO_VERB_PATH_FEC_IDX_FLAGS)&&(((*this)[ZT_PROTO_VERB_PATH_FEC_IDX_FLAGS] & ZT_PROTO_VERB_PATH_FEC_FLAG_SEND_PARITY) != 0)));
+
+	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_PATH_FEC,0,Packet::VERB_NOP,false,0);
+
+	return true;
+}
+
+bool IncomingPacket::_doBENCH(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	RR->bench->received(tPtr,peer,*this);
+
+	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_BENCH,0,Packet::VERB_NOP,false,0);
+
+	return true;
+}
+
+bool IncomingPacket::_doNAT_PROBE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	if (size() < (ZT_PROTO_VERB_NAT_PROBE_IDX_DELAY + 4))
+		return _malformed(RR,tPtr);
+
+	// Only meaningful for the path it arrived on, so relayed probes are ignored
+	if (!hops()) {
+		const uint64_t now = RR->node->now();
+		_path->natReplyRequested(now,packetId(),std::min(at<uint32_t>(ZT_PROTO_VERB_NAT_PROBE_IDX_DELAY),(uint32_t)ZT_PATH_NAT_PROBE_MAX_DELAY));
+		RR->node->schedulePeerPing(peer,_path->nextHeartbeat());
+	}
+
+	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_NAT_PROBE,0,Packet::VERB_NOP,false,0);
+
+	return true;
+}
+
+// Rejects a packet that ended early or has a field with an invalid value
+bool IncomingPacket::_malformed(const RuntimeEnvironment *RR,void *tPtr)
+{
+	RR->t->incomingPacketInvalid(tPtr,_path,packetId(),source(),hops(),verb(),"malformed packet");
+	return true;
+}
+
 void IncomingPacket::_sendErrorNeedCredentials(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const uint64_t nwid)
 {
 	const uint64_t now = RR->node->now();
@@ -1194,7 +1583,7 @@ void IncomingPacket::_sendErrorNeedCredentials(const RuntimeEnvironment *RR,void
 		outp.append(packetId());
 		outp.append((uint8_t)Packet::ERROR_NEED_MEMBERSHIP_CERTIFICATE);
 		outp.append(nwid);
-		outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+		outp.armor(peer->key(),true,_path->nextOutgoingCounter(),peer->keySchedule());
 		_path->send(RR,tPtr,outp.data(),outp.size(),now);
 	}
 }
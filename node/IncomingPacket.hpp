@@ -61,10 +61,16 @@ class Network;
  */
 class IncomingPacket : public Packet
 {
+	friend class DeferredPackets;
+	friend class CryptoPipeline;
+
 public:
 	IncomingPacket() :
 		Packet(),
-		_receiveTime(0)
+		_receiveTime(0),
+		_deferred(false),
+		_authenticated(false),
+		_ce(false)
 	{
 	}
 
@@ -80,7 +86,10 @@ public:
 	IncomingPacket(const void *data,unsigned int len,const SharedPtr<Path> &path,uint64_t now) :
 		Packet(data,len),
 		_receiveTime(now),
-		_path(path)
+		_path(path),
+		_deferred(false),
+		_authenticated(false),
+		_ce(false)
 	{
 	}
 
@@ -98,6 +107,9 @@ public:
 		copyFrom(data,len);
 		_receiveTime = now;
 		_path = path;
+		_deferred = false;
+		_authenticated = false;
+		_ce = false;
 	}
 
 	/**
@@ -120,9 +132,32 @@ public:
 	 */
 	inline uint64_t receiveTime() const { return _receiveTime; }
 
+	/**
+	 * Note that this packet, or a fragment of it, arrived marked congestion experienced
+	 *
+	 * A frame it holds then gets the mark too on its way to the tap.
+	 */
+	inline void setCongestionExperienced() { _ce = true; }
+
 private:
+	enum DearmorResult
+	{
+		DEARMOR_OK,
+		DEARMOR_MAC_FAILED,
+		DEARMOR_UNCOMPRESS_FAILED
+	};
+
+	// Split so that CryptoPipeline can run the first on a worker thread and
+	// the second in arrival order
+	DearmorResult _dearmorAndUncompress(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer,const bool trusted);
+	bool _decoded(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const DearmorResult result);
+
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
+	bool _dispatch(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _expensive() const;
+	bool _unencryptedFrameAllowed(const RuntimeEnvironment *RR) const;
+	bool _defer(const RuntimeEnvironment *RR,void *tPtr,const bool authenticated);
 	bool _doERROR(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool alreadyAuthenticated);
 	bool _doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
@@ -133,6 +168,7 @@ private:
 	bool _doECHO(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	void _batchVerifyCredentials(const RuntimeEnvironment *RR,void *tPtr);
 	bool _doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doNETWORK_CONFIG(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
@@ -140,11 +176,18 @@ private:
 	bool _doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doUSER_MESSAGE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doREMOTE_TRACE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doPATH_FEC(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doBENCH(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doNAT_PROBE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 
+	bool _malformed(const RuntimeEnvironment *RR,void *tPtr);
 	void _sendErrorNeedCredentials(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const uint64_t nwid);
 
 	uint64_t _receiveTime;
 	SharedPtr<Path> _path;
+	bool _deferred; // already taken from DeferredPackets, so decode here and now
+	bool _authenticated; // deferred after dearmor() and uncompress(), so go straight to the verb
+	bool _ce; // arrived marked congestion experienced
 };
 
 } // namespace ZeroTier
@@ -143,23 +143,31 @@ char *InetAddress::toIpString(char buf[64]) const
 		case AF_INET: {
 			const uint8_t *a = reinterpret_cast<const uint8_t *>(&(reinterpret_cast<const struct sockaddr_in *>(this)->sin_addr.s_addr));
 			char *p = buf;
-			for(int i=0;;++i) {
-				Utils::decimal((unsigned long)a[i],p);
-				if (i != 3) {
-					while (*p) ++p;
-					*(p++) = '.';
-				} else break;
+			for(int i=0;i<4;++i) {
+				const unsigned int o = a[i];
+				if (o >= 100) {
+					*(p++) = (char)('0' + (o / 100));
+					*(p++) = (char)('0' + ((o / 10) % 10));
+				} else if (o >= 10) {
+					*(p++) = (char)('0' + (o / 10));
+				}
+				*(p++) = (char)('0' + (o % 10));
+				*(p++) = (i == 3) ? (char)0 : '.';
 			}
 		}	break;
 
 		case AF_INET6: {
-			uint16_t a[8];
-			memcpy(a,reinterpret_cast<const struct sockaddr_in6 *>(this)->sin6_addr.s6_addr,16);
+			// Two groups at a time, from one 32-bit word of digits
+			const uint8_t *a = reinterpret_cast<const struct sockaddr_in6 *>(this)->sin6_addr.s6_addr;
 			char *p = buf;
-			for(int i=0;i<8;++i) {
-				Utils::hex(Utils::ntoh(a[i]),p);
-				p[4] = (i == 7) ? (char)0 : ':';
-				p += 5;
+			char d[8];
+			for(int i=0;i<4;++i) {
+				Utils::storeBigEndian<uint64_t>(d,Utils::hexDigits(Utils::loadBigEndian<uint32_t>(a + (i * 4))));
+				memcpy(p,d,4);
+				p[4] = ':';
+				memcpy(p + 5,d + 4,4);
+				p[9] = (i == 3) ? (char)0 : ':';
+				p += 10;
 			}
 		}	break;
 
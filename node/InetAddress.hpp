@@ -441,30 +441,6 @@ struct InetAddress : public sockaddr_storage
 	 */
 	bool isNetwork() const;
 
-	/**
-	 * @return 14-bit (0-16383) hash of this IP's first 24 or 48 bits (for V4 or V6) for rate limiting code, or 0 if non-IP
-	 */
-	inline unsigned long rateGateHash() const
-	{
-		unsigned long h = 0;
-		switch(ss_family) {
-			case AF_INET:
-				h = (Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(this)->sin_addr.s_addr) & 0xffffff00) >> 8;
-				h ^= (h >> 14);
-				break;
-			case AF_INET6: {
-				const uint8_t *ip = reinterpret_cast<const uint8_t *>(reinterpret_cast<const struct sockaddr_in6 *>(this)->sin6_addr.s6_addr);
-				h = ((unsigned long)ip[0]); h <<= 1;
-				h += ((unsigned long)ip[1]); h <<= 1;
-				h += ((unsigned long)ip[2]); h <<= 1;
-				h += ((unsigned long)ip[3]); h <<= 1;
-				h += ((unsigned long)ip[4]); h <<= 1;
-				h += ((unsigned long)ip[5]);
-			}	break;
-		}
-		return (h & 0x3fff);
-	}
-
 	/**
 	 * @return True if address family is non-zero
 	 */
@@ -526,6 +502,54 @@ struct InetAddress : public sockaddr_storage
 		return (p - startAt);
 	}
 
+	/**
+	 * Deserialize without throwing
+	 *
+	 * @param r Reader positioned at serialized data, advanced past it on success
+	 * @return True if a well formed address (or a skipped unsupported type) was read
+	 */
+	inline bool deserialize(BufferReader &r)
+	{
+		memset(this,0,sizeof(InetAddress));
+		switch(r.next<uint8_t>()) {
+			case 0:
+				break;
+			case 0x01:
+			case 0x02:
+				r.skip(6); // Ethernet and Bluetooth addresses (accepted for forward compatibility)
+				break;
+			case 0x03:
+				r.skip(r.next<uint16_t>()); // other addresses begin with 16-bit non-inclusive length
+				break;
+			case 0x04: {
+				const uint8_t *const ip = r.nextField(4);
+				const uint16_t port = r.next<uint16_t>();
+				if (ip) {
+					ss_family = AF_INET;
+					memcpy(&(reinterpret_cast<struct sockaddr_in *>(this)->sin_addr.s_addr),ip,4);
+					reinterpret_cast<struct sockaddr_in *>(this)->sin_port = Utils::hton(port);
+				}
+			}	break;
+			case 0x06: {
+				const uint8_t *const ip = r.nextField(16);
+				const uint16_t port = r.next<uint16_t>();
+				if (ip) {
+					ss_family = AF_INET6;
+					memcpy(reinterpret_cast<struct sockaddr_in6 *>(this)->sin6_addr.s6_addr,ip,16);
+					reinterpret_cast<struct sockaddr_in6 *>(this)->sin6_port = Utils::hton(port);
+				}
+			}	break;
+			default:
+				r.fail();
+				break;
+		}
+		if (!r.ok()) {
+			memset(this,0,sizeof(InetAddress));
+			return false;
+		}
+		return true;
+	}
+
 	bool operator==(const InetAddress &a) const;
 	bool operator<(const InetAddress &a) const;
 	inline bool operator!=(const InetAddress &a) const { return !(*this == a); }
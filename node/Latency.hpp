@@ -0,0 +1,296 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_LATENCY_HPP
+#define ZT_LATENCY_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || defined(__amd64))
+#define ZT_LATENCY_TSC 1
+#include <x86intrin.h>
+#endif
+
+#ifdef __WINDOWS__
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+/**
+ * log2 of the largest time a histogram can resolve in ticks (larger times land in the last bucket)
+ */
+#define ZT_LATENCY_MAGNITUDES 40
+
+/**
+ * Buckets per histogram: exact for 0-7 ticks, then 8 sub-buckets per power of two (within 12.5%)
+ */
+#define ZT_LATENCY_BUCKETS ((ZT_LATENCY_MAGNITUDES - 2) * 8)
+
+namespace ZeroTier {
+
+/**
+ * Per-stage timing histograms for the packet paths
+ *
+ * Times are taken from the TSC on x86 and from a monotonic clock elsewhere,
+ * and are binned as ticks into log-linear buckets with relaxed atomic adds.
+ * Ticks are converted to nanoseconds only when stats are read. Stages nest:
+ * e.g. WIRE_VERB includes FILTER_IN and TAP_WRITE for frames. Building with
+ * ZT_NO_LATENCY makes all timing calls empty and drops the histograms.
+ */
+class Latency : NonCopyable
+{
+public:
+	enum Stage
+	{
+		WIRE_PACKET = 0,  // processWirePacket(), all of it
+		WIRE_DEARMOR,     // MAC check, decryption and decompression
+		WIRE_VERB,        // verb handler
+		FILTER_IN,        // rules engine on inbound frames
+		TAP_WRITE,        // virtual network frame callback (write to tap)
+		FRAME_PACKET,     // processVirtualNetworkFrame(), all of it
+		FILTER_OUT,       // rules engine on outbound frames
+		ARMOR,            // encryption and MAC of outgoing packets
+		STAGE_COUNT
+	};
+
+	/**
+	 * Summary of one stage's histogram, in nanoseconds
+	 */
+	struct Stats
+	{
+		uint64_t count;
+		uint64_t mean;
+		uint64_t p50;
+		uint64_t p90;
+		uint64_t p99;
+		uint64_t p999;
+		uint64_t max;
+	};
+
+	/**
+	 * Measures from construction to destruction into one stage
+	 */
+	class Scope : NonCopyable
+	{
+	public:
+#ifdef ZT_NO_LATENCY
+		Scope(Latency *,const Stage) {}
+#else
+		Scope(Latency *l,const Stage s) : _l(l),_s(s),_start(Latency::ticks()) {}
+		~Scope() { _l->record(_s,_start); }
+	private:
+		Latency *const _l;
+		const Stage _s;
+		const uint64_t _start;
+#endif
+	};
+
+	/**
+	 * @return Monotonic clock in nanoseconds (available with ZT_NO_LATENCY too)
+	 */
+	static inline uint64_t nanoseconds()
+	{
+#ifdef __WINDOWS__
+		LARGE_INTEGER c,f;
+		QueryPerformanceCounter(&c);
+		QueryPerformanceFrequency(&f);
+		return (uint64_t)(((double)c.QuadPart * 1000000000.0) / (double)f.QuadPart);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return (((uint64_t)ts.tv_sec) * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+#endif
+	}
+
+#ifdef ZT_NO_LATENCY
+	static const bool ENABLED = false;
+	Latency() {}
+	static inline uint64_t ticks() { return 0; }
+	inline void record(const Stage,const uint64_t) {}
+	inline void stats(const Stage,Stats &st) const { memset(&st,0,sizeof(st)); }
+#else
+	static const bool ENABLED = true;
+
+	Latency() :
+		_ticks0(ticks()),
+		_ns0(nanoseconds())
+	{
+		for(unsigned int s=0;s<STAGE_COUNT;++s) {
+			_s[s].count = 0;
+			_s[s].sum = 0;
+			for(unsigned int i=0;i<ZT_LATENCY_BUCKETS;++i)
+				_s[s].buckets[i] = 0;
+		}
+	}
+
+	/**
+	 * @return Current time in ticks (TSC cycles or nanoseconds)
+	 */
+	static inline uint64_t ticks()
+	{
+#if defined(ZT_LATENCY_TSC)
+		return (uint64_t)__rdtsc();
+#else
+		return nanoseconds();
+#endif
+	}
+
+	/**
+	 * Add the time since start to a stage's histogram
+	 *
+	 * @param s Stage
+	 * @param start Start time from ticks()
+	 */
+	inline void record(const Stage s,const uint64_t start)
+	{
+		const uint64_t now = ticks();
+		const uint64_t t = (now > start) ? (now - start) : 0; // TSC can step backwards across cores
+		_Stage &st = _s[s];
+		_add(st.count,1);
+		_add(st.sum,t);
+		_add(st.buckets[_bucket(t)],1);
+	}
+
+	/**
+	 * Summarize a stage
+	 *
+	 * Percentiles are the highest time in the bucket the percentile falls in,
+	 * so they are never low by more than one bucket width.
+	 *
+	 * @param s Stage
+	 * @param st Stats to fill
+	 */
+	inline void stats(const Stage s,Stats &st) const
+	{
+		const double nsPerTick = _nsPerTick();
+		const _Stage &h = _s[s];
+		uint64_t b[ZT_LATENCY_BUCKETS];
+		uint64_t total = 0;
+		for(unsigned int i=0;i<ZT_LATENCY_BUCKETS;++i) {
+			b[i] = _get(h.buckets[i]);
+			total += b[i];
+		}
+
+		memset(&st,0,sizeof(st));
+		st.count = total;
+		if (!total)
+			return;
+		st.mean = (uint64_t)(((double)_get(h.sum) / (double)_get(h.count)) * nsPerTick);
+
+		const uint64_t want[4] = { ((total * 500) + 999) / 1000,((total * 900) + 999) / 1000,((total * 990) + 999) / 1000,((total * 999) + 999) / 1000 };
+		uint64_t *const out[4] = { &st.p50,&st.p90,&st.p99,&st.p999 };
+		unsigned int w = 0;
+		uint64_t seen = 0;
+		for(unsigned int i=0;i<ZT_LATENCY_BUCKETS;++i) {
+			if (!b[i])
+				continue;
+			seen += b[i];
+			const uint64_t top = (uint64_t)((double)_bucketTop(i) * nsPerTick);
+			while ((w < 4)&&(seen >= want[w]))
+				*(out[w++]) = top;
+			st.max = top;
+		}
+	}
+
+private:
+	struct _Stage
+	{
+#ifdef __GNUC__
+		uint64_t count;
+		uint64_t sum;
+		uint64_t buckets[ZT_LATENCY_BUCKETS];
+#else
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> buckets[ZT_LATENCY_BUCKETS];
+#endif
+		uint8_t pad[48]; // round up to whole cache lines so stages never share one
+	};
+
+#ifdef __GNUC__
+	static inline void _add(uint64_t &v,const uint64_t n) { __atomic_fetch_add(&v,n,__ATOMIC_RELAXED); }
+	static inline uint64_t _get(const uint64_t &v) { return __atomic_load_n(&v,__ATOMIC_RELAXED); }
+#else
+	static inline void _add(std::atomic<uint64_t> &v,const uint64_t n) { v.fetch_add(n,std::memory_order_relaxed); }
+	static inline uint64_t _get(const std::atomic<uint64_t> &v) { return v.load(std::memory_order_relaxed); }
+#endif
+
+	static inline unsigned int _bucket(const uint64_t t)
+	{
+		if (t < 8)
+			return (unsigned int)t;
+#ifdef __GNUC__
+		const unsigned int m = 63 - (unsigned int)__builtin_clzll((unsigned long long)t);
+#else
+		unsigned int m = 3;
+		while ((t >> (m + 1)) != 0) ++m;
+#endif
+		if (m >= ZT_LATENCY_MAGNITUDES)
+			return ZT_LATENCY_BUCKETS - 1;
+		return ((m - 2) << 3) + (unsigned int)((t >> (m - 3)) & 7);
+	}
+
+	static inline uint64_t _bucketTop(const unsigned int i)
+	{
+		if (i < 8)
+			return (uint64_t)i;
+		const unsigned int m = (i >> 3) + 2;
+		return ((((uint64_t)(8 + (i & 7))) + 1) << (m - 3)) - 1;
+	}
+
+	// Tick rate is measured against the monotonic clock over our whole lifetime
+	inline double _nsPerTick() const
+	{
+#if defined(ZT_LATENCY_TSC)
+		const uint64_t t = ticks() - _ticks0;
+		const uint64_t n = nanoseconds() - _ns0;
+		if ((t == 0)||(n < 1000000))
+			return 1.0;
+		return (double)n / (double)t;
+#else
+		return 1.0;
+#endif
+	}
+
+	const uint64_t _ticks0;
+	const uint64_t _ns0;
+	_Stage _s[STAGE_COUNT];
+#endif
+};
+
+} // namespace ZeroTier
+
+#endif
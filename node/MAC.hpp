@@ -109,6 +109,23 @@ public:
 		*b = (unsigned char)(_m & 0xff);
 	}
 
+	/**
+	 * @param buf Buffer to fill with xx:xx:xx:xx:xx:xx
+	 * @return Pointer to buf
+	 */
+	inline char *toString(char buf[18]) const
+	{
+		char h[17];
+		Utils::hex(_m,h);
+		for(unsigned int i=0;i<6;++i) {
+			buf[i * 3] = h[4 + (i * 2)];
+			buf[(i * 3) + 1] = h[5 + (i * 2)];
+			buf[(i * 3) + 2] = ':';
+		}
+		buf[17] = (char)0;
+		return buf;
+	}
+
 	/**
 	 * Append to a buffer in big-endian byte order
 	 *
@@ -34,6 +34,7 @@
 #include "Packet.hpp"
 #include "Node.hpp"
 #include "Trace.hpp"
+#include "CredentialPushes.hpp"
 
 #define ZT_CREDENTIAL_PUSH_EVERY (ZT_NETWORK_AUTOCONF_DELAY / 3)
 
@@ -43,86 +44,64 @@ Membership::Membership() :
 	_lastUpdatedMulticast(0),
 	_lastPushedCom(0),
 	_comRevocationThreshold(0),
-	_revocations(4),
-	_remoteTags(4),
-	_remoteCaps(4),
-	_remoteCoos(4)
+	_allowed(0)
 {
 	resetPushState();
 }
 
-void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const uint64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force)
+void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const uint64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force,CredentialPushes *batch)
 {
 	bool sendCom = ( (nconf.com) && ( ((now - _lastPushedCom) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) );
 
-	const Capability *sendCap;
-	if (localCapabilityIndex >= 0) {
+	const Capability *sendCap = (const Capability *)0;
+	if ( (localCapabilityIndex >= 0) && ( (localCapabilityIndex != _lastPushedCapIndex) || ((now - _lastPushedCap) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) ) {
 		sendCap = &(nconf.capabilities[localCapabilityIndex]);
-		if ( ((now - _localCredLastPushed.cap[localCapabilityIndex]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) )
-			_localCredLastPushed.cap[localCapabilityIndex] = now;
-		else sendCap = (const Capability *)0;
-	} else sendCap = (const Capability *)0;
+		_lastPushedCap = now;
+		_lastPushedCapIndex = localCapabilityIndex;
+	}
 
-	const Tag *sendTags[ZT_MAX_NETWORK_TAGS];
 	unsigned int sendTagCount = 0;
-	for(unsigned int t=0;t<nconf.tagCount;++t) {
-		if ( ((now - _localCredLastPushed.tag[t]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) {
-			_localCredLastPushed.tag[t] = now;
-			sendTags[sendTagCount++] = &(nconf.tags[t]);
-		}
+	if ( (nconf.tagCount) && ( ((now - _lastPushedTags) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) ) {
+		_lastPushedTags = now;
+		sendTagCount = nconf.tagCount;
 	}
 
-	const CertificateOfOwnership *sendCoos[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
 	unsigned int sendCooCount = 0;
-	for(unsigned int c=0;c<nconf.certificateOfOwnershipCount;++c) {
-		if ( ((now - _localCredLastPushed.coo[c]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) {
-			_localCredLastPushed.coo[c] = now;
-			sendCoos[sendCooCount++] = &(nconf.certificatesOfOwnership[c]);
-		}
+	if ( (nconf.certificateOfOwnershipCount) && ( ((now - _lastPushedCoos) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) ) {
+		_lastPushedCoos = now;
+		sendCooCount = nconf.certificateOfOwnershipCount;
 	}
 
-	unsigned int tagPtr = 0;
-	unsigned int cooPtr = 0;
-	while ((tagPtr < sendTagCount)||(cooPtr < sendCooCount)||(sendCom)||(sendCap)) {
-		Packet outp(peerAddress,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-
-		if (sendCom) {
-			sendCom = false;
-			nconf.com.serialize(outp);
-			_lastPushedCom = now;
-		}
-		outp.append((uint8_t)0x00);
-
-		if (sendCap) {
-			outp.append((uint16_t)1);
-			sendCap->serialize(outp);
-			sendCap = (const Capability *)0;
-		} else outp.append((uint16_t)0);
-
-		const unsigned int tagCountAt = outp.size();
-		outp.addSize(2);
-		unsigned int thisPacketTagCount = 0;
-		while ((tagPtr < sendTagCount)&&((outp.size() + sizeof(Tag) + 16) < ZT_PROTO_MAX_PACKET_LENGTH)) {
-			sendTags[tagPtr++]->serialize(outp);
-			++thisPacketTagCount;
-		}
-		outp.setAt(tagCountAt,(uint16_t)thisPacketTagCount);
-
-		// No revocations, these propagate differently
-		outp.append((uint16_t)0);
-
-		const unsigned int cooCountAt = outp.size();
-		outp.addSize(2);
-		unsigned int thisPacketCooCount = 0;
-		while ((cooPtr < sendCooCount)&&((outp.size() + sizeof(CertificateOfOwnership) + 16) < ZT_PROTO_MAX_PACKET_LENGTH)) {
-			sendCoos[cooPtr++]->serialize(outp);
-			++thisPacketCooCount;
-		}
-		outp.setAt(cooCountAt,(uint16_t)thisPacketCooCount);
+	if ((!sendCom)&&(!sendCap)&&(!sendTagCount)&&(!sendCooCount))
+		return;
 
-		outp.compress();
-		RR->sw->send(tPtr,outp,true);
+	CredentialPushes direct;
+	CredentialPushes &out = (batch) ? *batch : direct;
+	if (sendCom) {
+		out.add(peerAddress,nconf.com);
+		_lastPushedCom = now;
 	}
+	if (sendCap)
+		out.add(peerAddress,*sendCap);
+	for(unsigned int t=0;t<sendTagCount;++t)
+		out.add(peerAddress,nconf.tags[t]);
+	for(unsigned int c=0;c<sendCooCount;++c)
+		out.add(peerAddress,nconf.certificatesOfOwnership[c]);
+	if (!batch)
+		direct.send(RR,tPtr);
+}
+
+bool Membership::credentialsDue(const uint64_t now,const NetworkConfig &nconf,int localCapabilityIndex) const
+{
+	if ((nconf.com)&&((now - _lastPushedCom) >= ZT_CREDENTIAL_PUSH_EVERY))
+		return true;
+	if ((localCapabilityIndex >= 0)&&((localCapabilityIndex != _lastPushedCapIndex)||((now - _lastPushedCap) >= ZT_CREDENTIAL_PUSH_EVERY)))
+		return true;
+	if ((nconf.tagCount)&&((now - _lastPushedTags) >= ZT_CREDENTIAL_PUSH_EVERY))
+		return true;
+	if ((nconf.certificateOfOwnershipCount)&&((now - _lastPushedCoos) >= ZT_CREDENTIAL_PUSH_EVERY))
+		return true;
+	return false;
 }
 
 Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com)
@@ -147,6 +126,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 			return ADD_REJECTED;
 		case 0:
 			_com = com;
+			__atomic_store_n(&_allowed,0,__ATOMIC_RELAXED);
 			RR->t->credentialAccepted(tPtr,com);
 			return ADD_ACCEPTED_NEW;
 		case 1:
@@ -155,8 +135,8 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 }
 
 // Template out addCredential() for many cred types to avoid copypasta
-template<typename C>
-static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,uint64_t> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
+template<typename C,unsigned int N,unsigned int RN>
+static Membership::AddCredentialResult _addCredImpl(SmallMap<uint32_t,C,N> &remoteCreds,const SmallMap<uint64_t,uint64_t,RN> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
 {
 	C *rc = remoteCreds.get(cred.id());
 	if (rc) {
@@ -189,9 +169,9 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl<Tag>(_remoteTags,_revocations,RR,tPtr,nconf,tag); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl<Capability>(_remoteCaps,_revocations,RR,tPtr,nconf,cap); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,RR,tPtr,nconf,coo); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl(_remoteTags,_revocations,RR,tPtr,nconf,tag); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl(_remoteCaps,_revocations,RR,tPtr,nconf,cap); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl(_remoteCoos,_revocations,RR,tPtr,nconf,coo); }
 
 Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev)
 {
@@ -207,6 +187,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 					if (rev.threshold() > _comRevocationThreshold) {
 						RR->t->credentialAccepted(tPtr,rev);
 						_comRevocationThreshold = rev.threshold();
+						__atomic_store_n(&_allowed,0,__ATOMIC_RELAXED);
 						return ADD_ACCEPTED_NEW;
 					}
 					return ADD_ACCEPTED_REDUNDANT;
@@ -217,6 +198,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 					if (*rt < rev.threshold()) {
 						*rt = rev.threshold();
 						_comRevocationThreshold = rev.threshold();
+						__atomic_store_n(&_allowed,0,__ATOMIC_RELAXED);
 						return ADD_ACCEPTED_NEW;
 					}
 					return ADD_ACCEPTED_REDUNDANT;
@@ -32,7 +32,7 @@
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
 #include "Credential.hpp"
-#include "Hashtable.hpp"
+#include "SmallMap.hpp"
 #include "CertificateOfMembership.hpp"
 #include "Capability.hpp"
 #include "Tag.hpp"
@@ -45,6 +45,7 @@ namespace ZeroTier {
 
 class RuntimeEnvironment;
 class Network;
+class CredentialPushes;
 
 /**
  * A container for certificates of membership and other network credentials
@@ -79,8 +80,22 @@ public:
 	 * @param nconf My network config
 	 * @param localCapabilityIndex Index of local capability to include (in nconf.capabilities[]) or -1 if none
 	 * @param force If true, send objects regardless of last push time
+	 * @param batch If non-NULL, add credentials to this for the caller to send along with other networks' instead of sending now
 	 */
-	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const uint64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force);
+	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const uint64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force,CredentialPushes *batch = (CredentialPushes *)0);
+
+	/**
+	 * Check whether pushCredentials() would send anything without force
+	 *
+	 * Unlike pushCredentials() this changes nothing, so it's safe while the
+	 * network is only read locked.
+	 *
+	 * @param now Current time
+	 * @param nconf My network config
+	 * @param localCapabilityIndex Index of local capability to include (in nconf.capabilities[]) or -1 if none
+	 * @return True if some credential is due to be pushed
+	 */
+	bool credentialsDue(const uint64_t now,const NetworkConfig &nconf,int localCapabilityIndex) const;
 
 	/**
 	 * Check whether we should push MULTICAST_LIKEs to this peer, and update last sent time if true
@@ -100,14 +115,23 @@ public:
 	/**
 	 * Check whether the peer represented by this Membership should be allowed on this network at all
 	 *
+	 * This is checked for every frame, so the result is cached against our
+	 * own COM's timestamp. It can't change otherwise until this member's COM
+	 * or COM revocation threshold does, and both of those clear the cache.
+	 *
 	 * @param nconf Our network config
 	 * @return True if this peer is allowed on this network at all
 	 */
 	inline bool isAllowedOnNetwork(const NetworkConfig &nconf) const
 	{
 		if (nconf.isPublic()) return true;
-		if (_com.timestamp() <= _comRevocationThreshold) return false;
-		return nconf.com.agreesWith(_com);
+		const uint64_t key = (nconf.com.timestamp() << 2) | 2;
+		const uint64_t c = __atomic_load_n(&_allowed,__ATOMIC_RELAXED);
+		if ((c & ~1ULL) == key)
+			return ((c & 1) != 0);
+		const bool allowed = ((_com.timestamp() > _comRevocationThreshold)&&(nconf.com.agreesWith(_com)));
+		__atomic_store_n(&_allowed,key | (uint64_t)allowed,__ATOMIC_RELAXED);
+		return allowed;
 	}
 
 	inline bool recentlyAssociated(const uint64_t now) const
@@ -126,11 +150,9 @@ public:
 	template<typename T>
 	inline bool hasCertificateOfOwnershipFor(const NetworkConfig &nconf,const T &r) const
 	{
-		uint32_t *k = (uint32_t *)0;
-		CertificateOfOwnership *v = (CertificateOfOwnership *)0;
-		Hashtable< uint32_t,CertificateOfOwnership >::Iterator i(*(const_cast< Hashtable< uint32_t,CertificateOfOwnership> *>(&_remoteCoos)));
-		while (i.next(k,v)) {
-			if (_isCredentialTimestampValid(nconf,*v)&&(v->owns(r)))
+		for(unsigned int i=0;i<_remoteCoos.size();++i) {
+			const CertificateOfOwnership &v = _remoteCoos.valueAt(i);
+			if (_isCredentialTimestampValid(nconf,v)&&(v.owns(r)))
 				return true;
 		}
 		return false;
@@ -190,9 +212,17 @@ public:
 	inline void resetPushState()
 	{
 		_lastPushedCom = 0;
-		memset(&_localCredLastPushed,0,sizeof(_localCredLastPushed));
+		_lastPushedCap = 0;
+		_lastPushedCapIndex = -1;
+		_lastPushedTags = 0;
+		_lastPushedCoos = 0;
 	}
 
+	/**
+	 * @return Bytes allocated for remote credentials and revocations, beyond sizeof(Membership)
+	 */
+	inline unsigned long footprint() const { return (_revocations.footprint() + _remoteTags.footprint() + _remoteCaps.footprint() + _remoteCoos.footprint()); }
+
 	/**
 	 * Generates a key for the internal use in indexing credentials by type and credential ID
 	 */
@@ -210,15 +240,13 @@ private:
 		return false;
 	}
 
-	template<typename C>
-	void _cleanCredImpl(const NetworkConfig &nconf,Hashtable<uint32_t,C> &remoteCreds)
+	template<typename C,unsigned int N>
+	void _cleanCredImpl(const NetworkConfig &nconf,SmallMap<uint32_t,C,N> &remoteCreds)
 	{
-		uint32_t *k = (uint32_t *)0;
-		C *v = (C *)0;
-		typename Hashtable<uint32_t,C>::Iterator i(remoteCreds);
-		while (i.next(k,v)) {
-			if (!_isCredentialTimestampValid(nconf,*v))
-				remoteCreds.erase(*k);
+		for(unsigned int i=remoteCreds.size();i>0;) {
+			--i;
+			if (!_isCredentialTimestampValid(nconf,remoteCreds.valueAt(i)))
+				remoteCreds.eraseAt(i);
 		}
 	}
 
@@ -234,29 +262,33 @@ private:
 	// Remote member's latest network COM
 	CertificateOfMembership _com;
 
-	// Revocations by credentialKey()
-	Hashtable< uint64_t,uint64_t > _revocations;
-
-	// Remote credentials that we have received from this member (and that are valid)
-	Hashtable< uint32_t,Tag > _remoteTags;
-	Hashtable< uint32_t,Capability > _remoteCaps;
-	Hashtable< uint32_t,CertificateOfOwnership > _remoteCoos;
+	// isAllowedOnNetwork() result: our COM's timestamp << 2, 2, and 1 if allowed, or 0 if not known
+	mutable uint64_t _allowed;
 
-	// Time we last pushed our local credentials to this member
-	struct {
-		uint64_t tag[ZT_MAX_NETWORK_TAGS];
-		uint64_t cap[ZT_MAX_NETWORK_CAPABILITIES];
-		uint64_t coo[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
-	} _localCredLastPushed;
+	// Revocations by credentialKey()
+	SmallMap< uint64_t,uint64_t,2 > _revocations;
+
+	// Remote credentials that we have received from this member (and that are
+	// valid). Members usually have a tag or two and rarely a capability or a
+	// certificate of ownership, which are large, so only tags are kept inline.
+	SmallMap< uint32_t,Tag,2 > _remoteTags;
+	SmallMap< uint32_t,Capability,0 > _remoteCaps;
+	SmallMap< uint32_t,CertificateOfOwnership,0 > _remoteCoos;
+
+	// Time we last pushed our local credentials to this member. All of our
+	// tags (and likewise certificates of ownership) are always pushed together,
+	// so one time covers them all. Only one capability is pushed to a member.
+	uint64_t _lastPushedCap;
+	int _lastPushedCapIndex; // index in nconf.capabilities[] of capability pushed at _lastPushedCap, or -1
+	uint64_t _lastPushedTags;
+	uint64_t _lastPushedCoos;
 
 public:
 	class CapabilityIterator
 	{
 	public:
 		CapabilityIterator(Membership &m,const NetworkConfig &nconf) :
-			_hti(m._remoteCaps),
-			_k((uint32_t *)0),
-			_c((Capability *)0),
+			_i(0),
 			_m(m),
 			_nconf(nconf)
 		{
@@ -264,17 +296,16 @@ public:
 
 		inline Capability *next()
 		{
-			while (_hti.next(_k,_c)) {
-				if (_m._isCredentialTimestampValid(_nconf,*_c))
-					return _c;
+			while (_i < _m._remoteCaps.size()) {
+				Capability *const c = &(_m._remoteCaps.valueAt(_i++));
+				if (_m._isCredentialTimestampValid(_nconf,*c))
+					return c;
 			}
 			return (Capability *)0;
 		}
 
 	private:
-		Hashtable< uint32_t,Capability >::Iterator _hti;
-		uint32_t *_k;
-		Capability *_c;
+		unsigned int _i;
 		Membership &_m;
 		const NetworkConfig &_nconf;
 	};
@@ -0,0 +1,136 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_MEMORYUSAGE_HPP
+#define ZT_MEMORYUSAGE_HPP
+
+#include <stdint.h>
+
+#include "Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Snapshot of how many objects each subsystem holds and roughly how much memory they use
+ *
+ * Nothing is tracked as objects come and go. Each subsystem walks its own
+ * tables when asked, so this costs nothing until it is read. Byte counts are
+ * estimates from object and container sizes and don't include allocator
+ * overhead, so they will be somewhat below what they add to RSS.
+ */
+class MemoryUsage
+{
+public:
+	enum Subsystem
+	{
+		PEERS = 0,
+		IDENTITIES,
+		PATHS,
+		NETWORKS,
+		MEMBERSHIPS,
+		MULTICAST_GROUPS,
+		MULTICAST_MEMBERS,
+		MULTICAST_TX_QUEUE,
+		RX_QUEUE,
+		TX_QUEUE,
+		WHOIS_QUEUE,
+		EGRESS_QUEUE,
+		DEFERRED_PACKETS,
+		CRYPTO_JOBS,
+		CONTROLLER_NETWORKS,
+		CONTROLLER_MEMBERS,
+		CONTROLLER_WRITE_QUEUE,
+		SUBSYSTEM_COUNT
+	};
+
+	struct Entry
+	{
+		uint64_t count;
+		uint64_t bytes;
+	};
+
+	MemoryUsage()
+	{
+		for(unsigned int i=0;i<SUBSYSTEM_COUNT;++i) {
+			_e[i].count = 0;
+			_e[i].bytes = 0;
+		}
+	}
+
+	inline void add(const Subsystem s,const uint64_t count,const uint64_t bytes)
+	{
+		_e[s].count += count;
+		_e[s].bytes += bytes;
+	}
+
+	inline const Entry &get(const Subsystem s) const { return _e[s]; }
+
+	/**
+	 * @return Sum of bytes over all subsystems
+	 */
+	inline uint64_t totalBytes() const
+	{
+		uint64_t t = 0;
+		for(unsigned int i=0;i<SUBSYSTEM_COUNT;++i)
+			t += _e[i].bytes;
+		return t;
+	}
+
+	/**
+	 * @return Name of subsystem for rendering, e.g. "peers"
+	 */
+	static inline const char *name(const Subsystem s)
+	{
+		static const char *const n[SUBSYSTEM_COUNT] = {
+			"peers",
+			"identities",
+			"paths",
+			"networks",
+			"memberships",
+			"multicastGroups",
+			"multicastMembers",
+			"multicastTxQueue",
+			"rxQueue",
+			"txQueue",
+			"whoisQueue",
+			"egressQueue",
+			"deferredPackets",
+			"cryptoJobs",
+			"controllerNetworks",
+			"controllerMembers",
+			"controllerWriteQueue"
+		};
+		return n[s];
+	}
+
+private:
+	Entry _e[SUBSYSTEM_COUNT];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_METRICS_HPP
+#define ZT_METRICS_HPP
+
+#include <stdint.h>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+/**
+ * Size counters are padded to, so that counters bumped by different threads don't share a cache line
+ */
+#define ZT_METRICS_CACHE_LINE_SIZE ZT_CACHE_LINE_SIZE
+
+namespace ZeroTier {
+
+/**
+ * Counters for events on packet processing paths
+ *
+ * Counters are bumped with relaxed atomic adds and each has its own cache
+ * line, so threads only contend when they bump the same counter and reads
+ * never block. Drops are counted by Trace, since every drop is traced.
+ */
+class Metrics : NonCopyable
+{
+public:
+	enum Counter
+	{
+		PACKETS_IN = 0,
+		BYTES_IN,
+		PACKETS_OUT,
+		BYTES_OUT,
+		FRAGMENTS_IN,
+		FRAGMENT_REASSEMBLY_EXPIRED,
+		RX_QUEUE_EVICTED,
+		PACKETS_DROPPED_INVALID,
+		PACKETS_DROPPED_HELLO,
+		PACKETS_DROPPED_UNTRUSTED_PATH,
+		CRYPTO_FAILURES,
+		TX_QUEUE_TIMEOUTS,
+		WHOIS_SENT,
+		WHOIS_ANSWERED,
+		WHOIS_LATENCY_MS,
+		WHOIS_TIMEOUTS,
+		WHOIS_PACKETS,
+		QOS_QUEUED,
+		QOS_DROPPED,
+		FRAMES_IN_DROPPED_ACCESS,
+		FRAMES_IN_DROPPED,
+		FRAMES_OUT_DROPPED,
+		FILTER_IN_ACCEPT,
+		FILTER_IN_DROP,
+		FILTER_IN_REDIRECT,
+		FILTER_OUT_ACCEPT,
+		FILTER_OUT_DROP,
+		FILTER_OUT_REDIRECT,
+		MEMBER_RATE_IN_DROPPED,
+		MEMBER_RATE_OUT_DROPPED,
+		RELAY_RATE_DROPPED,
+		NEIGHBOR_ANSWERED_ARP,
+		NEIGHBOR_ANSWERED_NDP,
+		MULTICAST_FRAMES_SENT,
+		MULTICAST_PACKETS_SENT,
+		MULTICAST_GATHERS_SENT,
+		CREDENTIALS_REJECTED,
+		SURFACE_CHANGES,
+		SURFACE_CHANGES_COALESCED,
+		PATH_RESET_PASSES,
+		PATHS_RESET,
+		PEERS_EVICTED,
+		IDENTITIES_EVICTED,
+		CRYPTO_JOBS_WORKER,
+		CRYPTO_JOBS_INLINE,
+		CRYPTO_JOBS_DROPPED,
+		FEC_PARITY_SENT,
+		FEC_REPAIRED,
+		FEC_UNREPAIRABLE,
+		FLOWS_EXPORTED,
+		FLOWS_OVERFLOWED,
+		IDENTITY_VERIFICATIONS_ADMITTED,
+		IDENTITY_VERIFICATIONS_THROTTLED,
+		COUNTER_COUNT
+	};
+
+	/**
+	 * Description of a counter for rendering
+	 *
+	 * Counters with the same name are adjacent and differ only in labels.
+	 */
+	struct Info
+	{
+		const char *name;
+		const char *labels; // e.g. reason="invalid", or empty
+		const char *help;
+	};
+
+	Metrics()
+	{
+		for(unsigned int i=0;i<COUNTER_COUNT;++i)
+			_c[i].v = 0;
+	}
+
+	inline void add(const Counter c,const uint64_t n)
+	{
+#ifdef __GNUC__
+		__atomic_fetch_add(&(_c[c].v),n,__ATOMIC_RELAXED);
+#else
+		_c[c].v.fetch_add(n,std::memory_order_relaxed);
+#endif
+	}
+
+	inline void inc(const Counter c) { add(c,1); }
+
+	inline uint64_t get(const Counter c) const
+	{
+#ifdef __GNUC__
+		return __atomic_load_n(&(_c[c].v),__ATOMIC_RELAXED);
+#else
+		return _c[c].v.load(std::memory_order_relaxed);
+#endif
+	}
+
+	static inline const Info &info(const Counter c)
+	{
+		static const Info i[COUNTER_COUNT] = {
+			{ "zt_packets_in_total","","Packets and fragments received from the physical network" },
+			{ "zt_bytes_in_total","","Bytes received from the physical network" },
+			{ "zt_packets_out_total","","Packets and fragments sent to the physical network" },
+			{ "zt_bytes_out_total","","Bytes sent to the physical network" },
+			{ "zt_fragments_in_total","","Fragments (other than heads) received for this node" },
+			{ "zt_rx_queue_dropped_total","reason=\"expired\"","Incomplete packets dropped from the receive queue" },
+			{ "zt_rx_queue_dropped_total","reason=\"evicted\"","Incomplete packets dropped from the receive queue" },
+			{ "zt_packets_dropped_total","reason=\"invalid\"","Packets for this node dropped before reaching a network" },
+			{ "zt_packets_dropped_total","reason=\"hello_rejected\"","Packets for this node dropped before reaching a network" },
+			{ "zt_packets_dropped_total","reason=\"untrusted_path\"","Packets for this node dropped before reaching a network" },
+			{ "zt_crypto_failures_total","","Packets that failed message authentication" },
+			{ "zt_tx_queue_timeouts_total","","Outgoing packets dropped while waiting for a peer's identity" },
+			{ "zt_whois_sent_total","","WHOIS lookups started" },
+			{ "zt_whois_answered_total","","WHOIS lookups answered" },
+			{ "zt_whois_latency_ms_total","","Total milliseconds from starting to answering answered WHOIS lookups" },
+			{ "zt_whois_timeouts_total","","WHOIS lookups given up on" },
+			{ "zt_whois_packets_total","","WHOIS packets sent, each carrying one or more lookups" },
+			{ "zt_qos_queued_total","","Outgoing packets held back by the egress bandwidth cap" },
+			{ "zt_qos_dropped_total","","Outgoing packets dropped because egress queues were full" },
+			{ "zt_frames_dropped_total","direction=\"in\",reason=\"access_denied\"","Network frames dropped" },
+			{ "zt_frames_dropped_total","direction=\"in\",reason=\"rejected\"","Network frames dropped" },
+			{ "zt_frames_dropped_total","direction=\"out\",reason=\"rejected\"","Network frames dropped" },
+			{ "zt_filter_verdicts_total","direction=\"in\",verdict=\"accept\"","Network rules engine verdicts" },
+			{ "zt_filter_verdicts_total","direction=\"in\",verdict=\"drop\"","Network rules engine verdicts" },
+			{ "zt_filter_verdicts_total","direction=\"in\",verdict=\"redirect\"","Network rules engine verdicts" },
+			{ "zt_filter_verdicts_total","direction=\"out\",verdict=\"accept\"","Network rules engine verdicts" },
+			{ "zt_filter_verdicts_total","direction=\"out\",verdict=\"drop\"","Network rules engine verdicts" },
+			{ "zt_filter_verdicts_total","direction=\"out\",verdict=\"redirect\"","Network rules engine verdicts" },
+			{ "zt_member_rate_dropped_total","direction=\"in\"","Frames dropped for exceeding a network's per-member rate limit" },
+			{ "zt_member_rate_dropped_total","direction=\"out\"","Frames dropped for exceeding a network's per-member rate limit" },
+			{ "zt_relay_rate_dropped_total","","Packets not relayed because their source or destination was over the relay rate limit" },
+			{ "zt_neighbor_answered_total","protocol=\"arp\"","Address resolution requests answered locally instead of multicast" },
+			{ "zt_neighbor_answered_total","protocol=\"ndp\"","Address resolution requests answered locally instead of multicast" },
+			{ "zt_multicast_frames_sent_total","","Multicast frames sent" },
+			{ "zt_multicast_packets_sent_total","","Packets sent to deliver multicast frames" },
+			{ "zt_multicast_gathers_sent_total","","Multicast gather queries sent" },
+			{ "zt_credentials_rejected_total","","Network credentials rejected" },
+			{ "zt_surface_changes_total","","Changes to our external address reported by upstream peers" },
+			{ "zt_surface_changes_coalesced_total","","External address changes folded into an already pending path reset" },
+			{ "zt_path_reset_passes_total","","Passes over all peers to reset paths after external address changes" },
+			{ "zt_paths_reset_total","","Paths reset after external address changes" },
+			{ "zt_topology_evicted_total","kind=\"peer\"","Peers and known identities dropped to stay within the peer limit" },
+			{ "zt_topology_evicted_total","kind=\"identity\"","Peers and known identities dropped to stay within the peer limit" },
+			{ "zt_crypto_jobs_total","run=\"worker\"","Packets of busy peers encrypted or decrypted through the crypto pipeline" },
+			{ "zt_crypto_jobs_total","run=\"inline\"","Packets of busy peers encrypted or decrypted through the crypto pipeline" },
+			{ "zt_crypto_jobs_dropped_total","","Packets dropped because their peer had too many in the crypto pipeline" },
+			{ "zt_fec_parity_sent_total","","FEC parity datagrams sent on lossy paths" },
+			{ "zt_fec_repairs_total","result=\"repaired\"","Parity datagrams that found datagrams lost, by whether one could be rebuilt" },
+			{ "zt_fec_repairs_total","result=\"unrepairable\"","Parity datagrams that found datagrams lost, by whether one could be rebuilt" },
+			{ "zt_flows_exported_total","","Flow records collected for export" },
+			{ "zt_flows_overflowed_total","","Frames of new flows not counted because a network's flow table was full" },
+			{ "zt_identity_verifications_total","result=\"admitted\"","Unknown identities presented, by whether their source prefix was allowed to have them verified" },
+			{ "zt_identity_verifications_total","result=\"throttled\"","Unknown identities presented, by whether their source prefix was allowed to have them verified" }
+		};
+		return i[c];
+	}
+
+private:
+	struct _Counter
+	{
+#ifdef __GNUC__
+		uint64_t v;
+#else
+		std::atomic<uint64_t> v;
+#endif
+		uint8_t pad[ZT_METRICS_CACHE_LINE_SIZE - 8];
+	};
+	_Counter _c[COUNTER_COUNT];
+};
+
+} // namespace ZeroTier
+
+#endif
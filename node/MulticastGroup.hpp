@@ -89,6 +89,45 @@ public:
 		return MulticastGroup();
 	}
 
+	/**
+	 * Derive the multicast group for an IPv4 or IPv6 multicast address
+	 *
+	 * This is the standard mapping of IP multicast onto Ethernet, so IPv4
+	 * groups that differ only in the top nine bits of the address share one.
+	 *
+	 * @param ip Raw IP address (4 or 16 bytes)
+	 * @param v6 If true, this is an IPv6 address
+	 * @return Multicast group with an ADI of zero
+	 */
+	static inline MulticastGroup deriveMulticastGroupForIpMulticast(const uint8_t *ip,const bool v6)
+	{
+		if (v6)
+			return MulticastGroup(MAC(0x33,0x33,ip[12],ip[13],ip[14],ip[15]),0);
+		return MulticastGroup(MAC(0x01,0x00,0x5e,ip[1] & 0x7f,ip[2],ip[3]),0);
+	}
+
+	/**
+	 * Check whether hosts join this group with IGMP or MLD reports
+	 *
+	 * This is true for IP multicast groups other than link-local IPv4 ones
+	 * (224.0.0.0/24), well-known IPv6 ones like all-nodes, and IPv6 solicited
+	 * node groups, which hosts either never report or which are better
+	 * handled by address resolution.
+	 *
+	 * @return True if membership in this group can be learned by snooping
+	 */
+	inline bool joinedByReport() const
+	{
+		if (_adi)
+			return false;
+		const uint64_t m = _mac.toInt();
+		if ((m >> 23) == (0x01005eULL << 1))
+			return ((m & 0x7fff00ULL) != 0);
+		if ((m >> 32) == 0x3333ULL)
+			return (((m & 0xffffff00ULL) != 0)&&(((m >> 24) & 0xff) != 0xff));
+		return false;
+	}
+
 	/**
 	 * @return Multicast address
 	 */
@@ -0,0 +1,134 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_MULTICASTLIKES_HPP
+#define ZT_MULTICASTLIKES_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "MulticastGroup.hpp"
+#include "Packet.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Switch.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * MULTICAST_LIKEs collected for sending, grouped by recipient
+ *
+ * A LIKE can carry groups from any number of networks, so collecting
+ * everything bound for a peer before sending lets announcements for all
+ * networks share packets.
+ *
+ * This is not thread safe.
+ */
+class MulticastLikes : NonCopyable
+{
+public:
+	MulticastLikes() : _likes(8) {}
+
+	/**
+	 * @param peer Recipient
+	 * @param nwid Network ID
+	 * @param mg Multicast group we belong to on this network
+	 */
+	inline void add(const Address &peer,const uint64_t nwid,const MulticastGroup &mg)
+	{
+		_likes[peer].push_back(_Like(nwid,mg));
+	}
+
+	/**
+	 * @param peer Recipient
+	 * @param nwid Network ID
+	 * @param mgs Multicast groups we belong to on this network
+	 */
+	inline void add(const Address &peer,const uint64_t nwid,const std::vector<MulticastGroup> &mgs)
+	{
+		std::vector<_Like> &l = _likes[peer];
+		for(std::vector<MulticastGroup>::const_iterator mg(mgs.begin());mg!=mgs.end();++mg)
+			l.push_back(_Like(nwid,*mg));
+	}
+
+	/**
+	 * @return True if nothing has been added since the last send()
+	 */
+	inline bool empty() const { return (_likes.size() == 0); }
+
+	/**
+	 * Send everything in as few MULTICAST_LIKE packets as will hold it and clear
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 */
+	inline void send(const RuntimeEnvironment *RR,void *tPtr)
+	{
+		Hashtable< Address,std::vector<_Like> >::Iterator i(_likes);
+		Address *peer = (Address *)0;
+		std::vector<_Like> *l = (std::vector<_Like> *)0;
+		while (i.next(peer,l)) {
+			Packet outp(*peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+			for(std::vector<_Like>::const_iterator like(l->begin());like!=l->end();++like) {
+				if ((outp.size() + 24) >= ZT_PROTO_MAX_PACKET_LENGTH) {
+					outp.compress();
+					RR->sw->send(tPtr,outp,true);
+					outp.reset(*peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+				}
+
+				// network ID, MAC, ADI
+				outp.append((uint64_t)like->nwid);
+				like->mg.mac().appendTo(outp);
+				outp.append((uint32_t)like->mg.adi());
+			}
+			if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH) {
+				outp.compress();
+				RR->sw->send(tPtr,outp,true);
+			}
+		}
+		_likes.clear();
+	}
+
+private:
+	struct _Like
+	{
+		_Like() : nwid(0) {}
+		_Like(const uint64_t n,const MulticastGroup &g) : nwid(n),mg(g) {}
+		uint64_t nwid;
+		MulticastGroup mg;
+	};
+
+	Hashtable< Address,std::vector<_Like> > _likes;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -37,14 +37,19 @@
 #include "C25519.hpp"
 #include "CertificateOfMembership.hpp"
 #include "Node.hpp"
+#include "Metrics.hpp"
+#include "Utils.hpp"
 
 namespace ZeroTier {
 
 Multicaster::Multicaster(const RuntimeEnvironment *renv) :
 	RR(renv),
-	_groups(256),
-	_gatherAuth(256)
+	_lastClean(0)
 {
+	for(unsigned int s=0;s<ZT_MULTICASTER_SHARDS;++s) {
+		_cleanGroupsPosition[s] = 0;
+		_cleanGatherAuthPosition[s] = 0;
+	}
 }
 
 Multicaster::~Multicaster()
@@ -55,33 +60,32 @@ void Multicaster::addMultiple(void *tPtr,uint64_t now,uint64_t nwid,const Multic
 {
 	const unsigned char *p = (const unsigned char *)addresses;
 	const unsigned char *e = p + (5 * count);
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus &gs = _groups[Multicaster::Key(nwid,mg)];
+	_Shard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.groups_m);
+	MulticastGroupStatus &gs = sh.groups[Multicaster::Key(nwid,mg)];
 	while (p != e) {
-		_add(tPtr,now,nwid,mg,gs,Address(p,5));
+		_add(tPtr,now,nwid,mg,sh,gs,Address(p,5));
 		p += 5;
 	}
 }
 
 void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &member)
 {
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	_Shard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.groups_m);
+	MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if (s) {
-		for(std::vector<MulticastGroupMember>::iterator m(s->members.begin());m!=s->members.end();++m) {
-			if (m->address == member) {
-				s->members.erase(m);
-				break;
-			}
-		}
+		const unsigned long i = _findMember(sh,nwid,mg,*s,member);
+		if (i < s->members.size())
+			_removeMember(sh,nwid,mg,*s,i);
 	}
 }
 
 unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const
 {
 	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned int added = 0,totalKnown = 0;
+	uint64_t a;
 
 	if (!limit)
 		return 0;
@@ -102,27 +106,26 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 		}
 	}
 
-	Mutex::Lock _l(_groups_m);
+	const _Shard &sh = const_cast<Multicaster *>(this)->_shard(nwid);
+	Mutex::Lock _l(sh.groups_m);
 
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	const MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if ((s)&&(!s->members.empty())) {
 		totalKnown += (unsigned int)s->members.size();
 
-		// Members are returned in random order so that repeated gather queries
-		// will return different subsets of a large multicast group.
-		k = 0;
-		while ((added < limit)&&(k < s->members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_UDP_DEFAULT_PAYLOAD_MTU)) {
-			rptr = (unsigned int)RR->node->prng();
-
-restart_member_scan:
-			a = s->members[rptr % (unsigned int)s->members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
-				}
-			}
-			picked[k++] = a;
+		// Members are returned starting at a random point and stepping by a
+		// random stride so that repeated gather queries will return different
+		// subsets of a large multicast group. A stride coprime to the number of
+		// members visits each one once, so no record of picks is needed and
+		// the cost is in the number returned, not the size of the group.
+		const unsigned long n = (unsigned long)s->members.size();
+		unsigned long m = (unsigned long)(RR->node->prng() % n);
+		unsigned long stride = (n > 1) ? (unsigned long)(1 + (RR->node->prng() % (n - 1))) : 1;
+		while (_gcd(stride,n) != 1)
+			--stride;
+		for(unsigned long k=0;((added < limit)&&(k < n)&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_UDP_DEFAULT_PAYLOAD_MTU));++k) {
+			a = s->members[m].address.toInt();
+			m = (m + stride) % n;
 
 			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
 				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
@@ -145,15 +148,20 @@ restart_member_scan:
 std::vector<Address> Multicaster::getMembers(uint64_t nwid,const MulticastGroup &mg,unsigned int limit) const
 {
 	std::vector<Address> ls;
-	Mutex::Lock _l(_groups_m);
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	const _Shard &sh = const_cast<Multicaster *>(this)->_shard(nwid);
+	Mutex::Lock _l(sh.groups_m);
+	const MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if (!s)
 		return ls;
-	for(std::vector<MulticastGroupMember>::const_reverse_iterator m(s->members.rbegin());m!=s->members.rend();++m) {
-		ls.push_back(m->address);
-		if (ls.size() >= limit)
-			break;
+	// Most recently heard from first
+	std::vector<MulticastGroupMember> recent(s->members);
+	if (recent.size() > limit) {
+		std::nth_element(recent.begin(),recent.begin() + limit,recent.end(),_newerMember);
+		recent.resize(limit);
 	}
+	std::sort(recent.begin(),recent.end(),_newerMember);
+	for(std::vector<MulticastGroupMember>::const_iterator m(recent.begin());m!=recent.end();++m)
+		ls.push_back(m->address);
 	return ls;
 }
 
@@ -164,6 +172,7 @@ void Multicaster::send(
 	uint64_t nwid,
 	bool disableCompression,
 	const std::vector<Address> &alwaysSendTo,
+	const Address &exclude,
 	const MulticastGroup &mg,
 	const MAC &src,
 	unsigned int etherType,
@@ -173,20 +182,31 @@ void Multicaster::send(
 	unsigned long idxbuf[8194];
 	unsigned long *indexes = idxbuf;
 
+	RR->metrics->inc(Metrics::MULTICAST_FRAMES_SENT);
+
+	Node::SendBatch _sb(RR->node,tPtr);
+
+	if (_replicate(tPtr,limit,now,nwid,disableCompression,mg,src,etherType,data,len))
+		return;
+
 	try {
-		Mutex::Lock _l(_groups_m);
-		MulticastGroupStatus &gs = _groups[Multicaster::Key(nwid,mg)];
+		_Shard &sh = _shard(nwid);
+		Mutex::Lock _l(sh.groups_m);
+		MulticastGroupStatus &gs = sh.groups[Multicaster::Key(nwid,mg)];
 
 		if (!gs.members.empty()) {
 			// Allocate a memory buffer if group is monstrous
 			if (gs.members.size() > (sizeof(idxbuf) / sizeof(unsigned long)))
 				indexes = new unsigned long[gs.members.size()];
 
-			// Generate a random permutation of member indexes
-			for(unsigned long i=0;i<gs.members.size();++i)
+			// Randomly choose as many member indexes as the sends below can use:
+			// up to limit members, plus any skipped for being in alwaysSendTo.
+			const unsigned long n = (unsigned long)gs.members.size();
+			const unsigned long picks = std::min(n,(unsigned long)limit + (unsigned long)alwaysSendTo.size() + 1);
+			for(unsigned long i=0;i<n;++i)
 				indexes[i] = i;
-			for(unsigned long i=(unsigned long)gs.members.size()-1;i>0;--i) {
-				unsigned long j = (unsigned long)RR->node->prng() % (i + 1);
+			for(unsigned long i=0;i<picks;++i) {
+				unsigned long j = i + ((unsigned long)RR->node->prng() % (n - i));
 				unsigned long tmp = indexes[j];
 				indexes[j] = indexes[i];
 				indexes[i] = tmp;
@@ -204,6 +224,7 @@ void Multicaster::send(
 				disableCompression,
 				limit,
 				1, // we'll still gather a little from peers to keep multicast list fresh
+				false,
 				src,
 				mg,
 				etherType,
@@ -223,7 +244,7 @@ void Multicaster::send(
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
 				Address ma(gs.members[indexes[idx++]].address);
-				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end()) {
+				if ((ma != exclude)&&(std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end())) {
 					out.sendOnly(RR,tPtr,ma); // optimization: don't use dedup log if it's a one-pass send
 					++count;
 				}
@@ -264,6 +285,7 @@ void Multicaster::send(
 						com->serialize(outp);
 					RR->node->expectReplyTo(outp.packetId());
 					RR->sw->send(tPtr,outp,true);
+					RR->metrics->inc(Metrics::MULTICAST_GATHERS_SENT);
 				}
 			}
 
@@ -277,6 +299,7 @@ void Multicaster::send(
 				disableCompression,
 				limit,
 				gatherLimit,
+				false,
 				src,
 				mg,
 				etherType,
@@ -296,7 +319,7 @@ void Multicaster::send(
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
 				Address ma(gs.members[indexes[idx++]].address);
-				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end()) {
+				if ((ma != exclude)&&(std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end())) {
 					out.sendAndLog(RR,tPtr,ma);
 					++count;
 				}
@@ -309,52 +332,105 @@ void Multicaster::send(
 		delete [] indexes;
 }
 
-void Multicaster::clean(uint64_t now)
+void Multicaster::memoryUsage(MemoryUsage &mu)
 {
-	{
-		Mutex::Lock _l(_groups_m);
-		Multicaster::Key *k = (Multicaster::Key *)0;
-		MulticastGroupStatus *s = (MulticastGroupStatus *)0;
-		Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(_groups);
-		while (mm.next(k,s)) {
-			for(std::list<OutboundMulticast>::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
-				if ((tx->expired(now))||(tx->atLimit()))
-					s->txQueue.erase(tx++);
-				else ++tx;
+	for(unsigned int shard=0;shard<ZT_MULTICASTER_SHARDS;++shard) {
+		_Shard &sh = _shards[shard];
+		{
+			Mutex::Lock _l(sh.groups_m);
+			mu.add(MemoryUsage::MULTICAST_GROUPS,sh.groups.size(),sh.groups.footprint());
+			mu.add(MemoryUsage::MULTICAST_MEMBERS,0,sh.memberIndex.footprint());
+			Multicaster::Key *k = (Multicaster::Key *)0;
+			MulticastGroupStatus *s = (MulticastGroupStatus *)0;
+			FlatHashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(sh.groups);
+			while (mm.next(k,s)) {
+				mu.add(MemoryUsage::MULTICAST_MEMBERS,s->members.size(),s->members.capacity() * sizeof(MulticastGroupMember));
+				const unsigned long txq = (unsigned long)s->txQueue.size();
+				mu.add(MemoryUsage::MULTICAST_TX_QUEUE,txq,txq * (sizeof(OutboundMulticast) + (2 * sizeof(void *)))); // std::list nodes
 			}
+		}
+		{
+			Mutex::Lock _l(sh.gatherAuth_m);
+			mu.add(MemoryUsage::MULTICAST_GROUPS,0,sh.gatherAuth.footprint());
+		}
+	}
+}
+
+void Multicaster::clean(uint64_t now)
+{
+	const uint64_t elapsed = now - _lastClean;
+	_lastClean = now;
+
+	// Each shard is cleaned a slice at a time, holding only its own locks
+	for(unsigned int shard=0;shard<ZT_MULTICASTER_SHARDS;++shard) {
+		_Shard &sh = _shards[shard];
+		{
+			Mutex::Lock _l(sh.groups_m);
+			unsigned long budget = Utils::housekeepingSlice(sh.groups.size(),elapsed);
+			Multicaster::Key *k = (Multicaster::Key *)0;
+			MulticastGroupStatus *s = (MulticastGroupStatus *)0;
+			FlatHashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(sh.groups,_cleanGroupsPosition[shard]);
+			for(;;) {
+				if (!budget) {
+					_cleanGroupsPosition[shard] = mm.position();
+					break;
+				}
+				if (!mm.next(k,s)) {
+					_cleanGroupsPosition[shard] = 0;
+					break;
+				}
+				--budget;
 
-			unsigned long count = 0;
-			{
-				std::vector<MulticastGroupMember>::iterator reader(s->members.begin());
-				std::vector<MulticastGroupMember>::iterator writer(reader);
-				while (reader != s->members.end()) {
-					if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
-						*writer = *reader;
-						++writer;
+				for(std::list<OutboundMulticast>::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
+					if ((tx->expired(now))||(tx->atLimit()))
+						s->txQueue.erase(tx++);
+					else ++tx;
+				}
+
+				unsigned long count = 0;
+				for(unsigned long reader=0;reader<s->members.size();++reader) {
+					const MulticastGroupMember &m = s->members[reader];
+					if ((now - m.timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
+						if (count != reader) {
+							s->members[count] = m;
+							if (s->indexed)
+								sh.memberIndex.set(_MemberKey(k->nwid,k->mg,m.address),count);
+						}
 						++count;
+					} else if (s->indexed) {
+						sh.memberIndex.erase(_MemberKey(k->nwid,k->mg,m.address));
 					}
-					++reader;
 				}
-			}
 
-			if (count) {
-				s->members.resize(count);
-			} else if (s->txQueue.empty()) {
-				_groups.erase(*k);
-			} else {
-				s->members.clear();
+				if (count) {
+					s->members.resize(count);
+				} else if (s->txQueue.empty()) {
+					sh.groups.erase(*k);
+				} else {
+					s->members.clear();
+				}
 			}
 		}
-	}
 
-	{
-		Mutex::Lock _l(_gatherAuth_m);
-		_GatherAuthKey *k = (_GatherAuthKey *)0;
-		uint64_t *ts = NULL;
-		Hashtable<_GatherAuthKey,uint64_t>::Iterator i(_gatherAuth);
-		while (i.next(k,ts)) {
-			if ((now - *ts) >= ZT_MULTICAST_CREDENTIAL_EXPIRATON)
-				_gatherAuth.erase(*k);
+		{
+			Mutex::Lock _l(sh.gatherAuth_m);
+			unsigned long budget = Utils::housekeepingSlice(sh.gatherAuth.size(),elapsed);
+			_GatherAuthKey *k = (_GatherAuthKey *)0;
+			uint64_t *ts = NULL;
+			Hashtable<_GatherAuthKey,uint64_t>::Iterator i(sh.gatherAuth,_cleanGatherAuthPosition[shard]);
+			for(;;) {
+				if (!budget) {
+					_cleanGatherAuthPosition[shard] = i.position();
+					break;
+				}
+				if (!i.next(k,ts)) {
+					_cleanGatherAuthPosition[shard] = 0;
+					break;
+				}
+				--budget;
+				if ((now - *ts) >= ZT_MULTICAST_CREDENTIAL_EXPIRATON)
+					sh.gatherAuth.erase(*k);
+			}
 		}
 	}
 }
@@ -362,27 +438,75 @@ void Multicaster::clean(uint64_t now)
 void Multicaster::addCredential(void *tPtr,const CertificateOfMembership &com,bool alreadyValidated)
 {
 	if ((alreadyValidated)||(com.verify(RR,tPtr) == 0)) {
-		Mutex::Lock _l(_gatherAuth_m);
-		_gatherAuth[_GatherAuthKey(com.networkId(),com.issuedTo())] = RR->node->now();
+		_Shard &sh = _shard(com.networkId());
+		Mutex::Lock _l(sh.gatherAuth_m);
+		sh.gatherAuth[_GatherAuthKey(com.networkId(),com.issuedTo())] = RR->node->now();
 	}
 }
 
-void Multicaster::_add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member)
+bool Multicaster::_replicate(void *tPtr,unsigned int limit,uint64_t now,uint64_t nwid,bool disableCompression,const MulticastGroup &mg,const MAC &src,unsigned int etherType,const void *data,unsigned int len)
+{
+	const SharedPtr<Network> network(RR->node->network(nwid));
+	if ((!network)||(!limit))
+		return false;
+	const std::vector<Address> replicators(network->config().multicastReplicators());
+	if ((replicators.empty())||(network->config().isMulticastReplicator(RR->identity.address())))
+		return false;
+
+	// Each group goes to the same replicator to spread load, unless that one
+	// is not reachable right now and another one is.
+	const unsigned long first = (unsigned long)(mg.hashCode() % (unsigned long)replicators.size());
+	Address replicator(replicators[first]);
+	for(unsigned long i=0;i<(unsigned long)replicators.size();++i) {
+		const SharedPtr<Peer> p(RR->topology->getPeerNoCache(replicators[(first + i) % replicators.size()]));
+		if ((p)&&(p->isAlive(now))) {
+			replicator = p->address();
+			break;
+		}
+	}
+
+	// The replicator re-sends from itself, so the source MAC always goes along
+	OutboundMulticast out;
+	out.init(
+		RR,
+		now,
+		nwid,
+		disableCompression,
+		limit,
+		0,
+		true,
+		(src) ? src : MAC(RR->identity.address(),nwid),
+		mg,
+		etherType,
+		data,
+		len);
+	out.sendOnly(RR,tPtr,replicator);
+
+	return true;
+}
+
+void Multicaster::_add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGroup &mg,_Shard &sh,MulticastGroupStatus &gs,const Address &member)
 {
-	// assumes _groups_m is locked
+	// assumes groups_m of nwid's shard is locked
 
 	// Do not add self -- even if someone else returns it
 	if (member == RR->identity.address())
 		return;
 
-	for(std::vector<MulticastGroupMember>::iterator m(gs.members.begin());m!=gs.members.end();++m) {
-		if (m->address == member) {
-			m->timestamp = now;
-			return;
-		}
+	const unsigned long i = _findMember(sh,nwid,mg,gs,member);
+	if (i < gs.members.size()) {
+		gs.members[i].timestamp = now;
+		return;
 	}
 
 	gs.members.push_back(MulticastGroupMember(member,now));
+	if (gs.indexed) {
+		sh.memberIndex.set(_MemberKey(nwid,mg,member),i);
+	} else if (gs.members.size() >= ZT_MULTICASTER_INDEX_THRESHOLD) {
+		for(unsigned long j=0;j<gs.members.size();++j)
+			sh.memberIndex.set(_MemberKey(nwid,mg,gs.members[j].address),j);
+		gs.indexed = true;
+	}
 
 	for(std::list<OutboundMulticast>::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
 		if (tx->atLimit())
@@ -396,4 +520,31 @@ void Multicaster::_add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGrou
 	}
 }
 
+unsigned long Multicaster::_findMember(const _Shard &sh,uint64_t nwid,const MulticastGroup &mg,const MulticastGroupStatus &gs,const Address &member)
+{
+	if (gs.indexed) {
+		const unsigned long *const i = sh.memberIndex.get(_MemberKey(nwid,mg,member));
+		return (i) ? *i : (unsigned long)gs.members.size();
+	}
+	for(unsigned long i=0;i<gs.members.size();++i) {
+		if (gs.members[i].address == member)
+			return i;
+	}
+	return (unsigned long)gs.members.size();
+}
+
+void Multicaster::_removeMember(_Shard &sh,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,unsigned long i)
+{
+	// Members aren't ordered, so the last one takes the removed one's place
+	const unsigned long last = (unsigned long)gs.members.size() - 1;
+	if (gs.indexed) {
+		sh.memberIndex.erase(_MemberKey(nwid,mg,gs.members[i].address));
+		if (i != last)
+			sh.memberIndex.set(_MemberKey(nwid,mg,gs.members[last].address),i);
+	}
+	if (i != last)
+		gs.members[i] = gs.members[last];
+	gs.members.pop_back();
+}
+
 } // namespace ZeroTier
@@ -33,9 +33,11 @@
 #include <map>
 #include <vector>
 #include <list>
+#include <algorithm>
 
 #include "Constants.hpp"
 #include "Hashtable.hpp"
+#include "FlatHashtable.hpp"
 #include "Address.hpp"
 #include "MAC.hpp"
 #include "MulticastGroup.hpp"
@@ -43,6 +45,21 @@
 #include "Utils.hpp"
 #include "Mutex.hpp"
 #include "NonCopyable.hpp"
+#include "MemoryUsage.hpp"
+
+/**
+ * Number of independently locked shards of multicast state (power of two)
+ */
+#define ZT_MULTICASTER_SHARDS 16
+
+/**
+ * Members a group can have before their positions are indexed
+ *
+ * Smaller groups, which is nearly all of them on leaves, are searched.
+ * Roots aggregate LIKEs for every group of every network they see, and
+ * without an index each one costs a search of the whole group.
+ */
+#define ZT_MULTICASTER_INDEX_THRESHOLD 64
 
 namespace ZeroTier {
 
@@ -79,11 +96,12 @@ private:
 
 	struct MulticastGroupStatus
 	{
-		MulticastGroupStatus() : lastExplicitGather(0) {}
+		MulticastGroupStatus() : lastExplicitGather(0),indexed(false) {}
 
 		uint64_t lastExplicitGather;
 		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
-		std::vector<MulticastGroupMember> members; // members of this group
+		std::vector<MulticastGroupMember> members; // members of this group, in no particular order
+		bool indexed; // if true, each member's position is in its shard's memberIndex
 	};
 
 public:
@@ -100,8 +118,9 @@ public:
 	 */
 	inline void add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGroup &mg,const Address &member)
 	{
-		Mutex::Lock _l(_groups_m);
-		_add(tPtr,now,nwid,mg,_groups[Multicaster::Key(nwid,mg)],member);
+		_Shard &sh = _shard(nwid);
+		Mutex::Lock _l(sh.groups_m);
+		_add(tPtr,now,nwid,mg,sh,sh.groups[Multicaster::Key(nwid,mg)],member);
 	}
 
 	/**
@@ -165,6 +184,7 @@ public:
 	 * @param nwid Network ID
 	 * @param disableCompression Disable packet payload compression?
 	 * @param alwaysSendTo Send to these peers first and even if not included in subscriber list
+	 * @param exclude Member not to send to, such as the origin of a multicast being replicated, or a nil address
 	 * @param mg Multicast group
 	 * @param src Source Ethernet MAC address or NULL to skip in packet and compute from ZT address (non-bridged mode)
 	 * @param etherType Ethernet frame type
@@ -178,6 +198,7 @@ public:
 		uint64_t nwid,
 		bool disableCompression,
 		const std::vector<Address> &alwaysSendTo,
+		const Address &exclude,
 		const MulticastGroup &mg,
 		const MAC &src,
 		unsigned int etherType,
@@ -185,13 +206,22 @@ public:
 		unsigned int len);
 
 	/**
-	 * Clean up and resort database
+	 * Clean up and resort the next slice of the database
+	 *
+	 * This should be called on every background task run and is not safe to
+	 * call concurrently with itself.
 	 *
-	 * @param RR Runtime environment
 	 * @param now Current time
 	 */
 	void clean(uint64_t now);
 
+	/**
+	 * Add groups, their members and queued multicasts to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
 	/**
 	 * Add an authorization credential
 	 *
@@ -214,18 +244,27 @@ public:
 	 */
 	bool cacheAuthorized(const Address &a,const uint64_t nwid,const uint64_t now) const
 	{
-		Mutex::Lock _l(_gatherAuth_m);
-		const uint64_t *p = _gatherAuth.get(_GatherAuthKey(nwid,a));
+		const _Shard &sh = const_cast<Multicaster *>(this)->_shard(nwid);
+		Mutex::Lock _l(sh.gatherAuth_m);
+		const uint64_t *p = sh.gatherAuth.get(_GatherAuthKey(nwid,a));
 		return ((p)&&((now - *p) < ZT_MULTICAST_CREDENTIAL_EXPIRATON));
 	}
 
 private:
-	void _add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member);
+	static inline unsigned long _gcd(unsigned long a,unsigned long b)
+	{
+		while (b) {
+			const unsigned long t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+	static inline bool _newerMember(const MulticastGroupMember &a,const MulticastGroupMember &b) { return (a.timestamp > b.timestamp); }
 
-	const RuntimeEnvironment *RR;
+	bool _replicate(void *tPtr,unsigned int limit,uint64_t now,uint64_t nwid,bool disableCompression,const MulticastGroup &mg,const MAC &src,unsigned int etherType,const void *data,unsigned int len);
 
-	Hashtable<Multicaster::Key,MulticastGroupStatus> _groups;
-	Mutex _groups_m;
+	const RuntimeEnvironment *RR;
 
 	struct _GatherAuthKey
 	{
@@ -236,8 +275,45 @@ private:
 		uint64_t member;
 		uint64_t networkId;
 	};
-	Hashtable< _GatherAuthKey,uint64_t > _gatherAuth;
-	Mutex _gatherAuth_m;
+
+	struct _MemberKey
+	{
+		_MemberKey() : nwid(0),mg(),member(0) {}
+		_MemberKey(const uint64_t n,const MulticastGroup &g,const Address &a) : nwid(n),mg(g),member(a.toInt()) {}
+		inline unsigned long hashCode() const { return (mg.hashCode() ^ (unsigned long)(nwid ^ (nwid >> 32)) ^ (unsigned long)(member * 0xff51afd7ed558ccdULL)); }
+		inline bool operator==(const _MemberKey &k) const { return ((member == k.member)&&(nwid == k.nwid)&&(mg == k.mg)); }
+		uint64_t nwid;
+		MulticastGroup mg;
+		uint64_t member;
+	};
+
+	// Groups and gather authorizations are split by network ID into separately
+	// locked shards, so multicast on one network never waits on another. The
+	// network ID is mixed since its high bits are the controller's address.
+	// Members of groups large enough to be indexed have their positions in
+	// memberIndex, which is locked with groups. Keeping the index out of
+	// MulticastGroupStatus keeps that small to move when groups is rehashed.
+	struct _Shard
+	{
+		_Shard() : groups(32),memberIndex(32),gatherAuth(32) {}
+		FlatHashtable<Multicaster::Key,MulticastGroupStatus> groups;
+		FlatHashtable<_MemberKey,unsigned long> memberIndex;
+		Mutex groups_m;
+		Hashtable< _GatherAuthKey,uint64_t > gatherAuth;
+		Mutex gatherAuth_m;
+	};
+	inline _Shard &_shard(const uint64_t nwid) { return _shards[(unsigned int)((nwid * 0x9e3779b97f4a7c15ULL) >> 32) & (ZT_MULTICASTER_SHARDS - 1)]; }
+
+	// These assume the shard's groups_m is locked
+	void _add(void *tPtr,uint64_t now,uint64_t nwid,const MulticastGroup &mg,_Shard &sh,MulticastGroupStatus &gs,const Address &member);
+	static unsigned long _findMember(const _Shard &sh,uint64_t nwid,const MulticastGroup &mg,const MulticastGroupStatus &gs,const Address &member);
+	static void _removeMember(_Shard &sh,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,unsigned long i);
+	_Shard _shards[ZT_MULTICASTER_SHARDS];
+
+	// Position of incremental clean() passes
+	uint64_t _lastClean;
+	unsigned long _cleanGroupsPosition[ZT_MULTICASTER_SHARDS];
+	unsigned long _cleanGatherAuthPosition[ZT_MULTICASTER_SHARDS];
 };
 
 } // namespace ZeroTier
@@ -30,6 +30,13 @@
 #include "Constants.hpp"
 #include "NonCopyable.hpp"
 
+/**
+ * Times AdaptiveMutex tries to take a contended lock before blocking
+ */
+#ifndef ZT_MUTEX_SPIN_COUNT
+#define ZT_MUTEX_SPIN_COUNT 1000
+#endif
+
 #ifdef __UNIX_LIKE__
 
 #include <stdlib.h>
@@ -101,6 +108,125 @@ private:
 	pthread_mutex_t _mh;
 };
 
+/**
+ * Reader-writer lock allowing many concurrent readers or one writer
+ *
+ * Read locks must not be taken recursively, since a waiting writer may
+ * block the second one.
+ */
+class RWMutex : NonCopyable
+{
+public:
+	RWMutex()
+	{
+		pthread_rwlock_init(&_rw,(const pthread_rwlockattr_t *)0);
+	}
+
+	~RWMutex()
+	{
+		pthread_rwlock_destroy(&_rw);
+	}
+
+	inline void lock() const { pthread_rwlock_wrlock(const_cast<pthread_rwlock_t *>(&_rw)); }
+	inline void rlock() const { pthread_rwlock_rdlock(const_cast<pthread_rwlock_t *>(&_rw)); }
+	inline void unlock() const { pthread_rwlock_unlock(const_cast<pthread_rwlock_t *>(&_rw)); }
+	inline void runlock() const { pthread_rwlock_unlock(const_cast<pthread_rwlock_t *>(&_rw)); }
+	inline bool tryLock() const { return (pthread_rwlock_trywrlock(const_cast<pthread_rwlock_t *>(&_rw)) == 0); }
+	inline bool tryRLock() const { return (pthread_rwlock_tryrdlock(const_cast<pthread_rwlock_t *>(&_rw)) == 0); }
+
+	/**
+	 * Exclusive (write) lock for the life of this object
+	 */
+	class Lock : NonCopyable
+	{
+	public:
+		Lock(const RWMutex &m) : _m(&m) { m.lock(); }
+		~Lock() { _m->unlock(); }
+	private:
+		const RWMutex *const _m;
+	};
+
+	/**
+	 * Shared (read) lock for the life of this object
+	 */
+	class RLock : NonCopyable
+	{
+	public:
+		RLock(const RWMutex &m) : _m(&m) { m.rlock(); }
+		~RLock() { _m->runlock(); }
+	private:
+		const RWMutex *const _m;
+	};
+
+private:
+	pthread_rwlock_t _rw;
+};
+
+/**
+ * Mutex that spins for a short while before blocking
+ *
+ * This is for locks that are held for only a handful of instructions, like
+ * a hash table lookup, but are taken by several threads for every packet.
+ * Putting a waiting thread to sleep costs far more than the wait itself.
+ * On glibc this is a PTHREAD_MUTEX_ADAPTIVE_NP mutex, which tunes its own
+ * spin time.
+ */
+class AdaptiveMutex : NonCopyable
+{
+public:
+	AdaptiveMutex()
+	{
+#if defined(__GLIBC__) && defined(PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP)
+		pthread_mutexattr_t a;
+		pthread_mutexattr_init(&a);
+		pthread_mutexattr_settype(&a,PTHREAD_MUTEX_ADAPTIVE_NP);
+		pthread_mutex_init(&_mh,&a);
+		pthread_mutexattr_destroy(&a);
+#else
+		pthread_mutex_init(&_mh,(const pthread_mutexattr_t *)0);
+#endif
+	}
+
+	~AdaptiveMutex()
+	{
+		pthread_mutex_destroy(&_mh);
+	}
+
+	inline void lock() const
+	{
+		pthread_mutex_t *const mh = const_cast<pthread_mutex_t *>(&_mh);
+#if !(defined(__GLIBC__) && defined(PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP))
+		for(unsigned int i=0;i<ZT_MUTEX_SPIN_COUNT;++i) {
+			if (pthread_mutex_trylock(mh) == 0)
+				return;
+#if defined(__i386__) || defined(__x86_64__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+			__asm__ __volatile__("yield");
+#endif
+		}
+#endif
+		pthread_mutex_lock(mh);
+	}
+
+	inline void unlock() const
+	{
+		pthread_mutex_unlock(const_cast<pthread_mutex_t *>(&_mh));
+	}
+
+	class Lock : NonCopyable
+	{
+	public:
+		Lock(const AdaptiveMutex &m) : _m(&m) { m.lock(); }
+		~Lock() { _m->unlock(); }
+	private:
+		const AdaptiveMutex *const _m;
+	};
+
+private:
+	pthread_mutex_t _mh;
+};
+
 } // namespace ZeroTier
 
 #endif // Apple / Linux
@@ -173,6 +299,72 @@ private:
 	CRITICAL_SECTION _cs;
 };
 
+class RWMutex : NonCopyable
+{
+public:
+	RWMutex()
+	{
+		InitializeSRWLock(&_rw);
+	}
+
+	inline void lock() const { AcquireSRWLockExclusive(const_cast<PSRWLOCK>(&_rw)); }
+	inline void rlock() const { AcquireSRWLockShared(const_cast<PSRWLOCK>(&_rw)); }
+	inline void unlock() const { ReleaseSRWLockExclusive(const_cast<PSRWLOCK>(&_rw)); }
+	inline void runlock() const { ReleaseSRWLockShared(const_cast<PSRWLOCK>(&_rw)); }
+	inline bool tryLock() const { return (TryAcquireSRWLockExclusive(const_cast<PSRWLOCK>(&_rw)) != 0); }
+	inline bool tryRLock() const { return (TryAcquireSRWLockShared(const_cast<PSRWLOCK>(&_rw)) != 0); }
+
+	class Lock : NonCopyable
+	{
+	public:
+		Lock(const RWMutex &m) : _m(&m) { m.lock(); }
+		~Lock() { _m->unlock(); }
+	private:
+		const RWMutex *const _m;
+	};
+
+	class RLock : NonCopyable
+	{
+	public:
+		RLock(const RWMutex &m) : _m(&m) { m.rlock(); }
+		~RLock() { _m->runlock(); }
+	private:
+		const RWMutex *const _m;
+	};
+
+private:
+	SRWLOCK _rw;
+};
+
+class AdaptiveMutex : NonCopyable
+{
+public:
+	AdaptiveMutex()
+	{
+		InitializeCriticalSectionAndSpinCount(&_cs,ZT_MUTEX_SPIN_COUNT);
+	}
+
+	~AdaptiveMutex()
+	{
+		DeleteCriticalSection(&_cs);
+	}
+
+	inline void lock() const { EnterCriticalSection(const_cast<CRITICAL_SECTION *>(&_cs)); }
+	inline void unlock() const { LeaveCriticalSection(const_cast<CRITICAL_SECTION *>(&_cs)); }
+
+	class Lock : NonCopyable
+	{
+	public:
+		Lock(const AdaptiveMutex &m) : _m(&m) { m.lock(); }
+		~Lock() { _m->unlock(); }
+	private:
+		const AdaptiveMutex *const _m;
+	};
+
+private:
+	CRITICAL_SECTION _cs;
+};
+
 } // namespace ZeroTier
 
 #endif // _WIN32
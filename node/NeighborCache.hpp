@@ -0,0 +1,185 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_NEIGHBORCACHE_HPP
+#define ZT_NEIGHBORCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+#include "Mutex.hpp"
+#include "Utils.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Which member owns each IP address on each network we're on
+ *
+ * This is learned from certificates of ownership, which the controller
+ * issues for the addresses it assigns, and lets ARP and NDP for those
+ * addresses be answered locally instead of going out as multicasts. It is
+ * shared by all networks so lookups cost the same however many we're on.
+ * An entry is only a hint: the network must still confirm the owner's
+ * certificate before it's used.
+ */
+class NeighborCache : NonCopyable
+{
+public:
+	NeighborCache() :
+		_entries(64),
+		_lastClean(0),
+		_cleanPosition(0)
+	{
+	}
+
+	/**
+	 * Remember or refresh the owner of an address
+	 *
+	 * @param nwid Network ID
+	 * @param ip IPv4 or IPv6 address (port is ignored)
+	 * @param owner Member that owns it
+	 * @param now Current time
+	 */
+	inline void learn(const uint64_t nwid,const InetAddress &ip,const Address &owner,const uint64_t now)
+	{
+		_Key k;
+		if (!_key(k,nwid,ip))
+			return;
+		Mutex::Lock _l(_lock);
+		_Entry *const e = _entries.get(k);
+		if (e) {
+			e->owner = owner;
+			e->lastLearned = now;
+		} else if (_entries.size() < ZT_NEIGHBOR_CACHE_MAX_ENTRIES) {
+			_Entry &ne = _entries[k];
+			ne.owner = owner;
+			ne.lastLearned = now;
+		}
+	}
+
+	/**
+	 * @param nwid Network ID
+	 * @param ip IPv4 or IPv6 address (port is ignored)
+	 * @param now Current time
+	 * @return Member last known to own this address or a nil address if none
+	 */
+	inline Address get(const uint64_t nwid,const InetAddress &ip,const uint64_t now) const
+	{
+		_Key k;
+		if (!_key(k,nwid,ip))
+			return Address();
+		Mutex::Lock _l(_lock);
+		const _Entry *const e = _entries.get(k);
+		if ((e)&&((now - e->lastLearned) < ZT_NEIGHBOR_CACHE_TTL))
+			return e->owner;
+		return Address();
+	}
+
+	/**
+	 * Forget expired addresses, a slice of the table at a time
+	 *
+	 * @param now Current time
+	 */
+	inline void clean(const uint64_t now)
+	{
+		const uint64_t elapsed = now - _lastClean;
+		_lastClean = now;
+
+		Mutex::Lock _l(_lock);
+		unsigned long budget = Utils::housekeepingSlice(_entries.size(),elapsed);
+		Hashtable< _Key,_Entry >::Iterator i(_entries,_cleanPosition);
+		_Key *k = (_Key *)0;
+		_Entry *e = (_Entry *)0;
+		for(;;) {
+			if (!budget) {
+				_cleanPosition = i.position();
+				break;
+			}
+			if (!i.next(k,e)) {
+				_cleanPosition = 0;
+				break;
+			}
+			--budget;
+			if ((now - e->lastLearned) >= ZT_NEIGHBOR_CACHE_TTL)
+				_entries.erase(*k);
+		}
+	}
+
+	/**
+	 * @return Number of addresses known
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _entries.size();
+	}
+
+private:
+	struct _Key
+	{
+		uint64_t nwid;
+		uint64_t ip[2]; // IPv4 addresses are IPv4-mapped
+		inline bool operator==(const _Key &k) const { return ((nwid == k.nwid)&&(ip[0] == k.ip[0])&&(ip[1] == k.ip[1])); }
+		inline unsigned long hashCode() const { return (unsigned long)((((nwid * 0x9e3779b97f4a7c15ULL) + ip[0]) * 0x9e3779b97f4a7c15ULL + ip[1]) >> 32); }
+	};
+
+	struct _Entry
+	{
+		Address owner;
+		uint64_t lastLearned;
+	};
+
+	static inline bool _key(_Key &k,const uint64_t nwid,const InetAddress &ip)
+	{
+		k.nwid = nwid;
+		if (ip.ss_family == AF_INET) {
+			uint8_t *const b = reinterpret_cast<uint8_t *>(k.ip);
+			memset(b,0,10);
+			b[10] = 0xff; b[11] = 0xff;
+			memcpy(b + 12,&(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr),4);
+			return true;
+		} else if (ip.ss_family == AF_INET6) {
+			memcpy(k.ip,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
+			return true;
+		}
+		return false;
+	}
+
+	Hashtable< _Key,_Entry > _entries;
+	uint64_t _lastClean;
+	unsigned long _cleanPosition;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -43,6 +43,13 @@
 #include "Node.hpp"
 #include "Peer.hpp"
 #include "Trace.hpp"
+#include "Metrics.hpp"
+#include "Latency.hpp"
+#include "Probes.hpp"
+#include "Capture.hpp"
+#include "NeighborCache.hpp"
+#include "MulticastLikes.hpp"
+#include "CredentialPushes.hpp"
 
 namespace ZeroTier {
 
@@ -86,205 +93,178 @@ enum _doZtFilterResult
 	DOZTFILTER_SUPER_ACCEPT
 };
 
-static _doZtFilterResult _doZtFilter(
+// Tag values a compiled rule list tests, for one frame: ours are resolved
+// at compile time and the remote member's the first time a rule needs each
+class _FrameTags
+{
+public:
+	_FrameTags(const CompiledRules &compiled,const NetworkConfig &nconf,const Membership *membership) :
+		_compiled(compiled),
+		_nconf(nconf),
+		_membership(membership)
+	{
+		memset(_remoteState,0,_compiled.tagCount());
+	}
+
+	inline bool local(const unsigned int slot,uint32_t &v) const { return _compiled.localTag(slot,v); }
+
+	inline bool remote(const unsigned int slot,uint32_t &v)
+	{
+		if (!_remoteState[slot]) {
+			const Tag *const t = (_membership) ? _membership->getTag(_nconf,_compiled.tagId(slot)) : (const Tag *)0;
+			_remoteState[slot] = (t) ? 1 : 2;
+			_remoteValues[slot] = (t) ? t->value() : 0;
+		}
+		v = _remoteValues[slot];
+		return (_remoteState[slot] == 1);
+	}
+
+private:
+	const CompiledRules &_compiled;
+	const NetworkConfig &_nconf;
+	const Membership *const _membership;
+	uint32_t _remoteValues[ZT_COMPILED_RULES_MAX_TAGS];
+	uint8_t _remoteState[ZT_COMPILED_RULES_MAX_TAGS]; // 0 not looked up yet, 1 present, 2 absent
+};
+
+// Our value of a tag, from the frame's tags if it has a slot there
+static inline bool _doZtFilterLocalTag(const NetworkConfig &nconf,const _FrameTags *ft,const unsigned int slot,const uint32_t id,uint32_t &v)
+{
+	if ((ft)&&(slot != ZT_COMPILED_RULES_NO_TAG))
+		return ft->local(slot,v);
+	const std::vector<Tag>::const_iterator localTag(std::lower_bound(nconf.tags.begin(),nconf.tags.end(),id,Tag::IdComparePredicate()));
+	if ((localTag != nconf.tags.end())&&(localTag->id() == id)) {
+		v = localTag->value();
+		return true;
+	}
+	return false;
+}
+
+// The remote member's value of a tag, from the frame's tags if it has a slot there
+static inline bool _doZtFilterRemoteTag(const NetworkConfig &nconf,const Membership *membership,_FrameTags *ft,const unsigned int slot,const uint32_t id,uint32_t &v)
+{
+	if ((ft)&&(slot != ZT_COMPILED_RULES_NO_TAG))
+		return ft->remote(slot,v);
+	const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,id) : (const Tag *)0);
+	if (remoteTag) {
+		v = remoteTag->value();
+		return true;
+	}
+	return false;
+}
+
+// Evaluates one MATCH entry, not counting its OR and NOT bits
+static inline uint8_t _doZtFilterMatch(
 	const RuntimeEnvironment *RR,
-	Trace::RuleResultLog &rrl,
 	const NetworkConfig &nconf,
 	const Membership *membership, // can be NULL
+	_FrameTags *ft, // can be NULL
+	const unsigned int tagSlot, // slot of this entry's tag in ft, or ZT_COMPILED_RULES_NO_TAG
 	const bool inbound,
+	const bool superAccept,
 	const Address &ztSource,
-	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const Address &ztDest,
 	const MAC &macSource,
 	const MAC &macDest,
 	const uint8_t *const frameData,
 	const unsigned int frameLen,
 	const unsigned int etherType,
 	const unsigned int vlanId,
-	const ZT_VirtualNetworkRule *rules, // cannot be NULL
-	const unsigned int ruleCount,
-	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
-	unsigned int &ccLength, // MUTABLE -- set to length of packet payload to TEE
-	bool &ccWatch) // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	const ZT_VirtualNetworkRule &rule,
+	const ZT_VirtualNetworkRuleType rt)
 {
-	// Set to true if we are a TEE/REDIRECT/WATCH target
-	bool superAccept = false;
-
-	// The default match state for each set of entries starts as 'true' since an
-	// ACTION with no MATCH entries preceding it is always taken.
-	uint8_t thisSetMatches = 1;
-
-	rrl.clear();
-
-	for(unsigned int rn=0;rn<ruleCount;++rn) {
-		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
-
-		// First check if this is an ACTION
-		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
-			if (thisSetMatches) {
-				switch(rt) {
-					case ZT_NETWORK_RULE_ACTION_DROP:
-						return DOZTFILTER_DROP;
-
-					case ZT_NETWORK_RULE_ACTION_ACCEPT:
-						return (superAccept ? DOZTFILTER_SUPER_ACCEPT : DOZTFILTER_ACCEPT); // match, accept packet
-
-					// These are initially handled together since preliminary logic is common
-					case ZT_NETWORK_RULE_ACTION_TEE:
-					case ZT_NETWORK_RULE_ACTION_WATCH:
-					case ZT_NETWORK_RULE_ACTION_REDIRECT:	{
-						const Address fwdAddr(rules[rn].v.fwd.address);
-						if (fwdAddr == ztSource) {
-							// Skip as no-op since source is target
-						} else if (fwdAddr == RR->identity.address()) {
-							if (inbound) {
-								return DOZTFILTER_SUPER_ACCEPT;
-							} else {
-							}
-						} else if (fwdAddr == ztDest) {
-						} else {
-							if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
-								ztDest = fwdAddr;
-								return DOZTFILTER_REDIRECT;
-							} else {
-								cc = fwdAddr;
-								ccLength = (rules[rn].v.fwd.length != 0) ? ((frameLen < (unsigned int)rules[rn].v.fwd.length) ? frameLen : (unsigned int)rules[rn].v.fwd.length) : frameLen;
-								ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
-							}
-						}
-					}	continue;
-
-					case ZT_NETWORK_RULE_ACTION_BREAK:
-						return DOZTFILTER_NO_MATCH;
-
-					// Unrecognized ACTIONs are ignored as no-ops
-					default:
-						continue;
-				}
+	uint8_t thisRuleMatches = 0;
+	uint64_t ownershipVerificationMask = 1; // this magic value means it hasn't been computed yet -- this is done lazily the first time it's needed
+	switch(rt) {
+		case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+			thisRuleMatches = (uint8_t)(rule.v.zt == ztSource.toInt());
+			break;
+		case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+			thisRuleMatches = (uint8_t)(rule.v.zt == ztDest.toInt());
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+			thisRuleMatches = (uint8_t)(rule.v.vlanId == (uint16_t)vlanId);
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
+			// NOT SUPPORTED YET
+			thisRuleMatches = (uint8_t)(rule.v.vlanPcp == 0);
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
+			// NOT SUPPORTED YET
+			thisRuleMatches = (uint8_t)(rule.v.vlanDei == 0);
+			break;
+		case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			thisRuleMatches = (uint8_t)(MAC(rule.v.mac,6) == macSource);
+			break;
+		case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+			thisRuleMatches = (uint8_t)(MAC(rule.v.mac,6) == macDest);
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rule.v.ipv4.ip),4,rule.v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 12),4,0)));
 			} else {
-				// If this is an incoming packet and we are a TEE or REDIRECT target, we should
-				// super-accept if we accept at all. This will cause us to accept redirected or
-				// tee'd packets in spite of MAC and ZT addressing checks.
-				if (inbound) {
-					switch(rt) {
-						case ZT_NETWORK_RULE_ACTION_TEE:
-						case ZT_NETWORK_RULE_ACTION_WATCH:
-						case ZT_NETWORK_RULE_ACTION_REDIRECT:
-							if (RR->identity.address() == rules[rn].v.fwd.address)
-								superAccept = true;
-							break;
-						default:
-							break;
-					}
-				}
-
-				thisSetMatches = 1; // reset to default true for next batch of entries
-				continue;
+				thisRuleMatches = 0;
 			}
-		}
-
-		// Circuit breaker: no need to evaluate an AND if the set's match state
-		// is currently false since anything AND false is false.
-		if ((!thisSetMatches)&&(!(rules[rn].t & 0x40))) {
-			rrl.logSkipped(rn,thisSetMatches);
-			continue;
-		}
-
-		// If this was not an ACTION evaluate next MATCH and update thisSetMatches with (AND [result])
-		uint8_t thisRuleMatches = 0;
-		uint64_t ownershipVerificationMask = 1; // this magic value means it hasn't been computed yet -- this is done lazily the first time it's needed
-		switch(rt) {
-			case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
-				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztSource.toInt());
-				break;
-			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
-				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztDest.toInt());
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_ID:
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanId == (uint16_t)vlanId);
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
-				// NOT SUPPORTED YET
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanPcp == 0);
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
-				// NOT SUPPORTED YET
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanDei == 0);
-				break;
-			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
-				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac,6) == macSource);
-				break;
-			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
-				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac,6) == macDest);
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rules[rn].v.ipv4.ip),4,rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 12),4,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rules[rn].v.ipv4.ip),4,rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 16),4,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
-				if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)rules[rn].v.ipv6.ip,16,rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 8),16,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
-				if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)rules[rn].v.ipv6.ip,16,rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 24),16,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_TOS:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					const uint8_t tosMasked = frameData[1] & rules[rn].v.ipTos.mask;
-					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0])&&(tosMasked <= rules[rn].v.ipTos.value[1]));
-				} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					const uint8_t tosMasked = (((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f)) & rules[rn].v.ipTos.mask;
-					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0])&&(tosMasked <= rules[rn].v.ipTos.value[1]));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == frameData[9]);
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == (uint8_t)proto);
-					} else {
-						thisRuleMatches = 0;
-					}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rule.v.ipv4.ip),4,rule.v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 16),4,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)rule.v.ipv6.ip,16,rule.v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 8),16,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+			if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)rule.v.ipv6.ip,16,rule.v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 24),16,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_TOS:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				const uint8_t tosMasked = frameData[1] & rule.v.ipTos.mask;
+				thisRuleMatches = (uint8_t)((tosMasked >= rule.v.ipTos.value[0])&&(tosMasked <= rule.v.ipTos.value[1]));
+			} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				const uint8_t tosMasked = (((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f)) & rule.v.ipTos.mask;
+				thisRuleMatches = (uint8_t)((tosMasked >= rule.v.ipTos.value[0])&&(tosMasked <= rule.v.ipTos.value[1]));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(rule.v.ipProtocol == frameData[9]);
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					thisRuleMatches = (uint8_t)(rule.v.ipProtocol == (uint8_t)proto);
 				} else {
 					thisRuleMatches = 0;
 				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
-				thisRuleMatches = (uint8_t)(rules[rn].v.etherType == (uint16_t)etherType);
-				break;
-			case ZT_NETWORK_RULE_MATCH_ICMP:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					if (frameData[9] == 0x01) { // IP protocol == ICMP
-						const unsigned int ihl = (frameData[0] & 0xf) * 4;
-						if (frameLen >= (ihl + 2)) {
-							if (rules[rn].v.icmp.type == frameData[ihl]) {
-								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
-									thisRuleMatches = (uint8_t)(frameData[ihl+1] == rules[rn].v.icmp.code);
-								} else {
-									thisRuleMatches = 1;
-								}
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			thisRuleMatches = (uint8_t)(rule.v.etherType == (uint16_t)etherType);
+			break;
+		case ZT_NETWORK_RULE_MATCH_ICMP:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				if (frameData[9] == 0x01) { // IP protocol == ICMP
+					const unsigned int ihl = (frameData[0] & 0xf) * 4;
+					if (frameLen >= (ihl + 2)) {
+						if (rule.v.icmp.type == frameData[ihl]) {
+							if ((rule.v.icmp.flags & 0x01) != 0) {
+								thisRuleMatches = (uint8_t)(frameData[ihl+1] == rule.v.icmp.code);
 							} else {
-								thisRuleMatches = 0;
+								thisRuleMatches = 1;
 							}
 						} else {
 							thisRuleMatches = 0;
@@ -292,18 +272,18 @@ static _doZtFilterResult _doZtFilter(
 					} else {
 						thisRuleMatches = 0;
 					}
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						if ((proto == 0x3a)&&(frameLen >= (pos+2))) {
-							if (rules[rn].v.icmp.type == frameData[pos]) {
-								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
-									thisRuleMatches = (uint8_t)(frameData[pos+1] == rules[rn].v.icmp.code);
-								} else {
-									thisRuleMatches = 1;
-								}
+				} else {
+					thisRuleMatches = 0;
+				}
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					if ((proto == 0x3a)&&(frameLen >= (pos+2))) {
+						if (rule.v.icmp.type == frameData[pos]) {
+							if ((rule.v.icmp.flags & 0x01) != 0) {
+								thisRuleMatches = (uint8_t)(frameData[pos+1] == rule.v.icmp.code);
 							} else {
-								thisRuleMatches = 0;
+								thisRuleMatches = 1;
 							}
 						} else {
 							thisRuleMatches = 0;
@@ -314,192 +294,398 @@ static _doZtFilterResult _doZtFilter(
 				} else {
 					thisRuleMatches = 0;
 				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
-			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+		case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+				int p = -1;
+				switch(frameData[9]) { // IP protocol number
+					// All these start with 16-bit source and destination port in that order
+					case 0x06: // TCP
+					case 0x11: // UDP
+					case 0x84: // SCTP
+					case 0x88: // UDPLite
+						if (frameLen > (headerLen + 4)) {
+							unsigned int pos = headerLen + ((rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0);
+							p = (int)frameData[pos++] << 8;
+							p |= (int)frameData[pos];
+						}
+						break;
+				}
+
+				thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rule.v.port[0])&&(p <= (int)rule.v.port[1])) : (uint8_t)0;
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
 					int p = -1;
-					switch(frameData[9]) { // IP protocol number
+					switch(proto) { // IP protocol number
 						// All these start with 16-bit source and destination port in that order
 						case 0x06: // TCP
 						case 0x11: // UDP
 						case 0x84: // SCTP
 						case 0x88: // UDPLite
-							if (frameLen > (headerLen + 4)) {
-								unsigned int pos = headerLen + ((rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0);
+							if (frameLen > (pos + 4)) {
+								if (rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) pos += 2;
 								p = (int)frameData[pos++] << 8;
 								p |= (int)frameData[pos];
 							}
 							break;
 					}
-
-					thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0])&&(p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						int p = -1;
-						switch(proto) { // IP protocol number
-							// All these start with 16-bit source and destination port in that order
-							case 0x06: // TCP
-							case 0x11: // UDP
-							case 0x84: // SCTP
-							case 0x88: // UDPLite
-								if (frameLen > (pos + 4)) {
-									if (rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) pos += 2;
-									p = (int)frameData[pos++] << 8;
-									p |= (int)frameData[pos];
-								}
-								break;
-						}
-						thisRuleMatches = (p > 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0])&&(p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
-					} else {
-						thisRuleMatches = 0;
-					}
+					thisRuleMatches = (p > 0) ? (uint8_t)((p >= (int)rule.v.port[0])&&(p <= (int)rule.v.port[1])) : (uint8_t)0;
 				} else {
 					thisRuleMatches = 0;
 				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
-				uint64_t cf = (inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
-				if (macDest.isMulticast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
-				if (macDest.isBroadcast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
-				if (ownershipVerificationMask == 1) {
-					ownershipVerificationMask = 0;
-					InetAddress src;
-					if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-						src.set((const void *)(frameData + 12),4,0);
-					} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-						// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
-						if ( (frameLen >= (40 + 8 + 16)) && (frameData[6] == 0x3a) && ((frameData[40] == 0x87)||(frameData[40] == 0x88)) ) {
-							if (frameData[40] == 0x87) {
-								// Neighbor solicitations contain no reliable source address, so we implement a small
-								// hack by considering them authenticated. Otherwise you would pretty much have to do
-								// this manually in the rule set for IPv6 to work at all.
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							} else {
-								// Neighbor advertisements on the other hand can absolutely be authenticated.
-								src.set((const void *)(frameData + 40 + 8),16,0);
-							}
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
+			uint64_t cf = (inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
+			if (macDest.isMulticast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
+			if (macDest.isBroadcast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
+			if (ownershipVerificationMask == 1) {
+				ownershipVerificationMask = 0;
+				InetAddress src;
+				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+					src.set((const void *)(frameData + 12),4,0);
+				} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+					// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
+					if ( (frameLen >= (40 + 8 + 16)) && (frameData[6] == 0x3a) && ((frameData[40] == 0x87)||(frameData[40] == 0x88)) ) {
+						if (frameData[40] == 0x87) {
+							// Neighbor solicitations contain no reliable source address, so we implement a small
+							// hack by considering them authenticated. Otherwise you would pretty much have to do
+							// this manually in the rule set for IPv6 to work at all.
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
 						} else {
-							// Other IPv6 packets can be handled normally
-							src.set((const void *)(frameData + 8),16,0);
-						}
-					} else if ((etherType == ZT_ETHERTYPE_ARP)&&(frameLen >= 28)) {
-						src.set((const void *)(frameData + 14),4,0);
-					}
-					if (inbound) {
-						if (membership) {
-							if ((src)&&(membership->hasCertificateOfOwnershipFor<InetAddress>(nconf,src)))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							if (membership->hasCertificateOfOwnershipFor<MAC>(nconf,macSource))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+							// Neighbor advertisements on the other hand can absolutely be authenticated.
+							src.set((const void *)(frameData + 40 + 8),16,0);
 						}
 					} else {
-						for(unsigned int i=0;i<nconf.certificateOfOwnershipCount;++i) {
-							if ((src)&&(nconf.certificatesOfOwnership[i].owns(src)))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							if (nconf.certificatesOfOwnership[i].owns(macSource))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
-						}
+						// Other IPv6 packets can be handled normally
+						src.set((const void *)(frameData + 8),16,0);
 					}
+				} else if ((etherType == ZT_ETHERTYPE_ARP)&&(frameLen >= 28)) {
+					src.set((const void *)(frameData + 14),4,0);
 				}
-				cf |= ownershipVerificationMask;
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)&&(frameData[9] == 0x06)) {
-					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
-					cf |= (uint64_t)frameData[headerLen + 13];
-					cf |= (((uint64_t)(frameData[headerLen + 12] & 0x0f)) << 8);
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						if ((proto == 0x06)&&(frameLen > (pos + 14))) {
-							cf |= (uint64_t)frameData[pos + 13];
-							cf |= (((uint64_t)(frameData[pos + 12] & 0x0f)) << 8);
-						}
+				if (inbound) {
+					if (membership) {
+						if ((src)&&(membership->hasCertificateOfOwnershipFor<InetAddress>(nconf,src)))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+						if (membership->hasCertificateOfOwnershipFor<MAC>(nconf,macSource))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+					}
+				} else {
+					for(unsigned int i=0;i<nconf.certificateOfOwnershipCount;++i) {
+						if ((src)&&(nconf.certificatesOfOwnership[i].owns(src)))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+						if (nconf.certificatesOfOwnership[i].owns(macSource))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
 					}
 				}
-				thisRuleMatches = (uint8_t)((cf & rules[rn].v.characteristics) != 0);
-			}	break;
-			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
-				thisRuleMatches = (uint8_t)((frameLen >= (unsigned int)rules[rn].v.frameSize[0])&&(frameLen <= (unsigned int)rules[rn].v.frameSize[1]));
-				break;
-			case ZT_NETWORK_RULE_MATCH_RANDOM:
-				thisRuleMatches = (uint8_t)((uint32_t)(RR->node->prng() & 0xffffffffULL) <= rules[rn].v.randomProbability);
-				break;
-			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
-			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL: {
-				const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rules[rn].v.tag.id,Tag::IdComparePredicate());
-				if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rules[rn].v.tag.id)) {
-					const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rules[rn].v.tag.id) : (const Tag *)0);
-					if (remoteTag) {
-						const uint32_t ltv = localTag->value();
-						const uint32_t rtv = remoteTag->value();
-						if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
-							const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
-							thisRuleMatches = (uint8_t)(diff <= rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
-							thisRuleMatches = (uint8_t)((ltv & rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
-							thisRuleMatches = (uint8_t)((ltv | rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
-							thisRuleMatches = (uint8_t)((ltv ^ rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_EQUAL) {
-							thisRuleMatches = (uint8_t)((ltv == rules[rn].v.tag.value)&&(rtv == rules[rn].v.tag.value));
-						} else { // sanity check, can't really happen
-							thisRuleMatches = 0;
-						}
-					} else {
-						if ((inbound)&&(!superAccept)) {
-							thisRuleMatches = 0;
-						} else {
-							// Outbound side is not strict since if we have to match both tags and
-							// we are sending a first packet to a recipient, we probably do not know
-							// about their tags yet. They will filter on inbound and we will filter
-							// once we get their tag. If we are a tee/redirect target we are also
-							// not strict since we likely do not have these tags.
-							thisRuleMatches = 1;
-						}
+			}
+			cf |= ownershipVerificationMask;
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)&&(frameData[9] == 0x06)) {
+				const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+				cf |= (uint64_t)frameData[headerLen + 13];
+				cf |= (((uint64_t)(frameData[headerLen + 12] & 0x0f)) << 8);
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					if ((proto == 0x06)&&(frameLen > (pos + 14))) {
+						cf |= (uint64_t)frameData[pos + 13];
+						cf |= (((uint64_t)(frameData[pos + 12] & 0x0f)) << 8);
 					}
-				} else {
-					thisRuleMatches = 0;
 				}
-			}	break;
-			case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
-			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
-				if (superAccept) {
-					thisRuleMatches = 1;
-				} else if ( ((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER)&&(inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER)&&(!inbound)) ) {
-					const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rules[rn].v.tag.id) : (const Tag *)0);
-					if (remoteTag) {
-						thisRuleMatches = (uint8_t)(remoteTag->value() == rules[rn].v.tag.value);
+			}
+			thisRuleMatches = (uint8_t)((cf & rule.v.characteristics) != 0);
+		}	break;
+		case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+			thisRuleMatches = (uint8_t)((frameLen >= (unsigned int)rule.v.frameSize[0])&&(frameLen <= (unsigned int)rule.v.frameSize[1]));
+			break;
+		case ZT_NETWORK_RULE_MATCH_RANDOM:
+			thisRuleMatches = (uint8_t)((uint32_t)(RR->node->prng() & 0xffffffffULL) <= rule.v.randomProbability);
+			break;
+		case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL: {
+			uint32_t ltv,rtv;
+			if (_doZtFilterLocalTag(nconf,ft,tagSlot,rule.v.tag.id,ltv)) {
+				if (_doZtFilterRemoteTag(nconf,membership,ft,tagSlot,rule.v.tag.id,rtv)) {
+					if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
+						const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
+						thisRuleMatches = (uint8_t)(diff <= rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
+						thisRuleMatches = (uint8_t)((ltv & rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
+						thisRuleMatches = (uint8_t)((ltv | rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
+						thisRuleMatches = (uint8_t)((ltv ^ rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_EQUAL) {
+						thisRuleMatches = (uint8_t)((ltv == rule.v.tag.value)&&(rtv == rule.v.tag.value));
+					} else { // sanity check, can't really happen
+						thisRuleMatches = 0;
+					}
+				} else {
+					if ((inbound)&&(!superAccept)) {
+						thisRuleMatches = 0;
 					} else {
-						if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
-							// If we are checking the receiver and this is an outbound packet, we
-							// can't be strict since we may not yet know the receiver's tag.
-							thisRuleMatches = 1;
-						} else {
-							thisRuleMatches = 0;
-						}
+						// Outbound side is not strict since if we have to match both tags and
+						// we are sending a first packet to a recipient, we probably do not know
+						// about their tags yet. They will filter on inbound and we will filter
+						// once we get their tag. If we are a tee/redirect target we are also
+						// not strict since we likely do not have these tags.
+						thisRuleMatches = 1;
 					}
-				} else { // sender and outbound or receiver and inbound
-					const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rules[rn].v.tag.id,Tag::IdComparePredicate());
-					if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rules[rn].v.tag.id)) {
-						thisRuleMatches = (uint8_t)(localTag->value() == rules[rn].v.tag.value);
+				}
+			} else {
+				thisRuleMatches = 0;
+			}
+		}	break;
+		case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+		case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
+			if (superAccept) {
+				thisRuleMatches = 1;
+			} else if ( ((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER)&&(inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER)&&(!inbound)) ) {
+				uint32_t rtv;
+				if (_doZtFilterRemoteTag(nconf,membership,ft,tagSlot,rule.v.tag.id,rtv)) {
+					thisRuleMatches = (uint8_t)(rtv == rule.v.tag.value);
+				} else {
+					if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
+						// If we are checking the receiver and this is an outbound packet, we
+						// can't be strict since we may not yet know the receiver's tag.
+						thisRuleMatches = 1;
 					} else {
 						thisRuleMatches = 0;
 					}
 				}
-			}	break;
+			} else { // sender and outbound or receiver and inbound
+				uint32_t ltv;
+				if (_doZtFilterLocalTag(nconf,ft,tagSlot,rule.v.tag.id,ltv)) {
+					thisRuleMatches = (uint8_t)(ltv == rule.v.tag.value);
+				} else {
+					thisRuleMatches = 0;
+				}
+			}
+		}	break;
 
-			// The result of an unsupported MATCH is configurable at the network
-			// level via a flag.
-			default:
-				thisRuleMatches = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
-				break;
+		// The result of an unsupported MATCH is configurable at the network
+		// level via a flag.
+		default:
+			thisRuleMatches = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
+			break;
+	}
+
+	return thisRuleMatches;
+}
+
+// Takes the ACTION of a set that matched, returning true if this ends evaluation with result r
+static inline bool _doZtFilterAction(
+	const RuntimeEnvironment *RR,
+	const bool inbound,
+	const bool superAccept,
+	const Address &ztSource,
+	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const ZT_VirtualNetworkRule &rule,
+	const ZT_VirtualNetworkRuleType rt,
+	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int &ccLength, // MUTABLE -- set to maximum length of packet payload to TEE, or 0 for all of it
+	bool &ccWatch, // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	_doZtFilterResult &r)
+{
+	switch(rt) {
+		case ZT_NETWORK_RULE_ACTION_DROP:
+			r = DOZTFILTER_DROP;
+			return true;
+
+		case ZT_NETWORK_RULE_ACTION_ACCEPT:
+			r = (superAccept ? DOZTFILTER_SUPER_ACCEPT : DOZTFILTER_ACCEPT); // match, accept packet
+			return true;
+
+		// These are initially handled together since preliminary logic is common
+		case ZT_NETWORK_RULE_ACTION_TEE:
+		case ZT_NETWORK_RULE_ACTION_WATCH:
+		case ZT_NETWORK_RULE_ACTION_REDIRECT:	{
+			const Address fwdAddr(rule.v.fwd.address);
+			if (fwdAddr == ztSource) {
+				// Skip as no-op since source is target
+			} else if (fwdAddr == RR->identity.address()) {
+				if (inbound) {
+					r = DOZTFILTER_SUPER_ACCEPT;
+					return true;
+				} else {
+				}
+			} else if (fwdAddr == ztDest) {
+			} else {
+				if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
+					ztDest = fwdAddr;
+					r = DOZTFILTER_REDIRECT;
+					return true;
+				} else {
+					cc = fwdAddr;
+					ccLength = (unsigned int)rule.v.fwd.length;
+					ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
+				}
+			}
+		}	return false;
+
+		case ZT_NETWORK_RULE_ACTION_BREAK:
+			r = DOZTFILTER_NO_MATCH;
+			return true;
+
+		// Unrecognized ACTIONs are ignored as no-ops
+		default:
+			return false;
+	}
+}
+
+// Evaluates a rule list through its compiled form, with the same results as _doZtFilterInterpreted()
+static _doZtFilterResult _doZtFilterCompiled(
+	const RuntimeEnvironment *RR,
+	const NetworkConfig &nconf,
+	const Membership *membership, // can be NULL
+	const bool inbound,
+	const Address &ztSource,
+	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule *rules, // cannot be NULL
+	const CompiledRules &compiled,
+	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int &ccLength, // MUTABLE -- set to maximum length of packet payload to TEE, or 0 for all of it
+	bool &ccWatch) // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+{
+	bool superAccept = false;
+	_FrameTags ft(compiled,nconf,membership);
+
+	unsigned int plen = 0;
+	const uint16_t *const prog = compiled.program(etherType,plen);
+	for(unsigned int pi=0;pi<plen;++pi) {
+		const CompiledRules::Set &set = compiled.set(prog[pi] & ~ZT_COMPILED_RULES_INERT);
+
+		if ((prog[pi] & ZT_COMPILED_RULES_INERT) != 0) {
+			// This set cannot match this ethertype, but it forwards to us
+			if (inbound)
+				superAccept = true;
+			continue;
+		}
+
+		uint8_t thisSetMatches = 1;
+		for(unsigned int rn=set.start;rn<set.action;++rn) {
+			if (!thisSetMatches) {
+				if (!set.hasOr)
+					break;
+				if (!(rules[rn].t & 0x40))
+					continue;
+			}
+			const uint8_t thisRuleMatches = _doZtFilterMatch(RR,nconf,membership,&ft,compiled.tagSlot(rn),inbound,superAccept,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules[rn],(ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f));
+			if ((rules[rn].t & 0x40))
+				thisSetMatches |= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+			else thisSetMatches &= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+		}
+
+		if (thisSetMatches) {
+			_doZtFilterResult r;
+			if (_doZtFilterAction(RR,inbound,superAccept,ztSource,ztDest,rules[set.action],(ZT_VirtualNetworkRuleType)(rules[set.action].t & 0x3f),cc,ccLength,ccWatch,r))
+				return r;
+		} else if ((inbound)&&(set.targetsSelf)) {
+			superAccept = true;
 		}
+	}
+
+	return DOZTFILTER_NO_MATCH;
+}
+
+// Stands in for Trace::RuleResultLog when no one is tracing, so logging compiles away
+class _NoRuleResultLog
+{
+public:
+	inline void clear() {}
+	inline void log(const unsigned int rn,const uint8_t thisRuleMatches,const uint8_t thisSetMatches) {}
+	inline void logSkipped(const unsigned int rn,const uint8_t thisSetMatches) {}
+};
+
+// Interprets a rule list, logging each rule's result to a Trace::RuleResultLog or to a _NoRuleResultLog
+template<typename L>
+static _doZtFilterResult _doZtFilterInterpreted(
+	const RuntimeEnvironment *RR,
+	L &rrl,
+	const NetworkConfig &nconf,
+	const Membership *membership, // can be NULL
+	const bool inbound,
+	const Address &ztSource,
+	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule *rules, // cannot be NULL
+	const unsigned int ruleCount,
+	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int &ccLength, // MUTABLE -- set to maximum length of packet payload to TEE, or 0 for all of it
+	bool &ccWatch) // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+{
+	// Set to true if we are a TEE/REDIRECT/WATCH target
+	bool superAccept = false;
+
+	// The default match state for each set of entries starts as 'true' since an
+	// ACTION with no MATCH entries preceding it is always taken.
+	uint8_t thisSetMatches = 1;
+
+	rrl.clear();
+
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
+
+		// First check if this is an ACTION
+		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+			if (thisSetMatches) {
+				_doZtFilterResult r;
+				if (_doZtFilterAction(RR,inbound,superAccept,ztSource,ztDest,rules[rn],rt,cc,ccLength,ccWatch,r))
+					return r;
+				continue;
+			} else {
+				// If this is an incoming packet and we are a TEE or REDIRECT target, we should
+				// super-accept if we accept at all. This will cause us to accept redirected or
+				// tee'd packets in spite of MAC and ZT addressing checks.
+				if (inbound) {
+					switch(rt) {
+						case ZT_NETWORK_RULE_ACTION_TEE:
+						case ZT_NETWORK_RULE_ACTION_WATCH:
+						case ZT_NETWORK_RULE_ACTION_REDIRECT:
+							if (RR->identity.address() == rules[rn].v.fwd.address)
+								superAccept = true;
+							break;
+						default:
+							break;
+					}
+				}
+
+				thisSetMatches = 1; // reset to default true for next batch of entries
+				continue;
+			}
+		}
+
+		// Circuit breaker: no need to evaluate an AND if the set's match state
+		// is currently false since anything AND false is false.
+		if ((!thisSetMatches)&&(!(rules[rn].t & 0x40))) {
+			rrl.logSkipped(rn,thisSetMatches);
+			continue;
+		}
+
+		// If this was not an ACTION evaluate next MATCH and update thisSetMatches with (AND [result])
+		const uint8_t thisRuleMatches = _doZtFilterMatch(RR,nconf,membership,(_FrameTags *)0,ZT_COMPILED_RULES_NO_TAG,inbound,superAccept,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules[rn],rt);
 
 		rrl.log(rn,thisRuleMatches,thisSetMatches);
 
@@ -511,6 +697,97 @@ static _doZtFilterResult _doZtFilter(
 	return DOZTFILTER_NO_MATCH;
 }
 
+static _doZtFilterResult _doZtFilter(
+	const RuntimeEnvironment *RR,
+	Trace::RuleResultLog &rrl, // only filled in if the network is being traced
+	const NetworkConfig &nconf,
+	const Membership *membership, // can be NULL
+	const bool inbound,
+	const Address &ztSource,
+	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule *rules, // cannot be NULL
+	const unsigned int ruleCount,
+	const CompiledRules *compiled, // compiled form of rules, or NULL to interpret them
+	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int &ccLength, // MUTABLE -- set to maximum length of packet payload to TEE, or 0 for all of it
+	bool &ccWatch) // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+{
+	// The compiled form skips sets that cannot match, so it cannot fill in a
+	// complete rule result log. Interpret the rules if they are being traced.
+	if (nconf.remoteTraceTarget)
+		return _doZtFilterInterpreted(RR,rrl,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,ruleCount,cc,ccLength,ccWatch);
+	if (compiled)
+		return _doZtFilterCompiled(RR,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,*compiled,cc,ccLength,ccWatch);
+	_NoRuleResultLog nrl;
+	return _doZtFilterInterpreted(RR,nrl,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,ruleCount,cc,ccLength,ccWatch);
+}
+
+// True if the verdict for a flow does not depend on anything that varies from frame to frame
+static bool _flowCacheable(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount)
+{
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		switch((ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f)) {
+			case ZT_NETWORK_RULE_MATCH_RANDOM:
+			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+				return false;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+// True if two configs would compile to the same rule tables (capabilities are reissued with new timestamps, so only their rules are compared)
+static bool _sameRules(const NetworkConfig &a,const NetworkConfig &b)
+{
+	if ((a.ruleCount != b.ruleCount)||(a.capabilityCount != b.capabilityCount))
+		return false;
+	if ((a.ruleCount)&&(memcmp(a.rules.data(),b.rules.data(),sizeof(ZT_VirtualNetworkRule) * a.ruleCount) != 0))
+		return false;
+	for(unsigned int c=0;c<a.capabilityCount;++c) {
+		const Capability &ca = a.capabilities[c];
+		const Capability &cb = b.capabilities[c];
+		if ((ca.id() != cb.id())||(ca.ruleCount() != cb.ruleCount()))
+			return false;
+		if ((ca.ruleCount())&&(memcmp(ca.rules(),cb.rules(),sizeof(ZT_VirtualNetworkRule) * ca.ruleCount()) != 0))
+			return false;
+	}
+	return true;
+}
+
+// True if everything else the filter reads from our own config (tag values, owned things, flags) is the same
+static bool _sameFilterCredentials(const NetworkConfig &a,const NetworkConfig &b)
+{
+	if ((a.flags != b.flags)||(a.tagCount != b.tagCount)||(a.certificateOfOwnershipCount != b.certificateOfOwnershipCount))
+		return false;
+	for(unsigned int t=0;t<a.tagCount;++t) {
+		if ((a.tags[t].id() != b.tags[t].id())||(a.tags[t].value() != b.tags[t].value()))
+			return false;
+	}
+	for(unsigned int c=0;c<a.certificateOfOwnershipCount;++c) {
+		const CertificateOfOwnership &ca = a.certificatesOfOwnership[c];
+		const CertificateOfOwnership &cb = b.certificatesOfOwnership[c];
+		if (ca.thingCount() != cb.thingCount())
+			return false;
+		for(unsigned int i=0;i<ca.thingCount();++i) {
+			if ((ca.thingType(i) != cb.thingType(i))||(memcmp(ca.thingValue(i),cb.thingValue(i),ZT_CERTIFICATEOFOWNERSHIP_MAX_THING_VALUE_SIZE) != 0))
+				return false;
+		}
+	}
+	return true;
+}
+
+static inline unsigned int _teeLength(const unsigned int ccLength,const unsigned int frameLen)
+{
+	return ((ccLength != 0)&&(ccLength < frameLen)) ? ccLength : frameLen;
+}
+
 } // anonymous namespace
 
 const ZeroTier::MulticastGroup Network::BROADCAST(ZeroTier::MAC(0xffffffffffffULL),0);
@@ -522,10 +799,22 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 	_lastAnnouncedMulticastGroupsUpstream(0),
 	_mac(renv->identity.address(),nwid),
 	_portInitialized(false),
+	_lastBridgedMulticastQuery(0),
+	_remoteBridgeRoutes(ZT_MAX_BRIDGE_ROUTES,ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE),
+	_cfg(new _ConfigSnapshot()),
+	_flowCacheGeneration(1),
+	_memberRates(16),
+	_flows(16),
 	_lastConfigUpdate(0),
+	_framesIn(0),
+	_framesOut(0),
+	_bytesIn(0),
+	_bytesOut(0),
+	_framesDropped(0),
 	_destroyed(false),
 	_netconfFailure(NETCONF_FAILURE_NONE),
-	_portError(0)
+	_portError(0),
+	_physicalMtu(ZT_UDP_DEFAULT_PAYLOAD_MTU)
 {
 	for(int i=0;i<ZT_NETWORK_MAX_INCOMING_UPDATES;++i)
 		_incomingConfigChunks[i].ts = 0;
@@ -538,13 +827,15 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 		tmp[0] = nwid; tmp[1] = 0;
 
 		bool got = false;
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dict = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 		try {
-			int n = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,dict->unsafeData(),ZT_NETWORKCONFIG_DICT_CAPACITY - 1);
+			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> dict;
+			char *const d = dict.unsafeData(ZT_NETWORKCONFIG_DICT_CAPACITY);
+			int n = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,d,ZT_NETWORKCONFIG_DICT_CAPACITY - 1);
 			if (n > 1) {
+				d[n] = (char)0;
 				NetworkConfig *nconf = new NetworkConfig();
 				try {
-					if (nconf->fromDictionary(*dict)) {
+					if (nconf->fromDictionary(dict)) {
 						this->setConfiguration(tPtr,*nconf,false);
 						_lastConfigUpdate = 0; // still want to re-request an update since it's likely outdated
 						got = true;
@@ -553,7 +844,6 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 				delete nconf;
 			}
 		} catch ( ... ) {}
-		delete dict;
 
 		if (!got)
 			RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,"\n",1);
@@ -578,6 +868,10 @@ Network::~Network()
 	} else {
 		RR->node->configureVirtualNetworkPort((void *)0,_id,&_uPtr,ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DOWN,&ctmp);
 	}
+
+	for(std::vector<_ConfigSnapshot *>::iterator r(_retiredCfgs.begin());r!=_retiredCfgs.end();++r)
+		delete *r;
+	delete _cfg;
 }
 
 bool Network::filterOutgoingPacket(
@@ -592,99 +886,143 @@ bool Network::filterOutgoingPacket(
 	const unsigned int etherType,
 	const unsigned int vlanId)
 {
+	Latency::Scope _ls(RR->latency,Latency::FILTER_OUT);
 	const uint64_t now = RR->node->now();
-	Address ztFinalDest(ztDest);
-	int localCapabilityIndex = -1;
-	int accept = 0;
 	Trace::RuleResultLog rrl,crrl;
-	Address cc;
-	unsigned int ccLength = 0;
-	bool ccWatch = false;
-
-	Mutex::Lock _l(_lock);
+	_FlowVerdict fv(ztDest);
+	const _ConfigSnapshot *cfg;
+	bool pushToDest = false;
 
-	Membership *const membership = (ztDest) ? _memberships.get(ztDest) : (Membership *)0;
+	{
+		// Rules only read memberships, so many frames can be filtered at once
+		RWMutex::RLock _l(_lock);
+
+		cfg = _currentConfig(); // under _lock so it matches _flowCacheGeneration
+		const NetworkConfig &nconf = cfg->config;
+		Membership *const membership = (ztDest) ? _memberships.get(ztDest) : (Membership *)0;
+
+		_FlowKey fk;
+		const bool useFlowCache = ((cfg->flowCacheable)&&(!nconf.remoteTraceTarget)&&(_flowKey(fk,false,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId)));
+		if ((!useFlowCache)||(!_flowCacheGet(fk,fv))) {
+			switch(_doZtFilter(RR,rrl,nconf,membership,false,ztSource,fv.ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.rules.data(),nconf.ruleCount,&(cfg->rules),fv.cc,fv.ccLength,fv.ccWatch)) {
+
+				case DOZTFILTER_NO_MATCH: {
+					for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+						fv.ztFinalDest = ztDest; // sanity check, shouldn't be possible if there was no match
+						Address cc2;
+						unsigned int ccLength2 = 0;
+						bool ccWatch2 = false;
+						switch (_doZtFilter(RR,crrl,nconf,membership,false,ztSource,fv.ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.capabilities[c].rules(),nconf.capabilities[c].ruleCount(),&(cfg->capabilityRules[c]),cc2,ccLength2,ccWatch2)) {
+							case DOZTFILTER_NO_MATCH:
+							case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+								break;
 
-	switch(_doZtFilter(RR,rrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
+							case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+							case DOZTFILTER_ACCEPT:
+							case DOZTFILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
+								fv.localCapabilityIndex = (int)c;
+								fv.accept = 1;
+								fv.cc2 = cc2;
+								fv.ccLength2 = ccLength2;
+								fv.ccWatch2 = ccWatch2;
+								break;
+						}
+						if (fv.accept)
+							break;
+					}
+				}	break;
 
-		case DOZTFILTER_NO_MATCH: {
-			for(unsigned int c=0;c<_config.capabilityCount;++c) {
-				ztFinalDest = ztDest; // sanity check, shouldn't be possible if there was no match
-				Address cc2;
-				unsigned int ccLength2 = 0;
-				bool ccWatch2 = false;
-				switch (_doZtFilter(RR,crrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.capabilities[c].rules(),_config.capabilities[c].ruleCount(),cc2,ccLength2,ccWatch2)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
-						break;
+				case DOZTFILTER_DROP:
+					break;
 
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
-					case DOZTFILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
-						localCapabilityIndex = (int)c;
-						accept = 1;
-
-						if ((!noTee)&&(cc2)) {
-							Membership &m2 = _membership(cc2);
-							m2.pushCredentials(RR,tPtr,now,cc2,_config,localCapabilityIndex,false);
-
-							Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-							outp.append(_id);
-							outp.append((uint8_t)(ccWatch2 ? 0x16 : 0x02));
-							macDest.appendTo(outp);
-							macSource.appendTo(outp);
-							outp.append((uint16_t)etherType);
-							outp.append(frameData,ccLength2);
-							outp.compress();
-							RR->sw->send(tPtr,outp,true);
-						}
+				case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+				case DOZTFILTER_ACCEPT:
+					fv.accept = 1;
+					break;
 
-						break;
-				}
-				if (accept)
+				case DOZTFILTER_SUPER_ACCEPT:
+					fv.accept = 2;
 					break;
 			}
-		}	break;
 
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
-			return false;
+			if (useFlowCache)
+				_flowCachePut(fk,fv);
+		}
 
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
-			accept = 1;
-			break;
+		pushToDest = ((fv.accept)&&(membership)&&(membership->credentialsDue(now,nconf,fv.localCapabilityIndex)));
+	}
 
-		case DOZTFILTER_SUPER_ACCEPT:
-			accept = 2;
-			break;
+	ZT_PROBE_FILTER_VERDICT(_id,0,ztSource.toInt(),ztDest.toInt(),etherType,fv.accept);
+	if ((RR->capture->enabled())&&(RR->capture->wants(_id,false,ztDest.toInt(),etherType,fv.accept))) {
+		InetAddress pathAddress;
+		if (ztDest) {
+			const SharedPtr<Peer> destPeer(RR->topology->getPeerNoCache(ztDest));
+			if (destPeer) {
+				const SharedPtr<Path> bp(destPeer->getBestPath(now,false));
+				if (bp)
+					pathAddress = bp->address();
+			}
+		}
+		RR->capture->record(now,_id,false,fv.accept,ztDest.toInt(),pathAddress,macSource,macDest,etherType,vlanId,frameData,frameLen);
 	}
 
-	if (accept) {
-		if (membership)
-			membership->pushCredentials(RR,tPtr,now,ztDest,_config,localCapabilityIndex,false);
+	// cfg stays valid for ZT_NETWORK_CONFIG_RETIRE_DELAY after being replaced
+	const NetworkConfig &nconf = cfg->config;
+
+	if ((fv.accept)&&(ztDest)&&(!_memberRateGate(nconf,ztDest,false,frameLen,now))) {
+		RR->metrics->inc(Metrics::MEMBER_RATE_OUT_DROPPED);
+		++_framesDropped;
+		return false;
+	}
 
-		if ((!noTee)&&(cc)) {
-			Membership &m2 = _membership(cc);
-			m2.pushCredentials(RR,tPtr,now,cc,_config,localCapabilityIndex,false);
+	if (fv.accept) {
+		const bool teeTo2 = ((!noTee)&&(fv.cc2));
+		const bool teeTo = ((!noTee)&&(fv.cc));
+		const bool redirected = ((ztDest != fv.ztFinalDest)&&(fv.ztFinalDest));
+
+		if ((pushToDest)||(teeTo2)||(teeTo)||(redirected)) {
+			RWMutex::Lock _l(_lock);
+			if (_currentConfig() == cfg) { // a new config resets push state and is pushed on its own
+				if (teeTo2)
+					_membership(fv.cc2).pushCredentials(RR,tPtr,now,fv.cc2,nconf,fv.localCapabilityIndex,false);
+				if (pushToDest) {
+					Membership *const membership = _memberships.get(ztDest);
+					if (membership)
+						membership->pushCredentials(RR,tPtr,now,ztDest,nconf,fv.localCapabilityIndex,false);
+				}
+				if (teeTo)
+					_membership(fv.cc).pushCredentials(RR,tPtr,now,fv.cc,nconf,fv.localCapabilityIndex,false);
+				if (redirected)
+					_membership(fv.ztFinalDest).pushCredentials(RR,tPtr,now,fv.ztFinalDest,nconf,fv.localCapabilityIndex,false);
+			}
+		}
 
-			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		if (teeTo2) {
+			Packet outp(fv.cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
-			outp.append((uint8_t)(ccWatch ? 0x16 : 0x02));
+			outp.append((uint8_t)(fv.ccWatch2 ? 0x16 : 0x02));
 			macDest.appendTo(outp);
 			macSource.appendTo(outp);
 			outp.append((uint16_t)etherType);
-			outp.append(frameData,ccLength);
+			outp.append(frameData,_teeLength(fv.ccLength2,frameLen));
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 		}
 
-		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			Membership &m2 = _membership(ztFinalDest);
-			m2.pushCredentials(RR,tPtr,now,ztFinalDest,_config,localCapabilityIndex,false);
+		if (teeTo) {
+			Packet outp(fv.cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
+			outp.append(_id);
+			outp.append((uint8_t)(fv.ccWatch ? 0x16 : 0x02));
+			macDest.appendTo(outp);
+			macSource.appendTo(outp);
+			outp.append((uint16_t)etherType);
+			outp.append(frameData,_teeLength(fv.ccLength,frameLen));
+			outp.compress();
+			RR->sw->send(tPtr,outp,true);
+		}
 
-			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		if (redirected) {
+			Packet outp(fv.ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
 			outp.append((uint8_t)0x04);
 			macDest.appendTo(outp);
@@ -694,17 +1032,25 @@ bool Network::filterOutgoingPacket(
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+			if (nconf.remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(fv.localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(fv.localCapabilityIndex >= 0) ? &(nconf.capabilities[fv.localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+			RR->metrics->inc(Metrics::FILTER_OUT_REDIRECT);
 			return false; // DROP locally, since we redirected
 		} else {
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
+			if (nconf.remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(fv.localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(fv.localCapabilityIndex >= 0) ? &(nconf.capabilities[fv.localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
+			RR->metrics->inc(Metrics::FILTER_OUT_ACCEPT);
+			++_framesOut;
+			_bytesOut += frameLen;
+			if (RR->flowExport->enabled())
+				_countFlow(false,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,now);
 			return true;
 		}
 	} else {
-		if (_config.remoteTraceTarget)
-			RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+		if (nconf.remoteTraceTarget)
+			RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+		RR->metrics->inc(Metrics::FILTER_OUT_DROP);
+		++_framesDropped;
 		return false;
 	}
 }
@@ -712,6 +1058,7 @@ bool Network::filterOutgoingPacket(
 int Network::filterIncomingPacket(
 	void *tPtr,
 	const SharedPtr<Peer> &sourcePeer,
+	const SharedPtr<Path> &path,
 	const Address &ztDest,
 	const MAC &macSource,
 	const MAC &macDest,
@@ -720,115 +1067,172 @@ int Network::filterIncomingPacket(
 	const unsigned int etherType,
 	const unsigned int vlanId)
 {
-	Address ztFinalDest(ztDest);
+	Latency::Scope _ls(RR->latency,Latency::FILTER_IN);
 	Trace::RuleResultLog rrl,crrl;
-	int accept = 0;
-	Address cc;
-	unsigned int ccLength = 0;
-	bool ccWatch = false;
-	const Capability *c = (Capability *)0;
-
-	Mutex::Lock _l(_lock);
-
-	Membership &membership = _membership(sourcePeer->address());
-
-	switch (_doZtFilter(RR,rrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
-
-		case DOZTFILTER_NO_MATCH: {
-			Membership::CapabilityIterator mci(membership,_config);
-			while ((c = mci.next())) {
-				ztFinalDest = ztDest; // sanity check, should be unmodified if there was no match
-				Address cc2;
-				unsigned int ccLength2 = 0;
-				bool ccWatch2 = false;
-				switch(_doZtFilter(RR,crrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),cc2,ccLength2,ccWatch2)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
-						break;
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
-						accept = 1; // ACCEPT
-						break;
-					case DOZTFILTER_SUPER_ACCEPT:
-						accept = 2; // super-ACCEPT
+	_FlowVerdict fv(ztDest);
+	const _ConfigSnapshot *cfg;
+	bool newMember;
+
+	{
+		// Rules only read memberships, so many frames can be filtered at once
+		RWMutex::RLock _l(_lock);
+
+		cfg = _currentConfig(); // under _lock so it matches _flowCacheGeneration
+		const NetworkConfig &nconf = cfg->config;
+		const Capability *c = (Capability *)0;
+
+		// A member we have no record of yet holds no credentials, so it's
+		// filtered as such and its record is created below
+		Membership *const membership = _memberships.get(sourcePeer->address());
+		newMember = (!membership);
+
+		_FlowKey fk;
+		bool useFlowCache = ((cfg->flowCacheable)&&(!nconf.remoteTraceTarget)&&(_flowKey(fk,true,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId)));
+		if ((!useFlowCache)||(!_flowCacheGet(fk,fv))) {
+			switch (_doZtFilter(RR,rrl,nconf,membership,true,sourcePeer->address(),fv.ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.rules.data(),nconf.ruleCount,&(cfg->rules),fv.cc,fv.ccLength,fv.ccWatch)) {
+
+				case DOZTFILTER_NO_MATCH: {
+					if (!membership)
 						break;
-				}
+					Membership::CapabilityIterator mci(*membership,nconf);
+					while ((c = mci.next())) {
+						// Capabilities from peers are not checked when the config is set
+						if ((useFlowCache)&&(!_flowCacheable(c->rules(),c->ruleCount())))
+							useFlowCache = false;
+
+						fv.ztFinalDest = ztDest; // sanity check, should be unmodified if there was no match
+						Address cc2;
+						unsigned int ccLength2 = 0;
+						bool ccWatch2 = false;
+						switch(_doZtFilter(RR,crrl,nconf,membership,true,sourcePeer->address(),fv.ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),(const CompiledRules *)0,cc2,ccLength2,ccWatch2)) {
+							case DOZTFILTER_NO_MATCH:
+							case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+								break;
+							case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
+							case DOZTFILTER_ACCEPT:
+								fv.accept = 1; // ACCEPT
+								break;
+							case DOZTFILTER_SUPER_ACCEPT:
+								fv.accept = 2; // super-ACCEPT
+								break;
+						}
 
-				if (accept) {
-					if (cc2) {
-						_membership(cc2).pushCredentials(RR,tPtr,RR->node->now(),cc2,_config,-1,false);
-
-						Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-						outp.append(_id);
-						outp.append((uint8_t)(ccWatch2 ? 0x1c : 0x08));
-						macDest.appendTo(outp);
-						macSource.appendTo(outp);
-						outp.append((uint16_t)etherType);
-						outp.append(frameData,ccLength2);
-						outp.compress();
-						RR->sw->send(tPtr,outp,true);
+						if (fv.accept) {
+							fv.cc2 = cc2;
+							fv.ccLength2 = ccLength2;
+							fv.ccWatch2 = ccWatch2;
+							break;
+						}
 					}
+				}	break;
+
+				case DOZTFILTER_DROP:
+					break;
+
+				case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+				case DOZTFILTER_ACCEPT:
+					fv.accept = 1; // ACCEPT
+					break;
+				case DOZTFILTER_SUPER_ACCEPT:
+					fv.accept = 2; // super-ACCEPT
 					break;
-				}
 			}
-		}	break;
 
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
-			return 0; // DROP
+			if (useFlowCache)
+				_flowCachePut(fk,fv);
+		}
 
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
-			accept = 1; // ACCEPT
-			break;
-		case DOZTFILTER_SUPER_ACCEPT:
-			accept = 2; // super-ACCEPT
-			break;
+		// c points into the membership, so it's only looked at while it can't change
+		if (nconf.remoteTraceTarget)
+			RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,((ztDest != fv.ztFinalDest)&&(fv.ztFinalDest)) ? 0 : fv.accept);
 	}
 
-	if (accept) {
-		if (cc) {
-			_membership(cc).pushCredentials(RR,tPtr,RR->node->now(),cc,_config,-1,false);
-
-			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)(ccWatch ? 0x1c : 0x08));
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,ccLength);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
+	// cfg stays valid for ZT_NETWORK_CONFIG_RETIRE_DELAY after being replaced
+	const NetworkConfig &nconf = cfg->config;
+
+	const bool redirected = ((fv.accept)&&(ztDest != fv.ztFinalDest)&&(fv.ztFinalDest));
+
+	if ((newMember)||((fv.accept)&&((fv.cc2)||(fv.cc)||(redirected)))) {
+		RWMutex::Lock _l(_lock);
+		if (newMember)
+			_membership(sourcePeer->address());
+		if ((fv.accept)&&(_currentConfig() == cfg)) { // a new config resets push state and is pushed on its own
+			const uint64_t now = RR->node->now();
+			if (fv.cc2)
+				_membership(fv.cc2).pushCredentials(RR,tPtr,now,fv.cc2,nconf,-1,false);
+			if (fv.cc)
+				_membership(fv.cc).pushCredentials(RR,tPtr,now,fv.cc,nconf,-1,false);
+			if (redirected)
+				_membership(fv.ztFinalDest).pushCredentials(RR,tPtr,now,fv.ztFinalDest,nconf,-1,false);
 		}
+	}
 
-		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			_membership(ztFinalDest).pushCredentials(RR,tPtr,RR->node->now(),ztFinalDest,_config,-1,false);
+	ZT_PROBE_FILTER_VERDICT(_id,1,sourcePeer->address().toInt(),ztDest.toInt(),etherType,fv.accept);
+	if ((RR->capture->enabled())&&(RR->capture->wants(_id,true,sourcePeer->address().toInt(),etherType,fv.accept)))
+		RR->capture->record(RR->node->now(),_id,true,fv.accept,sourcePeer->address().toInt(),(path) ? path->address() : InetAddress(),macSource,macDest,etherType,vlanId,frameData,frameLen);
 
-			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)0x0a);
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,frameLen);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
+	if (!fv.accept) {
+		RR->metrics->inc(Metrics::FILTER_IN_DROP);
+		++_framesDropped;
+		return 0; // DROP
+	}
 
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
-			return 0; // DROP locally, since we redirected
-		}
+	if (!_memberRateGate(nconf,sourcePeer->address(),true,frameLen,RR->node->now())) {
+		RR->metrics->inc(Metrics::MEMBER_RATE_IN_DROPPED);
+		++_framesDropped;
+		return 0;
+	}
+
+	if (fv.cc2) {
+		Packet outp(fv.cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		outp.append(_id);
+		outp.append((uint8_t)(fv.ccWatch2 ? 0x1c : 0x08));
+		macDest.appendTo(outp);
+		macSource.appendTo(outp);
+		outp.append((uint16_t)etherType);
+		outp.append(frameData,_teeLength(fv.ccLength2,frameLen));
+		outp.compress();
+		RR->sw->send(tPtr,outp,true);
+	}
+
+	if (fv.cc) {
+		Packet outp(fv.cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		outp.append(_id);
+		outp.append((uint8_t)(fv.ccWatch ? 0x1c : 0x08));
+		macDest.appendTo(outp);
+		macSource.appendTo(outp);
+		outp.append((uint16_t)etherType);
+		outp.append(frameData,_teeLength(fv.ccLength,frameLen));
+		outp.compress();
+		RR->sw->send(tPtr,outp,true);
+	}
+
+	if (redirected) {
+		Packet outp(fv.ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		outp.append(_id);
+		outp.append((uint8_t)0x0a);
+		macDest.appendTo(outp);
+		macSource.appendTo(outp);
+		outp.append((uint16_t)etherType);
+		outp.append(frameData,frameLen);
+		outp.compress();
+		RR->sw->send(tPtr,outp,true);
+
+		RR->metrics->inc(Metrics::FILTER_IN_REDIRECT);
+		return 0; // DROP locally, since we redirected
 	}
 
-	if (_config.remoteTraceTarget)
-		RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,accept);
-	return accept;
+	RR->metrics->inc(Metrics::FILTER_IN_ACCEPT);
+	++_framesIn;
+	_bytesIn += frameLen;
+	if (RR->flowExport->enabled())
+		_countFlow(true,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,RR->node->now());
+	return fv.accept;
 }
 
 bool Network::subscribedToMulticastGroup(const MulticastGroup &mg,bool includeBridgedGroups) const
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::RLock _l(_lock);
 	if (std::binary_search(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg))
 		return true;
 	else if (includeBridgedGroups)
@@ -838,16 +1242,16 @@ bool Network::subscribedToMulticastGroup(const MulticastGroup &mg,bool includeBr
 
 void Network::multicastSubscribe(void *tPtr,const MulticastGroup &mg)
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	if (!std::binary_search(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg)) {
 		_myMulticastGroups.insert(std::upper_bound(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg),mg);
-		_sendUpdatesToMembers(tPtr,&mg);
+		_multicastGroupAdded(mg);
 	}
 }
 
 void Network::multicastUnsubscribe(const MulticastGroup &mg)
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	std::vector<MulticastGroup>::iterator i(std::lower_bound(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg));
 	if ( (i != _myMulticastGroups.end()) && (*i == mg) )
 		_myMulticastGroups.erase(i);
@@ -865,15 +1269,24 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 	const void *chunkData = chunk.field(ptr,chunkLen); ptr += chunkLen;
 
 	NetworkConfig *nc = (NetworkConfig *)0;
+	std::string ncDict;
+	bool deltaFailed = false;
 	uint64_t configUpdateId;
 	{
-		Mutex::Lock _l(_lock);
+		RWMutex::Lock _l(_lock);
 
 		_IncomingConfigChunk *c = (_IncomingConfigChunk *)0;
 		uint64_t chunkId = 0;
 		unsigned long totalLength,chunkIndex;
+		bool isDelta = false,isBinary = false,isCompressed = false;
 		if (ptr < chunk.size()) {
-			const bool fastPropagate = ((chunk[ptr++] & 0x01) != 0);
+			const uint8_t flags = chunk[ptr++];
+			isDelta = ((flags & ZT_NETWORKCONFIG_CHUNK_FLAG_DELTA) != 0);
+			isBinary = ((flags & ZT_NETWORKCONFIG_CHUNK_FLAG_BINARY) != 0);
+			isCompressed = ((flags & ZT_NETWORKCONFIG_CHUNK_FLAG_COMPRESSED) != 0);
+			if ((isDelta)&&(isBinary)) // deltas are only computed between dictionaries
+				return 0;
+			const bool fastPropagate = (((flags & 0x01) != 0)&&(!isDelta)); // deltas are specific to their recipient
 			configUpdateId = chunk.at<uint64_t>(ptr); ptr += 8;
 			totalLength = chunk.at<uint32_t>(ptr); ptr += 4;
 			chunkIndex = chunk.at<uint32_t>(ptr); ptr += 4;
@@ -954,27 +1367,89 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 			return false;
 		c->haveChunkIds[c->haveChunks++] = chunkId;
 
-		memcpy(c->data.unsafeData() + chunkIndex,chunkData,chunkLen);
+		memcpy(c->data.unsafeData((unsigned int)totalLength + 1) + chunkIndex,chunkData,chunkLen);
 		c->haveBytes += chunkLen;
 
 		if (c->haveBytes == totalLength) {
-			c->data.unsafeData()[c->haveBytes] = (char)0; // ensure null terminated
+			if (isCompressed) {
+				char *const uncompressed = new char[ZT_NETWORKCONFIG_DICT_CAPACITY];
+				const int ul = Packet::lz4Decompress(c->data.data(),(unsigned int)c->haveBytes,uncompressed,ZT_NETWORKCONFIG_DICT_CAPACITY - 1); // leave room for a null
+				if (ul > 0) {
+					memcpy(c->data.unsafeData((unsigned int)ul + 1),uncompressed,ul);
+					c->haveBytes = (unsigned long)ul;
+				}
+				delete [] uncompressed;
+				if (ul <= 0) {
+					c->updateId = 0;
+					return 0;
+				}
+			}
+			c->data.unsafeData((unsigned int)c->haveBytes + 1)[c->haveBytes] = (char)0; // ensure null terminated
+
+			// A delta is applied to the last config we got from the controller
+			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> merged;
+			const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *full = &(c->data);
+			if (isBinary) {
+				// Our delta base is the dictionary the controller encoded this from,
+				// which it will only use if re-encoding here reproduces it exactly.
+				nc = new NetworkConfig();
+				try {
+					if (nc->fromBinary(c->data.data(),(unsigned int)c->haveBytes)) {
+						if (nc->toDictionary(merged,false))
+							ncDict.assign(merged.data(),merged.sizeBytes());
+					} else {
+						delete nc;
+						nc = (NetworkConfig *)0;
+					}
+				} catch ( ... ) {
+					delete nc;
+					nc = (NetworkConfig *)0;
+				}
+				full = (const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
+			} else if (isDelta) {
+				if ((_configDict.length() > 0)&&(NetworkConfig::applyDelta(_configDict.data(),(unsigned int)_configDict.length(),c->data,merged))) {
+					full = &merged;
+				} else {
+					full = (const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
+					deltaFailed = true;
+				}
+			}
 
-			nc = new NetworkConfig();
-			try {
-				if (!nc->fromDictionary(c->data)) {
+			if (full) {
+				nc = new NetworkConfig();
+				try {
+					if (nc->fromDictionary(*full)) {
+						ncDict.assign(full->data(),full->sizeBytes());
+					} else {
+						delete nc;
+						nc = (NetworkConfig *)0;
+					}
+				} catch ( ... ) {
 					delete nc;
 					nc = (NetworkConfig *)0;
 				}
-			} catch ( ... ) {
-				delete nc;
-				nc = (NetworkConfig *)0;
 			}
+
+			c->data.clear();
+		}
+	}
+
+	if (deltaFailed) {
+		// Our base is missing or differs from what the controller thinks we have,
+		// so forget it and ask for a full config.
+		{
+			RWMutex::Lock _l(_lock);
+			_configDict.clear();
 		}
+		this->requestConfiguration(tPtr);
+		return 0;
 	}
 
 	if (nc) {
-		this->setConfiguration(tPtr,*nc,true);
+		if (this->setConfiguration(tPtr,*nc,true)) {
+			RWMutex::Lock _l(_lock);
+			_configDict.swap(ncDict);
+		}
 		delete nc;
 		return configUpdateId;
 	} else {
@@ -993,16 +1468,53 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 	try {
 		if ((nconf.issuedTo != RR->identity.address())||(nconf.networkId != _id))
 			return 0; // invalid config that is not for us or not for this network
-		if (_config == nconf)
+		if (config() == nconf) {
+			// Controllers may resend an unchanged config, which still confirms it's current
+			RWMutex::Lock _l(_lock);
+			_lastConfigUpdate = RR->node->now();
 			return 1; // OK config, but duplicate of what we already have
+		}
+
+		// Copying and compiling the new config is done before anything is locked.
+		// Most updates only refresh credentials, so the old rule tables and flow
+		// cache are kept unless something the filter reads actually changed.
+		const _ConfigSnapshot *const old = _currentConfig();
+		_ConfigSnapshot *const cfg = new _ConfigSnapshot();
+		cfg->config = nconf;
+		const bool rulesChanged = !_sameRules(old->config,nconf);
+		if (rulesChanged) {
+			_compileRules(*cfg);
+		} else {
+			cfg->rules = old->rules;
+			cfg->capabilityRules = old->capabilityRules;
+			cfg->flowCacheable = old->flowCacheable;
+		}
+		const bool filterChanged = ((rulesChanged)||(!_sameFilterCredentials(old->config,nconf)));
 
 		ZT_VirtualNetworkConfig ctmp;
 		bool oldPortInitialized;
 		{	// do things that require lock here, but unlock before calling callbacks
-			Mutex::Lock _l(_lock);
+			RWMutex::Lock _l(_lock);
+			const uint64_t now = RR->node->now();
+
+			// Readers that loaded the old config without _lock may still be using it
+			std::vector<_ConfigSnapshot *>::iterator w(_retiredCfgs.begin());
+			for(std::vector<_ConfigSnapshot *>::iterator r(_retiredCfgs.begin());r!=_retiredCfgs.end();++r) {
+				if ((now - (*r)->retiredAt) > ZT_NETWORK_CONFIG_RETIRE_DELAY)
+					delete *r;
+				else *(w++) = *r;
+			}
+			_retiredCfgs.erase(w,_retiredCfgs.end());
+			_cfg->retiredAt = now;
+			_retiredCfgs.push_back(_cfg);
+			__atomic_store_n(&_cfg,cfg,__ATOMIC_RELEASE);
 
-			_config = nconf;
-			_lastConfigUpdate = RR->node->now();
+			if ((cfg->flowCacheable)&&(_flowCache.empty()))
+				_flowCache.resize(ZT_NETWORK_FLOW_CACHE_SIZE);
+			if (filterChanged)
+				_flowCacheInvalidate();
+
+			_lastConfigUpdate = now;
 			_netconfFailure = NETCONF_FAILURE_NONE;
 
 			oldPortInitialized = _portInitialized;
@@ -1020,15 +1532,14 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 		_portError = RR->node->configureVirtualNetworkPort(tPtr,_id,&_uPtr,(oldPortInitialized) ? ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE : ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP,&ctmp);
 
 		if (saveToDisk) {
-			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 			try {
-				if (nconf.toDictionary(*d,false)) {
+				Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> d;
+				if (nconf.toDictionary(d,false)) {
 					uint64_t tmp[2];
 					tmp[0] = _id; tmp[1] = 0;
-					RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,d->data(),d->sizeBytes());
+					RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,d.data(),d.sizeBytes());
 				}
 			} catch ( ... ) {}
-			delete d;
 		}
 
 		return 2; // OK and configuration has changed
@@ -1062,6 +1573,7 @@ void Network::requestConfiguration(void *tPtr)
 			nconf->multicastLimit = 0;
 			nconf->staticIpCount = 1;
 			nconf->ruleCount = 14;
+			nconf->rules.resize(14);
 			nconf->staticIps[0] = InetAddress::makeIpv66plane(_id,RR->identity.address().toInt());
 
 			// Drop everything but IPv6
@@ -1134,6 +1646,8 @@ void Network::requestConfiguration(void *tPtr)
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY_VERSION,(uint64_t)ZT_NETWORKCONFIG_BINARY_VERSION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_COMPRESSION,(uint64_t)ZT_NETWORKCONFIG_COMPRESSION_LZ4);
 
 	RR->t->networkConfigRequestSent(tPtr,*this,ctrl);
 
@@ -1146,14 +1660,21 @@ void Network::requestConfiguration(void *tPtr)
 		return;
 	}
 
+	{
+		// Let the controller send only what changed since the config we hold
+		RWMutex::Lock _l(_lock);
+		if (_configDict.length() > 0)
+			rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_CONFIG_BASE,NetworkConfig::dictionaryHash(_configDict.data(),(unsigned int)_configDict.length()));
+	}
+
 	Packet outp(ctrl,RR->identity.address(),Packet::VERB_NETWORK_CONFIG_REQUEST);
 	outp.append((uint64_t)_id);
 	const unsigned int rmdSize = rmd.sizeBytes();
 	outp.append((uint16_t)rmdSize);
 	outp.append((const void *)rmd.data(),rmdSize);
-	if (_config) {
-		outp.append((uint64_t)_config.revision);
-		outp.append((uint64_t)_config.timestamp);
+	if (config()) {
+		outp.append((uint64_t)config().revision);
+		outp.append((uint64_t)config().timestamp);
 	} else {
 		outp.append((unsigned char)0,16);
 	}
@@ -1165,16 +1686,18 @@ void Network::requestConfiguration(void *tPtr)
 bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const uint64_t now = RR->node->now();
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	try {
-		if (_config) {
+		if (config()) {
 			Membership *m = _memberships.get(peer->address());
-			if ( (_config.isPublic()) || ((m)&&(m->isAllowedOnNetwork(_config))) ) {
+			if ( (config().isPublic()) || ((m)&&(m->isAllowedOnNetwork(config()))) ) {
 				if (!m)
 					m = &(_membership(peer->address()));
 				if (m->multicastLikeGate(now)) {
-					m->pushCredentials(RR,tPtr,now,peer->address(),_config,-1,false);
-					_announceMulticastGroupsTo(tPtr,peer->address(),_allMulticastGroups());
+					m->pushCredentials(RR,tPtr,now,peer->address(),config(),-1,false);
+					MulticastLikes likes;
+					likes.add(peer->address(),_id,_allMulticastGroups());
+					likes.send(RR,tPtr);
 				}
 				return true;
 			}
@@ -1185,7 +1708,7 @@ bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 
 bool Network::recentlyAssociatedWith(const Address &addr)
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::RLock _l(_lock);
 	const Membership *m = _memberships.get(addr);
 	return ((m)&&(m->recentlyAssociated(RR->node->now())));
 }
@@ -1193,17 +1716,40 @@ bool Network::recentlyAssociatedWith(const Address &addr)
 void Network::clean()
 {
 	const uint64_t now = RR->node->now();
-	Mutex::Lock _l(_lock);
+	std::vector<Address> members;
+	{
+		RWMutex::Lock _l(_lock);
+		if (_destroyed)
+			return;
+		_clean(now,members);
+	}
 
-	if (_destroyed)
-		return;
+	// Peers are locked on their own, so path MTUs are read after _lock is released
+	unsigned int pmtu = 0;
+	for(std::vector<Address>::const_iterator a(members.begin());a!=members.end();++a) {
+		const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(*a));
+		if (peer) {
+			const SharedPtr<Path> bp(peer->getBestPath(now,false));
+			if ((bp)&&((!pmtu)||(bp->mtu() < pmtu)))
+				pmtu = bp->mtu();
+		}
+	}
 
+	RWMutex::Lock _l(_lock);
+	_physicalMtu = (pmtu) ? pmtu : ZT_UDP_DEFAULT_PAYLOAD_MTU;
+}
+
+void Network::_clean(const uint64_t now,std::vector<Address> &members)
+{
+	// assumes _lock is locked
 	{
+		// Without a querier hosts never report again, so keep what they did report
+		const bool querier = ((now - _lastBridgedMulticastQuery) < ZT_MULTICAST_SNOOP_QUERIER_TIMEOUT);
 		Hashtable< MulticastGroup,uint64_t >::Iterator i(_multicastGroupsBehindMe);
 		MulticastGroup *mg = (MulticastGroup *)0;
 		uint64_t *ts = (uint64_t *)0;
 		while (i.next(mg,ts)) {
-			if ((now - *ts) > (ZT_MULTICAST_LIKE_EXPIRE * 2))
+			if (((now - *ts) > (ZT_MULTICAST_LIKE_EXPIRE * 2))&&((querier)||(!mg->joinedByReport())))
 				_multicastGroupsBehindMe.erase(*mg);
 		}
 	}
@@ -1213,57 +1759,237 @@ void Network::clean()
 		Membership *m = (Membership *)0;
 		Hashtable<Address,Membership>::Iterator i(_memberships);
 		while (i.next(a,m)) {
-			if (!RR->topology->getPeerNoCache(*a))
+			if (!RR->topology->hasPeer(*a)) {
 				_memberships.erase(*a);
-			else m->clean(now,_config);
+			} else {
+				m->clean(now,config());
+				members.push_back(*a);
+			}
 		}
 	}
-}
 
-void Network::learnBridgeRoute(const MAC &mac,const Address &addr)
-{
-	Mutex::Lock _l(_lock);
-	_remoteBridgeRoutes[mac] = addr;
+	{
+		// A full bucket is the same as none, so these go once members go quiet
+		AdaptiveMutex::Lock _l2(_memberRates_m);
+		Address *a = (Address *)0;
+		_MemberRate *r = (_MemberRate *)0;
+		Hashtable<Address,_MemberRate>::Iterator i(_memberRates);
+		while (i.next(a,r)) {
+			if ((r->in.full(now))&&(r->out.full(now)))
+				_memberRates.erase(*a);
+		}
+	}
 
-	// Anti-DOS circuit breaker to prevent nodes from spamming us with absurd numbers of bridge routes
-	while (_remoteBridgeRoutes.size() > ZT_MAX_BRIDGE_ROUTES) {
-		Hashtable< Address,unsigned long > counts;
-		Address maxAddr;
-		unsigned long maxCount = 0;
+	// Credentials may have expired or gone with their members
+	_flowCacheInvalidate();
+}
 
-		MAC *m = (MAC *)0;
-		Address *a = (Address *)0;
+bool Network::_memberRateGate(const NetworkConfig &nconf,const Address &member,const bool inbound,const unsigned int len,const uint64_t now)
+{
+	if ((!nconf.memberRateLimit)||(nconf.isActiveBridge(member)))
+		return true;
+	uint64_t burst = (nconf.memberRateBurst) ? nconf.memberRateBurst : nconf.memberRateLimit;
+	if (burst < ZT_MAX_MTU)
+		burst = ZT_MAX_MTU; // a limit below one frame per burst would drop everything
+	AdaptiveMutex::Lock _l(_memberRates_m);
+	TokenBucket &tb = (inbound) ? _memberRates[member].in : _memberRates[member].out;
+	if ((tb.rate() != nconf.memberRateLimit)||(tb.burst() != burst))
+		tb.set(nconf.memberRateLimit,burst,now);
+	return tb.conform(len,now);
+}
 
-		// Find the address responsible for the most entries
-		{
-			Hashtable<MAC,Address>::Iterator i(_remoteBridgeRoutes);
-			while (i.next(m,a)) {
-				const unsigned long c = ++counts[*a];
-				if (c > maxCount) {
-					maxCount = c;
-					maxAddr = *a;
-				}
-			}
+void Network::_countFlow(const bool inbound,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId,const uint64_t now)
+{
+	// The flow cache's key less the TCP flags, which change within a flow
+	_FlowKey k;
+	if (!_flowKey(k,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId))
+		return;
+	k.w[1] &= 0x000fffffffffffffULL;
+
+	AdaptiveMutex::Lock _l(_flows_m);
+	_FlowCounts *c = _flows.get(k);
+	if (!c) {
+		if (_flows.size() >= RR->flowExport->maxFlows()) {
+			RR->metrics->inc(Metrics::FLOWS_OVERFLOWED);
+			return;
 		}
+		c = &(_flows[k]);
+		c->first = now;
+		c->packets = 0;
+		c->bytes = 0;
+	}
+	c->last = now;
+	++c->packets;
+	c->bytes += frameLen;
+}
 
-		// Kill this address from our table, since it's most likely spamming us
-		{
-			Hashtable<MAC,Address>::Iterator i(_remoteBridgeRoutes);
-			while (i.next(m,a)) {
-				if (*a == maxAddr)
-					_remoteBridgeRoutes.erase(*m);
-			}
+void Network::flows(std::vector<FlowExport::Flow> &flows)
+{
+	Hashtable< _FlowKey,_FlowCounts > taken(16);
+	{
+		AdaptiveMutex::Lock _l(_flows_m);
+		if (!_flows.size())
+			return;
+		_flows.swap(taken);
+	}
+
+	// Everything but the counts is decoded from the key, see _flowKey()
+	_FlowKey *k = (_FlowKey *)0;
+	_FlowCounts *c = (_FlowCounts *)0;
+	Hashtable< _FlowKey,_FlowCounts >::Iterator i(taken);
+	while (i.next(k,c)) {
+		flows.push_back(FlowExport::Flow());
+		FlowExport::Flow &f = flows.back();
+		f.networkId = _id;
+		f.inbound = ((k->w[0] & 0x10000000000ULL) != 0);
+		f.ipv6 = ((k->w[0] & 0x20000000000ULL) != 0);
+		f.peer = (f.inbound) ? (k->w[0] & 0xffffffffffULL) : (k->w[1] & 0xffffffffffULL);
+		f.first = c->first;
+		f.last = c->last;
+		f.packets = c->packets;
+		f.bytes = c->bytes;
+		f.macSource = MAC(k->w[2]);
+		f.macDest = MAC(k->w[3]);
+		memset(f.ipSource,0,sizeof(f.ipSource));
+		memset(f.ipDest,0,sizeof(f.ipDest));
+		const uint8_t *const ips = reinterpret_cast<const uint8_t *>(&(k->w[4]));
+		if (f.ipv6) {
+			memcpy(f.ipSource,ips,16);
+			memcpy(f.ipDest,ips + 16,16);
+		} else {
+			memcpy(f.ipSource,ips,4);
+			memcpy(f.ipDest,ips + 4,4);
 		}
+		f.portSource = (unsigned int)(k->w[2] >> 48);
+		f.portDest = (unsigned int)(k->w[3] >> 48);
+		f.protocol = (unsigned int)((k->w[0] >> 48) & 0xff);
+		f.tos = (unsigned int)(k->w[0] >> 56);
+		f.vlanId = (unsigned int)((k->w[1] >> 40) & 0xfff);
 	}
 }
 
+void Network::learnBridgeRoute(const MAC &mac,const Address &addr)
+{
+	RWMutex::Lock _l(_lock);
+	_remoteBridgeRoutes.learn(mac,addr); // evicts by LRU and per-bridge quota as needed
+}
+
 void Network::learnBridgedMulticastGroup(void *tPtr,const MulticastGroup &mg,uint64_t now)
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	const unsigned long tmp = (unsigned long)_multicastGroupsBehindMe.size();
 	_multicastGroupsBehindMe.set(mg,now);
 	if (tmp != _multicastGroupsBehindMe.size())
-		_sendUpdatesToMembers(tPtr,&mg);
+		_multicastGroupAdded(mg);
+}
+
+// IGMPv3 and MLDv2 group records: type, aux data length, source count, group, sources, aux data
+static void _snoopGroupRecords(const uint8_t *r,unsigned int len,unsigned int count,const bool v6,std::vector<MulticastGroup> &joined,std::vector<MulticastGroup> &left)
+{
+	const unsigned int alen = (v6) ? 16 : 4;
+	while ((count--)&&(len >= (4 + alen))) {
+		const unsigned int type = r[0];
+		const unsigned int nsrc = ((unsigned int)r[2] << 8) | (unsigned int)r[3];
+		const unsigned int rlen = 4 + alen + (nsrc * alen) + ((unsigned int)r[1] * 4);
+		if (rlen > len)
+			break;
+		if ((v6) ? (r[4] == 0xff) : ((r[4] & 0xf0) == 0xe0)) {
+			// Only a change to including no sources is a leave. Excluding (any
+			// source) or including some sources is a join, and blocking some
+			// sources (6) doesn't change whether we want the group at all.
+			const MulticastGroup mg(MulticastGroup::deriveMulticastGroupForIpMulticast(r + 4,v6));
+			if ((type == 3)&&(!nsrc))
+				left.push_back(mg);
+			else if ((type == 2)||(type == 4)||(((type == 1)||(type == 3)||(type == 5))&&(nsrc)))
+				joined.push_back(mg);
+		}
+		r += rlen;
+		len -= rlen;
+	}
+}
+
+Network::MulticastSnoopResult Network::snoopMulticastMembership(const unsigned int etherType,const uint8_t *data,const unsigned int len,std::vector<MulticastGroup> &joined,std::vector<MulticastGroup> &left)
+{
+	if (etherType == ZT_ETHERTYPE_IPV4) {
+		if ((len < 20)||((data[0] >> 4) != 4)||(data[9] != 0x02)) // IGMP
+			return MULTICAST_SNOOP_NONE;
+		const unsigned int ihl = ((unsigned int)data[0] & 0xf) * 4;
+		if ((ihl < 20)||((ihl + 8) > len))
+			return MULTICAST_SNOOP_NONE;
+		const uint8_t *const igmp = data + ihl;
+		switch(igmp[0]) {
+			case 0x11: // membership query
+				return MULTICAST_SNOOP_QUERY;
+			case 0x12: // v1 report
+			case 0x16: // v2 report
+			case 0x17: // v2 leave
+				if ((igmp[4] & 0xf0) != 0xe0)
+					return MULTICAST_SNOOP_NONE;
+				((igmp[0] == 0x17) ? left : joined).push_back(MulticastGroup::deriveMulticastGroupForIpMulticast(igmp + 4,false));
+				return MULTICAST_SNOOP_REPORT;
+			case 0x22: // v3 report
+				_snoopGroupRecords(igmp + 8,len - (ihl + 8),((unsigned int)igmp[6] << 8) | (unsigned int)igmp[7],false,joined,left);
+				return MULTICAST_SNOOP_REPORT;
+		}
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		if ((len < 40)||((data[0] >> 4) != 6))
+			return MULTICAST_SNOOP_NONE;
+		// MLD always comes after a hop-by-hop header with a router alert
+		unsigned int nh = data[6],p = 40;
+		while ((nh == 0)||(nh == 43)||(nh == 60)) { // hop-by-hop, routing, destination options
+			if ((p + 8) > len)
+				return MULTICAST_SNOOP_NONE;
+			nh = data[p];
+			p += ((unsigned int)data[p + 1] + 1) * 8;
+		}
+		if ((nh != 58)||((p + 8) > len)) // ICMPv6
+			return MULTICAST_SNOOP_NONE;
+		const uint8_t *const mld = data + p;
+		switch(mld[0]) {
+			case 130: // listener query
+				return MULTICAST_SNOOP_QUERY;
+			case 131: // v1 report
+			case 132: // v1 done
+				if (((p + 24) > len)||(mld[8] != 0xff))
+					return MULTICAST_SNOOP_NONE;
+				((mld[0] == 132) ? left : joined).push_back(MulticastGroup::deriveMulticastGroupForIpMulticast(mld + 8,true));
+				return MULTICAST_SNOOP_REPORT;
+			case 143: // v2 report
+				_snoopGroupRecords(mld + 8,len - (p + 8),((unsigned int)mld[6] << 8) | (unsigned int)mld[7],true,joined,left);
+				return MULTICAST_SNOOP_REPORT;
+		}
+	}
+	return MULTICAST_SNOOP_NONE;
+}
+
+void Network::snoopBridgedMulticast(void *tPtr,const unsigned int etherType,const uint8_t *data,const unsigned int len,const uint64_t now)
+{
+	std::vector<MulticastGroup> joined,left;
+	const MulticastSnoopResult r = snoopMulticastMembership(etherType,data,len,joined,left);
+	if (r == MULTICAST_SNOOP_NONE)
+		return;
+
+	RWMutex::Lock _l(_lock);
+	if (r == MULTICAST_SNOOP_QUERY) {
+		_lastBridgedMulticastQuery = now;
+		return;
+	}
+
+	for(std::vector<MulticastGroup>::const_iterator mg(joined.begin());mg!=joined.end();++mg) {
+		const unsigned long tmp = (unsigned long)_multicastGroupsBehindMe.size();
+		_multicastGroupsBehindMe.set(*mg,now);
+		if (tmp != _multicastGroupsBehindMe.size())
+			_multicastGroupAdded(*mg);
+	}
+
+	// With no querier to ask who is left, one host leaving says nothing about the others
+	if ((now - _lastBridgedMulticastQuery) < ZT_MULTICAST_SNOOP_QUERIER_TIMEOUT) {
+		for(std::vector<MulticastGroup>::const_iterator mg(left.begin());mg!=left.end();++mg) {
+			uint64_t *const ts = _multicastGroupsBehindMe.get(*mg);
+			if ((ts)&&((now - *ts) < ((ZT_MULTICAST_LIKE_EXPIRE * 2) - ZT_MULTICAST_SNOOP_LEAVE_DELAY)))
+				*ts = now - ((ZT_MULTICAST_LIKE_EXPIRE * 2) - ZT_MULTICAST_SNOOP_LEAVE_DELAY);
+		}
+	}
 }
 
 Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfMembership &com)
@@ -1271,25 +1997,50 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Certific
 	if (com.networkId() != _id)
 		return Membership::ADD_REJECTED;
 	const Address a(com.issuedTo());
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	Membership &m = _membership(a);
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,com);
+	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,config(),com);
+	if (result == Membership::ADD_ACCEPTED_NEW)
+		_flowCacheInvalidate();
 	if ((result == Membership::ADD_ACCEPTED_NEW)||(result == Membership::ADD_ACCEPTED_REDUNDANT)) {
-		m.pushCredentials(RR,tPtr,RR->node->now(),a,_config,-1,false);
+		m.pushCredentials(RR,tPtr,RR->node->now(),a,config(),-1,false);
 		RR->mc->addCredential(tPtr,com,true);
 	}
 	return result;
 }
 
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfOwnership &coo)
+{
+	if (coo.networkId() != _id)
+		return Membership::ADD_REJECTED;
+	RWMutex::Lock _l(_lock);
+	const Membership::AddCredentialResult result = _membership(coo.issuedTo()).addCredential(RR,tPtr,config(),coo);
+	if (result == Membership::ADD_ACCEPTED_NEW)
+		_flowCacheInvalidate();
+	if ((result == Membership::ADD_ACCEPTED_NEW)||(result == Membership::ADD_ACCEPTED_REDUNDANT)) {
+		// Lets ARP and NDP for this member's addresses be answered locally
+		const uint64_t now = RR->node->now();
+		for(unsigned int i=0;i<coo.thingCount();++i) {
+			if (coo.thingType(i) == CertificateOfOwnership::THING_IPV4_ADDRESS)
+				RR->neighbors->learn(_id,InetAddress(coo.thingValue(i),4,0),coo.issuedTo(),now);
+			else if (coo.thingType(i) == CertificateOfOwnership::THING_IPV6_ADDRESS)
+				RR->neighbors->learn(_id,InetAddress(coo.thingValue(i),16,0),coo.issuedTo(),now);
+		}
+	}
+	return result;
+}
+
 Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev)
 {
 	if (rev.networkId() != _id)
 		return Membership::ADD_REJECTED;
 
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	Membership &m = _membership(rev.target());
 
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,rev);
+	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,config(),rev);
+	if (result == Membership::ADD_ACCEPTED_NEW)
+		_flowCacheInvalidate();
 
 	if ((result == Membership::ADD_ACCEPTED_NEW)&&(rev.fastPropagate())) {
 		Address *a = (Address *)0;
@@ -1314,10 +2065,37 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address
 
 void Network::destroy()
 {
-	Mutex::Lock _l(_lock);
+	RWMutex::Lock _l(_lock);
 	_destroyed = true;
 }
 
+void Network::memoryUsage(MemoryUsage &mu)
+{
+	RWMutex::RLock _l(_lock);
+
+	uint64_t bytes = sizeof(Network) + _configDict.capacity() + _multicastGroupsBehindMe.footprint();
+	bytes += (_myMulticastGroups.capacity() + _newMulticastGroups.capacity()) * sizeof(MulticastGroup);
+	bytes += (1 + _retiredCfgs.size()) * sizeof(_ConfigSnapshot) + _retiredCfgs.capacity() * sizeof(_ConfigSnapshot *);
+	bytes += _flowCache.capacity() * sizeof(_FlowCacheEntry);
+	{
+		AdaptiveMutex::Lock _l2(_memberRates_m);
+		bytes += _memberRates.footprint();
+	}
+	{
+		AdaptiveMutex::Lock _l2(_flows_m);
+		bytes += _flows.footprint();
+	}
+	mu.add(MemoryUsage::NETWORKS,1,bytes);
+
+	bytes = _memberships.footprint();
+	Address *a = (Address *)0;
+	Membership *m = (Membership *)0;
+	Hashtable<Address,Membership>::Iterator i(_memberships);
+	while (i.next(a,m))
+		bytes += m->footprint();
+	mu.add(MemoryUsage::MEMBERSHIPS,_memberships.size(),bytes);
+}
+
 ZT_VirtualNetworkStatus Network::_status() const
 {
 	// assumes _lock is locked
@@ -1329,7 +2107,7 @@ ZT_VirtualNetworkStatus Network::_status() const
 		case NETCONF_FAILURE_NOT_FOUND:
 			return ZT_NETWORK_STATUS_NOT_FOUND;
 		case NETCONF_FAILURE_NONE:
-			return ((_config) ? ZT_NETWORK_STATUS_OK : ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION);
+			return ((config()) ? ZT_NETWORK_STATUS_OK : ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION);
 		default:
 			return ZT_NETWORK_STATUS_PORT_ERROR;
 	}
@@ -1338,26 +2116,34 @@ ZT_VirtualNetworkStatus Network::_status() const
 void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 {
 	// assumes _lock is locked
+	const NetworkConfig &nconf = config();
 	ec->nwid = _id;
 	ec->mac = _mac.toInt();
-	if (_config)
-		Utils::scopy(ec->name,sizeof(ec->name),_config.name);
+	if (nconf)
+		Utils::scopy(ec->name,sizeof(ec->name),nconf.name);
 	else ec->name[0] = (char)0;
 	ec->status = _status();
-	ec->type = (_config) ? (_config.isPrivate() ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC) : ZT_NETWORK_TYPE_PRIVATE;
-	ec->mtu = (_config) ? _config.mtu : ZT_DEFAULT_MTU;
-	ec->physicalMtu = ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 16);
+	ec->type = (nconf) ? (nconf.isPrivate() ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC) : ZT_NETWORK_TYPE_PRIVATE;
+	ec->mtu = (nconf) ? nconf.mtu : ZT_DEFAULT_MTU;
+	ec->physicalMtu = _physicalMtu - (ZT_PACKET_IDX_PAYLOAD + 16);
 	ec->dhcp = 0;
-	std::vector<Address> ab(_config.activeBridges());
-	ec->bridge = ((_config.allowPassiveBridging())||(std::find(ab.begin(),ab.end(),RR->identity.address()) != ab.end())) ? 1 : 0;
-	ec->broadcastEnabled = (_config) ? (_config.enableBroadcast() ? 1 : 0) : 0;
+	std::vector<Address> ab(nconf.activeBridges());
+	ec->bridge = ((nconf.allowPassiveBridging())||(std::find(ab.begin(),ab.end(),RR->identity.address()) != ab.end())) ? 1 : 0;
+	ec->broadcastEnabled = (nconf) ? (nconf.enableBroadcast() ? 1 : 0) : 0;
 	ec->portError = _portError;
-	ec->netconfRevision = (_config) ? (unsigned long)_config.revision : 0;
+	ec->netconfRevision = (nconf) ? (unsigned long)nconf.revision : 0;
+	ec->bridgeRouteCount = _remoteBridgeRoutes.size();
+
+	ec->framesIn = _framesIn;
+	ec->framesOut = _framesOut;
+	ec->bytesIn = _bytesIn;
+	ec->bytesOut = _bytesOut;
+	ec->framesDropped = _framesDropped;
 
 	ec->assignedAddressCount = 0;
 	for(unsigned int i=0;i<ZT_MAX_ZT_ASSIGNED_ADDRESSES;++i) {
-		if (i < _config.staticIpCount) {
-			memcpy(&(ec->assignedAddresses[i]),&(_config.staticIps[i]),sizeof(struct sockaddr_storage));
+		if (i < nconf.staticIpCount) {
+			memcpy(&(ec->assignedAddresses[i]),&(nconf.staticIps[i]),sizeof(struct sockaddr_storage));
 			++ec->assignedAddressCount;
 		} else {
 			memset(&(ec->assignedAddresses[i]),0,sizeof(struct sockaddr_storage));
@@ -1366,8 +2152,8 @@ void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 
 	ec->routeCount = 0;
 	for(unsigned int i=0;i<ZT_MAX_NETWORK_ROUTES;++i) {
-		if (i < _config.routeCount) {
-			memcpy(&(ec->routes[i]),&(_config.routes[i]),sizeof(ZT_VirtualNetworkRoute));
+		if (i < nconf.routeCount) {
+			memcpy(&(ec->routes[i]),&(nconf.routes[i]),sizeof(ZT_VirtualNetworkRoute));
 			++ec->routeCount;
 		} else {
 			memset(&(ec->routes[i]),0,sizeof(ZT_VirtualNetworkRoute));
@@ -1375,59 +2161,78 @@ void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 	}
 }
 
-void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup)
+void Network::announceNewMulticastGroups(void *tPtr,MulticastLikes &likes,CredentialPushes &creds)
 {
-	// Assumes _lock is locked
+	RWMutex::Lock _l(_lock);
+	if ((_newMulticastGroups.empty())||(!config()))
+		return;
 	const uint64_t now = RR->node->now();
 
 	std::vector<MulticastGroup> groups;
-	if (newMulticastGroup)
-		groups.push_back(*newMulticastGroup);
-	else groups = _allMulticastGroups();
+	groups.swap(_newMulticastGroups);
+	std::sort(groups.begin(),groups.end());
+	groups.erase(std::unique(groups.begin(),groups.end()),groups.end());
+
+	// Upstreams get our COM too in case this beat our first full announcement
+	const std::vector<Address> upstreams(RR->topology->upstreamAddresses());
+	for(std::vector<Address>::const_iterator a(upstreams.begin());a!=upstreams.end();++a) {
+		_pushComTo(creds,*a);
+		likes.add(*a,_id,groups);
+	}
+	const Address c(controller());
+	if ( (std::find(upstreams.begin(),upstreams.end(),c) == upstreams.end()) && (!_memberships.contains(c)) ) {
+		_pushComTo(creds,c);
+		likes.add(c,_id,groups);
+	}
+
+	Address *a = (Address *)0;
+	Membership *m = (Membership *)0;
+	Hashtable<Address,Membership>::Iterator i(_memberships);
+	while (i.next(a,m)) {
+		if (m->isAllowedOnNetwork(config())) {
+			m->pushCredentials(RR,tPtr,now,*a,config(),-1,false,&creds);
+			likes.add(*a,_id,groups);
+		}
+	}
+}
+
+void Network::_sendUpdatesToMembers(void *tPtr,MulticastLikes &likes,CredentialPushes &creds)
+{
+	// Assumes _lock is locked
+	const uint64_t now = RR->node->now();
+	const std::vector<MulticastGroup> groups(_allMulticastGroups());
 
-	if ((newMulticastGroup)||((now - _lastAnnouncedMulticastGroupsUpstream) >= ZT_MULTICAST_ANNOUNCE_PERIOD)) {
-		if (!newMulticastGroup)
-			_lastAnnouncedMulticastGroupsUpstream = now;
+	if ((now - _lastAnnouncedMulticastGroupsUpstream) >= ZT_MULTICAST_ANNOUNCE_PERIOD) {
+		_lastAnnouncedMulticastGroupsUpstream = now;
 
 		// Announce multicast groups to upstream peers (roots, etc.) and also send
 		// them our COM so that MULTICAST_GATHER can be authenticated properly.
 		const std::vector<Address> upstreams(RR->topology->upstreamAddresses());
 		for(std::vector<Address>::const_iterator a(upstreams.begin());a!=upstreams.end();++a) {
-			if (_config.com) {
-				Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-				_config.com.serialize(outp);
-				outp.append((uint8_t)0x00);
-				outp.append((uint16_t)0); // no capabilities
-				outp.append((uint16_t)0); // no tags
-				outp.append((uint16_t)0); // no revocations
-				outp.append((uint16_t)0); // no certificates of ownership
-				RR->sw->send(tPtr,outp,true);
-			}
-			_announceMulticastGroupsTo(tPtr,*a,groups);
+			_pushComTo(creds,*a);
+			likes.add(*a,_id,groups);
 		}
 
 		// Also announce to controller, and send COM to simplify and generalize behavior even though in theory it does not need it
 		const Address c(controller());
 		if ( (std::find(upstreams.begin(),upstreams.end(),c) == upstreams.end()) && (!_memberships.contains(c)) ) {
-			if (_config.com) {
-				Packet outp(c,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-				_config.com.serialize(outp);
-				outp.append((uint8_t)0x00);
-				outp.append((uint16_t)0); // no capabilities
-				outp.append((uint16_t)0); // no tags
-				outp.append((uint16_t)0); // no revocations
-				outp.append((uint16_t)0); // no certificates of ownership
-				RR->sw->send(tPtr,outp,true);
-			}
-			_announceMulticastGroupsTo(tPtr,c,groups);
+			_pushComTo(creds,c);
+			likes.add(c,_id,groups);
 		}
 	}
 
-	// Make sure that all "network anchors" have Membership records so we will
-	// push multicasts to them.
-	const std::vector<Address> anchors(_config.anchors());
+	// Make sure that all "network anchors" and multicast replicators have
+	// Membership records so we will push multicasts to them. Relays get our
+	// credentials this way too, which they need before relaying for us.
+	const std::vector<Address> anchors(config().anchors());
 	for(std::vector<Address>::const_iterator a(anchors.begin());a!=anchors.end();++a)
 		_membership(*a);
+	const std::vector<Address> replicators(config().multicastReplicators());
+	for(std::vector<Address>::const_iterator a(replicators.begin());a!=replicators.end();++a)
+		_membership(*a);
+	const std::vector<Address> relays(config().relays());
+	for(std::vector<Address>::const_iterator a(relays.begin());a!=relays.end();++a)
+		_membership(*a);
 
 	// Send credentials and multicast LIKEs to members, upstreams, and controller
 	{
@@ -1435,35 +2240,25 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 		Membership *m = (Membership *)0;
 		Hashtable<Address,Membership>::Iterator i(_memberships);
 		while (i.next(a,m)) {
-			m->pushCredentials(RR,tPtr,now,*a,_config,-1,false);
-			if ( ( m->multicastLikeGate(now) || (newMulticastGroup) ) && (m->isAllowedOnNetwork(_config)) )
-				_announceMulticastGroupsTo(tPtr,*a,groups);
+			m->pushCredentials(RR,tPtr,now,*a,config(),-1,false,&creds);
+			if ( (m->multicastLikeGate(now)) && (m->isAllowedOnNetwork(config())) )
+				likes.add(*a,_id,groups);
 		}
 	}
 }
 
-void Network::_announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups)
+void Network::_pushComTo(CredentialPushes &creds,const Address &peer)
 {
 	// Assumes _lock is locked
-	Packet outp(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
-
-	for(std::vector<MulticastGroup>::const_iterator mg(allMulticastGroups.begin());mg!=allMulticastGroups.end();++mg) {
-		if ((outp.size() + 24) >= ZT_PROTO_MAX_PACKET_LENGTH) {
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
-			outp.reset(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
-		}
-
-		// network ID, MAC, ADI
-		outp.append((uint64_t)_id);
-		mg->mac().appendTo(outp);
-		outp.append((uint32_t)mg->adi());
-	}
+	if (config().com)
+		creds.add(peer,config().com);
+}
 
-	if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH) {
-		outp.compress();
-		RR->sw->send(tPtr,outp,true);
-	}
+void Network::_multicastGroupAdded(const MulticastGroup &mg)
+{
+	// Assumes _lock is locked
+	_newMulticastGroups.push_back(mg);
+	RR->node->multicastGroupsChanged();
 }
 
 std::vector<MulticastGroup> Network::_allMulticastGroups() const
@@ -1473,13 +2268,71 @@ std::vector<MulticastGroup> Network::_allMulticastGroups() const
 	mgs.reserve(_myMulticastGroups.size() + _multicastGroupsBehindMe.size() + 1);
 	mgs.insert(mgs.end(),_myMulticastGroups.begin(),_myMulticastGroups.end());
 	_multicastGroupsBehindMe.appendKeys(mgs);
-	if ((_config)&&(_config.enableBroadcast()))
+	if ((config())&&(config().enableBroadcast()))
 		mgs.push_back(Network::BROADCAST);
 	std::sort(mgs.begin(),mgs.end());
 	mgs.erase(std::unique(mgs.begin(),mgs.end()),mgs.end());
 	return mgs;
 }
 
+void Network::_compileRules(_ConfigSnapshot &cfg) const
+{
+	const NetworkConfig &nconf = cfg.config;
+	cfg.rules.compile(nconf.rules.data(),nconf.ruleCount,RR->identity.address(),nconf.tags);
+	cfg.capabilityRules.resize(nconf.capabilityCount);
+	for(unsigned int c=0;c<nconf.capabilityCount;++c)
+		cfg.capabilityRules[c].compile(nconf.capabilities[c].rules(),nconf.capabilities[c].ruleCount(),RR->identity.address(),nconf.tags);
+
+	cfg.flowCacheable = (ZT_NETWORK_FLOW_CACHE_SIZE > 0)&&(_flowCacheable(nconf.rules.data(),nconf.ruleCount));
+	for(unsigned int c=0;c<nconf.capabilityCount;++c)
+		cfg.flowCacheable = (cfg.flowCacheable)&&(_flowCacheable(nconf.capabilities[c].rules(),nconf.capabilities[c].ruleCount()));
+}
+
+bool Network::_flowKey(_FlowKey &k,const bool inbound,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId)
+{
+	// Only TCP and UDP-like protocols with their ports (and TCP flags) present
+	// are keyed, so that every MATCH that reads the frame reads it from here.
+	unsigned int pos,proto,tos;
+	memset(k.w,0,sizeof(k.w));
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		pos = 4 * (frameData[0] & 0xf);
+		proto = frameData[9];
+		tos = frameData[1];
+		memcpy(&(k.w[4]),frameData + 12,8);
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+		pos = 0;
+		proto = 0;
+		if (!_ipv6GetPayload(frameData,frameLen,pos,proto))
+			return false;
+		tos = ((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f);
+		memcpy(&(k.w[4]),frameData + 8,32);
+	} else {
+		return false;
+	}
+
+	switch(proto) {
+		case 0x06: // TCP
+			if (frameLen <= (pos + 14))
+				return false;
+			k.w[1] |= ((uint64_t)frameData[pos + 13] | ((uint64_t)(frameData[pos + 12] & 0x0f) << 8)) << 52;
+			break;
+		case 0x11: // UDP
+		case 0x84: // SCTP
+		case 0x88: // UDPLite
+			if (frameLen <= (pos + 4))
+				return false;
+			break;
+		default:
+			return false;
+	}
+
+	k.w[0] = ztSource.toInt() | ((inbound) ? 0x10000000000ULL : 0ULL) | ((etherType == ZT_ETHERTYPE_IPV6) ? 0x20000000000ULL : 0ULL) | ((uint64_t)proto << 48) | ((uint64_t)tos << 56);
+	k.w[1] |= ztDest.toInt() | ((uint64_t)(vlanId & 0xfff) << 40);
+	k.w[2] = macSource.toInt() | ((uint64_t)frameData[pos] << 56) | ((uint64_t)frameData[pos + 1] << 48);
+	k.w[3] = macDest.toInt() | ((uint64_t)frameData[pos + 2] << 56) | ((uint64_t)frameData[pos + 3] << 48);
+	return true;
+}
+
 Membership &Network::_membership(const Address &a)
 {
 	// assumes _lock is locked
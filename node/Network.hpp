@@ -28,6 +28,7 @@
 #define ZT_NETWORK_HPP
 
 #include <stdint.h>
+#include <string.h>
 
 #include "../include/ZeroTierOne.h"
 
@@ -40,6 +41,8 @@
 #include "Constants.hpp"
 #include "NonCopyable.hpp"
 #include "Hashtable.hpp"
+#include "BridgeRouteTable.hpp"
+#include "TokenBucket.hpp"
 #include "Address.hpp"
 #include "Mutex.hpp"
 #include "SharedPtr.hpp"
@@ -51,14 +54,34 @@
 #include "Membership.hpp"
 #include "NetworkConfig.hpp"
 #include "CertificateOfMembership.hpp"
+#include "CompiledRules.hpp"
+#include "MemoryUsage.hpp"
+#include "FlowExport.hpp"
 
 #define ZT_NETWORK_MAX_INCOMING_UPDATES 3
 #define ZT_NETWORK_MAX_UPDATE_CHUNKS ((ZT_NETWORKCONFIG_DICT_CAPACITY / 1024) + 1)
 
+/**
+ * Entries in each network's cache of filter verdicts by flow (must be a power of two, 0 to disable)
+ */
+#ifndef ZT_NETWORK_FLOW_CACHE_SIZE
+#define ZT_NETWORK_FLOW_CACHE_SIZE 1024
+#endif
+
+/**
+ * How long a replaced config is kept for readers that may still hold it, in ms
+ */
+#ifndef ZT_NETWORK_CONFIG_RETIRE_DELAY
+#define ZT_NETWORK_CONFIG_RETIRE_DELAY 10000
+#endif
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
 class Peer;
+class Path;
+class MulticastLikes;
+class CredentialPushes;
 
 /**
  * A virtual LAN
@@ -96,11 +119,11 @@ public:
 
 	inline uint64_t id() const { return _id; }
 	inline Address controller() const { return Address(_id >> 24); }
-	inline bool multicastEnabled() const { return (_config.multicastLimit > 0); }
-	inline bool hasConfig() const { return (_config); }
+	inline bool multicastEnabled() const { return (config().multicastLimit > 0); }
+	inline bool hasConfig() const { return (config()); }
 	inline uint64_t lastConfigUpdate() const { return _lastConfigUpdate; }
-	inline ZT_VirtualNetworkStatus status() const { Mutex::Lock _l(_lock); return _status(); }
-	inline const NetworkConfig &config() const { return _config; }
+	inline ZT_VirtualNetworkStatus status() const { RWMutex::RLock _l(_lock); return _status(); }
+	inline const NetworkConfig &config() const { return _currentConfig()->config; }
 	inline const MAC &mac() const { return _mac; }
 
 	/**
@@ -145,6 +168,7 @@ public:
 	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param sourcePeer Source Peer
+	 * @param path Path the frame arrived on
 	 * @param ztDest Destination ZeroTier address
 	 * @param macSource Ethernet layer source address
 	 * @param macDest Ethernet layer destination address
@@ -157,6 +181,7 @@ public:
 	int filterIncomingPacket(
 		void *tPtr,
 		const SharedPtr<Peer> &sourcePeer,
+		const SharedPtr<Path> &path,
 		const Address &ztDest,
 		const MAC &macSource,
 		const MAC &macDest,
@@ -220,7 +245,7 @@ public:
 	 */
 	inline void setAccessDenied()
 	{
-		Mutex::Lock _l(_lock);
+		RWMutex::Lock _l(_lock);
 		_netconfFailure = NETCONF_FAILURE_ACCESS_DENIED;
 	}
 
@@ -229,7 +254,7 @@ public:
 	 */
 	inline void setNotFound()
 	{
-		Mutex::Lock _l(_lock);
+		RWMutex::Lock _l(_lock);
 		_netconfFailure = NETCONF_FAILURE_NOT_FOUND;
 	}
 
@@ -263,20 +288,39 @@ public:
 
 	/**
 	 * Do periodic cleanup and housekeeping tasks
+	 *
+	 * This also refreshes the physical MTU hint reported to the port, which
+	 * is the smallest MTU path MTU discovery has found to a reachable member.
 	 */
 	void clean();
 
 	/**
 	 * Push state to members such as multicast group memberships and latest COM (if needed)
 	 *
+	 * Full lists of our multicast groups for peers that are due for one are
+	 * added to likes, which the caller sends.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param likes Multicast LIKEs to send
+	 * @param creds Credentials to send, which should go before likes
 	 */
-	inline void sendUpdatesToMembers(void *tPtr)
+	inline void sendUpdatesToMembers(void *tPtr,MulticastLikes &likes,CredentialPushes &creds)
 	{
-		Mutex::Lock _l(_lock);
-		_sendUpdatesToMembers(tPtr,(const MulticastGroup *)0);
+		RWMutex::Lock _l(_lock);
+		_sendUpdatesToMembers(tPtr,likes,creds);
 	}
 
+	/**
+	 * Add multicast groups joined since the last call to likes for everyone we announce to
+	 *
+	 * Between the periodic full announcements only these deltas are sent.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param likes Multicast LIKEs to send
+	 * @param creds Credentials to send, which should go before likes
+	 */
+	void announceNewMulticastGroups(void *tPtr,MulticastLikes &likes,CredentialPushes &creds);
+
 	/**
 	 * Find the node on this network that has this MAC behind it (if any)
 	 *
@@ -285,7 +329,7 @@ public:
 	 */
 	inline Address findBridgeTo(const MAC &mac) const
 	{
-		Mutex::Lock _l(_lock);
+		RWMutex::RLock _l(_lock);
 		const Address *const br = _remoteBridgeRoutes.get(mac);
 		return ((br) ? *br : Address());
 	}
@@ -307,6 +351,46 @@ public:
 	 */
 	void learnBridgedMulticastGroup(void *tPtr,const MulticastGroup &mg,uint64_t now);
 
+	/**
+	 * What an IGMP or MLD message says about multicast membership
+	 */
+	enum MulticastSnoopResult
+	{
+		MULTICAST_SNOOP_NONE = 0,   // not IGMP or MLD, or nothing we track
+		MULTICAST_SNOOP_QUERY = 1,  // a querier asking hosts to report
+		MULTICAST_SNOOP_REPORT = 2  // a report or leave, with groups joined and left
+	};
+
+	/**
+	 * Parse an IGMP (v1-v3) or MLD (v1-v2) message from an Ethernet frame payload
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Length of payload
+	 * @param joined Groups reported as joined are appended here
+	 * @param left Groups reported as left are appended here
+	 * @return What the frame was
+	 */
+	static MulticastSnoopResult snoopMulticastMembership(const unsigned int etherType,const uint8_t *data,const unsigned int len,std::vector<MulticastGroup> &joined,std::vector<MulticastGroup> &left);
+
+	/**
+	 * Learn IP multicast groups from IGMP and MLD sent by hosts bridged to our tap
+	 *
+	 * IP multicast groups (see MulticastGroup::joinedByReport()) are learned
+	 * from bridged hosts only this way, not from traffic they send, so we
+	 * subscribe to and receive only what someone behind us has joined. If a
+	 * querier is present, reports are refreshed periodically and leaves are
+	 * honored. Otherwise hosts report once on joining, so learned groups are
+	 * kept until the network goes away.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Length of payload
+	 * @param now Current time
+	 */
+	void snoopBridgedMulticast(void *tPtr,const unsigned int etherType,const uint8_t *data,const unsigned int len,const uint64_t now);
+
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
@@ -319,8 +403,11 @@ public:
 	{
 		if (cap.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(cap.issuedTo()).addCredential(RR,tPtr,_config,cap);
+		RWMutex::Lock _l(_lock);
+		const Membership::AddCredentialResult result = _membership(cap.issuedTo()).addCredential(RR,tPtr,config(),cap);
+		if (result == Membership::ADD_ACCEPTED_NEW)
+			_flowCacheInvalidate();
+		return result;
 	}
 
 	/**
@@ -330,8 +417,11 @@ public:
 	{
 		if (tag.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(tag.issuedTo()).addCredential(RR,tPtr,_config,tag);
+		RWMutex::Lock _l(_lock);
+		const Membership::AddCredentialResult result = _membership(tag.issuedTo()).addCredential(RR,tPtr,config(),tag);
+		if (result == Membership::ADD_ACCEPTED_NEW)
+			_flowCacheInvalidate();
+		return result;
 	}
 
 	/**
@@ -342,12 +432,21 @@ public:
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo)
+	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo);
+
+	/**
+	 * Check whether a member holds a valid certificate of ownership for an IP
+	 *
+	 * @param member Member address
+	 * @param ip IP address (port is ignored)
+	 * @return True if member is allowed on this network and owns this IP
+	 */
+	inline bool memberOwns(const Address &member,const InetAddress &ip) const
 	{
-		if (coo.networkId() != _id)
-			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(coo.issuedTo()).addCredential(RR,tPtr,_config,coo);
+		RWMutex::RLock _l(_lock);
+		const Membership *const m = _memberships.get(member);
+		const NetworkConfig &nconf = config();
+		return ((m)&&(m->isAllowedOnNetwork(nconf))&&(m->hasCertificateOfOwnershipFor(nconf,ip)));
 	}
 
 	/**
@@ -359,8 +458,8 @@ public:
 	 */
 	inline void pushCredentialsNow(void *tPtr,const Address &to,const uint64_t now)
 	{
-		Mutex::Lock _l(_lock);
-		_membership(to).pushCredentials(RR,tPtr,now,to,_config,-1,true);
+		RWMutex::Lock _l(_lock);
+		_membership(to).pushCredentials(RR,tPtr,now,to,config(),-1,true);
 	}
 
 	/**
@@ -378,10 +477,24 @@ public:
 	 */
 	inline void externalConfig(ZT_VirtualNetworkConfig *ec) const
 	{
-		Mutex::Lock _l(_lock);
+		RWMutex::RLock _l(_lock);
 		_externalConfig(ec);
 	}
 
+	/**
+	 * Take the flow counts gathered since the last call and reset them
+	 *
+	 * @param flows Flows are appended here
+	 */
+	void flows(std::vector<FlowExport::Flow> &flows);
+
+	/**
+	 * Add this network and its memberships to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
 	/**
 	 * @return Externally usable pointer-to-pointer exported via the core API
 	 */
@@ -390,12 +503,109 @@ public:
 private:
 	ZT_VirtualNetworkStatus _status() const;
 	void _externalConfig(ZT_VirtualNetworkConfig *ec) const; // assumes _lock is locked
+	void _clean(const uint64_t now,std::vector<Address> &members); // assumes _lock is locked
 	bool _gate(const SharedPtr<Peer> &peer);
-	void _sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup);
-	void _announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups);
+	void _sendUpdatesToMembers(void *tPtr,MulticastLikes &likes,CredentialPushes &creds);
+	void _pushComTo(CredentialPushes &creds,const Address &peer);
+	void _multicastGroupAdded(const MulticastGroup &mg);
 	std::vector<MulticastGroup> _allMulticastGroups() const;
 	Membership &_membership(const Address &a);
 
+	// An immutable config with everything derived from it, replaced as a
+	// whole by setConfiguration() so readers need no lock to look at it
+	struct _ConfigSnapshot
+	{
+		_ConfigSnapshot() : flowCacheable(false),retiredAt(0) {}
+		NetworkConfig config;
+		CompiledRules rules; // config.rules
+		std::vector<CompiledRules> capabilityRules; // rules of config.capabilities[]
+		bool flowCacheable; // false if the rules depend on more than _FlowKey
+		uint64_t retiredAt; // when it was replaced, for freeing it later
+	};
+
+	inline const _ConfigSnapshot *_currentConfig() const { return __atomic_load_n(&_cfg,__ATOMIC_ACQUIRE); }
+	void _compileRules(_ConfigSnapshot &cfg) const;
+
+	// Everything about a TCP or UDP frame that the rules can look at, other
+	// than its size and the credentials we and the peer hold
+	struct _FlowKey
+	{
+		uint64_t w[8];
+		inline bool operator==(const _FlowKey &k) const { return (memcmp(w,k.w,sizeof(w)) == 0); }
+		inline unsigned long hashCode() const
+		{
+			uint64_t h = 0;
+			for(unsigned int i=0;i<8;++i)
+				h = (h + w[i]) * 0x9e3779b97f4a7c15ULL;
+			return (unsigned long)(h >> 32);
+		}
+	};
+
+	// Result of filtering a frame, from the rules and any capability that accepted it
+	struct _FlowVerdict
+	{
+		_FlowVerdict(const Address &ztDest) :
+			ztFinalDest(ztDest),
+			ccLength(0),
+			ccLength2(0),
+			localCapabilityIndex(-1),
+			accept(0),
+			ccWatch(false),
+			ccWatch2(false) {}
+		Address ztFinalDest; // changed by REDIRECT
+		Address cc; // TEE or WATCH target from the rules
+		Address cc2; // TEE or WATCH target from the capability
+		unsigned int ccLength; // 0 for whole frame
+		unsigned int ccLength2;
+		int localCapabilityIndex;
+		int accept; // 0 drop, 1 accept, 2 super-accept
+		bool ccWatch;
+		bool ccWatch2;
+	};
+
+	struct _FlowCacheEntry
+	{
+		_FlowCacheEntry() : v(Address()),generation(0) {}
+		_FlowKey k;
+		_FlowVerdict v;
+		uint64_t generation; // entry is valid if this equals _flowCacheGeneration
+	};
+
+	static bool _flowKey(_FlowKey &k,const bool inbound,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId);
+	inline bool _flowCacheGet(const _FlowKey &k,_FlowVerdict &v) const
+	{
+		const _FlowCacheEntry &e = _flowCache[k.hashCode() & (ZT_NETWORK_FLOW_CACHE_SIZE - 1)];
+		AdaptiveMutex::Lock _l(_flowCache_m);
+		if ((e.generation == _flowCacheGeneration)&&(e.k == k)) {
+			v = e.v;
+			return true;
+		}
+		return false;
+	}
+	inline void _flowCachePut(const _FlowKey &k,const _FlowVerdict &v) const
+	{
+		_FlowCacheEntry &e = _flowCache[k.hashCode() & (ZT_NETWORK_FLOW_CACHE_SIZE - 1)];
+		AdaptiveMutex::Lock _l(_flowCache_m);
+		e.k = k;
+		e.v = v;
+		e.generation = _flowCacheGeneration;
+	}
+	inline void _flowCacheInvalidate() { ++_flowCacheGeneration; } // assumes _lock is locked
+
+	// Frames to and from one member, policed against the network's member rate limit
+	struct _MemberRate
+	{
+		TokenBucket in,out;
+	};
+	bool _memberRateGate(const NetworkConfig &nconf,const Address &member,const bool inbound,const unsigned int len,const uint64_t now);
+
+	// Frames and bytes of one flow since flows() was last called
+	struct _FlowCounts
+	{
+		uint64_t first,last,packets,bytes;
+	};
+	void _countFlow(const bool inbound,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId,const uint64_t now);
+
 	const RuntimeEnvironment *const RR;
 	void *_uPtr;
 	const uint64_t _id;
@@ -404,21 +614,39 @@ private:
 	bool _portInitialized;
 
 	std::vector< MulticastGroup > _myMulticastGroups; // multicast groups that we belong to (according to tap)
+	std::vector< MulticastGroup > _newMulticastGroups; // joined since last announced, sent as deltas
 	Hashtable< MulticastGroup,uint64_t > _multicastGroupsBehindMe; // multicast groups that seem to be behind us and when we last saw them (if we are a bridge)
-	Hashtable< MAC,Address > _remoteBridgeRoutes; // remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
-
-	NetworkConfig _config;
+	uint64_t _lastBridgedMulticastQuery; // last IGMP or MLD query seen from behind us
+	BridgeRouteTable _remoteBridgeRoutes; // remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
+
+	_ConfigSnapshot *_cfg; // published under _lock, read with _currentConfig()
+	std::vector<_ConfigSnapshot *> _retiredCfgs; // freed once older than ZT_NETWORK_CONFIG_RETIRE_DELAY
+	std::string _configDict; // serialized config as last received from the controller, the base for deltas
+	mutable std::vector<_FlowCacheEntry> _flowCache; // direct mapped, allocated when first enabled
+	uint64_t _flowCacheGeneration;
+	AdaptiveMutex _flowCache_m; // filters run read locked, so entries have their own lock
+	Hashtable< Address,_MemberRate > _memberRates;
+	AdaptiveMutex _memberRates_m; // likewise locked on its own
+	Hashtable< _FlowKey,_FlowCounts > _flows; // keyed without TCP flags, only while exporting flows
+	AdaptiveMutex _flows_m;
 	uint64_t _lastConfigUpdate;
 
+	// Frames accepted and dropped by the filters, lock-free and approximate under races
+	volatile uint64_t _framesIn;
+	volatile uint64_t _framesOut;
+	volatile uint64_t _bytesIn;
+	volatile uint64_t _bytesOut;
+	volatile uint64_t _framesDropped;
+
 	struct _IncomingConfigChunk
 	{
-		_IncomingConfigChunk() { memset(this,0,sizeof(_IncomingConfigChunk)); }
+		_IncomingConfigChunk() : ts(0),updateId(0),haveChunks(0),haveBytes(0) {}
 		uint64_t ts;
 		uint64_t updateId;
 		uint64_t haveChunkIds[ZT_NETWORK_MAX_UPDATE_CHUNKS];
 		unsigned long haveChunks;
 		unsigned long haveBytes;
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> data;
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> data; // heap backed and only as big as the update, freed once it's complete
 	};
 	_IncomingConfigChunk _incomingConfigChunks[ZT_NETWORK_MAX_INCOMING_UPDATES];
 
@@ -431,10 +659,11 @@ private:
 		NETCONF_FAILURE_INIT_FAILED
 	} _netconfFailure;
 	int _portError; // return value from port config callback
+	unsigned int _physicalMtu; // smallest discovered path MTU to active members, updated by clean()
 
 	Hashtable<Address,Membership> _memberships;
 
-	Mutex _lock;
+	RWMutex _lock; // read locked only by accessors that change nothing
 
 	AtomicCounter __refCount;
 };
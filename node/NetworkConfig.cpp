@@ -29,9 +29,195 @@
 #include <algorithm>
 
 #include "NetworkConfig.hpp"
+#include "SHA512.hpp"
 
 namespace ZeroTier {
 
+bool NetworkConfig::operator==(const NetworkConfig &nc) const
+{
+	if ((networkId != nc.networkId)||(timestamp != nc.timestamp)||(credentialTimeMaxDelta != nc.credentialTimeMaxDelta)||(revision != nc.revision))
+		return false;
+	if ((issuedTo != nc.issuedTo)||(remoteTraceTarget != nc.remoteTraceTarget)||(flags != nc.flags)||(mtu != nc.mtu)||(multicastLimit != nc.multicastLimit)||(type != nc.type))
+		return false;
+	if ((memberRateLimit != nc.memberRateLimit)||(memberRateBurst != nc.memberRateBurst))
+		return false;
+	if ((specialistCount != nc.specialistCount)||(routeCount != nc.routeCount)||(staticIpCount != nc.staticIpCount)||(authOnlyPathCount != nc.authOnlyPathCount)||(hasMulticastKey != nc.hasMulticastKey)||(ruleCount != nc.ruleCount)||(capabilityCount != nc.capabilityCount)||(tagCount != nc.tagCount)||(certificateOfOwnershipCount != nc.certificateOfOwnershipCount))
+		return false;
+	if (memcmp(specialists,nc.specialists,sizeof(uint64_t) * specialistCount) != 0)
+		return false;
+	if (memcmp(routes,nc.routes,sizeof(ZT_VirtualNetworkRoute) * routeCount) != 0)
+		return false;
+	for(unsigned int i=0;i<staticIpCount;++i) {
+		if (staticIps[i] != nc.staticIps[i])
+			return false;
+	}
+	for(unsigned int i=0;i<authOnlyPathCount;++i) {
+		if (authOnlyPaths[i] != nc.authOnlyPaths[i])
+			return false;
+	}
+	if ((hasMulticastKey)&&(!Utils::secureEq(multicastKey,nc.multicastKey,sizeof(multicastKey))))
+		return false;
+	if ((ruleCount)&&(memcmp(rules.data(),nc.rules.data(),sizeof(ZT_VirtualNetworkRule) * ruleCount) != 0))
+		return false;
+	if ((capabilities != nc.capabilities)||(tags != nc.tags)||(certificatesOfOwnership != nc.certificatesOfOwnership))
+		return false;
+	return ((memcmp(name,nc.name,sizeof(name)) == 0)&&(com == nc.com));
+}
+
+// Fields whose values are binary blobs, in the order they're written, and their dictionary keys
+#define ZT_NETWORKCONFIG_BLOB_FIELD_COUNT 10
+static const struct { unsigned int field; const char *key; } _blobFields[ZT_NETWORKCONFIG_BLOB_FIELD_COUNT] = {
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_COM,ZT_NETWORKCONFIG_DICT_KEY_COM },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_CAPABILITIES,ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_TAGS,ZT_NETWORKCONFIG_DICT_KEY_TAGS },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_CERTIFICATES_OF_OWNERSHIP,ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_SPECIALISTS,ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_ROUTES,ZT_NETWORKCONFIG_DICT_KEY_ROUTES },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_STATIC_IPS,ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_RULES,ZT_NETWORKCONFIG_DICT_KEY_RULES },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_AUTH_ONLY_PATHS,ZT_NETWORKCONFIG_DICT_KEY_AUTH_ONLY_PATHS },
+	{ ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_KEY,ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_KEY }
+};
+
+// Append a blob field's value, or nothing if it's empty
+static void _appendBlob(const NetworkConfig &nc,const unsigned int field,Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b)
+{
+	switch(field) {
+		case ZT_NETWORKCONFIG_BINARY_FIELD_COM:
+			if (nc.com)
+				nc.com.serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_CAPABILITIES:
+			for(unsigned int i=0;i<nc.capabilityCount;++i)
+				nc.capabilities[i].serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_TAGS:
+			for(unsigned int i=0;i<nc.tagCount;++i)
+				nc.tags[i].serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_CERTIFICATES_OF_OWNERSHIP:
+			for(unsigned int i=0;i<nc.certificateOfOwnershipCount;++i)
+				nc.certificatesOfOwnership[i].serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_SPECIALISTS:
+			for(unsigned int i=0;i<nc.specialistCount;++i)
+				b.append((uint64_t)nc.specialists[i]);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_ROUTES:
+			for(unsigned int i=0;i<nc.routeCount;++i) {
+				reinterpret_cast<const InetAddress *>(&(nc.routes[i].target))->serialize(b);
+				reinterpret_cast<const InetAddress *>(&(nc.routes[i].via))->serialize(b);
+				b.append((uint16_t)nc.routes[i].flags);
+				b.append((uint16_t)nc.routes[i].metric);
+			}
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_STATIC_IPS:
+			for(unsigned int i=0;i<nc.staticIpCount;++i)
+				nc.staticIps[i].serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_RULES:
+			if (nc.ruleCount)
+				Capability::serializeRules(b,nc.rules.data(),nc.ruleCount);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_AUTH_ONLY_PATHS:
+			for(unsigned int i=0;i<nc.authOnlyPathCount;++i)
+				nc.authOnlyPaths[i].serialize(b);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_KEY:
+			if (nc.hasMulticastKey)
+				b.append(nc.multicastKey,ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH);
+			break;
+	}
+}
+
+// Decode a blob field's value (may throw)
+static void _readBlob(NetworkConfig &nc,const unsigned int field,const Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b)
+{
+	switch(field) {
+		case ZT_NETWORKCONFIG_BINARY_FIELD_COM:
+			nc.com.deserialize(b,0);
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_CAPABILITIES:
+			try {
+				unsigned int p = 0;
+				while ((p < b.size())&&(nc.capabilities.size() < ZT_MAX_NETWORK_CAPABILITIES)) {
+					Capability cap;
+					p += cap.deserialize(b,p);
+					nc.capabilities.push_back(cap);
+				}
+			} catch ( ... ) {}
+			std::sort(nc.capabilities.begin(),nc.capabilities.end());
+			nc.capabilityCount = (unsigned int)nc.capabilities.size();
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_TAGS:
+			try {
+				unsigned int p = 0;
+				while ((p < b.size())&&(nc.tags.size() < ZT_MAX_NETWORK_TAGS)) {
+					Tag tag;
+					p += tag.deserialize(b,p);
+					nc.tags.push_back(tag);
+				}
+			} catch ( ... ) {}
+			std::sort(nc.tags.begin(),nc.tags.end());
+			nc.tagCount = (unsigned int)nc.tags.size();
+			break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_CERTIFICATES_OF_OWNERSHIP: {
+			unsigned int p = 0;
+			while (p < b.size()) {
+				CertificateOfOwnership coo;
+				p += coo.deserialize(b,p);
+				if (nc.certificatesOfOwnership.size() < ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
+					nc.certificatesOfOwnership.push_back(coo);
+			}
+			nc.certificateOfOwnershipCount = (unsigned int)nc.certificatesOfOwnership.size();
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_SPECIALISTS: {
+			unsigned int p = 0;
+			while ((p + 8) <= b.size()) {
+				if (nc.specialistCount < ZT_MAX_NETWORK_SPECIALISTS)
+					nc.specialists[nc.specialistCount++] = b.at<uint64_t>(p);
+				p += 8;
+			}
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_ROUTES: {
+			unsigned int p = 0;
+			while ((p < b.size())&&(nc.routeCount < ZT_MAX_NETWORK_ROUTES)) {
+				p += reinterpret_cast<InetAddress *>(&(nc.routes[nc.routeCount].target))->deserialize(b,p);
+				p += reinterpret_cast<InetAddress *>(&(nc.routes[nc.routeCount].via))->deserialize(b,p);
+				nc.routes[nc.routeCount].flags = b.at<uint16_t>(p); p += 2;
+				nc.routes[nc.routeCount].metric = b.at<uint16_t>(p); p += 2;
+				++nc.routeCount;
+			}
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_STATIC_IPS: {
+			unsigned int p = 0;
+			while ((p < b.size())&&(nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+				p += nc.staticIps[nc.staticIpCount++].deserialize(b,p);
+			}
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_RULES: {
+			// Decoded at full size and then copied, so the kept vector is no larger than needed
+			std::vector<ZT_VirtualNetworkRule> r(ZT_MAX_NETWORK_RULES);
+			unsigned int p = 0,rc = 0;
+			Capability::deserializeRules(b,p,r.data(),rc,ZT_MAX_NETWORK_RULES);
+			nc.rules.assign(r.begin(),r.begin() + rc);
+			nc.ruleCount = rc;
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_AUTH_ONLY_PATHS: {
+			unsigned int p = 0;
+			while ((p < b.size())&&(nc.authOnlyPathCount < ZT_NETWORKCONFIG_MAX_AUTH_ONLY_PATHS)) {
+				p += nc.authOnlyPaths[nc.authOnlyPathCount++].deserialize(b,p);
+			}
+		}	break;
+		case ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_KEY:
+			if (b.size() == ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH) {
+				memcpy(nc.multicastKey,b.data(),ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH);
+				nc.hasMulticastKey = true;
+			}
+			break;
+	}
+}
+
 bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy) const
 {
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
@@ -53,6 +239,10 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)this->type)) return false;
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name)) return false;
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_MTU,(uint64_t)this->mtu)) return false;
+		if (this->memberRateLimit) {
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_LIMIT,this->memberRateLimit)) return false;
+			if ((this->memberRateBurst)&&(!d.add(ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_BURST,this->memberRateBurst))) return false;
+		}
 
 #ifdef ZT_SUPPORT_OLD_STYLE_NETCONF
 		if (includeLegacy) {
@@ -128,63 +318,11 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 
 		// Then add binary blobs
 
-		if (this->com) {
+		for(unsigned int i=0;i<ZT_NETWORKCONFIG_BLOB_FIELD_COUNT;++i) {
 			tmp->clear();
-			this->com.serialize(*tmp);
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->capabilityCount;++i)
-			this->capabilities[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->tagCount;++i)
-			this->tags[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->certificateOfOwnershipCount;++i)
-			this->certificatesOfOwnership[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->specialistCount;++i)
-			tmp->append((uint64_t)this->specialists[i]);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->routeCount;++i) {
-			reinterpret_cast<const InetAddress *>(&(this->routes[i].target))->serialize(*tmp);
-			reinterpret_cast<const InetAddress *>(&(this->routes[i].via))->serialize(*tmp);
-			tmp->append((uint16_t)this->routes[i].flags);
-			tmp->append((uint16_t)this->routes[i].metric);
-		}
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) return false;
-		}
-
-		tmp->clear();
-		for(unsigned int i=0;i<this->staticIpCount;++i)
-			this->staticIps[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) return false;
-		}
-
-		if (this->ruleCount) {
-			tmp->clear();
-			Capability::serializeRules(*tmp,rules,ruleCount);
+			_appendBlob(*this,_blobFields[i].field,*tmp);
 			if (tmp->size()) {
-				if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) return false;
+				if (!d.add(_blobFields[i].key,*tmp)) return false;
 			}
 		}
 
@@ -197,12 +335,13 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 	return true;
 }
 
-bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d)
+bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &dict)
 {
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index d(dict); // dozens of keys are looked up below
 
 	try {
-		memset(this,0,sizeof(NetworkConfig));
+		*this = NetworkConfig();
 
 		// Fields that are always present, new or old
 		this->networkId = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,0);
@@ -221,6 +360,8 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 		this->remoteTraceTarget = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_TARGET);
 		this->multicastLimit = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
 		d.get(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name,sizeof(this->name));
+		this->memberRateLimit = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_LIMIT,0);
+		this->memberRateBurst = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_BURST,0);
 
 		this->mtu = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MTU,ZT_DEFAULT_MTU);
 		if (this->mtu < 1280)
@@ -268,14 +409,20 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					unsigned int et = Utils::hexStrToUInt(f) & 0xffff;
 					if ((this->ruleCount + 2) > ZT_MAX_NETWORK_RULES) break;
+					ZT_VirtualNetworkRule r;
+					memset(&r,0,sizeof(r));
 					if (et > 0) {
-						this->rules[this->ruleCount].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
-						this->rules[this->ruleCount].v.etherType = (uint16_t)et;
-						++this->ruleCount;
+						r.t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+						r.v.etherType = (uint16_t)et;
+						this->rules.push_back(r);
+						memset(&r,0,sizeof(r));
 					}
-					this->rules[this->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+					r.t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+					this->rules.push_back(r);
+					this->ruleCount = (unsigned int)this->rules.size();
 				}
 			} else {
+				this->rules.resize(1);
 				this->rules[0].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
 				this->ruleCount = 1;
 			}
@@ -295,89 +442,318 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 			this->flags = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_FLAGS,0);
 			this->type = (ZT_VirtualNetworkType)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)ZT_NETWORK_TYPE_PRIVATE);
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp))
-				this->com.deserialize(*tmp,0);
-
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) {
-				try {
-					unsigned int p = 0;
-					while (p < tmp->size()) {
-						Capability cap;
-						p += cap.deserialize(*tmp,p);
-						this->capabilities[this->capabilityCount++] = cap;
-					}
-				} catch ( ... ) {}
-				std::sort(&(this->capabilities[0]),&(this->capabilities[this->capabilityCount]));
+			for(unsigned int i=0;i<ZT_NETWORKCONFIG_BLOB_FIELD_COUNT;++i) {
+				if (d.get(_blobFields[i].key,*tmp))
+					_readBlob(*this,_blobFields[i].field,*tmp);
 			}
+		}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) {
-				try {
-					unsigned int p = 0;
-					while (p < tmp->size()) {
-						Tag tag;
-						p += tag.deserialize(*tmp,p);
-						this->tags[this->tagCount++] = tag;
-					}
-				} catch ( ... ) {}
-				std::sort(&(this->tags[0]),&(this->tags[this->tagCount]));
-			}
+		//printf("~~~\n%s\n~~~\n",d.data());
+		//dump();
+		//printf("~~~\n");
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) {
-				unsigned int p = 0;
-				while (p < tmp->size()) {
-					if (certificateOfOwnershipCount < ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
-						p += certificatesOfOwnership[certificateOfOwnershipCount++].deserialize(*tmp,p);
-					else {
-						CertificateOfOwnership foo;
-						p += foo.deserialize(*tmp,p);
-					}
-				}
-			}
+		delete tmp;
+		return true;
+	} catch ( ... ) {
+		delete tmp;
+		return false;
+	}
+}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) {
-				unsigned int p = 0;
-				while ((p + 8) <= tmp->size()) {
-					if (specialistCount < ZT_MAX_NETWORK_SPECIALISTS)
-						this->specialists[this->specialistCount++] = tmp->at<uint64_t>(p);
-					p += 8;
-				}
+bool NetworkConfig::toBinary(Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b) const
+{
+	try {
+		b.clear();
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_VERSION);
+
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_NETWORK_ID); b.append((uint32_t)8); b.append((uint64_t)this->networkId);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_TIMESTAMP); b.append((uint32_t)8); b.append((uint64_t)this->timestamp);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_CREDENTIAL_TIME_MAX_DELTA); b.append((uint32_t)8); b.append((uint64_t)this->credentialTimeMaxDelta);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_REVISION); b.append((uint32_t)8); b.append((uint64_t)this->revision);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_ISSUED_TO); b.append((uint32_t)8); b.append((uint64_t)this->issuedTo.toInt());
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_REMOTE_TRACE_TARGET); b.append((uint32_t)8); b.append((uint64_t)this->remoteTraceTarget.toInt());
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_FLAGS); b.append((uint32_t)8); b.append((uint64_t)this->flags);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_LIMIT); b.append((uint32_t)4); b.append((uint32_t)this->multicastLimit);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_TYPE); b.append((uint32_t)1); b.append((uint8_t)this->type);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_MTU); b.append((uint32_t)4); b.append((uint32_t)this->mtu);
+		if (this->memberRateLimit) {
+			b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_LIMIT); b.append((uint32_t)8); b.append((uint64_t)this->memberRateLimit);
+			if (this->memberRateBurst) {
+				b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_BURST); b.append((uint32_t)8); b.append((uint64_t)this->memberRateBurst);
 			}
+		}
+		const unsigned int nl = (unsigned int)strnlen(this->name,sizeof(this->name));
+		if (nl) {
+			b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FIELD_NAME); b.append((uint32_t)nl); b.append(this->name,nl);
+		}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) {
-				unsigned int p = 0;
-				while ((p < tmp->size())&&(routeCount < ZT_MAX_NETWORK_ROUTES)) {
-					p += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].target))->deserialize(*tmp,p);
-					p += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].via))->deserialize(*tmp,p);
-					this->routes[this->routeCount].flags = tmp->at<uint16_t>(p); p += 2;
-					this->routes[this->routeCount].metric = tmp->at<uint16_t>(p); p += 2;
-					++this->routeCount;
-				}
-			}
+		for(unsigned int i=0;i<ZT_NETWORKCONFIG_BLOB_FIELD_COUNT;++i) {
+			const unsigned int lp = b.size() + 1;
+			b.append((uint8_t)_blobFields[i].field);
+			b.append((uint32_t)0);
+			_appendBlob(*this,_blobFields[i].field,b);
+			if (b.size() == (lp + 4))
+				b.setSize(lp - 1); // omit empty fields
+			else b.setAt(lp,(uint32_t)(b.size() - (lp + 4)));
+		}
+	} catch ( ... ) {
+		return false;
+	}
+	return true;
+}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) {
-				unsigned int p = 0;
-				while ((p < tmp->size())&&(staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
-					p += this->staticIps[this->staticIpCount++].deserialize(*tmp,p);
-				}
-			}
+bool NetworkConfig::fromBinary(const void *data,unsigned int len)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+	const uint8_t *const eof = p + len;
+	if ((!len)||(!*p)||(*p > ZT_NETWORKCONFIG_BINARY_VERSION))
+		return false;
+	++p;
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) {
-				this->ruleCount = 0;
-				unsigned int p = 0;
-				Capability::deserializeRules(*tmp,p,this->rules,this->ruleCount,ZT_MAX_NETWORK_RULES);
+	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	try {
+		*this = NetworkConfig();
+		this->type = ZT_NETWORK_TYPE_PRIVATE;
+		this->mtu = ZT_DEFAULT_MTU;
+
+		while (p < eof) {
+			if ((eof - p) < 5)
+				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
+			const unsigned int field = p[0];
+			const unsigned int fl = ((unsigned int)p[1] << 24) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 8) | (unsigned int)p[4];
+			p += 5;
+			if (fl > (unsigned int)(eof - p))
+				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_OVERFLOW;
+
+			uint64_t v = 0; // integer value if this field is an integer
+			for(unsigned int i=0;((i<fl)&&(i<8));++i)
+				v = (v << 8) | (uint64_t)p[i];
+
+			switch(field) {
+				case ZT_NETWORKCONFIG_BINARY_FIELD_NETWORK_ID: this->networkId = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_TIMESTAMP: this->timestamp = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_CREDENTIAL_TIME_MAX_DELTA: this->credentialTimeMaxDelta = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_REVISION: this->revision = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_ISSUED_TO: this->issuedTo = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_REMOTE_TRACE_TARGET: this->remoteTraceTarget = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_FLAGS: this->flags = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_LIMIT: this->multicastLimit = (unsigned int)v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_TYPE: this->type = (ZT_VirtualNetworkType)v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_MTU: this->mtu = (unsigned int)v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_LIMIT: this->memberRateLimit = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_BURST: this->memberRateBurst = v; break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_NAME:
+					memset(this->name,0,sizeof(this->name));
+					memcpy(this->name,p,std::min(fl,(unsigned int)sizeof(this->name) - 1));
+					break;
+				case ZT_NETWORKCONFIG_BINARY_FIELD_COM:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_CAPABILITIES:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_TAGS:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_CERTIFICATES_OF_OWNERSHIP:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_SPECIALISTS:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_ROUTES:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_STATIC_IPS:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_RULES:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_AUTH_ONLY_PATHS:
+				case ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_KEY:
+					tmp->copyFrom(p,fl);
+					_readBlob(*this,field,*tmp);
+					break;
+				default: // unknown fields from later versions are skipped
+					break;
 			}
-		}
 
-		//printf("~~~\n%s\n~~~\n",d.data());
-		//dump();
-		//printf("~~~\n");
+			p += fl;
+		}
 
 		delete tmp;
-		return true;
 	} catch ( ... ) {
 		delete tmp;
 		return false;
 	}
+
+	if ((!this->networkId)||(!this->issuedTo))
+		return false;
+	if (this->mtu < 1280)
+		this->mtu = 1280; // minimum MTU allowed by IPv6 standard and others
+	else if (this->mtu > ZT_MAX_MTU)
+		this->mtu = ZT_MAX_MTU;
+	return true;
+}
+
+// One key=value entry of a serialized dictionary, still escaped
+struct _NetworkConfigDictLine
+{
+	const char *l; // start of line (and key)
+	unsigned int ll; // length of line
+	unsigned int kl; // length of key
+};
+
+// Split a serialized dictionary into lines, failing on too many or duplicate keys
+static bool _splitDictLines(const char *d,unsigned int len,_NetworkConfigDictLine *lines,unsigned int &n)
+{
+	n = 0;
+	unsigned int i = 0;
+	while (i < len) {
+		if ((d[i] == 10)||(d[i] == 13)) {
+			++i;
+			continue;
+		}
+		if (n >= ZT_NETWORKCONFIG_DELTA_MAX_KEYS)
+			return false;
+		_NetworkConfigDictLine &dl = lines[n];
+		const unsigned int s = i;
+		while ((i < len)&&(d[i] != 10)&&(d[i] != 13))
+			++i;
+		dl.l = d + s;
+		dl.ll = i - s;
+		dl.kl = 0;
+		while ((dl.kl < dl.ll)&&(dl.l[dl.kl] != '='))
+			++dl.kl;
+		for(unsigned int j=0;j<n;++j) {
+			if ((lines[j].kl == dl.kl)&&(!memcmp(lines[j].l,dl.l,dl.kl)))
+				return false;
+		}
+		++n;
+	}
+	return true;
+}
+
+static int _findDictLine(const _NetworkConfigDictLine *lines,const unsigned int n,const char *k,const unsigned int kl)
+{
+	for(unsigned int i=0;i<n;++i) {
+		if ((lines[i].kl == kl)&&(!memcmp(lines[i].l,k,kl)))
+			return (int)i;
+	}
+	return -1;
+}
+
+static inline bool _isDeltaMetaKey(const char *k,const unsigned int kl)
+{
+	return ( (kl == 2) && ( (!memcmp(k,ZT_NETWORKCONFIG_DELTA_KEY_BASE,2)) || (!memcmp(k,ZT_NETWORKCONFIG_DELTA_KEY_RESULT,2)) || (!memcmp(k,ZT_NETWORKCONFIG_DELTA_KEY_ERASE,2)) ) );
+}
+
+static bool _inKeyList(const char *list,const char *k,const unsigned int kl)
+{
+	const char *p = list;
+	while (*p) {
+		const char *e = p;
+		while ((*e)&&(*e != ','))
+			++e;
+		if ((((unsigned int)(e - p)) == kl)&&(!memcmp(p,k,kl)))
+			return true;
+		p = (*e) ? (e + 1) : e;
+	}
+	return false;
+}
+
+static inline bool _appendDictLine(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,unsigned int &ol,const _NetworkConfigDictLine &dl)
+{
+	char *const out = d.unsafeData(ol + dl.ll + 2);
+	if (!out)
+		return false;
+	if (ol)
+		out[ol++] = (char)10;
+	memcpy(out + ol,dl.l,dl.ll);
+	ol += dl.ll;
+	out[ol] = (char)0;
+	return true;
+}
+
+// Merge a delta into a base without checking either hash
+static bool _mergeDelta(const char *base,unsigned int baseLen,const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &delta,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &result)
+{
+	_NetworkConfigDictLine *const bl = new _NetworkConfigDictLine[ZT_NETWORKCONFIG_DELTA_MAX_KEYS * 2];
+	_NetworkConfigDictLine *const dl = bl + ZT_NETWORKCONFIG_DELTA_MAX_KEYS;
+	unsigned int bn = 0,dn = 0;
+	char erase[1024];
+	bool ok = ((_splitDictLines(base,baseLen,bl,bn))&&(_splitDictLines(delta.data(),delta.sizeBytes(),dl,dn)));
+	delta.get(ZT_NETWORKCONFIG_DELTA_KEY_ERASE,erase,sizeof(erase));
+
+	unsigned int ol = 0;
+	result.clear();
+
+	// Base entries keep their order and are replaced in place, then new entries follow in delta order
+	for(unsigned int i=0;((ok)&&(i<bn));++i) {
+		if (_inKeyList(erase,bl[i].l,bl[i].kl))
+			continue;
+		const int j = _findDictLine(dl,dn,bl[i].l,bl[i].kl);
+		ok = _appendDictLine(result,ol,(j >= 0) ? dl[j] : bl[i]);
+	}
+	for(unsigned int i=0;((ok)&&(i<dn));++i) {
+		if ((!_isDeltaMetaKey(dl[i].l,dl[i].kl))&&(_findDictLine(bl,bn,dl[i].l,dl[i].kl) < 0))
+			ok = _appendDictLine(result,ol,dl[i]);
+	}
+
+	delete [] bl;
+	return ok;
+}
+
+uint64_t NetworkConfig::dictionaryHash(const char *d,unsigned int len)
+{
+	uint8_t h[64];
+	uint64_t r;
+	SHA512::hash(h,d,len);
+	memcpy(&r,h,8);
+	return r;
+}
+
+bool NetworkConfig::makeDelta(const char *base,unsigned int baseLen,const char *target,unsigned int targetLen,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &delta,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &result)
+{
+	_NetworkConfigDictLine *const bl = new _NetworkConfigDictLine[ZT_NETWORKCONFIG_DELTA_MAX_KEYS * 2];
+	_NetworkConfigDictLine *const tl = bl + ZT_NETWORKCONFIG_DELTA_MAX_KEYS;
+	unsigned int bn = 0,tn = 0;
+	char erase[1024];
+	unsigned int el = 0;
+	bool ok = ((_splitDictLines(base,baseLen,bl,bn))&&(_splitDictLines(target,targetLen,tl,tn)));
+
+	for(unsigned int i=0;((ok)&&(i<bn));++i) {
+		if (_findDictLine(tl,tn,bl[i].l,bl[i].kl) < 0) {
+			if (((el + bl[i].kl + 2) > sizeof(erase))||(memchr(bl[i].l,',',bl[i].kl))) {
+				ok = false;
+			} else {
+				if (el)
+					erase[el++] = ',';
+				memcpy(erase + el,bl[i].l,bl[i].kl);
+				el += bl[i].kl;
+			}
+		}
+	}
+	erase[el] = (char)0;
+
+	delta.clear();
+	if (ok) {
+		ok = delta.add(ZT_NETWORKCONFIG_DELTA_KEY_BASE,dictionaryHash(base,baseLen));
+		if ((ok)&&(el))
+			ok = delta.add(ZT_NETWORKCONFIG_DELTA_KEY_ERASE,erase,(int)el);
+	}
+
+	// Carry entries that are new or changed (including the signature) verbatim
+	unsigned int ol = delta.sizeBytes();
+	for(unsigned int i=0;((ok)&&(i<tn));++i) {
+		if (_isDeltaMetaKey(tl[i].l,tl[i].kl)) {
+			ok = false;
+		} else {
+			const int j = _findDictLine(bl,bn,tl[i].l,tl[i].kl);
+			if ((j < 0)||(bl[j].ll != tl[i].ll)||(memcmp(bl[j].l,tl[i].l,tl[i].ll)))
+				ok = _appendDictLine(delta,ol,tl[i]);
+		}
+	}
+
+	delete [] bl;
+
+	if ((ok)&&(_mergeDelta(base,baseLen,delta,result)))
+		return delta.add(ZT_NETWORKCONFIG_DELTA_KEY_RESULT,dictionaryHash(result.data(),result.sizeBytes()));
+	return false;
+}
+
+bool NetworkConfig::applyDelta(const char *base,unsigned int baseLen,const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &delta,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &result)
+{
+	if (delta.getUI(ZT_NETWORKCONFIG_DELTA_KEY_BASE,0) != dictionaryHash(base,baseLen))
+		return false;
+	if (!_mergeDelta(base,baseLen,delta,result))
+		return false;
+	return (delta.getUI(ZT_NETWORKCONFIG_DELTA_KEY_RESULT,0) == dictionaryHash(result.data(),result.sizeBytes()));
 }
 
 } // namespace ZeroTier
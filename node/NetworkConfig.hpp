@@ -50,6 +50,16 @@
 #include "Identity.hpp"
 #include "Utils.hpp"
 
+/**
+ * Maximum number of physical networks on which frames may be sent unencrypted
+ */
+#define ZT_NETWORKCONFIG_MAX_AUTH_ONLY_PATHS 16
+
+/**
+ * Length of a network's multicast group key
+ */
+#define ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH 32
+
 /**
  * Default maximum time delta for COMs, tags, and capabilities
  *
@@ -91,6 +101,11 @@
  */
 #define ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION 0x0000000000000010ULL
 
+/**
+ * Flag: compress frames with zstd for members that support it, for a better ratio at more CPU
+ */
+#define ZT_NETWORKCONFIG_FLAG_COMPRESS_ZSTD 0x0000000000000020ULL
+
 /**
  * Device is an active bridge
  */
@@ -106,6 +121,16 @@
  */
 #define ZT_NETWORKCONFIG_SPECIALIST_TYPE_CIRCUIT_TESTER 0x0000080000000000ULL
 
+/**
+ * Device re-sends multicasts that other members hand to it, so they need not fan them out themselves
+ */
+#define ZT_NETWORKCONFIG_SPECIALIST_TYPE_MULTICAST_REPLICATOR 0x0000100000000000ULL
+
+/**
+ * Device relays for members that can't reach each other directly, if it's closer than a root
+ */
+#define ZT_NETWORKCONFIG_SPECIALIST_TYPE_RELAY 0x0000200000000000ULL
+
 namespace ZeroTier {
 
 // Dictionary capacity needed for max size network config
@@ -145,6 +170,65 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_AUTH "a"
 // Network configuration meta-data flags
 #define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS "f"
+// Hash of the serialized config this node holds, which a controller may send a delta against
+#define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_CONFIG_BASE "cb"
+// Highest binary config encoding version this node can decode, if any
+#define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY_VERSION "bv"
+// Bit mask of config compression methods (ZT_NETWORKCONFIG_COMPRESSION_*) this node can decode
+#define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_COMPRESSION "cz"
+
+// Config chunk flag: assembled dictionary is a delta (see NetworkConfig::makeDelta())
+#define ZT_NETWORKCONFIG_CHUNK_FLAG_DELTA 0x02
+// Config chunk flag: assembled config is binary (see NetworkConfig::toBinary())
+#define ZT_NETWORKCONFIG_CHUNK_FLAG_BINARY 0x04
+// Config chunk flag: assembled chunks are LZ4 compressed (see Packet::lz4Compress()), and
+// decompress to a delta, binary config, or dictionary as the other flags say
+#define ZT_NETWORKCONFIG_CHUNK_FLAG_COMPRESSED 0x08
+
+// Config compression method: LZ4 over the whole serialized config, before it's split into chunks
+#define ZT_NETWORKCONFIG_COMPRESSION_LZ4 1
+
+// Binary config encoding version
+#define ZT_NETWORKCONFIG_BINARY_VERSION 1
+
+// Binary config field types. A binary config is a version byte followed by
+// fields, each a type byte, a 32-bit length, and that many bytes of value.
+// Integers are big-endian and blobs are the same as the corresponding
+// dictionary values. Unknown fields are skipped.
+#define ZT_NETWORKCONFIG_BINARY_FIELD_NETWORK_ID 1
+#define ZT_NETWORKCONFIG_BINARY_FIELD_TIMESTAMP 2
+#define ZT_NETWORKCONFIG_BINARY_FIELD_CREDENTIAL_TIME_MAX_DELTA 3
+#define ZT_NETWORKCONFIG_BINARY_FIELD_REVISION 4
+#define ZT_NETWORKCONFIG_BINARY_FIELD_ISSUED_TO 5
+#define ZT_NETWORKCONFIG_BINARY_FIELD_REMOTE_TRACE_TARGET 6
+#define ZT_NETWORKCONFIG_BINARY_FIELD_FLAGS 7
+#define ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_LIMIT 8
+#define ZT_NETWORKCONFIG_BINARY_FIELD_TYPE 9
+#define ZT_NETWORKCONFIG_BINARY_FIELD_NAME 10
+#define ZT_NETWORKCONFIG_BINARY_FIELD_MTU 11
+#define ZT_NETWORKCONFIG_BINARY_FIELD_COM 12
+#define ZT_NETWORKCONFIG_BINARY_FIELD_CAPABILITIES 13
+#define ZT_NETWORKCONFIG_BINARY_FIELD_TAGS 14
+#define ZT_NETWORKCONFIG_BINARY_FIELD_CERTIFICATES_OF_OWNERSHIP 15
+#define ZT_NETWORKCONFIG_BINARY_FIELD_SPECIALISTS 16
+#define ZT_NETWORKCONFIG_BINARY_FIELD_ROUTES 17
+#define ZT_NETWORKCONFIG_BINARY_FIELD_STATIC_IPS 18
+#define ZT_NETWORKCONFIG_BINARY_FIELD_RULES 19
+#define ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_LIMIT 20
+#define ZT_NETWORKCONFIG_BINARY_FIELD_MEMBER_RATE_BURST 21
+#define ZT_NETWORKCONFIG_BINARY_FIELD_AUTH_ONLY_PATHS 22
+#define ZT_NETWORKCONFIG_BINARY_FIELD_MULTICAST_KEY 23
+
+// Maximum number of keys in a config that a delta can be computed for
+#define ZT_NETWORKCONFIG_DELTA_MAX_KEYS 128
+
+// Keys that only appear in config deltas
+// hash of the config the delta applies to
+#define ZT_NETWORKCONFIG_DELTA_KEY_BASE "dB"
+// hash of the config that results from applying it
+#define ZT_NETWORKCONFIG_DELTA_KEY_RESULT "dR"
+// comma-separated keys to erase from the base
+#define ZT_NETWORKCONFIG_DELTA_KEY_ERASE "dX"
 
 // These dictionary keys are short so they don't take up much room.
 // By convention we use upper case for binary blobs, but it doesn't really matter.
@@ -171,6 +255,10 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_NAME "n"
 // network MTU
 #define ZT_NETWORKCONFIG_DICT_KEY_MTU "mtu"
+// per-member rate limit in bytes/second (hex, 0 or absent for none)
+#define ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_LIMIT "mrl"
+// per-member burst in bytes (hex, 0 or absent for default)
+#define ZT_NETWORKCONFIG_DICT_KEY_MEMBER_RATE_BURST "mrb"
 // credential time max delta in ms
 #define ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA "ctmd"
 // binary serialized certificate of membership
@@ -181,6 +269,10 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_ROUTES "RT"
 // static IPs (binary blob)
 #define ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS "I"
+// physical networks for unencrypted frames (binary blob)
+#define ZT_NETWORKCONFIG_DICT_KEY_AUTH_ONLY_PATHS "AP"
+// multicast group key (binary blob)
+#define ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_KEY "MK"
 // rules (binary blob)
 #define ZT_NETWORKCONFIG_DICT_KEY_RULES "R"
 // capabilities (binary blobs)
@@ -220,26 +312,39 @@ namespace ZeroTier {
 /**
  * Network configuration received from network controller nodes
  *
- * This is a memcpy()'able structure and is safe (in a crash sense) to modify
- * without locks.
+ * Rules, capabilities, tags and certificates of ownership are kept in
+ * vectors holding exactly ruleCount, capabilityCount, etc. entries, since
+ * at their maximum sizes they would make every config hundreds of KB. Code
+ * that fills these in must keep each count equal to its vector's size.
  */
 class NetworkConfig
 {
 public:
-	NetworkConfig()
+	NetworkConfig() :
+		networkId(0),
+		timestamp(0),
+		credentialTimeMaxDelta(0),
+		revision(0),
+		flags(0),
+		mtu(0),
+		multicastLimit(0),
+		memberRateLimit(0),
+		memberRateBurst(0),
+		specialistCount(0),
+		routeCount(0),
+		staticIpCount(0),
+		authOnlyPathCount(0),
+		ruleCount(0),
+		capabilityCount(0),
+		tagCount(0),
+		certificateOfOwnershipCount(0),
+		hasMulticastKey(false),
+		type((ZT_VirtualNetworkType)0)
 	{
-		memset(this,0,sizeof(NetworkConfig));
-	}
-
-	NetworkConfig(const NetworkConfig &nc)
-	{
-		memcpy(this,&nc,sizeof(NetworkConfig));
-	}
-
-	inline NetworkConfig &operator=(const NetworkConfig &nc)
-	{
-		memcpy(this,&nc,sizeof(NetworkConfig));
-		return *this;
+		memset(specialists,0,sizeof(specialists));
+		memset(routes,0,sizeof(routes));
+		memset(multicastKey,0,sizeof(multicastKey));
+		memset(name,0,sizeof(name));
 	}
 
 	/**
@@ -259,6 +364,63 @@ public:
 	 */
 	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d);
 
+	/**
+	 * Write this network config in the binary encoding
+	 *
+	 * This is smaller than a dictionary and decodes without unescaping, but
+	 * should only be sent to nodes that advertise support for it in their
+	 * request meta-data. Legacy fields are never included.
+	 *
+	 * @param b Buffer to fill
+	 * @return True if successful, false if e.g. overflow
+	 */
+	bool toBinary(Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b) const;
+
+	/**
+	 * Read this network config from the binary encoding
+	 *
+	 * @param data Binary config as produced by toBinary()
+	 * @param len Length of data in bytes
+	 * @return True if valid and network config successfully initialized
+	 */
+	bool fromBinary(const void *data,unsigned int len);
+
+	/**
+	 * @param d Serialized config
+	 * @param len Length of d in bytes
+	 * @return Hash identifying a serialized config, used to name delta bases
+	 */
+	static uint64_t dictionaryHash(const char *d,unsigned int len);
+
+	/**
+	 * Compute a delta that brings a holder of one serialized config to another
+	 *
+	 * Deltas work at the level of dictionary entries: entries that are new or
+	 * whose values changed are carried verbatim, and removed keys are listed.
+	 * Since entry order may differ, the config that a recipient ends up with
+	 * is returned in result and is what should be treated as the new base.
+	 *
+	 * @param base Config the recipient holds
+	 * @param baseLen Length of base in bytes
+	 * @param target Config the recipient should end up with
+	 * @param targetLen Length of target in bytes
+	 * @param delta Delta to send
+	 * @param result Config the recipient will hold after applying delta
+	 * @return True if a delta was computed, false to fall back to sending target whole
+	 */
+	static bool makeDelta(const char *base,unsigned int baseLen,const char *target,unsigned int targetLen,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &delta,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &result);
+
+	/**
+	 * Apply a delta computed by makeDelta()
+	 *
+	 * @param base Config held locally
+	 * @param baseLen Length of base in bytes
+	 * @param delta Delta
+	 * @param result Resulting config
+	 * @return False if base is not the delta's base or the result does not match
+	 */
+	static bool applyDelta(const char *base,unsigned int baseLen,const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &delta,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &result);
+
 	/**
 	 * @return True if passive bridging is allowed (experimental)
 	 */
@@ -279,6 +441,11 @@ public:
 	 */
 	inline bool disableCompression() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION) != 0); }
 
+	/**
+	 * @return True if frames should be compressed with zstd where the recipient supports it
+	 */
+	inline bool zstdCompression() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_COMPRESS_ZSTD) != 0); }
+
 	/**
 	 * @return Network type is public (no access control)
 	 */
@@ -302,6 +469,19 @@ public:
 		return r;
 	}
 
+	/**
+	 * @param a Address to check
+	 * @return True if address is an active bridge
+	 */
+	inline bool isActiveBridge(const Address &a) const
+	{
+		for(unsigned int i=0;i<specialistCount;++i) {
+			if ((a == specialists[i])&&((specialists[i] & ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE) != 0))
+				return true;
+		}
+		return false;
+	}
+
 	/**
 	 * @return ZeroTier addresses of "anchor" devices on this network
 	 */
@@ -328,6 +508,58 @@ public:
 		return false;
 	}
 
+	/**
+	 * @return ZeroTier addresses of devices on this network designated as multicast replicators
+	 */
+	inline std::vector<Address> multicastReplicators() const
+	{
+		std::vector<Address> r;
+		for(unsigned int i=0;i<specialistCount;++i) {
+			if ((specialists[i] & ZT_NETWORKCONFIG_SPECIALIST_TYPE_MULTICAST_REPLICATOR) != 0)
+				r.push_back(Address(specialists[i]));
+		}
+		return r;
+	}
+
+	/**
+	 * @param a Address to check
+	 * @return True if address is a multicast replicator
+	 */
+	inline bool isMulticastReplicator(const Address &a) const
+	{
+		for(unsigned int i=0;i<specialistCount;++i) {
+			if ((a == specialists[i])&&((specialists[i] & ZT_NETWORKCONFIG_SPECIALIST_TYPE_MULTICAST_REPLICATOR) != 0))
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @return ZeroTier addresses of devices on this network designated as relays
+	 */
+	inline std::vector<Address> relays() const
+	{
+		std::vector<Address> r;
+		for(unsigned int i=0;i<specialistCount;++i) {
+			if ((specialists[i] & ZT_NETWORKCONFIG_SPECIALIST_TYPE_RELAY) != 0)
+				r.push_back(Address(specialists[i]));
+		}
+		return r;
+	}
+
+	/**
+	 * @param a Address to check
+	 * @return True if address is a relay
+	 */
+	inline bool isRelay(const Address &a) const
+	{
+		for(unsigned int i=0;i<specialistCount;++i) {
+			if ((a == specialists[i])&&((specialists[i] & ZT_NETWORKCONFIG_SPECIALIST_TYPE_RELAY) != 0))
+				return true;
+		}
+		return false;
+	}
+
 	/**
 	 * @param fromPeer Peer attempting to bridge other Ethernet peers onto network
 	 * @return True if this network allows bridging
@@ -363,7 +595,7 @@ public:
 	 */
 	inline operator bool() const { return (networkId != 0); }
 
-	inline bool operator==(const NetworkConfig &nc) const { return (memcmp(this,&nc,sizeof(NetworkConfig)) == 0); }
+	bool operator==(const NetworkConfig &nc) const;
 	inline bool operator!=(const NetworkConfig &nc) const { return (!(*this == nc)); }
 
 	/**
@@ -392,6 +624,19 @@ public:
 		return false;
 	}
 
+	/**
+	 * @param phy Physical address of a path
+	 * @return True if frames on this network may be sent over this path with a MAC but no encryption
+	 */
+	inline bool authOnlyPath(const InetAddress &phy) const
+	{
+		for(unsigned int i=0;i<authOnlyPathCount;++i) {
+			if (authOnlyPaths[i].containsAddress(phy))
+				return true;
+		}
+		return false;
+	}
+
 	const Capability *capability(const uint32_t id) const
 	{
 		for(unsigned int i=0;i<capabilityCount;++i) {
@@ -455,6 +700,16 @@ public:
 	 */
 	unsigned int multicastLimit;
 
+	/**
+	 * Maximum bytes per second of frames to or from any one member, or 0 for no limit
+	 */
+	uint64_t memberRateLimit;
+
+	/**
+	 * Bytes a member may send or receive at once before memberRateLimit applies (0 for default)
+	 */
+	uint64_t memberRateBurst;
+
 	/**
 	 * Number of specialists
 	 */
@@ -470,6 +725,11 @@ public:
 	 */
 	unsigned int staticIpCount;
 
+	/**
+	 * Number of physical networks designated for authenticated-only frames
+	 */
+	unsigned int authOnlyPathCount;
+
 	/**
 	 * Number of rule table entries
 	 */
@@ -509,24 +769,47 @@ public:
 	InetAddress staticIps[ZT_MAX_ZT_ASSIGNED_ADDRESSES];
 
 	/**
-	 * Base network rules
+	 * Physical networks (IP/bits) over which frames are sent with a MAC but not encrypted
+	 *
+	 * For private links where confidentiality is already provided, this
+	 * skips the cipher while still authenticating every frame, unlike a
+	 * trusted path which skips both and is configured per node.
+	 */
+	InetAddress authOnlyPaths[ZT_NETWORKCONFIG_MAX_AUTH_ONLY_PATHS];
+
+	/**
+	 * True if multicastKey is set and multicasts may be sent armored with it
+	 */
+	bool hasMulticastKey;
+
+	/**
+	 * Symmetric key shared by all members for encrypt-once multicast
+	 *
+	 * Multicast frames are armored with this once and the same ciphertext is
+	 * sent to every recipient that supports it, instead of once per recipient
+	 * with each peer key. See ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012.
+	 */
+	uint8_t multicastKey[ZT_NETWORKCONFIG_MULTICAST_KEY_LENGTH];
+
+	/**
+	 * Base network rules (at most ZT_MAX_NETWORK_RULES)
 	 */
-	ZT_VirtualNetworkRule rules[ZT_MAX_NETWORK_RULES];
+	std::vector<ZT_VirtualNetworkRule> rules;
 
 	/**
-	 * Capabilities for this node on this network, in ascending order of capability ID
+	 * Capabilities for this node on this network, in ascending order of capability ID (at most ZT_MAX_NETWORK_CAPABILITIES)
 	 */
-	Capability capabilities[ZT_MAX_NETWORK_CAPABILITIES];
+	std::vector<Capability> capabilities;
 
 	/**
-	 * Tags for this node on this network, in ascending order of tag ID
+	 * Tags for this node on this network, in ascending order of tag ID (at most ZT_MAX_NETWORK_TAGS)
 	 */
-	Tag tags[ZT_MAX_NETWORK_TAGS];
+	std::vector<Tag> tags;
 
 	/**
-	 * Certificates of ownership for this network member
+	 * Certificates of ownership for this network member (at most ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
 	 */
-	CertificateOfOwnership certificatesOfOwnership[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
+	std::vector<CertificateOfOwnership> certificatesOfOwnership;
 
 	/**
 	 * Network type (currently just public or private)
@@ -71,6 +71,22 @@ public:
 		 */
 		virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig) = 0;
 
+		/**
+		 * Send a configuration that has already been serialized
+		 *
+		 * This lets controllers cache and resend a signed configuration without
+		 * rebuilding it, or send only a delta against the config a member holds.
+		 * Deltas are never sent to this node itself.
+		 *
+		 * @param nwid Network ID
+		 * @param requestPacketId Request packet ID to send OK(NETWORK_CONFIG_REQUEST) or 0 to send NETWORK_CONFIG (push)
+		 * @param destination Destination peer Address
+		 * @param conf Configuration as produced by NetworkConfig::toDictionary(), makeDelta(), or toBinary()
+		 * @param confLen Length of conf in bytes not including any terminating NULL
+		 * @param chunkFlags ZT_NETWORKCONFIG_CHUNK_FLAG_DELTA for a delta, ZT_NETWORKCONFIG_CHUNK_FLAG_BINARY for a binary config, or 0, plus ZT_NETWORKCONFIG_CHUNK_FLAG_COMPRESSED if conf is compressed
+		 */
+		virtual void ncSendSerializedConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const void *conf,unsigned int confLen,uint8_t chunkFlags) = 0;
+
 		/**
 		 * Send revocation to a node
 		 *
@@ -79,6 +95,15 @@ public:
 		 */
 		virtual void ncSendRevocation(const Address &destination,const Revocation &rev) = 0;
 
+		/**
+		 * Send several revocations to a node, packed into as few packets as possible
+		 *
+		 * @param destination Destination node address
+		 * @param revs Revocations to send
+		 * @param count Number of revocations
+		 */
+		virtual void ncSendRevocations(const Address &destination,const Revocation *revs,unsigned int count) = 0;
+
 		/**
 		 * Send a network configuration request error
 		 *
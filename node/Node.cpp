@@ -29,6 +29,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "../version.h"
 
@@ -45,8 +46,19 @@
 #include "Address.hpp"
 #include "Identity.hpp"
 #include "SelfAwareness.hpp"
+#include "SignatureCache.hpp"
+#include "NeighborCache.hpp"
+#include "MulticastLikes.hpp"
+#include "CredentialPushes.hpp"
+#include "DeferredPackets.hpp"
+#include "CryptoPipeline.hpp"
+#include "Bench.hpp"
+#include "Capture.hpp"
+#include "FlowExport.hpp"
+#include "Cluster.hpp"
 #include "Network.hpp"
 #include "Trace.hpp"
+#include "SHA512.hpp"
 
 namespace ZeroTier {
 
@@ -59,22 +71,38 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,uint6
 	RR(&_RR),
 	_uPtr(uptr),
 	_networks(8),
+	_networkSnapshot(new _NetworkSnapshot()),
+	_pingWheel(ZT_CORE_TIMER_TASK_GRANULARITY,now),
 	_now(now),
 	_lastPingCheck(0),
-	_lastHousekeepingRun(0)
+	_lastHousekeepingRun(0),
+	_lastMulticastAnnouncement(0),
+	_multicastGroupsChanged(0)
 {
-	if (callbacks->version != 0)
-		throw ZT_EXCEPTION_INVALID_ARGUMENT;
-	memcpy(&_cb,callbacks,sizeof(ZT_Node_Callbacks));
+	// Version 0 callback structs end before wirePacketBatchSendFunction, version 1 before deferredPacketsFunction, version 2 before cryptoJobsFunction
+	if (callbacks->version == 0) {
+		memset(&_cb,0,sizeof(ZT_Node_Callbacks));
+		memcpy(&_cb,callbacks,offsetof(ZT_Node_Callbacks,wirePacketBatchSendFunction));
+	} else if (callbacks->version == 1) {
+		memset(&_cb,0,sizeof(ZT_Node_Callbacks));
+		memcpy(&_cb,callbacks,offsetof(ZT_Node_Callbacks,deferredPacketsFunction));
+	} else if (callbacks->version == 2) {
+		memset(&_cb,0,sizeof(ZT_Node_Callbacks));
+		memcpy(&_cb,callbacks,offsetof(ZT_Node_Callbacks,cryptoJobsFunction));
+	} else if (callbacks->version == 3) {
+		memcpy(&_cb,callbacks,sizeof(ZT_Node_Callbacks));
+	} else throw ZT_EXCEPTION_INVALID_ARGUMENT;
 
 	// Initialize non-cryptographic PRNG from a good random source
 	Utils::getSecureRandom((void *)_prngState,sizeof(_prngState));
 
 	_online = false;
+	_multipathMode = false;
+	_peerIdleTimeout = ZT_PEER_ACTIVITY_TIMEOUT;
+	_ecn = false;
 
 	memset(_expectingRepliesToBucketPtr,0,sizeof(_expectingRepliesToBucketPtr));
 	memset(_expectingRepliesTo,0,sizeof(_expectingRepliesTo));
-	memset(_lastIdentityVerification,0,sizeof(_lastIdentityVerification));
 
 	uint64_t idtmp[2];
 	idtmp[0] = 0; idtmp[1] = 0;
@@ -106,18 +134,47 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,uint6
 		}
 	}
 
+	// Derive the key used to encrypt secrets (e.g. peer keys) in cached state
+	{
+		uint8_t h[64];
+		SHA512::hash(h,RR->secretIdentityStr,(unsigned int)strlen(RR->secretIdentityStr));
+		memcpy(RR->stateKey,h,sizeof(RR->stateKey));
+		Utils::burn(h,sizeof(h));
+	}
+
 	try {
+		RR->metrics = new Metrics();
+		RR->ptrace = new PacketTrace();
+		RR->latency = new Latency();
 		RR->t = new Trace(RR);
 		RR->sw = new Switch(RR);
 		RR->mc = new Multicaster(RR);
 		RR->topology = new Topology(RR,tptr);
 		RR->sa = new SelfAwareness(RR);
+		RR->sc = new SignatureCache();
+		RR->neighbors = new NeighborCache();
+		RR->dp = new DeferredPackets();
+		RR->bench = new Bench(RR);
+		RR->capture = new Capture();
+		RR->flowExport = new FlowExport();
+		if (_cb.cryptoJobsFunction)
+			RR->cp = new CryptoPipeline();
 	} catch ( ... ) {
+		delete RR->cp;
+		delete RR->flowExport;
+		delete RR->capture;
+		delete RR->bench;
+		delete RR->dp;
+		delete RR->neighbors;
+		delete RR->sc;
 		delete RR->sa;
 		delete RR->topology;
 		delete RR->mc;
 		delete RR->sw;
 		delete RR->t;
+		delete RR->latency;
+		delete RR->ptrace;
+		delete RR->metrics;
 		throw;
 	}
 
@@ -129,12 +186,168 @@ Node::~Node()
 	{
 		Mutex::Lock _l(_networks_m);
 		_networks.clear(); // destroy all networks before shutdown
+		delete _networkSnapshot;
+		_networkSnapshot = (_NetworkSnapshot *)0;
+		for(std::vector<_NetworkSnapshot *>::iterator s(_retiredNetworkSnapshots.begin());s!=_retiredNetworkSnapshots.end();++s)
+			delete *s;
+		_retiredNetworkSnapshots.clear();
 	}
+	delete RR->cluster;
+	delete RR->cp;
+	delete RR->flowExport;
+	delete RR->capture;
+	delete RR->bench;
+	delete RR->dp;
+	delete RR->neighbors;
+	delete RR->sc;
 	delete RR->sa;
 	delete RR->topology;
 	delete RR->mc;
 	delete RR->sw;
 	delete RR->t;
+	delete RR->latency;
+	delete RR->ptrace;
+	delete RR->metrics;
+}
+
+namespace {
+// Packets queued by Node::SendBatch on this thread. The buffers are only
+// allocated the first time a thread opens a batch.
+struct _SendBatchState
+{
+	_SendBatchState() : node((Node *)0),tPtr((void *)0),depth(0),count(0),bytes(0),flushing(false) {}
+	Node *node;
+	void *tPtr;
+	unsigned int depth;
+	unsigned int count;
+	unsigned int bytes;
+	bool flushing;
+	ZT_WirePacket packets[ZT_SEND_BATCH_MAX_PACKETS];
+	InetAddress addrs[ZT_SEND_BATCH_MAX_PACKETS];
+	uint8_t data[ZT_SEND_BATCH_MAX_BYTES];
+};
+struct _SendBatchHolder
+{
+	_SendBatchHolder() : s((_SendBatchState *)0) {}
+	~_SendBatchHolder() { delete s; }
+	_SendBatchState *s;
+};
+static thread_local _SendBatchHolder _sendBatch;
+} // anonymous namespace
+
+Node::SendBatch::SendBatch(Node *n,void *tPtr,const bool enable) :
+	_active(false)
+{
+	if ((!enable)||(!n->_cb.wirePacketBatchSendFunction))
+		return;
+	_SendBatchState *s = _sendBatch.s;
+	if (!s)
+		_sendBatch.s = s = new _SendBatchState();
+	if ((s->flushing)||((s->depth)&&(s->node != n)))
+		return;
+	s->node = n;
+	++s->depth;
+	_active = true;
+}
+
+Node::SendBatch::~SendBatch()
+{
+	if (_active) {
+		_SendBatchState *const s = _sendBatch.s;
+		if (--s->depth == 0) {
+			s->node->_flushBatch();
+			s->node = (Node *)0;
+		}
+	}
+}
+
+void Node::_fillPeer(const SharedPtr<Peer> &peer,ZT_Peer *p) const
+{
+	const uint64_t now = _now;
+	p->address = peer->address().toInt();
+	if (peer->remoteVersionKnown()) {
+		p->versionMajor = peer->remoteVersionMajor();
+		p->versionMinor = peer->remoteVersionMinor();
+		p->versionRev = peer->remoteVersionRevision();
+	} else {
+		p->versionMajor = -1;
+		p->versionMinor = -1;
+		p->versionRev = -1;
+	}
+	p->latency = peer->latency();
+	p->role = RR->topology->role(peer->identity().address());
+	p->compressionBytesIn = peer->compressionBytesIn();
+	p->compressionBytesSaved = peer->compressionBytesSaved();
+	p->compressionBytesSkipped = peer->compressionBytesSkipped();
+	p->compressionZstdBytesIn = peer->compressionZstdBytesIn();
+	p->compressionZstdBytesSaved = peer->compressionZstdBytesSaved();
+	p->zstd = (peer->zstdEnabled()) ? 1 : 0;
+	p->packetsIn = peer->packetsIn();
+	p->packetsOut = peer->packetsOut();
+	p->bytesIn = peer->bytesIn();
+	p->bytesOut = peer->bytesOut();
+	p->packetsDropped = peer->packetsDropped();
+	p->lastActivity = peer->lastActivity();
+
+	std::vector< SharedPtr<Path> > paths(peer->paths(now));
+	SharedPtr<Path> bestp(peer->getBestPath(now,false));
+	p->pathCount = 0;
+	for(std::vector< SharedPtr<Path> >::iterator path(paths.begin());((path!=paths.end())&&(p->pathCount < ZT_MAX_PEER_NETWORK_PATHS));++path) {
+		const InetAddress pa((*path)->address());
+		memcpy(&(p->paths[p->pathCount].address),&pa,sizeof(struct sockaddr_storage));
+		p->paths[p->pathCount].lastSend = (*path)->lastOut();
+		p->paths[p->pathCount].lastReceive = (*path)->lastIn();
+		p->paths[p->pathCount].trustedPathId = RR->topology->getOutboundPathTrust(pa);
+		p->paths[p->pathCount].linkQuality = (int)(*path)->linkQuality();
+		p->paths[p->pathCount].fec = ((*path)->fecActive(now)) ? 1 : 0;
+		p->paths[p->pathCount].fecRepaired = (*path)->fecRepaired();
+		p->paths[p->pathCount].expired = 0;
+		p->paths[p->pathCount].preferred = ((*path) == bestp) ? 1 : 0;
+		++p->pathCount;
+	}
+}
+
+bool Node::_batchPacket(void *tPtr,const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl)
+{
+	_SendBatchState *const s = _sendBatch.s;
+	if ((!s)||(!s->depth)||(s->node != this)||(s->flushing))
+		return false;
+	if ((s->count)&&((s->count >= ZT_SEND_BATCH_MAX_PACKETS)||((s->bytes + len) > ZT_SEND_BATCH_MAX_BYTES)||(s->tPtr != tPtr)))
+		_flushBatch();
+	if (len > ZT_SEND_BATCH_MAX_BYTES)
+		return false;
+	const unsigned int i = s->count++;
+	s->tPtr = tPtr;
+	s->addrs[i] = addr;
+	memcpy(s->data + s->bytes,data,len);
+	ZT_WirePacket &p = s->packets[i];
+	p.localSocket = localSocket;
+	p.remoteAddress = reinterpret_cast<const struct sockaddr_storage *>(&(s->addrs[i]));
+	p.packetData = s->data + s->bytes;
+	p.packetLength = len;
+	p.ttl = ttl;
+	s->bytes += len;
+	return true;
+}
+
+void Node::_flushBatch()
+{
+	_SendBatchState *const s = _sendBatch.s;
+	if (!s->count)
+		return;
+	// Anything sent from within the host's callback goes out directly
+	s->flushing = true;
+	try {
+		if (s->count == 1) {
+			const ZT_WirePacket &p = s->packets[0];
+			_cb.wirePacketSendFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,s->tPtr,p.localSocket,p.remoteAddress,p.packetData,p.packetLength,p.ttl);
+		} else {
+			_cb.wirePacketBatchSendFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,s->tPtr,s->packets,s->count);
+		}
+	} catch ( ... ) {}
+	s->flushing = false;
+	s->count = 0;
+	s->bytes = 0;
 }
 
 ZT_ResultCode Node::processWirePacket(
@@ -144,10 +357,13 @@ ZT_ResultCode Node::processWirePacket(
 	const struct sockaddr_storage *remoteAddress,
 	const void *packetData,
 	unsigned int packetLength,
-	volatile uint64_t *nextBackgroundTaskDeadline)
+	volatile uint64_t *nextBackgroundTaskDeadline,
+	unsigned int ecn)
 {
 	_now = now;
-	RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	Latency::Scope _ls(RR->latency,Latency::WIRE_PACKET);
+	RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength,ecn);
+	_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
 	return ZT_RESULT_OK;
 }
 
@@ -164,18 +380,156 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	volatile uint64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
-	SharedPtr<Network> nw(this->network(nwid));
+	Latency::Scope _ls(RR->latency,Latency::FRAME_PACKET);
+	const SharedPtr<Network> &nw = this->network(nwid);
 	if (nw) {
 		RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,frameData,frameLength);
+		_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
+ZT_ResultCode Node::processWirePackets(
+	void *tptr,
+	uint64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	SendBatch _sb(this,tptr);
+	for(unsigned int i=0;i<packetCount;++i) {
+		try {
+			Latency::Scope _ls(RR->latency,Latency::WIRE_PACKET);
+			RR->sw->onRemotePacket(tptr,packets[i].localSocket,*(reinterpret_cast<const InetAddress *>(packets[i].remoteAddress)),packets[i].packetData,packets[i].packetLength,(packets[i].ttl & ZT_WIRE_PACKET_ECN_MASK) >> ZT_WIRE_PACKET_ECN_SHIFT);
+		} catch (std::bad_alloc &exc) {
+			throw;
+		} catch ( ... ) {} // invalid packets are simply dropped, as in processWirePacket()
+	}
+	_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::processVirtualNetworkFrames(
+	void *tptr,
+	uint64_t now,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	ZT_ResultCode rc = ZT_RESULT_OK;
+	SendBatch _sb(this,tptr);
+	const SharedPtr<Network> *nw = &_nullNetwork;
+	uint64_t nwid = 0;
+	for(unsigned int i=0;i<frameCount;++i) {
+		const ZT_VirtualNetworkFrame &f = frames[i];
+		Latency::Scope _ls(RR->latency,Latency::FRAME_PACKET);
+		if ((!*nw)||(f.nwid != nwid)) {
+			nwid = f.nwid;
+			nw = &(this->network(nwid));
+		}
+		if (*nw) {
+			RR->sw->onLocalEthernet(tptr,*nw,MAC(f.sourceMac),MAC(f.destMac),f.etherType,f.vlanId,f.frameData,f.frameLength);
+		} else rc = ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
+	}
+	_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
+	return rc;
+}
+
+void Node::flows(std::vector<FlowExport::Flow> &flows)
+{
+	const unsigned long before = (unsigned long)flows.size();
+	const std::vector< SharedPtr<Network> > nw(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator n(nw.begin());n!=nw.end();++n)
+		(*n)->flows(flows);
+	RR->metrics->add(Metrics::FLOWS_EXPORTED,(uint64_t)(flows.size() - before));
+}
+
+void Node::memoryUsage(MemoryUsage &mu)
+{
+	RR->topology->memoryUsage(mu);
+	RR->sw->memoryUsage(mu);
+	RR->mc->memoryUsage(mu);
+	RR->dp->memoryUsage(mu);
+	if (RR->cp)
+		RR->cp->memoryUsage(mu);
+	const std::vector< SharedPtr<Network> > nw(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator n(nw.begin());n!=nw.end();++n)
+		(*n)->memoryUsage(mu);
+}
+
+ZT_ResultCode Node::processDeferredPackets(void *tptr,uint64_t now,unsigned int maxPackets,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	SendBatch _sb(this,tptr);
+	RR->dp->process(RR,tptr,maxPackets);
+	_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::processCryptoJobs(void *tptr,uint64_t now,unsigned int maxJobs,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	if (RR->cp) {
+		SendBatch _sb(this,tptr);
+		RR->cp->process(RR,tptr,maxJobs);
+		_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
+	}
+	return ZT_RESULT_OK;
+}
+
+// WHOIS lookups and multicast announcements waiting on their batch windows
+// and packets held back by the egress cap need the background task deadline
+// brought forward, since it's otherwise at least a timer tick away
+void Node::_flushDeferred(void *tptr,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	const uint64_t deadlines[3] = { RR->sw->flushWhoisRequests(tptr,now),RR->sw->drainEgress(tptr,now),_flushMulticastAnnouncements(tptr,now) };
+	uint64_t d = 0;
+	for(unsigned int i=0;i<3;++i) {
+		if ((deadlines[i])&&((!d)||(deadlines[i] < d)))
+			d = deadlines[i];
+	}
+	if ((d)&&(nextBackgroundTaskDeadline)&&(d < *nextBackgroundTaskDeadline))
+		*nextBackgroundTaskDeadline = d;
+}
+
+// Sends multicast groups joined on any network since the last batch, packed
+// together for each recipient, and returns when the next batch may go or 0
+uint64_t Node::_flushMulticastAnnouncements(void *tptr,uint64_t now)
+{
+	if (!__atomic_load_n(&_multicastGroupsChanged,__ATOMIC_ACQUIRE))
+		return 0;
+	Mutex::Lock ml(_multicastAnnouncement_m);
+	if ((now - _lastMulticastAnnouncement) < ZT_MULTICAST_ANNOUNCE_BATCH_WINDOW)
+		return (_lastMulticastAnnouncement + ZT_MULTICAST_ANNOUNCE_BATCH_WINDOW);
+	if (!__atomic_exchange_n(&_multicastGroupsChanged,0,__ATOMIC_ACQ_REL))
+		return 0;
+	_lastMulticastAnnouncement = now;
+
+	std::vector< SharedPtr<Network> > networks;
+	{
+		Mutex::Lock _l(_networks_m);
+		Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(_networks);
+		uint64_t *k = (uint64_t *)0;
+		SharedPtr<Network> *v = (SharedPtr<Network> *)0;
+		while (i.next(k,v))
+			networks.push_back(*v);
+	}
+	MulticastLikes likes;
+	CredentialPushes creds;
+	for(std::vector< SharedPtr<Network> >::const_iterator n(networks.begin());n!=networks.end();++n)
+		(*n)->announceNewMulticastGroups(tptr,likes,creds);
+	creds.send(RR,tptr);
+	likes.send(RR,tptr);
+	return 0;
+}
+
 // Closure used to ping upstream and active/online peers
-class _PingPeersThatNeedPing
+class _PingUpstreams
 {
 public:
-	_PingPeersThatNeedPing(const RuntimeEnvironment *renv,void *tPtr,Hashtable< Address,std::vector<InetAddress> > &upstreamsToContact,uint64_t now) :
+	_PingUpstreams(const RuntimeEnvironment *renv,void *tPtr,Hashtable< Address,std::vector<InetAddress> > &upstreamsToContact,uint64_t now) :
 		lastReceiveFromUpstream(0),
 		RR(renv),
 		_tPtr(tPtr),
@@ -225,8 +579,6 @@ public:
 
 			lastReceiveFromUpstream = std::max(p->lastReceive(),lastReceiveFromUpstream);
 			_upstreamsToContact.erase(p->address()); // erase from upstreams to contact so that we can WHOIS those that remain
-		} else if (p->isActive(_now)) {
-			p->doPingAndKeepalive(_tPtr,_now,-1);
 		}
 	}
 
@@ -251,6 +603,8 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 
 			// Get networks that need config without leaving mutex locked
 			std::vector< SharedPtr<Network> > needConfig;
+			MulticastLikes likes; // full announcements for all networks, packed together
+			CredentialPushes creds; // and credentials due to peers on any of them
 			{
 				Mutex::Lock _l(_networks_m);
 				Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(_networks);
@@ -259,17 +613,33 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 				while (i.next(k,v)) {
 					if (((now - (*v)->lastConfigUpdate()) >= ZT_NETWORK_AUTOCONF_DELAY)||(!(*v)->hasConfig()))
 						needConfig.push_back(*v);
-					(*v)->sendUpdatesToMembers(tptr);
+					(*v)->sendUpdatesToMembers(tptr,likes,creds);
 				}
 			}
+			creds.send(RR,tptr);
+			likes.send(RR,tptr);
 			for(std::vector< SharedPtr<Network> >::const_iterator n(needConfig.begin());n!=needConfig.end();++n)
 				(*n)->requestConfiguration(tptr);
 
-			// Do pings and keepalives
+			// Ping upstreams, which are always kept alive (other peers are pinged below as they come due)
 			Hashtable< Address,std::vector<InetAddress> > upstreamsToContact;
 			RR->topology->getUpstreamsToContact(upstreamsToContact);
-			_PingPeersThatNeedPing pfunc(RR,tptr,upstreamsToContact,now);
-			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
+			_PingUpstreams pfunc(RR,tptr,upstreamsToContact,now);
+			{
+				std::vector<Address> upstreamAddresses;
+				Hashtable< Address,std::vector<InetAddress> >::Iterator i(upstreamsToContact);
+				Address *upstreamAddress = (Address *)0;
+				std::vector<InetAddress> *upstreamStableEndpoints = (std::vector<InetAddress> *)0;
+				while (i.next(upstreamAddress,upstreamStableEndpoints))
+					upstreamAddresses.push_back(*upstreamAddress);
+				for(std::vector<Address>::const_iterator a(upstreamAddresses.begin());a!=upstreamAddresses.end();++a) {
+					const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+					if (p) {
+						pfunc(*RR->topology,p);
+						p->postPathEvents(tptr,now);
+					}
+				}
+			}
 
 			// Run WHOIS to create Peer for any upstreams we could not contact (including pending moon seeds)
 			Hashtable< Address,std::vector<InetAddress> >::Iterator i(upstreamsToContact);
@@ -290,12 +660,43 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 		timeUntilNextPingCheck -= (unsigned long)timeSinceLastPingCheck;
 	}
 
-	if ((now - _lastHousekeepingRun) >= ZT_HOUSEKEEPING_PERIOD) {
+	// Pings and keepalives for other peers whose scheduled checks are due
+	try {
+		std::vector< SharedPtr<Peer> > due;
+		{
+			Mutex::Lock _l(_pingWheel_m);
+			_pingWheel.advance(now,due);
+			std::vector< SharedPtr<Peer> >::iterator w(due.begin());
+			for(std::vector< SharedPtr<Peer> >::iterator p(due.begin());p!=due.end();++p) {
+				const uint64_t d = (*p)->pingDeadline();
+				if ((d)&&(d <= now)) { // otherwise it's been rescheduled
+					(*p)->setPingDeadline(0);
+					w->swap(*p);
+					++w;
+				}
+			}
+			due.erase(w,due.end());
+		}
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(due.begin());p!=due.end();++p) {
+			(*p)->postPathEvents(tptr,now);
+			if ((*p)->isActive(now)) {
+				if (!RR->topology->isUpstream((*p)->identity()))
+					(*p)->doPingAndKeepalive(tptr,now,-1);
+				schedulePeerPing(*p,(*p)->nextKeepalive(now));
+			}
+		}
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+
+	// Housekeeping is done a bounded slice at a time so it never stalls packet processing
+	if ((now - _lastHousekeepingRun) >= ZT_CORE_TIMER_TASK_GRANULARITY) {
 		_lastHousekeepingRun = now;
 		try {
 			RR->topology->doPeriodicTasks(tptr,now);
-			RR->sa->clean(now);
+			RR->sa->clean(tptr,now);
 			RR->mc->clean(now);
+			RR->neighbors->clean(now);
 		} catch ( ... ) {
 			return ZT_RESULT_FATAL_ERROR_INTERNAL;
 		}
@@ -303,6 +704,15 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 
 	try {
 		*nextBackgroundTaskDeadline = now + (uint64_t)std::max(std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(tptr,now)),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
+
+		// Cluster members flush their state queues on a much shorter timer
+		if (RR->cluster) {
+			RR->cluster->doPeriodicTasks(tptr,now);
+			if (*nextBackgroundTaskDeadline > (now + ZT_CLUSTER_PERIODIC_TASK_PERIOD))
+				*nextBackgroundTaskDeadline = now + ZT_CLUSTER_PERIODIC_TASK_PERIOD;
+		}
+
+		_flushDeferred(tptr,now,nextBackgroundTaskDeadline);
 	} catch ( ... ) {
 		return ZT_RESULT_FATAL_ERROR_INTERNAL;
 	}
@@ -310,12 +720,50 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 	return ZT_RESULT_OK;
 }
 
+void Node::schedulePeerPing(const SharedPtr<Peer> &peer,const uint64_t when)
+{
+	Mutex::Lock _l(_pingWheel_m);
+	const uint64_t d = peer->pingDeadline();
+	if ((!d)||(when < d)) {
+		peer->setPingDeadline(when);
+		_pingWheel.add(when,peer);
+	}
+}
+
 ZT_ResultCode Node::join(uint64_t nwid,void *uptr,void *tptr)
 {
-	Mutex::Lock _l(_networks_m);
-	SharedPtr<Network> &nw = _networks[nwid];
-	if (!nw)
+	// The network is constructed with no lock held, since that loads its saved
+	// config and brings up its port, so joins of different networks don't wait
+	// on each other.
+	{
+		Mutex::Lock _l(_networks_m);
+		if ((_networks.contains(nwid))||(_joining.contains(nwid)))
+			return ZT_RESULT_OK;
+		_joining[nwid] = false;
+	}
+
+	SharedPtr<Network> nw;
+	try {
 		nw = SharedPtr<Network>(new Network(RR,tptr,nwid,uptr,(const NetworkConfig *)0));
+	} catch ( ... ) {
+		Mutex::Lock _l(_networks_m);
+		_joining.erase(nwid);
+		throw;
+	}
+
+	bool left = false;
+	{
+		Mutex::Lock _l(_networks_m);
+		const bool *const l = _joining.get(nwid);
+		if (l)
+			left = *l;
+		_joining.erase(nwid);
+		_networks[nwid] = nw;
+		_publishNetworks();
+	}
+	if (left)
+		leave(nwid,(void **)0,tptr);
+
 	return ZT_RESULT_OK;
 }
 
@@ -326,8 +774,12 @@ ZT_ResultCode Node::leave(uint64_t nwid,void **uptr,void *tptr)
 	{
 		Mutex::Lock _l(_networks_m);
 		SharedPtr<Network> *nw = _networks.get(nwid);
-		if (!nw)
+		if (!nw) {
+			bool *const j = _joining.get(nwid);
+			if (j)
+				*j = true; // join() leaves once it's done
 			return ZT_RESULT_OK;
+		}
 		if (uptr)
 			*uptr = (*nw)->userPtr();
 		(*nw)->externalConfig(&ctmp);
@@ -341,6 +793,7 @@ ZT_ResultCode Node::leave(uint64_t nwid,void **uptr,void *tptr)
 	{
 		Mutex::Lock _l(_networks_m);
 		_networks.erase(nwid);
+		_publishNetworks();
 	}
 
 	uint64_t tmp[2];
@@ -350,11 +803,44 @@ ZT_ResultCode Node::leave(uint64_t nwid,void **uptr,void *tptr)
 	return ZT_RESULT_OK;
 }
 
+void Node::_publishNetworks()
+{
+	_NetworkSnapshot *const s = new _NetworkSnapshot();
+	std::vector< std::pair< uint64_t,SharedPtr<Network> > > sorted;
+	sorted.reserve(_networks.size());
+	Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(_networks);
+	uint64_t *k = (uint64_t *)0;
+	SharedPtr<Network> *v = (SharedPtr<Network> *)0;
+	while (i.next(k,v))
+		sorted.push_back(std::pair< uint64_t,SharedPtr<Network> >(*k,*v));
+	std::sort(sorted.begin(),sorted.end());
+	s->ids.reserve(sorted.size());
+	s->networks.reserve(sorted.size());
+	for(std::vector< std::pair< uint64_t,SharedPtr<Network> > >::const_iterator n(sorted.begin());n!=sorted.end();++n) {
+		s->ids.push_back(n->first);
+		s->networks.push_back(n->second);
+	}
+
+	// Readers that loaded the old snapshot without a lock may still be using it
+	const uint64_t now = _now;
+	std::vector<_NetworkSnapshot *>::iterator w(_retiredNetworkSnapshots.begin());
+	for(std::vector<_NetworkSnapshot *>::iterator r(_retiredNetworkSnapshots.begin());r!=_retiredNetworkSnapshots.end();++r) {
+		if ((now - (*r)->retiredAt) > ZT_NETWORK_CONFIG_RETIRE_DELAY)
+			delete *r;
+		else *(w++) = *r;
+	}
+	_retiredNetworkSnapshots.erase(w,_retiredNetworkSnapshots.end());
+	_networkSnapshot->retiredAt = now;
+	_retiredNetworkSnapshots.push_back(_networkSnapshot);
+	__atomic_store_n(&_networkSnapshot,s,__ATOMIC_RELEASE);
+}
+
 ZT_ResultCode Node::multicastSubscribe(void *tptr,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi)
 {
 	SharedPtr<Network> nw(this->network(nwid));
 	if (nw) {
 		nw->multicastSubscribe(tptr,MulticastGroup(MAC(multicastGroup),(uint32_t)(multicastAdi & 0xffffffff)));
+		_flushMulticastAnnouncements(tptr,_now); // or the next batch window, if this is one of many
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
@@ -405,39 +891,40 @@ ZT_PeerList *Node::peers() const
 	pl->peers = (ZT_Peer *)(buf + sizeof(ZT_PeerList));
 
 	pl->peerCount = 0;
-	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::iterator pi(peers.begin());pi!=peers.end();++pi) {
-		ZT_Peer *p = &(pl->peers[pl->peerCount++]);
-		p->address = pi->second->address().toInt();
-		if (pi->second->remoteVersionKnown()) {
-			p->versionMajor = pi->second->remoteVersionMajor();
-			p->versionMinor = pi->second->remoteVersionMinor();
-			p->versionRev = pi->second->remoteVersionRevision();
-		} else {
-			p->versionMajor = -1;
-			p->versionMinor = -1;
-			p->versionRev = -1;
-		}
-		p->latency = pi->second->latency();
-		p->role = RR->topology->role(pi->second->identity().address());
-
-		std::vector< SharedPtr<Path> > paths(pi->second->paths(_now));
-		SharedPtr<Path> bestp(pi->second->getBestPath(_now,false));
-		p->pathCount = 0;
-		for(std::vector< SharedPtr<Path> >::iterator path(paths.begin());path!=paths.end();++path) {
-			memcpy(&(p->paths[p->pathCount].address),&((*path)->address()),sizeof(struct sockaddr_storage));
-			p->paths[p->pathCount].lastSend = (*path)->lastOut();
-			p->paths[p->pathCount].lastReceive = (*path)->lastIn();
-			p->paths[p->pathCount].trustedPathId = RR->topology->getOutboundPathTrust((*path)->address());
-			p->paths[p->pathCount].linkQuality = (int)(*path)->linkQuality();
-			p->paths[p->pathCount].expired = 0;
-			p->paths[p->pathCount].preferred = ((*path) == bestp) ? 1 : 0;
-			++p->pathCount;
-		}
-	}
+	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::iterator pi(peers.begin());pi!=peers.end();++pi)
+		_fillPeer(pi->second,&(pl->peers[pl->peerCount++]));
 
 	return pl;
 }
 
+ZT_ResultCode Node::peer(uint64_t address,ZT_Peer *p) const
+{
+	const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(Address(address)));
+	if (!peer)
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	_fillPeer(peer,p);
+	return ZT_RESULT_OK;
+}
+
+unsigned int Node::peersAfter(uint64_t after,ZT_Peer *p,unsigned int max) const
+{
+	std::vector<Address> addrs;
+	RR->topology->peerAddressesAfter(Address(after),addrs);
+	if (addrs.size() > max) {
+		std::nth_element(addrs.begin(),addrs.begin() + max,addrs.end());
+		addrs.resize(max);
+	}
+	std::sort(addrs.begin(),addrs.end());
+
+	unsigned int n = 0;
+	for(std::vector<Address>::const_iterator a(addrs.begin());a!=addrs.end();++a) {
+		const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(*a));
+		if (peer) // unless removed since
+			_fillPeer(peer,&(p[n++]));
+	}
+	return n;
+}
+
 ZT_VirtualNetworkConfig *Node::networkConfig(uint64_t nwid) const
 {
 	Mutex::Lock _l(_networks_m);
@@ -563,6 +1050,84 @@ void Node::setTrustedPaths(const struct sockaddr_storage *networks,const uint64_
 	RR->topology->setTrustedPaths(reinterpret_cast<const InetAddress *>(networks),ids,count);
 }
 
+void Node::setEgressBandwidthLimit(uint64_t bitsPerSecond)
+{
+	RR->sw->setEgressLimit(bitsPerSecond / 8,now());
+}
+
+void Node::setEgressPacing(bool enabled)
+{
+	RR->sw->setEgressPacing(enabled,now());
+}
+
+void Node::setRelayBandwidthLimit(uint64_t bitsPerSecond)
+{
+	RR->sw->setRelayLimit(bitsPerSecond / 8);
+}
+
+void Node::setPeerLimit(unsigned long maxPeers)
+{
+	RR->topology->setPeerLimit(maxPeers);
+}
+
+void Node::setIdentityVerificationLimit(unsigned long prefixes,unsigned int burst)
+{
+	if (prefixes)
+		_verificationGate.setSize(prefixes);
+	_verificationGate.setBurst(burst);
+}
+
+void Node::reservePeers(unsigned long peers)
+{
+	RR->topology->reservePeers(peers);
+}
+
+ZT_ResultCode Node::clusterInit(
+	unsigned int myId,
+	const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+	int32_t x,
+	int32_t y,
+	int32_t z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg)
+{
+	if ((myId >= ZT_CLUSTER_MAX_MEMBERS)||(RR->cluster))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	Cluster *const c = new Cluster(RR,(uint16_t)myId,zeroTierPhysicalEndpoints,x,y,z,sendFunction,sendFunctionArg,addressToLocationFunction,addressToLocationFunctionArg);
+	__atomic_store_n(&(RR->cluster),c,__ATOMIC_RELEASE);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::clusterAddMember(unsigned int memberId)
+{
+	if (!RR->cluster)
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	return (RR->cluster->addMember((uint16_t)memberId)) ? ZT_RESULT_OK : ZT_RESULT_ERROR_BAD_PARAMETER;
+}
+
+void Node::clusterRemoveMember(unsigned int memberId)
+{
+	if (RR->cluster)
+		RR->cluster->removeMember((uint16_t)memberId);
+}
+
+void Node::clusterHandleIncomingMessage(const void *msg,unsigned int len)
+{
+	if (RR->cluster)
+		RR->cluster->handleIncomingStateMessage((void *)0,msg,len);
+}
+
+void Node::clusterStatus(ZT_ClusterStatus *cs)
+{
+	if (!cs)
+		return;
+	if (RR->cluster)
+		RR->cluster->status(*cs);
+	else memset(cs,0,sizeof(ZT_ClusterStatus));
+}
+
 World Node::planet() const
 {
 	return RR->topology->planet();
@@ -580,65 +1145,109 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 		if (!n) return;
 		n->setConfiguration((void *)0,nc,true);
 	} else {
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
-		try {
-			if (nc.toDictionary(*dconf,sendLegacyFormatConfig)) {
-				uint64_t configUpdateId = prng();
-				if (!configUpdateId) ++configUpdateId;
-
-				const unsigned int totalSize = dconf->sizeBytes();
-				unsigned int chunkIndex = 0;
-				while (chunkIndex < totalSize) {
-					const unsigned int chunkLen = std::min(totalSize - chunkIndex,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 256)));
-					Packet outp(destination,RR->identity.address(),(requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
-					if (requestPacketId) {
-						outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
-						outp.append(requestPacketId);
-					}
-
-					const unsigned int sigStart = outp.size();
-					outp.append(nwid);
-					outp.append((uint16_t)chunkLen);
-					outp.append((const void *)(dconf->data() + chunkIndex),chunkLen);
-
-					outp.append((uint8_t)0); // no flags
-					outp.append((uint64_t)configUpdateId);
-					outp.append((uint32_t)totalSize);
-					outp.append((uint32_t)chunkIndex);
-
-					C25519::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t *>(outp.data()) + sigStart,outp.size() - sigStart));
-					outp.append((uint8_t)1);
-					outp.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
-					outp.append(sig.data,ZT_C25519_SIGNATURE_LEN);
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> dconf;
+		if (nc.toDictionary(dconf,sendLegacyFormatConfig))
+			ncSendSerializedConfig(nwid,requestPacketId,destination,dconf.data(),dconf.sizeBytes(),0);
+	}
+}
 
-					outp.compress();
-					RR->sw->send((void *)0,outp,true);
-					chunkIndex += chunkLen;
+void Node::ncSendSerializedConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const void *conf,unsigned int confLen,uint8_t chunkFlags)
+{
+	if (destination == RR->identity.address()) {
+		SharedPtr<Network> n(network(nwid));
+		if ((!n)||((chunkFlags & ZT_NETWORKCONFIG_CHUNK_FLAG_DELTA) != 0)) return; // local requests never advertise a delta base
+		NetworkConfig *nc = new NetworkConfig();
+		char *uncompressed = (char *)0;
+		try {
+			bool ok = true;
+			if ((chunkFlags & ZT_NETWORKCONFIG_CHUNK_FLAG_COMPRESSED) != 0) {
+				uncompressed = new char[ZT_NETWORKCONFIG_DICT_CAPACITY];
+				const int ul = Packet::lz4Decompress(conf,confLen,uncompressed,ZT_NETWORKCONFIG_DICT_CAPACITY - 1);
+				ok = (ul > 0);
+				conf = uncompressed;
+				confLen = (ok) ? (unsigned int)ul : 0;
+			}
+			if (ok) {
+				if ((chunkFlags & ZT_NETWORKCONFIG_CHUNK_FLAG_BINARY) != 0) {
+					ok = nc->fromBinary(conf,confLen);
+				} else {
+					const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> dconf(reinterpret_cast<const char *>(conf),confLen);
+					ok = nc->fromDictionary(dconf);
 				}
 			}
-			delete dconf;
+			if (ok)
+				n->setConfiguration((void *)0,*nc,true);
+			delete nc;
+			delete [] uncompressed;
 		} catch ( ... ) {
-			delete dconf;
+			delete nc;
+			delete [] uncompressed;
 			throw;
 		}
+	} else {
+		uint64_t configUpdateId = prng();
+		if (!configUpdateId) ++configUpdateId;
+
+		SendBatch _sb(this,(void *)0);
+		unsigned int chunkIndex = 0;
+		while (chunkIndex < confLen) {
+			const unsigned int chunkLen = std::min(confLen - chunkIndex,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 256)));
+			Packet outp(destination,RR->identity.address(),(requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
+			if (requestPacketId) {
+				outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
+				outp.append(requestPacketId);
+			}
+
+			const unsigned int sigStart = outp.size();
+			outp.append(nwid);
+			outp.append((uint16_t)chunkLen);
+			outp.append(reinterpret_cast<const uint8_t *>(conf) + chunkIndex,chunkLen);
+
+			outp.append((uint8_t)chunkFlags);
+			outp.append((uint64_t)configUpdateId);
+			outp.append((uint32_t)confLen);
+			outp.append((uint32_t)chunkIndex);
+
+			C25519::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t *>(outp.data()) + sigStart,outp.size() - sigStart));
+			outp.append((uint8_t)1);
+			outp.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
+			outp.append(sig.data,ZT_C25519_SIGNATURE_LEN);
+
+			outp.compress();
+			RR->sw->send((void *)0,outp,true);
+			chunkIndex += chunkLen;
+		}
 	}
 }
 
 void Node::ncSendRevocation(const Address &destination,const Revocation &rev)
+{
+	ncSendRevocations(destination,&rev,1);
+}
+
+void Node::ncSendRevocations(const Address &destination,const Revocation *revs,unsigned int count)
 {
 	if (destination == RR->identity.address()) {
-		SharedPtr<Network> n(network(rev.networkId()));
-		if (!n) return;
-		n->addCredential((void *)0,RR->identity.address(),rev);
+		for(unsigned int i=0;i<count;++i) {
+			SharedPtr<Network> n(network(revs[i].networkId()));
+			if (n)
+				n->addCredential((void *)0,RR->identity.address(),revs[i]);
+		}
 	} else {
-		Packet outp(destination,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-		outp.append((uint8_t)0x00);
-		outp.append((uint16_t)0);
-		outp.append((uint16_t)0);
-		outp.append((uint16_t)1);
-		rev.serialize(outp);
-		outp.append((uint16_t)0);
-		RR->sw->send((void *)0,outp,true);
+		while (count) {
+			const unsigned int c = std::min(count,(unsigned int)ZT_NODE_NC_REVOCATIONS_PER_PACKET);
+			Packet outp(destination,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
+			outp.append((uint8_t)0x00);
+			outp.append((uint16_t)0);
+			outp.append((uint16_t)0);
+			outp.append((uint16_t)c);
+			for(unsigned int i=0;i<c;++i)
+				revs[i].serialize(outp);
+			outp.append((uint16_t)0);
+			RR->sw->send((void *)0,outp,true);
+			revs += c;
+			count -= c;
+		}
 	}
 }
 
@@ -748,6 +1357,62 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processWirePackets(tptr,now,packets,packetCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
+enum ZT_ResultCode ZT_Node_processDeferredPackets(ZT_Node *node,void *tptr,uint64_t now,unsigned int maxPackets,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processDeferredPackets(tptr,now,maxPackets,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
+enum ZT_ResultCode ZT_Node_processCryptoJobs(ZT_Node *node,void *tptr,uint64_t now,unsigned int maxJobs,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processCryptoJobs(tptr,now,maxJobs,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processVirtualNetworkFrames(tptr,now,frames,frameCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline)
 {
 	try {
@@ -842,6 +1507,24 @@ ZT_PeerList *ZT_Node_peers(ZT_Node *node)
 	}
 }
 
+enum ZT_ResultCode ZT_Node_peer(ZT_Node *node,uint64_t address,ZT_Peer *peer)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->peer(address,peer);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+unsigned int ZT_Node_peersAfter(ZT_Node *node,uint64_t after,ZT_Peer *peers,unsigned int max)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->peersAfter(after,peers,max);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
 ZT_VirtualNetworkConfig *ZT_Node_networkConfig(ZT_Node *node,uint64_t nwid)
 {
 	try {
@@ -906,6 +1589,124 @@ void ZT_Node_setTrustedPaths(ZT_Node *node,const struct sockaddr_storage *networ
 	} catch ( ... ) {}
 }
 
+void ZT_Node_setMultipathMode(ZT_Node *node,int enabled)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setMultipathMode(enabled != 0);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setPeerIdleTimeout(ZT_Node *node,unsigned int ms)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setPeerIdleTimeout(ms);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setEgressBandwidthLimit(ZT_Node *node,uint64_t bitsPerSecond)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setEgressBandwidthLimit(bitsPerSecond);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setEgressPacing(ZT_Node *node,int enabled)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setEgressPacing(enabled != 0);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setEcn(ZT_Node *node,int enabled)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setEcn(enabled != 0);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setRelayBandwidthLimit(ZT_Node *node,uint64_t bitsPerSecond)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setRelayBandwidthLimit(bitsPerSecond);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setPeerLimit(ZT_Node *node,unsigned long maxPeers)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setPeerLimit(maxPeers);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setIdentityVerificationLimit(ZT_Node *node,unsigned long prefixes,unsigned int burst)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setIdentityVerificationLimit(prefixes,burst);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_reservePeers(ZT_Node *node,unsigned long peers)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->reservePeers(peers);
+	} catch ( ... ) {}
+}
+
+enum ZT_ResultCode ZT_Node_clusterInit(
+	ZT_Node *node,
+	unsigned int myId,
+	const struct sockaddr_storage *zeroTierPhysicalEndpoints,
+	unsigned int numZeroTierPhysicalEndpoints,
+	int x,
+	int y,
+	int z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg)
+{
+	try {
+		std::vector<ZeroTier::InetAddress> za;
+		for(unsigned int i=0;i<numZeroTierPhysicalEndpoints;++i)
+			za.push_back(zeroTierPhysicalEndpoints[i]);
+		return reinterpret_cast<ZeroTier::Node *>(node)->clusterInit(myId,za,x,y,z,sendFunction,sendFunctionArg,addressToLocationFunction,addressToLocationFunctionArg);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_clusterAddMember(ZT_Node *node,unsigned int memberId)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->clusterAddMember(memberId);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+void ZT_Node_clusterRemoveMember(ZT_Node *node,unsigned int memberId)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->clusterRemoveMember(memberId);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_clusterHandleIncomingMessage(ZT_Node *node,const void *msg,unsigned int len)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->clusterHandleIncomingMessage(msg,len);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_clusterStatus(ZT_Node *node,ZT_ClusterStatus *cs)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->clusterStatus(cs);
+	} catch ( ... ) {}
+}
+
 void ZT_version(int *major,int *minor,int *revision)
 {
 	if (major) *major = ZEROTIER_ONE_VERSION_MAJOR;
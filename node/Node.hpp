@@ -41,20 +41,35 @@
 #include "RuntimeEnvironment.hpp"
 #include "InetAddress.hpp"
 #include "Mutex.hpp"
+#include "NonCopyable.hpp"
 #include "MAC.hpp"
 #include "Network.hpp"
 #include "Path.hpp"
 #include "Salsa20.hpp"
 #include "NetworkController.hpp"
 #include "Hashtable.hpp"
+#include "Metrics.hpp"
+#include "MemoryUsage.hpp"
+#include "PacketTrace.hpp"
+#include "Latency.hpp"
+#include "Probes.hpp"
+#include "TimerWheel.hpp"
+#include "Bench.hpp"
+#include "Capture.hpp"
+#include "FlowExport.hpp"
+#include "VerificationGate.hpp"
 
 // Bit mask for "expecting reply" hash
 #define ZT_EXPECTING_REPLIES_BUCKET_MASK1 255
 #define ZT_EXPECTING_REPLIES_BUCKET_MASK2 31
 
+// Revocations sent by a controller in one NETWORK_CREDENTIALS packet (~150 bytes each, so this fits one fragment)
+#define ZT_NODE_NC_REVOCATIONS_PER_PACKET 8
+
 namespace ZeroTier {
 
 class World;
+class Peer;
 
 /**
  * Implementation of Node object as defined in CAPI
@@ -82,7 +97,8 @@ public:
 		const struct sockaddr_storage *remoteAddress,
 		const void *packetData,
 		unsigned int packetLength,
-		volatile uint64_t *nextBackgroundTaskDeadline);
+		volatile uint64_t *nextBackgroundTaskDeadline,
+		unsigned int ecn = 0);
 	ZT_ResultCode processVirtualNetworkFrame(
 		void *tptr,
 		uint64_t now,
@@ -94,6 +110,20 @@ public:
 		const void *frameData,
 		unsigned int frameLength,
 		volatile uint64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processWirePackets(
+		void *tptr,
+		uint64_t now,
+		const ZT_WirePacket *packets,
+		unsigned int packetCount,
+		volatile uint64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processVirtualNetworkFrames(
+		void *tptr,
+		uint64_t now,
+		const ZT_VirtualNetworkFrame *frames,
+		unsigned int frameCount,
+		volatile uint64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processDeferredPackets(void *tptr,uint64_t now,unsigned int maxPackets,volatile uint64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processCryptoJobs(void *tptr,uint64_t now,unsigned int maxJobs,volatile uint64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processBackgroundTasks(void *tptr,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode join(uint64_t nwid,void *uptr,void *tptr);
 	ZT_ResultCode leave(uint64_t nwid,void **uptr,void *tptr);
@@ -104,6 +134,8 @@ public:
 	uint64_t address() const;
 	void status(ZT_NodeStatus *status) const;
 	ZT_PeerList *peers() const;
+	ZT_ResultCode peer(uint64_t address,ZT_Peer *p) const;
+	unsigned int peersAfter(uint64_t after,ZT_Peer *p,unsigned int max) const;
 	ZT_VirtualNetworkConfig *networkConfig(uint64_t nwid) const;
 	ZT_VirtualNetworkList *networks() const;
 	void freeQueryResult(void *qr);
@@ -116,8 +148,37 @@ public:
 
 	inline uint64_t now() const { return _now; }
 
+	/**
+	 * Scope within which outgoing packets are handed to the host in one batch
+	 *
+	 * If the host supplied a batched send function, packets sent via
+	 * putPacket() on this thread while one of these is in scope are queued
+	 * and passed to it together when the outermost scope closes (or when the
+	 * queue fills). Scopes nest, and are ignored if there is no batch send
+	 * function or if another node's batch is already open on this thread.
+	 */
+	class SendBatch : NonCopyable
+	{
+	public:
+		SendBatch(Node *n,void *tPtr,const bool enable = true);
+		~SendBatch();
+
+	private:
+		bool _active;
+	};
+
+	/**
+	 * Send a packet out over the physical wire
+	 *
+	 * If a SendBatch is open the packet is queued and true is returned, since
+	 * the host's result is not known until the batch is flushed.
+	 */
 	inline bool putPacket(void *tPtr,const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl = 0)
 	{
+		RR->metrics->inc(Metrics::PACKETS_OUT);
+		RR->metrics->add(Metrics::BYTES_OUT,len);
+		if ((_cb.wirePacketBatchSendFunction)&&(_batchPacket(tPtr,localSocket,addr,data,len,ttl)))
+			return true;
 		return (_cb.wirePacketSendFunction(
 			reinterpret_cast<ZT_Node *>(this),
 			_uPtr,
@@ -131,6 +192,8 @@ public:
 
 	inline void putFrame(void *tPtr,uint64_t nwid,void **nuptr,const MAC &source,const MAC &dest,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
+		Latency::Scope _ls(RR->latency,Latency::TAP_WRITE);
+		ZT_PROBE_TAP_WRITE(nwid,etherType,len);
 		_cb.virtualNetworkFrameFunction(
 			reinterpret_cast<ZT_Node *>(this),
 			_uPtr,
@@ -145,33 +208,55 @@ public:
 			len);
 	}
 
-	inline SharedPtr<Network> network(uint64_t nwid) const
+	/**
+	 * Look up a network without taking any lock
+	 *
+	 * The result refers into an immutable snapshot of our networks, which
+	 * stays valid for ZT_NETWORK_CONFIG_RETIRE_DELAY after being replaced by
+	 * a join or leave. It can be held by reference while handling a packet
+	 * or frame, which saves touching the network's reference count, but must
+	 * be copied to be kept any longer than that.
+	 *
+	 * @param nwid Network ID
+	 * @return Network or NULL pointer if we are not a member
+	 */
+	inline const SharedPtr<Network> &network(const uint64_t nwid) const
 	{
-		Mutex::Lock _l(_networks_m);
-		const SharedPtr<Network> *n = _networks.get(nwid);
-		if (n)
-			return *n;
-		return SharedPtr<Network>();
+		const _NetworkSnapshot *const s = __atomic_load_n(&_networkSnapshot,__ATOMIC_ACQUIRE);
+		unsigned int lo = 0,hi = (unsigned int)s->ids.size();
+		while (lo < hi) {
+			const unsigned int mid = (lo + hi) >> 1;
+			if (s->ids[mid] < nwid)
+				lo = mid + 1;
+			else hi = mid;
+		}
+		return (((lo < s->ids.size())&&(s->ids[lo] == nwid)) ? s->networks[lo] : _nullNetwork);
 	}
 
-	inline bool belongsToNetwork(uint64_t nwid) const
-	{
-		Mutex::Lock _l(_networks_m);
-		return _networks.contains(nwid);
-	}
+	inline bool belongsToNetwork(uint64_t nwid) const { return (bool)network(nwid); }
 
-	inline std::vector< SharedPtr<Network> > allNetworks() const
+	/**
+	 * Verify and decrypt a multicast armored with one of our networks' group keys
+	 *
+	 * Each network with a key is tried in turn, which is cheap since a failed
+	 * try costs one MAC and most nodes are on only a few networks.
+	 *
+	 * @param packet Packet armored with Packet::armorGroup()
+	 * @return ID of the network whose key it was, or 0 if none (packet is left as received)
+	 */
+	inline uint64_t dearmorGroup(Packet &packet) const
 	{
-		std::vector< SharedPtr<Network> > nw;
-		Mutex::Lock _l(_networks_m);
-		Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(*const_cast< Hashtable< uint64_t,SharedPtr<Network> > * >(&_networks));
-		uint64_t *k = (uint64_t *)0;
-		SharedPtr<Network> *v = (SharedPtr<Network> *)0;
-		while (i.next(k,v))
-			nw.push_back(*v);
-		return nw;
+		const _NetworkSnapshot *const s = __atomic_load_n(&_networkSnapshot,__ATOMIC_ACQUIRE);
+		for(unsigned int i=0;i<(unsigned int)s->networks.size();++i) {
+			const NetworkConfig &nc = s->networks[i]->config();
+			if ((nc.hasMulticastKey)&&(packet.dearmorGroup(nc.multicastKey)))
+				return s->ids[i];
+		}
+		return 0;
 	}
 
+	inline std::vector< SharedPtr<Network> > allNetworks() const { return __atomic_load_n(&_networkSnapshot,__ATOMIC_ACQUIRE)->networks; }
+
 	inline std::vector<InetAddress> directPaths() const
 	{
 		Mutex::Lock _l(_directPaths_m);
@@ -180,6 +265,24 @@ public:
 
 	inline void postEvent(void *tPtr,ZT_Event ev,const void *md = (const void *)0) { _cb.eventCallback(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,ev,md); }
 
+	/**
+	 * Post a peer or path event with a ZT_PeerEvent as its meta-data
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param ev ZT_EVENT_PEER_* or ZT_EVENT_*_PATH_* event
+	 * @param peer Peer address
+	 * @param path Physical path (may be empty)
+	 * @param latency Peer latency or 0 if unknown
+	 */
+	inline void postPeerEvent(void *tPtr,ZT_Event ev,const Address &peer,const InetAddress &path,const unsigned int latency)
+	{
+		ZT_PeerEvent pe;
+		pe.address = peer.toInt();
+		memcpy(&(pe.path),&path,sizeof(struct sockaddr_storage));
+		pe.latency = latency;
+		postEvent(tPtr,ev,&pe);
+	}
+
 	inline int configureVirtualNetworkPort(void *tPtr,uint64_t nwid,void **nuptr,ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nc) { return _cb.virtualNetworkConfigFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,nwid,nuptr,op,nc); }
 
 	inline bool online() const { return _online; }
@@ -191,14 +294,130 @@ public:
 	bool shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,const int64_t localSocket,const InetAddress &remoteAddress);
 	inline bool externalPathLookup(void *tPtr,const Address &ztaddr,int family,InetAddress &addr) { return ( (_cb.pathLookupFunction) ? (_cb.pathLookupFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,ztaddr.toInt(),family,reinterpret_cast<struct sockaddr_storage *>(&addr)) != 0) : false ); }
 
+	/**
+	 * @return True if the host supplied worker threads for expensive packets (see DeferredPackets)
+	 */
+	inline bool deferringPackets() const { return (_cb.deferredPacketsFunction != 0); }
+
+	/**
+	 * Tell the host that DeferredPackets has work for a worker thread
+	 *
+	 * @param tPtr Thread pointer
+	 */
+	inline void postDeferredPackets(void *tPtr) { _cb.deferredPacketsFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr); }
+
+	/**
+	 * Tell the host that CryptoPipeline has work for a worker thread
+	 *
+	 * @param tPtr Thread pointer
+	 */
+	inline void postCryptoJobs(void *tPtr) { _cb.cryptoJobsFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr); }
+
 	uint64_t prng();
+
+	/**
+	 * Schedule a ping and keepalive check for a peer
+	 *
+	 * Peers that are not upstreams are only checked when a scheduled check
+	 * comes due instead of on every ping check. A check later than one that
+	 * is already pending is ignored, so this can only move it earlier.
+	 *
+	 * @param peer Peer to check
+	 * @param when Time at which it should be checked
+	 */
+	void schedulePeerPing(const SharedPtr<Peer> &peer,const uint64_t when);
+
 	void setTrustedPaths(const struct sockaddr_storage *networks,const uint64_t *ids,unsigned int count);
 
+	inline void setMultipathMode(const bool enabled) { _multipathMode = enabled; }
+	inline bool multipathMode() const { return _multipathMode; }
+
+	/**
+	 * @param ms Time without frames to or from a peer after which it's idle and no longer kept alive, or 0 for ZT_PEER_ACTIVITY_TIMEOUT
+	 */
+	inline void setPeerIdleTimeout(const unsigned int ms) { _peerIdleTimeout = (ms) ? ms : ZT_PEER_ACTIVITY_TIMEOUT; }
+	inline unsigned int peerIdleTimeout() const { return _peerIdleTimeout; }
+
+	/**
+	 * @param enabled If true, carry ECN between frames and the wire (see ZT_Node_setEcn())
+	 */
+	inline void setEcn(const bool enabled) { _ecn = enabled; }
+	inline bool ecn() const { return _ecn; }
+
+	/**
+	 * Note that a network has multicast groups to announce as deltas
+	 *
+	 * These go out in a batch with those of all other networks when the
+	 * ZT_MULTICAST_ANNOUNCE_BATCH_WINDOW since the last batch has passed.
+	 */
+	inline void multicastGroupsChanged() { __atomic_store_n(&_multicastGroupsChanged,1,__ATOMIC_RELEASE); }
+
+	void setEgressBandwidthLimit(uint64_t bitsPerSecond);
+	void setEgressPacing(bool enabled);
+	void setRelayBandwidthLimit(uint64_t bitsPerSecond);
+	void setPeerLimit(unsigned long maxPeers);
+	void setIdentityVerificationLimit(unsigned long prefixes,unsigned int burst);
+	void reservePeers(unsigned long peers);
+
+	ZT_ResultCode clusterInit(
+		unsigned int myId,
+		const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+		int32_t x,
+		int32_t y,
+		int32_t z,
+		void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+		void *sendFunctionArg,
+		int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+		void *addressToLocationFunctionArg);
+	ZT_ResultCode clusterAddMember(unsigned int memberId);
+	void clusterRemoveMember(unsigned int memberId);
+	void clusterHandleIncomingMessage(const void *msg,unsigned int len);
+	void clusterStatus(ZT_ClusterStatus *cs);
+
 	World planet() const;
 	std::vector<World> moons() const;
 
 	inline const Identity &identity() const { return _RR.identity; }
 
+	/**
+	 * @return Counters for this node (valid for the life of the node)
+	 */
+	inline const Metrics &metrics() const { return *(_RR.metrics); }
+
+	/**
+	 * @return Sampled packet path trace for this node (valid for the life of the node)
+	 */
+	inline PacketTrace &packetTrace() { return *(_RR.ptrace); }
+
+	/**
+	 * @return Per-stage packet path timing for this node (valid for the life of the node)
+	 */
+	inline const Latency &latency() const { return *(_RR.latency); }
+
+	/**
+	 * @return Peer throughput and latency test for this node (valid for the life of the node)
+	 */
+	inline Bench &bench() { return *(_RR.bench); }
+	inline Capture &capture() { return *(_RR.capture); }
+	inline FlowExport &flowExport() { return *(_RR.flowExport); }
+
+	/**
+	 * Take every network's flow counts since the last call, if flowExport() is enabled
+	 *
+	 * @param flows Flows are appended here
+	 */
+	void flows(std::vector<FlowExport::Flow> &flows);
+
+	/**
+	 * Add this node's peers, paths, networks and queues to a memory usage snapshot
+	 *
+	 * This walks every table, each under its own lock, so it is meant for
+	 * occasional introspection and not for anything run per packet.
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
 	/**
 	 * Register that we are expecting a reply to a packet ID
 	 *
@@ -245,21 +464,29 @@ public:
 	 */
 	inline bool rateGateIdentityVerification(const uint64_t now,const InetAddress &from)
 	{
-		unsigned long iph = from.rateGateHash();
-		if ((now - _lastIdentityVerification[iph]) >= ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT) {
-			_lastIdentityVerification[iph] = now;
+		if (_verificationGate.admit(now,from)) {
+			RR->metrics->inc(Metrics::IDENTITY_VERIFICATIONS_ADMITTED);
 			return true;
 		}
+		RR->metrics->inc(Metrics::IDENTITY_VERIFICATIONS_THROTTLED);
 		return false;
 	}
 
 	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig);
+	virtual void ncSendSerializedConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const void *conf,unsigned int confLen,uint8_t chunkFlags);
 	virtual void ncSendRevocation(const Address &destination,const Revocation &rev);
+	virtual void ncSendRevocations(const Address &destination,const Revocation *revs,unsigned int count);
 	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode);
 
 	inline const Address &remoteTraceTarget() const { return _remoteTraceTarget; }
 
 private:
+	void _fillPeer(const SharedPtr<Peer> &peer,ZT_Peer *p) const;
+	bool _batchPacket(void *tPtr,const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl);
+	void _flushDeferred(void *tptr,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline);
+	uint64_t _flushMulticastAnnouncements(void *tptr,uint64_t now);
+	void _flushBatch();
+
 	RuntimeEnvironment _RR;
 	RuntimeEnvironment *RR;
 	void *_uPtr; // _uptr (lower case) is reserved in Visual Studio :P
@@ -269,23 +496,46 @@ private:
 	uint8_t _expectingRepliesToBucketPtr[ZT_EXPECTING_REPLIES_BUCKET_MASK1 + 1];
 	uint32_t _expectingRepliesTo[ZT_EXPECTING_REPLIES_BUCKET_MASK1 + 1][ZT_EXPECTING_REPLIES_BUCKET_MASK2 + 1];
 
-	// Time of last identity verification indexed by InetAddress.rateGateHash() -- used in IncomingPacket::_doHELLO() via rateGateIdentityVerification()
-	uint64_t _lastIdentityVerification[16384];
+	// Per source prefix limits on identity verification -- used in IncomingPacket::_doHELLO() via rateGateIdentityVerification()
+	VerificationGate _verificationGate;
 
 	Hashtable< uint64_t,SharedPtr<Network> > _networks;
-	Mutex _networks_m;
+	Hashtable< uint64_t,bool > _joining; // networks being constructed by join(), true if left meanwhile
+	Mutex _networks_m; // also guards _joining
+
+	// _networks as published for network() by _publishNetworks(), sorted by ID
+	struct _NetworkSnapshot
+	{
+		_NetworkSnapshot() : retiredAt(0) {}
+		std::vector<uint64_t> ids;
+		std::vector< SharedPtr<Network> > networks; // same order as ids
+		uint64_t retiredAt;
+	};
+	void _publishNetworks(); // _networks_m must be locked
+	_NetworkSnapshot *_networkSnapshot; // published under _networks_m, read with no lock
+	std::vector<_NetworkSnapshot *> _retiredNetworkSnapshots; // freed once older than ZT_NETWORK_CONFIG_RETIRE_DELAY
+	const SharedPtr<Network> _nullNetwork;
 
 	std::vector<InetAddress> _directPaths;
 	Mutex _directPaths_m;
 
 	Mutex _backgroundTasksLock;
 
+	TimerWheel< SharedPtr<Peer> > _pingWheel;
+	Mutex _pingWheel_m;
+
 	Address _remoteTraceTarget;
 	uint64_t _now;
 	uint64_t _lastPingCheck;
 	uint64_t _lastHousekeepingRun;
+	uint64_t _lastMulticastAnnouncement;
+	uint32_t _multicastGroupsChanged;
+	Mutex _multicastAnnouncement_m;
 	volatile uint64_t _prngState[2];
 	bool _online;
+	volatile bool _multipathMode;
+	volatile unsigned int _peerIdleTimeout;
+	volatile bool _ecn;
 };
 
 } // namespace ZeroTier
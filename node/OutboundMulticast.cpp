@@ -32,6 +32,7 @@
 #include "Node.hpp"
 #include "Peer.hpp"
 #include "Topology.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
@@ -42,6 +43,7 @@ void OutboundMulticast::init(
 	bool disableCompression,
 	unsigned int limit,
 	unsigned int gatherLimit,
+	bool replicate,
 	const MAC &src,
 	const MulticastGroup &dest,
 	unsigned int etherType,
@@ -64,19 +66,21 @@ void OutboundMulticast::init(
 	_etherType = etherType;
 
 	if (gatherLimit) flags |= 0x02;
+	if (replicate) flags |= 0x08;
 
-	_packet.setSource(RR->identity.address());
-	_packet.setVerb(Packet::VERB_MULTICAST_FRAME);
-	_packet.append((uint64_t)nwid);
-	_packet.append(flags);
-	if (gatherLimit) _packet.append((uint32_t)gatherLimit);
-	if (src) src.appendTo(_packet);
-	dest.mac().appendTo(_packet);
-	_packet.append((uint32_t)dest.adi());
-	_packet.append((uint16_t)etherType);
-	_packet.append(payload,_frameLen);
+	_packet = SharedPtr<Packet>(new Packet());
+	_packet->setSource(RR->identity.address());
+	_packet->setVerb(Packet::VERB_MULTICAST_FRAME);
+	_packet->append((uint64_t)nwid);
+	_packet->append(flags);
+	if (gatherLimit) _packet->append((uint32_t)gatherLimit);
+	if (src) src.appendTo(*_packet);
+	dest.mac().appendTo(*_packet);
+	_packet->append((uint32_t)dest.adi());
+	_packet->append((uint16_t)etherType);
+	_packet->append(payload,_frameLen);
 	if (!disableCompression)
-		_packet.compress();
+		_packet->compress();
 
 	memcpy(_frameData,payload,_frameLen);
 }
@@ -86,12 +90,32 @@ void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,void *tPtr,const A
 	const SharedPtr<Network> nw(RR->node->network(_nwid));
 	const Address toAddr2(toAddr);
 	if ((nw)&&(nw->filterOutgoingPacket(tPtr,true,RR->identity.address(),toAddr2,_macSrc,_macDest,_frameData,_frameLen,_etherType,0))) {
-		_packet.newInitializationVector();
-		_packet.setDestination(toAddr2);
-		RR->node->expectReplyTo(_packet.packetId());
+		const NetworkConfig &nc = nw->config();
+		if (nc.hasMulticastKey) {
+			const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(toAddr2));
+			if ((peer)&&(peer->groupKeyEnabled())) {
+				// Encrypted and MACed once, after which each recipient only costs a copy
+				if (!_groupPacket) {
+					_groupPacket = SharedPtr<Packet>(new Packet(*_packet));
+					_groupPacket->newInitializationVector();
+					_groupPacket->armorGroup(nc.multicastKey);
+					RR->node->expectReplyTo(_groupPacket->packetId());
+				}
+				const SharedPtr<Packet> tmp(new Packet(*_groupPacket));
+				tmp->setDestination(toAddr2);
+				RR->sw->send(tPtr,tmp,true,_nwid);
+				RR->metrics->inc(Metrics::MULTICAST_PACKETS_SENT);
+				return;
+			}
+		}
 
-		Packet tmp(_packet); // make a copy of packet so as not to garble the original -- GitHub issue #461
-		RR->sw->send(tPtr,tmp,true);
+		_packet->newInitializationVector();
+		_packet->setDestination(toAddr2);
+		RR->node->expectReplyTo(_packet->packetId());
+
+		const SharedPtr<Packet> tmp(new Packet(*_packet)); // make a copy of packet so as not to garble the original -- GitHub issue #461
+		RR->sw->send(tPtr,tmp,true,_nwid);
+		RR->metrics->inc(Metrics::MULTICAST_PACKETS_SENT);
 	}
 }
 
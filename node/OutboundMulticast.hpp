@@ -37,6 +37,7 @@
 #include "MulticastGroup.hpp"
 #include "Address.hpp"
 #include "Packet.hpp"
+#include "Bloom.hpp"
 
 namespace ZeroTier {
 
@@ -67,6 +68,7 @@ public:
 	 * @param disableCompression Disable compression of frame payload
 	 * @param limit Multicast limit for desired number of packets to send
 	 * @param gatherLimit Number to lazily/implicitly gather with this frame or 0 for none
+	 * @param replicate If true, ask the recipient (a multicast replicator) to re-send this to the group
 	 * @param src Source MAC address of frame or NULL to imply compute from sender ZT address
 	 * @param dest Destination multicast group (MAC + ADI)
 	 * @param etherType 16-bit Ethernet type ID
@@ -81,6 +83,7 @@ public:
 		bool disableCompression,
 		unsigned int limit,
 		unsigned int gatherLimit,
+		bool replicate,
 		const MAC &src,
 		const MulticastGroup &dest,
 		unsigned int etherType,
@@ -106,6 +109,11 @@ public:
 	/**
 	 * Just send without checking log
 	 *
+	 * If the network has a multicast group key and the recipient supports it,
+	 * this sends a copy of one packet armored with that key, which is done
+	 * the first time it's needed. Otherwise the packet is armored for this
+	 * recipient alone with its peer key.
+	 *
 	 * @param RR Runtime environment
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param toAddr Destination address
@@ -122,6 +130,7 @@ public:
 	inline void sendAndLog(const RuntimeEnvironment *RR,void *tPtr,const Address &toAddr)
 	{
 		_alreadySentTo.push_back(toAddr);
+		_alreadySentToBloom.set(toAddr.toInt());
 		sendOnly(RR,tPtr,toAddr);
 	}
 
@@ -135,7 +144,7 @@ public:
 	 */
 	inline bool sendIfNew(const RuntimeEnvironment *RR,void *tPtr,const Address &toAddr)
 	{
-		if (std::find(_alreadySentTo.begin(),_alreadySentTo.end(),toAddr) == _alreadySentTo.end()) {
+		if ((!_alreadySentToBloom.maybe(toAddr.toInt()))||(std::find(_alreadySentTo.begin(),_alreadySentTo.end(),toAddr) == _alreadySentTo.end())) {
 			sendAndLog(RR,tPtr,toAddr);
 			return true;
 		} else {
@@ -151,8 +160,10 @@ private:
 	unsigned int _limit;
 	unsigned int _frameLen;
 	unsigned int _etherType;
-	Packet _packet;
+	SharedPtr<Packet> _packet;
+	SharedPtr<Packet> _groupPacket; // _packet armored with the network's group key, once one is sent
 	std::vector<Address> _alreadySentTo;
+	Bloom<ZT_MULTICAST_SENT_BLOOM_BITS> _alreadySentToBloom; // lets sendIfNew() skip scanning _alreadySentTo for most new addresses
 	uint8_t _frameData[ZT_MAX_MTU];
 };
 
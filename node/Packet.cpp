@@ -31,6 +31,7 @@
 #include <stdio.h>
 
 #include "Packet.hpp"
+#include "HugePages.hpp"
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 #include "../ext/x64-salsa2012-asm/salsa2012.h"
@@ -39,6 +40,10 @@
 #include "../ext/arm32-neon-salsa2012-asm/salsa2012.h"
 #endif
 
+#ifdef ZT_USE_ZSTD
+#include <zstd.h>
+#endif
+
 #ifdef _MSC_VER
 #define FORCE_INLINE static __forceinline
 #include <intrin.h>
@@ -54,9 +59,9 @@ namespace ZeroTier {
 
 /* Set up macros for fast single-pass ASM Salsa20/12 crypto, if we have it */
 
-// x64 SSE crypto
+// x64 SSE crypto (but Salsa20::crypt12() is faster if it has AVX2 or AVX-512)
 #ifdef ZT_USE_X64_ASM_SALSA2012
-#define ZT_HAS_FAST_CRYPTO() (true)
+#define ZT_HAS_FAST_CRYPTO() (Salsa20::crypt12Implementation() == Salsa20::CRYPT12_DEFAULT)
 #define ZT_FAST_SINGLE_PASS_SALSA2012(b,l,n,k) zt_salsa2012_amd64_xmm6(reinterpret_cast<unsigned char *>(b),(l),reinterpret_cast<const unsigned char *>(n),reinterpret_cast<const unsigned char *>(k))
 #endif
 
@@ -1061,9 +1066,199 @@ static inline int LZ4_decompress_safe(const char* source, char* dest, int compre
 
 const unsigned char Packet::ZERO_KEY[32] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
 
-void Packet::armor(const void *key,bool encryptPayload,unsigned int counter)
+// Blocks are a little larger than Packet so that IncomingPacket, which adds
+// only a few fields, can use them too.
+#define ZT_PACKET_POOL_BLOCK_SIZE (sizeof(Packet) + 64)
+
+namespace {
+struct _PacketPool
+{
+	_PacketPool() : head((void **)0),count(0) {}
+	~_PacketPool()
+	{
+		while (head) {
+			void **const n = reinterpret_cast<void **>(*head);
+			HugePages::free(reinterpret_cast<void *>(head),ZT_PACKET_POOL_BLOCK_SIZE);
+			head = n;
+		}
+		count = ZT_PACKET_POOL_MAX_FREE; // anything freed later on this thread goes straight to the heap
+	}
+	void **head;
+	unsigned int count;
+};
+static thread_local _PacketPool _packetPool;
+
+// Next packet ID for this thread (zero until first use and after wrapping)
+static thread_local uint64_t _packetIdCounter = 0;
+
+#ifdef ZT_USE_ZSTD
+// Each thread's zstd contexts, created on first use so threads that never
+// compress with zstd don't pay for them
+struct _ZstdContexts
+{
+	_ZstdContexts() : c((ZSTD_CCtx *)0),d((ZSTD_DCtx *)0) {}
+	~_ZstdContexts()
+	{
+		if (c)
+			ZSTD_freeCCtx(c);
+		if (d)
+			ZSTD_freeDCtx(d);
+	}
+	inline ZSTD_CCtx *compressor()
+	{
+		if (!c) {
+			c = ZSTD_createCCtx();
+			if (c) {
+				// No content size, checksum or dictionary ID, since the packet
+				// already carries its length and is authenticated
+				ZSTD_CCtx_setParameter(c,ZSTD_c_compressionLevel,ZT_PROTO_ZSTD_LEVEL);
+				ZSTD_CCtx_setParameter(c,ZSTD_c_contentSizeFlag,0);
+				ZSTD_CCtx_setParameter(c,ZSTD_c_checksumFlag,0);
+				ZSTD_CCtx_setParameter(c,ZSTD_c_dictIDFlag,0);
+			}
+		}
+		return c;
+	}
+	inline ZSTD_DCtx *decompressor()
+	{
+		if (!d)
+			d = ZSTD_createDCtx();
+		return d;
+	}
+	ZSTD_CCtx *c;
+	ZSTD_DCtx *d;
+};
+static thread_local _ZstdContexts _zstdContexts;
+#endif
+} // anonymous namespace
+
+void Packet::_newPacketId(void *id)
+{
+	uint64_t c = _packetIdCounter;
+	if (!c) {
+		// Two threads sending to the same peer only collide if their random
+		// starting points are within the number of packets either one sends.
+		Utils::getSecureRandom(&c,sizeof(c));
+		c |= 8;
+	}
+	_packetIdCounter = ((c + 8) > c) ? (c + 8) : 0; // reseed on the next call if this wrapped
+	c = Utils::hton(c);
+	memcpy(id,&c,8);
+}
+
+void *Packet::operator new(size_t sz)
+{
+	if (sz <= ZT_PACKET_POOL_BLOCK_SIZE) {
+		_PacketPool &pp = _packetPool;
+		if (pp.head) {
+			void **const b = pp.head;
+			pp.head = reinterpret_cast<void **>(*b);
+			--pp.count;
+			return reinterpret_cast<void *>(b);
+		}
+		return HugePages::allocate(ZT_PACKET_POOL_BLOCK_SIZE);
+	}
+	return ::operator new(sz);
+}
+
+void Packet::operator delete(void *p,size_t sz)
+{
+	if (!p)
+		return;
+	if (sz <= ZT_PACKET_POOL_BLOCK_SIZE) {
+		_PacketPool &pp = _packetPool;
+		if (pp.count < ZT_PACKET_POOL_MAX_FREE) {
+			*reinterpret_cast<void **>(p) = reinterpret_cast<void *>(pp.head);
+			pp.head = reinterpret_cast<void **>(p);
+			++pp.count;
+			return;
+		}
+		HugePages::free(p,ZT_PACKET_POOL_BLOCK_SIZE);
+		return;
+	}
+	::operator delete(p);
+}
+
+// Payloads are crypted and authenticated in chunks so that each chunk goes
+// through Poly1305 while it is still in L1, rather than in two passes over
+// the whole packet. Chunks are a multiple of 64 bytes so that successive
+// Salsa20::crypt12() calls continue the keystream.
+#define ZT_PACKET_CRYPT_CHUNK_SIZE 2048
+
+// Payloads up to this size get their Poly1305 key and keystream from one
+// Salsa20::crypt12() call, so that control packets are a single multi-block
+// pass instead of a MAC key block followed by a few single blocks.
+#define ZT_PACKET_SMALL_PAYLOAD_MAX 448
+
+// Encrypt with Salsa20/12 then MAC the ciphertext
+static inline void _s20EncryptAndPoly1305(Salsa20 &s20,const void *macKey,uint8_t *payload,unsigned int len,uint64_t mac[2])
+{
+	Poly1305 p1305(macKey);
+	while (len) {
+		const unsigned int n = (len < ZT_PACKET_CRYPT_CHUNK_SIZE) ? len : ZT_PACKET_CRYPT_CHUNK_SIZE;
+		s20.crypt12(payload,payload,n);
+		p1305.update(payload,n);
+		payload += n;
+		len -= n;
+	}
+	p1305.finish(mac);
+}
+
+// MAC the ciphertext then decrypt with Salsa20/12
+static inline void _s20Poly1305AndDecrypt(Salsa20 &s20,const void *macKey,uint8_t *payload,unsigned int len,uint64_t mac[2])
+{
+	Poly1305 p1305(macKey);
+	while (len) {
+		const unsigned int n = (len < ZT_PACKET_CRYPT_CHUNK_SIZE) ? len : ZT_PACKET_CRYPT_CHUNK_SIZE;
+		p1305.update(payload,n);
+		s20.crypt12(payload,payload,n);
+		payload += n;
+		len -= n;
+	}
+	p1305.finish(mac);
+}
+
+// Same as the above two for a precomputed keystream
+static inline void _xorAndPoly1305(const uint8_t *keyStream,const void *macKey,uint8_t *payload,unsigned int len,uint64_t mac[2],const bool decrypt)
+{
+	Poly1305 p1305(macKey);
+	while (len) {
+		const unsigned int n = (len < ZT_PACKET_CRYPT_CHUNK_SIZE) ? len : ZT_PACKET_CRYPT_CHUNK_SIZE;
+		if (decrypt) {
+			p1305.update(payload,n);
+			Salsa20::memxor(payload,keyStream,n);
+		} else {
+			Salsa20::memxor(payload,keyStream,n);
+			p1305.update(payload,n);
+		}
+		keyStream += n;
+		payload += n;
+		len -= n;
+	}
+	p1305.finish(mac);
+}
+
+// Compute the first 64 bits of the AES-GMAC of a packet's plaintext payload.
+// This must never go on the wire as it is: two of these under the same packet
+// ID (the GMAC nonce) would give away the GHASH key.
+static inline void _aesGmacSivTag(const AES aesKeys[2],const uint8_t *data,unsigned int payloadLen,uint8_t mac[8])
+{
+	uint8_t gmacIv[12];
+	memcpy(gmacIv,data + ZT_PACKET_IDX_IV,8);
+	memset(gmacIv + 8,0,4);
+
+	// Destination, source, and flags with hop count masked since relays change it
+	uint8_t aad[ZT_PACKET_IDX_MAC - ZT_PACKET_IDX_DEST];
+	memcpy(aad,data + ZT_PACKET_IDX_DEST,sizeof(aad));
+	aad[ZT_PACKET_IDX_FLAGS - ZT_PACKET_IDX_DEST] &= 0xf8;
+
+	uint8_t tag[16];
+	aesKeys[0].gmac(gmacIv,aad,sizeof(aad),data + ZT_PACKET_IDX_VERB,payloadLen,tag);
+	memcpy(mac,tag,8);
+}
+
+void Packet::armor(const void *key,bool encryptPayload,unsigned int counter,const Salsa20 *keySchedule)
 {
-	uint8_t mangledKey[32];
 	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
 
 	// Mask least significant 3 bits of packet ID with counter to embed packet send counter for QoS use
@@ -1072,78 +1267,180 @@ void Packet::armor(const void *key,bool encryptPayload,unsigned int counter)
 	// Set flag now, since it affects key mangle function
 	setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
 
-	_salsa20MangleKey((const unsigned char *)key,mangledKey);
+	_armorSalsa20(key,encryptPayload,keySchedule);
+}
+
+void Packet::armorGroup(const void *key)
+{
+	setCipher(ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012);
+	_armorSalsa20(key,true,(const Salsa20 *)0);
+}
+
+void Packet::_armorSalsa20(const void *key,bool encryptPayload,const Salsa20 *keySchedule)
+{
+	uint8_t mangledKey[32];
+	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+	uint64_t mac[2];
+
 	if (ZT_HAS_FAST_CRYPTO()) {
-		const unsigned int encryptLen = (encryptPayload) ? (size() - ZT_PACKET_IDX_VERB) : 0;
+		_salsa20MangleKey((const unsigned char *)key,mangledKey);
+		const unsigned int encryptLen = (encryptPayload) ? payloadLen : 0;
 		uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
 		ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,encryptLen + 64,(data + ZT_PACKET_IDX_IV),mangledKey);
-		Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),encryptLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,data + ZT_PACKET_IDX_VERB,size() - ZT_PACKET_IDX_VERB,keyStream);
-#ifdef ZT_NO_TYPE_PUNNING
-		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
-#else
-		(*reinterpret_cast<uint64_t *>(data + ZT_PACKET_IDX_MAC)) = mac[0];
-#endif
+		if (encryptPayload)
+			_xorAndPoly1305(reinterpret_cast<const uint8_t *>(keyStream + 8),keyStream,payload,payloadLen,mac,false);
+		else Poly1305::compute(mac,payload,payloadLen,keyStream);
+	} else if ((!encryptPayload)||(payloadLen <= ZT_PACKET_SMALL_PAYLOAD_MAX)) {
+		Salsa20 s20;
+		_salsa20Init(s20,key,keySchedule);
+		const unsigned int encryptLen = (encryptPayload) ? payloadLen : 0;
+		uint64_t keyStream[(ZT_PACKET_SMALL_PAYLOAD_MAX + 64) / 8];
+		memset(keyStream,0,encryptLen + 64);
+		s20.crypt12(keyStream,keyStream,encryptLen + 64);
+		if (encryptPayload)
+			_xorAndPoly1305(reinterpret_cast<const uint8_t *>(keyStream + 8),keyStream,payload,payloadLen,mac,false);
+		else Poly1305::compute(mac,payload,payloadLen,keyStream);
 	} else {
-		Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
+		Salsa20 s20;
+		_salsa20Init(s20,key,keySchedule);
 		uint64_t macKey[4];
 		s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-		uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
-		const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
 		if (encryptPayload)
-			s20.crypt12(payload,payload,payloadLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,payload,payloadLen,macKey);
-		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
+			_s20EncryptAndPoly1305(s20,macKey,payload,payloadLen,mac);
+		else Poly1305::compute(mac,payload,payloadLen,macKey);
 	}
+
+#ifdef ZT_NO_TYPE_PUNNING
+	memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
+#else
+	(*reinterpret_cast<uint64_t *>(data + ZT_PACKET_IDX_MAC)) = mac[0];
+#endif
 }
 
-bool Packet::dearmor(const void *key)
+void Packet::armorAesGmacSiv(const AES aesKeys[2],unsigned int counter)
+{
+	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	data[7] = (data[7] & 0xf8) | (uint8_t)(counter & 0x07);
+	setCipher(ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV);
+
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+
+	// The synthetic IV is the packet ID and MAC encrypted together, and it
+	// replaces both on the wire so the raw GMAC is never seen.
+	uint8_t siv[16];
+	memcpy(siv,data + ZT_PACKET_IDX_IV,8);
+	_aesGmacSivTag(aesKeys,data,payloadLen,siv + 8);
+	aesKeys[1].encrypt(siv,siv);
+	aesKeys[1].ctr(siv,payload,payloadLen,payload);
+	memcpy(data + ZT_PACKET_IDX_IV,siv,8);
+	memcpy(data + ZT_PACKET_IDX_MAC,siv + 8,8);
+}
+
+bool Packet::dearmor(const void *key,const AES *aesKeys,const Salsa20 *keySchedule)
 {
-	uint8_t mangledKey[32];
 	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
 	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
 	unsigned char *const payload = data + ZT_PACKET_IDX_VERB;
 	const unsigned int cs = cipher();
 
 	if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)||(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
-		_salsa20MangleKey((const unsigned char *)key,mangledKey);
+		return _dearmorSalsa20(key,(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012),keySchedule);
+	} else if (cs == ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV) {
+		if ((!aesKeys)||(!AES::accelerated()))
+			return false;
+
+		// The packet ID and MAC fields hold the synthetic IV. Decrypt with it,
+		// then recover the real packet ID and MAC from it and check the MAC.
+		// On failure the packet is put back the way it came in.
+		uint8_t siv[16],idAndMac[16],mac[8];
+		memcpy(siv,data + ZT_PACKET_IDX_IV,8);
+		memcpy(siv + 8,data + ZT_PACKET_IDX_MAC,8);
+		aesKeys[1].ctr(siv,payload,payloadLen,payload);
+		aesKeys[1].decrypt(siv,idAndMac);
+		memcpy(data + ZT_PACKET_IDX_IV,idAndMac,8);
+
+		_aesGmacSivTag(aesKeys,data,payloadLen,mac);
+		if (!Utils::secureEq(mac,idAndMac + 8,8)) {
+			memcpy(data + ZT_PACKET_IDX_IV,siv,8);
+			aesKeys[1].ctr(siv,payload,payloadLen,payload);
+			return false;
+		}
+
+		memcpy(data + ZT_PACKET_IDX_MAC,idAndMac + 8,8);
+		return true;
+	} else {
+		return false; // unrecognized cipher suite
+	}
+}
+
+bool Packet::dearmorGroup(const void *key)
+{
+	if (cipher() != ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012)
+		return false;
+	return _dearmorSalsa20(key,true,(const Salsa20 *)0);
+}
+
+bool Packet::_dearmorSalsa20(const void *key,bool encrypted,const Salsa20 *keySchedule)
+{
+	uint8_t mangledKey[32];
+	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+	unsigned char *const payload = data + ZT_PACKET_IDX_VERB;
+	uint64_t mac[2];
+
+	// Encrypted payloads are decrypted in the same pass as the MAC check, so
+	// on failure they are encrypted again to leave the packet as received.
+	if ((ZT_HAS_FAST_CRYPTO())||(!encrypted)||(payloadLen <= ZT_PACKET_SMALL_PAYLOAD_MAX)) {
+		const unsigned int keyStreamLen = (encrypted) ? (payloadLen + 64) : 64;
+		uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
 		if (ZT_HAS_FAST_CRYPTO()) {
-			uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
-			ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) ? (payloadLen + 64) : 64),(data + ZT_PACKET_IDX_IV),mangledKey);
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,keyStream);
+			_salsa20MangleKey((const unsigned char *)key,mangledKey);
+			ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,keyStreamLen,(data + ZT_PACKET_IDX_IV),mangledKey);
+		} else {
+			Salsa20 s20;
+			_salsa20Init(s20,key,keySchedule);
+			memset(keyStream,0,keyStreamLen);
+			s20.crypt12(keyStream,keyStream,keyStreamLen);
+		}
+		if (encrypted)
+			_xorAndPoly1305(reinterpret_cast<const uint8_t *>(keyStream + 8),keyStream,payload,payloadLen,mac,true);
+		else Poly1305::compute(mac,payload,payloadLen,keyStream);
 #ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
+		if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8)) {
 #else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
+		if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) { // also secure, constant time
 #endif
-			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
-		} else {
-			Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
-			uint64_t macKey[4];
-			s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,macKey);
+			if (encrypted)
+				Salsa20::memxor(payload,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
+			return false;
+		}
+	} else {
+		Salsa20 s20;
+		_salsa20Init(s20,key,keySchedule);
+		uint64_t macKey[4];
+		s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
+		if (encrypted)
+			_s20Poly1305AndDecrypt(s20,macKey,payload,payloadLen,mac);
+		else Poly1305::compute(mac,payload,payloadLen,macKey);
 #ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
+		if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8)) {
 #else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
+		if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) { // also secure, constant time
 #endif
-			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				s20.crypt12(payload,payload,payloadLen);
+			if (encrypted) {
+				Salsa20 s20r;
+				_salsa20Init(s20r,key,keySchedule);
+				s20r.crypt12(ZERO_KEY,macKey,sizeof(macKey));
+				s20r.crypt12(payload,payload,payloadLen);
+			}
+			return false;
 		}
-
-		return true;
-	} else {
-		return false; // unrecognized cipher suite
 	}
+
+	return true;
 }
 
 void Packet::cryptField(const void *key,unsigned int start,unsigned int len)
@@ -1176,6 +1473,33 @@ bool Packet::compress()
 	return false;
 }
 
+bool Packet::compressZstd()
+{
+#ifdef ZT_USE_ZSTD
+	char *const data = reinterpret_cast<char *>(unsafeData());
+	char buf[ZT_PROTO_MAX_PACKET_LENGTH * 2];
+
+	if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 64))) {
+		ZSTD_CCtx *const cctx = _zstdContexts.compressor();
+		if (cctx) {
+			const unsigned int pl = size() - ZT_PACKET_IDX_PAYLOAD;
+			const size_t cl = ZSTD_compress2(cctx,buf,sizeof(buf),data + ZT_PACKET_IDX_PAYLOAD,pl);
+			if ((!ZSTD_isError(cl))&&(cl < pl)) {
+				data[ZT_PACKET_IDX_VERB] |= (char)(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_ZSTD);
+				setSize((unsigned int)cl + ZT_PACKET_IDX_PAYLOAD);
+				memcpy(data + ZT_PACKET_IDX_PAYLOAD,buf,cl);
+				return true;
+			}
+		}
+	}
+	data[ZT_PACKET_IDX_VERB] &= (char)(~(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_ZSTD));
+
+	return false;
+#else
+	return compress();
+#endif
+}
+
 bool Packet::uncompress()
 {
 	char *const data = reinterpret_cast<char *>(unsafeData());
@@ -1184,7 +1508,19 @@ bool Packet::uncompress()
 	if ((compressed())&&(size() >= ZT_PROTO_MIN_PACKET_LENGTH)) {
 		if (size() > ZT_PACKET_IDX_PAYLOAD) {
 			unsigned int compLen = size() - ZT_PACKET_IDX_PAYLOAD;
-			int ucl = LZ4_decompress_safe((const char *)data + ZT_PACKET_IDX_PAYLOAD,buf,compLen,sizeof(buf));
+			int ucl = -1;
+			if (((unsigned char)data[ZT_PACKET_IDX_VERB] & ZT_PROTO_VERB_FLAG_ZSTD) != 0) {
+#ifdef ZT_USE_ZSTD
+				ZSTD_DCtx *const dctx = _zstdContexts.decompressor();
+				if (dctx) {
+					const size_t dl = ZSTD_decompressDCtx(dctx,buf,sizeof(buf),data + ZT_PACKET_IDX_PAYLOAD,compLen);
+					if (!ZSTD_isError(dl))
+						ucl = (int)dl;
+				}
+#endif
+			} else {
+				ucl = LZ4_decompress_safe((const char *)data + ZT_PACKET_IDX_PAYLOAD,buf,compLen,sizeof(buf));
+			}
 			if ((ucl > 0)&&(ucl <= (int)(capacity() - ZT_PACKET_IDX_PAYLOAD))) {
 				setSize((unsigned int)ucl + ZT_PACKET_IDX_PAYLOAD);
 				memcpy(data + ZT_PACKET_IDX_PAYLOAD,buf,ucl);
@@ -1192,10 +1528,22 @@ bool Packet::uncompress()
 				return false;
 			}
 		}
-		data[ZT_PACKET_IDX_VERB] &= (char)(~ZT_PROTO_VERB_FLAG_COMPRESSED);
+		data[ZT_PACKET_IDX_VERB] &= (char)(~(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_ZSTD));
 	}
 
 	return true;
 }
 
+unsigned int Packet::lz4Compress(const void *in,unsigned int inLen,void *out,unsigned int outCapacity)
+{
+	const int cl = LZ4_compress_fast(reinterpret_cast<const char *>(in),reinterpret_cast<char *>(out),(int)inLen,(int)outCapacity,1);
+	return (cl > 0) ? (unsigned int)cl : 0;
+}
+
+int Packet::lz4Decompress(const void *in,unsigned int inLen,void *out,unsigned int outCapacity)
+{
+	const int ucl = LZ4_decompress_safe(reinterpret_cast<const char *>(in),reinterpret_cast<char *>(out),(int)inLen,(int)outCapacity);
+	return (ucl >= 0) ? ucl : -1;
+}
+
 } // namespace ZeroTier
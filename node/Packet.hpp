@@ -39,8 +39,11 @@
 #include "Address.hpp"
 #include "Poly1305.hpp"
 #include "Salsa20.hpp"
+#include "AES.hpp"
 #include "Utils.hpp"
 #include "Buffer.hpp"
+#include "AtomicCounter.hpp"
+#include "SharedPtr.hpp"
 
 /**
  * Protocol version -- incremented only for major changes
@@ -92,10 +95,12 @@
  *
  * This specifies Poly1305 MAC using a 32-bit key derived from the first
  * 32 bytes of a Salsa20/12 keystream as in the Salsa20/12 cipher suite,
- * but the payload is not encrypted. This is currently only used to send
- * HELLO since that's the public key specification packet and must be
- * sent in the clear. Key agreement is performed using Curve25519 elliptic
- * curve Diffie-Hellman.
+ * but the payload is not encrypted. This is used to send HELLO since
+ * that's the public key specification packet and must be sent in the
+ * clear, and for frames sent directly over physical paths that their
+ * network's config designates as authenticated-only. Frames received this
+ * way over any other path are discarded. Key agreement is performed using
+ * Curve25519 elliptic curve Diffie-Hellman.
  */
 #define ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE 0
 
@@ -121,6 +126,84 @@
  */
 #define ZT_PROTO_CIPHER_SUITE__NO_CRYPTO_TRUSTED_PATH 2
 
+/**
+ * Cipher suite: AES-GMAC-SIV
+ *
+ * This uses two AES-256 keys taken from SHA-512 of the peer key. A GMAC
+ * under the first key is computed over the packet ID (as IV), the header
+ * fields after it (with hop count bits masked) and the plaintext payload.
+ * The packet ID and the first 64 bits of this GMAC are then encrypted with
+ * the second key to get a synthetic IV, which is the initial counter block
+ * for AES-CTR encryption of the payload under the second key. The synthetic
+ * IV replaces the packet ID and MAC fields on the wire and the receiver
+ * decrypts it to get them back. The raw GMAC is never sent, so a repeated
+ * packet ID shows at most that two packets were identical. It's only used
+ * with peers that advertise it in HELLO (see
+ * ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV) and only when both sides have
+ * hardware AES.
+ */
+#define ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV 3
+
+/**
+ * Not a cipher suite: marks a forward error correction parity datagram
+ *
+ * These share the packet header but are not packets. See Fec.hpp. They are
+ * only sent to peers that advertise ZT_PROTO_HELLO_CAPABILITY_FEC and ask
+ * for them with VERB_PATH_FEC.
+ */
+#define ZT_PROTO_CIPHER_SUITE__FEC_PARITY 4
+
+/**
+ * Cipher suite: Poly1305/Salsa20/12 under a network's multicast group key
+ *
+ * This is POLY1305_SALSA2012 keyed with a symmetric key the controller gives
+ * every member of a network (see NetworkConfig::multicastKey) instead of a
+ * pairwise peer key. The destination address and the fragmented flag are
+ * left out of the key tweak, so a multicast frame is encrypted and MACed
+ * once and the same ciphertext goes to every recipient. Only
+ * VERB_MULTICAST_FRAME for the network whose key it is may be sent this
+ * way, and only to peers that advertise
+ * ZT_PROTO_HELLO_CAPABILITY_GROUP_KEY.
+ */
+#define ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012 5
+
+/**
+ * HELLO capability bit: peer can receive ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV
+ *
+ * Only advertised when AES::accelerated(), so never by non-x86 builds.
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV 0x0000000000000001ULL
+
+/**
+ * HELLO capability bit: peer understands VERB_PATH_FEC and parity datagrams
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_FEC 0x0000000000000002ULL
+
+/**
+ * HELLO capability bit: peer can receive ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_GROUP_KEY 0x0000000000000004ULL
+
+/**
+ * HELLO capability bit: peer answers VERB_NAT_PROBE
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_NAT_PROBE 0x0000000000000008ULL
+
+/**
+ * HELLO capability bit: peer can receive payloads compressed with zstd (ZT_PROTO_VERB_FLAG_ZSTD)
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_ZSTD 0x0000000000000010ULL
+
+/**
+ * HELLO capability bit: peer copies CE marks on packets it receives into the frames they hold
+ *
+ * Direct packets holding an ECN-capable IP frame are only sent with that
+ * frame's ECN field to peers that advertise this. Marks on packets to other
+ * peers would be lost, so routers would mark instead of dropping and the
+ * flow inside would never slow down.
+ */
+#define ZT_PROTO_HELLO_CAPABILITY_ECN 0x0000000000000020ULL
+
 /**
  * DEPRECATED payload encrypted flag, may be re-used in the future.
  *
@@ -141,6 +224,21 @@
  */
 #define ZT_PROTO_VERB_FLAG_COMPRESSED 0x80
 
+/**
+ * Verb flag set along with ZT_PROTO_VERB_FLAG_COMPRESSED if zstd was used instead of LZ4
+ *
+ * This is only sent to peers that advertise ZT_PROTO_HELLO_CAPABILITY_ZSTD.
+ * Older nodes would take such a payload for LZ4 and drop it.
+ */
+#define ZT_PROTO_VERB_FLAG_ZSTD 0x40
+
+/**
+ * zstd compression level for packet payloads
+ *
+ * Packets are small, so higher levels gain little for the extra CPU.
+ */
+#define ZT_PROTO_ZSTD_LEVEL 3
+
 /**
  * Rounds used for Salsa20 encryption in ZT
  *
@@ -285,6 +383,13 @@
 #define ZT_PROTO_VERB_RENDEZVOUS_IDX_ADDRLEN (ZT_PROTO_VERB_RENDEZVOUS_IDX_PORT + 2)
 #define ZT_PROTO_VERB_RENDEZVOUS_IDX_ADDRESS (ZT_PROTO_VERB_RENDEZVOUS_IDX_ADDRLEN + 1)
 
+// RENDEZVOUS flag: sender asks an upstream to RENDEZVOUS it with the given peer
+#define ZT_PROTO_VERB_RENDEZVOUS_FLAG_REQUEST 0x01
+
+// First byte of the payload of an ECHO probing a relay, see VERB_ECHO
+#define ZT_PROTO_ECHO_RELAY_PROBE 0x01
+#define ZT_PROTO_ECHO_RELAY_PROBE_LENGTH 14
+
 #define ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID (ZT_PACKET_IDX_PAYLOAD)
 #define ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE (ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID + 8)
 #define ZT_PROTO_VERB_FRAME_IDX_PAYLOAD (ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE + 2)
@@ -324,6 +429,25 @@
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_ADI + 4)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE + 2)
 
+#define ZT_PROTO_VERB_PATH_FEC_IDX_FLAGS (ZT_PACKET_IDX_PAYLOAD)
+
+// PATH_FEC flag: send parity on this path
+#define ZT_PROTO_VERB_PATH_FEC_FLAG_SEND_PARITY 0x01
+
+#define ZT_PROTO_VERB_BENCH_IDX_TYPE (ZT_PACKET_IDX_PAYLOAD)
+#define ZT_PROTO_VERB_BENCH_IDX_SESSION (ZT_PROTO_VERB_BENCH_IDX_TYPE + 1)
+#define ZT_PROTO_VERB_BENCH_IDX_VALUE (ZT_PROTO_VERB_BENCH_IDX_SESSION + 8)
+#define ZT_PROTO_VERB_BENCH_IDX_RESULT (ZT_PROTO_VERB_BENCH_IDX_VALUE + 8)
+
+// BENCH message types
+#define ZT_PROTO_VERB_BENCH_TYPE_PING 0x01
+#define ZT_PROTO_VERB_BENCH_TYPE_PONG 0x02
+#define ZT_PROTO_VERB_BENCH_TYPE_DATA 0x03
+#define ZT_PROTO_VERB_BENCH_TYPE_RESULT_REQUEST 0x04
+#define ZT_PROTO_VERB_BENCH_TYPE_RESULT 0x05
+
+#define ZT_PROTO_VERB_NAT_PROBE_IDX_DELAY (ZT_PACKET_IDX_PAYLOAD)
+
 #define ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP (ZT_PROTO_VERB_OK_IDX_PAYLOAD)
 #define ZT_PROTO_VERB_HELLO__OK__IDX_PROTOCOL_VERSION (ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP + 8)
 #define ZT_PROTO_VERB_HELLO__OK__IDX_MAJOR_VERSION (ZT_PROTO_VERB_HELLO__OK__IDX_PROTOCOL_VERSION + 1)
@@ -385,9 +509,15 @@ namespace ZeroTier {
  *
  * For unencrypted packets, MAC is computed on plaintext. Only HELLO is ever
  * sent in the clear, as it's the "here is my public key" message.
+ *
+ * Packets (and IncomingPackets) created with new come from a per-thread
+ * pool of freed buffers and can be held by SharedPtr, so a packet can be
+ * queued or shared by handle instead of copied.
  */
 class Packet : public Buffer<ZT_PROTO_MAX_PACKET_LENGTH>
 {
+	template<typename T> friend class SharedPtr;
+
 public:
 	/**
 	 * A packet fragment
@@ -556,6 +686,7 @@ public:
 		 *   [... additional moon type/ID/timestamp tuples ...]
 		 *   <[2] 16-bit length of certificate of representation>
 		 *   [... certificate of representation ...]
+		 *   [<[8] 64-bit capability flags (ZT_PROTO_HELLO_CAPABILITY_*)>]
 		 *
 		 * HELLO is sent in the clear as it is how peers share their identity
 		 * public keys. A few additional fields are sent in the clear too, but
@@ -579,6 +710,7 @@ public:
 		 *   [[...] updates to planets and/or moons]
 		 *   <[2] 16-bit length of certificate of representation>
 		 *   [... certificate of representation ...]
+		 *   [<[8] 64-bit capability flags (ZT_PROTO_HELLO_CAPABILITY_*)>]
 		 *
 		 * With the exception of the timestamp, the other fields pertain to the
 		 * respondent who is sending OK and are not echoes.
@@ -628,16 +760,26 @@ public:
 
 		/**
 		 * Relay-mediated NAT traversal or firewall punching initiation:
-		 *   <[1] flags (unused, currently 0)>
+		 *   <[1] flags>
 		 *   <[5] ZeroTier address of peer that might be found at this address>
 		 *   <[2] 16-bit protocol address port>
 		 *   <[1] protocol address length (4 for IPv4, 16 for IPv6)>
 		 *   <[...] protocol address (network byte order)>
 		 *
+		 * Flags:
+		 *   0x01 - Request: only flags and address are present
+		 *
 		 * An upstream node can send this to inform both sides of a relay of
-		 * information they might use to establish a direct connection.
+		 * information they might use to establish a direct connection. It
+		 * sends one for each address family both sides have.
 		 *
-		 * Upon receipt a peer sends HELLO to establish a direct link.
+		 * Upon receipt a peer sends HELLO to establish a direct link, from
+		 * all of its sockets and also to a few predicted ports for IPv4.
+		 *
+		 * A node that starts sending to a peer it has no direct path to can
+		 * send a request to an upstream, which then unites the two right
+		 * away instead of waiting to relay a packet between them. Upstreams
+		 * that don't understand requests ignore them.
 		 *
 		 * No OK or ERROR is generated.
 		 */
@@ -703,6 +845,12 @@ public:
 		 * This generates OK with a copy of the transmitted payload. No ERROR
 		 * is generated. Response to ECHO requests is optional and ECHO may be
 		 * ignored if a node detects a possible flood.
+		 *
+		 * ECHOs sent through a relay to find out whether and how fast it can
+		 * reach a peer carry this payload, which only the sender interprets:
+		 *   <[1] ZT_PROTO_ECHO_RELAY_PROBE>
+		 *   <[5] address of relay>
+		 *   <[8] 64-bit timestamp of sender>
 		 */
 		VERB_ECHO = 0x08,
 
@@ -761,7 +909,8 @@ public:
 		 * This message requests network configuration from a node capable of
 		 * providing it.
 		 *
-		 * Respones to this are always whole configs intended for the recipient.
+		 * Respones to this are whole configs intended for the recipient, or
+		 * deltas against the config it holds (see flags under NETWORK_CONFIG).
 		 * For patches and other updates a NETWORK_CONFIG is sent instead.
 		 *
 		 * It would be valid and correct as of 1.2.0 to use NETWORK_CONFIG always,
@@ -820,6 +969,12 @@ public:
 		 *
 		 * Flags:
 		 *   0x01 - Use fast propagation
+		 *   0x02 - Assembled dictionary is a delta against the recipient's config
+		 *
+		 * A delta is only sent to a member that advertised the hash of the config
+		 * it holds in its request meta-data. If the recipient can't apply it, it
+		 * discards its base and requests a full config. Deltas are never fast
+		 * propagated since they are specific to their recipient.
 		 *
 		 * An OK should be sent if the config is successfully received and
 		 * accepted.
@@ -881,6 +1036,12 @@ public:
 		 *   0x01 - Network certificate of membership attached (DEPRECATED)
 		 *   0x02 - Implicit gather limit field is present
 		 *   0x04 - Source MAC is specified -- otherwise it's computed from sender
+		 *   0x08 - Recipient is a multicast replicator and should re-send to the group
+		 *
+		 * A multicast replicator re-sends with flag 0x08 cleared and the
+		 * original source MAC, and recipients accept that source MAC from it
+		 * as they would from an active bridge. Older nodes ignore 0x08, and it
+		 * is only sent to nodes the network config designates as replicators.
 		 *
 		 * OK and ERROR responses are optional. OK may be generated if there are
 		 * implicit gather results or if the recipient wants to send its own
@@ -970,7 +1131,73 @@ public:
 		 * node on startup. This is helpful in identifying traces from different
 		 * members of a cluster.
 		 */
-		VERB_REMOTE_TRACE = 0x15
+		VERB_REMOTE_TRACE = 0x15,
+
+		/**
+		 * Ask for forward error correction on the path this arrives on:
+		 *   <[1] flags>
+		 *
+		 * Flags:
+		 *   0x01 - send FEC parity datagrams (otherwise stop)
+		 *
+		 * This is sent directly (never relayed) by a node that sees sustained
+		 * loss of packets arriving on a path, and repeated while that lasts.
+		 * The peer then follows each group of datagrams it sends us on that
+		 * path with a parity datagram (see Fec.hpp) from which one lost
+		 * datagram of the group can be rebuilt. Parity stops if requests stop.
+		 * It's only sent to peers that advertise ZT_PROTO_HELLO_CAPABILITY_FEC.
+		 *
+		 * OK and ERROR are not generated.
+		 */
+		VERB_PATH_FEC = 0x16,
+
+		/**
+		 * Throughput and round trip time test:
+		 *   <[1] type>
+		 *   <[8] session ID>
+		 *   <[8] value>
+		 *   [<[...] type-specific fields>]
+		 *
+		 * Types:
+		 *   0x01 - PING, value is a timestamp answered with a PONG
+		 *   0x02 - PONG, value is the timestamp from the PING
+		 *   0x03 - DATA, value is a sequence number, followed by padding
+		 *   0x04 - RESULT_REQUEST, value is unused
+		 *   0x05 - RESULT, value is unused, followed by:
+		 *          <[8] DATA packets received in this session>
+		 *          <[8] bytes of DATA received (packet sizes on the wire)>
+		 *          <[8] nanoseconds from first to last DATA received>
+		 *
+		 * The node running the test (see Bench.hpp) sends DATA as fast as
+		 * allowed with PINGs mixed in, then asks for a RESULT. Session IDs are
+		 * random and chosen by the sender. The receiver keeps counts for one
+		 * session at a time, and a RESULT for an unknown session reports zero.
+		 * Peers that don't know this verb ignore it, so no RESULT comes back.
+		 *
+		 * OK and ERROR are not generated.
+		 */
+		VERB_BENCH = 0x17,
+
+		/**
+		 * NAT binding timeout probe:
+		 *   <[4] delay in milliseconds>
+		 *
+		 * This asks the peer to answer with OK(NAT_PROBE) on the path this
+		 * arrives on, but not until the delay has passed. The sender stays
+		 * silent on that path meanwhile, so an answer shows that the NAT
+		 * bindings along it outlast that much idle time and a missing one
+		 * that they may not. The peer holds its own heartbeats on the path
+		 * until it answers. Probes are sent directly (never relayed) in place
+		 * of a heartbeat, and only to peers that advertise
+		 * ZT_PROTO_HELLO_CAPABILITY_NAT_PROBE. Delays over
+		 * ZT_PATH_NAT_PROBE_MAX_DELAY are cut to it.
+		 *
+		 * OK payload:
+		 *   <[4] delay in milliseconds as requested>
+		 *
+		 * ERROR is not generated.
+		 */
+		VERB_NAT_PROBE = 0x18
 	};
 
 	/**
@@ -1012,13 +1239,24 @@ public:
 	{
 	}
 
+	Packet(const Packet &p) :
+		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(p)
+	{
+	}
+
+	inline Packet &operator=(const Packet &p)
+	{
+		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>::operator=(p);
+		return *this;
+	}
+
 	Packet(const void *data,unsigned int len) :
 		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(data,len)
 	{
 	}
 
 	/**
-	 * Construct a new empty packet with a unique random packet ID
+	 * Construct a new empty packet with a unique packet ID
 	 *
 	 * Flags and hops will be zero. Other fields and data region are undefined.
 	 * Use the header access methods (setDestination() and friends) to fill out
@@ -1027,7 +1265,7 @@ public:
 	Packet() :
 		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(ZT_PROTO_MIN_PACKET_LENGTH)
 	{
-		Utils::getSecureRandom(field(ZT_PACKET_IDX_IV,8),8);
+		_newPacketId(field(ZT_PACKET_IDX_IV,8));
 		(*this)[ZT_PACKET_IDX_FLAGS] = 0; // zero flags, cipher ID, and hops
 	}
 
@@ -1043,12 +1281,12 @@ public:
 	Packet(const Packet &prototype,const Address &dest) :
 		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(prototype)
 	{
-		Utils::getSecureRandom(field(ZT_PACKET_IDX_IV,8),8);
+		_newPacketId(field(ZT_PACKET_IDX_IV,8));
 		setDestination(dest);
 	}
 
 	/**
-	 * Construct a new empty packet with a unique random packet ID
+	 * Construct a new empty packet with a unique packet ID
 	 *
 	 * @param dest Destination ZT address
 	 * @param source Source ZT address
@@ -1057,7 +1295,7 @@ public:
 	Packet(const Address &dest,const Address &source,const Verb v) :
 		Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(ZT_PROTO_MIN_PACKET_LENGTH)
 	{
-		Utils::getSecureRandom(field(ZT_PACKET_IDX_IV,8),8);
+		_newPacketId(field(ZT_PACKET_IDX_IV,8));
 		setDestination(dest);
 		setSource(source);
 		(*this)[ZT_PACKET_IDX_FLAGS] = 0; // zero flags and hops
@@ -1074,7 +1312,7 @@ public:
 	inline void reset(const Address &dest,const Address &source,const Verb v)
 	{
 		setSize(ZT_PROTO_MIN_PACKET_LENGTH);
-		Utils::getSecureRandom(field(ZT_PACKET_IDX_IV,8),8);
+		_newPacketId(field(ZT_PACKET_IDX_IV,8));
 		setDestination(dest);
 		setSource(source);
 		(*this)[ZT_PACKET_IDX_FLAGS] = 0; // zero flags, cipher ID, and hops
@@ -1088,7 +1326,7 @@ public:
 	 * technically different but otherwise identical copies of the same
 	 * packet.
 	 */
-	inline void newInitializationVector() { Utils::getSecureRandom(field(ZT_PACKET_IDX_IV,8),8); }
+	inline void newInitializationVector() { _newPacketId(field(ZT_PACKET_IDX_IV,8)); }
 
 	/**
 	 * Set this packet's destination
@@ -1247,8 +1485,21 @@ public:
 	 * @param key 32-byte key
 	 * @param encryptPayload If true, encrypt packet payload, else just MAC
 	 * @param counter Packet send counter for destination peer -- only least significant 3 bits are used
+	 * @param keySchedule Salsa20 instance keyed with key to skip expanding it again (see Peer::keySchedule()), or NULL
+	 */
+	void armor(const void *key,bool encryptPayload,unsigned int counter,const Salsa20 *keySchedule = (const Salsa20 *)0);
+
+	/**
+	 * Armor packet with the AES-GMAC-SIV cipher suite
+	 *
+	 * This must only be used if AES::accelerated() is true and the peer has
+	 * advertised support for this suite. Until dearmor() the packet ID field
+	 * holds half of the synthetic IV instead of the packet ID.
+	 *
+	 * @param aesKeys GMAC and CTR keys derived from the peer key (see Peer::aesKeys())
+	 * @param counter Packet send counter for destination peer -- only least significant 3 bits are used
 	 */
-	void armor(const void *key,bool encryptPayload,unsigned int counter);
+	void armorAesGmacSiv(const AES aesKeys[2],unsigned int counter);
 
 	/**
 	 * Verify and (if encrypted) decrypt packet
@@ -1257,10 +1508,37 @@ public:
 	 * for these. These are handled in IncomingPacket if the sending physical
 	 * address and MAC field match a trusted path.
 	 *
+	 * AES-GMAC-SIV packets are rejected if aesKeys is NULL or this CPU has
+	 * no hardware AES.
+	 *
 	 * @param key 32-byte key
+	 * @param aesKeys AES-GMAC-SIV keys or NULL if not available
+	 * @param keySchedule Salsa20 instance keyed with key to skip expanding it again (see Peer::keySchedule()), or NULL
 	 * @return False if packet is invalid or failed MAC authenticity check
 	 */
-	bool dearmor(const void *key);
+	bool dearmor(const void *key,const AES *aesKeys = (const AES *)0,const Salsa20 *keySchedule = (const Salsa20 *)0);
+
+	/**
+	 * Armor packet with a network's multicast group key
+	 *
+	 * The result doesn't depend on the destination address or the fragmented
+	 * flag, so one armored packet can be copied to each recipient with only
+	 * setDestination() between them. The packet ID is used as is, with no
+	 * link quality counter, so give it a new one before calling this.
+	 *
+	 * @param key 32-byte group key
+	 */
+	void armorGroup(const void *key);
+
+	/**
+	 * Verify and decrypt a packet armored with armorGroup()
+	 *
+	 * The packet is left as received if this fails.
+	 *
+	 * @param key 32-byte group key
+	 * @return False if packet isn't group armored or failed MAC authenticity check
+	 */
+	bool dearmorGroup(const void *key);
 
 	/**
 	 * Encrypt/decrypt a separately armored portion of a packet
@@ -1289,53 +1567,170 @@ public:
 	 */
 	bool compress();
 
+	/**
+	 * Attempt to compress payload with zstd instead of LZ4
+	 *
+	 * This trades CPU for a better ratio and should only be used for peers
+	 * that advertise ZT_PROTO_HELLO_CAPABILITY_ZSTD. If this build doesn't
+	 * have zstd, this is the same as compress().
+	 *
+	 * @return True if compression occurred
+	 */
+	bool compressZstd();
+
+	/**
+	 * @return True if this build can compress and decompress with zstd
+	 */
+	static inline bool zstdAvailable()
+	{
+#ifdef ZT_USE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	/**
 	 * Attempt to decompress payload if it is compressed (must be unencrypted)
 	 *
-	 * If payload is compressed, it is decompressed and the compressed verb
-	 * flag is cleared. Otherwise nothing is done and true is returned.
+	 * If payload is compressed, with LZ4 or zstd, it is decompressed and the
+	 * compression verb flags are cleared. Otherwise nothing is done and true
+	 * is returned.
 	 *
 	 * @return True if data is now decompressed and valid, false on error
 	 */
 	bool uncompress();
 
+	/**
+	 * LZ4 compress arbitrary data the same way packet payloads are compressed
+	 *
+	 * @param in Data to compress
+	 * @param inLen Length of data
+	 * @param out Buffer for compressed data
+	 * @param outCapacity Size of out
+	 * @return Compressed length, or 0 if it did not fit in out
+	 */
+	static unsigned int lz4Compress(const void *in,unsigned int inLen,void *out,unsigned int outCapacity);
+
+	/**
+	 * Decompress data compressed with lz4Compress()
+	 *
+	 * @param in Compressed data
+	 * @param inLen Length of compressed data
+	 * @param out Buffer for decompressed data
+	 * @param outCapacity Size of out
+	 * @return Decompressed length, or -1 if data is invalid or did not fit in out
+	 */
+	static int lz4Decompress(const void *in,unsigned int inLen,void *out,unsigned int outCapacity);
+
+	/**
+	 * Allocate from this thread's pool of packet buffers
+	 *
+	 * The pool is refilled from the HugePages arena, or the heap if there is
+	 * none, and returns what it has no room for there.
+	 */
+	static void *operator new(size_t sz);
+
+	/**
+	 * Return to this thread's pool of packet buffers
+	 */
+	static void operator delete(void *p,size_t sz);
+
 private:
 	static const unsigned char ZERO_KEY[32];
 
+	AtomicCounter __refCount;
+
 	/**
-	 * Deterministically mangle a 256-bit crypto key based on packet
+	 * Write a new packet ID / IV
+	 *
+	 * IDs come from a per-thread 61-bit counter that starts at a random value,
+	 * so they are unique without drawing random bytes for every packet. The
+	 * counter advances in steps of 8 since armor() overwrites the least
+	 * significant 3 bits with the path's QoS counter.
+	 *
+	 * @param id Eight byte IV field to fill
+	 */
+	static void _newPacketId(void *id);
+
+	// Poly1305/Salsa20/12 armor and dearmor once the cipher suite is set
+	void _armorSalsa20(const void *key,bool encryptPayload,const Salsa20 *keySchedule);
+	bool _dearmorSalsa20(const void *key,bool encrypted,const Salsa20 *keySchedule);
+
+	/**
+	 * Compute the bytes XORed with the first 21 bytes of the key for this packet
 	 *
 	 * This uses extra data from the packet to mangle the secret, giving us an
 	 * effective IV that is somewhat more than 64 bits. This is "free" for
 	 * Salsa20 since it has negligible key setup time so using a different
 	 * key each time is fine.
 	 *
-	 * @param in Input key (32 bytes)
-	 * @param out Output buffer (32 bytes)
+	 * @param tweak Output buffer (21 bytes)
 	 */
-	inline void _salsa20MangleKey(const unsigned char *in,unsigned char *out) const
+	inline void _salsa20KeyTweak(unsigned char *tweak) const
 	{
 		const unsigned char *d = (const unsigned char *)data();
 
 		// IV and source/destination addresses. Using the addresses divides the
 		// key space into two halves-- A->B and B->A (since order will change).
 		for(unsigned int i=0;i<18;++i) // 8 + (ZT_ADDRESS_LENGTH * 2) == 18
-			out[i] = in[i] ^ d[i];
+			tweak[i] = d[i];
 
 		// Flags, but with hop count masked off. Hop count is altered by forwarding
 		// nodes. It's one of the only parts of a packet modifiable by people
 		// without the key.
-		out[18] = in[18] ^ (d[ZT_PACKET_IDX_FLAGS] & 0xf8);
+		tweak[18] = d[ZT_PACKET_IDX_FLAGS] & 0xf8;
+
+		// Group keyed packets are armored once for all recipients, so leave out
+		// what differs between them. The source stays in so two members never
+		// share a key stream.
+		if (((d[ZT_PACKET_IDX_FLAGS] & 0x38) >> 3) == ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012) {
+			for(unsigned int i=ZT_PACKET_IDX_DEST;i<(ZT_PACKET_IDX_DEST + ZT_ADDRESS_LENGTH);++i)
+				tweak[i] = 0;
+			tweak[18] &= (unsigned char)(~ZT_PROTO_FLAG_FRAGMENTED);
+		}
 
 		// Raw packet size in bytes -- thus each packet size defines a new
 		// key space.
-		out[19] = in[19] ^ (unsigned char)(size() & 0xff);
-		out[20] = in[20] ^ (unsigned char)((size() >> 8) & 0xff); // little endian
+		tweak[19] = (unsigned char)(size() & 0xff);
+		tweak[20] = (unsigned char)((size() >> 8) & 0xff); // little endian
+	}
+
+	/**
+	 * Deterministically mangle a 256-bit crypto key based on packet
+	 *
+	 * @param in Input key (32 bytes)
+	 * @param out Output buffer (32 bytes)
+	 */
+	inline void _salsa20MangleKey(const unsigned char *in,unsigned char *out) const
+	{
+		_salsa20KeyTweak(out);
+		for(unsigned int i=0;i<21;++i)
+			out[i] ^= in[i];
 
 		// Rest of raw key is used unchanged
 		for(unsigned int i=21;i<32;++i)
 			out[i] = in[i];
 	}
+
+	/**
+	 * Initialize Salsa20 with this packet's mangled key and IV
+	 *
+	 * @param s20 Salsa20 instance to initialize
+	 * @param key Input key (32 bytes)
+	 * @param keySchedule Salsa20 instance already keyed with key, or NULL to expand key
+	 */
+	inline void _salsa20Init(Salsa20 &s20,const void *key,const Salsa20 *keySchedule) const
+	{
+		unsigned char k[32];
+		if (keySchedule) {
+			_salsa20KeyTweak(k);
+			s20.initTweaked(*keySchedule,k,field(ZT_PACKET_IDX_IV,8));
+		} else {
+			_salsa20MangleKey((const unsigned char *)key,k);
+			s20.init(k,field(ZT_PACKET_IDX_IV,8));
+		}
+	}
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,234 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+#ifndef ZT_PACKETTRACE_HPP
+#define ZT_PACKETTRACE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+/**
+ * Number of records kept (must be a power of two)
+ */
+#define ZT_PACKETTRACE_RECORDS 8192
+
+namespace ZeroTier {
+
+/**
+ * Sampled binary records of packet path events, kept in a ring buffer
+ *
+ * Recording an event is an atomic increment plus a 64-byte copy, with no
+ * locks, so this can be left on in production. Sampling is by packet ID
+ * so that every event for a sampled packet is recorded. The buffer is only
+ * allocated once sampling is first turned on.
+ *
+ * Readers copy records out and check each record's sequence number before
+ * and after, skipping any that were being overwritten at the time.
+ */
+class PacketTrace : NonCopyable
+{
+public:
+	enum Event
+	{
+		EVENT_PACKET_RECEIVED = 1,  // authenticated and about to be handled
+		EVENT_PACKET_SENT = 2,      // sent to a peer (hops is 0)
+		EVENT_PACKET_RELAYED = 3,   // not for us, passed on (hops is as received)
+		EVENT_PACKET_DROPPED = 4,   // see reason
+		EVENT_FRAME_DROPPED = 5     // see reason; networkId is set
+	};
+
+	enum Reason
+	{
+		REASON_NONE = 0,
+		REASON_INVALID = 1,
+		REASON_HELLO_REJECTED = 2,
+		REASON_UNTRUSTED_PATH = 3,
+		REASON_MAC_FAILED = 4,
+		REASON_TX_TIMEOUT = 5,
+		REASON_ACCESS_DENIED = 6,
+		REASON_REJECTED_INBOUND = 7,
+		REASON_REJECTED_OUTBOUND = 8
+	};
+
+	/**
+	 * One event, 64 bytes
+	 */
+	struct Record
+	{
+		uint64_t seq; // 1-based position in the sequence of all records, 0 while being written
+		uint64_t timestamp;
+		uint64_t packetId;
+		uint64_t networkId;
+		uint64_t source; // ZeroTier address, or 0
+		uint64_t destination; // ZeroTier address, or 0
+		uint32_t size;
+		uint8_t event;
+		uint8_t reason;
+		uint8_t verb;
+		uint8_t hops;
+		uint8_t reserved[8];
+	};
+
+	PacketTrace() :
+		_records((Record *)0),
+		_next(0),
+		_counter(0),
+		_sampleRate(0) {}
+
+	~PacketTrace() { delete [] _load(_records); }
+
+	/**
+	 * Set sampling rate: 0 for off, 1 for every packet, N for about one in N
+	 *
+	 * This may be called at any time from any thread.
+	 */
+	inline void setSampleRate(const unsigned int rate)
+	{
+		if ((rate)&&(!_load(_records))) {
+			Record *const r = new Record[ZT_PACKETTRACE_RECORDS];
+			memset(r,0,sizeof(Record) * ZT_PACKETTRACE_RECORDS);
+			if (!_setRecords(r))
+				delete [] r; // someone else got there first
+		}
+		_store(_sampleRate,rate);
+	}
+
+	inline unsigned int sampleRate() const { return _load(_sampleRate); }
+
+	/**
+	 * @param packetId Packet ID or 0 if the event has none
+	 * @return True if an event for this packet should be recorded
+	 */
+	inline bool sample(const uint64_t packetId)
+	{
+		const unsigned int rate = _load(_sampleRate);
+		if (rate <= 1)
+			return (rate == 1);
+		const uint64_t h = (packetId) ? (packetId * 0x9e3779b97f4a7c15ULL) : (_fetchAdd(_counter) * 0x9e3779b97f4a7c15ULL);
+		return (((h >> 32) % rate) == 0);
+	}
+
+	/**
+	 * Record an event, if this packet is sampled
+	 */
+	inline void record(const uint64_t now,const Event event,const Reason reason,const uint64_t packetId,const uint64_t networkId,const uint64_t source,const uint64_t destination,const unsigned int verb,const unsigned int hops,const unsigned int size)
+	{
+		if (!sample(packetId))
+			return;
+		Record *const records = _load(_records);
+		const uint64_t seq = _fetchAdd(_next) + 1;
+		Record &r = records[(seq - 1) & (ZT_PACKETTRACE_RECORDS - 1)];
+		_storeSeq(r.seq,0);
+		_fence();
+		r.timestamp = now;
+		r.packetId = packetId;
+		r.networkId = networkId;
+		r.source = source;
+		r.destination = destination;
+		r.size = (uint32_t)size;
+		r.event = (uint8_t)event;
+		r.reason = (uint8_t)reason;
+		r.verb = (uint8_t)verb;
+		r.hops = (uint8_t)hops;
+		_storeSeq(r.seq,seq);
+	}
+
+	/**
+	 * Copy out records after a given sequence number, oldest first
+	 *
+	 * To follow the trace, pass the return value as 'since' next time.
+	 *
+	 * @param since Return only records with a higher sequence number (0 for all)
+	 * @param out Records are appended here
+	 * @return Sequence number of the last record written
+	 */
+	inline uint64_t get(uint64_t since,std::vector<Record> &out) const
+	{
+		const Record *const records = _load(_records);
+		const uint64_t last = _load(_next);
+		if (!records)
+			return last;
+		if (since > last)
+			since = 0; // from before a restart
+		if ((last - since) > ZT_PACKETTRACE_RECORDS)
+			since = last - ZT_PACKETTRACE_RECORDS;
+		for(uint64_t seq=since+1;seq<=last;++seq) {
+			const Record &r = records[(seq - 1) & (ZT_PACKETTRACE_RECORDS - 1)];
+			if (_loadSeq(r.seq) != seq)
+				continue; // not finished yet, or already overwritten
+			out.push_back(r);
+			_fence();
+			if (_loadSeq(r.seq) != seq)
+				out.pop_back(); // overwritten while we were copying it
+		}
+		return last;
+	}
+
+private:
+#ifdef __GNUC__
+	template<typename T>
+	static inline T _load(const T &v) { return __atomic_load_n(&v,__ATOMIC_ACQUIRE); }
+	template<typename T>
+	static inline void _store(T &v,const T n) { __atomic_store_n(&v,n,__ATOMIC_RELEASE); }
+	static inline uint64_t _fetchAdd(uint64_t &v) { return __atomic_fetch_add(&v,1,__ATOMIC_RELAXED); }
+	static inline uint64_t _loadSeq(const uint64_t &v) { return __atomic_load_n(&v,__ATOMIC_ACQUIRE); }
+	static inline void _storeSeq(uint64_t &v,const uint64_t n) { __atomic_store_n(&v,n,__ATOMIC_RELEASE); }
+	static inline void _fence() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+	inline bool _setRecords(Record *r) { Record *expected = (Record *)0; return __atomic_compare_exchange_n(&_records,&expected,r,false,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE); }
+
+	Record *_records;
+	uint64_t _next;
+	uint64_t _counter;
+	unsigned int _sampleRate;
+#else
+	template<typename T>
+	static inline T _load(const std::atomic<T> &v) { return v.load(std::memory_order_acquire); }
+	template<typename T>
+	static inline void _store(std::atomic<T> &v,const T n) { v.store(n,std::memory_order_release); }
+	static inline uint64_t _fetchAdd(std::atomic<uint64_t> &v) { return v.fetch_add(1,std::memory_order_relaxed); }
+	static inline uint64_t _loadSeq(const uint64_t &v) { const uint64_t n = *reinterpret_cast<const volatile uint64_t *>(&v); std::atomic_thread_fence(std::memory_order_acquire); return n; }
+	static inline void _storeSeq(uint64_t &v,const uint64_t n) { std::atomic_thread_fence(std::memory_order_release); *reinterpret_cast<volatile uint64_t *>(&v) = n; }
+	static inline void _fence() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+	inline bool _setRecords(Record *r) { Record *expected = (Record *)0; return _records.compare_exchange_strong(expected,r); }
+
+	std::atomic<Record *> _records;
+	std::atomic<uint64_t> _next;
+	std::atomic<uint64_t> _counter;
+	std::atomic<unsigned int> _sampleRate;
+#endif
+};
+
+} // namespace ZeroTier
+
+#endif
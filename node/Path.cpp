@@ -27,16 +27,146 @@
 #include "Path.hpp"
 #include "RuntimeEnvironment.hpp"
 #include "Node.hpp"
+#include "Fec.hpp"
 
 namespace ZeroTier {
 
-bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,uint64_t now)
+// Jumbo (9000) and 4352-byte link MTUs, less IPv6 and UDP headers and some slack
+static const unsigned int _mtuProbeSizes[ZT_PATH_MTU_PROBE_STEPS] = { 8900,4300 };
+
+Path::~Path()
+{
+	delete _fec;
+}
+
+bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,uint64_t now,unsigned int ecn)
 {
-	if (RR->node->putPacket(tPtr,_localSocket,_addr,data,len)) {
+	if (RR->node->putPacket(tPtr,_localSocket,_addr.toInetAddress(),data,len,ecn << ZT_WIRE_PACKET_ECN_SHIFT)) {
 		_lastOut = now;
+		++_packetsOut;
+		_bytesOut += len;
+		return true;
+	}
+	return false;
+}
+
+unsigned int Path::mtuProbeSize(const uint64_t now)
+{
+	if (_mtuProbePacketId) {
+		if ((now - _lastMtuProbe) < ZT_PATH_MTU_PROBE_TIMEOUT)
+			return 0;
+		_mtuProbePacketId = 0; // not answered, so try the next smaller size
+		if (++_mtuProbeStep >= ZT_PATH_MTU_PROBE_STEPS)
+			_mtu = ZT_UDP_DEFAULT_PAYLOAD_MTU;
+	}
+	if (_mtuProbeStep >= ZT_PATH_MTU_PROBE_STEPS) {
+		if ( ((now - _lastMtuProbe) < ZT_PATH_MTU_PROBE_INTERVAL) || ((now - _lastLargeOut) >= ZT_PATH_MTU_PROBE_INTERVAL) )
+			return 0;
+		_mtuProbeStep = 0;
+	}
+	return _mtuProbeSizes[_mtuProbeStep];
+}
+
+bool Path::mtuProbeAnswered(const uint64_t inRePacketId)
+{
+	if ((inRePacketId)&&(inRePacketId == _mtuProbePacketId)) {
+		const unsigned int step = _mtuProbeStep;
+		_mtuProbePacketId = 0;
+		if (step < ZT_PATH_MTU_PROBE_STEPS)
+			_mtu = _mtuProbeSizes[step];
+		_mtuProbeStep = ZT_PATH_MTU_PROBE_STEPS;
+		return true;
+	}
+	return false;
+}
+
+void Path::natProbeCheck(const uint64_t now)
+{
+	if (!alive(now)) {
+		// Start over when it comes back, since the path may now cross different NATs
+		_natProbePacketId = 0;
+		_natTimeout = 0;
+		_natTimeoutMax = ZT_PATH_NAT_PROBE_MAX_DELAY;
+		return;
+	}
+	if ((_natProbePacketId)&&((now - _lastNatProbe) >= ((uint64_t)_natProbeDelay + ZT_PATH_NAT_PROBE_TIMEOUT))) {
+		_natProbePacketId = 0;
+		if ((_lastOut == _lastNatProbe)&&(_natProbeDelay < _natTimeoutMax))
+			_natTimeoutMax = _natProbeDelay;
+	}
+}
+
+unsigned int Path::natProbeDelay(const uint64_t now) const
+{
+	if ((_natProbePacketId)||((now - _lastNatProbe) < ZT_PATH_NAT_PROBE_INTERVAL))
+		return 0;
+	const unsigned int lo = std::max((unsigned int)_natTimeout,(unsigned int)(ZT_PATH_HEARTBEAT_PERIOD + ZT_PATH_NAT_PROBE_MARGIN));
+	const unsigned int hi = _natTimeoutMax;
+	if (hi <= (lo + ZT_PATH_NAT_PROBE_RESOLUTION))
+		return 0;
+	return ((lo + hi) / 2);
+}
+
+bool Path::natProbeAnswered(const uint64_t now,const uint64_t inRePacketId)
+{
+	if ((inRePacketId)&&(inRePacketId == _natProbePacketId)) {
+		_natProbePacketId = 0;
+		if ((_lastOut == _lastNatProbe)&&(_packetsIn == (_natProbePacketsIn + 1))) { // the answer itself is the only packet in
+			const unsigned int idle = (unsigned int)std::min(now - _lastNatProbe,(uint64_t)ZT_PATH_NAT_PROBE_MAX_DELAY);
+			if (idle > _natTimeout)
+				_natTimeout = idle;
+			if (_natTimeoutMax < _natTimeout)
+				_natTimeoutMax = _natTimeout;
+		}
 		return true;
 	}
 	return false;
 }
 
+int Path::fecRequest(const uint64_t now)
+{
+	if ((now - _lastFecCheck) < ZT_PATH_FEC_REQUEST_INTERVAL)
+		return -1;
+	_lastFecCheck = now;
+	const unsigned int lq = linkQuality();
+	if (_fecWanted) {
+		if (lq >= ZT_PATH_FEC_DONE_QUALITY) {
+			_fecWanted = false;
+			return 0;
+		}
+	} else if (lq <= ZT_PATH_FEC_WANT_QUALITY) {
+		_fecWanted = true;
+	} else {
+		return -1;
+	}
+	return 1;
+}
+
+unsigned int Path::fecEncode(const void *data,unsigned int len,const Address &source,void *parity)
+{
+	Mutex::Lock _l(_fec_m);
+	if (!_fec)
+		_fec = new Fec();
+	return _fec->encode(data,len,source,parity);
+}
+
+void Path::fecRemember(const void *data,unsigned int len)
+{
+	Mutex::Lock _l(_fec_m);
+	if (!_fec)
+		_fec = new Fec();
+	_fec->remember(data,len);
+}
+
+int Path::fecRepair(const void *parity,unsigned int len,void *repaired)
+{
+	Mutex::Lock _l(_fec_m);
+	if (!_fec)
+		return 0;
+	const int r = _fec->repair(parity,len,repaired);
+	if (r > 0)
+		++_fecRepaired;
+	return r;
+}
+
 } // namespace ZeroTier
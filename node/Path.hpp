@@ -36,19 +36,54 @@
 
 #include "Constants.hpp"
 #include "InetAddress.hpp"
+#include "CompactInetAddress.hpp"
 #include "SharedPtr.hpp"
 #include "AtomicCounter.hpp"
 #include "NonCopyable.hpp"
+#include "Mutex.hpp"
+#include "Address.hpp"
 #include "Utils.hpp"
+#include "HugePages.hpp"
 
 /**
  * Maximum return value of preferenceRank()
  */
 #define ZT_PATH_MAX_PREFERENCE_RANK ((ZT_INETADDRESS_MAX_SCOPE << 1) | 1)
 
+/**
+ * Loss estimate meaning every probe was lost
+ */
+#define ZT_PATH_LOSS_MAX 65535
+
+/**
+ * Number of sizes tried (largest first) during path MTU discovery
+ */
+#define ZT_PATH_MTU_PROBE_STEPS 2
+
+/**
+ * Link quality (see Path::linkQuality()) at or below which we ask for FEC parity
+ */
+#define ZT_PATH_FEC_WANT_QUALITY 250
+
+/**
+ * Link quality at or above which we ask for FEC parity to stop
+ */
+#define ZT_PATH_FEC_DONE_QUALITY 254
+
+/**
+ * How often FEC parity is asked for while it's wanted
+ */
+#define ZT_PATH_FEC_REQUEST_INTERVAL 5000
+
+/**
+ * Parity stops if the peer hasn't asked for it in this long
+ */
+#define ZT_PATH_FEC_REQUEST_TIMEOUT (ZT_PATH_FEC_REQUEST_INTERVAL * 3)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class Fec;
 
 /**
  * A path across the physical network
@@ -91,45 +126,154 @@ public:
 	};
 
 	Path() :
-		_lastOut(0),
+		_localSocket(-1),
+		_addr(),
+		_ipScope(InetAddress::IP_SCOPE_NONE),
+		_mtu(ZT_UDP_DEFAULT_PAYLOAD_MTU),
+		_mtuProbeStep(ZT_PATH_MTU_PROBE_STEPS),
+		_lastMtuProbe(0),
+		_mtuProbePacketId(0),
+		_lastProbeSent(0),
+		_srtt(0),
+		_rttvar(0),
+		_loss(0),
 		_lastIn(0),
 		_lastTrustEstablishedPacketReceived(0),
+		_packetsIn(0),
+		_bytesIn(0),
 		_incomingLinkQualityFastLog(0xffffffffffffffffULL),
-		_localSocket(-1),
 		_incomingLinkQualitySlowLogPtr(0),
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
+		_lastOut(0),
+		_lastLargeOut(0),
+		_packetsOut(0),
+		_bytesOut(0),
 		_outgoingPacketCounter(0),
-		_addr(),
-		_ipScope(InetAddress::IP_SCOPE_NONE)
+		_fecRequested(0),
+		_lastFecCheck(0),
+		_fecWanted(false),
+		_fecRepaired(0),
+		_fec((Fec *)0),
+		_lastNatProbe(0),
+		_natProbePacketId(0),
+		_natProbePacketsIn(0),
+		_natProbeDelay(0),
+		_natTimeout(0),
+		_natTimeoutMax(ZT_PATH_NAT_PROBE_MAX_DELAY),
+		_natReplyDue(0),
+		_natReplyPacketId(0),
+		_natReplyDelay(0)
 	{
 		for(int i=0;i<(int)sizeof(_incomingLinkQualitySlowLog);++i)
 			_incomingLinkQualitySlowLog[i] = ZT_PATH_LINK_QUALITY_MAX;
 	}
 
 	Path(const int64_t localSocket,const InetAddress &addr) :
-		_lastOut(0),
+		_localSocket(localSocket),
+		_addr(addr),
+		_ipScope(addr.ipScope()),
+		_mtu(ZT_UDP_DEFAULT_PAYLOAD_MTU),
+		_mtuProbeStep(ZT_PATH_MTU_PROBE_STEPS),
+		_lastMtuProbe(0),
+		_mtuProbePacketId(0),
+		_lastProbeSent(0),
+		_srtt(0),
+		_rttvar(0),
+		_loss(0),
 		_lastIn(0),
 		_lastTrustEstablishedPacketReceived(0),
+		_packetsIn(0),
+		_bytesIn(0),
 		_incomingLinkQualityFastLog(0xffffffffffffffffULL),
-		_localSocket(localSocket),
 		_incomingLinkQualitySlowLogPtr(0),
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
+		_lastOut(0),
+		_lastLargeOut(0),
+		_packetsOut(0),
+		_bytesOut(0),
 		_outgoingPacketCounter(0),
-		_addr(addr),
-		_ipScope(addr.ipScope())
+		_fecRequested(0),
+		_lastFecCheck(0),
+		_fecWanted(false),
+		_fecRepaired(0),
+		_fec((Fec *)0),
+		_lastNatProbe(0),
+		_natProbePacketId(0),
+		_natProbePacketsIn(0),
+		_natProbeDelay(0),
+		_natTimeout(0),
+		_natTimeoutMax(ZT_PATH_NAT_PROBE_MAX_DELAY),
+		_natReplyDue(0),
+		_natReplyPacketId(0),
+		_natReplyDelay(0)
 	{
 		for(int i=0;i<(int)sizeof(_incomingLinkQualitySlowLog);++i)
 			_incomingLinkQualitySlowLog[i] = ZT_PATH_LINK_QUALITY_MAX;
 	}
 
+	~Path();
+
+	/**
+	 * Allocate from the HugePages arena if there is one
+	 */
+	static inline void *operator new(size_t sz) { return HugePages::allocate(sz); }
+	static inline void operator delete(void *p,size_t sz) { HugePages::free(p,sz); }
+
 	/**
 	 * Called when a packet is received from this remote path, regardless of content
 	 *
 	 * @param t Time of receive
+	 * @param len Length of packet in bytes
 	 */
-	inline void received(const uint64_t t) { _lastIn = t; }
+	inline void received(const uint64_t t,const unsigned int len)
+	{
+		_lastIn = t;
+		++_packetsIn;
+		_bytesIn += len;
+	}
+
+	/**
+	 * Note that a HELLO or ECHO probe was sent directly on this path
+	 *
+	 * Only the latest probe is tracked. If the one before it was never
+	 * answered it is counted as lost.
+	 *
+	 * @param now Current time
+	 */
+	inline void probeSent(const uint64_t now)
+	{
+		if (_lastProbeSent)
+			_loss = _loss - (_loss >> 3) + (ZT_PATH_LOSS_MAX >> 3);
+		_lastProbeSent = now;
+	}
+
+	/**
+	 * Note a direct OK(HELLO) or OK(ECHO) received on this path
+	 *
+	 * This takes a round trip time sample against the outstanding probe and
+	 * updates smoothed RTT and RTT variance (jitter) as TCP does (RFC 6298).
+	 *
+	 * @param now Current time
+	 */
+	inline void probeAnswered(const uint64_t now)
+	{
+		const uint64_t ps = _lastProbeSent;
+		if ((ps)&&(now >= ps)&&((now - ps) <= ZT_HELLO_MAX_ALLOWABLE_LATENCY)) {
+			_lastProbeSent = 0;
+			_loss = _loss - (_loss >> 3);
+			const int r = (int)(now - ps);
+			if (!_srtt) {
+				_srtt = (unsigned int)(r << 3) | 1; // low bit keeps a 0ms sample distinct from unknown
+				_rttvar = (unsigned int)(r << 1);
+			} else {
+				const int d = r - (int)(_srtt >> 3);
+				_srtt = (unsigned int)((int)_srtt + d);
+				_rttvar = (unsigned int)((int)_rttvar + ((d < 0) ? -d : d) - (int)(_rttvar >> 2));
+			}
+		}
+	}
 
 	/**
 	 * Update link quality using a counter from an incoming packet (or packet head in fragmented case)
@@ -177,9 +321,56 @@ public:
 	 * @param data Packet data
 	 * @param len Packet length
 	 * @param now Current time
+	 * @param ecn IP ECN field to send with (0 for not ECN-capable)
 	 * @return True if transport reported success
 	 */
-	bool send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,uint64_t now);
+	bool send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,uint64_t now,unsigned int ecn = 0);
+
+	/**
+	 * @return Largest packet known to cross this path unfragmented (UDP payload bytes)
+	 */
+	inline unsigned int mtu() const { return _mtu; }
+
+	/**
+	 * Note that a packet too big for the default MTU was sent on this path
+	 *
+	 * Path MTU discovery only runs on paths that would benefit from it.
+	 *
+	 * @param now Current time
+	 */
+	inline void largePacketSent(const uint64_t now) { _lastLargeOut = now; }
+
+	/**
+	 * Advance path MTU discovery and get the size of the next probe to send
+	 *
+	 * Probes are tried from the largest size down, one at a time. The first
+	 * one answered sets the path MTU. If none are answered the MTU falls back
+	 * to ZT_UDP_DEFAULT_PAYLOAD_MTU.
+	 *
+	 * @param now Current time
+	 * @return Size of probe to send now (UDP payload bytes) or 0 if none
+	 */
+	unsigned int mtuProbeSize(const uint64_t now);
+
+	/**
+	 * Note that an MTU probe of the size last returned by mtuProbeSize() was sent
+	 *
+	 * @param now Current time
+	 * @param packetId Packet ID of probe
+	 */
+	inline void mtuProbeSent(const uint64_t now,const uint64_t packetId)
+	{
+		_lastMtuProbe = now;
+		_mtuProbePacketId = packetId;
+	}
+
+	/**
+	 * Check whether an OK(ECHO) answers this path's outstanding MTU probe
+	 *
+	 * @param inRePacketId Packet ID the OK is in reply to
+	 * @return True if this was the MTU probe (path MTU has been updated)
+	 */
+	bool mtuProbeAnswered(const uint64_t inRePacketId);
 
 	/**
 	 * Manually update last sent time
@@ -196,7 +387,12 @@ public:
 	/**
 	 * @return Physical address
 	 */
-	inline const InetAddress &address() const { return _addr; }
+	inline InetAddress address() const { return _addr.toInetAddress(); }
+
+	/**
+	 * @return Physical address as stored, for comparisons that don't need an InetAddress
+	 */
+	inline const CompactInetAddress &compactAddress() const { return _addr; }
 
 	/**
 	 * @return IP scope -- faster shortcut for address().ipScope()
@@ -215,7 +411,7 @@ public:
 	{
 		// This causes us to rank paths in order of IP scope rank (see InetAdddress.hpp) but
 		// within each IP scope class to prefer IPv6 over IPv4.
-		return ( ((unsigned int)_ipScope << 1) | (unsigned int)(_addr.ss_family == AF_INET6) );
+		return ( ((unsigned int)_ipScope << 1) | (unsigned int)(_addr.family() == AF_INET6) );
 	}
 
 	/**
@@ -258,15 +454,215 @@ public:
 		return false;
 	}
 
+	/**
+	 * @return Smoothed round trip time in milliseconds or 0 if not yet measured
+	 */
+	inline unsigned int rtt() const { return (_srtt >> 3); }
+
+	/**
+	 * @return Round trip time variance (jitter) in milliseconds
+	 */
+	inline unsigned int jitter() const { return (_rttvar >> 2); }
+
+	/**
+	 * @return Smoothed probe loss from 0 (none) to ZT_PATH_LOSS_MAX (all)
+	 */
+	inline unsigned int loss() const { return _loss; }
+
+	/**
+	 * Estimate path quality from RTT, jitter, and probe loss
+	 *
+	 * The score is RTT plus twice the jitter, multiplied by up to four as
+	 * probe loss rises. It is only meaningful when compared to another path.
+	 *
+	 * @return Score (lower is better) or 0xffffffff if RTT has not been measured
+	 */
+	inline unsigned int quality() const
+	{
+		const unsigned int srtt = _srtt;
+		if (!srtt)
+			return 0xffffffff;
+		const uint64_t d = (uint64_t)(srtt >> 3) + (uint64_t)(_rttvar >> 1) + 1;
+		return (unsigned int)std::min((d * ((uint64_t)ZT_PATH_LOSS_MAX + 1 + ((uint64_t)_loss * 3))) >> 16,(uint64_t)0xfffffffe);
+	}
+
+	/**
+	 * @return Time in ms after which an unanswered probe or request on this path is taken as lost
+	 */
+	inline unsigned int answerTimeout() const
+	{
+		const unsigned int srtt = _srtt;
+		if (!srtt)
+			return ZT_WHOIS_RETRY_DELAY;
+		return std::max(std::min((srtt >> 3) + _rttvar,(unsigned int)ZT_WHOIS_RETRY_DELAY),(unsigned int)ZT_UPSTREAM_MIN_ANSWER_TIMEOUT);
+	}
+
+	/**
+	 * @return Time the outstanding probe was sent if nothing at all has been received since, otherwise 0
+	 */
+	inline uint64_t unansweredProbe() const
+	{
+		const uint64_t ps = _lastProbeSent;
+		return ((ps)&&(_lastIn < ps)) ? ps : 0;
+	}
+
+	/**
+	 * @return Packets received on this path
+	 */
+	inline uint64_t packetsIn() const { return _packetsIn; }
+
+	/**
+	 * @return Packets sent on this path
+	 */
+	inline uint64_t packetsOut() const { return _packetsOut; }
+
+	/**
+	 * @return Bytes received on this path
+	 */
+	inline uint64_t bytesIn() const { return _bytesIn; }
+
+	/**
+	 * @return Bytes sent on this path
+	 */
+	inline uint64_t bytesOut() const { return _bytesOut; }
+
 	/**
 	 * @return True if path appears alive
 	 */
-	inline bool alive(const uint64_t now) const { return ((now - _lastIn) <= ZT_PATH_ALIVE_TIMEOUT); }
+	inline bool alive(const uint64_t now) const
+	{
+		// A NAT probe's silence is counted from when it was sent, as if it had been answered then
+		const uint64_t li = (_natProbePacketId) ? std::max((uint64_t)_lastIn,(uint64_t)_lastNatProbe) : (uint64_t)_lastIn;
+		return ((now - li) <= ZT_PATH_ALIVE_TIMEOUT);
+	}
+
+	/**
+	 * @return Heartbeat period, stretched to just under the path's measured NAT binding timeout
+	 */
+	inline unsigned int heartbeatPeriod() const
+	{
+		const unsigned int t = _natTimeout;
+		return (t > (ZT_PATH_HEARTBEAT_PERIOD + ZT_PATH_NAT_PROBE_MARGIN)) ? std::min(t - ZT_PATH_NAT_PROBE_MARGIN,(unsigned int)ZT_PATH_KEEPALIVE_MAX) : ZT_PATH_HEARTBEAT_PERIOD;
+	}
 
 	/**
 	 * @return True if this path needs a heartbeat
 	 */
-	inline bool needsHeartbeat(const uint64_t now) const { return ((now - _lastOut) >= ZT_PATH_HEARTBEAT_PERIOD); }
+	inline bool needsHeartbeat(const uint64_t now) const
+	{
+		// Neither side sends heartbeats while a NAT probe is outstanding
+		if ((_natProbePacketId)||(now < _natReplyDue))
+			return false;
+		return ((now - _lastOut) >= heartbeatPeriod());
+	}
+
+	/**
+	 * @return Time this path will next need a heartbeat, NAT probe answer, or NAT probe timeout check
+	 */
+	inline uint64_t nextHeartbeat() const
+	{
+		if (_natReplyPacketId)
+			return _natReplyDue;
+		if (_natProbePacketId)
+			return _lastNatProbe + _natProbeDelay + ZT_PATH_NAT_PROBE_TIMEOUT;
+		return _lastOut + heartbeatPeriod();
+	}
+
+	/**
+	 * Time out an unanswered NAT probe, and forget what was measured if the path has died
+	 *
+	 * A probe that times out with nothing else sent on the path meanwhile
+	 * sets an upper bound on the NAT binding timeout. This should be called
+	 * before needsHeartbeat() when checking paths for keepalives.
+	 *
+	 * @param now Current time
+	 */
+	void natProbeCheck(const uint64_t now);
+
+	/**
+	 * Get the delay for the next NAT binding timeout probe, if one is due
+	 *
+	 * This is a binary search between the longest idle time the path is
+	 * known to survive (at least ZT_PATH_HEARTBEAT_PERIOD) and the shortest
+	 * it may not, which starts at ZT_PATH_NAT_PROBE_MAX_DELAY. Probes are
+	 * sent at most every ZT_PATH_NAT_PROBE_INTERVAL until the two are within
+	 * ZT_PATH_NAT_PROBE_RESOLUTION.
+	 *
+	 * @param now Current time
+	 * @return Delay to ask for in milliseconds, or 0 to send an ordinary heartbeat
+	 */
+	unsigned int natProbeDelay(const uint64_t now) const;
+
+	/**
+	 * Note that a NAT probe was sent on this path
+	 *
+	 * @param now Current time
+	 * @param packetId Packet ID of probe
+	 * @param delay Delay it asked for
+	 */
+	inline void natProbeSent(const uint64_t now,const uint64_t packetId,const unsigned int delay)
+	{
+		_lastNatProbe = now;
+		_natProbeDelay = delay;
+		_natProbePacketsIn = _packetsIn;
+		_natProbePacketId = packetId;
+	}
+
+	/**
+	 * Check whether an OK(NAT_PROBE) answers this path's outstanding NAT probe
+	 *
+	 * The time since the probe was sent becomes the path's known NAT binding
+	 * timeout, unless something else crossed the path in either direction
+	 * while waiting and could have refreshed the bindings.
+	 *
+	 * @param now Current time
+	 * @param inRePacketId Packet ID the OK is in reply to
+	 * @return True if this was the NAT probe
+	 */
+	bool natProbeAnswered(const uint64_t now,const uint64_t inRePacketId);
+
+	/**
+	 * @return True if a NAT probe is outstanding (nothing else should be sent on this path)
+	 */
+	inline bool natProbing() const { return (_natProbePacketId != 0); }
+
+	/**
+	 * @return Longest idle time NAT bindings on this path are known to survive, or 0 if not measured
+	 */
+	inline unsigned int natTimeout() const { return _natTimeout; }
+
+	/**
+	 * Note a VERB_NAT_PROBE from the peer on this path, to be answered after its delay
+	 *
+	 * Only the latest is remembered.
+	 *
+	 * @param now Current time
+	 * @param packetId Packet ID of probe
+	 * @param delay Delay it asked for (already capped)
+	 */
+	inline void natReplyRequested(const uint64_t now,const uint64_t packetId,const unsigned int delay)
+	{
+		_natReplyDue = now + delay;
+		_natReplyDelay = delay;
+		_natReplyPacketId = packetId;
+	}
+
+	/**
+	 * Take the peer's NAT probe if its answer is due
+	 *
+	 * @param now Current time
+	 * @param delay Set to the delay it asked for
+	 * @return Packet ID of the probe to answer, or 0 if none is due
+	 */
+	inline uint64_t natReplyDue(const uint64_t now,unsigned int &delay)
+	{
+		const uint64_t pid = _natReplyPacketId;
+		if ((!pid)||(now < _natReplyDue))
+			return 0;
+		_natReplyPacketId = 0;
+		delay = _natReplyDelay;
+		return pid;
+	}
 
 	/**
 	 * @return Last time we sent something
@@ -290,19 +686,116 @@ public:
 	 */
 	inline unsigned int nextOutgoingCounter() { return _outgoingPacketCounter++; }
 
+	/**
+	 * Note a VERB_PATH_FEC from the peer on this path
+	 *
+	 * @param now Current time
+	 * @param on True to send parity, false to stop
+	 */
+	inline void fecRequested(const uint64_t now,const bool on) { _fecRequested = (on) ? now : 0; }
+
+	/**
+	 * @return True if the peer on this path wants FEC parity from us
+	 */
+	inline bool fecActive(const uint64_t now) const { return ((now - _fecRequested) < ZT_PATH_FEC_REQUEST_TIMEOUT); }
+
+	/**
+	 * Decide whether to send the peer on this path a VERB_PATH_FEC
+	 *
+	 * This is checked as packets arrive, at most every
+	 * ZT_PATH_FEC_REQUEST_INTERVAL. Parity is wanted from when link quality
+	 * falls to ZT_PATH_FEC_WANT_QUALITY until it recovers to
+	 * ZT_PATH_FEC_DONE_QUALITY, and is asked for again each time while wanted.
+	 *
+	 * @param now Current time
+	 * @return 1 to ask for parity, 0 to ask for it to stop, or -1 to send nothing
+	 */
+	int fecRequest(const uint64_t now);
+
+	/**
+	 * @return True if we want FEC parity on this path (and remember datagrams to use it)
+	 */
+	inline bool fecWanted() const { return _fecWanted; }
+
+	/**
+	 * Cover a datagram we just sent on this path with FEC (see Fec::encode())
+	 */
+	unsigned int fecEncode(const void *data,unsigned int len,const Address &source,void *parity);
+
+	/**
+	 * Remember a datagram received on this path for FEC (see Fec::remember())
+	 */
+	void fecRemember(const void *data,unsigned int len);
+
+	/**
+	 * Rebuild a lost datagram from parity received on this path (see Fec::repair())
+	 */
+	int fecRepair(const void *parity,unsigned int len,void *repaired);
+
+	/**
+	 * @return Datagrams rebuilt from FEC parity received on this path
+	 */
+	inline uint64_t fecRepaired() const { return _fecRepaired; }
+
 private:
-	volatile uint64_t _lastOut;
+	// Read-mostly fields, fields written by the receive path, fields written
+	// by the send path, and the reference count each get their own cache lines.
+	// Counters and estimators are updated without locks; a rare lost update
+	// only makes a statistic slightly less precise.
+
+	int64_t _localSocket;
+	CompactInetAddress _addr;
+	InetAddress::IpScope _ipScope; // memoize this since it's a computed value checked often
+	volatile unsigned int _mtu;
+	volatile unsigned int _mtuProbeStep; // index of size being probed, ZT_PATH_MTU_PROBE_STEPS if not probing
+	volatile uint64_t _lastMtuProbe;
+	volatile uint64_t _mtuProbePacketId; // 0 if no MTU probe is outstanding
+	volatile uint64_t _lastProbeSent; // 0 if no probe is outstanding
+	volatile unsigned int _srtt; // smoothed RTT in ms * 8, 0 if unknown
+	volatile unsigned int _rttvar; // RTT variance in ms * 4
+	volatile unsigned int _loss; // smoothed loss, 0 to ZT_PATH_LOSS_MAX
+
+	uint8_t _pad0[ZT_CACHE_LINE_SIZE];
+
 	volatile uint64_t _lastIn;
 	volatile uint64_t _lastTrustEstablishedPacketReceived;
+	volatile uint64_t _packetsIn;
+	volatile uint64_t _bytesIn;
 	volatile uint64_t _incomingLinkQualityFastLog;
-	int64_t _localSocket;
 	volatile unsigned long _incomingLinkQualitySlowLogPtr;
 	volatile signed int _incomingLinkQualitySlowLogCounter;
 	volatile unsigned int _incomingLinkQualityPreviousPacketCounter;
-	volatile unsigned int _outgoingPacketCounter;
-	InetAddress _addr;
-	InetAddress::IpScope _ipScope; // memoize this since it's a computed value checked often
 	volatile uint8_t _incomingLinkQualitySlowLog[32];
+
+	uint8_t _pad1[ZT_CACHE_LINE_SIZE];
+
+	volatile uint64_t _lastOut;
+	volatile uint64_t _lastLargeOut;
+	volatile uint64_t _packetsOut;
+	volatile uint64_t _bytesOut;
+	volatile unsigned int _outgoingPacketCounter;
+	volatile uint64_t _fecRequested; // last time peer asked for parity, 0 if it asked us to stop
+
+	uint8_t _pad2[ZT_CACHE_LINE_SIZE];
+
+	volatile uint64_t _lastFecCheck;
+	volatile bool _fecWanted;
+	volatile uint64_t _fecRepaired;
+	Fec *_fec; // allocated on first use
+	Mutex _fec_m;
+
+	volatile uint64_t _lastNatProbe;
+	volatile uint64_t _natProbePacketId; // 0 if no NAT probe is outstanding
+	volatile uint64_t _natProbePacketsIn; // _packetsIn when it was sent
+	volatile unsigned int _natProbeDelay;
+	volatile unsigned int _natTimeout; // longest idle time bindings survived, 0 if not measured
+	volatile unsigned int _natTimeoutMax; // shortest idle time they may not survive
+	volatile uint64_t _natReplyDue; // heartbeats are held until then
+	volatile uint64_t _natReplyPacketId; // peer's NAT probe to answer, 0 if none
+	volatile unsigned int _natReplyDelay;
+
+	uint8_t _pad3[ZT_CACHE_LINE_SIZE];
+
 	AtomicCounter __refCount;
 };
 
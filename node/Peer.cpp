@@ -24,6 +24,8 @@
  * of your own application.
  */
 
+#include <algorithm>
+
 #include "../version.h"
 
 #include "Constants.hpp"
@@ -34,34 +36,103 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Trace.hpp"
+#include "Topology.hpp"
+#include "Buffer.hpp"
+#include "Salsa20.hpp"
+#include "Poly1305.hpp"
+#include "SHA512.hpp"
+#include "Cluster.hpp"
+#include "Probes.hpp"
 
 namespace ZeroTier {
 
-Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const uint8_t *key) :
 	RR(renv),
+	_myIdentity(&(renv->identity)),
+	_id(peerIdentity),
+	_vProto(0),
+	_vMajor(0),
+	_vMinor(0),
+	_vRevision(0),
+	_remoteCapabilities(0),
 	_lastReceive(0),
 	_lastNontrivialReceive(0),
+	_lastNontrivialSend(0),
+	_compressionBytesIn(0),
+	_compressionBytesSaved(0),
+	_compressionBytesSkipped(0),
+	_compressionZstdBytesIn(0),
+	_compressionZstdBytesSaved(0),
+	_packetsIn(0),
+	_packetsOut(0),
+	_bytesIn(0),
+	_bytesOut(0),
+	_packetsDropped(0),
+	_lastActivity(0),
+	_latency(0),
+	_requestSent(0),
+	_pingDeadline(0),
 	_lastTriedMemorizedPath(0),
 	_lastDirectPathPushSent(0),
 	_lastDirectPathPushReceive(0),
 	_lastCredentialRequestSent(0),
 	_lastWhoisRequestReceived(0),
+	_lastRendezvousRequestSent(0),
+	_lastRelayProbeSent(0),
 	_lastEchoRequestReceived(0),
 	_lastComRequestReceived(0),
 	_lastComRequestSent(0),
 	_lastCredentialsReceived(0),
 	_lastTrustEstablishedPacketReceived(0),
-	_vProto(0),
-	_vMajor(0),
-	_vMinor(0),
-	_vRevision(0),
-	_id(peerIdentity),
-	_latency(0),
+	_lastStateSaved(0),
 	_directPathPushCutoffCount(0),
-	_credentialsCutoffCount(0)
+	_credentialsCutoffCount(0),
+	_relayProbeCounter(0),
+	_relayViaAnswered(0),
+	_relayViaLatency(0),
+	_reportedLatency(0)
+{
+	_primaryPaths[0] = (Path *)0;
+	_primaryPaths[1] = (Path *)0;
+	if (key) {
+		memcpy(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+		_initDerivedKeys();
+		++_keyReady;
+	}
+	memset(_compressionSkip,0,sizeof(_compressionSkip));
+	memset(_compressionBackoff,0,sizeof(_compressionBackoff));
+}
+
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
+	Peer(renv,peerIdentity,(const uint8_t *)0)
 {
-	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
-		throw ZT_EXCEPTION_INVALID_ARGUMENT;
+	_myIdentity = &myIdentity;
+}
+
+void Peer::_agree() const
+{
+	Mutex::Lock _l(_key_m);
+	if (!_keyReady.load()) {
+		// This only fails if our identity lacks a secret, in which case the key
+		// is left zeroed and nothing we armor will authenticate.
+		if (!_myIdentity->agree(_id,_key,ZT_PEER_SECRET_KEY_LENGTH))
+			Utils::burn(_key,sizeof(_key));
+		_initDerivedKeys();
+		++_keyReady;
+	}
+}
+
+void Peer::_initDerivedKeys() const
+{
+	static const uint8_t zeroIv[8] = { 0,0,0,0,0,0,0,0 };
+	_s20.init(_key,zeroIv);
+	if (AES::accelerated()) {
+		uint8_t k[64];
+		SHA512::hash(k,_key,ZT_PEER_SECRET_KEY_LENGTH);
+		_aes[0].init(k);
+		_aes[1].init(k + 32);
+		Utils::burn(k,sizeof(k));
+	}
 }
 
 void Peer::received(
@@ -77,14 +148,10 @@ void Peer::received(
 {
 	const uint64_t now = RR->node->now();
 
-/*
-#ifdef ZT_ENABLE_CLUSTER
-	bool isClusterSuboptimalPath = false;
-	if ((RR->cluster)&&(hops == 0)) {
-		// Note: findBetterEndpoint() is first since we still want to check
-		// for a better endpoint even if we don't actually send a redirect.
+	// Cluster members send peers that HELLO from far away to a closer member
+	if ((RR->cluster)&&(hops == 0)&&(verb == Packet::VERB_HELLO)) {
 		InetAddress redirectTo;
-		if ( (verb != Packet::VERB_OK) && (verb != Packet::VERB_ERROR) && (verb != Packet::VERB_RENDEZVOUS) && (verb != Packet::VERB_PUSH_DIRECT_PATHS) && (RR->cluster->findBetterEndpoint(redirectTo,_id.address(),path->address(),false)) ) {
+		if (RR->cluster->findBetterEndpoint(redirectTo,_id.address(),path->address(),false)) {
 			if (_vProto >= 5) {
 				// For newer peers we can send a more idiomatic verb: PUSH_DIRECT_PATHS.
 				Packet outp(_id.address(),RR->identity.address(),Packet::VERB_PUSH_DIRECT_PATHS);
@@ -101,7 +168,7 @@ void Peer::received(
 					outp.append(redirectTo.rawIpData(),16);
 				}
 				outp.append((uint16_t)redirectTo.port());
-				outp.armor(_key,true,path->nextOutgoingCounter());
+				outp.armor(key(),true,path->nextOutgoingCounter(),keySchedule());
 				path->send(RR,tPtr,outp.data(),outp.size(),now);
 			} else {
 				// For older peers we use RENDEZVOUS to coax them into contacting us elsewhere.
@@ -116,22 +183,23 @@ void Peer::received(
 					outp.append((uint8_t)16);
 					outp.append(redirectTo.rawIpData(),16);
 				}
-				outp.armor(_key,true,path->nextOutgoingCounter());
+				outp.armor(key(),true,path->nextOutgoingCounter(),keySchedule());
 				path->send(RR,tPtr,outp.data(),outp.size(),now);
 			}
-			isClusterSuboptimalPath = true;
 		}
 	}
-#endif
-*/
 
 	_lastReceive = now;
+	_requestSent = 0;
 	switch (verb) {
 		case Packet::VERB_FRAME:
 		case Packet::VERB_EXT_FRAME:
 		case Packet::VERB_NETWORK_CONFIG_REQUEST:
 		case Packet::VERB_NETWORK_CONFIG:
 		case Packet::VERB_MULTICAST_FRAME:
+			// Only active peers are kept alive, so that's when pings need scheduling
+			if (!isActive(now))
+				RR->node->schedulePeerPing(SharedPtr<Peer>(this),now + ZT_PING_CHECK_INVERVAL);
 			_lastNontrivialReceive = now;
 			break;
 		default: break;
@@ -145,54 +213,102 @@ void Peer::received(
 	if (_vProto >= 9)
 		path->updateLinkQuality((unsigned int)(packetId & 7));
 
+	if ((hops == 0)&&((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_FEC) != 0)) {
+		// Ask for FEC parity while packets arriving on this path are being lost
+		const int fr = path->fecRequest(now);
+		if (fr >= 0) {
+			Packet outp(_id.address(),RR->identity.address(),Packet::VERB_PATH_FEC);
+			outp.append((uint8_t)((fr) ? ZT_PROTO_VERB_PATH_FEC_FLAG_SEND_PARITY : 0));
+			outp.armor(key(),true,path->nextOutgoingCounter(),keySchedule());
+			path->send(RR,tPtr,outp.data(),outp.size(),now);
+		}
+	}
+
 	if (hops == 0) {
 		// If this is a direct packet (no hops), update existing paths or learn new ones
 		bool pathAlreadyKnown = false;
+		const int family = path->compactAddress().family();
+
+		// Paths are canonicalized by Topology::getPath(), so the common case of
+		// a packet arriving on the current primary path is a pointer compare.
+		// If the primary is replaced concurrently this timestamp may land on
+		// its successor, which is harmless since a new primary is always one
+		// that has just been heard from.
+		if ((family == AF_INET)||(family == AF_INET6)) {
+			const unsigned int pi = (family == AF_INET) ? 0 : 1;
+			if (__atomic_load_n(&(_primaryPaths[pi]),__ATOMIC_ACQUIRE) == path.ptr()) {
+				__atomic_store_n(&(((pi == 0) ? _v4Path : _v6Path).lr),now,__ATOMIC_RELAXED);
+				pathAlreadyKnown = true;
+			}
+		}
 
-		{
-			Mutex::Lock _l(_paths_m);
-			if ((path->address().ss_family == AF_INET)&&(_v4Path.p)) {
-				const struct sockaddr_in *const r = reinterpret_cast<const struct sockaddr_in *>(&(path->address()));
-				const struct sockaddr_in *const l = reinterpret_cast<const struct sockaddr_in *>(&(_v4Path.p->address()));
-				if ((r->sin_addr.s_addr == l->sin_addr.s_addr)&&(r->sin_port == l->sin_port)&&(path->localSocket() == _v4Path.p->localSocket())) {
-					_v4Path.lr = now;
-					pathAlreadyKnown = true;
-				}
-			} else if ((path->address().ss_family == AF_INET6)&&(_v6Path.p)) {
-				const struct sockaddr_in6 *const r = reinterpret_cast<const struct sockaddr_in6 *>(&(path->address()));
-				const struct sockaddr_in6 *const l = reinterpret_cast<const struct sockaddr_in6 *>(&(_v6Path.p->address()));
-				if ((!memcmp(r->sin6_addr.s6_addr,l->sin6_addr.s6_addr,16))&&(r->sin6_port == l->sin6_port)&&(path->localSocket() == _v6Path.p->localSocket())) {
-					_v6Path.lr = now;
+		if ((!pathAlreadyKnown)&&(RR->node->multipathMode())) {
+			RWMutex::Lock _l(_paths_m);
+			for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+				if (_mpPaths[i].p == path) {
+					_mpPaths[i].lr = now;
 					pathAlreadyKnown = true;
+
+					// Promote an additional path if its family's primary path has died
+					_PeerPath &primary = (family == AF_INET) ? _v4Path : _v6Path;
+					if ( ((!primary.p)||(!primary.p->alive(now))) && ((now - primary.sticky) > ZT_PEER_PATH_EXPIRATION) ) {
+						std::swap(primary,_mpPaths[i]);
+						_publishPrimaryPaths();
+					}
+					break;
 				}
 			}
 		}
 
 		if ( (!pathAlreadyKnown) && (RR->node->shouldUsePathForZeroTierTraffic(tPtr,_id.address(),path->localSocket(),path->address())) ) {
-			Mutex::Lock _l(_paths_m);
-
-			_PeerPath *replacablePath = (_PeerPath *)0;
-			if (path->address().ss_family == AF_INET) {
-				if ( ( (!_v4Path.p) || (!_v4Path.p->alive(now)) || (path->preferenceRank() >= _v4Path.p->preferenceRank()) ) && ( (now - _v4Path.sticky) > ZT_PEER_PATH_EXPIRATION ) ) {
-					replacablePath = &_v4Path;
+			bool learned = false;
+			{
+				RWMutex::Lock _l(_paths_m);
+
+				_PeerPath *replacablePath = (_PeerPath *)0;
+				if (family == AF_INET) {
+					if ( ( (!_v4Path.p) || (!_v4Path.p->alive(now)) || (path->preferenceRank() >= _v4Path.p->preferenceRank()) ) && ( (now - _v4Path.sticky) > ZT_PEER_PATH_EXPIRATION ) ) {
+						replacablePath = &_v4Path;
+					}
+				} else if (family == AF_INET6) {
+					if ( ( (!_v6Path.p) || (!_v6Path.p->alive(now)) || (path->preferenceRank() >= _v6Path.p->preferenceRank()) ) && ( (now - _v6Path.sticky) > ZT_PEER_PATH_EXPIRATION ) ) {
+						replacablePath = &_v6Path;
+					}
 				}
-			} else if (path->address().ss_family == AF_INET6) {
-				if ( ( (!_v6Path.p) || (!_v6Path.p->alive(now)) || (path->preferenceRank() >= _v6Path.p->preferenceRank()) ) && ( (now - _v6Path.sticky) > ZT_PEER_PATH_EXPIRATION ) ) {
-					replacablePath = &_v6Path;
+
+				// In multipath mode a path that doesn't displace the primary is kept
+				// alongside it, and a displaced primary that still works is kept too.
+				_PeerPath *multipathSlot = (_PeerPath *)0;
+				if (RR->node->multipathMode()) {
+					if ((!replacablePath)||((replacablePath->p)&&(replacablePath->p->alive(now))))
+						multipathSlot = _multipathSlot(now);
+					if (!replacablePath) {
+						replacablePath = multipathSlot;
+						multipathSlot = (_PeerPath *)0;
+					}
 				}
-			}
 
-			if (replacablePath) {
-				if (verb == Packet::VERB_OK) {
-					RR->t->peerLearnedNewPath(tPtr,networkId,*this,replacablePath->p,path,packetId);
-					replacablePath->lr = now;
-					replacablePath->p = path;
-				} else {
-					RR->t->peerConfirmingUnknownPath(tPtr,networkId,*this,path,packetId,verb);
-					attemptToContactAt(tPtr,path->localSocket(),path->address(),now,true,path->nextOutgoingCounter());
-					path->sent(now);
+				if (replacablePath) {
+					if (verb == Packet::VERB_OK) {
+						RR->t->peerLearnedNewPath(tPtr,networkId,*this,replacablePath->p,path,packetId);
+						if (multipathSlot)
+							*multipathSlot = *replacablePath;
+						replacablePath->lr = now;
+						replacablePath->p = path;
+						_publishPrimaryPaths();
+						if (RR->cluster)
+							RR->cluster->broadcastHavePeer(_id);
+						learned = true;
+					} else {
+						RR->t->peerConfirmingUnknownPath(tPtr,networkId,*this,path,packetId,verb);
+						attemptToContactAt(tPtr,path->localSocket(),path->address(),now,true,path->nextOutgoingCounter());
+						path->sent(now);
+						path->probeSent(now);
+					}
 				}
 			}
+			if (learned)
+				postPathEvents(tPtr,now);
 		}
 	} else if (this->trustEstablished(now)) {
 		// Send PUSH_DIRECT_PATHS if hops>0 (relayed) and we have a trust relationship (common network membership)
@@ -248,7 +364,7 @@ void Peer::received(
 
 					if (count) {
 						outp.setAt(ZT_PACKET_IDX_PAYLOAD,(uint16_t)count);
-						outp.armor(_key,true,path->nextOutgoingCounter());
+						outp.armor(key(),true,path->nextOutgoingCounter(),keySchedule());
 						path->send(RR,tPtr,outp.data(),outp.size(),now);
 					}
 				}
@@ -259,7 +375,7 @@ void Peer::received(
 
 bool Peer::sendDirect(void *tPtr,const void *data,unsigned int len,uint64_t now,bool force)
 {
-	Mutex::Lock _l(_paths_m);
+	RWMutex::RLock _l(_paths_m);
 
 	uint64_t v6lr = 0;
 	if ( ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v6Path.p) )
@@ -268,6 +384,12 @@ bool Peer::sendDirect(void *tPtr,const void *data,unsigned int len,uint64_t now,
 	if ( ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v4Path.p) )
 		v4lr = _v4Path.p->lastIn();
 
+	if ((v6lr)&&(v4lr)) {
+		const SharedPtr<Path> *const bp = _betterLivePath(now);
+		if (bp)
+			return (*bp)->send(RR,tPtr,data,len,now);
+	}
+
 	if ( (v6lr > v4lr) && ((now - v6lr) < ZT_PATH_ALIVE_TIMEOUT) ) {
 		return _v6Path.p->send(RR,tPtr,data,len,now);
 	} else if ((now - v4lr) < ZT_PATH_ALIVE_TIMEOUT) {
@@ -283,9 +405,40 @@ bool Peer::sendDirect(void *tPtr,const void *data,unsigned int len,uint64_t now,
 	return false;
 }
 
+unsigned int Peer::relayQuality(const uint64_t now) const
+{
+	const uint64_t tsr = now - _lastReceive;
+	if (tsr >= ZT_PEER_ACTIVITY_TIMEOUT)
+		return (~(unsigned int)0);
+
+	unsigned int q = 0xffffffff;
+	unsigned int timeout = ZT_WHOIS_RETRY_DELAY;
+	uint64_t probe = 0;
+	{
+		RWMutex::RLock _l(_paths_m);
+		const Path *const pp[2] = { _v4Path.p.ptr(),_v6Path.p.ptr() };
+		for(int i=0;i<2;++i) {
+			if ((pp[i])&&(pp[i]->alive(now))&&(pp[i]->quality() <= q)) {
+				q = pp[i]->quality();
+				timeout = pp[i]->answerTimeout();
+				probe = pp[i]->unansweredProbe();
+			}
+		}
+	}
+
+	// Fail over as soon as the upstream should have answered, rather than when its paths expire
+	const uint64_t rs = _requestSent;
+	if ( ((rs)&&((now - rs) > timeout)) || ((probe)&&((now - probe) > timeout)) )
+		return (~(unsigned int)0) - 1;
+
+	if (q == 0xffffffff)
+		q = (_latency) ? _latency : 0xffff;
+	return (unsigned int)std::min((uint64_t)q * ((tsr / (ZT_PEER_PING_PERIOD + 1000)) + 1),(uint64_t)0xfffffffd);
+}
+
 SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
 {
-	Mutex::Lock _l(_paths_m);
+	RWMutex::RLock _l(_paths_m);
 
 	uint64_t v6lr = 0;
 	if ( ( includeExpired || ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) ) && (_v6Path.p) )
@@ -294,6 +447,12 @@ SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
 	if ( ( includeExpired || ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) ) && (_v4Path.p) )
 		v4lr = _v4Path.p->lastIn();
 
+	if ((v6lr)&&(v4lr)) {
+		const SharedPtr<Path> *const bp = _betterLivePath(now);
+		if (bp)
+			return *bp;
+	}
+
 	if (v6lr > v4lr) {
 		return _v6Path.p;
 	} else if (v4lr) {
@@ -303,6 +462,95 @@ SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
 	return SharedPtr<Path>();
 }
 
+void Peer::compressFrame(Packet &outp,const uint32_t flowId,const bool zstd)
+{
+	const unsigned int slot = (unsigned int)(flowId % ZT_PEER_COMPRESSION_FLOW_SLOTS);
+	const unsigned int before = outp.size();
+	const unsigned int payloadLen = before - ZT_PACKET_IDX_PAYLOAD;
+
+	if (_compressionSkip[slot]) {
+		--_compressionSkip[slot];
+		_compressionBytesSkipped += payloadLen;
+		return;
+	}
+
+	if (zstd)
+		outp.compressZstd();
+	else outp.compress();
+	const unsigned int saved = before - outp.size();
+	_compressionBytesIn += payloadLen;
+	_compressionBytesSaved += saved;
+	if (zstd) {
+		_compressionZstdBytesIn += payloadLen;
+		_compressionZstdBytesSaved += saved;
+	}
+
+	// Small frames like TCP ACKs say little about a flow, so only frames of
+	// 256 bytes or more adjust the policy. Saving less than 1/16th is poor.
+	if (payloadLen >= 256) {
+		if ((saved << 4) < payloadLen) {
+			const unsigned int b = std::min((unsigned int)_compressionBackoff[slot] + 1,(unsigned int)ZT_PEER_COMPRESSION_MAX_BACKOFF);
+			_compressionBackoff[slot] = (uint8_t)b;
+			_compressionSkip[slot] = (uint8_t)((1U << b) - 1);
+		} else {
+			_compressionBackoff[slot] = 0;
+		}
+	}
+}
+
+SharedPtr<Path> Peer::getFlowPath(const uint64_t now,const uint32_t flowId)
+{
+	RWMutex::RLock _l(_paths_m);
+
+	const _PeerPath *live[2 + ZT_PEER_MAX_MULTIPATH_PATHS];
+	unsigned int q[2 + ZT_PEER_MAX_MULTIPATH_PATHS];
+	unsigned int n = 0;
+	unsigned int bestq = 0xffffffff;
+	if (((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v4Path.p->alive(now)))
+		live[n++] = &_v4Path;
+	if (((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v6Path.p->alive(now)))
+		live[n++] = &_v6Path;
+	for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+		if (((now - _mpPaths[i].lr) < ZT_PEER_PATH_EXPIRATION)&&(_mpPaths[i].p->alive(now)))
+			live[n++] = &(_mpPaths[i]);
+	}
+	if (n < 2)
+		return SharedPtr<Path>();
+	for(unsigned int i=0;i<n;++i) {
+		q[i] = live[i]->p->quality();
+		bestq = std::min(bestq,q[i]);
+	}
+
+	// Weights are coarse (1, 2 or 4 draws) so that ordinary RTT noise doesn't
+	// move flows around. Unmeasured paths get the smallest share unless no
+	// path has been measured yet.
+	const _PeerPath *best = live[0];
+	uint64_t bestScore = 0;
+	for(unsigned int i=0;i<n;++i) {
+		unsigned int w = 1;
+		if ((q[i] != 0xffffffff)&&(bestq != 0xffffffff)) {
+			if ((uint64_t)q[i] <= ((uint64_t)bestq * 2))
+				w = 4;
+			else if ((uint64_t)q[i] <= ((uint64_t)bestq * 4))
+				w = 2;
+		}
+		for(unsigned int k=0;k<w;++k) {
+			uint64_t h = (((uint64_t)flowId << 32) | (uint64_t)k) ^ ((uint64_t)((uintptr_t)live[i]->p.ptr()) * 0x9e3779b97f4a7c15ULL);
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			if (h >= bestScore) {
+				bestScore = h;
+				best = live[i];
+			}
+		}
+	}
+
+	return best->p;
+}
+
 void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,uint64_t now,unsigned int counter)
 {
 	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_HELLO);
@@ -339,12 +587,15 @@ void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atA
 	RR->topology->appendCertificateOfRepresentation(outp);
 	outp.setAt(corSizeAt,(uint16_t)(outp.size() - (corSizeAt + 2)));
 
-	outp.cryptField(_key,startCryptedPortionAt,outp.size() - startCryptedPortionAt);
+	outp.append((uint64_t)(((AES::accelerated()) ? ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV : 0) | ((Packet::zstdAvailable()) ? ZT_PROTO_HELLO_CAPABILITY_ZSTD : 0) | ((RR->node->ecn()) ? ZT_PROTO_HELLO_CAPABILITY_ECN : 0) | ZT_PROTO_HELLO_CAPABILITY_FEC | ZT_PROTO_HELLO_CAPABILITY_GROUP_KEY | ZT_PROTO_HELLO_CAPABILITY_NAT_PROBE));
+
+	outp.cryptField(key(),startCryptedPortionAt,outp.size() - startCryptedPortionAt);
 
 	RR->node->expectReplyTo(outp.packetId());
 
 	if (atAddress) {
-		outp.armor(_key,false,counter); // false == don't encrypt full payload, but add MAC
+		outp.armor(key(),false,counter,keySchedule()); // false == don't encrypt full payload, but add MAC
+		countOut(now,outp.size());
 		RR->node->putPacket(tPtr,localSocket,atAddress,outp.data(),outp.size());
 	} else {
 		RR->sw->send(tPtr,outp,false); // false == don't encrypt full payload, but add MAC
@@ -356,7 +607,7 @@ void Peer::attemptToContactAt(void *tPtr,const int64_t localSocket,const InetAdd
 	if ( (!sendFullHello) && (_vProto >= 5) && (!((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) ) {
 		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
 		RR->node->expectReplyTo(outp.packetId());
-		outp.armor(_key,true,counter);
+		outp.armor(key(),true,counter,keySchedule());
 		RR->node->putPacket(tPtr,localSocket,atAddress,outp.data(),outp.size());
 	} else {
 		sendHELLO(tPtr,localSocket,atAddress,now,counter);
@@ -370,12 +621,159 @@ void Peer::tryMemorizedPath(void *tPtr,uint64_t now)
 		InetAddress mp;
 		if (RR->node->externalPathLookup(tPtr,_id.address(),-1,mp))
 			attemptToContactAt(tPtr,InetAddress(),mp,now,true,0);
+
+		// Paths restored from the peer cache stay expired until they are
+		// confirmed, so try them here alongside any externally memorized one.
+		SharedPtr<Path> cached[2];
+		{
+			RWMutex::RLock _l(_paths_m);
+			if ((_v4Path.p)&&(!_v4Path.lr))
+				cached[0] = _v4Path.p;
+			if ((_v6Path.p)&&(!_v6Path.lr))
+				cached[1] = _v6Path.p;
+		}
+		for(unsigned int i=0;i<2;++i) {
+			if (cached[i]) {
+				attemptToContactAt(tPtr,cached[i]->localSocket(),cached[i]->address(),now,true,cached[i]->nextOutgoingCounter());
+				cached[i]->sent(now);
+				cached[i]->probeSent(now);
+			}
+		}
+	}
+}
+
+void Peer::saveState(void *tPtr,const uint64_t now)
+{
+	try {
+		Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> b;
+		b.append((uint8_t)ZT_PEER_STATE_FORMAT_VERSION);
+		b.append(now);
+		_id.serialize(b,false);
+
+		// The shared key is Salsa20/12 encrypted under a key derived from our
+		// secret identity, and the whole record is authenticated with Poly1305
+		// keyed from the first 64 bytes of the same keystream as in Packet.
+		uint8_t iv[8],macKey[64];
+		Utils::getSecureRandom(iv,sizeof(iv));
+		b.append(iv,sizeof(iv));
+		Salsa20 s20(RR->stateKey,iv);
+		memset(macKey,0,sizeof(macKey));
+		s20.crypt12(macKey,macKey,sizeof(macKey));
+		const unsigned int keyAt = b.size();
+		b.append(key(),ZT_PEER_SECRET_KEY_LENGTH);
+		s20.crypt12(b.field(keyAt,ZT_PEER_SECRET_KEY_LENGTH),b.field(keyAt,ZT_PEER_SECRET_KEY_LENGTH),ZT_PEER_SECRET_KEY_LENGTH);
+
+		b.append((uint16_t)_latency);
+		{
+			RWMutex::RLock _l(_paths_m);
+			const unsigned int countAt = b.size();
+			b.addSize(1);
+			uint8_t count = 0;
+			const _PeerPath *const pp[2] = { &_v4Path,&_v6Path };
+			for(unsigned int i=0;i<2;++i) {
+				if ((pp[i]->p)&&(pp[i]->lr)) {
+					b.append((uint64_t)pp[i]->p->localSocket());
+					b.append(pp[i]->lr);
+					pp[i]->p->address().serialize(b);
+					++count;
+				}
+			}
+			b.setAt(countAt,count);
+		}
+
+		uint8_t mac[16];
+		Poly1305::compute(mac,b.data(),b.size(),macKey);
+		Utils::burn(macKey,sizeof(macKey));
+		b.append(mac,sizeof(mac));
+
+		uint64_t id[2];
+		id[0] = _id.address().toInt(); id[1] = 0;
+		RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_PEER,id,b.data(),b.size());
+		_lastStateSaved = now;
+	} catch ( ... ) {} // can only be out of bounds, which would indicate a bug in the size macro
+}
+
+SharedPtr<Peer> Peer::createFromStateUpdate(const RuntimeEnvironment *renv,void *tPtr,const void *data,unsigned int len)
+{
+	try {
+		if ((len <= 16)||(len > ZT_PEER_MAX_SERIALIZED_STATE_SIZE))
+			return SharedPtr<Peer>();
+		const Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> b(data,len - 16);
+		const uint64_t now = renv->node->now();
+
+		unsigned int ptr = 0;
+		if (b[ptr++] != ZT_PEER_STATE_FORMAT_VERSION)
+			return SharedPtr<Peer>();
+		const uint64_t saved = b.at<uint64_t>(ptr); ptr += 8;
+		if ((saved > now)||((now - saved) > ZT_PEER_STATE_MAX_AGE))
+			return SharedPtr<Peer>();
+		Identity id;
+		ptr += id.deserialize(b,ptr);
+		if (id.address() == renv->identity.address())
+			return SharedPtr<Peer>();
+
+		uint8_t macKey[64],key[ZT_PEER_SECRET_KEY_LENGTH],mac[16];
+		Salsa20 s20(renv->stateKey,b.field(ptr,8)); ptr += 8;
+		memset(macKey,0,sizeof(macKey));
+		s20.crypt12(macKey,macKey,sizeof(macKey));
+		Poly1305::compute(mac,b.data(),b.size(),macKey);
+		Utils::burn(macKey,sizeof(macKey));
+		if (!Utils::secureEq(mac,reinterpret_cast<const uint8_t *>(data) + (len - 16),16))
+			return SharedPtr<Peer>();
+		s20.crypt12(b.field(ptr,ZT_PEER_SECRET_KEY_LENGTH),key,ZT_PEER_SECRET_KEY_LENGTH); ptr += ZT_PEER_SECRET_KEY_LENGTH;
+
+		SharedPtr<Peer> p(new Peer(renv,id,key));
+		Utils::burn(key,sizeof(key));
+		p->_latency = b.at<uint16_t>(ptr); ptr += 2;
+		p->_lastStateSaved = now;
+
+		unsigned int count = b[ptr++];
+		while (count--) {
+			const int64_t localSocket = (int64_t)b.at<uint64_t>(ptr); ptr += 8;
+			ptr += 8; // time path was last confirmed, restored paths start out expired
+			InetAddress addr;
+			ptr += addr.deserialize(b,ptr);
+			if ( (Path::isAddressValidForPath(addr)) && (renv->node->shouldUsePathForZeroTierTraffic(tPtr,id.address(),localSocket,addr)) ) {
+				_PeerPath *const pp = (addr.ss_family == AF_INET6) ? &(p->_v6Path) : &(p->_v4Path);
+				pp->p = renv->topology->getPath(localSocket,addr);
+			}
+		}
+		{
+			RWMutex::Lock _l(p->_paths_m);
+			p->_publishPrimaryPaths();
+		}
+
+		return p;
+	} catch ( ... ) {} // invalid or truncated records are ignored
+	return SharedPtr<Peer>();
+}
+
+bool Peer::isActive(const uint64_t now) const
+{
+	return ((now - std::max(_lastNontrivialReceive,(uint64_t)_lastNontrivialSend)) < RR->node->peerIdleTimeout());
+}
+
+void Peer::frameSent(const uint64_t now)
+{
+	if (_lastNontrivialSend != now) {
+		if (!isActive(now))
+			RR->node->schedulePeerPing(SharedPtr<Peer>(this),now + ZT_PING_CHECK_INVERVAL);
+		_lastNontrivialSend = now;
 	}
 }
 
 bool Peer::doPingAndKeepalive(void *tPtr,uint64_t now,int inetAddressFamily)
 {
-	Mutex::Lock _l(_paths_m);
+	RWMutex::RLock _l(_paths_m);
+
+	const bool multipath = RR->node->multipathMode();
+	if (multipath) {
+		for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+			_PeerPath &mp = _mpPaths[i];
+			if ( ((now - mp.lr) < ZT_PEER_PATH_EXPIRATION) && ((inetAddressFamily < 0)||(mp.p->compactAddress().family() == inetAddressFamily)) )
+				_keepalive(tPtr,now,mp);
+		}
+	}
 
 	if (inetAddressFamily < 0) {
 		uint64_t v6lr = 0;
@@ -385,38 +783,160 @@ bool Peer::doPingAndKeepalive(void *tPtr,uint64_t now,int inetAddressFamily)
 		if ( ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v4Path.p) )
 			v4lr = _v4Path.p->lastIn();
 
+		// In multipath mode both primaries carry flows, so both are kept alive
 		if (v6lr > v4lr) {
-			if ( ((now - _v6Path.lr) >= ZT_PEER_PING_PERIOD) || (_v6Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v6Path.p->localSocket(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
-				_v6Path.p->sent(now);
-				return true;
-			}
+			if ((multipath)&&(v4lr))
+				_keepalive(tPtr,now,_v4Path);
+			return _keepalive(tPtr,now,_v6Path);
 		} else if (v4lr) {
-			if ( ((now - _v4Path.lr) >= ZT_PEER_PING_PERIOD) || (_v4Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v4Path.p->localSocket(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
-				_v4Path.p->sent(now);
-				return true;
-			}
+			if ((multipath)&&(v6lr))
+				_keepalive(tPtr,now,_v6Path);
+			return _keepalive(tPtr,now,_v4Path);
 		}
 	} else {
 		if ( (inetAddressFamily == AF_INET) && ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) ) {
-			if ( ((now - _v4Path.lr) >= ZT_PEER_PING_PERIOD) || (_v4Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v4Path.p->localSocket(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
-				_v4Path.p->sent(now);
-				return true;
-			}
+			return _keepalive(tPtr,now,_v4Path);
 		} else if ( (inetAddressFamily == AF_INET6) && ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) ) {
-			if ( ((now - _v6Path.lr) >= ZT_PEER_PING_PERIOD) || (_v6Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v6Path.p->localSocket(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
-				_v6Path.p->sent(now);
-				return true;
+			return _keepalive(tPtr,now,_v6Path);
+		}
+	}
+
+	return false;
+}
+
+void Peer::postPathEvents(void *tPtr,const uint64_t now)
+{
+	const std::vector< SharedPtr<Path> > cur(paths(now));
+	const SharedPtr<Path> best(getBestPath(now,false));
+	const unsigned int latency = _latency;
+
+	// At most every old path down, every new path up, best path, and latency
+	ZT_Event evs[((ZT_PEER_MAX_MULTIPATH_PATHS + 2) * 2) + 2];
+	SharedPtr<Path> evPaths[((ZT_PEER_MAX_MULTIPATH_PATHS + 2) * 2) + 2];
+	unsigned int evc = 0;
+	{
+		Mutex::Lock _l(_reported_m);
+
+		for(unsigned int i=0;i<(ZT_PEER_MAX_MULTIPATH_PATHS + 2);++i) {
+			if ((_reportedPaths[i])&&(std::find(cur.begin(),cur.end(),_reportedPaths[i]) == cur.end())) {
+				evs[evc] = ZT_EVENT_PATH_DOWN;
+				evPaths[evc++] = _reportedPaths[i];
+			}
+		}
+		for(std::vector< SharedPtr<Path> >::const_iterator p(cur.begin());p!=cur.end();++p) {
+			if (std::find(_reportedPaths,_reportedPaths + ZT_PEER_MAX_MULTIPATH_PATHS + 2,*p) == (_reportedPaths + ZT_PEER_MAX_MULTIPATH_PATHS + 2)) {
+				evs[evc] = ZT_EVENT_PATH_UP;
+				evPaths[evc++] = *p;
+			}
+		}
+		for(unsigned int i=0;i<(ZT_PEER_MAX_MULTIPATH_PATHS + 2);++i)
+			_reportedPaths[i] = (i < (unsigned int)cur.size()) ? cur[i] : SharedPtr<Path>();
+
+		if (best != _reportedBestPath) {
+			evs[evc] = ZT_EVENT_BEST_PATH_CHANGED;
+			evPaths[evc++] = best;
+			_reportedBestPath = best;
+		}
+
+		if (latency) {
+			const unsigned int ol = _reportedLatency;
+			const unsigned int d = (latency > ol) ? (latency - ol) : (ol - latency);
+			if ((!ol)||(d >= std::max((unsigned int)ZT_PEER_LATENCY_EVENT_MIN_DELTA,ol / 8))) {
+				evs[evc] = ZT_EVENT_PEER_LATENCY_CHANGED;
+				evPaths[evc++] = best;
+				_reportedLatency = latency;
 			}
 		}
 	}
 
+	for(unsigned int i=0;i<evc;++i) {
+		const InetAddress pa((evPaths[i]) ? evPaths[i]->address() : InetAddress());
+		if (evs[i] != ZT_EVENT_PEER_LATENCY_CHANGED)
+			ZT_PROBE_PATH_CHANGE(_id.address().toInt(),evs[i],&pa);
+		RR->node->postPeerEvent(tPtr,evs[i],_id.address(),pa,latency);
+	}
+}
+
+uint64_t Peer::nextKeepalive(const uint64_t now)
+{
+	uint64_t next = now + ZT_PATH_KEEPALIVE_MAX;
+	RWMutex::RLock _l(_paths_m);
+	for(unsigned int i=0;i<(ZT_PEER_MAX_MULTIPATH_PATHS + 2);++i) {
+		const _PeerPath &pp = (i == 0) ? _v4Path : ((i == 1) ? _v6Path : _mpPaths[i - 2]);
+		if ( (pp.p) && ((now - pp.lr) < ZT_PEER_PATH_EXPIRATION) )
+			next = std::min(next,std::min(pp.lr + ZT_PEER_PING_PERIOD,pp.p->nextHeartbeat()));
+	}
+	return std::max(next,now + ZT_PING_CHECK_INVERVAL);
+}
+
+bool Peer::_keepalive(void *tPtr,const uint64_t now,_PeerPath &pp)
+{
+	unsigned int natReplyDelay = 0;
+	const uint64_t natReplyTo = pp.p->natReplyDue(now,natReplyDelay);
+	if (natReplyTo) {
+		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_OK);
+		outp.append((unsigned char)Packet::VERB_NAT_PROBE);
+		outp.append(natReplyTo);
+		outp.append((uint32_t)natReplyDelay);
+		outp.armor(key(),true,pp.p->nextOutgoingCounter(),keySchedule());
+		pp.p->send(RR,tPtr,outp.data(),outp.size(),now);
+	}
+
+	pp.p->natProbeCheck(now);
+
+	const bool ping = ((now - pp.lr) >= ZT_PEER_PING_PERIOD);
+	if ( (ping) || (pp.p->needsHeartbeat(now)) ) {
+		// A NAT probe takes the place of a heartbeat until the path's binding timeout is known
+		const unsigned int natProbeDelay = ((!ping)&&((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_NAT_PROBE) != 0)&&(pp.p->alive(now))) ? pp.p->natProbeDelay(now) : 0;
+		if (natProbeDelay) {
+			Packet outp(_id.address(),RR->identity.address(),Packet::VERB_NAT_PROBE);
+			outp.append((uint32_t)natProbeDelay);
+			outp.armor(key(),true,pp.p->nextOutgoingCounter(),keySchedule());
+			pp.p->send(RR,tPtr,outp.data(),outp.size(),now);
+			pp.p->natProbeSent(now,outp.packetId(),natProbeDelay);
+		} else {
+			attemptToContactAt(tPtr,pp.p->localSocket(),pp.p->address(),now,false,pp.p->nextOutgoingCounter());
+			pp.p->sent(now);
+			pp.p->probeSent(now);
+		}
+		return true;
+	}
+	if (!pp.p->natProbing())
+		_probeMtu(tPtr,now,pp.p); // only when not pinging, since the peer rate limits ECHO
 	return false;
 }
 
+void Peer::_probeMtu(void *tPtr,const uint64_t now,const SharedPtr<Path> &path)
+{
+	if ((_vProto < 5)||((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) // same ECHO condition as attemptToContactAt()
+		return;
+	const unsigned int size = path->mtuProbeSize(now);
+	if (!size)
+		return;
+
+	// A padded ECHO sent with don't fragment set only arrives (and is echoed
+	// back) if the path can carry a packet this big in one piece.
+	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+	outp.addSize(size - outp.size());
+	RR->node->expectReplyTo(outp.packetId());
+	outp.armor(key(),true,path->nextOutgoingCounter(),keySchedule());
+	RR->node->putPacket(tPtr,path->localSocket(),path->address(),outp.data(),outp.size(),ZT_WIRE_PACKET_DONT_FRAGMENT);
+	path->mtuProbeSent(now,outp.packetId());
+}
+
+Peer::_PeerPath *Peer::_multipathSlot(const uint64_t now)
+{
+	_PeerPath *oldest = (_PeerPath *)0;
+	for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+		_PeerPath &mp = _mpPaths[i];
+		if (!mp.p)
+			return &mp;
+		if ( (((now - mp.lr) >= ZT_PEER_PATH_EXPIRATION)||(!mp.p->alive(now))) && ((!oldest)||(mp.lr < oldest->lr)) )
+			oldest = &mp;
+	}
+	return oldest;
+}
+
 void Peer::redirect(void *tPtr,const int64_t localSocket,const InetAddress &remoteAddress,const uint64_t now)
 {
 	if ((remoteAddress.ss_family != AF_INET)&&(remoteAddress.ss_family != AF_INET6)) // sanity check
@@ -425,9 +945,10 @@ void Peer::redirect(void *tPtr,const int64_t localSocket,const InetAddress &remo
 	SharedPtr<Path> op;
 	SharedPtr<Path> np(RR->topology->getPath(localSocket,remoteAddress));
 	attemptToContactAt(tPtr,localSocket,remoteAddress,now,true,np->nextOutgoingCounter());
+	np->probeSent(now);
 
 	{
-		Mutex::Lock _l(_paths_m);
+		RWMutex::Lock _l(_paths_m);
 		if (remoteAddress.ss_family == AF_INET) {
 			op = _v4Path.p;
 			_v4Path.p = np;
@@ -437,6 +958,7 @@ void Peer::redirect(void *tPtr,const int64_t localSocket,const InetAddress &remo
 			_v6Path.p = np;
 			_v6Path.sticky = now;
 		}
+		_publishPrimaryPaths();
 	}
 
 	RR->t->peerRedirected(tPtr,0,*this,op,np);
@@ -50,9 +50,31 @@
 #include "Hashtable.hpp"
 #include "Mutex.hpp"
 #include "NonCopyable.hpp"
+#include "CryptoPipeline.hpp"
+#include "HugePages.hpp"
 
 #define ZT_PEER_MAX_SERIALIZED_STATE_SIZE (sizeof(Peer) + 32 + (sizeof(Path) * 2))
 
+/**
+ * Version of the peer cache record written by Peer::saveState()
+ */
+#define ZT_PEER_STATE_FORMAT_VERSION 1
+
+/**
+ * Maximum number of additional direct paths kept active in multipath mode
+ */
+#define ZT_PEER_MAX_MULTIPATH_PATHS 4
+
+/**
+ * Number of per-flow compression yield slots per peer (flows may share slots)
+ */
+#define ZT_PEER_COMPRESSION_FLOW_SLOTS 64
+
+/**
+ * Maximum compression backoff exponent (skip up to 2^this - 1 frames after a poor result)
+ */
+#define ZT_PEER_COMPRESSION_MAX_BACKOFF 8
+
 namespace ZeroTier {
 
 /**
@@ -64,20 +86,43 @@ class Peer : NonCopyable
 
 private:
 	Peer() {} // disabled to prevent bugs -- should not be constructed uninitialized
+	Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const uint8_t *key);
 
 public:
 	~Peer() { Utils::burn(_key,sizeof(_key)); }
 
+	/**
+	 * Allocate from the HugePages arena if there is one
+	 */
+	static inline void *operator new(size_t sz) { return HugePages::allocate(sz); }
+	static inline void operator delete(void *p,size_t sz) { HugePages::free(p,sz); }
+
 	/**
 	 * Construct a new peer
 	 *
+	 * Key agreement is deferred until key() is first called.
+	 *
 	 * @param renv Runtime environment
-	 * @param myIdentity Identity of THIS node (for key agreement)
+	 * @param myIdentity Identity of THIS node (for key agreement, must have a secret key and outlive this Peer)
 	 * @param peerIdentity Identity of peer
-	 * @throws std::runtime_error Key agreement with peer's identity failed
 	 */
 	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
 
+	/**
+	 * Reconstitute a peer from a record written by saveState()
+	 *
+	 * This skips key agreement, which is the expensive part of learning a
+	 * peer. Cached paths are restored as expired and are only tried via
+	 * tryMemorizedPath() until the peer answers on one of them.
+	 *
+	 * @param renv Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param data Record data
+	 * @param len Length of record in bytes
+	 * @return Peer or NULL if record is invalid, too old, or was not written by this node
+	 */
+	static SharedPtr<Peer> createFromStateUpdate(const RuntimeEnvironment *renv,void *tPtr,const void *data,unsigned int len);
+
 	/**
 	 * @return This peer's ZT address (short for identity().address())
 	 */
@@ -122,8 +167,14 @@ public:
 	 */
 	inline bool hasActivePathTo(uint64_t now,const InetAddress &addr) const
 	{
-		Mutex::Lock _l(_paths_m);
-		return ( ((addr.ss_family == AF_INET)&&(_v4Path.p)&&(_v4Path.p->address() == addr)&&(_v4Path.p->alive(now))) || ((addr.ss_family == AF_INET6)&&(_v6Path.p)&&(_v6Path.p->address() == addr)&&(_v6Path.p->alive(now))) );
+		RWMutex::RLock _l(_paths_m);
+		if ( ((addr.ss_family == AF_INET)&&(_v4Path.p)&&(_v4Path.p->compactAddress() == addr)&&(_v4Path.p->alive(now))) || ((addr.ss_family == AF_INET6)&&(_v6Path.p)&&(_v6Path.p->compactAddress() == addr)&&(_v6Path.p->alive(now))) )
+			return true;
+		for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+			if ((_mpPaths[i].p)&&(_mpPaths[i].p->compactAddress() == addr)&&(_mpPaths[i].p->alive(now)))
+				return true;
+		}
+		return false;
 	}
 
 	/**
@@ -142,7 +193,9 @@ public:
 	 * Get the best current direct path
 	 *
 	 * This does not check Path::alive(), but does return the most recently
-	 * active path and does check expiration (which is a longer timeout).
+	 * active path and does check expiration (which is a longer timeout). If
+	 * both paths are alive and measured, the one with better Path::quality()
+	 * is returned instead.
 	 *
 	 * @param now Current time
 	 * @param includeExpired If true, include even expired paths
@@ -150,6 +203,19 @@ public:
 	 */
 	SharedPtr<Path> getBestPath(uint64_t now,bool includeExpired);
 
+	/**
+	 * Get the path a flow should use in multipath mode
+	 *
+	 * Flows are assigned to live paths by weighted rendezvous hashing, with
+	 * paths of better Path::quality() getting a larger share. A flow stays
+	 * on its path unless the set of live paths or their weights change.
+	 *
+	 * @param now Current time
+	 * @param flowId Non-zero flow ID
+	 * @return Path for this flow or NULL if fewer than two paths are alive
+	 */
+	SharedPtr<Path> getFlowPath(const uint64_t now,const uint32_t flowId);
+
 	/**
 	 * Send a HELLO to this peer at a specified physical address
 	 *
@@ -187,6 +253,24 @@ public:
 	 */
 	void tryMemorizedPath(void *tPtr,uint64_t now);
 
+	/**
+	 * Write this peer to the peer cache (ZT_STATE_OBJECT_PEER)
+	 *
+	 * The record holds our identity-derived shared key encrypted under
+	 * RuntimeEnvironment::stateKey, along with latency and last good paths.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void saveState(void *tPtr,const uint64_t now);
+
+	/**
+	 * @param now Current time
+	 * @param minInterval Minimum time since last save
+	 * @return True if this peer has been heard from since it was last saved and minInterval has elapsed
+	 */
+	inline bool needsStateSave(const uint64_t now,const uint64_t minInterval) const { return ((_lastReceive > _lastStateSaved)&&((now - _lastStateSaved) >= minInterval)); }
+
 	/**
 	 * Send pings or keepalives depending on configured timeouts
 	 *
@@ -197,6 +281,38 @@ public:
 	 */
 	bool doPingAndKeepalive(void *tPtr,uint64_t now,int inetAddressFamily);
 
+	/**
+	 * Get when doPingAndKeepalive() next needs to run for this peer's paths
+	 *
+	 * This is at least ZT_PING_CHECK_INVERVAL and at most ZT_PATH_KEEPALIVE_MAX
+	 * from now, so unanswered pings are not retried any faster than before.
+	 *
+	 * @param now Current time
+	 * @return Time of next ping or keepalive check
+	 */
+	uint64_t nextKeepalive(const uint64_t now);
+
+	/**
+	 * Post events for paths that have come up or gone down, a change of best path, or a change in latency
+	 *
+	 * Each call reports changes since the last one, so this can be called
+	 * from anywhere a change may have happened.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void postPathEvents(void *tPtr,const uint64_t now);
+
+	/**
+	 * @return Deadline of this peer's pending entry in Node's ping wheel or 0 if none (guarded by Node's ping wheel lock)
+	 */
+	inline uint64_t pingDeadline() const { return _pingDeadline; }
+
+	/**
+	 * @param d New ping wheel deadline or 0 if none (guarded by Node's ping wheel lock)
+	 */
+	inline void setPingDeadline(const uint64_t d) { _pingDeadline = d; }
+
 	/**
 	 * Specify remote path for this peer and forget others
 	 *
@@ -215,25 +331,42 @@ public:
 	 * Reset paths within a given IP scope and address family
 	 *
 	 * Resetting a path involves sending an ECHO to it and then deactivating
-	 * it until or unless it responds.
+	 * it until or unless it responds. Paths heard from at or after 'since'
+	 * evidently still work and are left alone.
 	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param scope IP scope
 	 * @param inetAddressFamily Family e.g. AF_INET
+	 * @param localSocket Only reset paths on this local socket, or -1 for any
+	 * @param since Time the change that prompted this reset was detected
 	 * @param now Current time
+	 * @return Number of paths reset
 	 */
-	inline void resetWithinScope(void *tPtr,InetAddress::IpScope scope,int inetAddressFamily,uint64_t now)
+	inline unsigned int resetWithinScope(void *tPtr,InetAddress::IpScope scope,int inetAddressFamily,int64_t localSocket,uint64_t since,uint64_t now)
 	{
-		Mutex::Lock _l(_paths_m);
-		if ((inetAddressFamily == AF_INET)&&(_v4Path.lr)&&(_v4Path.p->address().ipScope() == scope)) {
+		unsigned int n = 0;
+		RWMutex::Lock _l(_paths_m);
+		if ((inetAddressFamily == AF_INET)&&(_v4Path.lr)&&(_v4Path.lr < since)&&(_v4Path.p->ipScope() == scope)&&((localSocket == -1)||(_v4Path.p->localSocket() == localSocket))) {
 			attemptToContactAt(tPtr,_v4Path.p->localSocket(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
 			_v4Path.p->sent(now);
 			_v4Path.lr = 0; // path will not be used unless it speaks again
-		} else if ((inetAddressFamily == AF_INET6)&&(_v6Path.lr)&&(_v6Path.p->address().ipScope() == scope)) {
+			++n;
+		} else if ((inetAddressFamily == AF_INET6)&&(_v6Path.lr)&&(_v6Path.lr < since)&&(_v6Path.p->ipScope() == scope)&&((localSocket == -1)||(_v6Path.p->localSocket() == localSocket))) {
 			attemptToContactAt(tPtr,_v6Path.p->localSocket(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
 			_v6Path.p->sent(now);
 			_v6Path.lr = 0; // path will not be used unless it speaks again
+			++n;
+		}
+		for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+			_PeerPath &mp = _mpPaths[i];
+			if ((mp.lr)&&(mp.lr < since)&&(mp.p->compactAddress().family() == inetAddressFamily)&&(mp.p->ipScope() == scope)&&((localSocket == -1)||(mp.p->localSocket() == localSocket))) {
+				attemptToContactAt(tPtr,mp.p->localSocket(),mp.p->address(),now,false,mp.p->nextOutgoingCounter());
+				mp.p->sent(now);
+				mp.lr = 0;
+				++n;
+			}
 		}
+		return n;
 	}
 
 	/**
@@ -245,7 +378,7 @@ public:
 	 */
 	inline void getRendezvousAddresses(uint64_t now,InetAddress &v4,InetAddress &v6) const
 	{
-		Mutex::Lock _l(_paths_m);
+		RWMutex::RLock _l(_paths_m);
 		if (((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v4Path.p->alive(now)))
 			v4 = _v4Path.p->address();
 		if (((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v6Path.p->alive(now)))
@@ -259,11 +392,15 @@ public:
 	inline std::vector< SharedPtr<Path> > paths(const uint64_t now) const
 	{
 		std::vector< SharedPtr<Path> > pp;
-		Mutex::Lock _l(_paths_m);
+		RWMutex::RLock _l(_paths_m);
 		if (((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v4Path.p->alive(now)))
 			pp.push_back(_v4Path.p);
 		if (((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v6Path.p->alive(now)))
 			pp.push_back(_v6Path.p);
+		for(unsigned int i=0;i<ZT_PEER_MAX_MULTIPATH_PATHS;++i) {
+			if (((now - _mpPaths[i].lr) < ZT_PEER_PATH_EXPIRATION)&&(_mpPaths[i].p->alive(now)))
+				pp.push_back(_mpPaths[i].p);
+		}
 		return pp;
 	}
 
@@ -278,9 +415,24 @@ public:
 	inline bool isAlive(const uint64_t now) const { return ((now - _lastReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
 
 	/**
-	 * @return True if this peer has sent us real network traffic recently
+	 * Check whether real network traffic has gone to or from this peer recently
+	 *
+	 * Only active peers are pinged and have their paths kept alive. Once a
+	 * peer has been idle for Node::peerIdleTimeout() its direct paths are
+	 * left to lapse, and the next frame sent to it goes through a root, which
+	 * is asked to introduce us again.
+	 *
+	 * @param now Current time
+	 * @return True if a frame, network config, etc. was sent or received within the idle timeout
+	 */
+	bool isActive(const uint64_t now) const;
+
+	/**
+	 * Note that a frame was sent to this peer, waking it from idle if need be
+	 *
+	 * @param now Current time
 	 */
-	inline uint64_t isActive(uint64_t now) const { return ((now - _lastNontrivialReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
+	void frameSent(const uint64_t now);
 
 	/**
 	 * @return Latency in milliseconds or 0 if unknown
@@ -291,22 +443,30 @@ public:
 	 * This computes a quality score for relays and root servers
 	 *
 	 * If we haven't heard anything from these in ZT_PEER_ACTIVITY_TIMEOUT, they
-	 * receive the worst possible quality (max unsigned int). Otherwise the
-	 * quality is a product of latency and the number of potential missed
-	 * pings. This causes roots and relays to switch over a bit faster if they
-	 * fail.
+	 * receive the worst possible quality (max unsigned int). If a WHOIS or a
+	 * probe has gone unanswered for longer than the best path's answer
+	 * timeout, they get the next worst, so another upstream is used until they
+	 * answer again. Otherwise the quality is the best live path's
+	 * Path::quality() (RTT, jitter and loss), or latency if that hasn't been
+	 * measured, times the number of potential missed pings.
+	 *
+	 * @param now Current time
+	 * @return Relay quality score, lower is better
+	 */
+	unsigned int relayQuality(const uint64_t now) const;
+
+	/**
+	 * Note that a request expecting an answer, such as a WHOIS, was sent to this peer
+	 *
+	 * Only the oldest unanswered request is tracked, and anything at all
+	 * received from the peer answers it.
 	 *
-	 * @return Relay quality score computed from latency and other factors, lower is better
+	 * @param now Current time
 	 */
-	inline unsigned int relayQuality(const uint64_t now) const
+	inline void requestSent(const uint64_t now)
 	{
-		const uint64_t tsr = now - _lastReceive;
-		if (tsr >= ZT_PEER_ACTIVITY_TIMEOUT)
-			return (~(unsigned int)0);
-		unsigned int l = _latency;
-		if (!l)
-			l = 0xffff;
-		return (l * (((unsigned int)tsr / (ZT_PEER_PING_PERIOD + 1000)) + 1));
+		if (!_requestSent)
+			_requestSent = now;
 	}
 
 	/**
@@ -323,9 +483,99 @@ public:
 	}
 
 	/**
+	 * Get the secret key shared with this peer, agreeing it on first use
+	 *
+	 * Peers are often created for identities we never exchange traffic with,
+	 * so key agreement is deferred until something is armored or dearmored.
+	 *
 	 * @return 256-bit secret symmetric encryption key
 	 */
-	inline const unsigned char *key() const { return _key; }
+	inline const unsigned char *key() const
+	{
+		if (unlikely(!_keyReady.load()))
+			_agree();
+		return _key;
+	}
+
+	/**
+	 * Compress a frame packet unless its flow has recently not compressed well
+	 *
+	 * Already compressed or encrypted traffic (TLS, SSH, media) never shrinks,
+	 * so after a poor result a flow skips compression for an exponentially
+	 * growing number of frames before trying again.
+	 *
+	 * @param outp Packet to compress
+	 * @param flowId Flow ID of frame
+	 * @param zstd If true, compress with zstd instead of LZ4 (check zstdEnabled() first)
+	 */
+	void compressFrame(Packet &outp,const uint32_t flowId,const bool zstd);
+
+	/**
+	 * @return Frame payload bytes run through the compressor
+	 */
+	inline uint64_t compressionBytesIn() const { return _compressionBytesIn; }
+
+	/**
+	 * @return Bytes saved by compressing frames
+	 */
+	inline uint64_t compressionBytesSaved() const { return _compressionBytesSaved; }
+
+	/**
+	 * @return Frame payload bytes sent uncompressed without trying because of poor recent yield
+	 */
+	inline uint64_t compressionBytesSkipped() const { return _compressionBytesSkipped; }
+
+	/**
+	 * @return Frame payload bytes run through zstd, also counted in compressionBytesIn()
+	 */
+	inline uint64_t compressionZstdBytesIn() const { return _compressionZstdBytesIn; }
+
+	/**
+	 * @return Bytes saved by zstd, also counted in compressionBytesSaved()
+	 */
+	inline uint64_t compressionZstdBytesSaved() const { return _compressionZstdBytesSaved; }
+
+	/**
+	 * Count a packet received from this peer
+	 *
+	 * @param now Current time
+	 * @param len Packet size on the wire
+	 * @param dropped True if it failed authentication or could not be decoded
+	 */
+	inline void countIn(const uint64_t now,const unsigned int len,const bool dropped)
+	{
+		if (dropped) {
+			++_packetsDropped;
+		} else {
+			++_packetsIn;
+			_bytesIn += len;
+			_lastActivity = now;
+		}
+	}
+
+	/**
+	 * Count a packet sent to this peer
+	 *
+	 * @param now Current time
+	 * @param len Packet size on the wire
+	 */
+	inline void countOut(const uint64_t now,const unsigned int len)
+	{
+		++_packetsOut;
+		_bytesOut += len;
+		_lastActivity = now;
+	}
+
+	inline uint64_t packetsIn() const { return _packetsIn; }
+	inline uint64_t packetsOut() const { return _packetsOut; }
+	inline uint64_t bytesIn() const { return _bytesIn; }
+	inline uint64_t bytesOut() const { return _bytesOut; }
+	inline uint64_t packetsDropped() const { return _packetsDropped; }
+
+	/**
+	 * @return Time a packet was last sent to or received from this peer, direct or relayed
+	 */
+	inline uint64_t lastActivity() const { return _lastActivity; }
 
 	/**
 	 * Set the currently known remote version of this peer's client
@@ -348,6 +598,61 @@ public:
 	inline unsigned int remoteVersionMinor() const { return _vMinor; }
 	inline unsigned int remoteVersionRevision() const { return _vRevision; }
 
+	/**
+	 * Set capability flags the peer sent in HELLO or OK(HELLO)
+	 *
+	 * @param c ZT_PROTO_HELLO_CAPABILITY_* flags
+	 */
+	inline void setRemoteCapabilities(const uint64_t c) { _remoteCapabilities = c; }
+
+	/**
+	 * @return True if packets to this peer can be armored with AES-GMAC-SIV
+	 */
+	inline bool aesGmacSivEnabled() const { return (((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_AES_GMAC_SIV) != 0)&&(AES::accelerated())); }
+
+	/**
+	 * @return True if multicasts to this peer can be armored with a network's group key
+	 */
+	inline bool groupKeyEnabled() const { return ((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_GROUP_KEY) != 0); }
+
+	/**
+	 * @return True if frames to this peer can be compressed with zstd
+	 */
+	inline bool zstdEnabled() const { return (((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_ZSTD) != 0)&&(Packet::zstdAvailable())); }
+
+	/**
+	 * @return True if this peer passes on CE marks, so direct packets to it may carry their frame's ECN field
+	 */
+	inline bool ecnEnabled() const { return ((_remoteCapabilities & ZT_PROTO_HELLO_CAPABILITY_ECN) != 0); }
+
+	/**
+	 * @return AES-GMAC-SIV keys derived from key(), only valid if AES::accelerated()
+	 */
+	inline const AES *aesKeys() const
+	{
+		key();
+		return _aes;
+	}
+
+	/**
+	 * @return Salsa20 keyed with key() for Packet::armor() and dearmor(), so the key isn't expanded for every packet
+	 */
+	inline const Salsa20 *keySchedule() const
+	{
+		key();
+		return &_s20;
+	}
+
+	/**
+	 * @return Ordering of packets from this peer through CryptoPipeline
+	 */
+	inline CryptoPipeline::Sequencer &inboundSequencer() { return _inboundSequencer; }
+
+	/**
+	 * @return Ordering of packets to this peer through CryptoPipeline
+	 */
+	inline CryptoPipeline::Sequencer &outboundSequencer() { return _outboundSequencer; }
+
 	inline bool remoteVersionKnown() const { return ((_vMajor > 0)||(_vMinor > 0)||(_vRevision > 0)); }
 
 	/**
@@ -391,6 +696,68 @@ public:
 		return false;
 	}
 
+	/**
+	 * Rate limit gate for asking an upstream to RENDEZVOUS us with this peer
+	 */
+	inline bool rateGateRendezvousRequest(const uint64_t now)
+	{
+		if ((now - _lastRendezvousRequestSent) >= ZT_MIN_UNITE_INTERVAL) {
+			_lastRendezvousRequestSent = now;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Rate limit gate for probing relays for a path to this peer
+	 */
+	inline bool rateGateRelayProbe(const uint64_t now)
+	{
+		if ((now - _lastRelayProbeSent) >= ZT_PEER_RELAY_PROBE_INTERVAL) {
+			_lastRelayProbeSent = now;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @return Counter incremented on each call, to take turns probing relays
+	 */
+	inline unsigned int nextRelayProbe() { return _relayProbeCounter++; }
+
+	/**
+	 * Note an answer to an ECHO sent to this peer through a relay
+	 *
+	 * The relay answering fastest is kept, and one that's no longer heard
+	 * from is replaced by the next to answer.
+	 *
+	 * @param now Current time
+	 * @param relay Relay the probe went through (a member, or an upstream)
+	 * @param latency Round trip time through it in ms
+	 */
+	inline void relayProbeAnswered(const uint64_t now,const Address &relay,const unsigned int latency)
+	{
+		Mutex::Lock _l(_relay_m);
+		if (relay == _relayVia) {
+			_relayViaLatency = (_relayViaLatency + latency) / 2;
+			_relayViaAnswered = now;
+		} else if ((!_relayVia)||((now - _relayViaAnswered) >= ZT_PEER_RELAY_EXPIRATION)||(latency < _relayViaLatency)) {
+			_relayVia = relay;
+			_relayViaLatency = latency;
+			_relayViaAnswered = now;
+		}
+	}
+
+	/**
+	 * @param now Current time
+	 * @return Relay with the fastest answered probe to this peer, or nil if none has answered lately
+	 */
+	inline Address relayVia(const uint64_t now) const
+	{
+		Mutex::Lock _l(_relay_m);
+		return ((now - _relayViaAnswered) < ZT_PEER_RELAY_EXPIRATION) ? _relayVia : Address();
+	}
+
 	/**
 	 * Rate limit gate for inbound WHOIS requests
 	 */
@@ -443,42 +810,131 @@ private:
 	struct _PeerPath
 	{
 		_PeerPath() : lr(0),sticky(0),p() {}
-		uint64_t lr; // time of last valid ZeroTier packet
+		volatile uint64_t lr; // time of last valid ZeroTier packet, may be updated with _paths_m only read locked
 		uint64_t sticky; // time last set as sticky
 		SharedPtr<Path> p;
 	};
 
-	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
+	void _agree() const;
+	void _initDerivedKeys() const;
+	bool _keepalive(void *tPtr,const uint64_t now,_PeerPath &pp);
+	void _probeMtu(void *tPtr,const uint64_t now,const SharedPtr<Path> &path);
+	_PeerPath *_multipathSlot(const uint64_t now);
+
+	// Call with _paths_m write locked after _v4Path.p or _v6Path.p changes
+	inline void _publishPrimaryPaths()
+	{
+		__atomic_store_n(&(_primaryPaths[0]),_v4Path.p.ptr(),__ATOMIC_RELEASE);
+		__atomic_store_n(&(_primaryPaths[1]),_v6Path.p.ptr(),__ATOMIC_RELEASE);
+	}
+
+	// If both direct paths are alive and have RTT measurements, return the one
+	// with the better Path::quality(), otherwise NULL. Call with _paths_m locked.
+	inline const SharedPtr<Path> *_betterLivePath(const uint64_t now) const
+	{
+		if ( (_v4Path.p) && (_v6Path.p) && (_v4Path.p->alive(now)) && (_v6Path.p->alive(now)) ) {
+			const unsigned int q4 = _v4Path.p->quality();
+			const unsigned int q6 = _v6Path.p->quality();
+			if ((q4 != 0xffffffff)&&(q6 != 0xffffffff))
+				return (q6 <= q4) ? &(_v6Path.p) : &(_v4Path.p);
+		}
+		return (const SharedPtr<Path> *)0;
+	}
+
+	// Fields are grouped so that the reference count, the read-mostly identity
+	// and keys, the per-packet timestamps and counters, and the paths don't
+	// share cache lines with each other.
 
 	const RuntimeEnvironment *RR;
+	const Identity *_myIdentity;
+	Identity _id;
+
+	mutable uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
+	mutable AtomicCounter _keyReady;
+	mutable AES _aes[2];
+	mutable Salsa20 _s20;
+	mutable Mutex _key_m;
+
+	uint16_t _vProto;
+	uint16_t _vMajor;
+	uint16_t _vMinor;
+	uint16_t _vRevision;
+	volatile uint64_t _remoteCapabilities;
+
+	uint8_t _pad0[ZT_CACHE_LINE_SIZE];
 
 	uint64_t _lastReceive; // direct or indirect
 	uint64_t _lastNontrivialReceive; // frames, things like netconf, etc.
+	volatile uint64_t _lastNontrivialSend; // frames
+
+	// Compression yield tracking is lock-free; races only cost an extra or
+	// skipped compression attempt or a slightly off counter.
+	volatile uint64_t _compressionBytesIn;
+	volatile uint64_t _compressionBytesSaved;
+	volatile uint64_t _compressionBytesSkipped;
+	volatile uint64_t _compressionZstdBytesIn;
+	volatile uint64_t _compressionZstdBytesSaved;
+	uint8_t _compressionSkip[ZT_PEER_COMPRESSION_FLOW_SLOTS]; // frames left to skip
+	uint8_t _compressionBackoff[ZT_PEER_COMPRESSION_FLOW_SLOTS]; // consecutive poor results
+
+	// Traffic counters for monitoring, also lock-free and approximate under races
+	volatile uint64_t _packetsIn;
+	volatile uint64_t _packetsOut;
+	volatile uint64_t _bytesIn;
+	volatile uint64_t _bytesOut;
+	volatile uint64_t _packetsDropped;
+	volatile uint64_t _lastActivity;
+
+	unsigned int _latency;
+	volatile uint64_t _requestSent; // oldest unanswered request or 0, see requestSent()
+
+	uint8_t _pad1[ZT_CACHE_LINE_SIZE];
+
+	_PeerPath _v4Path; // IPv4 direct path
+	_PeerPath _v6Path; // IPv6 direct path
+	_PeerPath _mpPaths[ZT_PEER_MAX_MULTIPATH_PATHS]; // additional direct paths of either family (multipath mode only)
+	RWMutex _paths_m; // read locked to use paths, write locked to replace or reorder them
+	Path *_primaryPaths[2]; // naked copies of _v4Path.p and _v6Path.p for lock-free compares, see _publishPrimaryPaths()
+
+	uint8_t _pad2[ZT_CACHE_LINE_SIZE];
+
+	CryptoPipeline::Sequencer _inboundSequencer;
+	CryptoPipeline::Sequencer _outboundSequencer;
+
+	uint8_t _pad3[ZT_CACHE_LINE_SIZE];
+
+	uint64_t _pingDeadline;
 	uint64_t _lastTriedMemorizedPath;
 	uint64_t _lastDirectPathPushSent;
 	uint64_t _lastDirectPathPushReceive;
 	uint64_t _lastCredentialRequestSent;
 	uint64_t _lastWhoisRequestReceived;
+	uint64_t _lastRendezvousRequestSent;
+	uint64_t _lastRelayProbeSent;
 	uint64_t _lastEchoRequestReceived;
 	uint64_t _lastComRequestReceived;
 	uint64_t _lastComRequestSent;
 	uint64_t _lastCredentialsReceived;
 	uint64_t _lastTrustEstablishedPacketReceived;
+	uint64_t _lastStateSaved;
 
-	uint16_t _vProto;
-	uint16_t _vMajor;
-	uint16_t _vMinor;
-	uint16_t _vRevision;
+	unsigned int _directPathPushCutoffCount;
+	unsigned int _credentialsCutoffCount;
+	unsigned int _relayProbeCounter;
 
-	_PeerPath _v4Path; // IPv4 direct path
-	_PeerPath _v6Path; // IPv6 direct path
-	Mutex _paths_m;
+	// Relay for when there's no direct path, see relayProbeAnswered()
+	Address _relayVia;
+	uint64_t _relayViaAnswered;
+	unsigned int _relayViaLatency;
+	mutable Mutex _relay_m;
 
-	Identity _id;
+	// Path state as last reported by postPathEvents()
+	SharedPtr<Path> _reportedPaths[ZT_PEER_MAX_MULTIPATH_PATHS + 2];
+	SharedPtr<Path> _reportedBestPath;
+	unsigned int _reportedLatency;
+	Mutex _reported_m;
 
-	unsigned int _latency;
-	unsigned int _directPathPushCutoffCount;
-	unsigned int _credentialsCutoffCount;
+	uint8_t _pad4[ZT_CACHE_LINE_SIZE];
 
 	AtomicCounter __refCount;
 };
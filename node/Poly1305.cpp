@@ -16,6 +16,13 @@ Public domain.
 #pragma warning(disable: 4146)
 #endif
 
+// The four-way AVX2 code is built with per-function target attributes so the
+// rest of the code still runs on any x86-64 CPU
+#if (!defined(ZT_POLY1305_NO_AVX2)) && (defined(__GNUC__) || defined(__clang__)) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__))
+#define ZT_POLY1305_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace ZeroTier {
 
 #if 0
@@ -364,6 +371,213 @@ poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
   st->pad[1] = 0;
 }
 
+#ifdef ZT_POLY1305_AVX2
+
+//////////////////////////////////////////////////////////////////////////////
+// Four-way AVX2 implementation (after Goll and Gueron)
+//
+// Blocks 4k+j go into lane j and each lane is stepped with h = h*r^4 + m.
+// At the end lanes 0..3 are multiplied by r^4..r^1 and summed. Limbs are 26
+// bits so that _mm256_mul_epu32 can do the 32x32->64 products.
+
+#define poly1305_avx2_min_bytes 256
+
+/* o = a * b mod 2^130-5 in 26-bit limbs, partially reduced */
+static inline void
+poly1305_mul26(unsigned long long o[5], const unsigned long long a[5], const unsigned long long b[5]) {
+  const unsigned long long s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+  unsigned long long d0,d1,d2,d3,d4,c;
+
+  d0 = (a[0] * b[0]) + (a[1] * s4) + (a[2] * s3) + (a[3] * s2) + (a[4] * s1);
+  d1 = (a[0] * b[1]) + (a[1] * b[0]) + (a[2] * s4) + (a[3] * s3) + (a[4] * s2);
+  d2 = (a[0] * b[2]) + (a[1] * b[1]) + (a[2] * b[0]) + (a[3] * s4) + (a[4] * s3);
+  d3 = (a[0] * b[3]) + (a[1] * b[2]) + (a[2] * b[1]) + (a[3] * b[0]) + (a[4] * s4);
+  d4 = (a[0] * b[4]) + (a[1] * b[3]) + (a[2] * b[2]) + (a[3] * b[1]) + (a[4] * b[0]);
+
+                c = d0 >> 26; o[0] = d0 & 0x3ffffff;
+  d1 += c;      c = d1 >> 26; o[1] = d1 & 0x3ffffff;
+  d2 += c;      c = d2 >> 26; o[2] = d2 & 0x3ffffff;
+  d3 += c;      c = d3 >> 26; o[3] = d3 & 0x3ffffff;
+  d4 += c;      c = d4 >> 26; o[4] = d4 & 0x3ffffff;
+  o[0] += c * 5; c = o[0] >> 26; o[0] &= 0x3ffffff;
+  o[1] += c;
+}
+
+/* d = h * r lane-wise, where s = r * 5 */
+__attribute__((target("avx2")))
+static inline void
+poly1305_mul_avx2(__m256i d[5], const __m256i h[5], const __m256i r[5], const __m256i s[5]) {
+  d[0] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[0]),_mm256_mul_epu32(h[1],s[4])),_mm256_mul_epu32(h[2],s[3])),_mm256_mul_epu32(h[3],s[2])),_mm256_mul_epu32(h[4],s[1]));
+  d[1] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[1]),_mm256_mul_epu32(h[1],r[0])),_mm256_mul_epu32(h[2],s[4])),_mm256_mul_epu32(h[3],s[3])),_mm256_mul_epu32(h[4],s[2]));
+  d[2] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[2]),_mm256_mul_epu32(h[1],r[1])),_mm256_mul_epu32(h[2],r[0])),_mm256_mul_epu32(h[3],s[4])),_mm256_mul_epu32(h[4],s[3]));
+  d[3] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[3]),_mm256_mul_epu32(h[1],r[2])),_mm256_mul_epu32(h[2],r[1])),_mm256_mul_epu32(h[3],r[0])),_mm256_mul_epu32(h[4],s[4]));
+  d[4] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[4]),_mm256_mul_epu32(h[1],r[3])),_mm256_mul_epu32(h[2],r[2])),_mm256_mul_epu32(h[3],r[1])),_mm256_mul_epu32(h[4],r[0]));
+}
+
+/* (partial) h = d % p lane-wise */
+__attribute__((target("avx2")))
+static inline void
+poly1305_carry_avx2(__m256i h[5], __m256i d[5], const __m256i mask26) {
+  __m256i c;
+                                     c = _mm256_srli_epi64(d[0],26); h[0] = _mm256_and_si256(d[0],mask26);
+  d[1] = _mm256_add_epi64(d[1],c);   c = _mm256_srli_epi64(d[1],26); h[1] = _mm256_and_si256(d[1],mask26);
+  d[2] = _mm256_add_epi64(d[2],c);   c = _mm256_srli_epi64(d[2],26); h[2] = _mm256_and_si256(d[2],mask26);
+  d[3] = _mm256_add_epi64(d[3],c);   c = _mm256_srli_epi64(d[3],26); h[3] = _mm256_and_si256(d[3],mask26);
+  d[4] = _mm256_add_epi64(d[4],c);   c = _mm256_srli_epi64(d[4],26); h[4] = _mm256_and_si256(d[4],mask26);
+  h[0] = _mm256_add_epi64(h[0],_mm256_add_epi64(c,_mm256_slli_epi64(c,2)));
+                                     c = _mm256_srli_epi64(h[0],26); h[0] = _mm256_and_si256(h[0],mask26);
+  h[1] = _mm256_add_epi64(h[1],c);
+}
+
+/* split four 16-byte blocks into 26-bit limbs, one block per lane */
+__attribute__((target("avx2")))
+static inline void
+poly1305_load_avx2(__m256i l[5], const unsigned char *m, const __m256i mask26, const __m256i hibit) {
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m));
+  const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m + 32));
+  const __m256i t0 = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a,b),0xd8);
+  const __m256i t1 = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a,b),0xd8);
+  l[0] = _mm256_and_si256(t0,mask26);
+  l[1] = _mm256_and_si256(_mm256_srli_epi64(t0,26),mask26);
+  l[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(t0,52),_mm256_slli_epi64(t1,12)),mask26);
+  l[3] = _mm256_and_si256(_mm256_srli_epi64(t1,14),mask26);
+  l[4] = _mm256_or_si256(_mm256_srli_epi64(t1,40),hibit);
+}
+
+/* four-lane state kept between updates, folded back into h by poly1305_avx2_finish() */
+typedef struct poly1305_avx2_state_t {
+  unsigned long long h[5][4]; /* lanes of h in 26-bit limbs */
+  unsigned long long r[4][5]; /* r^1..r^4 in 26-bit limbs */
+  unsigned char buffer[64];
+  size_t leftover;
+  unsigned char started;
+} poly1305_avx2_state_t;
+
+/* start four-lane processing from the current h, which must have no leftover bytes */
+static void
+poly1305_avx2_start(poly1305_avx2_state_t *a, const poly1305_state_internal_t *st) {
+  unsigned long long t;
+  int i,j;
+
+  /* r and h from 44-bit to 26-bit limbs, h goes in lane 0 */
+  t = st->r[0];
+  a->r[0][0] = t & 0x3ffffff; t >>= 26; t += st->r[1] << 18;
+  a->r[0][1] = t & 0x3ffffff; t >>= 26;
+  a->r[0][2] = t & 0x3ffffff; t >>= 26; t += st->r[2] << 10;
+  a->r[0][3] = t & 0x3ffffff; t >>= 26;
+  a->r[0][4] = t;
+  poly1305_mul26(a->r[1],a->r[0],a->r[0]);
+  poly1305_mul26(a->r[2],a->r[1],a->r[0]);
+  poly1305_mul26(a->r[3],a->r[1],a->r[1]);
+
+  for (i = 0; i < 5; i++) {
+    for (j = 1; j < 4; j++)
+      a->h[i][j] = 0;
+  }
+  t = st->h[0];
+  a->h[0][0] = t & 0x3ffffff; t >>= 26; t += st->h[1] << 18;
+  a->h[1][0] = t & 0x3ffffff; t >>= 26;
+  a->h[2][0] = t & 0x3ffffff; t >>= 26; t += st->h[2] << 10;
+  a->h[3][0] = t & 0x3ffffff; t >>= 26;
+  a->h[4][0] = t;
+
+  a->leftover = 0;
+  a->started = 0;
+}
+
+/* like poly1305_blocks() but bytes must be a non-zero multiple of 64 */
+__attribute__((target("avx2")))
+static void
+poly1305_avx2_blocks(poly1305_avx2_state_t *a, const unsigned char *m, size_t bytes) {
+  const __m256i mask26 = _mm256_set1_epi64x(0x3ffffff);
+  const __m256i hibit = _mm256_set1_epi64x(1 << 24); /* 1 << 128 */
+  __m256i R[5],S[5],H[5],M[5],D[5];
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    R[i] = _mm256_set1_epi64x((long long)a->r[3][i]);
+    S[i] = _mm256_set1_epi64x((long long)(a->r[3][i] * 5));
+    H[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a->h[i]));
+  }
+
+  /* the first four blocks are just added since lane 0 already holds h */
+  if (!a->started) {
+    poly1305_load_avx2(M, m, mask26, hibit);
+    for (i = 0; i < 5; i++)
+      H[i] = _mm256_add_epi64(H[i], M[i]);
+    a->started = 1;
+    m += 64;
+    bytes -= 64;
+  }
+
+  while (bytes >= 64) {
+    /* h = h * r^4 + m */
+    poly1305_mul_avx2(D, H, R, S);
+    poly1305_load_avx2(M, m, mask26, hibit);
+    for (i = 0; i < 5; i++)
+      D[i] = _mm256_add_epi64(D[i], M[i]);
+    poly1305_carry_avx2(H, D, mask26);
+    m += 64;
+    bytes -= 64;
+  }
+
+  for (i = 0; i < 5; i++)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(a->h[i]), H[i]);
+}
+
+/* h = lane0 * r^4 + lane1 * r^3 + lane2 * r^2 + lane3 * r, leaving leftover bytes in a->buffer */
+__attribute__((target("avx2")))
+static void
+poly1305_avx2_finish(poly1305_avx2_state_t *a, poly1305_state_internal_t *st) {
+  const __m256i mask26 = _mm256_set1_epi64x(0x3ffffff);
+  __m256i R[5],S[5],H[5],D[5];
+  unsigned long long hl[5];
+  unsigned long long h0,h1,h2,c;
+  int i;
+
+  if (!a->started)
+    return; /* h is unchanged */
+
+  for (i = 0; i < 5; i++) {
+    R[i] = _mm256_setr_epi64x((long long)a->r[3][i], (long long)a->r[2][i], (long long)a->r[1][i], (long long)a->r[0][i]);
+    S[i] = _mm256_setr_epi64x((long long)(a->r[3][i] * 5), (long long)(a->r[2][i] * 5), (long long)(a->r[1][i] * 5), (long long)(a->r[0][i] * 5));
+    H[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a->h[i]));
+  }
+  poly1305_mul_avx2(D, H, R, S);
+  poly1305_carry_avx2(H, D, mask26);
+  for (i = 0; i < 5; i++) {
+    const __m128i x = _mm_add_epi64(_mm256_castsi256_si128(H[i]), _mm256_extracti128_si256(H[i], 1));
+    hl[i] = (unsigned long long)_mm_cvtsi128_si64(x) + (unsigned long long)_mm_extract_epi64(x, 1);
+  }
+
+  /* (partial) h %= p, then back to 44-bit limbs */
+                c = hl[0] >> 26; hl[0] &= 0x3ffffff;
+  hl[1] += c;   c = hl[1] >> 26; hl[1] &= 0x3ffffff;
+  hl[2] += c;   c = hl[2] >> 26; hl[2] &= 0x3ffffff;
+  hl[3] += c;   c = hl[3] >> 26; hl[3] &= 0x3ffffff;
+  hl[4] += c;   c = hl[4] >> 26; hl[4] &= 0x3ffffff;
+  hl[0] += c * 5;
+
+  h0 = hl[0] + (hl[1] << 26);                     c = h0 >> 44; h0 &= 0xfffffffffff;
+  h1 = c + (hl[2] << 8) + (hl[3] << 34);          c = h1 >> 44; h1 &= 0xfffffffffff;
+  h2 = c + (hl[4] << 16);
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+}
+
+static Poly1305::Implementation poly1305_detect_implementation() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return Poly1305::IMPLEMENTATION_AVX2;
+  return Poly1305::IMPLEMENTATION_DEFAULT;
+}
+static const Poly1305::Implementation poly1305_best_implementation = poly1305_detect_implementation();
+static Poly1305::Implementation poly1305_implementation = poly1305_best_implementation;
+
+#endif // ZT_POLY1305_AVX2
+
 //////////////////////////////////////////////////////////////////////////////
 
 #else
@@ -619,14 +833,147 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
   }
 }
 
+/* poly1305_context plus the four-lane AVX2 state if that is in use */
+typedef struct poly1305_dispatch_context {
+  poly1305_context donna;
+#ifdef ZT_POLY1305_AVX2
+  poly1305_avx2_state_t avx2;
+  unsigned char avx2active;
+#endif
+} poly1305_dispatch_context;
+
+/* Poly1305 objects keep one of these in a uint64_t[72] */
+typedef char poly1305_dispatch_context_fits[(sizeof(poly1305_dispatch_context) <= (sizeof(uint64_t) * 72)) ? 1 : -1];
+
+static inline void
+poly1305_dispatch_init(poly1305_dispatch_context *ctx, const unsigned char key[32]) {
+  poly1305_init(&ctx->donna, key);
+#ifdef ZT_POLY1305_AVX2
+  ctx->avx2active = 0;
+#endif
+}
+
+/* Once a message is long enough for the AVX2 code it stays there until finish, with
+ * partial 64-byte chunks buffered between updates. */
+static inline void
+poly1305_dispatch_update(poly1305_dispatch_context *ctx, const unsigned char *m, size_t bytes) {
+#ifdef ZT_POLY1305_AVX2
+  poly1305_state_internal_t *st = (poly1305_state_internal_t *)&ctx->donna;
+  poly1305_avx2_state_t *a = &ctx->avx2;
+  size_t i;
+
+  if (!ctx->avx2active) {
+    if ((poly1305_implementation != Poly1305::IMPLEMENTATION_AVX2)||((st->leftover + bytes) < poly1305_avx2_min_bytes)) {
+      poly1305_update(&ctx->donna, m, bytes);
+      return;
+    }
+    if (st->leftover) {
+      size_t want = (poly1305_block_size - st->leftover);
+      if (want > bytes)
+        want = bytes;
+      poly1305_update(&ctx->donna, m, want);
+      m += want;
+      bytes -= want;
+    }
+    poly1305_avx2_start(a, st);
+    ctx->avx2active = 1;
+  }
+
+  /* handle leftover */
+  if (a->leftover) {
+    size_t want = (64 - a->leftover);
+    if (want > bytes)
+      want = bytes;
+    for (i = 0; i < want; i++)
+      a->buffer[a->leftover + i] = m[i];
+    bytes -= want;
+    m += want;
+    a->leftover += want;
+    if (a->leftover < 64)
+      return;
+    poly1305_avx2_blocks(a, a->buffer, 64);
+    a->leftover = 0;
+  }
+
+  /* process full chunks */
+  if (bytes >= 64) {
+    const size_t want = bytes & ~((size_t)63);
+    poly1305_avx2_blocks(a, m, want);
+    m += want;
+    bytes -= want;
+  }
+
+  /* store leftover */
+  for (i = 0; i < bytes; i++)
+    a->buffer[i] = m[i];
+  a->leftover = bytes;
+#else
+  poly1305_update(&ctx->donna, m, bytes);
+#endif
+}
+
+static inline void
+poly1305_dispatch_finish(poly1305_dispatch_context *ctx, unsigned char mac[16]) {
+#ifdef ZT_POLY1305_AVX2
+  if (ctx->avx2active) {
+    poly1305_avx2_finish(&ctx->avx2, (poly1305_state_internal_t *)&ctx->donna);
+    poly1305_update(&ctx->donna, ctx->avx2.buffer, ctx->avx2.leftover);
+    /* zero out the state */
+    memset(&ctx->avx2, 0, sizeof(ctx->avx2));
+  }
+#endif
+  poly1305_finish(&ctx->donna, mac);
+}
+
 } // anonymous namespace
 
+bool Poly1305::implementationSupported(const Implementation impl)
+{
+#ifdef ZT_POLY1305_AVX2
+  return (impl <= poly1305_best_implementation);
+#else
+  return (impl == IMPLEMENTATION_DEFAULT);
+#endif
+}
+
+Poly1305::Implementation Poly1305::implementation()
+{
+#ifdef ZT_POLY1305_AVX2
+  return poly1305_implementation;
+#else
+  return IMPLEMENTATION_DEFAULT;
+#endif
+}
+
+void Poly1305::setImplementation(const Implementation impl)
+{
+#ifdef ZT_POLY1305_AVX2
+  if (impl <= poly1305_best_implementation)
+    poly1305_implementation = impl;
+#endif
+}
+
 void Poly1305::compute(void *auth,const void *data,unsigned int len,const void *key)
 {
-  poly1305_context ctx;
-  poly1305_init(&ctx,reinterpret_cast<const unsigned char *>(key));
-  poly1305_update(&ctx,reinterpret_cast<const unsigned char *>(data),(size_t)len);
-  poly1305_finish(&ctx,reinterpret_cast<unsigned char *>(auth));
+  poly1305_dispatch_context ctx;
+  poly1305_dispatch_init(&ctx,reinterpret_cast<const unsigned char *>(key));
+  poly1305_dispatch_update(&ctx,reinterpret_cast<const unsigned char *>(data),(size_t)len);
+  poly1305_dispatch_finish(&ctx,reinterpret_cast<unsigned char *>(auth));
+}
+
+Poly1305::Poly1305(const void *key)
+{
+  poly1305_dispatch_init(reinterpret_cast<poly1305_dispatch_context *>(_ctx),reinterpret_cast<const unsigned char *>(key));
+}
+
+void Poly1305::update(const void *data,unsigned int len)
+{
+  poly1305_dispatch_update(reinterpret_cast<poly1305_dispatch_context *>(_ctx),reinterpret_cast<const unsigned char *>(data),(size_t)len);
+}
+
+void Poly1305::finish(void *auth)
+{
+  poly1305_dispatch_finish(reinterpret_cast<poly1305_dispatch_context *>(_ctx),reinterpret_cast<unsigned char *>(auth));
 }
 
 } // namespace ZeroTier
@@ -27,6 +27,8 @@
 #ifndef ZT_POLY1305_HPP
 #define ZT_POLY1305_HPP
 
+#include <stdint.h>
+
 namespace ZeroTier {
 
 #define ZT_POLY1305_KEY_LEN 32
@@ -42,10 +44,44 @@ namespace ZeroTier {
  * In Packet this is done by using the first 32 bytes of the stream cipher
  * keystream as a one-time-use key. These 32 bytes are then discarded and
  * the packet is encrypted with the next N bytes.
+ *
+ * On x86 CPUs with AVX2, messages of 256 bytes or more are processed four
+ * blocks at a time. The implementation is picked at startup by checking the
+ * CPU.
  */
 class Poly1305
 {
 public:
+	/**
+	 * Implementations of compute() that can be selected at runtime
+	 */
+	enum Implementation
+	{
+		IMPLEMENTATION_DEFAULT = 0, // one block at a time (Poly1305-donna)
+		IMPLEMENTATION_AVX2 = 1     // four blocks at a time
+	};
+
+	/**
+	 * @param impl Implementation
+	 * @return True if this build and CPU can use this implementation
+	 */
+	static bool implementationSupported(const Implementation impl);
+
+	/**
+	 * @return Implementation currently used by compute()
+	 */
+	static Implementation implementation();
+
+	/**
+	 * Override the implementation used by compute()
+	 *
+	 * This is for testing and benchmarking and is not thread safe. Unsupported
+	 * implementations are ignored.
+	 *
+	 * @param impl Implementation
+	 */
+	static void setImplementation(const Implementation impl);
+
 	/**
 	 * Compute a one-time authentication code
 	 *
@@ -55,6 +91,34 @@ public:
 	 * @param key 32-byte one-time use key to authenticate data (must not be reused)
 	 */
 	static void compute(void *auth,const void *data,unsigned int len,const void *key);
+
+	/**
+	 * Start an incremental computation
+	 *
+	 * Feeding the same bytes to update() in any number of pieces gives the
+	 * same code as compute().
+	 *
+	 * @param key 32-byte one-time use key to authenticate data (must not be reused)
+	 */
+	Poly1305(const void *key);
+
+	/**
+	 * @param data Next data to authenticate
+	 * @param len Length of data in bytes
+	 */
+	void update(const void *data,unsigned int len);
+
+	/**
+	 * Finish, write the code, and zero the key state
+	 *
+	 * This object must not be used after this.
+	 *
+	 * @param auth Buffer to receive code -- MUST be 16 bytes in length
+	 */
+	void finish(void *auth);
+
+private:
+	uint64_t _ctx[72]; // poly1305_dispatch_context in Poly1305.cpp
 };
 
 } // namespace ZeroTier
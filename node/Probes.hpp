@@ -0,0 +1,115 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PROBES_HPP
+#define ZT_PROBES_HPP
+
+/*
+ * USDT static probes at points along the packet paths
+ *
+ * These are compiled out unless built with ZT_USDT=1. On Linux that needs
+ * <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel) and the probes
+ * can then be used from bpftrace, perf or SystemTap, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/zerotier-one:zerotier:verb__dispatch { @[arg2] = count(); }'
+ *
+ * On macOS and FreeBSD the make files generate ZeroTierProbes.h from
+ * ZeroTierProbes.d with dtrace -h for use from DTrace, e.g.:
+ *
+ *   dtrace -n 'zerotier*:::dearmor-fail { @[arg2] = count(); }'
+ *
+ * An unused probe is a single no-op instruction, so they can be left in
+ * production builds. Arguments are always evaluated, so keep them cheap.
+ *
+ * Probes and their arguments (addresses are 40-bit ZeroTier addresses):
+ *
+ *   packet__receive(int64_t localSocket,struct sockaddr_storage *from,unsigned int len)
+ *     - a packet arrived from the physical network
+ *   dearmor__ok(uint64_t source,uint64_t packetId,unsigned int len)
+ *     - a packet was authenticated, decrypted and decompressed
+ *   dearmor__fail(uint64_t source,uint64_t packetId,int reason)
+ *     - a packet failed its MAC check (reason 1) or decompression (reason 2)
+ *   verb__dispatch(uint64_t source,uint64_t packetId,unsigned int verb,unsigned int hops)
+ *     - an authenticated packet is about to be handled by its verb
+ *   filter__verdict(uint64_t nwid,int inbound,uint64_t ztSource,uint64_t ztDest,unsigned int etherType,int verdict)
+ *     - the rules engine decided on a frame (verdict 0 drop, 1 accept, 2 accept as bridged)
+ *   tap__write(uint64_t nwid,unsigned int etherType,unsigned int len)
+ *     - a frame is being handed to a network's tap
+ *   whois__send(uint64_t address,uint64_t upstream)
+ *     - a WHOIS for an address is being sent to a root
+ *   whois__resolve(uint64_t address,uint64_t ms)
+ *     - an outstanding WHOIS was answered after this many milliseconds
+ *   path__change(uint64_t peer,int event,struct sockaddr_storage *address)
+ *     - a peer's path came up or went down or its best path changed (event is a ZT_Event)
+ */
+
+#ifdef ZT_USDT
+
+#ifdef ZT_USDT_DTRACE_H
+
+#include "ZeroTierProbes.h"
+
+#define ZT_PROBE_PACKET_RECEIVE(s,f,l) ZEROTIER_PACKET_RECEIVE((int64_t)(s),(void *)(f),(unsigned int)(l))
+#define ZT_PROBE_DEARMOR_OK(s,p,l) ZEROTIER_DEARMOR_OK((uint64_t)(s),(uint64_t)(p),(unsigned int)(l))
+#define ZT_PROBE_DEARMOR_FAIL(s,p,r) ZEROTIER_DEARMOR_FAIL((uint64_t)(s),(uint64_t)(p),(int)(r))
+#define ZT_PROBE_VERB_DISPATCH(s,p,v,h) ZEROTIER_VERB_DISPATCH((uint64_t)(s),(uint64_t)(p),(unsigned int)(v),(unsigned int)(h))
+#define ZT_PROBE_FILTER_VERDICT(n,i,s,d,e,v) ZEROTIER_FILTER_VERDICT((uint64_t)(n),(int)(i),(uint64_t)(s),(uint64_t)(d),(unsigned int)(e),(int)(v))
+#define ZT_PROBE_TAP_WRITE(n,e,l) ZEROTIER_TAP_WRITE((uint64_t)(n),(unsigned int)(e),(unsigned int)(l))
+#define ZT_PROBE_WHOIS_SEND(a,u) ZEROTIER_WHOIS_SEND((uint64_t)(a),(uint64_t)(u))
+#define ZT_PROBE_WHOIS_RESOLVE(a,t) ZEROTIER_WHOIS_RESOLVE((uint64_t)(a),(uint64_t)(t))
+#define ZT_PROBE_PATH_CHANGE(p,e,a) ZEROTIER_PATH_CHANGE((uint64_t)(p),(int)(e),(void *)(a))
+
+#else // <sys/sdt.h>
+
+#include <sys/sdt.h>
+
+#define ZT_PROBE_PACKET_RECEIVE(s,f,l) DTRACE_PROBE3(zerotier,packet__receive,(int64_t)(s),(const void *)(f),(unsigned int)(l))
+#define ZT_PROBE_DEARMOR_OK(s,p,l) DTRACE_PROBE3(zerotier,dearmor__ok,(uint64_t)(s),(uint64_t)(p),(unsigned int)(l))
+#define ZT_PROBE_DEARMOR_FAIL(s,p,r) DTRACE_PROBE3(zerotier,dearmor__fail,(uint64_t)(s),(uint64_t)(p),(int)(r))
+#define ZT_PROBE_VERB_DISPATCH(s,p,v,h) DTRACE_PROBE4(zerotier,verb__dispatch,(uint64_t)(s),(uint64_t)(p),(unsigned int)(v),(unsigned int)(h))
+#define ZT_PROBE_FILTER_VERDICT(n,i,s,d,e,v) DTRACE_PROBE6(zerotier,filter__verdict,(uint64_t)(n),(int)(i),(uint64_t)(s),(uint64_t)(d),(unsigned int)(e),(int)(v))
+#define ZT_PROBE_TAP_WRITE(n,e,l) DTRACE_PROBE3(zerotier,tap__write,(uint64_t)(n),(unsigned int)(e),(unsigned int)(l))
+#define ZT_PROBE_WHOIS_SEND(a,u) DTRACE_PROBE2(zerotier,whois__send,(uint64_t)(a),(uint64_t)(u))
+#define ZT_PROBE_WHOIS_RESOLVE(a,t) DTRACE_PROBE2(zerotier,whois__resolve,(uint64_t)(a),(uint64_t)(t))
+#define ZT_PROBE_PATH_CHANGE(p,e,a) DTRACE_PROBE3(zerotier,path__change,(uint64_t)(p),(int)(e),(const void *)(a))
+
+#endif
+
+#else // !ZT_USDT
+
+#define ZT_PROBE_PACKET_RECEIVE(s,f,l) ((void)0)
+#define ZT_PROBE_DEARMOR_OK(s,p,l) ((void)0)
+#define ZT_PROBE_DEARMOR_FAIL(s,p,r) ((void)0)
+#define ZT_PROBE_VERB_DISPATCH(s,p,v,h) ((void)0)
+#define ZT_PROBE_FILTER_VERDICT(n,i,s,d,e,v) ((void)0)
+#define ZT_PROBE_TAP_WRITE(n,e,l) ((void)0)
+#define ZT_PROBE_WHOIS_SEND(a,u) ((void)0)
+#define ZT_PROBE_WHOIS_RESOLVE(a,t) ((void)0)
+#define ZT_PROBE_PATH_CHANGE(p,e,a) ((void)0)
+
+#endif
+
+#endif
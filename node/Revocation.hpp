@@ -46,9 +46,25 @@
  */
 #define ZT_REVOCATION_FLAG_FAST_PROPAGATE 0x1ULL
 
+/**
+ * Wire layout of the fixed-size head of a revocation, ahead of its signature
+ */
+#define ZT_REVOCATION_WIRE_IDX_RESERVED0 0 // 4 unused bytes, currently set to 0
+#define ZT_REVOCATION_WIRE_IDX_ID 4
+#define ZT_REVOCATION_WIRE_IDX_NETWORK_ID 8
+#define ZT_REVOCATION_WIRE_IDX_RESERVED1 16 // 4 unused bytes, currently set to 0
+#define ZT_REVOCATION_WIRE_IDX_CREDENTIAL_ID 20
+#define ZT_REVOCATION_WIRE_IDX_THRESHOLD 24
+#define ZT_REVOCATION_WIRE_IDX_FLAGS 32
+#define ZT_REVOCATION_WIRE_IDX_TARGET 40
+#define ZT_REVOCATION_WIRE_IDX_SIGNED_BY (ZT_REVOCATION_WIRE_IDX_TARGET + ZT_ADDRESS_LENGTH)
+#define ZT_REVOCATION_WIRE_IDX_TYPE (ZT_REVOCATION_WIRE_IDX_SIGNED_BY + ZT_ADDRESS_LENGTH)
+#define ZT_REVOCATION_WIRE_HEAD_LENGTH (ZT_REVOCATION_WIRE_IDX_TYPE + 1)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Revocation certificate to instantaneously revoke a COM, capability, or tag
@@ -117,27 +133,36 @@ public:
 	 */
 	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
 
+	/**
+	 * Add this revocation's signature to a batch if the signer is known
+	 *
+	 * This only makes a later verify() cheaper and does not replace it.
+	 *
+	 * @param RR Runtime environment to allow identity lookup for signers
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch Batch to add to
+	 */
+	void addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const;
+
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
 	{
 		if (forSign) b.append((uint64_t)0x7f7f7f7f7f7f7f7fULL);
 
-		b.append((uint32_t)0); // 4 unused bytes, currently set to 0
-		b.append(_id);
-		b.append(_networkId);
-		b.append((uint32_t)0); // 4 unused bytes, currently set to 0
-		b.append(_credentialId);
-		b.append(_threshold);
-		b.append(_flags);
-		_target.appendTo(b);
-		_signedBy.appendTo(b);
-		b.append((uint8_t)_type);
-
-		if (!forSign) {
-			b.append((uint8_t)1); // 1 == Ed25519 signature
-			b.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
-			b.append(_signature.data,ZT_C25519_SIGNATURE_LEN);
-		}
+		uint8_t *const h = reinterpret_cast<uint8_t *>(b.appendField(ZT_REVOCATION_WIRE_HEAD_LENGTH));
+		Utils::storeBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_RESERVED0,0);
+		Utils::storeBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_ID,_id);
+		Utils::storeBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_NETWORK_ID,_networkId);
+		Utils::storeBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_RESERVED1,0);
+		Utils::storeBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_CREDENTIAL_ID,_credentialId);
+		Utils::storeBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_THRESHOLD,_threshold);
+		Utils::storeBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_FLAGS,_flags);
+		_target.copyTo(h + ZT_REVOCATION_WIRE_IDX_TARGET,ZT_ADDRESS_LENGTH);
+		_signedBy.copyTo(h + ZT_REVOCATION_WIRE_IDX_SIGNED_BY,ZT_ADDRESS_LENGTH);
+		h[ZT_REVOCATION_WIRE_IDX_TYPE] = (uint8_t)_type;
+
+		if (!forSign)
+			_appendSignature(b,_signature);
 
 		// This is the size of any additional fields, currently 0.
 		b.append((uint16_t)0);
@@ -152,26 +177,16 @@ public:
 
 		unsigned int p = startAt;
 
-		p += 4; // 4 bytes, currently unused
-		_id = b.template at<uint32_t>(p); p += 4;
-		_networkId = b.template at<uint64_t>(p); p += 8;
-		p += 4; // 4 bytes, currently unused
-		_credentialId = b.template at<uint32_t>(p); p += 4;
-		_threshold = b.template at<uint64_t>(p); p += 8;
-		_flags = b.template at<uint64_t>(p); p += 8;
-		_target.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		_signedBy.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		_type = (Credential::Type)b[p++];
-
-		if (b[p++] == 1) {
-			if (b.template at<uint16_t>(p) == ZT_C25519_SIGNATURE_LEN) {
-				p += 2;
-				memcpy(_signature.data,b.field(p,ZT_C25519_SIGNATURE_LEN),ZT_C25519_SIGNATURE_LEN);
-				p += ZT_C25519_SIGNATURE_LEN;
-			} else throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_CRYPTOGRAPHIC_TOKEN;
-		} else {
-			p += 2 + b.template at<uint16_t>(p);
-		}
+		const uint8_t *const h = b.field(p,ZT_REVOCATION_WIRE_HEAD_LENGTH);
+		_id = Utils::loadBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_ID);
+		_networkId = Utils::loadBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_NETWORK_ID);
+		_credentialId = Utils::loadBigEndian<uint32_t>(h + ZT_REVOCATION_WIRE_IDX_CREDENTIAL_ID);
+		_threshold = Utils::loadBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_THRESHOLD);
+		_flags = Utils::loadBigEndian<uint64_t>(h + ZT_REVOCATION_WIRE_IDX_FLAGS);
+		_target.setTo(h + ZT_REVOCATION_WIRE_IDX_TARGET,ZT_ADDRESS_LENGTH);
+		_signedBy.setTo(h + ZT_REVOCATION_WIRE_IDX_SIGNED_BY,ZT_ADDRESS_LENGTH);
+		_type = (Credential::Type)h[ZT_REVOCATION_WIRE_IDX_TYPE];
+		p = _readSignature(b,p + ZT_REVOCATION_WIRE_HEAD_LENGTH,_signature);
 
 		p += 2 + b.template at<uint16_t>(p);
 		if (p > b.size())
@@ -43,6 +43,17 @@ class Multicaster;
 class NetworkController;
 class SelfAwareness;
 class Trace;
+class SignatureCache;
+class Metrics;
+class PacketTrace;
+class Latency;
+class NeighborCache;
+class DeferredPackets;
+class Bench;
+class Capture;
+class FlowExport;
+class CryptoPipeline;
+class Cluster;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -54,19 +65,33 @@ public:
 		node(n)
 		,identity()
 		,localNetworkController((NetworkController *)0)
+		,metrics((Metrics *)0)
+		,ptrace((PacketTrace *)0)
+		,latency((Latency *)0)
+		,t((Trace *)0)
 		,sw((Switch *)0)
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
 		,sa((SelfAwareness *)0)
+		,sc((SignatureCache *)0)
+		,neighbors((NeighborCache *)0)
+		,dp((DeferredPackets *)0)
+		,bench((Bench *)0)
+		,capture((Capture *)0)
+		,flowExport((FlowExport *)0)
+		,cp((CryptoPipeline *)0)
+		,cluster((Cluster *)0)
 	{
 		Utils::getSecureRandom(&instanceId,sizeof(instanceId));
 		memset(publicIdentityStr,0,sizeof(publicIdentityStr));
 		memset(secretIdentityStr,0,sizeof(secretIdentityStr));
+		memset(stateKey,0,sizeof(stateKey));
 	}
 
 	~RuntimeEnvironment()
 	{
 		Utils::burn(secretIdentityStr,sizeof(secretIdentityStr));
+		Utils::burn(stateKey,sizeof(stateKey));
 	}
 
 	/**
@@ -82,6 +107,9 @@ public:
 	char publicIdentityStr[ZT_IDENTITY_STRING_BUFFER_LENGTH];
 	char secretIdentityStr[ZT_IDENTITY_STRING_BUFFER_LENGTH];
 
+	// Key derived from our secret identity for encrypting cached state at rest
+	uint8_t stateKey[32];
+
 	// This is set externally to an instance of this base class
 	NetworkController *localNetworkController;
 
@@ -93,11 +121,26 @@ public:
 	 * These are constant and never null after startup unless indicated.
 	 */
 
+	Metrics *metrics;
+	PacketTrace *ptrace;
+	Latency *latency;
 	Trace *t;
 	Switch *sw;
 	Multicaster *mc;
 	Topology *topology;
 	SelfAwareness *sa;
+	SignatureCache *sc;
+	NeighborCache *neighbors;
+	DeferredPackets *dp;
+	Bench *bench;
+	Capture *capture;
+	FlowExport *flowExport;
+
+	// Non-null only if the embedder supplied a cryptoJobsFunction
+	CryptoPipeline *cp;
+
+	// Non-null only on roots/moons after ZT_Node_clusterInit()
+	Cluster *cluster;
 };
 
 } // namespace ZeroTier
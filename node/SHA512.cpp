@@ -14,6 +14,13 @@ Public domain.
 #include "SHA512.hpp"
 #include "Utils.hpp"
 
+// The four-lane AVX2 code used by SHA512::hashMulti() is built with per-function
+// target attributes and only used if the CPU has AVX2
+#if (!defined(ZT_SHA512_NO_AVX2)) && (defined(__GNUC__) || defined(__clang__)) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__))
+#define ZT_SHA512_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace ZeroTier {
 
 #define uint64 uint64_t
@@ -276,27 +283,11 @@ static const unsigned char iv[64] = {
   0x5b,0xe0,0xcd,0x19,0x13,0x7e,0x21,0x79
 };
 
-//////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-void SHA512::hash(void *digest,const void *data,unsigned int len)
+/* Pads the last (len & 127) bytes of a message, returns 1 or 2 blocks */
+static inline unsigned int sha512_pad(unsigned char padded[256],const unsigned char *in,unsigned int inlen,uint64_t bytes)
 {
-  unsigned char h[64];
-  unsigned char padded[256];
-  int i;
-  uint64_t bytes = len;
-
-  const unsigned char *in = (const unsigned char *)data;
-  unsigned int inlen = len;
-
-  for (i = 0;i < 64;++i) h[i] = iv[i];
-
-  blocks(h,in,inlen);
-  in += inlen;
-  inlen &= 127;
-  in -= inlen;
-
-  for (i = 0;i < (int)inlen;++i) padded[i] = in[i];
+  unsigned int i;
+  for (i = 0;i < inlen;++i) padded[i] = in[i];
   padded[inlen] = 0x80;
 
   if (inlen < 112) {
@@ -310,7 +301,7 @@ void SHA512::hash(void *digest,const void *data,unsigned int len)
     padded[125] = (unsigned char)((bytes >> 13) & 0xff);
     padded[126] = (unsigned char)((bytes >> 5) & 0xff);
     padded[127] = (unsigned char)((bytes << 3) & 0xff);
-    blocks(h,padded,128);
+    return 1;
   } else {
     for (i = inlen + 1;i < 247;++i) padded[i] = 0;
     padded[247] = (unsigned char)((bytes >> 61) & 0xff);
@@ -322,10 +313,236 @@ void SHA512::hash(void *digest,const void *data,unsigned int len)
     padded[253] = (unsigned char)((bytes >> 13) & 0xff);
     padded[254] = (unsigned char)((bytes >> 5) & 0xff);
     padded[255] = (unsigned char)((bytes << 3) & 0xff);
-    blocks(h,padded,256);
+    return 2;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+#ifdef ZT_SHA512_AVX2
+
+// Four independent messages, one per 64-bit lane, compressed in lockstep
+
+static const uint64_t sha512_avx2_k[80] = {
+  0x428a2f98d728ae22ULL,0x7137449123ef65cdULL,0xb5c0fbcfec4d3b2fULL,0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL,0x59f111f1b605d019ULL,0x923f82a4af194f9bULL,0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL,0x12835b0145706fbeULL,0x243185be4ee4b28cULL,0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL,0x80deb1fe3b1696b1ULL,0x9bdc06a725c71235ULL,0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL,0xefbe4786384f25e3ULL,0x0fc19dc68b8cd5b5ULL,0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL,0x4a7484aa6ea6e483ULL,0x5cb0a9dcbd41fbd4ULL,0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL,0xa831c66d2db43210ULL,0xb00327c898fb213fULL,0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL,0xd5a79147930aa725ULL,0x06ca6351e003826fULL,0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL,0x2e1b21385c26c926ULL,0x4d2c6dfc5ac42aedULL,0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL,0x766a0abb3c77b2a8ULL,0x81c2c92e47edaee6ULL,0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL,0xa81a664bbc423001ULL,0xc24b8b70d0f89791ULL,0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL,0xd69906245565a910ULL,0xf40e35855771202aULL,0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL,0x1e376c085141ab53ULL,0x2748774cdf8eeb99ULL,0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL,0x4ed8aa4ae3418acbULL,0x5b9cca4f7763e373ULL,0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL,0x78a5636f43172f60ULL,0x84c87814a1f0ab72ULL,0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL,0xa4506cebde82bde9ULL,0xbef9a3f7b2c67915ULL,0xc67178f2e372532bULL,
+  0xca273eceea26619cULL,0xd186b8c721c0c207ULL,0xeada7dd6cde0eb1eULL,0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL,0x0a637dc5a2c898a6ULL,0x113f9804bef90daeULL,0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL,0x32caab7b40c72493ULL,0x3c9ebe0a15c9bebcULL,0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL,0x597f299cfc657e2aULL,0x5fcb6fab3ad6faecULL,0x6c44198c4a475817ULL
+};
+
+#define AVX2_ROTR(x,c) _mm256_or_si256(_mm256_srli_epi64((x),(c)),_mm256_slli_epi64((x),64 - (c)))
+#define AVX2_SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x,28),AVX2_ROTR(x,34)),AVX2_ROTR(x,39))
+#define AVX2_SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x,14),AVX2_ROTR(x,18)),AVX2_ROTR(x,41))
+#define AVX2_sigma0(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x, 1),AVX2_ROTR(x, 8)),_mm256_srli_epi64((x),7))
+#define AVX2_sigma1(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x,19),AVX2_ROTR(x,61)),_mm256_srli_epi64((x),6))
+
+/* state[word][lane], one 128-byte block per lane */
+__attribute__((target("avx2")))
+static void sha512_avx2_block4(uint64_t state[8][4],const unsigned char *const in[4])
+{
+  __m256i w[16];
+  __m256i a = _mm256_loadu_si256((const __m256i *)state[0]);
+  __m256i b = _mm256_loadu_si256((const __m256i *)state[1]);
+  __m256i c = _mm256_loadu_si256((const __m256i *)state[2]);
+  __m256i d = _mm256_loadu_si256((const __m256i *)state[3]);
+  __m256i e = _mm256_loadu_si256((const __m256i *)state[4]);
+  __m256i f = _mm256_loadu_si256((const __m256i *)state[5]);
+  __m256i g = _mm256_loadu_si256((const __m256i *)state[6]);
+  __m256i h = _mm256_loadu_si256((const __m256i *)state[7]);
+  int t;
+
+  for (t = 0;t < 16;++t)
+    w[t] = _mm256_set_epi64x((long long)load_bigendian(in[3] + (t * 8)),(long long)load_bigendian(in[2] + (t * 8)),(long long)load_bigendian(in[1] + (t * 8)),(long long)load_bigendian(in[0] + (t * 8)));
+
+  for (t = 0;t < 80;++t) {
+    if (t >= 16)
+      w[t & 15] = _mm256_add_epi64(_mm256_add_epi64(AVX2_sigma1(w[(t - 2) & 15]),w[(t - 7) & 15]),_mm256_add_epi64(AVX2_sigma0(w[(t - 15) & 15]),w[t & 15]));
+    const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e,f),_mm256_andnot_si256(e,g));
+    const __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a,b),_mm256_and_si256(a,c)),_mm256_and_si256(b,c));
+    const __m256i T1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(h,AVX2_SIGMA1(e)),_mm256_add_epi64(ch,_mm256_set1_epi64x((long long)sha512_avx2_k[t]))),w[t & 15]);
+    const __m256i T2 = _mm256_add_epi64(AVX2_SIGMA0(a),maj);
+    h = g; g = f; f = e;
+    e = _mm256_add_epi64(d,T1);
+    d = c; c = b; b = a;
+    a = _mm256_add_epi64(T1,T2);
+  }
+
+  _mm256_storeu_si256((__m256i *)state[0],_mm256_add_epi64(a,_mm256_loadu_si256((const __m256i *)state[0])));
+  _mm256_storeu_si256((__m256i *)state[1],_mm256_add_epi64(b,_mm256_loadu_si256((const __m256i *)state[1])));
+  _mm256_storeu_si256((__m256i *)state[2],_mm256_add_epi64(c,_mm256_loadu_si256((const __m256i *)state[2])));
+  _mm256_storeu_si256((__m256i *)state[3],_mm256_add_epi64(d,_mm256_loadu_si256((const __m256i *)state[3])));
+  _mm256_storeu_si256((__m256i *)state[4],_mm256_add_epi64(e,_mm256_loadu_si256((const __m256i *)state[4])));
+  _mm256_storeu_si256((__m256i *)state[5],_mm256_add_epi64(f,_mm256_loadu_si256((const __m256i *)state[5])));
+  _mm256_storeu_si256((__m256i *)state[6],_mm256_add_epi64(g,_mm256_loadu_si256((const __m256i *)state[6])));
+  _mm256_storeu_si256((__m256i *)state[7],_mm256_add_epi64(h,_mm256_loadu_si256((const __m256i *)state[7])));
+}
+
+static bool sha512_detect_avx2()
+{
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("avx2") != 0);
+}
+static const bool sha512_has_avx2 = sha512_detect_avx2();
+
+/* A message split into its full blocks and one or two padded final blocks */
+struct sha512_lane
+{
+  const unsigned char *in;
+  unsigned int full;
+  unsigned int blocks;
+  unsigned char padded[256];
+
+  inline const unsigned char *block(unsigned int k) const { return (k < full) ? (in + (k * 128)) : (padded + ((k - full) * 128)); }
+};
+
+static void sha512_avx2_hash4(void *const digests[4],const void *const data[4],const unsigned int lens[4])
+{
+  sha512_lane lanes[4];
+  uint64_t state[8][4];
+  const unsigned char *in[4];
+  unsigned char h[64];
+  unsigned int minBlocks = 0xffffffff;
+  int i,j;
+
+  for (j = 0;j < 4;++j) {
+    lanes[j].in = (const unsigned char *)data[j];
+    lanes[j].full = lens[j] >> 7;
+    lanes[j].blocks = lanes[j].full + sha512_pad(lanes[j].padded,lanes[j].in + (lanes[j].full * 128),lens[j] & 127,lens[j]);
+    if (lanes[j].blocks < minBlocks)
+      minBlocks = lanes[j].blocks;
+    for (i = 0;i < 8;++i)
+      state[i][j] = load_bigendian(iv + (i * 8));
+  }
+
+  for (unsigned int k = 0;k < minBlocks;++k) {
+    for (j = 0;j < 4;++j)
+      in[j] = lanes[j].block(k);
+    sha512_avx2_block4(state,in);
   }
 
+  for (j = 0;j < 4;++j) {
+    for (i = 0;i < 8;++i)
+      store_bigendian(h + (i * 8),state[i][j]);
+    for (unsigned int k = minBlocks;k < lanes[j].blocks;++k)
+      blocks(h,lanes[j].block(k),128);
+    for (i = 0;i < 64;++i) ((unsigned char *)digests[j])[i] = h[i];
+  }
+}
+
+#endif // ZT_SHA512_AVX2
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void SHA512::hash(void *digest,const void *data,unsigned int len)
+{
+  unsigned char h[64];
+  unsigned char padded[256];
+  int i;
+
+  const unsigned char *in = (const unsigned char *)data;
+  unsigned int inlen = len;
+
+  for (i = 0;i < 64;++i) h[i] = iv[i];
+
+  blocks(h,in,inlen);
+  in += inlen;
+  inlen &= 127;
+  in -= inlen;
+
+  blocks(h,padded,sha512_pad(padded,in,inlen,len) * 128);
+
+  for (i = 0;i < 64;++i) ((unsigned char *)digest)[i] = h[i];
+}
+
+void SHA512::Stream::reset()
+{
+  for (unsigned int i = 0;i < 64;++i) _h[i] = iv[i];
+  _bytes = 0;
+}
+
+void SHA512::Stream::update(const void *data,unsigned int len)
+{
+  const unsigned char *in = (const unsigned char *)data;
+  unsigned int have = (unsigned int)(_bytes & 127);
+  _bytes += len;
+
+  if (have) {
+    while ((have < 128)&&(len)) {
+      _buf[have++] = *(in++);
+      --len;
+    }
+    if (have < 128)
+      return;
+    blocks(_h,_buf,128);
+  }
+
+  const unsigned int whole = len & ~((unsigned int)127);
+  blocks(_h,in,whole);
+  for (unsigned int i = whole;i < len;++i) _buf[i - whole] = in[i];
+}
+
+void SHA512::Stream::digest(void *digest) const
+{
+  unsigned char h[64];
+  unsigned char padded[256];
+  unsigned int i;
+
+  for (i = 0;i < 64;++i) h[i] = _h[i];
+  blocks(h,padded,sha512_pad(padded,_buf,(unsigned int)(_bytes & 127),_bytes) * 128);
+
   for (i = 0;i < 64;++i) ((unsigned char *)digest)[i] = h[i];
 }
 
+void SHA512::hashMulti(void *const *digests,const void *const *data,const unsigned int *lens,unsigned int n)
+{
+#ifdef ZT_SHA512_AVX2
+  if (sha512_has_avx2) {
+    while (n >= 2) {
+      // Short groups repeat their first message in the unused lanes
+      void *d4[4];
+      const void *m4[4];
+      unsigned char scratch[3][64];
+      unsigned int l4[4];
+      const unsigned int k = (n < 4) ? n : 4;
+      for (unsigned int j=0;j<4;++j) {
+        if (j < k) {
+          d4[j] = digests[j];
+          m4[j] = data[j];
+          l4[j] = lens[j];
+        } else {
+          d4[j] = scratch[j - 1];
+          m4[j] = data[0];
+          l4[j] = lens[0];
+        }
+      }
+      sha512_avx2_hash4(d4,m4,l4);
+      digests += k;
+      data += k;
+      lens += k;
+      n -= k;
+    }
+  }
+#endif
+  for (unsigned int j=0;j<n;++j)
+    hash(digests[j],data[j],lens[j]);
+}
+
 } // namespace ZeroTier
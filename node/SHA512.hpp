@@ -27,6 +27,8 @@
 #ifndef ZT_SHA512_HPP
 #define ZT_SHA512_HPP
 
+#include <stdint.h>
+
 #define ZT_SHA512_DIGEST_LEN 64
 
 namespace ZeroTier {
@@ -38,6 +40,60 @@ class SHA512
 {
 public:
 	static void hash(void *digest,const void *data,unsigned int len);
+
+	/**
+	 * Hash several independent messages
+	 *
+	 * Messages are hashed four at a time with AVX2 where the CPU has it. The
+	 * results are the same as calling hash() on each.
+	 *
+	 * @param digests Output buffers of ZT_SHA512_DIGEST_LEN bytes each
+	 * @param data Messages
+	 * @param lens Message lengths
+	 * @param n Number of messages
+	 */
+	static void hashMulti(void *const *digests,const void *const *data,const unsigned int *lens,unsigned int n);
+
+	/**
+	 * Incremental SHA-512 for data that arrives in pieces
+	 *
+	 * The digest is the same as hash() over all the pieces concatenated.
+	 */
+	class Stream
+	{
+	public:
+		Stream() { reset(); }
+
+		/**
+		 * Start over with no data
+		 */
+		void reset();
+
+		/**
+		 * @param data More data
+		 * @param len Length of data
+		 */
+		void update(const void *data,unsigned int len);
+
+		/**
+		 * Get the digest of all data so far
+		 *
+		 * This does not change the state, so more data can still be added.
+		 *
+		 * @param digest Buffer of ZT_SHA512_DIGEST_LEN bytes
+		 */
+		void digest(void *digest) const;
+
+		/**
+		 * @return Total bytes hashed so far
+		 */
+		inline uint64_t bytes() const { return _bytes; }
+
+	private:
+		unsigned char _h[64];
+		unsigned char _buf[128];
+		uint64_t _bytes;
+	};
 };
 
 } // namespace ZeroTier
@@ -10,6 +10,27 @@
 #include "Constants.hpp"
 #include "Salsa20.hpp"
 
+// Multi-block AVX2 and AVX-512 kernels are built with per-function target
+// attributes so the rest of the code still runs on any x86 CPU
+#if (!defined(ZT_SALSA20_NO_AVX)) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ZT_SALSA20_AVX 1
+#include <immintrin.h>
+#endif
+
+// NEON is part of the base ARMv8-A profile but Linux can still report it
+// missing (e.g. some emulators), so check HWCAP there before using it
+#if (!defined(ZT_SALSA20_NO_NEON)) && (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__) && (!defined(__AARCH64EB__))
+#define ZT_SALSA20_NEON 1
+#include <arm_neon.h>
+#ifdef __LINUX__
+#include <sys/auxv.h>
+#endif
+#endif
+
+#if defined(ZT_SALSA20_AVX) || defined(ZT_SALSA20_NEON)
+#define ZT_SALSA20_MULTIBLOCK 1
+#endif
+
 #define ROTATE(v,c) (((v) << (c)) | ((v) >> (32 - (c))))
 #define XOR(v,w) ((v) ^ (w))
 #define PLUS(v,w) ((uint32_t)((v) + (w)))
@@ -66,6 +87,254 @@ static const _s20sseconsts _S20SSECONSTANTS;
 
 namespace ZeroTier {
 
+#ifdef ZT_SALSA20_MULTIBLOCK
+
+// Salsa20 quarter-round on vectors of 32-bit words, one block per lane
+#define ZT_S20_QR(ADD,XOR,ROTL,a,b,c,d) \
+	b = XOR(b,ROTL(ADD(a,d),7)); \
+	c = XOR(c,ROTL(ADD(b,a),9)); \
+	d = XOR(d,ROTL(ADD(c,b),13)); \
+	a = XOR(a,ROTL(ADD(d,c),18))
+#define ZT_S20_DOUBLEROUND(ADD,XOR,ROTL,x) \
+	ZT_S20_QR(ADD,XOR,ROTL,x[0],x[4],x[8],x[12]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[5],x[9],x[13],x[1]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[10],x[14],x[2],x[6]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[15],x[3],x[7],x[11]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[0],x[1],x[2],x[3]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[5],x[6],x[7],x[4]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[10],x[11],x[8],x[9]); \
+	ZT_S20_QR(ADD,XOR,ROTL,x[15],x[12],x[13],x[14])
+
+#endif // ZT_SALSA20_MULTIBLOCK
+
+#ifdef ZT_SALSA20_AVX
+
+#define ZT_S20_AVX2_ROTL(v,n) _mm256_or_si256(_mm256_slli_epi32((v),(n)),_mm256_srli_epi32((v),32 - (n)))
+#define ZT_S20_AVX512_ROTL(v,n) _mm512_or_si512(_mm512_slli_epi32((v),(n)),_mm512_srli_epi32((v),32 - (n)))
+
+// Transpose 16 vectors of (word, 8 blocks) into 8 keystream blocks, XOR them with m, and store to c
+__attribute__((target("avx2")))
+static inline void _s20x8Output(const __m256i *const w,const uint8_t *const m,uint8_t *const c)
+{
+	for(unsigned int half=0;half<2;++half) {
+		const __m256i *const a = w + (half * 8);
+		const __m256i t0 = _mm256_unpacklo_epi32(a[0],a[1]);
+		const __m256i t1 = _mm256_unpackhi_epi32(a[0],a[1]);
+		const __m256i t2 = _mm256_unpacklo_epi32(a[2],a[3]);
+		const __m256i t3 = _mm256_unpackhi_epi32(a[2],a[3]);
+		const __m256i t4 = _mm256_unpacklo_epi32(a[4],a[5]);
+		const __m256i t5 = _mm256_unpackhi_epi32(a[4],a[5]);
+		const __m256i t6 = _mm256_unpacklo_epi32(a[6],a[7]);
+		const __m256i t7 = _mm256_unpackhi_epi32(a[6],a[7]);
+		const __m256i u0 = _mm256_unpacklo_epi64(t0,t2); // blocks 0 and 4, words 0-3
+		const __m256i u1 = _mm256_unpackhi_epi64(t0,t2); // blocks 1 and 5
+		const __m256i u2 = _mm256_unpacklo_epi64(t1,t3); // blocks 2 and 6
+		const __m256i u3 = _mm256_unpackhi_epi64(t1,t3); // blocks 3 and 7
+		const __m256i u4 = _mm256_unpacklo_epi64(t4,t6); // same, words 4-7
+		const __m256i u5 = _mm256_unpackhi_epi64(t4,t6);
+		const __m256i u6 = _mm256_unpacklo_epi64(t5,t7);
+		const __m256i u7 = _mm256_unpackhi_epi64(t5,t7);
+		__m256i k[8];
+		k[0] = _mm256_permute2x128_si256(u0,u4,0x20);
+		k[1] = _mm256_permute2x128_si256(u1,u5,0x20);
+		k[2] = _mm256_permute2x128_si256(u2,u6,0x20);
+		k[3] = _mm256_permute2x128_si256(u3,u7,0x20);
+		k[4] = _mm256_permute2x128_si256(u0,u4,0x31);
+		k[5] = _mm256_permute2x128_si256(u1,u5,0x31);
+		k[6] = _mm256_permute2x128_si256(u2,u6,0x31);
+		k[7] = _mm256_permute2x128_si256(u3,u7,0x31);
+		for(unsigned int b=0;b<8;++b) {
+			const unsigned int o = (b * 64) + (half * 32);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(c + o),_mm256_xor_si256(k[b],_mm256_loadu_si256(reinterpret_cast<const __m256i *>(m + o))));
+		}
+	}
+}
+
+// Salsa20/12 over a multiple of 8 blocks, st[] in standard word order with counter in st[8] and st[9]
+__attribute__((target("avx2")))
+static void _s20Crypt12Avx2(const uint32_t *const st,uint64_t ctr,const uint8_t *m,uint8_t *c,unsigned int blocks)
+{
+	while (blocks >= 8) {
+		__m256i x[16],o[16];
+		for(unsigned int k=0;k<16;++k)
+			o[k] = _mm256_set1_epi32((int)st[k]);
+		uint32_t cl[8],ch[8];
+		for(unsigned int b=0;b<8;++b) {
+			cl[b] = (uint32_t)(ctr + b);
+			ch[b] = (uint32_t)((ctr + b) >> 32);
+		}
+		o[8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cl));
+		o[9] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ch));
+		for(unsigned int k=0;k<16;++k)
+			x[k] = o[k];
+
+		for(unsigned int r=0;r<6;++r) {
+			ZT_S20_DOUBLEROUND(_mm256_add_epi32,_mm256_xor_si256,ZT_S20_AVX2_ROTL,x);
+		}
+
+		for(unsigned int k=0;k<16;++k)
+			x[k] = _mm256_add_epi32(x[k],o[k]);
+		_s20x8Output(x,m,c);
+
+		ctr += 8;
+		m += 512;
+		c += 512;
+		blocks -= 8;
+	}
+}
+
+// Salsa20/12 over a multiple of 16 blocks, as above
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized" // GCC 12's unmasked AVX-512 shifts pass _mm512_undefined_epi32() as their unused source
+__attribute__((target("avx512f")))
+static void _s20Crypt12Avx512(const uint32_t *const st,uint64_t ctr,const uint8_t *m,uint8_t *c,unsigned int blocks)
+{
+	while (blocks >= 16) {
+		__m512i x[16],o[16];
+		for(unsigned int k=0;k<16;++k)
+			o[k] = _mm512_set1_epi32((int)st[k]);
+		uint32_t cl[16],ch[16];
+		for(unsigned int b=0;b<16;++b) {
+			cl[b] = (uint32_t)(ctr + b);
+			ch[b] = (uint32_t)((ctr + b) >> 32);
+		}
+		o[8] = _mm512_loadu_si512(cl);
+		o[9] = _mm512_loadu_si512(ch);
+		for(unsigned int k=0;k<16;++k)
+			x[k] = o[k];
+
+		for(unsigned int r=0;r<6;++r) {
+			ZT_S20_DOUBLEROUND(_mm512_add_epi32,_mm512_xor_si512,ZT_S20_AVX512_ROTL,x);
+		}
+
+		// Blocks 0-7 are in the low 256 bits of each word vector and 8-15 in the high
+		__m256i lo[16],hi[16];
+		for(unsigned int k=0;k<16;++k) {
+			x[k] = _mm512_add_epi32(x[k],o[k]);
+			lo[k] = _mm512_extracti64x4_epi64(x[k],0);
+			hi[k] = _mm512_extracti64x4_epi64(x[k],1);
+		}
+		_s20x8Output(lo,m,c);
+		_s20x8Output(hi,m + 512,c + 512);
+
+		ctr += 16;
+		m += 1024;
+		c += 1024;
+		blocks -= 16;
+	}
+}
+#pragma GCC diagnostic pop
+
+static Salsa20::Crypt12Implementation _s20DetectCrypt12Implementation()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return Salsa20::CRYPT12_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return Salsa20::CRYPT12_AVX2;
+	return Salsa20::CRYPT12_DEFAULT;
+}
+static const Salsa20::Crypt12Implementation _s20BestCrypt12Implementation = _s20DetectCrypt12Implementation();
+static Salsa20::Crypt12Implementation _s20Crypt12Implementation = _s20BestCrypt12Implementation;
+
+#endif // ZT_SALSA20_AVX
+
+#ifdef ZT_SALSA20_NEON
+
+#define ZT_S20_NEON_ROTL(v,n) vsriq_n_u32(vshlq_n_u32((v),(n)),(v),32 - (n))
+
+// Salsa20/12 over a multiple of 4 blocks, st[] in standard word order with counter in st[8] and st[9]
+static void _s20Crypt12Neon(const uint32_t *const st,uint64_t ctr,const uint8_t *m,uint8_t *c,unsigned int blocks)
+{
+	while (blocks >= 4) {
+		uint32x4_t x[16],o[16];
+		for(unsigned int k=0;k<16;++k)
+			o[k] = vdupq_n_u32(st[k]);
+		uint32_t cl[4],ch[4];
+		for(unsigned int b=0;b<4;++b) {
+			cl[b] = (uint32_t)(ctr + b);
+			ch[b] = (uint32_t)((ctr + b) >> 32);
+		}
+		o[8] = vld1q_u32(cl);
+		o[9] = vld1q_u32(ch);
+		for(unsigned int k=0;k<16;++k)
+			x[k] = o[k];
+
+		for(unsigned int r=0;r<6;++r) {
+			ZT_S20_DOUBLEROUND(vaddq_u32,veorq_u32,ZT_S20_NEON_ROTL,x);
+		}
+
+		// Transpose each group of four word vectors into 16 bytes of each of the 4 blocks
+		for(unsigned int q=0;q<4;++q) {
+			const uint32x4_t *const a = x + (q * 4);
+			const uint32x4_t *const ao = o + (q * 4);
+			const uint32x4_t a0 = vaddq_u32(a[0],ao[0]);
+			const uint32x4_t a1 = vaddq_u32(a[1],ao[1]);
+			const uint32x4_t a2 = vaddq_u32(a[2],ao[2]);
+			const uint32x4_t a3 = vaddq_u32(a[3],ao[3]);
+			const uint64x2_t t0 = vreinterpretq_u64_u32(vtrn1q_u32(a0,a1));
+			const uint64x2_t t1 = vreinterpretq_u64_u32(vtrn2q_u32(a0,a1));
+			const uint64x2_t t2 = vreinterpretq_u64_u32(vtrn1q_u32(a2,a3));
+			const uint64x2_t t3 = vreinterpretq_u64_u32(vtrn2q_u32(a2,a3));
+			uint8x16_t k[4];
+			k[0] = vreinterpretq_u8_u64(vtrn1q_u64(t0,t2));
+			k[1] = vreinterpretq_u8_u64(vtrn1q_u64(t1,t3));
+			k[2] = vreinterpretq_u8_u64(vtrn2q_u64(t0,t2));
+			k[3] = vreinterpretq_u8_u64(vtrn2q_u64(t1,t3));
+			for(unsigned int b=0;b<4;++b) {
+				const unsigned int off = (b * 64) + (q * 16);
+				vst1q_u8(c + off,veorq_u8(k[b],vld1q_u8(m + off)));
+			}
+		}
+
+		ctr += 4;
+		m += 256;
+		c += 256;
+		blocks -= 4;
+	}
+}
+
+static Salsa20::Crypt12Implementation _s20DetectCrypt12Implementation()
+{
+#if defined(__LINUX__) && defined(HWCAP_ASIMD)
+	if ((getauxval(AT_HWCAP) & HWCAP_ASIMD) == 0)
+		return Salsa20::CRYPT12_DEFAULT;
+#endif
+	return Salsa20::CRYPT12_NEON;
+}
+static const Salsa20::Crypt12Implementation _s20BestCrypt12Implementation = _s20DetectCrypt12Implementation();
+static Salsa20::Crypt12Implementation _s20Crypt12Implementation = _s20BestCrypt12Implementation;
+
+#endif // ZT_SALSA20_NEON
+
+bool Salsa20::crypt12ImplementationSupported(const Crypt12Implementation impl)
+{
+#if defined(ZT_SALSA20_AVX)
+	return ((impl <= CRYPT12_AVX512)&&(impl <= _s20BestCrypt12Implementation));
+#elif defined(ZT_SALSA20_NEON)
+	return ((impl == CRYPT12_DEFAULT)||(impl == _s20BestCrypt12Implementation));
+#else
+	return (impl == CRYPT12_DEFAULT);
+#endif
+}
+
+Salsa20::Crypt12Implementation Salsa20::crypt12Implementation()
+{
+#ifdef ZT_SALSA20_MULTIBLOCK
+	return _s20Crypt12Implementation;
+#else
+	return CRYPT12_DEFAULT;
+#endif
+}
+
+void Salsa20::setCrypt12Implementation(const Crypt12Implementation impl)
+{
+#ifdef ZT_SALSA20_MULTIBLOCK
+	if (crypt12ImplementationSupported(impl))
+		_s20Crypt12Implementation = impl;
+#endif
+}
+
 void Salsa20::init(const void *key,const void *iv)
 {
 #ifdef ZT_SALSA20_SSE
@@ -108,6 +377,38 @@ void Salsa20::init(const void *key,const void *iv)
 #endif
 }
 
+void Salsa20::initTweaked(const Salsa20 &keyed,const uint8_t *tweak,const void *iv)
+{
+	uint32_t t[6];
+	for(unsigned int i=0;i<5;++i)
+		t[i] = (uint32_t)tweak[i * 4] | ((uint32_t)tweak[(i * 4) + 1] << 8) | ((uint32_t)tweak[(i * 4) + 2] << 16) | ((uint32_t)tweak[(i * 4) + 3] << 24);
+	t[5] = (uint32_t)tweak[20];
+	_state = keyed._state;
+#ifdef ZT_SALSA20_SSE
+	_state.i[13] ^= t[0];
+	_state.i[10] ^= t[1];
+	_state.i[7] ^= t[2];
+	_state.i[4] ^= t[3];
+	_state.i[15] ^= t[4];
+	_state.i[12] ^= t[5];
+	_state.i[5] = 0;
+	_state.i[8] = 0;
+	_state.i[11] = ((const uint32_t *)iv)[1];
+	_state.i[14] = ((const uint32_t *)iv)[0];
+#else
+	_state.i[1] ^= t[0];
+	_state.i[2] ^= t[1];
+	_state.i[3] ^= t[2];
+	_state.i[4] ^= t[3];
+	_state.i[11] ^= t[4];
+	_state.i[12] ^= t[5];
+	_state.i[6] = U8TO32_LITTLE(((const uint8_t *)iv) + 0);
+	_state.i[7] = U8TO32_LITTLE(((const uint8_t *)iv) + 4);
+	_state.i[8] = 0;
+	_state.i[9] = 0;
+#endif
+}
+
 void Salsa20::crypt12(const void *in,void *out,unsigned int bytes)
 {
 	uint8_t tmp[64];
@@ -116,6 +417,71 @@ void Salsa20::crypt12(const void *in,void *out,unsigned int bytes)
 	uint8_t *ctarget = c;
 	unsigned int i;
 
+#ifdef ZT_SALSA20_MULTIBLOCK
+	const Crypt12Implementation impl = _s20Crypt12Implementation;
+	if ((impl != CRYPT12_DEFAULT)&&(bytes >= 256)) {
+		// Kernels take the state in standard word order
+		uint32_t st[16];
+#ifdef ZT_SALSA20_SSE
+		static const unsigned char sseOrder[16] = { 0,13,10,7,4,1,14,11,8,5,2,15,12,9,6,3 };
+		for(i=0;i<16;++i)
+			st[i] = _state.i[sseOrder[i]];
+#else
+		for(i=0;i<16;++i)
+			st[i] = _state.i[i];
+#endif
+		uint64_t ctr = (uint64_t)st[8] | ((uint64_t)st[9] << 32);
+
+#ifdef ZT_SALSA20_AVX
+		if ((impl == CRYPT12_AVX512)&&(bytes >= 1024)) {
+			const unsigned int n = bytes & ~1023U;
+			_s20Crypt12Avx512(st,ctr,m,c,n / 64);
+			ctr += n / 64;
+			m += n;
+			c += n;
+			bytes -= n;
+		}
+		if (bytes >= 512) {
+			const unsigned int n = bytes & ~511U;
+			_s20Crypt12Avx2(st,ctr,m,c,n / 64);
+			ctr += n / 64;
+			m += n;
+			c += n;
+			bytes -= n;
+		}
+		if (bytes >= 256) {
+			// Cheaper to run one more 8-block pass over a copy than 4-7 single blocks
+			uint8_t last[512];
+			memcpy(last,m,bytes);
+			_s20Crypt12Avx2(st,ctr,last,last,8);
+			memcpy(c,last,bytes);
+			ctr += (bytes + 63) / 64;
+			bytes = 0;
+		}
+#endif // ZT_SALSA20_AVX
+#ifdef ZT_SALSA20_NEON
+		{
+			// Any remainder under 4 blocks is left to the single block code below
+			const unsigned int n = bytes & ~255U;
+			_s20Crypt12Neon(st,ctr,m,c,n / 64);
+			ctr += n / 64;
+			m += n;
+			c += n;
+			bytes -= n;
+		}
+#endif // ZT_SALSA20_NEON
+
+#ifdef ZT_SALSA20_SSE
+		_state.i[8] = (uint32_t)ctr;
+		_state.i[5] = (uint32_t)(ctr >> 32);
+#else
+		_state.i[8] = (uint32_t)ctr;
+		_state.i[9] = (uint32_t)(ctr >> 32);
+#endif
+		ctarget = c;
+	}
+#endif // ZT_SALSA20_MULTIBLOCK
+
 #ifndef ZT_SALSA20_SSE
 	uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
 	uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -27,10 +27,46 @@ namespace ZeroTier {
 
 /**
  * Salsa20 stream cipher
+ *
+ * On x86 CPUs with AVX2 or AVX-512 crypt12() computes 8 or 16 blocks at a
+ * time, and on ARM64 it computes 4 at a time with NEON. The implementation
+ * is picked at startup by checking the CPU.
  */
 class Salsa20
 {
 public:
+	/**
+	 * Implementations of crypt12() that can be selected at runtime
+	 */
+	enum Crypt12Implementation
+	{
+		CRYPT12_DEFAULT = 0, // one block at a time (SSE2 or portable C)
+		CRYPT12_AVX2 = 1,    // 8 blocks at a time
+		CRYPT12_AVX512 = 2,  // 16 blocks at a time
+		CRYPT12_NEON = 3     // 4 blocks at a time (ARM64)
+	};
+
+	/**
+	 * @param impl Implementation
+	 * @return True if this build and CPU can use this implementation
+	 */
+	static bool crypt12ImplementationSupported(const Crypt12Implementation impl);
+
+	/**
+	 * @return Implementation currently used by crypt12()
+	 */
+	static Crypt12Implementation crypt12Implementation();
+
+	/**
+	 * Override the implementation used by crypt12()
+	 *
+	 * This is for testing and benchmarking and is not thread safe. Unsupported
+	 * implementations are ignored.
+	 *
+	 * @param impl Implementation
+	 */
+	static void setCrypt12Implementation(const Crypt12Implementation impl);
+
 	Salsa20() {}
 	~Salsa20() { Utils::burn(&_state,sizeof(_state)); }
 
@@ -127,6 +163,20 @@ public:
 	 */
 	void init(const void *key,const void *iv);
 
+	/**
+	 * Initialize cipher with another instance's key XORed with a tweak
+	 *
+	 * This gives the same result as init() with the first 21 bytes of the
+	 * original key XORed with tweak, without unpacking a key again. It lets
+	 * a long-lived key be expanded once and then varied per message, which
+	 * is how Packet mangles keys.
+	 *
+	 * @param keyed Instance initialized with the base key (its IV and position are ignored)
+	 * @param tweak 21 bytes to XOR with the start of the key
+	 * @param iv 64-bit initialization vector
+	 */
+	void initTweaked(const Salsa20 &keyed,const uint8_t *tweak,const void *iv);
+
 	/**
 	 * Encrypt/decrypt data using Salsa20/12
 	 *
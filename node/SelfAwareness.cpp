@@ -40,33 +40,48 @@
 #include "Peer.hpp"
 #include "Switch.hpp"
 #include "Trace.hpp"
+#include "Utils.hpp"
+#include "Metrics.hpp"
 
 // Entry timeout -- make it fairly long since this is just to prevent stale buildup
 #define ZT_SELFAWARENESS_ENTRY_TIMEOUT 600000
 
 namespace ZeroTier {
 
+// Time to wait after a change is detected for other upstreams' reports before resetting paths
+#define ZT_SELFAWARENESS_RESET_DELAY 1000
+
+// Minimum time between path resets for the same scope, family, and local socket
+#define ZT_SELFAWARENESS_RESET_MIN_INTERVAL 10000
+
 class _ResetWithinScope
 {
 public:
-	_ResetWithinScope(void *tPtr,uint64_t now,int inetAddressFamily,InetAddress::IpScope scope) :
+	_ResetWithinScope(void *tPtr,uint64_t now,const std::vector<SelfAwareness::PathReset> &resets) :
+		count(0),
 		_now(now),
 		_tPtr(tPtr),
-		_family(inetAddressFamily),
-		_scope(scope) {}
+		_resets(resets) {}
+
+	inline void operator()(Topology &t,const SharedPtr<Peer> &p)
+	{
+		for(std::vector<SelfAwareness::PathReset>::const_iterator r(_resets.begin());r!=_resets.end();++r)
+			count += p->resetWithinScope(_tPtr,r->scope,r->family,r->localSocket,r->since,_now);
+	}
 
-	inline void operator()(Topology &t,const SharedPtr<Peer> &p) { p->resetWithinScope(_tPtr,_scope,_family,_now); }
+	uint64_t count;
 
 private:
 	uint64_t _now;
 	void *_tPtr;
-	int _family;
-	InetAddress::IpScope _scope;
+	const std::vector<SelfAwareness::PathReset> &_resets;
 };
 
 SelfAwareness::SelfAwareness(const RuntimeEnvironment *renv) :
 	RR(renv),
-	_phy(128)
+	_phy(128),
+	_lastClean(0),
+	_cleanPosition(0)
 {
 }
 
@@ -101,9 +116,24 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 			}
 		}
 
-		// Reset all paths within this scope and address family
-		_ResetWithinScope rset(tPtr,now,myPhysicalAddress.ss_family,(InetAddress::IpScope)scope);
-		RR->topology->eachPeer<_ResetWithinScope &>(rset);
+		// Paths in this scope and family on this local socket are reset by clean()
+		RR->metrics->inc(Metrics::SURFACE_CHANGES);
+		const int family = (int)myPhysicalAddress.ss_family;
+		for(std::vector<PathReset>::iterator r(_resets.begin());r!=_resets.end();++r) {
+			if ((r->localSocket == receivedOnLocalSocket)&&(r->family == family)&&(r->scope == scope)) {
+				if (r->since)
+					RR->metrics->inc(Metrics::SURFACE_CHANGES_COALESCED);
+				else r->since = now;
+				return;
+			}
+		}
+		PathReset r;
+		r.localSocket = receivedOnLocalSocket;
+		r.since = now;
+		r.lastReset = 0;
+		r.family = family;
+		r.scope = scope;
+		_resets.push_back(r);
 	} else {
 		// Otherwise just update DB to use to determine external surface info
 		entry.mySurface = myPhysicalAddress;
@@ -112,13 +142,49 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 	}
 }
 
-void SelfAwareness::clean(uint64_t now)
+void SelfAwareness::clean(void *tPtr,uint64_t now)
 {
+	const uint64_t elapsed = now - _lastClean;
+	_lastClean = now;
+
+	std::vector<PathReset> due;
+	{
+		Mutex::Lock _l(_phy_m);
+		std::vector<PathReset>::iterator w(_resets.begin());
+		for(std::vector<PathReset>::iterator r(_resets.begin());r!=_resets.end();++r) {
+			if ((r->since)&&((now - r->since) >= ZT_SELFAWARENESS_RESET_DELAY)&&((now - r->lastReset) >= ZT_SELFAWARENESS_RESET_MIN_INTERVAL)) {
+				due.push_back(*r);
+				r->since = 0;
+				r->lastReset = now;
+			}
+			if ((r->since)||((now - r->lastReset) < ZT_SELFAWARENESS_RESET_MIN_INTERVAL))
+				*(w++) = *r;
+		}
+		_resets.erase(w,_resets.end());
+	}
+	if (!due.empty()) {
+		// One pass over all peers for every reset that came due, without holding _phy_m
+		_ResetWithinScope rset(tPtr,now,due);
+		RR->topology->eachPeer<_ResetWithinScope &>(rset);
+		RR->metrics->inc(Metrics::PATH_RESET_PASSES);
+		RR->metrics->add(Metrics::PATHS_RESET,rset.count);
+	}
+
 	Mutex::Lock _l(_phy_m);
-	Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy);
+	unsigned long budget = Utils::housekeepingSlice(_phy.size(),elapsed);
+	Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy,_cleanPosition);
 	PhySurfaceKey *k = (PhySurfaceKey *)0;
 	PhySurfaceEntry *e = (PhySurfaceEntry *)0;
-	while (i.next(k,e)) {
+	for(;;) {
+		if (!budget) {
+			_cleanPosition = i.position();
+			break;
+		}
+		if (!i.next(k,e)) {
+			_cleanPosition = 0;
+			break;
+		}
+		--budget;
 		if ((now - e->ts) >= ZT_SELFAWARENESS_ENTRY_TIMEOUT)
 			_phy.erase(*k);
 	}
@@ -27,8 +27,11 @@
 #ifndef ZT_SELFAWARENESS_HPP
 #define ZT_SELFAWARENESS_HPP
 
+#include <vector>
+
 #include "Constants.hpp"
 #include "InetAddress.hpp"
+#include "CompactInetAddress.hpp"
 #include "Hashtable.hpp"
 #include "Address.hpp"
 #include "Mutex.hpp"
@@ -58,11 +61,15 @@ public:
 	void iam(void *tPtr,const Address &reporter,const int64_t receivedOnLocalSocket,const InetAddress &reporterPhysicalAddress,const InetAddress &myPhysicalAddress,bool trusted,uint64_t now);
 
 	/**
-	 * Clean up database periodically
+	 * Clean up the next slice of the database and perform due path resets
+	 *
+	 * This should be called on every background task run and is not safe to
+	 * call concurrently with itself.
 	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param now Current time
 	 */
-	void clean(uint64_t now);
+	void clean(void *tPtr,uint64_t now);
 
 	/**
 	 * If we appear to be behind a symmetric NAT, get predictions for possible external endpoints
@@ -72,11 +79,13 @@ public:
 	std::vector<InetAddress> getSymmetricNatPredictions();
 
 private:
+	friend class _ResetWithinScope;
+
 	struct PhySurfaceKey
 	{
 		Address reporter;
 		int64_t receivedOnLocalSocket;
-		InetAddress reporterPhysicalAddress;
+		CompactInetAddress reporterPhysicalAddress;
 		InetAddress::IpScope scope;
 
 		PhySurfaceKey() : reporter(),scope(InetAddress::IP_SCOPE_NONE) {}
@@ -95,10 +104,27 @@ private:
 		PhySurfaceEntry(const InetAddress &a,const uint64_t t) : mySurface(a),ts(t),trusted(false) {}
 	};
 
+	// A reset of paths in one scope and family on one local socket. Reports
+	// of a change are collected here and acted on by clean() after a short
+	// delay, so a burst of reports from several upstreams costs one pass.
+	struct PathReset
+	{
+		int64_t localSocket;
+		uint64_t since; // when a pending change was first detected, or 0 if none
+		uint64_t lastReset;
+		int family;
+		InetAddress::IpScope scope;
+	};
+
 	const RuntimeEnvironment *RR;
 
 	Hashtable< PhySurfaceKey,PhySurfaceEntry > _phy;
+	std::vector<PathReset> _resets; // small: one per scope, family, and local socket that has changed
 	Mutex _phy_m;
+
+	// Position of incremental clean() passes
+	uint64_t _lastClean;
+	unsigned long _cleanPosition;
 };
 
 } // namespace ZeroTier
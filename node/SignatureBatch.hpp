@@ -0,0 +1,116 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_SIGNATUREBATCH_HPP
+#define ZT_SIGNATUREBATCH_HPP
+
+#include <string>
+
+#include "Constants.hpp"
+#include "C25519.hpp"
+#include "Identity.hpp"
+#include "SignatureCache.hpp"
+
+namespace ZeroTier {
+
+/**
+ * A set of signatures to check together with C25519::verifyBatch()
+ *
+ * Credentials add their signatures with their addToBatch() methods, and the
+ * batch is verified before the credentials are handed to Membership. Valid
+ * signatures go into the SignatureCache, where the verify() calls made
+ * there then find them. Signatures already cached are not added.
+ */
+class SignatureBatch
+{
+public:
+	SignatureBatch(SignatureCache &cache) :
+		_cache(cache),
+		_count(0) {}
+
+	/**
+	 * @param signer Identity that made the signature
+	 * @param data Signed data (copied)
+	 * @param len Length of data in bytes
+	 * @param signature Signature
+	 * @return False if the batch is full
+	 */
+	inline bool add(const Identity &signer,const void *data,unsigned int len,const C25519::Signature &signature)
+	{
+		if (_count >= ZT_C25519_VERIFY_BATCH_MAX)
+			return false;
+		if (_cache.contains(signer.publicKey(),data,len,signature.data))
+			return true;
+		_keys[_count] = signer.publicKey();
+		_signatures[_count] = signature;
+		_offsets[_count] = (unsigned int)_data.length();
+		_lengths[_count] = len;
+		_data.append(reinterpret_cast<const char *>(data),len);
+		++_count;
+		return true;
+	}
+
+	/**
+	 * Verify all signatures in this batch and cache the valid ones
+	 *
+	 * @return True if all are valid
+	 */
+	inline bool verify()
+	{
+		C25519::VerifyBatchEntry e[ZT_C25519_VERIFY_BATCH_MAX];
+		bool valid[ZT_C25519_VERIFY_BATCH_MAX];
+		for(unsigned int i=0;i<_count;++i) {
+			e[i].their = &(_keys[i]);
+			e[i].msg = _data.data() + _offsets[i];
+			e[i].len = _lengths[i];
+			e[i].signature = _signatures[i].data;
+		}
+		const bool allValid = C25519::verifyBatch(e,_count,valid);
+		for(unsigned int i=0;i<_count;++i) {
+			if (valid[i])
+				_cache.add(_keys[i],e[i].msg,e[i].len,e[i].signature);
+		}
+		return allValid;
+	}
+
+	/**
+	 * @return Number of signatures in batch
+	 */
+	inline unsigned int size() const { return _count; }
+
+private:
+	SignatureCache &_cache;
+	C25519::Public _keys[ZT_C25519_VERIFY_BATCH_MAX];
+	C25519::Signature _signatures[ZT_C25519_VERIFY_BATCH_MAX];
+	unsigned int _offsets[ZT_C25519_VERIFY_BATCH_MAX];
+	unsigned int _lengths[ZT_C25519_VERIFY_BATCH_MAX];
+	std::string _data;
+	unsigned int _count;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <string.h>
+
+#include "SignatureCache.hpp"
+#include "SHA512.hpp"
+
+namespace ZeroTier {
+
+SignatureCache::SignatureCache() :
+	_clock(0)
+{
+	memset(_entries,0,sizeof(_entries));
+}
+
+bool SignatureCache::verify(const Identity &id,const void *data,unsigned int len,const C25519::Signature &signature)
+{
+	uint64_t fp[6];
+	_fingerprint(fp,id.publicKey(),data,len,signature.data);
+	{
+		Mutex::Lock _l(_lock);
+		if (_find(fp))
+			return true;
+	}
+	if (!id.verify(data,len,signature))
+		return false;
+	Mutex::Lock _l(_lock);
+	_insert(fp);
+	return true;
+}
+
+bool SignatureCache::contains(const C25519::Public &key,const void *data,unsigned int len,const void *signature)
+{
+	uint64_t fp[6];
+	_fingerprint(fp,key,data,len,signature);
+	Mutex::Lock _l(_lock);
+	return _find(fp);
+}
+
+void SignatureCache::add(const C25519::Public &key,const void *data,unsigned int len,const void *signature)
+{
+	uint64_t fp[6];
+	_fingerprint(fp,key,data,len,signature);
+	Mutex::Lock _l(_lock);
+	if (!_find(fp))
+		_insert(fp);
+}
+
+void SignatureCache::_fingerprint(uint64_t fp[6],const C25519::Public &key,const void *data,unsigned int len,const void *signature)
+{
+	unsigned char tmp[ZT_C25519_PUBLIC_KEY_LEN + ZT_SHA512_DIGEST_LEN + ZT_C25519_SIGNATURE_LEN];
+	unsigned char h[ZT_SHA512_DIGEST_LEN];
+	memcpy(tmp,key.data,ZT_C25519_PUBLIC_KEY_LEN);
+	SHA512::hash(tmp + ZT_C25519_PUBLIC_KEY_LEN,data,len);
+	memcpy(tmp + ZT_C25519_PUBLIC_KEY_LEN + ZT_SHA512_DIGEST_LEN,signature,ZT_C25519_SIGNATURE_LEN);
+	SHA512::hash(h,tmp,sizeof(tmp));
+	memcpy(fp,h,sizeof(uint64_t) * 6);
+}
+
+bool SignatureCache::_find(const uint64_t fp[6])
+{
+	_Entry *const set = _entries[(unsigned int)fp[0] & (ZT_SIGNATURE_CACHE_SETS - 1)];
+	for(unsigned int w=0;w<ZT_SIGNATURE_CACHE_WAYS;++w) {
+		if ((set[w].lastUsed)&&(!memcmp(set[w].fp,fp,sizeof(set[w].fp)))) {
+			set[w].lastUsed = ++_clock;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SignatureCache::_insert(const uint64_t fp[6])
+{
+	_Entry *const set = _entries[(unsigned int)fp[0] & (ZT_SIGNATURE_CACHE_SETS - 1)];
+	unsigned int lru = 0;
+	for(unsigned int w=1;w<ZT_SIGNATURE_CACHE_WAYS;++w) {
+		if (set[w].lastUsed < set[lru].lastUsed)
+			lru = w;
+	}
+	memcpy(set[lru].fp,fp,sizeof(set[lru].fp));
+	set[lru].lastUsed = ++_clock;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,113 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_SIGNATURECACHE_HPP
+#define ZT_SIGNATURECACHE_HPP
+
+#include <stdint.h>
+
+#include "Constants.hpp"
+#include "C25519.hpp"
+#include "Identity.hpp"
+#include "Mutex.hpp"
+
+/**
+ * Number of sets in signature cache (must be a power of two)
+ */
+#define ZT_SIGNATURE_CACHE_SETS 256
+
+/**
+ * Entries per set in signature cache, evicted least recently used first
+ */
+#define ZT_SIGNATURE_CACHE_WAYS 4
+
+namespace ZeroTier {
+
+/**
+ * Bounded cache of signatures already found valid
+ *
+ * Peers re-push the same credentials on every config refresh, so most
+ * credential verifications repeat one already done. Entries are keyed by a
+ * hash of the signer's public key, SHA512 of the signed bytes, and the
+ * signature itself, so a hit costs two small hashes instead of a curve
+ * operation. Only valid signatures are cached.
+ */
+class SignatureCache
+{
+public:
+	SignatureCache();
+
+	/**
+	 * Verify a signature, using and updating the cache
+	 *
+	 * @param id Identity of signer
+	 * @param data Signed data
+	 * @param len Length of data in bytes
+	 * @param signature Signature
+	 * @return True if signature is valid
+	 */
+	bool verify(const Identity &id,const void *data,unsigned int len,const C25519::Signature &signature);
+
+	/**
+	 * @param key Public key of signer
+	 * @param data Signed data
+	 * @param len Length of data in bytes
+	 * @param signature Signature (ZT_C25519_SIGNATURE_LEN bytes)
+	 * @return True if this signature is cached as valid
+	 */
+	bool contains(const C25519::Public &key,const void *data,unsigned int len,const void *signature);
+
+	/**
+	 * Remember a signature that the caller has already verified
+	 *
+	 * @param key Public key of signer
+	 * @param data Signed data
+	 * @param len Length of data in bytes
+	 * @param signature Signature (ZT_C25519_SIGNATURE_LEN bytes)
+	 */
+	void add(const C25519::Public &key,const void *data,unsigned int len,const void *signature);
+
+private:
+	struct _Entry
+	{
+		uint64_t fp[6];
+		uint64_t lastUsed; // 0 if empty
+	};
+
+	static void _fingerprint(uint64_t fp[6],const C25519::Public &key,const void *data,unsigned int len,const void *signature);
+
+	// These must be called with _lock held
+	bool _find(const uint64_t fp[6]);
+	void _insert(const uint64_t fp[6]);
+
+	_Entry _entries[ZT_SIGNATURE_CACHE_SETS][ZT_SIGNATURE_CACHE_WAYS];
+	uint64_t _clock;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
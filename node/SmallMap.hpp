@@ -0,0 +1,207 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_SMALLMAP_HPP
+#define ZT_SMALLMAP_HPP
+
+#include <vector>
+
+namespace ZeroTier {
+
+/**
+ * A map kept as a vector sorted by key, with room for N entries inline
+ *
+ * This is for the many small maps held per object, such as a member's
+ * credentials, where a Hashtable's bucket array and per-entry allocations
+ * cost far more than the handful of entries in them. Up to N entries need
+ * no allocation at all. Beyond that all entries move to the heap, and they
+ * move back when the map shrinks to N again. Lookups are binary searches
+ * and inserts and erases shift later entries, so it's only suitable for
+ * small maps. N may be zero for large values that are usually absent.
+ *
+ * Entries are addressed by index, from 0 to size()-1 in key order. An
+ * insert or erase invalidates pointers and references to entries.
+ *
+ * @tparam K Key type, which must have operator< and operator==
+ * @tparam V Value type
+ * @tparam N Number of entries stored inline
+ */
+template<typename K,typename V,unsigned int N>
+class SmallMap
+{
+private:
+	struct _E
+	{
+		K k;
+		V v;
+	};
+	template<unsigned int L,typename D = void>
+	struct _Local
+	{
+		inline _E *data() { return e; }
+		inline const _E *data() const { return e; }
+		_E e[L];
+	};
+	template<typename D>
+	struct _Local<0,D>
+	{
+		inline _E *data() { return (_E *)0; }
+		inline const _E *data() const { return (const _E *)0; }
+	};
+
+public:
+	SmallMap() : _n(0) {}
+
+	/**
+	 * @return Number of entries
+	 */
+	inline unsigned int size() const { return _n; }
+
+	/**
+	 * @return True if map is empty
+	 */
+	inline bool empty() const { return (_n == 0); }
+
+	inline const K &keyAt(const unsigned int i) const { return _data()[i].k; }
+	inline V &valueAt(const unsigned int i) { return _data()[i].v; }
+	inline const V &valueAt(const unsigned int i) const { return _data()[i].v; }
+
+	/**
+	 * @param k Key
+	 * @return Pointer to value or NULL if not found
+	 */
+	inline V *get(const K &k)
+	{
+		const unsigned int i = _lowerBound(k);
+		return (((i < _n)&&(_data()[i].k == k)) ? &(_data()[i].v) : (V *)0);
+	}
+	inline const V *get(const K &k) const
+	{
+		const unsigned int i = _lowerBound(k);
+		return (((i < _n)&&(_data()[i].k == k)) ? &(_data()[i].v) : (const V *)0);
+	}
+
+	/**
+	 * @param k Key
+	 * @return Value, inserted default constructed if not already present
+	 */
+	inline V &operator[](const K &k)
+	{
+		const unsigned int i = _lowerBound(k);
+		if ((i < _n)&&(_data()[i].k == k))
+			return _data()[i].v;
+
+		if (_n < N) {
+			_E *const e = _local.data();
+			for(unsigned int j=_n;j>i;--j)
+				e[j] = e[j-1];
+			e[i].k = k;
+			e[i].v = V();
+		} else {
+			if (_n == N) {
+				_heap.reserve(N * 2 + 1);
+				_heap.assign(_local.data(),_local.data() + N);
+				for(unsigned int j=0;j<N;++j)
+					_local.data()[j].v = V(); // don't hold on to anything the values own
+			}
+			_E ne;
+			ne.k = k;
+			_heap.insert(_heap.begin() + i,ne);
+		}
+		++_n;
+		return _data()[i].v;
+	}
+
+	/**
+	 * @param k Key to erase if present
+	 */
+	inline void erase(const K &k)
+	{
+		const unsigned int i = _lowerBound(k);
+		if ((i < _n)&&(_data()[i].k == k))
+			eraseAt(i);
+	}
+
+	/**
+	 * Erase the entry at an index, leaving entries below it where they were
+	 *
+	 * @param i Index from 0 to size()-1
+	 */
+	inline void eraseAt(const unsigned int i)
+	{
+		if (_n > N) {
+			_heap.erase(_heap.begin() + i);
+			if (--_n == N) {
+				for(unsigned int j=0;j<N;++j)
+					_local.data()[j] = _heap[j];
+				std::vector<_E>().swap(_heap);
+			}
+		} else {
+			_E *const e = _local.data();
+			for(unsigned int j=i+1;j<_n;++j)
+				e[j-1] = e[j];
+			e[--_n].v = V();
+		}
+	}
+
+	inline void clear()
+	{
+		for(unsigned int j=0;j<((_n < N) ? _n : N);++j)
+			_local.data()[j].v = V();
+		std::vector<_E>().swap(_heap);
+		_n = 0;
+	}
+
+	/**
+	 * @return Bytes allocated beyond sizeof(SmallMap), not counting anything values point to
+	 */
+	inline unsigned long footprint() const { return (unsigned long)(_heap.capacity() * sizeof(_E)); }
+
+private:
+	inline _E *_data() { return ((_n > N) ? &(_heap[0]) : _local.data()); }
+	inline const _E *_data() const { return ((_n > N) ? &(_heap[0]) : _local.data()); }
+
+	inline unsigned int _lowerBound(const K &k) const
+	{
+		const _E *const e = _data();
+		unsigned int lo = 0,hi = _n;
+		while (lo < hi) {
+			const unsigned int mid = (lo + hi) >> 1;
+			if (e[mid].k < k)
+				lo = mid + 1;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	_Local<N> _local;
+	std::vector<_E> _heap; // holds all entries if there are more than N, otherwise empty
+	unsigned int _n;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -44,6 +44,13 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Trace.hpp"
+#include "Cluster.hpp"
+#include "PacketTrace.hpp"
+#include "NeighborCache.hpp"
+#include "Latency.hpp"
+#include "CryptoPipeline.hpp"
+#include "Fec.hpp"
+#include "Probes.hpp"
 
 namespace ZeroTier {
 
@@ -51,17 +58,27 @@ Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_outstandingWhoisRequests(32),
-	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
+	_lastWhoisSent(0),
+	_lastWhoisUpstream(0),
+	_lastUniteAttempt(8), // only really used on root servers and upstreams, and it'll grow there just fine
+	_relayLimit(ZT_RELAY_MAX_BYTES_PER_DESTINATION_PER_SECOND),
+	_egress(ZT_QOS_MAX_QUEUE_BYTES,ZT_QOS_MAX_QUEUE_PER_PEER),
+	_egressLimit(0),
+	_egressPacing(false)
 {
+	Utils::getSecureRandom(&_rxQueueSalt,sizeof(_rxQueueSalt));
 }
 
-void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len)
+void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len,const unsigned int ecn)
 {
 	try {
 		const uint64_t now = RR->node->now();
+		RR->metrics->inc(Metrics::PACKETS_IN);
+		RR->metrics->add(Metrics::BYTES_IN,len);
+		ZT_PROBE_PACKET_RECEIVE(localSocket,&fromAddr,len);
 
 		const SharedPtr<Path> path(RR->topology->getPath(localSocket,fromAddr));
-		path->received(now);
+		path->received(now,len);
 
 		if (len == 13) {
 			/* LEGACY: before VERB_PUSH_DIRECT_PATHS, peers used broadcast
@@ -79,234 +96,187 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 				if ((now - _lastBeaconResponse) >= 2500) { // limit rate of responses
 					_lastBeaconResponse = now;
 					Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NOP);
-					outp.armor(peer->key(),true,path->nextOutgoingCounter());
+					outp.armor(peer->key(),true,path->nextOutgoingCounter(),peer->keySchedule());
 					path->send(RR,tPtr,outp.data(),outp.size(),now);
 				}
 			}
 
 		} else if (len > ZT_PROTO_MIN_FRAGMENT_LENGTH) { // SECURITY: min length check is important since we do some C-style stuff below!
-			if (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
-				// Handle fragment ----------------------------------------------------
-
-				Packet::Fragment fragment(data,len);
-				const Address destination(fragment.destination());
-
-				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amRoot()) && (!path->trustEstablished(now)) )
-						return;
-
-					if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
-						fragment.incrementHops();
-
-						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
-						// It wouldn't hurt anything, just redundant and unnecessary.
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((!relayTo)||(!relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,false))) {
-							// Don't know peer or no direct path -- so relay via someone upstream
-							relayTo = RR->topology->getUpstreamPeer();
-							if (relayTo)
-								relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,true);
-						}
-					}
-				} else {
-					// Fragment looks like ours
-					const uint64_t fragmentPacketId = fragment.packetId();
-					const unsigned int fragmentNumber = fragment.fragmentNumber();
-					const unsigned int totalFragments = fragment.totalFragments();
-
-					if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
-						// Fragment appears basically sane. Its fragment number must be
-						// 1 or more, since a Packet with fragmented bit set is fragment 0.
-						// Total fragments must be more than 1, otherwise why are we
-						// seeing a Packet::Fragment?
-
-						Mutex::Lock _l(_rxQueue_m);
-						RXQueueEntry *const rq = _findRXQueueEntry(now,fragmentPacketId);
-
-						if ((!rq->timestamp)||(rq->packetId != fragmentPacketId)) {
-							// No packet found, so we received a fragment without its head.
-
-							rq->timestamp = now;
-							rq->packetId = fragmentPacketId;
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments; // total fragment count is known
-							rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
-							rq->complete = false;
-						} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
-							// We have other fragments and maybe the head, so add this one and check
-
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments;
-
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
-								// We have all fragments -- assemble and process full Packet
-
-								for(unsigned int f=1;f<totalFragments;++f)
-									rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-								if (rq->frag0.tryDecode(RR,tPtr)) {
-									rq->timestamp = 0; // packet decoded, free entry
-								} else {
-									rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-								}
-							}
-						} // else this is a duplicate fragment, ignore
+			_receiveDatagram(tPtr,path,data,len,now,false,(ecn == 3));
+		}
+	} catch ( ... ) {} // sanity check, should be caught elsewhere
+}
+
+void Switch::_receiveDatagram(void *tPtr,const SharedPtr<Path> &path,const void *data,unsigned int len,const uint64_t now,const bool repaired,const bool ce)
+{
+	// Anything not addressed to us is relayed straight from the wire bytes,
+	// since only the destination and hop count in the header matter. The
+	// destination is at the same index in packet heads and fragments.
+	const Address destination(reinterpret_cast<const uint8_t *>(data) + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+	const bool isFragment = (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR);
+	if (destination != RR->identity.address()) {
+		if ((isFragment)||(len >= ZT_PROTO_MIN_PACKET_LENGTH))
+			_relay(tPtr,path,destination,data,len,isFragment,now);
+		return;
+	}
+
+	if (isFragment) {
+		// Handle fragment ----------------------------------------------------
+
+		if ((!repaired)&&(path->fecWanted()))
+			path->fecRemember(data,len);
+
+		Packet::Fragment fragment(data,len);
+		RR->metrics->inc(Metrics::FRAGMENTS_IN);
+
+		// Fragment looks like ours
+		const uint64_t fragmentPacketId = fragment.packetId();
+		const unsigned int fragmentNumber = fragment.fragmentNumber();
+		const unsigned int totalFragments = fragment.totalFragments();
+
+		if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
+			// Fragment appears basically sane. Its fragment number must be
+			// 1 or more, since a Packet with fragmented bit set is fragment 0.
+			// Total fragments must be more than 1, otherwise why are we
+			// seeing a Packet::Fragment?
+
+			const unsigned int fragmentPayloadLength = fragment.payloadLength();
+			if (fragmentPayloadLength > ZT_UDP_DEFAULT_PAYLOAD_MTU)
+				return; // larger than any fragment we would send
+
+			RXQueueBucket &b = _rxQueueBucket(fragmentPacketId);
+			Mutex::Lock _l(b.lock);
+			RXQueueEntry *const rq = _findRXQueueEntry(b,now,fragmentPacketId);
+
+			if ((!rq->timestamp)||(rq->packetId != fragmentPacketId)) {
+				// No packet found, so we received a fragment without its head.
+
+				rq->timestamp = now;
+				rq->packetId = fragmentPacketId;
+				memcpy(rq->frags[fragmentNumber - 1],fragment.payload(),fragmentPayloadLength);
+				rq->fragLengths[fragmentNumber - 1] = fragmentPayloadLength;
+				rq->totalFragments = totalFragments; // total fragment count is known
+				rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
+				rq->complete = false;
+				rq->ce = ce;
+			} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
+				// We have other fragments and maybe the head, so add this one and check
+
+				memcpy(rq->frags[fragmentNumber - 1],fragment.payload(),fragmentPayloadLength);
+				rq->fragLengths[fragmentNumber - 1] = fragmentPayloadLength;
+				rq->totalFragments = totalFragments;
+				rq->ce |= ce;
+
+				if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
+					// We have all fragments -- assemble and process full Packet
+
+					_assembleRXQueueEntry(rq);
+
+					if (rq->frag0->tryDecode(RR,tPtr)) {
+						rq->timestamp = 0; // packet decoded, free entry
+					} else {
+						rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
 					}
 				}
+			} // else this is a duplicate fragment, ignore
+		}
 
-				// --------------------------------------------------------------------
-			} else if (len >= ZT_PROTO_MIN_PACKET_LENGTH) { // min length check is important!
-				// Handle packet head -------------------------------------------------
+		// --------------------------------------------------------------------
+	} else if (len >= ZT_PROTO_MIN_PACKET_LENGTH) { // min length check is important!
+		// Handle packet head -------------------------------------------------
 
-				const Address destination(reinterpret_cast<const uint8_t *>(data) + 8,ZT_ADDRESS_LENGTH);
-				const Address source(reinterpret_cast<const uint8_t *>(data) + 13,ZT_ADDRESS_LENGTH);
+		const Address source(reinterpret_cast<const uint8_t *>(data) + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH);
 
-				if (source == RR->identity.address())
-					return;
+		if (source == RR->identity.address())
+			return;
 
-				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amRoot()) && (!path->trustEstablished(now)) && (source != RR->identity.address()) )
-						return;
-
-					Packet packet(data,len);
-
-					if (packet.hops() < ZT_RELAY_MAX_HOPS) {
-						packet.incrementHops();
-
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((relayTo)&&(relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,false))) {
-							if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) { // don't send RENDEZVOUS for cluster frontplane relays
-								const InetAddress *hintToSource = (InetAddress *)0;
-								const InetAddress *hintToDest = (InetAddress *)0;
-
-								InetAddress destV4,destV6;
-								InetAddress sourceV4,sourceV6;
-								relayTo->getRendezvousAddresses(now,destV4,destV6);
-
-								const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
-								if (sourcePeer) {
-									sourcePeer->getRendezvousAddresses(now,sourceV4,sourceV6);
-									if ((destV6)&&(sourceV6)) {
-										hintToSource = &destV6;
-										hintToDest = &sourceV6;
-									} else if ((destV4)&&(sourceV4)) {
-										hintToSource = &destV4;
-										hintToDest = &sourceV4;
-									}
-
-									if ((hintToSource)&&(hintToDest)) {
-										unsigned int alt = (unsigned int)RR->node->prng() & 1; // randomize which hint we send first for obscure NAT-t reasons
-										const unsigned int completed = alt + 2;
-										while (alt != completed) {
-											if ((alt & 1) == 0) {
-												Packet outp(source,RR->identity.address(),Packet::VERB_RENDEZVOUS);
-												outp.append((uint8_t)0);
-												destination.appendTo(outp);
-												outp.append((uint16_t)hintToSource->port());
-												if (hintToSource->ss_family == AF_INET6) {
-													outp.append((uint8_t)16);
-													outp.append(hintToSource->rawIpData(),16);
-												} else {
-													outp.append((uint8_t)4);
-													outp.append(hintToSource->rawIpData(),4);
-												}
-												send(tPtr,outp,true);
-											} else {
-												Packet outp(destination,RR->identity.address(),Packet::VERB_RENDEZVOUS);
-												outp.append((uint8_t)0);
-												source.appendTo(outp);
-												outp.append((uint16_t)hintToDest->port());
-												if (hintToDest->ss_family == AF_INET6) {
-													outp.append((uint8_t)16);
-													outp.append(hintToDest->rawIpData(),16);
-												} else {
-													outp.append((uint8_t)4);
-													outp.append(hintToDest->rawIpData(),4);
-												}
-												send(tPtr,outp,true);
-											}
-											++alt;
-										}
-									}
-								}
-							}
-						} else {
-							relayTo = RR->topology->getUpstreamPeer(&source,1,true);
-							if (relayTo)
-								relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,true);
-						}
+		if (Fec::isParity(data)) {
+			// Rebuild a datagram of the group this covers if just one was lost
+			if (!repaired) {
+				uint8_t rebuilt[ZT_FEC_MAX_DATAGRAM];
+				const int rlen = path->fecRepair(data,len,rebuilt);
+				if (rlen > 0) {
+					RR->metrics->inc(Metrics::FEC_REPAIRED);
+					_receiveDatagram(tPtr,path,rebuilt,(unsigned int)rlen,now,true,ce);
+				} else if (rlen < 0) {
+					RR->metrics->inc(Metrics::FEC_UNREPAIRABLE);
+				}
+			}
+			return;
+		}
+		if ((!repaired)&&(path->fecWanted()))
+			path->fecRemember(data,len);
+
+		if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
+			// Packet is the head of a fragmented packet series
+
+			const uint64_t packetId = (
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[0]) << 56) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[1]) << 48) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[2]) << 40) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[3]) << 32) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[4]) << 24) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[5]) << 16) |
+				(((uint64_t)reinterpret_cast<const uint8_t *>(data)[6]) << 8) |
+				((uint64_t)reinterpret_cast<const uint8_t *>(data)[7])
+			);
+
+			RXQueueBucket &b = _rxQueueBucket(packetId);
+			Mutex::Lock _l(b.lock);
+			RXQueueEntry *const rq = _findRXQueueEntry(b,now,packetId);
+
+			if ((!rq->timestamp)||(rq->packetId != packetId)) {
+				// If we have no other fragments yet, create an entry and save the head
+
+				rq->timestamp = now;
+				rq->packetId = packetId;
+				_initRXQueueHead(rq,data,len,path,now);
+				rq->totalFragments = 0;
+				rq->haveFragments = 1;
+				rq->complete = false;
+				rq->ce = ce;
+			} else if (!(rq->haveFragments & 1)) {
+				// If we have other fragments but no head, see if we are complete with the head
+
+				rq->ce |= ce;
+
+				if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
+					// We have all fragments -- assemble and process full Packet
+
+					_initRXQueueHead(rq,data,len,path,now);
+					_assembleRXQueueEntry(rq);
+
+					if (rq->frag0->tryDecode(RR,tPtr)) {
+						rq->timestamp = 0; // packet decoded, free entry
+					} else {
+						rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
 					}
-				} else if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
-					// Packet is the head of a fragmented packet series
-
-					const uint64_t packetId = (
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[0]) << 56) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[1]) << 48) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[2]) << 40) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[3]) << 32) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[4]) << 24) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[5]) << 16) |
-						(((uint64_t)reinterpret_cast<const uint8_t *>(data)[6]) << 8) |
-						((uint64_t)reinterpret_cast<const uint8_t *>(data)[7])
-					);
-
-					Mutex::Lock _l(_rxQueue_m);
-					RXQueueEntry *const rq = _findRXQueueEntry(now,packetId);
-
-					if ((!rq->timestamp)||(rq->packetId != packetId)) {
-						// If we have no other fragments yet, create an entry and save the head
-
-						rq->timestamp = now;
-						rq->packetId = packetId;
-						rq->frag0.init(data,len,path,now);
-						rq->totalFragments = 0;
-						rq->haveFragments = 1;
-						rq->complete = false;
-					} else if (!(rq->haveFragments & 1)) {
-						// If we have other fragments but no head, see if we are complete with the head
-
-						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
-							// We have all fragments -- assemble and process full Packet
-
-							rq->frag0.init(data,len,path,now);
-							for(unsigned int f=1;f<rq->totalFragments;++f)
-								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-							if (rq->frag0.tryDecode(RR,tPtr)) {
-								rq->timestamp = 0; // packet decoded, free entry
-							} else {
-								rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-							}
-						} else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data,len,path,now);
-						}
-					} // else this is a duplicate head, ignore
 				} else {
-					// Packet is unfragmented, so just process it
-					IncomingPacket packet(data,len,path,now);
-					if (!packet.tryDecode(RR,tPtr)) {
-						Mutex::Lock _l(_rxQueue_m);
-						RXQueueEntry *rq = &(_rxQueue[ZT_RX_QUEUE_SIZE - 1]);
-						unsigned long i = ZT_RX_QUEUE_SIZE - 1;
-						while ((i)&&(rq->timestamp)) {
-							RXQueueEntry *tmp = &(_rxQueue[--i]);
-							if (tmp->timestamp < rq->timestamp)
-								rq = tmp;
-						}
-						rq->timestamp = now;
-						rq->packetId = packet.packetId();
-						rq->frag0 = packet;
-						rq->totalFragments = 1;
-						rq->haveFragments = 1;
-						rq->complete = true;
-					}
+					// Still waiting on more fragments, but keep the head
+					_initRXQueueHead(rq,data,len,path,now);
 				}
-
-				// --------------------------------------------------------------------
+			} // else this is a duplicate head, ignore
+		} else {
+			// Packet is unfragmented, so just process it
+			const SharedPtr<IncomingPacket> packet(new IncomingPacket(data,len,path,now));
+			if (ce)
+				packet->setCongestionExperienced();
+			if (!packet->tryDecode(RR,tPtr)) {
+				const uint64_t packetId = packet->packetId();
+				RXQueueBucket &b = _rxQueueBucket(packetId);
+				Mutex::Lock _l(b.lock);
+				RXQueueEntry *const rq = _findRXQueueEntry(b,now,packetId);
+				rq->timestamp = now;
+				rq->packetId = packetId;
+				rq->frag0 = packet; // keep the handle, no copy
+				rq->totalFragments = 1;
+				rq->haveFragments = 1;
+				rq->complete = true;
 			}
 		}
-	} catch ( ... ) {} // sanity check, should be caught elsewhere
+
+		// --------------------------------------------------------------------
+	}
 }
 
 void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
@@ -337,7 +307,27 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				 * them into multicasts by stuffing the IP address being queried into
 				 * the 32-bit ADI field. In practice this uses our multicast pub/sub
 				 * system to implement a kind of extended/distributed ARP table. */
-				multicastGroup = MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress(((const unsigned char *)data) + 24,4,0));
+				const uint8_t *const arp = reinterpret_cast<const uint8_t *>(data);
+				const InetAddress target(arp + 24,4,0);
+
+				// If the controller gave this IP to a member we know, answer for it
+				MAC targetMac;
+				if (_resolveLocally(network,target,targetMac)) {
+					uint8_t reply[28];
+					reply[0] = 0x00; reply[1] = 0x01; // Ethernet
+					reply[2] = 0x08; reply[3] = 0x00; // IPv4
+					reply[4] = 6; reply[5] = 4;
+					reply[6] = 0x00; reply[7] = 0x02; // reply
+					targetMac.copyTo(reply + 8,6);
+					memcpy(reply + 14,arp + 24,4);
+					memcpy(reply + 18,arp + 8,6);
+					memcpy(reply + 24,arp + 14,4);
+					RR->node->putFrame(tPtr,network->id(),network->userPtr(),targetMac,from,ZT_ETHERTYPE_ARP,0,reply,28);
+					RR->metrics->inc(Metrics::NEIGHBOR_ANSWERED_ARP);
+					return;
+				}
+
+				multicastGroup = MulticastGroup::deriveMulticastGroupForAddressResolution(target);
 			} else if (!network->config().enableBroadcast()) {
 				// Don't transmit broadcasts if this network doesn't want them
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"broadcast disabled");
@@ -392,38 +382,22 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				}
 
 				if ((v6EmbeddedAddress)&&(v6EmbeddedAddress != RR->identity.address())) {
-					const MAC peerMac(v6EmbeddedAddress,network->id());
-
-					uint8_t adv[72];
-					adv[0] = 0x60; adv[1] = 0x00; adv[2] = 0x00; adv[3] = 0x00;
-					adv[4] = 0x00; adv[5] = 0x20;
-					adv[6] = 0x3a; adv[7] = 0xff;
-					for(int i=0;i<16;++i) adv[8 + i] = pkt6[i];
-					for(int i=0;i<16;++i) adv[24 + i] = my6[i];
-					adv[40] = 0x88; adv[41] = 0x00;
-					adv[42] = 0x00; adv[43] = 0x00; // future home of checksum
-					adv[44] = 0x60; adv[45] = 0x00; adv[46] = 0x00; adv[47] = 0x00;
-					for(int i=0;i<16;++i) adv[48 + i] = pkt6[i];
-					adv[64] = 0x02; adv[65] = 0x01;
-					adv[66] = peerMac[0]; adv[67] = peerMac[1]; adv[68] = peerMac[2]; adv[69] = peerMac[3]; adv[70] = peerMac[4]; adv[71] = peerMac[5];
-
-					uint16_t pseudo_[36];
-					uint8_t *const pseudo = reinterpret_cast<uint8_t *>(pseudo_);
-					for(int i=0;i<32;++i) pseudo[i] = adv[8 + i];
-					pseudo[32] = 0x00; pseudo[33] = 0x00; pseudo[34] = 0x00; pseudo[35] = 0x20;
-					pseudo[36] = 0x00; pseudo[37] = 0x00; pseudo[38] = 0x00; pseudo[39] = 0x3a;
-					for(int i=0;i<32;++i) pseudo[40 + i] = adv[40 + i];
-					uint32_t checksum = 0;
-					for(int i=0;i<36;++i) checksum += Utils::hton(pseudo_[i]);
-					while ((checksum >> 16)) checksum = (checksum & 0xffff) + (checksum >> 16);
-					checksum = ~checksum;
-					adv[42] = (checksum >> 8) & 0xff;
-					adv[43] = checksum & 0xff;
-
-					RR->node->putFrame(tPtr,network->id(),network->userPtr(),peerMac,from,ZT_ETHERTYPE_IPV6,0,adv,72);
+					_sendNeighborAdvertisement(tPtr,network,MAC(v6EmbeddedAddress,network->id()),from,pkt6,my6);
 					return; // NDP emulation done. We have forged a "fake" reply, so no need to send actual NDP query.
 				} // else no NDP emulation
 			} // else no NDP emulation
+
+			// Otherwise answer solicitations for IPs the controller gave members we know
+			if ((reinterpret_cast<const uint8_t *>(data)[6] == 0x3a)&&(reinterpret_cast<const uint8_t *>(data)[40] == 0x87)) {
+				const uint8_t *const src6 = reinterpret_cast<const uint8_t *>(data) + 8;
+				const uint8_t *const pkt6 = reinterpret_cast<const uint8_t *>(data) + 40 + 8;
+				MAC targetMac;
+				if ((!Utils::isZero(src6,16))&&(_resolveLocally(network,InetAddress(pkt6,16,0),targetMac))) { // never answer duplicate address detection
+					_sendNeighborAdvertisement(tPtr,network,targetMac,from,pkt6,src6);
+					RR->metrics->inc(Metrics::NEIGHBOR_ANSWERED_NDP);
+					return;
+				}
+			}
 		}
 
 		// Check this after NDP emulation, since that has to be allowed in exactly this case
@@ -435,9 +409,14 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		/* Learn multicast groups for bridged-in hosts.
 		 * Note that some OSes, most notably Linux, do this for you by learning
 		 * multicast addresses on bridge interfaces and subscribing each slave.
-		 * But in that case this does no harm, as the sets are just merged. */
-		if (fromBridged)
-			network->learnBridgedMulticastGroup(tPtr,multicastGroup,RR->node->now());
+		 * But in that case this does no harm, as the sets are just merged.
+		 * IP multicast groups are learned only from IGMP and MLD, since a
+		 * host sending to a group (a camera, say) hasn't joined it. */
+		if (fromBridged) {
+			network->snoopBridgedMulticast(tPtr,etherType,(const uint8_t *)data,len,RR->node->now());
+			if (!multicastGroup.joinedByReport())
+				network->learnBridgedMulticastGroup(tPtr,multicastGroup,RR->node->now());
+		}
 
 		// First pass sets noTee to false, but noTee is set to true in OutboundMulticast to prevent duplicates.
 		if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),Address(),from,to,(const uint8_t *)data,len,etherType,vlanId)) {
@@ -452,6 +431,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			network->id(),
 			network->config().disableCompression(),
 			network->config().activeBridges(),
+			Address(),
 			multicastGroup,
 			(fromBridged) ? from : MAC(),
 			etherType,
@@ -471,6 +451,9 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			return;
 		}
 
+		const uint32_t flowId = _frameFlowId(from,to,etherType,(const uint8_t *)data,len);
+		const unsigned int qosClass = _frameQosClass(etherType,(const uint8_t *)data,len);
+
 		if (fromBridged) {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(network->id());
@@ -479,17 +462,23 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			from.appendTo(outp);
 			outp.append((uint16_t)etherType);
 			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
+			if (!network->config().disableCompression()) {
+				if (toPeer)
+					toPeer->compressFrame(outp,flowId,(network->config().zstdCompression())&&(toPeer->zstdEnabled()));
+				else outp.compress();
+			}
+			send(tPtr,outp,true,flowId,qosClass,network->id());
 		} else {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
 			outp.append(network->id());
 			outp.append((uint16_t)etherType);
 			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
+			if (!network->config().disableCompression()) {
+				if (toPeer)
+					toPeer->compressFrame(outp,flowId,(network->config().zstdCompression())&&(toPeer->zstdEnabled()));
+				else outp.compress();
+			}
+			send(tPtr,outp,true,flowId,qosClass,network->id());
 		}
 
 	} else {
@@ -535,6 +524,8 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			}
 		}
 
+		const uint32_t flowId = ((numBridges)&&(RR->node->multipathMode())) ? _frameFlowId(from,to,etherType,(const uint8_t *)data,len) : 0;
+		const unsigned int qosClass = _frameQosClass(etherType,(const uint8_t *)data,len);
 		for(unsigned int b=0;b<numBridges;++b) {
 			if (network->filterOutgoingPacket(tPtr,true,RR->identity.address(),bridges[b],from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 				Packet outp(bridges[b],RR->identity.address(),Packet::VERB_EXT_FRAME);
@@ -546,7 +537,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				outp.append(data,len);
 				if (!network->config().disableCompression())
 					outp.compress();
-				send(tPtr,outp,true);
+				send(tPtr,outp,true,flowId,qosClass,network->id());
 			} else {
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked (bridge replication)");
 			}
@@ -554,101 +545,209 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 	}
 }
 
-void Switch::send(void *tPtr,Packet &packet,bool encrypt)
+void Switch::send(void *tPtr,Packet &packet,bool encrypt,const uint32_t flowId,const unsigned int qosClass,const uint64_t nwid)
 {
 	if (packet.destination() == RR->identity.address())
 		return;
-	if (!_trySend(tPtr,packet,encrypt)) {
-		Mutex::Lock _l(_txQueue_m);
-		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt));
-	}
+	if (!_trySend(tPtr,packet,encrypt,flowId,qosClass,nwid))
+		_enqueue(packet.destination(),SharedPtr<Packet>(new Packet(packet)),encrypt,flowId,qosClass,nwid);
+}
+
+void Switch::send(void *tPtr,const SharedPtr<Packet> &packet,bool encrypt,const uint64_t nwid)
+{
+	if (packet->destination() == RR->identity.address())
+		return;
+	if (!_trySend(tPtr,*packet,encrypt,0,ZT_QOS_CLASS_NORMAL,nwid))
+		_enqueue(packet->destination(),packet,encrypt,0,ZT_QOS_CLASS_NORMAL,nwid);
 }
 
 void Switch::requestWhois(void *tPtr,const Address &addr)
 {
 	if (addr == RR->identity.address())
 		return;
-	bool inserted = false;
+	std::vector<Address> batch;
 	{
 		Mutex::Lock _l(_outstandingWhoisRequests_m);
 		WhoisRequest &r = _outstandingWhoisRequests[addr];
 		if (r.lastSent) {
 			r.retries = 0; // reset retry count if entry already existed, but keep waiting and retry again after normal timeout
-		} else {
-			r.lastSent = RR->node->now();
-			inserted = true;
+			return;
 		}
+		const uint64_t now = RR->node->now();
+		r.lastSent = r.started = now;
+		_pendingWhois.push_back(addr);
+		if ((_pendingWhois.size() >= ZT_WHOIS_MAX_BATCH)||((now - _lastWhoisSent) >= ZT_WHOIS_BATCH_WINDOW)) {
+			batch.swap(_pendingWhois);
+			_lastWhoisSent = now;
+		}
+	}
+	RR->metrics->inc(Metrics::WHOIS_SENT);
+	if (!batch.empty())
+		_sendWhoisRequests(tPtr,batch);
+}
+
+void Switch::requestWhois(void *tPtr,const Address &addr,const Address &requester,const uint64_t inRePacketId)
+{
+	if (addr == RR->identity.address())
+		return;
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		std::vector<WhoisRequester> &rq = _whoisRequesters[addr];
+		std::vector<WhoisRequester>::iterator r(rq.begin());
+		while ((r != rq.end())&&(r->requester != requester))
+			++r;
+		if (r != rq.end()) {
+			r->inRePacketId = inRePacketId;
+		} else if (rq.size() < ZT_WHOIS_MAX_DEFERRED_REPLIES) {
+			rq.push_back(WhoisRequester());
+			rq.back().requester = requester;
+			rq.back().inRePacketId = inRePacketId;
+		}
+	}
+	requestWhois(tPtr,addr);
+}
+
+uint64_t Switch::flushWhoisRequests(void *tPtr,uint64_t now)
+{
+	std::vector<Address> batch;
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		if (_pendingWhois.empty())
+			return 0;
+		if ((now - _lastWhoisSent) < ZT_WHOIS_BATCH_WINDOW)
+			return (_lastWhoisSent + ZT_WHOIS_BATCH_WINDOW);
+		batch.swap(_pendingWhois);
+		_lastWhoisSent = now;
 	}
-	if (inserted)
-		_sendWhoisRequest(tPtr,addr,(const Address *)0,0);
+	_sendWhoisRequests(tPtr,batch);
+	return 0;
 }
 
-void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
+void Switch::doAnythingWaitingForPeer(void *tPtr,const Address &addr)
 {
+	std::vector<WhoisRequester> requesters;
 	{	// cancel pending WHOIS since we now know this peer
 		Mutex::Lock _l(_outstandingWhoisRequests_m);
-		_outstandingWhoisRequests.erase(peer->address());
+		const WhoisRequest *const r = _outstandingWhoisRequests.get(addr);
+		if (r) {
+			RR->metrics->inc(Metrics::WHOIS_ANSWERED);
+			RR->metrics->add(Metrics::WHOIS_LATENCY_MS,RR->node->now() - r->started);
+			ZT_PROBE_WHOIS_RESOLVE(addr.toInt(),RR->node->now() - r->started);
+			_outstandingWhoisRequests.erase(addr);
+		}
+		std::vector<WhoisRequester> *const rq = _whoisRequesters.get(addr);
+		if (rq) {
+			requesters.swap(*rq);
+			_whoisRequesters.erase(addr);
+		}
+	}
+
+	if (!requesters.empty()) {	// answer peers that asked us for this identity while we looked it up
+		const Identity id(RR->topology->getIdentity(tPtr,addr));
+		if (id) {
+			for(std::vector<WhoisRequester>::const_iterator r(requesters.begin());r!=requesters.end();++r) {
+				Packet outp(r->requester,RR->identity.address(),Packet::VERB_OK);
+				outp.append((unsigned char)Packet::VERB_WHOIS);
+				outp.append(r->inRePacketId);
+				id.serialize(outp,false);
+				send(tPtr,outp,true);
+			}
+		}
 	}
 
 	{	// finish processing any packets waiting on peer's public key / identity
-		Mutex::Lock _l(_rxQueue_m);
-		unsigned long i = ZT_RX_QUEUE_SIZE;
-		while (i) {
-			RXQueueEntry *rq = &(_rxQueue[--i]);
-			if ((rq->timestamp)&&(rq->complete)) {
-				if (rq->frag0.tryDecode(RR,tPtr))
-					rq->timestamp = 0;
+		for(unsigned long bi=0;bi<(ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_WAYS);++bi) {
+			RXQueueBucket &b = _rxQueue[bi];
+			Mutex::Lock _l(b.lock);
+			for(unsigned int i=0;i<ZT_RX_QUEUE_WAYS;++i) {
+				RXQueueEntry *const rq = &(b.e[i]);
+				if ((rq->timestamp)&&(rq->complete)) {
+					if (rq->frag0->tryDecode(RR,tPtr))
+						rq->timestamp = 0;
+				}
 			}
 		}
 	}
 
 	{	// finish sending any packets waiting on peer's public key / identity
-		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (txi->dest == peer->address()) {
-				if (_trySend(tPtr,txi->packet,txi->encrypt))
-					_txQueue.erase(txi++);
-				else ++txi;
-			} else ++txi;
-		}
+		TXQueue q;
+		if ((_takeTXQueue(addr,q))&&(_flushTXQueue(tPtr,q)))
+			_returnTXQueue(addr,q);
 	}
 }
 
+void Switch::rendezvousRequested(void *tPtr,const Address &source,const Address &destination)
+{
+	if ((source == destination)||(destination == RR->identity.address()))
+		return;
+	const uint64_t now = RR->node->now();
+	const SharedPtr<Peer> destPeer(RR->topology->getPeer(tPtr,destination));
+	if ((destPeer)&&(destPeer->getBestPath(now,false))&&(_shouldUnite(now,source,destination)))
+		_unite(tPtr,now,source,destination,destPeer);
+}
+
 unsigned long Switch::doTimerTasks(void *tPtr,uint64_t now)
 {
 	unsigned long nextDelay = 0xffffffff; // ceiling delay, caller will cap to minimum
 
-	{	// Retry outstanding WHOIS requests
-		Mutex::Lock _l(_outstandingWhoisRequests_m);
-		Hashtable< Address,WhoisRequest >::Iterator i(_outstandingWhoisRequests);
-		Address *a = (Address *)0;
-		WhoisRequest *r = (WhoisRequest *)0;
-		while (i.next(a,r)) {
-			const unsigned long since = (unsigned long)(now - r->lastSent);
-			if (since >= ZT_WHOIS_RETRY_DELAY) {
-				if (r->retries >= ZT_MAX_WHOIS_RETRIES) {
-					_outstandingWhoisRequests.erase(*a);
+	{	// Send WHOIS lookups waiting on the batch window along with any retries that are due
+		// If the upstream last asked has stopped answering, retry everything with
+		// the next best now rather than waiting out the retry delay.
+		const uint64_t lastUpstream = _lastWhoisUpstream;
+		bool failedOver = false;
+		if (lastUpstream) {
+			const SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer());
+			failedOver = ((upstream)&&(upstream->address().toInt() != lastUpstream));
+		}
+
+		std::vector<Address> batch;
+		{
+			Mutex::Lock _l(_outstandingWhoisRequests_m);
+			batch.swap(_pendingWhois);
+			FlatHashtable< Address,WhoisRequest >::Iterator i(_outstandingWhoisRequests);
+			Address *a = (Address *)0;
+			WhoisRequest *r = (WhoisRequest *)0;
+			while (i.next(a,r)) {
+				const unsigned long since = (unsigned long)(now - r->lastSent);
+				if ((since >= ZT_WHOIS_RETRY_DELAY)||(failedOver)) {
+					if (r->retries >= ZT_MAX_WHOIS_RETRIES) {
+						RR->metrics->inc(Metrics::WHOIS_TIMEOUTS);
+						_whoisRequesters.erase(*a);
+						_outstandingWhoisRequests.erase(*a);
+					} else {
+						r->lastSent = now;
+						++r->retries;
+						batch.push_back(*a);
+						nextDelay = std::min(nextDelay,(unsigned long)ZT_WHOIS_RETRY_DELAY);
+					}
 				} else {
-					r->lastSent = now;
-					r->peersConsulted[r->retries] = _sendWhoisRequest(tPtr,*a,r->peersConsulted,(r->retries > 1) ? r->retries : 0);
-					++r->retries;
-					nextDelay = std::min(nextDelay,(unsigned long)ZT_WHOIS_RETRY_DELAY);
+					nextDelay = std::min(nextDelay,ZT_WHOIS_RETRY_DELAY - since);
 				}
-			} else {
-				nextDelay = std::min(nextDelay,ZT_WHOIS_RETRY_DELAY - since);
 			}
+			if (!batch.empty())
+				_lastWhoisSent = now;
 		}
+		if (!batch.empty())
+			_sendWhoisRequests(tPtr,batch);
 	}
 
 	{	// Time out TX queue packets that never got WHOIS lookups or other info.
-		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(tPtr,txi->packet,txi->encrypt))
-				_txQueue.erase(txi++);
-			else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
-				RR->t->txTimedOut(tPtr,txi->dest);
-				_txQueue.erase(txi++);
-			} else ++txi;
+		std::vector<Address> dests;
+		{
+			Mutex::Lock _l(_txQueue_m);
+			_txQueue.appendKeys(dests);
+		}
+		for(std::vector<Address>::const_iterator a(dests.begin());a!=dests.end();++a) {
+			TXQueue q;
+			if ((_takeTXQueue(*a,q))&&(_flushTXQueue(tPtr,q))) {
+				// Entries are in creation order, so expired ones are at the front
+				while ((q.count)&&((now - q.front().creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT)) {
+					RR->t->txTimedOut(tPtr,*a);
+					q.popFront();
+				}
+				if (q.count)
+					_returnTXQueue(*a,q);
+			}
 		}
 	}
 
@@ -666,6 +765,298 @@ unsigned long Switch::doTimerTasks(void *tPtr,uint64_t now)
 	return nextDelay;
 }
 
+void Switch::rxQueueStats(uint64_t &evicted,uint64_t &expired)
+{
+	evicted = 0;
+	expired = 0;
+	for(unsigned long bi=0;bi<(ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_WAYS);++bi) {
+		Mutex::Lock _l(_rxQueue[bi].lock);
+		evicted += _rxQueue[bi].evicted;
+		expired += _rxQueue[bi].expired;
+	}
+}
+
+void Switch::memoryUsage(MemoryUsage &mu)
+{
+	uint64_t n = 0,bytes = sizeof(_rxQueue);
+	for(unsigned long bi=0;bi<(ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_WAYS);++bi) {
+		Mutex::Lock _l(_rxQueue[bi].lock);
+		for(unsigned int w=0;w<ZT_RX_QUEUE_WAYS;++w) {
+			if (_rxQueue[bi].e[w].timestamp)
+				++n;
+			if (_rxQueue[bi].e[w].frag0)
+				bytes += sizeof(IncomingPacket);
+		}
+	}
+	mu.add(MemoryUsage::RX_QUEUE,n,bytes);
+
+	{
+		Mutex::Lock _l(_txQueue_m);
+		n = 0;
+		Address *a = (Address *)0;
+		TXQueue *q = (TXQueue *)0;
+		Hashtable< Address,TXQueue >::Iterator i(_txQueue);
+		while (i.next(a,q))
+			n += q->count;
+		mu.add(MemoryUsage::TX_QUEUE,n,_txQueue.footprint() + (n * sizeof(Packet)));
+	}
+
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		mu.add(MemoryUsage::WHOIS_QUEUE,_outstandingWhoisRequests.size(),_outstandingWhoisRequests.footprint() + (_pendingWhois.capacity() * sizeof(Address)));
+	}
+
+	{
+		Mutex::Lock _l(_egress_m);
+		mu.add(MemoryUsage::EGRESS_QUEUE,_egress.count(),_egress.bytes() + (_egress.count() * sizeof(_EgressPacket)));
+	}
+}
+
+void Switch::setEgressLimit(uint64_t bytesPerSecond,uint64_t now)
+{
+	Mutex::Lock _l(_egress_m);
+	_egressLimit = bytesPerSecond;
+	_setEgressBucket(now);
+}
+
+void Switch::setEgressPacing(bool pace,uint64_t now)
+{
+	Mutex::Lock _l(_egress_m);
+	_egressPacing = pace;
+	_setEgressBucket(now);
+}
+
+uint64_t Switch::drainEgress(void *tPtr,uint64_t now)
+{
+	std::vector<_EgressPacket> out;
+	uint64_t next = 0;
+	{
+		Mutex::Lock _l(_egress_m);
+		unsigned int bytes = 0;
+		const _EgressPacket *p;
+		while ((p = _egress.peek(bytes))) {
+			// The queues empty regardless if the cap was lifted
+			if ((_egressLimit)&&(!_egressBucket.conform(bytes,now))) {
+				next = now + std::max(_egressBucket.delay(bytes,now),1UL);
+				break;
+			}
+			out.push_back(*p);
+			_egress.pop();
+		}
+	}
+	for(std::vector<_EgressPacket>::const_iterator p(out.begin());p!=out.end();++p)
+		p->path->send(RR,tPtr,p->data.data(),(unsigned int)p->data.length(),now,p->ecn);
+	return next;
+}
+
+void Switch::_relay(void *tPtr,const SharedPtr<Path> &path,const Address &destination,const void *data,unsigned int len,const bool isFragment,const uint64_t now)
+{
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+
+	Address source;
+	if (!isFragment) {
+		source.setTo(d + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH);
+		if (source == RR->identity.address())
+			return;
+	}
+
+	// Other cluster members forward what they couldn't deliver themselves
+	const bool fromClusterMember = ((RR->cluster)&&(RR->cluster->isClusterPeerFrontplane(path->address())));
+	if ( (!RR->topology->amRoot()) && (!fromClusterMember) && (!path->trustEstablished(now)) )
+		return;
+
+	const unsigned int hopsAt = (isFragment) ? ZT_PACKET_FRAGMENT_IDX_HOPS : ZT_PACKET_IDX_FLAGS;
+	const unsigned int hops = (isFragment) ? (unsigned int)d[hopsAt] : (unsigned int)(d[hopsAt] & 0x07);
+	if ((hops >= ZT_RELAY_MAX_HOPS)||(len > ZT_PROTO_MAX_PACKET_LENGTH))
+		return;
+	if ((!_relayRateGate(destination,len,now))||((source)&&(!_relayRateGate(source,len,now)))) {
+		RR->metrics->inc(Metrics::RELAY_RATE_DROPPED);
+		return;
+	}
+
+	// The wire buffer is const, so copy just what was received to bump hops
+	uint8_t buf[ZT_PROTO_MAX_PACKET_LENGTH];
+	memcpy(buf,data,len);
+	if (isFragment)
+		buf[hopsAt] = (uint8_t)((hops + 1) & ZT_PROTO_MAX_HOPS);
+	else buf[hopsAt] = (uint8_t)((d[hopsAt] & 0xf8) | ((hops + 1) & 0x07));
+
+	// A peer that isn't in memory has no live direct path, so don't load one.
+	// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
+	if (!isFragment) {
+		uint64_t packetId = 0;
+		for(unsigned int i=0;i<8;++i)
+			packetId = (packetId << 8) | (uint64_t)d[ZT_PACKET_IDX_IV + i];
+		RR->ptrace->record(now,PacketTrace::EVENT_PACKET_RELAYED,PacketTrace::REASON_NONE,packetId,0,source.toInt(),destination.toInt(),0,hops,len);
+	}
+
+	SharedPtr<Peer> relayTo(RR->topology->getPeerNoCache(destination));
+	if ((relayTo)&&(relayTo->sendDirect(tPtr,buf,len,now,false))) {
+		if ((!isFragment)&&(_shouldUnite(now,source,destination)))
+			_unite(tPtr,now,source,destination,relayTo);
+	} else {
+		// A peer connected to another member is reached through that member,
+		// but never bounce something another member already gave us.
+		if ((RR->cluster)&&(!fromClusterMember)&&(RR->cluster->relayViaCluster(tPtr,source,destination,buf,len,((!isFragment)&&(_shouldUnite(now,source,destination))))))
+			return;
+
+		// Don't know peer or no direct path -- so relay via someone upstream
+		relayTo = (isFragment) ? RR->topology->getUpstreamPeer() : RR->topology->getUpstreamPeer(&source,1,true);
+		if (relayTo)
+			relayTo->sendDirect(tPtr,buf,len,now,true);
+	}
+}
+
+SharedPtr<Path> Switch::_memberRelayPath(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Peer> &upstream,const uint64_t nwid,const uint64_t now)
+{
+	const SharedPtr<Network> network(RR->node->network(nwid));
+	if ((!network)||(!network->hasConfig()))
+		return SharedPtr<Path>();
+	const std::vector<Address> relays(network->config().relays());
+	if (relays.empty())
+		return SharedPtr<Path>();
+
+	// Relays we can reach directly take turns carrying an ECHO to the peer, and
+	// so does the upstream, so a member is only used if it beats the root.
+	if (peer->rateGateRelayProbe(now)) {
+		std::vector< std::pair< Address,SharedPtr<Path> > > candidates;
+		for(std::vector<Address>::const_iterator a(relays.begin());a!=relays.end();++a) {
+			if ((*a == RR->identity.address())||(*a == peer->address()))
+				continue;
+			const SharedPtr<Peer> rp(RR->topology->getPeerNoCache(*a));
+			if (rp) {
+				const SharedPtr<Path> rpp(rp->getBestPath(now,false));
+				if ((rpp)&&(rpp->alive(now)))
+					candidates.push_back(std::pair< Address,SharedPtr<Path> >(*a,rpp));
+			}
+		}
+		if (!candidates.empty()) {
+			if ((upstream)&&(upstream != peer)) {
+				const SharedPtr<Path> up(upstream->getBestPath(now,false));
+				if (up)
+					candidates.push_back(std::pair< Address,SharedPtr<Path> >(upstream->address(),up));
+			}
+			const std::pair< Address,SharedPtr<Path> > &c = candidates[peer->nextRelayProbe() % candidates.size()];
+			Packet outp(peer->address(),RR->identity.address(),Packet::VERB_ECHO);
+			outp.append((uint8_t)ZT_PROTO_ECHO_RELAY_PROBE);
+			c.first.appendTo(outp);
+			outp.append((uint64_t)now);
+			RR->node->expectReplyTo(outp.packetId());
+			outp.armor(peer->key(),true,c.second->nextOutgoingCounter(),peer->keySchedule());
+			c.second->send(RR,tPtr,outp.data(),outp.size(),now);
+		}
+	}
+
+	const Address via(peer->relayVia(now));
+	if ((!via)||((upstream)&&(via == upstream->address()))||(!network->config().isRelay(via)))
+		return SharedPtr<Path>();
+	const SharedPtr<Peer> vp(RR->topology->getPeerNoCache(via));
+	if (vp) {
+		const SharedPtr<Path> p(vp->getBestPath(now,false));
+		if ((p)&&(p->alive(now)))
+			return p;
+	}
+	return SharedPtr<Path>();
+}
+
+bool Switch::_resolveLocally(const SharedPtr<Network> &network,const InetAddress &ip,MAC &mac)
+{
+	const Address owner(RR->neighbors->get(network->id(),ip,RR->node->now()));
+	if ((!owner)||(owner == RR->identity.address())||(!network->memberOwns(owner,ip)))
+		return false;
+	mac.fromAddress(owner,network->id());
+	return true;
+}
+
+void Switch::_sendNeighborAdvertisement(void *tPtr,const SharedPtr<Network> &network,const MAC &targetMac,const MAC &to,const uint8_t *target6,const uint8_t *dest6)
+{
+	uint8_t adv[72];
+	adv[0] = 0x60; adv[1] = 0x00; adv[2] = 0x00; adv[3] = 0x00;
+	adv[4] = 0x00; adv[5] = 0x20;
+	adv[6] = 0x3a; adv[7] = 0xff;
+	for(int i=0;i<16;++i) adv[8 + i] = target6[i];
+	for(int i=0;i<16;++i) adv[24 + i] = dest6[i];
+	adv[40] = 0x88; adv[41] = 0x00;
+	adv[42] = 0x00; adv[43] = 0x00; // future home of checksum
+	adv[44] = 0x60; adv[45] = 0x00; adv[46] = 0x00; adv[47] = 0x00;
+	for(int i=0;i<16;++i) adv[48 + i] = target6[i];
+	adv[64] = 0x02; adv[65] = 0x01;
+	adv[66] = targetMac[0]; adv[67] = targetMac[1]; adv[68] = targetMac[2]; adv[69] = targetMac[3]; adv[70] = targetMac[4]; adv[71] = targetMac[5];
+
+	uint16_t pseudo_[36];
+	uint8_t *const pseudo = reinterpret_cast<uint8_t *>(pseudo_);
+	for(int i=0;i<32;++i) pseudo[i] = adv[8 + i];
+	pseudo[32] = 0x00; pseudo[33] = 0x00; pseudo[34] = 0x00; pseudo[35] = 0x20;
+	pseudo[36] = 0x00; pseudo[37] = 0x00; pseudo[38] = 0x00; pseudo[39] = 0x3a;
+	for(int i=0;i<32;++i) pseudo[40 + i] = adv[40 + i];
+	uint32_t checksum = 0;
+	for(int i=0;i<36;++i) checksum += Utils::hton(pseudo_[i]);
+	while ((checksum >> 16)) checksum = (checksum & 0xffff) + (checksum >> 16);
+	checksum = ~checksum;
+	adv[42] = (checksum >> 8) & 0xff;
+	adv[43] = checksum & 0xff;
+
+	RR->node->putFrame(tPtr,network->id(),network->userPtr(),targetMac,to,ZT_ETHERTYPE_IPV6,0,adv,72);
+}
+
+bool Switch::_relayRateGate(const Address &peer,const unsigned int len,const uint64_t now)
+{
+	const uint64_t rate = _relayLimit;
+	if (!rate)
+		return true;
+	const uint64_t a = peer.toInt();
+	_RelayLimit &rl = _relayLimits[(unsigned long)((a * 0x9e3779b97f4a7c15ULL) >> 32) & (ZT_RELAY_RATE_LIMIT_SLOTS - 1)];
+	Mutex::Lock _l(rl.lock);
+	if ((rl.address != a)||(rl.bucket.rate() != rate)) {
+		rl.address = a;
+		rl.bucket.set(rate,std::max(rate * ZT_RELAY_BURST_MS / 1000,(uint64_t)ZT_PROTO_MAX_PACKET_LENGTH),now);
+	}
+	return rl.bucket.conform(len,now);
+}
+
+void Switch::_unite(void *tPtr,const uint64_t now,const Address &source,const Address &destination,const SharedPtr<Peer> &relayTo)
+{
+	InetAddress destV4,destV6;
+	InetAddress sourceV4,sourceV6;
+	relayTo->getRendezvousAddresses(now,destV4,destV6);
+
+	const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
+	if (!sourcePeer)
+		return;
+	sourcePeer->getRendezvousAddresses(now,sourceV4,sourceV6);
+
+	// Hints go out for every family both sides have so dual stack peers punch both at once
+	const InetAddress *const hints[2][2] = { { &destV6,&sourceV6 },{ &destV4,&sourceV4 } };
+	for(unsigned int f=0;f<2;++f) {
+		if ((!(*hints[f][0]))||(!(*hints[f][1])))
+			continue;
+		unsigned int alt = (unsigned int)RR->node->prng() & 1; // randomize which hint we send first for obscure NAT-t reasons
+		const unsigned int completed = alt + 2;
+		while (alt != completed) {
+			if ((alt & 1) == 0)
+				_sendRendezvous(tPtr,source,destination,*hints[f][0]);
+			else _sendRendezvous(tPtr,destination,source,*hints[f][1]);
+			++alt;
+		}
+	}
+}
+
+void Switch::_sendRendezvous(void *tPtr,const Address &to,const Address &with,const InetAddress &at)
+{
+	Packet outp(to,RR->identity.address(),Packet::VERB_RENDEZVOUS);
+	outp.append((uint8_t)0);
+	with.appendTo(outp);
+	outp.append((uint16_t)at.port());
+	if (at.ss_family == AF_INET6) {
+		outp.append((uint8_t)16);
+		outp.append(at.rawIpData(),16);
+	} else {
+		outp.append((uint8_t)4);
+		outp.append(at.rawIpData(),4);
+	}
+	send(tPtr,outp,true);
+}
+
 bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address &destination)
 {
 	Mutex::Lock _l(_lastUniteAttempt_m);
@@ -677,26 +1068,175 @@ bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address
 	return false;
 }
 
-Address Switch::_sendWhoisRequest(void *tPtr,const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted)
+void Switch::_sendWhoisRequests(void *tPtr,const std::vector<Address> &addrs)
 {
-	SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer(peersAlreadyConsulted,numPeersAlreadyConsulted,false));
+	SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer());
 	if (upstream) {
-		Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
-		addr.appendTo(outp);
-		RR->node->expectReplyTo(outp.packetId());
-		send(tPtr,outp,true);
+		for(unsigned long i=0;i<addrs.size();) {
+			Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
+			for(unsigned int n=0;((n<ZT_WHOIS_MAX_BATCH)&&(i<addrs.size()));++n) {
+				ZT_PROBE_WHOIS_SEND(addrs[i].toInt(),upstream->address().toInt());
+				addrs[i++].appendTo(outp);
+			}
+			RR->node->expectReplyTo(outp.packetId());
+			RR->metrics->inc(Metrics::WHOIS_PACKETS);
+			send(tPtr,outp,true);
+		}
+		upstream->requestSent(RR->node->now());
+		_lastWhoisUpstream = upstream->address().toInt();
 	}
-	return Address();
 }
 
-bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
+void Switch::_enqueue(const Address &dest,const SharedPtr<Packet> &packet,bool encrypt,const uint32_t flowId,const unsigned int qosClass,const uint64_t nwid)
+{
+	TXQueueEntry e;
+	e.creationTime = RR->node->now();
+	e.nwid = nwid;
+	e.packet = packet;
+	e.flowId = flowId;
+	e.qosClass = qosClass;
+	e.encrypt = encrypt;
+	Mutex::Lock _l(_txQueue_m);
+	_txQueue[dest].push(e);
+}
+
+// Queues are taken out of _txQueue to be sent so that _txQueue_m is not
+// held across _trySend(), which can itself queue a WHOIS.
+bool Switch::_takeTXQueue(const Address &dest,TXQueue &q)
+{
+	Mutex::Lock _l(_txQueue_m);
+	TXQueue *const tq = _txQueue.get(dest);
+	if (!tq)
+		return false;
+	q = *tq;
+	_txQueue.erase(dest);
+	return true;
+}
+
+void Switch::_returnTXQueue(const Address &dest,TXQueue &q)
+{
+	Mutex::Lock _l(_txQueue_m);
+	TXQueue &tq = _txQueue[dest];
+	// Anything queued while q was out is newer, so it goes behind q
+	while (tq.count) {
+		q.push(tq.front());
+		tq.popFront();
+	}
+	tq = q;
+}
+
+// Sends queued packets in order until one can't be sent and returns how
+// many remain. Sending fails only for lack of a peer or path, which is the
+// same for every packet to this destination.
+unsigned int Switch::_flushTXQueue(void *tPtr,TXQueue &q)
+{
+	while (q.count) {
+		TXQueueEntry &e = q.front();
+		if (!_trySend(tPtr,*(e.packet),e.encrypt,e.flowId,e.qosClass,e.nwid))
+			break;
+		q.popFront();
+	}
+	return q.count;
+}
+
+uint32_t Switch::_frameFlowId(const MAC &from,const MAC &to,const unsigned int etherType,const uint8_t *data,const unsigned int len)
+{
+	// Hash the IP protocol, addresses and (for unfragmented TCP/UDP) ports,
+	// or just the MAC pair for anything that isn't IP.
+	uint64_t h = (from.toInt() * 0x9e3779b97f4a7c15ULL) ^ to.toInt();
+	unsigned int proto = 0,addrStart = 0,addrEnd = 0,ports = 0;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		proto = data[9];
+		addrStart = 12;
+		addrEnd = 20;
+		const unsigned int ihl = ((unsigned int)(data[0] & 0xf)) * 4;
+		if (((data[6] & 0x3f) == 0)&&(data[7] == 0)&&(ihl >= 20)&&(len >= (ihl + 4)))
+			ports = ihl;
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		proto = data[6];
+		addrStart = 8;
+		addrEnd = 40;
+		if (len >= 44)
+			ports = 40;
+	}
+	h = (h ^ (uint64_t)proto) * 0x100000001b3ULL;
+	for(unsigned int i=addrStart;i<addrEnd;++i)
+		h = (h ^ (uint64_t)data[i]) * 0x100000001b3ULL;
+	if ((ports)&&((proto == 6)||(proto == 17))) {
+		for(unsigned int i=ports;i<(ports + 4);++i)
+			h = (h ^ (uint64_t)data[i]) * 0x100000001b3ULL;
+	}
+	h ^= h >> 29;
+	const uint32_t fid = (uint32_t)(h ^ (h >> 32));
+	return (fid) ? fid : 1;
+}
+
+unsigned int Switch::_frameQosClass(const unsigned int etherType,const uint8_t *data,const unsigned int len)
+{
+	// Classify by DSCP: CS4 and up (video, voice, network control) is
+	// interactive, CS1 and LE are bulk, and everything else is normal. The
+	// ECN field goes along above the class.
+	unsigned int tc;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		tc = (unsigned int)data[1];
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		tc = (((unsigned int)data[0] & 0x0f) << 4) | ((unsigned int)data[1] >> 4);
+	} else return ZT_QOS_CLASS_NORMAL;
+	const unsigned int dscp = tc >> 2;
+	const unsigned int ecn = (tc & 3) << ZT_QOS_ECN_SHIFT;
+	if (dscp >= 32)
+		return (ZT_QOS_CLASS_INTERACTIVE | ecn);
+	if ((dscp == 8)||(dscp == 1))
+		return (ZT_QOS_CLASS_BULK | ecn);
+	return (ZT_QOS_CLASS_NORMAL | ecn);
+}
+
+bool Switch::markCongestion(const unsigned int etherType,uint8_t *data,const unsigned int len)
+{
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)&&((data[0] >> 4) == 4)) {
+		if ((data[1] & 3) == 0)
+			return false;
+		// Incremental checksum update for the word holding TOS (RFC 1624)
+		const uint32_t before = ((uint32_t)data[0] << 8) | (uint32_t)data[1];
+		data[1] |= 3;
+		const uint32_t after = ((uint32_t)data[0] << 8) | (uint32_t)data[1];
+		uint32_t sum = (~(((uint32_t)data[10] << 8) | (uint32_t)data[11]) & 0xffff) + (~before & 0xffff) + after;
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = (sum & 0xffff) + (sum >> 16);
+		data[10] = (uint8_t)((~sum >> 8) & 0xff);
+		data[11] = (uint8_t)(~sum & 0xff);
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)&&((data[0] >> 4) == 6)) {
+		if ((data[1] & 0x30) == 0)
+			return false;
+		data[1] |= 0x30;
+	}
+	return true;
+}
+
+bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt,const uint32_t flowId,unsigned int qosClass,const uint64_t nwid)
 {
 	SharedPtr<Path> viaPath;
+	bool direct = true; // false if relayed or via a path that isn't alive
 	const uint64_t now = RR->node->now();
 	const Address destination(packet.destination());
+	bool frame = true;
+	switch(packet.verb()) {
+		case Packet::VERB_FRAME:
+		case Packet::VERB_EXT_FRAME:
+		case Packet::VERB_MULTICAST_FRAME:
+		case Packet::VERB_USER_MESSAGE:
+			break;
+		default:
+			qosClass = ZT_QOS_CLASS_CONTROL;
+			frame = false;
+			break;
+	}
 
 	const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,destination));
 	if (peer) {
+		if (frame)
+			peer->frameSent(now);
+
 		/* First get the best path, and if it's dead (and this is not a root)
 		 * we attempt to re-activate that path but this packet will flow
 		 * upstream. If the path comes back alive, it will be used in the future.
@@ -704,21 +1244,42 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 		 * to send heartbeats "down" and because we have to at least try to
 		 * go somewhere. */
 
-		viaPath = peer->getBestPath(now,false);
+		if ((flowId)&&(RR->node->multipathMode()))
+			viaPath = peer->getFlowPath(now,flowId);
+		if (!viaPath)
+			viaPath = peer->getBestPath(now,false);
 		if ( (viaPath) && (!viaPath->alive(now)) && (!RR->topology->isUpstream(peer->identity())) ) {
 			if ((now - viaPath->lastOut()) > std::max((now - viaPath->lastIn()) * 4,(uint64_t)ZT_PATH_MIN_REACTIVATE_INTERVAL)) {
 				peer->attemptToContactAt(tPtr,viaPath->localSocket(),viaPath->address(),now,false,viaPath->nextOutgoingCounter());
 				viaPath->sent(now);
+				viaPath->probeSent(now);
 			}
 			viaPath.zero();
 		}
 
 		if (!viaPath) {
+			direct = false;
+			if (RR->cluster) {
+				const int memberId = RR->cluster->checkSendViaCluster(destination);
+				if (memberId >= 0) {
+					_sendViaCluster(tPtr,packet,peer,encrypt,memberId);
+					return true;
+				}
+			}
+
 			peer->tryMemorizedPath(tPtr,now); // periodically attempt memorized or statically defined paths, if any are known
 			const SharedPtr<Peer> relay(RR->topology->getUpstreamPeer());
-			if ( (!relay) || (!(viaPath = relay->getBestPath(now,false))) ) {
+			if (nwid)
+				viaPath = _memberRelayPath(tPtr,peer,relay,nwid,now);
+			if ( (!viaPath) && ( (!relay) || (!(viaPath = relay->getBestPath(now,false))) ) ) {
 				if (!(viaPath = peer->getBestPath(now,true)))
 					return false;
+			} else if ((relay)&&(relay != peer)&&(!RR->topology->amRoot())&&(peer->rateGateRendezvousRequest(now))) {
+				// Ask the relay to unite us now rather than when it gets around to it
+				Packet outp(relay->address(),RR->identity.address(),Packet::VERB_RENDEZVOUS);
+				outp.append((uint8_t)ZT_PROTO_VERB_RENDEZVOUS_FLAG_REQUEST);
+				destination.appendTo(outp);
+				send(tPtr,outp,true);
 			}
 		}
 	} else {
@@ -726,19 +1287,112 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 		return false; // if we are not in cluster mode, there is no way we can send without knowing the peer directly
 	}
 
-	unsigned int chunkSize = std::min(packet.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
+	// A frame's ECN field only goes out on a direct path to a peer that will
+	// pass marks on, since a relay or an older peer would lose them
+	if ((!direct)||(!RR->node->ecn())||(!peer->ecnEnabled()))
+		qosClass &= ZT_QOS_CLASS_MASK;
+
+	// The head goes out as large as the path MTU allows. Later fragments are
+	// kept to the default MTU, which is the most any receiver will accept.
+	if (packet.size() > ZT_UDP_DEFAULT_PAYLOAD_MTU)
+		viaPath->largePacketSent(now);
+	// With FEC on, datagrams are kept small enough for their parity to fit
+	// the default MTU too.
+	unsigned int chunkSize = std::min(packet.size(),(viaPath->fecActive(now)) ? (unsigned int)ZT_FEC_MAX_DATAGRAM : viaPath->mtu());
 	packet.setFragmented(chunkSize < packet.size());
 
-	const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(viaPath->address());
-	if (trustedPathId) {
-		packet.setTrusted(trustedPathId);
-	} else {
-		packet.armor(peer->key(),encrypt,viaPath->nextOutgoingCounter());
+	RR->ptrace->record(now,PacketTrace::EVENT_PACKET_SENT,PacketTrace::REASON_NONE,packet.packetId(),0,RR->identity.address().toInt(),destination.toInt(),(unsigned int)packet.verb(),0,packet.size());
+	peer->countOut(now,packet.size());
+
+	// Multicasts already armored with their network's group key go as they are
+	if (packet.cipher() != ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012) {
+		const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(viaPath->address());
+		if (trustedPathId) {
+			packet.setTrusted(trustedPathId);
+		} else {
+			// Frames go with a MAC but unencrypted directly over paths their network designates for it
+			if ((encrypt)&&(nwid)&&(direct)) {
+				const SharedPtr<Network> &network = RR->node->network(nwid);
+				if ((network)&&(network->config().authOnlyPath(viaPath->address())))
+					encrypt = false;
+			}
+			// Busy peers have their packets armored by worker threads and sent in order
+			const unsigned int counter = viaPath->nextOutgoingCounter();
+			if ((RR->cp)&&(RR->cp->outbound(RR,tPtr,peer,viaPath,packet,encrypt,counter,chunkSize,qosClass,now)))
+				return true;
+			Latency::Scope _ls(RR->latency,Latency::ARMOR);
+			if ((encrypt)&&(peer->aesGmacSivEnabled())) {
+				packet.armorAesGmacSiv(peer->aesKeys(),counter);
+			} else {
+				packet.armor(peer->key(),encrypt,counter,peer->keySchedule());
+			}
+		}
 	}
 
-	if (viaPath->send(RR,tPtr,packet.data(),chunkSize,now)) {
+	_sendArmored(tPtr,viaPath,packet,chunkSize,now,qosClass,destination);
+	return true;
+}
+
+void Switch::_sendArmored(void *tPtr,const SharedPtr<Path> &viaPath,const Packet &packet,unsigned int chunkSize,const uint64_t now,const unsigned int qosClass,const Address &destination)
+{
+	const bool fec = viaPath->fecActive(now);
+	Node::SendBatch _sb(RR->node,tPtr,((chunkSize < packet.size())||(fec)));
+	if (_egressSend(tPtr,viaPath,packet.data(),chunkSize,now,qosClass,destination)) {
+		if (fec)
+			_fecCover(tPtr,viaPath,packet.data(),chunkSize,now,qosClass,destination);
+		if (chunkSize < packet.size()) {
+			// Too big for one packet, fragment the rest. Fragments are no larger
+			// than the head, which is smaller than the default MTU only with FEC
+			// on, unless that would take too many fragments.
+			unsigned int fragStart = chunkSize;
+			unsigned int remaining = packet.size() - chunkSize;
+			unsigned int fragMax = std::min(chunkSize,(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU) - ZT_PROTO_MIN_FRAGMENT_LENGTH;
+			if (((remaining + fragMax - 1) / fragMax) >= ZT_MAX_PACKET_FRAGMENTS)
+				fragMax = ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH;
+			unsigned int fragsRemaining = (remaining / fragMax);
+			if ((fragsRemaining * fragMax) < remaining)
+				++fragsRemaining;
+			const unsigned int totalFragments = fragsRemaining + 1;
+
+			for(unsigned int fno=1;fno<totalFragments;++fno) {
+				chunkSize = std::min(remaining,fragMax);
+				Packet::Fragment frag(packet,fragStart,chunkSize,fno,totalFragments);
+				_egressSend(tPtr,viaPath,frag.data(),frag.size(),now,qosClass,destination);
+				if (fec)
+					_fecCover(tPtr,viaPath,frag.data(),frag.size(),now,qosClass,destination);
+				fragStart += chunkSize;
+				remaining -= chunkSize;
+			}
+		}
+	}
+}
+
+void Switch::_fecCover(void *tPtr,const SharedPtr<Path> &viaPath,const void *data,unsigned int len,const uint64_t now,const unsigned int qosClass,const Address &destination)
+{
+	uint8_t parity[ZT_UDP_DEFAULT_PAYLOAD_MTU];
+	const unsigned int plen = viaPath->fecEncode(data,len,RR->identity.address(),parity);
+	if (plen) {
+		_egressSend(tPtr,viaPath,parity,plen,now,qosClass,destination);
+		RR->metrics->inc(Metrics::FEC_PARITY_SENT);
+	}
+}
+
+void Switch::_sendViaCluster(void *tPtr,Packet &packet,const SharedPtr<Peer> &peer,bool encrypt,int memberId)
+{
+	// There's no path of ours to take an MTU or counter from, so this goes
+	// out at the default MTU like any packet on an unknown path.
+	if (packet.cipher() != ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012) {
+		if ((encrypt)&&(peer->aesGmacSivEnabled())) {
+			packet.armorAesGmacSiv(peer->aesKeys(),0);
+		} else {
+			packet.armor(peer->key(),encrypt,0,peer->keySchedule());
+		}
+	}
+
+	unsigned int chunkSize = std::min(packet.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
+	packet.setFragmented(chunkSize < packet.size());
+	if (RR->cluster->sendViaCluster(tPtr,memberId,packet.data(),chunkSize)) {
 		if (chunkSize < packet.size()) {
-			// Too big for one packet, fragment the rest
 			unsigned int fragStart = chunkSize;
 			unsigned int remaining = packet.size() - chunkSize;
 			unsigned int fragsRemaining = (remaining / (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
@@ -749,13 +1403,45 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 			for(unsigned int fno=1;fno<totalFragments;++fno) {
 				chunkSize = std::min(remaining,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
 				Packet::Fragment frag(packet,fragStart,chunkSize,fno,totalFragments);
-				viaPath->send(RR,tPtr,frag.data(),frag.size(),now);
+				RR->cluster->sendViaCluster(tPtr,memberId,frag.data(),frag.size());
 				fragStart += chunkSize;
 				remaining -= chunkSize;
 			}
 		}
 	}
+}
+
+void Switch::_setEgressBucket(uint64_t now)
+{
+	const uint64_t burst = (_egressLimit * ((_egressPacing) ? ZT_QOS_PACED_BURST_MS : ZT_QOS_BURST_MS)) / 1000;
+	_egressBucket.set(_egressLimit,std::max(burst,(uint64_t)(ZT_PROTO_MAX_PACKET_LENGTH)),now);
+}
+
+bool Switch::_egressSend(void *tPtr,const SharedPtr<Path> &path,const void *data,unsigned int len,uint64_t now,unsigned int qosClass,const Address &peer)
+{
+	const unsigned int ecn = qosClass >> ZT_QOS_ECN_SHIFT;
+	if (!_egressLimit)
+		return path->send(RR,tPtr,data,len,now,ecn);
+
+	{
+		Mutex::Lock _l(_egress_m);
+		if ((!_egress.empty())||(!_egressBucket.conform(len,now))) {
+			_EgressPacket p;
+			p.path = path;
+			p.data.assign(reinterpret_cast<const char *>(data),len);
+			p.ecn = ecn;
+			if (!_egress.enqueue(qosClass & ZT_QOS_CLASS_MASK,peer,p,len)) {
+				RR->metrics->inc(Metrics::QOS_DROPPED);
+				return false;
+			}
+			RR->metrics->inc(Metrics::QOS_QUEUED);
+			data = (const void *)0;
+		}
+	}
 
+	if (data)
+		return path->send(RR,tPtr,data,len,now,ecn);
+	drainEgress(tPtr,now); // the bucket may have refilled for what's ahead of this
 	return true;
 }
 
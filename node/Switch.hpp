@@ -45,6 +45,13 @@
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
 #include "Hashtable.hpp"
+#include "FlatHashtable.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Metrics.hpp"
+#include "MemoryUsage.hpp"
+#include "EgressScheduler.hpp"
+#include "TokenBucket.hpp"
+#include "HugePages.hpp"
 
 namespace ZeroTier {
 
@@ -61,9 +68,17 @@ class Peer;
  */
 class Switch : NonCopyable
 {
+	friend class CryptoPipeline;
+
 public:
 	Switch(const RuntimeEnvironment *renv);
 
+	/**
+	 * Allocate from the HugePages arena if there is one
+	 */
+	static inline void *operator new(size_t sz) { return HugePages::allocate(sz); }
+	static inline void operator delete(void *p,size_t sz) { HugePages::free(p,sz); }
+
 	/**
 	 * Called when a packet is received from the real network
 	 *
@@ -72,8 +87,9 @@ public:
 	 * @param fromAddr Internet IP address of origin
 	 * @param data Packet data
 	 * @param len Packet length
+	 * @param ecn IP ECN field the packet arrived with, or 0 if not known
 	 */
-	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len);
+	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len,const unsigned int ecn = 0);
 
 	/**
 	 * Called when a packet comes from a local Ethernet tap
@@ -89,6 +105,22 @@ public:
 	 */
 	void onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
 
+	/**
+	 * Pass a congestion experienced mark on to the IP header of a frame
+	 *
+	 * This decapsulates ECN as in RFC 6040 for a frame that arrived in a
+	 * packet marked CE. An ECN-capable IPv4 or IPv6 header is marked CE, with
+	 * the IPv4 header checksum updated to match. A frame that is IP but not
+	 * ECN-capable can't carry the mark, so it should be dropped, which is
+	 * what a router would have done. Other frames are left alone.
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload, modified in place
+	 * @param len Length of frame payload
+	 * @return False if the frame should be dropped
+	 */
+	static bool markCongestion(const unsigned int etherType,uint8_t *data,const unsigned int len);
+
 	/**
 	 * Send a packet to a ZeroTier address (destination in packet)
 	 *
@@ -105,25 +137,87 @@ public:
 	 * @param packet Packet to send (buffer may be modified)
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
 	 */
-	void send(void *tPtr,Packet &packet,bool encrypt);
+	inline void send(void *tPtr,Packet &packet,bool encrypt) { send(tPtr,packet,encrypt,0); }
+
+	/**
+	 * Send a packet belonging to a flow
+	 *
+	 * In multipath mode all packets with the same non-zero flow ID go over
+	 * the same path to the destination peer. A flow ID of zero means the
+	 * packet isn't part of any flow and takes the best path.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param packet Packet to send (buffer may be modified)
+	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param flowId Flow ID or 0 for none
+	 * @param qosClass Traffic class if this is a data packet (control verbs are always ZT_QOS_CLASS_CONTROL)
+	 * @param nwid Network if this is a frame, which is then not encrypted over that network's authenticated-only paths (0 for none)
+	 */
+	void send(void *tPtr,Packet &packet,bool encrypt,const uint32_t flowId,const unsigned int qosClass = ZT_QOS_CLASS_NORMAL,const uint64_t nwid = 0);
+
+	/**
+	 * Send a pooled packet, queueing the handle itself if it can't be sent yet
+	 *
+	 * This avoids the copy send() makes when it must queue. The caller must
+	 * not touch the packet after this call.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param packet Packet to send (buffer may be modified)
+	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param nwid Network if this is a frame, which is then not encrypted over that network's authenticated-only paths (0 for none)
+	 */
+	void send(void *tPtr,const SharedPtr<Packet> &packet,bool encrypt,const uint64_t nwid = 0);
 
 	/**
 	 * Request WHOIS on a given address
 	 *
+	 * Lookups made within ZT_WHOIS_BATCH_WINDOW of each other are sent
+	 * together in one WHOIS packet. Lookups left waiting are sent by
+	 * flushWhoisRequests() or doTimerTasks().
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param addr Address to look up
 	 */
 	void requestWhois(void *tPtr,const Address &addr);
 
+	/**
+	 * Request WHOIS on a given address and answer a peer's WHOIS for it once known
+	 *
+	 * Roots and moons use this for addresses they can't answer for yet, so
+	 * the requester gets an OK(WHOIS) as soon as the identity arrives rather
+	 * than waiting out its retry delay and asking elsewhere. At most
+	 * ZT_WHOIS_MAX_DEFERRED_REPLIES requesters are remembered per address.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param addr Address to look up
+	 * @param requester Peer that asked us
+	 * @param inRePacketId Packet ID of its WHOIS
+	 */
+	void requestWhois(void *tPtr,const Address &addr,const Address &requester,const uint64_t inRePacketId);
+
 	/**
 	 * Run any processes that are waiting for this peer's identity
 	 *
 	 * Called when we learn of a peer's identity from HELLO, OK(WHOIS), etc.
+	 * Anything found waiting promotes the identity to a full Peer via
+	 * Topology::getPeer().
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param addr Address of newly known peer
+	 */
+	void doAnythingWaitingForPeer(void *tPtr,const Address &addr);
+
+	/**
+	 * Unite a peer with another at its request
+	 *
+	 * This is subject to the same per pair rate limit as uniting peers
+	 * whose traffic we relay, and is only done if the other peer is online.
 	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
-	 * @param peer New peer
+	 * @param source Peer that asked
+	 * @param destination Peer it wants a direct path to
 	 */
-	void doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer);
+	void rendezvousRequested(void *tPtr,const Address &source,const Address &destination);
 
 	/**
 	 * Perform retries and other periodic timer tasks
@@ -137,10 +231,98 @@ public:
 	 */
 	unsigned long doTimerTasks(void *tPtr,uint64_t now);
 
+	/**
+	 * Send waiting WHOIS lookups if their batch window has closed
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Time by which lookups still waiting must be sent, or 0 if none are
+	 */
+	uint64_t flushWhoisRequests(void *tPtr,uint64_t now);
+
+	/**
+	 * Get RX queue (fragment reassembly) eviction statistics
+	 *
+	 * @param evicted Set to number of in-progress entries replaced by newer packets
+	 * @param expired Set to number of incomplete entries that timed out
+	 */
+	void rxQueueStats(uint64_t &evicted,uint64_t &expired);
+
+	/**
+	 * Add packet queues and pending WHOIS lookups to a memory usage snapshot
+	 *
+	 * The RX queue is a fixed array, so its bytes are the same whatever its
+	 * count of packets in progress.
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
+	/**
+	 * Set a cap on outgoing bandwidth
+	 *
+	 * With a cap, packets we originate that exceed it wait in per-class
+	 * and per-peer queues and go out paced to the cap, control traffic
+	 * first. Without one everything goes straight to the wire. Relayed
+	 * traffic is not subject to this.
+	 *
+	 * @param bytesPerSecond Cap in bytes per second or 0 for none
+	 * @param now Current time
+	 */
+	void setEgressLimit(uint64_t bytesPerSecond,uint64_t now);
+
+	/**
+	 * Set whether a cap paces packets out evenly instead of in bursts
+	 *
+	 * Normally a cap lets ZT_QOS_BURST_MS worth of packets go at once, which
+	 * is friendlier to the CPU. Pacing shrinks that to ZT_QOS_PACED_BURST_MS
+	 * so bulk sends like fragment trains and multicast fanout reach a shallow
+	 * uplink buffer spread out rather than all together.
+	 *
+	 * @param pace If true, pace packets under a cap
+	 * @param now Current time
+	 */
+	void setEgressPacing(bool pace,uint64_t now);
+
+	/**
+	 * Set the rate at which we'll relay packets from or to any one peer
+	 *
+	 * Each peer has a token bucket and a packet is relayed only if both its
+	 * source and its destination have tokens for it. Fragments carry no
+	 * source and are charged to their destination only.
+	 *
+	 * @param bytesPerSecond Limit in bytes per second or 0 for none
+	 */
+	inline void setRelayLimit(uint64_t bytesPerSecond) { _relayLimit = bytesPerSecond; }
+
+	/**
+	 * Send as many queued outgoing packets as the bandwidth cap allows
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Time at which more can be sent, or 0 if nothing is queued
+	 */
+	uint64_t drainEgress(void *tPtr,uint64_t now);
+
 private:
+	void _relay(void *tPtr,const SharedPtr<Path> &path,const Address &destination,const void *data,unsigned int len,const bool isFragment,const uint64_t now);
+	bool _relayRateGate(const Address &peer,const unsigned int len,const uint64_t now);
+	bool _resolveLocally(const SharedPtr<Network> &network,const InetAddress &ip,MAC &mac);
+	void _sendNeighborAdvertisement(void *tPtr,const SharedPtr<Network> &network,const MAC &targetMac,const MAC &to,const uint8_t *target6,const uint8_t *dest6);
+	void _unite(void *tPtr,const uint64_t now,const Address &source,const Address &destination,const SharedPtr<Peer> &relayTo);
+	void _sendRendezvous(void *tPtr,const Address &to,const Address &with,const InetAddress &at);
 	bool _shouldUnite(const uint64_t now,const Address &source,const Address &destination);
-	Address _sendWhoisRequest(void *tPtr,const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted);
-	bool _trySend(void *tPtr,Packet &packet,bool encrypt); // packet is modified if return is true
+	void _sendWhoisRequests(void *tPtr,const std::vector<Address> &addrs);
+	bool _trySend(void *tPtr,Packet &packet,bool encrypt,const uint32_t flowId,const unsigned int qosClass,const uint64_t nwid); // packet is modified if return is true
+	SharedPtr<Path> _memberRelayPath(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Peer> &upstream,const uint64_t nwid,const uint64_t now); // path to a network's relay that reaches peer faster than upstream, or NULL
+	void _sendArmored(void *tPtr,const SharedPtr<Path> &viaPath,const Packet &packet,unsigned int chunkSize,const uint64_t now,const unsigned int qosClass,const Address &destination);
+	void _fecCover(void *tPtr,const SharedPtr<Path> &viaPath,const void *data,unsigned int len,const uint64_t now,const unsigned int qosClass,const Address &destination);
+	void _receiveDatagram(void *tPtr,const SharedPtr<Path> &path,const void *data,unsigned int len,const uint64_t now,const bool repaired,const bool ce);
+	bool _egressSend(void *tPtr,const SharedPtr<Path> &path,const void *data,unsigned int len,uint64_t now,unsigned int qosClass,const Address &peer);
+	void _setEgressBucket(uint64_t now);
+	void _sendViaCluster(void *tPtr,Packet &packet,const SharedPtr<Peer> &peer,bool encrypt,int memberId);
+	static uint32_t _frameFlowId(const MAC &from,const MAC &to,const unsigned int etherType,const uint8_t *data,const unsigned int len);
+	static unsigned int _frameQosClass(const unsigned int etherType,const uint8_t *data,const unsigned int len);
 
 	const RuntimeEnvironment *const RR;
 	uint64_t _lastBeaconResponse;
@@ -148,13 +330,22 @@ private:
 	// Outstanding WHOIS requests and how many retries they've undergone
 	struct WhoisRequest
 	{
-		WhoisRequest() : lastSent(0),retries(0) {}
+		WhoisRequest() : started(0),lastSent(0),retries(0) {}
+		uint64_t started;
 		uint64_t lastSent;
-		Address peersConsulted[ZT_MAX_WHOIS_RETRIES]; // by retry
 		unsigned int retries; // 0..ZT_MAX_WHOIS_RETRIES
 	};
-	Hashtable< Address,WhoisRequest > _outstandingWhoisRequests;
-	Mutex _outstandingWhoisRequests_m;
+	FlatHashtable< Address,WhoisRequest > _outstandingWhoisRequests;
+	std::vector<Address> _pendingWhois; // new lookups waiting for the batch window to close
+	uint64_t _lastWhoisSent;
+	struct WhoisRequester
+	{
+		Address requester;
+		uint64_t inRePacketId;
+	};
+	Hashtable< Address,std::vector<WhoisRequester> > _whoisRequesters; // peers to answer once an outstanding WHOIS resolves (roots only)
+	Mutex _outstandingWhoisRequests_m; // also guards _pendingWhois, _lastWhoisSent and _whoisRequesters
+	volatile uint64_t _lastWhoisUpstream; // address of upstream last sent a WHOIS, or 0
 
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry
@@ -162,50 +353,120 @@ private:
 		RXQueueEntry() : timestamp(0) {}
 		uint64_t timestamp; // 0 if entry is not in use
 		uint64_t packetId;
-		IncomingPacket frag0; // head of packet
-		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments (if any)
+		SharedPtr<IncomingPacket> frag0; // head of packet (buffer is kept and reused with the entry)
+		uint8_t frags[ZT_MAX_PACKET_FRAGMENTS - 1][ZT_UDP_DEFAULT_PAYLOAD_MTU]; // payloads of later fragments (if any)
+		unsigned int fragLengths[ZT_MAX_PACKET_FRAGMENTS - 1];
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments; // bit mask, LSB to MSB
 		bool complete; // if true, packet is complete
+		bool ce; // if true, some datagram of the packet arrived marked congestion experienced
+	};
+
+	// Set of entries for packet IDs that hash to the same bucket
+	struct RXQueueBucket
+	{
+		RXQueueBucket() : evicted(0),expired(0) {}
+		RXQueueEntry e[ZT_RX_QUEUE_WAYS];
+		uint64_t evicted; // live entries replaced by a new packet
+		uint64_t expired; // incomplete entries that timed out
+		Mutex lock;
 	};
-	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
-	Mutex _rxQueue_m;
+	RXQueueBucket _rxQueue[ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_WAYS];
+	uint64_t _rxQueueSalt;
+
+	inline RXQueueBucket &_rxQueueBucket(uint64_t packetId)
+	{
+		// Packet IDs are chosen by senders, so salt them before picking a bucket
+		return _rxQueue[(unsigned long)(((packetId ^ _rxQueueSalt) * 0x9e3779b97f4a7c15ULL) >> 32) & ((ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_WAYS) - 1)];
+	}
+
+	// Stores a packet head in an RX queue entry, reusing its buffer if it has one
+	inline void _initRXQueueHead(RXQueueEntry *rq,const void *data,unsigned int len,const SharedPtr<Path> &path,uint64_t now)
+	{
+		if (!rq->frag0)
+			rq->frag0 = SharedPtr<IncomingPacket>(new IncomingPacket());
+		rq->frag0->init(data,len,path,now);
+	}
 
-	/* Returns the matching or oldest entry. Caller must check timestamp and
-	 * packet ID to determine which. */
-	inline RXQueueEntry *_findRXQueueEntry(uint64_t now,uint64_t packetId)
+	// Appends the payloads of fragments 1..totalFragments-1 to the head
+	inline void _assembleRXQueueEntry(RXQueueEntry *rq)
 	{
-		RXQueueEntry *rq;
-		RXQueueEntry *oldest = &(_rxQueue[ZT_RX_QUEUE_SIZE - 1]);
-		unsigned long i = ZT_RX_QUEUE_SIZE;
-		while (i) {
-			rq = &(_rxQueue[--i]);
-			if ((rq->packetId == packetId)&&(rq->timestamp))
-				return rq;
-			if ((now - rq->timestamp) >= ZT_RX_QUEUE_EXPIRE)
-				rq->timestamp = 0;
+		for(unsigned int f=1;f<rq->totalFragments;++f)
+			rq->frag0->append(rq->frags[f - 1],rq->fragLengths[f - 1]);
+		if (rq->ce)
+			rq->frag0->setCongestionExperienced();
+	}
+
+	/* Returns the matching, a free, or the oldest entry in a bucket. Caller
+	 * must hold the bucket's lock and check timestamp and packet ID to
+	 * determine which. */
+	inline RXQueueEntry *_findRXQueueEntry(RXQueueBucket &b,uint64_t now,uint64_t packetId)
+	{
+		RXQueueEntry *oldest = &(b.e[0]);
+		for(unsigned int i=0;i<ZT_RX_QUEUE_WAYS;++i) {
+			RXQueueEntry *const rq = &(b.e[i]);
+			if (rq->timestamp) {
+				if (rq->packetId == packetId)
+					return rq;
+				if ((now - rq->timestamp) >= ZT_RX_QUEUE_EXPIRE) {
+					if (!rq->complete) {
+						++b.expired;
+						RR->metrics->inc(Metrics::FRAGMENT_REASSEMBLY_EXPIRED);
+					}
+					rq->timestamp = 0;
+				}
+			}
 			if (rq->timestamp < oldest->timestamp)
 				oldest = rq;
 		}
+		if (oldest->timestamp) {
+			++b.evicted;
+			RR->metrics->inc(Metrics::RX_QUEUE_EVICTED);
+		}
 		return oldest;
 	}
 
-	// ZeroTier-layer TX queue entry
+	// ZeroTier-layer TX queue: a bounded ring of packets per destination, so
+	// that resolving one peer only touches its own packets
 	struct TXQueueEntry
 	{
-		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
-			dest(d),
-			creationTime(ct),
-			packet(p),
-			encrypt(enc) {}
-
-		Address dest;
+		TXQueueEntry() : creationTime(0),nwid(0),flowId(0),qosClass(ZT_QOS_CLASS_NORMAL),encrypt(false) {}
+
 		uint64_t creationTime;
-		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
+		uint64_t nwid;
+		SharedPtr<Packet> packet; // unencrypted/unMAC'd packet -- this is done at send time
+		uint32_t flowId;
+		unsigned int qosClass;
 		bool encrypt;
 	};
-	std::list< TXQueueEntry > _txQueue;
+	struct TXQueue
+	{
+		TXQueue() : head(0),count(0) {}
+
+		inline TXQueueEntry &front() { return q[head]; }
+		inline void popFront()
+		{
+			q[head].packet.zero();
+			head = (head + 1) % ZT_TX_QUEUE_PER_DESTINATION;
+			--count;
+		}
+		inline void push(const TXQueueEntry &e)
+		{
+			if (count >= ZT_TX_QUEUE_PER_DESTINATION)
+				popFront(); // drop oldest
+			q[(head + count) % ZT_TX_QUEUE_PER_DESTINATION] = e;
+			++count;
+		}
+
+		TXQueueEntry q[ZT_TX_QUEUE_PER_DESTINATION];
+		unsigned int head;
+		unsigned int count;
+	};
+	void _enqueue(const Address &dest,const SharedPtr<Packet> &packet,bool encrypt,const uint32_t flowId,const unsigned int qosClass,const uint64_t nwid);
+	bool _takeTXQueue(const Address &dest,TXQueue &q);
+	void _returnTXQueue(const Address &dest,TXQueue &q);
+	unsigned int _flushTXQueue(void *tPtr,TXQueue &q);
+	Hashtable< Address,TXQueue > _txQueue;
 	Mutex _txQueue_m;
 
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
@@ -228,6 +489,30 @@ private:
 	};
 	Hashtable< _LastUniteKey,uint64_t > _lastUniteAttempt; // key is always sorted in ascending order, for set-like behavior
 	Mutex _lastUniteAttempt_m;
+
+	// Per-peer relay token buckets
+	struct _RelayLimit
+	{
+		_RelayLimit() : address(0) {}
+		uint64_t address;
+		TokenBucket bucket;
+		Mutex lock;
+	};
+	_RelayLimit _relayLimits[ZT_RELAY_RATE_LIMIT_SLOTS];
+	volatile uint64_t _relayLimit;
+
+	// Egress pacing, only used when a bandwidth cap is set
+	struct _EgressPacket
+	{
+		SharedPtr<Path> path;
+		std::string data; // armored wire packet or fragment
+		unsigned int ecn;
+	};
+	EgressScheduler<_EgressPacket> _egress;
+	TokenBucket _egressBucket;
+	volatile uint64_t _egressLimit; // mirrors _egressBucket's rate, read without the lock
+	bool _egressPacing;
+	Mutex _egress_m;
 };
 
 } // namespace ZeroTier
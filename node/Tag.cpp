@@ -30,6 +30,7 @@
 #include "Topology.hpp"
 #include "Switch.hpp"
 #include "Network.hpp"
+#include "SignatureBatch.hpp"
 
 namespace ZeroTier {
 
@@ -45,10 +46,24 @@ int Tag::verify(const RuntimeEnvironment *RR,void *tPtr) const
 	try {
 		Buffer<(sizeof(Tag) * 2)> tmp;
 		this->serialize(tmp,true);
-		return (id.verify(tmp.data(),tmp.size(),_signature) ? 0 : -1);
+		return (RR->sc->verify(id,tmp.data(),tmp.size(),_signature) ? 0 : -1);
 	} catch ( ... ) {
 		return -1;
 	}
 }
 
+void Tag::addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const
+{
+	if ((!_signedBy)||(_signedBy != Network::controllerFor(_networkId)))
+		return;
+	const Identity id(RR->topology->getIdentity(tPtr,_signedBy));
+	if (id) {
+		try {
+			Buffer<(sizeof(Tag) * 2)> tmp;
+			this->serialize(tmp,true);
+			batch.add(id,tmp.data(),tmp.size(),_signature);
+		} catch ( ... ) {}
+	}
+}
+
 } // namespace ZeroTier
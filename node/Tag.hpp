@@ -39,9 +39,21 @@
 #include "Identity.hpp"
 #include "Buffer.hpp"
 
+/**
+ * Wire layout of the fixed-size head of a tag, ahead of its signature
+ */
+#define ZT_TAG_WIRE_IDX_NETWORK_ID 0
+#define ZT_TAG_WIRE_IDX_TIMESTAMP 8
+#define ZT_TAG_WIRE_IDX_ID 16
+#define ZT_TAG_WIRE_IDX_VALUE 20
+#define ZT_TAG_WIRE_IDX_ISSUED_TO 24
+#define ZT_TAG_WIRE_IDX_SIGNED_BY (ZT_TAG_WIRE_IDX_ISSUED_TO + ZT_ADDRESS_LENGTH)
+#define ZT_TAG_WIRE_HEAD_LENGTH (ZT_TAG_WIRE_IDX_SIGNED_BY + ZT_ADDRESS_LENGTH)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * A tag that can be associated with members and matched in rules
@@ -121,23 +133,31 @@ public:
 	 */
 	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
 
+	/**
+	 * Add this tag's signature to a batch if the signer is known
+	 *
+	 * This only makes a later verify() cheaper and does not replace it.
+	 *
+	 * @param RR Runtime environment to allow identity lookup for signers
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch Batch to add to
+	 */
+	void addToBatch(const RuntimeEnvironment *RR,void *tPtr,SignatureBatch &batch) const;
+
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
 	{
 		if (forSign) b.append((uint64_t)0x7f7f7f7f7f7f7f7fULL);
 
-		b.append(_networkId);
-		b.append(_ts);
-		b.append(_id);
-		b.append(_value);
-
-		_issuedTo.appendTo(b);
-		_signedBy.appendTo(b);
-		if (!forSign) {
-			b.append((uint8_t)1); // 1 == Ed25519
-			b.append((uint16_t)ZT_C25519_SIGNATURE_LEN); // length of signature
-			b.append(_signature.data,ZT_C25519_SIGNATURE_LEN);
-		}
+		uint8_t *const h = reinterpret_cast<uint8_t *>(b.appendField(ZT_TAG_WIRE_HEAD_LENGTH));
+		Utils::storeBigEndian<uint64_t>(h + ZT_TAG_WIRE_IDX_NETWORK_ID,_networkId);
+		Utils::storeBigEndian<uint64_t>(h + ZT_TAG_WIRE_IDX_TIMESTAMP,_ts);
+		Utils::storeBigEndian<uint32_t>(h + ZT_TAG_WIRE_IDX_ID,_id);
+		Utils::storeBigEndian<uint32_t>(h + ZT_TAG_WIRE_IDX_VALUE,_value);
+		_issuedTo.copyTo(h + ZT_TAG_WIRE_IDX_ISSUED_TO,ZT_ADDRESS_LENGTH);
+		_signedBy.copyTo(h + ZT_TAG_WIRE_IDX_SIGNED_BY,ZT_ADDRESS_LENGTH);
+		if (!forSign)
+			_appendSignature(b,_signature);
 
 		b.append((uint16_t)0); // length of additional fields, currently 0
 
@@ -151,22 +171,14 @@ public:
 
 		memset(this,0,sizeof(Tag));
 
-		_networkId = b.template at<uint64_t>(p); p += 8;
-		_ts = b.template at<uint64_t>(p); p += 8;
-		_id = b.template at<uint32_t>(p); p += 4;
-
-		_value = b.template at<uint32_t>(p); p += 4;
-
-		_issuedTo.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		_signedBy.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
-		if (b[p++] == 1) {
-			if (b.template at<uint16_t>(p) != ZT_C25519_SIGNATURE_LEN)
-				throw ZT_EXCEPTION_INVALID_SERIALIZED_DATA_INVALID_CRYPTOGRAPHIC_TOKEN;
-			p += 2;
-			memcpy(_signature.data,b.field(p,ZT_C25519_SIGNATURE_LEN),ZT_C25519_SIGNATURE_LEN); p += ZT_C25519_SIGNATURE_LEN;
-		} else {
-			p += 2 + b.template at<uint16_t>(p);
-		}
+		const uint8_t *const h = b.field(p,ZT_TAG_WIRE_HEAD_LENGTH);
+		_networkId = Utils::loadBigEndian<uint64_t>(h + ZT_TAG_WIRE_IDX_NETWORK_ID);
+		_ts = Utils::loadBigEndian<uint64_t>(h + ZT_TAG_WIRE_IDX_TIMESTAMP);
+		_id = Utils::loadBigEndian<uint32_t>(h + ZT_TAG_WIRE_IDX_ID);
+		_value = Utils::loadBigEndian<uint32_t>(h + ZT_TAG_WIRE_IDX_VALUE);
+		_issuedTo.setTo(h + ZT_TAG_WIRE_IDX_ISSUED_TO,ZT_ADDRESS_LENGTH);
+		_signedBy.setTo(h + ZT_TAG_WIRE_IDX_SIGNED_BY,ZT_ADDRESS_LENGTH);
+		p = _readSignature(b,p + ZT_TAG_WIRE_HEAD_LENGTH,_signature);
 
 		p += 2 + b.template at<uint16_t>(p);
 		if (p > b.size())
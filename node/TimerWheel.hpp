@@ -0,0 +1,186 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TIMERWHEEL_HPP
+#define ZT_TIMERWHEEL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * Bits of slot index per wheel level (64 slots per level)
+ */
+#define ZT_TIMERWHEEL_SLOT_BITS 6
+#define ZT_TIMERWHEEL_SLOTS (1 << ZT_TIMERWHEEL_SLOT_BITS)
+
+/**
+ * Number of levels, each covering 64 times the span of the one below it
+ */
+#define ZT_TIMERWHEEL_LEVELS 3
+
+namespace ZeroTier {
+
+/**
+ * Hierarchical timer wheel
+ *
+ * Entries are kept in slots by deadline so that advancing the wheel only
+ * touches entries that are due, plus an occasional cascade of a higher
+ * level slot into the one below. Adding an entry is constant time. With a
+ * tick of T the levels cover 64T, 4096T and 262144T; anything later waits
+ * in the top level and is placed again as it gets closer.
+ *
+ * There is no removal. Users that reschedule should recognize and skip
+ * stale entries when they come due.
+ *
+ * This is not thread safe.
+ *
+ * @tparam V Type of value stored with each deadline
+ */
+template<typename V>
+class TimerWheel
+{
+private:
+	struct _Entry
+	{
+		_Entry(const uint64_t t,const V &v) : tick(t),value(v) {}
+		uint64_t tick;
+		V value;
+	};
+
+public:
+	/**
+	 * @param tickMs Resolution of deadlines in milliseconds
+	 * @param now Current time
+	 */
+	TimerWheel(const uint64_t tickMs,const uint64_t now) :
+		_tickMs(tickMs),
+		_tick(now / tickMs),
+		_size(0)
+	{
+	}
+
+	/**
+	 * Add an entry
+	 *
+	 * Deadlines in the past are due at the next tick.
+	 *
+	 * @param deadline Time at or after which this entry is due
+	 * @param v Value
+	 */
+	inline void add(const uint64_t deadline,const V &v)
+	{
+		const uint64_t t = (deadline + _tickMs - 1) / _tickMs;
+		_place(_Entry((t > _tick) ? t : (_tick + 1),v));
+		++_size;
+	}
+
+	/**
+	 * Advance to the current time and collect due entries
+	 *
+	 * @param now Current time
+	 * @param due Values of entries now due are appended here
+	 */
+	inline void advance(const uint64_t now,std::vector<V> &due)
+	{
+		const uint64_t target = now / _tickMs;
+		if ((target - _tick) >= (1ULL << (ZT_TIMERWHEEL_SLOT_BITS * (ZT_TIMERWHEEL_LEVELS - 1)))) {
+			// After a long stall (e.g. system sleep) stepping tick by tick through
+			// mostly empty slots costs more than sorting everything out again
+			std::vector<_Entry> all;
+			all.reserve(_size);
+			for(unsigned int l=0;l<ZT_TIMERWHEEL_LEVELS;++l) {
+				for(unsigned int s=0;s<ZT_TIMERWHEEL_SLOTS;++s) {
+					std::vector<_Entry> &slot = _slots[l][s];
+					all.insert(all.end(),slot.begin(),slot.end());
+					slot.clear();
+				}
+			}
+			_tick = target;
+			for(typename std::vector<_Entry>::const_iterator e(all.begin());e!=all.end();++e) {
+				if (e->tick <= _tick) {
+					due.push_back(e->value);
+					--_size;
+				} else {
+					_place(*e);
+				}
+			}
+			return;
+		}
+
+		while (_tick < target) {
+			++_tick;
+
+			// Cascade the next higher level slot whenever a lower level wraps,
+			// top level first so its entries can fall more than one level
+			for(unsigned int l=ZT_TIMERWHEEL_LEVELS-1;l>0;--l) {
+				if ((_tick & ((1ULL << (ZT_TIMERWHEEL_SLOT_BITS * l)) - 1)) == 0) {
+					std::vector<_Entry> c;
+					c.swap(_slots[l][(_tick >> (ZT_TIMERWHEEL_SLOT_BITS * l)) & (ZT_TIMERWHEEL_SLOTS - 1)]);
+					for(typename std::vector<_Entry>::const_iterator e(c.begin());e!=c.end();++e)
+						_place(*e);
+				}
+			}
+
+			std::vector<_Entry> &slot = _slots[0][_tick & (ZT_TIMERWHEEL_SLOTS - 1)];
+			if (!slot.empty()) {
+				for(typename std::vector<_Entry>::const_iterator e(slot.begin());e!=slot.end();++e)
+					due.push_back(e->value);
+				_size -= (unsigned long)slot.size();
+				slot.clear();
+			}
+		}
+	}
+
+	/**
+	 * @return Number of entries in wheel, including any stale ones
+	 */
+	inline unsigned long size() const { return _size; }
+
+private:
+	inline void _place(const _Entry &e)
+	{
+		const uint64_t delta = e.tick - _tick;
+		for(unsigned int l=0;l<(ZT_TIMERWHEEL_LEVELS-1);++l) {
+			if (delta < (1ULL << (ZT_TIMERWHEEL_SLOT_BITS * (l + 1)))) {
+				_slots[l][(e.tick >> (ZT_TIMERWHEEL_SLOT_BITS * l)) & (ZT_TIMERWHEEL_SLOTS - 1)].push_back(e);
+				return;
+			}
+		}
+		const uint64_t maxTick = _tick + (1ULL << (ZT_TIMERWHEEL_SLOT_BITS * ZT_TIMERWHEEL_LEVELS)) - 1;
+		const uint64_t t = (e.tick < maxTick) ? e.tick : maxTick;
+		_slots[ZT_TIMERWHEEL_LEVELS - 1][(t >> (ZT_TIMERWHEEL_SLOT_BITS * (ZT_TIMERWHEEL_LEVELS - 1))) & (ZT_TIMERWHEEL_SLOTS - 1)].push_back(e);
+	}
+
+	const uint64_t _tickMs;
+	uint64_t _tick; // last tick whose slot has been processed
+	unsigned long _size;
+	std::vector<_Entry> _slots[ZT_TIMERWHEEL_LEVELS][ZT_TIMERWHEEL_SLOTS];
+};
+
+} // namespace ZeroTier
+
+#endif
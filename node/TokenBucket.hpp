@@ -0,0 +1,159 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TOKENBUCKET_HPP
+#define ZT_TOKENBUCKET_HPP
+
+#include <stdint.h>
+
+namespace ZeroTier {
+
+/**
+ * Token bucket rate limiter
+ *
+ * Tokens are bytes. They accrue at the configured rate up to the burst
+ * size, and a packet conforms if there are enough of them to pay for it.
+ * Tokens are kept in thousandths of a byte so that slow rates checked
+ * often still accrue. A rate of zero means unlimited.
+ *
+ * This is not thread safe.
+ */
+class TokenBucket
+{
+public:
+	TokenBucket() :
+		_rate(0),
+		_burst(0),
+		_tokens(0),
+		_last(0)
+	{
+	}
+
+	/**
+	 * @param rate Bytes per second or 0 for unlimited
+	 * @param burst Maximum bytes that may go at once after an idle period
+	 * @param now Current time
+	 */
+	TokenBucket(const uint64_t rate,const uint64_t burst,const uint64_t now)
+	{
+		set(rate,burst,now);
+	}
+
+	/**
+	 * Change rate and burst, starting with a full bucket
+	 *
+	 * @param rate Bytes per second or 0 for unlimited
+	 * @param burst Maximum bytes that may go at once after an idle period
+	 * @param now Current time
+	 */
+	inline void set(const uint64_t rate,const uint64_t burst,const uint64_t now)
+	{
+		_rate = rate;
+		_burst = burst * 1000;
+		_tokens = (int64_t)_burst;
+		_last = now;
+	}
+
+	/**
+	 * @return True if a rate is set
+	 */
+	inline bool limited() const { return (_rate != 0); }
+
+	/**
+	 * @return Rate in bytes per second or 0 if unlimited
+	 */
+	inline uint64_t rate() const { return _rate; }
+
+	/**
+	 * @return Burst size in bytes
+	 */
+	inline uint64_t burst() const { return (_burst / 1000); }
+
+	/**
+	 * @param now Current time
+	 * @return True if the bucket has refilled to its burst size
+	 */
+	inline bool full(const uint64_t now)
+	{
+		_refill(now);
+		return ((uint64_t)_tokens >= _burst);
+	}
+
+	/**
+	 * Take tokens for a packet if there are enough
+	 *
+	 * @param bytes Packet size
+	 * @param now Current time
+	 * @return True if packet conforms and its tokens were taken
+	 */
+	inline bool conform(const unsigned int bytes,const uint64_t now)
+	{
+		if (!_rate)
+			return true;
+		_refill(now);
+		const int64_t cost = (int64_t)bytes * 1000;
+		if (_tokens >= cost) {
+			_tokens -= cost;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @param bytes Packet size
+	 * @param now Current time
+	 * @return Milliseconds until a packet of this size would conform
+	 */
+	inline unsigned long delay(const unsigned int bytes,const uint64_t now)
+	{
+		if (!_rate)
+			return 0;
+		_refill(now);
+		const int64_t need = ((int64_t)bytes * 1000) - _tokens;
+		if (need <= 0)
+			return 0;
+		return (unsigned long)(((uint64_t)need + _rate - 1) / _rate);
+	}
+
+private:
+	inline void _refill(const uint64_t now)
+	{
+		if (now > _last) {
+			const uint64_t t = (uint64_t)_tokens + ((now - _last) * _rate);
+			_tokens = (int64_t)((t < _burst) ? t : _burst);
+			_last = now;
+		}
+	}
+
+	uint64_t _rate;
+	uint64_t _burst; // thousandths of a byte
+	int64_t _tokens; // thousandths of a byte
+	uint64_t _last;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -32,6 +32,8 @@
 #include "NetworkConfig.hpp"
 #include "Buffer.hpp"
 #include "Switch.hpp"
+#include "SHA512.hpp"
+#include "Utils.hpp"
 
 namespace ZeroTier {
 
@@ -63,11 +65,49 @@ namespace ZeroTier {
 #define ZT_DEFAULT_WORLD_LENGTH 634
 static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {0x01,0x00,0x00,0x00,0x00,0x08,0xea,0xc9,0x0a,0x00,0x00,0x01,0x52,0x3c,0x32,0x50,0x1a,0xb8,0xb3,0x88,0xa4,0x69,0x22,0x14,0x91,0xaa,0x9a,0xcd,0x66,0xcc,0x76,0x4c,0xde,0xfd,0x56,0x03,0x9f,0x10,0x67,0xae,0x15,0xe6,0x9c,0x6f,0xb4,0x2d,0x7b,0x55,0x33,0x0e,0x3f,0xda,0xac,0x52,0x9c,0x07,0x92,0xfd,0x73,0x40,0xa6,0xaa,0x21,0xab,0xa8,0xa4,0x89,0xfd,0xae,0xa4,0x4a,0x39,0xbf,0x2d,0x00,0x65,0x9a,0xc9,0xc8,0x18,0xeb,0x4a,0xf7,0x86,0xa8,0x40,0xd6,0x52,0xea,0xae,0x9e,0x7a,0xbf,0x4c,0x97,0x66,0xab,0x2d,0x6f,0xaf,0xc9,0x2b,0x3a,0xff,0xed,0xd6,0x30,0x3e,0xc4,0x6a,0x65,0xf2,0xbd,0x83,0x52,0xf5,0x40,0xe9,0xcc,0x0d,0x6e,0x89,0x3f,0x9a,0xa0,0xb8,0xdf,0x42,0xd2,0x2f,0x84,0xe6,0x03,0x26,0x0f,0xa8,0xe3,0xcc,0x05,0x05,0x03,0xef,0x12,0x80,0x0d,0xce,0x3e,0xb6,0x58,0x3b,0x1f,0xa8,0xad,0xc7,0x25,0xf9,0x43,0x71,0xa7,0x5c,0x9a,0xc7,0xe1,0xa3,0xb8,0x88,0xd0,0x71,0x6c,0x94,0x99,0x73,0x41,0x0b,0x1b,0x48,0x84,0x02,0x9d,0x21,0x90,0x39,0xf3,0x00,0x01,0xf0,0x92,0x2a,0x98,0xe3,0xb3,0x4e,0xbc,0xbf,0xf3,0x33,0x26,0x9d,0xc2,0x65,0xd7,0xa0,0x20,0xaa,0xb6,0x9d,0x72,0xbe,0x4d,0x4a,0xcc,0x9c,0x8c,0x92,0x94,0x78,0x57,0x71,0x25,0x6c,0xd1,0xd9,0x42,0xa9,0x0d,0x1b,0xd1,0xd2,0xdc,0xa3,0xea,0x84,0xef,0x7d,0x85,0xaf,0xe6,0x61,0x1f,0xb4,0x3f,0xf0,0xb7,0x41,0x26,0xd9,0x0a,0x6e,0x00,0x0c,0x04,0xbc,0xa6,0x5e,0xb1,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x02,0x00,0xd0,0x00,0x00,0x00,0x00,0x00,0x7d,0x00,0x01,0x27,0x09,0x04,0x9a,0x42,0xc5,0x21,0x27,0x09,0x06,0x2c,0x0f,0xf8,0x50,0x01,0x54,0x01,0x97,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x33,0x27,0x09,0x04,0x9f,0xcb,0x61,0xab,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x08,0x00,0x00,0xa1,0x00,0x00,0x00,0x00,0x00,0x54,0x60,0x01,0x27,0x09,0x04,0xa9,0x39,0x8f,0x68,0x27,0x09,0x06,0x26,0x07,0xf0,0xd0,0x1d,0x01,0x00,0x57,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,0x27,0x09,0x04,0x6b,0xaa,0xc5,0x0e,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x00,0x01,0x00,0x20,0x00,0x00,0x00,0x00,0x02,0x00,0xe0,0x01,0x27,0x09,0x04,0x80,0xc7,0xc5,0xd9,0x27,0x09,0x06,0x24,0x00,0x61,0x80,0x00,0x00,0x00,0xd0,0x00,0x00,0x00,0x00,0x00,0xb7,0x40,0x01,0x27,0x09,0x88,0x41,0x40,0x8a,0x2e,0x00,0xbb,0x1d,0x31,0xf2,0xc3,0x23,0xe2,0x64,0xe9,0xe6,0x41,0x72,0xc1,0xa7,0x4f,0x77,0x89,0x95,0x55,0xed,0x10,0x75,0x1c,0xd5,0x6e,0x86,0x40,0x5c,0xde,0x11,0x8d,0x02,0xdf,0xfe,0x55,0x5d,0x46,0x2c,0xcf,0x6a,0x85,0xb5,0x63,0x1c,0x12,0x35,0x0c,0x8d,0x5d,0xc4,0x09,0xba,0x10,0xb9,0x02,0x5d,0x0f,0x44,0x5c,0xf4,0x49,0xd9,0x2b,0x1c,0x00,0x0c,0x04,0x2d,0x20,0xc6,0x82,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x64,0x00,0x81,0xc3,0x54,0x00,0x00,0xff,0xfe,0x18,0x1d,0x61,0x27,0x09,0x04,0x2e,0x65,0xa0,0xf9,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x03,0x00,0xd0,0x00,0x00,0x00,0x00,0x00,0x6a,0x30,0x01,0x27,0x09,0x04,0x6b,0xbf,0x2e,0xd2,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x68,0x00,0x83,0xa4,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x64,0x27,0x09,0x04,0x2d,0x20,0xf6,0xb3,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x58,0x00,0x8b,0xf8,0x54,0x00,0x00,0xff,0xfe,0x15,0xb3,0x9a,0x27,0x09,0x04,0x2d,0x20,0xf8,0x57,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x70,0x00,0x9b,0xc9,0x54,0x00,0x00,0xff,0xfe,0x15,0xc4,0xf5,0x27,0x09,0x04,0x9f,0xcb,0x02,0x9a,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x0c,0xad,0x00,0xd0,0x00,0x00,0x00,0x00,0x00,0x26,0x70,0x01,0x27,0x09};
 
+namespace {
+// Per-thread direct-mapped cache in front of Topology::_paths. Entries hold
+// naked pointers and are only trusted while _pathEpoch equals the epoch the
+// cache was filled in. The epoch is bumped before any path can be removed
+// from a path table (and when a Topology is destroyed), and removed paths are
+// only deleted after ZT_TOPOLOGY_PATH_RETIRE_DELAY, so a thread that passes
+// the epoch check can always safely take a reference.
+struct _PathCacheEntry
+{
+	const Topology *topology;
+	Path::HashKey key;
+	Path *path;
+};
+struct _PathCache
+{
+	uint64_t epoch;
+	_PathCacheEntry entries[ZT_TOPOLOGY_PATH_CACHE_SIZE];
+};
+static thread_local _PathCache _pathCache;
+static uint64_t _pathEpoch = 1; // shared by all Topology instances in this process
+
+static inline void _bumpPathEpoch() { __atomic_add_fetch(&_pathEpoch,1,__ATOMIC_SEQ_CST); }
+static inline unsigned int _pathCacheIndex(const Path::HashKey &k)
+{
+	const unsigned long h = k.hashCode();
+	return (unsigned int)((h ^ (h >> 16)) & (ZT_TOPOLOGY_PATH_CACHE_SIZE - 1));
+}
+} // anonymous namespace
+
 Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 	RR(renv),
 	_trustedPathCount(0),
+	_peerLimit(0),
+	_lastClean(0),
+	_cleanShard(0),
+	_cleanShardIdentities(false),
+	_cleanPosition(0),
+	_cleanPathPosition(0),
+	_validatedIdentityClock(0),
 	_amRoot(false)
 {
+	memset(_validatedIdentities,0,sizeof(_validatedIdentities));
+
 	uint8_t tmp[ZT_WORLD_MAX_SERIALIZED_LENGTH];
 	uint64_t idtmp[2];
 	idtmp[0] = 0; idtmp[1] = 0;
@@ -88,48 +128,148 @@ Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 	addWorld(tPtr,defaultPlanet,false);
 }
 
+Topology::~Topology()
+{
+	_bumpPathEpoch(); // other threads' caches may still name our paths
+	for(std::vector< std::pair<uint64_t,Path *> >::iterator r(_retiredPaths.begin());r!=_retiredPaths.end();++r)
+		delete r->second;
+}
+
+SharedPtr<Path> Topology::getPath(const int64_t l,const InetAddress &r)
+{
+	const Path::HashKey k(l,r);
+	_PathCache &c = _pathCache;
+	_PathCacheEntry &ce = c.entries[_pathCacheIndex(k)];
+
+	const uint64_t epoch = __atomic_load_n(&_pathEpoch,__ATOMIC_SEQ_CST);
+	if ((c.epoch == epoch)&&(ce.topology == this)&&(ce.key == k)) {
+		SharedPtr<Path> p(ce.path);
+		// If the epoch moved the path may have been detached from _paths before
+		// our reference was counted, so fall back to the table. Dropping the
+		// reference can't delete it since the table's reference is never released.
+		if (__atomic_load_n(&_pathEpoch,__ATOMIC_SEQ_CST) == epoch)
+			return p;
+	}
+
+	SharedPtr<Path> p;
+	{
+		RWMutex::RLock _l(_paths_m);
+		const SharedPtr<Path> *const hp = _paths.get(k);
+		if (hp)
+			p = *hp;
+	}
+	if (!p) {
+		RWMutex::Lock _l(_paths_m);
+		SharedPtr<Path> &hp = _paths[k];
+		if (!hp)
+			hp.setToUnsafe(new Path(l,r));
+		p = hp;
+	}
+
+	// Paths found after reading epoch can't have been removed without changing it
+	if (c.epoch != epoch) {
+		for(unsigned int i=0;i<ZT_TOPOLOGY_PATH_CACHE_SIZE;++i)
+			c.entries[i].topology = (const Topology *)0;
+		c.epoch = epoch;
+	}
+	ce.topology = this;
+	ce.key = k;
+	ce.path = p.ptr();
+
+	return p;
+}
+
 SharedPtr<Peer> Topology::addPeer(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	SharedPtr<Peer> np;
 	{
-		Mutex::Lock _l(_peers_m);
-		SharedPtr<Peer> &hp = _peers[peer->address()];
+		_PeerShard &s = _peerShard(peer->address());
+		AdaptiveMutex::Lock _l(s.lock);
+		SharedPtr<Peer> &hp = s.peers[peer->address()];
 		if (!hp)
 			hp = peer;
 		np = hp;
+		s.identities.erase(peer->address());
+	}
+	if (np == peer) {
+		RR->node->postPeerEvent(tPtr,ZT_EVENT_PEER_ADDED,peer->address(),InetAddress(),0);
+		if (_amRoot)
+			_storeIdentity(tPtr,peer->identity());
 	}
 	return np;
 }
 
+void Topology::addIdentity(void *tPtr,const Identity &id)
+{
+	if (id.address() == RR->identity.address())
+		return;
+	bool added = false;
+	{
+		_PeerShard &s = _peerShard(id.address());
+		AdaptiveMutex::Lock _l(s.lock);
+		if (!s.peers.contains(id.address())) {
+			_KnownIdentity &ki = s.identities[id.address()];
+			added = (!ki.id);
+			ki.id = id;
+			ki.lastUsed = RR->node->now();
+		}
+	}
+	if ((added)&&(_amRoot))
+		_storeIdentity(tPtr,id);
+}
+
 SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 {
 	if (zta == RR->identity.address())
 		return SharedPtr<Peer>();
 
+	SharedPtr<Peer> promoted;
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		AdaptiveMutex::Lock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return *ap;
+
+		// Promote a known identity, which is cheap since key agreement is lazy
+		const _KnownIdentity *const ki = s.identities.get(zta);
+		if (ki) {
+			SharedPtr<Peer> &np = s.peers[zta];
+			np = new Peer(RR,RR->identity,ki->id);
+			s.identities.erase(zta);
+			promoted = np;
+		}
+	}
+	if (promoted) {
+		RR->node->postPeerEvent(tPtr,ZT_EVENT_PEER_ADDED,zta,InetAddress(),0);
+		return promoted;
 	}
 
-	/*
+	// Peers that were known before a restart are loaded lazily from the peer
+	// cache. This is done without holding the shard lock since restoring
+	// paths consults the path check callback.
 	try {
 		char buf[ZT_PEER_MAX_SERIALIZED_STATE_SIZE];
 		uint64_t idbuf[2]; idbuf[0] = zta.toInt(); idbuf[1] = 0;
 		int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_PEER,idbuf,buf,(unsigned int)sizeof(buf));
 		if (len > 0) {
-			Mutex::Lock _l(_peers_m);
-			SharedPtr<Peer> &ap = _peers[zta];
-			if (ap)
+			const SharedPtr<Peer> np(Peer::createFromStateUpdate(RR,tPtr,buf,(unsigned int)len));
+			if ((np)&&(np->address() == zta)) {
+				SharedPtr<Peer> ap;
+				{
+					_PeerShard &s = _peerShard(zta);
+					AdaptiveMutex::Lock _l(s.lock);
+					SharedPtr<Peer> &hp = s.peers[zta];
+					if (!hp)
+						hp = np;
+					ap = hp;
+				}
+				if (ap == np)
+					RR->node->postPeerEvent(tPtr,ZT_EVENT_PEER_ADDED,zta,InetAddress(),0);
 				return ap;
-			ap = Peer::createFromStateUpdate(RR,tPtr,buf,len);
-			if (!ap)
-				_peers.erase(zta);
-			return ap;
+			}
 		}
-	} catch ( ... ) {} // ignore invalid identities or other strage failures
-	*/
+	} catch ( ... ) {} // ignore invalid identities or other strange failures
 
 	return SharedPtr<Peer>();
 }
@@ -139,51 +279,121 @@ Identity Topology::getIdentity(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address()) {
 		return RR->identity;
 	} else {
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		AdaptiveMutex::Lock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return (*ap)->identity();
+		_KnownIdentity *const ki = s.identities.get(zta);
+		if (ki) {
+			ki->lastUsed = RR->node->now();
+			return ki->id;
+		}
+	}
+
+	// Roots and moons fall back to the identity store, read with no locks held
+	if (_amRoot) {
+		try {
+			char buf[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+			uint64_t idbuf[2]; idbuf[0] = zta.toInt(); idbuf[1] = 0;
+			const int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_IDENTITY,idbuf,buf,(unsigned int)sizeof(buf) - 1);
+			if (len > 0) {
+				buf[len] = (char)0;
+				Identity id;
+				if ((id.fromString(buf))&&(id.address() == zta)) {
+					_PeerShard &s = _peerShard(zta);
+					AdaptiveMutex::Lock _l(s.lock);
+					if (!s.peers.contains(zta)) {
+						_KnownIdentity &ki = s.identities[zta];
+						ki.id = id;
+						ki.lastUsed = RR->node->now();
+					}
+					return id;
+				}
+			}
+		} catch ( ... ) {} // ignore invalid identities or other strange failures
 	}
+
 	return Identity();
 }
 
+void Topology::_storeIdentity(void *tPtr,const Identity &id)
+{
+	char buf[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+	uint64_t idbuf[2]; idbuf[0] = id.address().toInt(); idbuf[1] = 0;
+	id.toString(false,buf);
+	RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_IDENTITY,idbuf,buf,(unsigned int)strlen(buf));
+}
+
+bool Topology::locallyValidate(const Identity &id)
+{
+	uint8_t tmp[ZT_ADDRESS_LENGTH + ZT_C25519_PUBLIC_KEY_LEN];
+	uint64_t h[8];
+	id.address().copyTo(tmp,ZT_ADDRESS_LENGTH);
+	memcpy(tmp + ZT_ADDRESS_LENGTH,id.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+	SHA512::hash(h,tmp,sizeof(tmp));
+
+	_ValidatedIdentity *const set = _validatedIdentities[(unsigned int)h[0] & (ZT_TOPOLOGY_VALIDATED_IDENTITY_SETS - 1)];
+	{
+		Mutex::Lock _l(_validatedIdentities_m);
+		for(unsigned int w=0;w<ZT_TOPOLOGY_VALIDATED_IDENTITY_WAYS;++w) {
+			if ((set[w].lastUsed)&&(!memcmp(set[w].fp,h,sizeof(set[w].fp)))) {
+				set[w].lastUsed = ++_validatedIdentityClock;
+				return true;
+			}
+		}
+	}
+
+	if (!id.locallyValidate())
+		return false;
+
+	Mutex::Lock _l(_validatedIdentities_m);
+	unsigned int lru = 0;
+	for(unsigned int w=1;w<ZT_TOPOLOGY_VALIDATED_IDENTITY_WAYS;++w) {
+		if (set[w].lastUsed < set[lru].lastUsed)
+			lru = w;
+	}
+	memcpy(set[lru].fp,h,sizeof(set[lru].fp));
+	set[lru].lastUsed = ++_validatedIdentityClock;
+	return true;
+}
+
 SharedPtr<Peer> Topology::getUpstreamPeer(const Address *avoid,unsigned int avoidCount,bool strictAvoid)
 {
 	const uint64_t now = RR->node->now();
 	unsigned int bestQualityOverall = ~((unsigned int)0);
 	unsigned int bestQualityNotAvoid = ~((unsigned int)0);
-	const SharedPtr<Peer> *bestOverall = (const SharedPtr<Peer> *)0;
-	const SharedPtr<Peer> *bestNotAvoid = (const SharedPtr<Peer> *)0;
+	SharedPtr<Peer> bestOverall;
+	SharedPtr<Peer> bestNotAvoid;
 
-	Mutex::Lock _l1(_peers_m);
-	Mutex::Lock _l2(_upstreams_m);
+	Mutex::Lock _l(_upstreams_m);
 
 	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
-		const SharedPtr<Peer> *p = _peers.get(*a);
+		const SharedPtr<Peer> p(getPeerNoCache(*a));
 		if (p) {
 			bool avoiding = false;
 			for(unsigned int i=0;i<avoidCount;++i) {
-				if (avoid[i] == (*p)->address()) {
+				if (avoid[i] == p->address()) {
 					avoiding = true;
 					break;
 				}
 			}
-			const unsigned int q = (*p)->relayQuality(now);
+			const unsigned int q = p->relayQuality(now);
 			if (q <= bestQualityOverall) {
 				bestQualityOverall = q;
-				bestOverall = &(*p);
+				bestOverall = p;
 			}
 			if ((!avoiding)&&(q <= bestQualityNotAvoid)) {
 				bestQualityNotAvoid = q;
-				bestNotAvoid = &(*p);
+				bestNotAvoid = p;
 			}
 		}
 	}
 
 	if (bestNotAvoid) {
-		return *bestNotAvoid;
+		return bestNotAvoid;
 	} else if ((!strictAvoid)&&(bestOverall)) {
-		return *bestOverall;
+		return bestOverall;
 	}
 
 	return SharedPtr<Peer>();
@@ -260,8 +470,7 @@ bool Topology::addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew)
 	if ((newWorld.type() != World::TYPE_PLANET)&&(newWorld.type() != World::TYPE_MOON))
 		return false;
 
-	Mutex::Lock _l1(_upstreams_m);
-	Mutex::Lock _l2(_peers_m);
+	Mutex::Lock _l(_upstreams_m);
 
 	World *existing = (World *)0;
 	switch(newWorld.type()) {
@@ -349,8 +558,7 @@ void Topology::addMoon(void *tPtr,const uint64_t id,const Address &seed)
 
 void Topology::removeMoon(void *tPtr,const uint64_t id)
 {
-	Mutex::Lock _l1(_upstreams_m);
-	Mutex::Lock _l2(_peers_m);
+	Mutex::Lock _l(_upstreams_m);
 
 	std::vector<World> nm;
 	for(std::vector<World>::const_iterator m(_moons.begin());m!=_moons.end();++m) {
@@ -374,35 +582,235 @@ void Topology::removeMoon(void *tPtr,const uint64_t id)
 	_memoizeUpstreams(tPtr);
 }
 
+void Topology::memoryUsage(MemoryUsage &mu)
+{
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		AdaptiveMutex::Lock _l(_peers[s].lock);
+		mu.add(MemoryUsage::PEERS,_peers[s].peers.size(),_peers[s].peers.footprint() + (_peers[s].peers.size() * sizeof(Peer)));
+		mu.add(MemoryUsage::IDENTITIES,_peers[s].identities.size(),_peers[s].identities.footprint());
+	}
+	{
+		RWMutex::RLock _l(_paths_m);
+		mu.add(MemoryUsage::PATHS,_paths.size(),_paths.footprint() + (_paths.size() * sizeof(Path)));
+	}
+}
+
+void Topology::reservePeers(const unsigned long n)
+{
+	// Addresses are random so shards fill evenly, give or take a little
+	const unsigned long perShard = ((n + (n >> 3)) / ZT_TOPOLOGY_PEER_SHARDS) + 1;
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		AdaptiveMutex::Lock _l(_peers[s].lock);
+		_peers[s].peers.reserve(perShard);
+	}
+	{
+		RWMutex::Lock _l(_paths_m);
+		_paths.reserve(n);
+	}
+}
+
 void Topology::doPeriodicTasks(void *tPtr,uint64_t now)
 {
+	const uint64_t elapsed = now - _lastClean;
+	_lastClean = now;
+
+	std::vector< SharedPtr<Peer> > toSave;
+	std::vector<Address> added,removed;
 	{
-		Mutex::Lock _l1(_peers_m);
-		Mutex::Lock _l2(_upstreams_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) )
-				_peers.erase(*a);
+		Mutex::Lock _l1(_upstreams_m);
+
+		added.swap(_addedUpstreams);
+		_enforcePeerLimit(now,toSave,removed);
+
+		unsigned long peerCount = 0;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l2(_peers[s].lock);
+			peerCount += _peers[s].peers.size() + _peers[s].identities.size();
+		}
+		unsigned long budget = Utils::housekeepingSlice(peerCount,elapsed);
+
+		// Each shard's peers and then its identities are done a slice at a time, at most one pass per call
+		for(unsigned int shards=0;(budget)&&(shards<ZT_TOPOLOGY_PEER_SHARDS);) {
+			_PeerShard &ps = _peers[_cleanShard];
+			AdaptiveMutex::Lock _l2(ps.lock);
+			Address *a = (Address *)0;
+			bool done = false;
+			if (!_cleanShardIdentities) {
+				FlatHashtable< Address,SharedPtr<Peer> >::Iterator i(ps.peers,_cleanPosition);
+				SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+				while (budget) {
+					if (!i.next(a,p)) {
+						done = true;
+						break;
+					}
+					--budget;
+					if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
+						if ((*p)->needsStateSave(now,0))
+							toSave.push_back(*p);
+						_KnownIdentity &ki = ps.identities[*a]; // keep identity so credentials still verify
+						ki.id = (*p)->identity();
+						ki.lastUsed = now;
+						removed.push_back(*a);
+						ps.peers.erase(*a);
+					} else if ((*p)->needsStateSave(now,ZT_PEER_STATE_SAVE_INTERVAL)) {
+						toSave.push_back(*p);
+					}
+				}
+				_cleanPosition = i.position();
+				if (done) {
+					_cleanShardIdentities = true;
+					_cleanPosition = 0;
+				}
+			} else {
+				Hashtable< Address,_KnownIdentity >::Iterator ii(ps.identities,_cleanPosition);
+				_KnownIdentity *ki = (_KnownIdentity *)0;
+				while (budget) {
+					if (!ii.next(a,ki)) {
+						done = true;
+						break;
+					}
+					--budget;
+					if ((now - ki->lastUsed) >= ((_amRoot) ? ZT_ROOT_KNOWN_IDENTITY_EXPIRATION : ZT_KNOWN_IDENTITY_EXPIRATION))
+						ps.identities.erase(*a);
+				}
+				_cleanPosition = ii.position();
+				if (done) {
+					_cleanShardIdentities = false;
+					_cleanPosition = 0;
+					_cleanShard = (_cleanShard + 1) % ZT_TOPOLOGY_PEER_SHARDS;
+					++shards;
+				}
+			}
 		}
 	}
 
+	// State objects are written and events posted with no locks held
+	for(std::vector< SharedPtr<Peer> >::iterator p(toSave.begin());p!=toSave.end();++p)
+		(*p)->saveState(tPtr,now);
+	for(std::vector<Address>::const_iterator a(added.begin());a!=added.end();++a)
+		RR->node->postPeerEvent(tPtr,ZT_EVENT_PEER_ADDED,*a,InetAddress(),0);
+	for(std::vector<Address>::const_iterator a(removed.begin());a!=removed.end();++a)
+		RR->node->postPeerEvent(tPtr,ZT_EVENT_PEER_REMOVED,*a,InetAddress(),0);
+
 	{
-		Mutex::Lock _l(_paths_m);
-		Hashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_paths);
+		RWMutex::Lock _l(_paths_m);
+
+		std::vector< std::pair<uint64_t,Path *> >::iterator rp(_retiredPaths.begin());
+		while ((rp != _retiredPaths.end())&&((now - rp->first) >= ZT_TOPOLOGY_PATH_RETIRE_DELAY))
+			delete (rp++)->second;
+		_retiredPaths.erase(_retiredPaths.begin(),rp);
+
+		bool epochBumped = false;
+		unsigned long budget = Utils::housekeepingSlice(_paths.size(),elapsed);
+		FlatHashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_paths,_cleanPathPosition);
 		Path::HashKey *k = (Path::HashKey *)0;
 		SharedPtr<Path> *p = (SharedPtr<Path> *)0;
-		while (i.next(k,p)) {
-			if (p->reclaimIfWeak())
-				_paths.erase(*k);
+		for(;;) {
+			if (!budget) {
+				_cleanPathPosition = i.position();
+				break;
+			}
+			if (!i.next(k,p)) {
+				_cleanPathPosition = 0;
+				break;
+			}
+			--budget;
+			// Cheap pre-check so caches are only invalidated when something may actually go
+			if (p->references() <= 1) {
+				if (!epochBumped) {
+					_bumpPathEpoch();
+					epochBumped = true;
+				}
+				Path *const dp = p->detachIfWeak();
+				if (dp) {
+					_retiredPaths.push_back(std::pair<uint64_t,Path *>(now,dp));
+					_paths.erase(*k);
+				}
+			}
+		}
+	}
+}
+
+void Topology::_enforcePeerLimit(uint64_t now,std::vector< SharedPtr<Peer> > &toSave,std::vector<Address> &removed)
+{
+	const unsigned long limit = _peerLimit;
+	if (!limit)
+		return;
+
+	unsigned long peerCount = 0,identityCount = 0;
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		AdaptiveMutex::Lock _l(_peers[s].lock);
+		peerCount += _peers[s].peers.size();
+		identityCount += _peers[s].identities.size();
+	}
+
+	// Going over evicts down to 7/8 of the limit, so a node sitting at the
+	// limit doesn't scan every table on every run.
+	const unsigned long target = limit - (limit / 8);
+
+	if (peerCount > limit) {
+		std::vector< std::pair<uint64_t,Address> > lru;
+		lru.reserve(peerCount);
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l(_peers[s].lock);
+			FlatHashtable< Address,SharedPtr<Peer> >::Iterator i(_peers[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end())
+					lru.push_back(std::pair<uint64_t,Address>((*p)->lastReceive(),*a));
+			}
+		}
+
+		const unsigned long n = std::min(peerCount - target,(unsigned long)lru.size());
+		if (n < lru.size())
+			std::nth_element(lru.begin(),lru.begin() + n,lru.end());
+		for(unsigned long k=0;k<n;++k) {
+			_PeerShard &ps = _peerShard(lru[k].second);
+			AdaptiveMutex::Lock _l(ps.lock);
+			const SharedPtr<Peer> *const p = ps.peers.get(lru[k].second);
+			if (p) {
+				if ((*p)->needsStateSave(now,0))
+					toSave.push_back(*p);
+				_KnownIdentity &ki = ps.identities[lru[k].second];
+				ki.id = (*p)->identity();
+				ki.lastUsed = now;
+				removed.push_back(lru[k].second);
+				ps.peers.erase(lru[k].second);
+				++identityCount;
+			}
 		}
+		RR->metrics->add(Metrics::PEERS_EVICTED,n);
+	}
+
+	const unsigned long identityLimit = limit * ZT_KNOWN_IDENTITY_LIMIT_FACTOR;
+	if (identityCount > identityLimit) {
+		std::vector< std::pair<uint64_t,Address> > lru;
+		lru.reserve(identityCount);
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l(_peers[s].lock);
+			Hashtable< Address,_KnownIdentity >::Iterator i(_peers[s].identities);
+			Address *a = (Address *)0;
+			_KnownIdentity *ki = (_KnownIdentity *)0;
+			while (i.next(a,ki))
+				lru.push_back(std::pair<uint64_t,Address>(ki->lastUsed,*a));
+		}
+
+		const unsigned long n = std::min(identityCount - (identityLimit - (identityLimit / 8)),(unsigned long)lru.size());
+		if (n < lru.size())
+			std::nth_element(lru.begin(),lru.begin() + n,lru.end());
+		for(unsigned long k=0;k<n;++k) {
+			_PeerShard &ps = _peerShard(lru[k].second);
+			AdaptiveMutex::Lock _l(ps.lock);
+			ps.identities.erase(lru[k].second);
+		}
+		RR->metrics->add(Metrics::IDENTITIES_EVICTED,n);
 	}
 }
 
 void Topology::_memoizeUpstreams(void *tPtr)
 {
-	// assumes _upstreams_m and _peers_m are locked
+	// assumes _upstreams_m is locked; peer shards are locked here after it
 	_upstreamAddresses.clear();
 	_amRoot = false;
 
@@ -411,9 +819,13 @@ void Topology::_memoizeUpstreams(void *tPtr)
 			_amRoot = true;
 		} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 			_upstreamAddresses.push_back(i->identity.address());
-			SharedPtr<Peer> &hp = _peers[i->identity.address()];
-			if (!hp)
+			_PeerShard &s = _peerShard(i->identity.address());
+			AdaptiveMutex::Lock _l(s.lock);
+			SharedPtr<Peer> &hp = s.peers[i->identity.address()];
+			if (!hp) {
 				hp = new Peer(RR,RR->identity,i->identity);
+				_addedUpstreams.push_back(i->identity.address());
+			}
 		}
 	}
 
@@ -423,9 +835,13 @@ void Topology::_memoizeUpstreams(void *tPtr)
 				_amRoot = true;
 			} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 				_upstreamAddresses.push_back(i->identity.address());
-				SharedPtr<Peer> &hp = _peers[i->identity.address()];
-				if (!hp)
+				_PeerShard &s = _peerShard(i->identity.address());
+				AdaptiveMutex::Lock _l(s.lock);
+				SharedPtr<Peer> &hp = s.peers[i->identity.address()];
+				if (!hp) {
 					hp = new Peer(RR,RR->identity,i->identity);
+					_addedUpstreams.push_back(i->identity.address());
+				}
 			}
 		}
 	}
@@ -45,8 +45,35 @@
 #include "Mutex.hpp"
 #include "InetAddress.hpp"
 #include "Hashtable.hpp"
+#include "FlatHashtable.hpp"
 #include "World.hpp"
 #include "CertificateOfRepresentation.hpp"
+#include "MemoryUsage.hpp"
+
+/**
+ * Number of independently locked shards in the peer table (power of two)
+ */
+#define ZT_TOPOLOGY_PEER_SHARDS 16
+
+/**
+ * Number of sets in the validated identity cache (must be a power of two)
+ */
+#define ZT_TOPOLOGY_VALIDATED_IDENTITY_SETS 1024
+
+/**
+ * Entries per set in the validated identity cache, evicted least recently used first
+ */
+#define ZT_TOPOLOGY_VALIDATED_IDENTITY_WAYS 4
+
+/**
+ * Entries in each thread's direct-mapped getPath() cache (must be a power of two)
+ */
+#define ZT_TOPOLOGY_PATH_CACHE_SIZE 64
+
+/**
+ * How long a path removed from the path table is kept for per-thread caches that may still point to it, in ms
+ */
+#define ZT_TOPOLOGY_PATH_RETIRE_DELAY 10000
 
 namespace ZeroTier {
 
@@ -59,6 +86,7 @@ class Topology
 {
 public:
 	Topology(const RuntimeEnvironment *renv,void *tPtr);
+	~Topology();
 
 	/**
 	 * Add a peer to database
@@ -72,6 +100,21 @@ public:
 	 */
 	SharedPtr<Peer> addPeer(void *tPtr,const SharedPtr<Peer> &peer);
 
+	/**
+	 * Remember an identity without creating a Peer for it
+	 *
+	 * Identities learned via WHOIS are held here and only promoted to a full
+	 * Peer by getPeer(), which happens once traffic flows to or from them.
+	 * Lookups via getIdentity() (e.g. for credential signers) don't promote.
+	 * This does nothing if a Peer already exists for this address. Roots and
+	 * moons also put it in the identity store so they can answer WHOIS for it
+	 * later.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param id Identity (must already be trusted or validated)
+	 */
+	void addIdentity(void *tPtr,const Identity &id);
+
 	/**
 	 * Get a peer from its address
 	 *
@@ -82,12 +125,31 @@ public:
 	SharedPtr<Peer> getPeer(void *tPtr,const Address &zta);
 
 	/**
+	 * Get the identity of a peer or known identity without promoting it
+	 *
+	 * On roots and moons a miss in memory is looked up in the identity store
+	 * (ZT_STATE_OBJECT_IDENTITY), and a hit there becomes a known identity.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param zta ZeroTier address of peer
 	 * @return Identity or NULL identity if not found
 	 */
 	Identity getIdentity(void *tPtr,const Address &zta);
 
+	/**
+	 * Check an identity with Identity::locallyValidate(), remembering successes
+	 *
+	 * The memory-hard hash behind locallyValidate() dominates the cost of
+	 * learning a peer from HELLO. Identities that pass are remembered by a
+	 * hash of their address and public key in a bounded cache, so repeat
+	 * HELLOs from the same identity (e.g. after its Peer has expired) only
+	 * cost one SHA512. Failures are never cached.
+	 *
+	 * @param id Identity to check
+	 * @return True if identity is valid
+	 */
+	bool locallyValidate(const Identity &id);
+
 	/**
 	 * Get a peer only if it is presently in memory (no disk cache)
 	 *
@@ -100,33 +162,49 @@ public:
 	 */
 	inline SharedPtr<Peer> getPeerNoCache(const Address &zta)
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		AdaptiveMutex::Lock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return *ap;
 		return SharedPtr<Peer>();
 	}
 
+	/**
+	 * Check whether a peer is presently in memory
+	 *
+	 * This is getPeerNoCache() for callers that only need to know, and it
+	 * doesn't touch the peer's reference count.
+	 *
+	 * @param zta ZeroTier address
+	 * @return True if peer is in memory
+	 */
+	inline bool hasPeer(const Address &zta)
+	{
+		_PeerShard &s = _peerShard(zta);
+		AdaptiveMutex::Lock _l(s.lock);
+		return (s.peers.get(zta) != (const SharedPtr<Peer> *)0);
+	}
+
 	/**
 	 * Get a Path object for a given local and remote physical address, creating if needed
 	 *
+	 * Repeat lookups from the same thread are usually answered by a small
+	 * per-thread cache without taking _paths_m.
+	 *
 	 * @param l Local socket
 	 * @param r Remote address
 	 * @return Pointer to canonicalized Path object
 	 */
-	inline SharedPtr<Path> getPath(const int64_t l,const InetAddress &r)
-	{
-		Mutex::Lock _l(_paths_m);
-		SharedPtr<Path> &p = _paths[Path::HashKey(l,r)];
-		if (!p)
-			p.setToUnsafe(new Path(l,r));
-		return p;
-	}
+	SharedPtr<Path> getPath(const int64_t l,const InetAddress &r);
 
 	/**
 	 * Get the current best upstream peer
 	 *
-	 * @return Root server with lowest latency or NULL if none
+	 * Upstreams are ranked by Peer::relayQuality(), so this is the one with
+	 * the best measured RTT and loss that is still answering.
+	 *
+	 * @return Best root server or NULL if none
 	 */
 	inline SharedPtr<Peer> getUpstreamPeer() { return getUpstreamPeer((const Address *)0,0,false); }
 
@@ -294,9 +372,20 @@ public:
 
 	/**
 	 * Clean and flush database
+	 *
+	 * Each call handles the next slice of peers, known identities and paths
+	 * (see Utils::housekeepingSlice()), so this should be called on every
+	 * background task run. It is not safe to call concurrently.
 	 */
 	void doPeriodicTasks(void *tPtr,uint64_t now);
 
+	/**
+	 * Add peers, known identities and paths to a memory usage snapshot
+	 *
+	 * @param mu Snapshot to add to
+	 */
+	void memoryUsage(MemoryUsage &mu);
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -304,14 +393,16 @@ public:
 	inline unsigned long countActive(uint64_t now) const
 	{
 		unsigned long cnt = 0;
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			const SharedPtr<Path> pp((*p)->getBestPath(now,false));
-			if ((pp)&&(pp->alive(now)))
-				++cnt;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l(_peers[s].lock);
+			FlatHashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				const SharedPtr<Path> pp((*p)->getBestPath(now,false));
+				if ((pp)&&(pp->alive(now)))
+					++cnt;
+			}
 		}
 		return cnt;
 	}
@@ -319,18 +410,29 @@ public:
 	/**
 	 * Apply a function or function object to all peers
 	 *
+	 * Each shard's peers are copied out and the function is called without
+	 * any peer table lock held, so it may call back into Topology.
+	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template<typename F>
 	inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			f(*this,*((const SharedPtr<Peer> *)p));
+		std::vector< SharedPtr<Peer> > sp;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			{
+				AdaptiveMutex::Lock _l(_peers[s].lock);
+				sp.reserve(_peers[s].peers.size());
+				FlatHashtable< Address,SharedPtr<Peer> >::Iterator i(_peers[s].peers);
+				Address *a = (Address *)0;
+				SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+				while (i.next(a,p))
+					sp.push_back(*p);
+			}
+			for(std::vector< SharedPtr<Peer> >::const_iterator p(sp.begin());p!=sp.end();++p)
+				f(*this,*p);
+			sp.clear();
 		}
 	}
 
@@ -339,8 +441,33 @@ public:
 	 */
 	inline std::vector< std::pair< Address,SharedPtr<Peer> > > allPeers() const
 	{
-		Mutex::Lock _l(_peers_m);
-		return _peers.entries();
+		std::vector< std::pair< Address,SharedPtr<Peer> > > ap;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l(_peers[s].lock);
+			std::vector< std::pair< Address,SharedPtr<Peer> > > e(_peers[s].peers.entries());
+			ap.insert(ap.end(),e.begin(),e.end());
+		}
+		return ap;
+	}
+
+	/**
+	 * Get the addresses of peers above a given address (unsorted)
+	 *
+	 * @param after Only addresses greater than this are returned
+	 * @param addrs Vector to append addresses to
+	 */
+	inline void peerAddressesAfter(const Address &after,std::vector<Address> &addrs) const
+	{
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			AdaptiveMutex::Lock _l(_peers[s].lock);
+			FlatHashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				if (*a > after)
+					addrs.push_back(*a);
+			}
+		}
 	}
 
 	/**
@@ -397,6 +524,30 @@ public:
 		_trustedPathCount = count;
 	}
 
+	/**
+	 * Set a limit on the number of peers held in memory
+	 *
+	 * Over the limit, doPeriodicTasks() demotes the least recently heard from
+	 * peers other than upstreams to known identities (saving their state
+	 * first), and known identities are limited to ZT_KNOWN_IDENTITY_LIMIT_FACTOR
+	 * times the limit. A demoted peer is recreated if it's heard from again.
+	 *
+	 * @param n Maximum number of peers or 0 for no limit
+	 */
+	inline void setPeerLimit(const unsigned long n) { _peerLimit = n; }
+
+	/**
+	 * Size the peer and path tables ahead of time for this many peers
+	 *
+	 * These tables grow by rehashing everything in them under their locks,
+	 * which at a hundred thousand peers stalls the threads looking up peers.
+	 * Sizing them up front leaves that to startup. Tables are never shrunk,
+	 * so this can be called again with a larger number.
+	 *
+	 * @param n Number of peers expected (and as many paths)
+	 */
+	void reservePeers(const unsigned long n);
+
 	/**
 	 * @return Current certificate of representation (copy)
 	 */
@@ -419,6 +570,8 @@ public:
 private:
 	Identity _getIdentity(void *tPtr,const Address &zta);
 	void _memoizeUpstreams(void *tPtr);
+	void _storeIdentity(void *tPtr,const Identity &id);
+	void _enforcePeerLimit(uint64_t now,std::vector< SharedPtr<Peer> > &toSave,std::vector<Address> &removed); // _upstreams_m must be locked
 
 	const RuntimeEnvironment *const RR;
 
@@ -427,16 +580,53 @@ private:
 	unsigned int _trustedPathCount;
 	Mutex _trustedPaths_m;
 
-	Hashtable< Address,SharedPtr<Peer> > _peers;
-	Mutex _peers_m;
+	// Peers are split by address into separately locked shards so that
+	// lookups from different threads rarely contend. Shards are picked by
+	// address bits 32-35 since Hashtable buckets use the low bits.
+	struct _KnownIdentity
+	{
+		_KnownIdentity() : id(),lastUsed(0) {}
+		Identity id;
+		uint64_t lastUsed;
+	};
+	struct _PeerShard
+	{
+		FlatHashtable< Address,SharedPtr<Peer> > peers;
+		Hashtable< Address,_KnownIdentity > identities; // known identities without a Peer
+		AdaptiveMutex lock;
+	};
+	inline _PeerShard &_peerShard(const Address &a) { return _peers[(unsigned int)(a.toInt() >> 32) & (ZT_TOPOLOGY_PEER_SHARDS - 1)]; }
+	_PeerShard _peers[ZT_TOPOLOGY_PEER_SHARDS];
+
+	FlatHashtable< Path::HashKey,SharedPtr<Path> > _paths;
+	RWMutex _paths_m;
 
-	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
-	Mutex _paths_m;
+	// Paths removed from _paths, deleted after ZT_TOPOLOGY_PATH_RETIRE_DELAY (guarded by _paths_m)
+	std::vector< std::pair<uint64_t,Path *> > _retiredPaths;
+
+	volatile unsigned long _peerLimit; // 0 for none
+
+	// Position of incremental doPeriodicTasks() passes
+	uint64_t _lastClean;
+	unsigned int _cleanShard;
+	bool _cleanShardIdentities; // peers of _cleanShard are done, now doing its identities
+	unsigned long _cleanPosition;
+	unsigned long _cleanPathPosition;
+
+	struct _ValidatedIdentity
+	{
+		uint64_t fp[4];
+		uint64_t lastUsed; // 0 if empty
+	};
+	_ValidatedIdentity _validatedIdentities[ZT_TOPOLOGY_VALIDATED_IDENTITY_SETS][ZT_TOPOLOGY_VALIDATED_IDENTITY_WAYS];
+	uint64_t _validatedIdentityClock;
+	Mutex _validatedIdentities_m;
 
 	World _planet;
 	std::vector<World> _moons;
 	std::vector< std::pair<uint64_t,Address> > _moonSeeds;
 	std::vector<Address> _upstreamAddresses;
+	std::vector<Address> _addedUpstreams; // upstream peers created while _upstreams_m was held, to be announced by doPeriodicTasks()
 	CertificateOfRepresentation _cor;
 	bool _amRoot;
 	Mutex _upstreams_m; // locks worlds, upstream info, moon info, etc.
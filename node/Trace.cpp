@@ -28,6 +28,8 @@
 #include "RuntimeEnvironment.hpp"
 #include "Switch.hpp"
 #include "Node.hpp"
+#include "Metrics.hpp"
+#include "PacketTrace.hpp"
 #include "Utils.hpp"
 #include "Dictionary.hpp"
 #include "CertificateOfMembership.hpp"
@@ -53,6 +55,8 @@ void Trace::resettingPathsInScope(void *const tPtr,const Address &reporter,const
 
 void Trace::txTimedOut(void *const tPtr,const Address &destination)
 {
+	RR->metrics->inc(Metrics::TX_QUEUE_TIMEOUTS);
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_PACKET_DROPPED,PacketTrace::REASON_TX_TIMEOUT,0,0,0,destination.toInt(),0,0,0);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__TX_TIMED_OUT_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__REMOTE_ZTADDR,destination);
@@ -112,7 +116,9 @@ void Trace::peerRedirected(void *const tPtr,const uint64_t networkId,Peer &peer,
 
 void Trace::outgoingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network> &network,const MAC &sourceMac,const MAC &destMac,const unsigned int etherType,const unsigned int vlanId,const unsigned int frameLen,const char *reason)
 {
+	RR->metrics->inc(Metrics::FRAMES_OUT_DROPPED);
 	if (!network) return; // sanity check
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_FRAME_DROPPED,PacketTrace::REASON_REJECTED_OUTBOUND,0,network->id(),RR->identity.address().toInt(),0,0,0,frameLen);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__OUTGOING_NETWORK_FRAME_DROPPED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__SOURCE_MAC,sourceMac.toInt());
@@ -128,7 +134,9 @@ void Trace::outgoingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingNetworkAccessDenied(void *const tPtr,const SharedPtr<Network> &network,const SharedPtr<Path> &path,const uint64_t packetId,const unsigned int packetLength,const Address &source,const Packet::Verb verb,bool credentialsRequested)
 {
+	RR->metrics->inc(Metrics::FRAMES_IN_DROPPED_ACCESS);
 	if (!network) return; // sanity check
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_FRAME_DROPPED,PacketTrace::REASON_ACCESS_DENIED,packetId,network->id(),source.toInt(),RR->identity.address().toInt(),(unsigned int)verb,0,packetLength);
 	char tmp[128];
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_ACCESS_DENIED_S);
@@ -145,7 +153,9 @@ void Trace::incomingNetworkAccessDenied(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network> &network,const SharedPtr<Path> &path,const uint64_t packetId,const unsigned int packetLength,const Address &source,const Packet::Verb verb,const MAC &sourceMac,const MAC &destMac,const char *reason)
 {
+	RR->metrics->inc(Metrics::FRAMES_IN_DROPPED);
 	if (!network) return; // sanity check
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_FRAME_DROPPED,PacketTrace::REASON_REJECTED_INBOUND,packetId,network->id(),source.toInt(),RR->identity.address().toInt(),(unsigned int)verb,0,packetLength);
 	char tmp[128];
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_FRAME_DROPPED_S);
@@ -166,11 +176,17 @@ void Trace::incomingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingPacketTrustedPath(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const uint64_t trustedPathId,bool approved)
 {
+	if (!approved) {
+		RR->metrics->inc(Metrics::PACKETS_DROPPED_UNTRUSTED_PATH);
+		RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_PACKET_DROPPED,PacketTrace::REASON_UNTRUSTED_PATH,packetId,0,source.toInt(),RR->identity.address().toInt(),0,0,0);
+	}
 	// TODO
 }
 
 void Trace::incomingPacketMessageAuthenticationFailure(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const unsigned int hops)
 {
+	RR->metrics->inc(Metrics::CRYPTO_FAILURES);
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_PACKET_DROPPED,PacketTrace::REASON_MAC_FAILED,packetId,0,source.toInt(),RR->identity.address().toInt(),0,hops,0);
 	char tmp[128];
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__PACKET_MAC_FAILURE_S);
@@ -184,6 +200,8 @@ void Trace::incomingPacketMessageAuthenticationFailure(void *const tPtr,const Sh
 
 void Trace::incomingPacketInvalid(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const unsigned int hops,const Packet::Verb verb,const char *reason)
 {
+	RR->metrics->inc(Metrics::PACKETS_DROPPED_INVALID);
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_PACKET_DROPPED,PacketTrace::REASON_INVALID,packetId,0,source.toInt(),RR->identity.address().toInt(),(unsigned int)verb,hops,0);
 	char tmp[128];
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__PACKET_INVALID_S);
@@ -200,6 +218,8 @@ void Trace::incomingPacketInvalid(void *const tPtr,const SharedPtr<Path> &path,c
 
 void Trace::incomingPacketDroppedHELLO(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const char *reason)
 {
+	RR->metrics->inc(Metrics::PACKETS_DROPPED_HELLO);
+	RR->ptrace->record(RR->node->now(),PacketTrace::EVENT_PACKET_DROPPED,PacketTrace::REASON_HELLO_REJECTED,packetId,0,source.toInt(),RR->identity.address().toInt(),(unsigned int)Packet::VERB_HELLO,0,0);
 	char tmp[128];
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__PACKET_INVALID_S);
@@ -264,6 +284,7 @@ void Trace::networkFilter(
 
 void Trace::credentialRejected(void *const tPtr,const CertificateOfMembership &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__NETWORK_ID,c.networkId());
@@ -278,6 +299,7 @@ void Trace::credentialRejected(void *const tPtr,const CertificateOfMembership &c
 
 void Trace::credentialRejected(void *const tPtr,const CertificateOfOwnership &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__NETWORK_ID,c.networkId());
@@ -292,6 +314,7 @@ void Trace::credentialRejected(void *const tPtr,const CertificateOfOwnership &c,
 
 void Trace::credentialRejected(void *const tPtr,const CertificateOfRepresentation &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__CREDENTIAL_TYPE,(uint64_t)c.credentialType());
@@ -304,6 +327,7 @@ void Trace::credentialRejected(void *const tPtr,const CertificateOfRepresentatio
 
 void Trace::credentialRejected(void *const tPtr,const Capability &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__NETWORK_ID,c.networkId());
@@ -318,6 +342,7 @@ void Trace::credentialRejected(void *const tPtr,const Capability &c,const char *
 
 void Trace::credentialRejected(void *const tPtr,const Tag &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__NETWORK_ID,c.networkId());
@@ -333,6 +358,7 @@ void Trace::credentialRejected(void *const tPtr,const Tag &c,const char *reason)
 
 void Trace::credentialRejected(void *const tPtr,const Revocation &c,const char *reason)
 {
+	RR->metrics->inc(Metrics::CREDENTIALS_REJECTED);
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
 	d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED_S);
 	d.add(ZT_REMOTE_TRACE_FIELD__NETWORK_ID,c.networkId());
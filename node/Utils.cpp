@@ -31,6 +31,8 @@
 #include <time.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+
 #include "Constants.hpp"
 
 #ifdef __UNIX_LIKE__
@@ -55,6 +57,25 @@ namespace ZeroTier {
 
 const char Utils::HEXCHARS[16] = { '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f' };
 
+const uint8_t Utils::UNHEXCHARS[256] = {
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,1,2,3,4,5,6,7,8,9,0,0,0,0,0,0,          // 0..9
+	0,10,11,12,13,14,15,0,0,0,0,0,0,0,0,0,    // A..F
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,10,11,12,13,14,15,0,0,0,0,0,0,0,0,0,    // a..f
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
 // Crazy hack to force memory to be securely zeroed in spite of the best efforts of optimizing compilers.
 static void _Utils_doBurn(volatile uint8_t *ptr,unsigned int len)
 {
@@ -64,28 +85,22 @@ static void _Utils_doBurn(volatile uint8_t *ptr,unsigned int len)
 static void (*volatile _Utils_doBurn_ptr)(volatile uint8_t *,unsigned int) = _Utils_doBurn;
 void Utils::burn(void *ptr,unsigned int len) { (_Utils_doBurn_ptr)((volatile uint8_t *)ptr,len); }
 
-static unsigned long _Utils_itoa(unsigned long n,char *s)
-{
-	if (n == 0)
-		return 0;
-	unsigned long pos = _Utils_itoa(n / 10,s);
-	if (pos >= 22) // sanity check, should be impossible
-		pos = 22;
-	s[pos] = '0' + (char)(n % 10);
-	return pos + 1;
-}
 char *Utils::decimal(unsigned long n,char s[24])
 {
-	if (n == 0) {
-		s[0] = '0';
-		s[1] = (char)0;
-		return s;
-	}
-	s[_Utils_itoa(n,s)] = (char)0;
+	char t[24];
+	unsigned int l = 0;
+	do {
+		t[l++] = '0' + (char)(n % 10);
+		n /= 10;
+	} while (n);
+	for(unsigned int i=0;i<l;++i)
+		s[i] = t[l - (i + 1)];
+	s[l] = (char)0;
 	return s;
 }
 
-void Utils::getSecureRandom(void *buf,unsigned int bytes)
+// Global generator: OS entropy whitened with Salsa20, used to seed each thread's generator
+static void _Utils_getGlobalSecureRandom(void *buf,unsigned int bytes)
 {
 	static Mutex globalLock;
 	static Salsa20 s20;
@@ -116,7 +131,7 @@ void Utils::getSecureRandom(void *buf,unsigned int bytes)
 
 	static HCRYPTPROV cryptProvider = NULL;
 
-	for(unsigned int i=0;i<bytes;++i) {
+	while (bytes) {
 		if (randomPtr >= sizeof(randomBuf)) {
 			if (cryptProvider == NULL) {
 				if (!CryptAcquireContextA(&cryptProvider,NULL,NULL,PROV_RSA_FULL,CRYPT_VERIFYCONTEXT|CRYPT_SILENT)) {
@@ -132,7 +147,11 @@ void Utils::getSecureRandom(void *buf,unsigned int bytes)
 			s20.crypt12(randomBuf,randomBuf,sizeof(randomBuf));
 			s20.init(randomBuf,randomBuf);
 		}
-		((uint8_t *)buf)[i] = randomBuf[randomPtr++];
+		const unsigned int n = std::min(bytes,(unsigned int)sizeof(randomBuf) - randomPtr);
+		memcpy(buf,randomBuf + randomPtr,n);
+		randomPtr += n;
+		buf = reinterpret_cast<uint8_t *>(buf) + n;
+		bytes -= n;
 	}
 
 #else // not __WINDOWS__
@@ -148,7 +167,7 @@ void Utils::getSecureRandom(void *buf,unsigned int bytes)
 		}
 	}
 
-	for(unsigned int i=0;i<bytes;++i) {
+	while (bytes) {
 		if (randomPtr >= sizeof(randomBuf)) {
 			for(;;) {
 				if ((int)::read(devURandomFd,randomBuf,sizeof(randomBuf)) != (int)sizeof(randomBuf)) {
@@ -165,10 +184,68 @@ void Utils::getSecureRandom(void *buf,unsigned int bytes)
 			s20.crypt12(randomBuf,randomBuf,sizeof(randomBuf));
 			s20.init(randomBuf,randomBuf);
 		}
-		((uint8_t *)buf)[i] = randomBuf[randomPtr++];
+		const unsigned int n = std::min(bytes,(unsigned int)sizeof(randomBuf) - randomPtr);
+		memcpy(buf,randomBuf + randomPtr,n);
+		randomPtr += n;
+		buf = reinterpret_cast<uint8_t *>(buf) + n;
+		bytes -= n;
 	}
 
 #endif // __WINDOWS__ or not
 }
 
+// Keystream bytes generated per refill of a thread's buffer
+#define ZT_UTILS_THREAD_RANDOM_BUF_SIZE 4096
+
+// Bytes a thread hands out before its generator is reseeded from the global one
+#define ZT_UTILS_THREAD_RANDOM_RESEED_AFTER 1048576
+
+namespace {
+// Per-thread Salsa20 generator keyed from the global one. The first 40
+// bytes of each refill rekey the cipher and are never handed out, so
+// earlier output can't be recovered from the thread's state.
+struct _ThreadRandom
+{
+	_ThreadRandom() : ptr(ZT_UTILS_THREAD_RANDOM_BUF_SIZE),sinceReseed(ZT_UTILS_THREAD_RANDOM_RESEED_AFTER) {}
+	~_ThreadRandom() { Utils::burn(buf,sizeof(buf)); }
+
+	inline void refill()
+	{
+		if (sinceReseed >= ZT_UTILS_THREAD_RANDOM_RESEED_AFTER) {
+			uint8_t seed[40];
+			_Utils_getGlobalSecureRandom(seed,sizeof(seed));
+			s20.init(seed,seed + 32);
+			Utils::burn(seed,sizeof(seed));
+			sinceReseed = 0;
+		}
+		memset(buf,0,sizeof(buf));
+		s20.crypt12(buf,buf,sizeof(buf));
+		s20.init(buf,buf + 32);
+		ptr = 40;
+		sinceReseed += sizeof(buf) - 40;
+	}
+
+	Salsa20 s20;
+	uint8_t buf[ZT_UTILS_THREAD_RANDOM_BUF_SIZE];
+	unsigned int ptr;
+	unsigned long sinceReseed;
+};
+static thread_local _ThreadRandom _threadRandom;
+} // anonymous namespace
+
+void Utils::getSecureRandom(void *buf,unsigned int bytes)
+{
+	_ThreadRandom &tr = _threadRandom;
+	while (bytes) {
+		if (tr.ptr >= sizeof(tr.buf))
+			tr.refill();
+		const unsigned int n = std::min(bytes,(unsigned int)sizeof(tr.buf) - tr.ptr);
+		memcpy(buf,tr.buf + tr.ptr,n);
+		memset(tr.buf + tr.ptr,0,n); // handed out bytes don't linger in this thread's buffer
+		tr.ptr += n;
+		buf = reinterpret_cast<uint8_t *>(buf) + n;
+		bytes -= n;
+	}
+}
+
 } // namespace ZeroTier
@@ -40,6 +40,11 @@
 
 #include "Constants.hpp"
 
+#if (!defined(ZT_UTILS_SSE2)) && defined(__SSE2__)
+#define ZT_UTILS_SSE2 1
+#include <emmintrin.h>
+#endif
+
 namespace ZeroTier {
 
 /**
@@ -76,24 +81,28 @@ public:
 	 */
 	static char *decimal(unsigned long n,char s[24]);
 
+	/**
+	 * Spell out a 32-bit value as 8 hex digits, most significant first
+	 *
+	 * Each nibble is spread into its own byte and all eight are turned into
+	 * digits at once, with no table lookups or branches.
+	 *
+	 * @param v Value
+	 * @return Eight ASCII digits in big-endian order (store with storeBigEndian())
+	 */
+	static inline uint64_t hexDigits(const uint32_t v)
+	{
+		uint64_t x = v;
+		x = ((x & 0xffff0000ULL) << 16) | (x & 0x0000ffffULL);
+		x = ((x & 0x0000ff000000ff00ULL) << 8) | (x & 0x000000ff000000ffULL);
+		x = ((x & 0x00f000f000f000f0ULL) << 4) | (x & 0x000f000f000f000fULL);
+		return (x + 0x3030303030303030ULL + ((((x + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL) * 0x27));
+	}
+
 	static inline char *hex(uint64_t i,char s[17])
 	{
-		s[0] = HEXCHARS[(i >> 60) & 0xf];
-		s[1] = HEXCHARS[(i >> 56) & 0xf];
-		s[2] = HEXCHARS[(i >> 52) & 0xf];
-		s[3] = HEXCHARS[(i >> 48) & 0xf];
-		s[4] = HEXCHARS[(i >> 44) & 0xf];
-		s[5] = HEXCHARS[(i >> 40) & 0xf];
-		s[6] = HEXCHARS[(i >> 36) & 0xf];
-		s[7] = HEXCHARS[(i >> 32) & 0xf];
-		s[8] = HEXCHARS[(i >> 28) & 0xf];
-		s[9] = HEXCHARS[(i >> 24) & 0xf];
-		s[10] = HEXCHARS[(i >> 20) & 0xf];
-		s[11] = HEXCHARS[(i >> 16) & 0xf];
-		s[12] = HEXCHARS[(i >> 12) & 0xf];
-		s[13] = HEXCHARS[(i >> 8) & 0xf];
-		s[14] = HEXCHARS[(i >> 4) & 0xf];
-		s[15] = HEXCHARS[i & 0xf];
+		storeBigEndian<uint64_t>(s,hexDigits((uint32_t)(i >> 32)));
+		storeBigEndian<uint64_t>(s + 8,hexDigits((uint32_t)i));
 		s[16] = (char)0;
 		return s;
 	}
@@ -102,28 +111,14 @@ public:
 	{
 		s[0] = HEXCHARS[(i >> 36) & 0xf];
 		s[1] = HEXCHARS[(i >> 32) & 0xf];
-		s[2] = HEXCHARS[(i >> 28) & 0xf];
-		s[3] = HEXCHARS[(i >> 24) & 0xf];
-		s[4] = HEXCHARS[(i >> 20) & 0xf];
-		s[5] = HEXCHARS[(i >> 16) & 0xf];
-		s[6] = HEXCHARS[(i >> 12) & 0xf];
-		s[7] = HEXCHARS[(i >> 8) & 0xf];
-		s[8] = HEXCHARS[(i >> 4) & 0xf];
-		s[9] = HEXCHARS[i & 0xf];
+		storeBigEndian<uint64_t>(s + 2,hexDigits((uint32_t)i));
 		s[10] = (char)0;
 		return s;
 	}
 
 	static inline char *hex(uint32_t i,char s[9])
 	{
-		s[0] = HEXCHARS[(i >> 28) & 0xf];
-		s[1] = HEXCHARS[(i >> 24) & 0xf];
-		s[2] = HEXCHARS[(i >> 20) & 0xf];
-		s[3] = HEXCHARS[(i >> 16) & 0xf];
-		s[4] = HEXCHARS[(i >> 12) & 0xf];
-		s[5] = HEXCHARS[(i >> 8) & 0xf];
-		s[6] = HEXCHARS[(i >> 4) & 0xf];
-		s[7] = HEXCHARS[i & 0xf];
+		storeBigEndian<uint64_t>(s,hexDigits(i));
 		s[8] = (char)0;
 		return s;
 	}
@@ -146,79 +141,95 @@ public:
 		return s;
 	}
 
+	/**
+	 * Encode bytes as lower case hex
+	 *
+	 * @param d Data
+	 * @param l Length of data
+	 * @param s Buffer of at least (l * 2) + 1 bytes
+	 * @return Pointer to s
+	 */
 	static inline char *hex(const void *d,unsigned int l,char *s)
 	{
-		char *const save = s;
-		for(unsigned int i=0;i<l;++i) {
-			const unsigned int b = reinterpret_cast<const uint8_t *>(d)[i];
-			*(s++) = HEXCHARS[b >> 4];
-			*(s++) = HEXCHARS[b & 0xf];
+		const uint8_t *b = reinterpret_cast<const uint8_t *>(d);
+		char *p = s;
+#ifdef ZT_UTILS_SSE2
+		// Sixteen bytes at a time: split into nibbles, turn each into a digit, and interleave
+		const __m128i lowNibbles = _mm_set1_epi8(0x0f);
+		const __m128i nine = _mm_set1_epi8(9);
+		const __m128i zero = _mm_set1_epi8('0');
+		const __m128i letterGap = _mm_set1_epi8('a' - '0' - 10);
+		while (l >= 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(v,4),lowNibbles);
+			__m128i lo = _mm_and_si128(v,lowNibbles);
+			hi = _mm_add_epi8(_mm_add_epi8(hi,zero),_mm_and_si128(_mm_cmpgt_epi8(hi,nine),letterGap));
+			lo = _mm_add_epi8(_mm_add_epi8(lo,zero),_mm_and_si128(_mm_cmpgt_epi8(lo,nine),letterGap));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(p),_mm_unpacklo_epi8(hi,lo));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16),_mm_unpackhi_epi8(hi,lo));
+			b += 16;
+			p += 32;
+			l -= 16;
 		}
-		*s = (char)0;
-		return save;
+#endif
+		while (l >= 4) {
+			storeBigEndian<uint64_t>(p,hexDigits(loadBigEndian<uint32_t>(b)));
+			b += 4;
+			p += 8;
+			l -= 4;
+		}
+		while (l) {
+			*(p++) = HEXCHARS[*b >> 4];
+			*(p++) = HEXCHARS[*(b++) & 0xf];
+			--l;
+		}
+		*p = (char)0;
+		return s;
 	}
 
+	/**
+	 * Decode hex, upper or lower case, up to a NUL or until buf is full
+	 *
+	 * Characters that aren't hex digits decode as zero and a trailing odd
+	 * digit is ignored.
+	 *
+	 * @param h Hex string
+	 * @param buf Buffer for decoded bytes
+	 * @param buflen Size of buf
+	 * @return Number of bytes decoded
+	 */
 	static inline unsigned int unhex(const char *h,void *buf,unsigned int buflen)
 	{
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(h);
+		uint8_t *const b = reinterpret_cast<uint8_t *>(buf);
 		unsigned int l = 0;
 		while (l < buflen) {
-			uint8_t hc = *(reinterpret_cast<const uint8_t *>(h++));
-			if (!hc) break;
-
-			uint8_t c = 0;
-			if ((hc >= 48)&&(hc <= 57)) // 0..9
-				c = hc - 48;
-			else if ((hc >= 97)&&(hc <= 102)) // a..f
-				c = hc - 87;
-			else if ((hc >= 65)&&(hc <= 70)) // A..F
-				c = hc - 55;
-
-			hc = *(reinterpret_cast<const uint8_t *>(h++));
-			if (!hc) break;
-
-			c <<= 4;
-			if ((hc >= 48)&&(hc <= 57))
-				c |= hc - 48;
-			else if ((hc >= 97)&&(hc <= 102))
-				c |= hc - 87;
-			else if ((hc >= 65)&&(hc <= 70))
-				c |= hc - 55;
-
-			reinterpret_cast<uint8_t *>(buf)[l++] = c;
+			if ((!p[0])||(!p[1])) break;
+			b[l++] = (uint8_t)((UNHEXCHARS[p[0]] << 4) | UNHEXCHARS[p[1]]);
+			p += 2;
 		}
 		return l;
 	}
 
+	/**
+	 * Decode at most hlen characters of hex, as unhex() above
+	 *
+	 * @param h Hex string
+	 * @param hlen Most characters to read from h
+	 * @param buf Buffer for decoded bytes
+	 * @param buflen Size of buf
+	 * @return Number of bytes decoded
+	 */
 	static inline unsigned int unhex(const char *h,unsigned int hlen,void *buf,unsigned int buflen)
 	{
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(h);
+		uint8_t *const b = reinterpret_cast<uint8_t *>(buf);
 		unsigned int l = 0;
-		const char *hend = h + hlen;
-		while (l < buflen) {
-			if (h == hend) break;
-			uint8_t hc = *(reinterpret_cast<const uint8_t *>(h++));
-			if (!hc) break;
-
-			uint8_t c = 0;
-			if ((hc >= 48)&&(hc <= 57))
-				c = hc - 48;
-			else if ((hc >= 97)&&(hc <= 102))
-				c = hc - 87;
-			else if ((hc >= 65)&&(hc <= 70))
-				c = hc - 55;
-
-			if (h == hend) break;
-			hc = *(reinterpret_cast<const uint8_t *>(h++));
-			if (!hc) break;
-
-			c <<= 4;
-			if ((hc >= 48)&&(hc <= 57))
-				c |= hc - 48;
-			else if ((hc >= 97)&&(hc <= 102))
-				c |= hc - 87;
-			else if ((hc >= 65)&&(hc <= 70))
-				c |= hc - 55;
-
-			reinterpret_cast<uint8_t *>(buf)[l++] = c;
+		while ((l < buflen)&&(hlen >= 2)) {
+			if ((!p[0])||(!p[1])) break;
+			b[l++] = (uint8_t)((UNHEXCHARS[p[0]] << 4) | UNHEXCHARS[p[1]]);
+			p += 2;
+			hlen -= 2;
 		}
 		return l;
 	}
@@ -226,8 +237,10 @@ public:
 	/**
 	 * Generate secure random bytes
 	 *
-	 * This will try to use whatever OS sources of entropy are available. It's
-	 * guarded by an internal mutex so it's thread-safe.
+	 * This will try to use whatever OS sources of entropy are available. Each
+	 * thread draws from its own Salsa20 generator that is seeded and
+	 * periodically reseeded from a global one fed by the OS, so calls take no
+	 * lock except when reseeding. It's thread-safe.
 	 *
 	 * @param buf Buffer to fill
 	 * @param bytes Number of random bytes to generate
@@ -347,6 +360,22 @@ public:
 		return (uint64_t)(v * ((uint64_t)~(uint64_t)0/255)) >> 56;
 	}
 
+	/**
+	 * Get how many table entries one housekeeping slice should examine
+	 *
+	 * This is enough to cover the whole table about once per
+	 * ZT_HOUSEKEEPING_PERIOD, but never more than ZT_HOUSEKEEPING_SLICE_MAX.
+	 *
+	 * @param tableSize Number of entries in table
+	 * @param elapsed Time since the last slice of this table
+	 * @return Entries to examine now
+	 */
+	static inline unsigned long housekeepingSlice(const unsigned long tableSize,const uint64_t elapsed)
+	{
+		const uint64_t n = ((uint64_t)tableSize * ((elapsed < ZT_HOUSEKEEPING_PERIOD) ? elapsed : (uint64_t)ZT_HOUSEKEEPING_PERIOD)) / ZT_HOUSEKEEPING_PERIOD;
+		return (unsigned long)((n < 16) ? 16 : ((n > ZT_HOUSEKEEPING_SLICE_MAX) ? ZT_HOUSEKEEPING_SLICE_MAX : n));
+	}
+
 	/**
 	 * Check if a memory buffer is all-zero
 	 *
@@ -422,10 +451,47 @@ public:
 	}
 	static inline int64_t ntoh(int64_t n) { return (int64_t)ntoh((uint64_t)n); }
 
+	/**
+	 * Store an integer in big-endian byte order at a possibly unaligned location
+	 *
+	 * This compiles to a byte swap and a store, so fixed-size wire layouts
+	 * can be written with one bounds check for the whole field.
+	 *
+	 * @param p Destination with at least sizeof(T) bytes
+	 * @param v Value
+	 * @tparam T Integer type (e.g. uint16_t, int64_t)
+	 */
+	template<typename T>
+	static inline void storeBigEndian(void *const p,const T v)
+	{
+		const T n = hton(v);
+		memcpy(p,&n,sizeof(T));
+	}
+
+	/**
+	 * Load an integer in big-endian byte order from a possibly unaligned location
+	 *
+	 * @param p Source with at least sizeof(T) bytes
+	 * @return Value
+	 * @tparam T Integer type (e.g. uint16_t, int64_t)
+	 */
+	template<typename T>
+	static inline T loadBigEndian(const void *const p)
+	{
+		T n;
+		memcpy(&n,p,sizeof(T));
+		return ntoh(n);
+	}
+
 	/**
 	 * Hexadecimal characters 0-f
 	 */
 	static const char HEXCHARS[16];
+
+	/**
+	 * Value of each hex digit by character, or zero for anything else
+	 */
+	static const uint8_t UNHEXCHARS[256];
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,214 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_VERIFICATIONGATE_HPP
+#define ZT_VERIFICATIONGATE_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "InetAddress.hpp"
+#include "Mutex.hpp"
+#include "Utils.hpp"
+
+/**
+ * Number of independently locked shards
+ */
+#define ZT_VERIFICATION_GATE_SHARDS 16
+
+/**
+ * Default number of source prefixes tracked across all shards
+ */
+#define ZT_VERIFICATION_GATE_DEFAULT_SIZE 16384
+
+/**
+ * Default number of verifications a prefix may have back to back after an idle period
+ */
+#define ZT_VERIFICATION_GATE_DEFAULT_BURST 1
+
+/**
+ * Slots probed for a prefix before the least recently used is taken over
+ */
+#define ZT_VERIFICATION_GATE_PROBE 8
+
+namespace ZeroTier {
+
+/**
+ * Admission control for expensive identity verification
+ *
+ * Validating a new identity costs milliseconds of CPU, so a HELLO from an
+ * unknown identity is only verified if its source's IPv4 /24 or IPv6 /48
+ * has a token. Each prefix has a token bucket holding up to 'burst' tokens
+ * that refills at one per ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT ms.
+ *
+ * Buckets are kept in open addressed tables keyed by the whole prefix, so
+ * unrelated sources never share one, under a per-process random salt so
+ * sources can't be picked to pile into one part of the table. The tables
+ * are split into shards, each with its own lock, so I/O threads seldom
+ * wait on each other. When all the slots probed for a new prefix are taken
+ * the least recently used is given to it. A bucket that has been idle long
+ * enough to refill is as good as absent, so during a flood from many
+ * prefixes it's the flood's own buckets that get recycled.
+ */
+class VerificationGate : NonCopyable
+{
+public:
+	VerificationGate() :
+		_burst(ZT_VERIFICATION_GATE_DEFAULT_BURST)
+	{
+		Utils::getSecureRandom(&_salt,sizeof(_salt));
+		_salt |= 1;
+		setSize(ZT_VERIFICATION_GATE_DEFAULT_SIZE);
+	}
+
+	/**
+	 * Resize tables, forgetting all prefixes if the size changes
+	 *
+	 * @param size Number of prefixes to track (rounded up to a power of two per shard)
+	 */
+	inline void setSize(const unsigned long size)
+	{
+		unsigned long per = 64;
+		while ((per * ZT_VERIFICATION_GATE_SHARDS) < size)
+			per <<= 1;
+		for(unsigned int s=0;s<ZT_VERIFICATION_GATE_SHARDS;++s) {
+			Mutex::Lock _l(_shards[s].lock);
+			if (_shards[s].entries.size() == per)
+				continue;
+			std::vector<_Entry>(per).swap(_shards[s].entries);
+			_shards[s].mask = per - 1;
+		}
+	}
+
+	/**
+	 * @param burst Verifications a prefix may have back to back (at least 1)
+	 */
+	inline void setBurst(const unsigned int burst) { _burst = (burst) ? burst : 1; }
+
+	/**
+	 * @return Number of prefixes tracked
+	 */
+	inline unsigned long size() const
+	{
+		unsigned long n = 0;
+		for(unsigned int s=0;s<ZT_VERIFICATION_GATE_SHARDS;++s) {
+			Mutex::Lock _l(_shards[s].lock);
+			n += (unsigned long)_shards[s].entries.size();
+		}
+		return n;
+	}
+
+	/**
+	 * Take a token for a source if it has one
+	 *
+	 * @param now Current time
+	 * @param from Source of packet needing verification
+	 * @return True if verification may go ahead
+	 */
+	inline bool admit(const uint64_t now,const InetAddress &from)
+	{
+		const uint64_t key = _prefix(from);
+		const uint64_t h = (key ^ _salt) * 0x9e3779b97f4a7c15ULL;
+		_Shard &sh = _shards[(unsigned int)(h >> 60) % ZT_VERIFICATION_GATE_SHARDS];
+		const int64_t capacity = (int64_t)_burst * ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT;
+
+		Mutex::Lock _l(sh.lock);
+		_Entry *e = (_Entry *)0;
+		_Entry *lru = (_Entry *)0;
+		for(unsigned long p=0;p<ZT_VERIFICATION_GATE_PROBE;++p) {
+			_Entry &c = sh.entries[(unsigned long)((h >> 20) + p) & sh.mask];
+			if ((c.last)&&(c.key == key)) {
+				e = &c;
+				break;
+			}
+			if ((!lru)||(c.last < lru->last))
+				lru = &c;
+		}
+		if (!e) {
+			e = lru;
+			e->key = key;
+			e->tokens = capacity;
+			e->last = now;
+		} else if (now > e->last) {
+			e->tokens += (int64_t)(now - e->last);
+			if (e->tokens > capacity)
+				e->tokens = capacity;
+		}
+		if (now > e->last)
+			e->last = now;
+		else if (!e->last)
+			e->last = 1;
+
+		if (e->tokens >= ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT) {
+			e->tokens -= ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	struct _Entry
+	{
+		_Entry() : key(0),last(0),tokens(0) {}
+		uint64_t key;
+		uint64_t last;  // last seen, or 0 if slot is empty
+		int64_t tokens; // in milliseconds of refill
+	};
+
+	struct _Shard
+	{
+		_Shard() : mask(0) {}
+		std::vector<_Entry> entries;
+		unsigned long mask;
+		Mutex lock;
+	};
+
+	// IPv4 /24 or IPv6 /48 with the family in the top byte
+	static inline uint64_t _prefix(const InetAddress &a)
+	{
+		if (a.ss_family == AF_INET) {
+			return (0x04ULL << 56) | (uint64_t)(Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(&a)->sin_addr.s_addr) >> 8);
+		} else if (a.ss_family == AF_INET6) {
+			const uint8_t *const ip = reinterpret_cast<const uint8_t *>(reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_addr.s6_addr);
+			uint64_t p = 0x06ULL;
+			for(unsigned int i=0;i<6;++i)
+				p = (p << 8) | (uint64_t)ip[i];
+			return (p << 8);
+		}
+		return 0;
+	}
+
+	uint64_t _salt;
+	volatile unsigned int _burst;
+	_Shard _shards[ZT_VERIFICATION_GATE_SHARDS];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -1,8 +1,16 @@
 CORE_OBJS=\
+	node/AES.o \
 	node/C25519.o \
 	node/Capability.o \
 	node/CertificateOfMembership.o \
 	node/CertificateOfOwnership.o \
+	node/Cluster.o \
+	node/CryptoPipeline.o \
+	node/Bench.o \
+	node/Capture.o \
+	node/Fec.o \
+	node/FlowExport.o \
+	node/HugePages.o \
 	node/Identity.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
@@ -20,6 +28,7 @@ CORE_OBJS=\
 	node/Salsa20.o \
 	node/SelfAwareness.o \
 	node/SHA512.o \
+	node/SignatureCache.o \
 	node/Switch.o \
 	node/Tag.o \
 	node/Topology.o \
@@ -29,9 +38,14 @@ CORE_OBJS=\
 ONE_OBJS=\
 	controller/EmbeddedNetworkController.o \
 	controller/JSONDB.o \
+	osdep/Arp.o \
+	osdep/CpuAffinity.o \
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
 	osdep/OSUtils.o \
+	osdep/TunAdapter.o \
+	osdep/UserspaceStack.o \
+	service/ClusterGeoIpService.o \
 	service/SoftwareUpdater.o \
 	service/OneService.o
 
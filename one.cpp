@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
 
 #include "node/Constants.hpp"
 
@@ -53,7 +54,6 @@
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <dirent.h>
-#include <signal.h>
 #ifdef __LINUX__
 #include <sys/prctl.h>
 #include <sys/syscall.h>
@@ -64,6 +64,9 @@
 #endif
 
 #include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
@@ -77,6 +80,9 @@
 #include "node/NetworkController.hpp"
 #include "node/Buffer.hpp"
 #include "node/World.hpp"
+#include "node/Mutex.hpp"
+#include "node/Bench.hpp"
+#include "node/Capture.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Http.hpp"
@@ -88,6 +94,9 @@
 
 #define ZT_PID_PATH "zerotier-one.pid"
 
+// Busiest peers shown by zerotier-cli top
+#define ZT_CLI_TOP_MAX_PEERS 20
+
 using namespace ZeroTier;
 
 static OneService *volatile zt1Service = (OneService *)0;
@@ -128,6 +137,10 @@ static void cliPrintHelp(const char *pn,FILE *out)
 	fprintf(out,"  info                    - Display status info" ZT_EOL_S);
 	fprintf(out,"  listpeers               - List all peers" ZT_EOL_S);
 	fprintf(out,"  listnetworks            - List all networks" ZT_EOL_S);
+	fprintf(out,"  top [<seconds>]         - Live traffic per peer and network" ZT_EOL_S);
+	fprintf(out,"  bench <address> [<sec>] - Test throughput and latency to a peer" ZT_EOL_S);
+	fprintf(out,"  capture <file> [<filter>] - Capture frames to a pcapng file until ^C" ZT_EOL_S);
+	fprintf(out,"    filter: nwid=<network>,peer=<address>,ethertype=<hex>,dir=in|out,drops,snap=<bytes>" ZT_EOL_S);
 	fprintf(out,"  join <network>          - Join a network" ZT_EOL_S);
 	fprintf(out,"  leave <network>         - Leave a network" ZT_EOL_S);
 	fprintf(out,"  set <network> <setting> - Set a network setting" ZT_EOL_S);
@@ -147,6 +160,380 @@ static std::string cliFixJsonCRs(const std::string &s)
 	return r;
 }
 
+// Per-second rate as a short human readable string e.g. 12.3K
+static const char *cliRate(char *buf,unsigned int len,double r)
+{
+	if (r >= 1000000000.0)
+		OSUtils::ztsnprintf(buf,len,"%.1fG",r / 1000000000.0);
+	else if (r >= 1000000.0)
+		OSUtils::ztsnprintf(buf,len,"%.1fM",r / 1000000.0);
+	else if (r >= 1000.0)
+		OSUtils::ztsnprintf(buf,len,"%.1fK",r / 1000.0);
+	else OSUtils::ztsnprintf(buf,len,"%.0f",r);
+	return buf;
+}
+
+struct _CliTopRow
+{
+	_CliTopRow() : pktIn(0),pktOut(0),bytesIn(0),bytesOut(0),drops(0),rPktIn(0.0),rPktOut(0.0),rBytesIn(0.0),rBytesOut(0.0),rDrops(0.0),latency(0) {}
+
+	// Takes new totals and turns the change since the last ones into rates
+	inline void update(nlohmann::json &j,const char *dropsField,const char *pktInField,const char *pktOutField,const double secs,const bool baseline)
+	{
+		const uint64_t pi = OSUtils::jsonInt(j[pktInField],0);
+		const uint64_t po = OSUtils::jsonInt(j[pktOutField],0);
+		const uint64_t bi = OSUtils::jsonInt(j["bytesIn"],0);
+		const uint64_t bo = OSUtils::jsonInt(j["bytesOut"],0);
+		const uint64_t d = OSUtils::jsonInt(j[dropsField],0);
+		if (baseline) {
+			rPktIn = rPktOut = rBytesIn = rBytesOut = rDrops = 0.0;
+		} else {
+			rPktIn = (double)(pi - std::min(pi,pktIn)) / secs;
+			rPktOut = (double)(po - std::min(po,pktOut)) / secs;
+			rBytesIn = (double)(bi - std::min(bi,bytesIn)) / secs;
+			rBytesOut = (double)(bo - std::min(bo,bytesOut)) / secs;
+			rDrops = (double)(d - std::min(d,drops)) / secs;
+		}
+		pktIn = pi; pktOut = po; bytesIn = bi; bytesOut = bo; drops = d;
+	}
+
+	inline void idle() { rPktIn = rPktOut = rBytesIn = rBytesOut = rDrops = 0.0; }
+
+	inline bool operator<(const _CliTopRow &r) const { return ((rBytesIn + rBytesOut) > (r.rBytesIn + r.rBytesOut)); } // busiest first
+
+	std::string id;
+	std::string info;
+	uint64_t pktIn,pktOut,bytesIn,bytesOut,drops;
+	double rPktIn,rPktOut,rBytesIn,rBytesOut,rDrops;
+	unsigned int latency;
+};
+
+/* Live traffic view. The first poll gets every peer's counters, after which
+ * only peers with traffic since the last poll are fetched (GET /peer?since=)
+ * and only the fields shown, so each refresh stays small on a big node. */
+static int cliTop(const InetAddress &addr,std::map<std::string,std::string> &requestHeaders,unsigned int interval)
+{
+	std::map<std::string,std::string> responseHeaders;
+	std::map<std::string,_CliTopRow> peers,networks;
+	uint64_t since = 0; // node clock, from lastActivity of peers seen
+	uint64_t lastPoll = 0;
+	char tmp[1024],r1[32],r2[32],r3[32],r4[32],r5[32];
+
+	for(;;) {
+		const uint64_t now = OSUtils::now();
+		const double secs = (lastPoll) ? ((double)std::max(now - lastPoll,(uint64_t)1) / 1000.0) : 1.0;
+		lastPoll = now;
+
+		std::string responseBody;
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"/peer?since=%llu&fields=address,latency,role,packetsIn,packetsOut,bytesIn,bytesOut,packetsDropped,lastActivity,paths",(unsigned long long)since);
+		unsigned int scode = Http::GET(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,tmp,requestHeaders,responseHeaders,responseBody);
+		if (scode != 200) {
+			printf("%u top %s" ZT_EOL_S,scode,responseBody.c_str());
+			return 1;
+		}
+		nlohmann::json pj,nj;
+		try {
+			pj = OSUtils::jsonParse(responseBody);
+			responseBody.clear();
+			scode = Http::GET(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/network?fields=nwid,name,framesIn,framesOut,bytesIn,bytesOut,framesDropped",requestHeaders,responseHeaders,responseBody);
+			if (scode != 200) {
+				printf("%u top %s" ZT_EOL_S,scode,responseBody.c_str());
+				return 1;
+			}
+			nj = OSUtils::jsonParse(responseBody);
+		} catch ( ... ) {
+			printf("%u top invalid JSON response" ZT_EOL_S,scode);
+			return 1;
+		}
+
+		for(std::map<std::string,_CliTopRow>::iterator p(peers.begin());p!=peers.end();++p)
+			p->second.idle(); // peers not returned had no traffic
+		unsigned long active = 0;
+		uint64_t newSince = since;
+		if (pj.is_array()) {
+			for(unsigned long k=0;k<pj.size();++k) {
+				nlohmann::json &p = pj[k];
+				const std::string a(OSUtils::jsonString(p["address"],""));
+				if (!a.length())
+					continue;
+				std::map<std::string,_CliTopRow>::iterator row(peers.find(a));
+				const bool isNew = (row == peers.end());
+				if (isNew) {
+					row = peers.insert(std::pair<std::string,_CliTopRow>(a,_CliTopRow())).first;
+					row->second.id = a;
+				}
+				row->second.update(p,"packetsDropped","packetsIn","packetsOut",secs,isNew);
+				row->second.latency = (unsigned int)OSUtils::jsonInt(p["latency"],0);
+				const char *pathType = "RELAY";
+				nlohmann::json &paths = p["paths"];
+				if (paths.is_array()) {
+					for(unsigned long i=0;i<paths.size();++i) {
+						if ((OSUtils::jsonBool(paths[i]["preferred"],false))&&(OSUtils::jsonBool(paths[i]["active"],false))) {
+							pathType = "DIRECT";
+							break;
+						}
+					}
+				}
+				row->second.info = OSUtils::jsonString(p["role"],"-") + "/" + pathType;
+				newSince = std::max(newSince,(uint64_t)OSUtils::jsonInt(p["lastActivity"],0));
+				if ((row->second.rPktIn > 0.0)||(row->second.rPktOut > 0.0))
+					++active;
+			}
+		}
+		since = newSince;
+
+		if (nj.is_array()) {
+			for(unsigned long k=0;k<nj.size();++k) {
+				nlohmann::json &n = nj[k];
+				const std::string id(OSUtils::jsonString(n["nwid"],""));
+				if (!id.length())
+					continue;
+				std::map<std::string,_CliTopRow>::iterator row(networks.find(id));
+				const bool isNew = (row == networks.end());
+				if (isNew) {
+					row = networks.insert(std::pair<std::string,_CliTopRow>(id,_CliTopRow())).first;
+					row->second.id = id;
+				}
+				row->second.update(n,"framesDropped","framesIn","framesOut",secs,isNew);
+				row->second.info = OSUtils::jsonString(n["name"],"-");
+			}
+		}
+
+		std::vector<_CliTopRow> prows,nrows;
+		for(std::map<std::string,_CliTopRow>::const_iterator p(peers.begin());p!=peers.end();++p)
+			prows.push_back(p->second);
+		for(std::map<std::string,_CliTopRow>::const_iterator n(networks.begin());n!=networks.end();++n)
+			nrows.push_back(n->second);
+		std::stable_sort(prows.begin(),prows.end());
+		std::stable_sort(nrows.begin(),nrows.end());
+
+		printf("\033[H\033[2J"); // home and clear, ANSI
+		printf("zerotier-cli top - every %us, %lu peers (%lu with traffic), %lu networks" ZT_EOL_S ZT_EOL_S,interval,(unsigned long)peers.size(),active,(unsigned long)networks.size());
+		printf("%-16s %-20s %8s %8s %8s %8s %7s" ZT_EOL_S,"NETWORK","NAME","PKT/S IN","OUT","B/S IN","OUT","DROP/S");
+		for(std::vector<_CliTopRow>::const_iterator n(nrows.begin());n!=nrows.end();++n) {
+			printf("%-16s %-20.20s %8s %8s %8s %8s %7.0f" ZT_EOL_S,
+				n->id.c_str(),
+				n->info.c_str(),
+				cliRate(r1,sizeof(r1),n->rPktIn),
+				cliRate(r2,sizeof(r2),n->rPktOut),
+				cliRate(r3,sizeof(r3),n->rBytesIn),
+				cliRate(r4,sizeof(r4),n->rBytesOut),
+				n->rDrops);
+		}
+		printf(ZT_EOL_S "%-16s %-20s %8s %8s %8s %8s %7s %s" ZT_EOL_S,"PEER","ROLE/PATH","PKT/S IN","OUT","B/S IN","OUT","DROP/S","LATENCY");
+		unsigned int shown = 0;
+		for(std::vector<_CliTopRow>::const_iterator p(prows.begin());((p!=prows.end())&&(shown < ZT_CLI_TOP_MAX_PEERS));++p,++shown) {
+			if (p->latency)
+				OSUtils::ztsnprintf(r5,sizeof(r5),"%ums",p->latency);
+			else OSUtils::ztsnprintf(r5,sizeof(r5),"-");
+			printf("%-16s %-20.20s %8s %8s %8s %8s %7.0f %s" ZT_EOL_S,
+				p->id.c_str(),
+				p->info.c_str(),
+				cliRate(r1,sizeof(r1),p->rPktIn),
+				cliRate(r2,sizeof(r2),p->rPktOut),
+				cliRate(r3,sizeof(r3),p->rBytesIn),
+				cliRate(r4,sizeof(r4),p->rBytesOut),
+				p->rDrops,
+				r5);
+		}
+		fflush(stdout);
+
+		Thread::sleep((unsigned long)interval * 1000);
+	}
+}
+
+/* Peer throughput and latency test. The node runs it (POST /bench/<address>)
+ * and this polls GET /bench until it's over, then prints the result. */
+static int cliBench(const InetAddress &addr,std::map<std::string,std::string> &requestHeaders,const std::string &peer,unsigned int seconds,bool jsonOut)
+{
+	std::map<std::string,std::string> responseHeaders;
+	std::string responseBody;
+	char jsons[128],cl[32],r1[32],r2[32];
+
+	OSUtils::ztsnprintf(jsons,sizeof(jsons),"{\"duration\":%u}",seconds * 1000);
+	OSUtils::ztsnprintf(cl,sizeof(cl),"%u",(unsigned int)strlen(jsons));
+	requestHeaders["Content-Type"] = "application/json";
+	requestHeaders["Content-Length"] = cl;
+	unsigned int scode = Http::POST(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,(std::string("/bench/") + peer).c_str(),requestHeaders,jsons,(unsigned long)strlen(jsons),responseHeaders,responseBody);
+	requestHeaders.erase("Content-Type");
+	requestHeaders.erase("Content-Length");
+	if (scode != 200) {
+		if (scode == 404)
+			printf("404 bench no path to %s" ZT_EOL_S,peer.c_str());
+		else if (scode == 409)
+			printf("409 bench a test is already running" ZT_EOL_S);
+		else printf("%u bench %s" ZT_EOL_S,scode,responseBody.c_str());
+		return 1;
+	}
+	if (!jsonOut) {
+		printf("testing %s for %us..." ZT_EOL_S,peer.c_str(),seconds);
+		fflush(stdout);
+	}
+
+	nlohmann::json j;
+	for(;;) {
+		Thread::sleep(500);
+		responseBody.clear();
+		scode = Http::GET(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/bench",requestHeaders,responseHeaders,responseBody);
+		if (scode != 200) {
+			printf("%u bench %s" ZT_EOL_S,scode,responseBody.c_str());
+			return 1;
+		}
+		try {
+			j = OSUtils::jsonParse(responseBody);
+		} catch ( ... ) {
+			printf("%u bench invalid JSON response" ZT_EOL_S,scode);
+			return 1;
+		}
+		if (!OSUtils::jsonBool(j["running"],false))
+			break;
+	}
+
+	if (jsonOut) {
+		printf("%s" ZT_EOL_S,OSUtils::jsonDump(j).c_str());
+		return 0;
+	}
+
+	const uint64_t packetsSent = OSUtils::jsonInt(j["packetsSent"],0);
+	const double perPacket = (packetsSent) ? (double)packetsSent * 1000.0 : 1.0; // ns to us per packet
+	printf("path:       %s %s, %u byte packets" ZT_EOL_S,
+		OSUtils::jsonBool(j["direct"],false) ? "direct to" : "relayed via",
+		OSUtils::jsonString(j["path"],"-").c_str(),
+		(unsigned int)OSUtils::jsonInt(j["packetSize"],0));
+	printf("sent:       %llu packets at %sbit/s" ZT_EOL_S,
+		(unsigned long long)packetsSent,
+		cliRate(r1,sizeof(r1),(double)OSUtils::jsonInt(j["sendRate"],0)));
+	if (OSUtils::jsonBool(j["answered"],false)) {
+		printf("received:   %llu packets at %sbit/s, %.2f%% loss" ZT_EOL_S,
+			(unsigned long long)OSUtils::jsonInt(j["packetsReceived"],0),
+			cliRate(r2,sizeof(r2),(double)OSUtils::jsonInt(j["receiveRate"],0)),
+			((j["loss"].is_number()) ? (double)j["loss"] : 0.0) * 100.0);
+	} else {
+		printf("received:   unknown (peer did not answer, it may not support this)" ZT_EOL_S);
+	}
+	if (OSUtils::jsonInt(j["pongsReceived"],0)) {
+		printf("rtt:        min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f ms (%llu of %llu pings)" ZT_EOL_S,
+			(double)OSUtils::jsonInt(j["rttMin"],0) / 1000000.0,
+			(double)OSUtils::jsonInt(j["rttP50"],0) / 1000000.0,
+			(double)OSUtils::jsonInt(j["rttP90"],0) / 1000000.0,
+			(double)OSUtils::jsonInt(j["rttP99"],0) / 1000000.0,
+			(double)OSUtils::jsonInt(j["rttMax"],0) / 1000000.0,
+			(unsigned long long)OSUtils::jsonInt(j["pongsReceived"],0),
+			(unsigned long long)OSUtils::jsonInt(j["pingsSent"],0));
+	} else {
+		printf("rtt:        unknown (no pings answered)" ZT_EOL_S);
+	}
+	printf("per packet: %.2f us crypto, %.2f us wire" ZT_EOL_S,
+		(double)OSUtils::jsonInt(j["armorTime"],0) / perPacket,
+		(double)OSUtils::jsonInt(j["wireTime"],0) / perPacket);
+	return 0;
+}
+
+static volatile bool cliCaptureStop = false;
+static void cliCaptureSignal(int sig) { cliCaptureStop = true; }
+
+/* Frame capture. The node records frames as they pass the rules engine
+ * (POST /capture) and this polls for new ones, appending them to a pcapng
+ * file (GET /capture/pcapng), until interrupted (DELETE /capture). */
+static int cliCapture(const InetAddress &addr,std::map<std::string,std::string> &requestHeaders,const std::string &path,const std::string &filter)
+{
+	std::map<std::string,std::string> responseHeaders;
+	std::string responseBody;
+	char tmp[256],cl[32];
+
+	nlohmann::json fj = nlohmann::json::object();
+	std::vector<std::string> terms(OSUtils::split(filter.c_str(),",","",""));
+	for(std::vector<std::string>::const_iterator t(terms.begin());t!=terms.end();++t) {
+		const std::size_t eq = t->find('=');
+		const std::string k(t->substr(0,eq));
+		const std::string v((eq == std::string::npos) ? std::string() : t->substr(eq + 1));
+		if (k == "nwid") fj["networkId"] = v;
+		else if (k == "peer") fj["peer"] = v;
+		else if (k == "ethertype") fj["etherType"] = Utils::hexStrToU64(v.c_str());
+		else if (k == "dir") fj["direction"] = v;
+		else if (k == "drops") fj["dropsOnly"] = true;
+		else if (k == "snap") fj["snapLength"] = Utils::strToU64(v.c_str());
+		else {
+			printf("capture unknown filter term %s" ZT_EOL_S,t->c_str());
+			return 2;
+		}
+	}
+
+	FILE *out = fopen(path.c_str(),"wb");
+	if (!out) {
+		printf("capture unable to open %s" ZT_EOL_S,path.c_str());
+		return 1;
+	}
+
+	const std::string jsons(OSUtils::jsonDump(fj));
+	OSUtils::ztsnprintf(cl,sizeof(cl),"%u",(unsigned int)jsons.length());
+	requestHeaders["Content-Type"] = "application/json";
+	requestHeaders["Content-Length"] = cl;
+	unsigned int scode = Http::POST(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/capture",requestHeaders,jsons.data(),(unsigned long)jsons.length(),responseHeaders,responseBody);
+	requestHeaders.erase("Content-Type");
+	requestHeaders.erase("Content-Length");
+	if (scode != 200) {
+		printf("%u capture %s" ZT_EOL_S,scode,responseBody.c_str());
+		fclose(out);
+		return 1;
+	}
+
+	cliCaptureStop = false;
+	signal(SIGINT,&cliCaptureSignal);
+	printf("capturing to %s, ^C to stop" ZT_EOL_S,path.c_str());
+	fflush(stdout);
+
+	uint64_t since = 0;
+	unsigned long frames = 0,bytes = 0;
+	bool header = true;
+	int rc = 0;
+	while (!cliCaptureStop) {
+		responseBody.clear();
+		scode = Http::GET(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/capture",requestHeaders,responseHeaders,responseBody);
+		if (scode != 200) {
+			printf(ZT_EOL_S "%u capture %s" ZT_EOL_S,scode,responseBody.c_str());
+			rc = 1;
+			break;
+		}
+		uint64_t last = since;
+		try {
+			nlohmann::json j(OSUtils::jsonParse(responseBody));
+			last = OSUtils::jsonInt(j["last"],since);
+		} catch ( ... ) {}
+
+		// Always asks for at least the last frame, which is still in the node's ring
+		if ((last > since)||(header)) {
+			if (last > since) {
+				frames += (unsigned long)std::min(last - since,(uint64_t)ZT_CAPTURE_FRAMES);
+			} else last = since;
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"/capture/pcapng?since=%llu&until=%llu&header=%d",(unsigned long long)since,(unsigned long long)last,(header) ? 1 : 0);
+			responseBody.clear();
+			scode = Http::GET(1024 * 1024 * 64,60000,(const struct sockaddr *)&addr,tmp,requestHeaders,responseHeaders,responseBody);
+			if (scode != 200) {
+				printf(ZT_EOL_S "%u capture %s" ZT_EOL_S,scode,responseBody.c_str());
+				rc = 1;
+				break;
+			}
+			fwrite(responseBody.data(),1,responseBody.length(),out);
+			fflush(out);
+			bytes += (unsigned long)responseBody.length();
+			since = last;
+			header = false;
+			printf("\r%lu frames, %lu bytes",frames,bytes);
+			fflush(stdout);
+		}
+
+		Thread::sleep(250);
+	}
+
+	signal(SIGINT,SIG_DFL);
+	fclose(out);
+	responseBody.clear();
+	Http::DEL(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/capture",requestHeaders,responseHeaders,responseBody);
+	printf(ZT_EOL_S);
+	return rc;
+}
+
 #ifdef __WINDOWS__
 static int cli(int argc, _TCHAR* argv[])
 #else
@@ -449,6 +836,26 @@ static int cli(int argc,char **argv)
 			printf("%u %s %s" ZT_EOL_S,scode,command.c_str(),responseBody.c_str());
 			return 1;
 		}
+	} else if (command == "top") {
+		const unsigned int interval = (arg1.length()) ? Utils::strToUInt(arg1.c_str()) : 2;
+		if (!interval) {
+			cliPrintHelp(argv[0],stderr);
+			return 2;
+		}
+		return cliTop(addr,requestHeaders,interval);
+	} else if (command == "bench") {
+		const unsigned int seconds = (arg2.length()) ? Utils::strToUInt(arg2.c_str()) : 5;
+		if ((arg1.length() != 10)||(!seconds)||(seconds > (ZT_BENCH_MAX_DURATION / 1000))) {
+			cliPrintHelp(argv[0],stderr);
+			return 2;
+		}
+		return cliBench(addr,requestHeaders,arg1,seconds,json);
+	} else if (command == "capture") {
+		if (!arg1.length()) {
+			cliPrintHelp(argv[0],stderr);
+			return 2;
+		}
+		return cliCapture(addr,requestHeaders,arg1,arg2);
 	} else if (command == "join") {
 		if (arg1.length() != 16) {
 			cliPrintHelp(argv[0],stderr);
@@ -630,7 +1037,7 @@ static void idtoolPrintHelp(FILE *out,const char *pn)
 		COPYRIGHT_NOTICE ZT_EOL_S
 		LICENSE_GRANT ZT_EOL_S);
 	fprintf(out,"Usage: %s <command> [<args>]" ZT_EOL_S"" ZT_EOL_S"Commands:" ZT_EOL_S,pn);
-	fprintf(out,"  generate [<identity.secret>] [<identity.public>] [<vanity>]" ZT_EOL_S);
+	fprintf(out,"  generate [-t<threads>] [<identity.secret>] [<identity.public>] [<vanity>]" ZT_EOL_S);
 	fprintf(out,"  validate <identity.secret/public>" ZT_EOL_S);
 	fprintf(out,"  getpublic <identity.secret>" ZT_EOL_S);
 	fprintf(out,"  sign <identity.secret> <file>" ZT_EOL_S);
@@ -639,6 +1046,41 @@ static void idtoolPrintHelp(FILE *out,const char *pn)
 	fprintf(out,"  genmoon <moon json>" ZT_EOL_S);
 }
 
+// Identity generation is a hashcash search, so threads just race and the
+// first one to find an identity (matching the vanity prefix if any) wins.
+#define ZT_IDTOOL_MAX_GENERATE_THREADS 256
+struct IdtoolGenerator
+{
+	IdtoolGenerator(uint64_t v,int vb) : vanity(v),vanityBits(vb),done(0),found(false) {}
+
+	inline void threadMain()
+		throw()
+	{
+		Identity id;
+		while (!done) {
+			if (!id.generate(&done))
+				break;
+			if ((id.address().toInt() >> (40 - vanityBits)) == vanity) {
+				Mutex::Lock _l(lock);
+				if (!found) {
+					result = id;
+					found = true;
+				}
+				done = 1;
+			} else {
+				fprintf(stderr,"vanity address: tried %.10llx looking for first %d bits of %.10llx\n",(unsigned long long)id.address().toInt(),vanityBits,(unsigned long long)(vanity << (40 - vanityBits)));
+			}
+		}
+	}
+
+	const uint64_t vanity;
+	const int vanityBits;
+	volatile int done;
+	bool found;
+	Identity result;
+	Mutex lock;
+};
+
 static Identity getIdFromArg(char *arg)
 {
 	Identity id;
@@ -667,41 +1109,54 @@ static int idtool(int argc,char **argv)
 	}
 
 	if (!strcmp(argv[1],"generate")) {
+		// -t<threads> may appear anywhere and is not counted as a positional argument
+		unsigned int threads = 1;
+		int pc = 2;
+		char *pargv[3] = { (char *)0,(char *)0,(char *)0 };
+		for(int i=2;i<argc;++i) {
+			if ((argv[i][0] == '-')&&(argv[i][1] == 't')) {
+				threads = std::max(std::min(Utils::strToUInt(argv[i] + 2),(unsigned int)ZT_IDTOOL_MAX_GENERATE_THREADS),1U);
+			} else if (pc < 5) {
+				pargv[(pc++) - 2] = argv[i];
+			}
+		}
+
 		uint64_t vanity = 0;
 		int vanityBits = 0;
-		if (argc >= 5) {
-			vanity = Utils::hexStrToU64(argv[4]) & 0xffffffffffULL;
-			vanityBits = 4 * (int)strlen(argv[4]);
+		if (pc >= 5) {
+			vanity = Utils::hexStrToU64(pargv[2]) & 0xffffffffffULL;
+			vanityBits = 4 * (int)strlen(pargv[2]);
 			if (vanityBits > 40)
 				vanityBits = 40;
 		}
 
-		Identity id;
-		for(;;) {
-			id.generate();
-			if ((id.address().toInt() >> (40 - vanityBits)) == vanity) {
-				if (vanityBits > 0) {
-					fprintf(stderr,"vanity address: found %.10llx !\n",(unsigned long long)id.address().toInt());
-				}
-				break;
-			} else {
-				fprintf(stderr,"vanity address: tried %.10llx looking for first %d bits of %.10llx\n",(unsigned long long)id.address().toInt(),vanityBits,(unsigned long long)(vanity << (40 - vanityBits)));
-			}
+		IdtoolGenerator gen(vanity,vanityBits);
+		if (threads > 1) {
+			std::vector<Thread> workers;
+			for(unsigned int t=0;t<threads;++t)
+				workers.push_back(Thread::start(&gen));
+			for(std::vector<Thread>::iterator t(workers.begin());t!=workers.end();++t)
+				Thread::join(*t);
+		} else {
+			gen.threadMain();
 		}
+		const Identity &id = gen.result;
+		if (vanityBits > 0)
+			fprintf(stderr,"vanity address: found %.10llx !\n",(unsigned long long)id.address().toInt());
 
 		char idtmp[1024];
 		std::string idser = id.toString(true,idtmp);
-		if (argc >= 3) {
-			if (!OSUtils::writeFile(argv[2],idser)) {
-				fprintf(stderr,"Error writing to %s" ZT_EOL_S,argv[2]);
+		if (pc >= 3) {
+			if (!OSUtils::writeFile(pargv[0],idser)) {
+				fprintf(stderr,"Error writing to %s" ZT_EOL_S,pargv[0]);
 				return 1;
-			} else printf("%s written" ZT_EOL_S,argv[2]);
-			if (argc >= 4) {
+			} else printf("%s written" ZT_EOL_S,pargv[0]);
+			if (pc >= 4) {
 				idser = id.toString(false,idtmp);
-				if (!OSUtils::writeFile(argv[3],idser)) {
-					fprintf(stderr,"Error writing to %s" ZT_EOL_S,argv[3]);
+				if (!OSUtils::writeFile(pargv[1],idser)) {
+					fprintf(stderr,"Error writing to %s" ZT_EOL_S,pargv[1]);
 					return 1;
-				} else printf("%s written" ZT_EOL_S,argv[3]);
+				} else printf("%s written" ZT_EOL_S,pargv[1]);
 			}
 		} else printf("%s",idser.c_str());
 	} else if (!strcmp(argv[1],"validate")) {
@@ -52,6 +52,15 @@
 #include <net/if_dl.h>
 #include <net/if_media.h>
 #include <net/route.h>
+#include <netinet/in_var.h>
+#include <netinet6/in6_var.h>
+#include <netinet6/nd6.h>
+#include <poll.h>
+
+#ifdef ZT_HAVE_NETMAP
+#define NETMAP_WITH_LIBS
+#include <net/netmap_user.h>
+#endif
 
 #include <string>
 #include <map>
@@ -72,6 +81,133 @@ static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC
 
 namespace ZeroTier {
 
+#ifdef ZT_HAVE_NETMAP
+// Taps using netmap, for flushNetmap()
+static Mutex _netmapTapsLock;
+static std::vector<BSDEthernetTap *> _netmapTaps;
+static thread_local bool _netmapDefer = false;
+#endif
+
+// Interface configuration is done with ioctl() on a datagram socket of the relevant family, as ifconfig does
+static bool _ifIoctl(int af,unsigned long req,void *arg)
+{
+	const int s = ::socket(af,SOCK_DGRAM,0);
+	if (s < 0)
+		return false;
+	const bool ok = (::ioctl(s,req,arg) == 0);
+	::close(s);
+	return ok;
+}
+
+static bool _ifReq(const char *dev,unsigned long req,struct ifreq &ifr)
+{
+	Utils::scopy(ifr.ifr_name,sizeof(ifr.ifr_name),dev);
+	return _ifIoctl(AF_INET,req,&ifr);
+}
+
+#ifdef __FreeBSD__
+static bool _ifCreate(const char *dev)
+{
+	struct ifreq ifr;
+	memset(&ifr,0,sizeof(ifr));
+	return _ifReq(dev,SIOCIFCREATE,ifr);
+}
+
+static bool _ifRename(const char *dev,const char *newName)
+{
+	char nn[IFNAMSIZ];
+	Utils::scopy(nn,sizeof(nn),newName);
+	struct ifreq ifr;
+	memset(&ifr,0,sizeof(ifr));
+	ifr.ifr_data = (caddr_t)nn;
+	return _ifReq(dev,SIOCSIFNAME,ifr);
+}
+#endif
+
+static void _ifDestroy(const char *dev)
+{
+	struct ifreq ifr;
+	memset(&ifr,0,sizeof(ifr));
+	_ifReq(dev,SIOCIFDESTROY,ifr);
+}
+
+static bool _ifSetMtu(const char *dev,unsigned int mtu)
+{
+	struct ifreq ifr;
+	memset(&ifr,0,sizeof(ifr));
+	ifr.ifr_mtu = (int)mtu;
+	return _ifReq(dev,SIOCSIFMTU,ifr);
+}
+
+// Equivalent of "ifconfig <dev> lladdr <mac> mtu <mtu> metric <metric> up"
+static bool _ifConfigure(const char *dev,const MAC &mac,unsigned int mtu,unsigned int metric)
+{
+	struct ifreq ifr;
+
+	memset(&ifr,0,sizeof(ifr));
+	ifr.ifr_addr.sa_len = 6;
+	ifr.ifr_addr.sa_family = AF_LINK;
+	mac.copyTo(ifr.ifr_addr.sa_data,6);
+	if (!_ifReq(dev,SIOCSIFLLADDR,ifr))
+		return false;
+
+	if (!_ifSetMtu(dev,mtu))
+		return false;
+
+	memset(&ifr,0,sizeof(ifr));
+	ifr.ifr_metric = (int)metric;
+	if (!_ifReq(dev,SIOCSIFMETRIC,ifr))
+		return false;
+
+	memset(&ifr,0,sizeof(ifr));
+	if (!_ifReq(dev,SIOCGIFFLAGS,ifr))
+		return false;
+	ifr.ifr_flags |= IFF_UP;
+	return _ifReq(dev,SIOCSIFFLAGS,ifr);
+}
+
+static void _ifPrefixMask(const InetAddress &ip,void *mask,unsigned int len)
+{
+	memset(mask,0,len);
+	unsigned int bits = ip.netmaskBits();
+	for(unsigned int i=0;(i<len)&&(bits);++i) {
+		const unsigned int b = (bits > 8) ? 8 : bits;
+		reinterpret_cast<uint8_t *>(mask)[i] = (uint8_t)(0xff << (8 - b));
+		bits -= b;
+	}
+}
+
+// Equivalent of "ifconfig <dev> inet|inet6 <ip/bits> alias"
+static bool _ifAddIp(const char *dev,const InetAddress &ip)
+{
+	if (ip.isV4()) {
+		struct ifaliasreq ifra;
+		memset(&ifra,0,sizeof(ifra));
+		Utils::scopy(ifra.ifra_name,sizeof(ifra.ifra_name),dev);
+		struct sockaddr_in *a = reinterpret_cast<struct sockaddr_in *>(&ifra.ifra_addr);
+		struct sockaddr_in *b = reinterpret_cast<struct sockaddr_in *>(&ifra.ifra_broadaddr);
+		struct sockaddr_in *m = reinterpret_cast<struct sockaddr_in *>(&ifra.ifra_mask);
+		a->sin_len = b->sin_len = m->sin_len = sizeof(struct sockaddr_in);
+		a->sin_family = b->sin_family = m->sin_family = AF_INET;
+		a->sin_addr.s_addr = reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr;
+		_ifPrefixMask(ip,&(m->sin_addr.s_addr),4);
+		b->sin_addr.s_addr = a->sin_addr.s_addr | ~(m->sin_addr.s_addr);
+		return _ifIoctl(AF_INET,SIOCAIFADDR,&ifra);
+	} else if (ip.isV6()) {
+		struct in6_aliasreq ifra;
+		memset(&ifra,0,sizeof(ifra));
+		Utils::scopy(ifra.ifra_name,sizeof(ifra.ifra_name),dev);
+		ifra.ifra_addr.sin6_len = ifra.ifra_prefixmask.sin6_len = sizeof(struct sockaddr_in6);
+		ifra.ifra_addr.sin6_family = ifra.ifra_prefixmask.sin6_family = AF_INET6;
+		memcpy(ifra.ifra_addr.sin6_addr.s6_addr,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
+		_ifPrefixMask(ip,ifra.ifra_prefixmask.sin6_addr.s6_addr,16);
+		ifra.ifra_lifetime.ia6t_vltime = ND6_INFINITE_LIFETIME;
+		ifra.ifra_lifetime.ia6t_pltime = ND6_INFINITE_LIFETIME;
+		return _ifIoctl(AF_INET6,SIOCAIFADDR_IN6,&ifra);
+	}
+	return false;
+}
+
 BSDEthernetTap::BSDEthernetTap(
 	const char *homePath,
 	const MAC &mac,
@@ -80,7 +216,8 @@ BSDEthernetTap::BSDEthernetTap(
 	uint64_t nwid,
 	const char *friendlyName,
 	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
-	void *arg) :
+	void *arg,
+	bool netmap) :
 	_handler(handler),
 	_arg(arg),
 	_nwid(nwid),
@@ -88,9 +225,14 @@ BSDEthernetTap::BSDEthernetTap(
 	_metric(metric),
 	_fd(0),
 	_enabled(true)
+#ifdef ZT_HAVE_NETMAP
+	,_nmRx((struct nm_desc *)0)
+	,_nmTx((struct nm_desc *)0)
+	,_nmTxPending(false)
+#endif
 {
 	static Mutex globalTapCreateLock;
-	char devpath[64],ethaddr[64],mtustr[32],metstr[32],tmpdevname[32];
+	char devpath[64],tmpdevname[32];
 
 	Mutex::Lock _gl(globalTapCreateLock);
 
@@ -117,27 +259,12 @@ BSDEthernetTap::BSDEthernetTap(
 		OSUtils::ztsnprintf(tmpdevname,sizeof(tmpdevname),"tap%d",i);
 		OSUtils::ztsnprintf(devpath,sizeof(devpath),"/dev/%s",tmpdevname);
 		if (std::find(devFiles.begin(),devFiles.end(),std::string(tmpdevname)) == devFiles.end()) {
-			long cpid = (long)vfork();
-			if (cpid == 0) {
-				::execl("/sbin/ifconfig","/sbin/ifconfig",tmpdevname,"create",(const char *)0);
-				::_exit(-1);
-			} else if (cpid > 0) {
-				int exitcode = -1;
-				::waitpid(cpid,&exitcode,0);
-			} else throw std::runtime_error("fork() failed");
+			_ifCreate(tmpdevname);
 
 			struct stat stattmp;
 			if (!stat(devpath,&stattmp)) {
-				cpid = (long)vfork();
-				if (cpid == 0) {
-					::execl("/sbin/ifconfig","/sbin/ifconfig",tmpdevname,"name",_dev.c_str(),(const char *)0);
-					::_exit(-1);
-				} else if (cpid > 0) {
-					int exitcode = -1;
-					::waitpid(cpid,&exitcode,0);
-					if (exitcode)
-						throw std::runtime_error("ifconfig rename operation failed");
-				} else throw std::runtime_error("fork() failed");
+				if (!_ifRename(tmpdevname,_dev.c_str()))
+					throw std::runtime_error("tap device rename operation failed");
 
 				_fd = ::open(devpath,O_RDWR);
 				if (_fd > 0)
@@ -171,25 +298,38 @@ BSDEthernetTap::BSDEthernetTap(
 	}
 
 	// Configure MAC address and MTU, bring interface up
-	OSUtils::ztsnprintf(ethaddr,sizeof(ethaddr),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(int)mac[0],(int)mac[1],(int)mac[2],(int)mac[3],(int)mac[4],(int)mac[5]);
-	OSUtils::ztsnprintf(mtustr,sizeof(mtustr),"%u",_mtu);
-	OSUtils::ztsnprintf(metstr,sizeof(metstr),"%u",_metric);
-	long cpid = (long)vfork();
-	if (cpid == 0) {
-		::execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),"lladdr",ethaddr,"mtu",mtustr,"metric",metstr,"up",(const char *)0);
-		::_exit(-1);
-	} else if (cpid > 0) {
-		int exitcode = -1;
-		::waitpid(cpid,&exitcode,0);
-		if (exitcode) {
-			::close(_fd);
-			throw std::runtime_error("ifconfig failure setting link-layer address and activating tap interface");
-		}
+	if (!_ifConfigure(_dev.c_str(),mac,_mtu,_metric)) {
+		::close(_fd);
+		throw std::runtime_error("failure setting link-layer address and activating tap interface");
 	}
 
 	// Set close-on-exec so that devices cannot persist if we fork/exec for update
 	fcntl(_fd,F_SETFD,fcntl(_fd,F_GETFD) | FD_CLOEXEC);
 
+#ifdef ZT_HAVE_NETMAP
+	if (netmap) {
+		// The host rings carry what the kernel sends out the tap and what it
+		// should receive from it, in place of reading and writing _fd. Each
+		// direction gets its own descriptor so the reader thread's poll()
+		// never syncs the ring put() is filling.
+		const std::string hr(std::string("netmap:") + _dev + "^");
+		_nmRx = nm_open((hr + "/R").c_str(),(const struct nmreq *)0,0,(const struct nm_desc *)0);
+		if (_nmRx) {
+			_nmTx = nm_open((hr + "/T").c_str(),(const struct nmreq *)0,NM_OPEN_NO_MMAP,_nmRx);
+			if (!_nmTx) {
+				nm_close(_nmRx);
+				_nmRx = (struct nm_desc *)0;
+			}
+		}
+		if (_nmRx) {
+			Mutex::Lock _l(_netmapTapsLock);
+			_netmapTaps.push_back(this);
+		} else {
+			fprintf(stderr,"WARNING: unable to use netmap on %s, using tap device reads and writes" ZT_EOL_S,_dev.c_str());
+		}
+	}
+#endif
+
 	::pipe(_shutdownSignalPipe);
 
 	_thread = Thread::start(this);
@@ -199,18 +339,21 @@ BSDEthernetTap::~BSDEthernetTap()
 {
 	::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
 	Thread::join(_thread);
+#ifdef ZT_HAVE_NETMAP
+	if (_nmRx) {
+		{
+			Mutex::Lock _l(_netmapTapsLock);
+			_netmapTaps.erase(std::find(_netmapTaps.begin(),_netmapTaps.end(),this));
+		}
+		nm_close(_nmTx);
+		nm_close(_nmRx);
+	}
+#endif
 	::close(_fd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
 
-	long cpid = (long)vfork();
-	if (cpid == 0) {
-		::execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),"destroy",(const char *)0);
-		::_exit(-1);
-	} else if (cpid > 0) {
-		int exitcode = -1;
-		::waitpid(cpid,&exitcode,0);
-	}
+	_ifDestroy(_dev.c_str());
 }
 
 void BSDEthernetTap::setEnabled(bool en)
@@ -225,17 +368,24 @@ bool BSDEthernetTap::enabled() const
 
 static bool ___removeIp(const std::string &_dev,const InetAddress &ip)
 {
-	long cpid = (long)vfork();
-	if (cpid == 0) {
-		char ipbuf[64];
-		execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),"inet",ip.toIpString(ipbuf),"-alias",(const char *)0);
-		_exit(-1);
-	} else if (cpid > 0) {
-		int exitcode = -1;
-		waitpid(cpid,&exitcode,0);
-		return (exitcode == 0);
+	if (ip.isV4()) {
+		struct ifreq ifr;
+		memset(&ifr,0,sizeof(ifr));
+		struct sockaddr_in *a = reinterpret_cast<struct sockaddr_in *>(&ifr.ifr_addr);
+		a->sin_len = sizeof(struct sockaddr_in);
+		a->sin_family = AF_INET;
+		a->sin_addr.s_addr = reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr;
+		return _ifReq(_dev.c_str(),SIOCDIFADDR,ifr);
+	} else if (ip.isV6()) {
+		struct in6_ifreq ifr;
+		memset(&ifr,0,sizeof(ifr));
+		Utils::scopy(ifr.ifr_name,sizeof(ifr.ifr_name),_dev.c_str());
+		ifr.ifr_addr.sin6_len = sizeof(struct sockaddr_in6);
+		ifr.ifr_addr.sin6_family = AF_INET6;
+		memcpy(ifr.ifr_addr.sin6_addr.s6_addr,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
+		return _ifIoctl(AF_INET6,SIOCDIFADDR_IN6,&ifr);
 	}
-	return false; // never reached, make compiler shut up about return value
+	return false;
 }
 
 bool BSDEthernetTap::addIp(const InetAddress &ip)
@@ -255,17 +405,7 @@ bool BSDEthernetTap::addIp(const InetAddress &ip)
 		}
 	}
 
-	long cpid = (long)vfork();
-	if (cpid == 0) {
-		char tmp[128];
-		::execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),ip.isV4() ? "inet" : "inet6",ip.toString(tmp),"alias",(const char *)0);
-		::_exit(-1);
-	} else if (cpid > 0) {
-		int exitcode = -1;
-		::waitpid(cpid,&exitcode,0);
-		return (exitcode == 0);
-	}
-	return false;
+	return _ifAddIp(_dev.c_str(),ip);
 }
 
 bool BSDEthernetTap::removeIp(const InetAddress &ip)
@@ -320,14 +460,48 @@ std::vector<InetAddress> BSDEthernetTap::ips() const
 
 void BSDEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
+#ifdef ZT_HAVE_NETMAP
+	if (_nmRx) {
+		if ((len <= _mtu)&&(_enabled)) {
+			Mutex::Lock _l(_nmTxLock);
+			struct netmap_ring *const tx = NETMAP_TXRING(_nmTx->nifp,_nmTx->first_tx_ring);
+			if (nm_ring_space(tx) == 0) {
+				_netmapSync();
+				if (nm_ring_space(tx) == 0)
+					return;
+			}
+			struct netmap_slot &s = tx->slot[tx->cur];
+			if ((len + 14) > tx->nr_buf_size)
+				return;
+			char *const f = NETMAP_BUF(tx,s.buf_idx);
+			to.copyTo(f,6);
+			from.copyTo(f + 6,6);
+			f[12] = (char)((etherType >> 8) & 0xff);
+			f[13] = (char)(etherType & 0xff);
+			memcpy(f + 14,data,len);
+			s.len = (uint16_t)(len + 14);
+			tx->head = tx->cur = nm_ring_next(tx,tx->cur);
+			if (_netmapDefer)
+				_nmTxPending = true;
+			else _netmapSync();
+		}
+		return;
+	}
+#endif
+
+	char hdrBuf[14];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		::write(_fd,putBuf,len);
+		to.copyTo(hdrBuf,6);
+		from.copyTo(hdrBuf + 6,6);
+		*((uint16_t *)(hdrBuf + 12)) = htons((uint16_t)etherType);
+
+		// Payload goes straight from the decrypted packet to the kernel
+		struct iovec iov[2];
+		iov[0].iov_base = hdrBuf;
+		iov[0].iov_len = 14;
+		iov[1].iov_base = const_cast<void *>(data);
+		iov[1].iov_len = len;
+		::writev(_fd,iov,(len) ? 2 : 1);
 	}
 }
 
@@ -384,16 +558,7 @@ void BSDEthernetTap::setMtu(unsigned int mtu)
 {
 	if (mtu != _mtu) {
 		_mtu = mtu;
-		long cpid = (long)vfork();
-		if (cpid == 0) {
-			char tmp[64];
-			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%u",mtu);
-			execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),"mtu",tmp,(const char *)0);
-			_exit(-1);
-		} else if (cpid > 0) {
-			int exitcode = -1;
-			waitpid(cpid,&exitcode,0);
-		}
+		_ifSetMtu(_dev.c_str(),mtu);
 	}
 }
 
@@ -409,6 +574,13 @@ void BSDEthernetTap::threadMain()
 	// constructing itself.
 	Thread::sleep(500);
 
+#ifdef ZT_HAVE_NETMAP
+	if (_nmRx) {
+		_netmapThreadMain();
+		return;
+	}
+#endif
+
 	FD_ZERO(&readfds);
 	FD_ZERO(&nullfds);
 	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
@@ -450,4 +622,64 @@ void BSDEthernetTap::threadMain()
 	}
 }
 
+#ifdef ZT_HAVE_NETMAP
+void BSDEthernetTap::deferNetmapSync(bool defer)
+{
+	_netmapDefer = defer;
+}
+
+void BSDEthernetTap::flushNetmap()
+{
+	Mutex::Lock _l(_netmapTapsLock);
+	for(std::vector<BSDEthernetTap *>::iterator t(_netmapTaps.begin());t!=_netmapTaps.end();++t) {
+		Mutex::Lock _l2((*t)->_nmTxLock);
+		if ((*t)->_nmTxPending)
+			(*t)->_netmapSync();
+	}
+}
+
+// Caller must hold _nmTxLock
+void BSDEthernetTap::_netmapSync()
+{
+	::ioctl(_nmTx->fd,NIOCTXSYNC,(void *)0);
+	_nmTxPending = false;
+}
+
+void BSDEthernetTap::_netmapThreadMain()
+{
+	MAC to,from;
+	struct pollfd fds[2];
+	fds[0].fd = _nmRx->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = _shutdownSignalPipe[0];
+	fds[1].events = POLLIN;
+
+	for(;;) {
+		// poll() syncs the receive ring, so each wakeup hands over everything queued since the last
+		fds[0].revents = fds[1].revents = 0;
+		if ((::poll(fds,2,-1) < 0)&&(errno != EINTR))
+			break;
+		if (fds[1].revents) // writes to shutdown pipe terminate thread
+			break;
+
+		for(unsigned int r=_nmRx->first_rx_ring;r<=_nmRx->last_rx_ring;++r) {
+			struct netmap_ring *const rx = NETMAP_RXRING(_nmRx->nifp,r);
+			uint32_t cur = rx->cur;
+			while (cur != rx->tail) {
+				const struct netmap_slot &s = rx->slot[cur];
+				const char *const f = NETMAP_BUF(rx,s.buf_idx);
+				if ((_enabled)&&(s.len > 14)&&(s.len <= (_mtu + 14))) {
+					to.setTo(f,6);
+					from.setTo(f + 6,6);
+					const unsigned int etherType = ((unsigned int)((const uint8_t *)f)[12] << 8) | (unsigned int)((const uint8_t *)f)[13];
+					_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(f + 14),s.len - 14);
+				}
+				cur = nm_ring_next(rx,cur);
+			}
+			rx->head = rx->cur = cur;
+		}
+	}
+}
+#endif
+
 } // namespace ZeroTier
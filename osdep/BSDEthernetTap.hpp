@@ -37,7 +37,13 @@
 #include "../node/Constants.hpp"
 #include "../node/MulticastGroup.hpp"
 #include "../node/MAC.hpp"
+#include "../node/Mutex.hpp"
 #include "Thread.hpp"
+#include "BSDNetmapReceiver.hpp"
+
+#ifdef ZT_HAVE_NETMAP
+struct nm_desc;
+#endif
 
 namespace ZeroTier {
 
@@ -52,7 +58,8 @@ public:
 		uint64_t nwid,
 		const char *friendlyName,
 		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
-		void *arg);
+		void *arg,
+		bool netmap = false);
 
 	~BSDEthernetTap();
 
@@ -70,7 +77,35 @@ public:
 	void threadMain()
 		throw();
 
+#ifdef ZT_HAVE_NETMAP
+	/**
+	 * @return True if this tap's frames go through netmap host rings
+	 */
+	inline bool netmap() const { return (_nmRx != (struct nm_desc *)0); }
+
+	/**
+	 * Hold back syncing netmap rings after put() on the calling thread
+	 *
+	 * While set, put() only queues frames, and they go to the kernel on the
+	 * next flushNetmap() from any thread (or when a ring fills). Threads that
+	 * deliver frames in batches set this and flush after each batch.
+	 *
+	 * @param defer If true, defer syncs from this thread
+	 */
+	static void deferNetmapSync(bool defer);
+
+	/**
+	 * Hand frames queued by deferred put() calls to the kernel, on all taps
+	 */
+	static void flushNetmap();
+#endif
+
 private:
+#ifdef ZT_HAVE_NETMAP
+	void _netmapThreadMain();
+	void _netmapSync();
+#endif
+
 	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
@@ -82,6 +117,12 @@ private:
 	int _fd;
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
+#ifdef ZT_HAVE_NETMAP
+	struct nm_desc *_nmRx; // host receive ring (frames the kernel sends out this tap), or NULL if not using netmap
+	struct nm_desc *_nmTx; // host transmit ring (frames for the kernel)
+	Mutex _nmTxLock;
+	bool _nmTxPending; // frames queued on _nmTx and not yet synced
+#endif
 };
 
 } // namespace ZeroTier
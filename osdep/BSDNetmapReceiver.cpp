@@ -0,0 +1,280 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include "BSDNetmapReceiver.hpp"
+
+#ifdef ZT_HAVE_NETMAP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+
+#define NETMAP_WITH_LIBS
+#include <net/netmap_user.h>
+
+#include <string>
+#include <algorithm>
+
+#include "CpuAffinity.hpp"
+
+namespace ZeroTier {
+
+BSDNetmapReceiver::BSDNetmapReceiver(
+	const char *dev,
+	const unsigned int *ports,
+	unsigned int portCount,
+	void (*handler)(void *,const BSDNetmapPacket *,unsigned int),
+	void *arg) :
+	_handler(handler),
+	_arg(arg),
+	_dev(dev),
+	_ifindex(0),
+	_nm((struct nm_desc *)0),
+	_nextTxRing(0)
+{
+	_ifindex = if_nametoindex(dev);
+	if (!_ifindex)
+		throw std::runtime_error("no such device");
+	if (!portCount)
+		throw std::runtime_error("no ports");
+	for(unsigned int i=0;i<portCount;++i)
+		_ports.push_back(ports[i]);
+
+	if (::pipe(_shutdownSignalPipe))
+		throw std::runtime_error("pipe() failed");
+
+	// "*" opens the host rings along with all the hardware rings
+	_nm = nm_open((std::string("netmap:") + _dev + "*").c_str(),(const struct nmreq *)0,0,(const struct nm_desc *)0);
+	if (!_nm) {
+		::close(_shutdownSignalPipe[0]);
+		::close(_shutdownSignalPipe[1]);
+		throw std::runtime_error(std::string("cannot open netmap port: ") + strerror(errno));
+	}
+
+	_thread = Thread::start(this);
+}
+
+BSDNetmapReceiver::~BSDNetmapReceiver()
+{
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
+	Thread::join(_thread);
+	nm_close(_nm); // gives the device back to the kernel
+	::close(_shutdownSignalPipe[0]);
+	::close(_shutdownSignalPipe[1]);
+}
+
+void BSDNetmapReceiver::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_IO);
+
+	BSDNetmapPacket packets[ZT_BSD_NETMAP_RX_BATCH];
+	struct netmap_if *const nifp = _nm->nifp;
+
+	struct pollfd fds[2];
+	fds[0].fd = _nm->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = _shutdownSignalPipe[0];
+	fds[1].events = POLLIN;
+
+	for(;;) {
+		// poll() also syncs the rings, picking up new packets and sending what was queued
+		fds[0].revents = fds[1].revents = 0;
+		if ((::poll(fds,2,-1) < 0)&&(errno != EINTR))
+			break;
+		if (fds[1].revents) // writes to shutdown pipe terminate thread
+			break;
+
+		bool sent = false;
+		for(unsigned int r=_nm->first_rx_ring;r<=_nm->last_rx_ring;++r) {
+			struct netmap_ring *const rx = NETMAP_RXRING(nifp,r);
+			if (r >= nifp->ni_rx_rings) {
+				if (_toWire(rx))
+					sent = true;
+			} else if (_receive(rx,packets)) {
+				sent = true;
+			}
+		}
+		if (sent)
+			::ioctl(_nm->fd,NIOCTXSYNC,(void *)0);
+	}
+}
+
+bool BSDNetmapReceiver::_receive(struct netmap_ring *rx,BSDNetmapPacket *packets)
+{
+	bool toHost = false;
+	unsigned int count = 0;
+	uint32_t cur = rx->cur;
+	while (cur != rx->tail) {
+		struct netmap_slot &s = rx->slot[cur];
+		if (_parse(reinterpret_cast<const uint8_t *>(NETMAP_BUF(rx,s.buf_idx)),s.len,packets[count])) {
+			++count;
+		} else if (_toHost(rx,cur)) {
+			toHost = true;
+		}
+		cur = nm_ring_next(rx,cur);
+
+		// Packets are read in place, so their slots are only released once handled
+		if ((count == ZT_BSD_NETMAP_RX_BATCH)||(cur == rx->tail)) {
+			if (count) {
+				try {
+					_handler(_arg,packets,count);
+				} catch ( ... ) {}
+				count = 0;
+			}
+			rx->head = rx->cur = cur;
+		}
+	}
+	return toHost;
+}
+
+bool BSDNetmapReceiver::_toHost(struct netmap_ring *rx,const uint32_t slot)
+{
+	// The host transmit ring follows the hardware ones; if it's full the packet is dropped
+	struct netmap_ring *const tx = NETMAP_TXRING(_nm->nifp,_nm->nifp->ni_tx_rings);
+	if (nm_ring_space(tx) == 0)
+		return false;
+	struct netmap_slot &rs = rx->slot[slot];
+	struct netmap_slot &ts = tx->slot[tx->cur];
+	const uint32_t b = ts.buf_idx;
+	ts.buf_idx = rs.buf_idx;
+	rs.buf_idx = b;
+	ts.len = rs.len;
+	ts.flags |= NS_BUF_CHANGED;
+	rs.flags |= NS_BUF_CHANGED;
+	tx->head = tx->cur = nm_ring_next(tx,tx->cur);
+	return true;
+}
+
+bool BSDNetmapReceiver::_toWire(struct netmap_ring *rx)
+{
+	// Packets from the kernel are spread across the hardware rings in turn
+	struct netmap_if *const nifp = _nm->nifp;
+	bool sent = false;
+	while (!nm_ring_empty(rx)) {
+		struct netmap_ring *tx = (struct netmap_ring *)0;
+		for(unsigned int i=0;i<nifp->ni_tx_rings;++i) {
+			struct netmap_ring *const t = NETMAP_TXRING(nifp,_nextTxRing);
+			_nextTxRing = (_nextTxRing + 1) % nifp->ni_tx_rings;
+			if (nm_ring_space(t)) {
+				tx = t;
+				break;
+			}
+		}
+		if (!tx)
+			break; // all full, so these wait in the host ring for the next pass
+		struct netmap_slot &rs = rx->slot[rx->cur];
+		struct netmap_slot &ts = tx->slot[tx->cur];
+		const uint32_t b = ts.buf_idx;
+		ts.buf_idx = rs.buf_idx;
+		rs.buf_idx = b;
+		ts.len = rs.len;
+		ts.flags |= NS_BUF_CHANGED;
+		rs.flags |= NS_BUF_CHANGED;
+		tx->head = tx->cur = nm_ring_next(tx,tx->cur);
+		rx->head = rx->cur = nm_ring_next(rx,rx->cur);
+		sent = true;
+	}
+	return sent;
+}
+
+bool BSDNetmapReceiver::_parse(const uint8_t *frame,unsigned int len,BSDNetmapPacket &pkt) const
+{
+	// Anything but unfragmented UDP without IP options, to one of our ports, is left to the kernel
+	if (len < 14)
+		return false;
+	const uint8_t *const ip = frame + 14;
+	len -= 14;
+	const unsigned int etherType = ((unsigned int)frame[12] << 8) | (unsigned int)frame[13];
+	if (etherType == 0x0800) {
+		if (len < 28)
+			return false;
+		const unsigned int totalLen = ((unsigned int)ip[2] << 8) | (unsigned int)ip[3];
+		if ((ip[0] != 0x45)||(ip[9] != 17)||((ip[6] & 0x3f) != 0)||(ip[7] != 0)||(totalLen < 28)||(totalLen > len))
+			return false;
+		const uint8_t *const udp = ip + 20;
+		const unsigned int udpLen = ((unsigned int)udp[4] << 8) | (unsigned int)udp[5];
+		if ((udpLen < 8)||(udpLen > (totalLen - 20))||(std::find(_ports.begin(),_ports.end(),((unsigned int)udp[2] << 8) | (unsigned int)udp[3]) == _ports.end()))
+			return false;
+
+		memset(&(pkt.from),0,sizeof(struct sockaddr_in));
+		struct sockaddr_in *const from = reinterpret_cast<struct sockaddr_in *>(&(pkt.from));
+		from->sin_len = sizeof(struct sockaddr_in);
+		from->sin_family = AF_INET;
+		memcpy(&(from->sin_addr),ip + 12,4);
+		memcpy(&(from->sin_port),udp,2);
+		memset(&(pkt.local),0,sizeof(struct sockaddr_in));
+		struct sockaddr_in *const local = reinterpret_cast<struct sockaddr_in *>(&(pkt.local));
+		local->sin_len = sizeof(struct sockaddr_in);
+		local->sin_family = AF_INET;
+		memcpy(&(local->sin_addr),ip + 16,4);
+		memcpy(&(local->sin_port),udp + 2,2);
+		pkt.data = (const void *)(udp + 8);
+		pkt.len = udpLen - 8;
+		return true;
+	} else if (etherType == 0x86dd) {
+		if (len < 48)
+			return false;
+		const unsigned int payloadLen = ((unsigned int)ip[4] << 8) | (unsigned int)ip[5];
+		if (((ip[0] >> 4) != 6)||(ip[6] != 17)||(payloadLen < 8)||(payloadLen > (len - 40)))
+			return false;
+		const uint8_t *const udp = ip + 40;
+		const unsigned int udpLen = ((unsigned int)udp[4] << 8) | (unsigned int)udp[5];
+		if ((udpLen < 8)||(udpLen > payloadLen)||(std::find(_ports.begin(),_ports.end(),((unsigned int)udp[2] << 8) | (unsigned int)udp[3]) == _ports.end()))
+			return false;
+
+		memset(&(pkt.from),0,sizeof(struct sockaddr_in6));
+		struct sockaddr_in6 *const from = reinterpret_cast<struct sockaddr_in6 *>(&(pkt.from));
+		from->sin6_len = sizeof(struct sockaddr_in6);
+		from->sin6_family = AF_INET6;
+		memcpy(&(from->sin6_addr),ip + 8,16);
+		memcpy(&(from->sin6_port),udp,2);
+		memset(&(pkt.local),0,sizeof(struct sockaddr_in6));
+		struct sockaddr_in6 *const local = reinterpret_cast<struct sockaddr_in6 *>(&(pkt.local));
+		local->sin6_len = sizeof(struct sockaddr_in6);
+		local->sin6_family = AF_INET6;
+		memcpy(&(local->sin6_addr),ip + 24,16);
+		memcpy(&(local->sin6_port),udp + 2,2);
+		if ((ip[8] == 0xfe)&&((ip[9] & 0xc0) == 0x80)) { // link-local
+			from->sin6_scope_id = _ifindex;
+			local->sin6_scope_id = _ifindex;
+		}
+		pkt.data = (const void *)(udp + 8);
+		pkt.len = udpLen - 8;
+		return true;
+	}
+	return false;
+}
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_NETMAP
@@ -0,0 +1,132 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BSDNETMAPRECEIVER_HPP
+#define ZT_BSDNETMAPRECEIVER_HPP
+
+// Built with -DZT_USE_NETMAP when the system headers have netmap. It is
+// only used (ZT_HAVE_NETMAP) on FreeBSD, where it is in the GENERIC kernel.
+#if defined(ZT_USE_NETMAP) && defined(__FreeBSD__)
+#define ZT_HAVE_NETMAP 1
+#endif
+
+#ifdef ZT_HAVE_NETMAP
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "../node/NonCopyable.hpp"
+#include "Thread.hpp"
+
+// Maximum packets passed to the handler at once
+#define ZT_BSD_NETMAP_RX_BATCH 64
+
+struct nm_desc;
+struct netmap_ring;
+
+namespace ZeroTier {
+
+/**
+ * A UDP packet received by BSDNetmapReceiver
+ */
+struct BSDNetmapPacket
+{
+	struct sockaddr_storage local; // destination IP and port
+	struct sockaddr_storage from; // source IP and port
+	const void *data; // UDP payload
+	unsigned int len;
+};
+
+/**
+ * Receives UDP for given ports straight off a device with netmap
+ *
+ * The device's hardware rings and its host rings are opened together, which
+ * takes it over from the kernel. One thread then moves frames between them:
+ * unfragmented IPv4 and IPv6 UDP packets for these ports are handed to the
+ * handler in batches straight from the receive rings, and everything else
+ * goes on to the kernel through the host rings by swapping buffers, as does
+ * everything the kernel sends out. Packets for these ports are taken
+ * whatever their destination address, so this isn't for a device that
+ * routes ZeroTier traffic on to other hosts.
+ *
+ * This only receives. Sends, and replies to these packets, still go out
+ * through normal sockets bound to the same ports (and so through the host
+ * rings). The device is given back to the kernel on close, including if
+ * this process dies. Requires root.
+ */
+class BSDNetmapReceiver : NonCopyable
+{
+public:
+	/**
+	 * @param dev Device name (e.g. ix0)
+	 * @param ports UDP ports to receive
+	 * @param portCount Number of ports
+	 * @param handler Called with batches of packets (from the receiver thread)
+	 * @param arg First argument to handler
+	 * @throws std::runtime_error netmap can't be used on this device (the device is left alone)
+	 */
+	BSDNetmapReceiver(
+		const char *dev,
+		const unsigned int *ports,
+		unsigned int portCount,
+		void (*handler)(void *,const BSDNetmapPacket *,unsigned int),
+		void *arg);
+
+	~BSDNetmapReceiver();
+
+	inline const std::string &deviceName() const { return _dev; }
+
+	void threadMain()
+		throw();
+
+private:
+	bool _receive(struct netmap_ring *rx,BSDNetmapPacket *packets);
+	bool _toHost(struct netmap_ring *rx,const uint32_t slot);
+	bool _toWire(struct netmap_ring *rx);
+	bool _parse(const uint8_t *frame,unsigned int len,BSDNetmapPacket &pkt) const;
+
+	void (*_handler)(void *,const BSDNetmapPacket *,unsigned int);
+	void *_arg;
+	std::string _dev;
+	unsigned int _ifindex;
+	std::vector<unsigned int> _ports;
+	struct nm_desc *_nm;
+	unsigned int _nextTxRing; // hardware ring the kernel's packets go out on next
+	Thread _thread;
+	int _shutdownSignalPipe[2];
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_NETMAP
+
+#endif
@@ -46,9 +46,16 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <ifaddrs.h>
+#include <fcntl.h>
 #ifdef __LINUX__
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+#ifdef __BSD__
+#include <net/if.h>
+#include <net/route.h>
 #endif
 #endif
 
@@ -71,6 +78,12 @@
 // Period between refreshes of bindings
 #define ZT_BINDER_REFRESH_PERIOD 30000
 
+// Period between refreshes of bindings when address changes are reported by the OS
+#define ZT_BINDER_MONITORED_REFRESH_PERIOD 300000
+
+// Delay after an address change before refreshing, to let bursts of changes settle
+#define ZT_BINDER_CHANGE_SETTLE_DELAY 250
+
 // Max number of bindings
 #define ZT_BINDER_MAX_BINDINGS 128
 
@@ -99,7 +112,106 @@ private:
 	};
 
 public:
-	Binder() : _bindingCount(0) {}
+	Binder() : _bindingCount(0),_pacingRate(0),_reusePort(false),_udpOnly(false) {}
+
+	/**
+	 * @param reusePort If true, bind UDP sockets with SO_REUSEPORT so other Binders can share the same ports
+	 * @param udpOnly If true, bind only UDP sockets and no TCP listen sockets
+	 */
+	Binder(const bool reusePort,const bool udpOnly) : _bindingCount(0),_pacingRate(0),_reusePort(reusePort),_udpOnly(udpOnly) {}
+
+	/**
+	 * Set whether UDP sockets bound from now on use SO_REUSEPORT
+	 *
+	 * @param reusePort If true, bind UDP sockets with SO_REUSEPORT so other Binders can share the same ports
+	 */
+	inline void setReusePort(const bool reusePort)
+	{
+		Mutex::Lock _l(_lock);
+		_reusePort = reusePort;
+	}
+
+	/**
+	 * Set the kernel pacing rate of bound UDP sockets and those bound later
+	 *
+	 * @param phy Physical interface
+	 * @param bytesPerSecond Maximum rate in bytes per second or 0 for no pacing
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline void setPacingRate(Phy<PHY_HANDLER_TYPE> &phy,const uint64_t bytesPerSecond)
+	{
+		Mutex::Lock _l(_lock);
+		if (bytesPerSecond == _pacingRate)
+			return;
+		_pacingRate = bytesPerSecond;
+		for(unsigned int b=0,c=_bindingCount;b<c;++b)
+			phy.setUdpPacingRate(_bindings[b].udpSock,bytesPerSecond);
+	}
+
+	/**
+	 * Open a socket that becomes readable when local interface addresses change
+	 *
+	 * This is an rtnetlink socket subscribed to address changes on Linux and
+	 * a routing socket on BSD and macOS. Data read from it should be passed
+	 * to isAddressChange() to see if a refresh() is warranted.
+	 *
+	 * @return Non-blocking socket to be closed by the caller, or -1 if unsupported or unavailable
+	 */
+	static inline int openAddressChangeMonitor()
+	{
+#if defined(__LINUX__)
+		const int s = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC|SOCK_NONBLOCK,NETLINK_ROUTE);
+		if (s < 0)
+			return -1;
+		struct sockaddr_nl sanl;
+		memset(&sanl,0,sizeof(sanl));
+		sanl.nl_family = AF_NETLINK;
+		sanl.nl_groups = RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+		if (::bind(s,(const struct sockaddr *)&sanl,sizeof(sanl)) != 0) {
+			::close(s);
+			return -1;
+		}
+		return s;
+#elif defined(__BSD__)
+		const int s = ::socket(PF_ROUTE,SOCK_RAW,0);
+		if (s < 0)
+			return -1;
+		fcntl(s,F_SETFL,fcntl(s,F_GETFL) | O_NONBLOCK);
+		fcntl(s,F_SETFD,fcntl(s,F_GETFD) | FD_CLOEXEC);
+		return s;
+#else
+		return -1;
+#endif
+	}
+
+	/**
+	 * @param data Data read from a socket returned by openAddressChangeMonitor()
+	 * @param len Length of data
+	 * @return True if data reports an address being added or removed
+	 */
+	static inline bool isAddressChange(const void *data,unsigned long len)
+	{
+#if defined(__LINUX__)
+		int l = (int)len;
+		for(const struct nlmsghdr *h=(const struct nlmsghdr *)data;NLMSG_OK(h,l);h=NLMSG_NEXT(h,l)) {
+			if ((h->nlmsg_type == RTM_NEWADDR)||(h->nlmsg_type == RTM_DELADDR))
+				return true;
+		}
+#elif defined(__BSD__)
+		// All routing socket messages begin with the same length, version and type fields
+		const char *p = (const char *)data;
+		while (len >= 4) {
+			const struct rt_msghdr *const h = (const struct rt_msghdr *)p;
+			if ((h->rtm_msglen < 4)||(h->rtm_msglen > len))
+				break;
+			if ((h->rtm_type == RTM_NEWADDR)||(h->rtm_type == RTM_DELADDR)||(h->rtm_type == RTM_IFINFO))
+				return true;
+			p += h->rtm_msglen;
+			len -= h->rtm_msglen;
+		}
+#endif
+		return false;
+	}
 
 	/**
 	 * Close all bound ports, should be called on shutdown
@@ -354,9 +466,9 @@ public:
 				++bi;
 			}
 			if (bi == _bindingCount) {
-				udps = phy.udpBind(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0,ZT_UDP_DESIRED_BUF_SIZE);
-				tcps = phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0);
-				if ((udps)&&(tcps)) {
+				udps = phy.udpBind(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0,ZT_UDP_DESIRED_BUF_SIZE,_reusePort);
+				tcps = (_udpOnly) ? (PhySocket *)0 : phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0);
+				if ((udps)&&((tcps)||(_udpOnly))) {
 #ifdef __LINUX__
 					// Bind Linux sockets to their device so routes tha we manage do not override physical routes (wish all platforms had this!)
 					if (ii->second.length() > 0) {
@@ -365,11 +477,15 @@ public:
 						int fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(udps);
 						if (fd >= 0)
 							setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
-						fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(tcps);
-						if (fd >= 0)
-							setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
+						if (tcps) {
+							fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(tcps);
+							if (fd >= 0)
+								setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
+						}
 					}
 #endif // __LINUX__
+					if (_pacingRate)
+						phy.setUdpPacingRate(udps,_pacingRate);
 					if (_bindingCount < ZT_BINDER_MAX_BINDINGS) {
 						_bindings[_bindingCount].udpSock = udps;
 						_bindings[_bindingCount].tcpListenSock = tcps;
@@ -426,6 +542,20 @@ public:
 		return false;
 	}
 
+	/**
+	 * @param addr Local address including port
+	 * @return UDP socket bound to this address or NULL if none
+	 */
+	inline PhySocket *udpSocketForLocalAddress(const InetAddress &addr) const
+	{
+		Mutex::Lock _l(_lock);
+		for(unsigned int b=0;b<_bindingCount;++b) {
+			if (_bindings[b].address == addr)
+				return _bindings[b].udpSock;
+		}
+		return (PhySocket *)0;
+	}
+
 	/**
 	 * Quickly check that a UDP socket is valid
 	 *
@@ -444,6 +574,9 @@ public:
 private:
 	_Binding _bindings[ZT_BINDER_MAX_BINDINGS];
 	std::atomic<unsigned int> _bindingCount;
+	uint64_t _pacingRate;
+	bool _reusePort;
+	bool _udpOnly;
 	Mutex _lock;
 };
 
@@ -0,0 +1,245 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "../node/Mutex.hpp"
+
+#include "CpuAffinity.hpp"
+#include "OSUtils.hpp"
+
+#ifdef __LINUX__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ZeroTier {
+
+static const char *const _CLASS_NAMES[CpuAffinity::THREAD_CLASS_COUNT] = { "main","io","tap","crypto","deferred","control","controller" };
+
+bool CpuAffinity::parse(const char *s,std::vector<unsigned int> &cpus)
+{
+	std::vector<unsigned int> c;
+	while (*s) {
+		char *e = (char *)0;
+		if ((*s < '0')||(*s > '9'))
+			return false;
+		const unsigned long a = strtoul(s,&e,10);
+		unsigned long b = a;
+		s = e;
+		if (*s == '-') {
+			++s;
+			if ((*s < '0')||(*s > '9'))
+				return false;
+			b = strtoul(s,&e,10);
+			s = e;
+		}
+		if ((b < a)||(b > ZT_CPU_AFFINITY_MAX_CPU))
+			return false;
+		for(unsigned long i=a;i<=b;++i)
+			c.push_back((unsigned int)i);
+		if (*s == ',')
+			++s;
+		else if ((*s)&&(*s != '\n'))
+			return false;
+		else break;
+	}
+	if (c.empty())
+		return false;
+	std::sort(c.begin(),c.end());
+	c.erase(std::unique(c.begin(),c.end()),c.end());
+	cpus.insert(cpus.end(),c.begin(),c.end());
+	return true;
+}
+
+std::string CpuAffinity::format(const std::vector<unsigned int> &cpus)
+{
+	std::string s;
+	char tmp[32];
+	for(unsigned long i=0;i<cpus.size();) {
+		unsigned long j = i;
+		while (((j + 1) < cpus.size())&&(cpus[j + 1] == (cpus[j] + 1)))
+			++j;
+		if (s.length())
+			s.push_back(',');
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),(j > i) ? "%u-%u" : "%u",cpus[i],cpus[j]);
+		s.append(tmp);
+		i = j + 1;
+	}
+	return s;
+}
+
+const char *CpuAffinity::name(const ThreadClass c)
+{
+	return ((unsigned int)c < THREAD_CLASS_COUNT) ? _CLASS_NAMES[(unsigned int)c] : "unknown";
+}
+
+bool CpuAffinity::classFromName(const char *n,ThreadClass &c)
+{
+	for(unsigned int i=0;i<THREAD_CLASS_COUNT;++i) {
+		if (!strcmp(n,_CLASS_NAMES[i])) {
+			c = (ThreadClass)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __LINUX__
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+static Mutex _lock;
+static std::vector<unsigned int> _cpus[CpuAffinity::THREAD_CLASS_COUNT];
+static cpu_set_t _original;
+static bool _haveOriginal = false;
+static bool _anyPinned = false;
+static std::vector<CpuAffinity::Placement> _placements;
+
+// NUMA node all of these CPUs are on, or -1 if they span nodes or there's no NUMA information
+static int _numaNode(const std::vector<unsigned int> &cpus)
+{
+	std::vector<std::string> nodes(OSUtils::listDirectory("/sys/devices/system/node",true));
+	for(std::vector<std::string>::const_iterator n(nodes.begin());n!=nodes.end();++n) {
+		if ((n->length() < 5)||(n->compare(0,4,"node") != 0)||((*n)[4] < '0')||((*n)[4] > '9'))
+			continue;
+		std::string cl;
+		std::vector<unsigned int> nc;
+		if ((!OSUtils::readFile((std::string("/sys/devices/system/node/") + *n + "/cpulist").c_str(),cl))||(!CpuAffinity::parse(cl.c_str(),nc)))
+			continue;
+		if (std::includes(nc.begin(),nc.end(),cpus.begin(),cpus.end()))
+			return atoi(n->c_str() + 4);
+	}
+	return -1;
+}
+
+static void _prune()
+{
+	char tmp[64];
+	for(std::vector<CpuAffinity::Placement>::iterator p(_placements.begin());p!=_placements.end();) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"/proc/self/task/%ld",p->tid);
+		if (OSUtils::fileExists(tmp,false))
+			++p;
+		else p = _placements.erase(p);
+	}
+}
+
+void CpuAffinity::set(const ThreadClass c,const std::vector<unsigned int> &cpus)
+{
+	Mutex::Lock _l(_lock);
+	if (!_haveOriginal) {
+		CPU_ZERO(&_original);
+		_haveOriginal = (sched_getaffinity(0,sizeof(_original),&_original) == 0);
+	}
+	if ((unsigned int)c < THREAD_CLASS_COUNT) {
+		_cpus[(unsigned int)c] = cpus;
+		if (!cpus.empty())
+			_anyPinned = true;
+	}
+}
+
+void CpuAffinity::apply(const ThreadClass c)
+{
+	if ((unsigned int)c >= THREAD_CLASS_COUNT)
+		return;
+
+	std::vector<unsigned int> cpus;
+	{
+		Mutex::Lock _l(_lock);
+		if (!_anyPinned)
+			return;
+		cpus = _cpus[(unsigned int)c];
+	}
+
+	Placement p;
+	p.threadClass = c;
+	p.tid = (long)syscall(SYS_gettid);
+	p.numaNode = -1;
+	p.pinned = false;
+
+	if (!cpus.empty()) {
+		cpu_set_t s;
+		CPU_ZERO(&s);
+		for(std::vector<unsigned int>::const_iterator i(cpus.begin());i!=cpus.end();++i)
+			CPU_SET(*i,&s);
+		// Fails if none of these CPUs are online and allowed, leaving the thread where it was
+		p.pinned = (sched_setaffinity(0,sizeof(s),&s) == 0);
+	} else if (_haveOriginal) {
+		sched_setaffinity(0,sizeof(_original),&_original);
+	}
+
+	// Report what the kernel actually allowed, since CPUs can be offline or outside our cpuset
+	cpu_set_t actual;
+	CPU_ZERO(&actual);
+	if (sched_getaffinity(0,sizeof(actual),&actual) == 0) {
+		std::vector<unsigned int> a;
+		for(unsigned int i=0;i<=ZT_CPU_AFFINITY_MAX_CPU;++i) {
+			if (CPU_ISSET(i,&actual))
+				a.push_back(i);
+		}
+		p.cpus = format(a);
+		if (!a.empty())
+			p.numaNode = _numaNode(a);
+	}
+
+	// Memory this thread allocates and first touches from here on comes from its node
+	if ((p.pinned)&&(p.numaNode >= 0)&&(p.numaNode < (int)(sizeof(unsigned long) * 8))) {
+		const unsigned long nodeMask = 1UL << p.numaNode;
+		syscall(SYS_set_mempolicy,MPOL_PREFERRED,&nodeMask,(unsigned long)(sizeof(nodeMask) * 8) + 1);
+	} else {
+		syscall(SYS_set_mempolicy,MPOL_DEFAULT,(const unsigned long *)0,0UL);
+	}
+
+	Mutex::Lock _l(_lock);
+	_prune();
+	_placements.push_back(p);
+}
+
+void CpuAffinity::placements(std::vector<Placement> &p)
+{
+	Mutex::Lock _l(_lock);
+	_prune();
+	p.insert(p.end(),_placements.begin(),_placements.end());
+}
+
+#else // !__LINUX__
+
+void CpuAffinity::set(const ThreadClass c,const std::vector<unsigned int> &cpus) {}
+void CpuAffinity::apply(const ThreadClass c) {}
+void CpuAffinity::placements(std::vector<Placement> &p) {}
+
+#endif
+
+} // namespace ZeroTier
@@ -0,0 +1,135 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_CPUAFFINITY_HPP
+#define ZT_CPUAFFINITY_HPP
+
+#include <string>
+#include <vector>
+
+#include "../node/Constants.hpp"
+
+/**
+ * Highest CPU number that can be named in a CPU list
+ */
+#define ZT_CPU_AFFINITY_MAX_CPU 1023
+
+namespace ZeroTier {
+
+/**
+ * CPU and NUMA placement of the service's threads
+ *
+ * Each class of thread can be given a set of CPUs in local.conf. Threads
+ * call apply() for their class first thing, which pins them there and, if
+ * all of those CPUs are on one NUMA node, makes that node preferred for
+ * the thread's memory. Buffers and packet pools a thread allocates and
+ * first touches after that then come from its own node. Threads created
+ * by a pinned thread inherit its placement, so a class with no CPU set
+ * is reset to the CPUs the process started with.
+ *
+ * Placement is only done on Linux. Elsewhere apply() does nothing.
+ */
+class CpuAffinity
+{
+public:
+	enum ThreadClass
+	{
+		THREAD_MAIN = 0,       // service main loop and Phy
+		THREAD_IO = 1,         // additional I/O threads and AF_XDP queues
+		THREAD_TAP = 2,        // tap reader queues
+		THREAD_CRYPTO = 3,     // crypto workers
+		THREAD_DEFERRED = 4,   // deferred packet workers
+		THREAD_CONTROL = 5,    // local HTTP control plane
+		THREAD_CONTROLLER = 6  // network controller and its database
+	};
+	static const unsigned int THREAD_CLASS_COUNT = 7;
+
+	/**
+	 * Where a thread that called apply() is running
+	 */
+	struct Placement
+	{
+		ThreadClass threadClass;
+		long tid;           // kernel thread ID
+		std::string cpus;   // CPUs it may run on, as a CPU list
+		int numaNode;       // NUMA node of those CPUs, or -1 if more than one or unknown
+		bool pinned;        // true if pinned to its class's CPU set
+	};
+
+	/**
+	 * Parse a CPU list such as "0-3,8,10-11"
+	 *
+	 * @param s CPU list
+	 * @param cpus Sorted CPU numbers are appended here
+	 * @return False if the list is empty or malformed
+	 */
+	static bool parse(const char *s,std::vector<unsigned int> &cpus);
+
+	/**
+	 * @param cpus Sorted CPU numbers
+	 * @return CPU list using ranges where possible
+	 */
+	static std::string format(const std::vector<unsigned int> &cpus);
+
+	/**
+	 * @param c Thread class
+	 * @return Name of class as used in local.conf
+	 */
+	static const char *name(const ThreadClass c);
+
+	/**
+	 * @param n Name of class as used in local.conf
+	 * @param c Set to class if found
+	 * @return True if name is a thread class
+	 */
+	static bool classFromName(const char *n,ThreadClass &c);
+
+	/**
+	 * Set the CPUs for a class of thread
+	 *
+	 * This must be called before any thread of the class calls apply().
+	 *
+	 * @param c Thread class
+	 * @param cpus CPUs to run on, or empty to run anywhere
+	 */
+	static void set(const ThreadClass c,const std::vector<unsigned int> &cpus);
+
+	/**
+	 * Place the calling thread according to its class
+	 *
+	 * @param c Class of calling thread
+	 */
+	static void apply(const ThreadClass c);
+
+	/**
+	 * @param p Threads that have called apply() and are still running are appended here
+	 */
+	static void placements(std::vector<Placement> &p);
+};
+
+} // namespace ZeroTier
+
+#endif
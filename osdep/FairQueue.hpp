@@ -0,0 +1,152 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_FAIRQUEUE_HPP
+#define ZT_FAIRQUEUE_HPP
+
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace ZeroTier {
+
+/**
+ * Thread-safe queue with one lane per key, served round-robin
+ *
+ * A key's items are handed out one at a time: after get() returns an item
+ * for a key, no other item for that key is returned until done() is called
+ * for it. Keys with waiting items take turns in the order they became
+ * ready, so a key with a deep backlog gets one item in per turn and can't
+ * hold up the rest. Any idle thread takes whichever key is next.
+ *
+ * Do not use in node/ since we have not gone C++11 there yet.
+ */
+template <class K,class T>
+class FairQueue
+{
+public:
+	FairQueue() : r(true),n(0) {}
+
+	inline void post(const K &k,T t)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		_Lane &l = lanes[k];
+		l.q.push_back(t);
+		++n;
+		if ((!l.busy)&&(l.q.size() == 1)) {
+			ready.push_back(k);
+			c.notify_one();
+		}
+	}
+
+	inline void stop()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		r = false;
+		c.notify_all();
+	}
+
+	enum TimedWaitResult
+	{
+		OK,
+		TIMED_OUT,
+		STOP
+	};
+
+	/**
+	 * Get the next item from the next ready key
+	 *
+	 * On OK the key is busy until done(k) is called.
+	 */
+	inline TimedWaitResult get(K &k,T &value,const unsigned long ms)
+	{
+		const std::chrono::milliseconds ms2{ms};
+		std::unique_lock<std::mutex> lock(m);
+		if (!r) return STOP;
+		while (ready.empty()) {
+			if (c.wait_for(lock,ms2) == std::cv_status::timeout)
+				return ((r) ? TIMED_OUT : STOP);
+			else if (!r)
+				return STOP;
+		}
+		k = ready.front();
+		ready.pop_front();
+		_Lane &l = lanes[k];
+		l.busy = true;
+		value = l.q.front();
+		l.q.pop_front();
+		--n;
+		return OK;
+	}
+
+	/**
+	 * Release a key returned by get() so its next item can be handed out
+	 */
+	inline void done(const K &k)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		typename std::unordered_map<K,_Lane>::iterator l(lanes.find(k));
+		if (l == lanes.end())
+			return;
+		if (l->second.q.empty()) {
+			lanes.erase(l);
+		} else {
+			l->second.busy = false;
+			ready.push_back(k);
+			c.notify_one();
+		}
+	}
+
+	/**
+	 * @return Number of items waiting (not counting those handed out)
+	 */
+	inline unsigned long size()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return n;
+	}
+
+private:
+	struct _Lane
+	{
+		_Lane() : busy(false) {}
+		std::deque<T> q;
+		bool busy;
+	};
+
+	volatile bool r;
+	unsigned long n;
+	std::unordered_map<K,_Lane> lanes;
+	std::deque<K> ready;
+	std::mutex m;
+	std::condition_variable c;
+};
+
+} // namespace ZeroTier
+
+#endif
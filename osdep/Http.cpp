@@ -33,6 +33,7 @@
 #include "OSUtils.hpp"
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
+#include "../node/InetAddress.hpp"
 
 #ifdef ZT_USE_SYSTEM_HTTP_PARSER
 #include <http_parser.h>
@@ -126,7 +127,7 @@ struct HttpPhyHandler
 	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
 	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
 	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
-	inline void phyOnUnixWritable(PhySocket *sock,void **uptr) {}
+	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked) {}
 #endif // __UNIX_LIKE__
 
 	http_parser parser;
@@ -140,6 +141,8 @@ struct HttpPhyHandler
 	unsigned long maxResponseSize;
 	std::map<std::string,std::string> *responseHeaders;
 	std::string *responseBody;
+	bool keepOpen; // if true, leave the connection open after the response and set complete
+	bool complete;
 	bool error;
 	bool done;
 
@@ -212,10 +215,28 @@ static int ShttpOnBody(http_parser *parser,const char *ptr,size_t length)
 static int ShttpOnMessageComplete(http_parser *parser)
 {
 	HttpPhyHandler *hh = reinterpret_cast<HttpPhyHandler *>(parser->data);
-	hh->phy->close(hh->sock);
+	if (hh->keepOpen) {
+		hh->complete = true;
+	} else {
+		hh->phy->close(hh->sock);
+	}
 	return 0;
 }
 
+static void _appendRequest(std::string &buf,const char *method,const char *path,const std::map<std::string,std::string> &requestHeaders,const void *requestBody,unsigned long requestBodyLength)
+{
+	char tmp[1024];
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s %s HTTP/1.1\r\n",method,path);
+	buf.append(tmp);
+	for(std::map<std::string,std::string>::const_iterator h(requestHeaders.begin());h!=requestHeaders.end();++h) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s: %s\r\n",h->first.c_str(),h->second.c_str());
+		buf.append(tmp);
+	}
+	buf.append("\r\n");
+	if ((requestBody)&&(requestBodyLength))
+		buf.append((const char *)requestBody,requestBodyLength);
+}
+
 } // anonymous namespace
 
 unsigned int Http::_do(
@@ -243,16 +264,7 @@ unsigned int Http::_do(
 		handler.lastActivity = OSUtils::now();
 
 		try {
-			char tmp[1024];
-			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s %s HTTP/1.1\r\n",method,path);
-			handler.writeBuf.append(tmp);
-			for(std::map<std::string,std::string>::const_iterator h(requestHeaders.begin());h!=requestHeaders.end();++h) {
-				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s: %s\r\n",h->first.c_str(),h->second.c_str());
-				handler.writeBuf.append(tmp);
-			}
-			handler.writeBuf.append("\r\n");
-			if ((requestBody)&&(requestBodyLength))
-				handler.writeBuf.append((const char *)requestBody,requestBodyLength);
+			_appendRequest(handler.writeBuf,method,path,requestHeaders,requestBody,requestBodyLength);
 		} catch ( ... ) {
 			responseBody = "request too large";
 			return 0;
@@ -265,6 +277,8 @@ unsigned int Http::_do(
 		}
 		handler.responseHeaders = &responseHeaders;
 		handler.responseBody = &responseBody;
+		handler.keepOpen = false;
+		handler.complete = false;
 		handler.error = false;
 		handler.done = false;
 
@@ -297,4 +311,164 @@ unsigned int Http::_do(
 	}
 }
 
+void Http::batch(
+	unsigned long timeout,
+	const struct sockaddr *remoteAddress,
+	const std::vector<Request> &requests,
+	std::vector<unsigned int> &statusCodes)
+{
+	Pool p;
+	p.batch(timeout,remoteAddress,requests,statusCodes);
+}
+
+struct Http::Pool::_Connection
+{
+	_Connection() : phy(&handler,true,true) {}
+
+	HttpPhyHandler handler;
+	Phy<HttpPhyHandler *> phy;
+	InetAddress remoteAddress;
+	uint64_t lastUsed;
+};
+
+Http::Pool::Pool() {}
+
+Http::Pool::~Pool()
+{
+	for(std::vector<_Connection *>::iterator c(_idle.begin());c!=_idle.end();++c)
+		delete *c;
+}
+
+unsigned int Http::Pool::request(
+	const char *method,
+	unsigned long maxResponseSize,
+	unsigned long timeout,
+	const struct sockaddr *remoteAddress,
+	const char *path,
+	const std::map<std::string,std::string> &requestHeaders,
+	const void *requestBody,
+	unsigned long requestBodyLength,
+	std::map<std::string,std::string> &responseHeaders,
+	std::string &responseBody)
+{
+	const InetAddress ra(remoteAddress);
+	for(int attempt=0;attempt<2;++attempt) {
+		responseHeaders.clear();
+		responseBody = "";
+
+		_Connection *c = (_Connection *)0;
+		if (attempt == 0) {
+			const uint64_t now = OSUtils::now();
+			Mutex::Lock _l(_idle_m);
+			for(std::vector<_Connection *>::iterator i(_idle.begin());i!=_idle.end();) {
+				if ((now - (*i)->lastUsed) > ZT_HTTP_POOL_IDLE_TIMEOUT) {
+					delete *i;
+					i = _idle.erase(i);
+				} else if ((*i)->remoteAddress == ra) {
+					c = *i;
+					_idle.erase(i);
+					break;
+				} else ++i;
+			}
+		}
+
+		try {
+			// If the server hung up on an idle connection we'll find out once we try to use it
+			const bool reused = (c != (_Connection *)0);
+			if (!c) {
+				c = new _Connection();
+				c->remoteAddress = ra;
+				c->handler.phy = &(c->phy);
+				c->handler.done = false;
+			}
+
+			HttpPhyHandler &h = c->handler;
+			http_parser_init(&(h.parser),HTTP_RESPONSE);
+			h.parser.data = (void *)&h;
+			h.currentHeaderField = "";
+			h.currentHeaderValue = "";
+			h.messageSize = 0;
+			h.writePtr = 0;
+			h.lastActivity = OSUtils::now();
+			h.writeBuf.clear();
+			_appendRequest(h.writeBuf,method,path,requestHeaders,requestBody,requestBodyLength);
+			h.maxResponseSize = (maxResponseSize) ? maxResponseSize : 2147483647;
+			h.responseHeaders = &responseHeaders;
+			h.responseBody = &responseBody;
+			h.keepOpen = true;
+			h.complete = false;
+			h.error = false;
+			if (reused) {
+				c->phy.setNotifyWritable(h.sock,true);
+			} else {
+				bool instantConnect = false;
+				h.sock = c->phy.tcpConnect(remoteAddress,instantConnect,(void *)0,true);
+				if (!h.sock) {
+					delete c;
+					responseBody = "connection failed (2)";
+					return 0;
+				}
+			}
+
+			bool timedOut = false;
+			while ((!h.done)&&(!h.complete)) {
+				c->phy.poll(timeout / 2);
+				if ((!h.complete)&&(timeout)&&((unsigned long)(OSUtils::now() - h.lastActivity) > timeout)) {
+					timedOut = true;
+					break;
+				}
+			}
+
+			if ((h.complete)&&(!h.error)) {
+				const unsigned int sc = h.parser.status_code;
+				if ((!h.done)&&(http_should_keep_alive(&(h.parser)))) {
+					c->lastUsed = OSUtils::now();
+					Mutex::Lock _l(_idle_m);
+					if (_idle.size() < ZT_HTTP_POOL_MAX_IDLE) {
+						_idle.push_back(c);
+						c = (_Connection *)0;
+					}
+				}
+				delete c;
+				return sc;
+			}
+
+			const bool retry = ((reused)&&(!timedOut)&&(!h.error)&&(h.messageSize == 0)&&(responseBody.length() == 0));
+			if (timedOut)
+				responseBody = "timed out";
+			else if ((!h.error)&&(responseBody.length() == 0))
+				responseBody = "connection closed";
+			delete c;
+			if (!retry)
+				return 0;
+		} catch (std::exception &exc) {
+			delete c;
+			responseBody = exc.what();
+			return 0;
+		} catch ( ... ) {
+			delete c;
+			responseBody = "unknown exception";
+			return 0;
+		}
+	}
+	return 0;
+}
+
+void Http::Pool::batch(
+	unsigned long timeout,
+	const struct sockaddr *remoteAddress,
+	const std::vector<Request> &requests,
+	std::vector<unsigned int> &statusCodes)
+{
+	std::map<std::string,std::string> responseHeaders;
+	std::string responseBody;
+	statusCodes.clear();
+	for(std::vector<Request>::const_iterator r(requests.begin());r!=requests.end();++r) {
+		const unsigned int sc = request(r->method.c_str(),0,timeout,remoteAddress,r->path.c_str(),r->headers,r->body.data(),(unsigned long)r->body.length(),responseHeaders,responseBody);
+		if (!sc)
+			break;
+		statusCodes.push_back(sc);
+	}
+}
+
 } // namespace ZeroTier
@@ -29,6 +29,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <stdexcept>
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -44,6 +45,19 @@
 #include <netinet/in.h>
 #endif
 
+#include "../node/Mutex.hpp"
+#include "../node/NonCopyable.hpp"
+
+/**
+ * Pooled connections idle for longer than this are closed instead of reused
+ */
+#define ZT_HTTP_POOL_IDLE_TIMEOUT 15000
+
+/**
+ * Maximum number of idle connections a pool keeps
+ */
+#define ZT_HTTP_POOL_MAX_IDLE 8
+
 namespace ZeroTier {
 
 /**
@@ -52,6 +66,69 @@ namespace ZeroTier {
 class Http
 {
 public:
+	/**
+	 * A request for batch()
+	 */
+	struct Request
+	{
+		std::string method;
+		std::string path;
+		std::map<std::string,std::string> headers;
+		std::string body;
+	};
+
+	/**
+	 * A pool of keep-alive client connections, reused across requests
+	 *
+	 * Requests through a pool go to whatever server they're addressed to. A
+	 * connection is checked out for each request, so several threads can use
+	 * one pool at once, and is put back afterwards if the server left it open.
+	 * If a reused connection turns out to have been closed by the server
+	 * before it answered, the request is retried once on a new connection.
+	 */
+	class Pool : NonCopyable
+	{
+	public:
+		Pool();
+		~Pool();
+
+		/**
+		 * Make an HTTP request
+		 *
+		 * The caller must set all headers, including Host and (if there is a
+		 * body) Content-Length.
+		 *
+		 * @return HTTP status code or 0 on error (responseBody will contain error message)
+		 */
+		unsigned int request(
+			const char *method,
+			unsigned long maxResponseSize,
+			unsigned long timeout,
+			const struct sockaddr *remoteAddress,
+			const char *path,
+			const std::map<std::string,std::string> &requestHeaders,
+			const void *requestBody,
+			unsigned long requestBodyLength,
+			std::map<std::string,std::string> &responseHeaders,
+			std::string &responseBody);
+
+		/**
+		 * Make a series of requests in order, stopping at the first that fails
+		 *
+		 * This is the same as Http::batch() except that connections are reused.
+		 */
+		void batch(
+			unsigned long timeout,
+			const struct sockaddr *remoteAddress,
+			const std::vector<Request> &requests,
+			std::vector<unsigned int> &statusCodes);
+
+	private:
+		struct _Connection;
+		std::vector<_Connection *> _idle;
+		Mutex _idle_m;
+	};
+
 	/**
 	 * Make HTTP GET request
 	 *
@@ -176,6 +253,26 @@ public:
 			responseBody);
 	}
 
+	/**
+	 * Make a series of HTTP requests in order over one keep-alive connection
+	 *
+	 * Each request is sent once the response to the previous one has been
+	 * read, reconnecting if the server closes the connection in between.
+	 * This stops early if a request fails or times out, so the caller should
+	 * retry any request without a status code. The caller must set all headers as with the methods
+	 * above. Response bodies are discarded.
+	 *
+	 * @param timeout Timeout for any single request
+	 * @param remoteAddress Address of server
+	 * @param requests Requests to make
+	 * @param statusCodes Filled with the HTTP status code of each request that got a response, in order
+	 */
+	static void batch(
+		unsigned long timeout,
+		const struct sockaddr *remoteAddress,
+		const std::vector<Request> &requests,
+		std::vector<unsigned int> &statusCodes);
+
 private:
 	static unsigned int _do(
 		const char *method,
@@ -37,6 +37,8 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
@@ -55,6 +57,7 @@
 #include "../node/Mutex.hpp"
 #include "../node/Dictionary.hpp"
 #include "OSUtils.hpp"
+#include "CpuAffinity.hpp"
 #include "LinuxEthernetTap.hpp"
 
 // ff:ff:ff:ff:ff:ff with no ADI
@@ -65,6 +68,51 @@ namespace ZeroTier {
 static Mutex __tapCreateLock;
 
 static const char _base32_chars[32] = { 'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z','2','3','4','5','6','7' };
+// Legacy virtio net header that precedes frames with IFF_VNET_HDR (linux/virtio_net.h doesn't compile as C++)
+struct _VirtioNetHdr
+{
+	uint8_t flags;
+	uint8_t gsoType;
+	uint16_t hdrLen;
+	uint16_t gsoSize;
+	uint16_t csumStart;
+	uint16_t csumOffset;
+};
+#define ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define ZT_VIRTIO_NET_HDR_F_DATA_VALID 2
+#define ZT_VIRTIO_NET_HDR_GSO_NONE 0
+#define ZT_VIRTIO_NET_HDR_GSO_TCPV4 1
+#define ZT_VIRTIO_NET_HDR_GSO_TCPV6 4
+#define ZT_VIRTIO_NET_HDR_GSO_ECN 0x80
+
+// One's complement sum over data in network byte order, for IP and TCP checksums
+static inline uint32_t _csumAdd(uint32_t sum,const uint8_t *p,unsigned int len)
+{
+	while (len > 1) {
+		sum += ((uint32_t)p[0] << 8) | (uint32_t)p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += (uint32_t)p[0] << 8;
+	return sum;
+}
+static inline uint16_t _csumFinish(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+static inline void _put16(uint8_t *p,const unsigned int v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+static inline bool _isVlanTagged(const uint8_t *frame)
+{
+	return ((frame[12] == 0x81)&&(frame[13] == 0x00));
+}
+
 static void _base32_5_to_8(const uint8_t *in,char *out)
 {
 	out[0] = _base32_chars[(in[0]) >> 3];
@@ -85,14 +133,21 @@ LinuxEthernetTap::LinuxEthernetTap(
 	uint64_t nwid,
 	const char *friendlyName,
 	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
-	void *arg) :
+	void *arg,
+	unsigned int queues,
+	bool ioUring,
+	bool l3) :
 	_handler(handler),
 	_arg(arg),
 	_nwid(nwid),
 	_homePath(homePath),
+	_mac(mac),
 	_mtu(mtu),
 	_fd(0),
-	_enabled(true)
+	_vnetHdr(false),
+	_ioUring(ioUring),
+	_enabled(true),
+	_tun((TunAdapter *)0)
 {
 	char procpath[128],nwids[32];
 	struct stat sbuf;
@@ -163,13 +218,37 @@ LinuxEthernetTap::LinuxEthernetTap(
 #endif
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-	if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
+	queues = std::max(std::min(queues,(unsigned int)ZT_LINUX_TAP_MAX_QUEUES),1U);
+	struct ifreq ifrq;
+	memcpy(&ifrq,&ifr,sizeof(ifrq)); // name and flags for attaching any additional queues
+
+	bool configured = false;
+	const short tapFlags = ((l3) ? IFF_TUN : IFF_TAP) | IFF_NO_PI | IFF_VNET_HDR;
+	ifr.ifr_flags = tapFlags;
+#ifdef IFF_MULTI_QUEUE
+	if (queues > 1) {
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+		configured = (ioctl(_fd,TUNSETIFF,(void *)&ifr) >= 0);
+		if (!configured) {
+			// Older kernels don't do multiqueue, and an existing device keeps the mode it was created with
+			memcpy(&ifr,&ifrq,sizeof(ifr));
+			ifr.ifr_flags = tapFlags;
+			queues = 1;
+		}
+	}
+#else
+	queues = 1;
+#endif
+	if ((!configured)&&(ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0)) {
 		::close(_fd);
 		throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
 	}
 
 	_dev = ifr.ifr_name;
+	_vnetHdr = true;
+
+	// If the kernel won't do offloads we still get a (zero) virtio header on every frame
+	::ioctl(_fd,TUNSETOFFLOAD,(unsigned int)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6));
 
 	::ioctl(_fd,TUNSETPERSIST,0); // valgrind may generate a false alarm here
 
@@ -180,14 +259,16 @@ LinuxEthernetTap::LinuxEthernetTap(
 		throw std::runtime_error("unable to open netlink socket");
 	}
 
-	// Set MAC address
-	ifr.ifr_ifru.ifru_hwaddr.sa_family = ARPHRD_ETHER;
-	mac.copyTo(ifr.ifr_ifru.ifru_hwaddr.sa_data,6);
-	if (ioctl(sock,SIOCSIFHWADDR,(void *)&ifr) < 0) {
-		::close(_fd);
-		::close(sock);
-		throw std::runtime_error("unable to configure TAP hardware (MAC) address");
-		return;
+	// Set MAC address (TUN devices have none, our MAC is only used on the network side)
+	if (!l3) {
+		ifr.ifr_ifru.ifru_hwaddr.sa_family = ARPHRD_ETHER;
+		mac.copyTo(ifr.ifr_ifru.ifru_hwaddr.sa_data,6);
+		if (ioctl(sock,SIOCSIFHWADDR,(void *)&ifr) < 0) {
+			::close(_fd);
+			::close(sock);
+			throw std::runtime_error("unable to configure TAP hardware (MAC) address");
+			return;
+		}
 	}
 
 	// Set MTU
@@ -221,8 +302,40 @@ LinuxEthernetTap::LinuxEthernetTap(
 	// Set close-on-exec so that devices cannot persist if we fork/exec for update
 	::fcntl(_fd,F_SETFD,fcntl(_fd,F_GETFD) | FD_CLOEXEC);
 
+	_queues.resize(1);
+	_queues[0].tap = this;
+	_queues[0].fd = _fd;
+
+#ifdef IFF_MULTI_QUEUE
+	// Attach additional queues to the device, stopping at the first that fails
+	Utils::scopy(ifrq.ifr_name,sizeof(ifrq.ifr_name),_dev.c_str());
+	ifrq.ifr_flags = tapFlags | IFF_MULTI_QUEUE;
+	while (_queues.size() < queues) {
+		const int qfd = ::open("/dev/net/tun",O_RDWR);
+		if (qfd <= 0)
+			break;
+		if (ioctl(qfd,TUNSETIFF,(void *)&ifrq) < 0) {
+			::close(qfd);
+			break;
+		}
+		::fcntl(qfd,F_SETFL,fcntl(qfd,F_GETFL) & ~O_NONBLOCK);
+		::fcntl(qfd,F_SETFD,fcntl(qfd,F_GETFD) | FD_CLOEXEC);
+		_queues.push_back(_Queue());
+		_queues.back().tap = this;
+		_queues.back().fd = qfd;
+	}
+#endif
+
 	(void)::pipe(_shutdownSignalPipe);
 
+	_l3WakePipe[0] = -1;
+	_l3WakePipe[1] = -1;
+	if (l3) {
+		_tun = new TunAdapter(mac,nwid);
+		if (::pipe(_l3WakePipe) == 0)
+			::fcntl(_l3WakePipe[1],F_SETFL,fcntl(_l3WakePipe[1],F_GETFL) | O_NONBLOCK);
+	}
+
 	/*
 	globalDeviceMap[nwids] = _dev;
 	devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"w");
@@ -236,16 +349,26 @@ LinuxEthernetTap::LinuxEthernetTap(
 	}
 	*/
 
-	_thread = Thread::start(this);
+	// _queues is not resized after this, so these pointers stay valid
+	for(std::vector<_Queue>::iterator q(_queues.begin());q!=_queues.end();++q)
+		q->thread = Thread::start(&(*q));
 }
 
 LinuxEthernetTap::~LinuxEthernetTap()
 {
-	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
-	Thread::join(_thread);
-	::close(_fd);
+	LinuxTapGro::forget(this);
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes threads to exit
+	for(std::vector<_Queue>::iterator q(_queues.begin());q!=_queues.end();++q) {
+		Thread::join(q->thread);
+		::close(q->fd);
+	}
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
+	if (_l3WakePipe[0] >= 0) {
+		::close(_l3WakePipe[0]);
+		::close(_l3WakePipe[1]);
+	}
+	delete _tun;
 }
 
 void LinuxEthernetTap::setEnabled(bool en)
@@ -335,6 +458,9 @@ bool LinuxEthernetTap::addIp(const InetAddress &ip)
 	if (!ip)
 		return false;
 
+	if (_tun)
+		_tun->addLocal(ip);
+
 	std::vector<InetAddress> allIps(ips());
 	if (std::binary_search(allIps.begin(),allIps.end(),ip))
 		return true;
@@ -369,6 +495,8 @@ bool LinuxEthernetTap::removeIp(const InetAddress &ip)
 {
 	if (!ip)
 		return true;
+	if (_tun)
+		_tun->removeLocal(ip);
 	std::vector<InetAddress> allIps(ips());
 	if (std::find(allIps.begin(),allIps.end(),ip) != allIps.end()) {
 		if (___removeIp(_dev,ip))
@@ -417,14 +545,54 @@ std::vector<InetAddress> LinuxEthernetTap::ips() const
 
 void LinuxEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
+	char hdrBuf[sizeof(_VirtioNetHdr) + 14];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		(void)::write(_fd,putBuf,len);
+		if (_tun) {
+			_L3Frame reply;
+			if (!_tun->inbound(from,etherType,data,len,reply.data,reply.len,reply.to,reply.etherType)) {
+				if ((reply.len)&&(_l3WakePipe[1] >= 0)) {
+					Mutex::Lock _l(_l3Pending_m);
+					if (_l3Pending.size() < ZT_LINUX_TAP_L3_MAX_PENDING) {
+						_l3Pending.push_back(reply);
+						(void)::write(_l3WakePipe[1],"\0",1);
+					}
+				}
+				return;
+			}
+
+			// The kernel gets just the IP packet behind the virtio header
+			_VirtioNetHdr vh;
+			memset(&vh,0,sizeof(vh));
+			vh.flags = ZT_VIRTIO_NET_HDR_F_DATA_VALID;
+			struct iovec iov[2];
+			iov[0].iov_base = &vh;
+			iov[0].iov_len = sizeof(vh);
+			iov[1].iov_base = const_cast<void *>(data);
+			iov[1].iov_len = len;
+			(void)::writev(_fd,iov,2);
+			return;
+		}
+
+		unsigned int vhl = 0;
+		if (_vnetHdr) {
+			// Frames arrive authenticated, so the kernel needn't verify their checksums again
+			_VirtioNetHdr vh;
+			memset(&vh,0,sizeof(vh));
+			vh.flags = ZT_VIRTIO_NET_HDR_F_DATA_VALID;
+			memcpy(hdrBuf,&vh,sizeof(vh));
+			vhl = sizeof(vh);
+		}
+		to.copyTo(hdrBuf + vhl,6);
+		from.copyTo(hdrBuf + vhl + 6,6);
+		*((uint16_t *)(hdrBuf + vhl + 12)) = htons((uint16_t)etherType);
+
+		// Payload goes straight from the decrypted packet to the kernel
+		struct iovec iov[2];
+		iov[0].iov_base = hdrBuf;
+		iov[0].iov_len = vhl + 14;
+		iov[1].iov_base = const_cast<void *>(data);
+		iov[1].iov_len = len;
+		(void)::writev(_fd,iov,(len) ? 2 : 1);
 	}
 }
 
@@ -468,8 +636,14 @@ void LinuxEthernetTap::scanMulticastGroups(std::vector<MulticastGroup> &added,st
 	}
 
 	std::vector<InetAddress> allIps(ips());
-	for(std::vector<InetAddress>::iterator ip(allIps.begin());ip!=allIps.end();++ip)
+	for(std::vector<InetAddress>::iterator ip(allIps.begin());ip!=allIps.end();++ip) {
 		newGroups.push_back(MulticastGroup::deriveMulticastGroupForAddressResolution(*ip));
+		if ((_tun)&&(ip->isV6())) {
+			// A TUN device joins no Ethernet groups, so listen for neighbor solicitations ourselves
+			const uint8_t *const a = reinterpret_cast<const uint8_t *>(ip->rawIpData());
+			newGroups.push_back(MulticastGroup(MAC(0x33,0x33,0xff,a[13],a[14],a[15]),0));
+		}
+	}
 
 	std::sort(newGroups.begin(),newGroups.end());
 	newGroups.erase(std::unique(newGroups.begin(),newGroups.end()),newGroups.end());
@@ -494,6 +668,7 @@ void LinuxEthernetTap::setMtu(unsigned int mtu)
 		if (sock > 0) {
 			struct ifreq ifr;
 			memset(&ifr,0,sizeof(ifr));
+			Utils::scopy(ifr.ifr_name,sizeof(ifr.ifr_name),_dev.c_str());
 			ifr.ifr_ifru.ifru_mtu = (int)mtu;
 			ioctl(sock,SIOCSIFMTU,(void *)&ifr);
 			close(sock);
@@ -501,31 +676,86 @@ void LinuxEthernetTap::setMtu(unsigned int mtu)
 	}
 }
 
-void LinuxEthernetTap::threadMain()
+void LinuxEthernetTap::setL3Routes(const ZT_VirtualNetworkRoute *routes,unsigned int count)
+{
+	if (_tun)
+		_tun->setRoutes(routes,count);
+}
+
+void LinuxEthernetTap::_Queue::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_TAP);
+	tap->_readQueue(fd);
+}
+
+void LinuxEthernetTap::_readQueue(int fd)
 	throw()
 {
 	fd_set readfds,nullfds;
 	MAC to,from;
 	int n,nfds,r;
 	char getBuf[ZT_MAX_MTU + 64];
+	uint8_t *const vnetBuf = (_vnetHdr) ? new uint8_t[ZT_LINUX_TAP_VNET_BUF_SIZE] : (uint8_t *)0;
 
 	Thread::sleep(500);
 
+#ifdef ZT_HAVE_IO_URING
+	if ((_ioUring)&&(!_tun)&&(_readQueueIoUring(fd))) {
+		delete [] vnetBuf;
+		return;
+	}
+#endif
+
+	// Replies queued by put() in L3 mode are sent from the first queue's thread
+	const int wakeFd = (fd == _fd) ? _l3WakePipe[0] : -1;
+
 	FD_ZERO(&readfds);
 	FD_ZERO(&nullfds);
-	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
+	nfds = (int)std::max(std::max(_shutdownSignalPipe[0],fd),wakeFd) + 1;
 
 	r = 0;
 	for(;;) {
 		FD_SET(_shutdownSignalPipe[0],&readfds);
-		FD_SET(_fd,&readfds);
+		FD_SET(fd,&readfds);
+		if (wakeFd >= 0)
+			FD_SET(wakeFd,&readfds);
 		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
 
 		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
 			break;
 
-		if (FD_ISSET(_fd,&readfds)) {
-			n = (int)::read(_fd,getBuf + r,sizeof(getBuf) - r);
+		if ((wakeFd >= 0)&&(FD_ISSET(wakeFd,&readfds))) {
+			char tmp[64];
+			(void)::read(wakeFd,tmp,sizeof(tmp));
+			_sendL3Pending();
+		}
+
+		if ((_tun)&&(vnetBuf)&&(FD_ISSET(fd,&readfds))) {
+			// Read the IP packet 14 bytes past the virtio header to leave room for an Ethernet header
+			struct iovec iov[2];
+			iov[0].iov_base = vnetBuf;
+			iov[0].iov_len = sizeof(_VirtioNetHdr);
+			iov[1].iov_base = vnetBuf + sizeof(_VirtioNetHdr) + 14;
+			iov[1].iov_len = ZT_LINUX_TAP_VNET_BUF_SIZE - (sizeof(_VirtioNetHdr) + 14);
+			n = (int)::readv(fd,iov,2);
+			if (n < 0) {
+				if ((errno != EINTR)&&(errno != ETIMEDOUT))
+					break;
+			} else if ((n > (int)(sizeof(_VirtioNetHdr) + 20))&&(_enabled)) {
+				_deliverTunPacket(vnetBuf,(unsigned int)n + 14);
+			}
+		} else if ((vnetBuf)&&(FD_ISSET(fd,&readfds))) {
+			// With a virtio header every read returns exactly one (possibly super-sized) frame
+			n = (int)::read(fd,vnetBuf,ZT_LINUX_TAP_VNET_BUF_SIZE);
+			if (n < 0) {
+				if ((errno != EINTR)&&(errno != ETIMEDOUT))
+					break;
+			} else if ((n > (int)(sizeof(_VirtioNetHdr) + 14))&&(_enabled)) {
+				_deliverVnetFrame(vnetBuf,(unsigned int)n);
+			}
+		} else if (FD_ISSET(fd,&readfds)) {
+			n = (int)::read(fd,getBuf + r,sizeof(getBuf) - r);
 			if (n < 0) {
 				if ((errno != EINTR)&&(errno != ETIMEDOUT))
 					break;
@@ -551,6 +781,447 @@ void LinuxEthernetTap::threadMain()
 			}
 		}
 	}
+
+	delete [] vnetBuf;
+}
+
+#ifdef ZT_HAVE_IO_URING
+// Returns false without having read anything if io_uring can't be used
+bool LinuxEthernetTap::_readQueueIoUring(int fd)
+	throw()
+{
+	LinuxIoUring *const ring = new LinuxIoUring();
+	const unsigned int bufSize = (_vnetHdr) ? ZT_LINUX_TAP_VNET_BUF_SIZE : (ZT_MAX_MTU + 64);
+	uint8_t *const bufs = new uint8_t[bufSize * ZT_LINUX_TAP_IO_URING_DEPTH];
+	struct iovec iov[ZT_LINUX_TAP_IO_URING_DEPTH];
+	for(unsigned int i=0;i<ZT_LINUX_TAP_IO_URING_DEPTH;++i) {
+		iov[i].iov_base = (void *)(bufs + (i * bufSize));
+		iov[i].iov_len = bufSize;
+	}
+	if ((!ring->init(ZT_LINUX_TAP_IO_URING_DEPTH * 2))||(!ring->registerBuffers(iov,ZT_LINUX_TAP_IO_URING_DEPTH))) {
+		delete ring;
+		delete [] bufs;
+		return false;
+	}
+
+	// Reads have user_data 1 through DEPTH, DEPTH+1 is the shutdown pipe, and 0 is a cancel
+	struct io_uring_sqe *sqe = ring->getSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = _shutdownSignalPipe[0];
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = ZT_LINUX_TAP_IO_URING_DEPTH + 1;
+	for(unsigned int i=0;i<ZT_LINUX_TAP_IO_URING_DEPTH;++i) {
+		sqe = ring->getSqe();
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)((uintptr_t)iov[i].iov_base);
+		sqe->len = bufSize;
+		sqe->buf_index = (uint16_t)i;
+		sqe->user_data = i + 1;
+	}
+	unsigned int inFlight = ZT_LINUX_TAP_IO_URING_DEPTH;
+
+	bool run = true;
+	while (run) {
+		const int r = ring->submit(1);
+		if ((r < 0)&&(r != -EINTR)&&(r != -EAGAIN)&&(r != -EBUSY))
+			break;
+		struct io_uring_cqe *cqe;
+		while ((cqe = ring->peekCqe())) {
+			const uint64_t id = cqe->user_data;
+			const int n = cqe->res;
+			ring->cqeSeen();
+			if ((id == 0)||(id > ZT_LINUX_TAP_IO_URING_DEPTH)) {
+				if (id) run = false; // writes to shutdown pipe terminate thread
+				continue;
+			}
+			--inFlight;
+			if ((n < 0)&&(n != -EINTR)&&(n != -EAGAIN)) {
+				run = false;
+				continue;
+			}
+			uint8_t *const b = bufs + ((id - 1) * bufSize);
+			if (_enabled) {
+				if (_vnetHdr) {
+					// With a virtio header every read returns exactly one (possibly super-sized) frame
+					if (n > (int)(sizeof(_VirtioNetHdr) + 14))
+						_deliverVnetFrame(b,(unsigned int)n);
+				} else if (n > 14) {
+					_deliverFrame(b,std::min((unsigned int)n,_mtu + 14));
+				}
+			}
+			if ((run)&&((sqe = ring->getSqe()))) {
+				sqe->opcode = IORING_OP_READ_FIXED;
+				sqe->fd = fd;
+				sqe->addr = (uint64_t)((uintptr_t)b);
+				sqe->len = bufSize;
+				sqe->buf_index = (uint16_t)(id - 1);
+				sqe->user_data = id;
+				++inFlight;
+			}
+		}
+	}
+
+	// The kernel writes straight into the registered buffers, so outstanding
+	// reads have to be cancelled and seen to finish before they can be freed.
+	for(unsigned int i=1;i<=ZT_LINUX_TAP_IO_URING_DEPTH;++i) {
+		if ((sqe = ring->getSqe())) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = i;
+			sqe->user_data = 0;
+		}
+	}
+	while (inFlight) {
+		const int r = ring->submit(1);
+		if ((r < 0)&&(r != -EINTR)&&(r != -EAGAIN)&&(r != -EBUSY))
+			return true; // can't tell when the reads end, so leave the buffers alone
+		struct io_uring_cqe *cqe;
+		while ((cqe = ring->peekCqe())) {
+			if ((cqe->user_data)&&(cqe->user_data <= ZT_LINUX_TAP_IO_URING_DEPTH))
+				--inFlight;
+			ring->cqeSeen();
+		}
+	}
+	delete ring;
+	delete [] bufs;
+	return true;
+}
+#endif
+
+void LinuxEthernetTap::_deliverVnetFrame(uint8_t *buf,unsigned int len)
+{
+	_VirtioNetHdr vh;
+	memcpy(&vh,buf,sizeof(vh));
+	uint8_t *const frame = buf + sizeof(vh);
+	const unsigned int flen = len - sizeof(vh);
+	const unsigned int gsoType = vh.gsoType & ~ZT_VIRTIO_NET_HDR_GSO_ECN;
+
+	if (gsoType == ZT_VIRTIO_NET_HDR_GSO_NONE) {
+		if ((vh.flags & ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM) != 0) {
+			// Checksum field already holds the pseudo-header sum, so just sum from csum_start to the end
+			const unsigned int cs = vh.csumStart;
+			const unsigned int co = cs + vh.csumOffset;
+			if ((cs >= flen)||((co + 2) > flen))
+				return;
+			_put16(frame + co,_csumFinish(_csumAdd(0,frame + cs,flen - cs)));
+		}
+		_deliverFrame(frame,flen);
+		return;
+	}
+
+	// Only TCP segmentation is advertised, and TSO frames always come with csum_start at the TCP header
+	if (((gsoType != ZT_VIRTIO_NET_HDR_GSO_TCPV4)&&(gsoType != ZT_VIRTIO_NET_HDR_GSO_TCPV6))||((vh.flags & ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM) == 0))
+		return;
+	const bool v4 = (gsoType == ZT_VIRTIO_NET_HDR_GSO_TCPV4);
+	const unsigned int l3 = 14;
+	const unsigned int l4 = vh.csumStart;
+	if ((flen <= l3)||(_isVlanTagged(frame))||((l3 + ((v4) ? 20 : 40)) > l4)||((l4 + 20) > flen))
+		return;
+	const unsigned int hlen = l4 + ((frame[l4 + 12] >> 4) * 4);
+	if ((hlen < (l4 + 20))||(hlen >= flen)||(hlen >= (_mtu + 14))||(!vh.gsoSize))
+		return;
+	// A guest may use an MSS bigger than our MTU allows, so cut to what fits
+	const unsigned int mss = std::min((unsigned int)vh.gsoSize,(_mtu + 14) - hlen);
+
+	const uint32_t seq = ((uint32_t)frame[l4 + 4] << 24) | ((uint32_t)frame[l4 + 5] << 16) | ((uint32_t)frame[l4 + 6] << 8) | (uint32_t)frame[l4 + 7];
+	const uint8_t tcpFlags = frame[l4 + 13];
+	const unsigned int ipId = ((unsigned int)frame[l3 + 4] << 8) | (unsigned int)frame[l3 + 5];
+	const unsigned int ipHdrLen = (frame[l3] & 0x0f) * 4;
+
+	uint8_t seg[ZT_MAX_MTU + 64];
+	for(unsigned int off=hlen,i=0;off<flen;off+=mss,++i) {
+		const unsigned int plen = std::min(mss,flen - off);
+		const unsigned int slen = hlen + plen;
+		memcpy(seg,frame,hlen);
+		memcpy(seg + hlen,frame + off,plen);
+		uint8_t *const ip = seg + l3;
+		uint8_t *const th = seg + l4;
+
+		const uint32_t sseq = seq + (off - hlen);
+		th[4] = (uint8_t)(sseq >> 24);
+		th[5] = (uint8_t)(sseq >> 16);
+		th[6] = (uint8_t)(sseq >> 8);
+		th[7] = (uint8_t)sseq;
+		uint8_t f = tcpFlags;
+		if ((off + plen) < flen)
+			f &= ~0x09; // FIN and PSH only on the last segment
+		if (i)
+			f &= ~0x80; // CWR only on the first
+		th[13] = f;
+
+		uint32_t sum;
+		if (v4) {
+			_put16(ip + 2,slen - l3);
+			_put16(ip + 4,ipId + i);
+			ip[10] = 0;
+			ip[11] = 0;
+			_put16(ip + 10,_csumFinish(_csumAdd(0,ip,ipHdrLen)));
+			sum = _csumAdd(0,ip + 12,8); // source and destination
+		} else {
+			_put16(ip + 4,slen - l3 - 40);
+			sum = _csumAdd(0,ip + 8,32);
+		}
+		sum += 6 + (slen - l4); // protocol and TCP length
+		th[16] = 0;
+		th[17] = 0;
+		_put16(th + 16,_csumFinish(_csumAdd(sum,th,slen - l4)));
+
+		_deliverFrame(seg,slen);
+	}
+}
+
+void LinuxEthernetTap::_deliverTunPacket(uint8_t *buf,unsigned int len)
+{
+	uint8_t *const frame = buf + sizeof(_VirtioNetHdr);
+	MAC to,queryDest;
+	unsigned int etherType = 0,queryLen = 0,queryEtherType = 0;
+	uint8_t query[ZT_TUNADAPTER_BUF_LENGTH];
+	const bool send = _tun->outbound(frame + 14,len - (sizeof(_VirtioNetHdr) + 14),to,etherType,query,queryLen,queryDest,queryEtherType);
+	if (queryLen)
+		_handler(_arg,(void *)0,_nwid,_mac,queryDest,queryEtherType,0,(const void *)query,queryLen);
+	if (!send)
+		return;
+
+	to.copyTo(frame,6);
+	_mac.copyTo(frame + 6,6);
+	_put16(frame + 12,etherType);
+
+	// Offsets in the virtio header are relative to the packet the kernel gave us
+	_VirtioNetHdr vh;
+	memcpy(&vh,buf,sizeof(vh));
+	if ((vh.flags & ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM) != 0) {
+		vh.csumStart += 14;
+		memcpy(buf,&vh,sizeof(vh));
+	}
+	_deliverVnetFrame(buf,len);
+}
+
+void LinuxEthernetTap::_sendL3Pending()
+{
+	std::vector<_L3Frame> pending;
+	{
+		Mutex::Lock _l(_l3Pending_m);
+		pending.swap(_l3Pending);
+	}
+	for(std::vector<_L3Frame>::const_iterator f(pending.begin());f!=pending.end();++f)
+		_handler(_arg,(void *)0,_nwid,_mac,f->to,f->etherType,0,(const void *)f->data,f->len);
+}
+
+void LinuxEthernetTap::_deliverFrame(const uint8_t *frame,unsigned int len)
+{
+	if ((len <= 14)||(len > (_mtu + 14)))
+		return;
+	const MAC to(frame,6);
+	const MAC from(frame + 6,6);
+	const unsigned int etherType = ((unsigned int)frame[12] << 8) | (unsigned int)frame[13];
+	if (_isVlanTagged(frame))
+		return; // virtual networks carry no 802.1Q tags, and stripping one would merge VLANs
+	_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(frame + 14),len - 14);
+}
+
+// Every LinuxTapGro, so a tap being deleted can be dropped from all of them
+static Mutex _groInstances_m;
+static std::vector<LinuxTapGro *> _groInstances;
+
+// Room ahead of the IP packet in each held flow for the virtio and Ethernet headers
+#define ZT_LINUX_TAP_GRO_HDR (sizeof(_VirtioNetHdr) + 14)
+
+LinuxTapGro::LinuxTapGro() :
+	_victim(0)
+{
+	for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i) {
+		_flows[i].tap = (LinuxEthernetTap *)0;
+		_flows[i].buf = new uint8_t[ZT_LINUX_TAP_GRO_HDR + ZT_LINUX_TAP_GRO_MAX_PACKET];
+	}
+	Mutex::Lock _l(_groInstances_m);
+	_groInstances.push_back(this);
+}
+
+LinuxTapGro::~LinuxTapGro()
+{
+	{
+		Mutex::Lock _l(_groInstances_m);
+		_groInstances.erase(std::remove(_groInstances.begin(),_groInstances.end(),this),_groInstances.end());
+	}
+	flush();
+	for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i)
+		delete [] _flows[i].buf;
+}
+
+bool LinuxTapGro::put(LinuxEthernetTap *tap,const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	if ((tap->_fd <= 0)||(tap->_tun)||(!tap->_vnetHdr)||(!tap->_enabled)||(len > tap->_mtu))
+		return false;
+
+	// Find the TCP header, leaving anything but TCP right behind an IPv4 or IPv6 header to put()
+	const uint8_t *const ip = reinterpret_cast<const uint8_t *>(data);
+	unsigned int l4,plen;
+	if (etherType == ZT_ETHERTYPE_IPV4) {
+		if ((len < 40)||(ip[0] != 0x45)||(ip[9] != 6)||((ip[6] & 0x3f) != 0)||(ip[7] != 0)) // no options or fragments
+			return false;
+		l4 = 20;
+		plen = ((unsigned int)ip[2] << 8) | (unsigned int)ip[3];
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		if ((len < 60)||((ip[0] >> 4) != 6)||(ip[6] != 6)) // no extension headers
+			return false;
+		l4 = 40;
+		plen = 40 + (((unsigned int)ip[4] << 8) | (unsigned int)ip[5]);
+	} else {
+		return false;
+	}
+	const uint8_t *const th = ip + l4;
+	const unsigned int hlen = l4 + ((th[12] >> 4) * 4);
+	if ((plen > len)||(hlen < (l4 + 20))||(hlen > plen))
+		return false;
+	const unsigned int payload = plen - hlen;
+	const uint8_t flags = th[13];
+	const uint32_t seq = ((uint32_t)th[4] << 24) | ((uint32_t)th[5] << 16) | ((uint32_t)th[6] << 8) | (uint32_t)th[7];
+	const unsigned int ao = (l4 == 20) ? 12 : 8; // addresses in the IP header
+	const unsigned int al = (l4 == 20) ? 8 : 32;
+
+	Mutex::Lock _l(_lock);
+
+	_Flow *f = (_Flow *)0;
+	for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i) {
+		_Flow &c = _flows[i];
+		if ((c.tap == tap)&&(c.etherType == etherType)&&(c.from == from)&&(c.to == to)) {
+			const uint8_t *const cip = c.buf + ZT_LINUX_TAP_GRO_HDR;
+			if ((memcmp(cip + ao,ip + ao,al) == 0)&&(memcmp(cip + l4,th,4) == 0)) {
+				f = &c;
+				break;
+			}
+		}
+	}
+
+	// Only segments with data and no flags but ACK and PSH are merged
+	if ((!payload)||((flags & ~0x08) != 0x10)) {
+		if (f)
+			_write(*f);
+		return false;
+	}
+
+	if (f) {
+		uint8_t *const cip = f->buf + ZT_LINUX_TAP_GRO_HDR;
+		uint8_t *const cth = cip + l4;
+		bool merge = ( (seq == f->nextSeq) &&
+		               (hlen == f->hlen) &&
+		               (payload <= f->mss) &&
+		               ((f->len + payload) <= ZT_LINUX_TAP_GRO_MAX_PACKET) &&
+		               (memcmp(cth + 8,th + 8,4) == 0) && // ACK
+		               (memcmp(cth + 20,th + 20,hlen - (l4 + 20)) == 0) ); // options, including timestamps
+		if (merge) {
+			if (l4 == 20)
+				merge = ((cip[1] == ip[1])&&(cip[8] == ip[8])&&((cip[6] & 0x40) == (ip[6] & 0x40))); // TOS, TTL and DF
+			else merge = ((memcmp(cip,ip,4) == 0)&&(cip[7] == ip[7])); // traffic class, flow label and hop limit
+		}
+		if (merge) {
+			memcpy(cip + f->len,ip + hlen,payload);
+			f->len += payload;
+			f->nextSeq += payload;
+			++f->segments;
+			cth[13] |= flags & 0x08;
+			cth[14] = th[14]; // the latest window
+			cth[15] = th[15];
+			if ((payload < f->mss)||((flags & 0x08) != 0)||((f->len + f->mss) > ZT_LINUX_TAP_GRO_MAX_PACKET))
+				_write(*f);
+			return true;
+		}
+		_write(*f);
+	}
+
+	// A PSH segment that starts a flow has nothing to wait for
+	if ((flags & 0x08) != 0)
+		return false;
+
+	if (!f) {
+		for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i) {
+			if (!_flows[i].tap) {
+				f = &(_flows[i]);
+				break;
+			}
+		}
+		if (!f) {
+			f = &(_flows[_victim]);
+			_victim = (_victim + 1) % ZT_LINUX_TAP_GRO_FLOWS;
+			_write(*f);
+		}
+	}
+	f->tap = tap;
+	f->from = from;
+	f->to = to;
+	f->etherType = etherType;
+	f->l4 = l4;
+	f->hlen = hlen;
+	f->mss = payload;
+	f->len = plen;
+	f->segments = 1;
+	f->nextSeq = seq + payload;
+	memcpy(f->buf + ZT_LINUX_TAP_GRO_HDR,ip,plen);
+	return true;
+}
+
+void LinuxTapGro::flush()
+{
+	Mutex::Lock _l(_lock);
+	for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i)
+		_write(_flows[i]);
+}
+
+void LinuxTapGro::forget(LinuxEthernetTap *tap)
+{
+	Mutex::Lock _l(_groInstances_m);
+	for(std::vector<LinuxTapGro *>::const_iterator g(_groInstances.begin());g!=_groInstances.end();++g) {
+		Mutex::Lock _l2((*g)->_lock);
+		for(unsigned int i=0;i<ZT_LINUX_TAP_GRO_FLOWS;++i) {
+			if ((*g)->_flows[i].tap == tap)
+				(*g)->_flows[i].tap = (LinuxEthernetTap *)0;
+		}
+	}
+}
+
+void LinuxTapGro::_write(_Flow &f)
+{
+	LinuxEthernetTap *const tap = f.tap;
+	if (!tap)
+		return;
+	f.tap = (LinuxEthernetTap *)0;
+
+	uint8_t *const eh = f.buf + sizeof(_VirtioNetHdr);
+	uint8_t *const ip = eh + 14;
+	_VirtioNetHdr vh;
+	memset(&vh,0,sizeof(vh));
+	if (f.segments == 1) {
+		// Frames arrive authenticated, so the kernel needn't verify their checksums again
+		vh.flags = ZT_VIRTIO_NET_HDR_F_DATA_VALID;
+	} else {
+		// The TCP checksum field gets the pseudo-header sum, and whoever
+		// segments or receives the super-frame finishes it
+		uint32_t sum;
+		if (f.l4 == 20) {
+			_put16(ip + 2,f.len);
+			ip[10] = 0;
+			ip[11] = 0;
+			_put16(ip + 10,_csumFinish(_csumAdd(0,ip,20)));
+			sum = _csumAdd(0,ip + 12,8);
+			vh.gsoType = ZT_VIRTIO_NET_HDR_GSO_TCPV4;
+		} else {
+			_put16(ip + 4,f.len - 40);
+			sum = _csumAdd(0,ip + 8,32);
+			vh.gsoType = ZT_VIRTIO_NET_HDR_GSO_TCPV6;
+		}
+		sum += 6 + (f.len - f.l4); // protocol and TCP length
+		_put16(ip + f.l4 + 16,(uint16_t)~_csumFinish(sum));
+		vh.flags = ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		vh.hdrLen = (uint16_t)(14 + f.hlen);
+		vh.gsoSize = (uint16_t)f.mss;
+		vh.csumStart = (uint16_t)(14 + f.l4);
+		vh.csumOffset = 16;
+	}
+	memcpy(f.buf,&vh,sizeof(vh));
+	f.to.copyTo(eh,6);
+	f.from.copyTo(eh + 6,6);
+	_put16(eh + 12,f.etherType);
+	(void)::write(tap->_fd,f.buf,ZT_LINUX_TAP_GRO_HDR + f.len);
 }
 
 } // namespace ZeroTier
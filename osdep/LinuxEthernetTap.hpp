@@ -35,15 +35,60 @@
 #include <stdexcept>
 
 #include "../node/MulticastGroup.hpp"
+#include "../node/Mutex.hpp"
 #include "Thread.hpp"
+#include "LinuxIoUring.hpp"
+#include "TunAdapter.hpp"
+
+// Maximum number of tap queues (each gets its own reader thread)
+#define ZT_LINUX_TAP_MAX_QUEUES 64
+
+// Read buffer size with offloads on: a 64KiB TSO super-frame plus Ethernet and virtio headers
+#define ZT_LINUX_TAP_VNET_BUF_SIZE 65664
+
+// Reads each queue keeps outstanding when reading through io_uring
+#define ZT_LINUX_TAP_IO_URING_DEPTH 8
+
+// Maximum ARP and NDP replies waiting to be sent to the network in L3 mode
+#define ZT_LINUX_TAP_L3_MAX_PENDING 256
+
+// TCP flows each LinuxTapGro coalesces at once
+#define ZT_LINUX_TAP_GRO_FLOWS 8
+
+// Largest IP packet LinuxTapGro builds (IPv4's total length is 16 bits)
+#define ZT_LINUX_TAP_GRO_MAX_PACKET 65535
 
 namespace ZeroTier {
 
 /**
  * Linux Ethernet tap using kernel tun/tap driver
+ *
+ * If more than one queue is requested the device is opened with
+ * IFF_MULTI_QUEUE and each queue gets its own reader thread, so frames
+ * from different flows reach the handler in parallel. If the kernel doesn't
+ * support multiqueue taps this falls back to a single queue.
+ *
+ * The device is also opened with a virtio net header (IFF_VNET_HDR) and
+ * advertises checksum and TCP segmentation offload. The kernel then hands us
+ * TCP super-frames of up to 64KiB in one read, with checksums left undone. We
+ * segment those into MTU-sized frames and finish checksums once here before
+ * passing frames on, instead of the kernel doing it per frame.
+ *
+ * With ioUring set (and kernel support), each reader thread keeps several
+ * reads into registered buffers outstanding on an io_uring instead of doing
+ * select() and read() per frame, so one system call collects and re-issues
+ * a whole batch of frames.
+ *
+ * With l3 set the device is a TUN device that exchanges bare IP packets with
+ * the kernel. Ethernet headers are added and removed here and ARP and NDP
+ * are handled by a TunAdapter, so the host does no neighbor discovery of
+ * its own. Reads in this mode use select() and readv() even if ioUring is
+ * set, since the header is built in front of the packet in place.
  */
 class LinuxEthernetTap
 {
+	friend class LinuxTapGro;
+
 public:
 	LinuxEthernetTap(
 		const char *homePath,
@@ -53,7 +98,10 @@ public:
 		uint64_t nwid,
 		const char *friendlyName,
 		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
-		void *arg);
+		void *arg,
+		unsigned int queues = 1,
+		bool ioUring = false,
+		bool l3 = false);
 
 	~LinuxEthernetTap();
 
@@ -71,21 +119,133 @@ public:
 	void scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed);
 	void setMtu(unsigned int mtu);
 
-	void threadMain()
-		throw();
+	/**
+	 * Set routes used to find gateways for off-link destinations in L3 mode
+	 *
+	 * @param routes Managed routes
+	 * @param count Number of routes
+	 */
+	void setL3Routes(const ZT_VirtualNetworkRoute *routes,unsigned int count);
 
 private:
+	struct _Queue
+	{
+		LinuxEthernetTap *tap;
+		int fd;
+		Thread thread;
+
+		void threadMain()
+			throw();
+	};
+
+	void _readQueue(int fd)
+		throw();
+#ifdef ZT_HAVE_IO_URING
+	bool _readQueueIoUring(int fd)
+		throw();
+#endif
+	void _deliverVnetFrame(uint8_t *buf,unsigned int len);
+	void _deliverTunPacket(uint8_t *buf,unsigned int len);
+	void _sendL3Pending();
+	void _deliverFrame(const uint8_t *frame,unsigned int len);
+
 	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
-	Thread _thread;
+	std::vector<_Queue> _queues; // [0] is _fd
 	std::string _homePath;
 	std::string _dev;
 	std::vector<MulticastGroup> _multicastGroups;
+	MAC _mac;
 	unsigned int _mtu;
 	int _fd;
 	int _shutdownSignalPipe[2];
+	bool _vnetHdr;
+	bool _ioUring;
 	volatile bool _enabled;
+
+	// L3 mode: replies generated in put() go out from the first reader thread
+	struct _L3Frame
+	{
+		MAC to;
+		unsigned int etherType;
+		unsigned int len;
+		uint8_t data[ZT_TUNADAPTER_BUF_LENGTH];
+	};
+	TunAdapter *_tun;
+	std::vector<_L3Frame> _l3Pending;
+	Mutex _l3Pending_m;
+	int _l3WakePipe[2];
+};
+
+/**
+ * Receive-side coalescing of TCP segments written to Linux taps
+ *
+ * Without this each frame from the network is its own write to the tap, so
+ * a fast TCP stream costs a system call and a trip up the host's stack for
+ * every segment. A thread delivering frames can hand them to one of these
+ * instead, which merges consecutive in-order segments of a flow into one
+ * super-frame and writes that with a virtio GSO header, as the kernel's own
+ * GRO would for a physical NIC. The host stack takes the super-frame whole,
+ * or segments it again if it's forwarded.
+ *
+ * Only segments carrying data with no flags but ACK and PSH are merged, and
+ * only while their sequence numbers, ACKs and TCP options line up. Anything
+ * else is left to put(), after whatever is held for its flow has been
+ * written so the flow isn't reordered. A flow is written out when a short
+ * or PSH segment ends it, when it reaches 64KiB, and at flush().
+ *
+ * Each thread that delivers frames has its own instance and calls flush()
+ * at the end of each batch of packets it receives, so frames wait no longer
+ * than that. A tap being deleted drops anything held for it in every
+ * instance. TAP mode only; L3 mode taps are always left to put().
+ */
+class LinuxTapGro
+{
+public:
+	LinuxTapGro();
+	~LinuxTapGro();
+
+	/**
+	 * Merge a frame or write it, or leave it to the caller
+	 *
+	 * @return True if the frame was taken, false if the caller should put() it
+	 */
+	bool put(LinuxEthernetTap *tap,const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+
+	/**
+	 * Write out every flow being held
+	 */
+	void flush();
+
+	/**
+	 * Drop anything held for a tap in all instances, before it's deleted
+	 *
+	 * @param tap Tap being deleted
+	 */
+	static void forget(LinuxEthernetTap *tap);
+
+private:
+	struct _Flow
+	{
+		LinuxEthernetTap *tap;  // or NULL if this slot is free
+		MAC from;
+		MAC to;
+		unsigned int etherType;
+		unsigned int l4;        // offset of TCP header in the IP packet
+		unsigned int hlen;      // IP plus TCP header length
+		unsigned int mss;       // payload of the first segment, which all but the last must match
+		unsigned int len;       // IP packet length so far
+		unsigned int segments;
+		uint32_t nextSeq;
+		uint8_t *buf;           // virtio header, Ethernet header, then the IP packet
+	};
+
+	void _write(_Flow &f);
+
+	_Flow _flows[ZT_LINUX_TAP_GRO_FLOWS];
+	unsigned int _victim; // next slot to write out if all are in use
+	Mutex _lock;          // only contended by forget()
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,324 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_LINUXIOURING_HPP
+#define ZT_LINUXIOURING_HPP
+
+// Built with -DZT_USE_IO_URING when the kernel headers have io_uring. The
+// wrapper is only available (ZT_HAVE_IO_URING) if they are new enough for
+// multishot receive (Linux 6.0).
+#ifdef ZT_USE_IO_URING
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "../node/NonCopyable.hpp"
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define ZT_HAVE_IO_URING 1
+#endif
+
+#endif // ZT_USE_IO_URING
+
+#ifdef ZT_HAVE_IO_URING
+
+namespace ZeroTier {
+
+/**
+ * Minimal io_uring submission and completion ring
+ *
+ * This talks to the kernel with the raw system calls rather than pulling in
+ * liburing. It covers what Phy<> and LinuxEthernetTap need: getting and
+ * submitting SQEs, reaping CQEs, registered (fixed) buffers, and one group of
+ * provided buffers for multishot receives.
+ *
+ * SQEs obtained with getSqe() are not seen by the kernel until submit(). A
+ * ring is used by one thread at a time; nothing here is locked.
+ */
+class LinuxIoUring : NonCopyable
+{
+public:
+	LinuxIoUring() :
+		_fd(-1),
+		_sqRing(MAP_FAILED),
+		_cqRing(MAP_FAILED),
+		_sqes((struct io_uring_sqe *)MAP_FAILED),
+		_sqRingSize(0),
+		_cqRingSize(0),
+		_sqesSize(0),
+		_toSubmit(0),
+		_bufs((char *)0),
+		_bufSize(0),
+		_bufGroup(0) {}
+
+	~LinuxIoUring()
+	{
+		if (_fd >= 0)
+			::close(_fd); // cancels anything still in flight
+		delete [] _bufs;
+		if (_sqes != (struct io_uring_sqe *)MAP_FAILED)
+			::munmap((void *)_sqes,_sqesSize);
+		if ((_cqRing != MAP_FAILED)&&(_cqRing != _sqRing))
+			::munmap(_cqRing,_cqRingSize);
+		if (_sqRing != MAP_FAILED)
+			::munmap(_sqRing,_sqRingSize);
+	}
+
+	/**
+	 * Create the ring
+	 *
+	 * @param entries Submission queue size (rounded up to a power of two by the kernel)
+	 * @param cqEntries Completion queue size or 0 for the default of twice entries
+	 * @return True on success, false if io_uring is unavailable or not permitted
+	 */
+	inline bool init(const unsigned int entries,const unsigned int cqEntries = 0)
+	{
+		struct io_uring_params p;
+		memset(&p,0,sizeof(p));
+		if (cqEntries) {
+			p.flags = IORING_SETUP_CQSIZE;
+			p.cq_entries = cqEntries;
+		}
+		_fd = (int)::syscall(__NR_io_uring_setup,entries,&p);
+		if (_fd < 0)
+			return false;
+
+		_sqRingSize = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+		_cqRingSize = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+		const bool single = ((p.features & IORING_FEAT_SINGLE_MMAP) != 0);
+		if ((single)&&(_cqRingSize > _sqRingSize))
+			_sqRingSize = _cqRingSize;
+		_sqRing = ::mmap((void *)0,_sqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_SQ_RING);
+		if (_sqRing == MAP_FAILED)
+			return false;
+		if (single) {
+			_cqRing = _sqRing;
+		} else {
+			_cqRing = ::mmap((void *)0,_cqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_CQ_RING);
+			if (_cqRing == MAP_FAILED)
+				return false;
+		}
+		_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+		_sqes = (struct io_uring_sqe *)::mmap((void *)0,_sqesSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_SQES);
+		if (_sqes == (struct io_uring_sqe *)MAP_FAILED)
+			return false;
+
+		char *const sq = reinterpret_cast<char *>(_sqRing);
+		_sqHead = reinterpret_cast<unsigned int *>(sq + p.sq_off.head);
+		_sqTail = reinterpret_cast<unsigned int *>(sq + p.sq_off.tail);
+		_sqMask = *reinterpret_cast<unsigned int *>(sq + p.sq_off.ring_mask);
+		_sqEntries = p.sq_entries;
+		_sqArray = reinterpret_cast<unsigned int *>(sq + p.sq_off.array);
+		_sqLocalTail = *_sqTail;
+
+		char *const cq = reinterpret_cast<char *>(_cqRing);
+		_cqHead = reinterpret_cast<unsigned int *>(cq + p.cq_off.head);
+		_cqTail = reinterpret_cast<unsigned int *>(cq + p.cq_off.tail);
+		_cqMask = *reinterpret_cast<unsigned int *>(cq + p.cq_off.ring_mask);
+		_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+		return true;
+	}
+
+	/**
+	 * @return Ring descriptor (becomes readable with poll/epoll when completions are waiting)
+	 */
+	inline int fd() const { return _fd; }
+
+	/**
+	 * Get a zeroed SQE to fill in, submitting what is queued first if the queue is full
+	 *
+	 * @return SQE or NULL if the queue is still full
+	 */
+	inline struct io_uring_sqe *getSqe()
+	{
+		if ((_sqLocalTail - __atomic_load_n(_sqHead,__ATOMIC_ACQUIRE)) >= _sqEntries) {
+			submit(0);
+			if ((_sqLocalTail - __atomic_load_n(_sqHead,__ATOMIC_ACQUIRE)) >= _sqEntries)
+				return (struct io_uring_sqe *)0;
+		}
+		const unsigned int i = _sqLocalTail & _sqMask;
+		struct io_uring_sqe *const sqe = &(_sqes[i]);
+		memset(sqe,0,sizeof(struct io_uring_sqe));
+		_sqArray[i] = i;
+		++_sqLocalTail;
+		++_toSubmit;
+		return sqe;
+	}
+
+	/**
+	 * Hand queued SQEs to the kernel and optionally wait for completions
+	 *
+	 * @param waitFor Block until at least this many completions are available (0 to not wait)
+	 * @return Number of SQEs consumed or negative errno (-EINTR if interrupted while waiting)
+	 */
+	inline int submit(const unsigned int waitFor)
+	{
+		if ((!_toSubmit)&&(!waitFor))
+			return 0;
+		__atomic_store_n(_sqTail,_sqLocalTail,__ATOMIC_RELEASE);
+		const int r = (int)::syscall(__NR_io_uring_enter,_fd,_toSubmit,waitFor,(waitFor) ? IORING_ENTER_GETEVENTS : 0,(void *)0,(size_t)0);
+		if (r < 0)
+			return -errno;
+		_toSubmit -= ((unsigned int)r < _toSubmit) ? (unsigned int)r : _toSubmit;
+		return r;
+	}
+
+	/**
+	 * @return Oldest unconsumed completion or NULL if there are none
+	 */
+	inline struct io_uring_cqe *peekCqe()
+	{
+		const unsigned int h = *_cqHead;
+		if (h == __atomic_load_n(_cqTail,__ATOMIC_ACQUIRE))
+			return (struct io_uring_cqe *)0;
+		return &(_cqes[h & _cqMask]);
+	}
+
+	/**
+	 * Release the completion returned by peekCqe() back to the kernel
+	 */
+	inline void cqeSeen()
+	{
+		__atomic_store_n(_cqHead,*_cqHead + 1,__ATOMIC_RELEASE);
+	}
+
+	/**
+	 * Register fixed buffers for IORING_OP_READ_FIXED / WRITE_FIXED
+	 *
+	 * @param iov Buffers, indexed by sqe->buf_index
+	 * @param count Number of buffers
+	 * @return True on success
+	 */
+	inline bool registerBuffers(const struct iovec *iov,const unsigned int count)
+	{
+		return (::syscall(__NR_io_uring_register,_fd,IORING_REGISTER_BUFFERS,iov,count) == 0);
+	}
+
+	/**
+	 * Allocate a group of provided buffers for IOSQE_BUFFER_SELECT
+	 *
+	 * This waits for the kernel to accept them, and so should be called
+	 * before anything else is submitted.
+	 *
+	 * @param group Buffer group ID to use in sqe->buf_group
+	 * @param count Number of buffers (at most 65536)
+	 * @param size Size of each buffer in bytes
+	 * @return True on success
+	 */
+	inline bool provideBuffers(const uint16_t group,const unsigned int count,const unsigned int size)
+	{
+		try {
+			_bufs = new char[(unsigned long)count * (unsigned long)size];
+		} catch ( ... ) {
+			return false;
+		}
+		_bufGroup = group;
+		_bufSize = size;
+		struct io_uring_sqe *const sqe = getSqe();
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+		sqe->fd = (int)count;
+		sqe->addr = (uint64_t)((uintptr_t)_bufs);
+		sqe->len = size;
+		sqe->buf_group = group;
+		if (submit(1) < 0)
+			return false;
+		struct io_uring_cqe *const cqe = peekCqe();
+		if (!cqe)
+			return false;
+		const bool ok = (cqe->res >= 0);
+		cqeSeen();
+		return ok;
+	}
+
+	/**
+	 * @return Size of each provided buffer
+	 */
+	inline unsigned int bufferSize() const { return _bufSize; }
+
+	/**
+	 * @param cqe Completion with IORING_CQE_F_BUFFER set
+	 * @return Provided buffer the kernel filled for this completion
+	 */
+	inline char *buffer(const struct io_uring_cqe *cqe) const { return _bufs + ((unsigned long)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * (unsigned long)_bufSize); }
+
+	/**
+	 * Give a provided buffer back to the kernel once its contents have been used
+	 *
+	 * This queues an SQE, which goes in with the next submit() and only
+	 * produces a completion if it fails.
+	 *
+	 * @param cqe Completion with IORING_CQE_F_BUFFER set
+	 * @return False if no SQE was available (buffer is lost to the kernel)
+	 */
+	inline bool recycleBuffer(const struct io_uring_cqe *cqe)
+	{
+		const unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		struct io_uring_sqe *const sqe = getSqe();
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+		sqe->fd = 1;
+		sqe->addr = (uint64_t)((uintptr_t)(_bufs + ((unsigned long)bid * (unsigned long)_bufSize)));
+		sqe->len = _bufSize;
+		sqe->off = bid;
+		sqe->buf_group = _bufGroup;
+		return true;
+	}
+
+private:
+	int _fd;
+	void *_sqRing;
+	void *_cqRing;
+	struct io_uring_sqe *_sqes;
+	size_t _sqRingSize,_cqRingSize,_sqesSize;
+
+	unsigned int *_sqHead,*_sqTail,*_sqArray;
+	unsigned int _sqMask,_sqEntries,_sqLocalTail,_toSubmit;
+	unsigned int *_cqHead,*_cqTail;
+	unsigned int _cqMask;
+	struct io_uring_cqe *_cqes;
+
+	char *_bufs;
+	unsigned int _bufSize;
+	uint16_t _bufGroup;
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_IO_URING
+
+#endif
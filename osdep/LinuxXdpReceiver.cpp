@@ -0,0 +1,467 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include "LinuxXdpReceiver.hpp"
+
+#ifdef ZT_HAVE_AF_XDP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+
+#include <string>
+#include <algorithm>
+
+#include "../node/Utils.hpp"
+#include "OSUtils.hpp"
+#include "CpuAffinity.hpp"
+
+namespace ZeroTier {
+
+static inline int _bpf(const int cmd,union bpf_attr *attr)
+{
+	return (int)::syscall(__NR_bpf,cmd,attr,sizeof(union bpf_attr));
+}
+
+static inline struct bpf_insn _bpfInsn(const uint8_t code,const uint8_t dst,const uint8_t src,const int16_t off,const int32_t imm)
+{
+	struct bpf_insn i;
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+}
+
+// BPF loads are in host byte order, so header fields are compared against network order values read the same way
+static inline int32_t _bpfNet16(const unsigned int v) { return (int32_t)Utils::hton((uint16_t)v); }
+
+LinuxXdpReceiver::LinuxXdpReceiver(
+	const char *dev,
+	const unsigned int *ports,
+	unsigned int portCount,
+	void (*handler)(void *,const LinuxXdpPacket *,unsigned int),
+	void *arg) :
+	_handler(handler),
+	_arg(arg),
+	_dev(dev),
+	_ifindex(0),
+	_mapFd(-1),
+	_progFd(-1),
+	_linkFd(-1)
+{
+	if (::pipe(_shutdownSignalPipe))
+		throw std::runtime_error("pipe() failed");
+
+	try {
+		_ifindex = if_nametoindex(dev);
+		if (!_ifindex)
+			throw std::runtime_error("no such device");
+		if (!portCount)
+			throw std::runtime_error("no ports");
+
+		unsigned int queueCount = 0;
+		std::vector<std::string> qs(OSUtils::listDirectory((std::string("/sys/class/net/") + _dev + "/queues").c_str(),true));
+		for(std::vector<std::string>::const_iterator qn(qs.begin());qn!=qs.end();++qn) {
+			if (qn->substr(0,3) == "rx-")
+				++queueCount;
+		}
+		queueCount = std::max(std::min(queueCount,(unsigned int)ZT_LINUX_XDP_MAX_QUEUES),1U);
+
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.map_type = BPF_MAP_TYPE_XSKMAP;
+		a.key_size = sizeof(uint32_t);
+		a.value_size = sizeof(uint32_t);
+		a.max_entries = queueCount;
+		_mapFd = _bpf(BPF_MAP_CREATE,&a);
+		if (_mapFd < 0)
+			throw std::runtime_error(std::string("cannot create XSKMAP: ") + strerror(errno));
+
+		// Sockets go in first, so nothing is steered to a queue without one
+		_queues.resize(queueCount);
+		for(unsigned int i=0;i<queueCount;++i) {
+			_Queue &q = _queues[i];
+			q.parent = this;
+			q.id = i;
+			q.fd = -1;
+			q.umem = MAP_FAILED;
+			q.fill.map = q.completion.map = q.rx.map = MAP_FAILED;
+		}
+		for(unsigned int i=0;i<queueCount;++i)
+			_openQueue(_queues[i]);
+
+		_progFd = _loadProgram(ports,portCount);
+
+		memset(&a,0,sizeof(a));
+		a.link_create.prog_fd = (uint32_t)_progFd;
+		a.link_create.target_ifindex = _ifindex;
+		a.link_create.attach_type = BPF_XDP;
+		_linkFd = _bpf(BPF_LINK_CREATE,&a);
+		if (_linkFd < 0)
+			throw std::runtime_error(std::string("cannot attach XDP program: ") + strerror(errno));
+	} catch ( ... ) {
+		_cleanup();
+		throw;
+	}
+
+	for(std::vector<_Queue>::iterator q(_queues.begin());q!=_queues.end();++q)
+		q->thread = Thread::start(&(*q));
+}
+
+LinuxXdpReceiver::~LinuxXdpReceiver()
+{
+	::close(_linkFd); // detaches the program, after which the kernel gets these packets again
+	_linkFd = -1;
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes threads to exit
+	for(std::vector<_Queue>::iterator q(_queues.begin());q!=_queues.end();++q)
+		Thread::join(q->thread);
+	_cleanup();
+}
+
+static void _mapRing(const int fd,const struct xdp_ring_offset &off,const unsigned int entries,const size_t descSize,const off_t pgoff,void *&map,size_t &mapSize,uint32_t *&producer,uint32_t *&consumer,uint32_t *&flags,void *&descs)
+{
+	mapSize = (size_t)off.desc + ((size_t)entries * descSize);
+	map = ::mmap((void *)0,mapSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,pgoff);
+	if (map == MAP_FAILED)
+		throw std::runtime_error(std::string("cannot map AF_XDP ring: ") + strerror(errno));
+	char *const m = reinterpret_cast<char *>(map);
+	producer = reinterpret_cast<uint32_t *>(m + off.producer);
+	consumer = reinterpret_cast<uint32_t *>(m + off.consumer);
+	flags = reinterpret_cast<uint32_t *>(m + off.flags);
+	descs = reinterpret_cast<void *>(m + off.desc);
+}
+
+void LinuxXdpReceiver::_openQueue(_Queue &q)
+{
+	q.fd = ::socket(AF_XDP,SOCK_RAW,0);
+	if (q.fd < 0)
+		throw std::runtime_error(std::string("cannot open AF_XDP socket: ") + strerror(errno));
+
+	const size_t umemSize = (size_t)ZT_LINUX_XDP_FRAMES * (size_t)ZT_LINUX_XDP_FRAME_SIZE;
+	q.umem = ::mmap((void *)0,umemSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,-1,0);
+	if (q.umem == MAP_FAILED)
+		throw std::runtime_error("cannot allocate UMEM");
+	struct xdp_umem_reg mr;
+	memset(&mr,0,sizeof(mr));
+	mr.addr = (uint64_t)((uintptr_t)q.umem);
+	mr.len = (uint64_t)umemSize;
+	mr.chunk_size = ZT_LINUX_XDP_FRAME_SIZE;
+	if (::setsockopt(q.fd,SOL_XDP,XDP_UMEM_REG,&mr,sizeof(mr)) != 0)
+		throw std::runtime_error(std::string("cannot register UMEM: ") + strerror(errno));
+
+	// The fill ring can hold every frame, so returning frames never has to wait
+	int n = ZT_LINUX_XDP_FRAMES;
+	if ((::setsockopt(q.fd,SOL_XDP,XDP_UMEM_FILL_RING,&n,sizeof(n)) != 0)||(::setsockopt(q.fd,SOL_XDP,XDP_RX_RING,&n,sizeof(n)) != 0))
+		throw std::runtime_error(std::string("cannot size AF_XDP rings: ") + strerror(errno));
+	n = 64; // required, but unused since nothing is sent
+	if (::setsockopt(q.fd,SOL_XDP,XDP_UMEM_COMPLETION_RING,&n,sizeof(n)) != 0)
+		throw std::runtime_error(std::string("cannot size AF_XDP rings: ") + strerror(errno));
+
+	struct xdp_mmap_offsets off;
+	socklen_t offLen = sizeof(off);
+	if (::getsockopt(q.fd,SOL_XDP,XDP_MMAP_OFFSETS,&off,&offLen) != 0)
+		throw std::runtime_error(std::string("cannot get AF_XDP ring offsets: ") + strerror(errno));
+	_mapRing(q.fd,off.fr,ZT_LINUX_XDP_FRAMES,sizeof(uint64_t),XDP_UMEM_PGOFF_FILL_RING,q.fill.map,q.fill.mapSize,q.fill.producer,q.fill.consumer,q.fill.flags,q.fill.descs);
+	_mapRing(q.fd,off.cr,64,sizeof(uint64_t),XDP_UMEM_PGOFF_COMPLETION_RING,q.completion.map,q.completion.mapSize,q.completion.producer,q.completion.consumer,q.completion.flags,q.completion.descs);
+	_mapRing(q.fd,off.rx,ZT_LINUX_XDP_FRAMES,sizeof(struct xdp_desc),XDP_PGOFF_RX_RING,q.rx.map,q.rx.mapSize,q.rx.producer,q.rx.consumer,q.rx.flags,q.rx.descs);
+
+	uint64_t *const fill = reinterpret_cast<uint64_t *>(q.fill.descs);
+	for(unsigned int i=0;i<ZT_LINUX_XDP_FRAMES;++i)
+		fill[i] = (uint64_t)i * (uint64_t)ZT_LINUX_XDP_FRAME_SIZE;
+	__atomic_store_n(q.fill.producer,(uint32_t)ZT_LINUX_XDP_FRAMES,__ATOMIC_RELEASE);
+
+	// Zero-copy is used if the driver supports it, otherwise the kernel copies
+	struct sockaddr_xdp sxdp;
+	memset(&sxdp,0,sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	sxdp.sxdp_ifindex = _ifindex;
+	sxdp.sxdp_queue_id = q.id;
+	if (::bind(q.fd,(const struct sockaddr *)&sxdp,sizeof(sxdp)) != 0)
+		throw std::runtime_error(std::string("cannot bind AF_XDP socket: ") + strerror(errno));
+
+	union bpf_attr a;
+	memset(&a,0,sizeof(a));
+	uint32_t key = q.id;
+	uint32_t value = (uint32_t)q.fd;
+	a.map_fd = (uint32_t)_mapFd;
+	a.key = (uint64_t)((uintptr_t)&key);
+	a.value = (uint64_t)((uintptr_t)&value);
+	if (_bpf(BPF_MAP_UPDATE_ELEM,&a) != 0)
+		throw std::runtime_error(std::string("cannot add AF_XDP socket to XSKMAP: ") + strerror(errno));
+}
+
+void LinuxXdpReceiver::_closeQueue(_Queue &q)
+{
+	if (q.rx.map != MAP_FAILED)
+		::munmap(q.rx.map,q.rx.mapSize);
+	if (q.completion.map != MAP_FAILED)
+		::munmap(q.completion.map,q.completion.mapSize);
+	if (q.fill.map != MAP_FAILED)
+		::munmap(q.fill.map,q.fill.mapSize);
+	if (q.fd >= 0)
+		::close(q.fd);
+	if (q.umem != MAP_FAILED)
+		::munmap(q.umem,(size_t)ZT_LINUX_XDP_FRAMES * (size_t)ZT_LINUX_XDP_FRAME_SIZE);
+	q.rx.map = q.completion.map = q.fill.map = MAP_FAILED;
+	q.fd = -1;
+	q.umem = MAP_FAILED;
+}
+
+int LinuxXdpReceiver::_loadProgram(const unsigned int *ports,unsigned int portCount)
+{
+	// r6 = ctx, r2 = data, r3 = data_end, r5 = header field being checked
+	std::vector<struct bpf_insn> p;
+	std::vector<unsigned int> toPass,toRedirect;
+
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_MOV|BPF_X,6,1,0,0));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_W,2,6,(int16_t)offsetof(struct xdp_md,data),0));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_W,3,6,(int16_t)offsetof(struct xdp_md,data_end),0));
+
+	// IPv4: Ethernet (14) + IP without options (20) + UDP (8), not a fragment
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_MOV|BPF_X,4,2,0,0));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_ADD|BPF_K,4,0,0,14 + 20 + 8));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JGT|BPF_X,4,3,0,0));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_H,5,2,12,0));
+	const unsigned int toV6 = (unsigned int)p.size();
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JEQ|BPF_K,5,0,0,_bpfNet16(0x86dd)));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JNE|BPF_K,5,0,0,_bpfNet16(0x0800)));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_B,5,2,14,0));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JNE|BPF_K,5,0,0,0x45));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_B,5,2,14 + 9,0));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JNE|BPF_K,5,0,0,17));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_H,5,2,14 + 6,0));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_AND|BPF_K,5,0,0,_bpfNet16(0x3fff))); // MF flag and fragment offset
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JNE|BPF_K,5,0,0,0));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_H,5,2,14 + 20 + 2,0));
+	const unsigned int toPorts = (unsigned int)p.size();
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JA,0,0,0,0));
+
+	// IPv6: Ethernet (14) + IPv6 (40) + UDP (8), next header UDP (so no extension headers)
+	p[toV6].off = (int16_t)(p.size() - (toV6 + 1));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_MOV|BPF_X,4,2,0,0));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_ADD|BPF_K,4,0,0,14 + 40 + 8));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JGT|BPF_X,4,3,0,0));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_B,5,2,14 + 6,0));
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JNE|BPF_K,5,0,0,17));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_H,5,2,14 + 40 + 2,0));
+
+	// Destination port
+	p[toPorts].off = (int16_t)(p.size() - (toPorts + 1));
+	for(unsigned int i=0;i<portCount;++i) {
+		toRedirect.push_back((unsigned int)p.size());
+		p.push_back(_bpfInsn(BPF_JMP|BPF_JEQ|BPF_K,5,0,0,_bpfNet16(ports[i])));
+	}
+	toPass.push_back((unsigned int)p.size());
+	p.push_back(_bpfInsn(BPF_JMP|BPF_JA,0,0,0,0));
+
+	// bpf_redirect_map(&xsks,ctx->rx_queue_index,XDP_PASS), which passes if the queue has no socket
+	for(std::vector<unsigned int>::const_iterator j(toRedirect.begin());j!=toRedirect.end();++j)
+		p[*j].off = (int16_t)(p.size() - (*j + 1));
+	p.push_back(_bpfInsn(BPF_LDX|BPF_MEM|BPF_W,2,6,(int16_t)offsetof(struct xdp_md,rx_queue_index),0));
+	p.push_back(_bpfInsn(BPF_LD|BPF_DW|BPF_IMM,1,BPF_PSEUDO_MAP_FD,0,_mapFd));
+	p.push_back(_bpfInsn(0,0,0,0,0));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_MOV|BPF_K,3,0,0,XDP_PASS));
+	p.push_back(_bpfInsn(BPF_JMP|BPF_CALL,0,0,0,BPF_FUNC_redirect_map));
+	p.push_back(_bpfInsn(BPF_JMP|BPF_EXIT,0,0,0,0));
+
+	for(std::vector<unsigned int>::const_iterator j(toPass.begin());j!=toPass.end();++j)
+		p[*j].off = (int16_t)(p.size() - (*j + 1));
+	p.push_back(_bpfInsn(BPF_ALU64|BPF_MOV|BPF_K,0,0,0,XDP_PASS));
+	p.push_back(_bpfInsn(BPF_JMP|BPF_EXIT,0,0,0,0));
+
+	union bpf_attr a;
+	memset(&a,0,sizeof(a));
+	a.prog_type = BPF_PROG_TYPE_XDP;
+	a.expected_attach_type = BPF_XDP;
+	a.insns = (uint64_t)((uintptr_t)p.data());
+	a.insn_cnt = (uint32_t)p.size();
+	a.license = (uint64_t)((uintptr_t)"GPL");
+	const int fd = _bpf(BPF_PROG_LOAD,&a);
+	if (fd < 0)
+		throw std::runtime_error(std::string("cannot load XDP program: ") + strerror(errno));
+	return fd;
+}
+
+bool LinuxXdpReceiver::_parse(const uint8_t *frame,unsigned int len,LinuxXdpPacket &pkt) const
+{
+	// The XDP program only sends us UDP, but lengths are checked again here
+	if (len < 14)
+		return false;
+	const uint8_t *const ip = frame + 14;
+	len -= 14;
+	const unsigned int etherType = ((unsigned int)frame[12] << 8) | (unsigned int)frame[13];
+	if (etherType == 0x0800) {
+		if (len < 20)
+			return false;
+		const unsigned int ihl = (unsigned int)(ip[0] & 0x0f) * 4;
+		const unsigned int totalLen = ((unsigned int)ip[2] << 8) | (unsigned int)ip[3];
+		if (((ip[0] >> 4) != 4)||(ihl < 20)||(ip[9] != 17)||((ip[6] & 0x3f) != 0)||(ip[7] != 0)||(totalLen < (ihl + 8))||(totalLen > len))
+			return false;
+		const uint8_t *const udp = ip + ihl;
+		const unsigned int udpLen = ((unsigned int)udp[4] << 8) | (unsigned int)udp[5];
+		if ((udpLen < 8)||(udpLen > (totalLen - ihl)))
+			return false;
+
+		memset(&(pkt.from),0,sizeof(struct sockaddr_in));
+		struct sockaddr_in *const from = reinterpret_cast<struct sockaddr_in *>(&(pkt.from));
+		from->sin_family = AF_INET;
+		memcpy(&(from->sin_addr),ip + 12,4);
+		memcpy(&(from->sin_port),udp,2);
+		memset(&(pkt.local),0,sizeof(struct sockaddr_in));
+		struct sockaddr_in *const local = reinterpret_cast<struct sockaddr_in *>(&(pkt.local));
+		local->sin_family = AF_INET;
+		memcpy(&(local->sin_addr),ip + 16,4);
+		memcpy(&(local->sin_port),udp + 2,2);
+		pkt.data = (const void *)(udp + 8);
+		pkt.len = udpLen - 8;
+		return true;
+	} else if (etherType == 0x86dd) {
+		if (len < 48)
+			return false;
+		const unsigned int payloadLen = ((unsigned int)ip[4] << 8) | (unsigned int)ip[5];
+		if (((ip[0] >> 4) != 6)||(ip[6] != 17)||(payloadLen < 8)||(payloadLen > (len - 40)))
+			return false;
+		const uint8_t *const udp = ip + 40;
+		const unsigned int udpLen = ((unsigned int)udp[4] << 8) | (unsigned int)udp[5];
+		if ((udpLen < 8)||(udpLen > payloadLen))
+			return false;
+
+		memset(&(pkt.from),0,sizeof(struct sockaddr_in6));
+		struct sockaddr_in6 *const from = reinterpret_cast<struct sockaddr_in6 *>(&(pkt.from));
+		from->sin6_family = AF_INET6;
+		memcpy(&(from->sin6_addr),ip + 8,16);
+		memcpy(&(from->sin6_port),udp,2);
+		memset(&(pkt.local),0,sizeof(struct sockaddr_in6));
+		struct sockaddr_in6 *const local = reinterpret_cast<struct sockaddr_in6 *>(&(pkt.local));
+		local->sin6_family = AF_INET6;
+		memcpy(&(local->sin6_addr),ip + 24,16);
+		memcpy(&(local->sin6_port),udp + 2,2);
+		if ((ip[8] == 0xfe)&&((ip[9] & 0xc0) == 0x80)) { // link-local
+			from->sin6_scope_id = _ifindex;
+			local->sin6_scope_id = _ifindex;
+		}
+		pkt.data = (const void *)(udp + 8);
+		pkt.len = udpLen - 8;
+		return true;
+	}
+	return false;
+}
+
+void LinuxXdpReceiver::_cleanup()
+{
+	if (_linkFd >= 0)
+		::close(_linkFd);
+	if (_progFd >= 0)
+		::close(_progFd);
+	if (_mapFd >= 0)
+		::close(_mapFd);
+	_linkFd = _progFd = _mapFd = -1;
+	for(std::vector<_Queue>::iterator q(_queues.begin());q!=_queues.end();++q)
+		_closeQueue(*q);
+	::close(_shutdownSignalPipe[0]);
+	::close(_shutdownSignalPipe[1]);
+}
+
+void LinuxXdpReceiver::_Queue::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_IO);
+
+	LinuxXdpPacket packets[ZT_LINUX_XDP_RX_BATCH];
+	uint64_t frames[ZT_LINUX_XDP_RX_BATCH];
+	const struct xdp_desc *const rxDescs = reinterpret_cast<const struct xdp_desc *>(rx.descs);
+	uint64_t *const fillDescs = reinterpret_cast<uint64_t *>(fill.descs);
+	const uint32_t mask = ZT_LINUX_XDP_FRAMES - 1;
+	uint8_t *const frameBase = reinterpret_cast<uint8_t *>(umem);
+
+	struct pollfd fds[2];
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = parent->_shutdownSignalPipe[0];
+	fds[1].events = POLLIN;
+
+	for(;;) {
+		const uint32_t rxCons = *rx.consumer;
+		uint32_t n = __atomic_load_n(rx.producer,__ATOMIC_ACQUIRE) - rxCons;
+		if (!n) {
+			fds[0].revents = fds[1].revents = 0;
+			if ((::poll(fds,2,-1) < 0)&&(errno != EINTR))
+				break;
+			if (fds[1].revents) // writes to shutdown pipe terminate thread
+				break;
+			continue;
+		}
+		if (n > ZT_LINUX_XDP_RX_BATCH)
+			n = ZT_LINUX_XDP_RX_BATCH;
+
+		unsigned int count = 0;
+		for(uint32_t i=0;i<n;++i) {
+			const struct xdp_desc &d = rxDescs[(rxCons + i) & mask];
+			frames[i] = d.addr & ~((uint64_t)ZT_LINUX_XDP_FRAME_SIZE - 1);
+			if (((d.addr + d.len) <= ((uint64_t)ZT_LINUX_XDP_FRAMES * (uint64_t)ZT_LINUX_XDP_FRAME_SIZE))&&(parent->_parse(frameBase + d.addr,d.len,packets[count])))
+				++count;
+		}
+		if (count) {
+			try {
+				parent->_handler(parent->_arg,packets,count);
+			} catch ( ... ) {}
+		}
+		__atomic_store_n(rx.consumer,rxCons + n,__ATOMIC_RELEASE);
+
+		// Every frame fits in the fill ring, so there is always room to give these back
+		const uint32_t fillProd = *fill.producer;
+		for(uint32_t i=0;i<n;++i)
+			fillDescs[(fillProd + i) & mask] = frames[i];
+		__atomic_store_n(fill.producer,fillProd + n,__ATOMIC_RELEASE);
+		if ((__atomic_load_n(fill.flags,__ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) != 0)
+			::recvfrom(fd,(void *)0,0,MSG_DONTWAIT,(struct sockaddr *)0,(socklen_t *)0);
+	}
+}
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_AF_XDP
@@ -0,0 +1,161 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_LINUXXDPRECEIVER_HPP
+#define ZT_LINUXXDPRECEIVER_HPP
+
+// Built with -DZT_USE_AF_XDP when the kernel headers have AF_XDP. The
+// receiver is only available (ZT_HAVE_AF_XDP) if they are new enough for
+// need-wakeup rings and XDP links (Linux 5.9).
+#ifdef ZT_USE_AF_XDP
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/version.h>
+#include <linux/if_xdp.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "../node/NonCopyable.hpp"
+#include "Thread.hpp"
+
+#if defined(XDP_USE_NEED_WAKEUP) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0))
+#define ZT_HAVE_AF_XDP 1
+#endif
+
+#endif // ZT_USE_AF_XDP
+
+#ifdef ZT_HAVE_AF_XDP
+
+// Maximum number of device receive queues (each gets a socket and a thread)
+#define ZT_LINUX_XDP_MAX_QUEUES 64
+
+// UMEM frames per queue, and frame size (one page, the most AF_XDP allows)
+#define ZT_LINUX_XDP_FRAMES 2048
+#define ZT_LINUX_XDP_FRAME_SIZE 4096
+
+// Maximum packets passed to the handler at once
+#define ZT_LINUX_XDP_RX_BATCH 64
+
+namespace ZeroTier {
+
+/**
+ * A UDP packet received by LinuxXdpReceiver
+ */
+struct LinuxXdpPacket
+{
+	struct sockaddr_storage local; // destination IP and port
+	struct sockaddr_storage from; // source IP and port
+	const void *data; // UDP payload
+	unsigned int len;
+};
+
+/**
+ * Receives UDP for given ports straight off a device with AF_XDP
+ *
+ * An XDP program attached to the device sends unfragmented IPv4 and IPv6
+ * UDP packets for these ports to an AF_XDP socket on each receive queue,
+ * bypassing the kernel's IP and UDP stack. Everything else, including
+ * fragments and packets with IP options, goes on to the kernel as usual.
+ * Each queue has a thread that hands packets to the handler in batches.
+ *
+ * This only receives. Sends, and replies to these packets, still go out
+ * through normal sockets bound to the same ports.
+ *
+ * The program is attached through a BPF link, so the kernel detaches it if
+ * this process dies. Requires CAP_NET_ADMIN and CAP_BPF (or root).
+ */
+class LinuxXdpReceiver : NonCopyable
+{
+public:
+	/**
+	 * @param dev Device name (e.g. eth0)
+	 * @param ports UDP ports to receive
+	 * @param portCount Number of ports
+	 * @param handler Called with batches of packets (from the queue threads, so concurrently)
+	 * @param arg First argument to handler
+	 * @throws std::runtime_error AF_XDP can't be used on this device (nothing is left attached)
+	 */
+	LinuxXdpReceiver(
+		const char *dev,
+		const unsigned int *ports,
+		unsigned int portCount,
+		void (*handler)(void *,const LinuxXdpPacket *,unsigned int),
+		void *arg);
+
+	~LinuxXdpReceiver();
+
+	inline const std::string &deviceName() const { return _dev; }
+	inline unsigned int queueCount() const { return (unsigned int)_queues.size(); }
+
+private:
+	struct _Ring
+	{
+		uint32_t *producer;
+		uint32_t *consumer;
+		uint32_t *flags;
+		void *descs;
+		void *map;
+		size_t mapSize;
+	};
+
+	struct _Queue
+	{
+		LinuxXdpReceiver *parent;
+		unsigned int id;
+		int fd;
+		void *umem;
+		_Ring fill,completion,rx;
+		Thread thread;
+
+		void threadMain()
+			throw();
+	};
+
+	void _openQueue(_Queue &q);
+	void _closeQueue(_Queue &q);
+	int _loadProgram(const unsigned int *ports,unsigned int portCount);
+	bool _parse(const uint8_t *frame,unsigned int len,LinuxXdpPacket &pkt) const;
+	void _cleanup();
+
+	void (*_handler)(void *,const LinuxXdpPacket *,unsigned int);
+	void *_arg;
+	std::string _dev;
+	unsigned int _ifindex;
+	std::vector<_Queue> _queues;
+	int _mapFd;
+	int _progFd;
+	int _linkFd;
+	int _shutdownSignalPipe[2];
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_AF_XDP
+
+#endif
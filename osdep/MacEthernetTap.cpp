@@ -0,0 +1,561 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_dl.h>
+#include <net/bpf.h>
+#include <net/ndrv.h>
+#include <netinet6/in6_var.h>
+#include <netinet/in_var.h>
+#include <netinet/icmp6.h>
+
+// OSX compile fix... in6_var defines this in a struct which namespaces it for C++ ... why?!?
+struct prf_ra {
+	u_char onlink : 1;
+	u_char autonomous : 1;
+	u_char reserved : 6;
+} prf_ra;
+
+#include <netinet6/nd6.h>
+#include <ifaddrs.h>
+
+// These are KERNEL_PRIVATE... why?
+#ifndef SIOCAUTOCONF_START
+#define SIOCAUTOCONF_START _IOWR('i', 132, struct in6_ifreq)    /* accept rtadvd on this interface */
+#endif
+#ifndef SIOCAUTOCONF_STOP
+#define SIOCAUTOCONF_STOP _IOWR('i', 133, struct in6_ifreq)    /* stop accepting rtadv for this interface */
+#endif
+
+#include <string>
+#include <map>
+#include <set>
+#include <algorithm>
+
+#include "../node/Constants.hpp"
+#include "../node/Utils.hpp"
+#include "../node/Mutex.hpp"
+#include "OSUtils.hpp"
+#include "MacEthernetTap.hpp"
+
+// feth# is the device the OS sees, feth(#+ZT_MACETHERNETTAP_PEER_OFFSET) is our end of the pair
+#define ZT_MACETHERNETTAP_PEER_OFFSET 5000
+
+static inline bool _setIpv6Stuff(const char *ifname,bool performNUD,bool acceptRouterAdverts)
+{
+	struct in6_ndireq nd;
+	struct in6_ifreq ifr;
+
+	int s = socket(AF_INET6,SOCK_DGRAM,0);
+	if (s <= 0)
+		return false;
+
+	memset(&nd,0,sizeof(nd));
+	strncpy(nd.ifname,ifname,sizeof(nd.ifname));
+
+	if (ioctl(s,SIOCGIFINFO_IN6,&nd)) {
+		close(s);
+		return false;
+	}
+
+	unsigned long oldFlags = (unsigned long)nd.ndi.flags;
+
+	if (performNUD)
+		nd.ndi.flags |= ND6_IFF_PERFORMNUD;
+	else nd.ndi.flags &= ~ND6_IFF_PERFORMNUD;
+
+	if (oldFlags != (unsigned long)nd.ndi.flags) {
+		if (ioctl(s,SIOCSIFINFO_FLAGS,&nd)) {
+			close(s);
+			return false;
+		}
+	}
+
+	memset(&ifr,0,sizeof(ifr));
+	strncpy(ifr.ifr_name,ifname,sizeof(ifr.ifr_name));
+	if (ioctl(s,acceptRouterAdverts ? SIOCAUTOCONF_START : SIOCAUTOCONF_STOP,&ifr)) {
+		close(s);
+		return false;
+	}
+
+	close(s);
+	return true;
+}
+
+// Run /sbin/ifconfig with a null-terminated argument list (not including argv[0])
+static inline bool _ifconfig(const char *const *args)
+{
+	const char *argv[16];
+	unsigned int argc = 0;
+	argv[argc++] = "/sbin/ifconfig";
+	while ((args[argc - 1])&&(argc < 15)) {
+		argv[argc] = args[argc - 1];
+		++argc;
+	}
+	argv[argc] = (const char *)0;
+
+	long cpid = (long)vfork();
+	if (cpid == 0) {
+		::execv("/sbin/ifconfig",const_cast<char *const *>(argv));
+		::_exit(-1);
+	} else if (cpid > 0) {
+		int exitcode = -1;
+		::waitpid(cpid,&exitcode,0);
+		return (exitcode == 0);
+	}
+	return false;
+}
+
+static inline void _destroyFeth(const char *dev)
+{
+	if (if_nametoindex(dev)) {
+		const char *args[] = { dev,"destroy",(const char *)0 };
+		_ifconfig(args);
+	}
+}
+
+namespace ZeroTier {
+
+static Mutex globalTapCreateLock;
+
+MacEthernetTap::MacEthernetTap(
+	const char *homePath,
+	const MAC &mac,
+	unsigned int mtu,
+	unsigned int metric,
+	uint64_t nwid,
+	const char *friendlyName,
+	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *data,unsigned int len),
+	void *arg) :
+	_handler(handler),
+	_arg(arg),
+	_nwid(nwid),
+	_homePath(homePath),
+	_mtu(mtu),
+	_metric(metric),
+	_bpfBufferSize(ZT_MACETHERNETTAP_BPF_BUFFER_SIZE),
+	_bpfFd(-1),
+	_ndrvFd(-1),
+	_enabled(true)
+{
+	char devname[64],peername[64],ethaddr[64],mtustr[32],peermtustr[32],metstr[32],nwids[32];
+
+	OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",nwid);
+
+	Mutex::Lock _gl(globalTapCreateLock);
+
+	// Try to reuse the device number we had last time for this network. If
+	// it is still around we crashed without cleaning up, so replace it.
+	std::map<std::string,std::string> globalDeviceMap;
+	FILE *devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"r");
+	if (devmapf) {
+		char buf[256];
+		while (fgets(buf,sizeof(buf),devmapf)) {
+			char *x = (char *)0;
+			char *y = (char *)0;
+			char *saveptr = (char *)0;
+			for(char *f=Utils::stok(buf,"\r\n=",&saveptr);(f);f=Utils::stok((char *)0,"\r\n=",&saveptr)) {
+				if (!x) x = f;
+				else if (!y) y = f;
+				else break;
+			}
+			if ((x)&&(y)&&(x[0])&&(y[0]))
+				globalDeviceMap[x] = y;
+		}
+		fclose(devmapf);
+	}
+	int devno = -1;
+	std::map<std::string,std::string>::const_iterator gdmEntry = globalDeviceMap.find(nwids);
+	if ((gdmEntry != globalDeviceMap.end())&&(gdmEntry->second.length() > 4)&&(!strncmp(gdmEntry->second.c_str(),"feth",4))) {
+		devno = (int)Utils::strToUInt(gdmEntry->second.c_str() + 4);
+		if ((devno < 0)||(devno >= ZT_MACETHERNETTAP_PEER_OFFSET)) {
+			devno = -1;
+		} else {
+			OSUtils::ztsnprintf(devname,sizeof(devname),"feth%d",devno);
+			OSUtils::ztsnprintf(peername,sizeof(peername),"feth%d",devno + ZT_MACETHERNETTAP_PEER_OFFSET);
+			_destroyFeth(peername);
+			_destroyFeth(devname);
+		}
+	}
+	if (devno < 0) {
+		for(int i=0;i<ZT_MACETHERNETTAP_PEER_OFFSET;++i) {
+			OSUtils::ztsnprintf(devname,sizeof(devname),"feth%d",i);
+			OSUtils::ztsnprintf(peername,sizeof(peername),"feth%d",i + ZT_MACETHERNETTAP_PEER_OFFSET);
+			if ((!if_nametoindex(devname))&&(!if_nametoindex(peername))) {
+				devno = i;
+				break;
+			}
+		}
+		if (devno < 0)
+			throw std::runtime_error("no more feth devices available");
+	}
+	_dev = devname;
+	_peerDev = peername;
+
+	// Create and pair the two ends. Our end gets the largest MTU we will ever
+	// need so nothing is truncated on the way through.
+	OSUtils::ztsnprintf(ethaddr,sizeof(ethaddr),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(int)mac[0],(int)mac[1],(int)mac[2],(int)mac[3],(int)mac[4],(int)mac[5]);
+	OSUtils::ztsnprintf(mtustr,sizeof(mtustr),"%u",_mtu);
+	OSUtils::ztsnprintf(peermtustr,sizeof(peermtustr),"%u",(unsigned int)ZT_MAX_MTU);
+	OSUtils::ztsnprintf(metstr,sizeof(metstr),"%u",_metric);
+	{
+		const char *createDev[] = { devname,"create",(const char *)0 };
+		const char *createPeer[] = { peername,"create",(const char *)0 };
+		const char *pair[] = { peername,"peer",devname,(const char *)0 };
+		const char *peerUp[] = { peername,"mtu",peermtustr,"up",(const char *)0 };
+		const char *devUp[] = { devname,"lladdr",ethaddr,"mtu",mtustr,"metric",metstr,"up",(const char *)0 };
+		if ((!_ifconfig(createDev))||(!_ifconfig(createPeer))||(!_ifconfig(pair))||(!_ifconfig(peerUp))||(!_ifconfig(devUp))) {
+			_destroyFeth(peername);
+			_destroyFeth(devname);
+			throw std::runtime_error("ifconfig failure creating or activating feth interface pair");
+		}
+	}
+
+	_setIpv6Stuff(devname,true,false);
+
+	// Outbound frames (from the network to the OS) are injected on our end
+	// with a raw AF_NDRV socket and come out of feth# as received frames.
+	_ndrvFd = ::socket(AF_NDRV,SOCK_RAW,0);
+	if (_ndrvFd < 0) {
+		_destroyFeth(peername);
+		_destroyFeth(devname);
+		throw std::runtime_error("unable to open AF_NDRV socket");
+	}
+	struct sockaddr_ndrv nd;
+	memset(&nd,0,sizeof(nd));
+	nd.snd_len = sizeof(nd);
+	nd.snd_family = AF_NDRV;
+	strncpy((char *)nd.snd_name,peername,sizeof(nd.snd_name) - 1);
+	if ((::bind(_ndrvFd,(struct sockaddr *)&nd,sizeof(nd)) != 0)||(::connect(_ndrvFd,(struct sockaddr *)&nd,sizeof(nd)) != 0)) {
+		::close(_ndrvFd);
+		_destroyFeth(peername);
+		_destroyFeth(devname);
+		throw std::runtime_error("unable to bind AF_NDRV socket to feth peer");
+	}
+
+	// Frames the OS sends out of feth# arrive on our end and are captured
+	// with BPF. The buffer size must be set before attaching to the device.
+	for(int i=0;i<256;++i) {
+		char bpfpath[32];
+		OSUtils::ztsnprintf(bpfpath,sizeof(bpfpath),"/dev/bpf%d",i);
+		_bpfFd = ::open(bpfpath,O_RDWR);
+		if (_bpfFd >= 0)
+			break;
+		if (errno != EBUSY)
+			break;
+	}
+	if (_bpfFd < 0) {
+		::close(_ndrvFd);
+		_destroyFeth(peername);
+		_destroyFeth(devname);
+		throw std::runtime_error("unable to open a BPF device");
+	}
+	{
+		u_int blen = ZT_MACETHERNETTAP_BPF_BUFFER_SIZE;
+		u_int one = 1;
+		u_int zero = 0;
+		struct ifreq ifr;
+		memset(&ifr,0,sizeof(ifr));
+		strncpy(ifr.ifr_name,peername,sizeof(ifr.ifr_name) - 1);
+		bool ok = (ioctl(_bpfFd,BIOCSBLEN,&blen) == 0);
+		ok = ok&&(ioctl(_bpfFd,BIOCSETIF,&ifr) == 0);
+		ok = ok&&(ioctl(_bpfFd,BIOCGBLEN,&blen) == 0);
+		ok = ok&&(ioctl(_bpfFd,BIOCIMMEDIATE,&one) == 0);
+		ok = ok&&(ioctl(_bpfFd,BIOCSSEESENT,&zero) == 0); // don't capture what we inject via AF_NDRV
+		ok = ok&&(ioctl(_bpfFd,BIOCSHDRCMPLT,&one) == 0);
+		ok = ok&&(ioctl(_bpfFd,BIOCPROMISC,(void *)0) == 0);
+		if (!ok) {
+			::close(_bpfFd);
+			::close(_ndrvFd);
+			_destroyFeth(peername);
+			_destroyFeth(devname);
+			throw std::runtime_error("unable to configure BPF device for feth peer");
+		}
+		_bpfBufferSize = blen;
+	}
+
+	// Set close-on-exec so that devices cannot persist if we fork/exec for update
+	fcntl(_bpfFd,F_SETFD,fcntl(_bpfFd,F_GETFD) | FD_CLOEXEC);
+	fcntl(_ndrvFd,F_SETFD,fcntl(_ndrvFd,F_GETFD) | FD_CLOEXEC);
+
+	::pipe(_shutdownSignalPipe);
+
+	globalDeviceMap[nwids] = _dev;
+	devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"w");
+	if (devmapf) {
+		gdmEntry = globalDeviceMap.begin();
+		while (gdmEntry != globalDeviceMap.end()) {
+			fprintf(devmapf,"%s=%s\n",gdmEntry->first.c_str(),gdmEntry->second.c_str());
+			++gdmEntry;
+		}
+		fclose(devmapf);
+	}
+
+	_thread = Thread::start(this);
+}
+
+MacEthernetTap::~MacEthernetTap()
+{
+	::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
+	Thread::join(_thread);
+
+	::close(_bpfFd);
+	::close(_ndrvFd);
+	::close(_shutdownSignalPipe[0]);
+	::close(_shutdownSignalPipe[1]);
+
+	Mutex::Lock _gl(globalTapCreateLock);
+	_destroyFeth(_peerDev.c_str());
+	_destroyFeth(_dev.c_str());
+}
+
+void MacEthernetTap::setEnabled(bool en)
+{
+	_enabled = en; // put() and the BPF reader drop frames while disabled, and the feth pair stays up
+}
+
+bool MacEthernetTap::enabled() const
+{
+	return _enabled;
+}
+
+bool MacEthernetTap::addIp(const InetAddress &ip)
+{
+	if (!ip)
+		return false;
+	char tmp[128];
+	const char *args[] = { _dev.c_str(),(ip.ss_family == AF_INET6) ? "inet6" : "inet",ip.toString(tmp),"alias",(const char *)0 };
+	return _ifconfig(args);
+}
+
+bool MacEthernetTap::removeIp(const InetAddress &ip)
+{
+	if (!ip)
+		return true;
+	std::vector<InetAddress> allIps(ips());
+	for(std::vector<InetAddress>::iterator i(allIps.begin());i!=allIps.end();++i) {
+		if (*i == ip) {
+			char tmp[128];
+			const char *args[] = { _dev.c_str(),(ip.ss_family == AF_INET6) ? "inet6" : "inet",ip.toIpString(tmp),"-alias",(const char *)0 };
+			return _ifconfig(args);
+		}
+	}
+	return false;
+}
+
+std::vector<InetAddress> MacEthernetTap::ips() const
+{
+	struct ifaddrs *ifa = (struct ifaddrs *)0;
+	if (getifaddrs(&ifa))
+		return std::vector<InetAddress>();
+
+	std::vector<InetAddress> r;
+
+	struct ifaddrs *p = ifa;
+	while (p) {
+		if ((!strcmp(p->ifa_name,_dev.c_str()))&&(p->ifa_addr)&&(p->ifa_netmask)&&(p->ifa_addr->sa_family == p->ifa_netmask->sa_family)) {
+			switch(p->ifa_addr->sa_family) {
+				case AF_INET: {
+					struct sockaddr_in *sin = (struct sockaddr_in *)p->ifa_addr;
+					struct sockaddr_in *nm = (struct sockaddr_in *)p->ifa_netmask;
+					r.push_back(InetAddress(&(sin->sin_addr.s_addr),4,Utils::countBits((uint32_t)nm->sin_addr.s_addr)));
+				}	break;
+				case AF_INET6: {
+					struct sockaddr_in6 *sin = (struct sockaddr_in6 *)p->ifa_addr;
+					struct sockaddr_in6 *nm = (struct sockaddr_in6 *)p->ifa_netmask;
+					uint32_t b[4];
+					memcpy(b,nm->sin6_addr.s6_addr,sizeof(b));
+					r.push_back(InetAddress(sin->sin6_addr.s6_addr,16,Utils::countBits(b[0]) + Utils::countBits(b[1]) + Utils::countBits(b[2]) + Utils::countBits(b[3])));
+				}	break;
+			}
+		}
+		p = p->ifa_next;
+	}
+
+	if (ifa)
+		freeifaddrs(ifa);
+
+	std::sort(r.begin(),r.end());
+	r.erase(std::unique(r.begin(),r.end()),r.end());
+
+	return r;
+}
+
+void MacEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	char hdrBuf[14];
+	if ((_ndrvFd >= 0)&&(len <= _mtu)&&(_enabled)) {
+		to.copyTo(hdrBuf,6);
+		from.copyTo(hdrBuf + 6,6);
+		*((uint16_t *)(hdrBuf + 12)) = htons((uint16_t)etherType);
+
+		// Payload goes straight from the decrypted packet to the kernel
+		struct iovec iov[2];
+		iov[0].iov_base = hdrBuf;
+		iov[0].iov_len = 14;
+		iov[1].iov_base = const_cast<void *>(data);
+		iov[1].iov_len = len;
+		::writev(_ndrvFd,iov,(len) ? 2 : 1);
+	}
+}
+
+std::string MacEthernetTap::deviceName() const
+{
+	return _dev;
+}
+
+void MacEthernetTap::setFriendlyName(const char *friendlyName)
+{
+}
+
+void MacEthernetTap::scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed)
+{
+	std::vector<MulticastGroup> newGroups;
+
+	struct ifmaddrs *ifmap = (struct ifmaddrs *)0;
+	if (!getifmaddrs(&ifmap)) {
+		struct ifmaddrs *p = ifmap;
+		while (p) {
+			if ((p->ifma_addr)&&(p->ifma_name)&&(p->ifma_addr->sa_family == AF_LINK)) {
+				struct sockaddr_dl *in = (struct sockaddr_dl *)p->ifma_name;
+				struct sockaddr_dl *la = (struct sockaddr_dl *)p->ifma_addr;
+				if ((la->sdl_alen == 6)&&(in->sdl_nlen <= _dev.length())&&(!memcmp(_dev.data(),in->sdl_data,in->sdl_nlen)))
+					newGroups.push_back(MulticastGroup(MAC(la->sdl_data + la->sdl_nlen,6),0));
+			}
+			p = p->ifma_next;
+		}
+		freeifmaddrs(ifmap);
+	}
+
+	std::vector<InetAddress> allIps(ips());
+	for(std::vector<InetAddress>::iterator ip(allIps.begin());ip!=allIps.end();++ip)
+		newGroups.push_back(MulticastGroup::deriveMulticastGroupForAddressResolution(*ip));
+
+	std::sort(newGroups.begin(),newGroups.end());
+	newGroups.erase(std::unique(newGroups.begin(),newGroups.end()),newGroups.end());
+
+	for(std::vector<MulticastGroup>::iterator m(newGroups.begin());m!=newGroups.end();++m) {
+		if (!std::binary_search(_multicastGroups.begin(),_multicastGroups.end(),*m))
+			added.push_back(*m);
+	}
+	for(std::vector<MulticastGroup>::iterator m(_multicastGroups.begin());m!=_multicastGroups.end();++m) {
+		if (!std::binary_search(newGroups.begin(),newGroups.end(),*m))
+			removed.push_back(*m);
+	}
+
+	_multicastGroups.swap(newGroups);
+}
+
+void MacEthernetTap::setMtu(unsigned int mtu)
+{
+	if (mtu != _mtu) {
+		_mtu = mtu;
+		char tmp[64];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%u",mtu);
+		const char *args[] = { _dev.c_str(),"mtu",tmp,(const char *)0 };
+		_ifconfig(args);
+	}
+}
+
+void MacEthernetTap::threadMain()
+	throw()
+{
+	fd_set readfds,nullfds;
+	MAC to,from;
+	int n,nfds;
+
+	uint8_t *const buf = (uint8_t *)malloc(_bpfBufferSize);
+	if (!buf)
+		return;
+
+	Thread::sleep(500);
+
+	FD_ZERO(&readfds);
+	FD_ZERO(&nullfds);
+	nfds = (int)std::max(_shutdownSignalPipe[0],_bpfFd) + 1;
+
+	for(;;) {
+		FD_SET(_shutdownSignalPipe[0],&readfds);
+		FD_SET(_bpfFd,&readfds);
+		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
+
+		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
+			break;
+
+		if (FD_ISSET(_bpfFd,&readfds)) {
+			// BPF reads must use the full buffer size and return every frame
+			// captured since the last read, each behind its own bpf_hdr.
+			n = (int)::read(_bpfFd,buf,_bpfBufferSize);
+			if (n < 0) {
+				if ((errno != EINTR)&&(errno != ETIMEDOUT))
+					break;
+				continue;
+			}
+			const uint8_t *p = buf;
+			const uint8_t *const eof = buf + n;
+			while ((p + sizeof(struct bpf_hdr)) <= eof) {
+				const struct bpf_hdr *const h = (const struct bpf_hdr *)p;
+				const uint8_t *const frame = p + h->bh_hdrlen;
+				const unsigned int flen = h->bh_caplen;
+				if ((frame + flen) > eof)
+					break;
+				if ((flen > 14)&&(flen == h->bh_datalen)&&(flen <= (_mtu + 14))&&(_enabled)) {
+					to.setTo(frame,6);
+					from.setTo(frame + 6,6);
+					unsigned int etherType = ntohs(((const uint16_t *)frame)[6]);
+					if (etherType != 0x8100) // virtual networks carry no 802.1Q tags, and stripping one would merge VLANs
+						_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(frame + 14),flen - 14);
+				}
+				p += BPF_WORDALIGN(h->bh_hdrlen + h->bh_caplen);
+			}
+		}
+	}
+
+	free(buf);
+}
+
+} // namespace ZeroTier
@@ -52,18 +52,21 @@
 #include <net/if_dl.h>
 #include <sys/sysctl.h>
 #endif
+#ifdef __LINUX__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 #include <ifaddrs.h>
+#include <errno.h>
 #endif
 
 #include <vector>
 #include <algorithm>
 #include <utility>
 
-#include "ManagedRoute.hpp"
+#include "../node/Mutex.hpp"
 
-#define ZT_BSD_ROUTE_CMD "/sbin/route"
-#define ZT_LINUX_IP_COMMAND "/sbin/ip"
-#define ZT_LINUX_IP_COMMAND_2 "/usr/sbin/ip"
+#include "ManagedRoute.hpp"
 
 namespace ZeroTier {
 
@@ -244,32 +247,106 @@ static std::vector<_RTE> _getRTEs(const InetAddress &target,bool contains)
 	return rtes;
 }
 
+// Routing socket messages pad each sockaddr to this alignment
+#ifdef __APPLE__
+#define ZT_RT_SA_ALIGN sizeof(uint32_t)
+#else
+#define ZT_RT_SA_ALIGN sizeof(long)
+#endif
+#define ZT_RT_SA_ROUNDUP(a) (((a) > 0) ? (1 + (((a) - 1) | (ZT_RT_SA_ALIGN - 1))) : ZT_RT_SA_ALIGN)
+
+static Mutex _rtSock_m;
+static int _rtSock = -1;
+static int _rtSeq = 0;
+
+static unsigned int _rtAppendSa(char *p,const InetAddress &a)
+{
+	if (a.ss_family == AF_INET) {
+		struct sockaddr_in sin;
+		memset(&sin,0,sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = reinterpret_cast<const struct sockaddr_in *>(&a)->sin_addr.s_addr;
+		memcpy(p,&sin,sizeof(sin));
+		return ZT_RT_SA_ROUNDUP(sizeof(sin));
+	} else {
+		struct sockaddr_in6 sin6;
+		memset(&sin6,0,sizeof(sin6));
+		sin6.sin6_len = sizeof(sin6);
+		sin6.sin6_family = AF_INET6;
+		memcpy(sin6.sin6_addr.s6_addr,reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_addr.s6_addr,16);
+		memcpy(p,&sin6,sizeof(sin6));
+		return ZT_RT_SA_ROUNDUP(sizeof(sin6));
+	}
+}
+
+// Equivalent to "route <op> [-ifscope <ifscope>] <target> <via>|-interface <localInterface>", written straight to a routing socket
 static void _routeCmd(const char *op,const InetAddress &target,const InetAddress &via,const char *ifscope,const char *localInterface)
 {
-	long p = (long)fork();
-	if (p > 0) {
-		int exitcode = -1;
-		::waitpid(p,&exitcode,0);
-	} else if (p == 0) {
-		::close(STDOUT_FILENO);
-		::close(STDERR_FILENO);
-		char ttmp[64];
-		char iptmp[64];
-		if (via) {
-			if ((ifscope)&&(ifscope[0])) {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,"-ifscope",ifscope,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),via.toIpString(iptmp),(const char *)0);
-			} else {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),via.toIpString(iptmp),(const char *)0);
-			}
-		} else if ((localInterface)&&(localInterface[0])) {
-			if ((ifscope)&&(ifscope[0])) {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,"-ifscope",ifscope,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),"-interface",localInterface,(const char *)0);
-			} else {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),"-interface",localInterface,(const char *)0);
-			}
-		}
-		::_exit(-1);
+	if ((target.ss_family != AF_INET)&&(target.ss_family != AF_INET6))
+		return;
+
+	unsigned int localIndex = 0;
+	if (!via) {
+		if ((!localInterface)||(!localInterface[0]))
+			return;
+		localIndex = if_nametoindex(localInterface);
+		if (!localIndex)
+			return;
+	}
+
+	struct {
+		struct rt_msghdr h;
+		char sa[512];
+	} m;
+	memset(&m,0,sizeof(m));
+	m.h.rtm_version = RTM_VERSION;
+	if (!strcmp(op,"add"))
+		m.h.rtm_type = RTM_ADD;
+	else if (!strcmp(op,"change"))
+		m.h.rtm_type = RTM_CHANGE;
+	else m.h.rtm_type = RTM_DELETE;
+	m.h.rtm_flags = RTF_UP|RTF_STATIC;
+	m.h.rtm_addrs = RTA_DST|RTA_GATEWAY|RTA_NETMASK;
+	m.h.rtm_pid = getpid();
+	if ((ifscope)&&(ifscope[0])) {
+#ifdef RTF_IFSCOPE
+		m.h.rtm_index = (unsigned short)if_nametoindex(ifscope);
+		if (!m.h.rtm_index)
+			return;
+		m.h.rtm_flags |= RTF_IFSCOPE;
+#else
+		return;
+#endif
+	}
+
+	char *p = m.sa;
+	p += _rtAppendSa(p,target.network());
+	if (via) {
+		m.h.rtm_flags |= RTF_GATEWAY;
+		p += _rtAppendSa(p,via);
+	} else {
+		struct sockaddr_dl sdl;
+		memset(&sdl,0,sizeof(sdl));
+		sdl.sdl_len = sizeof(sdl);
+		sdl.sdl_family = AF_LINK;
+		sdl.sdl_index = (unsigned short)localIndex;
+		memcpy(p,&sdl,sizeof(sdl));
+		p += ZT_RT_SA_ROUNDUP(sizeof(sdl));
+	}
+	p += _rtAppendSa(p,target.netmask());
+	m.h.rtm_msglen = (unsigned short)(p - (char *)&m);
+
+	Mutex::Lock _l(_rtSock_m);
+	if (_rtSock < 0) {
+		_rtSock = ::socket(PF_ROUTE,SOCK_RAW,0);
+		if (_rtSock < 0)
+			return;
+		// Replies aren't needed since write() reports errors, and would otherwise pile up unread
+		::shutdown(_rtSock,SHUT_RD);
 	}
+	m.h.rtm_seq = ++_rtSeq;
+	(void)::write(_rtSock,&m,m.h.rtm_msglen);
 }
 
 #endif // __BSD__ ------------------------------------------------------------
@@ -277,24 +354,107 @@ static void _routeCmd(const char *op,const InetAddress &target,const InetAddress
 #ifdef __LINUX__ // ----------------------------------------------------------
 #define ZT_ROUTING_SUPPORT_FOUND 1
 
+static Mutex _nlSock_m;
+static int _nlSock = -1;
+static uint32_t _nlSeq = 0;
+
+static void _nlAddAttr(struct nlmsghdr *n,unsigned int type,const void *data,unsigned int len)
+{
+	struct rtattr *rta = (struct rtattr *)(((char *)n) + NLMSG_ALIGN(n->nlmsg_len));
+	rta->rta_type = (unsigned short)type;
+	rta->rta_len = (unsigned short)RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta),data,len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+// Equivalent to "ip route <op> <target> via <via>|dev <localInterface>", sent straight to rtnetlink
 static void _routeCmd(const char *op,const InetAddress &target,const InetAddress &via,const char *localInterface)
 {
-	long p = (long)fork();
-	if (p > 0) {
-		int exitcode = -1;
-		::waitpid(p,&exitcode,0);
-	} else if (p == 0) {
-		::close(STDOUT_FILENO);
-		::close(STDERR_FILENO);
-		char ipbuf[64],ipbuf2[64];
-		if (via) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"via",via.toIpString(ipbuf2),(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"via",via.toIpString(ipbuf2),(const char *)0);
-		} else if ((localInterface)&&(localInterface[0])) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"dev",localInterface,(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"dev",localInterface,(const char *)0);
+	if ((target.ss_family != AF_INET)&&(target.ss_family != AF_INET6))
+		return;
+	const bool del = (!strcmp(op,"del"));
+
+	unsigned int localIndex = 0;
+	if (!via) {
+		if ((!localInterface)||(!localInterface[0]))
+			return;
+		localIndex = if_nametoindex(localInterface);
+		if (!localIndex)
+			return;
+	}
+
+	struct {
+		struct nlmsghdr n;
+		struct rtmsg r;
+		char attrs[256];
+	} m;
+	memset(&m,0,sizeof(m));
+	m.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	m.n.nlmsg_type = del ? RTM_DELROUTE : RTM_NEWROUTE;
+	m.n.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|(del ? 0 : (NLM_F_CREATE|NLM_F_REPLACE));
+	m.r.rtm_family = (unsigned char)target.ss_family;
+	m.r.rtm_dst_len = (unsigned char)target.netmaskBits();
+	m.r.rtm_table = RT_TABLE_MAIN;
+	if (del) {
+		m.r.rtm_scope = RT_SCOPE_NOWHERE;
+	} else {
+		m.r.rtm_protocol = RTPROT_BOOT;
+		m.r.rtm_scope = (via) ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+		m.r.rtm_type = RTN_UNICAST;
+	}
+
+	const unsigned int alen = (target.ss_family == AF_INET6) ? 16 : 4;
+	const InetAddress dst(target.network());
+	_nlAddAttr(&m.n,RTA_DST,dst.rawIpData(),alen);
+	if (via) {
+		if (via.ss_family != target.ss_family)
+			return;
+		_nlAddAttr(&m.n,RTA_GATEWAY,via.rawIpData(),alen);
+	} else {
+		const uint32_t oif = (uint32_t)localIndex;
+		_nlAddAttr(&m.n,RTA_OIF,&oif,sizeof(oif));
+	}
+
+	Mutex::Lock _l(_nlSock_m);
+	if (_nlSock < 0) {
+		_nlSock = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC,NETLINK_ROUTE);
+		if (_nlSock < 0)
+			return;
+		struct timeval tv;
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		::setsockopt(_nlSock,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+		struct sockaddr_nl sanl;
+		memset(&sanl,0,sizeof(sanl));
+		sanl.nl_family = AF_NETLINK;
+		if (::bind(_nlSock,(const struct sockaddr *)&sanl,sizeof(sanl)) != 0) {
+			::close(_nlSock);
+			_nlSock = -1;
+			return;
+		}
+	}
+	m.n.nlmsg_seq = ++_nlSeq;
+
+	struct sockaddr_nl kernel;
+	memset(&kernel,0,sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	if (::sendto(_nlSock,&m,m.n.nlmsg_len,0,(const struct sockaddr *)&kernel,sizeof(kernel)) != (ssize_t)m.n.nlmsg_len)
+		return;
+
+	// Wait for the ack so the route is in place when we return, as it was when ip was run
+	char buf[4096];
+	for(;;) {
+		const ssize_t n = ::recv(_nlSock,buf,sizeof(buf),0);
+		if (n <= 0) {
+			if ((n < 0)&&(errno == EINTR))
+				continue;
+			return;
+		}
+		int len = (int)n;
+		for(struct nlmsghdr *h=(struct nlmsghdr *)buf;NLMSG_OK(h,len);h=NLMSG_NEXT(h,len)) {
+			if ((h->nlmsg_seq == m.n.nlmsg_seq)&&((h->nlmsg_type == NLMSG_ERROR)||(h->nlmsg_type == NLMSG_DONE)))
+				return;
 		}
-		::_exit(-1);
 	}
 }
 
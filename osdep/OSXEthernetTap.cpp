@@ -573,14 +573,19 @@ std::vector<InetAddress> OSXEthernetTap::ips() const
 
 void OSXEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
+	char hdrBuf[14];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		::write(_fd,putBuf,len);
+		to.copyTo(hdrBuf,6);
+		from.copyTo(hdrBuf + 6,6);
+		*((uint16_t *)(hdrBuf + 12)) = htons((uint16_t)etherType);
+
+		// Payload goes straight from the decrypted packet to the kernel
+		struct iovec iov[2];
+		iov[0].iov_base = hdrBuf;
+		iov[0].iov_len = 14;
+		iov[1].iov_base = const_cast<void *>(data);
+		iov[1].iov_len = len;
+		::writev(_fd,iov,(len) ? 2 : 1);
 	}
 }
 
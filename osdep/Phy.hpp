@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <list>
 #include <stdexcept>
@@ -38,6 +39,7 @@
 
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <MSWSock.h>
 #include <Windows.h>
 
 #define ZT_PHY_SOCKFD_TYPE SOCKET
@@ -48,6 +50,11 @@
 #define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
+// Registered I/O is in the Windows 8 and newer SDK headers
+#ifdef WSAID_MULTIPLE_RIO
+#define ZT_PHY_HAVE_RIO 1
+#endif
+
 #else // not Windows
 
 #include <errno.h>
@@ -58,6 +65,7 @@
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -69,16 +77,83 @@
 #endif
 #endif
 
+// Pick the best available readiness notification mechanism unless select()
+// has been explicitly requested with ZT_PHY_USE_SELECT.
+#ifndef ZT_PHY_USE_SELECT
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#define ZT_PHY_USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#ifdef MSG_WAITFORONE
+#define ZT_PHY_HAVE_RECVMMSG 1
+#define ZT_PHY_HAVE_SENDMMSG 1
+#if defined(IP_RECVTOS) && defined(IPV6_RECVTCLASS) && defined(IPV6_TCLASS)
+#define ZT_PHY_HAVE_ECN 1
+#endif
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#include "LinuxIoUring.hpp"
+#ifdef ZT_HAVE_IO_URING
+#define ZT_PHY_HAVE_IO_URING 1
+#endif
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#define ZT_PHY_USE_KQUEUE 1
+#include <sys/event.h>
+#endif
+#endif // !ZT_PHY_USE_SELECT
+
 #define ZT_PHY_SOCKFD_TYPE int
 #define ZT_PHY_SOCKFD_NULL (-1)
 #define ZT_PHY_SOCKFD_VALID(s) ((s) > -1)
 #define ZT_PHY_CLOSE_SOCKET(s) ::close(s)
+#if defined(ZT_PHY_USE_EPOLL) || defined(ZT_PHY_USE_KQUEUE)
+// epoll and kqueue are not bound by FD_SETSIZE, so this is only a sanity limit
+#define ZT_PHY_MAX_SOCKETS 1048576
+#else
 #define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
+#endif
 #define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
 #endif // Windows or not
 
+#if defined(ZT_PHY_USE_EPOLL) || defined(ZT_PHY_USE_KQUEUE)
+#define ZT_PHY_EVENT_BACKEND 1
+#endif
+
+// Maximum number of readiness events fetched per poll() with epoll/kqueue
+#define ZT_PHY_MAX_EVENTS 256
+
+// Number of datagrams drained per recvmmsg() call, and maximum size of each
+// (larger datagrams are discarded; ZeroTier packets are far smaller)
+#define ZT_PHY_UDP_RECV_BATCH 32
+#define ZT_PHY_UDP_RECV_BATCH_MAX_SIZE 16384
+
+// Number of datagrams queued before PhyUdpSendQueue flushes, and the largest
+// datagram it will queue (larger ones are sent immediately)
+#define ZT_PHY_UDP_SEND_BATCH 32
+#define ZT_PHY_UDP_SEND_BATCH_MAX_SIZE 2048
+
+// Kernel limits for a single UDP GSO send
+#define ZT_PHY_UDP_GSO_MAX_SEGMENTS 64
+#define ZT_PHY_UDP_GSO_MAX_BYTES 65000
+
+// With useIoUring(): ring size, and number of receive buffers shared by all
+// UDP sockets (each holds one datagram of up to ZT_PHY_UDP_RECV_BATCH_MAX_SIZE)
+#define ZT_PHY_IO_URING_ENTRIES 64
+#define ZT_PHY_IO_URING_BUFFERS 256
+
+// With useRio(): most UDP sockets receiving through RIO (later ones use
+// select()), receives kept posted on each, and completions dequeued at once
+#define ZT_PHY_RIO_SOCKETS 64
+#define ZT_PHY_RIO_RECEIVES 16
+#define ZT_PHY_RIO_DEQUEUE 64
+
 namespace ZeroTier {
 
 /**
@@ -86,6 +161,170 @@ namespace ZeroTier {
  */
 typedef void PhySocket;
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+/**
+ * A queue of outgoing UDP datagrams sent in batches with sendmmsg()
+ *
+ * Datagrams are added with Phy<>::udpSendQueued() and go out when the queue
+ * fills or flush() is called. Consecutive datagrams sent from one socket are
+ * handed to the kernel in one sendmmsg() call, and runs of same-sized
+ * datagrams to the same destination are further merged into a single UDP
+ * GSO (UDP_SEGMENT) send. GSO is turned off for the life of the queue if the
+ * kernel rejects it.
+ *
+ * Data is copied on add. This isn't thread-safe; each sending thread should
+ * use its own queue, and it must be flushed before any socket in it closes.
+ * Anything still queued when the queue is destroyed is discarded.
+ */
+class PhyUdpSendQueue
+{
+public:
+	PhyUdpSendQueue() : _count(0),_gso(true) {}
+
+	/**
+	 * @return Number of datagrams waiting to be sent
+	 */
+	inline unsigned int size() const { return _count; }
+
+	/**
+	 * Add a datagram, flushing first if the queue is full
+	 *
+	 * @param fd Socket descriptor
+	 * @param gsoOk True if this socket may use UDP GSO (it must not have SO_NO_CHECK set)
+	 * @param to Destination address
+	 * @param data Datagram payload
+	 * @param len Length of datagram
+	 * @param ecn IP ECN field to send with, or 0 for the socket's default
+	 * @return True if queued, false if too large to queue (queue is flushed so the caller can send it directly in order)
+	 */
+	inline bool add(const int fd,const bool gsoOk,const struct sockaddr *to,const void *data,const unsigned long len,const unsigned int ecn = 0)
+	{
+		if (len > ZT_PHY_UDP_SEND_BATCH_MAX_SIZE) {
+			flush();
+			return false;
+		}
+		if (_count >= ZT_PHY_UDP_SEND_BATCH)
+			flush();
+		_Entry &e = _q[_count++];
+		e.fd = fd;
+		e.gsoOk = gsoOk;
+		e.tolen = (to->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		memcpy(&(e.to),to,e.tolen);
+		e.len = (unsigned int)len;
+#ifdef ZT_PHY_HAVE_ECN
+		e.ecn = ecn;
+#else
+		e.ecn = 0;
+#endif
+		memcpy(e.data,data,len);
+		return true;
+	}
+
+	/**
+	 * Send everything in the queue
+	 *
+	 * Datagrams the kernel refuses are dropped, as with a failed sendto().
+	 */
+	inline void flush()
+	{
+		unsigned int i = 0;
+		while (i < _count) {
+			const int fd = _q[i].fd;
+			unsigned int nmsgs = 0,niov = 0;
+			while ((i < _count)&&(_q[i].fd == fd)) {
+				struct mmsghdr &m = _msgs[nmsgs];
+				memset(&m,0,sizeof(struct mmsghdr));
+				m.msg_hdr.msg_name = (void *)&(_q[i].to);
+				m.msg_hdr.msg_namelen = _q[i].tolen;
+				m.msg_hdr.msg_iov = &(_iov[niov]);
+
+				// Gather a run of datagrams that the kernel can segment for us: same
+				// socket and destination, all the same size except possibly the last.
+				const unsigned int segSize = _q[i].len;
+				unsigned int segs = 0,total = 0;
+				for(;;) {
+					_iov[niov].iov_base = (void *)_q[i].data;
+					_iov[niov].iov_len = _q[i].len;
+					++niov;
+					++segs;
+					total += _q[i].len;
+					const bool shortSegment = (_q[i].len < segSize);
+					++i;
+					if ( (shortSegment) || (!_gso) || (!_q[i-1].gsoOk) || (i >= _count) || (_q[i].fd != fd) || (_q[i].len > segSize) || (segs >= ZT_PHY_UDP_GSO_MAX_SEGMENTS) || ((total + _q[i].len) > ZT_PHY_UDP_GSO_MAX_BYTES) || (_q[i].ecn != _q[i-1].ecn) || (_q[i].tolen != _q[i-1].tolen) || (memcmp(&(_q[i].to),&(_q[i-1].to),_q[i].tolen) != 0) )
+						break;
+				}
+				m.msg_hdr.msg_iovlen = segs;
+
+				const unsigned int ecn = _q[i-1].ecn;
+				if ((segs > 1)||(ecn)) {
+					m.msg_hdr.msg_control = (void *)_cmsg[nmsgs];
+					m.msg_hdr.msg_controllen = ((segs > 1) ? CMSG_SPACE(sizeof(uint16_t)) : 0) + ((ecn) ? CMSG_SPACE(sizeof(int)) : 0);
+					struct cmsghdr *cm = CMSG_FIRSTHDR(&(m.msg_hdr));
+					if (segs > 1) {
+						cm->cmsg_level = SOL_UDP;
+						cm->cmsg_type = UDP_SEGMENT;
+						cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+						const uint16_t gsoSize = (uint16_t)segSize;
+						memcpy(CMSG_DATA(cm),&gsoSize,sizeof(gsoSize));
+						cm = CMSG_NXTHDR(&(m.msg_hdr),cm);
+					}
+#ifdef ZT_PHY_HAVE_ECN
+					if (ecn) {
+						const int tos = (int)ecn;
+						cm->cmsg_level = (_q[i-1].to.ss_family == AF_INET6) ? IPPROTO_IPV6 : IPPROTO_IP;
+						cm->cmsg_type = (_q[i-1].to.ss_family == AF_INET6) ? IPV6_TCLASS : IP_TOS;
+						cm->cmsg_len = CMSG_LEN(sizeof(int));
+						memcpy(CMSG_DATA(cm),&tos,sizeof(tos));
+					}
+#endif
+				}
+
+				++nmsgs;
+			}
+
+			unsigned int sent = 0;
+			while (sent < nmsgs) {
+				const int r = ::sendmmsg(fd,_msgs + sent,nmsgs - sent,0);
+				if (r > 0) {
+					sent += (unsigned int)r;
+				} else {
+					struct msghdr &h = _msgs[sent].msg_hdr;
+					if ((h.msg_controllen)&&((errno == EINVAL)||(errno == EIO)||(errno == ENOPROTOOPT)||(errno == EOPNOTSUPP))) {
+						// Kernel or device can't do UDP GSO (or set the ECN field this
+						// way), so stop trying and send this run the slow way
+						if (h.msg_iovlen > 1)
+							_gso = false;
+						for(unsigned int k=0;k<(unsigned int)h.msg_iovlen;++k)
+							::sendto(fd,h.msg_iov[k].iov_base,h.msg_iov[k].iov_len,0,(const struct sockaddr *)h.msg_name,h.msg_namelen);
+					}
+					++sent;
+				}
+			}
+		}
+		_count = 0;
+	}
+
+private:
+	struct _Entry
+	{
+		int fd;
+		bool gsoOk;
+		socklen_t tolen;
+		struct sockaddr_storage to;
+		unsigned int len;
+		unsigned int ecn;
+		char data[ZT_PHY_UDP_SEND_BATCH_MAX_SIZE];
+	};
+
+	_Entry _q[ZT_PHY_UDP_SEND_BATCH];
+	struct mmsghdr _msgs[ZT_PHY_UDP_SEND_BATCH];
+	struct iovec _iov[ZT_PHY_UDP_SEND_BATCH];
+	char _cmsg[ZT_PHY_UDP_SEND_BATCH][CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int))];
+	unsigned int _count;
+	bool _gso;
+};
+#endif // ZT_PHY_HAVE_SENDMMSG
+
 /**
  * Simple templated non-blocking sockets implementation
  *
@@ -130,6 +369,13 @@ typedef void PhySocket;
  * handler, and in that case close() can be told not to call handlers to
  * prevent recursion.
  *
+ * On Linux readiness is obtained via epoll and on Mac and BSD platforms via
+ * kqueue, so the cost of poll() scales with the number of sockets that are
+ * actually ready rather than the number open. Elsewhere (or if built with
+ * ZT_PHY_USE_SELECT) select() is used and ZT_PHY_MAX_SOCKETS is limited to
+ * FD_SETSIZE. The handler interface is the same in all cases. On Windows,
+ * UDP can be received through Registered I/O instead; see useRio().
+ *
  * This isn't thread-safe with the exception of whack(), which is safe to
  * call from another thread to abort poll().
  */
@@ -158,15 +404,70 @@ private:
 		ZT_PHY_SOCKFD_TYPE sock;
 		void *uptr; // user-settable pointer
 		ZT_PHY_SOCKADDR_STORAGE_TYPE saddr; // remote for TCP_OUT and TCP_IN, local for TCP_LISTEN, RAW, and UDP
+		bool notifyReadable;
+		bool notifyWritable;
+#ifdef ZT_PHY_HAVE_IO_URING
+		bool ringRecv; // multishot receive outstanding on _ring; entry can't be freed until it ends
+		bool ringRecvData; // current multishot receive has delivered something
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		RIO_RQ rioRq; // request queue if receiving through RIO, else RIO_INVALID_RQ (zero)
+		unsigned int rioPending; // receives posted; entry can't be freed until they complete
+#endif
 	};
 
+#ifdef ZT_PHY_HAVE_RECVMMSG
+	// Preallocated receive ring for recvmmsg(), shared by all UDP sockets
+	struct UdpRecvBatch
+	{
+		struct mmsghdr msgs[ZT_PHY_UDP_RECV_BATCH];
+		struct iovec iov[ZT_PHY_UDP_RECV_BATCH];
+		struct sockaddr_storage from[ZT_PHY_UDP_RECV_BATCH];
+#ifdef ZT_PHY_HAVE_ECN
+		uint64_t control[ZT_PHY_UDP_RECV_BATCH][8]; // IP_TOS or IPV6_TCLASS, aligned for cmsghdr
+#endif
+		char data[ZT_PHY_UDP_RECV_BATCH][ZT_PHY_UDP_RECV_BATCH_MAX_SIZE];
+	};
+#endif
+
 	std::list<PhySocketImpl> _socks;
+#ifdef ZT_PHY_HAVE_RECVMMSG
+	UdpRecvBatch *_udpRecvBatch; // allocated on first udpBind()
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+	LinuxIoUring *_ring; // set by useIoUring(), else NULL
+	struct msghdr _ringMsg; // template for multishot recvmsg, which reads only the name and control lengths
+	bool _ringRecvUnsupported; // kernel rejected multishot recvmsg, so later sockets use epoll
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+	// One registered receive buffer, holding the sender's address and the datagram
+	struct RioSlot
+	{
+		SOCKADDR_INET from;
+		char data[ZT_PHY_UDP_RECV_BATCH_MAX_SIZE];
+	};
+
+	RIO_EXTENSION_FUNCTION_TABLE _rio;
+	RIO_CQ _rioCq; // completion queue shared by all RIO sockets; set by useRio(), else RIO_INVALID_CQ
+	HANDLE _rioIocp; // completion port the CQ notifies through
+	OVERLAPPED _rioOverlapped;
+	HANDLE _rioThread; // waits on _rioIocp and whacks poll() when receives complete
+	RioSlot *_rioPool; // ZT_PHY_RIO_SOCKETS * ZT_PHY_RIO_RECEIVES slots, registered as one buffer
+	RIO_BUFFERID _rioPoolId;
+	unsigned int _rioFree[ZT_PHY_RIO_SOCKETS * ZT_PHY_RIO_RECEIVES]; // stack of free slots
+	unsigned int _rioFreeCount;
+#endif
+#ifdef ZT_PHY_EVENT_BACKEND
+	int _eventFd; // epoll or kqueue descriptor
+	bool _haveClosed; // set by close() so poll() knows to remove dead entries from _socks
+#else
 	fd_set _readfds;
 	fd_set _writefds;
 #if defined(_WIN32) || defined(_WIN64)
 	fd_set _exceptfds;
 #endif
 	long _nfds;
+#endif
 
 	ZT_PHY_SOCKFD_TYPE _whackReceiveSocket;
 	ZT_PHY_SOCKFD_TYPE _whackSendSocket;
@@ -174,6 +475,13 @@ private:
 	bool _noDelay;
 	bool _noCheck;
 
+	// ECN field of the datagram being handed up on this thread
+	static inline unsigned int &_datagramEcn()
+	{
+		static thread_local unsigned int ecn = 0;
+		return ecn;
+	}
+
 public:
 	/**
 	 * @param handler Pointer of type HANDLER_PTR_TYPE to handler
@@ -183,8 +491,38 @@ public:
 	Phy(HANDLER_PTR_TYPE handler,bool noDelay,bool noCheck) :
 		_handler(handler)
 	{
+#ifdef ZT_PHY_HAVE_RECVMMSG
+		_udpRecvBatch = (UdpRecvBatch *)0;
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+		_ring = (LinuxIoUring *)0;
+		memset(&_ringMsg,0,sizeof(_ringMsg));
+		_ringMsg.msg_namelen = sizeof(struct sockaddr_storage);
+		_ringRecvUnsupported = false;
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		memset(&_rio,0,sizeof(_rio));
+		_rioCq = RIO_INVALID_CQ;
+		_rioIocp = (HANDLE)0;
+		memset(&_rioOverlapped,0,sizeof(_rioOverlapped));
+		_rioThread = (HANDLE)0;
+		_rioPool = (RioSlot *)0;
+		_rioPoolId = RIO_INVALID_BUFFERID;
+		_rioFreeCount = 0;
+#endif
+#ifdef ZT_PHY_EVENT_BACKEND
+		_haveClosed = false;
+#ifdef ZT_PHY_USE_EPOLL
+		_eventFd = ::epoll_create1(0);
+#else
+		_eventFd = ::kqueue();
+#endif
+		if (_eventFd < 0)
+			throw std::runtime_error("unable to create event notification descriptor");
+#else
 		FD_ZERO(&_readfds);
 		FD_ZERO(&_writefds);
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 		FD_ZERO(&_exceptfds);
@@ -220,7 +558,28 @@ public:
 			throw std::runtime_error("unable to create pipes for select() abort");
 #endif // Windows or not
 
+#ifdef ZT_PHY_EVENT_BACKEND
+		// The whack pipe is registered with a NULL user pointer to distinguish it from sockets
+#ifdef ZT_PHY_USE_EPOLL
+		{
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void *)0;
+			if (::epoll_ctl(_eventFd,EPOLL_CTL_ADD,pipes[0],&ev) != 0)
+				throw std::runtime_error("unable to register pipes for poll() abort");
+		}
+#else
+		{
+			struct kevent ev;
+			EV_SET(&ev,pipes[0],EVFILT_READ,EV_ADD,0,0,(void *)0);
+			if (::kevent(_eventFd,&ev,1,(struct kevent *)0,0,(const struct timespec *)0) != 0)
+				throw std::runtime_error("unable to register pipes for poll() abort");
+		}
+#endif
+#else
 		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
+#endif
 		_whackReceiveSocket = pipes[0];
 		_whackSendSocket = pipes[1];
 		_noDelay = noDelay;
@@ -233,8 +592,20 @@ public:
 			if (s->type != ZT_PHY_SOCKET_CLOSED)
 				this->close((PhySocket *)&(*s),true);
 		}
+#ifdef ZT_PHY_HAVE_RIO
+		_rioShutdown(); // before the whack pipe goes, since its thread may be using it
+#endif
 		ZT_PHY_CLOSE_SOCKET(_whackReceiveSocket);
 		ZT_PHY_CLOSE_SOCKET(_whackSendSocket);
+#ifdef ZT_PHY_EVENT_BACKEND
+		::close(_eventFd);
+#endif
+#ifdef ZT_PHY_HAVE_RECVMMSG
+		delete _udpRecvBatch;
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+		delete _ring;
+#endif
 	}
 
 	/**
@@ -264,6 +635,123 @@ public:
 #endif
 	}
 
+#ifdef ZT_PHY_HAVE_IO_URING
+	/**
+	 * Receive UDP through io_uring instead of epoll and recvmmsg()
+	 *
+	 * Each UDP socket bound after this keeps a multishot recvmsg outstanding
+	 * that fills buffers from a shared provided-buffer ring. poll() then
+	 * waits on the ring along with everything else and hands all received
+	 * datagrams to phyOnDatagram() without any further system calls. Sends
+	 * are unchanged.
+	 *
+	 * This must be called before any UDP sockets are bound. If multishot
+	 * receive turns out not to be supported on the first socket, that and
+	 * later sockets go back to epoll.
+	 *
+	 * @return True if io_uring is in use, false if unavailable (nothing changes)
+	 */
+	inline bool useIoUring()
+	{
+		if (_ring)
+			return true;
+		LinuxIoUring *const r = new LinuxIoUring();
+		if ((r->init(ZT_PHY_IO_URING_ENTRIES,ZT_PHY_IO_URING_BUFFERS * 2))&&(r->provideBuffers(0,ZT_PHY_IO_URING_BUFFERS,(unsigned int)(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + ZT_PHY_UDP_RECV_BATCH_MAX_SIZE)))) {
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void *)r; // distinguishes the ring from sockets in poll()
+			if (::epoll_ctl(_eventFd,EPOLL_CTL_ADD,r->fd(),&ev) == 0) {
+				_ring = r;
+				return true;
+			}
+		}
+		delete r;
+		return false;
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_RIO
+	/**
+	 * Receive UDP through Registered I/O instead of select() and recvfrom()
+	 *
+	 * Each UDP socket bound after this keeps ZT_PHY_RIO_RECEIVES receives
+	 * posted into a buffer pool registered once with the kernel, all
+	 * completing to one completion queue. That queue notifies an I/O
+	 * completion port, which a small thread waits on to whack() poll(). poll()
+	 * then dequeues completions ZT_PHY_RIO_DEQUEUE at a time and hands each
+	 * datagram to phyOnDatagram(), reposting its buffer as it goes. These
+	 * sockets are left out of the select() sets. Sends are unchanged, since
+	 * RIO request queues can't be posted to from more than one thread and
+	 * udpSend() is.
+	 *
+	 * This must be called before any UDP sockets are bound. Sockets beyond
+	 * ZT_PHY_RIO_SOCKETS, or any the kernel won't create a request queue
+	 * for, use select() as before.
+	 *
+	 * @return True if RIO is in use, false if unavailable (nothing changes)
+	 */
+	inline bool useRio()
+	{
+		if (_rioCq != RIO_INVALID_CQ)
+			return true;
+
+		// The function table is fetched through any socket
+		SOCKET s = ::socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+		if (s == INVALID_SOCKET)
+			return false;
+		GUID rioId = WSAID_MULTIPLE_RIO;
+		DWORD bytes = 0;
+		const int err = ::WSAIoctl(s,SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,&rioId,sizeof(rioId),&_rio,sizeof(_rio),&bytes,(LPWSAOVERLAPPED)0,(LPWSAOVERLAPPED_COMPLETION_ROUTINE)0);
+		::closesocket(s);
+		if (err != 0)
+			return false;
+
+		_rioIocp = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE,(HANDLE)0,0,1);
+		if (!_rioIocp) {
+			_rioShutdown();
+			return false;
+		}
+
+		const DWORD poolSize = (DWORD)(sizeof(RioSlot) * ZT_PHY_RIO_SOCKETS * ZT_PHY_RIO_RECEIVES);
+		_rioPool = (RioSlot *)::VirtualAlloc((LPVOID)0,poolSize,MEM_COMMIT|MEM_RESERVE,PAGE_READWRITE);
+		if (!_rioPool) {
+			_rioShutdown();
+			return false;
+		}
+		_rioPoolId = _rio.RIORegisterBuffer((PCHAR)_rioPool,poolSize);
+		if (_rioPoolId == RIO_INVALID_BUFFERID) {
+			_rioShutdown();
+			return false;
+		}
+		for(unsigned int i=0;i<(ZT_PHY_RIO_SOCKETS * ZT_PHY_RIO_RECEIVES);++i)
+			_rioFree[i] = i;
+		_rioFreeCount = ZT_PHY_RIO_SOCKETS * ZT_PHY_RIO_RECEIVES;
+
+		// Room for every socket's receives plus the one send each request queue must allow
+		RIO_NOTIFICATION_COMPLETION nc;
+		memset(&nc,0,sizeof(nc));
+		nc.Type = RIO_IOCP_COMPLETION;
+		nc.Iocp.IocpHandle = _rioIocp;
+		nc.Iocp.CompletionKey = (PVOID)1; // 0 tells the thread to exit
+		nc.Iocp.Overlapped = &_rioOverlapped;
+		_rioCq = _rio.RIOCreateCompletionQueue((DWORD)(ZT_PHY_RIO_SOCKETS * (ZT_PHY_RIO_RECEIVES + 1)),&nc);
+		if (_rioCq == RIO_INVALID_CQ) {
+			_rioShutdown();
+			return false;
+		}
+
+		_rioThread = ::CreateThread((LPSECURITY_ATTRIBUTES)0,0,&Phy::_rioThreadMain,(LPVOID)this,0,(LPDWORD)0);
+		if (!_rioThread) {
+			_rioShutdown();
+			return false;
+		}
+		_rio.RIONotify(_rioCq);
+
+		return true;
+	}
+#endif
+
 	/**
 	 * @return Number of open sockets
 	 */
@@ -305,14 +793,12 @@ public:
 			return (PhySocket *)0;
 		}
 		PhySocketImpl &sws = _socks.back();
-		if ((long)fd > _nfds)
-			_nfds = (long)fd;
-		FD_SET(fd,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_IN; /* TODO: Type was changed to allow for CBs with new RPC model */
 		sws.sock = fd;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		// no sockaddr for this socket type, leave saddr null
+		_watch(sws,true,false);
 		return (PhySocket *)&sws;
 	}
 
@@ -322,14 +808,20 @@ public:
 	 * @param localAddress Local endpoint address and port
 	 * @param uptr Initial value of user pointer associated with this socket (default: NULL)
 	 * @param bufferSize Desired socket receive/send buffer size -- will set as close to this as possible (default: 0, leave alone)
+	 * @param reusePort If true set SO_REUSEPORT (where supported) so other sockets may share this address and port (default: false)
 	 * @return Socket or NULL on failure to bind
 	 */
-	inline PhySocket *udpBind(const struct sockaddr *localAddress,void *uptr = (void *)0,int bufferSize = 0)
+	inline PhySocket *udpBind(const struct sockaddr *localAddress,void *uptr = (void *)0,int bufferSize = 0,bool reusePort = false)
 	{
 		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
 			return (PhySocket *)0;
 
+#ifdef ZT_PHY_HAVE_RIO
+		const bool rio = ((_rioCq != RIO_INVALID_CQ)&&(_rioFreeCount >= ZT_PHY_RIO_RECEIVES));
+		ZT_PHY_SOCKFD_TYPE s = (rio) ? ::WSASocketW(localAddress->sa_family,SOCK_DGRAM,IPPROTO_UDP,(LPWSAPROTOCOL_INFOW)0,0,WSA_FLAG_OVERLAPPED|WSA_FLAG_REGISTERED_IO) : ::socket(localAddress->sa_family,SOCK_DGRAM,0);
+#else
 		ZT_PHY_SOCKFD_TYPE s = ::socket(localAddress->sa_family,SOCK_DGRAM,0);
+#endif
 		if (!ZT_PHY_SOCKFD_VALID(s))
 			return (PhySocket *)0;
 
@@ -374,12 +866,24 @@ public:
 			}
 			f = 0; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,(void *)&f,sizeof(f));
 			f = 1; setsockopt(s,SOL_SOCKET,SO_BROADCAST,(void *)&f,sizeof(f));
+#ifdef SO_REUSEPORT
+			if (reusePort) {
+				f = 1; setsockopt(s,SOL_SOCKET,SO_REUSEPORT,(void *)&f,sizeof(f));
+			}
+#endif
 #ifdef IP_DONTFRAG
 			f = 0; setsockopt(s,IPPROTO_IP,IP_DONTFRAG,&f,sizeof(f));
 #endif
 #ifdef IP_MTU_DISCOVER
 			f = 0; setsockopt(s,IPPROTO_IP,IP_MTU_DISCOVER,&f,sizeof(f));
 #endif
+#ifdef ZT_PHY_HAVE_ECN
+			// Have each datagram's ECN field handed up with it (see datagramEcn())
+			f = 1;
+			if (localAddress->sa_family == AF_INET6)
+				setsockopt(s,IPPROTO_IPV6,IPV6_RECVTCLASS,&f,sizeof(f));
+			else setsockopt(s,IPPROTO_IP,IP_RECVTOS,&f,sizeof(f));
+#endif
 #ifdef SO_NO_CHECK
 			// For now at least we only set SO_NO_CHECK on IPv4 sockets since some
 			// IPv6 stacks incorrectly discard zero checksum packets. May remove
@@ -410,14 +914,48 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
+#ifdef ZT_PHY_HAVE_RECVMMSG
+		if (!_udpRecvBatch) {
+			try {
+				_udpRecvBatch = new UdpRecvBatch();
+				for(unsigned int i=0;i<ZT_PHY_UDP_RECV_BATCH;++i) {
+					_udpRecvBatch->iov[i].iov_base = (void *)_udpRecvBatch->data[i];
+					_udpRecvBatch->iov[i].iov_len = ZT_PHY_UDP_RECV_BATCH_MAX_SIZE;
+				}
+			} catch ( ... ) {
+				_udpRecvBatch = (UdpRecvBatch *)0; // fall back to recvfrom()
+			}
+		}
+#endif
+
 		sws.type = ZT_PHY_SOCKET_UDP;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+#ifdef ZT_PHY_HAVE_IO_URING
+		if ((_ring)&&(!_ringRecvUnsupported)) {
+			_watch(sws,false,false);
+			if (_ringRecvStart(sws))
+				_ring->submit(0);
+			else _setNotify(sws,true,false);
+			return (PhySocket *)&sws;
+		}
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		if (rio) {
+			sws.rioRq = _rio.RIOCreateRequestQueue(s,ZT_PHY_RIO_RECEIVES,1,1,1,_rioCq,_rioCq,(PVOID)&sws);
+			if (sws.rioRq != RIO_INVALID_RQ) {
+				_watch(sws,false,false);
+				for(unsigned int i=0;i<ZT_PHY_RIO_RECEIVES;++i)
+					_rioReceive(sws);
+				if (sws.rioPending)
+					return (PhySocket *)&sws;
+			}
+			sws.rioRq = RIO_INVALID_RQ;
+		}
+#endif
+		_watch(sws,true,false);
 
 		return (PhySocket *)&sws;
 	}
@@ -440,6 +978,72 @@ public:
 #endif
 	}
 
+	/**
+	 * Set or clear the IP don't fragment bit for the next outgoing packet (UDP sockets only)
+	 *
+	 * @param sock UDP socket
+	 * @param df If true, packets too big for the path are dropped instead of fragmented
+	 * @return True on success
+	 */
+	inline bool setIpDontFragment(PhySocket *sock,bool df)
+	{
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#if defined(_WIN32) || defined(_WIN64)
+		DWORD tmp = (df) ? 1 : 0;
+		if (sws.saddr.ss_family == AF_INET6)
+			return (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,(const char *)&tmp,sizeof(tmp)) == 0);
+#ifdef IP_DONTFRAGMENT
+		return (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAGMENT,(const char *)&tmp,sizeof(tmp)) == 0);
+#else
+		return false;
+#endif
+#else
+		bool r = false;
+		int tmp;
+		if (sws.saddr.ss_family == AF_INET6) {
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+			tmp = (df) ? IPV6_PMTUDISC_PROBE : 0; // PROBE sets DF without using the kernel's cached path MTU
+			r = (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_MTU_DISCOVER,(void *)&tmp,sizeof(tmp)) == 0);
+#endif
+#ifdef IPV6_DONTFRAG
+			tmp = (df) ? 1 : 0;
+			r = (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,(void *)&tmp,sizeof(tmp)) == 0);
+#endif
+		} else {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+			tmp = (df) ? IP_PMTUDISC_PROBE : 0;
+			r = (::setsockopt(sws.sock,IPPROTO_IP,IP_MTU_DISCOVER,(void *)&tmp,sizeof(tmp)) == 0);
+#endif
+#ifdef IP_DONTFRAG
+			tmp = (df) ? 1 : 0;
+			r = (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAG,(void *)&tmp,sizeof(tmp)) == 0);
+#endif
+		}
+		return r;
+#endif
+	}
+
+	/**
+	 * Set the rate at which the kernel paces packets out of a UDP socket
+	 *
+	 * This uses SO_MAX_PACING_RATE and so only works on Linux, and only takes
+	 * effect on interfaces using the fq queueing discipline.
+	 *
+	 * @param sock UDP socket
+	 * @param bytesPerSecond Maximum rate in bytes per second or 0 for no pacing
+	 * @return True on success
+	 */
+	inline bool setUdpPacingRate(PhySocket *sock,uint64_t bytesPerSecond)
+	{
+#ifdef SO_MAX_PACING_RATE
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		unsigned int tmp = ((bytesPerSecond)&&(bytesPerSecond < 0xffffffffULL)) ? (unsigned int)bytesPerSecond : ~0U; // ~0 is unlimited
+		return (::setsockopt(sws.sock,SOL_SOCKET,SO_MAX_PACING_RATE,(void *)&tmp,sizeof(tmp)) == 0);
+#else
+		return false;
+#endif
+	}
+
 	/**
 	 * Send a UDP packet
 	 *
@@ -447,11 +1051,37 @@ public:
 	 * @param remoteAddress Destination address (must be correct type for socket)
 	 * @param data Data to send
 	 * @param len Length of packet
+	 * @param ecn IP ECN field to send with, or 0 for the socket's default (ignored without ZT_PHY_HAVE_ECN)
 	 * @return True if packet appears to have been sent successfully
 	 */
-	inline bool udpSend(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len)
+	inline bool udpSend(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len,unsigned int ecn = 0)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#ifdef ZT_PHY_HAVE_ECN
+		if (ecn) {
+			struct iovec iov;
+			iov.iov_base = const_cast<void *>(data);
+			iov.iov_len = len;
+			uint64_t control[4];
+			struct msghdr h;
+			memset(&h,0,sizeof(h));
+			h.msg_name = const_cast<struct sockaddr *>(remoteAddress);
+			h.msg_namelen = (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			h.msg_iov = &iov;
+			h.msg_iovlen = 1;
+			h.msg_control = (void *)control;
+			h.msg_controllen = CMSG_SPACE(sizeof(int));
+			struct cmsghdr *const cm = CMSG_FIRSTHDR(&h);
+			const int tos = (int)ecn;
+			cm->cmsg_level = (remoteAddress->sa_family == AF_INET6) ? IPPROTO_IPV6 : IPPROTO_IP;
+			cm->cmsg_type = (remoteAddress->sa_family == AF_INET6) ? IPV6_TCLASS : IP_TOS;
+			cm->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cm),&tos,sizeof(tos));
+			if ((long)::sendmsg(sws.sock,&h,0) == (long)len)
+				return true;
+			// fall through and try without, e.g. if the kernel won't take IP_TOS this way
+		}
+#endif
 #if defined(_WIN32) || defined(_WIN64)
 		return ((long)::sendto(sws.sock,reinterpret_cast<const char *>(data),len,0,remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
 #else
@@ -459,6 +1089,40 @@ public:
 #endif
 	}
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	/**
+	 * Queue a UDP packet to be sent with the next flush of a send queue
+	 *
+	 * @param q Send queue (one per sending thread)
+	 * @param sock UDP socket
+	 * @param remoteAddress Destination address (must be correct type for socket)
+	 * @param data Data to send
+	 * @param len Length of packet
+	 * @param ecn IP ECN field to send with, or 0 for the socket's default
+	 * @return True if packet was queued or (if too large to queue) appears to have been sent
+	 */
+	inline bool udpSendQueued(PhyUdpSendQueue &q,PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len,unsigned int ecn = 0)
+	{
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		// The kernel refuses GSO on sockets that have SO_NO_CHECK set, which we do for IPv4 if _noCheck
+		if (q.add(sws.sock,((sws.saddr.ss_family == AF_INET6)||(!_noCheck)),remoteAddress,data,len,ecn))
+			return true;
+		return udpSend(sock,remoteAddress,data,len,ecn);
+	}
+#endif
+
+	/**
+	 * Get the IP ECN field of the datagram this thread is handing to phyOnDatagram()
+	 *
+	 * This is kept per thread, so a handler shared by several Phy<> instances
+	 * each polled by its own thread gets the right one. It's only known with
+	 * ZT_PHY_HAVE_ECN and when receiving through recvmmsg(), not through
+	 * io_uring or RIO. Otherwise, and outside of phyOnDatagram(), it's 0.
+	 *
+	 * @return ECN field (0-3)
+	 */
+	static inline unsigned int datagramEcn() { return _datagramEcn(); }
+
 #ifdef __UNIX_LIKE__
 	/**
 	 * Listen for connections on a Unix domain socket
@@ -504,14 +1168,12 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),&sun,sizeof(struct sockaddr_un));
+		_watch(sws,true,false);
 
 		return (PhySocket *)&sws;
 	}
@@ -570,14 +1232,12 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_TCP_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		_watch(sws,true,false);
 
 		return (PhySocket *)&sws;
 	}
@@ -655,22 +1315,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		if (connected) {
-			FD_SET(s,&_readfds);
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-		} else {
-			FD_SET(s,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-			FD_SET(s,&_exceptfds);
-#endif
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_PENDING;
-		}
+		sws.type = (connected) ? ZT_PHY_SOCKET_TCP_OUT_CONNECTED : ZT_PHY_SOCKET_TCP_OUT_PENDING;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		_watch(sws,connected,!connected);
+#if defined(_WIN32) || defined(_WIN64)
+		if (!connected)
+			FD_SET(s,&_exceptfds);
+#endif
 
 		if ((callConnectHandler)&&(connected)) {
 			try {
@@ -751,6 +1405,72 @@ public:
 #if defined(EWOULDBLOCK) && ( !defined(EAGAIN) || (EWOULDBLOCK != EAGAIN) )
 				case EWOULDBLOCK:
 #endif
+#ifdef EINTR
+				case EINTR:
+#endif
+					return 0;
+				default:
+					this->close(sock,callCloseHandler);
+					return -1;
+			}
+		}
+#endif // Windows or not
+		return n;
+	}
+
+	/**
+	 * Attempt to send two pieces of data to a stream connection in one call (non-blocking)
+	 *
+	 * This is the same as streamSend() with the two pieces concatenated, but
+	 * without copying them together first. It's meant for draining ring
+	 * buffers and for framing headers.
+	 *
+	 * @param sock An open stream socket (other socket types will fail)
+	 * @param d1 First piece of data
+	 * @param l1 Length of first piece
+	 * @param d2 Second piece of data, sent after the first
+	 * @param l2 Length of second piece (may be 0)
+	 * @param callCloseHandler If true, call close handler on socket closing failure condition (default: true)
+	 * @return Number of bytes actually sent or -1 on fatal error (socket closure)
+	 */
+	inline long streamSendv(PhySocket *sock,const void *d1,unsigned long l1,const void *d2,unsigned long l2,bool callCloseHandler = true)
+	{
+		if (!l2)
+			return streamSend(sock,d1,l1,callCloseHandler);
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#if defined(_WIN32) || defined(_WIN64)
+		WSABUF bufs[2];
+		bufs[0].buf = const_cast<char *>(reinterpret_cast<const char *>(d1));
+		bufs[0].len = (ULONG)l1;
+		bufs[1].buf = const_cast<char *>(reinterpret_cast<const char *>(d2));
+		bufs[1].len = (ULONG)l2;
+		DWORD sent = 0;
+		if (WSASend(sws.sock,bufs,2,&sent,0,NULL,NULL) == SOCKET_ERROR) {
+				switch(WSAGetLastError()) {
+					case WSAEINTR:
+					case WSAEWOULDBLOCK:
+						return 0;
+					default:
+						this->close(sock,callCloseHandler);
+						return -1;
+				}
+		}
+		long n = (long)sent;
+#else // not Windows
+		struct iovec iov[2];
+		iov[0].iov_base = const_cast<void *>(d1);
+		iov[0].iov_len = l1;
+		iov[1].iov_base = const_cast<void *>(d2);
+		iov[1].iov_len = l2;
+		long n = (long)::writev(sws.sock,iov,2);
+		if (n < 0) {
+			switch(errno) {
+#ifdef EAGAIN
+				case EAGAIN:
+#endif
+#if defined(EWOULDBLOCK) && ( !defined(EAGAIN) || (EWOULDBLOCK != EAGAIN) )
+				case EWOULDBLOCK:
+#endif
 #ifdef EINTR
 				case EINTR:
 #endif
@@ -818,11 +1538,8 @@ public:
 	inline const void setNotifyWritable(PhySocket *sock,bool notifyWritable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyWritable) {
-			FD_SET(sws.sock,&_writefds);
-		} else {
-			FD_CLR(sws.sock,&_writefds);
-		}
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_setNotify(sws,sws.notifyReadable,notifyWritable);
 	}
 
 	/**
@@ -838,11 +1555,8 @@ public:
 	inline const void setNotifyReadable(PhySocket *sock,bool notifyReadable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyReadable) {
-			FD_SET(sws.sock,&_readfds);
-		} else {
-			FD_CLR(sws.sock,&_readfds);
-		}
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_setNotify(sws,notifyReadable,sws.notifyWritable);
 	}
 
 	/**
@@ -857,7 +1571,49 @@ public:
 	inline void poll(unsigned long timeout)
 	{
 		char buf[131072];
-		struct sockaddr_storage ss;
+
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event events[ZT_PHY_MAX_EVENTS];
+		const int n = ::epoll_wait(_eventFd,events,ZT_PHY_MAX_EVENTS,(timeout > 0) ? ((timeout > 0x7fffffffUL) ? 0x7fffffff : (int)timeout) : -1);
+		for(int i=0;i<n;++i) {
+#ifdef ZT_PHY_HAVE_IO_URING
+			if ((_ring)&&(events[i].data.ptr == (void *)_ring)) {
+				_ringDrain();
+				continue;
+			}
+#endif
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>(events[i].data.ptr);
+			if (s) {
+				// Errors and hangups are reported as readability/writability so the
+				// subsequent recv()/getpeername() fails and closes the socket.
+				const bool err = ((events[i].events & (EPOLLERR|EPOLLHUP)) != 0);
+				_handleSocketEvents(*s,(((events[i].events & EPOLLIN) != 0)||(err)),(((events[i].events & EPOLLOUT) != 0)||(err)),buf,sizeof(buf));
+			} else {
+				char tmp[16];
+				::read(_whackReceiveSocket,tmp,16);
+			}
+		}
+		_reapClosed();
+#elif defined(ZT_PHY_USE_KQUEUE)
+		struct kevent events[ZT_PHY_MAX_EVENTS];
+		struct timespec ts;
+		ts.tv_sec = (time_t)(timeout / 1000);
+		ts.tv_nsec = (long)((timeout % 1000) * 1000000);
+		const int n = ::kevent(_eventFd,(const struct kevent *)0,0,events,ZT_PHY_MAX_EVENTS,(timeout > 0) ? &ts : (const struct timespec *)0);
+		for(int i=0;i<n;++i) {
+			if ((events[i].flags & EV_ERROR) != 0)
+				continue;
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>(events[i].udata);
+			if (s) {
+				// EV_EOF is delivered with the filter that fired, which leads to the same close paths as select()
+				_handleSocketEvents(*s,(events[i].filter == EVFILT_READ),(events[i].filter == EVFILT_WRITE),buf,sizeof(buf));
+			} else {
+				char tmp[16];
+				::read(_whackReceiveSocket,tmp,16);
+			}
+		}
+		_reapClosed();
+#else // select()
 		struct timeval tv;
 		fd_set rfds,wfds,efds;
 
@@ -883,172 +1639,31 @@ public:
 #endif
 		}
 
-		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
-			switch (s->type) {
-
-				case ZT_PHY_SOCKET_TCP_OUT_PENDING:
-#if defined(_WIN32) || defined(_WIN64)
-					if (FD_ISSET(s->sock,&efds)) {
-						this->close((PhySocket *)&(*s),true);
-					} else // ... if
-#endif
-					if (FD_ISSET(s->sock,&wfds)) {
-						socklen_t slen = sizeof(ss);
-						if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-							FD_SET(s->sock,&_readfds);
-							FD_CLR(s->sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-							FD_CLR(s->sock,&_exceptfds);
+#ifdef ZT_PHY_HAVE_RIO
+		// Completions are only signalled through whack(), but checking is cheap
+		if (_rioCq != RIO_INVALID_CQ)
+			_rioDrain();
 #endif
-							try {
-								_handler->phyOnTcpConnect((PhySocket *)&(*s),&(s->uptr),true);
-							} catch ( ... ) {}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
-				case ZT_PHY_SOCKET_TCP_IN: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::recv(sock,buf,sizeof(buf),0);
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnTcpData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnTcpWritable((PhySocket *)&(*s),&(s->uptr));
-						} catch ( ... ) {}
-					}
-				}	break;
 
-				case ZT_PHY_SOCKET_TCP_LISTEN:
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
+		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+			if (s->type != ZT_PHY_SOCKET_CLOSED) {
 #if defined(_WIN32) || defined(_WIN64)
-								{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
-#else
-								{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
-#endif
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_TCP_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									_handler->phyOnTcpAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UDP:
-					if (FD_ISSET(s->sock,&rfds)) {
-						for(;;) {
-							memset(&ss,0,sizeof(ss));
-							socklen_t slen = sizeof(ss);
-							long n = (long)::recvfrom(s->sock,buf,sizeof(buf),0,(struct sockaddr *)&ss,&slen);
-							if (n > 0) {
-								try {
-									_handler->phyOnDatagram((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
-								} catch ( ... ) {}
-							} else if (n < 0)
-								break;
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UNIX_IN: {
-#ifdef __UNIX_LIKE__
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnUnixWritable((PhySocket *)&(*s),&(s->uptr),false);
-						} catch ( ... ) {}
-					}
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::read(sock,buf,sizeof(buf));
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnUnixData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-#endif // __UNIX_LIKE__
-				}	break;
-
-				case ZT_PHY_SOCKET_UNIX_LISTEN:
-#ifdef __UNIX_LIKE__
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_UNIX_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									//_handler->phyOnUnixAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-#endif // __UNIX_LIKE__
-					break;
-
-				case ZT_PHY_SOCKET_FD: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;
-					const bool readable = ((FD_ISSET(sock,&rfds))&&(FD_ISSET(sock,&_readfds)));
-					const bool writable = ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds)));
-					if ((readable)||(writable)) {
-						try {
-							//_handler->phyOnFileDescriptorActivity((PhySocket *)&(*s),&(s->uptr),readable,writable);
-						} catch ( ... ) {}
-					}
-				}	break;
-
-				default:
-					break;
-
+				if ((s->type == ZT_PHY_SOCKET_TCP_OUT_PENDING)&&(FD_ISSET(s->sock,&efds)))
+					this->close((PhySocket *)&(*s),true);
+				else
+#endif
+				_handleSocketEvents(*s,(FD_ISSET(s->sock,&rfds) != 0),(FD_ISSET(s->sock,&wfds) != 0),buf,sizeof(buf));
 			}
 
+#ifdef ZT_PHY_HAVE_RIO
+			if ((s->type == ZT_PHY_SOCKET_CLOSED)&&(!s->rioPending))
+#else
 			if (s->type == ZT_PHY_SOCKET_CLOSED)
+#endif
 				_socks.erase(s++);
 			else ++s;
 		}
+#endif // epoll / kqueue / select
 	}
 
 	/**
@@ -1063,10 +1678,17 @@ public:
 		if (sws.type == ZT_PHY_SOCKET_CLOSED)
 			return;
 
-		FD_CLR(sws.sock,&_readfds);
-		FD_CLR(sws.sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-		FD_CLR(sws.sock,&_exceptfds);
+		_unwatch(sws);
+#ifdef ZT_PHY_HAVE_IO_URING
+		if (sws.ringRecv) {
+			// The ring holds its own reference to the socket, so the receive has to be cancelled
+			struct io_uring_sqe *const sqe = _ring->getSqe();
+			if (sqe) {
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = (uint64_t)((uintptr_t)&sws);
+				_ring->submit(0);
+			}
+		}
 #endif
 
 		if (sws.type != ZT_PHY_SOCKET_FD)
@@ -1105,6 +1727,9 @@ public:
 		// Causes entry to be deleted from list in poll(), ignored elsewhere
 		sws.type = ZT_PHY_SOCKET_CLOSED;
 
+#ifdef ZT_PHY_EVENT_BACKEND
+		_haveClosed = true;
+#else
 		if ((long)sws.sock >= (long)_nfds) {
 			long nfds = (long)_whackSendSocket;
 			if ((long)_whackReceiveSocket > nfds)
@@ -1115,6 +1740,456 @@ public:
 			}
 			_nfds = nfds;
 		}
+#endif
+	}
+
+private:
+	// Start monitoring a socket just added to _socks (sws.sock must be set)
+	inline void _watch(PhySocketImpl &sws,bool readable,bool writable)
+	{
+		sws.notifyReadable = false;
+		sws.notifyWritable = false;
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+		ev.data.ptr = (void *)&sws;
+		::epoll_ctl(_eventFd,EPOLL_CTL_ADD,sws.sock,&ev);
+		sws.notifyReadable = readable;
+		sws.notifyWritable = writable;
+#else
+#ifndef ZT_PHY_EVENT_BACKEND
+		if ((long)sws.sock > _nfds)
+			_nfds = (long)sws.sock;
+#endif
+		_setNotify(sws,readable,writable);
+#endif
+	}
+
+	// Change the set of conditions we are monitoring a socket for
+	inline void _setNotify(PhySocketImpl &sws,bool readable,bool writable)
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		if ((readable != sws.notifyReadable)||(writable != sws.notifyWritable)) {
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+			ev.data.ptr = (void *)&sws;
+			::epoll_ctl(_eventFd,EPOLL_CTL_MOD,sws.sock,&ev);
+		}
+#elif defined(ZT_PHY_USE_KQUEUE)
+		struct kevent ch[2];
+		int nch = 0;
+		if (readable != sws.notifyReadable) {
+			EV_SET(&(ch[nch]),sws.sock,EVFILT_READ,(readable ? EV_ADD : EV_DELETE),0,0,(void *)&sws);
+			++nch;
+		}
+		if (writable != sws.notifyWritable) {
+			EV_SET(&(ch[nch]),sws.sock,EVFILT_WRITE,(writable ? EV_ADD : EV_DELETE),0,0,(void *)&sws);
+			++nch;
+		}
+		if (nch)
+			::kevent(_eventFd,ch,nch,(struct kevent *)0,0,(const struct timespec *)0);
+#else
+		if (readable)
+			FD_SET(sws.sock,&_readfds);
+		else FD_CLR(sws.sock,&_readfds);
+		if (writable)
+			FD_SET(sws.sock,&_writefds);
+		else FD_CLR(sws.sock,&_writefds);
+#endif
+		sws.notifyReadable = readable;
+		sws.notifyWritable = writable;
+	}
+
+	// Stop monitoring a socket; must be called before its descriptor is closed
+	inline void _unwatch(PhySocketImpl &sws)
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event ev; // some old kernels require a non-NULL event for EPOLL_CTL_DEL
+		memset(&ev,0,sizeof(ev));
+		::epoll_ctl(_eventFd,EPOLL_CTL_DEL,sws.sock,&ev);
+		sws.notifyReadable = false;
+		sws.notifyWritable = false;
+#else
+		_setNotify(sws,false,false);
+#if defined(_WIN32) || defined(_WIN64)
+		FD_CLR(sws.sock,&_exceptfds);
+#endif
+#endif
+	}
+
+#ifdef ZT_PHY_EVENT_BACKEND
+	// Remove entries for sockets closed since the last call; only walks _socks if something was closed
+	inline void _reapClosed()
+	{
+		if (_haveClosed) {
+			_haveClosed = false;
+			for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+#ifdef ZT_PHY_HAVE_IO_URING
+				if ((s->type == ZT_PHY_SOCKET_CLOSED)&&(!s->ringRecv))
+#else
+				if (s->type == ZT_PHY_SOCKET_CLOSED)
+#endif
+					_socks.erase(s++);
+				else ++s;
+			}
+		}
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_IO_URING
+	// Queue a multishot recvmsg on a UDP socket (caller submits); completions carry the socket as user_data
+	inline bool _ringRecvStart(PhySocketImpl &sws)
+	{
+		struct io_uring_sqe *const sqe = _ring->getSqe();
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = sws.sock;
+		sqe->addr = (uint64_t)((uintptr_t)&_ringMsg);
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = (uint64_t)((uintptr_t)&sws);
+		sws.ringRecv = true;
+		sws.ringRecvData = false;
+		return true;
+	}
+
+	// Handle every completion waiting on the ring, then submit recycled buffers and re-armed receives
+	inline void _ringDrain()
+	{
+		struct io_uring_cqe *cqe;
+		while ((cqe = _ring->peekCqe())) {
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>((uintptr_t)cqe->user_data);
+			const int res = cqe->res;
+			const unsigned int flags = cqe->flags;
+			if (s) { // cancel requests complete with user_data 0
+				if ((flags & IORING_CQE_F_BUFFER) != 0) {
+					if ((res > 0)&&(s->type == ZT_PHY_SOCKET_UDP)) {
+						s->ringRecvData = true;
+						struct io_uring_recvmsg_out *const o = reinterpret_cast<struct io_uring_recvmsg_out *>(_ring->buffer(cqe));
+						if (((o->flags & MSG_TRUNC) == 0)&&(o->payloadlen > 0)) {
+							char *const from = reinterpret_cast<char *>(o) + sizeof(struct io_uring_recvmsg_out);
+							try {
+								_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)from,(void *)(from + _ringMsg.msg_namelen + _ringMsg.msg_controllen),(unsigned long)o->payloadlen);
+							} catch ( ... ) {}
+						}
+					}
+					_ring->recycleBuffer(cqe);
+				}
+				if ((flags & IORING_CQE_F_MORE) == 0) {
+					s->ringRecv = false;
+					if (s->type == ZT_PHY_SOCKET_CLOSED) {
+						_haveClosed = true; // now it can be reaped
+					} else if ((res == -EINVAL)||(res == -EOPNOTSUPP)) {
+						_ringRecvUnsupported = true; // kernel predates multishot recvmsg
+						_setNotify(*s,true,false);
+					} else if ((!s->ringRecvData)||(!_ringRecvStart(*s))) {
+						// The kernel also ends a multishot receive when buffers or CQ space run
+						// out, which is worth re-arming, but not one that never received anything.
+						_setNotify(*s,true,false);
+					}
+				}
+			}
+			_ring->cqeSeen();
+		}
+		_ring->submit(0);
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_RIO
+	// Post one receive on a RIO socket into a free slot
+	inline bool _rioReceive(PhySocketImpl &sws)
+	{
+		if (!_rioFreeCount)
+			return false;
+		const unsigned int slot = _rioFree[--_rioFreeCount];
+		RIO_BUF data,from;
+		data.BufferId = _rioPoolId;
+		data.Offset = (ULONG)(reinterpret_cast<char *>(_rioPool[slot].data) - reinterpret_cast<char *>(_rioPool));
+		data.Length = ZT_PHY_UDP_RECV_BATCH_MAX_SIZE;
+		from.BufferId = _rioPoolId;
+		from.Offset = (ULONG)(reinterpret_cast<char *>(&(_rioPool[slot].from)) - reinterpret_cast<char *>(_rioPool));
+		from.Length = sizeof(SOCKADDR_INET);
+		if (!_rio.RIOReceiveEx(sws.rioRq,&data,1,(PRIO_BUF)0,&from,(PRIO_BUF)0,(PRIO_BUF)0,0,(PVOID)((uintptr_t)slot))) {
+			_rioFree[_rioFreeCount++] = slot;
+			return false;
+		}
+		++sws.rioPending;
+		return true;
+	}
+
+	// Handle every completed receive, reposting each buffer, then ask for the next notification
+	inline void _rioDrain()
+	{
+		RIORESULT results[ZT_PHY_RIO_DEQUEUE];
+		for(;;) {
+			const ULONG n = _rio.RIODequeueCompletion(_rioCq,results,ZT_PHY_RIO_DEQUEUE);
+			if ((n == 0)||(n == RIO_CORRUPT_CQ))
+				break;
+			for(ULONG i=0;i<n;++i) {
+				PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>((uintptr_t)results[i].SocketContext);
+				const unsigned int slot = (unsigned int)results[i].RequestContext;
+				--s->rioPending;
+				// Receives cancelled by close() complete with an error, as do ICMP resets, and both are skipped
+				if ((s->type == ZT_PHY_SOCKET_UDP)&&(results[i].Status == 0)&&(results[i].BytesTransferred > 0)) {
+					try {
+						_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&(_rioPool[slot].from),(void *)_rioPool[slot].data,(unsigned long)results[i].BytesTransferred);
+					} catch ( ... ) {}
+				}
+				_rioFree[_rioFreeCount++] = slot;
+				if ((s->type == ZT_PHY_SOCKET_UDP)&&(!_rioReceive(*s))&&(!s->rioPending))
+					_setNotify(*s,true,false); // can't keep a receive posted, so fall back to select()
+			}
+			if (n < ZT_PHY_RIO_DEQUEUE)
+				break;
+		}
+		_rio.RIONotify(_rioCq);
+	}
+
+	static DWORD WINAPI _rioThreadMain(LPVOID arg)
+	{
+		Phy *const phy = reinterpret_cast<Phy *>(arg);
+		for(;;) {
+			DWORD bytes = 0;
+			ULONG_PTR key = 0;
+			LPOVERLAPPED ov = (LPOVERLAPPED)0;
+			if ((!::GetQueuedCompletionStatus(phy->_rioIocp,&bytes,&key,&ov,INFINITE))||(!key))
+				return 0;
+			phy->whack();
+		}
+	}
+
+	// Free everything useRio() set up; request queues went with their sockets
+	inline void _rioShutdown()
+	{
+		if (_rioThread) {
+			::PostQueuedCompletionStatus(_rioIocp,0,0,(LPOVERLAPPED)0);
+			::WaitForSingleObject(_rioThread,INFINITE);
+			::CloseHandle(_rioThread);
+			_rioThread = (HANDLE)0;
+		}
+		if (_rioCq != RIO_INVALID_CQ) {
+			_rio.RIOCloseCompletionQueue(_rioCq);
+			_rioCq = RIO_INVALID_CQ;
+		}
+		if (_rioPoolId != RIO_INVALID_BUFFERID) {
+			_rio.RIODeregisterBuffer(_rioPoolId);
+			_rioPoolId = RIO_INVALID_BUFFERID;
+		}
+		if (_rioPool) {
+			::VirtualFree((LPVOID)_rioPool,0,MEM_RELEASE);
+			_rioPool = (RioSlot *)0;
+		}
+		_rioFreeCount = 0;
+		if (_rioIocp) {
+			::CloseHandle(_rioIocp);
+			_rioIocp = (HANDLE)0;
+		}
+	}
+#endif
+
+	// Handle readiness for a single socket; 'buf' is scratch space for reads
+	inline void _handleSocketEvents(PhySocketImpl &sws,const bool readable,const bool writable,char *buf,const unsigned long bufSize)
+	{
+		PhySocketImpl *const s = &sws;
+		struct sockaddr_storage ss;
+
+		switch (s->type) {
+
+			case ZT_PHY_SOCKET_TCP_OUT_PENDING:
+				if (writable) {
+					socklen_t slen = sizeof(ss);
+					if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
+						_setNotify(*s,true,false);
+#if defined(_WIN32) || defined(_WIN64)
+						FD_CLR(s->sock,&_exceptfds);
+#endif
+						try {
+							_handler->phyOnTcpConnect((PhySocket *)s,&(s->uptr),true);
+						} catch ( ... ) {}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
+			case ZT_PHY_SOCKET_TCP_IN: {
+				ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
+				if (readable) {
+					long n = (long)::recv(sock,buf,bufSize,0);
+					if (n <= 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						try {
+							_handler->phyOnTcpData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+				if ((writable)&&(s->notifyWritable)) {
+					try {
+						_handler->phyOnTcpWritable((PhySocket *)s,&(s->uptr));
+					} catch ( ... ) {}
+				}
+			}	break;
+
+			case ZT_PHY_SOCKET_TCP_LISTEN:
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+#if defined(_WIN32) || defined(_WIN64)
+							{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
+#else
+							{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+#endif
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_TCP_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							_watch(sws,true,false);
+							try {
+								_handler->phyOnTcpAccept((PhySocket *)s,(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
+							} catch ( ... ) {}
+						}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UDP:
+				if (readable) {
+#ifdef ZT_PHY_HAVE_RECVMMSG
+					if (_udpRecvBatch) {
+						UdpRecvBatch &b = *_udpRecvBatch;
+						for(;;) {
+							for(unsigned int i=0;i<ZT_PHY_UDP_RECV_BATCH;++i) {
+								memset(&(b.msgs[i]),0,sizeof(struct mmsghdr));
+								b.msgs[i].msg_hdr.msg_name = (void *)&(b.from[i]);
+								b.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+								b.msgs[i].msg_hdr.msg_iov = &(b.iov[i]);
+								b.msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef ZT_PHY_HAVE_ECN
+								b.msgs[i].msg_hdr.msg_control = (void *)b.control[i];
+								b.msgs[i].msg_hdr.msg_controllen = sizeof(b.control[i]);
+#endif
+							}
+							const int n = ::recvmmsg(s->sock,b.msgs,ZT_PHY_UDP_RECV_BATCH,0,(struct timespec *)0);
+							for(int i=0;i<n;++i) {
+								if ((b.msgs[i].msg_len > 0)&&((b.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) == 0)) {
+#ifdef ZT_PHY_HAVE_ECN
+									for(struct cmsghdr *cm=CMSG_FIRSTHDR(&(b.msgs[i].msg_hdr));cm;cm=CMSG_NXTHDR(&(b.msgs[i].msg_hdr),cm)) {
+										// IP_TOS comes as one byte and IPV6_TCLASS as an int
+										if ((cm->cmsg_level == IPPROTO_IP)&&(cm->cmsg_type == IP_TOS)&&(cm->cmsg_len >= CMSG_LEN(1))) {
+											_datagramEcn() = (unsigned int)*reinterpret_cast<const uint8_t *>(CMSG_DATA(cm)) & 3;
+										} else if ((cm->cmsg_level == IPPROTO_IPV6)&&(cm->cmsg_type == IPV6_TCLASS)&&(cm->cmsg_len >= CMSG_LEN(sizeof(int)))) {
+											int tc;
+											memcpy(&tc,CMSG_DATA(cm),sizeof(tc));
+											_datagramEcn() = (unsigned int)tc & 3;
+										}
+									}
+#endif
+									try {
+										_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&(b.from[i]),(void *)b.data[i],(unsigned long)b.msgs[i].msg_len);
+									} catch ( ... ) {}
+									_datagramEcn() = 0;
+								}
+								if (s->type == ZT_PHY_SOCKET_CLOSED)
+									return;
+							}
+							if (n < (int)ZT_PHY_UDP_RECV_BATCH)
+								break; // socket drained; a partial batch means nothing else was queued
+						}
+						break;
+					}
+#endif
+					for(;;) {
+						memset(&ss,0,sizeof(ss));
+						socklen_t slen = sizeof(ss);
+						long n = (long)::recvfrom(s->sock,buf,bufSize,0,(struct sockaddr *)&ss,&slen);
+						if (n > 0) {
+							try {
+								_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
+							} catch ( ... ) {}
+						} else if (n < 0)
+							break;
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UNIX_IN: {
+#ifdef __UNIX_LIKE__
+				ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
+				if ((writable)&&(s->notifyWritable)) {
+					try {
+						_handler->phyOnUnixWritable((PhySocket *)s,&(s->uptr),false);
+					} catch ( ... ) {}
+				}
+				if ((readable)&&(s->type != ZT_PHY_SOCKET_CLOSED)) {
+					long n = (long)::read(sock,buf,bufSize);
+					if (n <= 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						try {
+							_handler->phyOnUnixData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+#endif // __UNIX_LIKE__
+			}	break;
+
+			case ZT_PHY_SOCKET_UNIX_LISTEN:
+#ifdef __UNIX_LIKE__
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_UNIX_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							_watch(sws,true,false);
+							try {
+								//_handler->phyOnUnixAccept((PhySocket *)s,(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
+							} catch ( ... ) {}
+						}
+					}
+				}
+#endif // __UNIX_LIKE__
+				break;
+
+			case ZT_PHY_SOCKET_FD: {
+				const bool r = ((readable)&&(s->notifyReadable));
+				const bool w = ((writable)&&(s->notifyWritable));
+				if ((r)||(w)) {
+					try {
+						//_handler->phyOnFileDescriptorActivity((PhySocket *)s,&(s->uptr),r,w);
+					} catch ( ... ) {}
+				}
+			}	break;
+
+			default:
+				break;
+
+		}
 	}
 };
 
@@ -41,6 +41,7 @@
 #include <string.h>
 
 #include <string>
+#include <algorithm>
 
 #include "../node/Utils.hpp"
 #include "OSUtils.hpp"
@@ -84,265 +85,442 @@ namespace ZeroTier {
 class PortMapperImpl
 {
 public:
-	PortMapperImpl(int localUdpPortToMap,const char *un) :
+	enum Method
+	{
+		METHOD_NATPMP = 0,
+		METHOD_UPNP = 1,
+		METHOD_COUNT = 2
+	};
+
+	PortMapperImpl(int localUdpPortToMap,const char *un,const char *cp,void (*cf)(void *),void *ca) :
 		run(true),
 		localPort(localUdpPortToMap),
-		uniqueName(un)
+		uniqueName(un),
+		cachePath((cp) ? cp : ""),
+		cachedNatPmpGateway(0),
+		changedFunction(cf),
+		changedArg(ca),
+		_refs(METHOD_COUNT)
 	{
+		for(int m=0;m<METHOD_COUNT;++m)
+			cachedPort[m] = 0;
+		_loadCache();
 	}
 
 	~PortMapperImpl() {}
 
-	void threadMain()
+	/**
+	 * Thread main for one mapping method
+	 *
+	 * NAT-PMP and UPnP each get their own thread so that a slow or absent
+	 * one never delays the other. Failed attempts are retried with backoff
+	 * instead of waiting out the full refresh delay.
+	 */
+	void threadMain(const Method method)
 		throw()
 	{
-		int mode = 0; // 0 == NAT-PMP, 1 == UPnP
-
 #ifdef ZT_PORTMAPPER_TRACE
-		fprintf(stderr,"PortMapper: started for UDP port %d" ZT_EOL_S,localPort);
+		PM_TRACE("PortMapper: %s started for UDP port %d" ZT_EOL_S,(method == METHOD_NATPMP) ? "NAT-PMP" : "UPnP",localPort);
 #endif
 
+		unsigned long retryDelay = ZT_PORTMAPPER_RETRY_DELAY_MIN;
 		while (run) {
-
-			// ---------------------------------------------------------------------
-			// NAT-PMP mode (preferred)
-			// ---------------------------------------------------------------------
-			if (mode == 0) {
-			  natpmp_t natpmp;
-			  natpmpresp_t response;
-				int r = 0;
-
-				bool natPmpSuccess = false;
-				for(int tries=0;tries<60;++tries) {
-					int tryPort = (int)localPort + tries;
-					if (tryPort >= 65535)
-						tryPort = (tryPort - 65535) + 1025;
-
-					memset(&natpmp,0,sizeof(natpmp));
-					memset(&response,0,sizeof(response));
-
-					if (initnatpmp(&natpmp,0,0) != 0) {
-						mode = 1;
+			const bool ok = (method == METHOD_NATPMP) ? _natPmp() : _upnp();
+			if (ok) {
+				retryDelay = ZT_PORTMAPPER_RETRY_DELAY_MIN;
+				_sleep(ZT_PORTMAPPER_REFRESH_DELAY);
+			} else {
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: NAT-PMP: init failed, switching to UPnP mode" ZT_EOL_S);
+				PM_TRACE("PortMapper: %s failed, retrying in %lu ms" ZT_EOL_S,(method == METHOD_NATPMP) ? "NAT-PMP" : "UPnP",retryDelay);
 #endif
-						break;
-					}
+				_sleep(retryDelay);
+				retryDelay = std::min(retryDelay * 2,(unsigned long)ZT_PORTMAPPER_REFRESH_DELAY);
+			}
+		}
 
-					InetAddress publicAddress;
-					sendpublicaddressrequest(&natpmp);
-					uint64_t myTimeout = OSUtils::now() + 5000;
-					do {
-						fd_set fds;
-						struct timeval timeout;
-						FD_ZERO(&fds);
-						FD_SET(natpmp.s, &fds);
-						getnatpmprequesttimeout(&natpmp, &timeout);
-						select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
-						r = readnatpmpresponseorretry(&natpmp, &response);
-						if (OSUtils::now() >= myTimeout)
-							break;
-					} while (r == NATPMP_TRYAGAIN);
-					if (r == 0) {
-						publicAddress = InetAddress((uint32_t)response.pnu.publicaddress.addr.s_addr,0);
-					} else {
-#ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: NAT-PMP: request for external address failed, aborting..." ZT_EOL_S);
-#endif
-						closenatpmp(&natpmp);
-						break;
-					}
+		// The last thread to exit frees the shared state
+		if (__sync_sub_and_fetch(&_refs,1) == 0)
+			delete this;
+	}
+
+	std::vector<InetAddress> get()
+	{
+		std::vector<InetAddress> r;
+		Mutex::Lock sl(surface_l);
+		for(int m=0;m<METHOD_COUNT;++m) {
+			if ((surface[m])&&(std::find(r.begin(),r.end(),surface[m]) == r.end()))
+				r.push_back(surface[m]);
+		}
+		return r;
+	}
+
+	void stop()
+	{
+		run = false;
+		Mutex::Lock cl(changed_l);
+		changedFunction = (void (*)(void *))0;
+	}
+
+	volatile bool run;
+	int localPort;
+	std::string uniqueName;
+	std::string cachePath;
+
+	// Gateway and external ports learned on a previous run, tried first
+	uint32_t cachedNatPmpGateway;
+	std::string cachedUpnpRootDescUrl;
+	int cachedPort[METHOD_COUNT];
+
+	Mutex surface_l;
+	InetAddress surface[METHOD_COUNT];
+
+	Mutex changed_l;
+	void (*changedFunction)(void *);
+	void *changedArg;
+
+private:
+	// Ports to try, starting with the one we had last time
+	inline int _tryPort(const Method method,const int tries) const
+	{
+		int tryPort;
+		if (cachedPort[method] > 0) {
+			if (tries == 0)
+				return cachedPort[method];
+			tryPort = localPort + tries - 1;
+		} else {
+			tryPort = localPort + tries;
+		}
+		if (tryPort >= 65535)
+			tryPort = (tryPort - 65535) + 1025;
+		return tryPort;
+	}
+
+	inline void _sleep(const unsigned long ms)
+	{
+		for(unsigned long slept=0;(run)&&(slept<ms);slept+=1000)
+			Thread::sleep(std::min(ms - slept,(unsigned long)1000));
+	}
+
+	void _publish(const Method method,const InetAddress &ext)
+	{
+		{
+			Mutex::Lock sl(surface_l);
+			if (surface[method] == ext)
+				return;
+			surface[method] = ext;
+		}
+		{
+			Mutex::Lock cl(cache_l);
+			cachedPort[method] = (int)ext.port();
+			_saveCache();
+		}
+		Mutex::Lock cl(changed_l);
+		if (changedFunction)
+			changedFunction(changedArg);
+	}
+
+	void _loadCache()
+	{
+		std::string buf;
+		if ((cachePath.empty())||(!OSUtils::readFile(cachePath.c_str(),buf)))
+			return;
+		std::vector<std::string> lines(OSUtils::split(buf.c_str(),"\r\n","",""));
+		for(std::vector<std::string>::const_iterator l(lines.begin());l!=lines.end();++l) {
+			std::vector<std::string> f(OSUtils::split(l->c_str()," ","",""));
+			if ((f.size() == 3)&&(f[0] == "natpmp")) {
+				cachedNatPmpGateway = (uint32_t)Utils::hexStrToULong(f[1].c_str());
+				cachedPort[METHOD_NATPMP] = Utils::strToInt(f[2].c_str());
+			} else if ((f.size() == 3)&&(f[0] == "upnp")) {
+				cachedPort[METHOD_UPNP] = Utils::strToInt(f[1].c_str());
+				cachedUpnpRootDescUrl = f[2];
+			}
+		}
+		for(int m=0;m<METHOD_COUNT;++m) {
+			if ((cachedPort[m] <= 0)||(cachedPort[m] > 65535))
+				cachedPort[m] = 0;
+		}
+	}
+
+	// Each thread only changes its own method's cache fields, and only with cache_l locked
+	void _saveCache()
+	{
+		if (cachePath.empty())
+			return;
+		char tmp[64];
+		std::string buf;
+		if (cachedPort[METHOD_NATPMP]) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"natpmp %.8lx %d" ZT_EOL_S,(unsigned long)cachedNatPmpGateway,cachedPort[METHOD_NATPMP]);
+			buf.append(tmp);
+		}
+		if ((cachedPort[METHOD_UPNP])&&(!cachedUpnpRootDescUrl.empty())&&(cachedUpnpRootDescUrl.find_first_of(" \r\n") == std::string::npos)) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"upnp %d ",cachedPort[METHOD_UPNP]);
+			buf.append(tmp);
+			buf.append(cachedUpnpRootDescUrl);
+			buf.append(ZT_EOL_S);
+		}
+		OSUtils::writeFile(cachePath.c_str(),buf);
+	}
 
-				  sendnewportmappingrequest(&natpmp,NATPMP_PROTOCOL_UDP,localPort,tryPort,(ZT_PORTMAPPER_REFRESH_DELAY * 2) / 1000);
-					myTimeout = OSUtils::now() + 10000;
-					do {
-				    fd_set fds;
-				    struct timeval timeout;
-				    FD_ZERO(&fds);
-				    FD_SET(natpmp.s, &fds);
-				    getnatpmprequesttimeout(&natpmp, &timeout);
-				    select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
-				    r = readnatpmpresponseorretry(&natpmp, &response);
-						if (OSUtils::now() >= myTimeout)
-							break;
-				  } while (r == NATPMP_TRYAGAIN);
-					if (r == 0) {
-						publicAddress.setPort(response.pnu.newportmapping.mappedpublicport);
+	bool _natPmp()
+	{
+		natpmp_t natpmp;
+		natpmpresp_t response;
+		int r = 0;
+
+		memset(&natpmp,0,sizeof(natpmp));
+		if (initnatpmp(&natpmp,0,0) != 0) {
 #ifdef ZT_PORTMAPPER_TRACE
-                        char paddr[128];
-                        PM_TRACE("PortMapper: NAT-PMP: mapped %u to %s" ZT_EOL_S,(unsigned int)localPort,publicAddress.toString(paddr));
+			PM_TRACE("PortMapper: NAT-PMP: init failed" ZT_EOL_S);
 #endif
-						Mutex::Lock sl(surface_l);
-						surface.clear();
-						surface.push_back(publicAddress);
-						natPmpSuccess = true;
-						closenatpmp(&natpmp);
-						break;
-					} else {
-						closenatpmp(&natpmp);
-						// continue
-					}
-				}
+			return false;
+		}
+		const uint32_t gateway = (uint32_t)natpmp.gateway;
+		closenatpmp(&natpmp);
+
+		// A port mapped through some other gateway is no use here
+		if (gateway != cachedNatPmpGateway) {
+			Mutex::Lock cl(cache_l);
+			cachedNatPmpGateway = gateway;
+			cachedPort[METHOD_NATPMP] = 0;
+		}
 
-				if (!natPmpSuccess) {
-					mode = 1;
+		for(int tries=0;(run)&&(tries<60);++tries) {
+			const int tryPort = _tryPort(METHOD_NATPMP,tries);
+
+			memset(&natpmp,0,sizeof(natpmp));
+			memset(&response,0,sizeof(response));
+
+			if (initnatpmp(&natpmp,1,(in_addr_t)gateway) != 0)
+				return false;
+
+			InetAddress publicAddress;
+			sendpublicaddressrequest(&natpmp);
+			uint64_t myTimeout = OSUtils::now() + 5000;
+			do {
+				fd_set fds;
+				struct timeval timeout;
+				FD_ZERO(&fds);
+				FD_SET(natpmp.s, &fds);
+				getnatpmprequesttimeout(&natpmp, &timeout);
+				select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
+				r = readnatpmpresponseorretry(&natpmp, &response);
+				if (OSUtils::now() >= myTimeout)
+					break;
+			} while (r == NATPMP_TRYAGAIN);
+			if (r == 0) {
+				publicAddress = InetAddress((uint32_t)response.pnu.publicaddress.addr.s_addr,0);
+			} else {
 #ifdef ZT_PORTMAPPER_TRACE
-                    PM_TRACE("PortMapper: NAT-PMP: request failed, switching to UPnP mode" ZT_EOL_S);
+				PM_TRACE("PortMapper: NAT-PMP: request for external address failed, aborting..." ZT_EOL_S);
 #endif
-				}
+				closenatpmp(&natpmp);
+				return false;
 			}
-			// ---------------------------------------------------------------------
-
-			// ---------------------------------------------------------------------
-			// UPnP mode
-			// ---------------------------------------------------------------------
-			if (mode == 1) {
-				char lanaddr[4096];
-				char externalip[4096]; // no range checking? so make these buffers larger than any UDP packet a uPnP server could send us as a precaution :P
-				char inport[16];
-				char outport[16];
-				struct UPNPUrls urls;
-				struct IGDdatas data;
-
-				int upnpError = 0;
-				UPNPDev *devlist = upnpDiscoverAll(5000,(const char *)0,(const char *)0,0,0,2,&upnpError);
-				if (devlist) {
 
+			sendnewportmappingrequest(&natpmp,NATPMP_PROTOCOL_UDP,localPort,tryPort,(ZT_PORTMAPPER_REFRESH_DELAY * 2) / 1000);
+			myTimeout = OSUtils::now() + 10000;
+			do {
+				fd_set fds;
+				struct timeval timeout;
+				FD_ZERO(&fds);
+				FD_SET(natpmp.s, &fds);
+				getnatpmprequesttimeout(&natpmp, &timeout);
+				select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
+				r = readnatpmpresponseorretry(&natpmp, &response);
+				if (OSUtils::now() >= myTimeout)
+					break;
+			} while (r == NATPMP_TRYAGAIN);
+			closenatpmp(&natpmp);
+			if (r == 0) {
+				publicAddress.setPort(response.pnu.newportmapping.mappedpublicport);
 #ifdef ZT_PORTMAPPER_TRACE
-					{
-						UPNPDev *dev = devlist;
-						while (dev) {
-                            PM_TRACE("PortMapper: found UPnP device at URL '%s': %s" ZT_EOL_S,dev->descURL,dev->st);
-							dev = dev->pNext;
-						}
-					}
+				char paddr[128];
+				PM_TRACE("PortMapper: NAT-PMP: mapped %u to %s" ZT_EOL_S,(unsigned int)localPort,publicAddress.toString(paddr));
 #endif
+				_publish(METHOD_NATPMP,publicAddress);
+				return true;
+			}
+		}
 
-					memset(lanaddr,0,sizeof(lanaddr));
-					memset(externalip,0,sizeof(externalip));
-					memset(&urls,0,sizeof(urls));
-					memset(&data,0,sizeof(data));
-					OSUtils::ztsnprintf(inport,sizeof(inport),"%d",localPort);
+		return false;
+	}
 
-					if ((UPNP_GetValidIGD(devlist,&urls,&data,lanaddr,sizeof(lanaddr)))&&(lanaddr[0])) {
+	bool _upnp()
+	{
+		char lanaddr[4096];
+		char externalip[4096]; // no range checking? so make these buffers larger than any UDP packet a uPnP server could send us as a precaution :P
+		char inport[16];
+		char outport[16];
+		struct UPNPUrls urls;
+		struct IGDdatas data;
+
+		memset(lanaddr,0,sizeof(lanaddr));
+		memset(externalip,0,sizeof(externalip));
+		memset(&urls,0,sizeof(urls));
+		memset(&data,0,sizeof(data));
+		OSUtils::ztsnprintf(inport,sizeof(inport),"%d",localPort);
+
+		// Go straight to the gateway we used last time if it still answers, skipping discovery
+		bool haveIgd = false;
+		if (!cachedUpnpRootDescUrl.empty()) {
+			if ((UPNP_GetIGDFromUrl(cachedUpnpRootDescUrl.c_str(),&urls,&data,lanaddr,sizeof(lanaddr)))&&(lanaddr[0])) {
+				haveIgd = true;
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: UPnP: my LAN IP address: %s" ZT_EOL_S,lanaddr);
+				PM_TRACE("PortMapper: UPnP: reusing cached IGD at %s" ZT_EOL_S,cachedUpnpRootDescUrl.c_str());
 #endif
-						if ((UPNP_GetExternalIPAddress(urls.controlURL,data.first.servicetype,externalip) == UPNPCOMMAND_SUCCESS)&&(externalip[0])) {
+			} else {
+				FreeUPNPUrls(&urls);
+				memset(&urls,0,sizeof(urls));
+				memset(&data,0,sizeof(data));
+				Mutex::Lock cl(cache_l);
+				cachedUpnpRootDescUrl.clear();
+				cachedPort[METHOD_UPNP] = 0;
+			}
+		}
+
+		if (!haveIgd) {
+			int upnpError = 0;
+			UPNPDev *devlist = upnpDiscoverAll(5000,(const char *)0,(const char *)0,0,0,2,&upnpError);
+			if (!devlist) {
 #ifdef ZT_PORTMAPPER_TRACE
-                            PM_TRACE("PortMapper: UPnP: my external IP address: %s" ZT_EOL_S,externalip);
+				PM_TRACE("PortMapper: upnpDiscover failed: %d" ZT_EOL_S,upnpError);
 #endif
+				return false;
+			}
 
-							for(int tries=0;tries<60;++tries) {
-								int tryPort = (int)localPort + tries;
-								if (tryPort >= 65535)
-									tryPort = (tryPort - 65535) + 1025;
-								OSUtils::ztsnprintf(outport,sizeof(outport),"%u",tryPort);
-
-								// First check and see if this port is already mapped to the
-								// same unique name. If so, keep this mapping and don't try
-								// to map again since this can break buggy routers. But don't
-								// fail if this command fails since not all routers support it.
-								{
-									char haveIntClient[128]; // 128 == big enough for all these as per miniupnpc "documentation"
-									char haveIntPort[128];
-									char haveDesc[128];
-									char haveEnabled[128];
-									char haveLeaseDuration[128];
-									memset(haveIntClient,0,sizeof(haveIntClient));
-									memset(haveIntPort,0,sizeof(haveIntPort));
-									memset(haveDesc,0,sizeof(haveDesc));
-									memset(haveEnabled,0,sizeof(haveEnabled));
-									memset(haveLeaseDuration,0,sizeof(haveLeaseDuration));
-									if ((UPNP_GetSpecificPortMappingEntry(urls.controlURL,data.first.servicetype,outport,"UDP",(const char *)0,haveIntClient,haveIntPort,haveDesc,haveEnabled,haveLeaseDuration) == UPNPCOMMAND_SUCCESS)&&(uniqueName == haveDesc)) {
 #ifdef ZT_PORTMAPPER_TRACE
-                                        PM_TRACE("PortMapper: UPnP: reusing previously reserved external port: %s" ZT_EOL_S,outport);
+			{
+				UPNPDev *dev = devlist;
+				while (dev) {
+					PM_TRACE("PortMapper: found UPnP device at URL '%s': %s" ZT_EOL_S,dev->descURL,dev->st);
+					dev = dev->pNext;
+				}
+			}
 #endif
-										Mutex::Lock sl(surface_l);
-										surface.clear();
-										InetAddress tmp(externalip);
-										tmp.setPort(tryPort);
-										surface.push_back(tmp);
-										break;
-									}
-								}
-
-								// Try to map this port
-								int mapResult = 0;
-								if ((mapResult = UPNP_AddPortMapping(urls.controlURL,data.first.servicetype,outport,inport,lanaddr,uniqueName.c_str(),"UDP",(const char *)0,"0")) == UPNPCOMMAND_SUCCESS) {
+
+			haveIgd = ((UPNP_GetValidIGD(devlist,&urls,&data,lanaddr,sizeof(lanaddr)))&&(lanaddr[0]));
+			freeUPNPDevlist(devlist);
+			if (!haveIgd) {
 #ifdef ZT_PORTMAPPER_TRACE
-                                    PM_TRACE("PortMapper: UPnP: reserved external port: %s" ZT_EOL_S,outport);
+				PM_TRACE("PortMapper: UPnP: UPNP_GetValidIGD failed" ZT_EOL_S);
 #endif
-									Mutex::Lock sl(surface_l);
-									surface.clear();
-									InetAddress tmp(externalip);
-									tmp.setPort(tryPort);
-									surface.push_back(tmp);
-									break;
-								} else {
+				FreeUPNPUrls(&urls);
+				return false;
+			}
+			if (urls.rootdescURL) {
+				Mutex::Lock cl(cache_l);
+				cachedUpnpRootDescUrl = urls.rootdescURL;
+			}
+		}
+
 #ifdef ZT_PORTMAPPER_TRACE
-                                    PM_TRACE("PortMapper: UPnP: UPNP_AddPortMapping(%s) failed: %d" ZT_EOL_S,outport,mapResult);
+		PM_TRACE("PortMapper: UPnP: my LAN IP address: %s" ZT_EOL_S,lanaddr);
 #endif
-									Thread::sleep(1000);
-								}
-							}
 
-						} else {
-							mode = 0;
+		bool ok = false;
+		if ((UPNP_GetExternalIPAddress(urls.controlURL,data.first.servicetype,externalip) == UPNPCOMMAND_SUCCESS)&&(externalip[0])) {
 #ifdef ZT_PORTMAPPER_TRACE
-                            PM_TRACE("PortMapper: UPnP: UPNP_GetExternalIPAddress failed, returning to NAT-PMP mode" ZT_EOL_S);
+			PM_TRACE("PortMapper: UPnP: my external IP address: %s" ZT_EOL_S,externalip);
 #endif
-						}
-					} else {
-						mode = 0;
+
+			for(int tries=0;(run)&&(tries<60);++tries) {
+				const int tryPort = _tryPort(METHOD_UPNP,tries);
+				OSUtils::ztsnprintf(outport,sizeof(outport),"%u",tryPort);
+
+				// First check and see if this port is already mapped to the
+				// same unique name. If so, keep this mapping and don't try
+				// to map again since this can break buggy routers. But don't
+				// fail if this command fails since not all routers support it.
+				{
+					char haveIntClient[128]; // 128 == big enough for all these as per miniupnpc "documentation"
+					char haveIntPort[128];
+					char haveDesc[128];
+					char haveEnabled[128];
+					char haveLeaseDuration[128];
+					memset(haveIntClient,0,sizeof(haveIntClient));
+					memset(haveIntPort,0,sizeof(haveIntPort));
+					memset(haveDesc,0,sizeof(haveDesc));
+					memset(haveEnabled,0,sizeof(haveEnabled));
+					memset(haveLeaseDuration,0,sizeof(haveLeaseDuration));
+					if ((UPNP_GetSpecificPortMappingEntry(urls.controlURL,data.first.servicetype,outport,"UDP",(const char *)0,haveIntClient,haveIntPort,haveDesc,haveEnabled,haveLeaseDuration) == UPNPCOMMAND_SUCCESS)&&(uniqueName == haveDesc)) {
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: UPnP: UPNP_GetValidIGD failed, returning to NAT-PMP mode" ZT_EOL_S);
+						PM_TRACE("PortMapper: UPnP: reusing previously reserved external port: %s" ZT_EOL_S,outport);
 #endif
+						InetAddress tmp(externalip);
+						tmp.setPort(tryPort);
+						_publish(METHOD_UPNP,tmp);
+						ok = true;
+						break;
 					}
+				}
 
-					freeUPNPDevlist(devlist);
-
+				// Try to map this port
+				int mapResult = 0;
+				if ((mapResult = UPNP_AddPortMapping(urls.controlURL,data.first.servicetype,outport,inport,lanaddr,uniqueName.c_str(),"UDP",(const char *)0,"0")) == UPNPCOMMAND_SUCCESS) {
+#ifdef ZT_PORTMAPPER_TRACE
+					PM_TRACE("PortMapper: UPnP: reserved external port: %s" ZT_EOL_S,outport);
+#endif
+					InetAddress tmp(externalip);
+					tmp.setPort(tryPort);
+					_publish(METHOD_UPNP,tmp);
+					ok = true;
+					break;
 				} else {
-					mode = 0;
 #ifdef ZT_PORTMAPPER_TRACE
-                    PM_TRACE("PortMapper: upnpDiscover failed, returning to NAT-PMP mode: %d" ZT_EOL_S,upnpError);
+					PM_TRACE("PortMapper: UPnP: UPNP_AddPortMapping(%s) failed: %d" ZT_EOL_S,outport,mapResult);
 #endif
+					Thread::sleep(1000);
 				}
 			}
-			// ---------------------------------------------------------------------
-
+		} else {
 #ifdef ZT_PORTMAPPER_TRACE
-            PM_TRACE("UPNPClient: rescanning in %d ms" ZT_EOL_S,ZT_PORTMAPPER_REFRESH_DELAY);
+			PM_TRACE("PortMapper: UPnP: UPNP_GetExternalIPAddress failed" ZT_EOL_S);
 #endif
-			Thread::sleep(ZT_PORTMAPPER_REFRESH_DELAY);
 		}
 
-		delete this;
+		FreeUPNPUrls(&urls);
+		return ok;
 	}
 
-	volatile bool run;
-	int localPort;
-	std::string uniqueName;
+	Mutex cache_l;
+	int _refs;
+};
 
-	Mutex surface_l;
-	std::vector<InetAddress> surface;
+// Runs one mapping method of a PortMapperImpl in its own thread
+class PortMapperThread
+{
+public:
+	PortMapperThread(PortMapperImpl *impl,const PortMapperImpl::Method method) :
+		_impl(impl),
+		_method(method) {}
+
+	void threadMain()
+		throw()
+	{
+		_impl->threadMain(_method);
+		delete this;
+	}
+
+private:
+	PortMapperImpl *const _impl;
+	const PortMapperImpl::Method _method;
 };
 
-PortMapper::PortMapper(int localUdpPortToMap,const char *uniqueName)
+PortMapper::PortMapper(int localUdpPortToMap,const char *uniqueName,const char *cachePath,void (*changed)(void *),void *arg)
 {
-	_impl = new PortMapperImpl(localUdpPortToMap,uniqueName);
-	Thread::start(_impl);
+	_impl = new PortMapperImpl(localUdpPortToMap,uniqueName,cachePath,changed,arg);
+	Thread::start(new PortMapperThread(_impl,PortMapperImpl::METHOD_NATPMP));
+	Thread::start(new PortMapperThread(_impl,PortMapperImpl::METHOD_UPNP));
 }
 
 PortMapper::~PortMapper()
 {
-	_impl->run = false;
+	_impl->stop();
 }
 
 std::vector<InetAddress> PortMapper::get() const
 {
-	Mutex::Lock _l(_impl->surface_l);
-	return _impl->surface;
+	return _impl->get();
 }
 
 } // namespace ZeroTier
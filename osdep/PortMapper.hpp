@@ -41,6 +41,11 @@
  */
 #define ZT_PORTMAPPER_REFRESH_DELAY 300000
 
+/**
+ * Delay before retrying a failed mapping attempt, doubled on each failure up to the refresh delay
+ */
+#define ZT_PORTMAPPER_RETRY_DELAY_MIN 5000
+
 namespace ZeroTier {
 
 class PortMapperImpl;
@@ -56,10 +61,21 @@ public:
 	/**
 	 * Create and start port mapper service
 	 *
+	 * NAT-PMP and UPnP are tried at the same time. If a cache path is given
+	 * the gateway and external port are remembered there, so a restart asks
+	 * the same gateway for the same port before falling back to discovery.
+	 *
+	 * The changed function is called from a port mapper thread whenever an
+	 * external mapping is acquired or changes. It is never called once the
+	 * destructor has returned.
+	 *
 	 * @param localUdpPortToMap Port we want visible to the outside world
 	 * @param name Unique name of this endpoint (based on ZeroTier address)
+	 * @param cachePath File to remember learned mappings in, or NULL for none
+	 * @param changed Function to call when mappings change, or NULL for none
+	 * @param arg Argument for changed function
 	 */
-	PortMapper(int localUdpPortToMap,const char *uniqueName);
+	PortMapper(int localUdpPortToMap,const char *uniqueName,const char *cachePath = (const char *)0,void (*changed)(void *) = (void (*)(void *))0,void *arg = (void *)0);
 
 	~PortMapper();
 
@@ -0,0 +1,154 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_RINGBUFFER_HPP
+#define ZT_RINGBUFFER_HPP
+
+#include <string.h>
+
+#include "../node/NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Bounded FIFO byte queue for stream socket output
+ *
+ * Writes append and sends consume from the front, both in constant time
+ * per byte with no shifting of queued data. Storage is allocated as data
+ * arrives and doubles up to the maximum size given at construction, so an
+ * idle connection costs nothing. Queued data occupies at most two
+ * contiguous regions, which can be handed to writev() together.
+ *
+ * This is not thread safe.
+ */
+class RingBuffer : NonCopyable
+{
+public:
+	/**
+	 * @param maxSize Maximum number of bytes that can be queued
+	 */
+	RingBuffer(const unsigned long maxSize) :
+		_buf((char *)0),
+		_cap(0),
+		_head(0),
+		_size(0),
+		_max(maxSize)
+	{
+	}
+
+	~RingBuffer() { delete [] _buf; }
+
+	/**
+	 * Append data if there is room for all of it
+	 *
+	 * @param data Data to append
+	 * @param len Length of data
+	 * @return False if this would exceed the maximum size, in which case nothing is appended
+	 */
+	inline bool write(const void *data,const unsigned long len)
+	{
+		if (!len)
+			return true;
+		if (len > (_max - _size))
+			return false;
+		if ((_size + len) > _cap)
+			_grow(_size + len);
+		const unsigned long tail = (_head + _size) & (_cap - 1);
+		const unsigned long first = ((_cap - tail) < len) ? (_cap - tail) : len;
+		memcpy(_buf + tail,data,first);
+		memcpy(_buf,reinterpret_cast<const char *>(data) + first,len - first);
+		_size += len;
+		return true;
+	}
+
+	/**
+	 * Get queued data without consuming it
+	 *
+	 * @param d1 Set to first region of queued data
+	 * @param l1 Set to length of first region
+	 * @param d2 Set to second region, which follows the first
+	 * @param l2 Set to length of second region, or 0 if all queued data is contiguous
+	 */
+	inline void peek(const void *&d1,unsigned long &l1,const void *&d2,unsigned long &l2) const
+	{
+		d1 = _buf + _head;
+		l1 = ((_cap - _head) < _size) ? (_cap - _head) : _size;
+		d2 = _buf;
+		l2 = _size - l1;
+	}
+
+	/**
+	 * Remove data from the front, e.g. after it's been sent
+	 *
+	 * @param len Number of bytes to remove (must not exceed size())
+	 */
+	inline void consume(const unsigned long len)
+	{
+		_size -= len;
+		_head = (_size) ? ((_head + len) & (_cap - 1)) : 0;
+	}
+
+	inline void clear() { _head = 0; _size = 0; }
+
+	/**
+	 * @param maxSize New maximum size (data already queued is kept even if it exceeds this)
+	 */
+	inline void setMaxSize(const unsigned long maxSize) { _max = (maxSize > _size) ? maxSize : _size; }
+
+	inline unsigned long size() const { return _size; }
+	inline unsigned long available() const { return (_max - _size); }
+	inline bool empty() const { return (_size == 0); }
+
+private:
+	inline void _grow(const unsigned long needed)
+	{
+		unsigned long c = (_cap) ? _cap : 4096;
+		while (c < needed)
+			c <<= 1;
+		char *const b = new char[c];
+		const void *d1,*d2;
+		unsigned long l1,l2;
+		peek(d1,l1,d2,l2);
+		if (l1)
+			memcpy(b,d1,l1);
+		if (l2)
+			memcpy(b + l1,d2,l2);
+		delete [] _buf;
+		_buf = b;
+		_cap = c;
+		_head = 0;
+	}
+
+	char *_buf;
+	unsigned long _cap; // zero or a power of two
+	unsigned long _head;
+	unsigned long _size;
+	unsigned long _max;
+};
+
+} // namespace ZeroTier
+
+#endif
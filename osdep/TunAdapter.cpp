@@ -0,0 +1,345 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "../node/Address.hpp"
+#include "TunAdapter.hpp"
+#include "OSUtils.hpp"
+
+namespace ZeroTier {
+
+static inline uint16_t _icmp6Checksum(const uint8_t *ip6)
+{
+	// Pseudo-header is source, destination, upper layer length, and next header (58)
+	const unsigned int plen = ((unsigned int)ip6[4] << 8) | (unsigned int)ip6[5];
+	uint32_t sum = 58 + plen;
+	for(unsigned int i=8;i<40;i+=2)
+		sum += ((uint32_t)ip6[i] << 8) | (uint32_t)ip6[i + 1];
+	const uint8_t *p = ip6 + 40;
+	for(unsigned int i=0;i<plen;i+=2)
+		sum += ((uint32_t)p[i] << 8) | (uint32_t)(((i + 1) < plen) ? p[i + 1] : 0);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+// Builds a 72-byte neighbor solicitation or advertisement with a link-layer address option
+static inline unsigned int _makeNeighborMessage(uint8_t *m,const uint8_t type,const uint8_t flags,const uint8_t *src6,const uint8_t *dest6,const uint8_t *target6,const MAC &mac)
+{
+	memset(m,0,72);
+	m[0] = 0x60;
+	m[5] = 32; // payload length
+	m[6] = 58; // ICMPv6
+	m[7] = 255; // hop limit
+	memcpy(m + 8,src6,16);
+	memcpy(m + 24,dest6,16);
+	m[40] = type;
+	m[44] = flags;
+	memcpy(m + 48,target6,16);
+	m[64] = (type == 135) ? 1 : 2; // source or target link-layer address
+	m[65] = 1;
+	mac.copyTo(m + 66,6);
+	const uint16_t cs = _icmp6Checksum(m);
+	m[42] = (uint8_t)(cs >> 8);
+	m[43] = (uint8_t)cs;
+	return 72;
+}
+
+TunAdapter::TunAdapter(const MAC &mac,uint64_t nwid) :
+	_mac(mac),
+	_nwid(nwid),
+	_neighbors(256),
+	_lastCleaned(OSUtils::now())
+{
+}
+
+void TunAdapter::addLocal(const InetAddress &ip)
+{
+	Mutex::Lock _l(_lock);
+	for(std::vector<InetAddress>::iterator i(_local.begin());i!=_local.end();++i) {
+		if (i->ipsEqual(ip)) {
+			*i = ip;
+			return;
+		}
+	}
+	_local.push_back(ip);
+	if (ip.isV4()) {
+		uint32_t a;
+		memcpy(&a,ip.rawIpData(),4);
+		_arp.addLocal(a,_mac);
+	}
+}
+
+void TunAdapter::removeLocal(const InetAddress &ip)
+{
+	Mutex::Lock _l(_lock);
+	for(std::vector<InetAddress>::iterator i(_local.begin());i!=_local.end();++i) {
+		if (i->ipsEqual(ip)) {
+			_local.erase(i);
+			if (ip.isV4()) {
+				uint32_t a;
+				memcpy(&a,ip.rawIpData(),4);
+				_arp.remove(a);
+			}
+			return;
+		}
+	}
+}
+
+void TunAdapter::setRoutes(const ZT_VirtualNetworkRoute *routes,unsigned int count)
+{
+	Mutex::Lock _l(_lock);
+	_routes.clear();
+	for(unsigned int i=0;i<count;++i) {
+		const InetAddress *const target = reinterpret_cast<const InetAddress *>(&(routes[i].target));
+		const InetAddress *const via = reinterpret_cast<const InetAddress *>(&(routes[i].via));
+		if ((*via)&&(target->ss_family == via->ss_family))
+			_routes.push_back(std::pair<InetAddress,InetAddress>(*target,via->ipOnly()));
+	}
+}
+
+bool TunAdapter::outbound(const uint8_t *packet,unsigned int len,MAC &to,unsigned int &etherType,uint8_t *query,unsigned int &queryLen,MAC &queryDest,unsigned int &queryEtherType)
+{
+	queryLen = 0;
+	if (len < 20)
+		return false;
+	const uint64_t now = OSUtils::now();
+
+	if ((packet[0] >> 4) == 4) {
+		etherType = ZT_ETHERTYPE_IPV4;
+		const uint8_t *const d = packet + 16;
+		if ((d[0] & 0xf0) == 0xe0) {
+			to = MAC(0x01,0x00,0x5e,d[1] & 0x7f,d[2],d[3]);
+			return true;
+		}
+		const InetAddress dest(d,4,0);
+		Mutex::Lock _l(_lock);
+		if ((d[0] == 0xff)&&(d[1] == 0xff)&&(d[2] == 0xff)&&(d[3] == 0xff)) {
+			to = MAC(0xffffffffffffULL);
+			return true;
+		}
+		for(std::vector<InetAddress>::const_iterator i(_local.begin());i!=_local.end();++i) {
+			if ((i->isV4())&&(i->netmaskBits() < 31)&&(i->broadcast().ipsEqual(dest))) {
+				to = MAC(0xffffffffffffULL);
+				return true;
+			}
+		}
+
+		const InetAddress nh(_nextHop(dest));
+		const _Neighbor *const n = _neighbors.get(nh);
+		if ((n)&&(n->mac)&&((now - n->lastSeen) < ZT_ARP_EXPIRE)) {
+			to = n->mac;
+			return true;
+		}
+
+		const InetAddress *const local = _localFor(nh);
+		if (!local)
+			return false;
+		uint32_t lip,tip;
+		memcpy(&lip,local->rawIpData(),4);
+		memcpy(&tip,nh.rawIpData(),4);
+		to = _arp.query(_mac,lip,tip,query,queryLen,queryDest);
+		queryEtherType = ZT_ETHERTYPE_ARP;
+		return (bool)to;
+	} else if (((packet[0] >> 4) == 6)&&(len >= 40)) {
+		etherType = ZT_ETHERTYPE_IPV6;
+		const uint8_t *const d = packet + 24;
+		if (d[0] == 0xff) {
+			to = MAC(0x33,0x33,d[12],d[13],d[14],d[15]);
+			return true;
+		}
+		const InetAddress dest(d,16,0);
+		Mutex::Lock _l(_lock);
+		const InetAddress nh(_nextHop(dest));
+		const uint8_t *const h = reinterpret_cast<const uint8_t *>(nh.rawIpData());
+
+		// RFC4193 and 6PLANE addresses carry the member's ZeroTier address
+		if ((h[0] == 0xfd)&&(h[9] == 0x99)&&(h[10] == 0x93)) {
+			uint64_t nw = 0;
+			for(unsigned int i=1;i<9;++i)
+				nw = (nw << 8) | (uint64_t)h[i];
+			if (nw == _nwid) {
+				to.fromAddress(Address(h + 11,ZT_ADDRESS_LENGTH),_nwid);
+				return true;
+			}
+		} else if (h[0] == 0xfc) {
+			const uint32_t nw = (uint32_t)(_nwid ^ (_nwid >> 32));
+			if ((((uint32_t)h[1] << 24) | ((uint32_t)h[2] << 16) | ((uint32_t)h[3] << 8) | (uint32_t)h[4]) == nw) {
+				to.fromAddress(Address(h + 5,ZT_ADDRESS_LENGTH),_nwid);
+				return true;
+			}
+		}
+
+		_Neighbor *n = _neighbors.get(nh);
+		if ((n)&&(n->mac)&&((now - n->lastSeen) < ZT_ARP_EXPIRE)) {
+			to = n->mac;
+			return true;
+		}
+		if ((!n)&&(_neighbors.size() < ZT_TUNADAPTER_MAX_NEIGHBORS))
+			n = &(_neighbors[nh]);
+
+		const InetAddress *const local = _localFor(nh);
+		if ((n)&&(local)&&((now - n->lastQuerySent) >= ZT_ARP_QUERY_INTERVAL)) {
+			n->lastQuerySent = now;
+			uint8_t sn[16];
+			memset(sn,0,sizeof(sn));
+			sn[0] = 0xff; sn[1] = 0x02; sn[11] = 0x01; sn[12] = 0xff;
+			sn[13] = h[13]; sn[14] = h[14]; sn[15] = h[15];
+			queryLen = _makeNeighborMessage(query,135,0,reinterpret_cast<const uint8_t *>(local->rawIpData()),sn,h,_mac);
+			queryDest = MAC(0x33,0x33,0xff,h[13],h[14],h[15]);
+			queryEtherType = ZT_ETHERTYPE_IPV6;
+		}
+		return false;
+	}
+
+	return false;
+}
+
+bool TunAdapter::inbound(const MAC &from,unsigned int etherType,const void *data,unsigned int len,uint8_t *response,unsigned int &responseLen,MAC &responseDest,unsigned int &responseEtherType)
+{
+	const uint8_t *const p = reinterpret_cast<const uint8_t *>(data);
+	const uint64_t now = OSUtils::now();
+	responseLen = 0;
+
+	switch(etherType) {
+		case ZT_ETHERTYPE_ARP: {
+			Mutex::Lock _l(_lock);
+			_arp.processIncomingArp(data,len,response,responseLen,responseDest);
+			responseEtherType = ZT_ETHERTYPE_ARP;
+		}	return false;
+
+		case ZT_ETHERTYPE_IPV4:
+			if ((len < 20)||((p[0] >> 4) != 4))
+				return false;
+			if (!from.isMulticast()) {
+				Mutex::Lock _l(_lock);
+				_learn(InetAddress(p + 12,4,0),from,now);
+			}
+			return true;
+
+		case ZT_ETHERTYPE_IPV6: {
+			if ((len < 40)||((p[0] >> 4) != 6))
+				return false;
+			Mutex::Lock _l(_lock);
+			if ((p[6] == 58)&&(len >= 64)) {
+				switch(p[40]) {
+					case 133: // router solicitation
+					case 134: // router advertisement
+					case 137: // redirect
+						return false;
+					case 135: { // neighbor solicitation
+						const InetAddress target(p + 48,16,0);
+						for(std::vector<InetAddress>::const_iterator i(_local.begin());i!=_local.end();++i) {
+							if (i->ipsEqual(target)) {
+								static const uint8_t allNodes[16] = { 0xff,0x02,0,0,0,0,0,0,0,0,0,0,0,0,0,1 };
+								bool unspecified = true;
+								for(unsigned int k=8;k<24;++k) {
+									if (p[k]) {
+										unspecified = false;
+										break;
+									}
+								}
+								responseLen = _makeNeighborMessage(response,136,(unspecified) ? 0x20 : 0x60,p + 48,(unspecified) ? allNodes : (p + 8),p + 48,_mac);
+								responseDest = from;
+								responseEtherType = ZT_ETHERTYPE_IPV6;
+								break;
+							}
+						}
+					}	return false;
+					case 136: { // neighbor advertisement
+						MAC tll(from);
+						if ((len >= 72)&&(p[64] == 2)&&(p[65] == 1))
+							tll.setTo(p + 66,6);
+						if (!tll.isMulticast())
+							_learn(InetAddress(p + 48,16,0),tll,now);
+					}	return false;
+				}
+			}
+			if ((!from.isMulticast())&&(p[8] != 0xff))
+				_learn(InetAddress(p + 8,16,0),from,now);
+		}	return true;
+	}
+
+	return false;
+}
+
+InetAddress TunAdapter::_nextHop(const InetAddress &dest) const
+{
+	for(std::vector<InetAddress>::const_iterator i(_local.begin());i!=_local.end();++i) {
+		if (i->containsAddress(dest))
+			return dest;
+	}
+	const std::pair<InetAddress,InetAddress> *best = (const std::pair<InetAddress,InetAddress> *)0;
+	for(std::vector< std::pair<InetAddress,InetAddress> >::const_iterator r(_routes.begin());r!=_routes.end();++r) {
+		if ((r->first.containsAddress(dest))&&((!best)||(r->first.netmaskBits() > best->first.netmaskBits())))
+			best = &(*r);
+	}
+	return (best) ? best->second : dest;
+}
+
+const InetAddress *TunAdapter::_localFor(const InetAddress &dest) const
+{
+	const InetAddress *any = (const InetAddress *)0;
+	for(std::vector<InetAddress>::const_iterator i(_local.begin());i!=_local.end();++i) {
+		if (i->ss_family == dest.ss_family) {
+			if (i->containsAddress(dest))
+				return &(*i);
+			if (!any)
+				any = &(*i);
+		}
+	}
+	return any;
+}
+
+void TunAdapter::_learn(const InetAddress &ip,const MAC &mac,uint64_t now)
+{
+	if ((now - _lastCleaned) >= ZT_ARP_EXPIRE) {
+		_lastCleaned = now;
+		Hashtable< InetAddress,_Neighbor >::Iterator i(_neighbors);
+		InetAddress *k = (InetAddress *)0;
+		_Neighbor *v = (_Neighbor *)0;
+		while (i.next(k,v)) {
+			if ((now - std::max(v->lastSeen,v->lastQuerySent)) >= ZT_ARP_EXPIRE)
+				_neighbors.erase(*k);
+		}
+	}
+
+	_Neighbor *n = _neighbors.get(ip);
+	if ((!n)&&(_neighbors.size() < ZT_TUNADAPTER_MAX_NEIGHBORS))
+		n = &(_neighbors[ip]);
+	if (n) {
+		n->mac = mac;
+		n->lastSeen = now;
+	}
+}
+
+} // namespace ZeroTier
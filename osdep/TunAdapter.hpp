@@ -0,0 +1,160 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_TUNADAPTER_HPP
+#define ZT_TUNADAPTER_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <utility>
+
+#include "../node/Constants.hpp"
+#include "../node/Hashtable.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/MAC.hpp"
+#include "../node/Mutex.hpp"
+
+#include "Arp.hpp"
+
+/**
+ * Size of buffers for generated ARP and neighbor discovery frames
+ */
+#define ZT_TUNADAPTER_BUF_LENGTH 128
+
+/**
+ * Maximum number of neighbors learned from traffic
+ */
+#define ZT_TUNADAPTER_MAX_NEIGHBORS 4096
+
+namespace ZeroTier {
+
+/**
+ * Ethernet framing for taps that use an L3 (TUN) device
+ *
+ * A TUN device exchanges bare IP packets with the OS, so the host does no
+ * ARP or neighbor discovery and never sees Ethernet headers. The network
+ * is still Ethernet, so this supplies what the OS would have: destination
+ * MACs for outgoing packets and answers to ARP and NDP queries for our own
+ * addresses from the network.
+ *
+ * Destinations are resolved, in order, from IPv6 addresses that embed a
+ * ZeroTier address (RFC4193 and 6PLANE), from a table learned from the
+ * source of traffic received, and finally by ARP or a neighbor solicitation
+ * sent to the network. The node usually answers those itself from the
+ * certificates of ownership it holds. Packets to an off-link destination
+ * are sent to the gateway of the most specific route covering it.
+ *
+ * This class is thread safe.
+ */
+class TunAdapter
+{
+public:
+	TunAdapter(const MAC &mac,uint64_t nwid);
+
+	/**
+	 * Add an address we answer ARP and neighbor solicitations for
+	 *
+	 * @param ip IP address (netmask bits in port are used to find the link for resolution)
+	 */
+	void addLocal(const InetAddress &ip);
+
+	/**
+	 * @param ip IP address to stop answering for
+	 */
+	void removeLocal(const InetAddress &ip);
+
+	/**
+	 * Set managed routes so off-link destinations resolve to their gateway
+	 *
+	 * @param routes Routes (those without a via are ignored)
+	 * @param count Number of routes
+	 */
+	void setRoutes(const ZT_VirtualNetworkRoute *routes,unsigned int count);
+
+	/**
+	 * Find the Ethernet destination for an IP packet read from the OS
+	 *
+	 * If this returns false the packet should be dropped. Either way a query
+	 * may have been generated, and should be sent if queryLen is non-zero.
+	 *
+	 * @param packet IP packet
+	 * @param len Length of packet
+	 * @param to Result: destination MAC
+	 * @param etherType Result: ethernet type of packet
+	 * @param query Buffer of at least ZT_TUNADAPTER_BUF_LENGTH for a generated ARP or neighbor solicitation
+	 * @param queryLen Result: length of query or 0 if none
+	 * @param queryDest Result: destination MAC of query
+	 * @param queryEtherType Result: ethernet type of query
+	 * @return True if packet should be sent to 'to'
+	 */
+	bool outbound(const uint8_t *packet,unsigned int len,MAC &to,unsigned int &etherType,uint8_t *query,unsigned int &queryLen,MAC &queryDest,unsigned int &queryEtherType);
+
+	/**
+	 * Handle a frame from the network
+	 *
+	 * ARP and neighbor discovery are consumed here and may generate a reply,
+	 * to be sent if responseLen is non-zero.
+	 *
+	 * @param from Source MAC
+	 * @param etherType Ethernet type
+	 * @param data Frame payload
+	 * @param len Length of payload
+	 * @param response Buffer of at least ZT_TUNADAPTER_BUF_LENGTH for a generated reply
+	 * @param responseLen Result: length of reply or 0 if none
+	 * @param responseDest Result: destination MAC of reply
+	 * @param responseEtherType Result: ethernet type of reply
+	 * @return True if payload is an IP packet that should be given to the OS
+	 */
+	bool inbound(const MAC &from,unsigned int etherType,const void *data,unsigned int len,uint8_t *response,unsigned int &responseLen,MAC &responseDest,unsigned int &responseEtherType);
+
+private:
+	struct _Neighbor
+	{
+		_Neighbor() : mac(),lastSeen(0),lastQuerySent(0) {}
+		MAC mac;
+		uint64_t lastSeen;
+		uint64_t lastQuerySent;
+	};
+
+	InetAddress _nextHop(const InetAddress &dest) const;
+	const InetAddress *_localFor(const InetAddress &dest) const;
+	void _learn(const InetAddress &ip,const MAC &mac,uint64_t now);
+
+	const MAC _mac;
+	const uint64_t _nwid;
+	std::vector<InetAddress> _local;
+	std::vector< std::pair<InetAddress,InetAddress> > _routes; // target, via
+	Hashtable< InetAddress,_Neighbor > _neighbors;
+	Arp _arp;
+	uint64_t _lastCleaned;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "../node/Utils.hpp"
+#include "UserspaceStack.hpp"
+#include "OSUtils.hpp"
+
+namespace ZeroTier {
+
+static inline uint32_t _csumAdd(uint32_t sum,const uint8_t *p,const unsigned int len)
+{
+	for(unsigned int i=0;i<len;i+=2)
+		sum += ((uint32_t)p[i] << 8) | (uint32_t)(((i + 1) < len) ? p[i + 1] : 0);
+	return sum;
+}
+
+static inline uint16_t _csumFinish(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static inline void _put16(uint8_t *p,const unsigned int v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static inline unsigned int _get16(const uint8_t *p) { return (((unsigned int)p[0] << 8) | (unsigned int)p[1]); }
+
+// Checksum of an upper layer message, including the IPv4 or IPv6 pseudo-header
+static inline uint16_t _l4Checksum(const uint8_t *ip,const bool v6,const unsigned int proto,const uint8_t *l4,const unsigned int l4len)
+{
+	uint32_t sum = proto + l4len;
+	sum = (v6) ? _csumAdd(sum,ip + 8,32) : _csumAdd(sum,ip + 12,8);
+	return _csumFinish(_csumAdd(sum,l4,l4len));
+}
+
+UserspaceStack::UserspaceStack(
+	const char *homePath,
+	const MAC &mac,
+	unsigned int mtu,
+	unsigned int metric,
+	uint64_t nwid,
+	const char *friendlyName,
+	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+	void *arg) :
+	_handler(handler),
+	_arg(arg),
+	_nwid(nwid),
+	_mac(mac),
+	_dev("zt_user_"),
+	_mtu(mtu),
+	_enabled(true),
+	_tun(mac,nwid),
+	_nextEphemeralPort(ZT_USERSPACE_STACK_EPHEMERAL_PORT_MIN),
+	_run(true)
+{
+	char tmp[32];
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+	_dev.append(tmp);
+	_thread = Thread::start(this);
+}
+
+UserspaceStack::~UserspaceStack()
+{
+	{
+		std::lock_guard<std::mutex> l(_replies_m);
+		_run = false;
+		_replies_c.notify_all();
+	}
+	Thread::join(_thread);
+	for(std::deque<_Reply *>::iterator r(_replies.begin());r!=_replies.end();++r)
+		delete *r;
+}
+
+bool UserspaceStack::addIp(const InetAddress &ip)
+{
+	if ((!ip.isV4())&&(!ip.isV6()))
+		return false;
+	Mutex::Lock _l(_ips_m);
+	if (std::find(_ips.begin(),_ips.end(),ip) == _ips.end()) {
+		_ips.push_back(ip);
+		std::sort(_ips.begin(),_ips.end());
+		_tun.addLocal(ip);
+	}
+	return true;
+}
+
+bool UserspaceStack::removeIp(const InetAddress &ip)
+{
+	Mutex::Lock _l(_ips_m);
+	std::vector<InetAddress>::iterator i(std::find(_ips.begin(),_ips.end(),ip));
+	if (i == _ips.end())
+		return false;
+	_ips.erase(i);
+	_tun.removeLocal(ip);
+	return true;
+}
+
+std::vector<InetAddress> UserspaceStack::ips() const
+{
+	Mutex::Lock _l(_ips_m);
+	return _ips;
+}
+
+void UserspaceStack::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	if ((!_enabled)||(len > ZT_MAX_MTU))
+		return;
+	uint8_t response[ZT_TUNADAPTER_BUF_LENGTH];
+	unsigned int responseLen = 0,responseEtherType = 0;
+	MAC responseDest;
+	if (!_tun.inbound(from,etherType,data,len,response,responseLen,responseDest,responseEtherType)) {
+		if (responseLen) {
+			_Reply *const r = new _Reply();
+			r->to = responseDest;
+			r->etherType = responseEtherType;
+			r->len = responseLen;
+			memcpy(r->data,response,responseLen);
+			_postReply(r);
+		}
+		return;
+	}
+	_inbound(reinterpret_cast<const uint8_t *>(data),len);
+}
+
+void UserspaceStack::scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed)
+{
+	std::vector<MulticastGroup> newGroups;
+	Mutex::Lock _l(_ips_m);
+
+	// There is no OS to join groups, so just listen for address resolution
+	for(std::vector<InetAddress>::const_iterator ip(_ips.begin());ip!=_ips.end();++ip)
+		newGroups.push_back(MulticastGroup::deriveMulticastGroupForAddressResolution(*ip));
+	std::sort(newGroups.begin(),newGroups.end());
+	newGroups.erase(std::unique(newGroups.begin(),newGroups.end()),newGroups.end());
+
+	for(std::vector<MulticastGroup>::iterator m(newGroups.begin());m!=newGroups.end();++m) {
+		if (!std::binary_search(_multicastGroups.begin(),_multicastGroups.end(),*m))
+			added.push_back(*m);
+	}
+	for(std::vector<MulticastGroup>::iterator m(_multicastGroups.begin());m!=_multicastGroups.end();++m) {
+		if (!std::binary_search(newGroups.begin(),newGroups.end(),*m))
+			removed.push_back(*m);
+	}
+
+	_multicastGroups.swap(newGroups);
+}
+
+unsigned int UserspaceStack::udpBind(unsigned int port)
+{
+	std::lock_guard<std::mutex> l(_ports_m);
+	if (!port) {
+		for(unsigned int k=0;k<(65536 - ZT_USERSPACE_STACK_EPHEMERAL_PORT_MIN);++k) {
+			const unsigned int p = _nextEphemeralPort;
+			if (++_nextEphemeralPort > 65535)
+				_nextEphemeralPort = ZT_USERSPACE_STACK_EPHEMERAL_PORT_MIN;
+			if (_ports.find(p) == _ports.end()) {
+				port = p;
+				break;
+			}
+		}
+		if (!port)
+			return 0;
+	} else if ((port > 65535)||(_ports.find(port) != _ports.end())) {
+		return 0;
+	}
+	_ports[port];
+	return port;
+}
+
+void UserspaceStack::udpClose(unsigned int port)
+{
+	std::lock_guard<std::mutex> l(_ports_m);
+	_ports.erase(port);
+	_ports_c.notify_all();
+}
+
+bool UserspaceStack::udpSend(unsigned int port,const InetAddress &to,const void *data,unsigned int len)
+{
+	const bool v6 = to.isV6();
+	if ((!_enabled)||((!v6)&&(!to.isV4()))||(!port)||(port > 65535)||(!to.port()))
+		return false;
+	const unsigned int hlen = (v6) ? 40 : 20;
+	if ((hlen + 8 + len) > std::min((unsigned int)_mtu,(unsigned int)ZT_MAX_MTU))
+		return false;
+
+	InetAddress src;
+	{
+		Mutex::Lock _l(_ips_m);
+		for(std::vector<InetAddress>::const_iterator ip(_ips.begin());ip!=_ips.end();++ip) {
+			if (ip->ss_family == to.ss_family) {
+				if (ip->containsAddress(to)) {
+					src = *ip;
+					break;
+				} else if (!src) {
+					src = *ip;
+				}
+			}
+		}
+	}
+	if (!src)
+		return false;
+
+	uint8_t pkt[ZT_MAX_MTU];
+	memset(pkt,0,hlen + 8);
+	if (v6) {
+		pkt[0] = 0x60;
+		_put16(pkt + 4,8 + len);
+		pkt[6] = 17;
+		pkt[7] = 64;
+		memcpy(pkt + 8,src.rawIpData(),16);
+		memcpy(pkt + 24,to.rawIpData(),16);
+	} else {
+		pkt[0] = 0x45;
+		_put16(pkt + 2,20 + 8 + len);
+		pkt[6] = 0x40; // don't fragment, so the ID can stay zero
+		pkt[8] = 64;
+		pkt[9] = 17;
+		memcpy(pkt + 12,src.rawIpData(),4);
+		memcpy(pkt + 16,to.rawIpData(),4);
+		_put16(pkt + 10,_csumFinish(_csumAdd(0,pkt,20)));
+	}
+	uint8_t *const udp = pkt + hlen;
+	_put16(udp,port);
+	_put16(udp + 2,to.port());
+	_put16(udp + 4,8 + len);
+	memcpy(udp + 8,data,len);
+	uint16_t cs = _l4Checksum(pkt,v6,17,udp,8 + len);
+	if (!cs)
+		cs = 0xffff; // zero means no checksum
+	_put16(udp + 6,cs);
+
+	return _sendIp(pkt,hlen + 8 + len);
+}
+
+int UserspaceStack::udpReceive(unsigned int port,InetAddress &from,void *buf,unsigned int len,unsigned long timeout)
+{
+	const std::chrono::steady_clock::time_point deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout));
+	std::unique_lock<std::mutex> l(_ports_m);
+	bool timedOut = (timeout == 0);
+	for(;;) {
+		std::map<unsigned int,_Port>::iterator p(_ports.find(port));
+		if (p == _ports.end())
+			return -1;
+		if (!p->second.q.empty()) {
+			_Datagram &d = p->second.q.front();
+			const unsigned int n = std::min(len,(unsigned int)d.data.length());
+			memcpy(buf,d.data.data(),n);
+			from = d.from;
+			p->second.q.pop_front();
+			return (int)n;
+		}
+		if (timedOut)
+			return -1;
+		timedOut = (_ports_c.wait_until(l,deadline) == std::cv_status::timeout);
+	}
+}
+
+void UserspaceStack::threadMain()
+	throw()
+{
+	for(;;) {
+		_Reply *r;
+		{
+			std::unique_lock<std::mutex> l(_replies_m);
+			while ((_run)&&(_replies.empty()))
+				_replies_c.wait(l);
+			if (!_run)
+				return;
+			r = _replies.front();
+			_replies.pop_front();
+		}
+		try {
+			if (r->etherType)
+				_handler(_arg,(void *)0,_nwid,_mac,r->to,r->etherType,0,r->data,r->len);
+			else _sendIp(r->data,r->len);
+		} catch ( ... ) {}
+		delete r;
+	}
+}
+
+bool UserspaceStack::_isLocal(const uint8_t *ip,const bool v6) const
+{
+	Mutex::Lock _l(_ips_m);
+	for(std::vector<InetAddress>::const_iterator i(_ips.begin());i!=_ips.end();++i) {
+		if ((v6) ? ((i->isV6())&&(!memcmp(i->rawIpData(),ip,16))) : ((i->isV4())&&(!memcmp(i->rawIpData(),ip,4))))
+			return true;
+	}
+	return false;
+}
+
+bool UserspaceStack::_sendIp(const uint8_t *packet,unsigned int len)
+{
+	MAC to,queryDest;
+	unsigned int etherType = 0,queryLen = 0,queryEtherType = 0;
+	uint8_t query[ZT_TUNADAPTER_BUF_LENGTH];
+	const bool send = _tun.outbound(packet,len,to,etherType,query,queryLen,queryDest,queryEtherType);
+	if (queryLen)
+		_handler(_arg,(void *)0,_nwid,_mac,queryDest,queryEtherType,0,(const void *)query,queryLen);
+	if (send)
+		_handler(_arg,(void *)0,_nwid,_mac,to,etherType,0,(const void *)packet,len);
+	return send;
+}
+
+void UserspaceStack::_postReply(_Reply *r)
+{
+	// Replies can't go out from within put(), which the node calls, so a thread sends them
+	{
+		std::lock_guard<std::mutex> l(_replies_m);
+		if (_replies.size() < ZT_USERSPACE_STACK_MAX_REPLIES) {
+			_replies.push_back(r);
+			_replies_c.notify_one();
+			return;
+		}
+	}
+	delete r;
+}
+
+void UserspaceStack::_inbound(const uint8_t *p,unsigned int len)
+{
+	if ((p[0] >> 4) == 4) {
+		const unsigned int ihl = ((unsigned int)p[0] & 0xf) * 4;
+		const unsigned int tot = _get16(p + 2);
+		if ((ihl < 20)||(tot < (ihl + 8))||(tot > len)||((p[6] & 0x3f) != 0)||(p[7] != 0)) // too short or a fragment
+			return;
+		if (!_isLocal(p + 16,false))
+			return;
+		const uint8_t *const l4 = p + ihl;
+		if ((p[9] == 1)&&(l4[0] == 8)) { // ICMP echo request
+			_Reply *const r = new _Reply();
+			r->etherType = 0;
+			r->len = tot;
+			memcpy(r->data,p,tot);
+			uint8_t *const ip = r->data;
+			memcpy(ip + 12,p + 16,4);
+			memcpy(ip + 16,p + 12,4);
+			ip[8] = 64;
+			_put16(ip + 10,0);
+			_put16(ip + 10,_csumFinish(_csumAdd(0,ip,ihl)));
+			uint8_t *const icmp = ip + ihl;
+			icmp[0] = 0; // echo reply
+			_put16(icmp + 2,0);
+			_put16(icmp + 2,_csumFinish(_csumAdd(0,icmp,tot - ihl)));
+			_postReply(r);
+		} else if (p[9] == 17) {
+			const unsigned int ulen = _get16(l4 + 4);
+			if ((ulen >= 8)&&(ulen <= (tot - ihl)))
+				_deliver(_get16(l4 + 2),InetAddress(p + 12,4,_get16(l4)),l4 + 8,ulen - 8);
+		}
+	} else {
+		const unsigned int plen = _get16(p + 4);
+		if (((40 + plen) > len)||(plen < 8))
+			return;
+		if (!_isLocal(p + 24,true))
+			return;
+		const uint8_t *const l4 = p + 40;
+		if ((p[6] == 58)&&(l4[0] == 128)) { // ICMPv6 echo request
+			_Reply *const r = new _Reply();
+			r->etherType = 0;
+			r->len = 40 + plen;
+			memcpy(r->data,p,40 + plen);
+			uint8_t *const ip = r->data;
+			memcpy(ip + 8,p + 24,16);
+			memcpy(ip + 24,p + 8,16);
+			ip[7] = 64;
+			uint8_t *const icmp = ip + 40;
+			icmp[0] = 129; // echo reply
+			_put16(icmp + 2,0);
+			_put16(icmp + 2,_l4Checksum(ip,true,58,icmp,plen));
+			_postReply(r);
+		} else if (p[6] == 17) {
+			const unsigned int ulen = _get16(l4 + 4);
+			if ((ulen >= 8)&&(ulen <= plen))
+				_deliver(_get16(l4 + 2),InetAddress(p + 8,16,_get16(l4)),l4 + 8,ulen - 8);
+		}
+	}
+}
+
+void UserspaceStack::_deliver(unsigned int port,const InetAddress &from,const uint8_t *data,unsigned int len)
+{
+	std::lock_guard<std::mutex> l(_ports_m);
+	std::map<unsigned int,_Port>::iterator p(_ports.find(port));
+	if ((p == _ports.end())||(p->second.q.size() >= ZT_USERSPACE_STACK_MAX_QUEUE))
+		return;
+	p->second.q.push_back(_Datagram());
+	p->second.q.back().from = from;
+	p->second.q.back().data.assign(reinterpret_cast<const char *>(data),len);
+	_ports_c.notify_all();
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,210 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_USERSPACESTACK_HPP
+#define ZT_USERSPACESTACK_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+#include "../node/Constants.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/MulticastGroup.hpp"
+#include "../node/MAC.hpp"
+#include "../node/Mutex.hpp"
+
+#include "Thread.hpp"
+#include "TunAdapter.hpp"
+
+/**
+ * Maximum datagrams waiting to be received on one port
+ */
+#define ZT_USERSPACE_STACK_MAX_QUEUE 256
+
+/**
+ * Maximum replies (ARP, NDP, ICMP echo) waiting to be sent
+ */
+#define ZT_USERSPACE_STACK_MAX_REPLIES 64
+
+/**
+ * First port handed out when binding to port 0
+ */
+#define ZT_USERSPACE_STACK_EPHEMERAL_PORT_MIN 49152
+
+namespace ZeroTier {
+
+/**
+ * Network port that is a minimal UDP-only IP stack inside the process
+ *
+ * Built with ZT_USERSPACE_STACK=1, the service uses this in place of the OS
+ * tap for every network, and applications in the same process send and
+ * receive UDP datagrams over the network directly through it with no tap
+ * device and no kernel crossing. It is a building block for embedders that
+ * only need UDP, not a general replacement for a tap: there is no TCP, and
+ * nothing outside the process can use the network. Anything that needs TCP
+ * should use a tap or plug a full stack in through ZT_SDK and SocketTap.
+ *
+ * It answers ARP and neighbor discovery for its addresses (via TunAdapter,
+ * which also resolves destinations and follows managed routes) and ICMP and
+ * ICMPv6 echo requests, and delivers UDP datagrams to bound ports. There is
+ * no TCP and no IP fragmentation, so datagrams must fit in the network MTU.
+ * As with a kernel stack, the first datagram to a neighbor not yet resolved
+ * is dropped while it is being looked up.
+ *
+ * The socket calls may be used from any number of application threads.
+ */
+class UserspaceStack
+{
+public:
+	UserspaceStack(
+		const char *homePath,
+		const MAC &mac,
+		unsigned int mtu,
+		unsigned int metric,
+		uint64_t nwid,
+		const char *friendlyName,
+		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void *arg);
+
+	~UserspaceStack();
+
+	inline void setEnabled(bool en) { _enabled = en; }
+	inline bool enabled() const { return _enabled; }
+
+	bool addIp(const InetAddress &ip);
+	bool removeIp(const InetAddress &ip);
+	std::vector<InetAddress> ips() const;
+	void put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+	inline std::string deviceName() const { return _dev; }
+	inline void setFriendlyName(const char *friendlyName) {}
+	void scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed);
+	inline void setMtu(unsigned int mtu) { _mtu = mtu; }
+	inline void setL3Routes(const ZT_VirtualNetworkRoute *routes,unsigned int count) { _tun.setRoutes(routes,count); }
+
+	/**
+	 * Bind a UDP port to receive datagrams on
+	 *
+	 * @param port Port or 0 to pick an unused one
+	 * @return Bound port or 0 if the port is already bound
+	 */
+	unsigned int udpBind(unsigned int port);
+
+	/**
+	 * Unbind a UDP port, waking any thread waiting in udpReceive() on it
+	 *
+	 * @param port Bound port
+	 */
+	void udpClose(unsigned int port);
+
+	/**
+	 * Send a UDP datagram
+	 *
+	 * The source address is the one of ours on the destination's network,
+	 * or else the first of the same family.
+	 *
+	 * @param port Source port
+	 * @param to Destination address and port
+	 * @param data Payload
+	 * @param len Length of payload
+	 * @return True if sent (false if too big, no source address, or destination not yet resolved)
+	 */
+	bool udpSend(unsigned int port,const InetAddress &to,const void *data,unsigned int len);
+
+	/**
+	 * Receive a UDP datagram
+	 *
+	 * @param port Bound port
+	 * @param from Result: source address and port
+	 * @param buf Buffer for payload (a longer payload is truncated)
+	 * @param len Size of buffer
+	 * @param timeout Milliseconds to wait for a datagram, 0 to not wait
+	 * @return Length of payload, or -1 if none arrived in time or the port is not bound
+	 */
+	int udpReceive(unsigned int port,InetAddress &from,void *buf,unsigned int len,unsigned long timeout);
+
+	void threadMain()
+		throw();
+
+private:
+	struct _Datagram
+	{
+		InetAddress from;
+		std::string data;
+	};
+
+	struct _Port
+	{
+		std::deque<_Datagram> q;
+	};
+
+	struct _Reply
+	{
+		MAC to;
+		unsigned int etherType; // 0 if this is an IP packet still to be resolved
+		unsigned int len;
+		uint8_t data[ZT_MAX_MTU];
+	};
+
+	bool _isLocal(const uint8_t *ip,const bool v6) const;
+	bool _sendIp(const uint8_t *packet,unsigned int len);
+	void _postReply(_Reply *r);
+	void _inbound(const uint8_t *packet,unsigned int len);
+	void _deliver(unsigned int port,const InetAddress &from,const uint8_t *data,unsigned int len);
+
+	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
+	void *_arg;
+	const uint64_t _nwid;
+	const MAC _mac;
+	std::string _dev;
+	volatile unsigned int _mtu;
+	volatile bool _enabled;
+
+	TunAdapter _tun;
+	std::vector<InetAddress> _ips;
+	std::vector<MulticastGroup> _multicastGroups;
+	Mutex _ips_m;
+
+	std::map<unsigned int,_Port> _ports;
+	unsigned int _nextEphemeralPort;
+	std::mutex _ports_m;
+	std::condition_variable _ports_c;
+
+	std::deque<_Reply *> _replies;
+	bool _run;
+	std::mutex _replies_m;
+	std::condition_variable _replies_c;
+	Thread _thread;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -473,6 +473,9 @@ WindowsEthernetTap::WindowsEthernetTap(
 	_mtu(mtu),
 	_tap(INVALID_HANDLE_VALUE),
 	_injectSemaphore(INVALID_HANDLE_VALUE),
+	_writeHead(0),
+	_writeIssued(0),
+	_writeTail(0),
 	_pathToHelpers(hp),
 	_run(true),
 	_initialized(false),
@@ -793,14 +796,17 @@ void WindowsEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherTyp
 	if ((!_initialized)||(!_enabled)||(_tap == INVALID_HANDLE_VALUE)||(len > _mtu))
 		return;
 
-	Mutex::Lock _l(_injectPending_m);
-	_injectPending.push( std::pair<Array<char,ZT_MAX_MTU + 32>,unsigned int>(Array<char,ZT_MAX_MTU + 32>(),len + 14) );
-	char *d = _injectPending.back().first.data;
-	to.copyTo(d,6);
-	from.copyTo(d + 6,6);
-	d[12] = (char)((etherType >> 8) & 0xff);
-	d[13] = (char)(etherType & 0xff);
-	memcpy(d + 14,data,len);
+	Mutex::Lock _l(_writeSlots_m);
+	if ((_writeTail - _writeHead) >= ZT_WINDOWS_TAP_IO_DEPTH)
+		return; // all write slots busy, drop like a full NIC queue would
+	_IoSlot &s = _writeSlots[_writeTail % ZT_WINDOWS_TAP_IO_DEPTH];
+	to.copyTo(s.buf,6);
+	from.copyTo(s.buf + 6,6);
+	s.buf[12] = (char)((etherType >> 8) & 0xff);
+	s.buf[13] = (char)(etherType & 0xff);
+	memcpy(s.buf + 14,data,len);
+	s.len = len + 14;
+	++_writeTail;
 
 	ReleaseSemaphore(_injectSemaphore,1,NULL);
 }
@@ -898,10 +904,8 @@ NET_IFINDEX WindowsEthernetTap::interfaceIndex() const
 void WindowsEthernetTap::threadMain()
 	throw()
 {
-	char tapReadBuf[ZT_MAX_MTU + 32];
 	char tapPath[128];
 	HANDLE wait4[3];
-	OVERLAPPED tapOvlRead,tapOvlWrite;
 
 	OSUtils::ztsnprintf(tapPath,sizeof(tapPath),"\\\\.\\Global\\%s.tap",_netCfgInstanceId.c_str());
 
@@ -1015,23 +1019,37 @@ void WindowsEthernetTap::threadMain()
 				_syncIps();
 			}
 
-			memset(&tapOvlRead,0,sizeof(tapOvlRead));
-			tapOvlRead.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
-			memset(&tapOvlWrite,0,sizeof(tapOvlWrite));
-			tapOvlWrite.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
+			for(unsigned int i=0;i<ZT_WINDOWS_TAP_IO_DEPTH;++i) {
+				memset(&(_readSlots[i].ovl),0,sizeof(OVERLAPPED));
+				_readSlots[i].ovl.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
+				memset(&(_writeSlots[i].ovl),0,sizeof(OVERLAPPED));
+				_writeSlots[i].ovl.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
+			}
+			{
+				// Anything put() before the tap was (re)opened is stale
+				Mutex::Lock _l(_writeSlots_m);
+				_writeHead = _writeIssued = _writeTail;
+			}
 
+			// Only the oldest read and the oldest write need be waited on since both complete in order
 			wait4[0] = _injectSemaphore;
-			wait4[1] = tapOvlRead.hEvent;
-			wait4[2] = tapOvlWrite.hEvent; // only included if writeInProgress is true
 
-			ReadFile(_tap,tapReadBuf,sizeof(tapReadBuf),NULL,&tapOvlRead);
-			bool writeInProgress = false;
+			for(unsigned int i=0;i<ZT_WINDOWS_TAP_IO_DEPTH;++i)
+				ReadFile(_tap,_readSlots[i].buf,sizeof(_readSlots[i].buf),NULL,&(_readSlots[i].ovl));
+			unsigned long readHead = 0;
 			ULONGLONG timeOfLastBorkCheck = GetTickCount64();
 			_initialized = true;
 			unsigned int oldmtu = _mtu;
 
 			while (_run) {
-				DWORD waitResult = WaitForMultipleObjectsEx(writeInProgress ? 3 : 2,wait4,FALSE,2500,TRUE);
+				wait4[1] = _readSlots[readHead % ZT_WINDOWS_TAP_IO_DEPTH].ovl.hEvent;
+				DWORD waitCount = 2;
+				{
+					Mutex::Lock _l(_writeSlots_m);
+					if (_writeHead != _writeIssued)
+						wait4[waitCount++] = _writeSlots[_writeHead % ZT_WINDOWS_TAP_IO_DEPTH].ovl.hEvent;
+				}
+				DWORD waitResult = WaitForMultipleObjectsEx(waitCount,wait4,FALSE,2500,TRUE);
 				if (!_run) break; // will also break outer while(_run) since _run is false
 
 				// Check for changes in MTU and break to restart tap device to reconfigure in this case
@@ -1073,41 +1091,64 @@ void WindowsEthernetTap::threadMain()
 					continue;
 				}
 
-				if (HasOverlappedIoCompleted(&tapOvlRead)) {
+				for(unsigned int n=0;n<ZT_WINDOWS_TAP_IO_DEPTH;++n) {
+					_IoSlot &s = _readSlots[readHead % ZT_WINDOWS_TAP_IO_DEPTH];
+					if (!HasOverlappedIoCompleted(&(s.ovl)))
+						break;
 					DWORD bytesRead = 0;
-					if (GetOverlappedResult(_tap,&tapOvlRead,&bytesRead,FALSE)) {
+					if (GetOverlappedResult(_tap,&(s.ovl),&bytesRead,FALSE)) {
 						if ((bytesRead > 14)&&(_enabled)) {
-							MAC to(tapReadBuf,6);
-							MAC from(tapReadBuf + 6,6);
-							unsigned int etherType = ((((unsigned int)tapReadBuf[12]) & 0xff) << 8) | (((unsigned int)tapReadBuf[13]) & 0xff);
+							MAC to(s.buf,6);
+							MAC from(s.buf + 6,6);
+							unsigned int etherType = ((((unsigned int)s.buf[12]) & 0xff) << 8) | (((unsigned int)s.buf[13]) & 0xff);
 							try {
-								_handler(_arg,(void *)0,_nwid,from,to,etherType,0,tapReadBuf + 14,bytesRead - 14);
+								_handler(_arg,(void *)0,_nwid,from,to,etherType,0,s.buf + 14,bytesRead - 14);
 							} catch ( ... ) {} // handlers should not throw
 						}
 					}
-					ReadFile(_tap,tapReadBuf,ZT_MAX_MTU + 32,NULL,&tapOvlRead);
+					ReadFile(_tap,s.buf,sizeof(s.buf),NULL,&(s.ovl));
+					++readHead;
 				}
 
-				if (writeInProgress) {
-					if (HasOverlappedIoCompleted(&tapOvlWrite)) {
-						writeInProgress = false;
-						_injectPending_m.lock();
-						_injectPending.pop();
-					} else continue; // still writing, so skip code below and wait
-				} else _injectPending_m.lock();
-
-				if (!_injectPending.empty()) {
-					WriteFile(_tap,_injectPending.front().first.data,_injectPending.front().second,NULL,&tapOvlWrite);
-					writeInProgress = true;
+				unsigned long issued,tail;
+				{
+					Mutex::Lock _l(_writeSlots_m);
+					while ((_writeHead != _writeIssued)&&(HasOverlappedIoCompleted(&(_writeSlots[_writeHead % ZT_WINDOWS_TAP_IO_DEPTH].ovl))))
+						++_writeHead;
+					issued = _writeIssued;
+					tail = _writeTail;
+				}
+				// Slots between issued and tail are not touched by put() until _writeHead passes them
+				for(unsigned long i=issued;i!=tail;++i) {
+					_IoSlot &s = _writeSlots[i % ZT_WINDOWS_TAP_IO_DEPTH];
+					WriteFile(_tap,s.buf,s.len,NULL,&(s.ovl));
+				}
+				if (issued != tail) {
+					Mutex::Lock _l(_writeSlots_m);
+					_writeIssued = tail;
 				}
-
-				_injectPending_m.unlock();
 			}
 
 			CancelIo(_tap);
 
-			CloseHandle(tapOvlRead.hEvent);
-			CloseHandle(tapOvlWrite.hEvent);
+			// Buffers can't be reused until cancelled I/O has actually finished
+			for(unsigned int i=0;i<ZT_WINDOWS_TAP_IO_DEPTH;++i) {
+				DWORD tmp = 0;
+				if (!HasOverlappedIoCompleted(&(_readSlots[i].ovl)))
+					GetOverlappedResult(_tap,&(_readSlots[i].ovl),&tmp,TRUE);
+				CloseHandle(_readSlots[i].ovl.hEvent);
+			}
+			{
+				Mutex::Lock _l(_writeSlots_m);
+				for(unsigned long i=_writeHead;i!=_writeIssued;++i) {
+					DWORD tmp = 0;
+					if (!HasOverlappedIoCompleted(&(_writeSlots[i % ZT_WINDOWS_TAP_IO_DEPTH].ovl)))
+						GetOverlappedResult(_tap,&(_writeSlots[i % ZT_WINDOWS_TAP_IO_DEPTH].ovl),&tmp,TRUE);
+				}
+				_writeHead = _writeIssued = _writeTail;
+				for(unsigned int i=0;i<ZT_WINDOWS_TAP_IO_DEPTH;++i)
+					CloseHandle(_writeSlots[i].ovl.hEvent);
+			}
 			CloseHandle(_tap);
 			_tap = INVALID_HANDLE_VALUE;
 
@@ -43,6 +43,13 @@
 #include "../node/InetAddress.hpp"
 #include "../osdep/Thread.hpp"
 
+/**
+ * Number of overlapped reads and of overlapped writes kept in flight on the tap
+ */
+#ifndef ZT_WINDOWS_TAP_IO_DEPTH
+#define ZT_WINDOWS_TAP_IO_DEPTH 16
+#endif
+
 namespace ZeroTier {
 
 class WindowsEthernetTap
@@ -127,6 +134,13 @@ private:
 	void _setRegistryIPv4Value(const char *regKey,const std::vector<std::string> &value);
 	void _syncIps();
 
+	struct _IoSlot
+	{
+		OVERLAPPED ovl;
+		unsigned int len;
+		char buf[ZT_MAX_MTU + 32];
+	};
+
 	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	void *_arg;
 	MAC _mac;
@@ -148,8 +162,13 @@ private:
 
 	std::vector<MulticastGroup> _multicastGroups;
 
-	std::queue< std::pair< Array<char,ZT_MAX_MTU + 32>,unsigned int > > _injectPending;
-	Mutex _injectPending_m;
+	// Reads are issued and completed in ring order so frames stay in order
+	_IoSlot _readSlots[ZT_WINDOWS_TAP_IO_DEPTH];
+
+	// Writes in [_writeHead,_writeIssued) are in flight, [_writeIssued,_writeTail) filled by put() and not yet issued
+	_IoSlot _writeSlots[ZT_WINDOWS_TAP_IO_DEPTH];
+	unsigned long _writeHead,_writeIssued,_writeTail;
+	Mutex _writeSlots_m;
 
 	std::string _pathToHelpers;
 
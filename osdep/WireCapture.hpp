@@ -0,0 +1,243 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_WIRECAPTURE_HPP
+#define ZT_WIRECAPTURE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "../node/Constants.hpp"
+#include "../node/NonCopyable.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/Mutex.hpp"
+
+/**
+ * First bytes of a capture file, followed by a one-byte format version
+ */
+#define ZT_WIRECAPTURE_MAGIC "ZTWC"
+#define ZT_WIRECAPTURE_VERSION 1
+
+namespace ZeroTier {
+
+/**
+ * Recording of received wire packets, for replaying into a node later
+ *
+ * The file is the magic and version, then one record per datagram:
+ *
+ *   <[8] receive time in ms>
+ *   <[8] local socket>
+ *   <[1] 4 or 6>
+ *   <[4] or [16] remote IP>
+ *   <[2] remote port>
+ *   <[2] length>
+ *   <[...] datagram>
+ *
+ * Integers are big-endian. Local sockets are only labels, so a replay
+ * keeps paths apart the way the node saw them. Sampling is by remote
+ * address, so every packet from a recorded path is kept and the peers on
+ * it can still be followed through a replay.
+ */
+class WireCapture : NonCopyable
+{
+public:
+	/**
+	 * One recorded datagram
+	 */
+	struct Record
+	{
+		uint64_t timestamp;
+		int64_t localSocket;
+		InetAddress from;
+		std::string data;
+	};
+
+	WireCapture() :
+		_f((FILE *)0),
+		_enabled(false),
+		_sampleRate(1),
+		_bytes(0),
+		_maxBytes(0) {}
+
+	~WireCapture() { close(); }
+
+	/**
+	 * Start recording, replacing whatever is at path
+	 *
+	 * @param path File to write
+	 * @param sampleRate Record about one in this many remote addresses (0 or 1 for all)
+	 * @param maxBytes Stop once the file reaches this size, or 0 for no limit
+	 * @return True if the file was opened
+	 */
+	inline bool open(const char *path,const unsigned int sampleRate,const uint64_t maxBytes)
+	{
+		Mutex::Lock _l(_lock);
+		if (_f)
+			fclose(_f);
+		_f = fopen(path,"wb");
+		if (!_f) {
+			_enabled = false;
+			return false;
+		}
+		fwrite(ZT_WIRECAPTURE_MAGIC,1,4,_f);
+		fputc(ZT_WIRECAPTURE_VERSION,_f);
+		_sampleRate = (sampleRate) ? sampleRate : 1;
+		_bytes = 5;
+		_maxBytes = maxBytes;
+		_enabled = true;
+		return true;
+	}
+
+	/**
+	 * Stop recording and close the file
+	 */
+	inline void close()
+	{
+		Mutex::Lock _l(_lock);
+		_enabled = false;
+		if (_f) {
+			fclose(_f);
+			_f = (FILE *)0;
+		}
+	}
+
+	/**
+	 * @return True if recording (checked before anything else on the receive path)
+	 */
+	inline bool enabled() const { return _enabled; }
+
+	/**
+	 * Record a datagram, if its remote address is sampled
+	 *
+	 * @param now Time of receipt
+	 * @param localSocket Local socket as passed to processWirePacket()
+	 * @param from Remote address
+	 * @param data Datagram
+	 * @param len Datagram length
+	 */
+	inline void record(const uint64_t now,const int64_t localSocket,const struct sockaddr_storage *from,const void *data,const unsigned long len)
+	{
+		const InetAddress &fa = *reinterpret_cast<const InetAddress *>(from);
+		if (((fa.ss_family != AF_INET)&&(fa.ss_family != AF_INET6))||(len > 0xffff))
+			return;
+		if ((_sampleRate > 1)&&((((uint64_t)fa.hashCode() * 0x9e3779b97f4a7c15ULL) >> 32) % _sampleRate) != 0)
+			return;
+
+		uint8_t h[39];
+		unsigned int hl = 0;
+		_be(h,hl,now,8);
+		_be(h,hl,(uint64_t)localSocket,8);
+		if (fa.ss_family == AF_INET) {
+			h[hl++] = 4;
+			memcpy(h + hl,fa.rawIpData(),4);
+			hl += 4;
+		} else {
+			h[hl++] = 6;
+			memcpy(h + hl,fa.rawIpData(),16);
+			hl += 16;
+		}
+		_be(h,hl,fa.port(),2);
+		_be(h,hl,len,2);
+
+		Mutex::Lock _l(_lock);
+		if (!_f)
+			return;
+		fwrite(h,1,hl,_f);
+		fwrite(data,1,len,_f);
+		_bytes += hl + len;
+		if ((_maxBytes)&&(_bytes >= _maxBytes)) {
+			_enabled = false;
+			fclose(_f);
+			_f = (FILE *)0;
+		}
+	}
+
+	/**
+	 * Check that a file starts with the magic and a version we can read
+	 *
+	 * @param f File positioned at its start
+	 * @return True if records follow
+	 */
+	static inline bool readHeader(FILE *f)
+	{
+		char h[5];
+		return ((fread(h,1,5,f) == 5)&&(memcmp(h,ZT_WIRECAPTURE_MAGIC,4) == 0)&&(h[4] == ZT_WIRECAPTURE_VERSION));
+	}
+
+	/**
+	 * Read the next record
+	 *
+	 * @param f File positioned after the header or a previous record
+	 * @param r Record to fill
+	 * @return True if a whole record was read, false at the end or if truncated
+	 */
+	static inline bool read(FILE *f,Record &r)
+	{
+		uint8_t h[17];
+		if (fread(h,1,17,f) != 17)
+			return false;
+		r.timestamp = _unbe(h,8);
+		r.localSocket = (int64_t)_unbe(h + 8,8);
+		uint8_t a[20];
+		const unsigned int al = (h[16] == 4) ? 4 : ((h[16] == 6) ? 16 : 0);
+		if ((!al)||(fread(a,1,al + 4,f) != (al + 4)))
+			return false;
+		r.from.set(a,al,(unsigned int)_unbe(a + al,2));
+		const unsigned int len = (unsigned int)_unbe(a + al + 2,2);
+		r.data.resize(len);
+		return ((!len)||(fread(&(r.data[0]),1,len,f) == len));
+	}
+
+private:
+	static inline void _be(uint8_t *b,unsigned int &i,const uint64_t v,const unsigned int n)
+	{
+		for(unsigned int k=0;k<n;++k)
+			b[i++] = (uint8_t)(v >> (8 * (n - k - 1)));
+	}
+
+	static inline uint64_t _unbe(const uint8_t *b,const unsigned int n)
+	{
+		uint64_t v = 0;
+		for(unsigned int k=0;k<n;++k)
+			v = (v << 8) | (uint64_t)b[k];
+		return v;
+	}
+
+	FILE *_f;
+	volatile bool _enabled;
+	unsigned int _sampleRate;
+	uint64_t _bytes;
+	uint64_t _maxBytes;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
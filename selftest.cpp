@@ -33,32 +33,63 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <set>
 #include <thread>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
+#include "node/FlatHashtable.hpp"
+#include "node/Bloom.hpp"
+#include "node/TimerWheel.hpp"
+#include "node/BridgeRouteTable.hpp"
+#include "node/NeighborCache.hpp"
+#include "node/EgressScheduler.hpp"
+#include "node/TokenBucket.hpp"
 #include "node/RuntimeEnvironment.hpp"
 #include "node/InetAddress.hpp"
+#include "node/CompactInetAddress.hpp"
+#include "node/SmallMap.hpp"
+#include "node/Membership.hpp"
+#include "node/Multicaster.hpp"
 #include "node/Utils.hpp"
 #include "node/Identity.hpp"
 #include "node/Buffer.hpp"
 #include "node/Packet.hpp"
 #include "node/Salsa20.hpp"
 #include "node/MAC.hpp"
+#include "node/Network.hpp"
 #include "node/NetworkConfig.hpp"
 #include "node/Peer.hpp"
+#include "node/Path.hpp"
+#include "node/Fec.hpp"
 #include "node/Dictionary.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
+#include "node/SignatureCache.hpp"
 #include "node/Poly1305.hpp"
+#include "node/AES.hpp"
 #include "node/CertificateOfMembership.hpp"
+#include "node/CertificateOfOwnership.hpp"
+#include "node/Capability.hpp"
+#include "node/Tag.hpp"
+#include "node/Revocation.hpp"
+#include "node/CompiledRules.hpp"
 #include "node/Node.hpp"
+#include "node/Switch.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/HugePages.hpp"
+#include "node/VerificationGate.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
+#include "osdep/RingBuffer.hpp"
+#include "osdep/FairQueue.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
+#include "osdep/CpuAffinity.hpp"
+#include "osdep/TunAdapter.hpp"
+#include "osdep/UserspaceStack.hpp"
+#include "osdep/WireCapture.hpp"
 
 #include "controller/JSONDB.hpp"
 
@@ -96,6 +127,14 @@ static const unsigned char poly1305TV1Input[12] = { 0x48,0x65,0x6c,0x6c,0x6f,0x2
 static const unsigned char poly1305TV1Key[32] = { 0x74,0x68,0x69,0x73,0x20,0x69,0x73,0x20,0x33,0x32,0x2d,0x62,0x79,0x74,0x65,0x20,0x6b,0x65,0x79,0x20,0x66,0x6f,0x72,0x20,0x50,0x6f,0x6c,0x79,0x31,0x33,0x30,0x35 };
 static const unsigned char poly1305TV1Tag[16] = { 0xa6,0xf7,0x45,0x00,0x8f,0x81,0xc9,0x16,0xa2,0x0d,0xcc,0x74,0xee,0xf2,0xb2,0xf0 };
 
+// AES-256-GCM: TV0 is NIST GCM test case 14 (zero key and IV, one zero block),
+// TV1 has a 13 byte AAD and a 100 byte message to cover partial and multi-block paths
+static const unsigned char aesGcmTV0Ct[16] = { 0xce,0xa7,0x40,0x3d,0x4d,0x60,0x6b,0x6e,0x07,0x4e,0xc5,0xd3,0xba,0xf3,0x9d,0x18 };
+static const unsigned char aesGcmTV0Tag[16] = { 0xd0,0xd1,0xc8,0xa7,0x99,0x99,0x6b,0xf0,0x26,0x5b,0x98,0xb5,0xd4,0x8a,0xb9,0x19 };
+static const unsigned char aesGcmTV0EmptyTag[16] = { 0x53,0x0f,0x8a,0xfb,0xc7,0x45,0x36,0xb9,0xa9,0x63,0xb4,0xf1,0xc4,0xcb,0x73,0x8b };
+static const unsigned char aesGcmTV1Ct[100] = { 0x7d,0xf9,0x96,0x03,0x55,0xea,0x10,0x82,0xf2,0x4a,0x4e,0x50,0x5b,0x22,0x0b,0x3a,0xa7,0x27,0x30,0x8b,0x97,0x51,0xcd,0x10,0x4f,0x56,0x54,0xda,0x9a,0x9f,0x86,0x02,0xb0,0x0e,0xb9,0xf6,0x09,0xa5,0x64,0xfe,0x66,0x29,0xb4,0x7c,0xbe,0xa3,0x51,0x52,0x43,0xeb,0x19,0x16,0x8f,0xf8,0x23,0x73,0x34,0x91,0xac,0xac,0x57,0x3c,0x16,0xd2,0xc5,0x3f,0xf1,0xf6,0x95,0x5d,0xe1,0xc5,0x95,0x7f,0x33,0xf3,0xcc,0xda,0xca,0x97,0x0d,0x8e,0xac,0xe8,0x2a,0xce,0x08,0x5b,0xe8,0x9f,0x56,0x62,0x6a,0x0f,0x71,0x8c,0xdc,0xa0,0xe0,0x03 };
+static const unsigned char aesGcmTV1Tag[16] = { 0x5e,0x70,0x00,0x26,0xd9,0x29,0x40,0xef,0x7d,0xff,0x96,0x7d,0x86,0xe8,0xe5,0x12 };
+
 static const char *sha512TV0Input = "supercalifragilisticexpealidocious";
 static const unsigned char sha512TV0Digest[64] = { 0x18,0x2a,0x85,0x59,0x69,0xe5,0xd3,0xe6,0xcb,0xf6,0x05,0x24,0xad,0xf2,0x88,0xd1,0xbb,0xf2,0x52,0x92,0x81,0x24,0x31,0xf6,0xd2,0x52,0xf1,0xdb,0xc1,0xcb,0x44,0xdf,0x21,0x57,0x3d,0xe1,0xb0,0x6b,0x68,0x75,0x95,0x9f,0x3b,0x6f,0x87,0xb1,0x13,0x81,0xd0,0xbc,0x79,0x2c,0x43,0x3a,0x13,0x55,0x3c,0xe0,0x84,0xc2,0x92,0x55,0x31,0x1c };
 
@@ -159,6 +198,28 @@ static int testCrypto()
 		Utils::getSecureRandom(buf1,64);
 		std::cout << "[crypto] getSecureRandom: " << Utils::hex(buf1,64,hexbuf) << std::endl;
 	}
+	{
+		// Each thread has its own generator, so two threads must never see the same stream
+		uint64_t r[2][512];
+		std::thread t0([&r]() { for(unsigned int i=0;i<512;++i) Utils::getSecureRandom(&(r[0][i]),8); });
+		std::thread t1([&r]() { for(unsigned int i=0;i<512;++i) Utils::getSecureRandom(&(r[1][i]),8); });
+		t0.join();
+		t1.join();
+		std::set<uint64_t> seen(r[0],r[0] + 512);
+		seen.insert(r[1],r[1] + 512);
+		if (seen.size() != 1024) {
+			std::cout << "[crypto] getSecureRandom: FAILED (repeated output across threads)" << std::endl;
+			return -1;
+		}
+		uint64_t x = 0,start = OSUtils::now();
+		for(unsigned int i=0;i<1000000;++i) {
+			uint64_t v;
+			Utils::getSecureRandom(&v,8);
+			x ^= v;
+		}
+		const uint64_t end = OSUtils::now();
+		std::cout << "[crypto] getSecureRandom: " << (1000000.0 / ((double)(end - start) / 1000.0)) << " 8-byte calls/second (" << (x & 1) << ")" << std::endl;
+	}
 
 	std::cout << "[crypto] Testing Salsa20... "; std::cout.flush();
 	for(unsigned int i=0;i<4;++i) {
@@ -200,8 +261,44 @@ static int testCrypto()
 	std::cout << "[crypto] Salsa20 SSE: DISABLED" << std::endl;
 #endif
 
-	std::cout << "[crypto] Benchmarking Salsa20/12... "; std::cout.flush();
-	{
+	static const char *const s20ImplNames[4] = { "default","AVX2","AVX-512","NEON" };
+	const Salsa20::Crypt12Implementation s20BestImpl = Salsa20::crypt12Implementation();
+	for(int impl=(int)Salsa20::CRYPT12_AVX2;impl<=(int)Salsa20::CRYPT12_NEON;++impl) {
+		if (!Salsa20::crypt12ImplementationSupported((Salsa20::Crypt12Implementation)impl))
+			continue;
+		std::cout << "[crypto] Testing Salsa20/12 " << s20ImplNames[impl] << " against default... "; std::cout.flush();
+		unsigned char *ref = (unsigned char *)::malloc(16384);
+		unsigned char *tst = (unsigned char *)::malloc(16384);
+		for(unsigned int len=0;len<=16384;len+=((len < 2200) ? 1 : 997)) {
+			Utils::getSecureRandom(buf1,64);
+			for(unsigned int i=0;i<len;++i)
+				ref[i] = tst[i] = (unsigned char)(i ^ buf1[i & 63]);
+			// Split into two calls (the second unaligned) to check counter hand-off between implementations
+			const unsigned int split = len / 3;
+			Salsa20::setCrypt12Implementation(Salsa20::CRYPT12_DEFAULT);
+			Salsa20 s20a(buf1,buf1 + 32);
+			s20a.crypt12(ref,ref,split);
+			s20a.crypt12(ref + split,ref + split,len - split);
+			Salsa20::setCrypt12Implementation((Salsa20::Crypt12Implementation)impl);
+			Salsa20 s20b(buf1,buf1 + 32);
+			s20b.crypt12(tst,tst,split);
+			s20b.crypt12(tst + split,tst + split,len - split);
+			if (memcmp(ref,tst,len)) {
+				std::cout << "FAIL (length " << len << ")" << std::endl;
+				Salsa20::setCrypt12Implementation(s20BestImpl);
+				return -1;
+			}
+		}
+		::free((void *)ref);
+		::free((void *)tst);
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(int impl=(int)Salsa20::CRYPT12_DEFAULT;impl<=(int)Salsa20::CRYPT12_NEON;++impl) {
+		if (!Salsa20::crypt12ImplementationSupported((Salsa20::Crypt12Implementation)impl))
+			continue;
+		Salsa20::setCrypt12Implementation((Salsa20::Crypt12Implementation)impl);
+		std::cout << "[crypto] Benchmarking Salsa20/12 (" << s20ImplNames[impl] << ")... "; std::cout.flush();
 		unsigned char *bb = (unsigned char *)::malloc(1234567);
 		for(unsigned int i=0;i<1234567;++i)
 			bb[i] = (unsigned char)i;
@@ -217,6 +314,7 @@ static int testCrypto()
 		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second (" << Utils::hex(buf1,16,hexbuf) << ')' << std::endl;
 		::free((void *)bb);
 	}
+	Salsa20::setCrypt12Implementation(s20BestImpl);
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 	std::cout << "[crypto] Benchmarking Salsa20/12 fast x64 ASM... "; std::cout.flush();
@@ -278,6 +376,55 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Testing SHA-512 hashMulti()... "; std::cout.flush();
+	{
+		// Lengths around the one and two padding block boundaries
+		static const unsigned int mlens[11] = { 0,1,64,111,112,127,128,239,240,300,1000 };
+		void *mout[11];
+		const void *min[11];
+		unsigned int mlen[11];
+		for(unsigned int k=0;k<sizeof(buf2);++k)
+			buf2[k] = (unsigned char)rand();
+		for(unsigned int n=1;n<=11;++n) {
+			for(unsigned int k=0;k<n;++k) {
+				mout[k] = buf1 + (k * 64);
+				min[k] = buf2 + (k * 7);
+				mlen[k] = mlens[(k + n) % 11];
+			}
+			SHA512::hashMulti(mout,min,mlen,n);
+			for(unsigned int k=0;k<n;++k) {
+				SHA512::hash(buf3,min[k],mlen[k]);
+				if (memcmp(buf3,mout[k],64)) {
+					std::cout << "FAIL (" << n << "," << k << ")" << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[crypto] Testing SHA-512 Stream... "; std::cout.flush();
+	{
+		// Feed messages in irregular pieces that straddle block boundaries
+		static const unsigned int pieces[7] = { 1,127,128,129,5,250,64 };
+		for(unsigned int len=0;len<=1000;len+=37) {
+			SHA512::Stream hs;
+			unsigned int p = 0,pn = len % 7;
+			while (p < len) {
+				const unsigned int n = std::min(pieces[pn++ % 7],len - p);
+				hs.update(buf2 + p,n);
+				p += n;
+			}
+			hs.digest(buf1);
+			SHA512::hash(buf3,buf2,len);
+			if ((hs.bytes() != len)||(memcmp(buf1,buf3,64))) {
+				std::cout << "FAIL (" << len << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[crypto] Testing Poly1305... "; std::cout.flush();
 	Poly1305::compute(buf1,poly1305TV0Input,sizeof(poly1305TV0Input),poly1305TV0Key);
 	if (memcmp(buf1,poly1305TV0Tag,16)) {
@@ -291,8 +438,71 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
-	std::cout << "[crypto] Benchmarking Poly1305... "; std::cout.flush();
-	{
+	static const char *const p1305ImplNames[2] = { "default","AVX2" };
+	const Poly1305::Implementation p1305BestImpl = Poly1305::implementation();
+	if (Poly1305::implementationSupported(Poly1305::IMPLEMENTATION_AVX2)) {
+		std::cout << "[crypto] Testing Poly1305 AVX2 against default... "; std::cout.flush();
+		unsigned char *bb = (unsigned char *)::malloc(16384);
+		unsigned char ref[16],tst[16];
+		for(unsigned int len=0;len<=16384;len+=((len < 2200) ? 1 : 997)) {
+			Utils::getSecureRandom(buf1,64);
+			for(unsigned int i=0;i<len;++i)
+				bb[i] = (unsigned char)(i ^ buf1[i & 63]);
+			// Every fourth key has its message set to all ones, which pushes limbs to their carry limits
+			if ((len & 3) == 0) {
+				memset(bb,0xff,len);
+				memset(buf1,0xff,32);
+			}
+			Poly1305::setImplementation(Poly1305::IMPLEMENTATION_DEFAULT);
+			Poly1305::compute(ref,bb,len,buf1);
+			Poly1305::setImplementation(Poly1305::IMPLEMENTATION_AVX2);
+			Poly1305::compute(tst,bb,len,buf1);
+			if (memcmp(ref,tst,16)) {
+				std::cout << "FAIL (length " << len << ")" << std::endl;
+				Poly1305::setImplementation(p1305BestImpl);
+				return -1;
+			}
+		}
+		::free((void *)bb);
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(int impl=(int)Poly1305::IMPLEMENTATION_DEFAULT;impl<=(int)Poly1305::IMPLEMENTATION_AVX2;++impl) {
+		if (!Poly1305::implementationSupported((Poly1305::Implementation)impl))
+			continue;
+		Poly1305::setImplementation((Poly1305::Implementation)impl);
+		std::cout << "[crypto] Testing incremental Poly1305 (" << p1305ImplNames[impl] << ")... "; std::cout.flush();
+		unsigned char *bb = (unsigned char *)::malloc(8192);
+		unsigned char ref[16],tst[16];
+		for(unsigned int k=0;k<256;++k) {
+			Utils::getSecureRandom(buf1,64);
+			const unsigned int len = ((unsigned int)buf1[32] | ((unsigned int)buf1[33] << 8)) & 8191;
+			for(unsigned int i=0;i<len;++i)
+				bb[i] = (unsigned char)(i ^ buf1[i & 63]);
+			Poly1305::compute(ref,bb,len,buf1);
+			Poly1305 p1305(buf1);
+			for(unsigned int i=0,n=0;i<len;i+=n) {
+				n = 1 + (((unsigned int)bb[i] * 7) % 700);
+				if (n > (len - i))
+					n = len - i;
+				p1305.update(bb + i,n);
+			}
+			p1305.finish(tst);
+			if (memcmp(ref,tst,16)) {
+				std::cout << "FAIL (length " << len << ")" << std::endl;
+				Poly1305::setImplementation(p1305BestImpl);
+				return -1;
+			}
+		}
+		::free((void *)bb);
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(int impl=(int)Poly1305::IMPLEMENTATION_DEFAULT;impl<=(int)Poly1305::IMPLEMENTATION_AVX2;++impl) {
+		if (!Poly1305::implementationSupported((Poly1305::Implementation)impl))
+			continue;
+		Poly1305::setImplementation((Poly1305::Implementation)impl);
+		std::cout << "[crypto] Benchmarking Poly1305 (" << p1305ImplNames[impl] << ")... "; std::cout.flush();
 		unsigned char *bb = (unsigned char *)::malloc(1234567);
 		for(unsigned int i=0;i<1234567;++i)
 			bb[i] = (unsigned char)i;
@@ -306,6 +516,52 @@ static int testCrypto()
 		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
 		::free((void *)bb);
 	}
+	Poly1305::setImplementation(p1305BestImpl);
+
+	if (AES::accelerated()) {
+		std::cout << "[crypto] Testing AES-256 CTR, GMAC and decryption against GCM test vectors... "; std::cout.flush();
+		uint8_t key[32],iv[16],aad[13],pt[100],ct[100],tag[16];
+		memset(key,0,sizeof(key));
+		memset(iv,0,sizeof(iv));
+		memset(pt,0,sizeof(pt));
+		AES aes0(key);
+		iv[15] = 2; // GCM encryption starts at counter 2, counter 1 is for the tag
+		aes0.ctr(iv,pt,16,ct);
+		aes0.gmac(iv,(const void *)0,0,ct,16,tag);
+		if ((memcmp(ct,aesGcmTV0Ct,16))||(memcmp(tag,aesGcmTV0Tag,16))) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		aes0.gmac(iv,(const void *)0,0,(const void *)0,0,tag);
+		if (memcmp(tag,aesGcmTV0EmptyTag,16)) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		aes0.decrypt(aesGcmTV0Ct,ct); // the keystream block is E(counter 2) since the plaintext is zero
+		if (memcmp(ct,iv,16)) {
+			std::cout << "FAIL (decrypt)" << std::endl;
+			return -1;
+		}
+		for(unsigned int i=0;i<32;++i) key[i] = (uint8_t)i;
+		for(unsigned int i=0;i<12;++i) iv[i] = (uint8_t)(0x10 + i);
+		for(unsigned int i=0;i<13;++i) aad[i] = (uint8_t)(0xa0 + i);
+		for(unsigned int i=0;i<100;++i) pt[i] = (uint8_t)(i * 7);
+		AES aes1(key);
+		aes1.ctr(iv,pt,100,ct);
+		aes1.gmac(iv,aad,13,ct,100,tag);
+		if ((memcmp(ct,aesGcmTV1Ct,100))||(memcmp(tag,aesGcmTV1Tag,16))) {
+			std::cout << "FAIL (3)" << std::endl;
+			return -1;
+		}
+		aes1.ctr(iv,ct,100,ct);
+		if (memcmp(ct,pt,100)) {
+			std::cout << "FAIL (4)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	} else {
+		std::cout << "[crypto] No hardware AES, skipping AES tests" << std::endl;
+	}
 
 	/*
 	for(unsigned int d=8;d<=10;++d) {
@@ -350,6 +606,33 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Testing X25519 against RFC 7748 test vectors... "; std::cout.flush();
+	{
+		static const unsigned char alicePriv[32] = {0x77,0x07,0x6d,0x0a,0x73,0x18,0xa5,0x7d,0x3c,0x16,0xc1,0x72,0x51,0xb2,0x66,0x45,0xdf,0x4c,0x2f,0x87,0xeb,0xc0,0x99,0x2a,0xb1,0x77,0xfb,0xa5,0x1d,0xb9,0x2c,0x2a};
+		static const unsigned char alicePub[32] = {0x85,0x20,0xf0,0x09,0x89,0x30,0xa7,0x54,0x74,0x8b,0x7d,0xdc,0xb4,0x3e,0xf7,0x5a,0x0d,0xbf,0x3a,0x0d,0x26,0x38,0x1a,0xf4,0xeb,0xa4,0xa9,0x8e,0xaa,0x9b,0x4e,0x6a};
+		static const unsigned char bobPriv[32] = {0x5d,0xab,0x08,0x7e,0x62,0x4a,0x8a,0x4b,0x79,0xe1,0x7f,0x8b,0x83,0x80,0x0e,0xe6,0x6f,0x3b,0xb1,0x29,0x26,0x18,0xb6,0xfd,0x1c,0x2f,0x8b,0x27,0xff,0x88,0xe0,0xeb};
+		static const unsigned char bobPub[32] = {0xde,0x9e,0xdb,0x7d,0x7b,0x7d,0xc1,0xb4,0xd3,0x5b,0x61,0xc2,0xec,0xe4,0x35,0x37,0x3f,0x83,0x43,0xc8,0x5b,0x78,0x67,0x4d,0xad,0xfc,0x7e,0x14,0x6f,0x88,0x2b,0x4f};
+		static const unsigned char shared[32] = {0x4a,0x5d,0x9d,0x5b,0xa4,0xce,0x2d,0xe1,0x72,0x8e,0x3b,0xf4,0x80,0x35,0x0f,0x25,0xe0,0x7e,0x21,0xc9,0x47,0xd1,0x9e,0x33,0x76,0xf0,0x9b,0x3c,0x1e,0x16,0x17,0x42};
+		C25519::Private ap,bp;
+		C25519::Public apub,bpub;
+		memset(ap.data,0,ap.size());
+		memset(bp.data,0,bp.size());
+		memset(apub.data,0,apub.size());
+		memset(bpub.data,0,bpub.size());
+		memcpy(ap.data,alicePriv,32);
+		memcpy(bp.data,bobPriv,32);
+		memcpy(apub.data,alicePub,32);
+		memcpy(bpub.data,bobPub,32);
+		SHA512::hash(buf3,shared,32); // agree() returns SHA-512 of the shared secret
+		C25519::agree(ap,bpub,buf1,64);
+		C25519::agree(bp,apub,buf2,64);
+		if ((memcmp(buf1,buf3,64))||(memcmp(buf2,buf3,64))) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[crypto] Testing C25519 ECC key agreement... "; std::cout.flush();
 	for(unsigned int i=0;i<100;++i) {
 		memset(buf1,64,sizeof(buf1));
@@ -421,6 +704,138 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Benchmarking Ed25519 signing... "; std::cout.flush();
+	const uint64_t sst = OSUtils::now();
+	for(unsigned int k=0;k<1000;++k) {
+		C25519::sign(bp[k & 7],buf1,64);
+	}
+	const uint64_t set = OSUtils::now();
+	std::cout << ((double)(set - sst) / 1000.0) << "ms per signature (" << (1000000.0 / (double)((set > sst) ? (set - sst) : 1)) << " signatures/second)" << std::endl;
+
+	std::cout << "[crypto] Testing Ed25519 batch verification... "; std::cout.flush();
+	{
+		C25519::Pair bkeys[4];
+		for(unsigned int k=0;k<4;++k)
+			bkeys[k] = C25519::generate();
+		unsigned char bmsg[ZT_C25519_VERIFY_BATCH_MAX][64];
+		C25519::Signature bsig[ZT_C25519_VERIFY_BATCH_MAX];
+		C25519::VerifyBatchEntry be[ZT_C25519_VERIFY_BATCH_MAX];
+		bool bvalid[ZT_C25519_VERIFY_BATCH_MAX];
+		for(unsigned int i=0;i<10;++i) {
+			// Several signatures per key so same-key terms get merged
+			for(unsigned int k=0;k<ZT_C25519_VERIFY_BATCH_MAX;++k) {
+				for(unsigned int j=0;j<64;++j)
+					bmsg[k][j] = (unsigned char)rand();
+				bsig[k] = C25519::sign(bkeys[k & 3],bmsg[k],64);
+				be[k].their = &(bkeys[k & 3].pub);
+				be[k].msg = bmsg[k];
+				be[k].len = 64;
+				be[k].signature = bsig[k].data;
+			}
+			if (!C25519::verifyBatch(be,ZT_C25519_VERIFY_BATCH_MAX,bvalid)) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+			const unsigned int bad = (unsigned int)rand() % ZT_C25519_VERIFY_BATCH_MAX;
+			for(unsigned int k=0;k<ZT_C25519_VERIFY_BATCH_MAX;++k) {
+				for(unsigned int j=0;j<64;++j)
+					bmsg[k][j] = (unsigned char)rand();
+				bsig[k] = C25519::sign(bkeys[k & 3],bmsg[k],64);
+			}
+			bsig[bad].data[(unsigned int)rand() % 64] ^= (unsigned char)(1 << (rand() & 7));
+			if (C25519::verifyBatch(be,ZT_C25519_VERIFY_BATCH_MAX,bvalid)) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+			for(unsigned int k=0;k<ZT_C25519_VERIFY_BATCH_MAX;++k) {
+				if (bvalid[k] != (k != bad)) {
+					std::cout << "FAIL (3)" << std::endl;
+					return -1;
+				}
+			}
+			if (C25519::verify(bkeys[bad & 3].pub,bmsg[bad],64,bsig[bad])) {
+				std::cout << "FAIL (4)" << std::endl;
+				return -1;
+			}
+			be[0].their = &(bkeys[1].pub); // signed by key 0
+			if ((C25519::verifyBatch(be,ZT_C25519_VERIFY_BATCH_MAX,bvalid))||(bvalid[0])) {
+				std::cout << "FAIL (5)" << std::endl;
+				return -1;
+			}
+			be[0].their = &(bkeys[0].pub);
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[crypto] Benchmarking Ed25519 verify() vs. verifyBatch()... "; std::cout.flush();
+		for(unsigned int k=0;k<ZT_C25519_VERIFY_BATCH_MAX;++k) {
+			for(unsigned int j=0;j<64;++j)
+				bmsg[k][j] = (unsigned char)rand();
+			bsig[k] = C25519::sign(bkeys[k & 3],bmsg[k],64);
+		}
+		uint64_t bst = OSUtils::now();
+		for(unsigned int k=0;k<ZT_C25519_VERIFY_BATCH_MAX;++k)
+			C25519::verify(bkeys[k & 3].pub,bmsg[k],64,bsig[k]);
+		uint64_t bet = OSUtils::now();
+		std::cout << ((double)(bet - bst) / (double)ZT_C25519_VERIFY_BATCH_MAX) << "ms vs. ";
+		bst = OSUtils::now();
+		for(unsigned int r=0;r<4;++r)
+			C25519::verifyBatch(be,ZT_C25519_VERIFY_BATCH_MAX,bvalid);
+		bet = OSUtils::now();
+		std::cout << ((double)(bet - bst) / (double)(4 * ZT_C25519_VERIFY_BATCH_MAX)) << "ms per signature" << std::endl;
+	}
+
+	std::cout << "[crypto] Testing signature cache... "; std::cout.flush();
+	{
+		SignatureCache *sc = new SignatureCache();
+		Identity sid;
+		sid.generate();
+		for(unsigned int k=0;k<sizeof(buf1);++k)
+			buf1[k] = (unsigned char)rand();
+		C25519::Signature sig = sid.sign(buf1,sizeof(buf1));
+		if ((sc->contains(sid.publicKey(),buf1,sizeof(buf1),sig.data))||(!sc->verify(sid,buf1,sizeof(buf1),sig))||(!sc->contains(sid.publicKey(),buf1,sizeof(buf1),sig.data))) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		C25519::Signature sig2(sig);
+		sig2.data[5] ^= 0x10;
+		if ((sc->verify(sid,buf1,sizeof(buf1),sig2))||(sc->contains(sid.publicKey(),buf1,sizeof(buf1),sig2.data))) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		++buf1[9];
+		if (sc->verify(sid,buf1,sizeof(buf1),sig)) {
+			std::cout << "FAIL (3)" << std::endl;
+			return -1;
+		}
+		--buf1[9];
+		uint64_t cst = OSUtils::now();
+		for(unsigned int k=0;k<10000;++k) {
+			if (!sc->verify(sid,buf1,sizeof(buf1),sig)) {
+				std::cout << "FAIL (4)" << std::endl;
+				return -1;
+			}
+		}
+		uint64_t cet = OSUtils::now();
+		// Fill well past capacity and check that the cache stays bounded
+		unsigned char fill[16];
+		for(unsigned int k=0;k<(ZT_SIGNATURE_CACHE_SETS * ZT_SIGNATURE_CACHE_WAYS * 2);++k) {
+			memcpy(fill,&k,sizeof(k));
+			sc->add(sid.publicKey(),fill,sizeof(fill),sig.data);
+		}
+		unsigned int cached = 0;
+		for(unsigned int k=0;k<(ZT_SIGNATURE_CACHE_SETS * ZT_SIGNATURE_CACHE_WAYS * 2);++k) {
+			memcpy(fill,&k,sizeof(k));
+			if (sc->contains(sid.publicKey(),fill,sizeof(fill),sig.data))
+				++cached;
+		}
+		if ((cached > (ZT_SIGNATURE_CACHE_SETS * ZT_SIGNATURE_CACHE_WAYS))||(cached < ZT_SIGNATURE_CACHE_SETS)) {
+			std::cout << "FAIL (5)" << std::endl;
+			return -1;
+		}
+		delete sc;
+		std::cout << "PASS (" << ((double)(cet - cst) * 1000.0 / 10000.0) << "us per cached verify)" << std::endl;
+	}
+
 	return 0;
 }
 
@@ -499,6 +914,34 @@ static int testIdentity()
 		}
 	}
 
+	{
+		std::cout << "[identity] Deserialize with BufferReader (incl. truncated): ";
+		buf.clear();
+		id.serialize(buf,false);
+		InetAddress(std::string("10.1.2.3/9993").c_str()).serialize(buf);
+		const unsigned int fullSize = buf.size();
+		Identity id2;
+		InetAddress a2;
+		BufferReader r(buf);
+		if ((!id2.deserialize(r))||(id != id2)||(!a2.deserialize(r))||(a2 != InetAddress(std::string("10.1.2.3/9993").c_str()))||(!r.atEnd())||(!r.ok())) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		for(unsigned int l=0;l<fullSize;++l) {
+			buf.setSize(l);
+			BufferReader r2(buf);
+			if ((id2.deserialize(r2))&&(a2.deserialize(r2))) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+			if ((r2.ok())||(r2.next<uint64_t>() != 0)||(r2.nextField(1))) {
+				std::cout << "FAIL (3)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
 	{
 		Identity id2;
 		id2.fromString(id.toString(true,buf2));
@@ -587,6 +1030,78 @@ static int testCertificate()
 		return -1;
 	}
 
+	std::cout << "[certificate] Testing credential serialization round trip... "; std::cout.flush();
+	Buffer<4096> creds;
+	{
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		cA.sign(authority);
+		Tag t(nwid,12345,idA.address(),7,42);
+		t.sign(authority);
+		CertificateOfOwnership coo(nwid,12345,idA.address(),3);
+		coo.addThing(InetAddress("10.1.2.3/0"));
+		coo.addThing(MAC(0x32aabbccddeeULL));
+		coo.sign(authority);
+		ZT_VirtualNetworkRule rules[2];
+		memset(rules,0,sizeof(rules));
+		rules[0].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+		rules[0].v.etherType = 0x0800;
+		rules[1].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		Capability cap(9,nwid,12345,3,rules,2);
+		cap.sign(authority,idA.address());
+		Revocation rev(5,nwid,9,12345,ZT_REVOCATION_FLAG_FAST_PROPAGATE,idA.address(),Credential::CREDENTIAL_TYPE_CAPABILITY);
+		rev.sign(authority);
+		cA.serialize(creds);
+		t.serialize(creds);
+		coo.serialize(creds);
+		cap.serialize(creds);
+		rev.serialize(creds);
+
+		CertificateOfMembership cA2;
+		Tag t2;
+		CertificateOfOwnership coo2;
+		Capability cap2;
+		Revocation rev2;
+		unsigned int p = 0;
+		p += cA2.deserialize(creds,p);
+		p += t2.deserialize(creds,p);
+		p += coo2.deserialize(creds,p);
+		p += cap2.deserialize(creds,p);
+		p += rev2.deserialize(creds,p);
+		Buffer<4096> again;
+		cA2.serialize(again);
+		t2.serialize(again);
+		coo2.serialize(again);
+		cap2.serialize(again);
+		rev2.serialize(again);
+		if ((p != creds.size())||(again != creds)||(!(cA2 == cA))||(t2.value() != 42)||(!coo2.owns(MAC(0x32aabbccddeeULL)))) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[certificate] Benchmarking credential decode (COM, tag, COO, capability, revocation)... "; std::cout.flush();
+	{
+		CertificateOfMembership dcom;
+		Tag dtag;
+		CertificateOfOwnership dcoo;
+		Capability dcap;
+		Revocation drev;
+		unsigned long n = 0;
+		const uint64_t start = OSUtils::now();
+		for(unsigned int k=0;k<1000000;++k) {
+			unsigned int p = 0;
+			p += dcom.deserialize(creds,p);
+			p += dtag.deserialize(creds,p);
+			p += dcoo.deserialize(creds,p);
+			p += dcap.deserialize(creds,p);
+			p += drev.deserialize(creds,p);
+			n += p;
+		}
+		const uint64_t end = OSUtils::now();
+		std::cout << ((5000000.0 / (double)((end > start) ? (end - start) : 1)) * 1000.0) << " credentials/second (" << (n / 1000000) << " bytes each round)" << std::endl;
+	}
+
 	return 0;
 }
 
@@ -623,13 +1138,285 @@ static int testPacket()
 		return -1;
 	}
 
+	// Falls back to LZ4 without zstd, so this round trip holds either way
+	a.compressZstd();
+	const unsigned int zcomplen = a.size();
+	if ((!a.compressed())||(((((unsigned char)a[ZT_PACKET_IDX_VERB] & ZT_PROTO_VERB_FLAG_ZSTD) != 0)) != Packet::zstdAvailable())||(!a.uncompress())||(a != b)) {
+		std::cout << "FAIL (zstd compression)" << std::endl;
+		return -1;
+	}
+	std::cout << "(" << ((Packet::zstdAvailable()) ? "zstd" : "no zstd, LZ4") << ": " << zcomplen << ") ";
+
 	a.armor(salsaKey,true,0);
 	if (!a.dearmor(salsaKey)) {
 		std::cout << "FAIL (encrypt-decrypt/verify)" << std::endl;
 		return -1;
 	}
 
+	{
+		// Counter based packet IDs must stay distinct after armor() overwrites their low bits
+		Packet p1(Address(),Address(),Packet::VERB_NOP);
+		Packet p2(Address(),Address(),Packet::VERB_NOP);
+		p1.armor(salsaKey,true,7);
+		p2.armor(salsaKey,true,7);
+		if (p1.packetId() == p2.packetId()) {
+			std::cout << "FAIL (packet ID repeated)" << std::endl;
+			return -1;
+		}
+	}
+
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing armor/dearmor at all sizes... "; std::cout.flush();
+	Salsa20 salsaKeySchedule(salsaKey,s20TV0Iv);
+	for(unsigned int len=0;len<=(ZT_PROTO_MAX_PACKET_LENGTH - ZT_PACKET_IDX_PAYLOAD);len+=((len < 1100) ? 1 : 37)) {
+		for(int encrypt=0;encrypt<2;++encrypt) {
+			a.reset(Address(),Address(),Packet::VERB_FRAME);
+			for(unsigned int i=0;i<len;++i)
+				a.append((uint8_t)(i ^ salsaKey[i & 31]));
+			b = a;
+			Packet scheduled(a);
+			a.armor(salsaKey,encrypt != 0,0);
+			Packet armored(a);
+			scheduled.armor(salsaKey,encrypt != 0,0,&salsaKeySchedule);
+			if ((scheduled != armored)||(!scheduled.dearmor(salsaKey,(const AES *)0,&salsaKeySchedule))||(memcmp(scheduled.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),scheduled.size() - ZT_PACKET_IDX_VERB))) {
+				std::cout << "FAIL (key schedule, length " << len << ", encrypt " << encrypt << ")" << std::endl;
+				return -1;
+			}
+			if ((!a.dearmor(salsaKey))||(memcmp(a.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),a.size() - ZT_PACKET_IDX_VERB))) {
+				std::cout << "FAIL (length " << len << ", encrypt " << encrypt << ")" << std::endl;
+				return -1;
+			}
+			// A failed dearmor must leave the packet as it was received
+			armored[armored.size() - 1] ^= 0x01;
+			Packet tampered(armored);
+			if ((armored.dearmor(salsaKey))||(armored != tampered)) {
+				std::cout << "FAIL (tampered, length " << len << ", encrypt " << encrypt << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing group key armor/dearmor... "; std::cout.flush();
+	for(unsigned int len=0;len<=(ZT_PROTO_MAX_PACKET_LENGTH - ZT_PACKET_IDX_PAYLOAD);len+=((len < 1100) ? 7 : 211)) {
+		a.reset(Address(),Address((uint64_t)0x1234567890ULL),Packet::VERB_MULTICAST_FRAME);
+		for(unsigned int i=0;i<len;++i)
+			a.append((uint8_t)(i ^ salsaKey[i & 31]));
+		b = a;
+		a.armorGroup(salsaKey);
+		// Each recipient gets the same ciphertext with only its address changed
+		Packet r1(a),r2(a);
+		r1.setDestination(Address((uint64_t)0x0102030405ULL));
+		r2.setDestination(Address((uint64_t)0x0a0b0c0d0eULL));
+		r2.setFragmented(true);
+		r2.incrementHops();
+		if ((a.cipher() != ZT_PROTO_CIPHER_SUITE__GROUP_POLY1305_SALSA2012)||(!r1.dearmorGroup(salsaKey))||(!r2.dearmorGroup(salsaKey))||(memcmp(r1.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),r1.size() - ZT_PACKET_IDX_VERB))||(memcmp(r2.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),r2.size() - ZT_PACKET_IDX_VERB))) {
+			std::cout << "FAIL (length " << len << ")" << std::endl;
+			return -1;
+		}
+		// Nor may another member claim to have sent it, or a peer key open it
+		Packet forged(a);
+		forged.setSource(Address((uint64_t)0x0102030405ULL));
+		Packet tampered(forged);
+		if ((forged.dearmorGroup(salsaKey))||(forged != tampered)||(a.dearmor(salsaKey))) {
+			std::cout << "FAIL (forged, length " << len << ")" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (AES::accelerated()) {
+		std::cout << "[packet] Testing AES-GMAC-SIV armor/dearmor at all sizes... "; std::cout.flush();
+		uint8_t aesKeyBytes[64];
+		SHA512::hash(aesKeyBytes,salsaKey,32);
+		AES aesKeys[2];
+		aesKeys[0].init(aesKeyBytes);
+		aesKeys[1].init(aesKeyBytes + 32);
+		for(unsigned int len=0;len<=(ZT_PROTO_MAX_PACKET_LENGTH - ZT_PACKET_IDX_PAYLOAD);len+=((len < 1100) ? 1 : 37)) {
+			a.reset(Address(),Address(),Packet::VERB_FRAME);
+			for(unsigned int i=0;i<len;++i)
+				a.append((uint8_t)(i ^ salsaKey[i & 31]));
+			b = a;
+			a.armorAesGmacSiv(aesKeys,0);
+			a.incrementHops(); // relays change the hop count, which must not break the MAC
+			Packet armored(a);
+			if ((a.cipher() != ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV)||(!a.dearmor(salsaKey,aesKeys))||(a.packetId() != (b.packetId() & 0xfffffffffffffff8ULL))||(memcmp(a.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),a.size() - ZT_PACKET_IDX_VERB))) {
+				std::cout << "FAIL (length " << len << ")" << std::endl;
+				return -1;
+			}
+			armored[armored.size() - 1] ^= 0x01;
+			Packet tampered(armored);
+			if ((armored.dearmor(salsaKey,aesKeys))||(armored != tampered)||(tampered.dearmor(salsaKey))) {
+				std::cout << "FAIL (tampered, length " << len << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[packet] Testing AES-GMAC-SIV with a repeated packet ID... "; std::cout.flush();
+		{
+			Packet p1(Address(),Address(),Packet::VERB_FRAME),p2(p1);
+			p1.append("first payload",13);
+			p2.append("other payload",13);
+			p1.armorAesGmacSiv(aesKeys,0);
+			p2.armorAesGmacSiv(aesKeys,0);
+			// Only the synthetic IV may be sent, so the packet ID and MAC fields differ
+			if ((!memcmp(p1.field(ZT_PACKET_IDX_IV,8),p2.field(ZT_PACKET_IDX_IV,8),8))||(!memcmp(p1.field(ZT_PACKET_IDX_MAC,8),p2.field(ZT_PACKET_IDX_MAC,8),8))) {
+				std::cout << "FAIL (raw MAC on the wire)" << std::endl;
+				return -1;
+			}
+			Packet p2t(p2);
+			p2t[ZT_PACKET_IDX_VERB + 3] ^= 0x20;
+			if ((p2t.dearmor(salsaKey,aesKeys))||(!p1.dearmor(salsaKey,aesKeys))||(!p2.dearmor(salsaKey,aesKeys))||(p1.packetId() != p2.packetId())) {
+				std::cout << "FAIL (tampered)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[packet] Benchmarking AES-GMAC-SIV armor() of 2800 byte packets... "; std::cout.flush();
+		a.reset(Address(),Address(),Packet::VERB_FRAME);
+		while (a.size() < 2800)
+			a.append((uint8_t)a.size());
+		long double bytes = 0.0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<200000;++i) {
+			a.armorAesGmacSiv(aesKeys,i);
+			bytes += (long double)a.size();
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
+	}
+
+	std::cout << "[packet] Benchmarking armor() of 2800 byte packets (single pass)... "; std::cout.flush();
+	{
+		a.reset(Address(),Address(),Packet::VERB_FRAME);
+		while (a.size() < 2800)
+			a.append((uint8_t)a.size());
+		long double bytes = 0.0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<200000;++i) {
+			a.armor(salsaKey,true,i);
+			bytes += (long double)a.size();
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
+	}
+
+	for(int sched=0;sched<2;++sched) {
+		std::cout << "[packet] Benchmarking armor() and dearmor() of 96 byte packets" << ((sched) ? " (key schedule)" : "") << "... "; std::cout.flush();
+		a.reset(Address(),Address(),Packet::VERB_ECHO);
+		while (a.size() < 96)
+			a.append((uint8_t)a.size());
+		const Salsa20 *const ks = (sched) ? &salsaKeySchedule : (const Salsa20 *)0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<1000000;++i) {
+			a.armor(salsaKey,true,i,ks);
+			a.dearmor(salsaKey,(const AES *)0,ks);
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << (1000000.0 / ((double)(end - start) / 1000.0)) << " packets/second" << std::endl;
+	}
+
+	std::cout << "[packet] Benchmarking Salsa20/12 then Poly1305 over 2800 bytes (two passes)... "; std::cout.flush();
+	{
+		uint8_t pkt[2800];
+		uint64_t macKey[4],mac[2];
+		const uint8_t zero[32] = { 0 };
+		memset(pkt,0,sizeof(pkt));
+		long double bytes = 0.0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<200000;++i) {
+			Salsa20 s20(salsaKey,pkt);
+			s20.crypt12(zero,macKey,sizeof(macKey));
+			s20.crypt12(pkt + ZT_PACKET_IDX_VERB,pkt + ZT_PACKET_IDX_VERB,sizeof(pkt) - ZT_PACKET_IDX_VERB);
+			Poly1305::compute(mac,pkt + ZT_PACKET_IDX_VERB,sizeof(pkt) - ZT_PACKET_IDX_VERB,macKey);
+			pkt[0] = (uint8_t)mac[0];
+			bytes += (long double)sizeof(pkt);
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
+	}
+
+	std::cout << "[packet] Testing pooled packet buffers... "; std::cout.flush();
+	{
+		Packet *first = new Packet(Address(0x0102030405ULL),Address(0x0a0b0c0d0eULL),Packet::VERB_ECHO);
+		first->append("pool",4);
+		const void *const firstPtr = first;
+		SharedPtr<Packet> sp(first);
+		SharedPtr<Packet> sp2(sp);
+		Packet copy(*sp); // copying must not copy the reference count
+		SharedPtr<Packet> sp3(new Packet(copy));
+		if ((sp3 == sp)||(sp3->size() != sp->size())||(memcmp(sp3->data(),sp->data(),sp->size()))) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		sp3.zero();
+		sp.zero();
+		if ((!sp2)||(sp2->destination() != Address(0x0102030405ULL))) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		sp2.zero();
+		// Most recently freed buffer is reused, also by IncomingPacket
+		SharedPtr<IncomingPacket> ip(new IncomingPacket());
+		if ((const void *)ip.ptr() != firstPtr) {
+			std::cout << "FAIL (3)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing FEC parity repair... "; std::cout.flush();
+	{
+		Packet dg[ZT_FEC_GROUP_SIZE];
+		for(unsigned int i=0;i<ZT_FEC_GROUP_SIZE;++i) {
+			dg[i].reset(Address(0x0102030405ULL),Address(0x0a0b0c0d0eULL),Packet::VERB_ECHO);
+			for(unsigned int k=0;k<(i * 150);++k)
+				dg[i].append((uint8_t)(k + i));
+			dg[i].armor(salsaKey,true,i);
+		}
+		Packet::Fragment frag(dg[ZT_FEC_GROUP_SIZE - 1],ZT_PACKET_IDX_PAYLOAD,200,1,2);
+
+		Fec tx,rx,rx2;
+		uint8_t parity[ZT_UDP_DEFAULT_PAYLOAD_MTU];
+		unsigned int plen = 0;
+		for(unsigned int i=0;i<ZT_FEC_GROUP_SIZE;++i) {
+			const void *const d = (i == 2) ? frag.data() : dg[i].data();
+			const unsigned int l = (i == 2) ? frag.size() : dg[i].size();
+			plen = tx.encode(d,l,Address(0x0a0b0c0d0eULL),parity);
+			if ((plen)&&(i != (ZT_FEC_GROUP_SIZE - 1))) {
+				std::cout << "FAIL (early parity)" << std::endl;
+				return -1;
+			}
+			if ((i != 2)&&(i != 5))
+				rx.remember(d,l);
+			if (i != 5)
+				rx2.remember(d,l);
+		}
+		if ((!plen)||(plen > ZT_UDP_DEFAULT_PAYLOAD_MTU)||(!Fec::isParity(parity))) {
+			std::cout << "FAIL (no parity)" << std::endl;
+			return -1;
+		}
+		uint8_t rebuilt[ZT_FEC_MAX_DATAGRAM];
+		if (rx.repair(parity,plen,rebuilt) != -1) {
+			std::cout << "FAIL (two lost)" << std::endl;
+			return -1;
+		}
+		const int rlen = rx2.repair(parity,plen,rebuilt);
+		if ((rlen != (int)dg[5].size())||(memcmp(rebuilt,dg[5].data(),rlen))) {
+			std::cout << "FAIL (one lost)" << std::endl;
+			return -1;
+		}
+		rx2.remember(dg[5].data(),dg[5].size());
+		if (rx2.repair(parity,plen,rebuilt) != 0) {
+			std::cout << "FAIL (none lost)" << std::endl;
+			return -1;
+		}
+	}
 	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
@@ -655,6 +1442,59 @@ static int testOther()
 		return -1;
 	}
 
+	std::cout << "[other] Testing hex/unhex against printf and odd lengths... "; std::cout.flush();
+	for(unsigned int k=0;k<10000;++k) {
+		uint64_t v;
+		Utils::getSecureRandom(&v,sizeof(v));
+		v >>= (k % 64);
+		char a[32],b[32];
+		OSUtils::ztsnprintf(a,sizeof(a),"%.16llx",(unsigned long long)v);
+		OSUtils::ztsnprintf(b,sizeof(b),"%.10llx",(unsigned long long)(v & 0xffffffffffULL));
+		if ((strcmp(a,Utils::hex(v,buf2)) != 0)||(strcmp(b,Utils::hex10(v & 0xffffffffffULL,buf2)) != 0)) {
+			std::cout << "FAIL! (" << a << ")" << std::endl;
+			return -1;
+		}
+		OSUtils::ztsnprintf(a,sizeof(a),"%.8x",(unsigned int)v);
+		if (strcmp(a,Utils::hex((uint32_t)v,buf2)) != 0) {
+			std::cout << "FAIL! (" << a << ")" << std::endl;
+			return -1;
+		}
+		OSUtils::ztsnprintf(a,sizeof(a),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(unsigned int)((v >> 40) & 0xff),(unsigned int)((v >> 32) & 0xff),(unsigned int)((v >> 24) & 0xff),(unsigned int)((v >> 16) & 0xff),(unsigned int)((v >> 8) & 0xff),(unsigned int)(v & 0xff));
+		if (strcmp(a,MAC(v).toString(buf2)) != 0) {
+			std::cout << "FAIL! (" << a << ")" << std::endl;
+			return -1;
+		}
+		OSUtils::ztsnprintf(a,sizeof(a),"%u.%u.%u.%u/%u",(unsigned int)(v >> 24) & 0xff,(unsigned int)(v >> 16) & 0xff,(unsigned int)(v >> 8) & 0xff,(unsigned int)v & 0xff,(unsigned int)(v >> 32) & 0xffff);
+		if (strcmp(a,InetAddress(a).toString(buf2)) != 0) {
+			std::cout << "FAIL! (" << a << ")" << std::endl;
+			return -1;
+		}
+		const unsigned int l = k % 100;
+		Utils::hex(buf,l,buf2);
+		for(unsigned int i=0;i<(l*2);++i) {
+			if ((rand() & 1)&&(buf2[i] >= 'a'))
+				buf2[i] -= 32; // decoding takes upper case too
+		}
+		memset(buf3,0,l + 1);
+		if ((strlen(buf2) != (l * 2))||(Utils::unhex(buf2,buf3,l + 1) != l)||(Utils::unhex(buf2,l * 2,buf3 + 1,l) != l)||(memcmp(buf,buf3 + 1,l) != 0)) {
+			std::cout << "FAIL! (length " << l << ")" << std::endl;
+			return -1;
+		}
+	}
+	{
+		const uint64_t start = OSUtils::now();
+		unsigned long long x = 0;
+		for(unsigned int k=0;k<2000000;++k) {
+			Utils::hex(buf,64,buf2);
+			x += (unsigned long long)Utils::unhex(buf2,buf3,64);
+			x += (unsigned long long)Utils::hex((uint64_t)((uint64_t)k * 0x9e3779b97f4a7c15ULL),buf2)[3];
+			x += (unsigned long long)Utils::hex10((uint64_t)k * 0x9e3779b97f4a7c15ULL,buf2)[5];
+			x += (unsigned long long)InetAddress((const void *)&k,4,9993).toString(buf2)[1];
+		}
+		const uint64_t end = OSUtils::now();
+		std::cout << "PASS (" << (2000000.0 / ((double)std::max(end - start,(uint64_t)1) / 1000.0)) << " rounds/second, " << (x & 1) << ")" << std::endl;
+	}
+
 	std::cout << "[other] Testing InetAddress encode/decode..."; std::cout.flush();
 	std::cout << " " << InetAddress("127.0.0.1/9993").toString(buf);
 	std::cout << " " << InetAddress("feed:dead:babe:dead:beef:f00d:1234:5678/12345").toString(buf);
@@ -662,7 +1502,57 @@ static int testOther()
 	std::cout << " " << InetAddress("").toString(buf);
 	std::cout << std::endl;
 
-#if 0
+	std::cout << "[other] Testing CompactInetAddress round trip..."; std::cout.flush();
+	{
+		const char *const addrs[3] = { "127.0.0.1/9993","feed:dead:babe:dead:beef:f00d:1234:5678/12345","" };
+		for(int i=0;i<3;++i) {
+			const InetAddress a(addrs[i]);
+			const CompactInetAddress c(a);
+			if ((c.toInetAddress() != a)||(c != a)||(c != CompactInetAddress(c.toInetAddress()))||(c.port() != a.port())||((bool)c != (bool)a)) {
+				std::cout << " FAILED (" << addrs[i] << ")" << std::endl;
+				return -1;
+			}
+		}
+		if (CompactInetAddress(InetAddress("10.0.0.1/9993")) == InetAddress("10.0.0.1/9994")) {
+			std::cout << " FAILED (port ignored)" << std::endl;
+			return -1;
+		}
+		std::cout << " " << sizeof(CompactInetAddress) << " bytes vs. " << sizeof(InetAddress) << ", OK" << std::endl;
+	}
+
+	std::cout << "[other] Testing SmallMap against std::map..."; std::cout.flush();
+	{
+		SmallMap<uint32_t,std::string,2> sm2;
+		SmallMap<uint32_t,std::string,0> sm0;
+		std::map<uint32_t,std::string> ref;
+		for(int k=0;k<20000;++k) {
+			const uint32_t key = (uint32_t)(rand() % 8); // small key space so maps grow and shrink through the inline size
+			if (rand() & 1) {
+				ref[key] = sm2[key] = sm0[key] = std::to_string(k);
+			} else {
+				ref.erase(key);
+				sm2.erase(key);
+				sm0.erase(key);
+			}
+			if (k % 7 == 0) {
+				const SmallMap<uint32_t,std::string,2> copy(sm2);
+				sm2 = copy;
+			}
+			bool ok = ((sm2.size() == ref.size())&&(sm0.size() == ref.size())&&((sm2.size() > 2) == (sm2.footprint() != 0)));
+			unsigned int i = 0;
+			for(std::map<uint32_t,std::string>::const_iterator r(ref.begin());(ok)&&(r!=ref.end());++r,++i) {
+				const std::string *const v = sm2.get(r->first);
+				ok = ((v)&&(*v == r->second)&&(sm2.keyAt(i) == r->first)&&(sm0.valueAt(i) == r->second));
+			}
+			if (!ok) {
+				std::cout << " FAILED (step " << k << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << " OK (Membership is " << sizeof(Membership) << " bytes)" << std::endl;
+	}
+
+#if 0
 	std::cout << "[other] Testing Hashtable... "; std::cout.flush();
 	{
 		Hashtable<uint64_t,std::string> ht;
@@ -739,94 +1629,1311 @@ static int testOther()
 					std::cout << "FAILED! (key " << i->first << "  not found, copied)" << std::endl;
 					return -1;
 				}
-				if (*v != i->second) {
-					std::cout << "FAILED! (key " << i->first << "  not equal, copied)" << std::endl;
+				if (*v != i->second) {
+					std::cout << "FAILED! (key " << i->first << "  not equal, copied)" << std::endl;
+					return -1;
+				}
+			}
+			{
+				uint64_t *k;
+				std::string *v;
+				Hashtable<uint64_t,std::string>::Iterator i(ht);
+				unsigned long ic = 0;
+				while (i.next(k,v)) {
+					if (ref[*k] != *v) {
+						std::cout << "FAILED! (iterate)" << std::endl;
+						return -1;
+					}
+					++ic;
+				}
+				if (ic != ht.size()) {
+					std::cout << "FAILED! (iterate coverage)" << std::endl;
+					return -1;
+				}
+			}
+			{
+				// Resuming from position() in slices, as incremental housekeeping does, must cover everything
+				std::set<uint64_t> seen;
+				unsigned long pos = 0;
+				for(;;) {
+					uint64_t *k;
+					std::string *v;
+					Hashtable<uint64_t,std::string>::Iterator i(ht,pos);
+					unsigned int n = 0;
+					bool done = false;
+					while (n < 100) {
+						if (!i.next(k,v)) {
+							done = true;
+							break;
+						}
+						seen.insert(*k);
+						++n;
+					}
+					if (done)
+						break;
+					pos = i.position();
+				}
+				if (seen.size() != ht.size()) {
+					std::cout << "FAILED! (resumed iterate coverage)" << std::endl;
+					return -1;
+				}
+			}
+			for(std::map<uint64_t,std::string>::iterator i(ref.begin());i!=ref.end();) {
+				if (!ht.get(i->first)) {
+					std::cout << "FAILED! (erase, check if exists)" << std::endl;
+					return -1;
+				}
+				ht.erase(i->first);
+				if (ht.get(i->first)) {
+					std::cout << "FAILED! (erase, check if erased)" << std::endl;
+					return -1;
+				}
+				ref.erase(i++);
+				if (ht.size() != ref.size()) {
+					std::cout << "FAILED! (erase, size)" << std::endl;
+					return -1;
+				}
+			}
+			if (!ht.empty()) {
+				std::cout << "FAILED! (erase, empty)" << std::endl;
+				return -1;
+			}
+			for(int i=0;i<10000;++i) {
+				uint64_t k = rand();
+				while ((k == 0)||(ref.count(k) > 0))
+					++k;
+				std::string v;
+				for(int j=0;j<(int)(k % 64);++j)
+					v.push_back("0123456789"[rand() % 10]);
+				ht.set(k,v);
+				ref[k] = v;
+			}
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (second populate)" << std::endl;
+				return -1;
+			}
+			ht.clear();
+			ref.clear();
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (clear)" << std::endl;
+				return -1;
+			}
+			for(int i=0;i<10000;++i) {
+				uint64_t k = rand();
+				while ((k == 0)||(ref.count(k) > 0))
+					++k;
+				std::string v;
+				for(int j=0;j<(int)(k % 64);++j)
+					v.push_back("0123456789"[rand() % 10]);
+				ht.set(k,v);
+				ref[k] = v;
+			}
+			{
+				Hashtable<uint64_t,std::string>::Iterator i(ht);
+				uint64_t *k;
+				std::string *v;
+				while (i.next(k,v))
+					ht.erase(*k);
+			}
+			ref.clear();
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (clear by iterate, " << ht.size() << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+	std::cout << "[other] Testing Bloom filter... "; std::cout.flush();
+	{
+		Bloom<1024> bf;
+		for(uint64_t k=1;k<=64;++k)
+			bf.set(k * 0x10000000001ULL);
+		for(uint64_t k=1;k<=64;++k) {
+			if (!bf.maybe(k * 0x10000000001ULL)) {
+				std::cout << "FAIL (false negative)" << std::endl;
+				return -1;
+			}
+		}
+		unsigned int fp = 0;
+		for(uint64_t k=65;k<=10064;++k) {
+			if (bf.maybe(k * 0x10000000001ULL))
+				++fp;
+		}
+		if (fp > 200) {
+			std::cout << "FAIL (" << fp << " false positives in 10000)" << std::endl;
+			return -1;
+		}
+		bf.clear();
+		if (bf.maybe(0x10000000001ULL)) {
+			std::cout << "FAIL (clear)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << fp << " false positives in 10000)" << std::endl;
+	}
+
+	std::cout << "[other] Testing TimerWheel... "; std::cout.flush();
+	{
+		// Deadlines from the past to beyond the top level's span, checked at an uneven pace
+		const uint64_t start = 1000000007ULL;
+		TimerWheel<unsigned int> tw(500,start);
+		std::vector<uint64_t> deadlines;
+		for(unsigned int i=0;i<20000;++i) {
+			const uint64_t d = (start - 1000) + ((uint64_t)rand() % ((i < 19990) ? 3600000ULL : 200000000ULL));
+			deadlines.push_back(d);
+			tw.add(d,i);
+		}
+		std::vector<bool> fired(deadlines.size(),false);
+		std::vector<unsigned int> due;
+		uint64_t now = start;
+		unsigned long count = 0;
+		while (tw.size()) {
+			const uint64_t last = now;
+			now += 1 + ((uint64_t)rand() % ((now < (start + 4000000ULL)) ? 2000 : 100000000ULL));
+			due.clear();
+			tw.advance(now,due);
+			for(std::vector<unsigned int>::const_iterator i(due.begin());i!=due.end();++i) {
+				// Nothing early, and nothing that was already a full tick overdue at the last advance
+				if ((fired[*i])||(deadlines[*i] > now)||((deadlines[*i] >= start)&&((deadlines[*i] + 500) <= last))) {
+					std::cout << "FAIL (entry " << *i << " deadline " << deadlines[*i] << " returned at " << now << ")" << std::endl;
+					return -1;
+				}
+				fired[*i] = true;
+				++count;
+			}
+		}
+		if (count != deadlines.size()) {
+			std::cout << "FAIL (" << count << " of " << deadlines.size() << " returned)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing BridgeRouteTable... "; std::cout.flush();
+	{
+		// Random learning checked against a naive list kept in recency order
+		BridgeRouteTable brt(64,24);
+		std::vector< std::pair<MAC,Address> > model; // most recently learned first
+		for(unsigned int i=0;i<200000;++i) {
+			const MAC mac((uint64_t)(rand() % 200) + 1);
+			const Address bridge((uint64_t)(rand() % ((i < 100000) ? 8 : 2)) + 1);
+			brt.learn(mac,bridge);
+
+			for(std::vector< std::pair<MAC,Address> >::iterator m(model.begin());m!=model.end();++m) {
+				if (m->first == mac) {
+					model.erase(m);
+					break;
+				}
+			}
+			model.insert(model.begin(),std::pair<MAC,Address>(mac,bridge));
+			unsigned long bc = 0;
+			for(std::vector< std::pair<MAC,Address> >::iterator m(model.begin());m!=model.end();++m)
+				bc += (m->second == bridge) ? 1 : 0;
+			if (bc > 24) {
+				for(long k=(long)model.size()-1;k>=0;--k) {
+					if (model[k].second == bridge) {
+						model.erase(model.begin() + k);
+						break;
+					}
+				}
+			}
+			if (model.size() > 64)
+				model.pop_back();
+
+			if (brt.size() != model.size()) {
+				std::cout << "FAIL (size " << brt.size() << ", expected " << model.size() << ")" << std::endl;
+				return -1;
+			}
+			if ((i % 97) == 0) {
+				for(uint64_t k=1;k<=200;++k) {
+					const Address *const a = brt.get(MAC(k));
+					Address expected;
+					for(std::vector< std::pair<MAC,Address> >::iterator m(model.begin());m!=model.end();++m) {
+						if (m->first == MAC(k)) {
+							expected = m->second;
+							break;
+						}
+					}
+					if ((a) ? (*a != expected) : (bool)expected) {
+						std::cout << "FAIL (wrong route for MAC " << k << ")" << std::endl;
+						return -1;
+					}
+				}
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing NeighborCache... "; std::cout.flush();
+	{
+		NeighborCache nc;
+		const uint8_t mapped6[16] = { 0,0,0,0,0,0,0,0,0,0,0xff,0xff,10,1,2,3 };
+		const InetAddress v4("10.1.2.3/0"),v6("fd00::10:1:2:3/0"),mapped(mapped6,16,0);
+		nc.learn(1,v4,Address(0x1111111111ULL),1000);
+		nc.learn(1,v6,Address(0x2222222222ULL),1000);
+		nc.learn(2,v4,Address(0x3333333333ULL),1000);
+		if ((nc.get(1,v4,2000) != Address(0x1111111111ULL))||(nc.get(1,v6,2000) != Address(0x2222222222ULL))||(nc.get(2,v4,2000) != Address(0x3333333333ULL))) {
+			std::cout << "FAIL (lookup)" << std::endl;
+			return -1;
+		}
+		if ((nc.get(3,v4,2000))||(nc.get(2,v6,2000))||(nc.get(1,mapped,2000) != nc.get(1,v4,2000))) {
+			std::cout << "FAIL (wrong network or family)" << std::endl;
+			return -1;
+		}
+		nc.learn(1,v4,Address(0x4444444444ULL),ZT_NEIGHBOR_CACHE_TTL);
+		if ((nc.get(1,v4,ZT_NEIGHBOR_CACHE_TTL + 1000) != Address(0x4444444444ULL))||(nc.get(1,v6,ZT_NEIGHBOR_CACHE_TTL + 1000))) {
+			std::cout << "FAIL (refresh or expiry)" << std::endl;
+			return -1;
+		}
+		for(uint64_t t=ZT_NEIGHBOR_CACHE_TTL + 1000;t<=ZT_NEIGHBOR_CACHE_TTL + ZT_HOUSEKEEPING_PERIOD;t+=ZT_CORE_TIMER_TASK_GRANULARITY)
+			nc.clean(t);
+		if (nc.size() != 1) {
+			std::cout << "FAIL (clean left " << nc.size() << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing IGMP/MLD snooping... "; std::cout.flush();
+	{
+		std::vector<MulticastGroup> joined,left;
+		// IGMPv2 report for 239.1.2.3, then leave
+		uint8_t igmp[28] = { 0x45,0,0,28, 0,0,0,0, 1,2,0,0, 10,0,0,1, 239,1,2,3, 0x16,0,0,0, 239,1,2,3 };
+		const MulticastGroup g4(MAC(0x01,0x00,0x5e,0x01,0x02,0x03),0);
+		if ((Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV4,igmp,sizeof(igmp),joined,left) != Network::MULTICAST_SNOOP_REPORT)||(joined.size() != 1)||(joined[0] != g4)||(!left.empty())) {
+			std::cout << "FAIL (IGMPv2 report)" << std::endl;
+			return -1;
+		}
+		igmp[20] = 0x17;
+		joined.clear();
+		if ((Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV4,igmp,sizeof(igmp),joined,left) != Network::MULTICAST_SNOOP_REPORT)||(!joined.empty())||(left.size() != 1)||(left[0] != g4)) {
+			std::cout << "FAIL (IGMPv2 leave)" << std::endl;
+			return -1;
+		}
+		igmp[20] = 0x11;
+		if (Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV4,igmp,sizeof(igmp),joined,left) != Network::MULTICAST_SNOOP_QUERY) {
+			std::cout << "FAIL (IGMP query)" << std::endl;
+			return -1;
+		}
+		// IGMPv3 report: exclude {} (join) 239.9.9.9, to include {} (leave) 239.1.2.3
+		const uint8_t igmp3[44] = { 0x45,0,0,44, 0,0,0,0, 1,2,0,0, 10,0,0,1, 224,0,0,22, 0x22,0,0,0, 0,0,0,2, 4,0,0,0, 239,9,9,9, 3,0,0,0, 239,1,2,3 };
+		joined.clear(); left.clear();
+		if ((Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV4,igmp3,sizeof(igmp3),joined,left) != Network::MULTICAST_SNOOP_REPORT)||(joined.size() != 1)||(joined[0] != MulticastGroup(MAC(0x01,0x00,0x5e,0x09,0x09,0x09),0))||(left.size() != 1)||(left[0] != g4)) {
+			std::cout << "FAIL (IGMPv3 report)" << std::endl;
+			return -1;
+		}
+		// MLDv2 report behind a hop-by-hop header: exclude {} ff05::1:3, truncated second record
+		uint8_t mld[40 + 8 + 8 + 20 + 4] = { 0x60,0,0,0, 0,40,0,1 };
+		mld[40] = 58; // ICMPv6 after hop-by-hop
+		mld[48] = 143; mld[55] = 2;
+		mld[56] = 2; mld[60] = 0xff; mld[61] = 0x05; mld[73] = 0x01; mld[75] = 0x03;
+		mld[76] = 4;
+		joined.clear(); left.clear();
+		if ((Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV6,mld,sizeof(mld),joined,left) != Network::MULTICAST_SNOOP_REPORT)||(joined.size() != 1)||(joined[0] != MulticastGroup(MAC(0x33,0x33,0x00,0x01,0x00,0x03),0))||(!left.empty())) {
+			std::cout << "FAIL (MLDv2 report)" << std::endl;
+			return -1;
+		}
+		if ((!joined[0].joinedByReport())||(!g4.joinedByReport())||(MulticastGroup(MAC(0x01,0x00,0x5e,0x00,0x00,0xfb),0).joinedByReport())||(MulticastGroup(MAC(0x33,0x33,0x00,0x00,0x00,0x01),0).joinedByReport())||(MulticastGroup(MAC(0x33,0x33,0xff,0x01,0x02,0x03),0).joinedByReport())||(Network::BROADCAST.joinedByReport())) {
+			std::cout << "FAIL (joinedByReport)" << std::endl;
+			return -1;
+		}
+		for(unsigned int l=0;l<sizeof(mld);++l) // truncation must never read past the end
+			Network::snoopMulticastMembership(ZT_ETHERTYPE_IPV6,mld,l,joined,left);
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing TunAdapter... "; std::cout.flush();
+	{
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MAC ours(Address(0x1111111111ULL),nwid),theirs(Address(0x2222222222ULL),nwid);
+		TunAdapter ta(ours,nwid);
+		ta.addLocal(InetAddress("10.1.0.1/16"));
+		const InetAddress our6(InetAddress::makeIpv6rfc4193(nwid,0x1111111111ULL));
+		ta.addLocal(our6);
+		uint8_t pkt[64],q[ZT_TUNADAPTER_BUF_LENGTH];
+		unsigned int et = 0,ql = 0,qet = 0;
+		MAC to,qd;
+
+		memset(pkt,0,sizeof(pkt));
+		pkt[0] = 0x60;
+		memcpy(pkt + 24,InetAddress::makeIpv6rfc4193(nwid,0x2222222222ULL).rawIpData(),16);
+		if ((!ta.outbound(pkt,40,to,et,q,ql,qd,qet))||(to != theirs)||(et != ZT_ETHERTYPE_IPV6)||(ql)) {
+			std::cout << "FAIL (RFC4193 destination)" << std::endl;
+			return -1;
+		}
+
+		memset(pkt,0,sizeof(pkt));
+		pkt[0] = 0x45;
+		pkt[16] = 10; pkt[17] = 1; pkt[18] = 0; pkt[19] = 2;
+		if ((ta.outbound(pkt,20,to,et,q,ql,qd,qet))||(ql != 28)||(qet != ZT_ETHERTYPE_ARP)||(qd != MAC(0xffffffffffffULL))) {
+			std::cout << "FAIL (ARP query)" << std::endl;
+			return -1;
+		}
+		uint8_t arp[28] = { 0x00,0x01,0x08,0x00,0x06,0x04,0x00,0x02 };
+		theirs.copyTo(arp + 8,6);
+		arp[14] = 10; arp[15] = 1; arp[16] = 0; arp[17] = 2;
+		ours.copyTo(arp + 18,6);
+		arp[24] = 10; arp[25] = 1; arp[26] = 0; arp[27] = 1;
+		if ((ta.inbound(theirs,ZT_ETHERTYPE_ARP,arp,28,q,ql,qd,qet))||(!ta.outbound(pkt,20,to,et,q,ql,qd,qet))||(to != theirs)) {
+			std::cout << "FAIL (ARP reply)" << std::endl;
+			return -1;
+		}
+
+		ZT_VirtualNetworkRoute rt;
+		memset(&rt,0,sizeof(rt));
+		*reinterpret_cast<InetAddress *>(&(rt.target)) = InetAddress("192.168.0.0/24");
+		*reinterpret_cast<InetAddress *>(&(rt.via)) = InetAddress("10.1.0.2/0");
+		ta.setRoutes(&rt,1);
+		pkt[16] = 192; pkt[17] = 168; pkt[18] = 0; pkt[19] = 5;
+		if ((!ta.outbound(pkt,20,to,et,q,ql,qd,qet))||(to != theirs)) {
+			std::cout << "FAIL (route via gateway)" << std::endl;
+			return -1;
+		}
+
+		arp[7] = 0x01; // now a request from them for our IP
+		memset(arp + 18,0,6);
+		if ((ta.inbound(theirs,ZT_ETHERTYPE_ARP,arp,28,q,ql,qd,qet))||(ql != 28)||(qd != theirs)||(q[7] != 0x02)||(MAC(q + 8,6) != ours)) {
+			std::cout << "FAIL (ARP answer)" << std::endl;
+			return -1;
+		}
+
+		uint8_t ns[72];
+		memset(ns,0,sizeof(ns));
+		ns[0] = 0x60; ns[5] = 32; ns[6] = 58; ns[7] = 255;
+		memcpy(ns + 8,InetAddress::makeIpv6rfc4193(nwid,0x2222222222ULL).rawIpData(),16);
+		ns[40] = 135;
+		memcpy(ns + 48,our6.rawIpData(),16);
+		if ((ta.inbound(theirs,ZT_ETHERTYPE_IPV6,ns,72,q,ql,qd,qet))||(ql != 72)||(qd != theirs)||(q[40] != 136)||(memcmp(q + 48,our6.rawIpData(),16))||(MAC(q + 66,6) != ours)) {
+			std::cout << "FAIL (neighbor advertisement)" << std::endl;
+			return -1;
+		}
+		uint32_t sum = 58 + 32;
+		for(unsigned int i=8;i<72;i+=2)
+			sum += ((uint32_t)q[i] << 8) | (uint32_t)q[i + 1];
+		while (sum >> 16)
+			sum = (sum & 0xffff) + (sum >> 16);
+		if (sum != 0xffff) {
+			std::cout << "FAIL (neighbor advertisement checksum)" << std::endl;
+			return -1;
+		}
+
+		if (!ta.inbound(theirs,ZT_ETHERTYPE_IPV4,pkt,20,q,ql,qd,qet)) {
+			std::cout << "FAIL (IPv4 to host)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing UserspaceStack... "; std::cout.flush();
+	{
+		struct _Sent
+		{
+			static void put(void *arg,void *tPtr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+			{
+				_Sent *const s = reinterpret_cast<_Sent *>(arg);
+				Mutex::Lock _l(s->lock);
+				s->frames.push_back(std::pair<MAC,std::string>(to,std::string(reinterpret_cast<const char *>(data),len)));
+			}
+			std::vector< std::pair<MAC,std::string> > frames;
+			Mutex lock;
+		} sent;
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MAC ours(Address(0x1111111111ULL),nwid),theirs(Address(0x2222222222ULL),nwid);
+		UserspaceStack us((const char *)0,ours,2800,0,nwid,"",&_Sent::put,&sent);
+		us.addIp(InetAddress("10.9.0.1/24"));
+
+		const unsigned int port = us.udpBind(7777);
+		if ((port != 7777)||(us.udpBind(7777))||(us.udpBind(0) < ZT_USERSPACE_STACK_EPHEMERAL_PORT_MIN)) {
+			std::cout << "FAIL (bind)" << std::endl;
+			return -1;
+		}
+
+		// A datagram from 10.9.0.2:5555, which also teaches the stack their MAC
+		uint8_t pkt[20 + 8 + 5] = { 0x45,0,0,33, 0,0,0x40,0, 64,17,0,0, 10,9,0,2, 10,9,0,1, 0x15,0xb3,0x1e,0x61,0,13,0,0, 'h','e','l','l','o' };
+		us.put(theirs,ours,ZT_ETHERTYPE_IPV4,pkt,sizeof(pkt));
+		InetAddress from;
+		char buf[64];
+		if ((us.udpReceive(7777,from,buf,sizeof(buf),1000) != 5)||(memcmp(buf,"hello",5))||(from != InetAddress("10.9.0.2/5555"))||(us.udpReceive(7777,from,buf,sizeof(buf),10) != -1)) {
+			std::cout << "FAIL (receive)" << std::endl;
+			return -1;
+		}
+
+		if (!us.udpSend(7777,from,"world",5)) {
+			std::cout << "FAIL (send)" << std::endl;
+			return -1;
+		}
+		{
+			Mutex::Lock _l(sent.lock);
+			const uint8_t *const f = (sent.frames.size() == 1) ? reinterpret_cast<const uint8_t *>(sent.frames[0].second.data()) : (const uint8_t *)0;
+			uint32_t sum = 17 + 13; // pseudo-header
+			if (f) {
+				for(unsigned int i=12;i<33;i+=2)
+					sum += ((uint32_t)f[i] << 8) | (uint32_t)((i < 32) ? f[i + 1] : 0);
+				while (sum >> 16)
+					sum = (sum & 0xffff) + (sum >> 16);
+			}
+			if ((!f)||(sent.frames[0].first != theirs)||(sent.frames[0].second.length() != 33)||(memcmp(f + 16,pkt + 12,4))||(f[22] != 0x15)||(f[23] != 0xb3)||(memcmp(f + 28,"world",5))||(sum != 0xffff)) {
+				std::cout << "FAIL (sent datagram)" << std::endl;
+				return -1;
+			}
+			sent.frames.clear();
+		}
+
+		// Ping, answered from the stack's own thread
+		uint8_t ping[20 + 8 + 4] = { 0x45,0,0,32, 0,0,0,0, 64,1,0,0, 10,9,0,2, 10,9,0,1, 8,0,0,0, 0x12,0x34,0,1, 1,2,3,4 };
+		us.put(theirs,ours,ZT_ETHERTYPE_IPV4,ping,sizeof(ping));
+		bool pong = false;
+		for(int i=0;((i<100)&&(!pong));++i) {
+			{
+				Mutex::Lock _l(sent.lock);
+				pong = ((sent.frames.size() == 1)&&(sent.frames[0].second.length() == sizeof(ping))&&(sent.frames[0].second[20] == 0)&&(!memcmp(sent.frames[0].second.data() + 24,ping + 24,8)));
+			}
+			if (!pong)
+				Thread::sleep(10);
+		}
+		if (!pong) {
+			std::cout << "FAIL (echo reply)" << std::endl;
+			return -1;
+		}
+
+		us.udpClose(7777);
+		if ((us.udpSend(7777,InetAddress("10.8.0.2/5555"),"x",1))||(us.udpReceive(7777,from,buf,sizeof(buf),0) != -1)) {
+			std::cout << "FAIL (unroutable or closed)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing TokenBucket... "; std::cout.flush();
+	{
+		// 100000 bytes/sec with a 5000 byte burst, offered 1000 byte packets every millisecond for ten seconds
+		TokenBucket tb(100000,5000,0);
+		uint64_t passed = 0;
+		for(uint64_t t=0;t<10000;++t) {
+			if (tb.conform(1000,t))
+				passed += 1000;
+		}
+		if ((passed < 995000)||(passed > 1006000)) {
+			std::cout << "FAIL (" << passed << " bytes passed)" << std::endl;
+			return -1;
+		}
+		while (tb.conform(1000,10000)) {}
+		if ((tb.delay(1000,10000) == 0)||(tb.delay(1000,10000) > 10)||(tb.delay(1000,10010) != 0)) {
+			std::cout << "FAIL (delay)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing EgressScheduler... "; std::cout.flush();
+	{
+		EgressScheduler<unsigned long> es(1000000000,1000000);
+		const Address p1(1),p2(2),p3(3);
+
+		// Peer 1 has a big normal class backlog, peer 2 a small one, and peer 3 sends
+		// in every class. Control must drain first, then classes by weight and peers evenly.
+		for(unsigned long i=0;i<5000;++i) {
+			es.enqueue(ZT_QOS_CLASS_NORMAL,p1,1,1000);
+			es.enqueue(ZT_QOS_CLASS_BULK,p3,3,1000);
+			es.enqueue(ZT_QOS_CLASS_INTERACTIVE,p3,4,1000);
+		}
+		for(unsigned long i=0;i<1000;++i)
+			es.enqueue(ZT_QOS_CLASS_NORMAL,p2,2,500);
+		for(unsigned long i=0;i<10;++i)
+			es.enqueue(ZT_QOS_CLASS_CONTROL,p1,0,100);
+
+		unsigned long bytesBy[5] = { 0,0,0,0,0 };
+		unsigned int bytes = 0;
+		for(unsigned long n=0;n<3000;++n) {
+			const unsigned long *const v = es.peek(bytes);
+			if ((!v)||((n < 10)&&(*v != 0))||((n >= 10)&&(*v == 0))) {
+				std::cout << "FAIL (control not first)" << std::endl;
+				return -1;
+			}
+			bytesBy[*v] += bytes;
+			es.pop();
+		}
+		// Interactive:normal:bulk should be 4:2:1 and normal split evenly by bytes between peers 1 and 2
+		const double i4 = (double)bytesBy[4],n12 = (double)(bytesBy[1] + bytesBy[2]),b3 = (double)bytesBy[3];
+		if ((i4 / n12 < 1.8)||(i4 / n12 > 2.2)||(n12 / b3 < 1.8)||(n12 / b3 > 2.2)||(bytesBy[1] < (bytesBy[2] * 9) / 10)||(bytesBy[1] > (bytesBy[2] * 11) / 10)) {
+			std::cout << "FAIL (shares " << bytesBy[4] << "/" << bytesBy[1] << "+" << bytesBy[2] << "/" << bytesBy[3] << ")" << std::endl;
+			return -1;
+		}
+		while (es.peek(bytes))
+			es.pop();
+		if ((es.count())||(es.bytes())) {
+			std::cout << "FAIL (not empty after draining)" << std::endl;
+			return -1;
+		}
+
+		EgressScheduler<unsigned long> small(10000,4);
+		bool ok = true;
+		for(unsigned long i=0;i<4;++i)
+			ok &= small.enqueue(ZT_QOS_CLASS_NORMAL,p1,i,1000);
+		if ((!ok)||(small.enqueue(ZT_QOS_CLASS_NORMAL,p1,4,1000))||(!small.enqueue(ZT_QOS_CLASS_BULK,p1,5,6000))||(small.enqueue(ZT_QOS_CLASS_NORMAL,p2,6,1))) {
+			std::cout << "FAIL (queue limits)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << bytesBy[4] << "/" << (bytesBy[1] + bytesBy[2]) << "/" << bytesBy[3] << " bytes by class)" << std::endl;
+	}
+
+	std::cout << "[other] Testing ECN congestion marking... "; std::cout.flush();
+	{
+		// Random ECN-capable IPv4 headers must come out CE with a checksum that still verifies
+		uint8_t h[20];
+		for(unsigned int k=0;k<10000;++k) {
+			Utils::getSecureRandom(h,sizeof(h));
+			h[0] = 0x45;
+			h[1] = (uint8_t)((h[1] & 0xfc) | (1 + (k % 3)));
+			h[10] = h[11] = 0;
+			uint32_t sum = 0;
+			for(unsigned int i=0;i<20;i+=2)
+				sum += ((uint32_t)h[i] << 8) | (uint32_t)h[i+1];
+			while (sum >> 16)
+				sum = (sum & 0xffff) + (sum >> 16);
+			h[10] = (uint8_t)((~sum >> 8) & 0xff);
+			h[11] = (uint8_t)(~sum & 0xff);
+			const uint8_t dscp = h[1] & 0xfc;
+			if (!Switch::markCongestion(ZT_ETHERTYPE_IPV4,h,sizeof(h))) {
+				std::cout << "FAIL (ECN-capable IPv4 dropped)" << std::endl;
+				return -1;
+			}
+			sum = 0;
+			for(unsigned int i=0;i<20;i+=2)
+				sum += ((uint32_t)h[i] << 8) | (uint32_t)h[i+1];
+			while (sum >> 16)
+				sum = (sum & 0xffff) + (sum >> 16);
+			if (((h[1] & 3) != 3)||((h[1] & 0xfc) != dscp)||(sum != 0xffff)) {
+				std::cout << "FAIL (IPv4 header after marking)" << std::endl;
+				return -1;
+			}
+		}
+		h[1] = 0xb8; // EF, not ECN-capable
+		if (Switch::markCongestion(ZT_ETHERTYPE_IPV4,h,sizeof(h))) {
+			std::cout << "FAIL (not ECN-capable IPv4 kept)" << std::endl;
+			return -1;
+		}
+		uint8_t h6[40];
+		memset(h6,0,sizeof(h6));
+		h6[0] = 0x6b; h6[1] = 0x90; // traffic class 0xb9: EF with ECT(1)
+		if ((!Switch::markCongestion(ZT_ETHERTYPE_IPV6,h6,sizeof(h6)))||(h6[0] != 0x6b)||(h6[1] != 0xb0)) {
+			std::cout << "FAIL (IPv6 header after marking)" << std::endl;
+			return -1;
+		}
+		h6[1] = 0x80;
+		if (Switch::markCongestion(ZT_ETHERTYPE_IPV6,h6,sizeof(h6))) {
+			std::cout << "FAIL (not ECN-capable IPv6 kept)" << std::endl;
+			return -1;
+		}
+		if (!Switch::markCongestion(ZT_ETHERTYPE_ARP,h,sizeof(h))) {
+			std::cout << "FAIL (non-IP dropped)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing RingBuffer... "; std::cout.flush();
+	{
+		// Random writes and partial consumes checked against a plain string, wrapping and growing
+		RingBuffer rb(100000);
+		std::string model;
+		char tmp[20000];
+		for(unsigned int i=0;i<100000;++i) {
+			if (rand() & 1) {
+				const unsigned long l = (unsigned long)(rand() % ((i < 50000) ? 200 : 20000));
+				for(unsigned long k=0;k<l;++k)
+					tmp[k] = (char)rand();
+				const bool fits = ((model.length() + l) <= 100000);
+				if (rb.write(tmp,l) != fits) {
+					std::cout << "FAIL (write of " << l << " with " << model.length() << " queued)" << std::endl;
+					return -1;
+				}
+				if (fits)
+					model.append(tmp,l);
+			} else if (model.length()) {
+				const void *d1,*d2;
+				unsigned long l1,l2;
+				rb.peek(d1,l1,d2,l2);
+				if ((rb.size() != model.length())||((l1 + l2) != model.length())||(memcmp(d1,model.data(),l1))||(memcmp(d2,model.data() + l1,l2))) {
+					std::cout << "FAIL (contents differ)" << std::endl;
+					return -1;
+				}
+				const unsigned long c = (unsigned long)(rand() % (model.length() + 1));
+				rb.consume(c);
+				model.erase(0,c);
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing FairQueue... "; std::cout.flush();
+	{
+		// A deep backlog on one key must not hold up the others
+		FairQueue<uint64_t,unsigned long> fq;
+		for(unsigned long i=0;i<1000;++i)
+			fq.post(1,i);
+		for(uint64_t k=2;k<=10;++k)
+			fq.post(k,(unsigned long)k);
+		uint64_t k = 0;
+		unsigned long v = 0;
+		for(uint64_t want=1;want<=10;++want) {
+			if ((fq.get(k,v,1000) != FairQueue<uint64_t,unsigned long>::OK)||(k != want)) {
+				std::cout << "FAIL (got key " << k << " expecting " << want << ")" << std::endl;
+				return -1;
+			}
+			fq.done(k);
+		}
+		while (fq.size() > 0) {
+			fq.get(k,v,1000);
+			fq.done(k);
+		}
+
+		// Under concurrency each key is held by one thread at a time and its items stay in order
+		volatile int held[8];
+		unsigned long next[8];
+		for(int i=0;i<8;++i) {
+			held[i] = 0;
+			next[i] = 0;
+		}
+		unsigned long posted[8] = { 0,0,0,0,0,0,0,0 };
+		for(int i=0;i<80000;++i) {
+			const unsigned int pk = (unsigned int)rand() % 8;
+			fq.post(pk,posted[pk]++);
+		}
+		bool bad = false;
+		std::vector<std::thread> t;
+		for(int n=0;n<4;++n) {
+			t.push_back(std::thread([&fq,&held,&next,&bad]() {
+				uint64_t tk = 0;
+				unsigned long tv = 0;
+				while (fq.get(tk,tv,100) == FairQueue<uint64_t,unsigned long>::OK) {
+					if (__sync_fetch_and_add(&(held[tk]),1) != 0)
+						bad = true;
+					if (next[tk]++ != tv)
+						bad = true;
+					__sync_fetch_and_sub(&(held[tk]),1);
+					fq.done(tk);
+				}
+			}));
+		}
+		for(std::vector<std::thread>::iterator i(t.begin());i!=t.end();++i)
+			i->join();
+		for(int i=0;i<8;++i) {
+			if (next[i] != posted[i])
+				bad = true;
+		}
+		if (bad) {
+			std::cout << "FAIL (key held twice or items out of order)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing AdaptiveMutex and RWMutex... "; std::cout.flush();
+	{
+		AdaptiveMutex am;
+		RWMutex rw;
+		unsigned long amCount = 0,rwCount = 0,rwSeen = 0;
+		std::vector<std::thread> t;
+		for(int k=0;k<4;++k) {
+			t.push_back(std::thread([&am,&rw,&amCount,&rwCount,&rwSeen]() {
+				for(int i=0;i<100000;++i) {
+					{
+						AdaptiveMutex::Lock _l(am);
+						++amCount;
+					}
+					if ((i & 7) == 0) {
+						RWMutex::Lock _l(rw);
+						++rwCount;
+					} else {
+						RWMutex::RLock _l(rw);
+						if (rwCount > 400000)
+							++rwSeen; // never true, keeps the read side from being optimized out
+					}
+				}
+			}));
+		}
+		for(std::vector<std::thread>::iterator i(t.begin());i!=t.end();++i)
+			i->join();
+		if ((amCount != 400000)||(rwCount != 50000)||(rwSeen)) {
+			std::cout << "FAIL (" << amCount << ", " << rwCount << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing path quality estimator... "; std::cout.flush();
+	{
+		Path fast(0,InetAddress("10.0.0.1/9993"));
+		Path lossy(0,InetAddress("10.0.0.2/9993"));
+		if (fast.quality() != 0xffffffff) {
+			std::cout << "FAIL (unmeasured path has a score)" << std::endl;
+			return -1;
+		}
+		uint64_t t = 1000000;
+		for(unsigned int i=0;i<32;++i) {
+			fast.probeSent(t);
+			fast.probeAnswered(t + 10);
+			lossy.probeSent(t);
+			if (i & 1)
+				lossy.probeAnswered(t + 10);
+			t += 1000;
+		}
+		if ((fast.rtt() != 10)||(fast.loss() != 0)||(lossy.loss() == 0)||(fast.quality() >= lossy.quality())) {
+			std::cout << "FAIL (rtt " << fast.rtt() << " loss " << lossy.loss() << " quality " << fast.quality() << "/" << lossy.quality() << ")" << std::endl;
+			return -1;
+		}
+		fast.probeSent(t);
+		if ((fast.answerTimeout() != ZT_UPSTREAM_MIN_ANSWER_TIMEOUT)||(fast.unansweredProbe() != t)) {
+			std::cout << "FAIL (answer timeout " << fast.answerTimeout() << ")" << std::endl;
+			return -1;
+		}
+		fast.received(t + 5,64);
+		if (fast.unansweredProbe() != 0) {
+			std::cout << "FAIL (probe still unanswered after receive)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (quality " << fast.quality() << " vs " << lossy.quality() << ")" << std::endl;
+	}
+
+	std::cout << "[other] Testing path MTU discovery... "; std::cout.flush();
+	{
+		Path p(0,InetAddress("10.0.0.1/9993"));
+		uint64_t t = 1000000;
+		if (p.mtuProbeSize(t) != 0) {
+			std::cout << "FAIL (probed a path with no large packets)" << std::endl;
+			return -1;
+		}
+		p.largePacketSent(t);
+		const unsigned int first = p.mtuProbeSize(t);
+		p.mtuProbeSent(t,1);
+		t += ZT_PATH_MTU_PROBE_TIMEOUT;
+		const unsigned int second = p.mtuProbeSize(t); // first probe timed out
+		p.mtuProbeSent(t,2);
+		if ((first <= second)||(second <= ZT_UDP_DEFAULT_PAYLOAD_MTU)||(p.mtuProbeAnswered(1))||(!p.mtuProbeAnswered(2))||(p.mtu() != second)||(p.mtuProbeSize(t + 1) != 0)) {
+			std::cout << "FAIL (probes " << first << "," << second << " mtu " << p.mtu() << ")" << std::endl;
+			return -1;
+		}
+		t += ZT_PATH_MTU_PROBE_INTERVAL;
+		if (p.mtuProbeSize(t) != 0) {
+			std::cout << "FAIL (reprobed an idle path)" << std::endl;
+			return -1;
+		}
+		p.largePacketSent(t);
+		for(unsigned int i=0;i<ZT_PATH_MTU_PROBE_STEPS;++i) {
+			if (!p.mtuProbeSize(t))
+				break;
+			p.mtuProbeSent(t,3 + i);
+			t += ZT_PATH_MTU_PROBE_TIMEOUT;
+		}
+		p.mtuProbeSize(t);
+		if (p.mtu() != ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+			std::cout << "FAIL (mtu " << p.mtu() << " after all probes were lost)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << second << ")" << std::endl;
+	}
+
+	std::cout << "[other] Testing NAT binding timeout discovery... "; std::cout.flush();
+	{
+		// Bindings expiring after 30s, and ones that outlast anything we'd probe
+		const unsigned int bindingTimeouts[2] = { 30000,120000 };
+		unsigned int periods[2];
+		for(unsigned int k=0;k<2;++k) {
+			Path p(0,InetAddress("10.0.0.1/9993"));
+			uint64_t t = 1000000;
+			for(unsigned int i=0;i<16;++i) {
+				p.sent(t); // heartbeat and its answer
+				p.received(t,64);
+				p.natProbeCheck(t);
+				const unsigned int d = p.natProbeDelay(t);
+				if (d) {
+					p.sent(t);
+					p.natProbeSent(t,100 + i,d);
+					if ((p.needsHeartbeat(t + d))||(!p.alive(t + d))) {
+						std::cout << "FAIL (heartbeat or path down during probe)" << std::endl;
+						return -1;
+					}
+					if (d < bindingTimeouts[k]) {
+						p.received(t + d,64);
+						p.natProbeAnswered(t + d,100 + i);
+					}
+					t += d + ZT_PATH_NAT_PROBE_TIMEOUT;
+					p.natProbeCheck(t);
+				}
+				t += ZT_PATH_NAT_PROBE_INTERVAL;
+			}
+			periods[k] = p.heartbeatPeriod();
+		}
+		if ((periods[0] >= bindingTimeouts[0])||(periods[0] < (bindingTimeouts[0] - ZT_PATH_NAT_PROBE_MARGIN - ZT_PATH_NAT_PROBE_RESOLUTION))||(periods[1] != ZT_PATH_KEEPALIVE_MAX)) {
+			std::cout << "FAIL (heartbeat periods " << periods[0] << "," << periods[1] << ")" << std::endl;
+			return -1;
+		}
+
+		// An answer is inconclusive if anything else came in while waiting
+		Path p(0,InetAddress("10.0.0.1/9993"));
+		uint64_t t = 1000000;
+		p.received(t,64);
+		const unsigned int d = p.natProbeDelay(t);
+		p.sent(t);
+		p.natProbeSent(t,1,d);
+		p.received(t + 1000,64);
+		p.received(t + d,64);
+		if ((!p.natProbeAnswered(t + d,1))||(p.natTimeout() != 0)||(p.heartbeatPeriod() != ZT_PATH_HEARTBEAT_PERIOD)) {
+			std::cout << "FAIL (inconclusive probe measured " << p.natTimeout() << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << periods[0] << "," << periods[1] << ")" << std::endl;
+	}
+
+	std::cout << "[other] Testing compiled rule dispatch... "; std::cout.flush();
+	{
+		const Address self(0x1122334455ULL);
+		ZT_VirtualNetworkRule rules[7];
+		memset(rules,0,sizeof(rules));
+		rules[0].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE | 0x80; rules[0].v.etherType = ZT_ETHERTYPE_IPV4;
+		rules[1].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE | 0x80; rules[1].v.etherType = ZT_ETHERTYPE_ARP;
+		rules[2].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE | 0x80; rules[2].v.etherType = ZT_ETHERTYPE_IPV6;
+		rules[3].t = (uint8_t)ZT_NETWORK_RULE_ACTION_DROP;
+		rules[4].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[4].v.etherType = ZT_ETHERTYPE_ARP;
+		rules[5].t = (uint8_t)ZT_NETWORK_RULE_ACTION_TEE; rules[5].v.fwd.address = self.toInt();
+		rules[6].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		CompiledRules cr;
+		cr.compile(rules,7,self,std::vector<Tag>());
+		unsigned int len = 0;
+		const uint16_t *p = cr.program(ZT_ETHERTYPE_IPV4,len);
+		if ((len != 2)||(p[0] != (1 | ZT_COMPILED_RULES_INERT))||(p[1] != 2)) {
+			std::cout << "FAIL (IPv4 program)" << std::endl;
+			return -1;
+		}
+		p = cr.program(ZT_ETHERTYPE_ARP,len);
+		if ((len != 2)||(p[0] != 1)||(p[1] != 2)) {
+			std::cout << "FAIL (ARP program)" << std::endl;
+			return -1;
+		}
+		p = cr.program(0x1234,len);
+		if ((len != 3)||(p[0] != 0)||(p[1] != (1 | ZT_COMPILED_RULES_INERT))||(p[2] != 2)) {
+			std::cout << "FAIL (default program)" << std::endl;
+			return -1;
+		}
+		if ((cr.set(0).start != 0)||(cr.set(0).action != 3)||(cr.set(1).targetsSelf != true)||(cr.set(2).start != 6)) {
+			std::cout << "FAIL (sets)" << std::endl;
+			return -1;
+		}
+
+		memset(rules,0,sizeof(rules));
+		rules[0].t = (uint8_t)ZT_NETWORK_RULE_MATCH_TAGS_EQUAL; rules[0].v.tag.id = 20;
+		rules[1].t = (uint8_t)ZT_NETWORK_RULE_MATCH_TAG_SENDER; rules[1].v.tag.id = 10;
+		rules[2].t = (uint8_t)ZT_NETWORK_RULE_ACTION_DROP;
+		rules[3].t = (uint8_t)ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE; rules[3].v.tag.id = 20;
+		rules[4].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		std::vector<Tag> tags;
+		tags.push_back(Tag(1,0,Address(),20,77));
+		cr.compile(rules,5,self,tags);
+		uint32_t tv = 0;
+		if ((cr.tagCount() != 2)||(cr.tagSlot(0) != 0)||(cr.tagSlot(1) != 1)||(cr.tagSlot(2) != ZT_COMPILED_RULES_NO_TAG)||(cr.tagSlot(3) != 0)||(!cr.localTag(0,tv))||(tv != 77)||(cr.localTag(1,tv))) {
+			std::cout << "FAIL (tag slots)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing frame capture... "; std::cout.flush();
+	{
+		Capture cap;
+		Capture::Filter f;
+		f.etherType = ZT_ETHERTYPE_IPV4;
+		f.inbound = false;
+		f.snapLength = 64;
+		cap.start(f);
+		uint8_t payload[100];
+		memset(payload,0x55,sizeof(payload));
+		const MAC m1(0x0102030405ULL),m2(0x0a0b0c0d0eULL);
+		if ((cap.wants(1,true,2,ZT_ETHERTYPE_IPV4,1))||(cap.wants(1,false,2,ZT_ETHERTYPE_ARP,1))||(!cap.wants(1,false,2,ZT_ETHERTYPE_IPV4,1))) {
+			std::cout << "FAIL (filter)" << std::endl;
+			return -1;
+		}
+		cap.record(1000,1,false,1,2,InetAddress("10.0.0.1/9993"),m1,m2,ZT_ETHERTYPE_IPV4,0,payload,sizeof(payload));
+		cap.record(1001,1,false,0,2,InetAddress(),m1,m2,ZT_ETHERTYPE_IPV4,42,payload,10);
+		std::string pcap;
+		const unsigned int n = cap.pcapng(0,cap.last(),true,pcap);
+		unsigned int blocks = 0,frames = 0;
+		for(unsigned long i=0;i+12<=pcap.length();++blocks) {
+			uint32_t type,len,len2;
+			memcpy(&type,pcap.data() + i,4);
+			memcpy(&len,pcap.data() + i + 4,4);
+			if ((len < 12)||((len & 3) != 0)||((i + len) > pcap.length()))
+				break;
+			memcpy(&len2,pcap.data() + i + len - 4,4);
+			if (len2 != len)
+				break;
+			if (type == 6)
+				++frames;
+			i += len;
+		}
+		std::string more;
+		if ((n != 2)||(cap.last() != 2)||(blocks != 4)||(frames != 2)||(pcap.find("verdict=drop") == std::string::npos)||(cap.pcapng(1,2,false,more) != 1)) {
+			std::cout << "FAIL (" << n << " frames, " << blocks << " blocks)" << std::endl;
+			return -1;
+		}
+		cap.stop();
+		if ((cap.enabled())||(cap.pcapng(0,2,false,more) != 0)) {
+			std::cout << "FAIL (stop)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << pcap.length() << " bytes)" << std::endl;
+	}
+
+	std::cout << "[other] Testing IPFIX flow export... "; std::cout.flush();
+	{
+		FlowExport fe;
+		std::vector<FlowExport::Flow> flows;
+		for(unsigned int i=0;i<40;++i) {
+			FlowExport::Flow f = FlowExport::Flow();
+			f.networkId = 0x8056c2e21c000001ULL;
+			f.packets = i + 1;
+			f.bytes = (i + 1) * 100;
+			f.ipv6 = ((i % 4) == 0);
+			f.protocol = 6;
+			f.portSource = 1000 + i;
+			f.portDest = 443;
+			flows.push_back(f);
+		}
+		std::vector<std::string> messages;
+		fe.ipfix(1500000000,1,flows,messages);
+		fe.ipfix(1500000060,1,flows,messages);
+		unsigned int records = 0,badAt = 0;
+		for(unsigned int mi=0;mi<messages.size();++mi) {
+			const uint8_t *const m = reinterpret_cast<const uint8_t *>(messages[mi].data());
+			const unsigned int ml = (unsigned int)messages[mi].length();
+			const uint32_t seq = ((uint32_t)m[8] << 24) | ((uint32_t)m[9] << 16) | ((uint32_t)m[10] << 8) | (uint32_t)m[11];
+			if ((ml > ZT_FLOW_EXPORT_MAX_MESSAGE)||(((m[0] << 8) | m[1]) != 10)||((unsigned int)((m[2] << 8) | m[3]) != ml)||(seq != records)) {
+				badAt = mi + 1;
+				break;
+			}
+			unsigned int p = 16;
+			while ((p + 4) <= ml) {
+				const unsigned int sid = (m[p] << 8) | m[p + 1];
+				const unsigned int sl = (m[p + 2] << 8) | m[p + 3];
+				if ((sl < 4)||((p + sl) > ml))
+					break;
+				if (sid == ZT_FLOW_EXPORT_TEMPLATE_IPV4)
+					records += (sl - 4) / 69;
+				else if (sid == ZT_FLOW_EXPORT_TEMPLATE_IPV6)
+					records += (sl - 4) / 93;
+				p += sl;
+			}
+			if (p != ml) {
+				badAt = mi + 1;
+				break;
+			}
+		}
+		if ((badAt)||(records != 80)||(messages.size() < 4)) {
+			std::cout << "FAIL (message " << badAt << ", " << records << " records in " << messages.size() << " messages)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << messages.size() << " messages)" << std::endl;
+	}
+
+	std::cout << "[other] Testing CPU list parsing... "; std::cout.flush();
+	{
+		const char *const good[4][2] = { { "0","0" },{ "3,0-2","0-3" },{ "8,1-2,4,2-3","1-4,8" },{ "0-1,3\n","0-1,3" } };
+		const char *const bad[5] = { "","-1","3-1","1,,2","0-1x" };
+		for(unsigned int i=0;i<4;++i) {
+			std::vector<unsigned int> cpus;
+			if ((!CpuAffinity::parse(good[i][0],cpus))||(CpuAffinity::format(cpus) != good[i][1])) {
+				std::cout << "FAIL (" << good[i][0] << ")" << std::endl;
+				return -1;
+			}
+		}
+		for(unsigned int i=0;i<5;++i) {
+			std::vector<unsigned int> cpus;
+			if (CpuAffinity::parse(bad[i],cpus)) {
+				std::cout << "FAIL (accepted '" << bad[i] << "')" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing identity verification gate... "; std::cout.flush();
+	{
+		VerificationGate g;
+		g.setSize(1);
+		const uint64_t t = 1000000;
+		if ((!g.admit(t,InetAddress("10.1.2.3/9993")))||(g.admit(t + 1,InetAddress("10.1.2.4/9993")))||(!g.admit(t + 2,InetAddress("10.1.3.3/9993")))||(!g.admit(t + ZT_IDENTITY_VALIDATION_SOURCE_RATE_LIMIT,InetAddress("10.1.2.5/9993")))) {
+			std::cout << "FAIL (IPv4 prefixes)" << std::endl;
+			return -1;
+		}
+		if ((!g.admit(t,InetAddress("2001:db8:1::1/9993")))||(g.admit(t,InetAddress("2001:db8:1:ffff::2/9993")))||(!g.admit(t,InetAddress("2001:db8:2::1/9993")))) {
+			std::cout << "FAIL (IPv6 prefixes)" << std::endl;
+			return -1;
+		}
+		g.setBurst(3);
+		unsigned int admitted = 0;
+		for(unsigned int i=0;i<5;++i)
+			admitted += (g.admit(t * 2,InetAddress("192.168.7.1/9993"))) ? 1 : 0;
+		if (admitted != 3) {
+			std::cout << "FAIL (burst admitted " << admitted << ")" << std::endl;
+			return -1;
+		}
+		// Distinct prefixes up to the table's size never share a bucket
+		g.setSize(g.size());
+		admitted = 0;
+		for(unsigned int i=0;i<(unsigned int)(g.size() / 2);++i) {
+			InetAddress a;
+			const uint32_t ip = Utils::hton((uint32_t)(0x0b000000 + (i << 8)));
+			a.set(&ip,4,9993);
+			admitted += (g.admit(t * 3,a)) ? 1 : 0;
+		}
+		if (admitted != (unsigned int)(g.size() / 2)) {
+			std::cout << "FAIL (" << admitted << " of " << (g.size() / 2) << " distinct prefixes admitted)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Testing huge page arena... "; std::cout.flush();
+	{
+		void *const heap = HugePages::allocate(100); // before init, from the heap
+		if ((!HugePages::init(4194304,false))||(HugePages::init(4194304,false))) {
+			std::cout << "FAIL (init)" << std::endl;
+			return -1;
+		}
+		void *const a = HugePages::allocate(100);
+		void *const b = HugePages::allocate(100);
+		void *const big = HugePages::allocate(8388608);
+		if ((HugePages::contains(heap))||(!HugePages::contains(a))||(!HugePages::contains(b))||(HugePages::contains(big))||((reinterpret_cast<uintptr_t>(b) & 63) != 0)) {
+			std::cout << "FAIL (placement)" << std::endl;
+			return -1;
+		}
+		HugePages::free(heap,100);
+		HugePages::free(big,8388608);
+		HugePages::free(a,100);
+		if (HugePages::allocate(100) != a) {
+			std::cout << "FAIL (reuse)" << std::endl;
+			return -1;
+		}
+		HugePages::free(a,100);
+		HugePages::free(b,100);
+		std::vector<Packet *> packets;
+		for(int i=0;i<1000;++i)
+			packets.push_back(new Packet());
+		for(std::vector<Packet *>::iterator p(packets.begin());p!=packets.end();++p)
+			delete *p;
+		HugePages::Status hs;
+		HugePages::status(hs);
+		std::cout << "PASS (" << HugePages::backingName(hs.backing) << ", " << hs.used << " bytes used)" << std::endl;
+	}
+
+	std::cout << "[other] Testing FlatHashtable... "; std::cout.flush();
+	{
+		FlatHashtable<uint64_t,std::string> ht(4);
+		std::map<uint64_t,std::string> ref;
+		for(int x=0;x<2;++x) {
+			for(int i=0;i<20000;++i) {
+				uint64_t k = (uint64_t)rand();
+				std::string v("!");
+				for(int j=0;j<(int)(k % 16);++j)
+					v.push_back("0123456789"[rand() % 10]);
+				ref[k] = v;
+				ht.set(k,v);
+				if ((rand() & 3) == 0) {
+					const uint64_t ek = ref.begin()->first;
+					ref.erase(ek);
+					if (!ht.erase(ek)) {
+						std::cout << "FAIL (erase)" << std::endl;
+						return -1;
+					}
+				}
+			}
+			if (ht.size() != ref.size()) {
+				std::cout << "FAIL (size mismatch)" << std::endl;
+				return -1;
+			}
+			FlatHashtable<uint64_t,std::string> ht2(ht);
+			FlatHashtable<uint64_t,std::string> ht3;
+			ht3 = ht;
+			for(std::map<uint64_t,std::string>::const_iterator i(ref.begin());i!=ref.end();++i) {
+				const std::string *v = ht.get(i->first);
+				const std::string *v2 = ht2.get(i->first);
+				const std::string *v3 = ht3.get(i->first);
+				if ((!v)||(!v2)||(!v3)||(*v != i->second)||(*v2 != i->second)||(*v3 != i->second)) {
+					std::cout << "FAIL (data mismatch)" << std::endl;
 					return -1;
 				}
 			}
 			{
-				uint64_t *k;
-				std::string *v;
-				Hashtable<uint64_t,std::string>::Iterator i(ht);
+				FlatHashtable<uint64_t,std::string>::Iterator i(ht);
+				uint64_t *k = (uint64_t *)0;
+				std::string *v = (std::string *)0;
 				unsigned long ic = 0;
 				while (i.next(k,v)) {
 					if (ref[*k] != *v) {
-						std::cout << "FAILED! (iterate)" << std::endl;
+						std::cout << "FAIL (iterate)" << std::endl;
 						return -1;
 					}
 					++ic;
 				}
-				if (ic != ht.size()) {
-					std::cout << "FAILED! (iterate coverage)" << std::endl;
+				if (ic != ref.size()) {
+					std::cout << "FAIL (iterate coverage)" << std::endl;
 					return -1;
 				}
 			}
-			for(std::map<uint64_t,std::string>::iterator i(ref.begin());i!=ref.end();) {
-				if (!ht.get(i->first)) {
-					std::cout << "FAILED! (erase, check if exists)" << std::endl;
-					return -1;
-				}
-				ht.erase(i->first);
-				if (ht.get(i->first)) {
-					std::cout << "FAILED! (erase, check if erased)" << std::endl;
-					return -1;
-				}
-				ref.erase(i++);
-				if (ht.size() != ref.size()) {
-					std::cout << "FAILED! (erase, size)" << std::endl;
-					return -1;
+			{
+				FlatHashtable<uint64_t,std::string>::Iterator i(ht);
+				uint64_t *k = (uint64_t *)0;
+				std::string *v = (std::string *)0;
+				while (i.next(k,v)) {
+					if ((*k & 1) == 0) {
+						ref.erase(*k);
+						ht.erase(*k);
+					}
 				}
 			}
-			if (!ht.empty()) {
-				std::cout << "FAILED! (erase, empty)" << std::endl;
+			if ((ht.size() != ref.size())||(ht.keys().size() != ref.size())) {
+				std::cout << "FAIL (erase while iterating)" << std::endl;
 				return -1;
 			}
-			for(int i=0;i<10000;++i) {
-				uint64_t k = rand();
-				while ((k == 0)||(ref.count(k) > 0))
-					++k;
-				std::string v;
-				for(int j=0;j<(int)(k % 64);++j)
-					v.push_back("0123456789"[rand() % 10]);
-				ht.set(k,v);
-				ref[k] = v;
-			}
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (second populate)" << std::endl;
-				return -1;
+			for(std::map<uint64_t,std::string>::const_iterator i(ref.begin());i!=ref.end();++i) {
+				if ((!ht.contains(i->first))||(ht.contains(i->first + 1))) {
+					std::cout << "FAIL (contains)" << std::endl;
+					return -1;
+				}
 			}
 			ht.clear();
 			ref.clear();
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (clear)" << std::endl;
+			if ((!ht.empty())||(ht.get(1))) {
+				std::cout << "FAIL (clear)" << std::endl;
 				return -1;
 			}
-			for(int i=0;i<10000;++i) {
-				uint64_t k = rand();
-				while ((k == 0)||(ref.count(k) > 0))
-					++k;
-				std::string v;
-				for(int j=0;j<(int)(k % 64);++j)
-					v.push_back("0123456789"[rand() % 10]);
-				ht.set(k,v);
-				ref[k] = v;
+		}
+		{
+			// A reserved table keeps its entries and then fills without growing
+			FlatHashtable<uint64_t,uint64_t> rht;
+			Hashtable<uint64_t,uint64_t> rht2;
+			for(uint64_t k=1;k<=100;++k) {
+				rht[k] = k;
+				rht2[k] = k;
 			}
-			{
-				Hashtable<uint64_t,std::string>::Iterator i(ht);
-				uint64_t *k;
-				std::string *v;
-				while (i.next(k,v))
-					ht.erase(*k);
+			rht.reserve(100000);
+			rht2.reserve(100000);
+			const unsigned long fp = rht.footprint();
+			for(uint64_t k=101;k<=100000;++k) {
+				rht[k] = k;
+				rht2[k] = k;
 			}
-			ref.clear();
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (clear by iterate, " << ht.size() << ")" << std::endl;
+			if (rht.footprint() != fp) {
+				std::cout << "FAIL (grew after reserve)" << std::endl;
 				return -1;
 			}
+			for(uint64_t k=1;k<=100000;++k) {
+				if ((!rht.get(k))||(*rht.get(k) != k)||(!rht2.get(k))||(*rht2.get(k) != k)) {
+					std::cout << "FAIL (lost entry after reserve)" << std::endl;
+					return -1;
+				}
+			}
 		}
 	}
 	std::cout << "PASS" << std::endl;
-#endif
+
+	std::cout << "[other] Testing multicast member index... "; std::cout.flush();
+	{
+		RuntimeEnvironment mrr((Node *)0);
+		Multicaster mc(&mrr);
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MulticastGroup mg(MAC(0xffffffffffffULL),0);
+		std::set<uint64_t> ref,fresh;
+
+		// Churn well past the size at which members are indexed
+		for(int i=0;i<50000;++i) {
+			const Address a((uint64_t)(rand() % 1024) + 1);
+			if ((rand() % 3) == 0) {
+				mc.remove(nwid,mg,a);
+				ref.erase(a.toInt());
+				fresh.erase(a.toInt());
+			} else {
+				const bool late = ((rand() & 1) == 0);
+				mc.add((void *)0,(late) ? ZT_MULTICAST_LIKE_EXPIRE : 1,nwid,mg,a);
+				ref.insert(a.toInt());
+				if (late)
+					fresh.insert(a.toInt());
+				else fresh.erase(a.toInt());
+			}
+		}
+		std::vector<Address> got(mc.getMembers(nwid,mg,0xffffffff));
+		std::set<uint64_t> gs;
+		for(std::vector<Address>::const_iterator a(got.begin());a!=got.end();++a)
+			gs.insert(a->toInt());
+		if ((got.size() != ref.size())||(gs != ref)) {
+			std::cout << "FAIL (members after churn)" << std::endl;
+			return -1;
+		}
+
+		// Expiring members moves the rest, after which removal must still find them
+		mc.clean(ZT_MULTICAST_LIKE_EXPIRE + 2);
+		got = mc.getMembers(nwid,mg,0xffffffff);
+		gs.clear();
+		for(std::vector<Address>::const_iterator a(got.begin());a!=got.end();++a)
+			gs.insert(a->toInt());
+		if ((got.size() != fresh.size())||(gs != fresh)) {
+			std::cout << "FAIL (members after expiry)" << std::endl;
+			return -1;
+		}
+		unsigned long n = (unsigned long)fresh.size();
+		for(std::set<uint64_t>::const_iterator a(fresh.begin());a!=fresh.end();++a) {
+			if ((*a & 1) == 0) {
+				mc.remove(nwid,mg,Address(*a));
+				--n;
+			}
+		}
+		got = mc.getMembers(nwid,mg,0xffffffff);
+		for(std::vector<Address>::const_iterator a(got.begin());a!=got.end();++a) {
+			if ((a->toInt() & 1) == 0) {
+				std::cout << "FAIL (remove after expiry)" << std::endl;
+				return -1;
+			}
+		}
+		if (got.size() != n) {
+			std::cout << "FAIL (count after expiry)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << ref.size() << "," << n << ")" << std::endl;
+	}
+
+	std::cout << "[other] Benchmarking Hashtable vs. FlatHashtable lookups... "; std::cout.flush();
+	{
+		Hashtable<uint64_t,uint64_t> cht;
+		FlatHashtable<uint64_t,uint64_t> fht;
+		std::vector<uint64_t> hkeys;
+		for(unsigned int i=0;i<50000;++i) {
+			const uint64_t k = (((uint64_t)rand() << 20) ^ (uint64_t)rand()) & 0xffffffffffULL;
+			hkeys.push_back(k);
+			cht[k] = i;
+			fht[k] = i;
+		}
+		uint64_t hsum = 0;
+		uint64_t hst = OSUtils::now();
+		for(unsigned int r=0;r<20;++r) {
+			for(std::vector<uint64_t>::const_iterator k(hkeys.begin());k!=hkeys.end();++k)
+				hsum += *(cht.get(*k));
+		}
+		uint64_t het = OSUtils::now();
+		std::cout << ((double)(het - hst) * 1000000.0 / (20.0 * (double)hkeys.size())) << "ns vs. ";
+		hst = OSUtils::now();
+		for(unsigned int r=0;r<20;++r) {
+			for(std::vector<uint64_t>::const_iterator k(hkeys.begin());k!=hkeys.end();++k)
+				hsum -= *(fht.get(*k));
+		}
+		het = OSUtils::now();
+		std::cout << ((double)(het - hst) * 1000000.0 / (20.0 * (double)hkeys.size())) << "ns per lookup";
+		if (hsum != 0) {
+			std::cout << " FAIL (mismatch)" << std::endl;
+			return -1;
+		}
+		std::cout << std::endl;
+	}
 
 	std::cout << "[other] Testing/fuzzing Dictionary... "; std::cout.flush();
 	for(int k=0;k<1000;++k) {
@@ -843,9 +2950,10 @@ static int testOther()
 			value[q][r] = (char)0;
 			test->add(key[q],value[q],r);
 		}
+		const Dictionary<8194>::Index *idx = new Dictionary<8194>::Index(*test);
 		for(unsigned int q=0;q<1024;++q) {
 			int r = rand() % 32;
-			char tmp[128];
+			char tmp[128],tmp2[128];
 			if (test->get(key[r],tmp,sizeof(tmp)) >= 0) {
 				if (strcmp(value[r],tmp)) {
 					std::cout << "FAILED (invalid value '" << value[r] << "' != '" << tmp << "')!" << std::endl;
@@ -855,7 +2963,12 @@ static int testOther()
 				std::cout << "FAILED (can't find key '" << key[r] << "')!" << std::endl;
 				return -1;
 			}
+			if ((idx->get(key[r],tmp2,sizeof(tmp2)) < 0)||(strcmp(tmp,tmp2))) {
+				std::cout << "FAILED (index lookup of key '" << key[r] << "' differs)!" << std::endl;
+				return -1;
+			}
 		}
+		delete idx;
 		delete test;
 	}
 	int foo = 0;
@@ -875,11 +2988,296 @@ static int testOther()
 			char value[8194];
 			*bar += test->get(tmp,value,sizeof(value));
 		}
+		const Dictionary<8194>::Index *idx = new Dictionary<8194>::Index(*test);
+		for(unsigned int q=0;q<100;++q) {
+			char tmp[128];
+			for(unsigned int x=0;x<128;++x) {
+				do { tmp[x] = (char)(rand() & 0xff); } while ((!tmp[x])||(tmp[x] == '=')||(tmp[x] == 13)||(tmp[x] == 10)); // not legal in keys
+			}
+			tmp[(q & 1) ? 127 : ((rand() % 2) + 1)] = (char)0; // short keys sometimes hit
+			char value[8194],value2[8194];
+			const int r = test->get(tmp,value,sizeof(value));
+			if ((idx->get(tmp,value2,sizeof(value2)) != r)||((r > 0)&&(memcmp(value,value2,r)))) {
+				std::cout << "FAILED (index lookup of junk differs)!" << std::endl;
+				return -1;
+			}
+			*bar += r;
+		}
+		delete idx;
 		delete test;
 		delete[] tmp;
 	}
 	std::cout << "PASS (junk value to prevent optimization-out of test: " << foo << ")" << std::endl;
 
+	std::cout << "[other] Testing heap-backed Dictionary... "; std::cout.flush();
+	{
+		// Must encode exactly as inline storage does, and a failed add must change nothing
+		Dictionary<8194> *fixed = new Dictionary<8194>();
+		Dictionary<ZT_DICTIONARY_MAX_INLINE + 1> *grown = new Dictionary<ZT_DICTIONARY_MAX_INLINE + 1>();
+		bool fixedFull = false;
+		for(unsigned int k=0;;++k) {
+			char key[16],value[128],tmp[128];
+			Utils::hex((uint32_t)k,key);
+			const int r = rand() % 128;
+			for(int x=0;x<r;++x)
+				value[x] = ("0123456789\0\t\r\n= ")[rand() % 16];
+			if (!fixedFull)
+				fixedFull = !fixed->add(key,value,r);
+			const Dictionary<ZT_DICTIONARY_MAX_INLINE + 1> before(*grown);
+			if (!grown->add(key,value,r)) {
+				// Escaping at most doubles the value, so an add that fails even then fits was refused early
+				if ((!fixedFull)||(strcmp(before.data(),grown->data()))||((grown->sizeBytes() + 1 + strlen(key) + 2 + (2 * r)) <= (ZT_DICTIONARY_MAX_INLINE + 1))) {
+					std::cout << "FAILED (failed add changed dictionary or was early)" << std::endl;
+					return -1;
+				}
+				break;
+			}
+			if ((!fixedFull)&&(strcmp(fixed->data(),grown->data()))) {
+				std::cout << "FAILED (differs from inline storage)" << std::endl;
+				return -1;
+			}
+			if ((grown->get(key,tmp,sizeof(tmp)) != r)||(memcmp(tmp,value,r))) {
+				std::cout << "FAILED (can't get key '" << key << "')" << std::endl;
+				return -1;
+			}
+		}
+		grown->clear();
+		if ((*grown)||(grown->sizeBytes())||(grown->contains("0"))) {
+			std::cout << "FAILED (clear)" << std::endl;
+			return -1;
+		}
+		delete grown;
+		delete fixed;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing NetworkConfig deltas... "; std::cout.flush();
+	{
+		NetworkConfig *nc = new NetworkConfig[3];
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>[4];
+		nc[0].networkId = 0x8056c2e21c000001ULL;
+		nc[0].timestamp = 1000;
+		nc[0].credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+		nc[0].revision = 1;
+		nc[0].issuedTo = Address(0x1234567890ULL);
+		nc[0].mtu = ZT_DEFAULT_MTU;
+		nc[0].ruleCount = ZT_MAX_NETWORK_RULES / 2;
+		nc[0].rules.resize(nc[0].ruleCount);
+		for(unsigned int i=0;i<nc[0].ruleCount;++i) {
+			nc[0].rules[i].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			nc[0].rules[i].v.etherType = (uint16_t)i;
+		}
+		nc[0].staticIps[nc[0].staticIpCount++] = InetAddress("10.0.0.1/24");
+		Utils::scopy(nc[0].name,sizeof(nc[0].name),"before");
+		nc[1] = nc[0];
+		nc[1].timestamp = 2000;
+		nc[1].staticIpCount = 0; // erases a key
+		nc[1].multicastLimit = 32;
+		nc[1].memberRateLimit = 1250000; // adds keys
+		nc[1].memberRateBurst = 65536;
+		nc[1].authOnlyPaths[nc[1].authOnlyPathCount++] = InetAddress("10.20.0.0/16");
+		Utils::scopy(nc[1].name,sizeof(nc[1].name),"after");
+		if ((!nc[0].toDictionary(d[0],false))||(!nc[1].toDictionary(d[1],false))) {
+			std::cout << "FAILED (toDictionary)" << std::endl;
+			return -1;
+		}
+		if (!NetworkConfig::makeDelta(d[0].data(),d[0].sizeBytes(),d[1].data(),d[1].sizeBytes(),d[2],d[3])) {
+			std::cout << "FAILED (makeDelta)" << std::endl;
+			return -1;
+		}
+		const unsigned int deltaSize = d[2].sizeBytes();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *applied = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		if ((!NetworkConfig::applyDelta(d[0].data(),d[0].sizeBytes(),d[2],*applied))||(strcmp(applied->data(),d[3].data()))) {
+			std::cout << "FAILED (applyDelta)" << std::endl;
+			return -1;
+		}
+		if ((!nc[0].fromDictionary(d[1]))||(!nc[2].fromDictionary(*applied))||(!(nc[2] == nc[0]))) {
+			std::cout << "FAILED (result does not match target)" << std::endl;
+			return -1;
+		}
+		if ((!nc[2].authOnlyPath(InetAddress("10.20.3.4/9993")))||(nc[2].authOnlyPath(InetAddress("10.21.3.4/9993")))) {
+			std::cout << "FAILED (authOnlyPath)" << std::endl;
+			return -1;
+		}
+		if (NetworkConfig::applyDelta(d[1].data(),d[1].sizeBytes(),d[2],*applied)) {
+			std::cout << "FAILED (applied to wrong base)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << deltaSize << " vs. " << d[1].sizeBytes() << " bytes)" << std::endl;
+		delete applied;
+		delete [] d;
+		delete [] nc;
+	}
+
+	std::cout << "[other] Testing config compression... "; std::cout.flush();
+	{
+		NetworkConfig *nc = new NetworkConfig();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		nc->networkId = 0x8056c2e21c000001ULL;
+		nc->timestamp = 1000;
+		nc->revision = 1;
+		nc->issuedTo = Address(0x1234567890ULL);
+		nc->mtu = ZT_DEFAULT_MTU;
+		nc->ruleCount = ZT_MAX_NETWORK_RULES;
+		nc->rules.resize(nc->ruleCount);
+		for(unsigned int i=0;i<nc->ruleCount;++i) {
+			nc->rules[i].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			nc->rules[i].v.etherType = (uint16_t)(i & 3);
+		}
+		if (!nc->toDictionary(*d,false)) {
+			std::cout << "FAILED (toDictionary)" << std::endl;
+			return -1;
+		}
+		const unsigned int dl = d->sizeBytes();
+		char *c = new char[dl];
+		char *u = new char[ZT_NETWORKCONFIG_DICT_CAPACITY];
+		const unsigned int cl = Packet::lz4Compress(d->data(),dl,c,dl);
+		if ((!cl)||(cl >= dl)) {
+			std::cout << "FAILED (did not compress)" << std::endl;
+			return -1;
+		}
+		if ((Packet::lz4Decompress(c,cl,u,ZT_NETWORKCONFIG_DICT_CAPACITY) != (int)dl)||(memcmp(u,d->data(),dl))) {
+			std::cout << "FAILED (round trip)" << std::endl;
+			return -1;
+		}
+		if (Packet::lz4Decompress(c,cl,u,dl / 2) >= 0) {
+			std::cout << "FAILED (overflowed output)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << dl << " to " << cl << " bytes)" << std::endl;
+		delete [] u;
+		delete [] c;
+		delete d;
+		delete nc;
+	}
+
+	std::cout << "[other] Testing controller msgpack to JSON conversion... "; std::cout.flush();
+	{
+		nlohmann::json m(nlohmann::json::object());
+		m["id"] = "1234567890";
+		m["authorized"] = true;
+		m["activeBridge"] = false;
+		m["revision"] = 0xfedcba9876543210ULL;
+		m["small"] = 7;
+		m["negative"] = -40000;
+		m["negativeSmall"] = -3;
+		m["nothing"] = nullptr;
+		m["name"] = std::string("quote\" backslash\\ tab\t nul") + std::string(1,(char)0) + std::string("\x01 caf\xc3\xa9");
+		m["ipAssignments"] = nlohmann::json::array();
+		m["ipAssignments"].push_back("10.0.0.1");
+		m["ipAssignments"].push_back(nlohmann::json::array());
+		m["authHistory"] = nlohmann::json::array();
+		m["authHistory"].push_back(nlohmann::json::object());
+		m["authHistory"][0]["a"] = true;
+		m["authHistory"][0]["ts"] = 1500000000000ULL;
+		m["long"] = std::string(300,'x');
+		std::string j;
+		if ((!JSONDB::packedToJson(nlohmann::json::to_msgpack(m),j))||(j != OSUtils::jsonDump(m,-1))) {
+			std::cout << "FAILED (" << j << ")" << std::endl;
+			return -1;
+		}
+		m["ratio"] = 0.25; // floats fall back to decoding
+		if ((!JSONDB::packedToJson(nlohmann::json::to_msgpack(m),j))||(j != OSUtils::jsonDump(m,-1))) {
+			std::cout << "FAILED (float: " << j << ")" << std::endl;
+			return -1;
+		}
+		std::vector<uint8_t> truncated(nlohmann::json::to_msgpack(m));
+		truncated.resize(truncated.size() / 2);
+		if (JSONDB::packedToJson(truncated,j)) {
+			std::cout << "FAILED (accepted truncated input)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[other] Benchmarking NetworkConfig decode... "; std::cout.flush();
+	{
+		NetworkConfig *nc = new NetworkConfig[2];
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *b = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		nc[0].networkId = 0x8056c2e21c000001ULL;
+		nc[0].timestamp = 1000;
+		nc[0].revision = 1;
+		nc[0].issuedTo = Address(0x1234567890ULL);
+		nc[0].mtu = ZT_DEFAULT_MTU;
+		nc[0].type = ZT_NETWORK_TYPE_PRIVATE;
+		nc[0].ruleCount = ZT_MAX_NETWORK_RULES / 2;
+		nc[0].rules.resize(nc[0].ruleCount);
+		for(unsigned int i=0;i<nc[0].ruleCount;++i) {
+			nc[0].rules[i].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			nc[0].rules[i].v.etherType = (uint16_t)i;
+		}
+		for(unsigned int i=0;i<16;++i)
+			nc[0].tags.push_back(Tag(nc[0].networkId,1000,nc[0].issuedTo,i,i * 2));
+		nc[0].tagCount = (unsigned int)nc[0].tags.size();
+		nc[0].staticIps[nc[0].staticIpCount++] = InetAddress("10.0.0.1/24");
+		nc[0].authOnlyPaths[nc[0].authOnlyPathCount++] = InetAddress("10.20.0.0/16");
+		Utils::scopy(nc[0].name,sizeof(nc[0].name),"bench");
+		nc[0].memberRateLimit = 1250000;
+		if ((!nc[0].toDictionary(*d,false))||(!nc[1].fromDictionary(*d))||(!(nc[1] == nc[0]))) {
+			std::cout << "FAILED (round trip)" << std::endl;
+			return -1;
+		}
+
+		// The keys NetworkConfig::fromDictionary() looks up, in its order
+		static const char *const keys[20] = {
+			ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA,ZT_NETWORKCONFIG_DICT_KEY_REVISION,
+			ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_TARGET,ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,ZT_NETWORKCONFIG_DICT_KEY_NAME,
+			ZT_NETWORKCONFIG_DICT_KEY_MTU,ZT_NETWORKCONFIG_DICT_KEY_VERSION,ZT_NETWORKCONFIG_DICT_KEY_FLAGS,ZT_NETWORKCONFIG_DICT_KEY_TYPE,
+			ZT_NETWORKCONFIG_DICT_KEY_COM,ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,ZT_NETWORKCONFIG_DICT_KEY_TAGS,ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,
+			ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,ZT_NETWORKCONFIG_DICT_KEY_ROUTES,ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,ZT_NETWORKCONFIG_DICT_KEY_RULES
+		};
+		const unsigned int rounds = 2000;
+		unsigned long found = 0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int k=0;k<rounds;++k) {
+			for(unsigned int i=0;i<20;++i)
+				found += (d->get(keys[i],*b)) ? 1 : 0;
+		}
+		const uint64_t linearTime = OSUtils::now() - start;
+		start = OSUtils::now();
+		for(unsigned int k=0;k<rounds;++k) {
+			const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index idx(*d);
+			for(unsigned int i=0;i<20;++i)
+				found -= (idx.get(keys[i],*b)) ? 1 : 0;
+		}
+		const uint64_t indexedTime = OSUtils::now() - start;
+		start = OSUtils::now();
+		for(unsigned int k=0;k<rounds;++k)
+			nc[1].fromDictionary(*d);
+		const uint64_t decodeTime = OSUtils::now() - start;
+		if (found != 0) {
+			std::cout << "FAILED (lookups differ)" << std::endl;
+			return -1;
+		}
+
+		if ((!nc[0].toBinary(*b))||(!nc[1].fromBinary(b->data(),b->size()))||(!(nc[1] == nc[0]))) {
+			std::cout << "FAILED (binary round trip)" << std::endl;
+			return -1;
+		}
+		{
+			// Members use the dictionary re-encoded from a binary config as their delta base
+			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d2 = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+			const bool same = ((nc[1].toDictionary(*d2,false))&&(d2->sizeBytes() == d->sizeBytes())&&(!memcmp(d2->data(),d->data(),d->sizeBytes())));
+			delete d2;
+			if (!same) {
+				std::cout << "FAILED (binary config does not re-encode to the same dictionary)" << std::endl;
+				return -1;
+			}
+		}
+		for(unsigned int l=0;l<b->size();l+=7)
+			nc[1].fromBinary(b->data(),l); // truncated, must not crash
+		start = OSUtils::now();
+		for(unsigned int k=0;k<rounds;++k)
+			nc[1].fromBinary(b->data(),b->size());
+		const uint64_t binaryDecodeTime = OSUtils::now() - start;
+
+		std::cout << d->sizeBytes() << " bytes (" << b->size() << " binary): lookups " << ((double)(linearTime * 1000) / (double)rounds) << "us linear, " << ((double)(indexedTime * 1000) / (double)rounds) << "us indexed, fromDictionary() " << ((double)(decodeTime * 1000) / (double)rounds) << "us, fromBinary() " << ((double)(binaryDecodeTime * 1000) / (double)rounds) << "us" << std::endl;
+		delete b;
+		delete d;
+		delete [] nc;
+	}
+
 	return 0;
 }
 
@@ -890,6 +3288,7 @@ static int testOther()
 #define ZT_TEST_PHY_TCP_MESSAGE_SIZE 1000000
 #define ZT_TEST_PHY_TIMEOUT_MS 20000
 static unsigned long phyTestUdpPacketCount = 0;
+static unsigned long phyTestUdpEct0Count = 0;
 static unsigned long phyTestTcpByteCount = 0;
 static unsigned long phyTestTcpConnectSuccessCount = 0;
 static unsigned long phyTestTcpConnectFailCount = 0;
@@ -901,6 +3300,8 @@ struct TestPhyHandlers
 	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
 	{
 		++phyTestUdpPacketCount;
+		if (Phy<TestPhyHandlers *>::datagramEcn() == 2)
+			++phyTestUdpEct0Count;
 	}
 
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
@@ -1004,6 +3405,93 @@ static int testPhy()
 	}
 	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	std::cout << "[phy] Testing batched UDP send/receive... "; std::cout.flush();
+	{
+		PhyUdpSendQueue *const sendq = new PhyUdpSendQueue();
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < (ZT_TEST_PHY_NUM_UDP_PACKETS * 2))) {
+			for(unsigned int i=0;((i<ZT_PHY_UDP_SEND_BATCH)&&(phyTestUdpPacketsSent < (ZT_TEST_PHY_NUM_UDP_PACKETS * 2)));++i) {
+				if (!testPhyInstance->udpSendQueued(*sendq,udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload))) {
+					std::cout << "FAILED." << std::endl;
+					delete sendq;
+					return -1;
+				} else ++phyTestUdpPacketsSent;
+			}
+			sendq->flush();
+			testPhyInstance->poll(100);
+		}
+		delete sendq;
+	}
+	if (phyTestUdpPacketCount < (ZT_TEST_PHY_NUM_UDP_PACKETS * 2)) {
+		std::cout << "got " << (phyTestUdpPacketCount - ZT_TEST_PHY_NUM_UDP_PACKETS) << " packets, FAILED." << std::endl;
+		return -1;
+	}
+	std::cout << "got " << (phyTestUdpPacketCount - ZT_TEST_PHY_NUM_UDP_PACKETS) << " packets, OK" << std::endl;
+#endif
+
+#ifdef ZT_PHY_HAVE_ECN
+	std::cout << "[phy] Testing UDP send/receive with ECT(0)... "; std::cout.flush();
+	{
+		// Half sent directly and half queued; only these are ECN-capable
+		PhyUdpSendQueue *const sendq = new PhyUdpSendQueue();
+		for(unsigned int i=0;i<16;++i) {
+			if (i & 1)
+				testPhyInstance->udpSendQueued(*sendq,udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload),2);
+			else testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload),2);
+		}
+		sendq->flush();
+		delete sendq;
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt)&&(phyTestUdpEct0Count < 16))
+			testPhyInstance->poll(100);
+		if (phyTestUdpEct0Count != 16) {
+			std::cout << "got " << phyTestUdpEct0Count << " marked, FAILED." << std::endl;
+			return -1;
+		}
+		std::cout << "got " << phyTestUdpEct0Count << " marked, OK" << std::endl;
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_IO_URING
+	std::cout << "[phy] Testing io_uring UDP receive... "; std::cout.flush();
+	{
+		Phy<TestPhyHandlers *> *const ringPhy = new Phy<TestPhyHandlers *>(&testPhyHandlers,false,true);
+		if (!ringPhy->useIoUring()) {
+			std::cout << "not supported by this kernel, skipped" << std::endl;
+		} else {
+			struct sockaddr_in ringaddr;
+			memcpy(&ringaddr,&bindaddr,sizeof(ringaddr));
+			ringaddr.sin_port = Utils::hton((uint16_t)60006);
+			PhySocket *const ringSock = ringPhy->udpBind((const struct sockaddr *)&ringaddr);
+			if (!ringSock) {
+				std::cout << "FAILED (bind)." << std::endl;
+				delete ringPhy;
+				return -1;
+			}
+			const unsigned long base = phyTestUdpPacketCount;
+			unsigned long sent = 0;
+			timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+			while ((OSUtils::now() < timeoutAt)&&((phyTestUdpPacketCount - base) < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+				for(unsigned int i=0;((i<64)&&(sent < ZT_TEST_PHY_NUM_UDP_PACKETS));++i) {
+					if (ringPhy->udpSend(ringSock,(const struct sockaddr *)&ringaddr,udpTestPayload,sizeof(udpTestPayload)))
+						++sent;
+				}
+				ringPhy->poll(100);
+			}
+			ringPhy->close(ringSock);
+			ringPhy->poll(1); // reaps the socket once its receive is cancelled
+			if ((phyTestUdpPacketCount - base) < ZT_TEST_PHY_NUM_UDP_PACKETS) {
+				std::cout << "got " << (phyTestUdpPacketCount - base) << " packets, FAILED." << std::endl;
+				delete ringPhy;
+				return -1;
+			}
+			std::cout << "got " << (phyTestUdpPacketCount - base) << " packets, OK" << std::endl;
+		}
+		delete ringPhy;
+	}
+#endif
+
 	std::cout << "[phy] Testing TCP... "; std::cout.flush();
 	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
 	while ((OSUtils::now() < timeoutAt)&&(phyTestTcpByteCount < (ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS * ZT_TEST_PHY_TCP_MESSAGE_SIZE))) {
@@ -1031,6 +3519,162 @@ static int testPhy()
 	return 0;
 }
 
+// Replays a capture recorded with the wireCapture setting into a node with
+// a copy of the recording node's state, read only from its home directory
+static int _replayStateGet(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	const char *const home = reinterpret_cast<const char *>(uptr);
+	char p[4096];
+	switch(type) {
+		case ZT_STATE_OBJECT_IDENTITY_PUBLIC: OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",home); break;
+		case ZT_STATE_OBJECT_IDENTITY_SECRET: OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",home); break;
+		case ZT_STATE_OBJECT_NETWORK_CONFIG:  OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d/%.16llx.conf",home,(unsigned long long)id[0]); break;
+		case ZT_STATE_OBJECT_PLANET:          OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",home); break;
+		case ZT_STATE_OBJECT_MOON:            OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d/%.16llx.moon",home,(unsigned long long)id[0]); break;
+		case ZT_STATE_OBJECT_PEER:            OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d/%.10llx.peer",home,(unsigned long long)id[0]); break;
+		case ZT_STATE_OBJECT_IDENTITY:        OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identities.d/%.10llx.id",home,(unsigned long long)id[0]); break;
+		default: return -1;
+	}
+	FILE *f = fopen(p,"rb");
+	if (!f)
+		return -1;
+	const int n = (int)fread(data,1,maxlen,f);
+	fclose(f);
+	return (n > 0) ? n : -1;
+}
+static void _replayStatePut(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len) {}
+static int _replayWirePacketSend(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl) { return 0; }
+static void _replayFrame(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len) {}
+static int _replayNetworkConfig(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf) { return 0; }
+static void _replayEvent(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData) {}
+
+static const char *_replayVerbName(const unsigned int v)
+{
+	static const char *const names[0x19] = {
+		"NOP","HELLO","ERROR","OK","WHOIS","RENDEZVOUS","FRAME","EXT_FRAME","ECHO","MULTICAST_LIKE","NETWORK_CREDENTIALS","NETWORK_CONFIG_REQUEST","NETWORK_CONFIG",
+		"MULTICAST_GATHER","MULTICAST_FRAME","(0x0f)","PUSH_DIRECT_PATHS","(0x11)","(0x12)","(0x13)","USER_MESSAGE","REMOTE_TRACE","PATH_FEC","BENCH","NAT_PROBE"
+	};
+	return (v < 0x19) ? names[v] : "(unknown)";
+}
+
+// Feeds every packet through a new node, timing each processWirePacket()
+// call. If byVerb is set, packets are traced so their cost is charged to
+// the verb they turned out to be, or to one of the extra rows at the end.
+static int _replayPass(const char *home,const char *capture,const bool byVerb,uint64_t &packets,uint64_t &ns,uint64_t verbPackets[0x1c],uint64_t verbNs[0x1c])
+{
+	FILE *f = fopen(capture,"rb");
+	if (!f) {
+		std::cout << "cannot open " << capture << std::endl;
+		return -1;
+	}
+	if (!WireCapture::readHeader(f)) {
+		std::cout << capture << " is not a wire capture" << std::endl;
+		fclose(f);
+		return -1;
+	}
+
+	WireCapture::Record r;
+	if (!WireCapture::read(f,r)) {
+		std::cout << capture << " is empty" << std::endl;
+		fclose(f);
+		return -1;
+	}
+
+	struct ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.stateGetFunction = _replayStateGet;
+	cb.statePutFunction = _replayStatePut;
+	cb.wirePacketSendFunction = _replayWirePacketSend;
+	cb.virtualNetworkFrameFunction = _replayFrame;
+	cb.virtualNetworkConfigFunction = _replayNetworkConfig;
+	cb.eventCallback = _replayEvent;
+	ZT_Node *zn = (ZT_Node *)0;
+	if (ZT_Node_new(&zn,const_cast<char *>(home),(void *)0,&cb,r.timestamp) != ZT_RESULT_OK) {
+		std::cout << "cannot start node" << std::endl;
+		fclose(f);
+		return -1;
+	}
+	Node *const n = reinterpret_cast<Node *>(zn);
+
+	const std::string nd(std::string(home) + ZT_PATH_SEPARATOR_S + "networks.d");
+	std::vector<std::string> nets(OSUtils::listDirectory(nd.c_str()));
+	for(std::vector<std::string>::iterator nf(nets.begin());nf!=nets.end();++nf) {
+		if ((nf->length() == 21)&&(nf->substr(16) == ".conf"))
+			n->join(Utils::hexStrToU64(nf->substr(0,16).c_str()),(void *)0,(void *)0);
+	}
+
+	std::vector<PacketTrace::Record> tr;
+	uint64_t traced = 0;
+	if (byVerb) {
+		n->packetTrace().setSampleRate(1);
+		traced = n->packetTrace().get(0,tr);
+	}
+	volatile uint64_t nextBackgroundTaskDeadline = r.timestamp;
+	do {
+		if (r.timestamp >= nextBackgroundTaskDeadline)
+			n->processBackgroundTasks((void *)0,r.timestamp,&nextBackgroundTaskDeadline);
+		const uint64_t start = Latency::nanoseconds();
+		n->processWirePacket((void *)0,r.timestamp,r.localSocket,reinterpret_cast<const struct sockaddr_storage *>(&(r.from)),r.data.data(),(unsigned int)r.data.length(),&nextBackgroundTaskDeadline);
+		const uint64_t t = Latency::nanoseconds() - start;
+		++packets;
+		ns += t;
+		if (byVerb) {
+			unsigned int row = 0x19; // fragment or packet waiting on something, e.g. a WHOIS
+			tr.clear();
+			traced = n->packetTrace().get(traced,tr);
+			for(std::vector<PacketTrace::Record>::const_iterator e(tr.begin());e!=tr.end();++e) {
+				if (e->event == PacketTrace::EVENT_PACKET_RECEIVED) {
+					row = std::min((unsigned int)e->verb,0x18U);
+					break;
+				} else if (e->event == PacketTrace::EVENT_PACKET_RELAYED) {
+					row = 0x1a;
+				} else if (e->event == PacketTrace::EVENT_PACKET_DROPPED) {
+					row = 0x1b;
+				}
+			}
+			++verbPackets[row];
+			verbNs[row] += t;
+		}
+	} while (WireCapture::read(f,r));
+
+	fclose(f);
+	ZT_Node_delete(zn);
+	return 0;
+}
+
+static int replayWireCapture(const char *home,const char *capture)
+{
+	uint64_t packets = 0,ns = 0;
+	uint64_t verbPackets[0x1c],verbNs[0x1c];
+	memset(verbPackets,0,sizeof(verbPackets));
+	memset(verbNs,0,sizeof(verbNs));
+
+	std::cout << "[replay] Replaying " << capture << " into a node from " << home << "... "; std::cout.flush();
+	if (_replayPass(home,capture,false,packets,ns,verbPackets,verbNs))
+		return -1;
+	std::cout << packets << " packets, " << ((ns) ? (uint64_t)(((double)packets * 1000000000.0) / (double)ns) : 0ULL) << " packets/second" << std::endl;
+
+	// The second pass is traced, which costs a little, so packets/second is from the first
+	packets = 0;
+	ns = 0;
+	std::cout << "[replay] Per-verb cost (traced pass):" << std::endl;
+	if (_replayPass(home,capture,true,packets,ns,verbPackets,verbNs))
+		return -1;
+	for(unsigned int v=0;v<0x1c;++v) {
+		if (!verbPackets[v])
+			continue;
+		char tmp[256];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"[replay]   %-24s %10llu packets %10llu ns/packet %6.2f%% of time",
+			(v < 0x19) ? _replayVerbName(v) : ((v == 0x19) ? "(fragment or pending)" : ((v == 0x1a) ? "(relayed)" : "(dropped)")),
+			(unsigned long long)verbPackets[v],
+			(unsigned long long)(verbNs[v] / verbPackets[v]),
+			(ns) ? (((double)verbNs[v] * 100.0) / (double)ns) : 0.0);
+		std::cout << tmp << std::endl;
+	}
+	return 0;
+}
+
 #ifdef __WINDOWS__
 int __cdecl _tmain(int argc, _TCHAR* argv[])
 #else
@@ -1039,6 +3683,11 @@ int main(int argc,char **argv)
 {
 	int r = 0;
 
+#ifndef __WINDOWS__
+	if ((argc == 4)&&(!strcmp(argv[1],"replay")))
+		return replayWireCapture(argv[2],argv[3]);
+#endif
+
 #ifdef __WINDOWS__
 	WSADATA wsaData;
 	WSAStartup(MAKEWORD(2,2),&wsaData);
@@ -27,14 +27,15 @@
 #ifndef ZT_CLUSTERDEFINITION_HPP
 #define ZT_CLUSTERDEFINITION_HPP
 
-#ifdef ZT_ENABLE_CLUSTER
-
 #include <vector>
+#include <string>
 #include <algorithm>
+#include <stdexcept>
 
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
 #include "../node/NonCopyable.hpp"
+#include "../node/InetAddress.hpp"
 #include "../osdep/OSUtils.hpp"
 
 #include "ClusterGeoIpService.hpp"
@@ -72,7 +73,7 @@ public:
 			return;
 
 		char myAddressStr[64];
-		Utils::ztsnprintf(myAddressStr,sizeof(myAddressStr),"%.10llx",myAddress);
+		OSUtils::ztsnprintf(myAddressStr,sizeof(myAddressStr),"%.10llx",myAddress);
 
 		std::vector<std::string> lines(OSUtils::split(cf.c_str(),"\r\n","",""));
 		for(std::vector<std::string>::iterator l(lines.begin());l!=lines.end();++l) {
@@ -95,7 +96,7 @@ public:
 
 			// <address> <ID> <name> <backplane IP/port(s)> <ZT frontplane IP/port(s)> <x,y,z>
 			int id = Utils::strToUInt(fields[1].c_str());
-			if ((id < 0)||(id > ZT_CLUSTER_MAX_MEMBERS))
+			if ((id < 0)||(id >= ZT_CLUSTER_MAX_MEMBERS))
 				throw std::runtime_error(std::string("invalid cluster member ID: ")+fields[1]);
 			MemberDefinition &md = _md[id];
 
@@ -107,13 +108,13 @@ public:
 				md.z = (xyz.size() > 2) ? Utils::strToInt(xyz[2].c_str()) : 0;
 			}
 			Utils::scopy(md.name,sizeof(md.name),fields[2].c_str());
-			md.clusterEndpoint.fromString(fields[3]);
+			md.clusterEndpoint.fromString(fields[3].c_str());
 			if (!md.clusterEndpoint)
 				continue;
 			std::vector<std::string> zips(OSUtils::split(fields[4].c_str(),",","",""));
 			for(std::vector<std::string>::iterator zip(zips.begin());zip!=zips.end();++zip) {
 				InetAddress i;
-				i.fromString(*zip);
+				i.fromString(zip->c_str());
 				if (i)
 					md.zeroTierEndpoints.push_back(i);
 			}
@@ -163,6 +164,4 @@ private:
 
 } // namespace ZeroTier
 
-#endif // ZT_ENABLE_CLUSTER
-
 #endif
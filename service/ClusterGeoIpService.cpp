@@ -24,8 +24,6 @@
  * of your own application.
  */
 
-#ifdef ZT_ENABLE_CLUSTER
-
 #include <math.h>
 
 #include <cmath>
@@ -114,8 +112,8 @@ void ClusterGeoIpService::_parseLine(const char *line,std::vector<_V4E> &v4db,st
 	     ((ipEndColumn >= 0)&&(ipEndColumn < (int)ls.size()))&&
 	     ((latitudeColumn >= 0)&&(latitudeColumn < (int)ls.size()))&&
 	     ((longitudeColumn >= 0)&&(longitudeColumn < (int)ls.size())) ) {
-		InetAddress ipStart(ls[ipStartColumn].c_str(),0);
-		InetAddress ipEnd(ls[ipEndColumn].c_str(),0);
+		InetAddress ipStart(ls[ipStartColumn].c_str());
+		InetAddress ipEnd(ls[ipEndColumn].c_str());
 		const double lat = strtod(ls[latitudeColumn].c_str(),(char **)0);
 		const double lon = strtod(ls[longitudeColumn].c_str(),(char **)0);
 
@@ -215,8 +213,6 @@ long ClusterGeoIpService::_load(const char *pathToCsv,int ipStartColumn,int ipEn
 
 } // namespace ZeroTier
 
-#endif // ZT_ENABLE_CLUSTER
-
 /*
 int main(int argc,char **argv)
 {
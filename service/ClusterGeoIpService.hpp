@@ -27,8 +27,6 @@
 #ifndef ZT_CLUSTERGEOIPSERVICE_HPP
 #define ZT_CLUSTERGEOIPSERVICE_HPP
 
-#ifdef ZT_ENABLE_CLUSTER
-
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -146,6 +144,4 @@ private:
 
 } // namespace ZeroTier
 
-#endif // ZT_ENABLE_CLUSTER
-
 #endif
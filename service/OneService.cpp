@@ -34,6 +34,13 @@
 #include <vector>
 #include <algorithm>
 #include <list>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
 
 #include "../version.h"
 #include "../include/ZeroTierOne.h"
@@ -41,6 +48,7 @@
 #include "../node/Constants.hpp"
 #include "../node/Mutex.hpp"
 #include "../node/Node.hpp"
+#include "../node/Packet.hpp"
 #include "../node/Utils.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/MAC.hpp"
@@ -48,18 +56,29 @@
 #include "../node/World.hpp"
 #include "../node/Salsa20.hpp"
 #include "../node/Poly1305.hpp"
+#include "../node/HugePages.hpp"
 #include "../node/SHA512.hpp"
 
 #include "../osdep/Phy.hpp"
 #include "../osdep/Thread.hpp"
+#include "../osdep/CpuAffinity.hpp"
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Http.hpp"
 #include "../osdep/PortMapper.hpp"
 #include "../osdep/Binder.hpp"
 #include "../osdep/ManagedRoute.hpp"
+#include "../osdep/RingBuffer.hpp"
+#include "../osdep/WireCapture.hpp"
+#ifdef __LINUX__
+#include "../osdep/LinuxXdpReceiver.hpp"
+#endif
+#ifdef __FreeBSD__
+#include "../osdep/BSDNetmapReceiver.hpp"
+#endif
 
 #include "OneService.hpp"
 #include "SoftwareUpdater.hpp"
+#include "ClusterDefinition.hpp"
 
 #ifdef __WINDOWS__
 #include <WinSock2.h>
@@ -94,6 +113,13 @@ namespace ZeroTier { typedef TestEthernetTap EthernetTap; }
 
 #else
 
+#ifdef ZT_USE_USERSPACE_STACK
+
+#include "../osdep/UserspaceStack.hpp"
+namespace ZeroTier { typedef UserspaceStack EthernetTap; }
+
+#else
+
 #ifdef ZT_SDK
 
 #include "../controller/EmbeddedNetworkController.hpp"
@@ -105,12 +131,20 @@ namespace ZeroTier { typedef SocketTap EthernetTap; }
 #else
 
 #ifdef __APPLE__
+#ifdef ZT_MAC_FETH
+#include "../osdep/MacEthernetTap.hpp"
+namespace ZeroTier { typedef MacEthernetTap EthernetTap; }
+#else
 #include "../osdep/OSXEthernetTap.hpp"
 namespace ZeroTier { typedef OSXEthernetTap EthernetTap; }
+#endif // ZT_MAC_FETH
 #endif // __APPLE__
 #ifdef __LINUX__
 #include "../osdep/LinuxEthernetTap.hpp"
 namespace ZeroTier { typedef LinuxEthernetTap EthernetTap; }
+#define ZT_TAP_HAVE_QUEUES 1
+#define ZT_TAP_HAVE_GRO 1
+#define ZT_TAP_HAVE_L3 1
 #endif // __LINUX__
 #ifdef __WINDOWS__
 #include "../osdep/WindowsEthernetTap.hpp"
@@ -119,6 +153,9 @@ namespace ZeroTier { typedef WindowsEthernetTap EthernetTap; }
 #ifdef __FreeBSD__
 #include "../osdep/BSDEthernetTap.hpp"
 namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
+#ifdef ZT_HAVE_NETMAP
+#define ZT_TAP_HAVE_NETMAP 1
+#endif
 #endif // __FreeBSD__
 #ifdef __OpenBSD__
 #include "../osdep/BSDEthernetTap.hpp"
@@ -127,11 +164,14 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 
 #endif // ZT_SERVICE_NETCON
 
+#endif // ZT_USE_USERSPACE_STACK
+
 #endif // ZT_USE_TEST_TAP
 
 // Sanity limits for HTTP
 #define ZT_MAX_HTTP_MESSAGE_SIZE (1024 * 1024 * 64)
 #define ZT_MAX_HTTP_CONNECTIONS 65536
+#define ZT_MAX_HTTP_PIPELINED 256
 
 // Interface metric for ZeroTier taps -- this ensures that if we are on WiFi and also
 // bridged via ZeroTier to the same LAN traffic will (if the OS is sane) prefer WiFi.
@@ -149,15 +189,48 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // Attempt to engage TCP fallback after this many ms of no reply to packets sent to global-scope IPs
 #define ZT_TCP_FALLBACK_AFTER 60000
 
+// Sanity limit for parallel TCP fallback tunnels (tcpFallbackTunnels in local.conf)
+#define ZT_TCP_FALLBACK_MAX_TUNNELS 16
+
 // How often to check for local interface addresses
 #define ZT_LOCAL_INTERFACE_CHECK_INTERVAL 60000
 
 // Maximum write buffer size for outgoing TCP connections (sanity limit)
 #define ZT_TCP_MAX_WRITEQ_SIZE 33554432
 
+// Maximum bytes queued to the TCP fallback tunnel, beyond which packets are dropped as UDP would
+#define ZT_TCP_TUNNEL_MAX_WRITEQ_SIZE 1048576
+
 // TCP activity timeout
 #define ZT_TCP_ACTIVITY_TIMEOUT 60000
 
+// Idle keep-alive control API connections are closed after this long
+#define ZT_HTTP_KEEPALIVE_TIMEOUT 30000
+
+// Longest a GET /controller/changes?wait= long poll is held, and how often held ones check for changes
+#define ZT_CONTROL_PLANE_MAX_WAIT 60000
+#define ZT_CONTROL_PLANE_WAIT_POLL 100
+
+// Sanity limit for threads receiving UDP (ioThreads in local.conf)
+#define ZT_MAX_IO_THREADS 256
+
+// Threads decoding packets the node defers (HELLOs from new peers, WHOIS replies, credentials)
+#define ZT_DEFERRED_PACKET_THREADS 2
+
+// Most threads rejoining saved networks at once at startup
+#define ZT_STARTUP_JOIN_THREADS 8
+
+// Sanity limit for threads encrypting and decrypting for busy peers (cryptoThreads in local.conf)
+#define ZT_MAX_CRYPTO_THREADS 64
+
+// Most state object digests kept to skip rewriting unchanged objects
+#define ZT_STATE_WRITER_MAX_DIGESTS 4096
+
+// Additional I/O threads need the kernel to spread UDP across SO_REUSEPORT sockets
+#if defined(__LINUX__) && defined(SO_REUSEPORT)
+#define ZT_USE_IO_THREADS 1
+#endif
+
 namespace ZeroTier {
 
 namespace {
@@ -165,6 +238,29 @@ namespace {
 // Fake TLS hello for TCP tunnel outgoing connections (TUNNELED mode)
 static const char ZT_TCP_TUNNEL_HELLO[9] = { 0x17,0x03,0x03,0x00,0x04,(char)ZEROTIER_ONE_VERSION_MAJOR,(char)ZEROTIER_ONE_VERSION_MINOR,(char)((ZEROTIER_ONE_VERSION_REVISION >> 8) & 0xff),(char)(ZEROTIER_ONE_VERSION_REVISION & 0xff) };
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+// If set, UDP packets sent by this thread are queued here and sent in batches.
+// The main loop and tap frame handlers set this; other threads send directly.
+static thread_local PhyUdpSendQueue *_threadUdpSendQueue = (PhyUdpSendQueue *)0;
+
+// Queue for a thread to batch into when it isn't already batching. A queue is
+// too big to put on the stack of every tap frame, so each thread allocates one
+// the first time and keeps it until it exits.
+static PhyUdpSendQueue &_threadSpareUdpSendQueue()
+{
+	static thread_local std::unique_ptr<PhyUdpSendQueue> q;
+	if (!q)
+		q.reset(new PhyUdpSendQueue());
+	return *q;
+}
+#endif
+
+#ifdef ZT_TAP_HAVE_GRO
+// If set, TCP segments this thread writes to taps are coalesced here. Threads
+// that receive UDP set this and flush it at the end of each batch.
+static thread_local LinuxTapGro *_threadTapGro = (LinuxTapGro *)0;
+#endif
+
 static std::string _trimString(const std::string &s)
 {
 	unsigned long end = (unsigned long)s.length();
@@ -202,24 +298,31 @@ static void _networkToJson(nlohmann::json &nj,const ZT_VirtualNetworkConfig *nc,
 		case ZT_NETWORK_TYPE_PUBLIC:                     ntype = "PUBLIC"; break;
 	}
 
-	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",nc->nwid);
+	Utils::hex((uint64_t)nc->nwid,tmp);
 	nj["id"] = tmp;
 	nj["nwid"] = tmp;
-	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(unsigned int)((nc->mac >> 40) & 0xff),(unsigned int)((nc->mac >> 32) & 0xff),(unsigned int)((nc->mac >> 24) & 0xff),(unsigned int)((nc->mac >> 16) & 0xff),(unsigned int)((nc->mac >> 8) & 0xff),(unsigned int)(nc->mac & 0xff));
-	nj["mac"] = tmp;
+	nj["mac"] = MAC(nc->mac).toString(tmp);
 	nj["name"] = nc->name;
 	nj["status"] = nstatus;
 	nj["type"] = ntype;
 	nj["mtu"] = nc->mtu;
+	nj["physicalMtu"] = nc->physicalMtu;
 	nj["dhcp"] = (bool)(nc->dhcp != 0);
 	nj["bridge"] = (bool)(nc->bridge != 0);
 	nj["broadcastEnabled"] = (bool)(nc->broadcastEnabled != 0);
 	nj["portError"] = nc->portError;
 	nj["netconfRevision"] = nc->netconfRevision;
+	nj["bridgeRouteCount"] = nc->bridgeRouteCount;
+	nj["framesIn"] = nc->framesIn;
+	nj["framesOut"] = nc->framesOut;
+	nj["bytesIn"] = nc->bytesIn;
+	nj["bytesOut"] = nc->bytesOut;
+	nj["framesDropped"] = nc->framesDropped;
 	nj["portDeviceName"] = portDeviceName;
 	nj["allowManaged"] = localSettings.allowManaged;
 	nj["allowGlobal"] = localSettings.allowGlobal;
 	nj["allowDefault"] = localSettings.allowDefault;
+	nj["l3"] = localSettings.l3;
 
 	nlohmann::json aa = nlohmann::json::array();
 	for(unsigned int i=0;i<nc->assignedAddressCount;++i) {
@@ -252,8 +355,7 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		case ZT_PEER_ROLE_PLANET: prole = "PLANET"; break;
 	}
 
-	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",peer->address);
-	pj["address"] = tmp;
+	pj["address"] = Utils::hex10(peer->address,tmp);
 	pj["versionMajor"] = peer->versionMajor;
 	pj["versionMinor"] = peer->versionMinor;
 	pj["versionRev"] = peer->versionRev;
@@ -261,6 +363,19 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 	pj["version"] = tmp;
 	pj["latency"] = peer->latency;
 	pj["role"] = prole;
+	pj["compressionBytesIn"] = peer->compressionBytesIn;
+	pj["compressionBytesSaved"] = peer->compressionBytesSaved;
+	pj["compressionBytesSkipped"] = peer->compressionBytesSkipped;
+	pj["compressionZstdBytesIn"] = peer->compressionZstdBytesIn;
+	pj["compressionZstdBytesSaved"] = peer->compressionZstdBytesSaved;
+	pj["compressionRatio"] = (peer->compressionBytesIn > peer->compressionBytesSaved) ? ((double)peer->compressionBytesIn / (double)(peer->compressionBytesIn - peer->compressionBytesSaved)) : 1.0;
+	pj["zstd"] = (bool)(peer->zstd != 0);
+	pj["packetsIn"] = peer->packetsIn;
+	pj["packetsOut"] = peer->packetsOut;
+	pj["bytesIn"] = peer->bytesIn;
+	pj["bytesOut"] = peer->bytesOut;
+	pj["packetsDropped"] = peer->packetsDropped;
+	pj["lastActivity"] = peer->lastActivity;
 
 	nlohmann::json pa = nlohmann::json::array();
 	for(unsigned int i=0;i<peer->pathCount;++i) {
@@ -270,6 +385,8 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["lastReceive"] = peer->paths[i].lastReceive;
 		j["trustedPathId"] = peer->paths[i].trustedPathId;
 		j["linkQuality"] = (double)peer->paths[i].linkQuality / (double)ZT_PATH_LINK_QUALITY_MAX;
+		j["fec"] = (bool)(peer->paths[i].fec != 0);
+		j["fecRepaired"] = peer->paths[i].fecRepaired;
 		j["active"] = (bool)(peer->paths[i].expired == 0);
 		j["expired"] = (bool)(peer->paths[i].expired != 0);
 		j["preferred"] = (bool)(peer->paths[i].preferred != 0);
@@ -281,8 +398,7 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 static void _moonToJson(nlohmann::json &mj,const World &world)
 {
 	char tmp[4096];
-	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",world.id());
-	mj["id"] = tmp;
+	mj["id"] = Utils::hex((uint64_t)world.id(),tmp);
 	mj["timestamp"] = world.timestamp();
 	mj["signature"] = Utils::hex(world.signature().data,(unsigned int)world.signature().size(),tmp);
 	mj["updatesMustBeSignedBy"] = Utils::hex(world.updatesMustBeSignedBy().data,(unsigned int)world.updatesMustBeSignedBy().size(),tmp);
@@ -300,6 +416,163 @@ static void _moonToJson(nlohmann::json &mj,const World &world)
 	mj["waiting"] = false;
 }
 
+static void _captureToJson(nlohmann::json &cj,const Capture &c)
+{
+	char tmp[64];
+	Capture::Filter f;
+	c.filter(f);
+	cj["enabled"] = c.enabled();
+	cj["networkId"] = Utils::hex((uint64_t)f.networkId,tmp);
+	cj["peer"] = Utils::hex10(f.peer,tmp);
+	cj["etherType"] = f.etherType;
+	cj["direction"] = (f.inbound) ? ((f.outbound) ? "both" : "in") : "out";
+	cj["dropsOnly"] = f.dropsOnly;
+	cj["snapLength"] = f.snapLength;
+	cj["last"] = c.last();
+}
+
+static void _benchToJson(nlohmann::json &bj,const Bench::Result &r)
+{
+	char tmp[256];
+	bj["peer"] = Utils::hex10(r.peer,tmp);
+	bj["path"] = (r.path) ? nlohmann::json(r.path.toString(tmp)) : nlohmann::json();
+	bj["running"] = r.running;
+	bj["direct"] = r.direct;
+	bj["answered"] = r.answered;
+	bj["duration"] = r.duration;
+	bj["packetSize"] = r.packetSize;
+	bj["packetsSent"] = r.packetsSent;
+	bj["bytesSent"] = r.bytesSent;
+	bj["sendTime"] = r.sendTime;
+	bj["armorTime"] = r.armorTime;
+	bj["wireTime"] = r.wireTime;
+	bj["packetsReceived"] = r.packetsReceived;
+	bj["bytesReceived"] = r.bytesReceived;
+	bj["receiveTime"] = r.receiveTime;
+	bj["pingsSent"] = r.pingsSent;
+	bj["pongsReceived"] = r.pongsReceived;
+	bj["rttMin"] = r.rttMin;
+	bj["rttP50"] = r.rttP50;
+	bj["rttP90"] = r.rttP90;
+	bj["rttP99"] = r.rttP99;
+	bj["rttMax"] = r.rttMax;
+
+	// Derived figures: bits per second on each side, and the fraction of DATA lost
+	bj["sendRate"] = (r.sendTime) ? (uint64_t)(((double)r.bytesSent * 8.0e9) / (double)r.sendTime) : (uint64_t)0;
+	bj["receiveRate"] = (r.receiveTime) ? (uint64_t)(((double)r.bytesReceived * 8.0e9) / (double)r.receiveTime) : (uint64_t)0;
+	bj["loss"] = ((r.answered)&&(r.packetsSent)) ? (double)(r.packetsSent - std::min(r.packetsSent,r.packetsReceived)) / (double)r.packetsSent : 0.0;
+}
+
+static const char *_latencyStageName(const unsigned int s)
+{
+	switch(s) {
+		case Latency::WIRE_PACKET:  return "wirePacket";
+		case Latency::WIRE_DEARMOR: return "wireDearmor";
+		case Latency::WIRE_VERB:    return "wireVerb";
+		case Latency::FILTER_IN:    return "filterIn";
+		case Latency::TAP_WRITE:    return "tapWrite";
+		case Latency::FRAME_PACKET: return "framePacket";
+		case Latency::FILTER_OUT:   return "filterOut";
+		case Latency::ARMOR:        return "armor";
+	}
+	return "unknown";
+}
+
+static const char *_packetTraceEventName(const unsigned int e)
+{
+	switch(e) {
+		case PacketTrace::EVENT_PACKET_RECEIVED: return "PACKET_RECEIVED";
+		case PacketTrace::EVENT_PACKET_SENT:     return "PACKET_SENT";
+		case PacketTrace::EVENT_PACKET_RELAYED:  return "PACKET_RELAYED";
+		case PacketTrace::EVENT_PACKET_DROPPED:  return "PACKET_DROPPED";
+		case PacketTrace::EVENT_FRAME_DROPPED:   return "FRAME_DROPPED";
+	}
+	return "UNKNOWN";
+}
+
+static const char *_packetTraceReasonName(const unsigned int r)
+{
+	switch(r) {
+		case PacketTrace::REASON_INVALID:           return "INVALID";
+		case PacketTrace::REASON_HELLO_REJECTED:    return "HELLO_REJECTED";
+		case PacketTrace::REASON_UNTRUSTED_PATH:    return "UNTRUSTED_PATH";
+		case PacketTrace::REASON_MAC_FAILED:        return "MAC_FAILED";
+		case PacketTrace::REASON_TX_TIMEOUT:        return "TX_TIMEOUT";
+		case PacketTrace::REASON_ACCESS_DENIED:     return "ACCESS_DENIED";
+		case PacketTrace::REASON_REJECTED_INBOUND:  return "REJECTED_INBOUND";
+		case PacketTrace::REASON_REJECTED_OUTBOUND: return "REJECTED_OUTBOUND";
+	}
+	return "";
+}
+
+// Paging and field selection for array responses, from ?offset=, ?limit= and ?fields=a,b,c
+struct _JsonPage
+{
+	_JsonPage(const std::map<std::string,std::string> &urlArgs) :
+		offset(0),
+		limit(0xffffffffUL)
+	{
+		std::map<std::string,std::string>::const_iterator a(urlArgs.find("offset"));
+		if (a != urlArgs.end())
+			offset = (unsigned long)Utils::strToU64(a->second.c_str());
+		a = urlArgs.find("limit");
+		if (a != urlArgs.end())
+			limit = (unsigned long)Utils::strToU64(a->second.c_str());
+		a = urlArgs.find("fields");
+		if (a != urlArgs.end())
+			fields = OSUtils::split(a->second.c_str(),",","","");
+	}
+
+	// Reduce an object to the selected fields, if any were selected
+	inline void select(nlohmann::json &j) const
+	{
+		if ((fields.empty())||(!j.is_object()))
+			return;
+		nlohmann::json sj = nlohmann::json::object();
+		for(std::vector<std::string>::const_iterator f(fields.begin());f!=fields.end();++f) {
+			nlohmann::json::iterator v(j.find(*f));
+			if (v != j.end())
+				sj[*f] = *v;
+		}
+		j.swap(sj);
+	}
+
+	// Serialize items one at a time instead of building the whole array first
+	inline void append(std::string &body,nlohmann::json &item) const
+	{
+		select(item);
+		body.append((body.length() > 1) ? ",\n" : "\n");
+		body.append(OSUtils::jsonDump(item));
+	}
+
+	unsigned long offset;
+	unsigned long limit;
+	std::vector<std::string> fields;
+};
+
+/* Split a control API URL into path elements and ?a=b&c=d arguments. Note: this is
+ * kind of restricted in what it'll take. It does not support URL encoding, and /'s in
+ * URL args will screw it up. But the URL args it uses are simple tokens and numbers,
+ * and otherwise it just takes simple paths to simply-named resources. */
+static void _splitUrl(const std::string &url,std::vector<std::string> &ps,std::map<std::string,std::string> &urlArgs)
+{
+	ps = OSUtils::split(url.c_str(),"/","","");
+	if (ps.size() > 0) {
+		std::size_t qpos = ps[ps.size() - 1].find('?');
+		if (qpos != std::string::npos) {
+			std::string args(ps[ps.size() - 1].substr(qpos + 1));
+			ps[ps.size() - 1] = ps[ps.size() - 1].substr(0,qpos);
+			std::vector<std::string> asplit(OSUtils::split(args.c_str(),"&","",""));
+			for(std::vector<std::string>::iterator a(asplit.begin());a!=asplit.end();++a) {
+				std::size_t eqpos = a->find('=');
+				if (eqpos == std::string::npos)
+					urlArgs[*a] = "";
+				else urlArgs[a->substr(0,eqpos)] = a->substr(eqpos + 1);
+			}
+		}
+	}
+}
+
 class OneServiceImpl;
 
 static int SnodeVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf);
@@ -307,10 +580,33 @@ static void SnodeEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event
 static void SnodeStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len);
 static int SnodeStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen);
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
+static int SnodeWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count);
+static void SnodeDeferredPacketsFunction(ZT_Node *node,void *uptr,void *tptr);
+static void SnodeCryptoJobsFunction(ZT_Node *node,void *uptr,void *tptr);
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr);
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+static int StenantVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf);
+static void StenantEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData);
+static void StenantStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len);
+static int StenantStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen);
+static int StenantWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
+static int StenantWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count);
+static void StenantDeferredPacketsFunction(ZT_Node *node,void *uptr,void *tptr);
+static void StenantCryptoJobsFunction(ZT_Node *node,void *uptr,void *tptr);
+static void StenantVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+static int StenantPathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr);
+static int StenantPathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
+static void StenantTapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+#ifdef ZT_HAVE_AF_XDP
+static void SxdpPacketHandler(void *uptr,const LinuxXdpPacket *packets,unsigned int count);
+#endif
+#ifdef ZT_HAVE_NETMAP
+static void SnetmapPacketHandler(void *uptr,const BSDNetmapPacket *packets,unsigned int count);
+#endif
+static void SclusterSendFunction(void *uptr,unsigned int toMemberId,const void *data,unsigned int len);
+static int SclusterGeoIpFunction(void *uptr,const struct sockaddr_storage *addr,int *x,int *y,int *z);
 
 static int ShttpOnMessageBegin(http_parser *parser);
 static int ShttpOnUrl(http_parser *parser,const char *ptr,size_t length);
@@ -353,6 +649,9 @@ static const struct http_parser_settings HTTP_PARSER_SETTINGS = {
  */
 struct TcpConnection
 {
+	// HTTP responses are never dropped; pipelining stops before writeq gets too large
+	TcpConnection() : tunnelIndex(0),writeq(~((unsigned long)0)) {}
+
 	enum {
 		TCP_UNCATEGORIZED_INCOMING, // uncategorized incoming connection
 		TCP_HTTP_INCOMING,
@@ -364,6 +663,9 @@ struct TcpConnection
 	PhySocket *sock;
 	InetAddress remoteAddr;
 	uint64_t lastReceive;
+	uint64_t id; // unique, so responses from the control thread can find it (or find that it's gone)
+	unsigned long pendingResponses; // requests handed to the control thread and not yet answered
+	unsigned int tunnelIndex; // slot in _tcpFallbackTunnels if this is a TCP_TUNNEL_OUTGOING connection
 
 	// Used for inbound HTTP connections
 	http_parser parser;
@@ -373,12 +675,241 @@ struct TcpConnection
 	std::string url;
 	std::string status;
 	std::map< std::string,std::string > headers;
+	bool closeAfterWrite; // close once writeq drains, since the last response said "Connection: close"
 
 	std::string readq;
-	std::string writeq;
+	RingBuffer writeq;
 	Mutex writeq_m;
 };
 
+// A control API request handed from the I/O thread to the control thread, and then its response
+struct ControlPlaneRequest
+{
+	uint64_t connectionId;
+	InetAddress remoteAddr;
+	unsigned int method;
+	std::string url;
+	std::map< std::string,std::string > headers;
+	std::string body;
+	bool closeAfter;
+	uint64_t waitUntil; // change feed long polls are held until this time or a change (0 if not a long poll)
+	uint64_t waitSince; // change feed revision and epoch the long poll is waiting to see something newer than
+	uint64_t waitEpoch;
+	std::string response; // complete HTTP response including status line and headers
+};
+
+// Thread that handles control API requests, so that slow ones (big peer lists,
+// controller queries that walk JSONDB) don't hold up packet I/O. Sockets stay on
+// the main thread's Phy<>, since the Binder's TCP listeners share it with UDP.
+// Requests are handled one at a time in order, so pipelined responses stay in order.
+// Change feed long polls are set aside until they can be answered, along with any
+// requests pipelined behind them on the same connection.
+struct ControlPlaneThread
+{
+	ControlPlaneThread(OneServiceImpl *p) :
+		parent(p),
+		run(true) {}
+
+	void threadMain()
+		throw();
+
+	OneServiceImpl *const parent;
+	Thread thread;
+
+	std::deque<ControlPlaneRequest *> requests;
+	std::mutex requests_m;
+	std::condition_variable requests_c;
+	bool run;
+
+	std::list<ControlPlaneRequest *> held; // only touched by the control thread
+};
+
+// Threads that decode packets the node has deferred because they need identity
+// validation or signature checks, so a burst of new peers or credentials doesn't
+// hold up forwarding on the I/O threads. Each wakeup decodes one packet, for
+// the main node or the tenant (see OneServiceImpl::Tenant) that asked.
+struct DeferredPacketThreads
+{
+	DeferredPacketThreads(OneServiceImpl *p) :
+		parent(p),
+		run(true) {}
+
+	void threadMain()
+		throw();
+
+	OneServiceImpl *const parent;
+	Thread threads[ZT_DEFERRED_PACKET_THREADS];
+
+	std::deque<void *> pending; // tenant each wakeup is for, or NULL for the main node
+	std::mutex pending_m;
+	std::condition_variable pending_c;
+	bool run;
+};
+
+// Threads that encrypt and decrypt packets to and from busy peers, so that
+// one heavy flow isn't limited to the I/O thread it lands on. The node puts
+// finished packets back in order itself. Each wakeup runs one packet.
+struct CryptoJobThreads
+{
+	CryptoJobThreads(OneServiceImpl *p) :
+		parent(p),
+		threadCount(0),
+		run(true) {}
+
+	void threadMain()
+		throw();
+
+	OneServiceImpl *const parent;
+	Thread threads[ZT_MAX_CRYPTO_THREADS];
+	unsigned int threadCount; // 0 if disabled, only set before the node is created
+
+	std::deque<void *> pending; // tenant each wakeup is for, or NULL for the main node
+	std::mutex pending_m;
+	std::condition_variable pending_c;
+	bool run;
+};
+
+// Thread that drives a peer throughput and latency test started through the
+// control API, since sending flat out would otherwise hold up whichever thread
+// ran it. Started and joined only by the control thread (and at shutdown).
+struct BenchThread
+{
+	BenchThread(OneServiceImpl *p) :
+		parent(p),
+		started(false) {}
+
+	void threadMain()
+		throw();
+
+	OneServiceImpl *const parent;
+	Thread thread;
+	bool started; // true from start until joined
+};
+
+// Threads that rejoin the networks saved in networks.d at startup, for the
+// main node and tenants. Most of a join is creating and configuring its tap,
+// so several at once cut startup on hosts with many networks, and since this
+// runs alongside the main loop, networks that are up carry traffic while the
+// rest are still coming up. Each thread exits when no joins are left.
+struct StartupJoinThreads
+{
+	struct Join
+	{
+		Node *node;
+		uint64_t nwid;
+		uint64_t ms; // time the join took, 0 until it's done
+	};
+
+	StartupJoinThreads() :
+		threadCount(0),
+		next(0),
+		done(0),
+		began(0),
+		finished(0),
+		run(true) {}
+
+	void threadMain()
+		throw();
+
+	Thread threads[ZT_STARTUP_JOIN_THREADS];
+	unsigned int threadCount;
+
+	std::vector<Join> joins; // filled in before the threads start
+	std::atomic<unsigned int> next; // index of next join to take
+	std::mutex m; // guards each join's ms, done and finished
+	unsigned int done;
+	uint64_t began;
+	uint64_t finished; // when the last join finished, or 0
+	std::atomic<bool> run;
+};
+
+// Thread that writes state objects put by the node, so that slow or network
+// backed disks don't hold up packet I/O. Puts of an object replace any still
+// pending write of it, and puts identical to what was last read or written
+// (by hash) are dropped without touching the disk. Files are written to a
+// temporary name and renamed into place so a crash never leaves one partial.
+struct StateWriterThread
+{
+	struct Pending
+	{
+		std::string data;
+		bool secure;
+		bool remove;
+	};
+
+	StateWriterThread() :
+		run(false) {}
+
+	void threadMain()
+		throw();
+
+	static inline void digest(const void *data,unsigned int len,uint64_t d[2])
+	{
+		uint64_t h[8];
+		SHA512::hash(h,data,len);
+		d[0] = h[0];
+		d[1] = h[1] ^ (uint64_t)len;
+	}
+
+	// Remember the digest of what is or will be at a path (with m locked). Past
+	// ZT_STATE_WRITER_MAX_DIGESTS another path's is forgotten, which only costs
+	// rewriting that object unchanged, so this stays bounded as peers come and go.
+	inline void remember(const std::string &path,const uint64_t d[2])
+	{
+		std::map< std::string,std::pair<uint64_t,uint64_t> >::iterator i(current.find(path));
+		if (i == current.end()) {
+			if (current.size() >= ZT_STATE_WRITER_MAX_DIGESTS) {
+				i = current.upper_bound(path);
+				current.erase((i == current.end()) ? current.begin() : i);
+			}
+			current[path] = std::pair<uint64_t,uint64_t>(d[0],d[1]);
+		} else {
+			i->second.first = d[0];
+			i->second.second = d[1];
+		}
+	}
+
+	Thread thread;
+
+	std::map< std::string,Pending > pending; // path -> latest unwritten state
+	std::map< std::string,Pending > writing; // path -> state being written now
+	std::map< std::string,std::pair<uint64_t,uint64_t> > current; // path -> digest of what is or will be on disk
+	std::mutex m;
+	std::condition_variable c;
+	bool run;
+};
+
+#ifdef ZT_USE_IO_THREADS
+// Additional thread receiving UDP from the shared Node on its own Phy<> and
+// SO_REUSEPORT bindings, which the kernel balances with the main thread's
+struct IoThread
+{
+	IoThread(OneServiceImpl *p) :
+		parent(p),
+		phy(p,false,true),
+		binder(true,true),
+		portCount(0),
+		refreshBindings(false),
+		run(true) {}
+
+	void threadMain()
+		throw();
+
+	OneServiceImpl *const parent;
+	Phy<OneServiceImpl *> phy;
+	Binder binder;
+	Thread thread;
+
+	// Ports to bind, set by the main thread before it sets refreshBindings
+	unsigned int ports[3];
+	unsigned int portCount;
+	Mutex ports_m;
+
+	std::atomic<bool> refreshBindings;
+	std::atomic<bool> run;
+};
+#endif
+
 class OneServiceImpl : public OneService
 {
 public:
@@ -387,11 +918,16 @@ public:
 	const std::string _homePath;
 	std::string _authToken;
 	std::string _controllerDbPath;
+	bool _controllerDbLog;
+	std::string _controllerReplicaAuthToken; // non-empty if this controller is a replica of another
 	const std::string _networksPath;
 	const std::string _moonsPath;
 
 	EmbeddedNetworkController *_controller;
 	Phy<OneServiceImpl *> _phy;
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	PhyUdpSendQueue _mainUdpSendQueue;
+#endif
 	Node *_node;
 	SoftwareUpdater *_updater;
 	PhySocket *_localControlSocket4;
@@ -399,6 +935,7 @@ public:
 	bool _updateAutoApply;
 	unsigned int _primaryPort;
 	volatile unsigned int _udpPortPickerCounter;
+	volatile uint64_t _udpPacingRate; // bytes per second for SO_MAX_PACING_RATE, 0 for none
 
 	// Local configuration and memo-ized information from it
 	json _localConfig;
@@ -426,8 +963,61 @@ public:
 	unsigned int _ports[3];
 	Binder _binder;
 
-	// Time we last received a packet from a global address
-	uint64_t _lastDirectReceiveFromGlobal;
+	// Readable when local addresses change, or NULL if the OS can't tell us
+	PhySocket *_addressChangeMonitor;
+	uint64_t _addressChangedAt; // time of a change not yet refreshed for, or 0
+
+	// Total threads receiving UDP, including the main thread
+	unsigned int _ioThreadCount;
+
+	// Queues (each with a reader thread) to open on new taps if supported
+	unsigned int _tapQueueCount;
+
+	// Use io_uring for UDP receive and tap reads where the kernel supports it
+	bool _ioUring;
+
+	// Coalesce TCP segments written to taps by threads receiving UDP
+	bool _tapGro;
+
+#ifdef ZT_HAVE_AF_XDP
+	// Device to receive our UDP ports from with AF_XDP, and the receiver if that worked
+	std::string _xdpDevice;
+	LinuxXdpReceiver *_xdp;
+#endif
+#ifdef ZT_HAVE_NETMAP
+	// Device to receive our UDP ports from with netmap, and the receiver if that worked
+	std::string _netmapDevice;
+	BSDNetmapReceiver *_netmap;
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+	// Open taps for newly joined networks in netmap mode
+	bool _netmapTaps;
+#endif
+#ifdef ZT_USE_IO_THREADS
+	std::vector<IoThread *> _ioThreads;
+#endif
+
+	// Background writer for state objects put by the node
+	StateWriterThread _stateWriter;
+
+	// Control API request handling, and responses waiting for the main thread to send them
+	ControlPlaneThread _controlThread;
+	std::vector<ControlPlaneRequest *> _controlResponses;
+	Mutex _controlResponses_m;
+
+	// Workers for packets the node defers
+	DeferredPacketThreads _deferredPackets;
+	CryptoJobThreads _cryptoJobs;
+	BenchThread _bench;
+	StartupJoinThreads _startupJoins;
+	uint64_t _nextTcpConnectionId;
+
+	// When run() started and when the node had loaded its identity and been created
+	uint64_t _startupBegan;
+	uint64_t _startupNodeReady;
+
+	// Time we last received a packet from a global address (set by every I/O thread)
+	std::atomic<uint64_t> _lastDirectReceiveFromGlobal;
 #ifdef ZT_TCP_FALLBACK_RELAY
 	uint64_t _lastSendToGlobalV4;
 #endif
@@ -448,6 +1038,7 @@ public:
 			settings.allowManaged = true;
 			settings.allowGlobal = false;
 			settings.allowDefault = false;
+			settings.l3 = false;
 		}
 
 		EthernetTap *tap;
@@ -459,10 +1050,38 @@ public:
 	std::map<uint64_t,NetworkState> _nets;
 	Mutex _nets_m;
 
+	// Other nodes hosted on the same sockets and threads if settings.tenants
+	// lists any, each with its own identity, state and networks under its own
+	// home, as if it were a separate instance. These are set up before any
+	// packets arrive and never change after, so they're read without locks.
+	struct Tenant
+	{
+		Tenant(OneServiceImpl *p,const std::string &hp) :
+			parent(p),
+			homePath(hp),
+			node((Node *)0),
+			nextBackgroundTaskDeadline(0) {}
+
+		OneServiceImpl *const parent;
+		const std::string homePath;
+		Node *node;
+		volatile uint64_t nextBackgroundTaskDeadline;
+		std::map<uint64_t,NetworkState> nets;
+		Mutex nets_m;
+	};
+	std::vector<Tenant *> _tenants;
+	Hashtable<uint64_t,Tenant *> _tenantsByAddress;
+
 	// Active TCP/IP connections
 	std::vector< TcpConnection * > _tcpConnections;
 	Mutex _tcpConnections_m;
-	TcpConnection *_tcpFallbackTunnel;
+
+	// Parallel TCP fallback tunnels, with destinations hashed across them so
+	// one stalled stream doesn't hold up traffic to every peer. Tunnel i goes
+	// to relay i modulo the number of relays.
+	TcpConnection *_tcpFallbackTunnels[ZT_TCP_FALLBACK_MAX_TUNNELS];
+	unsigned int _tcpFallbackTunnelCount;
+	std::vector<InetAddress> _tcpFallbackRelays;
 
 	// Termination status information
 	ReasonForTermination _termReason;
@@ -473,8 +1092,22 @@ public:
 	bool _portMappingEnabled; // local.conf settings
 #ifdef ZT_USE_MINIUPNPC
 	PortMapper *_portMapper;
+	volatile bool _portMappingChanged; // set by the port mapper, tells the core about mappings right away
 #endif
 
+	// Collector for flow counts if settings.flowExport is set, and the socket they're sent from
+	InetAddress _flowCollector;
+	uint64_t _flowExportInterval;
+	PhySocket *_flowExportSocket;
+
+	// Received packets recorded for replay if settings.wireCapture is set
+	WireCapture _wireCapture;
+
+	// Cluster definition and backplane socket if <home>/cluster exists
+	ClusterDefinition *_clusterDefinition;
+	PhySocket *_clusterMessageSocket;
+	unsigned int _clusterMemberId;
+
 	// Set to false to force service to stop
 	volatile bool _run;
 	Mutex _run_m;
@@ -484,6 +1117,7 @@ public:
 	OneServiceImpl(const char *hp,unsigned int port) :
 		_homePath((hp) ? hp : ".")
 		,_controllerDbPath(_homePath + ZT_PATH_SEPARATOR_S "controller.d")
+		,_controllerDbLog(false)
 		,_networksPath(_homePath + ZT_PATH_SEPARATOR_S "networks.d")
 		,_moonsPath(_homePath + ZT_PATH_SEPARATOR_S "moons.d")
 		,_controller((EmbeddedNetworkController *)0)
@@ -495,38 +1129,79 @@ public:
 		,_updateAutoApply(false)
 		,_primaryPort(port)
 		,_udpPortPickerCounter(0)
+		,_udpPacingRate(0)
+		,_controlThread(this)
+		,_deferredPackets(this)
+		,_cryptoJobs(this)
+		,_bench(this)
+		,_nextTcpConnectionId(1)
+		,_startupBegan(0)
+		,_startupNodeReady(0)
 		,_lastDirectReceiveFromGlobal(0)
 #ifdef ZT_TCP_FALLBACK_RELAY
 		,_lastSendToGlobalV4(0)
 #endif
 		,_lastRestart(0)
 		,_nextBackgroundTaskDeadline(0)
-		,_tcpFallbackTunnel((TcpConnection *)0)
+		,_tcpFallbackTunnelCount(1)
 		,_termReason(ONE_STILL_RUNNING)
 		,_portMappingEnabled(true)
 #ifdef ZT_USE_MINIUPNPC
 		,_portMapper((PortMapper *)0)
+		,_portMappingChanged(false)
 #endif
+		,_flowExportInterval(0)
+		,_flowExportSocket((PhySocket *)0)
+		,_clusterDefinition((ClusterDefinition *)0)
+		,_clusterMessageSocket((PhySocket *)0)
+		,_clusterMemberId(0)
 		,_run(true)
 	{
 		_ports[0] = 0;
 		_ports[1] = 0;
 		_ports[2] = 0;
+		_addressChangeMonitor = (PhySocket *)0;
+		_addressChangedAt = 0;
+		_ioThreadCount = 1;
+		_tapQueueCount = 1;
+		for(unsigned int i=0;i<ZT_TCP_FALLBACK_MAX_TUNNELS;++i)
+			_tcpFallbackTunnels[i] = (TcpConnection *)0;
+#ifdef ZT_TCP_FALLBACK_RELAY
+		_tcpFallbackRelays.push_back(InetAddress(ZT_TCP_FALLBACK_RELAY));
+#endif
+		_ioUring = false;
+		_tapGro = true;
+#ifdef ZT_HAVE_AF_XDP
+		_xdp = (LinuxXdpReceiver *)0;
+#endif
+#ifdef ZT_HAVE_NETMAP
+		_netmap = (BSDNetmapReceiver *)0;
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+		_netmapTaps = false;
+#endif
 	}
 
 	virtual ~OneServiceImpl()
 	{
 		_binder.closeAll(_phy);
+		_phy.close(_addressChangeMonitor,false);
 		_phy.close(_localControlSocket4);
 		_phy.close(_localControlSocket6);
 #ifdef ZT_USE_MINIUPNPC
 		delete _portMapper;
 #endif
 		delete _controller;
+		if (_clusterMessageSocket)
+			_phy.close(_clusterMessageSocket,false);
+		if (_flowExportSocket)
+			_phy.close(_flowExportSocket,false);
+		delete _clusterDefinition;
 	}
 
 	virtual ReasonForTermination run()
 	{
+		_startupBegan = OSUtils::now();
 		try {
 			{
 				const std::string authTokenPath(_homePath + ZT_PATH_SEPARATOR_S "authtoken.secret");
@@ -548,25 +1223,19 @@ public:
 				_authToken = _trimString(_authToken);
 			}
 
-			{
-				struct ZT_Node_Callbacks cb;
-				cb.version = 0;
-				cb.stateGetFunction = SnodeStateGetFunction;
-				cb.statePutFunction = SnodeStatePutFunction;
-				cb.wirePacketSendFunction = SnodeWirePacketSendFunction;
-				cb.virtualNetworkFrameFunction = SnodeVirtualNetworkFrameFunction;
-				cb.virtualNetworkConfigFunction = SnodeVirtualNetworkConfigFunction;
-				cb.eventCallback = SnodeEventCallback;
-				cb.pathCheckFunction = SnodePathCheckFunction;
-				cb.pathLookupFunction = SnodePathLookupFunction;
-				_node = new Node(this,(void *)0,&cb,OSUtils::now());
-			}
+			// Peer cache records and (on roots and moons) identities are written here by the state put function
+			OSUtils::mkdir(_homePath + ZT_PATH_SEPARATOR_S "peers.d");
+			OSUtils::mkdir(_homePath + ZT_PATH_SEPARATOR_S "identities.d");
 
-			// Read local configuration
+			_stateWriter.run = true;
+			_stateWriter.thread = Thread::start(&_stateWriter);
+
+			// Read local configuration (before creating the node, since some settings decide which callbacks it gets)
+			uint64_t trustedPathIds[ZT_MAX_TRUSTED_PATHS];
+			InetAddress trustedPathNetworks[ZT_MAX_TRUSTED_PATHS];
+			unsigned int trustedPathCount = 0;
+			std::vector<std::string> tenantPaths;
 			{
-				uint64_t trustedPathIds[ZT_MAX_TRUSTED_PATHS];
-				InetAddress trustedPathNetworks[ZT_MAX_TRUSTED_PATHS];
-				unsigned int trustedPathCount = 0;
 
 				// LEGACY: support old "trustedpaths" flat file
 				FILE *trustpaths = fopen((_homePath + ZT_PATH_SEPARATOR_S "trustedpaths").c_str(),"r");
@@ -635,11 +1304,182 @@ public:
 					const std::string cdbp(OSUtils::jsonString(settings["controllerDbPath"],""));
 					if (cdbp.length() > 0)
 						_controllerDbPath = cdbp;
+					_controllerDbLog = (OSUtils::jsonString(settings["controllerDbFormat"],"json") == "log");
+					const std::string replicaOf(OSUtils::jsonString(settings["controllerReplicaOf"],""));
+					if (replicaOf.length() > 0) {
+						_controllerDbPath = replicaOf + "/controller/db";
+						_controllerReplicaAuthToken = OSUtils::jsonString(settings["controllerReplicaAuthToken"],"");
+					}
+
+#ifdef ZT_USE_IO_THREADS
+					// Threads are started once, so this can't be changed at runtime
+					_ioThreadCount = std::max(std::min((unsigned int)OSUtils::jsonInt(settings["ioThreads"],1ULL),(unsigned int)ZT_MAX_IO_THREADS),1U);
+#endif
+#ifdef ZT_TAP_HAVE_QUEUES
+					_tapQueueCount = std::max((unsigned int)OSUtils::jsonInt(settings["tapQueues"],1ULL),1U);
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+					_tapGro = OSUtils::jsonBool(settings["tapCoalescing"],true);
+#endif
+#ifdef ZT_TCP_FALLBACK_RELAY
+					// Tunnels are looked up without locks, so these are also startup only
+					_tcpFallbackTunnelCount = std::max(std::min((unsigned int)OSUtils::jsonInt(settings["tcpFallbackTunnels"],1ULL),(unsigned int)ZT_TCP_FALLBACK_MAX_TUNNELS),1U);
+					json &relays = settings["tcpFallbackRelays"];
+					if (relays.is_array()) {
+						std::vector<InetAddress> r;
+						for(unsigned long i=0;i<relays.size();++i) {
+							const InetAddress ra(OSUtils::jsonString(relays[i],"").c_str());
+							if (ra.port())
+								r.push_back(ra);
+						}
+						if (!r.empty())
+							_tcpFallbackRelays.swap(r);
+					}
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+					// Sockets already bound keep using epoll, so this is also startup only
+					_ioUring = OSUtils::jsonBool(settings["ioUring"],false);
+					if ((_ioUring)&&(!_phy.useIoUring()))
+						fprintf(stderr,"WARNING: io_uring is not available, using epoll" ZT_EOL_S);
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+					// Likewise only UDP sockets bound after this receive through RIO
+					if ((OSUtils::jsonBool(settings["registeredIo"],false))&&(!_phy.useRio()))
+						fprintf(stderr,"WARNING: Registered I/O is not available, using select()" ZT_EOL_S);
+#endif
+#ifdef ZT_HAVE_AF_XDP
+					_xdpDevice = OSUtils::jsonString(settings["xdpDevice"],"");
+#endif
+#ifdef ZT_HAVE_NETMAP
+					_netmapDevice = OSUtils::jsonString(settings["netmapDevice"],"");
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+					_netmapTaps = OSUtils::jsonBool(settings["netmapTaps"],false);
+#endif
+					// Recording starts before any sockets are bound so a capture has every packet from the start
+					json &wireCapture = settings["wireCapture"];
+					if (wireCapture.is_object()) {
+						const std::string wcp(OSUtils::jsonString(wireCapture["path"],""));
+						if ((wcp.length())&&(!_wireCapture.open(wcp.c_str(),(unsigned int)OSUtils::jsonInt(wireCapture["sampleRate"],1ULL),OSUtils::jsonInt(wireCapture["maxMegabytes"],1024ULL) * 1048576ULL)))
+							fprintf(stderr,"WARNING: unable to open wire capture file %s" ZT_EOL_S,wcp.c_str());
+					}
+
+					// Tenant nodes are created along with the main one
+					json &tenants = settings["tenants"];
+					if (tenants.is_array()) {
+						for(unsigned long i=0;i<tenants.size();++i) {
+							std::string tp(OSUtils::jsonString(tenants[i],""));
+							if (!tp.length())
+								continue;
+							if (tp[0] != ZT_PATH_SEPARATOR)
+								tp = _homePath + ZT_PATH_SEPARATOR_S + tp;
+							tenantPaths.push_back(tp);
+						}
+					}
+
+					// Whether the node gets a crypto worker callback at all is fixed when it's created
+					_cryptoJobs.threadCount = std::min((unsigned int)OSUtils::jsonInt(settings["cryptoThreads"],0ULL),(unsigned int)ZT_MAX_CRYPTO_THREADS);
+
+					// Threads place themselves as they start, so this must be set before any do
+					json &affinity = settings["cpuAffinity"];
+					if (affinity.is_object()) {
+						for(json::iterator a(affinity.begin());a!=affinity.end();++a) {
+							CpuAffinity::ThreadClass tc;
+							std::vector<unsigned int> cpus;
+							if (!CpuAffinity::classFromName(a.key().c_str(),tc))
+								fprintf(stderr,"WARNING: unknown thread class '%s' in cpuAffinity" ZT_EOL_S,a.key().c_str());
+							else if (!CpuAffinity::parse(OSUtils::jsonString(a.value(),"").c_str(),cpus))
+								fprintf(stderr,"WARNING: invalid CPU list for '%s' in cpuAffinity" ZT_EOL_S,a.key().c_str());
+							else CpuAffinity::set(tc,cpus);
+						}
+					}
+
+					// Pin the main loop before the node and its buffers are allocated
+					CpuAffinity::apply(CpuAffinity::THREAD_MAIN);
+
+					// The arena has to be there before the node so its tables come from it
+					const uint64_t hugePages = OSUtils::jsonInt(settings["hugePages"],0ULL);
+					if (hugePages) {
+						if (!HugePages::init(hugePages * 1048576ULL,OSUtils::jsonBool(settings["lockMemory"],false))) {
+							fprintf(stderr,"WARNING: unable to allocate %lu MiB for packet buffers, using the heap" ZT_EOL_S,(unsigned long)hugePages);
+						} else {
+							HugePages::Status hs;
+							HugePages::status(hs);
+							if (hs.backing != HugePages::BACKING_HUGETLB)
+								fprintf(stderr,"WARNING: no huge pages reserved, packet buffers are in %s pages" ZT_EOL_S,HugePages::backingName(hs.backing));
+							if ((OSUtils::jsonBool(settings["lockMemory"],false))&&(!hs.locked))
+								fprintf(stderr,"WARNING: unable to lock packet buffers in memory (check RLIMIT_MEMLOCK)" ZT_EOL_S);
+						}
+					}
 				}
+			}
 
-				// Set trusted paths if there are any
-				if (trustedPathCount)
-					_node->setTrustedPaths(reinterpret_cast<const struct sockaddr_storage *>(trustedPathNetworks),trustedPathIds,trustedPathCount);
+			{
+				struct ZT_Node_Callbacks cb;
+				cb.version = 3;
+				cb.stateGetFunction = SnodeStateGetFunction;
+				cb.statePutFunction = SnodeStatePutFunction;
+				cb.wirePacketSendFunction = SnodeWirePacketSendFunction;
+				cb.virtualNetworkFrameFunction = SnodeVirtualNetworkFrameFunction;
+				cb.virtualNetworkConfigFunction = SnodeVirtualNetworkConfigFunction;
+				cb.eventCallback = SnodeEventCallback;
+				cb.pathCheckFunction = SnodePathCheckFunction;
+				cb.pathLookupFunction = SnodePathLookupFunction;
+				cb.wirePacketBatchSendFunction = SnodeWirePacketBatchSendFunction;
+				cb.deferredPacketsFunction = SnodeDeferredPacketsFunction;
+				cb.cryptoJobsFunction = (_cryptoJobs.threadCount) ? SnodeCryptoJobsFunction : (ZT_CryptoJobsFunction)0;
+				_node = new Node(this,(void *)0,&cb,OSUtils::now());
+				_startupNodeReady = OSUtils::now();
+			}
+			for(unsigned int i=0;i<ZT_DEFERRED_PACKET_THREADS;++i)
+				_deferredPackets.threads[i] = Thread::start(&_deferredPackets);
+			for(unsigned int i=0;i<_cryptoJobs.threadCount;++i)
+				_cryptoJobs.threads[i] = Thread::start(&_cryptoJobs);
+
+			// Set trusted paths if there are any
+			if (trustedPathCount)
+				_node->setTrustedPaths(reinterpret_cast<const struct sockaddr_storage *>(trustedPathNetworks),trustedPathIds,trustedPathCount);
+
+			// Create tenant nodes, which share everything above but the node
+			for(std::vector<std::string>::const_iterator tp(tenantPaths.begin());tp!=tenantPaths.end();++tp) {
+				OSUtils::mkdir(*tp);
+				OSUtils::mkdir(*tp + ZT_PATH_SEPARATOR_S "networks.d");
+				OSUtils::mkdir(*tp + ZT_PATH_SEPARATOR_S "moons.d");
+				OSUtils::mkdir(*tp + ZT_PATH_SEPARATOR_S "peers.d");
+				OSUtils::mkdir(*tp + ZT_PATH_SEPARATOR_S "identities.d");
+
+				Tenant *const t = new Tenant(this,*tp);
+				struct ZT_Node_Callbacks tcb;
+				tcb.version = 3;
+				tcb.stateGetFunction = StenantStateGetFunction;
+				tcb.statePutFunction = StenantStatePutFunction;
+				tcb.wirePacketSendFunction = StenantWirePacketSendFunction;
+				tcb.virtualNetworkFrameFunction = StenantVirtualNetworkFrameFunction;
+				tcb.virtualNetworkConfigFunction = StenantVirtualNetworkConfigFunction;
+				tcb.eventCallback = StenantEventCallback;
+				tcb.pathCheckFunction = StenantPathCheckFunction;
+				tcb.pathLookupFunction = StenantPathLookupFunction;
+				tcb.wirePacketBatchSendFunction = StenantWirePacketBatchSendFunction;
+				tcb.deferredPacketsFunction = StenantDeferredPacketsFunction;
+				tcb.cryptoJobsFunction = (_cryptoJobs.threadCount) ? StenantCryptoJobsFunction : (ZT_CryptoJobsFunction)0;
+				try {
+					t->node = new Node(t,(void *)0,&tcb,OSUtils::now());
+				} catch ( ... ) {
+					t->node = (Node *)0;
+				}
+				if (!t->node) {
+					fprintf(stderr,"WARNING: unable to create tenant node in %s" ZT_EOL_S,tp->c_str());
+				} else if ((t->node->address() == _node->address())||(_tenantsByAddress.contains(t->node->address()))) {
+					fprintf(stderr,"WARNING: tenant in %s has the same address as another node here, skipping" ZT_EOL_S,tp->c_str());
+				} else {
+					if (trustedPathCount)
+						t->node->setTrustedPaths(reinterpret_cast<const struct sockaddr_storage *>(trustedPathNetworks),trustedPathIds,trustedPathCount);
+					_tenants.push_back(t);
+					_tenantsByAddress.set(t->node->address(),t);
+					continue;
+				}
+				delete t->node;
+				delete t;
 			}
 
 			// Apply other runtime configuration from local.conf
@@ -663,6 +1503,7 @@ public:
 				Mutex::Lock _l(_termReason_m);
 				_termReason = ONE_UNRECOVERABLE_ERROR;
 				_fatalErrorMessage = "cannot bind to local control interface port";
+				_stopStateWriter();
 				return _termReason;
 			}
 
@@ -723,7 +1564,7 @@ public:
 					if (_ports[2]) {
 						char uniqueName[64];
 						OSUtils::ztsnprintf(uniqueName,sizeof(uniqueName),"ZeroTier/%.10llx@%u",_node->address(),_ports[2]);
-						_portMapper = new PortMapper(_ports[2],uniqueName);
+						_portMapper = new PortMapper(_ports[2],uniqueName,(_homePath + ZT_PATH_SEPARATOR_S "portmapper.cache").c_str(),&_portMappingChangedFunction,(void *)this);
 					}
 				}
 			}
@@ -733,26 +1574,67 @@ public:
 			OSUtils::rmDashRf((_homePath + ZT_PATH_SEPARATOR_S "iddb.d").c_str());
 
 			// Network controller is now enabled by default for desktop and server
-			_controller = new EmbeddedNetworkController(_node,_controllerDbPath.c_str());
+			_controller = new EmbeddedNetworkController(_node,_controllerDbPath.c_str(),_controllerDbLog,(_controllerReplicaAuthToken.length() > 0) ? _controllerReplicaAuthToken.c_str() : (const char *)0);
 			_node->setNetconfMaster((void *)_controller);
-
-			// Join existing networks in networks.d
 			{
-				std::vector<std::string> networksDotD(OSUtils::listDirectory((_homePath + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
-				for(std::vector<std::string>::iterator f(networksDotD.begin());f!=networksDotD.end();++f) {
-					std::size_t dot = f->find_last_of('.');
-					if ((dot == 16)&&(f->substr(16) == ".conf"))
-						_node->join(Utils::hexStrToU64(f->substr(0,dot).c_str()),(void *)0,(void *)0);
-				}
+				Mutex::Lock _l2(_localConfig_m);
+				json &settings = _localConfig["settings"];
+				if ((settings.is_object())&&(settings.count("controllerPushWindow")))
+					_controller->setPushWindow((unsigned long)OSUtils::jsonInt(settings["controllerPushWindow"],0ULL));
+				if ((settings.is_object())&&(settings.count("controllerTraceSampleRate")))
+					_controller->setRemoteTraceSampleRate((unsigned long)OSUtils::jsonInt(settings["controllerTraceSampleRate"],1ULL));
 			}
 
-			// Orbit existing moons in moons.d
-			{
-				std::vector<std::string> moonsDotD(OSUtils::listDirectory((_homePath + ZT_PATH_SEPARATOR_S "moons.d").c_str()));
-				for(std::vector<std::string>::iterator f(moonsDotD.begin());f!=moonsDotD.end();++f) {
-					std::size_t dot = f->find_last_of('.');
-					if ((dot == 16)&&(f->substr(16) == ".moon"))
-						_node->orbit((void *)0,Utils::hexStrToU64(f->substr(0,dot).c_str()),0);
+			// Orbit existing moons and rejoin existing networks, for tenants too.
+			// Networks are rejoined in the background so the main loop can start
+			// now and handle traffic for each one as soon as it's up.
+			_joinSaved(_node,_homePath);
+			for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t)
+				_joinSaved((*t)->node,(*t)->homePath);
+			_startupJoins.began = OSUtils::now();
+			if (_startupJoins.joins.empty())
+				_startupJoins.finished = _startupJoins.began;
+			_startupJoins.threadCount = std::min((unsigned int)_startupJoins.joins.size(),(unsigned int)ZT_STARTUP_JOIN_THREADS);
+			for(unsigned int i=0;i<_startupJoins.threadCount;++i)
+				_startupJoins.threads[i] = Thread::start(&_startupJoins);
+
+			// Join a root cluster if one is defined for this node
+			if (OSUtils::fileExists((_homePath + ZT_PATH_SEPARATOR_S "cluster").c_str())) {
+				_clusterDefinition = new ClusterDefinition(_node->address(),(_homePath + ZT_PATH_SEPARATOR_S "cluster").c_str());
+				if (_clusterDefinition->size() > 0) {
+					// Our member ID is whichever backplane endpoint we can bind
+					std::vector<ClusterDefinition::MemberDefinition> members(_clusterDefinition->members());
+					for(std::vector<ClusterDefinition::MemberDefinition>::iterator m(members.begin());m!=members.end();++m) {
+						PhySocket *const cs = _phy.udpBind(reinterpret_cast<const struct sockaddr *>(&(m->clusterEndpoint)));
+						if (cs) {
+							if (_clusterMessageSocket) {
+								_phy.close(cs,false);
+								Mutex::Lock _l(_termReason_m);
+								_termReason = ONE_UNRECOVERABLE_ERROR;
+								_fatalErrorMessage = "cluster: able to bind more than one cluster backplane endpoint, can't determine my member ID";
+								return _termReason;
+							}
+							_clusterMessageSocket = cs;
+							_clusterMemberId = m->id;
+						}
+					}
+					if (!_clusterMessageSocket) {
+						Mutex::Lock _l(_termReason_m);
+						_termReason = ONE_UNRECOVERABLE_ERROR;
+						_fatalErrorMessage = "cluster: unable to bind any cluster backplane endpoint, can't determine my member ID";
+						return _termReason;
+					}
+
+					const ClusterDefinition::MemberDefinition &me = (*_clusterDefinition)[_clusterMemberId];
+					if (_node->clusterInit(_clusterMemberId,me.zeroTierEndpoints,me.x,me.y,me.z,&SclusterSendFunction,this,(_clusterDefinition->geo().available()) ? &SclusterGeoIpFunction : 0,this) == ZT_RESULT_OK) {
+						for(std::vector<ClusterDefinition::MemberDefinition>::iterator m(members.begin());m!=members.end();++m) {
+							if (m->id != _clusterMemberId)
+								_node->clusterAddMember(m->id);
+						}
+					}
+				} else {
+					delete _clusterDefinition;
+					_clusterDefinition = (ClusterDefinition *)0;
 				}
 			}
 
@@ -761,9 +1643,71 @@ public:
 			uint64_t clockShouldBe = OSUtils::now();
 			_lastRestart = clockShouldBe;
 			uint64_t lastTapMulticastGroupCheck = 0;
+			uint64_t lastHttpIdleCheck = 0;
 			uint64_t lastBindRefresh = 0;
+			uint64_t lastRouteSync = 0;
 			uint64_t lastUpdateCheck = clockShouldBe;
+			uint64_t lastFlowExport = clockShouldBe;
 			uint64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give portmapper time to configure and other things time to settle
+#ifdef ZT_PHY_HAVE_SENDMMSG
+			_threadUdpSendQueue = &_mainUdpSendQueue;
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+			if (_tapGro)
+				_threadTapGro = new LinuxTapGro();
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+			// Frames for netmap taps go to the kernel in one ring sync per poll()
+			BSDEthernetTap::deferNetmapSync(true);
+#endif
+			_controlThread.thread = Thread::start(&_controlThread);
+#ifdef ZT_USE_IO_THREADS
+			if (_ioThreadCount > 1) {
+				_binder.setReusePort(true);
+				for(unsigned int i=1;i<_ioThreadCount;++i) {
+					IoThread *const t = new IoThread(this);
+#ifdef ZT_PHY_HAVE_IO_URING
+					if (_ioUring)
+						t->phy.useIoUring();
+#endif
+					t->binder.setPacingRate(t->phy,_udpPacingRate);
+					_ioThreads.push_back(t);
+				}
+				// Started only once the list is complete, since running threads read it
+				for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t)
+					(*t)->thread = Thread::start(*t);
+			}
+#endif
+#ifdef ZT_HAVE_AF_XDP
+			if (_xdpDevice.length() > 0) {
+				unsigned int p[3];
+				unsigned int pc = 0;
+				for(int i=0;i<3;++i) {
+					if (_ports[i])
+						p[pc++] = _ports[i];
+				}
+				try {
+					_xdp = new LinuxXdpReceiver(_xdpDevice.c_str(),p,pc,SxdpPacketHandler,(void *)this);
+				} catch (std::exception &exc) {
+					fprintf(stderr,"WARNING: unable to use AF_XDP on %s (%s), using UDP sockets" ZT_EOL_S,_xdpDevice.c_str(),exc.what());
+				}
+			}
+#endif
+#ifdef ZT_HAVE_NETMAP
+			if (_netmapDevice.length() > 0) {
+				unsigned int p[3];
+				unsigned int pc = 0;
+				for(int i=0;i<3;++i) {
+					if (_ports[i])
+						p[pc++] = _ports[i];
+				}
+				try {
+					_netmap = new BSDNetmapReceiver(_netmapDevice.c_str(),p,pc,SnetmapPacketHandler,(void *)this);
+				} catch (std::exception &exc) {
+					fprintf(stderr,"WARNING: unable to use netmap on %s (%s), using UDP sockets" ZT_EOL_S,_netmapDevice.c_str(),exc.what());
+				}
+			}
+#endif
 			for(;;) {
 				_run_m.lock();
 				if (!_run) {
@@ -792,23 +1736,52 @@ public:
 						_updater->apply();
 				}
 
-				// Refresh bindings in case device's interfaces have changed, and also sync routes to update any shadow routes (e.g. shadow default)
-				if (((now - lastBindRefresh) >= ZT_BINDER_REFRESH_PERIOD)||(restarted)) {
+				// Refresh bindings when addresses change, or periodically in case changes weren't seen
+				const bool addressesChanged = ((_addressChangedAt)&&((now - _addressChangedAt) >= ZT_BINDER_CHANGE_SETTLE_DELAY));
+				if ((addressesChanged)||((now - lastBindRefresh) >= ((_addressChangeMonitor) ? ZT_BINDER_MONITORED_REFRESH_PERIOD : ZT_BINDER_REFRESH_PERIOD))||(restarted)) {
 					lastBindRefresh = now;
+					_addressChangedAt = 0;
+					if (addressesChanged)
+						lastLocalInterfaceAddressCheck = 0; // tell the core about new addresses right away
+#ifdef __UNIX_LIKE__
+					if (!_addressChangeMonitor) {
+						const int fd = Binder::openAddressChangeMonitor();
+						if (fd >= 0) {
+							_addressChangeMonitor = _phy.wrapSocket(fd);
+							if (!_addressChangeMonitor)
+								::close(fd);
+						}
+					}
+#endif
 					unsigned int p[3];
 					unsigned int pc = 0;
 					for(int i=0;i<3;++i) {
 						if (_ports[i])
 							p[pc++] = _ports[i];
 					}
+#ifdef ZT_PHY_HAVE_SENDMMSG
+					_mainUdpSendQueue.flush(); // refresh may close sockets
+#endif
 					_binder.refresh(_phy,p,pc,*this);
-					{
-						Mutex::Lock _l(_nets_m);
-						for(std::map<uint64_t,NetworkState>::iterator n(_nets.begin());n!=_nets.end();++n) {
-							if (n->second.tap)
-								syncManagedStuff(n->second,false,true);
+#ifdef ZT_USE_IO_THREADS
+					for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t) {
+						{
+							Mutex::Lock _l2((*t)->ports_m);
+							memcpy((*t)->ports,p,sizeof(p));
+							(*t)->portCount = pc;
 						}
+						(*t)->refreshBindings = true;
+						(*t)->phy.whack();
 					}
+#endif
+				}
+
+				// Sync routes to update any shadow routes (e.g. shadow default)
+				if (((now - lastRouteSync) >= ZT_BINDER_REFRESH_PERIOD)||(restarted)) {
+					lastRouteSync = now;
+					_syncRoutes(_nets,_nets_m);
+					for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t)
+						_syncRoutes((*t)->nets,(*t)->nets_m);
 				}
 
 				// Run background task processor in core if it's time to do so
@@ -817,49 +1790,96 @@ public:
 					_node->processBackgroundTasks((void *)0,now,&_nextBackgroundTaskDeadline);
 					dl = _nextBackgroundTaskDeadline;
 				}
+				for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t) {
+					if ((*t)->nextBackgroundTaskDeadline <= now)
+						(*t)->node->processBackgroundTasks((void *)0,now,&((*t)->nextBackgroundTaskDeadline));
+					dl = std::min(dl,(uint64_t)(*t)->nextBackgroundTaskDeadline);
+				}
+
+				// Send flow counts to the collector
+				if ((_flowExportInterval)&&((now - lastFlowExport) >= _flowExportInterval)) {
+					lastFlowExport = now;
+					_exportFlows(now);
+				}
 
-				// Close TCP fallback tunnel if we have direct UDP
-				if ((_tcpFallbackTunnel)&&((now - _lastDirectReceiveFromGlobal) < (ZT_TCP_FALLBACK_AFTER / 2)))
-					_phy.close(_tcpFallbackTunnel->sock);
+				// Close TCP fallback tunnels if we have direct UDP
+				if ((now - _lastDirectReceiveFromGlobal.load(std::memory_order_relaxed)) < (ZT_TCP_FALLBACK_AFTER / 2)) {
+					for(unsigned int i=0;i<_tcpFallbackTunnelCount;++i) {
+						if (_tcpFallbackTunnels[i])
+							_phy.close(_tcpFallbackTunnels[i]->sock);
+					}
+				}
 
 				// Sync multicast group memberships
 				if ((now - lastTapMulticastGroupCheck) >= ZT_TAP_CHECK_MULTICAST_INTERVAL) {
 					lastTapMulticastGroupCheck = now;
-					Mutex::Lock _l(_nets_m);
-					for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
-						if (n->second.tap) {
-							std::vector<MulticastGroup> added,removed;
-							n->second.tap->scanMulticastGroups(added,removed);
-							for(std::vector<MulticastGroup>::iterator m(added.begin());m!=added.end();++m)
-								_node->multicastSubscribe((void *)0,n->first,m->mac().toInt(),m->adi());
-							for(std::vector<MulticastGroup>::iterator m(removed.begin());m!=removed.end();++m)
-								_node->multicastUnsubscribe(n->first,m->mac().toInt(),m->adi());
-						}
-					}
+					_syncMulticastGroups(_node,_nets,_nets_m);
+					for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t)
+						_syncMulticastGroups((*t)->node,(*t)->nets,(*t)->nets_m);
 				}
 
-				// Sync information about physical network interfaces
+				// Close control API connections that have been idle too long
+				if ((now - lastHttpIdleCheck) >= (ZT_HTTP_KEEPALIVE_TIMEOUT / 4)) {
+					lastHttpIdleCheck = now;
+					std::vector<PhySocket *> idle;
+					{
+						Mutex::Lock _l(_tcpConnections_m);
+						for(std::vector<TcpConnection *>::const_iterator c(_tcpConnections.begin());c!=_tcpConnections.end();++c) {
+							if ( (((*c)->type == TcpConnection::TCP_HTTP_INCOMING)||((*c)->type == TcpConnection::TCP_UNCATEGORIZED_INCOMING)) && ((now - (*c)->lastReceive) > ZT_HTTP_KEEPALIVE_TIMEOUT) ) {
+								Mutex::Lock _l2((*c)->writeq_m);
+								if (((*c)->writeq.empty())&&((*c)->pendingResponses == 0))
+									idle.push_back((*c)->sock);
+							}
+						}
+					}
+					for(std::vector<PhySocket *>::const_iterator s(idle.begin());s!=idle.end();++s)
+						_phy.close(*s);
+				}
+
+#ifdef ZT_USE_MINIUPNPC
+				if (_portMappingChanged) {
+					_portMappingChanged = false;
+					lastLocalInterfaceAddressCheck = 0;
+				}
+#endif
+
+				// Sync information about physical network interfaces
 				if ((now - lastLocalInterfaceAddressCheck) >= ZT_LOCAL_INTERFACE_CHECK_INTERVAL) {
 					lastLocalInterfaceAddressCheck = now;
 
-					_node->clearLocalInterfaceAddresses();
-
+					std::vector<InetAddress> localAddrs;
 #ifdef ZT_USE_MINIUPNPC
-					if (_portMapper) {
-						std::vector<InetAddress> mappedAddresses(_portMapper->get());
-						for(std::vector<InetAddress>::const_iterator ext(mappedAddresses.begin());ext!=mappedAddresses.end();++ext)
-							_node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*ext)));
-					}
+					if (_portMapper)
+						localAddrs = _portMapper->get();
 #endif
-
 					std::vector<InetAddress> boundAddrs(_binder.allBoundLocalInterfaceAddresses());
-					for(std::vector<InetAddress>::const_iterator i(boundAddrs.begin());i!=boundAddrs.end();++i)
-						_node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*i)));
+					localAddrs.insert(localAddrs.end(),boundAddrs.begin(),boundAddrs.end());
+
+					// Tenants are on the same sockets, so they have the same addresses
+					_setLocalInterfaceAddresses(_node,localAddrs);
+					for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t)
+						_setLocalInterfaceAddresses((*t)->node,localAddrs);
 				}
 
-				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+				unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+				if ((_addressChangedAt)&&(delay > ZT_BINDER_CHANGE_SETTLE_DELAY))
+					delay = ZT_BINDER_CHANGE_SETTLE_DELAY;
 				clockShouldBe = now + (uint64_t)delay;
+#ifdef ZT_PHY_HAVE_SENDMMSG
+				_mainUdpSendQueue.flush();
 				_phy.poll(delay);
+				_mainUdpSendQueue.flush();
+#else
+				_phy.poll(delay);
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+				if (_threadTapGro)
+					_threadTapGro->flush();
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+				BSDEthernetTap::flushNetmap();
+#endif
+				_sendControlPlaneResponses();
 			}
 		} catch ( ... ) {
 			Mutex::Lock _l(_termReason_m);
@@ -867,10 +1887,88 @@ public:
 			_fatalErrorMessage = "unexpected exception in main thread";
 		}
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		_mainUdpSendQueue.flush();
+		_threadUdpSendQueue = (PhyUdpSendQueue *)0;
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+		delete _threadTapGro;
+		_threadTapGro = (LinuxTapGro *)0;
+#endif
+
+#ifdef ZT_HAVE_AF_XDP
+		delete _xdp;
+		_xdp = (LinuxXdpReceiver *)0;
+#endif
+#ifdef ZT_HAVE_NETMAP
+		delete _netmap;
+		_netmap = (BSDNetmapReceiver *)0;
+#endif
+
+#ifdef ZT_USE_IO_THREADS
+		for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t) {
+			(*t)->run = false;
+			(*t)->phy.whack();
+		}
+		for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t) {
+			Thread::join((*t)->thread);
+			delete *t;
+		}
+		_ioThreads.clear();
+#endif
+
+		{
+			std::unique_lock<std::mutex> l(_controlThread.requests_m);
+			_controlThread.run = false;
+			_controlThread.requests_c.notify_all();
+		}
+		Thread::join(_controlThread.thread);
+		for(std::deque<ControlPlaneRequest *>::iterator r(_controlThread.requests.begin());r!=_controlThread.requests.end();++r)
+			delete *r;
+		_controlThread.requests.clear();
+		for(std::list<ControlPlaneRequest *>::iterator r(_controlThread.held.begin());r!=_controlThread.held.end();++r)
+			delete *r;
+		_controlThread.held.clear();
+		{
+			std::unique_lock<std::mutex> l(_deferredPackets.pending_m);
+			_deferredPackets.run = false;
+			_deferredPackets.pending_c.notify_all();
+		}
+		for(unsigned int i=0;i<ZT_DEFERRED_PACKET_THREADS;++i)
+			Thread::join(_deferredPackets.threads[i]);
+		{
+			std::unique_lock<std::mutex> l(_cryptoJobs.pending_m);
+			_cryptoJobs.run = false;
+			_cryptoJobs.pending_c.notify_all();
+		}
+		for(unsigned int i=0;i<_cryptoJobs.threadCount;++i)
+			Thread::join(_cryptoJobs.threads[i]);
+		if (_bench.started) {
+			_node->bench().stop();
+			Thread::join(_bench.thread);
+			_bench.started = false;
+		}
+		_startupJoins.run = false; // joins already under way finish first
+		for(unsigned int i=0;i<_startupJoins.threadCount;++i)
+			Thread::join(_startupJoins.threads[i]);
+		_startupJoins.threadCount = 0;
+		{
+			Mutex::Lock _l(_controlResponses_m);
+			for(std::vector<ControlPlaneRequest *>::iterator r(_controlResponses.begin());r!=_controlResponses.end();++r)
+				delete *r;
+			_controlResponses.clear();
+		}
+
 		try {
-			Mutex::Lock _l(_tcpConnections_m);
-			while (!_tcpConnections.empty())
-				_phy.close((*_tcpConnections.begin())->sock);
+			// phyOnTcpClose() takes _tcpConnections_m, so close outside it
+			std::vector<PhySocket *> socks;
+			{
+				Mutex::Lock _l(_tcpConnections_m);
+				for(std::vector<TcpConnection *>::const_iterator c(_tcpConnections.begin());c!=_tcpConnections.end();++c)
+					socks.push_back((*c)->sock);
+			}
+			for(std::vector<PhySocket *>::const_iterator s(socks.begin());s!=socks.end();++s)
+				_phy.close(*s);
 		} catch ( ... ) {}
 
 		{
@@ -880,14 +1978,65 @@ public:
 			_nets.clear();
 		}
 
+		for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t) {
+			{
+				Mutex::Lock _l((*t)->nets_m);
+				for(std::map<uint64_t,NetworkState>::iterator n((*t)->nets.begin());n!=(*t)->nets.end();++n)
+					delete n->second.tap;
+				(*t)->nets.clear();
+			}
+			delete (*t)->node;
+			delete *t;
+		}
+		_tenants.clear();
+		_tenantsByAddress.clear();
+
 		delete _updater;
 		_updater = (SoftwareUpdater *)0;
 		delete _node;
 		_node = (Node *)0;
 
+		_stopStateWriter();
+
 		return _termReason;
 	}
 
+	// Orbits moons in moons.d under a node's home and queues the networks in
+	// networks.d for the startup join threads
+	void _joinSaved(Node *const node,const std::string &homePath)
+	{
+		std::vector<std::string> networksDotD(OSUtils::listDirectory((homePath + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
+		for(std::vector<std::string>::iterator f(networksDotD.begin());f!=networksDotD.end();++f) {
+			std::size_t dot = f->find_last_of('.');
+			if ((dot == 16)&&(f->substr(16) == ".conf")) {
+				StartupJoinThreads::Join j;
+				j.node = node;
+				j.nwid = Utils::hexStrToU64(f->substr(0,dot).c_str());
+				j.ms = 0;
+				_startupJoins.joins.push_back(j);
+			}
+		}
+		std::vector<std::string> moonsDotD(OSUtils::listDirectory((homePath + ZT_PATH_SEPARATOR_S "moons.d").c_str()));
+		for(std::vector<std::string>::iterator f(moonsDotD.begin());f!=moonsDotD.end();++f) {
+			std::size_t dot = f->find_last_of('.');
+			if ((dot == 16)&&(f->substr(16) == ".moon"))
+				node->orbit((void *)0,Utils::hexStrToU64(f->substr(0,dot).c_str()),0);
+		}
+	}
+
+	// Writes out anything still pending and stops the state writer
+	void _stopStateWriter()
+	{
+		{
+			std::lock_guard<std::mutex> l(_stateWriter.m);
+			if (!_stateWriter.run)
+				return;
+			_stateWriter.run = false;
+			_stateWriter.c.notify_all();
+		}
+		Thread::join(_stateWriter.thread);
+	}
+
 	virtual ReasonForTermination reasonForTermination() const
 	{
 		Mutex::Lock _l(_termReason_m);
@@ -909,6 +2058,15 @@ public:
 		else return std::string();
 	}
 
+#ifdef ZT_USE_USERSPACE_STACK
+	virtual UserspaceStack *userspaceStack(uint64_t nwid)
+	{
+		Mutex::Lock _l(_nets_m);
+		std::map<uint64_t,NetworkState>::const_iterator n(_nets.find(nwid));
+		return ((n != _nets.end()) ? n->second.tap : (UserspaceStack *)0);
+	}
+#endif
+
 #ifdef ZT_SDK
 	virtual void leave(const char *hp)
 	{
@@ -998,6 +2156,7 @@ public:
 			fprintf(out,"allowManaged=%d\n",(int)n->second.settings.allowManaged);
 			fprintf(out,"allowGlobal=%d\n",(int)n->second.settings.allowGlobal);
 			fprintf(out,"allowDefault=%d\n",(int)n->second.settings.allowDefault);
+			fprintf(out,"l3=%d\n",(int)n->second.settings.l3);
 			fclose(out);
 		}
 
@@ -1023,27 +2182,9 @@ public:
 		char tmp[256];
 		unsigned int scode = 404;
 		json res;
-		std::vector<std::string> ps(OSUtils::split(path.c_str(),"/","",""));
+		std::vector<std::string> ps;
 		std::map<std::string,std::string> urlArgs;
-
-		/* Note: this is kind of restricted in what it'll take. It does not support
-		 * URL encoding, and /'s in URL args will screw it up. But the only URL args
-		 * it really uses in ?jsonp=funcionName, and otherwise it just takes simple
-		 * paths to simply-named resources. */
-		if (ps.size() > 0) {
-			std::size_t qpos = ps[ps.size() - 1].find('?');
-			if (qpos != std::string::npos) {
-				std::string args(ps[ps.size() - 1].substr(qpos + 1));
-				ps[ps.size() - 1] = ps[ps.size() - 1].substr(0,qpos);
-				std::vector<std::string> asplit(OSUtils::split(args.c_str(),"&","",""));
-				for(std::vector<std::string>::iterator a(asplit.begin());a!=asplit.end();++a) {
-					std::size_t eqpos = a->find('=');
-					if (eqpos == std::string::npos)
-						urlArgs[*a] = "";
-					else urlArgs[a->substr(0,eqpos)] = a->substr(eqpos + 1);
-				}
-			}
-		}
+		_splitUrl(path,ps,urlArgs);
 
 		bool isAuth = false;
 		{
@@ -1111,11 +2252,43 @@ public:
 					ZT_NodeStatus status;
 					_node->status(&status);
 
-					OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",status.address);
-					res["address"] = tmp;
+					res["address"] = Utils::hex10(status.address,tmp);
 					res["publicIdentity"] = status.publicIdentity;
 					res["online"] = (bool)(status.online != 0);
-					res["tcpFallbackActive"] = (_tcpFallbackTunnel != (TcpConnection *)0);
+					unsigned int tunnels = 0;
+					for(unsigned int i=0;i<_tcpFallbackTunnelCount;++i) {
+						if (_tcpFallbackTunnels[i])
+							++tunnels;
+					}
+					res["tcpFallbackActive"] = (tunnels > 0);
+					json &tenants = res["tenants"];
+					tenants = json::array();
+					for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t) {
+						ZT_NodeStatus ts;
+						(*t)->node->status(&ts);
+						json tj;
+						tj["address"] = Utils::hex10(ts.address,tmp);
+						tj["path"] = (*t)->homePath;
+						tj["online"] = (bool)(ts.online != 0);
+						tenants.push_back(tj);
+					}
+					{
+						json &st = res["startup"];
+						st["nodeMs"] = _startupNodeReady - _startupBegan;
+						json &sn = st["networks"];
+						sn = json::array();
+						std::lock_guard<std::mutex> l(_startupJoins.m);
+						st["joinMs"] = (_startupJoins.finished) ? (_startupJoins.finished - _startupJoins.began) : (OSUtils::now() - _startupJoins.began);
+						st["joining"] = (_startupJoins.finished == 0);
+						for(std::vector<StartupJoinThreads::Join>::const_iterator j(_startupJoins.joins.begin());j!=_startupJoins.joins.end();++j) {
+							json nj;
+							nj["nwid"] = Utils::hex((uint64_t)j->nwid,tmp);
+							nj["address"] = Utils::hex10(j->node->address(),tmp);
+							nj["ms"] = j->ms;
+							sn.push_back(nj);
+						}
+					}
+					res["tcpFallbackTunnels"] = tunnels;
 					res["versionMajor"] = ZEROTIER_ONE_VERSION_MAJOR;
 					res["versionMinor"] = ZEROTIER_ONE_VERSION_MINOR;
 					res["versionRev"] = ZEROTIER_ONE_VERSION_REVISION;
@@ -1143,6 +2316,28 @@ public:
 					res["planetWorldId"] = planet.id();
 					res["planetWorldTimestamp"] = planet.timestamp();
 
+					HugePages::Status hs;
+					HugePages::status(hs);
+					json &hp = res["hugePages"];
+					hp["backing"] = HugePages::backingName(hs.backing);
+					hp["size"] = hs.size;
+					hp["used"] = hs.used;
+					hp["locked"] = hs.locked;
+
+					std::vector<CpuAffinity::Placement> placements;
+					CpuAffinity::placements(placements);
+					json &threads = res["threads"];
+					threads = json::array();
+					for(std::vector<CpuAffinity::Placement>::const_iterator p(placements.begin());p!=placements.end();++p) {
+						json t;
+						t["class"] = CpuAffinity::name(p->threadClass);
+						t["tid"] = (int64_t)p->tid;
+						t["cpus"] = p->cpus;
+						t["numaNode"] = p->numaNode;
+						t["pinned"] = p->pinned;
+						threads.push_back(t);
+					}
+
 					scode = 200;
 				} else if (ps[0] == "moon") {
 					std::vector<World> moons(_node->moons());
@@ -1174,16 +2369,19 @@ public:
 					ZT_VirtualNetworkList *nws = _node->networks();
 					if (nws) {
 						if (ps.size() == 1) {
-							// Return [array] of all networks
+							// Return [array] of all networks, or the requested page of them
 
-							res = nlohmann::json::array();
-							for(unsigned long i=0;i<nws->networkCount;++i) {
+							const _JsonPage pg(urlArgs);
+							responseBody.push_back('[');
+							for(unsigned long i=pg.offset;((i<nws->networkCount)&&((i - pg.offset) < pg.limit));++i) {
 								OneService::NetworkSettings localSettings;
 								getNetworkSettings(nws->networks[i].nwid,localSettings);
 								nlohmann::json nj;
 								_networkToJson(nj,&(nws->networks[i]),portDeviceName(nws->networks[i].nwid),localSettings);
-								res.push_back(nj);
+								pg.append(responseBody,nj);
 							}
+							responseBody.append("\n]");
+							responseContentType = "application/json";
 
 							scode = 200;
 						} else if (ps.size() == 2) {
@@ -1195,6 +2393,7 @@ public:
 									OneService::NetworkSettings localSettings;
 									getNetworkSettings(nws->networks[i].nwid,localSettings);
 									_networkToJson(res,&(nws->networks[i]),portDeviceName(nws->networks[i].nwid),localSettings);
+									_JsonPage(urlArgs).select(res);
 									scode = 200;
 									break;
 								}
@@ -1203,18 +2402,55 @@ public:
 						} else scode = 404;
 						_node->freeQueryResult((void *)nws);
 					} else scode = 500;
+				} else if ((ps[0] == "cluster")&&(ps.size() == 1)) {
+					ZT_ClusterStatus *const cs = new ZT_ClusterStatus;
+					_node->clusterStatus(cs);
+					if (cs->clusterSize > 0) {
+						res["myId"] = cs->myId;
+						nlohmann::json ma = nlohmann::json::array();
+						for(unsigned int i=0;i<cs->clusterSize;++i) {
+							const ZT_ClusterMemberStatus &ms = cs->members[i];
+							nlohmann::json mj;
+							mj["id"] = ms.id;
+							mj["msSinceLastHeartbeat"] = ms.msSinceLastHeartbeat;
+							mj["alive"] = (bool)(ms.alive != 0);
+							mj["x"] = ms.x;
+							mj["y"] = ms.y;
+							mj["z"] = ms.z;
+							mj["load"] = ms.load;
+							mj["peers"] = ms.peers;
+							nlohmann::json ea = nlohmann::json::array();
+							for(unsigned int j=0;j<ms.numZeroTierPhysicalEndpoints;++j)
+								ea.push_back(reinterpret_cast<const InetAddress *>(&(ms.zeroTierPhysicalEndpoints[j]))->toString(tmp));
+							mj["zeroTierPhysicalEndpoints"] = ea;
+							ma.push_back(mj);
+						}
+						res["members"] = ma;
+						scode = 200;
+					} else scode = 404;
+					delete cs;
 				} else if (ps[0] == "peer") {
 					ZT_PeerList *pl = _node->peers();
 					if (pl) {
 						if (ps.size() == 1) {
-							// Return [array] of all peers
-
-							res = nlohmann::json::array();
-							for(unsigned long i=0;i<pl->peerCount;++i) {
+							// Return [array] of all peers, or the requested page of them, optionally
+							// only those with traffic since ?since= so a live view can poll cheaply
+
+							const _JsonPage pg(urlArgs);
+							std::map<std::string,std::string>::const_iterator since(urlArgs.find("since"));
+							const uint64_t sinceTime = (since != urlArgs.end()) ? Utils::strToU64(since->second.c_str()) : 0;
+							responseBody.push_back('[');
+							for(unsigned long i=0,n=0;((i<pl->peerCount)&&((n - std::min(n,pg.offset)) < pg.limit));++i) {
+								if (pl->peers[i].lastActivity < sinceTime)
+									continue;
+								if (n++ < pg.offset)
+									continue;
 								nlohmann::json pj;
 								_peerToJson(pj,&(pl->peers[i]));
-								res.push_back(pj);
+								pg.append(responseBody,pj);
 							}
+							responseBody.append("\n]");
+							responseContentType = "application/json";
 
 							scode = 200;
 						} else if (ps.size() == 2) {
@@ -1224,6 +2460,7 @@ public:
 							for(unsigned long i=0;i<pl->peerCount;++i) {
 								if (pl->peers[i].address == wantp) {
 									_peerToJson(res,&(pl->peers[i]));
+									_JsonPage(urlArgs).select(res);
 									scode = 200;
 									break;
 								}
@@ -1232,6 +2469,114 @@ public:
 						} else scode = 404;
 						_node->freeQueryResult((void *)pl);
 					} else scode = 500;
+				} else if ((ps[0] == "metrics")&&(ps.size() == 1)) {
+					// Prometheus text exposition format; counters sharing a name are adjacent
+					const Metrics &m = _node->metrics();
+					const char *lastName = (const char *)0;
+					for(unsigned int c=0;c<(unsigned int)Metrics::COUNTER_COUNT;++c) {
+						const Metrics::Info &mi = Metrics::info((Metrics::Counter)c);
+						if ((!lastName)||(strcmp(lastName,mi.name) != 0)) {
+							responseBody.append("# HELP ").append(mi.name).push_back(' ');
+							responseBody.append(mi.help).push_back('\n');
+							responseBody.append("# TYPE ").append(mi.name).append(" counter\n");
+							lastName = mi.name;
+						}
+						responseBody.append(mi.name);
+						if (mi.labels[0])
+							responseBody.append("{").append(mi.labels).push_back('}');
+						OSUtils::ztsnprintf(tmp,sizeof(tmp)," %llu\n",(unsigned long long)m.get((Metrics::Counter)c));
+						responseBody.append(tmp);
+					}
+					responseContentType = "text/plain; version=0.0.4";
+					scode = 200;
+				} else if ((ps[0] == "latency")&&(ps.size() == 1)) {
+					// Per-stage packet path timing in nanoseconds, percentiles are bucket upper bounds
+					const Latency &l = _node->latency();
+					responseBody = (Latency::ENABLED) ? "{\"enabled\":true,\"stages\":{" : "{\"enabled\":false,\"stages\":{";
+					for(unsigned int st=0;st<(unsigned int)Latency::STAGE_COUNT;++st) {
+						Latency::Stats ls;
+						l.stats((Latency::Stage)st,ls);
+						OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s\n\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+							(st == 0) ? "" : ",",
+							_latencyStageName(st),
+							(unsigned long long)ls.count,
+							(unsigned long long)ls.mean,
+							(unsigned long long)ls.p50,
+							(unsigned long long)ls.p90,
+							(unsigned long long)ls.p99,
+							(unsigned long long)ls.p999,
+							(unsigned long long)ls.max);
+						responseBody.append(tmp);
+					}
+					responseBody.append("\n}}");
+					scode = 200;
+				} else if ((ps[0] == "bench")&&(ps.size() == 1)) {
+					// Result of the running or last peer throughput and latency test
+					Bench::Result br;
+					_node->bench().result(br);
+					_benchToJson(res,br);
+					scode = 200;
+				} else if ((ps[0] == "capture")&&(ps.size() == 1)) {
+					_captureToJson(res,_node->capture());
+					scode = 200;
+				} else if ((ps[0] == "capture")&&(ps.size() == 2)&&(ps[1] == "pcapng")) {
+					// Captured frames after ?since= up to ?until=, with ?header=1 to start a new file
+					std::map<std::string,std::string>::const_iterator since(urlArgs.find("since"));
+					std::map<std::string,std::string>::const_iterator until(urlArgs.find("until"));
+					std::map<std::string,std::string>::const_iterator header(urlArgs.find("header"));
+					_node->capture().pcapng(
+						(since != urlArgs.end()) ? Utils::strToU64(since->second.c_str()) : 0,
+						(until != urlArgs.end()) ? Utils::strToU64(until->second.c_str()) : 0xffffffffffffffffULL,
+						((header != urlArgs.end())&&(header->second == "1")),
+						responseBody);
+					responseContentType = "application/x-pcapng";
+					scode = 200;
+				} else if ((ps[0] == "memory")&&(ps.size() == 1)) {
+					// Object counts and estimated bytes per subsystem, walked now
+					MemoryUsage mu;
+					_node->memoryUsage(mu);
+					if (_controller)
+						_controller->memoryUsage(mu);
+					OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\"totalBytes\":%llu,\"subsystems\":{",(unsigned long long)mu.totalBytes());
+					responseBody = tmp;
+					for(unsigned int s=0;s<(unsigned int)MemoryUsage::SUBSYSTEM_COUNT;++s) {
+						const MemoryUsage::Entry &e = mu.get((MemoryUsage::Subsystem)s);
+						OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s\n\"%s\":{\"count\":%llu,\"bytes\":%llu}",
+							(s == 0) ? "" : ",",
+							MemoryUsage::name((MemoryUsage::Subsystem)s),
+							(unsigned long long)e.count,
+							(unsigned long long)e.bytes);
+						responseBody.append(tmp);
+					}
+					responseBody.append("\n}}");
+					scode = 200;
+				} else if ((ps[0] == "trace")&&(ps.size() == 1)) {
+					// Sampled packet trace records after ?since=, so polling with the returned "next" follows it
+					std::map<std::string,std::string>::const_iterator since(urlArgs.find("since"));
+					std::vector<PacketTrace::Record> records;
+					const uint64_t next = _node->packetTrace().get((since != urlArgs.end()) ? Utils::strToU64(since->second.c_str()) : 0,records);
+					OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\"sampleRate\":%u,\"next\":%llu,\"records\":[",_node->packetTrace().sampleRate(),(unsigned long long)next);
+					responseBody.append(tmp);
+					char rtmp[512];
+					for(std::vector<PacketTrace::Record>::const_iterator r(records.begin());r!=records.end();++r) {
+						OSUtils::ztsnprintf(rtmp,sizeof(rtmp),"%s\n{\"seq\":%llu,\"time\":%llu,\"event\":\"%s\",\"reason\":\"%s\",\"packetId\":\"%.16llx\",\"networkId\":\"%.16llx\",\"source\":\"%.10llx\",\"destination\":\"%.10llx\",\"verb\":%u,\"hops\":%u,\"size\":%u}",
+							(r == records.begin()) ? "" : ",",
+							(unsigned long long)r->seq,
+							(unsigned long long)r->timestamp,
+							_packetTraceEventName(r->event),
+							_packetTraceReasonName(r->reason),
+							(unsigned long long)r->packetId,
+							(unsigned long long)r->networkId,
+							(unsigned long long)r->source,
+							(unsigned long long)r->destination,
+							(unsigned int)r->verb,
+							(unsigned int)r->hops,
+							(unsigned int)r->size);
+						responseBody.append(rtmp);
+					}
+					responseBody.append("\n]}");
+					responseContentType = "application/json";
+					scode = 200;
 				} else {
 					if (_controller) {
 						scode = _controller->handleControlPlaneHttpGET(std::vector<std::string>(ps.begin()+1,ps.end()),urlArgs,headers,body,responseBody,responseContentType);
@@ -1300,6 +2645,8 @@ public:
 											if (allowGlobal.is_boolean()) localSettings.allowGlobal = (bool)allowGlobal;
 											json &allowDefault = j["allowDefault"];
 											if (allowDefault.is_boolean()) localSettings.allowDefault = (bool)allowDefault;
+											json &l3 = j["l3"];
+											if (l3.is_boolean()) localSettings.l3 = (bool)l3;
 										}
 									} catch ( ... ) {
 										// discard invalid JSON
@@ -1316,6 +2663,68 @@ public:
 						} else scode = 500;
 
 					} else scode = 404;
+				} else if ((ps[0] == "trace")&&(ps.size() == 1)) {
+					try {
+						json j(OSUtils::jsonParse(body));
+						if (j.is_object())
+							_node->packetTrace().setSampleRate((unsigned int)OSUtils::jsonInt(j["sampleRate"],(uint64_t)_node->packetTrace().sampleRate()));
+					} catch ( ... ) {
+						// discard invalid JSON
+					}
+					res["sampleRate"] = _node->packetTrace().sampleRate();
+					scode = 200;
+				} else if ((ps[0] == "capture")&&(ps.size() == 1)) {
+					// Start capturing, discarding anything captured before
+					Capture::Filter f;
+					try {
+						json j(OSUtils::jsonParse(body));
+						if (j.is_object()) {
+							f.networkId = Utils::hexStrToU64(OSUtils::jsonString(j["networkId"],"0").c_str());
+							f.peer = Utils::hexStrToU64(OSUtils::jsonString(j["peer"],"0").c_str());
+							f.etherType = (unsigned int)OSUtils::jsonInt(j["etherType"],(uint64_t)0) & 0xffff;
+							const std::string dir(OSUtils::jsonString(j["direction"],"both"));
+							f.inbound = (dir != "out");
+							f.outbound = (dir != "in");
+							f.dropsOnly = OSUtils::jsonBool(j["dropsOnly"],false);
+							f.snapLength = (unsigned int)OSUtils::jsonInt(j["snapLength"],(uint64_t)f.snapLength);
+						}
+					} catch ( ... ) {
+						// discard invalid JSON
+					}
+					_node->capture().start(f);
+					_captureToJson(res,_node->capture());
+					scode = 200;
+				} else if ((ps[0] == "bench")&&(ps.size() == 2)) {
+					// Start a test against a peer, returning 409 if one is already running
+					unsigned int duration = 5000;
+					uint64_t rate = 0;
+					try {
+						json j(OSUtils::jsonParse(body));
+						if (j.is_object()) {
+							duration = (unsigned int)std::min(OSUtils::jsonInt(j["duration"],(uint64_t)duration),(uint64_t)ZT_BENCH_MAX_DURATION);
+							rate = OSUtils::jsonInt(j["rate"],rate);
+						}
+					} catch ( ... ) {
+						// discard invalid JSON
+					}
+
+					Bench::Result br;
+					_node->bench().result(br);
+					if (br.running) {
+						scode = 409;
+					} else {
+						if (_bench.started) {
+							Thread::join(_bench.thread);
+							_bench.started = false;
+						}
+						if (_node->bench().start((void *)0,Address(Utils::hexStrToU64(ps[1].c_str())),duration,rate)) {
+							_bench.thread = Thread::start(&_bench);
+							_bench.started = true;
+							_node->bench().result(br);
+							_benchToJson(res,br);
+							scode = 200;
+						} else scode = 404;
+					}
 				} else {
 					if (_controller)
 						scode = _controller->handleControlPlaneHttpPOST(std::vector<std::string>(ps.begin()+1,ps.end()),urlArgs,headers,body,responseBody,responseContentType);
@@ -1348,6 +2757,10 @@ public:
 						} // else 404
 						_node->freeQueryResult((void *)nws);
 					} else scode = 500;
+				} else if ((ps[0] == "capture")&&(ps.size() == 1)) {
+					_node->capture().stop();
+					_captureToJson(res,_node->capture());
+					scode = 200;
 				} else {
 					if (_controller)
 						scode = _controller->handleControlPlaneHttpDELETE(std::vector<std::string>(ps.begin()+1,ps.end()),urlArgs,headers,body,responseBody,responseContentType);
@@ -1458,6 +2871,28 @@ public:
 
 		_primaryPort = (unsigned int)OSUtils::jsonInt(settings["primaryPort"],(uint64_t)_primaryPort) & 0xffff;
 		_portMappingEnabled = OSUtils::jsonBool(settings["portMappingEnabled"],true);
+		_applyNodeSettings(_node,settings,_ecnReadable());
+		for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t)
+			_applyNodeSettings((*t)->node,settings,_ecnReadable());
+		const uint64_t egressLimit = OSUtils::jsonInt(settings["egressBandwidthLimit"],0ULL);
+		const bool egressPacing = OSUtils::jsonBool(settings["egressPacing"],false);
+		_udpPacingRate = (egressPacing) ? (egressLimit / 8) : 0;
+		_binder.setPacingRate(_phy,_udpPacingRate);
+#ifdef ZT_USE_IO_THREADS
+		for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t)
+			(*t)->binder.setPacingRate((*t)->phy,_udpPacingRate);
+#endif
+
+		json &flowExport = settings["flowExport"];
+		if (flowExport.is_object()) {
+			_flowCollector = InetAddress(OSUtils::jsonString(flowExport["collector"],"").c_str());
+			if ((_flowCollector.ss_family == AF_INET)||(_flowCollector.ss_family == AF_INET6)) {
+				if (!_flowCollector.port())
+					_flowCollector.setPort(4739); // IANA IPFIX port
+				_flowExportInterval = std::max(OSUtils::jsonInt(flowExport["interval"],60ULL),(uint64_t)1) * 1000;
+				_node->flowExport().setEnabled(true,(unsigned int)OSUtils::jsonInt(flowExport["maxFlows"],(uint64_t)ZT_FLOW_EXPORT_DEFAULT_MAX_FLOWS));
+			}
+		}
 
 #ifndef ZT_SDK
 		const std::string up(OSUtils::jsonString(settings["softwareUpdate"],ZT_SOFTWARE_UPDATE_DEFAULT));
@@ -1494,6 +2929,24 @@ public:
 		}
 	}
 
+	// Settings in local.conf that apply to each node, main or tenant
+	static void _applyNodeSettings(Node *const node,json &settings,const bool ecnReadable)
+	{
+		node->setMultipathMode(OSUtils::jsonBool(settings["multipath"],false));
+		node->setEcn((ecnReadable)&&(OSUtils::jsonBool(settings["ecn"],true)));
+		node->setPeerIdleTimeout((unsigned int)(OSUtils::jsonInt(settings["peerIdleTimeout"],(uint64_t)(ZT_PEER_ACTIVITY_TIMEOUT / 1000)) * 1000));
+		node->setEgressBandwidthLimit(OSUtils::jsonInt(settings["egressBandwidthLimit"],0ULL));
+		node->setEgressPacing(OSUtils::jsonBool(settings["egressPacing"],false));
+		node->setRelayBandwidthLimit(OSUtils::jsonInt(settings["relayBandwidthLimit"],(uint64_t)ZT_RELAY_MAX_BYTES_PER_DESTINATION_PER_SECOND * 8ULL));
+		node->setPeerLimit((unsigned long)OSUtils::jsonInt(settings["peerLimit"],0ULL));
+		node->reservePeers((unsigned long)OSUtils::jsonInt(settings["peerReserve"],0ULL));
+		json &idv = settings["identityVerification"];
+		if (idv.is_object())
+			node->setIdentityVerificationLimit((unsigned long)OSUtils::jsonInt(idv["prefixes"],(uint64_t)ZT_VERIFICATION_GATE_DEFAULT_SIZE),(unsigned int)OSUtils::jsonInt(idv["burst"],(uint64_t)ZT_VERIFICATION_GATE_DEFAULT_BURST));
+		else node->setIdentityVerificationLimit(ZT_VERIFICATION_GATE_DEFAULT_SIZE,ZT_VERIFICATION_GATE_DEFAULT_BURST);
+		node->packetTrace().setSampleRate((unsigned int)OSUtils::jsonInt(settings["packetTraceSampleRate"],0ULL));
+	}
+
 	// Checks if a managed IP or route target is allowed
 	bool checkIfManagedIsAllowed(const NetworkState &n,const InetAddress &target)
 	{
@@ -1541,6 +2994,10 @@ public:
 	{
 		char ipbuf[64];
 
+#ifdef ZT_USE_USERSPACE_STACK
+		syncRoutes = false; // there is no device for OS routes, and the stack follows routes itself
+#endif
+
 		// assumes _nets_m is locked
 		if (syncIps) {
 			std::vector<InetAddress> newManagedIps;
@@ -1642,22 +3099,118 @@ public:
 		}
 	}
 
+	void _syncRoutes(std::map<uint64_t,NetworkState> &nets,Mutex &nets_m)
+	{
+		Mutex::Lock _l(nets_m);
+		for(std::map<uint64_t,NetworkState>::iterator n(nets.begin());n!=nets.end();++n) {
+			if (n->second.tap)
+				syncManagedStuff(n->second,false,true);
+		}
+	}
+
+	void _syncMulticastGroups(Node *const node,std::map<uint64_t,NetworkState> &nets,Mutex &nets_m)
+	{
+		Mutex::Lock _l(nets_m);
+		for(std::map<uint64_t,NetworkState>::const_iterator n(nets.begin());n!=nets.end();++n) {
+			if (n->second.tap) {
+				std::vector<MulticastGroup> added,removed;
+				n->second.tap->scanMulticastGroups(added,removed);
+				for(std::vector<MulticastGroup>::iterator m(added.begin());m!=added.end();++m)
+					node->multicastSubscribe((void *)0,n->first,m->mac().toInt(),m->adi());
+				for(std::vector<MulticastGroup>::iterator m(removed.begin());m!=removed.end();++m)
+					node->multicastUnsubscribe(n->first,m->mac().toInt(),m->adi());
+			}
+		}
+	}
+
+	static void _setLocalInterfaceAddresses(Node *const node,const std::vector<InetAddress> &addrs)
+	{
+		node->clearLocalInterfaceAddresses();
+		for(std::vector<InetAddress>::const_iterator i(addrs.begin());i!=addrs.end();++i)
+			node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*i)));
+	}
+
+	// Sends flow counts since the last call to the collector as IPFIX
+	void _exportFlows(const uint64_t now)
+	{
+		std::vector<FlowExport::Flow> flows;
+		_node->flows(flows);
+		if (flows.empty())
+			return;
+
+		if (!_flowExportSocket) {
+			const uint8_t any[16] = { 0 };
+			const InetAddress local(any,(_flowCollector.ss_family == AF_INET6) ? 16 : 4,0);
+			_flowExportSocket = _phy.udpBind(reinterpret_cast<const struct sockaddr *>(&local));
+			if (!_flowExportSocket)
+				return;
+		}
+
+		// The observation domain is the low 32 bits of our ZeroTier address
+		std::vector<std::string> messages;
+		_node->flowExport().ipfix((uint32_t)(now / 1000),(uint32_t)_node->address(),flows,messages);
+		for(std::vector<std::string>::const_iterator m(messages.begin());m!=messages.end();++m)
+			_phy.udpSend(_flowExportSocket,reinterpret_cast<const struct sockaddr *>(&_flowCollector),m->data(),(unsigned long)m->length());
+	}
+
+	// Tenant a packet from the wire is addressed to, or NULL for the main node.
+	// Packets and fragments both have their destination at the same place.
+	inline Tenant *_tenantFor(const void *data,const unsigned long len) const
+	{
+		if ((_tenants.empty())||(len < ZT_PROTO_MIN_FRAGMENT_LENGTH))
+			return (Tenant *)0;
+		Tenant *const *const t = _tenantsByAddress.get(Address(reinterpret_cast<const uint8_t *>(data) + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH).toInt());
+		return (t) ? *t : (Tenant *)0;
+	}
+
+	inline ZT_ResultCode _processWirePacket(const uint64_t now,const int64_t localSocket,const struct sockaddr_storage *from,const void *data,const unsigned long len,const unsigned int ecn = 0)
+	{
+		Tenant *const t = _tenantFor(data,len);
+		if (t)
+			return t->node->processWirePacket((void *)0,now,localSocket,from,data,(unsigned int)len,&(t->nextBackgroundTaskDeadline),ecn);
+		return _node->processWirePacket((void *)0,now,localSocket,from,data,(unsigned int)len,&_nextBackgroundTaskDeadline,ecn);
+	}
+
+	// True if UDP is received only in ways that report each datagram's ECN
+	// field, which Node::setEcn() requires
+	inline bool _ecnReadable() const
+	{
+#ifdef ZT_PHY_HAVE_ECN
+		if (_ioUring)
+			return false;
+#ifdef ZT_HAVE_AF_XDP
+		if (_xdpDevice.length() > 0)
+			return false;
+#endif
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	// =========================================================================
 	// Handlers for Node and Phy<> callbacks
 	// =========================================================================
 
 	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
 	{
+		if ((_flowExportSocket)&&(sock == _flowExportSocket))
+			return; // collectors don't answer
+		if ((_clusterMessageSocket)&&(sock == _clusterMessageSocket)) {
+			_node->clusterHandleIncomingMessage(data,(unsigned int)len);
+			return;
+		}
 		if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
-			_lastDirectReceiveFromGlobal = OSUtils::now();
-		const ZT_ResultCode rc = _node->processWirePacket(
-			(void *)0,
+			_lastDirectReceiveFromGlobal.store(OSUtils::now(),std::memory_order_relaxed);
+		if (_wireCapture.enabled())
+			_wireCapture.record(OSUtils::now(),reinterpret_cast<int64_t>(sock),reinterpret_cast<const struct sockaddr_storage *>(from),data,len);
+		const ZT_ResultCode rc = _processWirePacket(
 			OSUtils::now(),
 			reinterpret_cast<int64_t>(sock),
 			reinterpret_cast<const struct sockaddr_storage *>(from), // Phy<> uses sockaddr_storage, so it'll always be that big
 			data,
 			len,
-			&_nextBackgroundTaskDeadline);
+			_phy.datagramEcn()); // kept per thread, so also right for I/O threads' Phy<>
 		if (ZT_ResultCode_isFatal(rc)) {
 			char tmp[256];
 			OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processWirePacket: %d",(int)rc);
@@ -1668,6 +3221,77 @@ public:
 		}
 	}
 
+#if defined(ZT_HAVE_AF_XDP) || defined(ZT_HAVE_NETMAP)
+	// Packets from AF_XDP or netmap, which both have local, from, data and len (at most BATCH of them)
+	template<typename P,unsigned int BATCH>
+	inline void _bypassPacketHandler(const P *packets,unsigned int count)
+	{
+#ifdef ZT_TAP_HAVE_GRO
+		// Receiver threads are only started once and run until shutdown, so each keeps its own
+		if ((_tapGro)&&(!_threadTapGro))
+			_threadTapGro = new LinuxTapGro();
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+		BSDEthernetTap::deferNetmapSync(true);
+#endif
+
+		// Replies go out through the socket bound to the address the packet was sent to
+		const uint64_t now = OSUtils::now();
+		ZT_WirePacket wp[BATCH];
+		unsigned int wpc = 0;
+		const struct sockaddr_storage *lastLocal = (const struct sockaddr_storage *)0;
+		int64_t localSocket = -1;
+		ZT_ResultCode rc = ZT_RESULT_OK;
+		for(unsigned int i=0;i<count;++i) {
+			if ((!lastLocal)||(*reinterpret_cast<const InetAddress *>(lastLocal) != *reinterpret_cast<const InetAddress *>(&(packets[i].local)))) {
+				lastLocal = &(packets[i].local);
+				PhySocket *const sock = _binder.udpSocketForLocalAddress(*reinterpret_cast<const InetAddress *>(lastLocal));
+				localSocket = (sock) ? reinterpret_cast<int64_t>(sock) : -1;
+			}
+			if ((packets[i].len >= 16)&&(reinterpret_cast<const InetAddress *>(&(packets[i].from))->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
+				_lastDirectReceiveFromGlobal.store(now,std::memory_order_relaxed);
+			if (_wireCapture.enabled())
+				_wireCapture.record(now,localSocket,&(packets[i].from),packets[i].data,packets[i].len);
+			Tenant *const t = _tenantFor(packets[i].data,packets[i].len);
+			if (t) {
+				const ZT_ResultCode trc = t->node->processWirePacket((void *)0,now,localSocket,&(packets[i].from),packets[i].data,packets[i].len,&(t->nextBackgroundTaskDeadline));
+				if (ZT_ResultCode_isFatal(trc))
+					rc = trc;
+				continue;
+			}
+			wp[wpc].localSocket = localSocket;
+			wp[wpc].remoteAddress = &(packets[i].from);
+			wp[wpc].packetData = packets[i].data;
+			wp[wpc].packetLength = packets[i].len;
+			wp[wpc].ttl = 0;
+			++wpc;
+		}
+		if ((wpc)&&(!ZT_ResultCode_isFatal(rc)))
+			rc = _node->processWirePackets((void *)0,now,wp,wpc,&_nextBackgroundTaskDeadline);
+#ifdef ZT_TAP_HAVE_GRO
+		if (_threadTapGro)
+			_threadTapGro->flush();
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+		BSDEthernetTap::flushNetmap();
+#endif
+		if (ZT_ResultCode_isFatal(rc)) {
+			char tmp[256];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processWirePackets: %d",(int)rc);
+			Mutex::Lock _l(_termReason_m);
+			_termReason = ONE_UNRECOVERABLE_ERROR;
+			_fatalErrorMessage = tmp;
+			this->terminate();
+		}
+	}
+#endif
+#ifdef ZT_HAVE_AF_XDP
+	inline void xdpPacketHandler(const LinuxXdpPacket *packets,unsigned int count) { _bypassPacketHandler<LinuxXdpPacket,ZT_LINUX_XDP_RX_BATCH>(packets,count); }
+#endif
+#ifdef ZT_HAVE_NETMAP
+	inline void netmapPacketHandler(const BSDNetmapPacket *packets,unsigned int count) { _bypassPacketHandler<BSDNetmapPacket,ZT_BSD_NETMAP_RX_BATCH>(packets,count); }
+#endif
+
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
 	{
 		if (!success) {
@@ -1683,9 +3307,10 @@ public:
 		tc->sock = sock;
 
 		if (tc->type == TcpConnection::TCP_TUNNEL_OUTGOING) {
-			if (_tcpFallbackTunnel)
-				_phy.close(_tcpFallbackTunnel->sock);
-			_tcpFallbackTunnel = tc;
+			TcpConnection *&slot = _tcpFallbackTunnels[tc->tunnelIndex];
+			if (slot)
+				_phy.close(slot->sock);
+			slot = tc;
 			_phy.streamSend(sock,ZT_TCP_TUNNEL_HELLO,sizeof(ZT_TCP_TUNNEL_HELLO));
 		} else {
 			_phy.close(sock,true);
@@ -1712,6 +3337,9 @@ public:
 			http_parser_init(&(tc->parser),HTTP_REQUEST);
 			tc->parser.data = (void *)tc;
 			tc->messageSize = 0;
+			tc->closeAfterWrite = false;
+			tc->id = _nextTcpConnectionId++;
+			tc->pendingResponses = 0;
 
 			*uptrN = (void *)tc;
 		}
@@ -1721,8 +3349,8 @@ public:
 	{
 		TcpConnection *tc = (TcpConnection *)*uptr;
 		if (tc) {
-			if (tc == _tcpFallbackTunnel) {
-				_tcpFallbackTunnel = (TcpConnection *)0;
+			if ((tc->type == TcpConnection::TCP_TUNNEL_OUTGOING)&&(_tcpFallbackTunnels[tc->tunnelIndex] == tc)) {
+				_tcpFallbackTunnels[tc->tunnelIndex] = (TcpConnection *)0;
 			}
 			{
 				Mutex::Lock _l(_tcpConnections_m);
@@ -1742,10 +3370,11 @@ public:
 
 				case TcpConnection::TCP_UNCATEGORIZED_INCOMING:
 					switch(reinterpret_cast<uint8_t *>(data)[0]) {
-						// HTTP: GET, PUT, POST, HEAD
+						// HTTP: GET, PUT, POST, HEAD, DELETE
 						case 'G':
 						case 'P':
-						case 'H': {
+						case 'H':
+						case 'D': {
 							// This is only allowed from IPs permitted to access the management
 							// backplane, which is just 127.0.0.1/::1 unless otherwise configured.
 							bool allow;
@@ -1780,9 +3409,14 @@ public:
 
 				case TcpConnection::TCP_HTTP_INCOMING:
 				case TcpConnection::TCP_HTTP_OUTGOING:
+					if (tc->closeAfterWrite)
+						return; // ignore anything pipelined after a request that ends the connection
 					http_parser_execute(&(tc->parser),&HTTP_PARSER_SETTINGS,(const char *)data,len);
-					if ((tc->parser.upgrade)||(tc->parser.http_errno != HPE_OK))
-						_phy.close(sock);
+					if ((tc->parser.upgrade)||(tc->parser.http_errno != HPE_OK)) {
+						// If we're already closing after the last response, let it finish sending first
+						if (!tc->closeAfterWrite)
+							_phy.close(sock);
+					}
 					return;
 
 				case TcpConnection::TCP_TUNNEL_OUTGOING:
@@ -1831,14 +3465,12 @@ public:
 
 								if (from) {
 									InetAddress fakeTcpLocalInterfaceAddress((uint32_t)0xffffffff,0xffff);
-									const ZT_ResultCode rc = _node->processWirePacket(
-										(void *)0,
+									const ZT_ResultCode rc = _processWirePacket(
 										OSUtils::now(),
 										-1,
 										reinterpret_cast<struct sockaddr_storage *>(&from),
 										data,
-										plen,
-										&_nextBackgroundTaskDeadline);
+										plen);
 									if (ZT_ResultCode_isFatal(rc)) {
 										char tmp[256];
 										OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processWirePacket: %d",(int)rc);
@@ -1871,17 +3503,18 @@ public:
 		bool closeit = false;
 		{
 			Mutex::Lock _l(tc->writeq_m);
-			if (tc->writeq.length() > 0) {
-				long sent = (long)_phy.streamSend(sock,tc->writeq.data(),(unsigned long)tc->writeq.length(),true);
+			if (!tc->writeq.empty()) {
+				const void *d1,*d2;
+				unsigned long l1,l2;
+				tc->writeq.peek(d1,l1,d2,l2);
+				long sent = _phy.streamSendv(sock,d1,l1,d2,l2,true);
 				if (sent > 0) {
-					if ((unsigned long)sent >= (unsigned long)tc->writeq.length()) {
-						tc->writeq.clear();
+					tc->writeq.consume((unsigned long)sent);
+					if (tc->writeq.empty()) {
 						_phy.setNotifyWritable(sock,false);
 
-						if (tc->type == TcpConnection::TCP_HTTP_INCOMING)
-							closeit = true; // HTTP keep alive not supported
-					} else {
-						tc->writeq.erase(tc->writeq.begin(),tc->writeq.begin() + sent);
+						if ((tc->type == TcpConnection::TCP_HTTP_INCOMING)&&(tc->closeAfterWrite)&&(tc->pendingResponses == 0))
+							closeit = true;
 					}
 				}
 			} else {
@@ -1894,86 +3527,199 @@ public:
 
 	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
 	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
-	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
-	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr)
+	{
+		// Messages may have been dropped if the monitor failed, so assume something changed
+		if (sock == _addressChangeMonitor) {
+			_addressChangeMonitor = (PhySocket *)0;
+			_addressChangedAt = OSUtils::now();
+		}
+	}
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+		if ((sock == _addressChangeMonitor)&&(!_addressChangedAt)&&(Binder::isAddressChange(data,len)))
+			_addressChangedAt = OSUtils::now();
+	}
 	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked) {}
 
+#ifdef ZT_USE_MINIUPNPC
+	// Called from a port mapper thread when a mapping is acquired or changes
+	static void _portMappingChangedFunction(void *arg)
+	{
+		OneServiceImpl *const impl = reinterpret_cast<OneServiceImpl *>(arg);
+		impl->_portMappingChanged = true;
+		impl->_phy.whack();
+	}
+#endif
+
 	inline int nodeVirtualNetworkConfigFunction(uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwc)
 	{
-		Mutex::Lock _l(_nets_m);
-		NetworkState &n = _nets[nwid];
+		return _virtualNetworkConfig(_homePath,_nets,_nets_m,StapFrameHandler,(void *)this,nwid,nuptr,op,nwc);
+	}
 
-		switch(op) {
+	inline int tenantVirtualNetworkConfigFunction(Tenant *t,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwc)
+	{
+		return _virtualNetworkConfig(t->homePath,t->nets,t->nets_m,StenantTapFrameHandler,(void *)t,nwid,nuptr,op,nwc);
+	}
 
-			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP:
-				if (!n.tap) {
-					try {
-						char friendlyName[128];
-						OSUtils::ztsnprintf(friendlyName,sizeof(friendlyName),"ZeroTier One [%.16llx]",nwid);
-
-						n.tap = new EthernetTap(
-							_homePath.c_str(),
-							MAC(nwc->mac),
-							nwc->mtu,
-							(unsigned int)ZT_IF_METRIC,
-							nwid,
-							friendlyName,
-							StapFrameHandler,
-							(void *)this);
-						*nuptr = (void *)&n;
+	// Reads a network's settings from networks.d/<nwid>.local.conf, if it's there
+	static void _loadNetworkSettings(const std::string &homePath,const uint64_t nwid,NetworkSettings &s)
+	{
+		char nlcpath[256];
+		OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",homePath.c_str(),nwid);
+		std::string nlcbuf;
+		if (OSUtils::readFile(nlcpath,nlcbuf)) {
+			Dictionary<4096> nc;
+			nc.load(nlcbuf.c_str());
+			Buffer<1024> allowManaged;
+			if (nc.get("allowManaged", allowManaged) && allowManaged.size() != 0) {
+				std::string addresses (allowManaged.begin(), allowManaged.size());
+				if (allowManaged.size() <= 5) { // untidy parsing for backward compatibility
+					if (allowManaged[0] == '1' || allowManaged[0] == 't' || allowManaged[0] == 'T') {
+						s.allowManaged = true;
+					} else {
+						s.allowManaged = false;
+					}
+				} else {
+					// this should be a list of IP addresses
+					s.allowManaged = true;
+					size_t pos = 0;
+					while (true) {
+						size_t nextPos = addresses.find(',', pos);
+						std::string address = addresses.substr(pos, (nextPos == std::string::npos ? addresses.size() : nextPos) - pos);
+						s.allowManagedWhitelist.push_back(InetAddress(address.c_str()));
+						if (nextPos == std::string::npos) break;
+						pos = nextPos + 1;
+					}
+				}
+			} else {
+				s.allowManaged = true;
+			}
+			s.allowGlobal = nc.getB("allowGlobal", false);
+			s.allowDefault = nc.getB("allowDefault", false);
+			s.l3 = nc.getB("l3", false);
+		}
+	}
 
-						char nlcpath[256];
-						OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",_homePath.c_str(),nwid);
-						std::string nlcbuf;
-						if (OSUtils::readFile(nlcpath,nlcbuf)) {
-							Dictionary<4096> nc;
-							nc.load(nlcbuf.c_str());
-							Buffer<1024> allowManaged;
-							if (nc.get("allowManaged", allowManaged) && allowManaged.size() != 0) {
-								std::string addresses (allowManaged.begin(), allowManaged.size());
-								if (allowManaged.size() <= 5) { // untidy parsing for backward compatibility
-									if (allowManaged[0] == '1' || allowManaged[0] == 't' || allowManaged[0] == 'T') {
-										n.settings.allowManaged = true;
-									} else {
-										n.settings.allowManaged = false;
-									}
-								} else {
-									// this should be a list of IP addresses
-									n.settings.allowManaged = true;
-									size_t pos = 0;
-									while (true) {
-										size_t nextPos = addresses.find(',', pos);
-										std::string address = addresses.substr(pos, (nextPos == std::string::npos ? addresses.size() : nextPos) - pos);
-										n.settings.allowManagedWhitelist.push_back(InetAddress(address.c_str()));
-										if (nextPos == std::string::npos) break;
-										pos = nextPos + 1;
-									}
-								}
-							} else {
-								n.settings.allowManaged = true;
-							}
-							n.settings.allowGlobal = nc.getB("allowGlobal", false);
-							n.settings.allowDefault = nc.getB("allowDefault", false);
-						}
-					} catch (std::exception &exc) {
+	// Opens and configures a new tap without holding nets_m, so several networks
+	// can come up at once and traffic on those already up isn't held up. The
+	// network is only added to nets once its tap is ready.
+	int _virtualNetworkUp(
+		const std::string &homePath,
+		std::map<uint64_t,NetworkState> &nets,
+		Mutex &nets_m,
+		void (*tapHandler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void *tapArg,
+		uint64_t nwid,
+		void **nuptr,
+		const ZT_VirtualNetworkConfig *nwc)
+	{
+		NetworkState n;
+		try {
+			char friendlyName[128];
+			OSUtils::ztsnprintf(friendlyName,sizeof(friendlyName),"ZeroTier One [%.16llx]",nwid);
+
+			_loadNetworkSettings(homePath,nwid,n.settings);
+
+			n.tap = new EthernetTap(
+				homePath.c_str(),
+				MAC(nwc->mac),
+				nwc->mtu,
+				(unsigned int)ZT_IF_METRIC,
+				nwid,
+				friendlyName,
+				tapHandler,
+				tapArg
+#ifdef ZT_TAP_HAVE_QUEUES
+				,_tapQueueCount
+				,_ioUring
+#endif
+#ifdef ZT_TAP_HAVE_L3
+				,n.settings.l3
+#endif
+#ifdef ZT_TAP_HAVE_NETMAP
+				,_netmapTaps
+#endif
+				);
+			memcpy(&(n.config),nwc,sizeof(ZT_VirtualNetworkConfig));
 #ifdef __WINDOWS__
-						FILE *tapFailLog = fopen((_homePath + ZT_PATH_SEPARATOR_S"port_error_log.txt").c_str(),"a");
-						if (tapFailLog) {
-							fprintf(tapFailLog,"%.16llx: %s" ZT_EOL_S,(unsigned long long)nwid,exc.what());
-							fclose(tapFailLog);
-						}
+			// wait for up to 5 seconds for the WindowsEthernetTap to actually be initialized
+			const int MAX_SLEEP_COUNT = 500;
+			for (int i = 0; !n.tap->isInitialized() && i < MAX_SLEEP_COUNT; i++) {
+				Sleep(10);
+			}
+#endif
+			syncManagedStuff(n,true,true);
+#if defined(ZT_TAP_HAVE_L3) || defined(ZT_USE_USERSPACE_STACK)
+			n.tap->setL3Routes(nwc->routes,nwc->routeCount);
+#endif
+			n.tap->setMtu(nwc->mtu);
+		} catch (std::exception &exc) {
+#ifdef __WINDOWS__
+			FILE *tapFailLog = fopen((homePath + ZT_PATH_SEPARATOR_S"port_error_log.txt").c_str(),"a");
+			if (tapFailLog) {
+				fprintf(tapFailLog,"%.16llx: %s" ZT_EOL_S,(unsigned long long)nwid,exc.what());
+				fclose(tapFailLog);
+			}
 #else
-						fprintf(stderr,"ERROR: unable to configure virtual network port: %s" ZT_EOL_S,exc.what());
+			fprintf(stderr,"ERROR: unable to configure virtual network port: %s" ZT_EOL_S,exc.what());
 #endif
-						_nets.erase(nwid);
-						return -999;
-					} catch ( ... ) {
-						return -999; // tap init failed
-					}
-				}
-				// After setting up tap, fall through to CONFIG_UPDATE since we also want to do this...
+			delete n.tap;
+			return -999;
+		} catch ( ... ) {
+			delete n.tap;
+			return -999; // tap init failed
+		}
+
+		Mutex::Lock _l(nets_m);
+		NetworkState &ns = nets[nwid];
+		ns.tap = n.tap;
+		memcpy(&(ns.config),&(n.config),sizeof(ZT_VirtualNetworkConfig));
+		ns.managedIps.swap(n.managedIps);
+		ns.managedRoutes.swap(n.managedRoutes);
+		ns.settings = n.settings;
+		*nuptr = (void *)&ns;
+		return 0;
+	}
+
+	// Opens, updates and closes taps for the main node or a tenant, each with its own networks and home
+	int _virtualNetworkConfig(
+		const std::string &homePath,
+		std::map<uint64_t,NetworkState> &nets,
+		Mutex &nets_m,
+		void (*tapHandler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void *tapArg,
+		uint64_t nwid,
+		void **nuptr,
+		enum ZT_VirtualNetworkConfigOperation op,
+		const ZT_VirtualNetworkConfig *nwc)
+	{
+		if (op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP) {
+			bool haveTap;
+			{
+				Mutex::Lock _l(nets_m);
+				std::map<uint64_t,NetworkState>::const_iterator n(nets.find(nwid));
+				haveTap = ((n != nets.end())&&(n->second.tap));
+			}
+			if (!haveTap)
+				return _virtualNetworkUp(homePath,nets,nets_m,tapHandler,tapArg,nwid,nuptr,nwc);
+		}
+
+		Mutex::Lock _l(nets_m);
+		NetworkState &n = nets[nwid];
+
+		switch(op) {
 
-			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE:
+			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP:
+				// Tap is already up, so just sync everything as CONFIG_UPDATE does...
+
+			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE: {
+				// Most updates only carry fresh credentials or rules, so addresses,
+				// routes, and MTU are only touched on the tap if they changed.
+				const bool fullSync = (op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP);
+				const bool ipsChanged = ((fullSync)||(n.config.assignedAddressCount != nwc->assignedAddressCount)||(memcmp(n.config.assignedAddresses,nwc->assignedAddresses,sizeof(struct sockaddr_storage) * nwc->assignedAddressCount) != 0));
+				const bool routesChanged = ((fullSync)||(n.config.routeCount != nwc->routeCount)||(memcmp(n.config.routes,nwc->routes,sizeof(ZT_VirtualNetworkRoute) * nwc->routeCount) != 0));
+				const bool mtuChanged = ((fullSync)||(n.config.mtu != nwc->mtu));
 				memcpy(&(n.config),nwc,sizeof(ZT_VirtualNetworkConfig));
 				if (n.tap) { // sanity check
 #ifdef __WINDOWS__
@@ -1986,13 +3732,20 @@ public:
 						Sleep(10);
 					}
 #endif
-					syncManagedStuff(n,true,true);
-					n.tap->setMtu(nwc->mtu);
+					// Routes via managed IPs depend on which IPs are assigned
+					if ((ipsChanged)||(routesChanged))
+						syncManagedStuff(n,ipsChanged,true);
+#if defined(ZT_TAP_HAVE_L3) || defined(ZT_USE_USERSPACE_STACK)
+					if (routesChanged)
+						n.tap->setL3Routes(nwc->routes,nwc->routeCount);
+#endif
+					if (mtuChanged)
+						n.tap->setMtu(nwc->mtu);
 				} else {
-					_nets.erase(nwid);
+					nets.erase(nwid);
 					return -999; // tap init failed
 				}
-				break;
+			}	break;
 
 			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DOWN:
 			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY:
@@ -2002,18 +3755,18 @@ public:
 #endif
 					*nuptr = (void *)0;
 					delete n.tap;
-					_nets.erase(nwid);
+					nets.erase(nwid);
 #ifdef __WINDOWS__
 					if ((op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY)&&(winInstanceId.length() > 0))
 						WindowsEthernetTap::deletePersistentTapDevice(winInstanceId.c_str());
 #endif
 					if (op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY) {
 						char nlcpath[256];
-						OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",_homePath.c_str(),nwid);
+						OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",homePath.c_str(),nwid);
 						OSUtils::rm(nlcpath);
 					}
 				} else {
-					_nets.erase(nwid);
+					nets.erase(nwid);
 				}
 				break;
 
@@ -2047,7 +3800,7 @@ public:
 
 			case ZT_EVENT_REMOTE_TRACE: {
 				const ZT_RemoteTrace *rt = reinterpret_cast<const ZT_RemoteTrace *>(metaData);
-				if ((rt)&&(rt->len > 0)&&(rt->len <= ZT_MAX_REMOTE_TRACE_SIZE)&&(rt->data))
+				if ((rt)&&(rt->len > 0)&&(rt->len <= ZT_MAX_REMOTE_TRACE_SIZE)&&(rt->data)&&(_controller))
 					_controller->handleRemoteTrace(*rt);
 			}
 
@@ -2056,90 +3809,144 @@ public:
 		}
 	}
 
-	inline void nodeStatePutFunction(enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+	// Tenants don't have a controller or updater, and one with a bad identity
+	// shouldn't take the others down with it
+	inline void tenantEventCallback(Tenant *t,enum ZT_Event event,const void *metaData)
+	{
+		switch(event) {
+			case ZT_EVENT_FATAL_ERROR_IDENTITY_COLLISION:
+				fprintf(stderr,"ERROR: identity/address collision for tenant in %s" ZT_EOL_S,t->homePath.c_str());
+				break;
+			case ZT_EVENT_TRACE:
+				if (metaData) {
+					::fprintf(stderr,"%s" ZT_EOL_S,(const char *)metaData);
+					::fflush(stderr);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	inline void nodeStatePutFunction(const std::string &homePath,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
 	{
 		char p[1024];
-		FILE *f;
 		bool secure = false;
 
 		switch(type) {
 			case ZT_STATE_OBJECT_IDENTITY_PUBLIC:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_IDENTITY_SECRET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",homePath.c_str());
 				secure = true;
 				break;
 			case ZT_STATE_OBJECT_PLANET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_MOON:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d/%.16llx.moon",_homePath.c_str(),(unsigned long long)id[0]);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d/%.16llx.moon",homePath.c_str(),(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_NETWORK_CONFIG:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d/%.16llx.conf",_homePath.c_str(),(unsigned long long)id[0]);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d/%.16llx.conf",homePath.c_str(),(unsigned long long)id[0]);
 				secure = true;
 				break;
+			case ZT_STATE_OBJECT_PEER:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d/%.10llx.peer",homePath.c_str(),(unsigned long long)id[0]);
+				break;
+			case ZT_STATE_OBJECT_IDENTITY:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identities.d/%.10llx.id",homePath.c_str(),(unsigned long long)id[0]);
+				break;
 			default:
 				return;
 		}
 
+		uint64_t d[2] = { 0,0 };
+		if (len >= 0)
+			StateWriterThread::digest(data,(unsigned int)len,d);
+		const std::string ps(p);
+		std::lock_guard<std::mutex> l(_stateWriter.m);
 		if (len >= 0) {
-			// Check to see if we've already written this first. This reduces
-			// redundant writes and I/O overhead on most platforms and has
-			// little effect on others.
-			f = fopen(p,"r");
-			if (f) {
-				char buf[65535];
-				long l = (long)fread(buf,1,sizeof(buf),f);
-				fclose(f);
-				if ((l == (long)len)&&(memcmp(data,buf,l) == 0))
-					return;
-			}
-
-			f = fopen(p,"w");
-			if (f) {
-				if (fwrite(data,len,1,f) != 1)
-					fprintf(stderr,"WARNING: unable to write to file: %s (I/O error)" ZT_EOL_S,p);
-				fclose(f);
-				if (secure)
-					OSUtils::lockDownFile(p,false);
-			} else {
-				fprintf(stderr,"WARNING: unable to write to file: %s (unable to open)" ZT_EOL_S,p);
-			}
+			std::map< std::string,std::pair<uint64_t,uint64_t> >::iterator cur(_stateWriter.current.find(ps));
+			if ((cur != _stateWriter.current.end())&&(cur->second.first == d[0])&&(cur->second.second == d[1]))
+				return;
+			_stateWriter.remember(ps,d);
+			StateWriterThread::Pending &w = _stateWriter.pending[ps];
+			w.data.assign((const char *)data,(unsigned long)len);
+			w.secure = secure;
+			w.remove = false;
 		} else {
-			OSUtils::rm(p);
+			_stateWriter.current.erase(ps);
+			StateWriterThread::Pending &w = _stateWriter.pending[ps];
+			w.data.clear();
+			w.secure = false;
+			w.remove = true;
 		}
+		_stateWriter.c.notify_one();
 	}
 
-	inline int nodeStateGetFunction(enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+	inline int nodeStateGetFunction(const std::string &homePath,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
 	{
 		char p[4096];
 		switch(type) {
 			case ZT_STATE_OBJECT_IDENTITY_PUBLIC:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_IDENTITY_SECRET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_NETWORK_CONFIG:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d/%.16llx.conf",_homePath.c_str(),(unsigned long long)id);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d/%.16llx.conf",homePath.c_str(),(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_PLANET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_MOON:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d/%.16llx.moon",_homePath.c_str(),(unsigned long long)id);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d/%.16llx.moon",homePath.c_str(),(unsigned long long)id[0]);
+				break;
+			case ZT_STATE_OBJECT_PEER:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d/%.10llx.peer",homePath.c_str(),(unsigned long long)id[0]);
+				break;
+			case ZT_STATE_OBJECT_IDENTITY:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identities.d/%.10llx.id",homePath.c_str(),(unsigned long long)id[0]);
 				break;
 			default:
 				return -1;
 		}
+
+		// Writes not yet on disk are returned from memory, and what is read is
+		// remembered so the node putting it right back doesn't rewrite it
+		std::lock_guard<std::mutex> l(_stateWriter.m);
+		const std::string ps(p);
+		const StateWriterThread::Pending *w = (const StateWriterThread::Pending *)0;
+		std::map< std::string,StateWriterThread::Pending >::const_iterator pw(_stateWriter.pending.find(ps));
+		if (pw != _stateWriter.pending.end()) {
+			w = &(pw->second);
+		} else {
+			pw = _stateWriter.writing.find(ps);
+			if (pw != _stateWriter.writing.end())
+				w = &(pw->second);
+		}
+		if (w) {
+			if (w->remove)
+				return -1;
+			const unsigned int n = std::min((unsigned int)w->data.length(),maxlen);
+			memcpy(data,w->data.data(),n);
+			return (int)n;
+		}
 		FILE *f = fopen(p,"r");
 		if (f) {
 			int n = (int)fread(data,1,maxlen,f);
 			fclose(f);
-			if (n >= 0)
+			if (n >= 0) {
+				// A read that fills the buffer may be truncated, so it says nothing about the file
+				if ((unsigned int)n < maxlen) {
+					uint64_t d[2];
+					StateWriterThread::digest(data,(unsigned int)n,d);
+					_stateWriter.remember(ps,d);
+				}
 				return n;
+			}
 		}
 		return -1;
 	}
@@ -2154,36 +3961,69 @@ public:
 				// IP address in ZT_TCP_FALLBACK_AFTER milliseconds. If we do start getting
 				// valid direct traffic we'll stop using it and close the socket after a while.
 				const uint64_t now = OSUtils::now();
-				if (((now - _lastDirectReceiveFromGlobal) > ZT_TCP_FALLBACK_AFTER)&&((now - _lastRestart) > ZT_TCP_FALLBACK_AFTER)) {
-					if (_tcpFallbackTunnel) {
-						Mutex::Lock _l(_tcpFallbackTunnel->writeq_m);
-						if (_tcpFallbackTunnel->writeq.length() == 0)
-							_phy.setNotifyWritable(_tcpFallbackTunnel->sock,true);
+				if (((now - _lastDirectReceiveFromGlobal.load(std::memory_order_relaxed)) > ZT_TCP_FALLBACK_AFTER)&&((now - _lastRestart) > ZT_TCP_FALLBACK_AFTER)) {
+					const struct sockaddr_in *const sin = reinterpret_cast<const struct sockaddr_in *>(addr);
+
+					// Keep each destination on one tunnel so its packets stay in order,
+					// using the next live one while its own is (re)connecting.
+					const unsigned long h = ((unsigned long)sin->sin_addr.s_addr * 2654435761UL) ^ ((unsigned long)sin->sin_port * 40503UL);
+					TcpConnection *tunnel = (TcpConnection *)0;
+					bool missing = false;
+					for(unsigned int i=0;i<_tcpFallbackTunnelCount;++i) {
+						TcpConnection *const t = _tcpFallbackTunnels[(h + i) % _tcpFallbackTunnelCount];
+						if (!t)
+							missing = true;
+						else if (!tunnel)
+							tunnel = t;
+					}
+
+					if (tunnel) {
 						const unsigned long mlen = len + 7;
-						_tcpFallbackTunnel->writeq.push_back((char)0x17);
-						_tcpFallbackTunnel->writeq.push_back((char)0x03);
-						_tcpFallbackTunnel->writeq.push_back((char)0x03); // fake TLS 1.2 header
-						_tcpFallbackTunnel->writeq.push_back((char)((mlen >> 8) & 0xff));
-						_tcpFallbackTunnel->writeq.push_back((char)(mlen & 0xff));
-						_tcpFallbackTunnel->writeq.push_back((char)4); // IPv4
-						_tcpFallbackTunnel->writeq.append(reinterpret_cast<const char *>(reinterpret_cast<const void *>(&(reinterpret_cast<const struct sockaddr_in *>(addr)->sin_addr.s_addr))),4);
-						_tcpFallbackTunnel->writeq.append(reinterpret_cast<const char *>(reinterpret_cast<const void *>(&(reinterpret_cast<const struct sockaddr_in *>(addr)->sin_port))),2);
-						_tcpFallbackTunnel->writeq.append((const char *)data,len);
-					} else if (((now - _lastSendToGlobalV4) < ZT_TCP_FALLBACK_AFTER)&&((now - _lastSendToGlobalV4) > (ZT_PING_CHECK_INVERVAL / 2))) {
-						const InetAddress addr(ZT_TCP_FALLBACK_RELAY);
-						TcpConnection *tc = new TcpConnection();
-						{
-							Mutex::Lock _l(_tcpConnections_m);
-							_tcpConnections.push_back(tc);
+						char hdr[12];
+						hdr[0] = (char)0x17;
+						hdr[1] = (char)0x03;
+						hdr[2] = (char)0x03; // fake TLS 1.2 header
+						hdr[3] = (char)((mlen >> 8) & 0xff);
+						hdr[4] = (char)(mlen & 0xff);
+						hdr[5] = (char)4; // IPv4
+						memcpy(hdr + 6,&(sin->sin_addr.s_addr),4);
+						memcpy(hdr + 10,&(sin->sin_port),2);
+
+						// If the tunnel is this far behind, drop the packet like a congested link
+						// would instead of queueing it behind seconds of other traffic.
+						Mutex::Lock _l(tunnel->writeq_m);
+						if (tunnel->writeq.available() >= (sizeof(hdr) + len)) {
+							if (tunnel->writeq.empty())
+								_phy.setNotifyWritable(tunnel->sock,true);
+							tunnel->writeq.write(hdr,sizeof(hdr));
+							tunnel->writeq.write(data,len);
+						}
+					}
+
+					if ((missing)&&((now - _lastSendToGlobalV4) < ZT_TCP_FALLBACK_AFTER)&&((now - _lastSendToGlobalV4) > (ZT_PING_CHECK_INVERVAL / 2))) {
+						for(unsigned int i=0;i<_tcpFallbackTunnelCount;++i) {
+							if (_tcpFallbackTunnels[i])
+								continue;
+							const InetAddress &relay = _tcpFallbackRelays[i % _tcpFallbackRelays.size()];
+							TcpConnection *tc = new TcpConnection();
+							{
+								Mutex::Lock _l(_tcpConnections_m);
+								_tcpConnections.push_back(tc);
+							}
+							tc->type = TcpConnection::TCP_TUNNEL_OUTGOING;
+							tc->writeq.setMaxSize(ZT_TCP_TUNNEL_MAX_WRITEQ_SIZE);
+							tc->remoteAddr = relay;
+							tc->lastReceive = OSUtils::now();
+							tc->parent = this;
+							tc->sock = (PhySocket *)0; // set in connect handler
+							tc->messageSize = 0;
+							tc->closeAfterWrite = false;
+							tc->id = _nextTcpConnectionId++;
+							tc->pendingResponses = 0;
+							tc->tunnelIndex = i;
+							bool connected = false;
+							_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&relay),connected,(void *)tc,true);
 						}
-						tc->type = TcpConnection::TCP_TUNNEL_OUTGOING;
-						tc->remoteAddr = addr;
-						tc->lastReceive = OSUtils::now();
-						tc->parent = this;
-						tc->sock = (PhySocket *)0; // set in connect handler
-						tc->messageSize = 0;
-						bool connected = false;
-						_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&addr),connected,(void *)tc,true);
 					}
 				}
 				_lastSendToGlobalV4 = now;
@@ -2194,39 +4034,118 @@ public:
 		// proxy fallback, which is slow.
 #endif // ZT_TCP_FALLBACK_RELAY
 
-		if ((localSocket != -1)&&(localSocket != 0)&&(_binder.isUdpSocketValid((PhySocket *)((uintptr_t)localSocket)))) {
+		if ((localSocket != -1)&&(localSocket != 0)&&(_isUdpSocketValid((PhySocket *)((uintptr_t)localSocket)))) {
+			const unsigned int ecn = (ttl & ZT_WIRE_PACKET_ECN_MASK) >> ZT_WIRE_PACKET_ECN_SHIFT;
+			ttl &= ~((unsigned int)ZT_WIRE_PACKET_ECN_MASK);
+#ifdef ZT_PHY_HAVE_SENDMMSG
+			if ((!ttl)&&(_threadUdpSendQueue))
+				return ((_phy.udpSendQueued(*_threadUdpSendQueue,(PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len,ecn)) ? 0 : -1);
+#endif
+			const bool df = ((ttl & ZT_WIRE_PACKET_DONT_FRAGMENT) != 0);
+			ttl &= 0xff;
 			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),ttl);
-			const bool r = _phy.udpSend((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len);
+			if (df) _phy.setIpDontFragment((PhySocket *)((uintptr_t)localSocket),true);
+			const bool r = _phy.udpSend((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len,ecn);
+			if (df) _phy.setIpDontFragment((PhySocket *)((uintptr_t)localSocket),false);
 			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),255);
 			return ((r) ? 0 : -1);
 		} else {
-			return ((_binder.udpSendAll(_phy,addr,data,len,ttl)) ? 0 : -1);
+			return ((_binder.udpSendAll(_phy,addr,data,len,ttl & 0xff)) ? 0 : -1);
 		}
 	}
 
+	inline int nodeWirePacketBatchSendFunction(const ZT_WirePacket *packets,unsigned int count)
+	{
+		int rc = 0;
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		// Threads that aren't already batching (e.g. the controller's) get one sendmmsg() per batch
+		if (!_threadUdpSendQueue) {
+			PhyUdpSendQueue &q = _threadSpareUdpSendQueue();
+			_threadUdpSendQueue = &q;
+			for(unsigned int i=0;i<count;++i) {
+				if (nodeWirePacketSendFunction(packets[i].localSocket,packets[i].remoteAddress,packets[i].packetData,packets[i].packetLength,packets[i].ttl))
+					rc = -1;
+			}
+			_threadUdpSendQueue = (PhyUdpSendQueue *)0;
+			q.flush();
+			return rc;
+		}
+#endif
+		for(unsigned int i=0;i<count;++i) {
+			if (nodeWirePacketSendFunction(packets[i].localSocket,packets[i].remoteAddress,packets[i].packetData,packets[i].packetLength,packets[i].ttl))
+				rc = -1;
+		}
+		return rc;
+	}
+
+	inline void nodeDeferredPacketsFunction(Tenant *t)
+	{
+		std::unique_lock<std::mutex> l(_deferredPackets.pending_m);
+		_deferredPackets.pending.push_back((void *)t);
+		_deferredPackets.pending_c.notify_one();
+	}
+
+	inline void processDeferredPackets(void *tenant)
+	{
+		Tenant *const t = reinterpret_cast<Tenant *>(tenant);
+		const ZT_ResultCode rc = (t) ? t->node->processDeferredPackets((void *)0,OSUtils::now(),1,&(t->nextBackgroundTaskDeadline)) : _node->processDeferredPackets((void *)0,OSUtils::now(),1,&_nextBackgroundTaskDeadline);
+		if (ZT_ResultCode_isFatal(rc)) {
+			char tmp[256];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processDeferredPackets: %d",(int)rc);
+			Mutex::Lock _l(_termReason_m);
+			_termReason = ONE_UNRECOVERABLE_ERROR;
+			_fatalErrorMessage = tmp;
+			this->terminate();
+		}
+	}
+
+	inline void nodeCryptoJobsFunction(Tenant *t)
+	{
+		std::unique_lock<std::mutex> l(_cryptoJobs.pending_m);
+		_cryptoJobs.pending.push_back((void *)t);
+		_cryptoJobs.pending_c.notify_one();
+	}
+
+	inline void processCryptoJobs(void *tenant)
+	{
+		Tenant *const t = reinterpret_cast<Tenant *>(tenant);
+		const ZT_ResultCode rc = (t) ? t->node->processCryptoJobs((void *)0,OSUtils::now(),1,&(t->nextBackgroundTaskDeadline)) : _node->processCryptoJobs((void *)0,OSUtils::now(),1,&_nextBackgroundTaskDeadline);
+		if (ZT_ResultCode_isFatal(rc)) {
+			char tmp[256];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processCryptoJobs: %d",(int)rc);
+			Mutex::Lock _l(_termReason_m);
+			_termReason = ONE_UNRECOVERABLE_ERROR;
+			_fatalErrorMessage = tmp;
+			this->terminate();
+		}
+	}
+
+	inline int stepBench()
+	{
+		return _node->bench().step((void *)0);
+	}
+
 	inline void nodeVirtualNetworkFrameFunction(uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
 		NetworkState *n = reinterpret_cast<NetworkState *>(*nuptr);
 		if ((!n)||(!n->tap))
 			return;
+#ifdef ZT_TAP_HAVE_GRO
+		if ((_threadTapGro)&&(_threadTapGro->put(n->tap,MAC(sourceMac),MAC(destMac),etherType,data,len)))
+			return;
+#endif
 		n->tap->put(MAC(sourceMac),MAC(destMac),etherType,data,len);
 	}
 
 	inline int nodePathCheckFunction(uint64_t ztaddr,const int64_t localSocket,const struct sockaddr_storage *remoteAddr)
 	{
-		// Make sure we're not trying to do ZeroTier-over-ZeroTier
-		{
-			Mutex::Lock _l(_nets_m);
-			for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
-				if (n->second.tap) {
-					std::vector<InetAddress> ips(n->second.tap->ips());
-					for(std::vector<InetAddress>::const_iterator i(ips.begin());i!=ips.end();++i) {
-						if (i->containsAddress(*(reinterpret_cast<const InetAddress *>(remoteAddr)))) {
-							return 0;
-						}
-					}
-				}
-			}
+		// Make sure we're not trying to do ZeroTier-over-ZeroTier, over any
+		// node's networks since tenants share the main node's sockets
+		if (_onTap(_nets,_nets_m,*(reinterpret_cast<const InetAddress *>(remoteAddr))))
+			return 0;
+		for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t) {
+			if (_onTap((*t)->nets,(*t)->nets_m,*(reinterpret_cast<const InetAddress *>(remoteAddr))))
+				return 0;
 		}
 
 		/* Note: I do not think we need to scan for overlap with managed routes
@@ -2263,6 +4182,21 @@ public:
 		return 1;
 	}
 
+	static bool _onTap(const std::map<uint64_t,NetworkState> &nets,Mutex &nets_m,const InetAddress &addr)
+	{
+		Mutex::Lock _l(nets_m);
+		for(std::map<uint64_t,NetworkState>::const_iterator n(nets.begin());n!=nets.end();++n) {
+			if (n->second.tap) {
+				std::vector<InetAddress> ips(n->second.tap->ips());
+				for(std::vector<InetAddress>::const_iterator i(ips.begin());i!=ips.end();++i) {
+					if (i->containsAddress(addr))
+						return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	inline int nodePathLookupFunction(uint64_t ztaddr,int family,struct sockaddr_storage *result)
 	{
 		const Hashtable< uint64_t,std::vector<InetAddress> > *lh = (const Hashtable< uint64_t,std::vector<InetAddress> > *)0;
@@ -2280,23 +4214,96 @@ public:
 		} else return 0;
 	}
 
-	inline void tapFrameHandler(uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+	inline void tapFrameHandler(Node *const node,volatile uint64_t *const nextBackgroundTaskDeadline,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
-		_node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		// Batch the packet and any fragments of it unless this thread is already batching
+		if (!_threadUdpSendQueue) {
+			PhyUdpSendQueue &q = _threadSpareUdpSendQueue();
+			_threadUdpSendQueue = &q;
+			node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,nextBackgroundTaskDeadline);
+			_threadUdpSendQueue = (PhyUdpSendQueue *)0;
+			q.flush();
+			return;
+		}
+#endif
+		node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,nextBackgroundTaskDeadline);
 	}
 
 	inline void onHttpRequestToServer(TcpConnection *tc)
+	{
+		// Note that we check allowed IP ranges when HTTP connections are first detected in
+		// phyOnTcpData(). If we made it here the source IP is okay.
+
+		if (tc->closeAfterWrite)
+			return; // pipelined after a request that ends the connection
+
+		ControlPlaneRequest *const r = new ControlPlaneRequest();
+		r->connectionId = tc->id;
+		r->remoteAddr = tc->remoteAddr;
+		r->method = tc->parser.method;
+		r->url.swap(tc->url);
+		r->headers.swap(tc->headers);
+		r->body.swap(tc->readq);
+		{
+			// Keep the connection open for more requests if the client asked to (the default
+			// for HTTP/1.1), unless it's not keeping up with reading pipelined responses.
+			Mutex::Lock _l(tc->writeq_m);
+			if ((!http_should_keep_alive(&(tc->parser)))||(tc->writeq.size() > ZT_TCP_MAX_WRITEQ_SIZE)||(tc->pendingResponses >= ZT_MAX_HTTP_PIPELINED))
+				tc->closeAfterWrite = true;
+			r->closeAfter = tc->closeAfterWrite;
+			++tc->pendingResponses;
+		}
+
+		// Long polls on the controller's change feed wait for a change, but only if authorized so
+		// anonymous clients can't tie up connections
+		r->waitUntil = 0;
+		if ((_controller)&&(r->method == HTTP_GET)&&((r->url.compare(0,19,"/controller/changes") == 0)||(r->url.compare(0,22,"/controller/db/changes") == 0))) {
+			std::vector<std::string> ps;
+			std::map<std::string,std::string> urlArgs;
+			_splitUrl(r->url,ps,urlArgs);
+			std::map<std::string,std::string>::const_iterator a(r->headers.find("x-zt1-auth"));
+			bool isAuth = ((a != r->headers.end())&&(_authToken == a->second));
+			if (!isAuth) {
+				a = urlArgs.find("auth");
+				isAuth = ((a != urlArgs.end())&&(_authToken == a->second));
+			}
+			a = urlArgs.find("wait");
+			if ((isAuth)&&(a != urlArgs.end())&&((ps.size() == 2)||((ps.size() == 3)&&(ps[1] == "db")))) {
+				const uint64_t wait = std::min((uint64_t)Utils::strToU64(a->second.c_str()),(uint64_t)ZT_CONTROL_PLANE_MAX_WAIT);
+				if (wait) {
+					r->waitUntil = OSUtils::now() + wait;
+					a = urlArgs.find("since");
+					r->waitSince = (a != urlArgs.end()) ? Utils::strToU64(a->second.c_str()) : 0;
+					a = urlArgs.find("epoch");
+					r->waitEpoch = (a != urlArgs.end()) ? Utils::hexStrToU64(a->second.c_str()) : 0;
+				}
+			}
+		}
+
+		std::unique_lock<std::mutex> l(_controlThread.requests_m);
+		_controlThread.requests.push_back(r);
+		_controlThread.requests_c.notify_one();
+	}
+
+	// Called by the control thread: true if a long poll has nothing new to report yet
+	inline bool controlPlaneRequestWaits(const ControlPlaneRequest &r,const uint64_t now)
+	{
+		if ((!r.waitUntil)||(now >= r.waitUntil)||(!_controller))
+			return false;
+		return ((r.waitEpoch == _controller->changeFeedEpoch())&&(r.waitSince >= _controller->changeFeedRevision()));
+	}
+
+	// Called by the control thread to handle a request and fill in its response
+	inline void handleControlPlaneRequest(ControlPlaneRequest &r)
 	{
 		char tmpn[4096];
 		std::string data;
 		std::string contentType("text/plain"); // default if not changed in handleRequest()
 		unsigned int scode = 404;
 
-		// Note that we check allowed IP ranges when HTTP connections are first detected in
-		// phyOnTcpData(). If we made it here the source IP is okay.
-
 		try {
-			scode = handleControlPlaneHttpRequest(tc->remoteAddr,tc->parser.method,tc->url,tc->headers,tc->readq,data,contentType);
+			scode = handleControlPlaneHttpRequest(r.remoteAddr,r.method,r.url,r.headers,r.body,data,contentType);
 		} catch (std::exception &exc) {
 			fprintf(stderr,"WARNING: unexpected exception processing control HTTP request: %s" ZT_EOL_S,exc.what());
 			scode = 500;
@@ -2318,19 +4325,48 @@ public:
 			default: scodestr = "Error"; break;
 		}
 
-		OSUtils::ztsnprintf(tmpn,sizeof(tmpn),"HTTP/1.1 %.3u %s\r\nCache-Control: no-cache\r\nPragma: no-cache\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+		OSUtils::ztsnprintf(tmpn,sizeof(tmpn),"HTTP/1.1 %.3u %s\r\nCache-Control: no-cache\r\nPragma: no-cache\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: %s\r\n\r\n",
 			scode,
 			scodestr,
 			contentType.c_str(),
-			(unsigned long)data.length());
+			(unsigned long)data.length(),
+			(r.closeAfter) ? "close" : "keep-alive");
+		r.response = tmpn;
+		if (r.method != HTTP_HEAD)
+			r.response.append(data);
+
 		{
-			Mutex::Lock _l(tc->writeq_m);
-			tc->writeq = tmpn;
-			if (tc->parser.method != HTTP_HEAD)
-				tc->writeq.append(data);
+			Mutex::Lock _l(_controlResponses_m);
+			_controlResponses.push_back(&r);
 		}
+		_phy.whack();
+	}
 
-		_phy.setNotifyWritable(tc->sock,true);
+	// Queue responses from the control thread on their connections, if they're still open
+	inline void _sendControlPlaneResponses()
+	{
+		std::vector<ControlPlaneRequest *> done;
+		{
+			Mutex::Lock _l(_controlResponses_m);
+			if (_controlResponses.empty())
+				return;
+			done.swap(_controlResponses);
+		}
+		Mutex::Lock _l(_tcpConnections_m);
+		for(std::vector<ControlPlaneRequest *>::iterator r(done.begin());r!=done.end();++r) {
+			for(std::vector<TcpConnection *>::const_iterator c(_tcpConnections.begin());c!=_tcpConnections.end();++c) {
+				if ((*c)->id == (*r)->connectionId) {
+					{
+						Mutex::Lock _l2((*c)->writeq_m);
+						(*c)->writeq.write((*r)->response.data(),(unsigned long)(*r)->response.length()); // handled in order, so pipelined responses stay in order
+						--(*c)->pendingResponses;
+					}
+					_phy.setNotifyWritable((*c)->sock,true);
+					break;
+				}
+			}
+			delete *r;
+		}
 	}
 
 	inline void onHttpResponseFromClient(TcpConnection *tc)
@@ -2363,22 +4399,31 @@ public:
 			}
 		}
 
-		{
-			Mutex::Lock _l(_nets_m);
-			for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
-				if (n->second.tap) {
-					std::vector<InetAddress> ips(n->second.tap->ips());
-					for(std::vector<InetAddress>::const_iterator i(ips.begin());i!=ips.end();++i) {
-						if (i->ipsEqual(ifaddr))
-							return false;
-					}
-				}
-			}
+		if (_hasTapIp(_nets,_nets_m,ifaddr))
+			return false;
+		for(std::vector<Tenant *>::const_iterator t(_tenants.begin());t!=_tenants.end();++t) {
+			if (_hasTapIp((*t)->nets,(*t)->nets_m,ifaddr))
+				return false;
 		}
 
 		return true;
 	}
 
+	static bool _hasTapIp(const std::map<uint64_t,NetworkState> &nets,Mutex &nets_m,const InetAddress &ip)
+	{
+		Mutex::Lock _l(nets_m);
+		for(std::map<uint64_t,NetworkState>::const_iterator n(nets.begin());n!=nets.end();++n) {
+			if (n->second.tap) {
+				std::vector<InetAddress> ips(n->second.tap->ips());
+				for(std::vector<InetAddress>::const_iterator i(ips.begin());i!=ips.end();++i) {
+					if (i->ipsEqual(ip))
+						return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	bool _trialBind(unsigned int port)
 	{
 		struct sockaddr_in in4;
@@ -2413,18 +4458,260 @@ public:
 
 		return false;
 	}
+
+	inline bool _isUdpSocketValid(PhySocket *const udpSock)
+	{
+		if (_binder.isUdpSocketValid(udpSock))
+			return true;
+#ifdef ZT_USE_IO_THREADS
+		for(std::vector<IoThread *>::const_iterator t(_ioThreads.begin());t!=_ioThreads.end();++t) {
+			if ((*t)->binder.isUdpSocketValid(udpSock))
+				return true;
+		}
+#endif
+		return false;
+	}
 };
 
+void ControlPlaneThread::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_CONTROL);
+	for(;;) {
+		ControlPlaneRequest *r = (ControlPlaneRequest *)0;
+		{
+			std::unique_lock<std::mutex> l(requests_m);
+			if (held.empty()) {
+				while ((run)&&(requests.empty()))
+					requests_c.wait(l);
+			} else if ((run)&&(requests.empty())) {
+				requests_c.wait_for(l,std::chrono::milliseconds(ZT_CONTROL_PLANE_WAIT_POLL));
+			}
+			if (!run)
+				break;
+			if (!requests.empty()) {
+				r = requests.front();
+				requests.pop_front();
+			}
+		}
+
+		const uint64_t now = OSUtils::now();
+
+		// Answer held requests that are ready, unless something before them on their connection is still held
+		std::set<uint64_t> blocked;
+		for(std::list<ControlPlaneRequest *>::iterator h(held.begin());h!=held.end();) {
+			if ((blocked.count((*h)->connectionId) == 0)&&(!parent->controlPlaneRequestWaits(**h,now))) {
+				parent->handleControlPlaneRequest(**h);
+				held.erase(h++);
+			} else {
+				blocked.insert((*h)->connectionId);
+				++h;
+			}
+		}
+
+		if (r) {
+			if ((blocked.count(r->connectionId))||(parent->controlPlaneRequestWaits(*r,now)))
+				held.push_back(r);
+			else parent->handleControlPlaneRequest(*r);
+		}
+	}
+}
+
+void DeferredPacketThreads::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_DEFERRED);
+	void *tenant;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> l(pending_m);
+			while ((run)&&(pending.empty()))
+				pending_c.wait(l);
+			if (!run)
+				break;
+			tenant = pending.front();
+			pending.pop_front();
+		}
+		parent->processDeferredPackets(tenant);
+	}
+}
+
+void CryptoJobThreads::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_CRYPTO);
+	void *tenant;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> l(pending_m);
+			while ((run)&&(pending.empty()))
+				pending_c.wait(l);
+			if (!run)
+				break;
+			tenant = pending.front();
+			pending.pop_front();
+		}
+		parent->processCryptoJobs(tenant);
+	}
+}
+
+void StartupJoinThreads::threadMain()
+	throw()
+{
+	while (run) {
+		const unsigned int i = next++;
+		if (i >= (unsigned int)joins.size())
+			break;
+		const uint64_t start = OSUtils::now();
+		try {
+			joins[i].node->join(joins[i].nwid,(void *)0,(void *)0);
+		} catch ( ... ) {}
+		const uint64_t now = OSUtils::now();
+		std::lock_guard<std::mutex> l(m);
+		joins[i].ms = std::max(now - start,(uint64_t)1);
+		if (++done == (unsigned int)joins.size())
+			finished = now;
+	}
+}
+
+void BenchThread::threadMain()
+	throw()
+{
+	for(;;) {
+		const int w = parent->stepBench();
+		if (w < 0)
+			break;
+		if (w > 0)
+			Thread::sleep((unsigned long)w);
+	}
+}
+
+void StateWriterThread::threadMain()
+	throw()
+{
+	std::vector<std::string> failed;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> l(m);
+			while ((run)&&(pending.empty()))
+				c.wait(l);
+			if (pending.empty())
+				break; // stopped, and everything has been written
+			writing.swap(pending);
+		}
+
+		// Only this thread changes writing, so it's read here without the lock
+		for(std::map< std::string,Pending >::const_iterator i(writing.begin());i!=writing.end();++i) {
+			if (i->second.remove) {
+				OSUtils::rm(i->first);
+				continue;
+			}
+			const std::string tmp(i->first + ".tmp");
+			FILE *f = fopen(tmp.c_str(),"wb");
+			if (!f) {
+				fprintf(stderr,"WARNING: unable to write to file: %s (unable to open)" ZT_EOL_S,tmp.c_str());
+				failed.push_back(i->first);
+				continue;
+			}
+			if (i->second.secure)
+				OSUtils::lockDownFile(tmp.c_str(),false);
+			bool ok = ((i->second.data.empty())||(fwrite(i->second.data.data(),i->second.data.length(),1,f) == 1));
+			if (fclose(f) != 0)
+				ok = false;
+			if (!ok) {
+				fprintf(stderr,"WARNING: unable to write to file: %s (I/O error)" ZT_EOL_S,tmp.c_str());
+				OSUtils::rm(tmp);
+				failed.push_back(i->first);
+				continue;
+			}
+#ifdef __WINDOWS__
+			if (MoveFileExA(tmp.c_str(),i->first.c_str(),MOVEFILE_REPLACE_EXISTING) == FALSE) {
+#else
+			if (::rename(tmp.c_str(),i->first.c_str()) != 0) {
+#endif
+				fprintf(stderr,"WARNING: unable to write to file: %s (rename failed)" ZT_EOL_S,i->first.c_str());
+				OSUtils::rm(tmp);
+				failed.push_back(i->first);
+			}
+		}
+
+		// Forget digests of failed writes so the next put of the same state tries again
+		std::lock_guard<std::mutex> l(m);
+		for(std::vector<std::string>::const_iterator f(failed.begin());f!=failed.end();++f)
+			current.erase(*f);
+		failed.clear();
+		writing.clear();
+	}
+}
+
+#ifdef ZT_USE_IO_THREADS
+void IoThread::threadMain()
+	throw()
+{
+	CpuAffinity::apply(CpuAffinity::THREAD_IO);
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	PhyUdpSendQueue *const sendq = new PhyUdpSendQueue();
+	_threadUdpSendQueue = sendq;
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+	if (parent->_tapGro)
+		_threadTapGro = new LinuxTapGro();
+#endif
+	while (run) {
+		if (refreshBindings.exchange(false)) {
+			unsigned int p[3];
+			unsigned int pc;
+			{
+				Mutex::Lock _l(ports_m);
+				memcpy(p,ports,sizeof(p));
+				pc = portCount;
+			}
+#ifdef ZT_PHY_HAVE_SENDMMSG
+			sendq->flush(); // refresh may close sockets
+#endif
+			binder.refresh(phy,p,pc,*parent);
+		}
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		sendq->flush();
+		phy.poll(0); // woken by whack() to refresh or exit
+		sendq->flush();
+#else
+		phy.poll(0);
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+		if (_threadTapGro)
+			_threadTapGro->flush();
+#endif
+	}
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	_threadUdpSendQueue = (PhyUdpSendQueue *)0;
+	delete sendq;
+#endif
+#ifdef ZT_TAP_HAVE_GRO
+	delete _threadTapGro;
+	_threadTapGro = (LinuxTapGro *)0;
+#endif
+	binder.closeAll(phy);
+}
+#endif
+
 static int SnodeVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeVirtualNetworkConfigFunction(nwid,nuptr,op,nwconf); }
 static void SnodeEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData)
 { reinterpret_cast<OneServiceImpl *>(uptr)->nodeEventCallback(event,metaData); }
 static void SnodeStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
-{ reinterpret_cast<OneServiceImpl *>(uptr)->nodeStatePutFunction(type,id,data,len); }
+{ OneServiceImpl *const impl = reinterpret_cast<OneServiceImpl *>(uptr); impl->nodeStatePutFunction(impl->_homePath,type,id,data,len); }
 static int SnodeStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
-{ return reinterpret_cast<OneServiceImpl *>(uptr)->nodeStateGetFunction(type,id,data,maxlen); }
+{ OneServiceImpl *const impl = reinterpret_cast<OneServiceImpl *>(uptr); return impl->nodeStateGetFunction(impl->_homePath,type,id,data,maxlen); }
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketSendFunction(localSocket,addr,data,len,ttl); }
+static int SnodeWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count)
+{ return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketBatchSendFunction(packets,count); }
+static void SnodeDeferredPacketsFunction(ZT_Node *node,void *uptr,void *tptr)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->nodeDeferredPacketsFunction((OneServiceImpl::Tenant *)0); }
+
+static void SnodeCryptoJobsFunction(ZT_Node *node,void *uptr,void *tptr)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->nodeCryptoJobsFunction((OneServiceImpl::Tenant *)0); }
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->nodeVirtualNetworkFrameFunction(nwid,nuptr,sourceMac,destMac,etherType,vlanId,data,len); }
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr)
@@ -2432,7 +4719,49 @@ static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t z
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodePathLookupFunction(ztaddr,family,result); }
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
-{ reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameHandler(nwid,from,to,etherType,vlanId,data,len); }
+{ OneServiceImpl *const impl = reinterpret_cast<OneServiceImpl *>(uptr); impl->tapFrameHandler(impl->_node,&(impl->_nextBackgroundTaskDeadline),nwid,from,to,etherType,vlanId,data,len); }
+
+static int StenantVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); return t->parent->tenantVirtualNetworkConfigFunction(t,nwid,nuptr,op,nwconf); }
+static void StenantEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); t->parent->tenantEventCallback(t,event,metaData); }
+static void StenantStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); t->parent->nodeStatePutFunction(t->homePath,type,id,data,len); }
+static int StenantStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); return t->parent->nodeStateGetFunction(t->homePath,type,id,data,maxlen); }
+static int StenantWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+{ return reinterpret_cast<OneServiceImpl::Tenant *>(uptr)->parent->nodeWirePacketSendFunction(localSocket,addr,data,len,ttl); }
+static int StenantWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count)
+{ return reinterpret_cast<OneServiceImpl::Tenant *>(uptr)->parent->nodeWirePacketBatchSendFunction(packets,count); }
+static void StenantDeferredPacketsFunction(ZT_Node *node,void *uptr,void *tptr)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); t->parent->nodeDeferredPacketsFunction(t); }
+static void StenantCryptoJobsFunction(ZT_Node *node,void *uptr,void *tptr)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); t->parent->nodeCryptoJobsFunction(t); }
+static void StenantVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+{ reinterpret_cast<OneServiceImpl::Tenant *>(uptr)->parent->nodeVirtualNetworkFrameFunction(nwid,nuptr,sourceMac,destMac,etherType,vlanId,data,len); }
+static int StenantPathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr)
+{ return reinterpret_cast<OneServiceImpl::Tenant *>(uptr)->parent->nodePathCheckFunction(ztaddr,localSocket,remoteAddr); }
+static int StenantPathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result)
+{ return reinterpret_cast<OneServiceImpl::Tenant *>(uptr)->parent->nodePathLookupFunction(ztaddr,family,result); }
+static void StenantTapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+{ OneServiceImpl::Tenant *const t = reinterpret_cast<OneServiceImpl::Tenant *>(uptr); t->parent->tapFrameHandler(t->node,&(t->nextBackgroundTaskDeadline),nwid,from,to,etherType,vlanId,data,len); }
+#ifdef ZT_HAVE_AF_XDP
+static void SxdpPacketHandler(void *uptr,const LinuxXdpPacket *packets,unsigned int count)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->xdpPacketHandler(packets,count); }
+#endif
+#ifdef ZT_HAVE_NETMAP
+static void SnetmapPacketHandler(void *uptr,const BSDNetmapPacket *packets,unsigned int count)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->netmapPacketHandler(packets,count); }
+#endif
+static void SclusterSendFunction(void *uptr,unsigned int toMemberId,const void *data,unsigned int len)
+{
+	OneServiceImpl *const impl = reinterpret_cast<OneServiceImpl *>(uptr);
+	const ClusterDefinition::MemberDefinition &md = (*(impl->_clusterDefinition))[toMemberId];
+	if (md.clusterEndpoint)
+		impl->_phy.udpSend(impl->_clusterMessageSocket,reinterpret_cast<const struct sockaddr *>(&(md.clusterEndpoint)),data,len);
+}
+static int SclusterGeoIpFunction(void *uptr,const struct sockaddr_storage *addr,int *x,int *y,int *z)
+{ return (int)(reinterpret_cast<OneServiceImpl *>(uptr)->_clusterDefinition->geo().locate(*(reinterpret_cast<const InetAddress *>(addr)),*x,*y,*z)); }
 
 static int ShttpOnMessageBegin(http_parser *parser)
 {
@@ -41,6 +41,10 @@ namespace ZeroTier { typedef SocketTap EthernetTap; }
 
 namespace ZeroTier {
 
+#ifdef ZT_USE_USERSPACE_STACK
+class UserspaceStack;
+#endif
+
 /**
  * Local service for ZeroTier One as system VPN/NFV provider
  */
@@ -98,6 +102,14 @@ public:
 		 * Allow overriding of system default routes for "full tunnel" operation?
 		 */
 		bool allowDefault;
+
+		/**
+		 * Use an L3 (TUN) device for routed-only networks where supported?
+		 *
+		 * This is read when the network's port is created, so changing it
+		 * takes effect the next time the network is brought up.
+		 */
+		bool l3;
 	};
 
 	/**
@@ -146,6 +158,18 @@ public:
 	 */
 	virtual std::string portDeviceName(uint64_t nwid) const = 0;
 
+#ifdef ZT_USE_USERSPACE_STACK
+	/**
+	 * Get the in-process IP stack serving as a network's port
+	 *
+	 * It remains valid until the network is left or the service terminates.
+	 *
+	 * @param nwid Network ID
+	 * @return Stack or NULL if not joined or the port isn't up yet
+	 */
+	virtual UserspaceStack *userspaceStack(uint64_t nwid) = 0;
+#endif
+
 #ifdef ZT_SDK
 	virtual void leave(const char *hp) = 0;
 	virtual void join(const char *hp) = 0;
@@ -93,15 +93,19 @@ SoftwareUpdater::SoftwareUpdater(Node &node,const std::string &homePath) :
 	_channel(ZT_SOFTWARE_UPDATE_DEFAULT_CHANNEL),
 	_distLog((FILE *)0),
 	_latestValid(false),
+	_downloadFile((FILE *)0),
 	_downloadLength(0)
 {
 	OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME).c_str());
+	_resumeDownload();
 }
 
 SoftwareUpdater::~SoftwareUpdater()
 {
 	if (_distLog)
 		fclose(_distLog);
+	if (_downloadFile)
+		fclose(_downloadFile);
 }
 
 void SoftwareUpdater::setUpdateDistribution(bool distribute)
@@ -229,21 +233,17 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 							const std::string hash = OSUtils::jsonBinFromHex(req[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]);
 							if ((len <= ZT_SOFTWARE_UPDATE_MAX_SIZE)&&(hash.length() >= 16)) {
 								if (_latestMeta != req) {
+									_resetDownload();
 									_latestMeta = req;
 									_latestValid = false;
 									OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME).c_str());
-									_download = std::string();
 									memcpy(_downloadHashPrefix.data,hash.data(),16);
 									_downloadLength = len;
+									OSUtils::writeFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_META_FILENAME).c_str(),OSUtils::jsonDump(req));
 								}
 
-								if ((_downloadLength > 0)&&(_download.length() < _downloadLength)) {
-									Buffer<128> gd;
-									gd.append((uint8_t)VERB_GET_DATA);
-									gd.append(_downloadHashPrefix.data,16);
-									gd.append((uint32_t)_download.length());
-									_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
-								}
+								if ((_downloadLength > 0)&&(_downloadHash.bytes() < _downloadLength))
+									_requestNextChunk();
 							}
 						}
 					}
@@ -259,6 +259,16 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 20);
 					std::map< Array<uint8_t,16>,_D >::iterator d(_dist.find(Array<uint8_t,16>(reinterpret_cast<const uint8_t *>(data) + 1)));
 					if ((d != _dist.end())&&(idx < (unsigned long)d->second.bin.length())) {
+						// Peers fetch one chunk at a time, so anything faster than this is a misbehaving or hostile peer
+						const uint64_t now = OSUtils::now();
+						_R &r = _distRequests[origin];
+						if ((now - r.windowStart) >= 1000) {
+							r.windowStart = now;
+							r.count = 0;
+						}
+						if (++r.count > ZT_SOFTWARE_UPDATE_MAX_CHUNK_REQUESTS_PER_SECOND)
+							break;
+
 						Buffer<ZT_SOFTWARE_UPDATE_CHUNK_SIZE + 128> buf;
 						buf.append((uint8_t)VERB_DATA);
 						buf.append(reinterpret_cast<const uint8_t *>(data) + 1,16);
@@ -275,14 +285,18 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 18) << 16;
 					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 19) << 8;
 					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 20);
-					if (idx == (unsigned long)_download.length()) {
-						_download.append(reinterpret_cast<const char *>(data) + 21,len - 21);
-						if (_download.length() < _downloadLength) {
-							Buffer<128> gd;
-							gd.append((uint8_t)VERB_GET_DATA);
-							gd.append(_downloadHashPrefix.data,16);
-							gd.append((uint32_t)_download.length());
-							_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+					if ((idx == (unsigned long)_downloadHash.bytes())&&(idx < _downloadLength)) {
+						const unsigned int n = (unsigned int)std::min((unsigned long)(len - 21),_downloadLength - idx);
+						if (!_downloadFile)
+							_downloadFile = fopen((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME).c_str(),"ab");
+						if ((_downloadFile)&&(fwrite(reinterpret_cast<const uint8_t *>(data) + 21,1,n,_downloadFile) == n)&&(fflush(_downloadFile) == 0)) {
+							_downloadHash.update(reinterpret_cast<const uint8_t *>(data) + 21,n);
+							if (_downloadHash.bytes() < _downloadLength)
+								_requestNextChunk();
+						} else {
+							// Can't write, e.g. disk full, so give up until the next check offers it again
+							_resetDownload();
+							_latestMeta = nlohmann::json();
 						}
 					}
 				}
@@ -331,30 +345,42 @@ bool SoftwareUpdater::check(const uint64_t now)
 		_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,tmp,len);
 	}
 
+	for(std::map< uint64_t,_R >::iterator r(_distRequests.begin());r!=_distRequests.end();) {
+		if ((now - r->second.windowStart) >= 1000)
+			_distRequests.erase(r++);
+		else ++r;
+	}
+
 	if (_latestValid)
 		return true;
 
 	if (_downloadLength > 0) {
-		if (_download.length() >= _downloadLength) {
+		if (_downloadHash.bytes() >= _downloadLength) {
 			// This is the very important security validation part that makes sure
 			// this software update doesn't have cooties.
 
+			if (_downloadFile) {
+				fclose(_downloadFile);
+				_downloadFile = (FILE *)0;
+			}
+
 			const std::string binPath(_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME);
 			try {
 				// (1) Check the hash itself to make sure the image is basically okay
 				uint8_t sha512[ZT_SHA512_DIGEST_LEN];
-				SHA512::hash(sha512,_download.data(),(unsigned int)_download.length());
+				_downloadHash.digest(sha512);
 				char hexbuf[(ZT_SHA512_DIGEST_LEN * 2) + 2];
 				if (OSUtils::jsonString(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH],"") == Utils::hex(sha512,ZT_SHA512_DIGEST_LEN,hexbuf)) {
 					// (2) Check signature by signing authority
 					const std::string sig(OSUtils::jsonBinFromHex(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIGNATURE]));
-					if (Identity(ZT_SOFTWARE_UPDATE_SIGNING_AUTHORITY).verify(_download.data(),(unsigned int)_download.length(),sig.data(),(unsigned int)sig.length())) {
-						// (3) Try to save file, and if so we are good.
+					if (Identity(ZT_SOFTWARE_UPDATE_SIGNING_AUTHORITY).verifyDigest(sha512,sig.data(),(unsigned int)sig.length())) {
+						// (3) Try to move the file into place, and if so we are good.
 						OSUtils::rm(binPath.c_str());
-						if (OSUtils::writeFile(binPath.c_str(),_download)) {
+						if (::rename((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME).c_str(),binPath.c_str()) == 0) {
+							OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_META_FILENAME).c_str());
 							OSUtils::lockDownFile(binPath.c_str(),false);
 							_latestValid = true;
-							_download = std::string();
+							_downloadHash.reset();
 							_downloadLength = 0;
 							return true;
 						}
@@ -364,22 +390,74 @@ bool SoftwareUpdater::check(const uint64_t now)
 
 			// If we get here, checks failed.
 			OSUtils::rm(binPath.c_str());
+			_resetDownload();
 			_latestMeta = nlohmann::json();
 			_latestValid = false;
-			_download = std::string();
-			_downloadLength = 0;
 		} else {
-			Buffer<128> gd;
-			gd.append((uint8_t)VERB_GET_DATA);
-			gd.append(_downloadHashPrefix.data,16);
-			gd.append((uint32_t)_download.length());
-			_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+			_requestNextChunk();
 		}
 	}
 
 	return false;
 }
 
+void SoftwareUpdater::_requestNextChunk()
+{
+	Buffer<128> gd;
+	gd.append((uint8_t)VERB_GET_DATA);
+	gd.append(_downloadHashPrefix.data,16);
+	gd.append((uint32_t)_downloadHash.bytes());
+	_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+}
+
+void SoftwareUpdater::_resetDownload()
+{
+	if (_downloadFile) {
+		fclose(_downloadFile);
+		_downloadFile = (FILE *)0;
+	}
+	OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME).c_str());
+	OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_META_FILENAME).c_str());
+	_downloadHash.reset();
+	_downloadLength = 0;
+}
+
+void SoftwareUpdater::_resumeDownload()
+{
+	// Pick up where a previous run left off by re-hashing what it wrote
+	std::string buf;
+	if (OSUtils::readFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_META_FILENAME).c_str(),buf)) {
+		try {
+			nlohmann::json meta(OSUtils::jsonParse(buf)); // throws on invalid JSON
+			if (meta.is_object()) {
+				const unsigned long len = (unsigned long)OSUtils::jsonInt(meta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE],0);
+				const std::string hash = OSUtils::jsonBinFromHex(meta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]);
+				if ((len > 0)&&(len <= ZT_SOFTWARE_UPDATE_MAX_SIZE)&&(hash.length() >= 16)) {
+					_downloadHash.reset();
+					FILE *f = fopen((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME).c_str(),"rb");
+					if (f) {
+						uint8_t tmp[65536];
+						for(;;) {
+							const size_t n = fread(tmp,1,sizeof(tmp),f);
+							if (!n)
+								break;
+							_downloadHash.update(tmp,(unsigned int)n);
+						}
+						fclose(f);
+					}
+					if (_downloadHash.bytes() <= len) {
+						_latestMeta = meta;
+						memcpy(_downloadHashPrefix.data,hash.data(),16);
+						_downloadLength = len;
+						return;
+					}
+				}
+			}
+		} catch ( ... ) {}
+	}
+	_resetDownload();
+}
+
 void SoftwareUpdater::apply()
 {
 	std::string updatePath(_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME);
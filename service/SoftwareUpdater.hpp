@@ -39,6 +39,7 @@
 #include "../node/Identity.hpp"
 #include "../node/Array.hpp"
 #include "../node/Packet.hpp"
+#include "../node/SHA512.hpp"
 
 #include "../ext/json/json.hpp"
 
@@ -84,6 +85,21 @@
  */
 #define ZT_SOFTWARE_UPDATE_BIN_FILENAME "latest-update.exe"
 
+/**
+ * Filename for an update being downloaded, renamed to ZT_SOFTWARE_UPDATE_BIN_FILENAME once verified
+ */
+#define ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME "latest-update.part"
+
+/**
+ * Filename for the meta-data of the update being downloaded, so a restart can resume it
+ */
+#define ZT_SOFTWARE_UPDATE_PARTIAL_META_FILENAME "latest-update.part.json"
+
+/**
+ * Maximum VERB_GET_DATA requests served per second to any one peer when distributing updates
+ */
+#define ZT_SOFTWARE_UPDATE_MAX_CHUNK_REQUESTS_PER_SECOND 32
+
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_MAJOR "vMajor"
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_MINOR "vMinor"
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_REVISION "vRev"
@@ -204,10 +220,24 @@ private:
 	};
 	std::map< Array<uint8_t,16>,_D > _dist; // key is first 16 bytes of hash
 
+	// Chunk requests served per peer in the current one second window
+	struct _R
+	{
+		_R() : windowStart(0),count(0) {}
+		uint64_t windowStart;
+		unsigned int count;
+	};
+	std::map< uint64_t,_R > _distRequests;
+
 	nlohmann::json _latestMeta;
 	bool _latestValid;
 
-	std::string _download;
+	// Downloads are streamed to ZT_SOFTWARE_UPDATE_PARTIAL_FILENAME and hashed as they arrive
+	void _requestNextChunk();
+	void _resetDownload();
+	void _resumeDownload();
+	FILE *_downloadFile;
+	SHA512::Stream _downloadHash;
 	Array<uint8_t,16> _downloadHashPrefix;
 	unsigned long _downloadLength;
 };